@@ -61,12 +61,15 @@ option(USE_TCP "option for using TCP transport" ON)
 option(USE_ASCEND "option for using npu" OFF)
 option(USE_MNNVL "option for using Multi-Node NVLink transport" OFF)
 option(USE_CXL "option for using CXL protocol" OFF)
+option(USE_MLX5_DC "option for using Mellanox DC transport in RDMA" OFF)
 option(USE_ETCD "option for enable etcd as metadata server" OFF)
 option(USE_ETCD_LEGACY "option for enable etcd based on etcd-cpp-api-v3" OFF)
 option(USE_REDIS "option for enable redis as metadata server" OFF)
 option(USE_HTTP "option for enable http as metadata server" ON)
 option(WITH_RUST_EXAMPLE "build the Rust interface and sample code for the transfer engine" OFF)
 option(WITH_METRICS "enable metrics and metrics reporting thread" ON)
+option(USE_RPC_RDMA "option for serving the master RPCs of mooncake store over RDMA" OFF)
+option(USE_USDT "option for USDT tracepoints that eBPF tools can attach to" ON)
 
 
 option(USE_LRU_MASTER "option for using LRU in master service" OFF)
@@ -100,10 +103,25 @@ if (USE_CUDA)
   )
 endif()
 
+if (USE_MLX5_DC)
+  add_compile_definitions(USE_MLX5_DC)
+endif()
+
 if (USE_TCP)
   add_compile_definitions(USE_TCP)
 endif()
 
+# coro_rpc runs over ibverbs with YLT_ENABLE_IBV, ibverbs is linked by the
+# transfer engine
+if (USE_RPC_RDMA)
+  add_compile_definitions(YLT_ENABLE_IBV)
+endif()
+
+if (USE_CXL)
+  add_compile_definitions(USE_CXL)
+  message(STATUS "CXL support is enabled")
+endif()
+
 if (USE_ASCEND)
   set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -DOPEN_BUILD_PROJECT ")
   set(CMAKE_C_FLAGS "${CMAKE_C_FLAGS} -DOPEN_BUILD_PROJECT ")
@@ -139,6 +157,18 @@ if (WITH_METRICS)
   message(STATUS "metrics is enabled")
 endif()
 
+# The tracepoints need the header of systemtap-sdt-dev, not its library
+if (USE_USDT)
+  include(CheckIncludeFileCXX)
+  check_include_file_cxx(sys/sdt.h HAVE_SYS_SDT_H)
+  if (HAVE_SYS_SDT_H)
+    add_compile_definitions(USE_USDT)
+    message(STATUS "USDT tracepoints are enabled")
+  else()
+    message(STATUS "sys/sdt.h not found, USDT tracepoints are disabled")
+  endif()
+endif()
+
 
 set(GFLAGS_USE_TARGET_NAMESPACE "true")
 find_package(yaml-cpp REQUIRED)
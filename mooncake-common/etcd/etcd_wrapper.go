@@ -11,7 +11,9 @@ import (
 	"context"
 	"strings"
 	"sync"
+	"sync/atomic"
 	"time"
+	"unsafe"
 
 	clientv3 "go.etcd.io/etcd/client/v3"
 )
@@ -103,6 +105,39 @@ func EtcdGetWrapper(key *C.char, value **C.char, errMsg **C.char) int {
 	return 0
 }
 
+// Gets the count keys in one transaction, setting each of the count values
+// to the value of its key, or to nil when the key does not exist
+//
+//export EtcdGetBatchWrapper
+func EtcdGetBatchWrapper(keys **C.char, count C.int, values **C.char, errMsg **C.char) int {
+	if globalClient == nil {
+		*errMsg = C.CString("etcd client not initialized")
+		return -1
+	}
+	keySlice := unsafe.Slice(keys, int(count))
+	valueSlice := unsafe.Slice(values, int(count))
+	ops := make([]clientv3.Op, len(keySlice))
+	for i, key := range keySlice {
+		ops[i] = clientv3.OpGet(C.GoString(key))
+	}
+	ctx, cancel := context.WithTimeout(context.Background(), 5*time.Second)
+	defer cancel()
+	resp, err := globalClient.Txn(ctx).Then(ops...).Commit()
+	if err != nil {
+		*errMsg = C.CString(err.Error())
+		return -1
+	}
+	for i, op := range resp.Responses {
+		kvs := op.GetResponseRange().Kvs
+		if len(kvs) == 0 {
+			valueSlice[i] = nil
+		} else {
+			valueSlice[i] = C.CString(string(kvs[0].Value))
+		}
+	}
+	return 0
+}
+
 //export EtcdDeleteWrapper
 func EtcdDeleteWrapper(key *C.char, errMsg **C.char) int {
 	if globalClient == nil {
@@ -120,6 +155,96 @@ func EtcdDeleteWrapper(key *C.char, errMsg **C.char) int {
 	return 0
 }
 
+// Changes under a prefix, queued until the transfer engine takes them
+type prefixWatch struct {
+	events   chan string
+	overflow int32
+	cancel   context.CancelFunc
+}
+
+var (
+	prefixWatches           = make(map[C.int]*prefixWatch)
+	nextPrefixWatchId C.int = 1
+	prefixWatchMutex  sync.Mutex
+)
+
+// Start watching a prefix with the given client, its changes are read with
+// EtcdNextWatchEventWrapper
+func startPrefixWatch(client *clientv3.Client, p string) C.int {
+	ctx, cancel := context.WithCancel(context.Background())
+	watch := &prefixWatch{events: make(chan string, 1024), cancel: cancel}
+	go func() {
+		for ctx.Err() == nil {
+			for resp := range client.Watch(ctx, p, clientv3.WithPrefix()) {
+				for _, event := range resp.Events {
+					select {
+					case watch.events <- string(event.Kv.Key):
+					default:
+						atomic.StoreInt32(&watch.overflow, 1)
+					}
+				}
+			}
+			if ctx.Err() == nil {
+				// Closed on errors such as compaction, changes may be missed
+				atomic.StoreInt32(&watch.overflow, 1)
+				time.Sleep(time.Second)
+			}
+		}
+	}()
+
+	prefixWatchMutex.Lock()
+	defer prefixWatchMutex.Unlock()
+	id := nextPrefixWatchId
+	prefixWatches[id] = watch
+	nextPrefixWatchId++
+	return id
+}
+
+//export EtcdWatchPrefixWrapper
+func EtcdWatchPrefixWrapper(prefix *C.char, watchId *C.int, errMsg **C.char) int {
+	if globalClient == nil {
+		*errMsg = C.CString("etcd client not initialized")
+		return -1
+	}
+	*watchId = startPrefixWatch(globalClient, C.GoString(prefix))
+	return 0
+}
+
+// Returns 0 with the next changed key, or an empty key when changes may
+// have been missed, and 1 when there is none within timeoutMs
+//
+//export EtcdNextWatchEventWrapper
+func EtcdNextWatchEventWrapper(watchId C.int, timeoutMs C.int, key **C.char, errMsg **C.char) int {
+	prefixWatchMutex.Lock()
+	watch, exists := prefixWatches[watchId]
+	prefixWatchMutex.Unlock()
+	if !exists {
+		*errMsg = C.CString("no watch found for the given id")
+		return -1
+	}
+	if atomic.SwapInt32(&watch.overflow, 0) == 1 {
+		*key = C.CString("")
+		return 0
+	}
+	select {
+	case k := <-watch.events:
+		*key = C.CString(k)
+		return 0
+	case <-time.After(time.Duration(timeoutMs) * time.Millisecond):
+		return 1
+	}
+}
+
+//export EtcdCancelWatchPrefixWrapper
+func EtcdCancelWatchPrefixWrapper(watchId C.int) {
+	prefixWatchMutex.Lock()
+	defer prefixWatchMutex.Unlock()
+	if watch, exists := prefixWatches[watchId]; exists {
+		watch.cancel()
+		delete(prefixWatches, watchId)
+	}
+}
+
 //export EtcdCloseWrapper
 func EtcdCloseWrapper() {
 	globalMutex.Lock()
@@ -331,6 +456,19 @@ func EtcdStoreCancelWatchWrapper(key *C.char, keySize C.int, errMsg **C.char) in
     return 0
 }
 
+// Changes under the prefix are read with EtcdNextWatchEventWrapper, the
+// watch is stopped with EtcdCancelWatchPrefixWrapper
+//
+//export EtcdStoreWatchPrefixWrapper
+func EtcdStoreWatchPrefixWrapper(prefix *C.char, prefixSize C.int, watchId *C.int, errMsg **C.char) int {
+    if storeClient == nil {
+        *errMsg = C.CString("etcd client not initialized")
+        return -1
+    }
+    *watchId = startPrefixWatch(storeClient, C.GoStringN(prefix, prefixSize))
+    return 0
+}
+
 /*
 * @brief First cancel the keep alive context, then delete it from the map.
 *        Cancel must be called before deleting in case this is a new context
@@ -14,7 +14,8 @@ ClientBufferAllocator::ClientBufferAllocator(size_t size) : buffer_size_(size) {
     }
 
     allocator_ = mooncake::offset_allocator::OffsetAllocator::create(
-        reinterpret_cast<uint64_t>(buffer_), size);
+        reinterpret_cast<uint64_t>(buffer_), size, 128 * 1024,
+        /*enableThreadCache=*/true);
 }
 
 ClientBufferAllocator::~ClientBufferAllocator() {
@@ -1,4 +1,5 @@
 #include "store_py.h"
+#include <Slab.h>
 
 #include <netinet/in.h>
 #include <pybind11/gil.h>  // For GIL management
@@ -6,10 +7,14 @@
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cstdlib>  // for atexit
+#include <numeric>
 #include <random>
 
 #include "client_buffer.hpp"
+#include "payload_codec.h"
+#include "segment_memory.h"
 #include "types.h"
 #include "utils.h"
 #include "config.h"
@@ -125,6 +130,10 @@ DistributedObjectStore::DistributedObjectStore() {
 DistributedObjectStore::~DistributedObjectStore() {
     // Unregister from the tracker before cleanup
     ResourceTracker::getInstance().unregisterInstance(this);
+#ifdef USE_CUDA
+    // Its work still queued uses the client
+    stream_waiter_.reset();
+#endif
 }
 
 int DistributedObjectStore::setup(const std::string &local_hostname,
@@ -178,19 +187,51 @@ int DistributedObjectStore::setup(const std::string &local_hostname,
     auto max_mr_size = globalConfig().max_mr_size; // Max segment size
     uint64_t total_glbseg_size = global_segment_size;  // For logging
     uint64_t current_glbseg_size = 0;                  // For logging
+    // With NICs on several NUMA nodes, split into at least one segment per
+    // node and place each on a node in turn
+    std::vector<int> numa_nodes;
+    if (protocol == "rdma") numa_nodes = SegmentNumaNodes(rdma_devices);
+    if (numa_nodes.size() > 1) {
+        const size_t alignment = facebook::cachelib::Slab::kSize;
+        size_t node_share = (global_segment_size + numa_nodes.size() - 1) /
+                            numa_nodes.size();
+        node_share = (node_share + alignment - 1) / alignment * alignment;
+        max_mr_size = std::min<uint64_t>(max_mr_size, node_share);
+    }
+    // Segments in files of this directory keep their objects across restarts
+    const char *persistent_dir = std::getenv("MC_STORE_PERSISTENT_SEGMENT_DIR");
+    std::string file_prefix = hostname;
+    std::replace_if(
+        file_prefix.begin(), file_prefix.end(),
+        [](char c) { return c == '/' || c == ':'; }, '_');
+    size_t segment_index = 0;
     while (global_segment_size > 0) {
         size_t segment_size = std::min(global_segment_size, max_mr_size);
         global_segment_size -= segment_size;
         current_glbseg_size += segment_size;
+        int numa_node = numa_nodes.empty()
+                            ? -1
+                            : numa_nodes[segment_index++ % numa_nodes.size()];
         LOG(INFO) << "Mounting segment: " << segment_size << " bytes, "
-                  << current_glbseg_size << " of " << total_glbseg_size;
-        void *ptr = allocate_buffer_allocator_memory(segment_size);
-        if (!ptr) {
+                  << current_glbseg_size << " of " << total_glbseg_size
+                  << ", NUMA node " << numa_node;
+        const size_t file_index = segment_ptrs_.size();
+        auto memory =
+            persistent_dir
+                ? SegmentMemory::AllocatePersistent(
+                      std::string(persistent_dir) + "/" + file_prefix + "-" +
+                          std::to_string(file_index),
+                      segment_size, numa_node)
+                : SegmentMemory::Allocate(segment_size, numa_node);
+        if (!memory) {
             LOG(ERROR) << "Failed to allocate segment memory";
             return 1;
         }
-        segment_ptrs_.emplace_back(ptr);
-        auto mount_result = client_->MountSegment(ptr, segment_size);
+        void *ptr = memory->data();
+        const UUID memory_id = memory->memory_id();
+        segment_ptrs_.emplace_back(std::move(memory));
+        auto mount_result = client_->MountSegment(ptr, segment_size,
+                                                  kWildcardLocation, memory_id);
         if (!mount_result.has_value()) {
             LOG(ERROR) << "Failed to mount segment: "
                        << toString(mount_result.error());
@@ -201,6 +242,48 @@ int DistributedObjectStore::setup(const std::string &local_hostname,
     return 0;
 }
 
+int DistributedObjectStore::attach_shared_segment(const std::string &path) {
+    if (!client_) {
+        LOG(ERROR) << "Client is not initialized";
+        return 1;
+    }
+    auto memory = SegmentMemory::AttachShared(path);
+    if (!memory) {
+        return 1;
+    }
+    auto attach_result = client_->AttachSegment(memory->data(), memory->size(),
+                                                memory->memory_id());
+    if (!attach_result.has_value()) {
+        LOG(ERROR) << "Failed to attach segment: "
+                   << toString(attach_result.error());
+        return 1;
+    }
+    segment_ptrs_.emplace_back(std::move(memory));
+    return 0;
+}
+
+int DistributedObjectStore::mount_device_segment(size_t size, int device) {
+    if (!client_) {
+        LOG(ERROR) << "Client is not initialized";
+        return 1;
+    }
+    auto memory = SegmentMemory::AllocateDevice(size, device);
+    if (!memory) {
+        LOG(ERROR) << "Failed to allocate segment memory on CUDA device "
+                   << device;
+        return 1;
+    }
+    auto mount_result =
+        client_->MountSegment(memory->data(), size, memory->location());
+    if (!mount_result.has_value()) {
+        LOG(ERROR) << "Failed to mount segment: "
+                   << toString(mount_result.error());
+        return 1;
+    }
+    segment_ptrs_.emplace_back(std::move(memory));
+    return 0;
+}
+
 int DistributedObjectStore::initAll(const std::string &protocol_,
                                     const std::string &device_name,
                                     size_t mount_segment_size) {
@@ -446,6 +529,22 @@ pybind11::bytes DistributedObjectStore::get(const std::string &key) {
             return kNullString;
         }
 
+        // Objects put with a codec arrive encoded
+        const auto *data = static_cast<const uint8_t *>(buffer_handle.ptr());
+        if (auto header = ParsePayloadHeader(data, total_size)) {
+            std::string decoded(header->original_size, '\0');
+            auto decode_result =
+                DecodePayload({data, total_size},
+                              {Slice{decoded.data(), decoded.size()}});
+            py::gil_scoped_acquire acquire_gil;
+            if (!decode_result) {
+                LOG(ERROR) << "Failed to decode key: " << key << " with error: "
+                           << toString(decode_result.error());
+                return kNullString;
+            }
+            return pybind11::bytes(decoded);
+        }
+
         py::gil_scoped_acquire acquire_gil;
 
         // Create Python bytes object - buffer_handle will be released
@@ -596,6 +695,32 @@ long DistributedObjectStore::removeAll() {
     return result.value();
 }
 
+long DistributedObjectStore::removeByTag(const std::string &tag) {
+    if (!client_) {
+        LOG(ERROR) << "Client is not initialized";
+        return -1;
+    }
+    auto result = client_->RemoveByTag(tag);
+    if (!result) {
+        LOG(ERROR) << "RemoveByTag failed: " << result.error();
+        return -1;
+    }
+    return result.value();
+}
+
+long DistributedObjectStore::removeByPrefix(const std::string &prefix) {
+    if (!client_) {
+        LOG(ERROR) << "Client is not initialized";
+        return -1;
+    }
+    auto result = client_->RemoveByPrefix(prefix);
+    if (!result) {
+        LOG(ERROR) << "RemoveByPrefix failed: " << result.error();
+        return -1;
+    }
+    return result.value();
+}
+
 int DistributedObjectStore::isExist(const std::string &key) {
     if (!client_) {
         LOG(ERROR) << "Client is not initialized";
@@ -646,6 +771,100 @@ std::vector<int> DistributedObjectStore::batchIsExist(
     return results;
 }
 
+std::vector<int> DistributedObjectStore::batchTouch(
+    const std::vector<std::string> &keys, uint64_t ttl_ms,
+    uint64_t next_use_ms) {
+    if (!client_) {
+        LOG(ERROR) << "Client is not initialized";
+        return std::vector<int>(keys.size(), -1);
+    }
+    auto touch_results = client_->BatchTouch(keys, ttl_ms, next_use_ms);
+    std::vector<int> results(keys.size(), toInt(ErrorCode::RPC_FAIL));
+    for (size_t i = 0; i < keys.size() && i < touch_results.size(); ++i) {
+        results[i] = touch_results[i] ? 0 : toInt(touch_results[i].error());
+    }
+    return results;
+}
+
+std::vector<int> DistributedObjectStore::prefetch(
+    const std::vector<std::string> &keys, const std::string &target_segment) {
+    if (!client_) {
+        LOG(ERROR) << "Client is not initialized";
+        return std::vector<int>(keys.size(), -1);
+    }
+    auto prefetch_results = client_->Prefetch(keys, target_segment);
+    std::vector<int> results(keys.size(), toInt(ErrorCode::RPC_FAIL));
+    for (size_t i = 0; i < keys.size() && i < prefetch_results.size(); ++i) {
+        results[i] =
+            prefetch_results[i] ? 0 : toInt(prefetch_results[i].error());
+    }
+    return results;
+}
+
+std::vector<int> DistributedObjectStore::cancelPrefetch(
+    const std::vector<std::string> &keys, const std::string &target_segment) {
+    if (!client_) {
+        LOG(ERROR) << "Client is not initialized";
+        return std::vector<int>(keys.size(), -1);
+    }
+    auto cancel_results = client_->CancelPrefetch(keys, target_segment);
+    std::vector<int> results(keys.size(), toInt(ErrorCode::RPC_FAIL));
+    for (size_t i = 0; i < keys.size() && i < cancel_results.size(); ++i) {
+        if (!cancel_results[i]) {
+            results[i] = toInt(cancel_results[i].error());
+        } else {
+            results[i] = cancel_results[i].value() ? 1 : 0;
+        }
+    }
+    return results;
+}
+
+int64_t DistributedObjectStore::longestPrefixMatch(
+    const std::vector<std::string> &keys, bool cache_replicas) {
+    if (!client_) {
+        LOG(ERROR) << "Client is not initialized";
+        return -1;
+    }
+    if (keys.empty()) {
+        return 0;
+    }
+    auto result = client_->LongestPrefixMatch(keys, cache_replicas);
+    if (!result) {
+        return toInt(result.error());
+    }
+    return static_cast<int64_t>(result->matched);
+}
+
+std::tuple<std::vector<std::string>, std::vector<std::vector<uint32_t>>,
+           std::vector<uint64_t>>
+DistributedObjectStore::batchQueryLocation(const std::vector<std::string> &keys,
+                                           bool with_prefix_hits) {
+    if (!client_) {
+        throw std::runtime_error("Client is not initialized");
+    }
+    auto result = client_->BatchQueryLocation(keys, with_prefix_hits);
+    if (!result) {
+        throw std::runtime_error("Failed to query key locations: " +
+                                 toString(result.error()));
+    }
+    return {std::move(result->segments), std::move(result->locations),
+            std::move(result->prefix_hits)};
+}
+
+std::pair<std::vector<std::string>, std::string>
+DistributedObjectStore::scanKeys(const std::string &prefix,
+                                 const std::string &cursor, uint64_t limit) {
+    if (!client_) {
+        throw std::runtime_error("Client is not initialized");
+    }
+    auto result = client_->ScanKeys(prefix, cursor, limit);
+    if (!result) {
+        throw std::runtime_error("Failed to scan keys: " +
+                                 toString(result.error()));
+    }
+    return {std::move(result->keys), std::move(result->next_cursor)};
+}
+
 int64_t DistributedObjectStore::getSize(const std::string &key) {
     if (!client_) {
         LOG(ERROR) << "Client is not initialized";
@@ -688,6 +907,199 @@ void *SliceBuffer::ptr() const { return handle_.ptr(); }
 
 uint64_t SliceBuffer::size() const { return handle_.size(); }
 
+StoreFuture::StoreFuture(TransferFuture future, int success_value)
+    : future_(std::move(future)), success_value_(success_value) {}
+
+StoreFuture::StoreFuture(int result) : success_value_(result) {}
+
+StoreFuture::StoreFuture()
+    : success_value_(0), deferred_(std::make_unique<Deferred>()) {}
+
+void StoreFuture::start(std::shared_ptr<StoreFuture> operation) {
+    std::vector<std::function<void(int)>> callbacks;
+    {
+        std::lock_guard<std::mutex> lock(deferred_->mutex);
+        deferred_->operation = operation;
+        callbacks.swap(deferred_->callbacks);
+    }
+    deferred_->cond.notify_all();
+    for (auto &callback : callbacks) {
+        operation->add_done_callback(std::move(callback));
+    }
+}
+
+bool StoreFuture::done() {
+    if (deferred_) {
+        std::lock_guard<std::mutex> lock(deferred_->mutex);
+        return deferred_->operation && deferred_->operation->done();
+    }
+    return !future_ || future_->isReady();
+}
+
+int StoreFuture::wait() {
+    if (deferred_) {
+        std::unique_lock<std::mutex> lock(deferred_->mutex);
+        deferred_->cond.wait(lock, [this] { return !!deferred_->operation; });
+        auto operation = deferred_->operation;
+        lock.unlock();
+        return operation->wait();
+    }
+    if (!future_) {
+        return success_value_;
+    }
+    return toResult(future_->wait(), success_value_);
+}
+
+void StoreFuture::add_done_callback(std::function<void(int)> callback) {
+    if (deferred_) {
+        std::shared_ptr<StoreFuture> operation;
+        {
+            std::lock_guard<std::mutex> lock(deferred_->mutex);
+            if (!deferred_->operation) {
+                deferred_->callbacks.push_back(std::move(callback));
+                return;
+            }
+            operation = deferred_->operation;
+        }
+        operation->add_done_callback(std::move(callback));
+        return;
+    }
+    if (!future_) {
+        callback(success_value_);
+        return;
+    }
+    // The handle may be released before the operation completes
+    future_->then([success_value = success_value_,
+                   callback = std::move(callback)](ErrorCode error_code) {
+        callback(toResult(error_code, success_value));
+    });
+}
+
+int StoreFuture::toResult(ErrorCode error_code, int success_value) {
+    return error_code == ErrorCode::OK ? success_value : -toInt(error_code);
+}
+
+#ifdef USE_CUDA
+StreamWaiter::StreamWaiter() : worker_(&StreamWaiter::worker, this) {}
+
+StreamWaiter::~StreamWaiter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cond_.notify_all();
+    worker_.join();
+}
+
+bool StreamWaiter::record(cudaStream_t stream, cudaEvent_t &event) {
+    cudaError_t err = cudaEventCreateWithFlags(
+        &event, cudaEventDisableTiming | cudaEventBlockingSync);
+    if (err == cudaSuccess) {
+        err = cudaEventRecord(event, stream);
+        if (err != cudaSuccess) cudaEventDestroy(event);
+    }
+    if (err != cudaSuccess) {
+        LOG(ERROR) << "Failed to record an event on the stream: "
+                   << cudaGetErrorString(err);
+        return false;
+    }
+    return true;
+}
+
+void StreamWaiter::enqueue(cudaEvent_t event, std::function<void()> work) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.emplace_back(event, std::move(work));
+    }
+    cond_.notify_one();
+}
+
+void StreamWaiter::worker() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cond_.wait(lock, [this] { return !running_ || !queue_.empty(); });
+        if (queue_.empty()) return;
+        auto entry = std::move(queue_.front());
+        queue_.pop_front();
+        lock.unlock();
+        cudaError_t err = cudaEventSynchronize(entry.first);
+        if (err != cudaSuccess) {
+            LOG(ERROR) << "Failed to wait for the stream: "
+                       << cudaGetErrorString(err);
+        }
+        cudaEventDestroy(entry.first);
+        entry.second();
+        lock.lock();
+    }
+}
+#endif
+
+// Split buffer into slices laid out like the replicas of an object. Returns
+// the object size, or a negative error code if the replica list is empty or
+// the buffer is too small.
+static int64_t make_read_slices(
+    const std::string &key,
+    const std::vector<Replica::Descriptor> &replica_list, void *buffer,
+    size_t size, std::vector<Slice> &slices) {
+    if (replica_list.empty()) {
+        LOG(ERROR) << "Empty replica list for key: " << key;
+        return -1;
+    }
+    const auto &replica = replica_list[0];
+    uint64_t total_size = 0;
+    if (replica.is_memory_replica() == false) {
+        total_size = replica.get_disk_descriptor().file_size;
+    } else {
+        for (auto &handle :
+             replica.get_memory_descriptor().buffer_descriptors) {
+            total_size += handle.size_;
+        }
+    }
+    if (size < total_size) {
+        LOG(ERROR) << "Buffer too small for key '" << key
+                   << "': required=" << total_size << ", available=" << size;
+        return -1;
+    }
+
+    uint64_t offset = 0;
+    if (replica.is_memory_replica() == false) {
+        while (offset < total_size) {
+            auto chunk_size = std::min(total_size - offset, kMaxSliceSize);
+            void *chunk_ptr = static_cast<char *>(buffer) + offset;
+            slices.emplace_back(Slice{chunk_ptr, chunk_size});
+            offset += chunk_size;
+        }
+    } else {
+        for (auto &handle :
+             replica.get_memory_descriptor().buffer_descriptors) {
+            void *chunk_ptr = static_cast<char *>(buffer) + offset;
+            slices.emplace_back(Slice{chunk_ptr, handle.size_});
+            offset += handle.size_;
+        }
+    }
+    return static_cast<int64_t>(total_size);
+}
+
+// Slices of the scattered buffers of one object, e.g. the pages of a KV
+// block, split so that no slice is larger than kMaxSliceSize
+static std::vector<Slice> make_iov_slices(const std::vector<void *> &buffers,
+                                          const std::vector<size_t> &sizes) {
+    std::vector<Slice> slices;
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        for (uint64_t offset = 0; offset < sizes[i];) {
+            auto chunk_size = std::min(sizes[i] - offset, kMaxSliceSize);
+            void *chunk_ptr = static_cast<char *>(buffers[i]) + offset;
+            slices.emplace_back(Slice{chunk_ptr, chunk_size});
+            offset += chunk_size;
+        }
+    }
+    return slices;
+}
+
+static std::shared_ptr<StoreFuture> make_failed_future(int result) {
+    return std::make_shared<StoreFuture>(result);
+}
+
 // Implementation of get_buffer method
 std::shared_ptr<SliceBuffer> DistributedObjectStore::get_buffer(
     const std::string &key) {
@@ -767,9 +1179,22 @@ int DistributedObjectStore::register_buffer(void *buffer, size_t size) {
                    << toString(register_result.error());
         return toInt(register_result.error());
     }
+    std::lock_guard<std::mutex> lock(registered_mutex_);
+    registered_buffers_[reinterpret_cast<uintptr_t>(buffer)] = size;
     return 0;
 }
 
+bool DistributedObjectStore::is_registered(const void *buffer, size_t size) {
+    const auto begin = reinterpret_cast<uintptr_t>(buffer);
+    std::lock_guard<std::mutex> lock(registered_mutex_);
+    auto it = registered_buffers_.upper_bound(begin);
+    if (it == registered_buffers_.begin()) {
+        return false;
+    }
+    --it;
+    return begin + size <= it->first + it->second;
+}
+
 int DistributedObjectStore::unregister_buffer(void *buffer) {
     if (!client_) {
         LOG(ERROR) << "Client is not initialized";
@@ -781,6 +1206,8 @@ int DistributedObjectStore::unregister_buffer(void *buffer) {
                    << toString(unregister_result.error());
         return toInt(unregister_result.error());
     }
+    std::lock_guard<std::mutex> lock(registered_mutex_);
+    registered_buffers_.erase(reinterpret_cast<uintptr_t>(buffer));
     return 0;
 }
 
@@ -860,7 +1287,12 @@ int DistributedObjectStore::get_into(const std::string &key, void *buffer,
         return -toInt(get_result.error());
     }
 
-    return static_cast<int>(total_size);
+    // Objects put with a codec arrive encoded, decode them in the buffer
+    auto decoded = DecodePayloadInPlace(buffer, total_size, size);
+    if (!decoded) {
+        return -toInt(decoded.error());
+    }
+    return static_cast<int>(decoded.value());
 }
 
 std::string DistributedObjectStore::get_hostname() const {
@@ -1081,70 +1513,750 @@ std::vector<int> DistributedObjectStore::batch_get_into(
             LOG(ERROR) << "BatchGet failed for key '" << op.key
                        << "': " << toString(error);
             results[op.original_index] = -toInt(error);
+            continue;
         }
+        auto decoded = DecodePayloadInPlace(buffers[op.original_index],
+                                            op.total_size,
+                                            sizes[op.original_index]);
+        results[op.original_index] =
+            decoded ? static_cast<int>(decoded.value())
+                    : -toInt(decoded.error());
     }
 
     return results;
 }
 
-int DistributedObjectStore::put_from(const std::string &key, void *buffer,
-                                     size_t size,
-                                     const ReplicateConfig &config) {
-    // NOTE: The buffer address must be previously registered with
-    // register_buffer() for zero-copy RDMA operations to work correctly
+int DistributedObjectStore::get_into_range(const std::string &key,
+                                           void *buffer, uint64_t offset,
+                                           size_t size) {
     if (!client_) {
         LOG(ERROR) << "Client is not initialized";
         return -1;
     }
 
-    if (size == 0) {
-        LOG(WARNING) << "Attempting to put empty data for key: " << key;
-        return 0;
+    auto result = client_->GetRange(key, offset, Slice{buffer, size});
+    if (!result) {
+        if (result.error() != ErrorCode::OBJECT_NOT_FOUND) {
+            LOG(ERROR) << "GetRange failed for key: " << key
+                       << " with error: " << toString(result.error());
+        }
+        return -toInt(result.error());
     }
+    return static_cast<int>(size);
+}
 
-    // Create slices directly from the user buffer
-    std::vector<mooncake::Slice> slices;
-    uint64_t offset = 0;
+int DistributedObjectStore::get_shard_into(const std::string &key,
+                                           size_t shard, void *buffer,
+                                           size_t size) {
+    if (!client_) {
+        LOG(ERROR) << "Client is not initialized";
+        return -1;
+    }
 
-    while (offset < size) {
-        auto chunk_size = std::min(size - offset, kMaxSliceSize);
-        void *chunk_ptr = static_cast<char *>(buffer) + offset;
-        slices.emplace_back(Slice{chunk_ptr, chunk_size});
-        offset += chunk_size;
+    auto result = client_->GetShard(key, shard, Slice{buffer, size});
+    if (!result) {
+        if (result.error() != ErrorCode::OBJECT_NOT_FOUND) {
+            LOG(ERROR) << "GetShard failed for key: " << key
+                       << " with error: " << toString(result.error());
+        }
+        return -toInt(result.error());
     }
+    return static_cast<int>(size);
+}
 
-    auto put_result = client_->Put(key, slices, config);
-    if (!put_result) {
-        LOG(ERROR) << "Put operation failed with error: "
-                   << toString(put_result.error());
-        return -toInt(put_result.error());
+std::vector<int> DistributedObjectStore::batch_get_into_range(
+    const std::vector<std::string> &keys, const std::vector<void *> &buffers,
+    const std::vector<uint64_t> &offsets, const std::vector<size_t> &sizes) {
+    if (!client_) {
+        LOG(ERROR) << "Client is not initialized";
+        return std::vector<int>(keys.size(), -1);
     }
 
-    return 0;
-}
+    if (keys.size() != buffers.size() || keys.size() != offsets.size() ||
+        keys.size() != sizes.size()) {
+        LOG(ERROR) << "Input vector sizes mismatch: keys=" << keys.size()
+                   << ", buffers=" << buffers.size()
+                   << ", offsets=" << offsets.size()
+                   << ", sizes=" << sizes.size();
+        return std::vector<int>(keys.size(), -1);
+    }
 
-template <typename T>
-py::array create_typed_array(char *exported_data, size_t total_length) {
-    py::capsule free_when_done(exported_data,
-                               [](void *p) { delete[] static_cast<T *>(p); });
+    std::vector<Slice> dests;
+    dests.reserve(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        dests.push_back(Slice{buffers[i], sizes[i]});
+    }
 
-    return py::array_t<T>({static_cast<ssize_t>(total_length / sizeof(T))},
-                          (T *)exported_data, free_when_done);
+    const auto range_results = client_->BatchGetRange(keys, offsets, dests);
+    std::vector<int> results(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (!range_results[i]) {
+            const auto error = range_results[i].error();
+            if (error != ErrorCode::OBJECT_NOT_FOUND) {
+                LOG(ERROR) << "BatchGetRange failed for key '" << keys[i]
+                           << "': " << toString(error);
+            }
+            results[i] = -toInt(error);
+        } else {
+            results[i] = static_cast<int>(sizes[i]);
+        }
+    }
+    return results;
 }
 
-pybind11::object DistributedObjectStore::get_tensor(const std::string &key,
-                                                    const std::string dtype) {
+int DistributedObjectStore::get_into_iov(const std::string &key,
+                                         const std::vector<void *> &buffers,
+                                         const std::vector<size_t> &sizes) {
     if (!client_) {
         LOG(ERROR) << "Client is not initialized";
-        return pybind11::none();
+        return -1;
+    }
+    if (buffers.size() != sizes.size()) {
+        LOG(ERROR) << "Mismatched sizes for buffers and sizes";
+        return -1;
     }
 
-    try {
-        // Query object info first
-        auto query_result = client_->Query(key);
-        if (!query_result) {
-            py::gil_scoped_acquire acquire_gil;
-            return pybind11::none();
+    auto slices = make_iov_slices(buffers, sizes);
+    auto result = client_->Get(key, slices);
+    if (!result) {
+        if (result.error() != ErrorCode::OBJECT_NOT_FOUND) {
+            LOG(ERROR) << "Get failed for key: " << key
+                       << " with error: " << toString(result.error());
+        }
+        return -toInt(result.error());
+    }
+    return static_cast<int>(
+        std::accumulate(sizes.begin(), sizes.end(), size_t{0}));
+}
+
+std::vector<int> DistributedObjectStore::batch_get_into_iov(
+    const std::vector<std::string> &keys,
+    const std::vector<std::vector<void *>> &buffers,
+    const std::vector<std::vector<size_t>> &sizes) {
+    if (!client_) {
+        LOG(ERROR) << "Client is not initialized";
+        return std::vector<int>(keys.size(), -1);
+    }
+    if (keys.size() != buffers.size() || keys.size() != sizes.size()) {
+        LOG(ERROR) << "Input vector sizes mismatch: keys=" << keys.size()
+                   << ", buffers=" << buffers.size()
+                   << ", sizes=" << sizes.size();
+        return std::vector<int>(keys.size(), -1);
+    }
+
+    std::vector<int> results(keys.size(), -1);
+    std::unordered_map<std::string, std::vector<Slice>> all_slices;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (buffers[i].size() != sizes[i].size()) {
+            LOG(ERROR) << "Mismatched sizes for buffers and sizes of key: "
+                       << keys[i];
+            return results;
+        }
+        all_slices[keys[i]] = make_iov_slices(buffers[i], sizes[i]);
+    }
+
+    const auto get_results = client_->BatchGet(keys, all_slices);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (!get_results[i]) {
+            const auto error = get_results[i].error();
+            if (error != ErrorCode::OBJECT_NOT_FOUND) {
+                LOG(ERROR) << "BatchGet failed for key '" << keys[i]
+                           << "': " << toString(error);
+            }
+            results[i] = -toInt(error);
+        } else {
+            results[i] = static_cast<int>(
+                std::accumulate(sizes[i].begin(), sizes[i].end(), size_t{0}));
+        }
+    }
+    return results;
+}
+
+std::shared_ptr<StoreFuture> DistributedObjectStore::get_into_async(
+    const std::string &key, void *buffer, size_t size) {
+    if (!client_) {
+        LOG(ERROR) << "Client is not initialized";
+        return make_failed_future(-1);
+    }
+
+    auto query_result = client_->Query(key);
+    if (!query_result) {
+        if (query_result.error() != ErrorCode::OBJECT_NOT_FOUND) {
+            LOG(ERROR) << "Query failed for key: " << key
+                       << " with error: " << toString(query_result.error());
+        }
+        return make_failed_future(-toInt(query_result.error()));
+    }
+
+    std::vector<Slice> slices;
+    const auto &replica_list = query_result.value();
+    int64_t total_size =
+        make_read_slices(key, replica_list, buffer, size, slices);
+    if (total_size < 0) {
+        return make_failed_future(static_cast<int>(total_size));
+    }
+    return std::make_shared<StoreFuture>(
+        client_->GetAsync(key, replica_list, slices),
+        static_cast<int>(total_size));
+}
+
+std::vector<std::shared_ptr<StoreFuture>>
+DistributedObjectStore::batch_get_into_async(
+    const std::vector<std::string> &keys, const std::vector<void *> &buffers,
+    const std::vector<size_t> &sizes) {
+    std::vector<std::shared_ptr<StoreFuture>> futures;
+    futures.reserve(keys.size());
+    if (!client_ || keys.size() != buffers.size() ||
+        keys.size() != sizes.size()) {
+        LOG(ERROR) << "Client is not initialized or input sizes mismatch";
+        for (size_t i = 0; i < keys.size(); ++i) {
+            futures.push_back(make_failed_future(-1));
+        }
+        return futures;
+    }
+
+    const auto query_results = client_->BatchQuery(keys);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (!query_results[i]) {
+            futures.push_back(
+                make_failed_future(-toInt(query_results[i].error())));
+            continue;
+        }
+        std::vector<Slice> slices;
+        const auto &replica_list = query_results[i].value();
+        int64_t total_size = make_read_slices(keys[i], replica_list,
+                                              buffers[i], sizes[i], slices);
+        if (total_size < 0) {
+            futures.push_back(make_failed_future(static_cast<int>(total_size)));
+            continue;
+        }
+        futures.push_back(std::make_shared<StoreFuture>(
+            client_->GetAsync(keys[i], replica_list, slices),
+            static_cast<int>(total_size)));
+    }
+    return futures;
+}
+
+LayerPutStream::LayerPutStream(std::shared_ptr<Client> client,
+                               std::shared_ptr<PutGroup> group,
+                               size_t keys_per_layer)
+    : client_(std::move(client)),
+      group_(std::move(group)),
+      keys_per_layer_(keys_per_layer) {}
+
+LayerPutStream::~LayerPutStream() {
+    if (!finished_) {
+        // Dropped from Python, do not hold the GIL while waiting
+        std::optional<pybind11::gil_scoped_release> release;
+        if (PyGILState_Check()) {
+            release.emplace();
+        }
+        finish();
+    }
+}
+
+size_t LayerPutStream::num_layers() const {
+    return group_->size() / keys_per_layer_;
+}
+
+int LayerPutStream::submit_layer(size_t layer) {
+    if (finished_ || layer >= num_layers()) {
+        LOG(ERROR) << "Invalid layer " << layer << " of " << num_layers()
+                   << (finished_ ? " in a finished stream" : "");
+        return -toInt(ErrorCode::INVALID_PARAMS);
+    }
+    return -toInt(client_->SubmitPutGroup(*group_, layer * keys_per_layer_,
+                                          keys_per_layer_));
+}
+
+std::vector<int> LayerPutStream::finish() {
+    if (finished_) {
+        return results_;
+    }
+    finished_ = true;
+    auto put_results = client_->EndPutGroup(*group_);
+    results_.reserve(put_results.size());
+    for (const auto &result : put_results) {
+        results_.push_back(result ? 0 : -toInt(result.error()));
+    }
+    return results_;
+}
+
+LayerGetStream::LayerGetStream(
+    std::shared_ptr<Client> client, std::vector<std::string> keys,
+    std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+        replicas,
+    std::vector<void *> buffers, std::vector<size_t> sizes,
+    size_t keys_per_layer, size_t prefetch_layers)
+    : client_(std::move(client)),
+      keys_(std::move(keys)),
+      replicas_(std::move(replicas)),
+      buffers_(std::move(buffers)),
+      sizes_(std::move(sizes)),
+      keys_per_layer_(keys_per_layer),
+      prefetch_layers_(prefetch_layers),
+      layers_(keys_.size() / keys_per_layer) {}
+
+LayerGetStream::~LayerGetStream() {
+    std::optional<pybind11::gil_scoped_release> release;
+    if (PyGILState_Check()) {
+        release.emplace();
+    }
+    for (auto &futures : layers_) {
+        for (auto &future : futures) {
+            future->wait();
+        }
+    }
+}
+
+size_t LayerGetStream::num_layers() const { return layers_.size(); }
+
+int LayerGetStream::submit_layer(size_t layer) {
+    if (layer >= num_layers()) {
+        LOG(ERROR) << "Invalid layer " << layer << " of " << num_layers();
+        return -toInt(ErrorCode::INVALID_PARAMS);
+    }
+    auto &futures = layers_[layer];
+    if (!futures.empty()) {
+        return 0;
+    }
+    futures.reserve(keys_per_layer_);
+    for (size_t i = layer * keys_per_layer_;
+         i < (layer + 1) * keys_per_layer_; ++i) {
+        if (i >= replicas_.size() || !replicas_[i]) {
+            futures.push_back(make_failed_future(
+                i < replicas_.size() ? -toInt(replicas_[i].error())
+                                     : -toInt(ErrorCode::RPC_FAIL)));
+            continue;
+        }
+        std::vector<Slice> slices;
+        int64_t total_size = make_read_slices(keys_[i], replicas_[i].value(),
+                                              buffers_[i], sizes_[i], slices);
+        if (total_size < 0) {
+            futures.push_back(make_failed_future(static_cast<int>(total_size)));
+            continue;
+        }
+        futures.push_back(std::make_shared<StoreFuture>(
+            client_->GetAsync(keys_[i], replicas_[i].value(), slices),
+            static_cast<int>(total_size)));
+    }
+    return 0;
+}
+
+std::vector<int> LayerGetStream::wait_layer(size_t layer) {
+    if (layer >= num_layers()) {
+        LOG(ERROR) << "Invalid layer " << layer << " of " << num_layers();
+        return std::vector<int>(keys_per_layer_,
+                                -toInt(ErrorCode::INVALID_PARAMS));
+    }
+    for (size_t next = layer;
+         next <= layer + prefetch_layers_ && next < num_layers(); ++next) {
+        submit_layer(next);
+    }
+    std::vector<int> results;
+    results.reserve(keys_per_layer_);
+    for (auto &future : layers_[layer]) {
+        results.push_back(future->wait());
+    }
+    return results;
+}
+
+std::shared_ptr<LayerPutStream> DistributedObjectStore::put_layers_from(
+    const std::vector<std::string> &keys, const std::vector<void *> &buffers,
+    const std::vector<size_t> &sizes, size_t keys_per_layer,
+    const ReplicateConfig &config) {
+    if (!client_ || keys.size() != buffers.size() ||
+        keys.size() != sizes.size() || keys_per_layer == 0 ||
+        keys.size() % keys_per_layer != 0) {
+        LOG(ERROR) << "Client is not initialized, input sizes mismatch or "
+                      "keys are not a multiple of keys_per_layer";
+        return nullptr;
+    }
+
+    std::vector<std::vector<mooncake::Slice>> batched_slices(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        uint64_t offset = 0;
+        while (offset < sizes[i]) {
+            auto chunk_size = std::min(sizes[i] - offset, kMaxSliceSize);
+            void *chunk_ptr = static_cast<char *>(buffers[i]) + offset;
+            batched_slices[i].emplace_back(Slice{chunk_ptr, chunk_size});
+            offset += chunk_size;
+        }
+    }
+    return std::make_shared<LayerPutStream>(
+        client_, client_->StartPutGroup(keys, batched_slices, config),
+        keys_per_layer);
+}
+
+std::shared_ptr<LayerGetStream> DistributedObjectStore::get_layers_into(
+    const std::vector<std::string> &keys, const std::vector<void *> &buffers,
+    const std::vector<size_t> &sizes, size_t keys_per_layer,
+    size_t prefetch_layers) {
+    if (!client_ || keys.size() != buffers.size() ||
+        keys.size() != sizes.size() || keys_per_layer == 0 ||
+        keys.size() % keys_per_layer != 0) {
+        LOG(ERROR) << "Client is not initialized, input sizes mismatch or "
+                      "keys are not a multiple of keys_per_layer";
+        return nullptr;
+    }
+    auto replicas = client_->BatchQuery(keys);
+    return std::make_shared<LayerGetStream>(client_, keys, std::move(replicas),
+                                            buffers, sizes, keys_per_layer,
+                                            prefetch_layers);
+}
+
+StoreView::StoreView(std::shared_ptr<Client> client, ObjectView view)
+    : client_(std::move(client)), view_(std::move(view)) {}
+
+StoreView::~StoreView() { release(); }
+
+pybind11::list StoreView::buffers() const {
+    pybind11::list result;
+    if (released_) {
+        return result;
+    }
+    for (const auto &buffer : view_.buffers) {
+        result.append(pybind11::memoryview::from_memory(
+            static_cast<const void *>(buffer.ptr),
+            static_cast<ssize_t>(buffer.size)));
+    }
+    return result;
+}
+
+size_t StoreView::size() const {
+    size_t total = 0;
+    for (const auto &buffer : view_.buffers) {
+        total += buffer.size;
+    }
+    return total;
+}
+
+void StoreView::release() {
+    if (!released_) {
+        released_ = true;
+        client_->ReleaseView(view_.handle);
+    }
+}
+
+std::shared_ptr<StoreView> DistributedObjectStore::get_view(
+    const std::string &key) {
+    if (!client_) {
+        LOG(ERROR) << "Client is not initialized";
+        return nullptr;
+    }
+    auto view = client_->GetView(key);
+    if (!view) {
+        if (view.error() != ErrorCode::OBJECT_NOT_FOUND &&
+            view.error() != ErrorCode::INVALID_REPLICA) {
+            LOG(ERROR) << "GetView failed for key: " << key
+                       << " with error: " << toString(view.error());
+        }
+        return nullptr;
+    }
+    return std::make_shared<StoreView>(client_, std::move(view.value()));
+}
+
+std::shared_ptr<StoreFuture> DistributedObjectStore::put_from_async(
+    const std::string &key, void *buffer, size_t size,
+    const ReplicateConfig &config) {
+    if (!client_) {
+        LOG(ERROR) << "Client is not initialized";
+        return make_failed_future(-1);
+    }
+
+    std::vector<mooncake::Slice> slices;
+    uint64_t offset = 0;
+    while (offset < size) {
+        auto chunk_size = std::min(size - offset, kMaxSliceSize);
+        void *chunk_ptr = static_cast<char *>(buffer) + offset;
+        slices.emplace_back(Slice{chunk_ptr, chunk_size});
+        offset += chunk_size;
+    }
+    return std::make_shared<StoreFuture>(
+        client_->PutAsync(key, slices, config), 0);
+}
+
+#ifdef USE_CUDA
+StreamWaiter *DistributedObjectStore::stream_waiter() {
+    std::lock_guard<std::mutex> lock(stream_waiter_mutex_);
+    if (!stream_waiter_) {
+        stream_waiter_ = std::make_unique<StreamWaiter>();
+    }
+    return stream_waiter_.get();
+}
+#endif
+
+std::shared_ptr<StoreFuture> DistributedObjectStore::put_from_on_stream(
+    const std::string &key, void *buffer, size_t size, uintptr_t stream,
+    const ReplicateConfig &config) {
+#ifdef USE_CUDA
+    if (!client_) {
+        LOG(ERROR) << "Client is not initialized";
+        return make_failed_future(-1);
+    }
+    cudaEvent_t event;
+    if (!stream_waiter()->record(reinterpret_cast<cudaStream_t>(stream),
+                                 event)) {
+        return make_failed_future(-1);
+    }
+    auto future = std::make_shared<StoreFuture>();
+    stream_waiter()->enqueue(event, [this, future, key, buffer, size,
+                                     config] {
+        future->start(put_from_async(key, buffer, size, config));
+    });
+    return future;
+#else
+    LOG(ERROR) << "Stream-ordered puts need a build with USE_CUDA";
+    return make_failed_future(-1);
+#endif
+}
+
+std::shared_ptr<StoreFuture> DistributedObjectStore::get_into_on_stream(
+    const std::string &key, void *buffer, size_t size, uintptr_t stream) {
+#ifdef USE_CUDA
+    if (!client_) {
+        LOG(ERROR) << "Client is not initialized";
+        return make_failed_future(-1);
+    }
+    auto cuda_stream = reinterpret_cast<cudaStream_t>(stream);
+    // The event goes first, the work before the hold may still use the
+    // buffer
+    cudaEvent_t event;
+    if (!stream_waiter()->record(cuda_stream, event)) {
+        return make_failed_future(-1);
+    }
+    auto hold_result = client_->HoldStream(cuda_stream);
+    if (!hold_result) {
+        cudaEventDestroy(event);
+        return make_failed_future(-toInt(hold_result.error()));
+    }
+    auto future = std::make_shared<StoreFuture>();
+    auto client = client_;
+    stream_waiter()->enqueue(
+        event, [this, future, key, buffer, size, client,
+                handle = hold_result.value()] {
+            auto operation = get_into_async(key, buffer, size);
+            operation->add_done_callback(
+                [client, handle](int) { client->ReleaseStream(handle); });
+            future->start(operation);
+        });
+    return future;
+#else
+    LOG(ERROR) << "Stream-ordered gets need a build with USE_CUDA";
+    return make_failed_future(-1);
+#endif
+}
+
+std::vector<std::shared_ptr<StoreFuture>>
+DistributedObjectStore::batch_put_from_async(
+    const std::vector<std::string> &keys, const std::vector<void *> &buffers,
+    const std::vector<size_t> &sizes, const ReplicateConfig &config) {
+    std::vector<std::shared_ptr<StoreFuture>> futures;
+    futures.reserve(keys.size());
+    if (!client_ || keys.size() != buffers.size() ||
+        keys.size() != sizes.size()) {
+        LOG(ERROR) << "Client is not initialized or input sizes mismatch";
+        for (size_t i = 0; i < keys.size(); ++i) {
+            futures.push_back(make_failed_future(-1));
+        }
+        return futures;
+    }
+
+    std::vector<std::vector<mooncake::Slice>> batched_slices(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        uint64_t offset = 0;
+        while (offset < sizes[i]) {
+            auto chunk_size = std::min(sizes[i] - offset, kMaxSliceSize);
+            void *chunk_ptr = static_cast<char *>(buffers[i]) + offset;
+            batched_slices[i].emplace_back(Slice{chunk_ptr, chunk_size});
+            offset += chunk_size;
+        }
+    }
+    for (auto &future :
+         client_->BatchPutAsync(keys, batched_slices, config)) {
+        futures.push_back(std::make_shared<StoreFuture>(std::move(future), 0));
+    }
+    return futures;
+}
+
+int DistributedObjectStore::put_from(const std::string &key, void *buffer,
+                                     size_t size,
+                                     const ReplicateConfig &config) {
+    // NOTE: The buffer address must be previously registered with
+    // register_buffer() for zero-copy RDMA operations to work correctly
+    if (!client_) {
+        LOG(ERROR) << "Client is not initialized";
+        return -1;
+    }
+
+    if (size == 0) {
+        LOG(WARNING) << "Attempting to put empty data for key: " << key;
+        return 0;
+    }
+
+    // Create slices directly from the user buffer
+    std::vector<mooncake::Slice> slices;
+    uint64_t offset = 0;
+
+    while (offset < size) {
+        auto chunk_size = std::min(size - offset, kMaxSliceSize);
+        void *chunk_ptr = static_cast<char *>(buffer) + offset;
+        slices.emplace_back(Slice{chunk_ptr, chunk_size});
+        offset += chunk_size;
+    }
+
+    auto put_result = client_->Put(key, slices, config);
+    if (!put_result) {
+        LOG(ERROR) << "Put operation failed with error: "
+                   << toString(put_result.error());
+        return -toInt(put_result.error());
+    }
+
+    return 0;
+}
+
+int DistributedObjectStore::put_from_iov(const std::string &key,
+                                         const std::vector<void *> &buffers,
+                                         const std::vector<size_t> &sizes,
+                                         const ReplicateConfig &config) {
+    if (!client_) {
+        LOG(ERROR) << "Client is not initialized";
+        return -1;
+    }
+    if (buffers.size() != sizes.size()) {
+        LOG(ERROR) << "Mismatched sizes for buffers and sizes";
+        return -1;
+    }
+
+    auto slices = make_iov_slices(buffers, sizes);
+    if (slices.empty()) {
+        LOG(WARNING) << "Attempting to put empty data for key: " << key;
+        return 0;
+    }
+    auto put_result = client_->Put(key, slices, config);
+    if (!put_result) {
+        LOG(ERROR) << "Put operation failed with error: "
+                   << toString(put_result.error());
+        return -toInt(put_result.error());
+    }
+    return 0;
+}
+
+std::vector<int> DistributedObjectStore::batch_put_from_iov(
+    const std::vector<std::string> &keys,
+    const std::vector<std::vector<void *>> &buffers,
+    const std::vector<std::vector<size_t>> &sizes,
+    const ReplicateConfig &config) {
+    if (!client_) {
+        LOG(ERROR) << "Client is not initialized";
+        return std::vector<int>(keys.size(), -1);
+    }
+    if (keys.size() != buffers.size() || keys.size() != sizes.size()) {
+        LOG(ERROR) << "Mismatched sizes for keys, buffers, and sizes";
+        return std::vector<int>(keys.size(), -1);
+    }
+
+    std::vector<std::vector<Slice>> batched_slices;
+    batched_slices.reserve(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (buffers[i].size() != sizes[i].size()) {
+            LOG(ERROR) << "Mismatched sizes for buffers and sizes of key: "
+                       << keys[i];
+            return std::vector<int>(keys.size(), -1);
+        }
+        batched_slices.push_back(make_iov_slices(buffers[i], sizes[i]));
+    }
+
+    auto put_results = client_->BatchPut(keys, batched_slices, config);
+    std::vector<int> results(keys.size());
+    for (size_t i = 0; i < put_results.size(); ++i) {
+        if (!put_results[i]) {
+            LOG(ERROR) << "BatchPut operation failed for key '" << keys[i]
+                       << "' with error: " << toString(put_results[i].error());
+            results[i] = -toInt(put_results[i].error());
+        } else {
+            results[i] = 0;
+        }
+    }
+    return results;
+}
+
+// Storage of a contiguous PyTorch tensor, with the GIL held
+static bool get_tensor_storage(const pybind11::object &tensor, void *&buffer,
+                               size_t &size) {
+    if (tensor.attr("__class__")
+            .attr("__name__")
+            .cast<std::string>()
+            .find("Tensor") == std::string::npos) {
+        LOG(ERROR) << "Input is not a PyTorch tensor";
+        return false;
+    }
+    if (!tensor.attr("is_contiguous")().cast<bool>()) {
+        LOG(ERROR) << "Tensor is not contiguous";
+        return false;
+    }
+    buffer =
+        reinterpret_cast<void *>(tensor.attr("data_ptr")().cast<uintptr_t>());
+    size = tensor.attr("numel")().cast<size_t>() *
+           tensor.attr("element_size")().cast<size_t>();
+    return true;
+}
+
+bool DistributedObjectStore::prepare_tensors(
+    const std::vector<pybind11::object> &tensors, std::vector<void *> &buffers,
+    std::vector<size_t> &sizes, std::vector<void *> &temporary) {
+    buffers.resize(tensors.size());
+    sizes.resize(tensors.size());
+    for (size_t i = 0; i < tensors.size(); ++i) {
+        if (!get_tensor_storage(tensors[i], buffers[i], sizes[i])) {
+            return false;
+        }
+    }
+
+    py::gil_scoped_release release;
+    for (size_t i = 0; i < tensors.size(); ++i) {
+        if (sizes[i] == 0 || is_registered(buffers[i], sizes[i])) {
+            continue;
+        }
+        if (register_buffer(buffers[i], sizes[i]) != 0) {
+            release_tensors(temporary);
+            temporary.clear();
+            return false;
+        }
+        temporary.push_back(buffers[i]);
+    }
+    return true;
+}
+
+void DistributedObjectStore::release_tensors(
+    const std::vector<void *> &temporary) {
+    for (void *buffer : temporary) {
+        unregister_buffer(buffer);
+    }
+}
+
+template <typename T>
+py::array create_typed_array(char *exported_data, size_t total_length) {
+    py::capsule free_when_done(exported_data,
+                               [](void *p) { delete[] static_cast<T *>(p); });
+
+    return py::array_t<T>({static_cast<ssize_t>(total_length / sizeof(T))},
+                          (T *)exported_data, free_when_done);
+}
+
+pybind11::object DistributedObjectStore::get_tensor(const std::string &key,
+                                                    const std::string dtype) {
+    if (!client_) {
+        LOG(ERROR) << "Client is not initialized";
+        return pybind11::none();
+    }
+
+    try {
+        // Query object info first
+        auto query_result = client_->Query(key);
+        if (!query_result) {
+            py::gil_scoped_acquire acquire_gil;
+            return pybind11::none();
         }
 
         auto replica_list = query_result.value();
@@ -1252,26 +2364,38 @@ int DistributedObjectStore::put_tensor(const std::string &key,
     }
 
     try {
-        // Import torch module
-        // Check if the object is a tensor
-        if (!(tensor.attr("__class__")
-                  .attr("__name__")
-                  .cast<std::string>()
-                  .find("Tensor") != std::string::npos)) {
-            LOG(ERROR) << "Input is not a PyTorch tensor";
+        std::vector<void *> buffers, temporary;
+        std::vector<size_t> sizes;
+        if (!prepare_tensors({tensor}, buffers, sizes, temporary)) {
+            return -1;
+        }
+        // Transfer straight from the tensor storage
+        py::gil_scoped_release release;
+        int result = put_from(key, buffers[0], sizes[0]);
+        release_tensors(temporary);
+        return result;
+    } catch (const pybind11::error_already_set &e) {
+        LOG(ERROR) << "Failed to access tensor data: " << e.what();
+        return -1;
+    }
+}
+
+int DistributedObjectStore::get_tensor_into(const std::string &key,
+                                            pybind11::object tensor) {
+    if (!client_) {
+        LOG(ERROR) << "Client is not initialized";
+        return -1;
+    }
+
+    try {
+        std::vector<void *> buffers, temporary;
+        std::vector<size_t> sizes;
+        if (!prepare_tensors({tensor}, buffers, sizes, temporary)) {
             return -1;
         }
-        // Get the data pointer and size directly from the tensor
-        uintptr_t data_ptr = tensor.attr("data_ptr")().cast<uintptr_t>();
-        size_t numel = tensor.attr("numel")().cast<size_t>();
-        size_t element_size = tensor.attr("element_size")().cast<size_t>();
-        size_t buffer_size = numel * element_size;
-
-        this->register_buffer(reinterpret_cast<void *>(data_ptr), buffer_size);
-        // Use put_from for direct memory access (zero-copy)
-        int result = this->put_from(key, reinterpret_cast<void *>(data_ptr),
-                                    buffer_size);
-        this->unregister_buffer(reinterpret_cast<void *>(data_ptr));
+        py::gil_scoped_release release;
+        int result = get_into(key, buffers[0], sizes[0]);
+        release_tensors(temporary);
         return result;
     } catch (const pybind11::error_already_set &e) {
         LOG(ERROR) << "Failed to access tensor data: " << e.what();
@@ -1279,13 +2403,95 @@ int DistributedObjectStore::put_tensor(const std::string &key,
     }
 }
 
+std::vector<int> DistributedObjectStore::batch_put_tensor(
+    const std::vector<std::string> &keys,
+    const std::vector<pybind11::object> &tensors,
+    const ReplicateConfig &config) {
+    if (!client_) {
+        LOG(ERROR) << "Client is not initialized";
+        return std::vector<int>(keys.size(), -1);
+    }
+    if (keys.size() != tensors.size()) {
+        LOG(ERROR) << "Mismatched sizes for keys and tensors";
+        return std::vector<int>(keys.size(), -1);
+    }
+
+    try {
+        std::vector<void *> buffers, temporary;
+        std::vector<size_t> sizes;
+        if (!prepare_tensors(tensors, buffers, sizes, temporary)) {
+            return std::vector<int>(keys.size(), -1);
+        }
+        py::gil_scoped_release release;
+        auto results = batch_put_from(keys, buffers, sizes, config);
+        release_tensors(temporary);
+        return results;
+    } catch (const pybind11::error_already_set &e) {
+        LOG(ERROR) << "Failed to access tensor data: " << e.what();
+        return std::vector<int>(keys.size(), -1);
+    }
+}
+
+std::vector<int> DistributedObjectStore::batch_get_tensor_into(
+    const std::vector<std::string> &keys,
+    const std::vector<pybind11::object> &tensors) {
+    if (!client_) {
+        LOG(ERROR) << "Client is not initialized";
+        return std::vector<int>(keys.size(), -1);
+    }
+    if (keys.size() != tensors.size()) {
+        LOG(ERROR) << "Mismatched sizes for keys and tensors";
+        return std::vector<int>(keys.size(), -1);
+    }
+
+    try {
+        std::vector<void *> buffers, temporary;
+        std::vector<size_t> sizes;
+        if (!prepare_tensors(tensors, buffers, sizes, temporary)) {
+            return std::vector<int>(keys.size(), -1);
+        }
+        py::gil_scoped_release release;
+        auto results = batch_get_into(keys, buffers, sizes);
+        release_tensors(temporary);
+        return results;
+    } catch (const pybind11::error_already_set &e) {
+        LOG(ERROR) << "Failed to access tensor data: " << e.what();
+        return std::vector<int>(keys.size(), -1);
+    }
+}
+
 PYBIND11_MODULE(store, m) {
+    py::enum_<PayloadCodecId>(m, "PayloadCodec")
+        .value("NONE", PayloadCodecId::NONE)
+        .value("BYTE_PLANE", PayloadCodecId::BYTE_PLANE)
+        .value("FP8_FROM_FP16", PayloadCodecId::FP8_FROM_FP16)
+        .value("FP8_FROM_BF16", PayloadCodecId::FP8_FROM_BF16);
+
     // Define the ReplicateConfig class
     py::class_<ReplicateConfig>(m, "ReplicateConfig")
         .def(py::init<>())
         .def_readwrite("replica_num", &ReplicateConfig::replica_num)
         .def_readwrite("with_soft_pin", &ReplicateConfig::with_soft_pin)
         .def_readwrite("preferred_segment", &ReplicateConfig::preferred_segment)
+        .def_readwrite("tag", &ReplicateConfig::tag)
+        .def_readwrite("codec", &ReplicateConfig::codec)
+        .def_readwrite("content_hash", &ReplicateConfig::content_hash)
+        .def_readwrite("ec_data_fragments",
+                       &ReplicateConfig::ec_data_fragments)
+        .def_readwrite("ec_parity_fragments",
+                       &ReplicateConfig::ec_parity_fragments)
+        .def_readwrite("chain_replication",
+                       &ReplicateConfig::chain_replication)
+        .def_readwrite("prefer_device_memory",
+                       &ReplicateConfig::prefer_device_memory)
+        .def_readwrite("contiguous_batch",
+                       &ReplicateConfig::contiguous_batch)
+        .def_readwrite("skip_resident", &ReplicateConfig::skip_resident)
+        .def_readwrite("refresh_resident_lease",
+                       &ReplicateConfig::refresh_resident_lease)
+        .def_readwrite("shard_segments", &ReplicateConfig::shard_segments)
+        .def_readwrite("next_use_ms", &ReplicateConfig::next_use_ms)
+        .def_readwrite("upsert", &ReplicateConfig::upsert)
         .def("__str__", [](const ReplicateConfig &config) {
             std::ostringstream oss;
             oss << config;
@@ -1331,10 +2537,107 @@ PYBIND11_MODULE(store, m) {
         });
 
     // Define the DistributedObjectStore class
+    // Python objects referenced from client threads must be released with
+    // the GIL held
+    auto keep_alive = [](py::object obj) {
+        return std::shared_ptr<py::object>(
+            new py::object(std::move(obj)), [](py::object *ptr) {
+                py::gil_scoped_acquire acquire_gil;
+                delete ptr;
+            });
+    };
+
+    py::class_<StoreFuture, std::shared_ptr<StoreFuture>>(m, "StoreFuture")
+        .def("done", &StoreFuture::done)
+        .def("wait", &StoreFuture::wait,
+             py::call_guard<py::gil_scoped_release>(),
+             "Block until the operation completes and return its result")
+        .def(
+            "add_done_callback",
+            [keep_alive](StoreFuture &self, py::function callback) {
+                auto py_callback = keep_alive(std::move(callback));
+                self.add_done_callback([py_callback](int result) {
+                    py::gil_scoped_acquire acquire_gil;
+                    try {
+                        (*py_callback)(result);
+                    } catch (py::error_already_set &e) {
+                        e.discard_as_unraisable("StoreFuture callback");
+                    }
+                });
+            },
+            py::arg("callback"),
+            "Call callback(result) from a client thread once the operation "
+            "completes")
+        .def("__await__", [keep_alive](StoreFuture &self) {
+            // Resolve an asyncio future on the running loop
+            py::object loop =
+                py::module_::import("asyncio").attr("get_running_loop")();
+            py::object py_future = loop.attr("create_future")();
+            auto py_loop = keep_alive(loop);
+            auto py_result = keep_alive(py_future);
+            self.add_done_callback([py_loop, py_result](int result) {
+                py::gil_scoped_acquire acquire_gil;
+                auto set_result = py::cpp_function([](py::object future,
+                                                      int value) {
+                    if (!future.attr("done")().cast<bool>()) {
+                        future.attr("set_result")(value);
+                    }
+                });
+                try {
+                    py_loop->attr("call_soon_threadsafe")(set_result,
+                                                          *py_result, result);
+                } catch (py::error_already_set &e) {
+                    // The event loop is already closed
+                    e.discard_as_unraisable("StoreFuture.__await__");
+                }
+            });
+            return py_future.attr("__await__")();
+        });
+
+    py::class_<LayerPutStream, std::shared_ptr<LayerPutStream>>(
+        m, "LayerPutStream")
+        .def_property_readonly("num_layers", &LayerPutStream::num_layers)
+        .def("submit_layer", &LayerPutStream::submit_layer,
+             py::call_guard<py::gil_scoped_release>(), py::arg("layer"),
+             "Start writing a layer once its data is in the buffers")
+        .def("finish", &LayerPutStream::finish,
+             py::call_guard<py::gil_scoped_release>(),
+             "Write the remaining layers, wait and finalize the puts; returns "
+             "one result per key");
+
+    py::class_<LayerGetStream, std::shared_ptr<LayerGetStream>>(
+        m, "LayerGetStream")
+        .def_property_readonly("num_layers", &LayerGetStream::num_layers)
+        .def("submit_layer", &LayerGetStream::submit_layer,
+             py::call_guard<py::gil_scoped_release>(), py::arg("layer"))
+        .def("wait_layer", &LayerGetStream::wait_layer,
+             py::call_guard<py::gil_scoped_release>(), py::arg("layer"),
+             "Wait for a layer to be read, prefetching the next ones; returns "
+             "the bytes read per key of the layer");
+
+    py::class_<StoreView, std::shared_ptr<StoreView>>(m, "StoreView")
+        .def_property_readonly("size", &StoreView::size)
+        .def("buffers", &StoreView::buffers,
+             "Read-only memoryviews of the buffers of the object, valid "
+             "until release")
+        .def("release", &StoreView::release)
+        .def("__enter__", [](std::shared_ptr<StoreView> self) { return self; })
+        .def("__exit__",
+             [](StoreView &self, const py::object &, const py::object &,
+                const py::object &) { self.release(); });
+
     py::class_<DistributedObjectStore>(m, "MooncakeDistributedStore")
         .def(py::init<>())
         .def("setup", &DistributedObjectStore::setup)
         .def("init_all", &DistributedObjectStore::initAll)
+        .def("mount_device_segment",
+             &DistributedObjectStore::mount_device_segment, py::arg("size"),
+             py::arg("device"),
+             "Mount a segment in the memory of a CUDA device")
+        .def("attach_shared_segment",
+             &DistributedObjectStore::attach_shared_segment, py::arg("path"),
+             "Attach to a segment another store mounted in shared memory, "
+             "e.g. a CXL memory pool")
         .def("get", &DistributedObjectStore::get)
         .def("get_batch", &DistributedObjectStore::get_batch)
         .def("get_buffer", &DistributedObjectStore::get_buffer,
@@ -1344,12 +2647,62 @@ PYBIND11_MODULE(store, m) {
              py::call_guard<py::gil_scoped_release>())
         .def("remove_all", &DistributedObjectStore::removeAll,
              py::call_guard<py::gil_scoped_release>())
+        .def("remove_by_tag", &DistributedObjectStore::removeByTag,
+             py::call_guard<py::gil_scoped_release>(), py::arg("tag"),
+             "Remove in the background the objects put with "
+             "ReplicateConfig.tag equal to tag. Returns the number of objects "
+             "queued for removal, or -1 on error")
+        .def("remove_by_prefix", &DistributedObjectStore::removeByPrefix,
+             py::call_guard<py::gil_scoped_release>(), py::arg("prefix"),
+             "Remove the objects whose key starts with prefix, except the "
+             "leased ones. Returns the number of objects removed, or -1 on "
+             "error")
         .def("is_exist", &DistributedObjectStore::isExist,
              py::call_guard<py::gil_scoped_release>())
         .def("batch_is_exist", &DistributedObjectStore::batchIsExist,
              py::call_guard<py::gil_scoped_release>(), py::arg("keys"),
              "Check if multiple objects exist. Returns list of results: 1 if "
              "exists, 0 if not exists, -1 if error")
+        .def("batch_touch", &DistributedObjectStore::batchTouch,
+             py::call_guard<py::gil_scoped_release>(), py::arg("keys"),
+             py::arg("ttl_ms") = 0, py::arg("next_use_ms") = 0,
+             "Extend the leases of objects without reading them, to keep them "
+             "from being evicted. ttl_ms of 0 uses the master's default "
+             "lease. next_use_ms hints when the objects are read again, 0 "
+             "for no hint. Returns list of results: 0 if touched, otherwise "
+             "a negative error code")
+        .def("prefetch", &DistributedObjectStore::prefetch,
+             py::call_guard<py::gil_scoped_release>(), py::arg("keys"),
+             py::arg("target_segment") = "",
+             "Copy objects to target_segment, this client's segment if "
+             "empty, in the background so that reading them is local. "
+             "Returns list of results: 0 if queued or already there, "
+             "otherwise a negative error code")
+        .def("cancel_prefetch", &DistributedObjectStore::cancelPrefetch,
+             py::call_guard<py::gil_scoped_release>(), py::arg("keys"),
+             py::arg("target_segment") = "",
+             "Drop the prefetches of keys that are not being copied yet. "
+             "Returns list of results: 1 if dropped, 0 if not, or a negative "
+             "error code")
+        .def("longest_prefix_match",
+             &DistributedObjectStore::longestPrefixMatch,
+             py::call_guard<py::gil_scoped_release>(), py::arg("keys"),
+             py::arg("cache_replicas") = false,
+             "Count the leading keys that exist in a single request. Returns "
+             "the number of matched keys, or a negative error code")
+        .def("batch_query_location",
+             &DistributedObjectStore::batchQueryLocation,
+             py::call_guard<py::gil_scoped_release>(), py::arg("keys"),
+             py::arg("with_prefix_hits") = false,
+             "Tell which segments hold each key in a single request. Returns "
+             "the segment names, the indices of the segments holding each "
+             "key, and the number of leading keys each segment holds if "
+             "with_prefix_hits is set")
+        .def("scan_keys", &DistributedObjectStore::scanKeys,
+             py::call_guard<py::gil_scoped_release>(), py::arg("prefix") = "",
+             py::arg("cursor") = "", py::arg("limit") = 1000,
+             "Fetch a page of the keys starting with prefix. Returns the keys "
+             "and the cursor of the next page, empty once the scan is over")
         .def("close", &DistributedObjectStore::tearDownAll)
         .def("get_size", &DistributedObjectStore::getSize,
              py::call_guard<py::gil_scoped_release>())
@@ -1357,6 +2710,18 @@ PYBIND11_MODULE(store, m) {
              py::arg("dtype"), "Get a PyTorch tensor from the store")
         .def("put_tensor", &DistributedObjectStore::put_tensor, py::arg("key"),
              py::arg("tensor"), "Put a PyTorch tensor into the store")
+        .def("get_tensor_into", &DistributedObjectStore::get_tensor_into,
+             py::arg("key"), py::arg("tensor"),
+             "Read an object directly into the storage of a contiguous tensor")
+        .def("batch_put_tensor", &DistributedObjectStore::batch_put_tensor,
+             py::arg("keys"), py::arg("tensors"),
+             py::arg("config") = ReplicateConfig{},
+             "Put multiple PyTorch tensors into the store in one call")
+        .def("batch_get_tensor_into",
+             &DistributedObjectStore::batch_get_tensor_into, py::arg("keys"),
+             py::arg("tensors"),
+             "Read multiple objects directly into the storage of their "
+             "tensors")
         .def(
             "register_buffer",
             [](DistributedObjectStore &self, uintptr_t buffer_ptr,
@@ -1407,6 +2772,181 @@ PYBIND11_MODULE(store, m) {
             py::arg("keys"), py::arg("buffer_ptrs"), py::arg("sizes"),
             "Get object data directly into pre-allocated buffers for multiple "
             "keys")
+        .def(
+            "get_into_async",
+            [](DistributedObjectStore &self, const std::string &key,
+               uintptr_t buffer_ptr, size_t size) {
+                void *buffer = reinterpret_cast<void *>(buffer_ptr);
+                py::gil_scoped_release release;
+                return self.get_into_async(key, buffer, size);
+            },
+            py::arg("key"), py::arg("buffer_ptr"), py::arg("size"),
+            "Start reading object data into a pre-allocated buffer, returns an "
+            "awaitable StoreFuture")
+        .def(
+            "get_into_range",
+            [](DistributedObjectStore &self, const std::string &key,
+               uintptr_t buffer_ptr, uint64_t offset, size_t size) {
+                void *buffer = reinterpret_cast<void *>(buffer_ptr);
+                py::gil_scoped_release release;
+                return self.get_into_range(key, buffer, offset, size);
+            },
+            py::arg("key"), py::arg("buffer_ptr"), py::arg("offset"),
+            py::arg("size"),
+            "Get size bytes of an object starting at offset into a "
+            "pre-allocated buffer")
+        .def(
+            "get_shard_into",
+            [](DistributedObjectStore &self, const std::string &key,
+               size_t shard, uintptr_t buffer_ptr, size_t size) {
+                void *buffer = reinterpret_cast<void *>(buffer_ptr);
+                py::gil_scoped_release release;
+                return self.get_shard_into(key, shard, buffer, size);
+            },
+            py::arg("key"), py::arg("shard"), py::arg("buffer_ptr"),
+            py::arg("size"),
+            "Get one shard of an object put with shard_segments into a "
+            "pre-allocated buffer")
+        .def(
+            "batch_get_into_range",
+            [](DistributedObjectStore &self,
+               const std::vector<std::string> &keys,
+               const std::vector<uintptr_t> &buffer_ptrs,
+               const std::vector<uint64_t> &offsets,
+               const std::vector<size_t> &sizes) {
+                std::vector<void *> buffers;
+                buffers.reserve(buffer_ptrs.size());
+                for (uintptr_t ptr : buffer_ptrs) {
+                    buffers.push_back(reinterpret_cast<void *>(ptr));
+                }
+                py::gil_scoped_release release;
+                return self.batch_get_into_range(keys, buffers, offsets,
+                                                 sizes);
+            },
+            py::arg("keys"), py::arg("buffer_ptrs"), py::arg("offsets"),
+            py::arg("sizes"),
+            "Get a range of each object into pre-allocated buffers, "
+            "transferring the ranges of all keys together")
+        .def(
+            "batch_get_into_async",
+            [](DistributedObjectStore &self,
+               const std::vector<std::string> &keys,
+               const std::vector<uintptr_t> &buffer_ptrs,
+               const std::vector<size_t> &sizes) {
+                std::vector<void *> buffers;
+                buffers.reserve(buffer_ptrs.size());
+                for (uintptr_t ptr : buffer_ptrs) {
+                    buffers.push_back(reinterpret_cast<void *>(ptr));
+                }
+                py::gil_scoped_release release;
+                return self.batch_get_into_async(keys, buffers, sizes);
+            },
+            py::arg("keys"), py::arg("buffer_ptrs"), py::arg("sizes"),
+            "Start reading multiple objects into pre-allocated buffers, "
+            "returns one StoreFuture per key")
+        .def(
+            "put_layers_from",
+            [](DistributedObjectStore &self,
+               const std::vector<std::string> &keys,
+               const std::vector<uintptr_t> &buffer_ptrs,
+               const std::vector<size_t> &sizes, size_t keys_per_layer,
+               const ReplicateConfig &config = ReplicateConfig{}) {
+                std::vector<void *> buffers;
+                buffers.reserve(buffer_ptrs.size());
+                for (uintptr_t ptr : buffer_ptrs) {
+                    buffers.push_back(reinterpret_cast<void *>(ptr));
+                }
+                py::gil_scoped_release release;
+                return self.put_layers_from(keys, buffers, sizes,
+                                            keys_per_layer, config);
+            },
+            py::arg("keys"), py::arg("buffer_ptrs"), py::arg("sizes"),
+            py::arg("keys_per_layer"), py::arg("config") = ReplicateConfig{},
+            "Allocate the objects of all layers of a block group at once and "
+            "return a LayerPutStream to write them layer by layer")
+        .def(
+            "get_layers_into",
+            [](DistributedObjectStore &self,
+               const std::vector<std::string> &keys,
+               const std::vector<uintptr_t> &buffer_ptrs,
+               const std::vector<size_t> &sizes, size_t keys_per_layer,
+               size_t prefetch_layers) {
+                std::vector<void *> buffers;
+                buffers.reserve(buffer_ptrs.size());
+                for (uintptr_t ptr : buffer_ptrs) {
+                    buffers.push_back(reinterpret_cast<void *>(ptr));
+                }
+                py::gil_scoped_release release;
+                return self.get_layers_into(keys, buffers, sizes,
+                                            keys_per_layer, prefetch_layers);
+            },
+            py::arg("keys"), py::arg("buffer_ptrs"), py::arg("sizes"),
+            py::arg("keys_per_layer"), py::arg("prefetch_layers") = 1,
+            "Query the objects of all layers of a block group at once and "
+            "return a LayerGetStream to read them layer by layer")
+        .def("get_view", &DistributedObjectStore::get_view,
+             py::call_guard<py::gil_scoped_release>(), py::arg("key"),
+             "View an object held in a local segment without copying it; "
+             "returns a StoreView or None")
+        .def(
+            "put_from_async",
+            [](DistributedObjectStore &self, const std::string &key,
+               uintptr_t buffer_ptr, size_t size,
+               const ReplicateConfig &config = ReplicateConfig{}) {
+                void *buffer = reinterpret_cast<void *>(buffer_ptr);
+                py::gil_scoped_release release;
+                return self.put_from_async(key, buffer, size, config);
+            },
+            py::arg("key"), py::arg("buffer_ptr"), py::arg("size"),
+            py::arg("config") = ReplicateConfig{},
+            "Start writing object data from a pre-allocated buffer, returns an "
+            "awaitable StoreFuture")
+        .def(
+            "put_from_on_stream",
+            [](DistributedObjectStore &self, const std::string &key,
+               uintptr_t buffer_ptr, size_t size, uintptr_t stream,
+               const ReplicateConfig &config = ReplicateConfig{}) {
+                void *buffer = reinterpret_cast<void *>(buffer_ptr);
+                py::gil_scoped_release release;
+                return self.put_from_on_stream(key, buffer, size, stream,
+                                               config);
+            },
+            py::arg("key"), py::arg("buffer_ptr"), py::arg("size"),
+            py::arg("stream"), py::arg("config") = ReplicateConfig{},
+            "Start writing object data from a buffer once the work queued on "
+            "the CUDA stream so far is done, returns an awaitable StoreFuture")
+        .def(
+            "get_into_on_stream",
+            [](DistributedObjectStore &self, const std::string &key,
+               uintptr_t buffer_ptr, size_t size, uintptr_t stream) {
+                void *buffer = reinterpret_cast<void *>(buffer_ptr);
+                py::gil_scoped_release release;
+                return self.get_into_on_stream(key, buffer, size, stream);
+            },
+            py::arg("key"), py::arg("buffer_ptr"), py::arg("size"),
+            py::arg("stream"),
+            "Start reading object data into a buffer once the work queued on "
+            "the CUDA stream so far is done, holding the work queued after "
+            "until it completes; returns an awaitable StoreFuture")
+        .def(
+            "batch_put_from_async",
+            [](DistributedObjectStore &self,
+               const std::vector<std::string> &keys,
+               const std::vector<uintptr_t> &buffer_ptrs,
+               const std::vector<size_t> &sizes,
+               const ReplicateConfig &config = ReplicateConfig{}) {
+                std::vector<void *> buffers;
+                buffers.reserve(buffer_ptrs.size());
+                for (uintptr_t ptr : buffer_ptrs) {
+                    buffers.push_back(reinterpret_cast<void *>(ptr));
+                }
+                py::gil_scoped_release release;
+                return self.batch_put_from_async(keys, buffers, sizes, config);
+            },
+            py::arg("keys"), py::arg("buffer_ptrs"), py::arg("sizes"),
+            py::arg("config") = ReplicateConfig{},
+            "Start writing multiple objects from pre-allocated buffers, "
+            "pipelined with earlier calls; returns one StoreFuture per key")
         .def(
             "put_from",
             [](DistributedObjectStore &self, const std::string &key,
@@ -1439,6 +2979,78 @@ PYBIND11_MODULE(store, m) {
             py::arg("config") = ReplicateConfig{},
             "Put object data directly from pre-allocated buffers for multiple "
             "keys")
+        .def(
+            "get_into_iov",
+            [](DistributedObjectStore &self, const std::string &key,
+               const std::vector<uintptr_t> &buffer_ptrs,
+               const std::vector<size_t> &sizes) {
+                std::vector<void *> buffers;
+                buffers.reserve(buffer_ptrs.size());
+                for (uintptr_t ptr : buffer_ptrs) {
+                    buffers.push_back(reinterpret_cast<void *>(ptr));
+                }
+                py::gil_scoped_release release;
+                return self.get_into_iov(key, buffers, sizes);
+            },
+            py::arg("key"), py::arg("buffer_ptrs"), py::arg("sizes"),
+            "Get object data directly into a list of pre-allocated buffers, "
+            "filled in order")
+        .def(
+            "batch_get_into_iov",
+            [](DistributedObjectStore &self,
+               const std::vector<std::string> &keys,
+               const std::vector<std::vector<uintptr_t>> &buffer_ptrs,
+               const std::vector<std::vector<size_t>> &sizes) {
+                std::vector<std::vector<void *>> buffers(buffer_ptrs.size());
+                for (size_t i = 0; i < buffer_ptrs.size(); ++i) {
+                    for (uintptr_t ptr : buffer_ptrs[i]) {
+                        buffers[i].push_back(reinterpret_cast<void *>(ptr));
+                    }
+                }
+                py::gil_scoped_release release;
+                return self.batch_get_into_iov(keys, buffers, sizes);
+            },
+            py::arg("keys"), py::arg("buffer_ptrs"), py::arg("sizes"),
+            "Get object data directly into a list of pre-allocated buffers "
+            "per key")
+        .def(
+            "put_from_iov",
+            [](DistributedObjectStore &self, const std::string &key,
+               const std::vector<uintptr_t> &buffer_ptrs,
+               const std::vector<size_t> &sizes,
+               const ReplicateConfig &config = ReplicateConfig{}) {
+                std::vector<void *> buffers;
+                buffers.reserve(buffer_ptrs.size());
+                for (uintptr_t ptr : buffer_ptrs) {
+                    buffers.push_back(reinterpret_cast<void *>(ptr));
+                }
+                py::gil_scoped_release release;
+                return self.put_from_iov(key, buffers, sizes, config);
+            },
+            py::arg("key"), py::arg("buffer_ptrs"), py::arg("sizes"),
+            py::arg("config") = ReplicateConfig{},
+            "Put object data directly from a list of pre-allocated buffers, "
+            "concatenated in order")
+        .def(
+            "batch_put_from_iov",
+            [](DistributedObjectStore &self,
+               const std::vector<std::string> &keys,
+               const std::vector<std::vector<uintptr_t>> &buffer_ptrs,
+               const std::vector<std::vector<size_t>> &sizes,
+               const ReplicateConfig &config = ReplicateConfig{}) {
+                std::vector<std::vector<void *>> buffers(buffer_ptrs.size());
+                for (size_t i = 0; i < buffer_ptrs.size(); ++i) {
+                    for (uintptr_t ptr : buffer_ptrs[i]) {
+                        buffers[i].push_back(reinterpret_cast<void *>(ptr));
+                    }
+                }
+                py::gil_scoped_release release;
+                return self.batch_put_from_iov(keys, buffers, sizes, config);
+            },
+            py::arg("keys"), py::arg("buffer_ptrs"), py::arg("sizes"),
+            py::arg("config") = ReplicateConfig{},
+            "Put object data directly from a list of pre-allocated buffers "
+            "per key")
         .def(
             "put",
             [](DistributedObjectStore &self, const std::string &key,
@@ -3,14 +3,29 @@
 #include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 
+#include <condition_variable>
 #include <csignal>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
+#include <thread>
+#include <tuple>
 #include <unordered_set>
+#include <utility>
+#include <vector>
+
+#ifdef USE_CUDA
+#include <cuda_runtime.h>
+#endif
 
 #include "allocator.h"
 #include "client.h"
 #include "client_buffer.hpp"
+#include "segment_memory.h"
 
 namespace mooncake {
 
@@ -67,6 +82,193 @@ class SliceBuffer {
     BufferHandle handle_;
 };
 
+/**
+ * @brief Handle of an asynchronous store operation, awaitable from Python
+ *
+ * The result is the one of the matching blocking call, e.g. the number of
+ * bytes read for get_into_async and 0 for put_from_async on success.
+ */
+class StoreFuture {
+   public:
+    StoreFuture(TransferFuture future, int success_value);
+
+    // A handle of an operation that already finished with result
+    explicit StoreFuture(int result);
+
+    // A handle of an operation not started yet, whose future is given to
+    // start() once it is
+    StoreFuture();
+
+    void start(std::shared_ptr<StoreFuture> operation);
+
+    bool done();
+
+    // Block until the operation completes and return its result
+    int wait();
+
+    /**
+     * @brief Run callback with the result once the operation completes, on
+     * the client thread completing it, or right away if it already has
+     */
+    void add_done_callback(std::function<void(int)> callback);
+
+   private:
+    static int toResult(ErrorCode error_code, int success_value);
+
+    // The operation once a deferred handle is started, and the callbacks
+    // added before
+    struct Deferred {
+        std::mutex mutex;
+        std::condition_variable cond;
+        std::shared_ptr<StoreFuture> operation;
+        std::vector<std::function<void(int)>> callbacks;
+    };
+
+    std::optional<TransferFuture> future_;
+    // Result on success, or the result of an operation that never started
+    const int success_value_;
+    std::unique_ptr<Deferred> deferred_;
+};
+
+#ifdef USE_CUDA
+/**
+ * @brief Runs host work once the work queued on a CUDA stream so far is
+ * done, without blocking the caller: the work waits for an event recorded
+ * on the stream on a thread of its own, in the order it was queued.
+ */
+class StreamWaiter {
+   public:
+    StreamWaiter();
+
+    // Runs the work still queued
+    ~StreamWaiter();
+
+    // Record an event of the work queued on stream so far, on the current
+    // device, which must be the one of stream
+    bool record(cudaStream_t stream, cudaEvent_t &event);
+
+    // Run work once event completes. Takes the event
+    void enqueue(cudaEvent_t event, std::function<void()> work);
+
+   private:
+    void worker();
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<std::pair<cudaEvent_t, std::function<void()>>> queue_;
+    bool running_ = true;
+    std::thread worker_;
+};
+#endif
+
+/**
+ * @brief Layer by layer put of the KV cache of a block group, with one key
+ * per block and layer: the keys of layer i are [i * keys_per_layer,
+ * (i + 1) * keys_per_layer). All the keys are allocated when the stream is
+ * opened and finalized together by finish, so the group costs two master
+ * round trips whatever its number of layers.
+ */
+class LayerPutStream {
+   public:
+    LayerPutStream(std::shared_ptr<Client> client,
+                   std::shared_ptr<PutGroup> group, size_t keys_per_layer);
+
+    // Finishes the stream if finish was not called
+    ~LayerPutStream();
+
+    size_t num_layers() const;
+
+    /**
+     * @brief Transfers a layer once its data is in the buffers, without
+     * waiting for it
+     * @return 0, or a negative value if the layer is out of range or the
+     * stream has finished
+     */
+    int submit_layer(size_t layer);
+
+    /**
+     * @brief Transfers the layers not submitted yet, waits for all of them
+     * and finalizes the puts
+     * @return One result per key, 0 on success or a negative value on error
+     */
+    std::vector<int> finish();
+
+   private:
+    std::shared_ptr<Client> client_;
+    std::shared_ptr<PutGroup> group_;
+    const size_t keys_per_layer_;
+    std::vector<int> results_;
+    bool finished_ = false;
+};
+
+/**
+ * @brief Layer by layer get of the KV cache of a block group, keys laid out
+ * as for LayerPutStream. The replicas of all the keys are queried when the
+ * stream is opened. Waiting for a layer submits the reads of the next
+ * prefetch_layers layers first, so that they overlap with consuming it.
+ */
+class LayerGetStream {
+   public:
+    LayerGetStream(
+        std::shared_ptr<Client> client, std::vector<std::string> keys,
+        std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+            replicas,
+        std::vector<void *> buffers, std::vector<size_t> sizes,
+        size_t keys_per_layer, size_t prefetch_layers);
+
+    // Waits for the reads submitted, the buffers must outlive them
+    ~LayerGetStream();
+
+    size_t num_layers() const;
+
+    // Submits the reads of a layer if not done yet, 0 or a negative value
+    int submit_layer(size_t layer);
+
+    /**
+     * @brief Waits for a layer to be in its buffers
+     * @return One result per key of the layer, the number of bytes read or
+     * a negative value on error
+     */
+    std::vector<int> wait_layer(size_t layer);
+
+   private:
+    std::shared_ptr<Client> client_;
+    const std::vector<std::string> keys_;
+    const std::vector<
+        tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+        replicas_;
+    const std::vector<void *> buffers_;
+    const std::vector<size_t> sizes_;
+    const size_t keys_per_layer_;
+    const size_t prefetch_layers_;
+    // The reads of each layer, empty until submitted
+    std::vector<std::vector<std::shared_ptr<StoreFuture>>> layers_;
+};
+
+/**
+ * @brief A read-only view of an object in a local segment, see
+ * Client::GetView. The buffers stay valid until release, called by the
+ * destructor at the latest.
+ */
+class StoreView {
+   public:
+    StoreView(std::shared_ptr<Client> client, ObjectView view);
+    ~StoreView();
+
+    // Read-only memoryviews of the buffers of the object, in order
+    pybind11::list buffers() const;
+
+    size_t size() const;
+
+    // Stops pinning the object, the memoryviews must not be used after
+    void release();
+
+   private:
+    std::shared_ptr<Client> client_;
+    ObjectView view_;
+    bool released_ = false;
+};
+
 class DistributedObjectStore {
    public:
     friend class SliceBuffer;  // Allow SliceBuffer to access private members
@@ -84,6 +286,26 @@ class DistributedObjectStore {
     int initAll(const std::string &protocol, const std::string &device_name,
                 size_t mount_segment_size = 1024 * 1024 * 16);  // Default 16MB
 
+    /**
+     * @brief Mount a segment in the memory of a GPU after setup, e.g. as a
+     * tier for hot objects put with prefer_device_memory
+     * @param size Size of the segment, a multiple of the slab size
+     * @param device CUDA device ordinal
+     * @return 0 on success, 1 on error
+     */
+    int mount_device_segment(size_t size, int device);
+
+    /**
+     * @brief Attach to the segment another store mounted from the file at
+     * path in memory this host maps too, e.g. a CXL memory pool on a DAX
+     * filesystem, so that its replicas are copied with load/store rather
+     * than through the transfer engine
+     * @param path File the owner mounted with
+     * MC_STORE_PERSISTENT_SEGMENT_DIR
+     * @return 0 on success, 1 on error
+     */
+    int attach_shared_segment(const std::string &path);
+
     int put(const std::string &key, std::span<const char> value,
             const ReplicateConfig &config = ReplicateConfig{});
 
@@ -118,6 +340,93 @@ class DistributedObjectStore {
                                     const std::vector<void *> &buffers,
                                     const std::vector<size_t> &sizes);
 
+    /**
+     * @brief Get size bytes of an object starting at offset directly into a
+     * pre-allocated buffer, transferring only that range
+     * @param key Key of the object to get
+     * @param buffer Pointer to the pre-allocated buffer (must be registered
+     * with register_buffer)
+     * @param offset Offset of the range in the object
+     * @param size Length of the range
+     * @return Number of bytes read on success, negative value on error
+     * @note Objects put with a codec are not decoded, the range is taken
+     * from their stored bytes
+     */
+    int get_into_range(const std::string &key, void *buffer, uint64_t offset,
+                       size_t size);
+
+    /**
+     * @brief Get one shard of an object put with shard_segments, e.g. the
+     * part of one tensor-parallel rank, into a pre-allocated buffer
+     * @param key Key of the sharded object
+     * @param shard Index of the shard
+     * @param buffer Pointer to the pre-allocated buffer (must be registered
+     * with register_buffer)
+     * @param size Size of the shard
+     * @return Number of bytes read on success, negative value on error
+     */
+    int get_shard_into(const std::string &key, size_t shard, void *buffer,
+                       size_t size);
+
+    /**
+     * @brief Batch version of get_into_range
+     * @param keys Vector of keys of the objects to get
+     * @param buffers Vector of pointers to the pre-allocated buffers
+     * @param offsets Vector of offsets of the ranges
+     * @param sizes Vector of lengths of the ranges
+     * @return Vector of integers, where each element is the number of bytes
+     * read on success, or a negative value on error
+     */
+    std::vector<int> batch_get_into_range(
+        const std::vector<std::string> &keys,
+        const std::vector<void *> &buffers,
+        const std::vector<uint64_t> &offsets,
+        const std::vector<size_t> &sizes);
+
+    /**
+     * @brief Get object data directly into scattered pre-allocated buffers,
+     * e.g. the pages of a KV block, filled in order
+     * @param key Key of the object to get
+     * @param buffers Pointers to the buffers (must be registered with
+     * register_buffer)
+     * @param sizes Sizes of the buffers, adding up to the object size
+     * @return Number of bytes read on success, negative value on error
+     */
+    int get_into_iov(const std::string &key,
+                     const std::vector<void *> &buffers,
+                     const std::vector<size_t> &sizes);
+
+    /**
+     * @brief Batch version of get_into_iov, one list of buffers per key
+     */
+    std::vector<int> batch_get_into_iov(
+        const std::vector<std::string> &keys,
+        const std::vector<std::vector<void *>> &buffers,
+        const std::vector<std::vector<size_t>> &sizes);
+
+    /**
+     * @brief Put object data directly from scattered pre-allocated buffers,
+     * concatenated in order
+     * @param key Key of the object to put
+     * @param buffers Pointers to the buffers (must be registered with
+     * register_buffer)
+     * @param sizes Sizes of the buffers
+     * @return 0 on success, negative value on error
+     */
+    int put_from_iov(const std::string &key,
+                     const std::vector<void *> &buffers,
+                     const std::vector<size_t> &sizes,
+                     const ReplicateConfig &config = ReplicateConfig{});
+
+    /**
+     * @brief Batch version of put_from_iov, one list of buffers per key
+     */
+    std::vector<int> batch_put_from_iov(
+        const std::vector<std::string> &keys,
+        const std::vector<std::vector<void *>> &buffers,
+        const std::vector<std::vector<size_t>> &sizes,
+        const ReplicateConfig &config = ReplicateConfig{});
+
     /**
      * @brief Put object data directly from a pre-allocated buffer
      * @param key Key of the object to put
@@ -148,6 +457,89 @@ class DistributedObjectStore {
         const std::vector<void *> &buffers, const std::vector<size_t> &sizes,
         const ReplicateConfig &config = ReplicateConfig{});
 
+    /**
+     * @brief Non-blocking get_into: submits the read and returns a future
+     * @note The buffer must stay valid until the future completes
+     */
+    std::shared_ptr<StoreFuture> get_into_async(const std::string &key,
+                                                void *buffer, size_t size);
+
+    /**
+     * @brief Non-blocking batch_get_into, one future per key
+     */
+    std::vector<std::shared_ptr<StoreFuture>> batch_get_into_async(
+        const std::vector<std::string> &keys,
+        const std::vector<void *> &buffers, const std::vector<size_t> &sizes);
+
+    /**
+     * @brief Non-blocking put_from: submits the write and returns a future
+     * @note The buffer must stay valid until the future completes
+     */
+    std::shared_ptr<StoreFuture> put_from_async(
+        const std::string &key, void *buffer, size_t size,
+        const ReplicateConfig &config = ReplicateConfig{});
+
+    /**
+     * @brief Non-blocking batch_put_from, one future per key. Consecutive
+     * calls are pipelined: a batch is started while the previous one is
+     * still transferring, and finished puts are finalized together.
+     * @note The buffers must stay valid until the futures complete
+     */
+    std::vector<std::shared_ptr<StoreFuture>> batch_put_from_async(
+        const std::vector<std::string> &keys,
+        const std::vector<void *> &buffers, const std::vector<size_t> &sizes,
+        const ReplicateConfig &config = ReplicateConfig{});
+
+    /**
+     * @brief put_from in the order of a CUDA stream, e.g.
+     * torch.cuda.Stream.cuda_stream: the put starts once the work queued on
+     * the stream so far is done, without blocking the caller
+     * @note The buffer must not be overwritten until the future completes
+     */
+    std::shared_ptr<StoreFuture> put_from_on_stream(
+        const std::string &key, void *buffer, size_t size, uintptr_t stream,
+        const ReplicateConfig &config = ReplicateConfig{});
+
+    /**
+     * @brief get_into in the order of a CUDA stream: the get starts once
+     * the work queued on the stream so far is done, and the work queued
+     * after waits until it completes, without blocking the caller. The
+     * result is reported by the future only; the stream goes on after a
+     * failed get as well
+     */
+    std::shared_ptr<StoreFuture> get_into_on_stream(const std::string &key,
+                                                    void *buffer, size_t size,
+                                                    uintptr_t stream);
+
+    /**
+     * @brief Opens a layer by layer put of a block group, see LayerPutStream
+     * @param keys The keys of every layer one after the other,
+     * keys_per_layer of each
+     * @note The buffers must stay valid until the stream finishes
+     */
+    std::shared_ptr<LayerPutStream> put_layers_from(
+        const std::vector<std::string> &keys,
+        const std::vector<void *> &buffers, const std::vector<size_t> &sizes,
+        size_t keys_per_layer,
+        const ReplicateConfig &config = ReplicateConfig{});
+
+    /**
+     * @brief Opens a layer by layer get of a block group, see LayerGetStream
+     * @note The buffers must stay valid until the stream is released
+     */
+    std::shared_ptr<LayerGetStream> get_layers_into(
+        const std::vector<std::string> &keys,
+        const std::vector<void *> &buffers, const std::vector<size_t> &sizes,
+        size_t keys_per_layer, size_t prefetch_layers = 1);
+
+    /**
+     * @brief Views an object in a local segment without copying it, see
+     * StoreView
+     * @return nullptr if the object is not held in a local segment or on
+     * error
+     */
+    std::shared_ptr<StoreView> get_view(const std::string &key);
+
     int put_parts(const std::string &key,
                   std::vector<std::span<const char>> values,
                   const ReplicateConfig &config = ReplicateConfig{});
@@ -175,6 +567,18 @@ class DistributedObjectStore {
 
     long removeAll();
 
+    /**
+     * @brief Remove the objects put with ReplicateConfig.tag equal to tag
+     * @return The number of objects queued for removal, -1 on error
+     */
+    long removeByTag(const std::string &tag);
+
+    /**
+     * @brief Remove the objects whose key starts with prefix
+     * @return The number of objects removed, -1 on error
+     */
+    long removeByPrefix(const std::string &prefix);
+
     int tearDownAll();
 
     /**
@@ -192,6 +596,73 @@ class DistributedObjectStore {
      */
     std::vector<int> batchIsExist(const std::vector<std::string> &keys);
 
+    /**
+     * @brief Extend the leases of objects without reading them, to keep
+     * them from being evicted
+     * @param keys Keys to touch
+     * @param ttl_ms Lease length, 0 for the master's default lease
+     * @param next_use_ms Expected time until the objects are read again, 0
+     * for no hint
+     * @return Vector of results: 0 if touched, otherwise a negative error
+     * code, e.g. OBJECT_NOT_FOUND
+     */
+    std::vector<int> batchTouch(const std::vector<std::string> &keys,
+                                uint64_t ttl_ms, uint64_t next_use_ms = 0);
+
+    /**
+     * @brief Copy objects to a segment in the background, e.g. the blocks
+     * a request scheduled on this node will read, so that the reads are
+     * local
+     * @param keys Keys to prefetch
+     * @param target_segment Segment of the copies, this client's if empty
+     * @return Vector of results: 0 if queued or already there, otherwise a
+     * negative error code
+     */
+    std::vector<int> prefetch(const std::vector<std::string> &keys,
+                              const std::string &target_segment);
+
+    /**
+     * @brief Drop the prefetches of keys that are not being copied yet
+     * @return Vector of results: 1 if dropped, 0 if not, negative error code
+     * on failure
+     */
+    std::vector<int> cancelPrefetch(const std::vector<std::string> &keys,
+                                    const std::string &target_segment);
+
+    /**
+     * @brief Count the leading keys that exist, e.g. the cached prefix of a
+     * chain of KV cache blocks, in a single request to the master
+     * @param keys Keys in prefix order
+     * @param cache_replicas Keep the replica lists of the matched keys in the
+     * replica cache, if it is enabled, for the following gets
+     * @return Number of matched keys, or a negative error code
+     */
+    int64_t longestPrefixMatch(const std::vector<std::string> &keys,
+                               bool cache_replicas);
+
+    /**
+     * @brief Tell which segments hold each key, in a single request
+     * @param keys Keys to locate, in prefix order for prefix hits
+     * @param with_prefix_hits Also count the leading keys of each segment
+     * @return The segment names, the indices of the segments holding each
+     * key, and the prefix hits of each segment if asked for
+     * @throws std::runtime_error if the master fails
+     */
+    std::tuple<std::vector<std::string>, std::vector<std::vector<uint32_t>>,
+               std::vector<uint64_t>>
+    batchQueryLocation(const std::vector<std::string> &keys,
+                       bool with_prefix_hits);
+
+    /**
+     * @brief Fetch a page of the keys starting with prefix
+     * @param cursor Empty for the first page, then the returned next cursor
+     * @param limit Most keys to return
+     * @return The keys and the next cursor, empty once the scan is over
+     * @throws std::runtime_error if the master fails
+     */
+    std::pair<std::vector<std::string>, std::string> scanKeys(
+        const std::string &prefix, const std::string &cursor, uint64_t limit);
+
     /**
      * @brief Get the size of an object
      * @param key Key of the object
@@ -217,7 +688,60 @@ class DistributedObjectStore {
      */
     int put_tensor(const std::string &key, pybind11::object tensor);
 
+    /**
+     * @brief Read an object into the storage of a contiguous tensor, which
+     * may live in GPU or pinned host memory
+     * @return Number of bytes read on success, negative value on error
+     * @note Tensors inside a buffer registered with register_buffer() are
+     * transferred without copies; others are registered for the call only
+     */
+    int get_tensor_into(const std::string &key, pybind11::object tensor);
+
+    /**
+     * @brief Put several tensors, e.g. all layers of a KV cache, in one call
+     * @return One result per key as for put_tensor
+     */
+    std::vector<int> batch_put_tensor(
+        const std::vector<std::string> &keys,
+        const std::vector<pybind11::object> &tensors,
+        const ReplicateConfig &config = ReplicateConfig{});
+
+    /**
+     * @brief Read several objects into the storage of their tensors
+     * @return One result per key as for get_tensor_into
+     */
+    std::vector<int> batch_get_tensor_into(
+        const std::vector<std::string> &keys,
+        const std::vector<pybind11::object> &tensors);
+
    private:
+    // Whether [buffer, buffer + size) lies in a buffer passed to
+    // register_buffer()
+    bool is_registered(const void *buffer, size_t size);
+
+    /**
+     * @brief Make the storage of tensors transferable: those outside any
+     * registered buffer are registered and returned in temporary
+     * @return false if a tensor is not contiguous or cannot be registered
+     */
+    bool prepare_tensors(const std::vector<pybind11::object> &tensors,
+                         std::vector<void *> &buffers,
+                         std::vector<size_t> &sizes,
+                         std::vector<void *> &temporary);
+
+    void release_tensors(const std::vector<void *> &temporary);
+
+#ifdef USE_CUDA
+    StreamWaiter *stream_waiter();
+
+    std::mutex stream_waiter_mutex_;
+    std::unique_ptr<StreamWaiter> stream_waiter_;
+#endif
+
+    std::mutex registered_mutex_;
+    // Start address and size of the buffers passed to register_buffer()
+    std::map<uintptr_t, size_t> registered_buffers_;
+
     pybind11::module numpy = pybind11::module::import("numpy");
     pybind11::module torch = pybind11::module::import("torch");
 
@@ -225,15 +749,7 @@ class DistributedObjectStore {
     std::shared_ptr<mooncake::Client> client_ = nullptr;
     std::shared_ptr<ClientBufferAllocator> client_buffer_allocator_ = nullptr;
 
-    struct SegmentDeleter {
-        void operator()(void *ptr) {
-            if (ptr) {
-                free(ptr);
-            }
-        }
-    };
-
-    std::vector<std::unique_ptr<void, SegmentDeleter>> segment_ptrs_;
+    std::vector<std::unique_ptr<SegmentMemory>> segment_ptrs_;
     std::string protocol;
     std::string device_name;
     std::string local_hostname;
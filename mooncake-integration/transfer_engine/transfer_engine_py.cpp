@@ -14,6 +14,7 @@
 
 #include "transfer_engine_py.h"
 
+#include <algorithm>
 #include <cassert>
 #include <numeric>
 #include <fstream>
@@ -328,53 +329,68 @@ int TransferEnginePy::transferSync(const char *target_hostname,
     return -1;
 }
 
-int TransferEnginePy::batchTransferSync(const char *target_hostname,
-                                   std::vector<uintptr_t> buffers,
-                                   std::vector<uintptr_t> peer_buffer_addresses,
-                                   std::vector<size_t> lengths,
-                                   TransferOpcode opcode) {
-    pybind11::gil_scoped_release release;
-    Transport::SegmentHandle handle;
-    {
-        std::lock_guard<std::mutex> guard(mutex_);
-        if (handle_map_.count(target_hostname)) {
-            handle = handle_map_[target_hostname];
-        } else {
-            handle = engine_->openSegment(target_hostname);
-            if (handle == (Transport::SegmentHandle)-1) return -1;
-            handle_map_[target_hostname] = handle;
-        }
-    }
-
-    if (buffers.size() != peer_buffer_addresses.size() || buffers.size() != lengths.size()) {
-        LOG(ERROR) << "buffers, peer_buffer_addresses and lengths have different size";
-        return -1;
-    }
-
-    const int max_retry = engine_->numContexts() + 1;
-    auto start_ts = getCurrentTimeInNano();
-    auto total_length = std::accumulate(lengths.begin(), lengths.end(), 0ull);
-    auto batch_size = buffers.size();
-    std::vector<TransferRequest> entries;
-    for (size_t i = 0; i < batch_size; ++i) {
-        TransferRequest entry;
-        if (opcode == TransferOpcode::WRITE) {
-            entry.opcode = TransferRequest::WRITE;
-        } else {
-            entry.opcode = TransferRequest::READ;
-        }
+Transport::SegmentHandle TransferEnginePy::getSegmentHandle(
+    const char *target_hostname) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto it = handle_map_.find(target_hostname);
+    if (it != handle_map_.end()) return it->second;
+    auto handle = engine_->openSegment(target_hostname);
+    if (handle != (Transport::SegmentHandle)-1)
+        handle_map_[target_hostname] = handle;
+    return handle;
+}
+
+std::vector<TransferRequest> TransferEnginePy::buildRequests(
+    Transport::SegmentHandle handle, const uintptr_t *buffers,
+    const uintptr_t *peer_buffer_addresses, const size_t *lengths,
+    size_t count, TransferOpcode opcode) {
+    std::vector<TransferRequest> entries(count);
+    for (size_t i = 0; i < count; ++i) {
+        auto &entry = entries[i];
+        entry.opcode = opcode == TransferOpcode::WRITE ? TransferRequest::WRITE
+                                                       : TransferRequest::READ;
         entry.length = lengths[i];
         entry.source = (void *)buffers[i];
         entry.target_id = handle;
         entry.target_offset = peer_buffer_addresses[i];
         entry.advise_retry_cnt = 0;
-        entries.push_back(entry);
     }
+    return entries;
+}
+
+int TransferEnginePy::submitAndWait(const std::vector<TransferRequest> &entries,
+                                    int32_t *task_status) {
+    const int max_retry = engine_->numContexts() + 1;
+    auto start_ts = getCurrentTimeInNano();
+    size_t total_length = 0;
+    for (auto &entry : entries) total_length += entry.length;
+    auto batch_size = entries.size();
+
+    // The status of each task of the last attempt, before its batch is freed
+    auto record_status = [&](batch_id_t batch_id, bool timed_out) {
+        if (!task_status) return;
+        for (size_t i = 0; i < batch_size; ++i) {
+            TransferStatus status;
+            Status s = engine_->getTransferStatus(batch_id, i, status);
+            if (!s.ok()) {
+                task_status[i] = TransferStatusEnum::INVALID;
+            } else if (timed_out &&
+                       status.s != TransferStatusEnum::COMPLETED &&
+                       status.s != TransferStatusEnum::FAILED) {
+                task_status[i] = TransferStatusEnum::TIMEOUT;
+            } else {
+                task_status[i] = status.s;
+            }
+        }
+    };
 
     for (int retry = 0; retry < max_retry; ++retry) {
         auto batch_id = engine_->allocateBatchID(batch_size);
         Status s = engine_->submitTransfer(batch_id, entries);
         if (!s.ok()) {
+            if (task_status)
+                std::fill(task_status, task_status + batch_size,
+                          TransferStatusEnum::FAILED);
             engine_->freeBatchID(batch_id);
             return -1;
         }
@@ -386,9 +402,13 @@ int TransferEnginePy::batchTransferSync(const char *target_hostname,
             Status s = engine_->getBatchTransferStatus(batch_id, status);
             LOG_ASSERT(s.ok());
             if (status.s == TransferStatusEnum::COMPLETED) {
+                if (task_status)
+                    std::fill(task_status, task_status + batch_size,
+                              TransferStatusEnum::COMPLETED);
                 engine_->freeBatchID(batch_id);
                 return 0;
             } else if (status.s == TransferStatusEnum::FAILED) {
+                record_status(batch_id, false);
                 engine_->freeBatchID(batch_id);
                 already_freed = true;
                 completed = true;
@@ -404,6 +424,7 @@ int TransferEnginePy::batchTransferSync(const char *target_hostname,
                 // TODO: as @doujiang24 mentioned, early free(while there are still waiting tasks)
                 // the batch_id may fail and cause memory leak(a known issue).
                 if (!already_freed) {
+                    record_status(batch_id, true);
                     engine_->freeBatchID(batch_id);
                 }
                 return -1;
@@ -413,51 +434,14 @@ int TransferEnginePy::batchTransferSync(const char *target_hostname,
     return -1;
 }
 
-batch_id_t TransferEnginePy::batchTransferAsync(const char *target_hostname,
-                                                const std::vector<uintptr_t>& buffers,
-                                                const std::vector<uintptr_t>& peer_buffer_addresses,
-                                                const std::vector<size_t>& lengths,
-                                                TransferOpcode opcode) {
-    pybind11::gil_scoped_release release;
-    Transport::SegmentHandle handle;
-    {
-        std::lock_guard<std::mutex> guard(mutex_);
-        if (handle_map_.count(target_hostname)) {
-            handle = handle_map_[target_hostname];
-        } else {
-            handle = engine_->openSegment(target_hostname);
-            if (handle == (Transport::SegmentHandle)-1) return -1;
-            handle_map_[target_hostname] = handle;
-        }
-    }
-
-    if (buffers.size() != peer_buffer_addresses.size() || buffers.size() != lengths.size()) {
-        LOG(ERROR) << "buffers, peer_buffer_addresses and lengths have different size";
-        return 0;
-    }
-
+batch_id_t TransferEnginePy::submitAsync(
+    const std::vector<TransferRequest> &entries) {
     const int max_retry = engine_->numContexts() + 1;
-    auto batch_size = buffers.size();
-    std::vector<TransferRequest> entries;
     batch_id_t batch_id = 0;
-    for (size_t i = 0; i < batch_size; ++i) {
-        TransferRequest entry;
-        if (opcode == TransferOpcode::WRITE) {
-            entry.opcode = TransferRequest::WRITE;
-        } else {
-            entry.opcode = TransferRequest::READ;
-        }
-        entry.length = lengths[i];
-        entry.source = (void *)buffers[i];
-        entry.target_id = handle;
-        entry.target_offset = peer_buffer_addresses[i];
-        entry.advise_retry_cnt = 0;
-        entries.push_back(entry);
-    }
-
     for (int retry = 0; retry < max_retry; ++retry) {
-        batch_id = engine_->allocateBatchID(batch_size);
-        auto batch_desc = reinterpret_cast<BatchDesc *>(batch_id);
+        batch_id = engine_->allocateBatchID(entries.size());
+        auto batch_desc = Transport::getBatchDesc(batch_id);
+        if (!batch_desc) return 0;
 
         auto start_ts = getCurrentTimeInNano();
         batch_desc->start_timestamp = start_ts;
@@ -474,13 +458,200 @@ batch_id_t TransferEnginePy::batchTransferAsync(const char *target_hostname,
     return batch_id;
 }
 
+int TransferEnginePy::batchTransferSync(const char *target_hostname,
+                                   std::vector<uintptr_t> buffers,
+                                   std::vector<uintptr_t> peer_buffer_addresses,
+                                   std::vector<size_t> lengths,
+                                   TransferOpcode opcode) {
+    pybind11::gil_scoped_release release;
+    auto handle = getSegmentHandle(target_hostname);
+    if (handle == (Transport::SegmentHandle)-1) return -1;
+
+    if (buffers.size() != peer_buffer_addresses.size() || buffers.size() != lengths.size()) {
+        LOG(ERROR) << "buffers, peer_buffer_addresses and lengths have different size";
+        return -1;
+    }
+
+    auto entries =
+        buildRequests(handle, buffers.data(), peer_buffer_addresses.data(),
+                      lengths.data(), buffers.size(), opcode);
+    return submitAndWait(entries, nullptr);
+}
+
+batch_id_t TransferEnginePy::batchTransferAsync(const char *target_hostname,
+                                                const std::vector<uintptr_t>& buffers,
+                                                const std::vector<uintptr_t>& peer_buffer_addresses,
+                                                const std::vector<size_t>& lengths,
+                                                TransferOpcode opcode) {
+    pybind11::gil_scoped_release release;
+    auto handle = getSegmentHandle(target_hostname);
+    if (handle == (Transport::SegmentHandle)-1) return -1;
+
+    if (buffers.size() != peer_buffer_addresses.size() || buffers.size() != lengths.size()) {
+        LOG(ERROR) << "buffers, peer_buffer_addresses and lengths have different size";
+        return 0;
+    }
+
+    auto entries =
+        buildRequests(handle, buffers.data(), peer_buffer_addresses.data(),
+                      lengths.data(), buffers.size(), opcode);
+    return submitAsync(entries);
+}
+
+int TransferEnginePy::transferOnStreamWrite(const char *target_hostname,
+                                            uintptr_t buffer,
+                                            uintptr_t peer_buffer_address,
+                                            size_t length, uintptr_t stream) {
+    return batchTransferOnStream(target_hostname, {buffer},
+                                 {peer_buffer_address}, {length},
+                                 TransferOpcode::WRITE, stream);
+}
+
+int TransferEnginePy::transferOnStreamRead(const char *target_hostname,
+                                           uintptr_t buffer,
+                                           uintptr_t peer_buffer_address,
+                                           size_t length, uintptr_t stream) {
+    return batchTransferOnStream(target_hostname, {buffer},
+                                 {peer_buffer_address}, {length},
+                                 TransferOpcode::READ, stream);
+}
+
+int TransferEnginePy::batchTransferOnStream(
+    const char *target_hostname, const std::vector<uintptr_t> &buffers,
+    const std::vector<uintptr_t> &peer_buffer_addresses,
+    const std::vector<size_t> &lengths, TransferOpcode opcode,
+    uintptr_t stream) {
+#ifdef USE_CUDA
+    pybind11::gil_scoped_release release;
+    auto handle = getSegmentHandle(target_hostname);
+    if (handle == (Transport::SegmentHandle)-1) return -1;
+
+    if (buffers.size() != peer_buffer_addresses.size() ||
+        buffers.size() != lengths.size()) {
+        LOG(ERROR) << "buffers, peer_buffer_addresses and lengths have "
+                      "different size";
+        return -1;
+    }
+
+    auto entries =
+        buildRequests(handle, buffers.data(), peer_buffer_addresses.data(),
+                      lengths.data(), buffers.size(), opcode);
+    Status s = engine_->transferOnStream(
+        entries, (cudaStream_t)stream,
+        [this](const TransferStatus &status) {
+            if (status.s != TransferStatusEnum::COMPLETED)
+                stream_transfer_failures_.fetch_add(
+                    1, std::memory_order_relaxed);
+        });
+    if (!s.ok()) {
+        LOG(ERROR) << "Failed to queue the transfer on the stream: "
+                   << s.ToString();
+        return -1;
+    }
+    return 0;
+#else
+    LOG(ERROR) << "Stream-ordered transfers need a build with USE_CUDA";
+    return -1;
+#endif
+}
+
+namespace {
+
+// Request the buffers of the three descriptor arrays, which must be 1-D,
+// contiguous and of 64-bit integers of the same length. Needs the GIL.
+std::array<pybind11::buffer_info, 3> requestDescriptorArrays(
+    const pybind11::buffer &buffers,
+    const pybind11::buffer &peer_buffer_addresses,
+    const pybind11::buffer &lengths) {
+    std::array<pybind11::buffer_info, 3> infos = {
+        buffers.request(), peer_buffer_addresses.request(), lengths.request()};
+    for (auto &info : infos) {
+        if (info.ndim != 1 || info.itemsize != sizeof(uint64_t) ||
+            (info.format != "q" && info.format != "Q" &&
+             info.format != "l" && info.format != "L"))
+            throw std::runtime_error(
+                "buffers, peer_buffer_addresses and lengths must be 1-D "
+                "int64 or uint64 arrays");
+        if (info.shape[0] > 1 && info.strides[0] != sizeof(uint64_t))
+            throw std::runtime_error(
+                "buffers, peer_buffer_addresses and lengths must be "
+                "contiguous");
+    }
+    if (infos[0].shape[0] != infos[1].shape[0] ||
+        infos[0].shape[0] != infos[2].shape[0])
+        throw std::runtime_error(
+            "buffers, peer_buffer_addresses and lengths have different size");
+    return infos;
+}
+
+}  // namespace
+
+int TransferEnginePy::batchTransferSyncArrays(
+    const char *target_hostname, const pybind11::buffer &buffers,
+    const pybind11::buffer &peer_buffer_addresses,
+    const pybind11::buffer &lengths, TransferOpcode opcode) {
+    auto infos = requestDescriptorArrays(buffers, peer_buffer_addresses,
+                                         lengths);
+    pybind11::gil_scoped_release release;
+    auto handle = getSegmentHandle(target_hostname);
+    if (handle == (Transport::SegmentHandle)-1) return -1;
+    auto entries = buildRequests(
+        handle, static_cast<const uintptr_t *>(infos[0].ptr),
+        static_cast<const uintptr_t *>(infos[1].ptr),
+        static_cast<const size_t *>(infos[2].ptr), infos[0].shape[0], opcode);
+    return submitAndWait(entries, nullptr);
+}
+
+batch_id_t TransferEnginePy::batchTransferAsyncArrays(
+    const char *target_hostname, const pybind11::buffer &buffers,
+    const pybind11::buffer &peer_buffer_addresses,
+    const pybind11::buffer &lengths, TransferOpcode opcode) {
+    auto infos = requestDescriptorArrays(buffers, peer_buffer_addresses,
+                                         lengths);
+    pybind11::gil_scoped_release release;
+    auto handle = getSegmentHandle(target_hostname);
+    if (handle == (Transport::SegmentHandle)-1) return 0;
+    auto entries = buildRequests(
+        handle, static_cast<const uintptr_t *>(infos[0].ptr),
+        static_cast<const uintptr_t *>(infos[1].ptr),
+        static_cast<const size_t *>(infos[2].ptr), infos[0].shape[0], opcode);
+    return submitAsync(entries);
+}
+
+pybind11::array_t<int32_t> TransferEnginePy::batchTransferSyncStatus(
+    const char *target_hostname, const pybind11::buffer &buffers,
+    const pybind11::buffer &peer_buffer_addresses,
+    const pybind11::buffer &lengths, TransferOpcode opcode) {
+    auto infos = requestDescriptorArrays(buffers, peer_buffer_addresses,
+                                         lengths);
+    const size_t count = infos[0].shape[0];
+    pybind11::array_t<int32_t> task_status(count);
+    int32_t *status_data = task_status.mutable_data();
+    std::fill(status_data, status_data + count, TransferStatusEnum::WAITING);
+
+    pybind11::gil_scoped_release release;
+    auto handle = getSegmentHandle(target_hostname);
+    if (handle == (Transport::SegmentHandle)-1) {
+        std::fill(status_data, status_data + count,
+                  TransferStatusEnum::INVALID);
+        return task_status;
+    }
+    auto entries = buildRequests(
+        handle, static_cast<const uintptr_t *>(infos[0].ptr),
+        static_cast<const uintptr_t *>(infos[1].ptr),
+        static_cast<const size_t *>(infos[2].ptr), count, opcode);
+    submitAndWait(entries, status_data);
+    return task_status;
+}
+
 int TransferEnginePy::getBatchTransferStatus(const std::vector<batch_id_t>& batch_ids) {
     pybind11::gil_scoped_release release;
     TransferStatus status;
     std::unordered_map<batch_id_t, int64_t> timeout_table{};
     for (auto &batch_id : batch_ids) {
         int64_t total_length = 0;
-        auto batch_desc = reinterpret_cast<BatchDesc *>(batch_id);
+        auto batch_desc = Transport::getBatchDesc(batch_id);
+        if (!batch_desc) return -1;
         const size_t task_count = batch_desc->task_list.size();
 
         for (size_t task_id = 0; task_id < task_count; task_id++) {
@@ -497,13 +668,14 @@ int TransferEnginePy::getBatchTransferStatus(const std::vector<batch_id_t>& batc
     std::unordered_set<batch_id_t> remove_ids {};
     while (!timeout_table.empty() && !failed_or_timeout) {
         for (auto &entry : timeout_table) {
-            auto batch_desc = reinterpret_cast<BatchDesc *>(entry.first);
+            auto batch_desc = Transport::getBatchDesc(entry.first);
             Status s = engine_->getBatchTransferStatus(entry.first, status);
             LOG_ASSERT(s.ok());
             if (status.s == TransferStatusEnum::COMPLETED) {
                 engine_->freeBatchID(entry.first);
                 LOG(INFO) << "Batch Transfer completed!";
                 remove_ids.insert(entry.first);
+                continue;
             } else if (status.s == TransferStatusEnum::FAILED) {
                 failed_or_timeout = true;
             } else if (status.s == TransferStatusEnum::TIMEOUT) {
@@ -641,6 +813,50 @@ PYBIND11_MODULE(engine, m) {
             .def("free_managed_buffer", &TransferEnginePy::freeManagedBuffer)
             .def("transfer_sync_write", &TransferEnginePy::transferSyncWrite)
             .def("transfer_sync_read", &TransferEnginePy::transferSyncRead)
+            // The array overloads come first, the list ones would accept
+            // numpy arrays too, converting them element by element
+            .def("batch_transfer_sync_write",
+                 [](TransferEnginePy &self, const char *target_hostname,
+                    const py::buffer &buffers,
+                    const py::buffer &peer_buffer_addresses,
+                    const py::buffer &lengths) {
+                     return self.batchTransferSyncArrays(
+                         target_hostname, buffers, peer_buffer_addresses,
+                         lengths, TransferEnginePy::TransferOpcode::WRITE);
+                 })
+            .def("batch_transfer_sync_read",
+                 [](TransferEnginePy &self, const char *target_hostname,
+                    const py::buffer &buffers,
+                    const py::buffer &peer_buffer_addresses,
+                    const py::buffer &lengths) {
+                     return self.batchTransferSyncArrays(
+                         target_hostname, buffers, peer_buffer_addresses,
+                         lengths, TransferEnginePy::TransferOpcode::READ);
+                 })
+            .def("batch_transfer_async_write",
+                 [](TransferEnginePy &self, const char *target_hostname,
+                    const py::buffer &buffers,
+                    const py::buffer &peer_buffer_addresses,
+                    const py::buffer &lengths) {
+                     return self.batchTransferAsyncArrays(
+                         target_hostname, buffers, peer_buffer_addresses,
+                         lengths, TransferEnginePy::TransferOpcode::WRITE);
+                 })
+            .def("batch_transfer_async_read",
+                 [](TransferEnginePy &self, const char *target_hostname,
+                    const py::buffer &buffers,
+                    const py::buffer &peer_buffer_addresses,
+                    const py::buffer &lengths) {
+                     return self.batchTransferAsyncArrays(
+                         target_hostname, buffers, peer_buffer_addresses,
+                         lengths, TransferEnginePy::TransferOpcode::READ);
+                 })
+            .def("batch_transfer_sync",
+                 &TransferEnginePy::batchTransferSyncArrays)
+            .def("batch_transfer_async",
+                 &TransferEnginePy::batchTransferAsyncArrays)
+            .def("batch_transfer_sync_status",
+                 &TransferEnginePy::batchTransferSyncStatus)
             .def("batch_transfer_sync_write", &TransferEnginePy::batchTransferSyncWrite)
             .def("batch_transfer_sync_read", &TransferEnginePy::batchTransferSyncRead)
             .def("batch_transfer_async_write", &TransferEnginePy::batchTransferAsyncWrite)
@@ -649,6 +865,14 @@ PYBIND11_MODULE(engine, m) {
             .def("batch_transfer_sync", &TransferEnginePy::batchTransferSync)
             .def("batch_transfer_async", &TransferEnginePy::batchTransferAsync)
             .def("get_batch_transfer_status", &TransferEnginePy::getBatchTransferStatus)
+            .def("transfer_on_stream_write",
+                 &TransferEnginePy::transferOnStreamWrite)
+            .def("transfer_on_stream_read",
+                 &TransferEnginePy::transferOnStreamRead)
+            .def("batch_transfer_on_stream",
+                 &TransferEnginePy::batchTransferOnStream)
+            .def("get_stream_transfer_failures",
+                 &TransferEnginePy::getStreamTransferFailures)
             .def("transfer_submit_write",
                  &TransferEnginePy::transferSubmitWrite)
             .def("transfer_check_status",
@@ -663,5 +887,16 @@ PYBIND11_MODULE(engine, m) {
             .def("get_first_buffer_address",
                  &TransferEnginePy::getFirstBufferAddress);
 
+    py::enum_<TransferStatusEnum> transfer_status(m, "TransferStatus",
+                                                  py::arithmetic());
+    transfer_status.value("Waiting", TransferStatusEnum::WAITING)
+        .value("Pending", TransferStatusEnum::PENDING)
+        .value("Invalid", TransferStatusEnum::INVALID)
+        .value("Canceled", TransferStatusEnum::CANCELED)
+        .value("Completed", TransferStatusEnum::COMPLETED)
+        .value("Timeout", TransferStatusEnum::TIMEOUT)
+        .value("Failed", TransferStatusEnum::FAILED);
+
     adaptor_cls.attr("TransferOpcode") = transfer_opcode;
+    adaptor_cls.attr("TransferStatus") = transfer_status;
 }
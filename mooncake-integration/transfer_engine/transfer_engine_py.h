@@ -14,9 +14,12 @@
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <sys/time.h>
 
+#include <array>
+#include <atomic>
 #include <cstdlib>
 #include <fstream>
 #include <iomanip>
@@ -112,8 +115,53 @@ class TransferEnginePy {
                           const std::vector<size_t> &lengths,
                           TransferOpcode opcode);
     
+    // Same as batchTransferSync and batchTransferAsync with the descriptors
+    // in numpy (or other buffer protocol) 1-D int64 arrays, read in place
+    // without the GIL
+    int batchTransferSyncArrays(const char *target_hostname,
+                                const pybind11::buffer &buffers,
+                                const pybind11::buffer &peer_buffer_addresses,
+                                const pybind11::buffer &lengths,
+                                TransferOpcode opcode);
+
+    batch_id_t batchTransferAsyncArrays(
+        const char *target_hostname, const pybind11::buffer &buffers,
+        const pybind11::buffer &peer_buffer_addresses,
+        const pybind11::buffer &lengths, TransferOpcode opcode);
+
+    // Returns the TransferStatusEnum of every request, COMPLETED for all of
+    // them on success
+    pybind11::array_t<int32_t> batchTransferSyncStatus(
+        const char *target_hostname, const pybind11::buffer &buffers,
+        const pybind11::buffer &peer_buffer_addresses,
+        const pybind11::buffer &lengths, TransferOpcode opcode);
+
     int getBatchTransferStatus(const std::vector<batch_id_t> &batch_ids);
 
+    // Transfer in the order of a CUDA stream, given by its handle, e.g.
+    // torch.cuda.Stream.cuda_stream: the transfer starts once the work
+    // queued on the stream so far is done, and the work queued after waits
+    // for it. Returns 0 once queued, without blocking on the stream; the
+    // transfers that fail afterwards are only counted by
+    // getStreamTransferFailures. Needs a build with USE_CUDA.
+    int transferOnStreamWrite(const char *target_hostname, uintptr_t buffer,
+                              uintptr_t peer_buffer_address, size_t length,
+                              uintptr_t stream);
+
+    int transferOnStreamRead(const char *target_hostname, uintptr_t buffer,
+                             uintptr_t peer_buffer_address, size_t length,
+                             uintptr_t stream);
+
+    int batchTransferOnStream(const char *target_hostname,
+                              const std::vector<uintptr_t> &buffers,
+                              const std::vector<uintptr_t> &peer_buffer_addresses,
+                              const std::vector<size_t> &lengths,
+                              TransferOpcode opcode, uintptr_t stream);
+
+    uint64_t getStreamTransferFailures() {
+        return stream_transfer_failures_.load(std::memory_order_relaxed);
+    }
+
     uintptr_t getFirstBufferAddress(const std::string &segment_name);
 
     int writeBytesToBuffer(uintptr_t dest_address, char *src_ptr,
@@ -140,6 +188,21 @@ class TransferEnginePy {
     int batchUnregisterMemory(std::vector<uintptr_t> buffer_addresses);
 
    private:
+    Transport::SegmentHandle getSegmentHandle(const char *target_hostname);
+
+    static std::vector<TransferRequest> buildRequests(
+        Transport::SegmentHandle handle, const uintptr_t *buffers,
+        const uintptr_t *peer_buffer_addresses, const size_t *lengths,
+        size_t count, TransferOpcode opcode);
+
+    // Submits the batch, retried on failure, and waits for it. Fills
+    // task_status, if not null, with the status of each request. Must be
+    // called without the GIL.
+    int submitAndWait(const std::vector<TransferRequest> &entries,
+                      int32_t *task_status);
+
+    batch_id_t submitAsync(const std::vector<TransferRequest> &entries);
+
     char *allocateRawBuffer(size_t capacity);
 
     int findClassId(size_t size);
@@ -158,4 +221,7 @@ class TransferEnginePy {
     bool auto_discovery_;
 
     uint64_t transfer_timeout_nsec_;
+    // Counted by the callbacks of the stream-ordered transfers, which stop
+    // with the engine
+    std::atomic<uint64_t> stream_transfer_failures_{0};
 };
@@ -17,9 +17,11 @@ package p2pstore
 import (
 	"context"
 	"log"
+	"math/rand"
 	"net"
 	"strconv"
 	"sync"
+	"time"
 )
 
 // When the data size larger than MAX_CHUNK_SIZE bytes, we split them into multiple buffers and registered separately.
@@ -30,6 +32,13 @@ import (
 const MAX_CHUNK_SIZE uint64 = 4096 * 1024 * 1024
 const METADATA_KEY_PREFIX string = "mooncake/checkpoint/"
 
+// Shards a GetReplica fetches at once, see SetFetchParallelism.
+const DEFAULT_FETCH_PARALLELISM int = 16
+
+// How often a GetReplica in progress lists the shards it has finished as
+// sources for other nodes.
+const PUBLISH_INTERVAL = 100 * time.Millisecond
+
 type P2PStore struct {
 	metadataConnString string
 	localServerName    string
@@ -37,6 +46,12 @@ type P2PStore struct {
 	memory             *RegisteredMemory
 	metadata           *Metadata
 	transfer           *TransferEngine
+	fetchParallelism   int
+
+	// Transfers in progress from each segment, to spread the shards over
+	// the least loaded holders
+	loadMu     sync.Mutex
+	sourceLoad map[string]int
 }
 
 const DEFAULT_PORT int = 12345
@@ -84,10 +99,21 @@ func NewP2PStore(metadataConnString string, localServerName string, nicPriorityM
 		memory:             NewRegisteredMemory(transfer, MAX_CHUNK_SIZE),
 		metadata:           metadata,
 		transfer:           transfer,
+		fetchParallelism:   DEFAULT_FETCH_PARALLELISM,
+		sourceLoad:         make(map[string]int),
 	}
 	return store, nil
 }
 
+// Sets how many shards GetReplica fetches at once, to be called before it.
+func (store *P2PStore) SetFetchParallelism(parallelism int) error {
+	if parallelism <= 0 {
+		return ErrInvalidArgument
+	}
+	store.fetchParallelism = parallelism
+	return nil
+}
+
 func (store *P2PStore) Close() error {
 	var retErr error = nil
 	store.transfer.Close()
@@ -246,48 +272,260 @@ func (store *P2PStore) List(ctx context.Context, namePrefix string) ([]PayloadIn
 	return result, nil
 }
 
-func (store *P2PStore) doGetReplica(ctx context.Context, payload *Payload, addrList []uintptr, sizeList []uint64) error {
-	var wg sync.WaitGroup
-	errChan := make(chan error, 1)
+// The locations of the shards of a payload in local buffers
+func (store *P2PStore) localLocations(addrList []uintptr, sizeList []uint64, maxShardSize uint64) []Location {
+	var locations []Location
+	for i := 0; i < len(addrList); i++ {
+		addr, size := addrList[i], sizeList[i]
+		for offset := uint64(0); offset < size; offset += maxShardSize {
+			locations = append(locations, Location{
+				SegmentName: store.localServerName,
+				Offset:      uint64(addr) + offset,
+			})
+		}
+	}
+	return locations
+}
 
-	var offset uint64 = 0
-	taskID := 0
-	maxShardSize := payload.MaxShardSize
+// The holders of each shard, as last read from the metadata
+type shardHolders struct {
+	mu     sync.Mutex
+	shards []Shard
+}
+
+func (holders *shardHolders) get(index int) Shard {
+	holders.mu.Lock()
+	defer holders.mu.Unlock()
+	return holders.shards[index]
+}
 
+func (holders *shardHolders) update(payload *Payload) {
+	holders.mu.Lock()
+	defer holders.mu.Unlock()
+	if len(payload.Shards) == len(holders.shards) {
+		holders.shards = payload.Shards
+	}
+}
+
+func (store *P2PStore) doGetReplica(ctx context.Context, name string, payload *Payload, addrList []uintptr, sizeList []uint64) error {
+	maxShardSize := payload.MaxShardSize
 	for i := 0; i < len(addrList); i++ {
-		addr, size := addrList[i], sizeList[i]
-		err := store.memory.Add(addr, size, maxShardSize, "cpu:0")
+		err := store.memory.Add(addrList[i], sizeList[i], maxShardSize, "cpu:0")
 		if err != nil {
 			return err
 		}
-		for ; offset < size; offset += maxShardSize {
-			source := addr + uintptr(offset)
-			shard := payload.Shards[taskID]
-			taskID++
-			wg.Add(1)
-			go func() {
-				defer wg.Done()
-				err = store.performTransfer(ctx, source, shard)
+	}
+	locations := store.localLocations(addrList, sizeList, maxShardSize)
+	if len(locations) != len(payload.Shards) {
+		return ErrInvalidArgument
+	}
+
+	ctx, cancel := context.WithCancel(ctx)
+	defer cancel()
+	holders := &shardHolders{shards: payload.Shards}
+	done := make(chan int, len(locations))
+	published := make(chan struct{})
+	go func() {
+		store.publishShards(ctx, name, locations, done, holders)
+		close(published)
+	}()
+
+	var wg sync.WaitGroup
+	errChan := make(chan error, 1)
+	indices := make(chan int)
+	for i := 0; i < store.fetchParallelism; i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			for index := range indices {
+				err := store.fetchShard(ctx, holders, index, uintptr(locations[index].Offset))
 				if err != nil {
 					select {
 					case errChan <- err:
 					default:
 					}
+					cancel()
+					return
 				}
-			}()
+				done <- index
+			}
+		}()
+	}
+	// In a random order, so that the nodes fetching the payload start from
+	// different shards and soon serve each other
+feed:
+	for _, index := range rand.Perm(len(locations)) {
+		select {
+		case indices <- index:
+		case <-ctx.Done():
+			break feed
 		}
 	}
-
+	close(indices)
 	wg.Wait()
+	close(done)
+	<-published
+
 	close(errChan)
-	select {
-	case err := <-errChan:
+	if err := <-errChan; err != nil {
+		return err
+	}
+	return ctx.Err()
+}
+
+// Fetches a shard from its least loaded holder, trying the others in turn
+// when a transfer fails.
+func (store *P2PStore) fetchShard(ctx context.Context, holders *shardHolders, index int, destination uintptr) error {
+	tried := make(map[Location]bool)
+	for {
+		shard := holders.get(index)
+		location := store.pickSource(&shard, tried)
+		if location == nil {
+			return ErrTooManyRetries
+		}
+		tried[*location] = true
+		completed, err := store.performTransfer(ctx, destination, *location, shard.Length, len(tried) == 1)
+		store.releaseSource(location)
 		if err != nil {
 			return err
 		}
-	default:
+		if completed {
+			return nil
+		}
+	}
+}
+
+// The holder of the shard with the fewest transfers from this node, at
+// random among equals. The owners of the payload count as busier, so that
+// once replicas appear they take the load off them.
+func (store *P2PStore) pickSource(shard *Shard, tried map[Location]bool) *Location {
+	store.loadMu.Lock()
+	defer store.loadMu.Unlock()
+	var best []Location
+	bestLoad := 0
+	consider := func(location Location, penalty int) {
+		if tried[location] || location.SegmentName == store.localServerName {
+			return
+		}
+		load := 2*store.sourceLoad[location.SegmentName] + penalty
+		if len(best) == 0 || load < bestLoad {
+			best = append(best[:0], location)
+			bestLoad = load
+		} else if load == bestLoad {
+			best = append(best, location)
+		}
+	}
+	for _, location := range shard.ReplicaList {
+		consider(location, 0)
+	}
+	for _, location := range shard.Gold {
+		consider(location, 1)
+	}
+	if len(best) == 0 {
+		return nil
+	}
+	location := best[rand.Intn(len(best))]
+	store.sourceLoad[location.SegmentName]++
+	return &location
+}
+
+func (store *P2PStore) releaseSource(location *Location) {
+	store.loadMu.Lock()
+	defer store.loadMu.Unlock()
+	store.sourceLoad[location.SegmentName]--
+	if store.sourceLoad[location.SegmentName] == 0 {
+		delete(store.sourceLoad, location.SegmentName)
+	}
+}
+
+// Lists this node as a holder of the shards received on done, every
+// PUBLISH_INTERVAL, and refreshes holders with the metadata read meanwhile.
+func (store *P2PStore) publishShards(ctx context.Context, name string, locations []Location, done <-chan int, holders *shardHolders) {
+	ticker := time.NewTicker(PUBLISH_INTERVAL)
+	defer ticker.Stop()
+	var pending []int
+	for {
+		select {
+		case index, ok := <-done:
+			if !ok {
+				// The rest is listed by updatePayloadMetadata
+				return
+			}
+			pending = append(pending, index)
+		case <-ticker.C:
+			if len(pending) == 0 {
+				continue
+			}
+			err := store.addHolders(ctx, name, locations, pending, holders)
+			if err != nil {
+				log.Println("failed to publish shards:", err)
+				continue
+			}
+			pending = nil
+		}
+	}
+}
+
+// Adds the local locations of the shards of indices to the metadata.
+func (store *P2PStore) addHolders(ctx context.Context, name string, locations []Location, indices []int, holders *shardHolders) error {
+	for {
+		payload, revision, err := store.metadata.Get(ctx, name)
+		if err != nil {
+			return err
+		}
+		if payload == nil {
+			return ErrPayloadNotFound
+		}
+		if len(payload.Shards) != len(locations) {
+			return ErrInvalidArgument
+		}
+		for _, index := range indices {
+			shard := &payload.Shards[index]
+			if !contains(shard.ReplicaList, locations[index]) {
+				shard.ReplicaList = append(shard.ReplicaList, locations[index])
+			}
+		}
+		success, err := store.metadata.Update(ctx, name, payload, revision)
+		if err != nil {
+			return err
+		}
+		if success {
+			if holders != nil {
+				holders.update(payload)
+			}
+			return nil
+		}
+	}
+}
+
+// Removes the local locations of all shards from the metadata.
+func (store *P2PStore) removeHolders(ctx context.Context, name string) error {
+	for {
+		payload, revision, err := store.metadata.Get(ctx, name)
+		if err != nil {
+			return err
+		}
+		if payload == nil {
+			return ErrPayloadNotFound
+		}
+
+		for idx, shard := range payload.Shards {
+			var newReplicaList []Location
+			for _, replica := range shard.ReplicaList {
+				if replica.SegmentName != store.localServerName {
+					newReplicaList = append(newReplicaList, replica)
+				}
+			}
+			payload.Shards[idx].ReplicaList = newReplicaList
+		}
+		success, err := store.metadata.Update(ctx, name, payload, revision)
+		if err != nil {
+			return err
+		}
+		if success {
+			return nil
+		}
 	}
-	return nil
 }
 
 func contains(slice []Location, value Location) bool {
@@ -335,125 +573,93 @@ func (store *P2PStore) GetReplica(ctx context.Context, name string, addrList []u
 		return ErrPayloadNotFound
 	}
 	for {
-		err = store.doGetReplica(ctx, payload, addrList, sizeList)
+		err = store.doGetReplica(ctx, name, payload, addrList, sizeList)
 		if err != nil {
+			// Shards published so far must not be served from buffers the
+			// caller takes back
+			innerErr := store.removeHolders(context.WithoutCancel(ctx), name)
+			if innerErr != nil {
+				log.Println("cascading error:", innerErr)
+			}
 			return err
 		}
 		newPayload, recheckRevision, err := store.metadata.Get(ctx, name)
 		if err != nil {
 			return err
 		}
+		if newPayload == nil {
+			return ErrPayloadNotFound
+		}
 		if revision == recheckRevision {
 			break
 		}
 		if isSubsetOf(payload, newPayload) {
 			break
 		}
+		payload, revision = newPayload, recheckRevision
 	}
-	return store.updatePayloadMetadata(ctx, name, addrList, sizeList, payload, revision)
+	return store.updatePayloadMetadata(ctx, name, addrList, sizeList, payload.MaxShardSize)
 }
 
-func (store *P2PStore) performTransfer(ctx context.Context, source uintptr, shard Shard) error {
-	retryCount := 0
-	maxRetryCount := max(3, shard.Count())
-	for retryCount < maxRetryCount {
-		batchID, err := store.transfer.allocateBatchID(1)
-		if err != nil {
-			return err
-		}
-
-		location := shard.GetLocation(retryCount)
-		if location == nil {
-			break
-		}
-
-		targetID, err := store.transfer.openSegment(location.SegmentName, retryCount == 0)
-		if err != nil {
-			return err
-		}
-
-		request := TransferRequest{
-			Opcode:       OPCODE_READ,
-			Source:       uint64(source),
-			TargetID:     targetID,
-			TargetOffset: location.Offset,
-			Length:       shard.Length,
-		}
-
-		err = store.transfer.submitTransfer(batchID, []TransferRequest{request})
-		if err != nil {
-			return err
-		}
+// Attempts to read a shard from location once, reporting whether the
+// transfer completed.
+func (store *P2PStore) performTransfer(ctx context.Context, destination uintptr, location Location, length uint64, useCache bool) (bool, error) {
+	batchID, err := store.transfer.allocateBatchID(1)
+	if err != nil {
+		return false, err
+	}
 
-		var status int
-		for status == STATUS_WAITING || status == STATUS_PENDING {
-			select {
-			case <-ctx.Done():
-				return ctx.Err()
-			default:
-				status, _, err = store.transfer.getTransferStatus(batchID, 0)
-				if err != nil {
-					return err
-				}
-			}
-		}
+	targetID, err := store.transfer.openSegment(location.SegmentName, useCache)
+	if err != nil {
+		store.transfer.freeBatchID(batchID)
+		return false, err
+	}
 
-		err = store.transfer.freeBatchID(batchID)
-		if err != nil {
-			return err
-		}
+	request := TransferRequest{
+		Opcode:       OPCODE_READ,
+		Source:       uint64(destination),
+		TargetID:     targetID,
+		TargetOffset: location.Offset,
+		Length:       length,
+	}
 
-		if status == STATUS_COMPLETED {
-			return nil
-		}
+	err = store.transfer.submitTransfer(batchID, []TransferRequest{request})
+	if err != nil {
+		store.transfer.freeBatchID(batchID)
+		return false, err
+	}
 
-		retryCount++
+	status, err := store.transfer.waitBatch(ctx, batchID)
+	if err != nil {
+		store.transfer.freeBatchID(batchID)
+		return false, err
 	}
 
-	return ErrTooManyRetries
+	err = store.transfer.freeBatchID(batchID)
+	if err != nil {
+		return false, err
+	}
+	return status == STATUS_COMPLETED, nil
 }
 
-func (store *P2PStore) updatePayloadMetadata(ctx context.Context, name string, addrList []uintptr, sizeList []uint64, payload *Payload, revision int64) error {
-	for {
-		taskID := 0
-		maxShardSize := payload.MaxShardSize
-		for i := 0; i < len(addrList); i++ {
-			addr, size := addrList[i], sizeList[i]
-			var offset uint64 = 0
-			for ; offset < size; offset += maxShardSize {
-				replicaLocation := Location{
-					SegmentName: store.localServerName,
-					Offset:      uint64(addr) + offset,
-				}
-				payload.Shards[taskID].ReplicaList = append(payload.Shards[taskID].ReplicaList, replicaLocation)
-				taskID++
-			}
-		}
-
-		success, err := store.metadata.Update(ctx, name, payload, revision)
-		if err != nil {
-			return err
-		}
-		if success {
-			params := CatalogParams{
-				IsGold:       false,
-				AddrList:     addrList,
-				SizeList:     sizeList,
-				MaxShardSize: maxShardSize,
-			}
-			store.catalog.Add(name, params)
-			return nil
-		} else {
-			payload, revision, err = store.metadata.Get(ctx, name)
-			if err != nil {
-				return err
-			}
-
-			if payload == nil {
-				return ErrPayloadNotFound
-			}
-		}
+func (store *P2PStore) updatePayloadMetadata(ctx context.Context, name string, addrList []uintptr, sizeList []uint64, maxShardSize uint64) error {
+	locations := store.localLocations(addrList, sizeList, maxShardSize)
+	indices := make([]int, len(locations))
+	for i := range indices {
+		indices[i] = i
+	}
+	err := store.addHolders(ctx, name, locations, indices, nil)
+	if err != nil {
+		return err
 	}
+	params := CatalogParams{
+		IsGold:       false,
+		AddrList:     addrList,
+		SizeList:     sizeList,
+		MaxShardSize: maxShardSize,
+	}
+	store.catalog.Add(name, params)
+	return nil
 }
 
 func (store *P2PStore) DeleteReplica(ctx context.Context, name string) error {
@@ -462,37 +668,16 @@ func (store *P2PStore) DeleteReplica(ctx context.Context, name string) error {
 		return ErrPayloadNotOpened
 	}
 
-	for {
-		payload, revision, err := store.metadata.Get(ctx, name)
-		if err != nil {
-			return err
-		}
-		if payload == nil {
-			return ErrPayloadNotFound
-		}
-
-		for idx, shard := range payload.Shards {
-			var newReplicaList []Location
-			for _, replica := range shard.ReplicaList {
-				if replica.SegmentName != store.localServerName {
-					newReplicaList = append(newReplicaList, replica)
-				}
-			}
-			payload.Shards[idx].ReplicaList = newReplicaList
-		}
-		success, err := store.metadata.Update(ctx, name, payload, revision)
-		if err != nil {
-			return err
-		}
-		if success {
-			store.catalog.Remove(name)
-			for index := 0; index < len(params.AddrList); index++ {
-				innerErr := store.memory.Remove(params.AddrList[index], params.SizeList[index], params.MaxShardSize)
-				if innerErr != nil {
-					log.Println("cascading error:", innerErr)
-				}
-			}
-			return nil
+	err := store.removeHolders(ctx, name)
+	if err != nil {
+		return err
+	}
+	store.catalog.Remove(name)
+	for index := 0; index < len(params.AddrList); index++ {
+		innerErr := store.memory.Remove(params.AddrList[index], params.SizeList[index], params.MaxShardSize)
+		if innerErr != nil {
+			log.Println("cascading error:", innerErr)
 		}
 	}
+	return nil
 }
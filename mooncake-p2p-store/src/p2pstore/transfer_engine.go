@@ -25,7 +25,13 @@ package p2pstore
 //#include "../../../mooncake-transfer-engine/include/transfer_engine_c.h"
 //#include <stdlib.h>
 import "C"
-import "unsafe"
+import (
+	"context"
+	"os"
+	"syscall"
+	"time"
+	"unsafe"
+)
 
 type BatchID int64
 
@@ -155,6 +161,46 @@ func (engine *TransferEngine) getTransferStatus(batchID BatchID, taskID int) (in
 	return int(status.status), uint64(status.transferred_bytes), nil
 }
 
+func (engine *TransferEngine) getBatchTransferStatus(batchID BatchID) (int, uint64, error) {
+	var status C.transfer_status_t
+	ret := C.getBatchTransferStatus(engine.engine, C.batch_id_t(batchID), &status)
+	if ret != 0 {
+		return -1, 0, ErrTransferEngine
+	}
+	return int(status.status), uint64(status.transferred_bytes), nil
+}
+
+// Parks the goroutine on the netpoller until the batch is done, then returns
+// its status. To be called after the last submitTransfer of the batch.
+func (engine *TransferEngine) waitBatch(ctx context.Context, batchID BatchID) (int, error) {
+	var fd C.int
+	ret := C.getBatchEventFd(engine.engine, C.batch_id_t(batchID), &fd)
+	if ret != 0 {
+		return -1, ErrTransferEngine
+	}
+	// The engine closes its eventfd in freeBatchID, the copy is ours
+	dupFd, err := syscall.Dup(int(fd))
+	if err != nil {
+		return -1, err
+	}
+	file := os.NewFile(uintptr(dupFd), "batch")
+	defer file.Close()
+	stop := context.AfterFunc(ctx, func() {
+		file.SetReadDeadline(time.Now())
+	})
+	defer stop()
+
+	var count [8]byte
+	if _, err := file.Read(count[:]); err != nil {
+		if ctx.Err() != nil {
+			return -1, ctx.Err()
+		}
+		return -1, err
+	}
+	status, _, err := engine.getBatchTransferStatus(batchID)
+	return status, err
+}
+
 func (engine *TransferEngine) freeBatchID(batchID BatchID) error {
 	ret := C.freeBatchID(engine.engine, C.batch_id_t(batchID))
 	if ret != 0 {
@@ -3,9 +3,14 @@
 #include <vector>
 #include <chrono>
 #include <algorithm>
+#include <cmath>
 #include <numeric>
 #include <iomanip>
+#include <memory>
+#include <string>
+#include <unordered_map>
 
+#include "allocation_strategy.h"
 #include "offset_allocator/offset_allocator.hpp"
 
 using namespace mooncake::offset_allocator;
@@ -172,8 +177,183 @@ void random_size_allocation_benchmark() {
     std::cout << "avg alloc time: " << avg_time_ns << " ns/op" << std::endl;
 }
 
+// Fill a 64-segment cluster with random sized slices through an allocation
+// strategy and report how evenly the segments fill up, how full the cluster
+// is when the first allocation fails (which is when eviction would start),
+// and the allocation latency. A few segments are marked hot by reporting
+// read traffic on them, the load-aware strategy should steer writes away.
+void allocation_strategy_benchmark(const std::string& name,
+                                   mooncake::AllocationStrategy& strategy) {
+    constexpr int kNumSegments = 64;
+    constexpr int kNumHotSegments = 8;
+    constexpr size_t kSegmentSize = 256ull * 1024 * 1024;
+    // KV cache slices come in a few fixed sizes
+    const std::vector<size_t> kSliceSizes = {256 * 1024, 512 * 1024,
+                                             1024 * 1024, 2 * 1024 * 1024};
+
+    // Declared before the allocators so they are torn down first and the
+    // buffers do not return their slices one by one
+    std::vector<std::unique_ptr<mooncake::AllocatedBuffer>> buffers;
+    std::vector<std::shared_ptr<mooncake::BufferAllocator>> allocators;
+    std::unordered_map<std::string,
+                       std::vector<std::shared_ptr<mooncake::BufferAllocator>>>
+        allocators_by_name;
+    for (int i = 0; i < kNumSegments; ++i) {
+        auto allocator = std::make_shared<mooncake::BufferAllocator>(
+            "segment" + std::to_string(i), 0x100000000ULL + i * kSegmentSize,
+            kSegmentSize);
+        allocators_by_name[allocator->getSegmentName()].push_back(allocator);
+        allocators.push_back(allocator);
+    }
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<size_t> size_dist(0, kSliceSizes.size() - 1);
+    std::uniform_int_distribution<int> hot_dist(0, kNumHotSegments - 1);
+    mooncake::ReplicateConfig config;
+    const size_t total = kNumSegments * kSegmentSize;
+    size_t allocated = 0;
+    size_t hot_allocations = 0;
+    std::chrono::nanoseconds alloc_time{0};
+
+    while (true) {
+        strategy.RecordTransfer("segment" + std::to_string(hot_dist(gen)),
+                                kSliceSizes.back());
+        const size_t size = kSliceSizes[size_dist(gen)];
+        auto start_time = std::chrono::high_resolution_clock::now();
+        auto buffer =
+            strategy.Allocate(allocators, allocators_by_name, size, config);
+        alloc_time += std::chrono::high_resolution_clock::now() - start_time;
+        if (!buffer) {
+            break;
+        }
+        const auto& segment = buffer->get_descriptor().segment_name_;
+        if (std::stoi(segment.substr(7)) < kNumHotSegments) {
+            ++hot_allocations;
+        }
+        allocated += size;
+        buffers.push_back(std::move(buffer));
+    }
+
+    std::vector<double> utils;
+    for (const auto& allocator : allocators) {
+        utils.push_back(static_cast<double>(allocator->size()) /
+                        allocator->capacity());
+    }
+    std::sort(utils.begin(), utils.end());
+    const double mean =
+        std::accumulate(utils.begin(), utils.end(), 0.0) / utils.size();
+    double variance = 0;
+    for (double util : utils) {
+        variance += (util - mean) * (util - mean);
+    }
+    const double stddev = std::sqrt(variance / utils.size());
+
+    std::cout << std::fixed << std::setprecision(4);
+    std::cout << std::left << std::setw(10) << name << std::right
+              << " fill at first failure: "
+              << static_cast<double>(allocated) / total
+              << ", segment util (min / max / stddev): " << utils.front()
+              << " / " << utils.back() << " / " << stddev
+              << ", hot segment share: "
+              << static_cast<double>(hot_allocations) / buffers.size()
+              << ", avg alloc time: "
+              << alloc_time.count() / static_cast<double>(buffers.size() + 1)
+              << " ns/op" << std::endl;
+}
+
+// Compare the segment allocators of the master on KV cache objects, whose
+// size is the sequence length times the bytes per token. Sequence lengths
+// follow a log-normal distribution, so sizes vary continuously instead of
+// falling into a few classes. The segment is filled until the first
+// failure, then objects are replaced at random, evicting random ones when
+// an allocation fails, and the utilization and latency are measured.
+void buffer_allocator_benchmark(const std::string& name,
+                                mooncake::BufferAllocatorType type) {
+    constexpr size_t kSegmentSize = 4ull * 1024 * 1024 * 1024;
+    // e.g. a layer of a 7B model in fp16
+    constexpr size_t kBytesPerToken = 16 * 1024;
+    constexpr int kBenchmarkNum = 200000;
+
+    std::vector<std::unique_ptr<mooncake::AllocatedBuffer>> buffers;
+    auto allocator = std::make_shared<mooncake::BufferAllocator>(
+        "segment", 0x100000000ULL, kSegmentSize,
+        mooncake::SegmentTopology{}, type);
+
+    std::mt19937 gen(42);
+    std::lognormal_distribution<double> tokens_dist(6.0, 1.0);
+    auto next_size = [&]() {
+        const double tokens = std::clamp(tokens_dist(gen), 16.0, 16384.0);
+        return static_cast<size_t>(tokens) * kBytesPerToken;
+    };
+
+    while (true) {
+        auto buffer = allocator->allocate(next_size());
+        if (!buffer) {
+            break;
+        }
+        buffers.push_back(std::move(buffer));
+    }
+    const double fill_ratio =
+        static_cast<double>(allocator->size()) / allocator->capacity();
+
+    double total_util_ratio = 0.0;
+    double min_util_ratio = 1.0;
+    size_t failures = 0;
+    std::chrono::nanoseconds alloc_time{0};
+    for (int i = 0; i < kBenchmarkNum; i++) {
+        const size_t size = next_size();
+        while (true) {
+            auto start_time = std::chrono::high_resolution_clock::now();
+            auto buffer = allocator->allocate(size);
+            alloc_time += std::chrono::high_resolution_clock::now() -
+                          start_time;
+            if (buffer) {
+                buffers.push_back(std::move(buffer));
+                break;
+            }
+            ++failures;
+            if (buffers.empty()) {
+                break;
+            }
+            std::uniform_int_distribution<size_t> dist(0, buffers.size() - 1);
+            std::swap(buffers[dist(gen)], buffers.back());
+            buffers.pop_back();
+        }
+        const double util_ratio =
+            static_cast<double>(allocator->size()) / allocator->capacity();
+        min_util_ratio = std::min(min_util_ratio, util_ratio);
+        total_util_ratio += util_ratio;
+    }
+    buffers.clear();
+
+    std::cout << std::fixed << std::setprecision(4);
+    std::cout << std::left << std::setw(10) << name << std::right
+              << " fill at first failure: " << fill_ratio
+              << ", util ratio (min / avg): " << min_util_ratio << " / "
+              << total_util_ratio / kBenchmarkNum
+              << ", failed allocs: " << failures << ", avg alloc time: "
+              << alloc_time.count() /
+                     static_cast<double>(kBenchmarkNum + failures)
+              << " ns/op" << std::endl;
+}
+
 int main() {
     std::cout << "=== OffsetAllocator Benchmark ===" << std::endl;
     uniform_size_allocation_benchmark<OffsetAllocatorBenchHelper>();
     random_size_allocation_benchmark<OffsetAllocatorBenchHelper>();
+
+    std::cout << std::endl
+              << "=== Allocation Strategy Benchmark ===" << std::endl;
+    mooncake::RandomAllocationStrategy random_strategy;
+    allocation_strategy_benchmark("random", random_strategy);
+    mooncake::CapacityAwareAllocationStrategy capacity_strategy;
+    allocation_strategy_benchmark("capacity", capacity_strategy);
+    mooncake::LoadAwareAllocationStrategy load_strategy;
+    allocation_strategy_benchmark("load", load_strategy);
+
+    std::cout << std::endl
+              << "=== Buffer Allocator Benchmark ===" << std::endl;
+    buffer_allocator_benchmark("cachelib",
+                               mooncake::BufferAllocatorType::CACHELIB);
+    buffer_allocator_benchmark("offset", mooncake::BufferAllocatorType::OFFSET);
 }
\ No newline at end of file
@@ -0,0 +1,324 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "eviction_strategy.h"
+
+// Replays the block accesses of Mooncake traces (FAST25-release/traces/*.jsonl,
+// one request per line with a "hash_ids" array of prefix cache blocks)
+// against the eviction policies, with the cache capacity set to a fraction of
+// the distinct blocks. Reports the hit ratio and the CPU time per eviction.
+//
+// The hint_N rows replay the ranking of the batch scan eviction with next
+// use hints (see MasterService::BatchTouch), as if a scheduler knew the
+// next N requests of the trace: a block gets a hint once a queued request
+// reads it again, and blocks without one are ranked by recency.
+//
+// Usage: eviction_policy_bench trace.jsonl [trace.jsonl ...]
+
+namespace {
+
+using mooncake::EvictionEngine;
+using mooncake::EvictionPolicy;
+
+// Extract the hash_ids of every request without a JSON dependency, and the
+// index of the first block of each request
+std::vector<uint64_t> LoadTrace(const std::string& path,
+                                std::vector<size_t>& request_starts) {
+    std::vector<uint64_t> blocks;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        auto pos = line.find("\"hash_ids\"");
+        if (pos == std::string::npos) {
+            continue;
+        }
+        pos = line.find('[', pos);
+        const auto end = line.find(']', pos);
+        if (pos == std::string::npos || end == std::string::npos) {
+            continue;
+        }
+        request_starts.push_back(blocks.size());
+        const char* p = line.data() + pos + 1;
+        const char* last = line.data() + end;
+        while (p < last) {
+            char* next = nullptr;
+            uint64_t id = std::strtoull(p, &next, 10);
+            if (next == p) {
+                ++p;
+                continue;
+            }
+            blocks.push_back(id);
+            p = next;
+        }
+    }
+    return blocks;
+}
+
+struct ReplayResult {
+    double hit_ratio = 0;
+    size_t evictions = 0;
+    double ns_per_eviction = 0;
+};
+
+ReplayResult ReplayPolicy(EvictionEngine engine,
+                          const std::vector<uint64_t>& blocks,
+                          size_t capacity) {
+    auto policy = mooncake::CreateEvictionPolicy(engine);
+    std::unordered_map<uint64_t, EvictionPolicy::Handle> cache;
+    std::vector<uint64_t> block_of;  // handle -> block id
+    std::vector<EvictionPolicy::Handle> free_handles;
+    cache.reserve(capacity * 2);
+
+    size_t hits = 0;
+    size_t evictions = 0;
+    std::chrono::steady_clock::duration evict_time{};
+    auto always = [](EvictionPolicy::Handle) { return true; };
+
+    for (uint64_t block : blocks) {
+        auto it = cache.find(block);
+        if (it != cache.end()) {
+            policy->OnAccess(it->second);
+            ++hits;
+            continue;
+        }
+        if (cache.size() >= capacity) {
+            auto start = std::chrono::steady_clock::now();
+            size_t budget = SIZE_MAX;
+            auto victim = policy->Evict(always, budget);
+            policy->OnRemove(*victim);
+            evict_time += std::chrono::steady_clock::now() - start;
+            cache.erase(block_of[*victim]);
+            free_handles.push_back(*victim);
+            ++evictions;
+        }
+        EvictionPolicy::Handle handle;
+        if (!free_handles.empty()) {
+            handle = free_handles.back();
+            free_handles.pop_back();
+            block_of[handle] = block;
+        } else {
+            handle = static_cast<EvictionPolicy::Handle>(block_of.size());
+            block_of.push_back(block);
+        }
+        policy->OnInsert(handle, block * 0x9E3779B97F4A7C15ULL);
+        cache.emplace(block, handle);
+    }
+
+    ReplayResult result;
+    result.hit_ratio = blocks.empty() ? 0 : double(hits) / blocks.size();
+    result.evictions = evictions;
+    result.ns_per_eviction =
+        evictions ? std::chrono::duration<double, std::nano>(evict_time)
+                            .count() /
+                        evictions
+                  : 0;
+    return result;
+}
+
+// Baseline: the string based LRUEvictionStrategy
+ReplayResult ReplayLru(const std::vector<uint64_t>& blocks, size_t capacity) {
+    mooncake::LRUEvictionStrategy lru;
+    std::unordered_set<uint64_t> cache;
+    size_t hits = 0;
+    size_t evictions = 0;
+    std::chrono::steady_clock::duration evict_time{};
+    for (uint64_t block : blocks) {
+        const std::string key = std::to_string(block);
+        if (cache.count(block)) {
+            lru.UpdateKey(key);
+            ++hits;
+            continue;
+        }
+        if (cache.size() >= capacity) {
+            auto start = std::chrono::steady_clock::now();
+            std::string victim = lru.EvictKey();
+            evict_time += std::chrono::steady_clock::now() - start;
+            cache.erase(std::stoull(victim));
+            ++evictions;
+        }
+        lru.AddKey(key);
+        cache.insert(block);
+    }
+    ReplayResult result;
+    result.hit_ratio = blocks.empty() ? 0 : double(hits) / blocks.size();
+    result.evictions = evictions;
+    result.ns_per_eviction =
+        evictions ? std::chrono::duration<double, std::nano>(evict_time)
+                            .count() /
+                        evictions
+                  : 0;
+    return result;
+}
+
+// Time is the index of the access. A hinted block ranks now - (next - now),
+// an unhinted one its last access, and the smallest rank is evicted, as
+// ObjectMetadata::EvictionRank does.
+ReplayResult ReplayHinted(const std::vector<uint64_t>& blocks,
+                          size_t capacity, size_t lookahead_requests,
+                          const std::vector<size_t>& request_starts) {
+    constexpr size_t kNone = SIZE_MAX;
+    // Index of the next access of the same block, kNone if there is none
+    std::vector<size_t> next_access(blocks.size(), kNone);
+    {
+        std::unordered_map<uint64_t, size_t> seen;
+        for (size_t i = blocks.size(); i-- > 0;) {
+            auto it = seen.find(blocks[i]);
+            if (it != seen.end()) {
+                next_access[i] = it->second;
+            }
+            seen[blocks[i]] = i;
+        }
+    }
+    struct Entry {
+        size_t last_access;
+        size_t next_use;  // kNone while unhinted
+    };
+    std::unordered_map<uint64_t, Entry> cache;
+    cache.reserve(capacity * 2);
+    std::set<std::pair<size_t, uint64_t>> unhinted;  // by last access
+    std::set<std::pair<size_t, uint64_t>> hinted;    // by next use
+    auto hint = [&](uint64_t block, size_t next_use) {
+        auto it = cache.find(block);
+        if (it == cache.end() || it->second.next_use != kNone) {
+            return;
+        }
+        unhinted.erase({it->second.last_access, block});
+        it->second.next_use = next_use;
+        hinted.insert({next_use, block});
+    };
+
+    size_t hits = 0;
+    size_t evictions = 0;
+    std::chrono::steady_clock::duration evict_time{};
+    size_t request = 0;
+    // Accesses before this index are known to the scheduler
+    size_t known = 0;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        while (request < request_starts.size() &&
+               request_starts[request] <= i) {
+            ++request;
+            const size_t end =
+                request + lookahead_requests < request_starts.size()
+                    ? request_starts[request + lookahead_requests]
+                    : blocks.size();
+            // A queued request hints the blocks it reads
+            for (; known < end; ++known) {
+                hint(blocks[known], known);
+            }
+        }
+        const uint64_t block = blocks[i];
+        auto it = cache.find(block);
+        if (it != cache.end()) {
+            ++hits;
+            if (it->second.next_use != kNone) {
+                hinted.erase({it->second.next_use, block});
+            } else {
+                unhinted.erase({it->second.last_access, block});
+            }
+        } else {
+            if (cache.size() >= capacity) {
+                auto start = std::chrono::steady_clock::now();
+                uint64_t victim;
+                // Rank of the farthest hint against the oldest access, in
+                // the same time scale
+                if (unhinted.empty() ||
+                    (!hinted.empty() &&
+                     2 * i < hinted.rbegin()->first +
+                                 unhinted.begin()->first)) {
+                    victim = hinted.rbegin()->second;
+                    hinted.erase(std::prev(hinted.end()));
+                } else {
+                    victim = unhinted.begin()->second;
+                    unhinted.erase(unhinted.begin());
+                }
+                cache.erase(victim);
+                evict_time += std::chrono::steady_clock::now() - start;
+                ++evictions;
+            }
+            it = cache.emplace(block, Entry{}).first;
+        }
+        it->second.last_access = i;
+        it->second.next_use = kNone;
+        if (next_access[i] < known) {
+            it->second.next_use = next_access[i];
+            hinted.insert({next_access[i], block});
+        } else {
+            unhinted.insert({i, block});
+        }
+    }
+
+    ReplayResult result;
+    result.hit_ratio = blocks.empty() ? 0 : double(hits) / blocks.size();
+    result.evictions = evictions;
+    result.ns_per_eviction =
+        evictions ? std::chrono::duration<double, std::nano>(evict_time)
+                            .count() /
+                        evictions
+                  : 0;
+    return result;
+}
+
+void PrintRow(const std::string& name, const ReplayResult& result) {
+    std::cout << "  " << std::left << std::setw(12) << name << std::right
+              << std::fixed << std::setprecision(4) << std::setw(12)
+              << result.hit_ratio << std::setw(14) << result.evictions
+              << std::setprecision(1) << std::setw(16)
+              << result.ns_per_eviction << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " trace.jsonl [trace.jsonl ...]"
+                  << std::endl;
+        return 1;
+    }
+
+    const std::vector<std::pair<std::string, EvictionEngine>> policies = {
+        {"sieve", EvictionEngine::SIEVE},
+        {"s3fifo", EvictionEngine::S3FIFO},
+        {"w_tinylfu", EvictionEngine::W_TINYLFU},
+    };
+
+    for (int i = 1; i < argc; ++i) {
+        std::vector<size_t> request_starts;
+        auto blocks = LoadTrace(argv[i], request_starts);
+        std::unordered_set<uint64_t> distinct(blocks.begin(), blocks.end());
+        std::cout << "=== " << argv[i] << ": " << blocks.size()
+                  << " block accesses, " << distinct.size()
+                  << " distinct blocks ===" << std::endl;
+
+        for (double fraction : {0.05, 0.1, 0.2, 0.4}) {
+            const size_t capacity =
+                std::max<size_t>(1, distinct.size() * fraction);
+            std::cout << "capacity=" << capacity << " (" << fraction * 100
+                      << "% of distinct blocks)" << std::endl;
+            std::cout << "  " << std::left << std::setw(12) << "policy"
+                      << std::right << std::setw(12) << "hit ratio"
+                      << std::setw(14) << "evictions" << std::setw(16)
+                      << "ns/eviction" << std::endl;
+            PrintRow("lru", ReplayLru(blocks, capacity));
+            for (const auto& [name, engine] : policies) {
+                PrintRow(name, ReplayPolicy(engine, blocks, capacity));
+            }
+            for (size_t lookahead : {1, 16, 256}) {
+                PrintRow("hint_" + std::to_string(lookahead),
+                         ReplayHinted(blocks, capacity, lookahead,
+                                      request_starts));
+            }
+        }
+    }
+    return 0;
+}
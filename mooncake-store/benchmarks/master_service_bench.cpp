@@ -0,0 +1,356 @@
+#include <benchmark/benchmark.h>
+#include <glog/logging.h>
+#include <malloc.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "master_service.h"
+#include "types.h"
+
+// Drives MasterService directly from the benchmark threads, without clients
+// or transfers: buffers are allocated from segments at fake addresses that
+// are never touched. Each iteration is one operation, chosen at random from
+// PutStart+PutEnd, Remove and GetReplicaList in the ratio of the run.
+//
+// Every run mounts its segments and preloads half of the keys, up to the
+// capacity, before timing. Puts and removes are as frequent. A capacity below 100% of the keys keeps the eviction thread
+// busy, and puts fail with NO_AVAILABLE_HANDLE until it frees space.
+//
+// MetadataFootprint instead reports the heap taken per stored key, to
+// compare layouts of the object metadata.
+//
+// Results are JSON unless --benchmark_format is given, e.g.
+//   master_service_bench --benchmark_filter=MixedWorkload
+//       --benchmark_out=master.json
+
+namespace mooncake {
+namespace {
+
+constexpr uintptr_t kSegmentBase = 0x300000000;
+constexpr size_t kSlabSize = 4 * 1024 * 1024;  // Segment alignment
+// The slab allocator needs a few slabs to mount a segment
+constexpr size_t kMinSegmentSize = 4 * kSlabSize;
+
+// Layout of the arguments of every family
+enum Arg {
+    kSegments,
+    kKeys,
+    kValueSize,
+    kPutPercent,
+    kCapacityPercent,
+    kEvictionEngine,
+    kAllocationStrategy,
+};
+
+const std::vector<std::string> kArgNames = {
+    "segments",     "keys",     "value_size", "put_pct",
+    "capacity_pct", "eviction", "allocation"};
+
+struct BenchState {
+    std::unique_ptr<MasterService> service;
+    std::vector<std::string> keys;
+    // Whether each key is stored, as last seen by the thread owning it
+    std::vector<uint8_t> present;
+    size_t capacity = 0;
+};
+
+BenchState g_bench;
+
+void SetupMaster(const benchmark::State& state) {
+    const size_t num_segments = state.range(kSegments);
+    const size_t num_keys = state.range(kKeys);
+    const size_t value_size = state.range(kValueSize);
+
+    // Leases expire at once, so that removes and evictions are not refused
+    g_bench.service = std::make_unique<MasterService>(MasterServiceConfig{
+        .enable_gc = false,
+        .default_kv_lease_ttl = 0,
+        .eviction_engine =
+            static_cast<EvictionEngine>(state.range(kEvictionEngine)),
+        .allocation_strategy = static_cast<AllocationStrategyType>(
+            state.range(kAllocationStrategy)),
+    });
+
+    const size_t total = num_keys * value_size / 100 *
+                         state.range(kCapacityPercent);
+    const size_t per_segment =
+        (total / num_segments + kSlabSize - 1) / kSlabSize * kSlabSize;
+    const size_t segment_size = std::max(kMinSegmentSize, per_segment);
+    for (size_t i = 0; i < num_segments; ++i) {
+        Segment segment(generate_uuid(), "segment_" + std::to_string(i),
+                        kSegmentBase + i * segment_size, segment_size);
+        auto result = g_bench.service->MountSegment(segment, generate_uuid());
+        CHECK(result.has_value()) << "Failed to mount segment " << i << ": "
+                                  << toString(result.error());
+    }
+    g_bench.capacity = num_segments * segment_size;
+
+    g_bench.keys.resize(num_keys);
+    g_bench.present.assign(num_keys, 0);
+    char key[32];
+    for (size_t i = 0; i < num_keys; ++i) {
+        std::snprintf(key, sizeof(key), "bench_key_%016zx", i);
+        g_bench.keys[i] = key;
+    }
+    // Half of the keys, so that puts and removes both find keys to work on
+    ReplicateConfig config;
+    for (size_t i = 0; i < num_keys; i += 2) {
+        if (g_bench.service->PutStart(g_bench.keys[i], {value_size}, config)
+                .has_value() &&
+            g_bench.service->PutEnd(g_bench.keys[i]).has_value()) {
+            g_bench.present[i] = 1;
+        }
+    }
+}
+
+void TeardownMaster(const benchmark::State&) {
+    g_bench.service.reset();
+    g_bench.keys.clear();
+    g_bench.present.clear();
+}
+
+void BM_Master(benchmark::State& state) {
+    MasterService& service = *g_bench.service;
+    const size_t num_keys = g_bench.keys.size();
+    const uint64_t value_size = state.range(kValueSize);
+    const int64_t put_percent = state.range(kPutPercent);
+    // As many removes as puts keep the stored keys steady
+    const int64_t remove_percent = put_percent;
+    // Threads put and remove their own keys only, gets go to all keys
+    const size_t stride = state.threads();
+    const size_t first = state.thread_index();
+    const size_t owned = (num_keys - first + stride - 1) / stride;
+
+    std::mt19937_64 rng(first + 1);
+    ReplicateConfig config;
+    int64_t puts = 0, put_failures = 0, removes = 0, gets = 0, get_hits = 0;
+
+    // The first owned key from a random one with the wanted presence
+    auto find_owned = [&](uint8_t wanted) -> size_t {
+        if (owned == 0) {
+            return num_keys;
+        }
+        const size_t start = rng() % owned;
+        for (size_t n = 0; n < owned; ++n) {
+            size_t key = first + (start + n) % owned * stride;
+            if (g_bench.present[key] == wanted) {
+                return key;
+            }
+        }
+        return num_keys;
+    };
+
+    for (auto _ : state) {
+        const int64_t dice = rng() % 100;
+        if (dice < put_percent) {
+            size_t key = find_owned(0);
+            if (key < num_keys) {
+                auto result =
+                    service.PutStart(g_bench.keys[key], {value_size}, config);
+                if (result.has_value()) {
+                    service.PutEnd(g_bench.keys[key]);
+                    g_bench.present[key] = 1;
+                } else if (result.error() ==
+                           ErrorCode::OBJECT_ALREADY_EXISTS) {
+                    g_bench.present[key] = 1;
+                } else {
+                    put_failures++;
+                }
+                puts++;
+                continue;
+            }
+        } else if (dice < put_percent + remove_percent) {
+            size_t key = find_owned(1);
+            if (key < num_keys) {
+                // Evicted keys are gone as well
+                auto result = service.Remove(g_bench.keys[key]);
+                if (result.has_value() ||
+                    result.error() == ErrorCode::OBJECT_NOT_FOUND) {
+                    g_bench.present[key] = 0;
+                }
+                removes++;
+                continue;
+            }
+        }
+        auto result = service.GetReplicaList(g_bench.keys[rng() % num_keys]);
+        benchmark::DoNotOptimize(result);
+        get_hits += result.has_value();
+        gets++;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.counters["puts"] = benchmark::Counter(puts);
+    state.counters["put_failures"] = benchmark::Counter(put_failures);
+    state.counters["removes"] = benchmark::Counter(removes);
+    state.counters["gets"] = benchmark::Counter(gets);
+    state.counters["get_hits"] = benchmark::Counter(get_hits);
+    if (first == 0) {
+        state.counters["capacity_bytes"] =
+            benchmark::Counter(static_cast<double>(g_bench.capacity));
+        state.counters["keys_stored"] =
+            benchmark::Counter(static_cast<double>(service.GetKeyCount()));
+    }
+}
+
+constexpr int64_t kBatchScan =
+    static_cast<int64_t>(EvictionEngine::BATCH_SCAN);
+constexpr int64_t kRandom =
+    static_cast<int64_t>(AllocationStrategyType::RANDOM);
+
+// Operation mix, key count, value size and segment count, with room for
+// every key
+BENCHMARK(BM_Master)
+    ->Name("MixedWorkload")
+    ->ArgNames(kArgNames)
+    ->ArgsProduct({{10, 100, 1000},
+                   {10000, 100000},
+                   {4096, 1 << 20},
+                   {10, 40},
+                   {200},
+                   {kBatchScan},
+                   {kRandom}})
+    ->Setup(SetupMaster)
+    ->Teardown(TeardownMaster)
+    ->Threads(1)
+    ->Threads(8)
+    ->UseRealTime();
+
+// Eviction engines with room for part of the preloaded half of the keys
+BENCHMARK(BM_Master)
+    ->Name("EvictionPressure")
+    ->ArgNames(kArgNames)
+    ->ArgsProduct({{100},
+                   {100000},
+                   {65536},
+                   {40},
+                   {40, 20},
+                   {static_cast<int64_t>(EvictionEngine::BATCH_SCAN),
+                    static_cast<int64_t>(EvictionEngine::CLOCK),
+                    static_cast<int64_t>(EvictionEngine::SIEVE),
+                    static_cast<int64_t>(EvictionEngine::S3FIFO),
+                    static_cast<int64_t>(EvictionEngine::W_TINYLFU)},
+                   {kRandom}})
+    ->Setup(SetupMaster)
+    ->Teardown(TeardownMaster)
+    ->Threads(8)
+    ->UseRealTime();
+
+// Allocation strategies over many segments, write heavy
+BENCHMARK(BM_Master)
+    ->Name("AllocationStrategy")
+    ->ArgNames(kArgNames)
+    ->ArgsProduct(
+        {{1000},
+         {100000},
+         {65536},
+         {45},
+         {200},
+         {kBatchScan},
+         {static_cast<int64_t>(AllocationStrategyType::RANDOM),
+          static_cast<int64_t>(AllocationStrategyType::CAPACITY_AWARE),
+          static_cast<int64_t>(AllocationStrategyType::LOAD_AWARE),
+          static_cast<int64_t>(AllocationStrategyType::TOPOLOGY_AWARE)}})
+    ->Setup(SetupMaster)
+    ->Teardown(TeardownMaster)
+    ->Threads(1)
+    ->Threads(8)
+    ->UseRealTime();
+
+// Heap in use, from the allocator's statistics
+size_t HeapInUse() {
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+// Heap taken by the metadata of each stored key, key included, then the
+// speed of GetReplicaList over those keys. Each run has a master of its own.
+void BM_MetadataFootprint(benchmark::State& state) {
+    const size_t num_keys = state.range(0);
+    const size_t replica_num = state.range(1);
+    constexpr size_t kValueSize = 4096;
+
+    MasterService service({.enable_gc = false, .default_kv_lease_ttl = 0});
+    // Twice the room needed, spread so that no allocator runs out of
+    // allocations
+    const size_t num_segments =
+        std::max<size_t>(replica_num, num_keys * replica_num / 32768);
+    const size_t segment_size = std::max(
+        kMinSegmentSize,
+        (2 * num_keys * replica_num * kValueSize / num_segments +
+         kSlabSize - 1) / kSlabSize * kSlabSize);
+    for (size_t i = 0; i < num_segments; ++i) {
+        Segment segment(generate_uuid(), "segment_" + std::to_string(i),
+                        kSegmentBase + i * segment_size, segment_size);
+        CHECK(service.MountSegment(segment, generate_uuid()).has_value());
+    }
+
+    std::vector<std::string> keys(num_keys);
+    char key[32];
+    for (size_t i = 0; i < num_keys; ++i) {
+        std::snprintf(key, sizeof(key), "bench_key_%016zx", i);
+        keys[i] = key;
+    }
+    ReplicateConfig config;
+    config.replica_num = replica_num;
+    const size_t heap_before = HeapInUse();
+    size_t stored = 0;
+    for (const auto& k : keys) {
+        if (service.PutStart(k, {kValueSize}, config).has_value() &&
+            service.PutEnd(k).has_value()) {
+            stored++;
+        }
+    }
+    const size_t heap_after = HeapInUse();
+
+    std::mt19937_64 rng(1);
+    int64_t hits = 0;
+    for (auto _ : state) {
+        auto result = service.GetReplicaList(keys[rng() % num_keys]);
+        benchmark::DoNotOptimize(result);
+        hits += result.has_value();
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["keys_stored"] =
+        benchmark::Counter(static_cast<double>(stored));
+    state.counters["bytes_per_key"] = benchmark::Counter(
+        stored ? static_cast<double>(heap_after - heap_before) / stored : 0);
+    state.counters["get_hits"] = benchmark::Counter(hits);
+}
+
+BENCHMARK(BM_MetadataFootprint)
+    ->Name("MetadataFootprint")
+    ->ArgNames({"keys", "replicas"})
+    ->ArgsProduct({{100000, 1000000}, {1, 2}})
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace mooncake
+
+int main(int argc, char** argv) {
+    google::InitGoogleLogging(argv[0]);
+    // Failed puts under eviction pressure would log on every operation
+    FLAGS_minloglevel = google::GLOG_ERROR;
+
+    std::vector<char*> args(argv, argv + argc);
+    char json_format[] = "--benchmark_format=json";
+    if (std::none_of(args.begin(), args.end(), [](const char* arg) {
+            return std::strncmp(arg, "--benchmark_format", 18) == 0;
+        })) {
+        args.push_back(json_format);
+    }
+    int args_count = static_cast<int>(args.size());
+    benchmark::Initialize(&args_count, args.data());
+    if (benchmark::ReportUnrecognizedArguments(args_count, args.data())) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    google::ShutdownGoogleLogging();
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "transfer_task.h"
+
+// Measures local-segment copy bandwidth of MemcpyWorkerPool. The single
+// worker pool matches the former behavior, one queue copying one task at a
+// time; the other pools split large tasks over their workers.
+//
+// Usage: memcpy_pool_bench [object_mb] [concurrent_tasks] [worker_count ...]
+//        (default: 256 MB objects, 1 task, 1 2 4 8 workers)
+
+namespace {
+
+constexpr int kRounds = 10;
+
+double RunBenchmark(size_t workers, size_t object_size, size_t tasks,
+                    std::vector<std::vector<char>>& src,
+                    std::vector<std::vector<char>>& dest) {
+    mooncake::MemcpyWorkerPool pool(workers);
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < kRounds; ++round) {
+        std::vector<std::shared_ptr<mooncake::MemcpyOperationState>> states;
+        for (size_t i = 0; i < tasks; ++i) {
+            auto state = std::make_shared<mooncake::MemcpyOperationState>();
+            std::vector<mooncake::MemcpyOperation> operations;
+            operations.emplace_back(dest[i].data(), src[i].data(),
+                                    object_size);
+            pool.submitTask(
+                mooncake::MemcpyTask(std::move(operations), state));
+            states.push_back(std::move(state));
+        }
+        for (auto& state : states) {
+            state->wait_for_completion();
+        }
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return static_cast<double>(object_size) * tasks * kRounds /
+           elapsed.count() / (1 << 30);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    size_t object_mb = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 256;
+    size_t tasks = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1;
+    std::vector<size_t> worker_counts;
+    for (int i = 3; i < argc; ++i) {
+        worker_counts.push_back(std::strtoull(argv[i], nullptr, 10));
+    }
+    if (worker_counts.empty()) {
+        worker_counts = {1, 2, 4, 8};
+    }
+    const size_t object_size = object_mb << 20;
+
+    // Touch all pages up front so page faults are not measured
+    std::vector<std::vector<char>> src(tasks,
+                                       std::vector<char>(object_size, 1));
+    std::vector<std::vector<char>> dest(tasks,
+                                        std::vector<char>(object_size, 0));
+
+    std::cout << "=== MemcpyWorkerPool Benchmark (" << object_mb << " MB x "
+              << tasks << " tasks, " << kRounds << " rounds) ===" << std::endl;
+    std::cout << std::left << std::setw(12) << "workers" << std::right
+              << std::setw(14) << "GB/s" << std::endl;
+    for (size_t workers : worker_counts) {
+        double bandwidth = RunBenchmark(workers, object_size, tasks, src, dest);
+        std::cout << std::left << std::setw(12) << workers << std::right
+                  << std::fixed << std::setprecision(2) << std::setw(14)
+                  << bandwidth << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "flat_metadata_map.h"
+#include "key_hash.h"
+
+// Compares the per-shard metadata containers of MasterService: the default
+// std::unordered_map<std::string, V> against FlatMetadataMap<V>. Keys are
+// spread over the same number of shards as MasterService so that per-shard
+// table sizes match a real master with the same key count. It first times
+// the key hashes, std::hash against the KeyHash the master shards with.
+//
+// Usage: metadata_map_bench [key_count ...]   (default: 1M 10M 50M)
+
+namespace {
+
+constexpr size_t kNumShards = 1024;  // Same as MasterService::kNumShards
+constexpr size_t kKeyLength = 40;
+
+// Roughly the footprint of MasterService::ObjectMetadata, non-movable.
+struct BenchValue {
+    explicit BenchValue(uint64_t s) : size(s) {}
+    BenchValue(const BenchValue&) = delete;
+    BenchValue& operator=(const BenchValue&) = delete;
+    BenchValue(BenchValue&&) = delete;
+    BenchValue& operator=(BenchValue&&) = delete;
+
+    std::vector<void*> replicas;
+    uint64_t size;
+    std::chrono::steady_clock::time_point lease_timeout;
+    std::chrono::steady_clock::time_point soft_pin_timeout;
+};
+
+// Build a fixed-length key such as "prefix_cache_0000000000abcdef..." without
+// going through snprintf, so key generation does not dominate the timings.
+void MakeKey(uint64_t id, char* out) {
+    static constexpr char kHex[] = "0123456789abcdef";
+    static constexpr std::string_view kPrefix = "prefix_cache_";
+    std::copy(kPrefix.begin(), kPrefix.end(), out);
+    uint64_t mixed = id * 0x9E3779B97F4A7C15ULL;
+    for (size_t i = kPrefix.size(); i < kKeyLength; ++i) {
+        out[i] = kHex[(i & 1) ? (id & 0xF) : (mixed & 0xF)];
+        if (i & 1) {
+            id >>= 4;
+        } else {
+            mixed >>= 4;
+        }
+    }
+}
+
+template <typename Map>
+struct StdMapOps {
+    static void Insert(Map& map, std::string_view key, uint64_t v) {
+        map.try_emplace(std::string(key), v);
+    }
+    static bool Find(Map& map, std::string_view key) {
+        return map.find(std::string(key)) != map.end();
+    }
+    static void Erase(Map& map, std::string_view key) {
+        map.erase(std::string(key));
+    }
+};
+
+template <typename Map>
+struct FlatMapOps {
+    static void Insert(Map& map, std::string_view key, uint64_t v) {
+        map.try_emplace(key, v);
+    }
+    static bool Find(Map& map, std::string_view key) {
+        return map.find(key) != map.end();
+    }
+    static void Erase(Map& map, std::string_view key) { map.erase(key); }
+};
+
+double Mops(size_t ops, std::chrono::steady_clock::duration d) {
+    double secs = std::chrono::duration<double>(d).count();
+    return secs > 0 ? ops / secs / 1e6 : 0.0;
+}
+
+template <typename Map, typename Ops>
+void RunBenchmark(const std::string& name, size_t key_count) {
+    auto shards = std::make_unique<Map[]>(kNumShards);
+    char key_buf[kKeyLength];
+    auto shard_of = [](std::string_view key) {
+        return mooncake::KeyHash(key) % kNumShards;
+    };
+
+    // Insert
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < key_count; ++i) {
+        MakeKey(i, key_buf);
+        std::string_view key(key_buf, kKeyLength);
+        Ops::Insert(shards[shard_of(key)], key, i);
+    }
+    auto insert_time = std::chrono::steady_clock::now() - start;
+
+    // Random lookups, half of them hits
+    const size_t lookup_count = std::min<size_t>(key_count, 10'000'000);
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<uint64_t> dist(0, key_count * 2 - 1);
+    std::vector<uint64_t> lookup_ids(lookup_count);
+    for (auto& id : lookup_ids) {
+        id = dist(rng);
+    }
+    size_t hits = 0;
+    start = std::chrono::steady_clock::now();
+    for (uint64_t id : lookup_ids) {
+        MakeKey(id, key_buf);
+        std::string_view key(key_buf, kKeyLength);
+        hits += Ops::Find(shards[shard_of(key)], key);
+    }
+    auto lookup_time = std::chrono::steady_clock::now() - start;
+
+    // Erase every key
+    start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < key_count; ++i) {
+        MakeKey(i, key_buf);
+        std::string_view key(key_buf, kKeyLength);
+        Ops::Erase(shards[shard_of(key)], key);
+    }
+    auto erase_time = std::chrono::steady_clock::now() - start;
+
+    std::cout << std::left << std::setw(22) << name << std::right
+              << std::setw(12) << key_count << std::fixed
+              << std::setprecision(2) << std::setw(14)
+              << Mops(key_count, insert_time) << std::setw(14)
+              << Mops(lookup_count, lookup_time) << std::setw(14)
+              << Mops(key_count, erase_time) << "   (hit ratio "
+              << static_cast<double>(hits) / lookup_count << ")" << std::endl;
+}
+
+// Keeps the hashes from being optimized away
+volatile uint64_t g_hash_sink;
+
+template <typename Hash>
+void RunHashBenchmark(const std::string& name) {
+    // Few enough keys to stay in the caches, the cost is that of the hash
+    constexpr size_t kKeys = 4096;
+    constexpr size_t kRounds = 2000;
+    std::vector<std::string> keys(kKeys, std::string(kKeyLength, ' '));
+    for (size_t i = 0; i < kKeys; ++i) {
+        MakeKey(i, keys[i].data());
+    }
+    uint64_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t round = 0; round < kRounds; ++round) {
+        for (const auto& key : keys) {
+            sum += Hash{}(key);
+        }
+    }
+    auto time = std::chrono::steady_clock::now() - start;
+    g_hash_sink = sum;
+    std::cout << std::left << std::setw(22) << name << std::right
+              << std::fixed << std::setprecision(2) << std::setw(14)
+              << Mops(kKeys * kRounds, time) << " Mhash/s" << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::vector<size_t> key_counts;
+    for (int i = 1; i < argc; ++i) {
+        key_counts.push_back(std::strtoull(argv[i], nullptr, 10));
+    }
+    if (key_counts.empty()) {
+        key_counts = {1'000'000, 10'000'000, 50'000'000};
+    }
+
+    using StdMap =
+        std::unordered_map<std::string, BenchValue, mooncake::KeyHasher>;
+    using FlatMap = mooncake::FlatMetadataMap<BenchValue>;
+
+    RunHashBenchmark<std::hash<std::string_view>>("std::hash");
+    RunHashBenchmark<mooncake::KeyHasher>("KeyHash");
+
+    std::cout << "=== Metadata Map Benchmark (" << kNumShards << " shards, "
+              << kKeyLength << "-byte keys) ===" << std::endl;
+    std::cout << std::left << std::setw(22) << "map" << std::right
+              << std::setw(12) << "keys" << std::setw(14) << "insert Mops"
+              << std::setw(14) << "lookup Mops" << std::setw(14)
+              << "erase Mops" << std::endl;
+    for (size_t key_count : key_counts) {
+        RunBenchmark<StdMap, StdMapOps<StdMap>>("std::unordered_map",
+                                                key_count);
+        RunBenchmark<FlatMap, FlatMapOps<FlatMap>>("FlatMetadataMap",
+                                                   key_count);
+    }
+    return 0;
+}
@@ -0,0 +1,436 @@
+#include <Slab.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "client.h"
+#include "types.h"
+#include "utils.h"
+
+// Drives the data path of the store client against a running master: for
+// every combination of --value_sizes, --batch_sizes, --replica_nums and
+// --threads, each thread puts --ops_per_thread objects, or batches of
+// objects, then gets them back, with Put/Get for a batch size of 1 and
+// BatchPut/BatchGet otherwise. The objects of a case are removed before the
+// next one. Reports the throughput and the P50/P90/P99/P999 latency of each
+// operation as JSON, on stdout or in --output.
+//
+// --protocol=local transfers over TCP with MC_STORE_MEMCPY=1, so that the
+// replicas in the segments of the process are copied with memcpy; with
+// --num_clients=1 every replica is local.
+//
+// Usage: mooncake_store_client_bench --master_address=host:50051
+//            --protocol=rdma --device_name=mlx5_0 [--threads=1,8 ...]
+
+DEFINE_string(protocol, "tcp", "Transfer protocol: rdma|tcp|local");
+DEFINE_string(device_name, "erdma_0",
+              "Device name to use, valid if protocol=rdma");
+DEFINE_string(master_address, "localhost:50051", "Address of master server");
+DEFINE_string(metadata_connection_string, "P2PHANDSHAKE",
+              "Metadata connection string");
+DEFINE_string(local_host, "localhost", "Host name of the clients");
+DEFINE_int32(local_port_base, 12345,
+             "Port of the first client, the others follow");
+DEFINE_int32(num_clients, 1,
+             "Clients, each mounting a segment, at least the replica count");
+DEFINE_uint64(segment_size_mb, 4096, "Segment mounted by each client");
+DEFINE_string(value_sizes, "4096,65536,1048576",
+              "Comma-separated object sizes in bytes");
+DEFINE_string(batch_sizes, "1,16", "Comma-separated objects per operation");
+DEFINE_string(replica_nums, "1", "Comma-separated replicas of each put");
+DEFINE_string(threads, "1,4", "Comma-separated thread counts");
+DEFINE_uint64(ops_per_thread, 32, "Operations of each thread per case");
+DEFINE_string(key_prefix, "client_bench_", "Prefix of the object keys");
+DEFINE_string(output, "", "File to write the JSON report to, stdout if empty");
+
+namespace mooncake {
+namespace benchmark {
+
+std::vector<uint64_t> ParseList(const std::string& list) {
+    std::vector<uint64_t> values;
+    std::stringstream in(list);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        if (!item.empty()) {
+            values.push_back(std::strtoull(item.c_str(), nullptr, 10));
+        }
+    }
+    return values;
+}
+
+struct BenchCase {
+    uint64_t value_size;
+    uint64_t batch_size;
+    uint64_t replica_num;
+    uint64_t threads;
+};
+
+enum Operation { kPut, kGet, kOperationCount };
+
+struct ThreadStats {
+    std::vector<double> latencies_us[kOperationCount];
+    uint64_t failures[kOperationCount] = {};
+};
+
+struct CaseResult {
+    BenchCase bench_case;
+    const char* names[kOperationCount];
+    double duration_s[kOperationCount] = {};
+    ThreadStats total;
+};
+
+struct BenchClient {
+    std::shared_ptr<Client> client;
+    void* segment = nullptr;
+    size_t segment_size = 0;
+    // One region of the largest batch per thread of the client
+    void* buffer = nullptr;
+    size_t buffer_size = 0;
+};
+
+size_t AlignToSlab(size_t size) {
+    const size_t alignment = facebook::cachelib::Slab::kSize;
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+bool InitializeClient(int index, size_t buffer_size,
+                      BenchClient& bench_client) {
+    void** args =
+        (FLAGS_protocol == "rdma") ? rdma_args(FLAGS_device_name) : nullptr;
+    const std::string protocol =
+        FLAGS_protocol == "local" ? "tcp" : FLAGS_protocol;
+    const std::string hostname = FLAGS_local_host + ":" +
+                                 std::to_string(FLAGS_local_port_base + index);
+    auto client_opt =
+        Client::Create(hostname, FLAGS_metadata_connection_string, protocol,
+                       args, FLAGS_master_address);
+    if (!client_opt.has_value()) {
+        LOG(ERROR) << "Failed to create client " << hostname;
+        return false;
+    }
+    bench_client.client = *client_opt;
+
+    bench_client.segment_size = AlignToSlab(FLAGS_segment_size_mb << 20);
+    bench_client.segment =
+        allocate_buffer_allocator_memory(bench_client.segment_size);
+    if (!bench_client.segment) {
+        LOG(ERROR) << "Failed to allocate segment of client " << hostname;
+        return false;
+    }
+    auto mounted = bench_client.client->MountSegment(
+        bench_client.segment, bench_client.segment_size);
+    if (!mounted.has_value()) {
+        LOG(ERROR) << "Failed to mount segment: " << toString(mounted.error());
+        return false;
+    }
+
+    bench_client.buffer_size = AlignToSlab(buffer_size);
+    bench_client.buffer =
+        allocate_buffer_allocator_memory(bench_client.buffer_size);
+    if (!bench_client.buffer) {
+        LOG(ERROR) << "Failed to allocate buffer of client " << hostname;
+        return false;
+    }
+    std::memset(bench_client.buffer, 'A' + index % 26,
+                bench_client.buffer_size);
+    auto registered = bench_client.client->RegisterLocalMemory(
+        bench_client.buffer, bench_client.buffer_size, "cpu:0", false, false);
+    if (!registered.has_value()) {
+        LOG(ERROR) << "Failed to register local memory: "
+                   << toString(registered.error());
+        return false;
+    }
+    return true;
+}
+
+void CleanupClient(BenchClient& bench_client) {
+    if (bench_client.client) {
+        if (bench_client.segment) {
+            bench_client.client->UnmountSegment(bench_client.segment,
+                                                bench_client.segment_size);
+        }
+        bench_client.client.reset();
+    }
+    free(bench_client.segment);
+    free(bench_client.buffer);
+}
+
+template <typename F>
+auto Timed(std::vector<double>& latencies, F&& fn) {
+    auto start = std::chrono::steady_clock::now();
+    auto result = fn();
+    latencies.push_back(std::chrono::duration<double, std::micro>(
+                            std::chrono::steady_clock::now() - start)
+                            .count());
+    return result;
+}
+
+// Put or get the objects of op of the thread, batch_size of them from
+// buffer
+void RunOperation(Client& client, const BenchCase& bench_case,
+                  Operation operation, const std::string& prefix,
+                  size_t thread, size_t op, char* buffer, ThreadStats& stats) {
+    std::vector<std::string> keys;
+    std::vector<std::vector<Slice>> batched_slices;
+    for (size_t i = 0; i < bench_case.batch_size; ++i) {
+        keys.push_back(prefix + std::to_string(thread) + "_" +
+                       std::to_string(op * bench_case.batch_size + i));
+        batched_slices.push_back(
+            {Slice{buffer + i * bench_case.value_size,
+                   static_cast<size_t>(bench_case.value_size)}});
+    }
+    auto& latencies = stats.latencies_us[operation];
+    uint64_t failed = 0;
+    if (operation == kPut) {
+        ReplicateConfig config;
+        config.replica_num = bench_case.replica_num;
+        if (bench_case.batch_size == 1) {
+            auto result = Timed(latencies, [&] {
+                return client.Put(keys[0], batched_slices[0], config);
+            });
+            failed = !result.has_value();
+        } else {
+            auto results = Timed(latencies, [&] {
+                return client.BatchPut(keys, batched_slices, config);
+            });
+            failed = std::count_if(results.begin(), results.end(),
+                                   [](const auto& r) { return !r; });
+        }
+    } else if (bench_case.batch_size == 1) {
+        auto result = Timed(
+            latencies, [&] { return client.Get(keys[0], batched_slices[0]); });
+        failed = !result.has_value();
+    } else {
+        std::unordered_map<std::string, std::vector<Slice>> slices;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            slices[keys[i]] = batched_slices[i];
+        }
+        auto results =
+            Timed(latencies, [&] { return client.BatchGet(keys, slices); });
+        failed = std::count_if(results.begin(), results.end(),
+                               [](const auto& r) { return !r; });
+    }
+    stats.failures[operation] += failed;
+}
+
+// Run operation on bench_case.threads threads started together, returning
+// the seconds until the last of them is done
+double RunPhase(std::vector<BenchClient>& clients, const BenchCase& bench_case,
+                Operation operation, const std::string& prefix,
+                size_t max_batch_bytes, std::vector<ThreadStats>& stats) {
+    std::atomic<bool> go{false};
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < bench_case.threads; ++t) {
+        auto& bench_client = clients[t % clients.size()];
+        Client* client = bench_client.client.get();
+        char* buffer = static_cast<char*>(bench_client.buffer) +
+                       (t / clients.size()) * max_batch_bytes;
+        workers.emplace_back([&, t, client, buffer] {
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            for (size_t op = 0; op < FLAGS_ops_per_thread; ++op) {
+                RunOperation(*client, bench_case, operation,
+                             prefix, t, op, buffer, stats[t]);
+            }
+        });
+    }
+    auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+}
+
+CaseResult RunCase(std::vector<BenchClient>& clients,
+                   const BenchCase& bench_case, size_t index,
+                   size_t max_batch_bytes) {
+    CaseResult result;
+    result.bench_case = bench_case;
+    const bool batched = bench_case.batch_size > 1;
+    result.names[kPut] = batched ? "BatchPut" : "Put";
+    result.names[kGet] = batched ? "BatchGet" : "Get";
+    const std::string prefix =
+        FLAGS_key_prefix + std::to_string(index) + "_";
+    for (int op = 0; op < kOperationCount; ++op) {
+        std::vector<ThreadStats> stats(bench_case.threads);
+        result.duration_s[op] =
+            RunPhase(clients, bench_case, static_cast<Operation>(op), prefix,
+                     max_batch_bytes, stats);
+        for (const auto& thread_stats : stats) {
+            result.total.latencies_us[op].insert(
+                result.total.latencies_us[op].end(),
+                thread_stats.latencies_us[op].begin(),
+                thread_stats.latencies_us[op].end());
+            result.total.failures[op] += thread_stats.failures[op];
+        }
+    }
+    auto removed = clients[0].client->RemoveByPrefix(prefix);
+    if (!removed.has_value()) {
+        LOG(WARNING) << "Failed to remove the objects of case " << index
+                     << ": " << toString(removed.error());
+    }
+    return result;
+}
+
+double Percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = static_cast<size_t>(std::ceil(sorted.size() * p) - 1);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+std::string ToJson(const std::vector<CaseResult>& results) {
+    const double kMiB = 1024.0 * 1024.0;
+    std::ostringstream out;
+    out << "{\n  \"protocol\": \"" << FLAGS_protocol
+        << "\",\n  \"num_clients\": " << FLAGS_num_clients
+        << ",\n  \"ops_per_thread\": " << FLAGS_ops_per_thread
+        << ",\n  \"results\": [";
+    bool first = true;
+    for (auto result : results) {
+        const auto& bench_case = result.bench_case;
+        for (int op = 0; op < kOperationCount; ++op) {
+            auto& latencies = result.total.latencies_us[op];
+            std::sort(latencies.begin(), latencies.end());
+            const double duration_s = std::max(result.duration_s[op], 1e-9);
+            const uint64_t objects = latencies.size() * bench_case.batch_size;
+            const uint64_t failures = result.total.failures[op];
+            const double bytes = double(objects - std::min(failures, objects)) *
+                                 bench_case.value_size;
+            out << (first ? "" : ",") << "\n    {\"operation\": \""
+                << result.names[op]
+                << "\", \"value_size\": " << bench_case.value_size
+                << ", \"batch_size\": " << bench_case.batch_size
+                << ", \"replica_num\": " << bench_case.replica_num
+                << ", \"threads\": " << bench_case.threads
+                << ", \"ops\": " << latencies.size()
+                << ", \"failed_objects\": " << failures
+                << ", \"duration_s\": " << duration_s
+                << ", \"ops_per_sec\": " << latencies.size() / duration_s
+                << ", \"objects_per_sec\": " << objects / duration_s
+                << ", \"throughput_mb_s\": " << bytes / kMiB / duration_s
+                << ", \"latency_us\": {\"p50\": "
+                << Percentile(latencies, 0.50)
+                << ", \"p90\": " << Percentile(latencies, 0.90)
+                << ", \"p99\": " << Percentile(latencies, 0.99)
+                << ", \"p999\": " << Percentile(latencies, 0.999)
+                << ", \"max\": "
+                << (latencies.empty() ? 0 : latencies.back()) << "}}";
+            first = false;
+        }
+    }
+    out << "\n  ]\n}\n";
+    return out.str();
+}
+
+}  // namespace benchmark
+}  // namespace mooncake
+
+int main(int argc, char** argv) {
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    google::InitGoogleLogging(argv[0]);
+    FLAGS_logtostderr = 1;
+
+    using namespace mooncake::benchmark;
+
+    if (FLAGS_protocol == "local") {
+        setenv("MC_STORE_MEMCPY", "1", 1);
+    }
+    const auto value_sizes = ParseList(FLAGS_value_sizes);
+    const auto batch_sizes = ParseList(FLAGS_batch_sizes);
+    const auto replica_nums = ParseList(FLAGS_replica_nums);
+    const auto thread_counts = ParseList(FLAGS_threads);
+    if (value_sizes.empty() || batch_sizes.empty() || replica_nums.empty() ||
+        thread_counts.empty() || FLAGS_num_clients < 1) {
+        LOG(ERROR) << "Nothing to run";
+        return 1;
+    }
+    const size_t max_batch_bytes =
+        *std::max_element(value_sizes.begin(), value_sizes.end()) *
+        *std::max_element(batch_sizes.begin(), batch_sizes.end());
+    const size_t max_threads =
+        *std::max_element(thread_counts.begin(), thread_counts.end());
+    const size_t threads_per_client =
+        (max_threads + FLAGS_num_clients - 1) / FLAGS_num_clients;
+
+    std::vector<BenchClient> clients(FLAGS_num_clients);
+    for (int i = 0; i < FLAGS_num_clients; ++i) {
+        if (!InitializeClient(i, threads_per_client * max_batch_bytes,
+                              clients[i])) {
+            for (auto& client : clients) {
+                CleanupClient(client);
+            }
+            return 1;
+        }
+    }
+
+    const uint64_t capacity =
+        FLAGS_num_clients * AlignToSlab(FLAGS_segment_size_mb << 20);
+    std::vector<CaseResult> results;
+    size_t index = 0;
+    for (auto value_size : value_sizes) {
+        for (auto batch_size : batch_sizes) {
+            for (auto replica_num : replica_nums) {
+                for (auto threads : thread_counts) {
+                    BenchCase bench_case{value_size, batch_size, replica_num,
+                                         threads};
+                    // The objects of a case are only removed at its end
+                    if (threads * FLAGS_ops_per_thread * batch_size *
+                            value_size * replica_num >
+                        capacity) {
+                        LOG(WARNING)
+                            << "Skipping value_size=" << value_size
+                            << " batch_size=" << batch_size
+                            << " replica_num=" << replica_num
+                            << " threads=" << threads
+                            << ", larger than the segments";
+                        continue;
+                    }
+                    LOG(INFO) << "Running value_size=" << value_size
+                              << " batch_size=" << batch_size
+                              << " replica_num=" << replica_num
+                              << " threads=" << threads;
+                    results.push_back(
+                        RunCase(clients, bench_case, index++, max_batch_bytes));
+                }
+            }
+        }
+    }
+
+    const std::string report = ToJson(results);
+    if (FLAGS_output.empty()) {
+        std::cout << report;
+    } else {
+        std::ofstream out(FLAGS_output);
+        out << report;
+        if (!out) {
+            LOG(ERROR) << "Failed to write " << FLAGS_output;
+        }
+    }
+
+    for (auto& client : clients) {
+        CleanupClient(client);
+    }
+    google::ShutdownGoogleLogging();
+    return 0;
+}
@@ -0,0 +1,478 @@
+#include <Slab.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "client.h"
+#include "types.h"
+#include "utils.h"
+
+// Replays Mooncake request traces (mooncake_trace.jsonl,
+// FAST25-release/traces/*.jsonl) against a running master with several
+// clients. Each request is served like a prefill node with a prefix cache:
+// BatchIsExist on the keys of its blocks, BatchGet of the leading blocks
+// that exist, and a Put of every other block. Requests start at their trace
+// timestamps, scaled by --time_scale. Reports the block hit ratio, the
+// p50/p99/p999 latency of each operation, the bytes moved and, with
+// --master_pid, the CPU time of the master.
+//
+// Usage: mooncake_store_trace_bench --trace=mooncake_trace.jsonl
+//            --master_address=host:50051 [--num_clients=4 ...]
+
+DEFINE_string(trace, "mooncake_trace.jsonl", "Trace to replay");
+DEFINE_string(protocol, "tcp", "Transfer protocol: rdma|tcp");
+DEFINE_string(device_name, "erdma_0",
+              "Device name to use, valid if protocol=rdma");
+DEFINE_string(master_address, "localhost:50051", "Address of master server");
+DEFINE_string(metadata_connection_string, "P2PHANDSHAKE",
+              "Metadata connection string");
+DEFINE_string(local_host, "localhost", "Host name of the clients");
+DEFINE_int32(local_port_base, 12345,
+             "Port of the first client, the others follow");
+DEFINE_int32(num_clients, 4, "Clients, each mounting a segment");
+DEFINE_int32(threads_per_client, 4, "Threads replaying requests per client");
+DEFINE_uint64(segment_size_mb, 4096, "Segment mounted by each client");
+DEFINE_uint64(block_tokens, 512, "Tokens per hash_ids block of the trace");
+DEFINE_uint64(bytes_per_token, 256, "KV cache bytes per token");
+DEFINE_double(time_scale, 1.0,
+              "Trace time multiplier, 0 to replay as fast as possible");
+DEFINE_uint64(max_requests, 0, "Requests replayed, 0 for the whole trace");
+DEFINE_string(key_prefix, "trace_", "Prefix of the block keys");
+DEFINE_int32(replica_num, 1, "Replicas of each put");
+DEFINE_int32(master_pid, 0,
+             "PID of the master on this host, to report its CPU time");
+
+namespace mooncake {
+namespace benchmark {
+
+struct TraceRequest {
+    // Milliseconds from the start of the trace
+    uint64_t timestamp_ms = 0;
+    uint64_t input_length = 0;
+    std::vector<uint64_t> hash_ids;
+};
+
+// Read the unsigned integer following "field": on line, without a JSON
+// dependency
+bool ParseField(const std::string& line, const char* field, uint64_t& value) {
+    auto pos = line.find(std::string("\"") + field + "\"");
+    if (pos == std::string::npos) {
+        return false;
+    }
+    pos = line.find(':', pos);
+    if (pos == std::string::npos) {
+        return false;
+    }
+    value = std::strtoull(line.c_str() + pos + 1, nullptr, 10);
+    return true;
+}
+
+std::vector<TraceRequest> LoadTrace(const std::string& path) {
+    std::vector<TraceRequest> requests;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        TraceRequest request;
+        ParseField(line, "timestamp", request.timestamp_ms);
+        ParseField(line, "input_length", request.input_length);
+        auto pos = line.find("\"hash_ids\"");
+        if (pos == std::string::npos) {
+            continue;
+        }
+        pos = line.find('[', pos);
+        const auto end = line.find(']', pos);
+        if (pos == std::string::npos || end == std::string::npos) {
+            continue;
+        }
+        const char* p = line.data() + pos + 1;
+        const char* last = line.data() + end;
+        while (p < last) {
+            char* next = nullptr;
+            uint64_t id = std::strtoull(p, &next, 10);
+            if (next == p) {
+                ++p;
+                continue;
+            }
+            request.hash_ids.push_back(id);
+            p = next;
+        }
+        requests.push_back(std::move(request));
+        if (FLAGS_max_requests && requests.size() >= FLAGS_max_requests) {
+            break;
+        }
+    }
+    return requests;
+}
+
+// Bytes of block i of the request, the last block holds the remaining tokens
+size_t BlockBytes(const TraceRequest& request, size_t i) {
+    uint64_t tokens = FLAGS_block_tokens;
+    if (request.input_length > i * FLAGS_block_tokens &&
+        request.input_length < (i + 1) * FLAGS_block_tokens) {
+        tokens = request.input_length - i * FLAGS_block_tokens;
+    }
+    return tokens * FLAGS_bytes_per_token;
+}
+
+size_t RequestBytes(const TraceRequest& request) {
+    size_t bytes = 0;
+    for (size_t i = 0; i < request.hash_ids.size(); ++i) {
+        bytes += BlockBytes(request, i);
+    }
+    return bytes;
+}
+
+enum Operation { kIsExist, kBatchGet, kPut, kOperationCount };
+
+const char* kOperationNames[kOperationCount] = {"BatchIsExist", "BatchGet",
+                                                "Put"};
+
+struct ThreadStats {
+    std::vector<double> latencies_us[kOperationCount];
+    uint64_t failures[kOperationCount] = {};
+    uint64_t blocks = 0;
+    uint64_t hit_blocks = 0;
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+    uint64_t requests = 0;
+    // Requests started later than their trace time
+    uint64_t late_requests = 0;
+};
+
+struct BenchClient {
+    std::shared_ptr<Client> client;
+    void* segment = nullptr;
+    size_t segment_size = 0;
+    // One region of max_request_bytes per thread
+    void* buffer = nullptr;
+    size_t buffer_size = 0;
+};
+
+size_t AlignToSlab(size_t size) {
+    const size_t alignment = facebook::cachelib::Slab::kSize;
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+bool InitializeClient(int index, size_t thread_buffer_size,
+                      BenchClient& bench_client) {
+    void** args =
+        (FLAGS_protocol == "rdma") ? rdma_args(FLAGS_device_name) : nullptr;
+    const std::string hostname = FLAGS_local_host + ":" +
+                                 std::to_string(FLAGS_local_port_base + index);
+    auto client_opt =
+        Client::Create(hostname, FLAGS_metadata_connection_string,
+                       FLAGS_protocol, args, FLAGS_master_address);
+    if (!client_opt.has_value()) {
+        LOG(ERROR) << "Failed to create client " << hostname;
+        return false;
+    }
+    bench_client.client = *client_opt;
+
+    bench_client.segment_size = AlignToSlab(FLAGS_segment_size_mb << 20);
+    bench_client.segment =
+        allocate_buffer_allocator_memory(bench_client.segment_size);
+    if (!bench_client.segment) {
+        LOG(ERROR) << "Failed to allocate segment of client " << hostname;
+        return false;
+    }
+    auto mounted = bench_client.client->MountSegment(
+        bench_client.segment, bench_client.segment_size);
+    if (!mounted.has_value()) {
+        LOG(ERROR) << "Failed to mount segment: " << toString(mounted.error());
+        return false;
+    }
+
+    bench_client.buffer_size =
+        AlignToSlab(thread_buffer_size * FLAGS_threads_per_client);
+    bench_client.buffer =
+        allocate_buffer_allocator_memory(bench_client.buffer_size);
+    if (!bench_client.buffer) {
+        LOG(ERROR) << "Failed to allocate buffer of client " << hostname;
+        return false;
+    }
+    std::memset(bench_client.buffer, 'A' + index % 26,
+                bench_client.buffer_size);
+    auto registered = bench_client.client->RegisterLocalMemory(
+        bench_client.buffer, bench_client.buffer_size, "cpu:0", false, false);
+    if (!registered.has_value()) {
+        LOG(ERROR) << "Failed to register local memory: "
+                   << toString(registered.error());
+        return false;
+    }
+    return true;
+}
+
+void CleanupClient(BenchClient& bench_client) {
+    if (bench_client.client) {
+        if (bench_client.segment) {
+            bench_client.client->UnmountSegment(bench_client.segment,
+                                                bench_client.segment_size);
+        }
+        bench_client.client.reset();
+    }
+    free(bench_client.segment);
+    free(bench_client.buffer);
+}
+
+template <typename F>
+auto Timed(std::vector<double>& latencies, F&& fn) {
+    auto start = std::chrono::steady_clock::now();
+    auto result = fn();
+    latencies.push_back(std::chrono::duration<double, std::micro>(
+                            std::chrono::steady_clock::now() - start)
+                            .count());
+    return result;
+}
+
+void ServeRequest(Client& client, const TraceRequest& request, char* buffer,
+                  ThreadStats& stats) {
+    std::vector<std::string> keys;
+    std::vector<size_t> offsets;
+    size_t offset = 0;
+    for (size_t i = 0; i < request.hash_ids.size(); ++i) {
+        keys.push_back(FLAGS_key_prefix +
+                       std::to_string(request.hash_ids[i]));
+        offsets.push_back(offset);
+        offset += BlockBytes(request, i);
+    }
+    stats.blocks += keys.size();
+
+    auto exist = Timed(stats.latencies_us[kIsExist],
+                       [&] { return client.BatchIsExist(keys); });
+    size_t prefix = 0;
+    while (prefix < exist.size() && exist[prefix].has_value() &&
+           exist[prefix].value()) {
+        ++prefix;
+    }
+    if (std::any_of(exist.begin(), exist.end(),
+                    [](const auto& result) { return !result.has_value(); })) {
+        stats.failures[kIsExist]++;
+    }
+
+    // A cached block may be evicted between the check and the read, the
+    // prefix then stops at the first failed read
+    size_t hits = 0;
+    if (prefix > 0) {
+        std::vector<std::string> prefix_keys(keys.begin(),
+                                             keys.begin() + prefix);
+        std::unordered_map<std::string, std::vector<Slice>> slices;
+        for (size_t i = 0; i < prefix; ++i) {
+            slices[keys[i]].push_back(
+                Slice{buffer + offsets[i], BlockBytes(request, i)});
+        }
+        auto results = Timed(stats.latencies_us[kBatchGet], [&] {
+            return client.BatchGet(prefix_keys, slices);
+        });
+        while (hits < results.size() && results[hits].has_value()) {
+            stats.bytes_read += BlockBytes(request, hits);
+            ++hits;
+        }
+        if (hits < prefix) {
+            stats.failures[kBatchGet]++;
+        }
+    }
+    stats.hit_blocks += hits;
+
+    ReplicateConfig config;
+    config.replica_num = FLAGS_replica_num;
+    for (size_t i = hits; i < keys.size(); ++i) {
+        std::vector<Slice> slices{
+            Slice{buffer + offsets[i], BlockBytes(request, i)}};
+        auto result = Timed(stats.latencies_us[kPut], [&] {
+            return client.Put(keys[i], slices, config);
+        });
+        // Another request may have put the block meanwhile
+        if (result.has_value()) {
+            stats.bytes_written += BlockBytes(request, i);
+        } else if (result.error() != ErrorCode::OBJECT_ALREADY_EXISTS) {
+            stats.failures[kPut]++;
+        }
+    }
+    stats.requests++;
+}
+
+void ReplayThread(Client& client, const std::vector<TraceRequest>& requests,
+                  size_t first, size_t stride, char* buffer,
+                  std::chrono::steady_clock::time_point start,
+                  ThreadStats& stats) {
+    for (size_t i = first; i < requests.size(); i += stride) {
+        if (FLAGS_time_scale > 0) {
+            auto due = start + std::chrono::microseconds(static_cast<int64_t>(
+                                   requests[i].timestamp_ms * 1000.0 *
+                                   FLAGS_time_scale));
+            if (std::chrono::steady_clock::now() > due) {
+                stats.late_requests++;
+            } else {
+                std::this_thread::sleep_until(due);
+            }
+        }
+        ServeRequest(client, requests[i], buffer, stats);
+    }
+}
+
+// User and system CPU seconds of a process, negative if unknown
+double ProcessCpuSeconds(int pid) {
+    std::ifstream in("/proc/" + std::to_string(pid) + "/stat");
+    std::string stat;
+    if (!std::getline(in, stat)) {
+        return -1;
+    }
+    // The fields after the command name, which may hold spaces
+    auto pos = stat.rfind(')');
+    if (pos == std::string::npos) {
+        return -1;
+    }
+    std::istringstream fields(stat.substr(pos + 2));
+    std::string field;
+    uint64_t utime = 0, stime = 0;
+    // utime and stime are the 14th and 15th fields, the 12th and 13th here
+    for (int i = 1; i <= 13 && fields >> field; ++i) {
+        if (i == 12) {
+            utime = std::strtoull(field.c_str(), nullptr, 10);
+        } else if (i == 13) {
+            stime = std::strtoull(field.c_str(), nullptr, 10);
+        }
+    }
+    return double(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+double Percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = static_cast<size_t>(std::ceil(sorted.size() * p) - 1);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+void PrintResults(const std::vector<ThreadStats>& thread_stats,
+                  double duration_s, double master_cpu_s) {
+    ThreadStats total;
+    for (const auto& stats : thread_stats) {
+        for (int op = 0; op < kOperationCount; ++op) {
+            total.latencies_us[op].insert(total.latencies_us[op].end(),
+                                          stats.latencies_us[op].begin(),
+                                          stats.latencies_us[op].end());
+            total.failures[op] += stats.failures[op];
+        }
+        total.blocks += stats.blocks;
+        total.hit_blocks += stats.hit_blocks;
+        total.bytes_read += stats.bytes_read;
+        total.bytes_written += stats.bytes_written;
+        total.requests += stats.requests;
+        total.late_requests += stats.late_requests;
+    }
+
+    const double kMiB = 1024.0 * 1024.0;
+    LOG(INFO) << "=== Trace Replay Results ===";
+    LOG(INFO) << "Trace: " << FLAGS_trace << ", requests: " << total.requests
+              << " (" << total.late_requests << " started late)";
+    LOG(INFO) << "Duration: " << duration_s << " s, clients: "
+              << FLAGS_num_clients
+              << ", threads per client: " << FLAGS_threads_per_client;
+    LOG(INFO) << "Block hit ratio: "
+              << (total.blocks ? double(total.hit_blocks) / total.blocks : 0)
+              << " (" << total.hit_blocks << " of " << total.blocks << ")";
+    LOG(INFO) << "Bytes read: " << total.bytes_read << " ("
+              << total.bytes_read / kMiB / duration_s << " MB/s)";
+    LOG(INFO) << "Bytes written: " << total.bytes_written << " ("
+              << total.bytes_written / kMiB / duration_s << " MB/s)";
+    if (master_cpu_s >= 0) {
+        LOG(INFO) << "Master CPU: " << master_cpu_s << " s ("
+                  << master_cpu_s / duration_s << " cores)";
+    }
+    LOG(INFO) << "=== Latency (microseconds) ===";
+    for (int op = 0; op < kOperationCount; ++op) {
+        auto& latencies = total.latencies_us[op];
+        std::sort(latencies.begin(), latencies.end());
+        LOG(INFO) << kOperationNames[op] << " - ops: " << latencies.size()
+                  << ", failed: " << total.failures[op]
+                  << ", P50: " << Percentile(latencies, 0.50)
+                  << ", P99: " << Percentile(latencies, 0.99)
+                  << ", P999: " << Percentile(latencies, 0.999);
+    }
+}
+
+}  // namespace benchmark
+}  // namespace mooncake
+
+int main(int argc, char** argv) {
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    google::InitGoogleLogging(argv[0]);
+    FLAGS_logtostderr = 1;
+
+    using namespace mooncake::benchmark;
+
+    auto requests = LoadTrace(FLAGS_trace);
+    if (requests.empty()) {
+        LOG(ERROR) << "No requests in trace " << FLAGS_trace;
+        return 1;
+    }
+    size_t max_request_bytes = 0;
+    for (const auto& request : requests) {
+        max_request_bytes = std::max(max_request_bytes, RequestBytes(request));
+    }
+    LOG(INFO) << "Loaded " << requests.size() << " requests from "
+              << FLAGS_trace << ", largest request " << max_request_bytes
+              << " bytes";
+
+    std::vector<BenchClient> clients(FLAGS_num_clients);
+    for (int i = 0; i < FLAGS_num_clients; ++i) {
+        if (!InitializeClient(i, max_request_bytes, clients[i])) {
+            for (auto& client : clients) {
+                CleanupClient(client);
+            }
+            return 1;
+        }
+    }
+
+    const size_t num_threads = FLAGS_num_clients * FLAGS_threads_per_client;
+    std::vector<ThreadStats> thread_stats(num_threads);
+    std::vector<std::thread> workers;
+    const double master_cpu_start =
+        FLAGS_master_pid ? ProcessCpuSeconds(FLAGS_master_pid) : -1;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < num_threads; ++t) {
+        auto& bench_client = clients[t % FLAGS_num_clients];
+        char* buffer = static_cast<char*>(bench_client.buffer) +
+                       (t / FLAGS_num_clients) * max_request_bytes;
+        workers.emplace_back(ReplayThread, std::ref(*bench_client.client),
+                             std::cref(requests), t, num_threads, buffer,
+                             start, std::ref(thread_stats[t]));
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    const double duration_s = std::chrono::duration<double>(
+                                  std::chrono::steady_clock::now() - start)
+                                  .count();
+    double master_cpu_s = -1;
+    if (master_cpu_start >= 0) {
+        const double master_cpu_end = ProcessCpuSeconds(FLAGS_master_pid);
+        if (master_cpu_end >= 0) {
+            master_cpu_s = master_cpu_end - master_cpu_start;
+        }
+    }
+
+    PrintResults(thread_stats, duration_s, master_cpu_s);
+
+    for (auto& client : clients) {
+        CleanupClient(client);
+    }
+    google::ShutdownGoogleLogging();
+    return 0;
+}
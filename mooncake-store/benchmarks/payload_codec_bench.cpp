@@ -0,0 +1,154 @@
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "payload_codec.h"
+
+// Measures the payload codecs on synthetic FP16 and BF16 KV cache data, and
+// the bandwidth a put or get of it reaches over a link of the given speed:
+// original bytes / (encode + encoded bytes over the link + decode). The
+// "none" rows are the link itself.
+//
+// Usage: payload_codec_bench [value_mb] [link_gbps]
+//        (default: 64 MB values, 100 Gbps)
+
+namespace {
+
+constexpr int kRounds = 5;
+
+// Values of a normal distribution, what attention keys and values look
+// like, as FP16 or BF16 elements
+std::vector<uint8_t> MakeKvData(size_t size, bool bf16) {
+    std::mt19937 rng(1);
+    std::normal_distribution<float> dist(0.0f, 1.0f);
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i + 1 < size; i += 2) {
+        float value = dist(rng);
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        const uint32_t magnitude = bits & 0x7fffffff;
+        uint16_t element = bits >> 16;
+        if (!bf16) {
+            element &= 0x8000;
+            if (magnitude >= 0x38800000) {
+                element |= (magnitude - 0x38000000) >> 13;
+            }
+        }
+        std::memcpy(data.data() + i, &element, sizeof(element));
+    }
+    return data;
+}
+
+double ElementValue(uint16_t element, bool bf16) {
+    if (bf16) {
+        const uint32_t bits = static_cast<uint32_t>(element) << 16;
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    const int exponent = (element >> 10) & 0x1f;
+    const int mantissa = element & 0x3ff;
+    const double value =
+        exponent ? std::ldexp(1.0 + mantissa / 1024.0, exponent - 15)
+                 : std::ldexp(mantissa, -24);
+    return (element & 0x8000) ? -value : value;
+}
+
+double SecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    using namespace mooncake;
+    size_t value_mb = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 64;
+    double link_gbps = argc > 2 ? std::strtod(argv[2], nullptr) : 100.0;
+    const size_t value_size = value_mb << 20;
+    const double link_bytes_per_sec = link_gbps * 1e9 / 8;
+
+    std::cout << "=== Payload Codec Benchmark (" << value_mb << " MB, "
+              << link_gbps << " Gbps link, " << kRounds << " rounds) ==="
+              << std::endl;
+    std::cout << std::left << std::setw(8) << "data" << std::setw(16)
+              << "codec" << std::right << std::setw(8) << "ratio"
+              << std::setw(14) << "encode GB/s" << std::setw(14)
+              << "decode GB/s" << std::setw(14) << "max abs err"
+              << std::setw(16) << "effective GB/s" << std::endl;
+
+    std::vector<uint8_t> decoded(value_size);
+    for (bool bf16 : {false, true}) {
+        const char* dtype = bf16 ? "bf16" : "fp16";
+        auto data = MakeKvData(value_size, bf16);
+        std::vector<Slice> slices = {{data.data(), data.size()}};
+        std::cout << std::left << std::setw(8) << dtype << std::setw(16)
+                  << "none" << std::right << std::fixed
+                  << std::setprecision(2) << std::setw(8) << 1.0
+                  << std::setw(14) << "-" << std::setw(14) << "-"
+                  << std::setw(14) << 0.0 << std::setw(16)
+                  << link_bytes_per_sec / 1e9 << std::endl;
+
+        for (auto id : {PayloadCodecId::BYTE_PLANE,
+                        bf16 ? PayloadCodecId::FP8_FROM_BF16
+                             : PayloadCodecId::FP8_FROM_FP16}) {
+            const PayloadCodec* codec = GetPayloadCodec(id);
+            std::vector<uint8_t> stored(
+                MaxEncodedPayloadSize(*codec, value_size));
+            size_t stored_size = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (int round = 0; round < kRounds; ++round) {
+                auto result = EncodePayload(*codec, slices, stored);
+                if (!result) {
+                    std::cerr << codec->name() << " failed to encode"
+                              << std::endl;
+                    return 1;
+                }
+                stored_size = result.value();
+            }
+            const double encode_sec = SecondsSince(start) / kRounds;
+
+            start = std::chrono::steady_clock::now();
+            for (int round = 0; round < kRounds; ++round) {
+                auto result =
+                    DecodePayload({stored.data(), stored_size},
+                                  {Slice{decoded.data(), value_size}});
+                if (!result) {
+                    std::cerr << codec->name() << " failed to decode"
+                              << std::endl;
+                    return 1;
+                }
+            }
+            const double decode_sec = SecondsSince(start) / kRounds;
+
+            double max_error = 0.0;
+            for (size_t i = 0; i + 1 < value_size; i += 2) {
+                uint16_t original, result;
+                std::memcpy(&original, data.data() + i, sizeof(original));
+                std::memcpy(&result, decoded.data() + i, sizeof(result));
+                max_error = std::max(
+                    max_error, std::fabs(ElementValue(original, bf16) -
+                                         ElementValue(result, bf16)));
+            }
+
+            const double transfer_sec = stored_size / link_bytes_per_sec;
+            const double effective =
+                value_size / (encode_sec + transfer_sec + decode_sec) / 1e9;
+            std::cout << std::left << std::setw(8) << dtype << std::setw(16)
+                      << codec->name() << std::right << std::setw(8)
+                      << static_cast<double>(value_size) / stored_size
+                      << std::setw(14) << value_size / encode_sec / 1e9
+                      << std::setw(14) << value_size / decode_sec / 1e9
+                      << std::setw(14) << max_error << std::setw(16)
+                      << effective << std::endl;
+        }
+    }
+    return 0;
+}
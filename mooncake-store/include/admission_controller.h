@@ -0,0 +1,130 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "ylt/metric/counter.hpp"
+
+namespace mooncake {
+
+struct AdmissionConfig {
+    // Keys per second admitted, a batch counts each key; 0 for no limit
+    uint64_t read_rate = 0;
+    uint64_t write_rate = 0;
+    // Shed requests while the shortest latency of an interval exceeds it,
+    // 0 disables latency-based shedding
+    std::chrono::microseconds target_latency{0};
+    std::chrono::milliseconds interval{100};
+
+    bool enabled() const {
+        return read_rate > 0 || write_rate > 0 || target_latency.count() > 0;
+    }
+};
+
+/**
+ * @brief Decides which requests the master serves when it is overloaded
+ *
+ * Each class of requests has a token bucket refilled at its rate, holding
+ * at most one interval of tokens. A batch larger than what is left is
+ * admitted as long as a token is left, and puts the bucket in debt.
+ *
+ * Like CoDel, the shortest latency of the requests completed in each
+ * interval tells standing queues from bursts: if even the fastest request
+ * took longer than the target, requests wait for each other. Writes are
+ * shed during the next interval, and reads too if it took more than
+ * kReadShedFactor times the target, so that reads, which are cheaper and
+ * which callers wait on, go on while the writes back off. An interval
+ * without completed requests ends the shedding.
+ */
+class AdmissionController {
+   public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class OpClass { READ = 0, WRITE = 1 };
+
+    static constexpr int kReadShedFactor = 4;
+
+    explicit AdmissionController(const AdmissionConfig& config);
+
+    AdmissionController(const AdmissionController&) = delete;
+    AdmissionController& operator=(const AdmissionController&) = delete;
+
+    /**
+     * @brief Whether to serve a request of op over cost keys, or to shed
+     * it with MASTER_BUSY
+     */
+    bool Admit(OpClass op, uint64_t cost,
+               Clock::time_point now = Clock::now());
+
+    /**
+     * @brief Reports the latency of an admitted request
+     */
+    void Complete(Clock::duration latency,
+                  Clock::time_point now = Clock::now());
+
+    // 0 when nothing is shed for latency, 1 when writes are, 2 when reads
+    // are as well
+    int OverloadLevel() const {
+        return level_.load(std::memory_order_relaxed);
+    }
+
+    // Prometheus text for the counters of shed requests
+    std::string SerializeMetrics();
+
+   private:
+    struct TokenBucket {
+        double rate = 0;  // tokens per second, 0 for no limit
+        double burst = 0;
+        double tokens = 0;
+        Clock::time_point last;
+
+        bool Take(uint64_t cost, Clock::time_point now);
+    };
+
+    // Ends the interval if it is over. Called with mutex_ held.
+    void RollInterval(Clock::time_point now);
+
+    const AdmissionConfig config_;
+    std::mutex mutex_;
+    std::array<TokenBucket, 2> buckets_;
+    Clock::time_point interval_start_;
+    Clock::duration interval_min_latency_ = Clock::duration::max();
+    std::atomic<int> level_{0};
+    ylt::metric::counter_t shed_reads_;
+    ylt::metric::counter_t shed_writes_;
+};
+
+/**
+ * @brief Asks the controller to admit a request and reports its latency
+ * when it goes out of scope. A null controller admits everything.
+ */
+class ScopedAdmission {
+   public:
+    ScopedAdmission(AdmissionController* controller,
+                    AdmissionController::OpClass op, uint64_t cost)
+        : controller_(controller),
+          start_(AdmissionController::Clock::now()),
+          admitted_(!controller || controller->Admit(op, cost, start_)) {}
+
+    ~ScopedAdmission() {
+        if (controller_ && admitted_) {
+            controller_->Complete(AdmissionController::Clock::now() - start_);
+        }
+    }
+
+    ScopedAdmission(const ScopedAdmission&) = delete;
+    ScopedAdmission& operator=(const ScopedAdmission&) = delete;
+
+    bool admitted() const { return admitted_; }
+
+   private:
+    AdmissionController* controller_;
+    AdmissionController::Clock::time_point start_;
+    bool admitted_;
+};
+
+}  // namespace mooncake
@@ -1,8 +1,15 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <memory>
+#include <numeric>
 #include <random>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 
 #include "allocator.h"  // Contains BufferAllocator declaration
@@ -34,6 +41,71 @@ class AllocationStrategy {
         const std::unordered_map<std::string, std::vector<std::shared_ptr<BufferAllocator>>>&
             allocators_by_name,
         size_t objectSize, const ReplicateConfig& config) = 0;
+
+    /**
+     * @brief Allocate a slice of one replica of an object.
+     * @param placed_segments Segments holding the object's earlier
+     *        replicas. Strategies that spread replicas across failure domains
+     *        avoid them; by default this is the same as Allocate().
+     */
+    virtual std::unique_ptr<AllocatedBuffer> AllocateReplicaSlice(
+        const std::vector<std::shared_ptr<BufferAllocator>>& allocators,
+        const std::unordered_map<std::string,
+                                 std::vector<std::shared_ptr<BufferAllocator>>>&
+            allocators_by_name,
+        size_t objectSize, const ReplicateConfig& config,
+        const std::vector<std::string>& placed_segments) {
+        return Allocate(allocators, allocators_by_name, objectSize, config);
+    }
+
+    /**
+     * @brief Account bytes transferred to or from a segment. Called by the
+     * master for reads it hands out; strategies that balance by load use it,
+     * the others ignore it.
+     */
+    virtual void RecordTransfer(std::string_view segment_name,
+                                uint64_t bytes) {}
+
+    /**
+     * @brief Whether RecordTransfer has any effect, so callers can skip
+     * collecting the transfers of reads.
+     */
+    virtual bool TracksTransferLoad() const { return false; }
+
+   protected:
+    static size_t FreeBytes(const BufferAllocator& allocator) {
+        const size_t used = allocator.size();
+        const size_t capacity = allocator.capacity();
+        return used < capacity ? capacity - used : 0;
+    }
+
+    /**
+     * @brief Attempts allocation from preferred segment if available and
+     * eligible
+     */
+    static std::unique_ptr<AllocatedBuffer> TryPreferredAllocate(
+        const std::unordered_map<std::string, std::vector<std::shared_ptr<BufferAllocator>>>&
+            allocators,
+        size_t objectSize, const ReplicateConfig& config) {
+        if (config.preferred_segment.empty()) {
+            return nullptr;
+        }
+
+        auto preferred_it = allocators.find(config.preferred_segment);
+        if (preferred_it == allocators.end()) {
+            return nullptr;
+        }
+
+        auto& preferred_allocators = preferred_it->second;
+        for (auto& allocator : preferred_allocators) {
+            auto buffer = allocator->allocate(objectSize);
+            if (buffer != nullptr) {
+                return buffer;
+            }
+        }
+
+        return nullptr;
+    }
 };
 
 /**
@@ -72,34 +144,6 @@ class RandomAllocationStrategy : public AllocationStrategy {
 
     std::mt19937 rng_;  // Mersenne Twister random number generator
 
-    /**
-     * @brief Attempts allocation from preferred segment if available and
-     * eligible
-     */
-    std::unique_ptr<AllocatedBuffer> TryPreferredAllocate(
-        const std::unordered_map<std::string, std::vector<std::shared_ptr<BufferAllocator>>>&
-            allocators,
-        size_t objectSize, const ReplicateConfig& config) {
-        if (config.preferred_segment.empty()) {
-            return nullptr;
-        }
-
-        auto preferred_it = allocators.find(config.preferred_segment);
-        if (preferred_it == allocators.end()) {
-            return nullptr;
-        }
-
-        auto& preferred_allocators = preferred_it->second;
-        for (auto& allocator : preferred_allocators) {
-            auto buffer = allocator->allocate(objectSize);
-            if (buffer != nullptr) {
-                return buffer;
-            }
-        }
-
-        return nullptr;
-    }
-
     /**
      * @brief Attempts allocation with random selection and retry logic
      */
@@ -133,4 +177,385 @@ class RandomAllocationStrategy : public AllocationStrategy {
     }
 };
 
+/**
+ * @brief Power of two choices over the mounted allocators.
+ *
+ * Samples two distinct allocators and tries the better one according to
+ * Prefer(), then the other. Allocators without enough free bytes lose
+ * against ones that have them. If both fail (e.g. due to fragmentation) it
+ * falls back to up to kMaxRetryLimit random allocators.
+ *
+ * Allocate() runs under the shared allocator lock, so concurrent calls are
+ * possible; the random generator is thread local and subclasses keep their
+ * state in atomics.
+ */
+class TwoChoiceAllocationStrategy : public AllocationStrategy {
+   public:
+    std::unique_ptr<AllocatedBuffer> Allocate(
+        const std::vector<std::shared_ptr<BufferAllocator>>& allocators,
+        const std::unordered_map<std::string,
+                                 std::vector<std::shared_ptr<BufferAllocator>>>&
+            allocators_by_name,
+        size_t objectSize, const ReplicateConfig& config) override {
+        if (allocators.empty()) {
+            return nullptr;
+        }
+        if (allocators.size() == 1) {
+            return Allocated(allocators[0]->allocate(objectSize));
+        }
+
+        if (auto preferred_buffer =
+                TryPreferredAllocate(allocators_by_name, objectSize, config)) {
+            return Allocated(std::move(preferred_buffer));
+        }
+
+        auto& rng = ThreadRng();
+        const size_t n = allocators.size();
+        size_t first = std::uniform_int_distribution<size_t>(0, n - 1)(rng);
+        size_t second = std::uniform_int_distribution<size_t>(0, n - 2)(rng);
+        if (second >= first) {
+            ++second;
+        }
+        if (!Better(*allocators[first], *allocators[second], objectSize)) {
+            std::swap(first, second);
+        }
+        for (size_t index : {first, second}) {
+            if (auto buffer = allocators[index]->allocate(objectSize)) {
+                return Allocated(std::move(buffer));
+            }
+        }
+
+        // Both candidates failed, probe other allocators at random
+        const size_t max_tries = std::min(kMaxRetryLimit, n);
+        for (size_t try_count = 0; try_count < max_tries; ++try_count) {
+            size_t index = std::uniform_int_distribution<size_t>(0, n - 1)(rng);
+            if (index == first || index == second) {
+                continue;
+            }
+            if (auto buffer = allocators[index]->allocate(objectSize)) {
+                return Allocated(std::move(buffer));
+            }
+        }
+        return nullptr;
+    }
+
+   protected:
+    /**
+     * @brief Whether allocator a should be tried before allocator b. Both
+     * have enough free bytes for the object, or neither has.
+     */
+    virtual bool Prefer(const BufferAllocator& a,
+                        const BufferAllocator& b) const = 0;
+
+    /**
+     * @brief Called with every buffer handed out
+     */
+    virtual void OnAllocated(const AllocatedBuffer& buffer) {}
+
+   private:
+    static constexpr size_t kMaxRetryLimit = 10;
+
+    static std::mt19937& ThreadRng() {
+        thread_local std::mt19937 rng(std::random_device{}());
+        return rng;
+    }
+
+    bool Better(const BufferAllocator& a, const BufferAllocator& b,
+                size_t objectSize) const {
+        const bool a_fits = FreeBytes(a) >= objectSize;
+        const bool b_fits = FreeBytes(b) >= objectSize;
+        if (a_fits != b_fits) {
+            return a_fits;
+        }
+        return Prefer(a, b);
+    }
+
+    std::unique_ptr<AllocatedBuffer> Allocated(
+        std::unique_ptr<AllocatedBuffer> buffer) {
+        if (buffer) {
+            OnAllocated(*buffer);
+        }
+        return buffer;
+    }
+};
+
+/**
+ * @brief Two-choice strategy that prefers the allocator with more free
+ * bytes, keeping segment utilization balanced so no segment fills up (and
+ * triggers eviction) long before the others.
+ */
+class CapacityAwareAllocationStrategy : public TwoChoiceAllocationStrategy {
+   protected:
+    bool Prefer(const BufferAllocator& a,
+                const BufferAllocator& b) const override {
+        return FreeBytes(a) > FreeBytes(b);
+    }
+};
+
+/**
+ * @brief Recent transfer volume per segment name.
+ *
+ * Segment names are hashed into a fixed array of slots, so distinct
+ * segments may share a slot; with far fewer segments than slots this only
+ * rarely merges two loads. Each slot counts the bytes of the current time
+ * window and keeps the previous one, and the load is the current window
+ * plus half of the previous, so bursts fade out within two windows. All
+ * operations are lock-free.
+ */
+class SegmentLoadTracker {
+   public:
+    static constexpr size_t kNumSlots = 1024;
+
+    explicit SegmentLoadTracker(
+        std::chrono::steady_clock::duration window = std::chrono::seconds(1))
+        : window_(window) {}
+
+    void Record(std::string_view segment_name, uint64_t bytes) {
+        Slot& slot = SlotOf(segment_name);
+        const int64_t now = CurrentWindow();
+        int64_t seen = slot.window.load(std::memory_order_acquire);
+        if (seen != now &&
+            slot.window.compare_exchange_strong(seen, now,
+                                                std::memory_order_acq_rel)) {
+            const uint64_t last = slot.current.exchange(0);
+            slot.previous.store(seen + 1 == now ? last : 0,
+                                std::memory_order_relaxed);
+        }
+        slot.current.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    uint64_t Load(std::string_view segment_name) const {
+        const Slot& slot = SlotOf(segment_name);
+        const int64_t now = CurrentWindow();
+        const int64_t seen = slot.window.load(std::memory_order_acquire);
+        const uint64_t current = slot.current.load(std::memory_order_relaxed);
+        if (seen == now) {
+            return current +
+                   slot.previous.load(std::memory_order_relaxed) / 2;
+        }
+        return seen + 1 == now ? current / 2 : 0;
+    }
+
+   private:
+    struct Slot {
+        std::atomic<int64_t> window{0};
+        std::atomic<uint64_t> current{0};
+        std::atomic<uint64_t> previous{0};
+    };
+
+    int64_t CurrentWindow() const {
+        return std::chrono::steady_clock::now().time_since_epoch() / window_;
+    }
+
+    Slot& SlotOf(std::string_view segment_name) {
+        return slots_[std::hash<std::string_view>{}(segment_name) % kNumSlots];
+    }
+    const Slot& SlotOf(std::string_view segment_name) const {
+        return slots_[std::hash<std::string_view>{}(segment_name) % kNumSlots];
+    }
+
+    const std::chrono::steady_clock::duration window_;
+    std::array<Slot, kNumSlots> slots_;
+};
+
+/**
+ * @brief Two-choice strategy that prefers the segment with less recent
+ * transfer load, breaking ties by free bytes.
+ *
+ * The load of a segment is the bytes written into buffers allocated on it
+ * plus the bytes of reads the master reported through RecordTransfer, so
+ * hot segments (and the NICs serving them) stop receiving new objects until
+ * their traffic cools down.
+ */
+class LoadAwareAllocationStrategy : public TwoChoiceAllocationStrategy {
+   public:
+    explicit LoadAwareAllocationStrategy(
+        std::chrono::steady_clock::duration window = std::chrono::seconds(1))
+        : load_(window) {}
+
+    void RecordTransfer(std::string_view segment_name,
+                        uint64_t bytes) override {
+        load_.Record(segment_name, bytes);
+    }
+
+    bool TracksTransferLoad() const override { return true; }
+
+    uint64_t Load(std::string_view segment_name) const {
+        return load_.Load(segment_name);
+    }
+
+   protected:
+    bool Prefer(const BufferAllocator& a,
+                const BufferAllocator& b) const override {
+        const uint64_t load_a = load_.Load(a.getSegmentName());
+        const uint64_t load_b = load_.Load(b.getSegmentName());
+        if (load_a != load_b) {
+            return load_a < load_b;
+        }
+        return FreeBytes(a) > FreeBytes(b);
+    }
+
+    void OnAllocated(const AllocatedBuffer& buffer) override {
+        const auto descriptor = buffer.get_descriptor();
+        load_.Record(descriptor.segment_name_, descriptor.size_);
+    }
+
+   private:
+    SegmentLoadTracker load_;
+};
+
+/**
+ * @brief Topology-aware replica placement.
+ *
+ * Segments carry the host, rack and NIC labels reported at mount time. Each
+ * replica goes to a different failure domain than the object's earlier
+ * replicas: never the same host if another host has room, and a different
+ * rack when racks are labelled. Among the allocators that spread replicas
+ * equally well it prefers the requesting client's locality, taken from the
+ * topology of the preferred segment: the same host and NIC, then the same
+ * host, then the same rack. Remaining ties are broken at random.
+ *
+ * The preferred segment itself is only used while it does not share a
+ * failure domain with an earlier replica.
+ */
+class TopologyAwareAllocationStrategy : public AllocationStrategy {
+   public:
+    std::unique_ptr<AllocatedBuffer> Allocate(
+        const std::vector<std::shared_ptr<BufferAllocator>>& allocators,
+        const std::unordered_map<std::string,
+                                 std::vector<std::shared_ptr<BufferAllocator>>>&
+            allocators_by_name,
+        size_t objectSize, const ReplicateConfig& config) override {
+        return AllocateReplicaSlice(allocators, allocators_by_name, objectSize,
+                                    config, {});
+    }
+
+    std::unique_ptr<AllocatedBuffer> AllocateReplicaSlice(
+        const std::vector<std::shared_ptr<BufferAllocator>>& allocators,
+        const std::unordered_map<std::string,
+                                 std::vector<std::shared_ptr<BufferAllocator>>>&
+            allocators_by_name,
+        size_t objectSize, const ReplicateConfig& config,
+        const std::vector<std::string>& placed_segments) override {
+        if (allocators.empty()) {
+            return nullptr;
+        }
+
+        std::vector<const SegmentTopology*> placed;
+        placed.reserve(placed_segments.size());
+        for (const auto& name : placed_segments) {
+            if (const auto* topology = TopologyOf(allocators_by_name, name)) {
+                placed.push_back(topology);
+            }
+        }
+
+        const SegmentTopology* client =
+            TopologyOf(allocators_by_name, config.preferred_segment);
+        if (client != nullptr && SpreadPenalty(*client, placed) == 0) {
+            if (auto buffer = TryPreferredAllocate(allocators_by_name,
+                                                   objectSize, config)) {
+                return buffer;
+            }
+        }
+
+        struct Candidate {
+            int penalty;
+            int locality;
+            size_t index;
+        };
+        std::vector<Candidate> candidates;
+        candidates.reserve(allocators.size());
+        for (size_t i = 0; i < allocators.size(); ++i) {
+            const auto& allocator = *allocators[i];
+            if (FreeBytes(allocator) < objectSize) {
+                continue;
+            }
+            const auto& topology = allocator.getTopology();
+            candidates.push_back(
+                {SpreadPenalty(topology, placed),
+                 client ? Locality(topology, *client) : 0, i});
+        }
+        std::shuffle(candidates.begin(), candidates.end(), ThreadRng());
+        std::stable_sort(candidates.begin(), candidates.end(),
+                         [](const Candidate& a, const Candidate& b) {
+                             if (a.penalty != b.penalty) {
+                                 return a.penalty < b.penalty;
+                             }
+                             return a.locality > b.locality;
+                         });
+
+        const size_t max_tries = std::min(kMaxRetryLimit, candidates.size());
+        for (size_t i = 0; i < max_tries; ++i) {
+            if (auto buffer =
+                    allocators[candidates[i].index]->allocate(objectSize)) {
+                return buffer;
+            }
+        }
+        return nullptr;
+    }
+
+   private:
+    static constexpr size_t kMaxRetryLimit = 10;
+
+    static std::mt19937& ThreadRng() {
+        thread_local std::mt19937 rng(std::random_device{}());
+        return rng;
+    }
+
+    static const SegmentTopology* TopologyOf(
+        const std::unordered_map<std::string,
+                                 std::vector<std::shared_ptr<BufferAllocator>>>&
+            allocators_by_name,
+        const std::string& segment_name) {
+        if (segment_name.empty()) {
+            return nullptr;
+        }
+        auto it = allocators_by_name.find(segment_name);
+        if (it == allocators_by_name.end() || it->second.empty()) {
+            return nullptr;
+        }
+        return &it->second.front()->getTopology();
+    }
+
+    // 0: new failure domain, 1: same rack as an earlier replica, 2: same host
+    static int SpreadPenalty(
+        const SegmentTopology& topology,
+        const std::vector<const SegmentTopology*>& placed) {
+        int penalty = 0;
+        for (const auto* other : placed) {
+            if (topology.host == other->host) {
+                return 2;
+            }
+            if (!topology.rack.empty() && topology.rack == other->rack) {
+                penalty = 1;
+            }
+        }
+        return penalty;
+    }
+
+    // Higher is closer to the client
+    static int Locality(const SegmentTopology& topology,
+                        const SegmentTopology& client) {
+        if (topology.host == client.host) {
+            return !client.nic.empty() && topology.nic == client.nic ? 3 : 2;
+        }
+        return !client.rack.empty() && topology.rack == client.rack ? 1 : 0;
+    }
+};
+
+inline std::shared_ptr<AllocationStrategy> CreateAllocationStrategy(
+    AllocationStrategyType type) {
+    switch (type) {
+        case AllocationStrategyType::CAPACITY_AWARE:
+            return std::make_shared<CapacityAwareAllocationStrategy>();
+        case AllocationStrategyType::LOAD_AWARE:
+            return std::make_shared<LoadAwareAllocationStrategy>();
+        case AllocationStrategyType::TOPOLOGY_AWARE:
+            return std::make_shared<TopologyAwareAllocationStrategy>();
+        case AllocationStrategyType::RANDOM:
+        default:
+            return std::make_shared<RandomAllocationStrategy>();
+    }
+}
+
 }  // namespace mooncake
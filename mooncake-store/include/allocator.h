@@ -2,11 +2,16 @@
 #define BUFFER_ALLOCATOR_H
 
 #include <atomic>
+#include <chrono>
+#include <deque>
 #include <memory>
+#include <optional>
 #include <string>
 
 #include "cachelib_memory_allocator/MemoryAllocator.h"
 #include "master_metric_manager.h"
+#include "mutex.h"
+#include "offset_allocator/offset_allocator.hpp"
 #include "types.h"
 
 using facebook::cachelib::MemoryAllocator;
@@ -16,7 +21,9 @@ namespace mooncake {
 
 /**
  * BufferAllocator manages memory allocation using CacheLib's slab allocation
- * strategy.
+ * strategy, or with BufferAllocatorType::OFFSET the TLSF-style
+ * OffsetAllocator, which allocates the requested sizes without rounding
+ * them up to slab classes.
  *
  * Important alignment requirements:
  * 1. Base address must be at least 8-byte aligned (CacheLib requirement)
@@ -38,21 +45,66 @@ namespace mooncake {
  */
 class BufferAllocator : public std::enable_shared_from_this<BufferAllocator> {
    public:
-    BufferAllocator(std::string segment_name, size_t base, size_t size);
+    // With BufferAllocatorType::OFFSET, freed space is only reused after
+    // free_delay, see MasterService::kRestoreFreeDelay
+    BufferAllocator(std::string segment_name, size_t base, size_t size,
+                    SegmentTopology topology = {},
+                    BufferAllocatorType type = DEFAULT_BUFFER_ALLOCATOR_TYPE,
+                    std::chrono::steady_clock::duration free_delay = {});
 
     ~BufferAllocator();
 
     std::unique_ptr<AllocatedBuffer> allocate(size_t size);
 
+    // Allocate size bytes at address, e.g. to restore a buffer allocated by
+    // a previous master. Only supported by BufferAllocatorType::OFFSET:
+    // CacheLib places allocations by size class, null for it.
+    std::unique_ptr<AllocatedBuffer> allocateAt(uintptr_t address,
+                                                size_t size);
+
+    // Only queues the free, e.g. while a metadata shard lock is held. The
+    // space counts as free at once, and the queued frees are done in a
+    // batch by the next allocation or by releasePendingFrees.
     void deallocate(AllocatedBuffer* handle);
 
+    // Do the queued frees, except the delayed ones whose delay is not over
+    void releasePendingFrees();
+
     size_t capacity() const { return total_size_; }
     size_t size() const { return cur_size_.load(); }
-    std::string getSegmentName() const { return segment_name_; }
+    const std::string& getSegmentName() const { return segment_name_; }
+    const SegmentTopology& getTopology() const { return topology_; }
+    BufferAllocatorType getType() const { return type_; }
+
+    // 1 - largest free region / free space, 0 when the free space is one
+    // region. Only measured for BufferAllocatorType::OFFSET, CacheLib
+    // allocators report 0.
+    double fragmentation();
 
    private:
+    static constexpr uint64_t kOffsetAllocatorAvgObjectSize = 64 * 1024;
+    static constexpr uint64_t kOffsetAllocatorMinAllocs = 128 * 1024;
+    static constexpr uint64_t kOffsetAllocatorMaxAllocs = 4 * 1024 * 1024;
+    // Slabs at most this used are taken from cold allocation classes
+    static constexpr double kSlabRebalanceMaxOccupancy = 0.25;
+    // Slabs waiting for their objects to be freed, so that a burst of
+    // failures does not stall a large part of the segment
+    static constexpr int64_t kMaxReleasingSlabs = 16;
+
+    std::unique_ptr<AllocatedBuffer> allocateOffset(size_t size);
+
+    // Called when no slab is left for an allocation of size. Releases the
+    // least used slab of every other allocation class if it is mostly empty:
+    // empty slabs go back to the pool right away, the others stop taking
+    // allocations and go back once their remaining objects are freed, e.g.
+    // evicted. True if a slab went back to the pool.
+    bool rebalanceSlabs(size_t size);
+
     // metadata
     const std::string segment_name_;
+    // SegmentNameTable ID of segment_name_, kept by the buffers
+    const uint32_t segment_id_;
+    SegmentTopology topology_;
     const size_t base_;
     const size_t total_size_;
     std::atomic_size_t cur_size_;
@@ -64,6 +116,21 @@ class BufferAllocator : public std::enable_shared_from_this<BufferAllocator> {
     size_t header_region_size_;
     std::unique_ptr<facebook::cachelib::MemoryAllocator> memory_allocator_;
     facebook::cachelib::PoolId pool_id_;
+
+    const BufferAllocatorType type_;
+    std::shared_ptr<offset_allocator::OffsetAllocator> offset_allocator_;
+
+    // Queued frees, oldest first. Freed OFFSET allocations may not be
+    // reused before free_delay_, so release_at never decreases.
+    struct PendingFree {
+        std::chrono::steady_clock::time_point release_at;
+        // The OFFSET allocation, or else the CacheLib one at buffer
+        std::optional<offset_allocator::OffsetAllocationHandle> handle;
+        void* buffer{nullptr};
+    };
+    const std::chrono::steady_clock::duration free_delay_;
+    Mutex pending_frees_mutex_;
+    std::deque<PendingFree> pending_frees_ GUARDED_BY(pending_frees_mutex_);
 };
 
 // The main difference is that it allocates real memory and returns it, while
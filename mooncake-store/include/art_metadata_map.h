@@ -0,0 +1,884 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <optional>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace mooncake {
+
+/**
+ * @brief Adaptive radix tree from string keys to non-movable values, a
+ * drop-in replacement for the per-shard std::unordered_map<std::string, V>
+ * in MasterService that also keeps the keys in lexicographic order.
+ *
+ * Layout:
+ * - Inner nodes have 4, 16, 48 or 256 children by the next key byte and
+ *   grow or shrink between those sizes, so sparse levels stay small.
+ * - Runs of bytes shared by all keys below a node are compressed into the
+ *   node. Up to kMaxStoredPrefix of them are stored in the node; lookups
+ *   skip the rest and the leaf check catches a mismatch, inserts read them
+ *   from a leaf below.
+ * - A key that ends at a node, e.g. "a" next to "ab", hangs off that node
+ *   as its terminal leaf, which sorts before the children.
+ * - Each leaf is a single allocation holding the value and the full key.
+ *   Values never move, so references returned by find() stay valid as
+ *   other keys are added and removed, just like std::unordered_map.
+ *
+ * Iterators hold the path to their leaf and rebuild it from the key when
+ * the tree changed under them, so only erasing an element invalidates the
+ * iterators to it, and erase(it) during iteration returns the next one.
+ *
+ * This class is not thread-safe; callers hold the shard mutex. Lookups do
+ * not modify the tree, so they may run concurrently under a shared lock.
+ */
+template <typename V>
+class ArtMetadataMap {
+   public:
+    static constexpr size_t kMaxStoredPrefix = 12;
+
+   private:
+    enum NodeType : uint8_t { kLeaf, kNode4, kNode16, kNode48, kNode256 };
+
+    struct Node {
+        explicit Node(NodeType t) : type(t) {}
+        NodeType type;
+    };
+
+    struct Leaf : Node {
+        template <typename... Args>
+        Leaf(std::string_view k, Args&&... args)
+            : Node(kLeaf),
+              key_len(static_cast<uint32_t>(k.size())),
+              value(std::forward<Args>(args)...) {
+            std::memcpy(key_data(), k.data(), k.size());
+        }
+
+        char* key_data() { return reinterpret_cast<char*>(this + 1); }
+        const char* key_data() const {
+            return reinterpret_cast<const char*>(this + 1);
+        }
+        std::string_view key() const { return {key_data(), key_len}; }
+
+        uint32_t key_len;
+        V value;
+    };
+
+    struct Inner : Node {
+        explicit Inner(NodeType t) : Node(t) {}
+        uint16_t num_children = 0;
+        uint32_t prefix_len = 0;
+        char prefix[kMaxStoredPrefix] = {};
+        Leaf* terminal = nullptr;
+    };
+
+    struct Node4 : Inner {
+        Node4() : Inner(kNode4) {}
+        uint8_t keys[4];
+        Node* children[4];
+    };
+
+    struct Node16 : Inner {
+        Node16() : Inner(kNode16) {}
+        uint8_t keys[16];
+        Node* children[16];
+    };
+
+    struct Node48 : Inner {
+        Node48() : Inner(kNode48) { std::memset(index, 0, sizeof(index)); }
+        // Slot of each key byte in children plus one, 0 if absent
+        uint8_t index[256];
+        Node* children[48] = {};
+    };
+
+    struct Node256 : Inner {
+        Node256() : Inner(kNode256) {}
+        Node* children[256] = {};
+    };
+
+    // Position of an iterator in an inner node: the terminal leaf (-1) or
+    // the child of a key byte
+    struct Frame {
+        const Inner* node;
+        int byte;
+    };
+
+   public:
+    // Iterator dereferences to a pair-like proxy so that call sites written
+    // against std::unordered_map (it->first, it->second) keep working.
+    struct value_type {
+        std::string_view first;
+        V& second;
+    };
+
+    template <bool kConst>
+    class IteratorBase {
+       public:
+        using map_type =
+            std::conditional_t<kConst, const ArtMetadataMap, ArtMetadataMap>;
+
+        IteratorBase() = default;
+
+        // Allow converting a mutable iterator into a const iterator
+        template <bool kOther, typename = std::enable_if_t<kConst && !kOther>>
+        IteratorBase(const IteratorBase<kOther>& other)
+            : map_(other.map_),
+              leaf_(other.leaf_),
+              path_(other.path_),
+              version_(other.version_) {}
+
+        // The cached proxy holds a reference, so copies only carry the
+        // position and rebuild the proxy lazily.
+        IteratorBase(const IteratorBase& other)
+            : map_(other.map_),
+              leaf_(other.leaf_),
+              path_(other.path_),
+              version_(other.version_) {}
+        IteratorBase& operator=(const IteratorBase& other) {
+            map_ = other.map_;
+            leaf_ = other.leaf_;
+            path_ = other.path_;
+            version_ = other.version_;
+            proxy_.reset();
+            return *this;
+        }
+
+        value_type operator*() const { return {leaf_->key(), leaf_->value}; }
+
+        const value_type* operator->() const {
+            proxy_.reset();
+            proxy_.emplace(**this);
+            return &*proxy_;
+        }
+
+        IteratorBase& operator++() {
+            if (version_ != map_->version_) {
+                // The path is stale or was never built, e.g. by find()
+                map_->SeekAtLeast(leaf_->key(), path_, leaf_);
+                version_ = map_->version_;
+            }
+            map_->Advance(path_, leaf_);
+            proxy_.reset();
+            return *this;
+        }
+
+        IteratorBase operator++(int) {
+            IteratorBase prev = *this;
+            ++*this;
+            return prev;
+        }
+
+        bool operator==(const IteratorBase& other) const {
+            return leaf_ == other.leaf_;
+        }
+        bool operator!=(const IteratorBase& other) const {
+            return leaf_ != other.leaf_;
+        }
+
+       private:
+        friend class ArtMetadataMap;
+        template <bool>
+        friend class IteratorBase;
+
+        IteratorBase(map_type* map, Leaf* leaf, std::vector<Frame> path,
+                     uint64_t version)
+            : map_(map), leaf_(leaf), path_(std::move(path)),
+              version_(version) {}
+
+        map_type* map_{nullptr};
+        Leaf* leaf_{nullptr};  // nullptr at end()
+        std::vector<Frame> path_;
+        uint64_t version_{0};
+        mutable std::optional<value_type> proxy_;
+    };
+
+    using iterator = IteratorBase<false>;
+    using const_iterator = IteratorBase<true>;
+
+    ArtMetadataMap() = default;
+    ~ArtMetadataMap() { clear(); }
+
+    ArtMetadataMap(const ArtMetadataMap&) = delete;
+    ArtMetadataMap& operator=(const ArtMetadataMap&) = delete;
+
+    iterator begin() { return Begin<iterator>(this); }
+    iterator end() { return iterator(this, nullptr, {}, 0); }
+    const_iterator begin() const { return Begin<const_iterator>(this); }
+    const_iterator end() const { return const_iterator(this, nullptr, {}, 0); }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    iterator find(std::string_view key) {
+        // The path is built only if the iterator is advanced
+        return iterator(this, FindLeaf(key), {}, kNoPath);
+    }
+
+    const_iterator find(std::string_view key) const {
+        return const_iterator(this, FindLeaf(key), {}, kNoPath);
+    }
+
+    bool contains(std::string_view key) const {
+        return FindLeaf(key) != nullptr;
+    }
+
+    /**
+     * @brief First element whose key is not less than key, e.g. the first
+     * key of a prefix
+     */
+    iterator lower_bound(std::string_view key) {
+        return LowerBound<iterator>(this, key);
+    }
+
+    const_iterator lower_bound(std::string_view key) const {
+        return LowerBound<const_iterator>(this, key);
+    }
+
+    /**
+     * @brief Construct the value in place if the key is absent.
+     * @return iterator to the element and whether an insertion happened
+     */
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(std::string_view key,
+                                          Args&&... args) {
+        if (Leaf* leaf = FindLeaf(key)) {
+            return {iterator(this, leaf, {}, kNoPath), false};
+        }
+        // Construct the value before touching the tree so that an exception
+        // in the constructor leaves the map unchanged.
+        Leaf* leaf = NewLeaf(key, std::forward<Args>(args)...);
+        Insert(leaf);
+        ++size_;
+        ++version_;
+        return {iterator(this, leaf, {}, kNoPath), true};
+    }
+
+    // std::unordered_map compatible piecewise emplace used by existing code
+    template <typename... KArgs, typename... VArgs>
+    std::pair<iterator, bool> emplace(std::piecewise_construct_t,
+                                      std::tuple<KArgs...> key_args,
+                                      std::tuple<VArgs...> value_args) {
+        return std::apply(
+            [&](auto&&... vargs) {
+                return try_emplace(std::string_view(std::get<0>(key_args)),
+                                   std::forward<decltype(vargs)>(vargs)...);
+            },
+            std::move(value_args));
+    }
+
+    iterator erase(iterator it) {
+        iterator next = it;
+        ++next;
+        Erase(it.leaf_->key());
+        if (next.leaf_ == nullptr) {
+            return end();
+        }
+        // Erasing may have merged the nodes on the path of next
+        std::vector<Frame> path;
+        Leaf* leaf = nullptr;
+        SeekAtLeast(next.leaf_->key(), path, leaf);
+        return iterator(this, leaf, std::move(path), version_);
+    }
+
+    size_t erase(std::string_view key) { return Erase(key) ? 1 : 0; }
+
+    void clear() {
+        if (root_ != nullptr) {
+            FreeTree(root_);
+            root_ = nullptr;
+        }
+        size_ = 0;
+        ++version_;
+    }
+
+    // Nodes are allocated as keys are added, nothing to reserve
+    void reserve(size_t) {}
+
+   private:
+    static constexpr uint64_t kNoPath = ~uint64_t{0};
+
+    static uint8_t Byte(std::string_view key, size_t depth) {
+        return static_cast<uint8_t>(key[depth]);
+    }
+
+    template <typename... Args>
+    static Leaf* NewLeaf(std::string_view key, Args&&... args) {
+        void* memory = ::operator new(sizeof(Leaf) + key.size());
+        try {
+            return new (memory) Leaf(key, std::forward<Args>(args)...);
+        } catch (...) {
+            ::operator delete(memory);
+            throw;
+        }
+    }
+
+    static void FreeLeaf(Leaf* leaf) {
+        leaf->~Leaf();
+        ::operator delete(leaf);
+    }
+
+    static void FreeInner(Inner* node) {
+        switch (node->type) {
+            case kNode4:
+                delete static_cast<Node4*>(node);
+                break;
+            case kNode16:
+                delete static_cast<Node16*>(node);
+                break;
+            case kNode48:
+                delete static_cast<Node48*>(node);
+                break;
+            default:
+                delete static_cast<Node256*>(node);
+        }
+    }
+
+    static void FreeTree(Node* node) {
+        if (node->type == kLeaf) {
+            FreeLeaf(static_cast<Leaf*>(node));
+            return;
+        }
+        auto* inner = static_cast<Inner*>(node);
+        if (inner->terminal != nullptr) {
+            FreeLeaf(inner->terminal);
+        }
+        for (int byte = NextChild(inner, 0); byte >= 0;
+             byte = NextChild(inner, byte + 1)) {
+            FreeTree(*ChildRef(inner, static_cast<uint8_t>(byte)));
+        }
+        FreeInner(inner);
+    }
+
+    // Slot of the child of byte, nullptr if there is none
+    static Node** ChildRef(Inner* node, uint8_t byte) {
+        switch (node->type) {
+            case kNode4: {
+                auto* n = static_cast<Node4*>(node);
+                for (int i = 0; i < n->num_children; ++i) {
+                    if (n->keys[i] == byte) return &n->children[i];
+                }
+                return nullptr;
+            }
+            case kNode16: {
+                auto* n = static_cast<Node16*>(node);
+                for (int i = 0; i < n->num_children; ++i) {
+                    if (n->keys[i] == byte) return &n->children[i];
+                }
+                return nullptr;
+            }
+            case kNode48: {
+                auto* n = static_cast<Node48*>(node);
+                return n->index[byte] ? &n->children[n->index[byte] - 1]
+                                      : nullptr;
+            }
+            default: {
+                auto* n = static_cast<Node256*>(node);
+                return n->children[byte] ? &n->children[byte] : nullptr;
+            }
+        }
+    }
+
+    static Node* Child(const Inner* node, uint8_t byte) {
+        Node** ref = ChildRef(const_cast<Inner*>(node), byte);
+        return ref ? *ref : nullptr;
+    }
+
+    // Smallest key byte of a child not less than from, -1 if there is none
+    static int NextChild(const Inner* node, int from) {
+        switch (node->type) {
+            case kNode4: {
+                auto* n = static_cast<const Node4*>(node);
+                for (int i = 0; i < n->num_children; ++i) {
+                    if (n->keys[i] >= from) return n->keys[i];
+                }
+                return -1;
+            }
+            case kNode16: {
+                auto* n = static_cast<const Node16*>(node);
+                for (int i = 0; i < n->num_children; ++i) {
+                    if (n->keys[i] >= from) return n->keys[i];
+                }
+                return -1;
+            }
+            case kNode48: {
+                auto* n = static_cast<const Node48*>(node);
+                for (int byte = from; byte < 256; ++byte) {
+                    if (n->index[byte]) return byte;
+                }
+                return -1;
+            }
+            default: {
+                auto* n = static_cast<const Node256*>(node);
+                for (int byte = from; byte < 256; ++byte) {
+                    if (n->children[byte]) return byte;
+                }
+                return -1;
+            }
+        }
+    }
+
+    // Any leaf below node, to read the prefix bytes that are not stored
+    static const Leaf* AnyLeaf(const Node* node) {
+        while (node->type != kLeaf) {
+            auto* inner = static_cast<const Inner*>(node);
+            if (inner->terminal != nullptr) {
+                return inner->terminal;
+            }
+            node = Child(inner, static_cast<uint8_t>(NextChild(inner, 0)));
+        }
+        return static_cast<const Leaf*>(node);
+    }
+
+    // Sets the prefix of node to the len bytes of key from depth, key being
+    // that of a leaf below it
+    static void SetPrefix(Inner* node, std::string_view key, size_t depth,
+                          size_t len) {
+        node->prefix_len = static_cast<uint32_t>(len);
+        std::memcpy(node->prefix, key.data() + depth,
+                    std::min(len, kMaxStoredPrefix));
+    }
+
+    // Whether key may continue with the prefix of node at depth, comparing
+    // only the stored bytes of the prefix
+    static bool PrefixMayMatch(const Inner* node, std::string_view key,
+                               size_t depth) {
+        if (key.size() < depth + node->prefix_len) {
+            return false;
+        }
+        const size_t stored =
+            std::min<size_t>(node->prefix_len, kMaxStoredPrefix);
+        return std::memcmp(node->prefix, key.data() + depth, stored) == 0;
+    }
+
+    // Length of the common run of key from depth and the whole prefix of
+    // node
+    static size_t PrefixMismatch(const Inner* node, std::string_view key,
+                                 size_t depth) {
+        const size_t limit =
+            std::min<size_t>(node->prefix_len, key.size() - depth);
+        const size_t stored = std::min(limit, kMaxStoredPrefix);
+        size_t i = 0;
+        for (; i < stored; ++i) {
+            if (node->prefix[i] != key[depth + i]) return i;
+        }
+        if (i < limit) {
+            std::string_view full = AnyLeaf(node)->key();
+            for (; i < limit; ++i) {
+                if (full[depth + i] != key[depth + i]) return i;
+            }
+        }
+        return i;
+    }
+
+    Leaf* FindLeaf(std::string_view key) const {
+        const Node* node = root_;
+        size_t depth = 0;
+        while (node != nullptr) {
+            if (node->type == kLeaf) {
+                auto* leaf = const_cast<Leaf*>(static_cast<const Leaf*>(node));
+                return leaf->key() == key ? leaf : nullptr;
+            }
+            auto* inner = static_cast<const Inner*>(node);
+            if (!PrefixMayMatch(inner, key, depth)) {
+                return nullptr;
+            }
+            depth += inner->prefix_len;
+            if (depth == key.size()) {
+                Leaf* leaf = inner->terminal;
+                return leaf != nullptr && leaf->key() == key ? leaf : nullptr;
+            }
+            node = Child(inner, Byte(key, depth));
+            ++depth;
+        }
+        return nullptr;
+    }
+
+    // Hangs leaf at depth below node, which ends its prefix there
+    static void Attach(Node** ref, Leaf* leaf, size_t depth) {
+        auto* node = static_cast<Inner*>(*ref);
+        if (leaf->key_len == depth) {
+            node->terminal = leaf;
+        } else {
+            AddChild(ref, Byte(leaf->key(), depth), leaf);
+        }
+    }
+
+    void Insert(Leaf* leaf) {
+        const std::string_view key = leaf->key();
+        Node** ref = &root_;
+        size_t depth = 0;
+        while (true) {
+            Node* node = *ref;
+            if (node == nullptr) {
+                *ref = leaf;
+                return;
+            }
+            if (node->type == kLeaf) {
+                // Split the leaf into a node of the bytes both keys share
+                auto* other = static_cast<Leaf*>(node);
+                const std::string_view other_key = other->key();
+                size_t common = 0;
+                while (depth + common < key.size() &&
+                       depth + common < other_key.size() &&
+                       key[depth + common] == other_key[depth + common]) {
+                    ++common;
+                }
+                auto* split = new Node4();
+                SetPrefix(split, key, depth, common);
+                *ref = split;
+                Attach(ref, other, depth + common);
+                Attach(ref, leaf, depth + common);
+                return;
+            }
+            auto* inner = static_cast<Inner*>(node);
+            if (inner->prefix_len > 0) {
+                const size_t common = PrefixMismatch(inner, key, depth);
+                if (common < inner->prefix_len) {
+                    // Split the prefix where the key leaves it
+                    const std::string_view full = AnyLeaf(inner)->key();
+                    auto* split = new Node4();
+                    SetPrefix(split, key, depth, common);
+                    const uint8_t byte = Byte(full, depth + common);
+                    SetPrefix(inner, full, depth + common + 1,
+                              inner->prefix_len - common - 1);
+                    *ref = split;
+                    AddChild(ref, byte, inner);
+                    Attach(ref, leaf, depth + common);
+                    return;
+                }
+                depth += inner->prefix_len;
+            }
+            if (depth == key.size()) {
+                inner->terminal = leaf;
+                return;
+            }
+            Node** child = ChildRef(inner, Byte(key, depth));
+            if (child == nullptr) {
+                AddChild(ref, Byte(key, depth), leaf);
+                return;
+            }
+            ref = child;
+            ++depth;
+        }
+    }
+
+    template <typename From, typename To>
+    static To* Resize(From* from) {
+        auto* to = new To();
+        to->prefix_len = from->prefix_len;
+        std::memcpy(to->prefix, from->prefix, kMaxStoredPrefix);
+        to->terminal = from->terminal;
+        for (int byte = NextChild(from, 0); byte >= 0;
+             byte = NextChild(from, byte + 1)) {
+            AddChildNoGrow(to, static_cast<uint8_t>(byte),
+                           Child(from, static_cast<uint8_t>(byte)));
+        }
+        delete from;
+        return to;
+    }
+
+    // Adds a child to a node with room for it
+    template <typename N>
+    static void AddChildNoGrow(N* node, uint8_t byte, Node* child) {
+        if constexpr (std::is_same_v<N, Node4> || std::is_same_v<N, Node16>) {
+            int i = node->num_children;
+            for (; i > 0 && node->keys[i - 1] > byte; --i) {
+                node->keys[i] = node->keys[i - 1];
+                node->children[i] = node->children[i - 1];
+            }
+            node->keys[i] = byte;
+            node->children[i] = child;
+        } else if constexpr (std::is_same_v<N, Node48>) {
+            int slot = 0;
+            while (node->children[slot] != nullptr) ++slot;
+            node->children[slot] = child;
+            node->index[byte] = static_cast<uint8_t>(slot + 1);
+        } else {
+            node->children[byte] = child;
+        }
+        ++node->num_children;
+    }
+
+    static void AddChild(Node** ref, uint8_t byte, Node* child) {
+        auto* node = static_cast<Inner*>(*ref);
+        switch (node->type) {
+            case kNode4: {
+                auto* n = static_cast<Node4*>(node);
+                if (n->num_children < 4) {
+                    AddChildNoGrow(n, byte, child);
+                    return;
+                }
+                *ref = Resize<Node4, Node16>(n);
+                break;
+            }
+            case kNode16: {
+                auto* n = static_cast<Node16*>(node);
+                if (n->num_children < 16) {
+                    AddChildNoGrow(n, byte, child);
+                    return;
+                }
+                *ref = Resize<Node16, Node48>(n);
+                break;
+            }
+            case kNode48: {
+                auto* n = static_cast<Node48*>(node);
+                if (n->num_children < 48) {
+                    AddChildNoGrow(n, byte, child);
+                    return;
+                }
+                *ref = Resize<Node48, Node256>(n);
+                break;
+            }
+            default:
+                AddChildNoGrow(static_cast<Node256*>(node), byte, child);
+                return;
+        }
+        AddChild(ref, byte, child);
+    }
+
+    // Removes the child of byte, shrinking the node once it is a quarter
+    // full or so
+    static void RemoveChild(Node** ref, uint8_t byte) {
+        auto* node = static_cast<Inner*>(*ref);
+        switch (node->type) {
+            case kNode4:
+            case kNode16: {
+                uint8_t* keys = node->type == kNode4
+                                    ? static_cast<Node4*>(node)->keys
+                                    : static_cast<Node16*>(node)->keys;
+                Node** children = node->type == kNode4
+                                      ? static_cast<Node4*>(node)->children
+                                      : static_cast<Node16*>(node)->children;
+                int i = 0;
+                while (keys[i] != byte) ++i;
+                for (; i + 1 < node->num_children; ++i) {
+                    keys[i] = keys[i + 1];
+                    children[i] = children[i + 1];
+                }
+                --node->num_children;
+                if (node->type == kNode16 && node->num_children <= 3) {
+                    *ref = Resize<Node16, Node4>(static_cast<Node16*>(node));
+                }
+                return;
+            }
+            case kNode48: {
+                auto* n = static_cast<Node48*>(node);
+                n->children[n->index[byte] - 1] = nullptr;
+                n->index[byte] = 0;
+                if (--n->num_children <= 12) {
+                    *ref = Resize<Node48, Node16>(n);
+                }
+                return;
+            }
+            default: {
+                auto* n = static_cast<Node256*>(node);
+                n->children[byte] = nullptr;
+                if (--n->num_children <= 40) {
+                    *ref = Resize<Node256, Node48>(n);
+                }
+                return;
+            }
+        }
+    }
+
+    // Replaces the node at depth by what is left below it once it holds a
+    // single leaf or child
+    static void Collapse(Node** ref, size_t depth) {
+        auto* node = static_cast<Inner*>(*ref);
+        if (node->num_children == 0) {
+            *ref = node->terminal;
+            FreeInner(node);
+            return;
+        }
+        if (node->num_children > 1 || node->terminal != nullptr) {
+            return;
+        }
+        Node* child = Child(node, static_cast<uint8_t>(NextChild(node, 0)));
+        if (child->type != kLeaf) {
+            // The child takes over the prefix of the node and its key byte
+            auto* inner = static_cast<Inner*>(child);
+            SetPrefix(inner, AnyLeaf(inner)->key(), depth,
+                      node->prefix_len + 1 + inner->prefix_len);
+        }
+        *ref = child;
+        FreeInner(node);
+    }
+
+    bool Erase(std::string_view key) {
+        Node** ref = &root_;
+        Node** parent = nullptr;
+        size_t parent_depth = 0;
+        size_t depth = 0;
+        while (*ref != nullptr) {
+            Node* node = *ref;
+            if (node->type == kLeaf) {
+                auto* leaf = static_cast<Leaf*>(node);
+                if (leaf->key() != key) {
+                    return false;
+                }
+                if (parent == nullptr) {
+                    root_ = nullptr;
+                } else {
+                    RemoveChild(parent, Byte(key, depth - 1));
+                    Collapse(parent, parent_depth);
+                }
+                FreeLeaf(leaf);
+                --size_;
+                ++version_;
+                return true;
+            }
+            auto* inner = static_cast<Inner*>(node);
+            if (!PrefixMayMatch(inner, key, depth)) {
+                return false;
+            }
+            const size_t node_depth = depth;
+            depth += inner->prefix_len;
+            if (depth == key.size()) {
+                Leaf* leaf = inner->terminal;
+                if (leaf == nullptr || leaf->key() != key) {
+                    return false;
+                }
+                inner->terminal = nullptr;
+                Collapse(ref, node_depth);
+                FreeLeaf(leaf);
+                --size_;
+                ++version_;
+                return true;
+            }
+            Node** child = ChildRef(inner, Byte(key, depth));
+            if (child == nullptr) {
+                return false;
+            }
+            parent = ref;
+            parent_depth = node_depth;
+            ref = child;
+            ++depth;
+        }
+        return false;
+    }
+
+    // Goes down to the smallest leaf below node
+    static void Leftmost(const Node* node, std::vector<Frame>& path,
+                         Leaf*& leaf) {
+        while (node->type != kLeaf) {
+            auto* inner = static_cast<const Inner*>(node);
+            if (inner->terminal != nullptr) {
+                path.push_back({inner, -1});
+                leaf = inner->terminal;
+                return;
+            }
+            const int byte = NextChild(inner, 0);
+            path.push_back({inner, byte});
+            node = Child(inner, static_cast<uint8_t>(byte));
+        }
+        leaf = const_cast<Leaf*>(static_cast<const Leaf*>(node));
+    }
+
+    // Moves to the leaf after the one path leads to, nullptr past the last
+    static void Advance(std::vector<Frame>& path, Leaf*& leaf) {
+        while (!path.empty()) {
+            Frame& frame = path.back();
+            const int byte = NextChild(frame.node, frame.byte + 1);
+            if (byte >= 0) {
+                frame.byte = byte;
+                Leftmost(Child(frame.node, static_cast<uint8_t>(byte)), path,
+                         leaf);
+                return;
+            }
+            path.pop_back();
+        }
+        leaf = nullptr;
+    }
+
+    // Positions path and leaf at the smallest leaf below node, at depth,
+    // whose key is not less than key, false if there is none
+    static bool Seek(const Node* node, std::string_view key, size_t depth,
+                     std::vector<Frame>& path, Leaf*& leaf) {
+        if (node->type == kLeaf) {
+            auto* candidate = static_cast<const Leaf*>(node);
+            if (candidate->key() < key) {
+                return false;
+            }
+            leaf = const_cast<Leaf*>(candidate);
+            return true;
+        }
+        auto* inner = static_cast<const Inner*>(node);
+        if (inner->prefix_len > 0) {
+            // Compare the whole prefix, all the keys below are on one side
+            // of key unless it continues with the prefix
+            const std::string_view full = AnyLeaf(inner)->key();
+            const size_t len = std::min<size_t>(inner->prefix_len,
+                                                key.size() - depth);
+            const int cmp = full.compare(depth, len, key, depth, len);
+            if (cmp != 0 || len < inner->prefix_len) {
+                if (cmp < 0) {
+                    return false;
+                }
+                Leftmost(inner, path, leaf);
+                return true;
+            }
+            depth += inner->prefix_len;
+        }
+        if (depth == key.size()) {
+            Leftmost(inner, path, leaf);
+            return true;
+        }
+        const uint8_t byte = Byte(key, depth);
+        path.push_back({inner, byte});
+        if (const Node* child = Child(inner, byte)) {
+            if (Seek(child, key, depth + 1, path, leaf)) {
+                return true;
+            }
+        }
+        const int next = NextChild(inner, byte + 1);
+        if (next >= 0) {
+            path.back().byte = next;
+            Leftmost(Child(inner, static_cast<uint8_t>(next)), path, leaf);
+            return true;
+        }
+        path.pop_back();
+        return false;
+    }
+
+    void SeekAtLeast(std::string_view key, std::vector<Frame>& path,
+                     Leaf*& leaf) const {
+        path.clear();
+        leaf = nullptr;
+        if (root_ != nullptr && !Seek(root_, key, 0, path, leaf)) {
+            path.clear();
+            leaf = nullptr;
+        }
+    }
+
+    template <typename It, typename Map>
+    static It Begin(Map* map) {
+        std::vector<Frame> path;
+        Leaf* leaf = nullptr;
+        if (map->root_ != nullptr) {
+            Leftmost(map->root_, path, leaf);
+        }
+        return It(map, leaf, std::move(path), map->version_);
+    }
+
+    template <typename It, typename Map>
+    static It LowerBound(Map* map, std::string_view key) {
+        std::vector<Frame> path;
+        Leaf* leaf = nullptr;
+        map->SeekAtLeast(key, path, leaf);
+        return It(map, leaf, std::move(path), map->version_);
+    }
+
+    Node* root_{nullptr};
+    size_t size_{0};
+    // Bumped by every change of the tree, so that iterators know when to
+    // rebuild their path
+    uint64_t version_{0};
+};
+
+}  // namespace mooncake
@@ -23,6 +23,7 @@
 #include <mutex>
 #include <optional>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "Slab.h"
@@ -54,17 +55,22 @@ class MemoryFreeList {
         tail = 0;
     }
 
+    // Unlink mem, a no-op if it is not in the list
     void release(MemoryAllocInfo_* mem) {
-        if (head == mem) {
-            head = 0;
-            return;
-        }
         if (mem->prev != 0) {
-            mem->prev = mem->next;
+            mem->prev->next = mem->next;
+        } else if (head == mem) {
+            head = mem->next;
+        } else {
+            return;
         }
         if (mem->next != 0) {
-            mem->next = mem->prev;
+            mem->next->prev = mem->prev;
+        } else {
+            tail = mem->prev;
         }
+        mem->prev = 0;
+        mem->next = 0;
     }
     void push_front(MemoryAllocInfo_* mem) {
         mem->next = 0;
@@ -85,7 +91,15 @@ class MemoryFreeList {
     MemoryAllocInfo_* front() { return head; }
 
     void pop_front() {
-        if (head != 0) head = head->next;
+        if (head == 0) return;
+        MemoryAllocInfo_* next = head->next;
+        head->next = 0;
+        head = next;
+        if (head != 0) {
+            head->prev = 0;
+        } else {
+            tail = 0;
+        }
     }
 
     MemoryAllocInfo_* head;
@@ -128,6 +142,14 @@ class AllocationClass {
         return static_cast<unsigned int>(Slab::kSize / allocationSize_);
     }
 
+    // The slab of this class with the fewest active allocations that is not
+    // being released, along with that number. Slabs not carved yet come
+    // first. nullptr if the class has no such slab.
+    std::pair<const Slab*, unsigned int> getLeastUsedSlab() const;
+
+    // Number of slabs marked for release that still have active allocations.
+    int64_t getNumActiveReleases() const noexcept { return activeReleases_; }
+
     // Whether the pool is full or free to allocate more in the current
     // state. This is only a hint and not a guarantee that subsequent
     // allocate will fail/succeed.
@@ -508,6 +530,9 @@ class AllocationClass {
     // active allocations need to be marked as free.
     std::unordered_map<uintptr_t, std::vector<MemoryAllocInfo_>> slabAllocMap_;
 
+    // number of active allocations of each slab in slabAllocMap_.
+    std::unordered_map<uintptr_t, unsigned int> slabActiveAllocs_;
+
     // Starting releasing a slab is serialized across threads.
     // Afterwards, the multiple threads can proceed in parallel to
     // complete the slab release
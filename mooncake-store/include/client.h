@@ -1,25 +1,98 @@
 #pragma once
 
+#include <async_simple/coro/Lazy.h>
+#include <atomic>
 #include <boost/functional/hash.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <span>
 #include <string>
+#include <thread>
 #include <vector>
 #include <ylt/util/tl/expected.hpp>
 
 #include "ha_helper.h"
-#include "master_client.h"
+#include "key_filter.h"
+#include "object_cache.h"
+#include "partitioned_master_client.h"
+#include "replica_cache.h"
+#include "request_tracer.h"
 #include "storage_backend.h"
 #include "thread_pool.h"
 #include "transfer_engine.h"
 #include "transfer_task.h"
 #include "types.h"
+#include "write_behind_queue.h"
 
 namespace mooncake {
 
 class PutOperation;
 
+/**
+ * @brief The puts of Client::StartPutGroup, to be submitted part by part
+ * and finished with Client::EndPutGroup. Not thread safe.
+ */
+class PutGroup {
+   public:
+    ~PutGroup();
+
+    PutGroup(const PutGroup&) = delete;
+    PutGroup& operator=(const PutGroup&) = delete;
+
+    size_t size() const;
+
+   private:
+    friend class Client;
+    PutGroup();
+
+    std::vector<PutOperation> ops_;
+    std::vector<bool> submitted_;
+    bool ended_ = false;
+};
+
+/**
+ * @brief A put of Client::StartMultipartPut, whose parts are written with
+ * Client::PutPart as they arrive and which is finished with
+ * Client::EndMultipartPut. Not thread safe.
+ */
+class MultipartPut {
+   public:
+    ~MultipartPut();
+
+    MultipartPut(const MultipartPut&) = delete;
+    MultipartPut& operator=(const MultipartPut&) = delete;
+
+    uint64_t size() const { return size_; }
+    uint64_t part_size() const { return part_size_; }
+    size_t part_count() const { return written_.size(); }
+
+   private:
+    friend class Client;
+    MultipartPut() = default;
+
+    ObjectKey key_;
+    uint64_t size_ = 0;
+    uint64_t part_size_ = 0;
+    std::vector<Replica::Descriptor> replicas_;
+    std::vector<bool> written_;
+    bool ended_ = false;
+};
+
+/**
+ * @brief A read-only view of an object in memory this process maps, from
+ * Client::GetView. The object stays leased until Client::ReleaseView.
+ */
+struct ObjectView {
+    // Handle to pass to Client::ReleaseView
+    uint64_t handle = 0;
+    // The buffers of the viewed replica in object order, not to be written
+    std::vector<Slice> buffers;
+};
+
 /**
  * @brief Client for interacting with the mooncake distributed object store
  */
@@ -50,6 +123,9 @@ class Client {
      * @param object_key Key to retrieve
      * @param slices Vector of slices to store the retrieved data
      * @return ErrorCode indicating success/failure
+     * @note Slices may be laid out otherwise than the stored buffers, e.g.
+     * as scattered pages, if they add up to the object size. Each slice
+     * then takes the parts of the buffers it overlaps, without staging.
      */
     tl::expected<void, ErrorCode> Get(const std::string& object_key,
                                       std::vector<Slice>& slices);
@@ -104,6 +180,72 @@ class Client {
         const std::vector<std::vector<Replica::Descriptor>>& replica_lists,
         std::unordered_map<std::string, std::vector<Slice>>& slices);
 
+    /**
+     * @brief Reads dest.size bytes of an object starting at offset
+     * @param object_key Key to retrieve
+     * @param offset Offset of the range in the object
+     * @param dest Registered buffer receiving the range
+     * @return INVALID_PARAMS if the range ends past the object
+     * @note Only the buffers of the replica overlapping the range are
+     * transferred. Objects put with a codec are ranged over their stored,
+     * encoded bytes.
+     */
+    tl::expected<void, ErrorCode> GetRange(const std::string& object_key,
+                                           uint64_t offset, Slice dest);
+
+    /**
+     * @brief Reads a range of an object using pre-queried object information
+     */
+    tl::expected<void, ErrorCode> GetRange(
+        const std::string& object_key,
+        const std::vector<Replica::Descriptor>& replica_list, uint64_t offset,
+        Slice dest);
+
+    /**
+     * @brief Batch version of GetRange, the ranges of all keys are
+     * transferred together
+     * @param object_keys Keys to retrieve
+     * @param offsets Offset of the range of each key
+     * @param dests Buffer receiving the range of each key
+     */
+    std::vector<tl::expected<void, ErrorCode>> BatchGetRange(
+        const std::vector<std::string>& object_keys,
+        const std::vector<uint64_t>& offsets, const std::vector<Slice>& dests);
+
+    /**
+     * @brief Reads one shard of an object put with
+     * ReplicateConfig::shard_segments, e.g. the part of a KV block of one
+     * tensor-parallel rank. Only that shard is transferred.
+     * @param object_key Key of the sharded object
+     * @param shard Index of the shard, i.e. of the slice it was put with
+     * @param dest Registered buffer of the size of the shard
+     * @return INVALID_PARAMS if the object has no such shard or dest is
+     * not of its size
+     */
+    tl::expected<void, ErrorCode> GetShard(const std::string& object_key,
+                                           size_t shard, Slice dest);
+
+    /**
+     * @brief Gives read-only access to an object held in a local segment
+     * of host memory or in an attached segment, without copying it, e.g.
+     * for kernels reading KV blocks from host memory. The object stays
+     * leased until ReleaseView, the lease being renewed with every ping of
+     * the master, so that eviction, Remove and upserts in place leave the
+     * buffers alone. Replicas that an upsert or a compaction replaced are
+     * freed kViewLeaseMs after that, and unmounting the segment frees
+     * them at once. Objects put with a codec are viewed as their stored,
+     * encoded bytes.
+     * @return INVALID_REPLICA if no complete replica lies wholly in memory
+     * of this process, or the errors of a get
+     */
+    tl::expected<ObjectView, ErrorCode> GetView(const std::string& object_key);
+
+    // Stops renewing the lease of a view, which then expires
+    void ReleaseView(uint64_t handle);
+
+    // Lease of the objects of open views, renewed with every ping
+    static constexpr uint64_t kViewLeaseMs = 10000;
+
     /**
      * @brief Stores data with replication
      * @param key Object key
@@ -116,7 +258,9 @@ class Client {
                                       const ReplicateConfig& config);
 
     /**
-     * @brief Batch put data with replication
+     * @brief Batch put data with replication. Keys that already exist
+     * succeed without being written, with config.skip_resident in the
+     * same round trip that starts the others.
      * @param keys Object keys
      * @param batched_slices Vector of vectors of data slices to store (indexed
      * to match keys)
@@ -127,6 +271,165 @@ class Client {
         std::vector<std::vector<Slice>>& batched_slices,
         const ReplicateConfig& config);
 
+    /**
+     * @brief Non-blocking Get. Looks up the replicas and submits the
+     * transfer, then returns without waiting for the data
+     * @param object_key Key to retrieve
+     * @param slices Slices to store the data, must stay valid until the
+     * returned future completes
+     * @return Future completed once the data is in slices; it supports
+     * callbacks through TransferFuture::then
+     */
+    TransferFuture GetAsync(const std::string& object_key,
+                            std::vector<Slice>& slices);
+
+    /**
+     * @brief Non-blocking Get using a pre-queried replica list
+     */
+    TransferFuture GetAsync(
+        const std::string& object_key,
+        const std::vector<Replica::Descriptor>& replica_list,
+        std::vector<Slice>& slices);
+
+    /**
+     * @brief Non-blocking BatchGet
+     * @return One future per key, in the order of object_keys
+     */
+    std::vector<TransferFuture> BatchGetAsync(
+        const std::vector<std::string>& object_keys,
+        std::unordered_map<std::string, std::vector<Slice>>& slices);
+
+    /**
+     * @brief Non-blocking Put. Allocates the replicas and submits the
+     * transfers, then returns; the put is finalized or revoked in the
+     * background once the transfers are done
+     * @param slices Data to store, must stay valid until the returned future
+     * completes
+     * @return Future completed once the object is readable or the put failed
+     */
+    TransferFuture PutAsync(const ObjectKey& key, std::vector<Slice>& slices,
+                            const ReplicateConfig& config);
+
+    /**
+     * @brief Streaming BatchPut. Starts the puts with one BatchPutStart and
+     * submits the transfers, then returns, so the next batch's
+     * BatchPutStart overlaps this batch's transfers. The puts of all
+     * batches whose transfers are done are finalized together by one
+     * BatchPutEnd on a background thread.
+     * @param batched_slices Data to store, must stay valid until the
+     * returned futures complete
+     * @return One future per key, completed once the object is readable or
+     * the put failed
+     */
+    std::vector<TransferFuture> BatchPutAsync(
+        const std::vector<ObjectKey>& keys,
+        std::vector<std::vector<Slice>>& batched_slices,
+        const ReplicateConfig& config);
+
+    /**
+     * @brief Coroutine Get. The coroutine is suspended while the master
+     * looks up the replicas and while the data is transferred, so one
+     * thread can drive many gets. It resumes on the executor of the Lazy,
+     * or else on the thread that completed the step: an RPC thread or the
+     * notifier thread of the transfer engine, which must not be blocked.
+     * Erasure-coded objects that must be rebuilt from their fragments and
+     * encoded payloads are refused with INVALID_PARAMS, use Get for them.
+     * @param slices Slices to store the data, must stay valid until the
+     * coroutine completes, as must the client
+     */
+    async_simple::coro::Lazy<tl::expected<void, ErrorCode>> CoGet(
+        std::string object_key, std::vector<Slice>& slices);
+
+    /**
+     * @brief Coroutine Put, suspended during PutStart, the transfers and
+     * PutEnd or PutRevoke as CoGet is
+     */
+    async_simple::coro::Lazy<tl::expected<void, ErrorCode>> CoPut(
+        ObjectKey key, std::vector<Slice>& slices, ReplicateConfig config);
+
+    /**
+     * @brief Starts a group of puts whose data becomes ready part by part,
+     * e.g. the KV cache of a block group with one key per block and layer,
+     * written as each layer is computed. All the objects are allocated with
+     * one BatchPutStart, SubmitPutGroup transfers a part once its data is
+     * ready, and EndPutGroup finalizes the group with one BatchPutEnd.
+     * @param batched_slices Where the data of each key is, must stay valid
+     * until EndPutGroup returns
+     * @return The group, whose objects the master failed to allocate are
+     * reported by EndPutGroup
+     */
+    std::shared_ptr<PutGroup> StartPutGroup(
+        const std::vector<ObjectKey>& keys,
+        std::vector<std::vector<Slice>>& batched_slices,
+        const ReplicateConfig& config);
+
+    /**
+     * @brief Submits the transfers of the objects [first, first + count) of
+     * the group without waiting for them. Objects already submitted are
+     * skipped.
+     * @return INVALID_PARAMS if the range is out of the group or the group
+     * has ended, OK otherwise; transfer failures are reported by EndPutGroup
+     */
+    ErrorCode SubmitPutGroup(PutGroup& group, size_t first, size_t count);
+
+    /**
+     * @brief Submits the objects not submitted yet, waits for all transfers
+     * and finalizes the group: one BatchPutEnd for the objects transferred
+     * and one BatchPutRevoke for the others
+     * @return One result per key, in the order of StartPutGroup
+     */
+    std::vector<tl::expected<void, ErrorCode>> EndPutGroup(PutGroup& group);
+
+    /**
+     * @brief Starts the put of an object too large to stage at once, e.g.
+     * a long-context KV cache or a checkpoint shard. The replicas of all
+     * size bytes are allocated with one PutStart; PutPart transfers each
+     * part as it arrives and EndMultipartPut finalizes the object.
+     * @param size Size of the object
+     * @param part_size Size of every part but the last one
+     * @return The put, or OBJECT_ALREADY_EXISTS, INVALID_PARAMS for an
+     * empty object or a config with a codec or erasure coding, or the
+     * error of PutStart
+     */
+    tl::expected<std::shared_ptr<MultipartPut>, ErrorCode>
+    StartMultipartPut(const ObjectKey& key, uint64_t size,
+                      uint64_t part_size, const ReplicateConfig& config);
+
+    /**
+     * @brief Writes part n, the bytes from n * part_size on, into every
+     * replica and returns once they are there, so that data can be reused
+     * for the next part. Parts may come in any order.
+     * @param data Registered buffer with the part, part_size bytes unless
+     * it is the last part
+     * @return INVALID_PARAMS if the part is out of the object, of the wrong
+     * size or the put has ended; a transfer error leaves the part unwritten
+     */
+    ErrorCode PutPart(MultipartPut& put, size_t n, Slice data);
+
+    /**
+     * @brief Finalizes the object with PutEnd if every part was written,
+     * otherwise revokes it with PutRevoke
+     * @return INVALID_PARAMS if a part is missing or the put has ended
+     */
+    tl::expected<void, ErrorCode> EndMultipartPut(MultipartPut& put);
+
+    /**
+     * @brief Reads an object part by part through a ring of small
+     * buffers, so that memory stays bounded whatever the object size.
+     * While on_part handles the part in one buffer, the next parts are
+     * read into the others.
+     * @param buffers Registered buffers, used in turn; each part fills one
+     * @param on_part Called with the offset of each part in the object and
+     * the part, in order. The buffer is reused once it returns; returning
+     * false stops the read.
+     * @return The error of the lookup or of a transfer
+     * @note Objects put with a codec are streamed as their stored, encoded
+     * bytes, like GetRange
+     */
+    tl::expected<void, ErrorCode> GetStream(
+        const std::string& object_key, const std::vector<Slice>& buffers,
+        const std::function<bool(uint64_t offset, Slice part)>& on_part);
+
     /**
      * @brief Removes an object and all its replicas
      * @param key Key to remove
@@ -140,13 +443,98 @@ class Client {
      */
     tl::expected<long, ErrorCode> RemoveAll();
 
+    /**
+     * @brief Removes the objects put with the given ReplicateConfig::tag.
+     * The master removes them in the background, each one once its lease
+     * expired.
+     * @return tl::expected<long, ErrorCode> number of objects queued for
+     * removal or error
+     */
+    tl::expected<long, ErrorCode> RemoveByTag(const std::string& tag);
+
+    /**
+     * @brief Removes the objects whose key starts with prefix, e.g. all
+     * the blocks of a model. Leased objects are skipped.
+     * @return tl::expected<long, ErrorCode> number of removed objects or
+     * error
+     */
+    tl::expected<long, ErrorCode> RemoveByPrefix(const std::string& prefix);
+
+    /**
+     * @brief Adds a memory replica of an object on target_segment, or on
+     * any segment without one if empty. The master has the client of the
+     * source replica copy it, which needs its compaction thread
+     * (MC_STORE_COMPACTION_INTERVAL_MS); readers see the replica once the
+     * copy is finished.
+     * @return ErrorCode indicating whether the copy is queued
+     */
+    tl::expected<void, ErrorCode> CopyReplica(
+        const ObjectKey& key, const std::string& target_segment);
+
+    /**
+     * @brief Moves the memory replica of an object on source_segment to
+     * target_segment, as CopyReplica does. The source is freed once the
+     * leases on the object expire.
+     * @return ErrorCode indicating whether the move is queued
+     */
+    tl::expected<void, ErrorCode> MigrateReplica(
+        const ObjectKey& key, const std::string& source_segment,
+        const std::string& target_segment);
+
+    /**
+     * @brief Adds a memory replica of an object on each of target_segments,
+     * or on every segment without one if empty, e.g. before many clients
+     * load a shared object. Each copy is made by the client holding its
+     * source, as for CopyReplica, and every new replica is the source of
+     * further copies, so N segments are reached in about log2(N) copies.
+     * Readers see each replica once its copy is finished.
+     * @return The number of segments to get a replica, ErrorCode if the
+     * broadcast could not start
+     */
+    tl::expected<uint64_t, ErrorCode> Broadcast(
+        const ObjectKey& key, const std::vector<std::string>& target_segments);
+
+    /**
+     * @brief Adds memory replicas of objects on target_segment, or on the
+     * segment of this client if empty, e.g. for the blocks a request
+     * scheduled here will read, so that the reads are local. The copies are
+     * made in the background as for CopyReplica; objects that have a
+     * replica there already are left as they are.
+     * @return For each key, whether its copy is queued or not needed;
+     * MASTER_BUSY if too many prefetches are in flight
+     */
+    std::vector<tl::expected<void, ErrorCode>> Prefetch(
+        const std::vector<ObjectKey>& keys,
+        const std::string& target_segment = "");
+
+    /**
+     * @brief Drops the prefetches of keys to target_segment, or to the
+     * segment of this client if empty, that are not being copied yet
+     * @return For each key, whether a prefetch was dropped
+     */
+    std::vector<tl::expected<bool, ErrorCode>> CancelPrefetch(
+        const std::vector<ObjectKey>& keys,
+        const std::string& target_segment = "");
+
     /**
      * @brief Registers a memory segment to master for allocation
      * @param buffer Memory buffer to register
      * @param size Size of the buffer in bytes
+     * @param location Where the buffer lives, e.g. "cuda:0" for GPU memory,
+     * detected from the buffer if kWildcardLocation
+     * @param memory_id Id of the persistent memory of the buffer, see
+     * SegmentMemory::AllocatePersistent, {0, 0} if it is not persistent
      * @return ErrorCode indicating success/failure
+     * @note Segments in GPU memory are labelled with their device, so that
+     * the master keeps them for objects put with prefer_device_memory, and
+     * are reached through the transfer engine rather than memcpy
+     * @note The master gives a segment of persistent memory back the
+     * replicas it held when it was last unmounted
      */
-    tl::expected<void, ErrorCode> MountSegment(const void* buffer, size_t size);
+    tl::expected<void, ErrorCode> MountSegment(
+        const void* buffer, size_t size,
+        const std::string& location = kWildcardLocation,
+        const UUID& memory_id = {0, 0});
 
     /**
      * @brief Unregisters a memory segment from master
@@ -157,6 +545,64 @@ class Client {
     tl::expected<void, ErrorCode> UnmountSegment(const void* buffer,
                                                  size_t size);
 
+    /**
+     * @brief Attaches to the segment another client mounted on memory this
+     * host maps too, e.g. a CXL memory pool shared by several hosts. The
+     * master records the attachment, and this client then reads and writes
+     * the replicas in the segment with load/store through its own mapping
+     * instead of the transfer engine, with no NIC involved.
+     * @param buffer Where this client maps the memory
+     * @param size Size of the mapping
+     * @param memory_id Id of the memory, the one the owner mounted the
+     * segment with, see SegmentMemory::AllocatePersistent
+     * @return ErrorCode indicating success/failure, SEGMENT_NOT_FOUND if
+     * no segment is mounted on the memory
+     */
+    tl::expected<void, ErrorCode> AttachSegment(const void* buffer,
+                                                size_t size,
+                                                const UUID& memory_id);
+
+    /**
+     * @brief Detaches from the segment mounted on memory_id, whose replicas
+     * go through the transfer engine again
+     */
+    tl::expected<void, ErrorCode> DetachSegment(const UUID& memory_id);
+
+    /**
+     * @brief Moves the replicas of a mounted segment to other segments,
+     * then unregisters it. New objects stop going to the segment at once;
+     * the master queues its replicas, hot objects first, and this client
+     * copies them out. Whatever is left at the timeout is dropped with the
+     * unmount. The destructor drains its segments this way when
+     * MC_STORE_DRAIN_TIMEOUT_MS is set.
+     * @param buffer Memory buffer to drain
+     * @param size Size of the buffer in bytes
+     * @param timeout Longest wait for the replicas to move
+     * @return ErrorCode indicating success/failure of the unmount
+     */
+    tl::expected<void, ErrorCode> DrainSegment(
+        const void* buffer, size_t size, std::chrono::milliseconds timeout);
+
+    /**
+     * @brief Grows or shrinks a mounted segment without unmounting it.
+     * Allocators cannot change their range, so the segment is a run of
+     * extents mounted under the same name: growing mounts
+     * [buffer + size, buffer + new_size) as a new extent, shrinking drains
+     * the extents past new_size like DrainSegment and unmounts them. Only
+     * the replicas in the released tail move; whatever is left of them at
+     * the timeout is dropped.
+     * @param buffer Start of the segment
+     * @param size Current size of the segment, its extents tiling
+     * [buffer, buffer + size)
+     * @param new_size Size to resize to. The caller keeps the memory of a
+     * grown segment reserved. A shrink must end on an extent boundary.
+     * @param timeout Longest wait for the replicas of the tail to move
+     * @return ErrorCode indicating success/failure
+     */
+    tl::expected<void, ErrorCode> ResizeSegment(
+        const void* buffer, size_t size, size_t new_size,
+        std::chrono::milliseconds timeout);
+
     /**
      * @brief Registers memory buffer with TransferEngine for data transfer
      * @param addr Memory address to register
@@ -179,6 +625,18 @@ class Client {
     tl::expected<void, ErrorCode> unregisterLocalMemory(
         void* addr, bool update_metadata = true);
 
+#ifdef USE_CUDA
+    /**
+     * @brief Holds the work queued on a CUDA stream from now on until
+     * ReleaseStream is called with the returned handle, e.g. until a get
+     * into GPU memory the stream consumes completes
+     * @return Handle to pass to ReleaseStream
+     */
+    tl::expected<uint64_t, ErrorCode> HoldStream(cudaStream_t stream);
+
+    void ReleaseStream(uint64_t handle);
+#endif
+
     /**
      * @brief Checks if an object exists
      * @param key Key to check
@@ -196,6 +654,54 @@ class Client {
     std::vector<tl::expected<bool, ErrorCode>> BatchIsExist(
         const std::vector<std::string>& keys);
 
+    /**
+     * @brief Extends the leases of objects without reading them, e.g. for a
+     * scheduler to keep a prefix it will soon reuse from being evicted
+     * @param ttl_ms Lease length, 0 for the master's default lease
+     * @param next_use_ms When the objects are expected to be read again,
+     * e.g. by the queued requests sharing a prefix, 0 for no hint. The
+     * master then evicts the objects used farthest ahead first.
+     * @return For each key, OBJECT_NOT_FOUND if it does not exist
+     */
+    std::vector<tl::expected<void, ErrorCode>> BatchTouch(
+        const std::vector<std::string>& keys, uint64_t ttl_ms,
+        uint64_t next_use_ms = 0);
+
+    /**
+     * @brief Counts the leading keys that exist and are complete in a single
+     * request, e.g. to find the cached prefix of a chain of KV cache blocks
+     * @param keys Keys in prefix order
+     * @param with_replicas Also return the replica lists of the matched keys.
+     * They are kept in the replica cache when it is enabled, so that the
+     * following Get of the prefix does not ask the master again.
+     * @return The number of matched keys and their replica lists
+     */
+    tl::expected<PrefixMatchResult, ErrorCode> LongestPrefixMatch(
+        const std::vector<std::string>& keys, bool with_replicas = false);
+
+    /**
+     * @brief Tells which segments hold each key in a single request, e.g.
+     * for a router sending a request to the node that holds most of its
+     * prefix blocks. A segment holds a key if a complete memory replica of
+     * it lies wholly on that segment. Keys are not leased.
+     * @param keys Keys to locate, in prefix order for prefix hits
+     * @param with_prefix_hits Also count for each segment the leading keys
+     * it holds
+     * @return The names of the segments, the indices of those holding each
+     * key and the prefix hits of each segment if asked for
+     */
+    tl::expected<KeyLocationResult, ErrorCode> BatchQueryLocation(
+        const std::vector<std::string>& keys, bool with_prefix_hits = false);
+
+    /**
+     * @brief Fetches a page of at most limit keys starting with prefix.
+     * Start with an empty cursor and pass the returned next_cursor until it
+     * is empty; keys that exist during the whole scan are returned once.
+     */
+    tl::expected<KeyScanResult, ErrorCode> ScanKeys(const std::string& prefix,
+                                                    const std::string& cursor,
+                                                    uint64_t limit);
+
    private:
     /**
      * @brief Private constructor to enforce creation through Create() method
@@ -220,27 +726,225 @@ class Client {
     ErrorCode TransferRead(const Replica::Descriptor& replica,
                            std::vector<Slice>& slices);
 
+    // Get and Put between their store_*_begin and store_*_end tracepoints
+    tl::expected<void, ErrorCode> DoGet(const std::string& object_key,
+                                        std::vector<Slice>& slices);
+    tl::expected<void, ErrorCode> DoPut(const ObjectKey& key,
+                                        std::vector<Slice>& slices,
+                                        const ReplicateConfig& config);
+
     /**
      * @brief Prepare and use the storage backend for persisting data
      */
     void PrepareStorageBackend(const std::string& storage_root_dir,
                                const std::string& fsdir);
 
+    /**
+     * @brief Register the objects the storage backend recovered from disk
+     * with the master, so that a restarted client serves its disk tier
+     * again without waiting for the objects to be put anew
+     */
+    void RegisterDiskObjects();
+
+    /**
+     * @brief Query the replica list of a key, from the replica cache when
+     * it holds an unexpired entry
+     * @param from_cache Optional, set when the replica cache answered
+     * @param lease_expiry Optional, set to when the lease on the replicas
+     * ends; left unchanged when they hold no lease
+     */
+    tl::expected<std::vector<Replica::Descriptor>, ErrorCode> QueryReplicas(
+        const std::string& object_key, bool* from_cache,
+        ReplicaCache::Clock::time_point* lease_expiry = nullptr);
+
+    // Read from the follower masters in MC_STORE_MASTER_FOLLOWERS, if set
+    void ConnectToFollowers();
+
+    // Create replica_cache_ if MC_STORE_REPLICA_CACHE_ENTRIES is set, and
+    // near_cache_ if MC_STORE_NEAR_CACHE_BYTES is set
+    void PrepareReplicaCache();
+
+    // Drop the cached replicas and value of a key, e.g. after a failed
+    // transfer
+    void InvalidateReplicaCache(const std::string& object_key);
+
+    // Follow the masters' key filters if MC_STORE_KEY_FILTER_REFRESH_MS is
+    // set
+    void PrepareKeyFilter();
+
+    // False for the keys the masters' key filters rule out, true for all
+    // keys when they are disabled. Refreshes the filters when due.
+    std::vector<bool> MayExist(const std::vector<std::string>& keys);
+
+    // Bring the key filters up to date, unless another thread does or they
+    // were refreshed within key_filter_refresh_
+    void RefreshKeyFilters();
+
+    // Forget the key filters, e.g. when a master changed
+    void ResetKeyFilters();
+
+    // Clear the replica and near caches, e.g. when the master changed
+    void ClearReplicaCache();
+
+    // Put small objects into extents reserved by the masters if
+    // MC_STORE_ALLOC_CREDIT_BYTES is set
+    void PrepareAllocationCredits();
+
+    // Put a small single replica object into the extent of an allocation
+    // credit, committing it with one CommitCreditPuts instead of a PutStart
+    // and a PutEnd. False if it has to be put as usual.
+    bool PutWithCredit(const ObjectKey& key, std::vector<Slice>& slices,
+                       const ReplicateConfig& config);
+
+    // Put the small objects of a BatchPut that fit allocation credits
+    // packed: the objects of a partition are placed one after another in
+    // its credit's extent, written by one transfer and committed with one
+    // CommitCreditPuts. The others are left for StartBatchPut.
+    void PackPutsWithCredit(std::vector<PutOperation>& ops,
+                            const ReplicateConfig& config);
+
+    // Put the operations pack of ops, reserved bytes in all, into the
+    // credit of partition
+    void PutPackWithCredit(std::vector<PutOperation>& ops, size_t partition,
+                           std::span<const size_t> pack, uint64_t reserved,
+                           const ReplicateConfig& config);
+
+    // Whether puts of config can go into allocation credits
+    bool CanPutWithCredit(const ReplicateConfig& config) const;
+
+    // Reserve reserved bytes of the credit of partition, asking the master
+    // for a new credit if the current one is used up. False if there is no
+    // credit to use.
+    bool ReserveCredit(size_t partition, uint64_t reserved,
+                       AllocationCredit& credit, uint64_t& offset);
+
+    // Stop using a credit, e.g. one the master no longer knows
+    void DropCredit(size_t partition, uint64_t credit_id);
+
+    // End the credits held, e.g. before the client exits
+    void ReturnAllocationCredits();
+
+    // Forget the credits held, e.g. when a master changed
+    void ResetAllocationCredits();
+
     ErrorCode GetFromLocalFile(const std::string& object_key,
                                std::vector<Slice>& slices,
                                std::vector<Replica::Descriptor>& replicas);
 
+    // Queue a write-through copy, blocking while the write-behind budget is
+    // used up
     void PutToLocalFile(const std::string& object_key,
                         std::vector<Slice>& slices);
 
+    // Register an object stored by write_behind_ as a disk replica
+    void OnStoredToLocalFile(const std::string& object_key);
+
+    /**
+     * @brief After reading an object from its disk replica, copy it back into
+     * memory in the background. Does nothing for memory replicas or once
+     * the master has reported that its disk tier is disabled.
+     */
+    void PromoteFromDisk(const std::string& object_key,
+                         const Replica::Descriptor& replica,
+                         const std::vector<Slice>& slices);
+
+    // Write value into new memory replicas of an object on the disk tier
+    void Promote(const std::string& object_key, std::string& value);
+
     /**
-     * @brief Find the first complete replica from a replica list
+     * @brief Encode each entry of batched_slices with codec into staging,
+     * registered with the transfer engine until the caller unregisters it
+     * @return Slices of the encoded payloads, in the order of batched_slices
+     */
+    tl::expected<std::vector<std::vector<Slice>>, ErrorCode> EncodePayloads(
+        PayloadCodecId codec,
+        const std::vector<std::vector<Slice>>& batched_slices,
+        std::vector<uint8_t>& staging);
+
+    // Read an object stored encoded into a staging buffer and decode it
+    // into slices
+    tl::expected<void, ErrorCode> GetEncoded(
+        const std::string& object_key,
+        const std::vector<Replica::Descriptor>& replica_list,
+        std::vector<Slice>& slices);
+
+    // Read a range that cannot be narrowed to the buffers it overlaps, e.g.
+    // of a disk replica, by reading the whole object into a staging buffer
+    tl::expected<void, ErrorCode> GetRangeStaged(
+        const std::string& object_key,
+        const std::vector<Replica::Descriptor>& replica_list, uint64_t offset,
+        Slice dest);
+
+    // Put an object as config.ec_data_fragments data fragments and
+    // config.ec_parity_fragments parity fragments, written from a staging
+    // buffer
+    tl::expected<void, ErrorCode> PutErasureCoded(
+        const ObjectKey& key, std::vector<Slice>& slices,
+        const ReplicateConfig& config);
+
+    // Read the fragments of an erasure-coded replica that are left, rebuild
+    // the lost data fragments and copy the data into slices
+    tl::expected<void, ErrorCode> GetErasureCoded(
+        const std::string& object_key, const Replica::Descriptor& replica,
+        std::vector<Slice>& slices);
+
+    // Relocate the replicas the master picks to compact fragmented
+    // segments, polling every interval while there are none
+    void CompactionThreadFunc(std::chrono::milliseconds interval);
+
+    // Copy the source of task into its target and finish the relocation
+    // with the master. Sources in the segments of this client are written
+    // from where they are, others go through a local buffer.
+    void Relocate(const CompactionTask& task);
+
+    // Run the relocations of the draining segments until their replicas
+    // have moved or the deadline passes
+    tl::expected<void, ErrorCode> WaitForDrain(
+        const std::vector<UUID>& segment_ids,
+        std::chrono::steady_clock::time_point deadline);
+
+    // Whether the buffers are all in the segments this client mounted
+    bool IsLocalReplica(const Replica::Descriptor& replica);
+
+    // Report the copy of a relocation to the master
+    void FinishRelocation(const CompactionTask& task, ErrorCode err);
+
+    /**
+     * @brief Complete an asynchronous operation in the background once all
+     * its transfers are done
+     * @param finalize Optional step run with the combined transfer result,
+     * returning the result of the whole operation
+     */
+    TransferFuture CompleteAsync(
+        std::vector<TransferFuture> transfers,
+        std::function<ErrorCode(ErrorCode)> finalize = nullptr);
+
+    // A future that has already completed with error_code
+    static TransferFuture MakeReadyFuture(ErrorCode error_code);
+
+    // A put of BatchPutAsync waiting for its transfers and BatchPutEnd
+    struct PendingPutEnd {
+        std::string key;
+        std::vector<Slice> slices;
+        std::vector<TransferFuture> transfers;
+        // Set if not all transfers could be submitted
+        ErrorCode submit_result = ErrorCode::OK;
+        std::shared_ptr<AsyncOperationState> state;
+    };
+
+    // Finalize the puts queued by BatchPutAsync, coalescing the BatchPutEnd
+    // and BatchPutRevoke calls of everything queued meanwhile
+    void PutEndThreadFunc();
+
+    /**
+     * @brief Choose the complete replica to read, preferring local and same
+     * host replicas, then the least loaded endpoints
      * @param replica_list List of replicas to search through
-     * @param replica the first complete replica (file or memory)
+     * @param replica the chosen complete replica (file or memory)
      * @return ErrorCode::OK if found, ErrorCode::INVALID_REPLICA if no complete
      * replica
      */
-    ErrorCode FindFirstCompleteReplica(
+    ErrorCode SelectReplica(
         const std::vector<Replica::Descriptor>& replica_list,
         Replica::Descriptor& replica);
 
@@ -253,6 +957,7 @@ class Client {
     void StartBatchPut(std::vector<PutOperation>& ops,
                        const ReplicateConfig& config);
     void SubmitTransfers(std::vector<PutOperation>& ops);
+    void SubmitTransfers(PutOperation& op);
     void WaitForTransfers(std::vector<PutOperation>& ops);
     void FinalizeBatchPut(std::vector<PutOperation>& ops);
     std::vector<tl::expected<void, ErrorCode>> CollectResults(
@@ -260,27 +965,121 @@ class Client {
 
     // Core components
     TransferEngine transfer_engine_;
-    MasterClient master_client_;
+    PartitionedMasterClient master_client_;
     std::unique_ptr<TransferSubmitter> transfer_submitter_;
 
+    // Keys of the open views by handle
+    std::mutex views_mutex_;
+    std::unordered_map<uint64_t, std::string> views_;
+    uint64_t next_view_handle_ = 0;
+    // Extend the leases of the objects of the open views
+    void RenewViews();
+
     // Mutex to protect mounted_segments_
     std::mutex mounted_segments_mutex_;
     std::unordered_map<UUID, Segment, boost::hash<UUID>> mounted_segments_;
+    // Segments of shared memory attached to, by memory id, with where this
+    // client maps them. Protected by mounted_segments_mutex_.
+    struct AttachedSegment {
+        Segment segment;
+        uintptr_t local_base;
+        size_t local_size;
+    };
+    std::unordered_map<UUID, AttachedSegment, boost::hash<UUID>>
+        attached_segments_;
 
     // Configuration
     const std::string local_hostname_;
     const std::string metadata_connstring_;
     const std::string storage_root_dir_;
+    // Read large objects in stripes from all complete replicas
+    const bool striped_read_;
+    // Register write-through copies with the master and promote objects
+    // read from disk, cleared when the master's disk tier is disabled
+    std::atomic<bool> disk_tier_{true};
+    // Values up to this size are put with PutInline, cleared when the
+    // master does not keep inline objects
+    std::atomic<uint64_t> inline_max_size_;
 
     // Client persistent thread pool for async operations
     ThreadPool write_thread_pool_;
+    // Waits for the transfers of asynchronous operations and completes them
+    ThreadPool async_thread_pool_;
+    std::mutex put_end_mutex_;
+    std::condition_variable put_end_cv_;
+    std::vector<PendingPutEnd> put_end_queue_;
+    bool put_end_running_ = true;
+    std::thread put_end_thread_;
+    // Relocation thread, started if MC_STORE_COMPACTION_INTERVAL_MS is set
+    std::mutex compaction_mutex_;
+    std::condition_variable compaction_cv_;
+    bool compaction_running_ = false;
+    std::thread compaction_thread_;
     std::shared_ptr<StorageBackend> storage_backend_;
+    // Writes write-through copies to storage_backend_ in batches
+    std::unique_ptr<WriteBehindQueue> write_behind_;
+    // Replica lists kept for the lease granted by GetReplicaList, null if
+    // disabled
+    std::unique_ptr<ReplicaCache> replica_cache_;
+    std::chrono::milliseconds replica_cache_ttl_{0};
+    // Values of hot objects kept for the lease of the read that fetched
+    // them, null if disabled
+    std::unique_ptr<ObjectCache> near_cache_;
+    // Copy of the key filter of each partition's master, and the change log
+    // sequence number it is up to date with. Disabled if key_filter_refresh_
+    // is zero.
+    struct PartitionKeyFilter {
+        std::optional<KeyFilter> filter;
+        uint64_t seq = 0;
+    };
+    std::chrono::milliseconds key_filter_refresh_{0};
+    std::mutex key_filter_mutex_;
+    std::vector<PartitionKeyFilter> key_filters_;
+    // Incremented by ResetKeyFilters, drops the updates requested before
+    uint64_t key_filter_generation_ = 0;
+    // Held by the thread refreshing the key filters
+    std::mutex key_filter_refresh_mutex_;
+    std::chrono::steady_clock::time_point key_filter_refreshed_;
+    // Allocation credit of each partition's master and the bytes placed in
+    // its extent. Disabled if credit_bytes_ is zero.
+    struct PartitionCredit {
+        std::optional<AllocationCredit> credit;
+        uint64_t used = 0;
+        // Nothing is placed after this, so that the commits reach the
+        // master before the credit expires
+        std::chrono::steady_clock::time_point usable_until;
+        // No credit is asked for before this after a refusal
+        std::chrono::steady_clock::time_point retry_at;
+    };
+    uint64_t credit_bytes_ = 0;
+    uint64_t credit_max_object_ = 0;
+    std::mutex credit_mutex_;
+    std::vector<PartitionCredit> credits_;
+    // Set by ConnectToFollowers
+    bool read_from_followers_ = false;
+    // Samples Get requests if MC_STORE_TRACE_SAMPLE_INTERVAL is set, the
+    // traces are served on MC_STORE_TRACE_PORT
+    std::unique_ptr<RequestTracer> tracer_;
+    std::unique_ptr<coro_http::coro_http_server> trace_http_server_;
+    // Prometheus text of the master RPCs in flight on each connection
+    std::string MasterClientMetricsText();
+
+    // Serves the transfer engine and master client metrics if
+    // MC_STORE_TE_METRICS_PORT is set
+    std::unique_ptr<coro_http::coro_http_server> te_metrics_http_server_;
 
     // For high availability
     MasterViewHelper master_view_helper_;
     std::thread ping_thread_;
     std::atomic<bool> ping_running_{false};
     void PingThreadFunc();
+    // Master of each partition, read and written by the ping thread once
+    // it is started
+    std::vector<std::string> master_addresses_;
+    // Wakes the ping thread when it stops or the master views change
+    std::mutex ping_mutex_;
+    std::condition_variable ping_cv_;
+    bool master_view_changed_ = false;  // GUARDED_BY(ping_mutex_)
 
     // Client identification
     UUID client_id_;
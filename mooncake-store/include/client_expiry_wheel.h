@@ -0,0 +1,58 @@
+#pragma once
+
+#include <boost/functional/hash.hpp>
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "types.h"
+
+namespace mooncake {
+
+/**
+ * @brief Hashed timer wheel telling when clients stop pinging
+ *
+ * A client expires once ttl has passed since its last Touch. Each client
+ * sits in the slot of one tick, at most that of its deadline; a Touch only
+ * moves the deadline, and the client is moved to the slot of the new
+ * deadline when the wheel reaches its old slot. A tick thus only visits the
+ * clients of one slot, about one in ttl / tick while all of them keep
+ * pinging, instead of every client. Clients expire up to one tick late.
+ *
+ * Not thread-safe, owned by the client monitor thread.
+ */
+class ClientExpiryWheel {
+   public:
+    using Clock = std::chrono::steady_clock;
+
+    ClientExpiryWheel(Clock::duration tick, Clock::duration ttl,
+                      Clock::time_point now = Clock::now());
+
+    ClientExpiryWheel(const ClientExpiryWheel&) = delete;
+    ClientExpiryWheel& operator=(const ClientExpiryWheel&) = delete;
+
+    // The client is alive at now, starts tracking it if new
+    void Touch(const UUID& client_id, Clock::time_point now);
+
+    // Stop tracking the clients whose ttl passed by now and return them
+    std::vector<UUID> Advance(Clock::time_point now);
+
+    size_t size() const { return deadlines_.size(); }
+
+   private:
+    uint64_t TickOf(Clock::time_point time) const {
+        return static_cast<uint64_t>((time - start_) / tick_);
+    }
+
+    const Clock::duration tick_;
+    const Clock::duration ttl_;
+    const Clock::time_point start_;
+    // Tick of the deadline of each client, rounded up
+    std::unordered_map<UUID, uint64_t, boost::hash<UUID>> deadlines_;
+    std::vector<std::vector<UUID>> slots_;
+    // The ticks before it have been processed
+    uint64_t next_tick_ = 0;
+};
+
+}  // namespace mooncake
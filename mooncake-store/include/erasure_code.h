@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "types.h"
+
+namespace mooncake {
+
+/**
+ * @brief Systematic Reed-Solomon code over GF(2^8) for erasure-coded objects
+ *
+ * The value of an object is split into k data fragments, stored as they
+ * are, and m parity fragments are computed from them with a Cauchy matrix.
+ * Any k of the k + m fragments give back the value, so the object survives
+ * the loss of m segments at (k + m) / k times its size instead of the
+ * replica_num times of full replicas.
+ *
+ * Data fragments differ by one byte at most. Parity fragments are as large
+ * as the first data fragment, the shorter ones count as padded with zeros.
+ */
+
+// Upper bound on k + m
+static constexpr size_t kMaxErasureFragments = 32;
+
+// Whether an object can be split into data_fragments data fragments with
+// parity_fragments parity fragments
+bool IsValidErasureCode(uint64_t size, size_t data_fragments,
+                        size_t parity_fragments);
+
+// Sizes of the data fragments of size bytes, the first ones are the largest
+std::vector<uint64_t> ErasureDataFragmentSizes(uint64_t size,
+                                               size_t data_fragments);
+
+// Computes the parity fragments from the data fragments. Each parity slice
+// is as large as the first data slice.
+void ErasureEncode(const std::vector<Slice>& data, std::vector<Slice>& parity);
+
+// Rebuilds the missing data fragments. fragments holds the data slices and
+// then the parity slices, present[i] whether fragments[i] was read. Fails
+// with INVALID_PARAMS when fewer than data_fragments of them are present.
+ErrorCode ErasureDecode(std::vector<Slice>& fragments, size_t data_fragments,
+                        const std::vector<bool>& present);
+
+}  // namespace mooncake
@@ -74,6 +74,36 @@ class EtcdHelper {
      */
     static ErrorCode CancelWatch(const char* key, const size_t key_size);
 
+    /*
+     * @brief Start watching the keys under a prefix. The changes are queued
+     *        until read with NextWatchEvent.
+     * @param prefix: The prefix to watch.
+     * @param prefix_size: The size of the prefix in bytes.
+     * @param watch_id: Output param, the id of the watch.
+     * @return: Error code.
+     */
+    static ErrorCode WatchPrefix(const char* prefix, const size_t prefix_size,
+                                 int& watch_id);
+
+    /*
+     * @brief Wait for the next change of a prefix watch. This is a blocking
+     *        function.
+     * @param watch_id: The id of the watch.
+     * @param timeout_ms: How long to wait for a change, in milliseconds.
+     * @param changed: Output param, false if there was no change in time.
+     * @param key: Output param, the changed key. It is empty when changes
+     *        may have been missed, e.g. on etcd compaction.
+     * @return: Error code.
+     */
+    static ErrorCode NextWatchEvent(int watch_id, int timeout_ms,
+                                    bool& changed, std::string& key);
+
+    /*
+     * @brief Stop a prefix watch.
+     * @param watch_id: The id of the watch.
+     */
+    static void CancelWatchPrefix(int watch_id);
+
     /*
      * @brief Keep a lease alive. This is a blocking function.
      * @param lease_id: The lease id to keep alive.
@@ -1,9 +1,19 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
 #include <memory>
+#include <optional>
 #include <random>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "types.h"
 
@@ -96,4 +106,563 @@ class FIFOEvictionStrategy : public EvictionStrategy {
     }  
 };
 
-}
\ No newline at end of file
+/**
+ * @brief Eviction policy working on compact integer handles instead of keys.
+ * The owner assigns every tracked object a small handle (see
+ * EvictionTracker) and reports insertions, accesses and removals; the
+ * policy keeps its per-object state in arrays indexed by handle.
+ *
+ * Thread safety: OnAccess may run concurrently with other OnAccess calls,
+ * e.g. from readers holding a shard lock in shared mode, so it only updates
+ * per-handle state with relaxed atomics. All other methods require
+ * exclusive access.
+ */
+class EvictionPolicy {
+   public:
+    using Handle = uint32_t;
+    using Evictable = std::function<bool(Handle)>;
+
+    virtual ~EvictionPolicy() = default;
+
+    // Start tracking a handle. The fingerprint is a hash of the object key,
+    // used by policies that remember objects beyond their lifetime.
+    virtual void OnInsert(Handle handle, uint64_t fingerprint) = 0;
+    virtual void OnAccess(Handle handle) = 0;
+    virtual void OnRemove(Handle handle) = 0;
+
+    /**
+     * @brief Choose the next victim among the tracked handles. Handles for
+     * which evictable returns false stay tracked and are treated as recently
+     * used. Every visited handle consumes one unit of budget.
+     * @return The victim, which stays tracked until the caller removes it
+     *         (before calling Evict again), or std::nullopt if the budget runs
+     *         out without finding one.
+     */
+    virtual std::optional<Handle> Evict(const Evictable& evictable,
+                                        size_t& budget) = 0;
+
+    virtual size_t Size() const = 0;
+
+   protected:
+    static constexpr Handle kNil = UINT32_MAX;
+
+    // Intrusive doubly linked lists of handles. All lists of a policy share
+    // the link arrays, so moving a handle between lists never allocates.
+    struct HandleList {
+        Handle head = kNil;
+        Handle tail = kNil;
+        size_t size = 0;
+    };
+
+    class HandleLinks {
+       public:
+        void Grow(Handle handle) {
+            if (handle >= prev_.size()) {
+                prev_.resize(handle + 1, kNil);
+                next_.resize(handle + 1, kNil);
+            }
+        }
+
+        void PushFront(HandleList& list, Handle handle) {
+            prev_[handle] = kNil;
+            next_[handle] = list.head;
+            if (list.head != kNil) {
+                prev_[list.head] = handle;
+            } else {
+                list.tail = handle;
+            }
+            list.head = handle;
+            ++list.size;
+        }
+
+        void Unlink(HandleList& list, Handle handle) {
+            const Handle prev = prev_[handle];
+            const Handle next = next_[handle];
+            if (prev != kNil) {
+                next_[prev] = next;
+            } else {
+                list.head = next;
+            }
+            if (next != kNil) {
+                prev_[next] = prev;
+            } else {
+                list.tail = prev;
+            }
+            prev_[handle] = next_[handle] = kNil;
+            --list.size;
+        }
+
+        void MoveToFront(HandleList& list, Handle handle) {
+            Unlink(list, handle);
+            PushFront(list, handle);
+        }
+
+        Handle Prev(Handle handle) const { return prev_[handle]; }
+
+       private:
+        std::vector<Handle> prev_;
+        std::vector<Handle> next_;
+    };
+
+    // Grow a per-handle state array so that handle is a valid index
+    template <typename T>
+    static void GrowTo(std::vector<T>& state, Handle handle) {
+        if (handle >= state.size()) {
+            state.resize(handle + 1);
+        }
+    }
+
+    static uint8_t LoadRelaxed(uint8_t& value) {
+        return std::atomic_ref<uint8_t>(value).load(std::memory_order_relaxed);
+    }
+
+    static void StoreRelaxed(uint8_t& value, uint8_t desired) {
+        std::atomic_ref<uint8_t>(value).store(desired,
+                                              std::memory_order_relaxed);
+    }
+
+    // Saturating increment. Concurrent increments may be lost, which only
+    // makes the counter slightly less precise.
+    static void IncrementRelaxed(uint8_t& value, uint8_t max) {
+        std::atomic_ref<uint8_t> ref(value);
+        const uint8_t current = ref.load(std::memory_order_relaxed);
+        if (current < max) {
+            ref.store(current + 1, std::memory_order_relaxed);
+        }
+    }
+};
+
+/**
+ * @brief SIEVE: a single FIFO queue with one visited bit per object. The
+ * hand moves from the oldest to the newest object, clearing visited bits and
+ * evicting the first unvisited object. Survivors are never moved, so hits
+ * cost a single relaxed store.
+ */
+class SieveEvictionPolicy : public EvictionPolicy {
+   public:
+    void OnInsert(Handle handle, uint64_t /*fingerprint*/) override {
+        links_.Grow(handle);
+        GrowTo(visited_, handle);
+        visited_[handle] = 0;
+        links_.PushFront(queue_, handle);
+    }
+
+    void OnAccess(Handle handle) override { StoreRelaxed(visited_[handle], 1); }
+
+    void OnRemove(Handle handle) override {
+        if (hand_ == handle) {
+            hand_ = links_.Prev(handle);
+        }
+        links_.Unlink(queue_, handle);
+    }
+
+    std::optional<Handle> Evict(const Evictable& evictable,
+                                size_t& budget) override {
+        while (budget > 0 && queue_.size > 0) {
+            if (hand_ == kNil) {
+                hand_ = queue_.tail;
+            }
+            const Handle handle = hand_;
+            hand_ = links_.Prev(handle);
+            --budget;
+            if (LoadRelaxed(visited_[handle])) {
+                StoreRelaxed(visited_[handle], 0);
+                continue;
+            }
+            if (evictable(handle)) {
+                return handle;
+            }
+        }
+        return std::nullopt;
+    }
+
+    size_t Size() const override { return queue_.size; }
+
+   private:
+    HandleLinks links_;
+    HandleList queue_;
+    Handle hand_ = kNil;
+    std::vector<uint8_t> visited_;
+};
+
+/**
+ * @brief S3-FIFO: a small FIFO queue (10% of the objects) filters one-hit
+ * wonders, a main FIFO queue with 2-bit frequencies and lazy promotion holds
+ * the rest, and a ghost queue of fingerprints remembers objects recently
+ * evicted from the small queue so that they are admitted to the main queue
+ * when they come back.
+ */
+class S3FifoEvictionPolicy : public EvictionPolicy {
+   public:
+    void OnInsert(Handle handle, uint64_t fingerprint) override {
+        links_.Grow(handle);
+        GrowTo(freq_, handle);
+        GrowTo(queue_of_, handle);
+        GrowTo(fingerprint_, handle);
+        freq_[handle] = 0;
+        fingerprint_[handle] = fingerprint;
+        if (ghost_.erase(fingerprint) > 0) {
+            queue_of_[handle] = kMain;
+            links_.PushFront(main_, handle);
+        } else {
+            queue_of_[handle] = kSmall;
+            links_.PushFront(small_, handle);
+        }
+    }
+
+    void OnAccess(Handle handle) override {
+        IncrementRelaxed(freq_[handle], kMaxFreq);
+    }
+
+    void OnRemove(Handle handle) override {
+        links_.Unlink(queue_of_[handle] == kSmall ? small_ : main_, handle);
+    }
+
+    std::optional<Handle> Evict(const Evictable& evictable,
+                                size_t& budget) override {
+        while (budget > 0 && Size() > 0) {
+            --budget;
+            const bool from_small =
+                small_.size > 0 &&
+                (small_.size * 100 >= Size() * kSmallQueuePercent ||
+                 main_.size == 0);
+            if (from_small) {
+                const Handle handle = small_.tail;
+                if (LoadRelaxed(freq_[handle]) > 1) {
+                    // Accessed again while in the small queue: promote
+                    links_.Unlink(small_, handle);
+                    StoreRelaxed(freq_[handle], 0);
+                    queue_of_[handle] = kMain;
+                    links_.PushFront(main_, handle);
+                } else if (evictable(handle)) {
+                    RememberGhost(fingerprint_[handle]);
+                    return handle;
+                } else {
+                    links_.MoveToFront(small_, handle);
+                }
+            } else {
+                const Handle handle = main_.tail;
+                const uint8_t freq = LoadRelaxed(freq_[handle]);
+                if (freq > 0) {
+                    StoreRelaxed(freq_[handle], freq - 1);
+                    links_.MoveToFront(main_, handle);
+                } else if (evictable(handle)) {
+                    return handle;
+                } else {
+                    links_.MoveToFront(main_, handle);
+                }
+            }
+        }
+        return std::nullopt;
+    }
+
+    size_t Size() const override { return small_.size + main_.size; }
+
+   private:
+    static constexpr uint8_t kSmall = 0;
+    static constexpr uint8_t kMain = 1;
+    static constexpr uint8_t kMaxFreq = 3;
+    static constexpr size_t kSmallQueuePercent = 10;
+
+    // The ghost queue remembers about as many fingerprints as there are
+    // tracked objects. An evicted duplicate may drop a newer entry early,
+    // which is harmless for an admission hint.
+    void RememberGhost(uint64_t fingerprint) {
+        if (ghost_.insert(fingerprint).second) {
+            ghost_fifo_.push_back(fingerprint);
+        }
+        while (ghost_fifo_.size() > std::max<size_t>(Size(), 1)) {
+            ghost_.erase(ghost_fifo_.front());
+            ghost_fifo_.pop_front();
+        }
+    }
+
+    HandleLinks links_;
+    HandleList small_;
+    HandleList main_;
+    std::vector<uint8_t> freq_;
+    std::vector<uint8_t> queue_of_;
+    std::vector<uint64_t> fingerprint_;
+    std::unordered_set<uint64_t> ghost_;
+    std::deque<uint64_t> ghost_fifo_;
+};
+
+/**
+ * @brief W-TinyLFU: a small admission window (1% of the objects) in front of
+ * a segmented main area (probation and protected, 80% protected). An object
+ * leaving the window only enters the main area if a count-min sketch says it
+ * is used more often than the main area's victim, so scans of one-off
+ * objects cannot flush frequently used ones.
+ *
+ * To keep hits free of list updates, recency inside each segment is tracked
+ * with a reference bit (CLOCK) instead of strict LRU moves, and promotion
+ * from probation to protected happens lazily when the bit is found set.
+ */
+class WTinyLfuEvictionPolicy : public EvictionPolicy {
+   public:
+    void OnInsert(Handle handle, uint64_t fingerprint) override {
+        links_.Grow(handle);
+        GrowTo(referenced_, handle);
+        GrowTo(queue_of_, handle);
+        GrowTo(fingerprint_, handle);
+        referenced_[handle] = 0;
+        fingerprint_[handle] = fingerprint;
+        queue_of_[handle] = kWindow;
+        links_.PushFront(window_, handle);
+        sketch_.EnsureCapacity(Size());
+        sketch_.Increment(fingerprint);
+    }
+
+    void OnAccess(Handle handle) override {
+        StoreRelaxed(referenced_[handle], 1);
+        sketch_.Increment(fingerprint_[handle]);
+    }
+
+    void OnRemove(Handle handle) override {
+        links_.Unlink(ListOf(handle), handle);
+    }
+
+    std::optional<Handle> Evict(const Evictable& evictable,
+                                size_t& budget) override {
+        sketch_.AgeIfNeeded();
+        while (budget > 0 && Size() > 0) {
+            --budget;
+            const size_t main_size = probation_.size + protected_.size;
+            const bool from_window =
+                window_.size > 0 &&
+                (window_.size * 100 > Size() * kWindowPercent ||
+                 main_size == 0);
+            Handle candidate;
+            if (from_window) {
+                const Handle handle = window_.tail;
+                if (LoadRelaxed(referenced_[handle])) {
+                    StoreRelaxed(referenced_[handle], 0);
+                    links_.MoveToFront(window_, handle);
+                    continue;
+                }
+                candidate = handle;
+                if (main_size > 0) {
+                    // The window victim competes with the main victim, the
+                    // less frequently used one is evicted.
+                    const Handle main_victim = MainTail();
+                    if (sketch_.Estimate(fingerprint_[handle]) >
+                        sketch_.Estimate(fingerprint_[main_victim])) {
+                        links_.Unlink(window_, handle);
+                        queue_of_[handle] = kProbation;
+                        links_.PushFront(probation_, handle);
+                        candidate = main_victim;
+                    }
+                }
+            } else {
+                const Handle handle = MainTail();
+                if (LoadRelaxed(referenced_[handle])) {
+                    StoreRelaxed(referenced_[handle], 0);
+                    Promote(handle);
+                    continue;
+                }
+                candidate = handle;
+            }
+
+            if (evictable(candidate)) {
+                return candidate;
+            }
+            links_.MoveToFront(ListOf(candidate), candidate);
+        }
+        return std::nullopt;
+    }
+
+    size_t Size() const override {
+        return window_.size + probation_.size + protected_.size;
+    }
+
+   private:
+    static constexpr uint8_t kWindow = 0;
+    static constexpr uint8_t kProbation = 1;
+    static constexpr uint8_t kProtected = 2;
+    static constexpr size_t kWindowPercent = 1;
+    static constexpr size_t kProtectedPercent = 80;
+
+    // Count-min sketch with 4 rows of saturating 4-bit counters (stored in
+    // bytes), halved periodically so that old popularity fades out.
+    class FrequencySketch {
+       public:
+        void EnsureCapacity(size_t count) {
+            size_t width = kMinWidth;
+            while (width < count) {
+                width <<= 1;
+            }
+            if (width > width_) {
+                width_ = width;
+                table_.assign(kDepth * width_, 0);
+                additions_.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        void Increment(uint64_t fingerprint) {
+            for (size_t row = 0; row < kDepth; ++row) {
+                IncrementRelaxed(table_[Index(fingerprint, row)], kMaxCount);
+            }
+            additions_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        uint8_t Estimate(uint64_t fingerprint) {
+            uint8_t estimate = kMaxCount;
+            for (size_t row = 0; row < kDepth; ++row) {
+                estimate = std::min(
+                    estimate, LoadRelaxed(table_[Index(fingerprint, row)]));
+            }
+            return estimate;
+        }
+
+        void AgeIfNeeded() {
+            if (additions_.load(std::memory_order_relaxed) < width_ * 10) {
+                return;
+            }
+            for (auto& counter : table_) {
+                counter >>= 1;
+            }
+            additions_.store(0, std::memory_order_relaxed);
+        }
+
+       private:
+        static constexpr size_t kDepth = 4;
+        static constexpr size_t kMinWidth = 64;
+        static constexpr uint8_t kMaxCount = 15;
+
+        size_t Index(uint64_t fingerprint, size_t row) const {
+            static constexpr uint64_t kSeeds[kDepth] = {
+                0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL,
+                0x165667B19E3779F9ULL, 0xD6E8FEB86659FD93ULL};
+            uint64_t h = (fingerprint ^ (fingerprint >> 29)) * kSeeds[row];
+            return row * width_ + ((h >> 32) & (width_ - 1));
+        }
+
+        size_t width_ = 0;
+        std::vector<uint8_t> table_;
+        std::atomic<uint64_t> additions_{0};
+    };
+
+    HandleList& ListOf(Handle handle) {
+        switch (queue_of_[handle]) {
+            case kWindow:
+                return window_;
+            case kProbation:
+                return probation_;
+            default:
+                return protected_;
+        }
+    }
+
+    Handle MainTail() const {
+        return probation_.size > 0 ? probation_.tail : protected_.tail;
+    }
+
+    // Move a referenced main area object to the front of the protected
+    // segment, demoting the protected tail when the segment is full.
+    void Promote(Handle handle) {
+        links_.Unlink(ListOf(handle), handle);
+        queue_of_[handle] = kProtected;
+        links_.PushFront(protected_, handle);
+        const size_t main_size = probation_.size + protected_.size;
+        if (protected_.size * 100 > main_size * kProtectedPercent &&
+            protected_.size > 1) {
+            const Handle demoted = protected_.tail;
+            links_.Unlink(protected_, demoted);
+            queue_of_[demoted] = kProbation;
+            links_.PushFront(probation_, demoted);
+        }
+    }
+
+    HandleLinks links_;
+    HandleList window_;
+    HandleList probation_;
+    HandleList protected_;
+    std::vector<uint8_t> referenced_;
+    std::vector<uint8_t> queue_of_;
+    std::vector<uint64_t> fingerprint_;
+    FrequencySketch sketch_;
+};
+
+/**
+ * @brief Create the policy of a policy based eviction engine, or nullptr for
+ * engines that do not use an EvictionPolicy.
+ */
+inline std::unique_ptr<EvictionPolicy> CreateEvictionPolicy(
+    EvictionEngine engine) {
+    switch (engine) {
+        case EvictionEngine::SIEVE:
+            return std::make_unique<SieveEvictionPolicy>();
+        case EvictionEngine::S3FIFO:
+            return std::make_unique<S3FifoEvictionPolicy>();
+        case EvictionEngine::W_TINYLFU:
+            return std::make_unique<WTinyLfuEvictionPolicy>();
+        default:
+            return nullptr;
+    }
+}
+
+/**
+ * @brief Owns an EvictionPolicy and the mapping between the compact handles
+ * it works on and the object keys. The tracker does not copy the keys: it
+ * keeps views of the keys stored in the metadata map, which stay valid as
+ * long as the objects. Freed handles are reused. Same thread safety rules
+ * as EvictionPolicy.
+ */
+class EvictionTracker {
+   public:
+    using Handle = EvictionPolicy::Handle;
+
+    explicit EvictionTracker(std::unique_ptr<EvictionPolicy> policy)
+        : policy_(std::move(policy)) {}
+
+    // Tracks an object, key must stay valid until the handle is removed
+    Handle Add(std::string_view key) {
+        Handle handle;
+        if (!free_handles_.empty()) {
+            handle = free_handles_.back();
+            free_handles_.pop_back();
+            keys_[handle] = key;
+        } else {
+            handle = static_cast<Handle>(keys_.size());
+            keys_.push_back(key);
+        }
+        policy_->OnInsert(handle, std::hash<std::string_view>{}(key));
+        return handle;
+    }
+
+    // Takes an object out of the policy while keeping its handle, e.g.
+    // while it only has a disk replica, and puts it back as a new one
+    void Suspend(Handle handle) { policy_->OnRemove(handle); }
+    void Resume(Handle handle) {
+        policy_->OnInsert(handle,
+                          std::hash<std::string_view>{}(keys_[handle]));
+    }
+
+    // Frees the handle, suspended tells that the object is out of the
+    // policy already
+    void Remove(Handle handle, bool suspended = false) {
+        if (!suspended) {
+            policy_->OnRemove(handle);
+        }
+        keys_[handle] = {};
+        free_handles_.push_back(handle);
+    }
+
+    void Access(Handle handle) { policy_->OnAccess(handle); }
+
+    std::optional<Handle> Evict(const EvictionPolicy::Evictable& evictable,
+                                size_t& budget) {
+        return policy_->Evict(evictable, budget);
+    }
+
+    std::string_view Key(Handle handle) const { return keys_[handle]; }
+
+    size_t Size() const { return policy_->Size(); }
+
+   private:
+    std::unique_ptr<EvictionPolicy> policy_;
+    std::vector<std::string_view> keys_;
+    std::vector<Handle> free_handles_;
+};
+
+}  // namespace mooncake
@@ -0,0 +1,403 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <new>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "key_hash.h"
+
+namespace mooncake {
+
+/**
+ * @brief Open-addressing hash map from string keys to non-movable values,
+ * designed as a drop-in replacement for the per-shard
+ * std::unordered_map<std::string, V> in MasterService.
+ *
+ * Layout:
+ * - A dense control byte array holds a 7-bit hash tag per slot (or the
+ *   kEmpty / kDeleted markers), so misses and most tag mismatches are
+ *   resolved without touching the slot array.
+ * - Each slot is 16 bytes and stores the full 32-bit hash, the key length
+ *   and a pointer to its entry, so four slots share a cache line and a
+ *   probe only reads an entry when the full hash matches.
+ * - Each entry is a single allocation holding the value and the key.
+ *   Entries never move, so references returned by find() and the keys
+ *   seen through iterators stay valid across rehashes, just like
+ *   std::unordered_map.
+ *
+ * Erase leaves a tombstone (or an empty slot when the probe chain allows
+ * it) and never rehashes, so erase(it) during iteration is safe and returns
+ * the next valid iterator. Insertions may rehash and invalidate iterators.
+ *
+ * This class is not thread-safe; callers hold the shard mutex.
+ */
+template <typename V>
+class FlatMetadataMap {
+   private:
+    static constexpr int8_t kEmpty = -128;   // 0b10000000
+    static constexpr int8_t kDeleted = -2;   // 0b11111110
+    static constexpr size_t kMinCapacity = 16;
+
+    // The key bytes follow the entry in the same allocation
+    struct Entry {
+        template <typename... Args>
+        explicit Entry(Args&&... args) : value(std::forward<Args>(args)...) {}
+
+        char* key_data() { return reinterpret_cast<char*>(this + 1); }
+        const char* key_data() const {
+            return reinterpret_cast<const char*>(this + 1);
+        }
+
+        V value;
+    };
+
+    struct Slot {
+        uint32_t hash;
+        uint32_t key_len;
+        Entry* entry;
+
+        std::string_view key() const { return {entry->key_data(), key_len}; }
+    };
+    static_assert(sizeof(Slot) == 16, "Four slots should share a line");
+
+   public:
+    // Iterator dereferences to a pair-like proxy so that call sites written
+    // against std::unordered_map (it->first, it->second) keep working.
+    struct value_type {
+        std::string_view first;
+        V& second;
+    };
+
+    template <bool kConst>
+    class IteratorBase {
+       public:
+        using map_type = std::conditional_t<kConst, const FlatMetadataMap,
+                                            FlatMetadataMap>;
+
+        IteratorBase() = default;
+        IteratorBase(map_type* map, size_t idx) : map_(map), idx_(idx) {
+            SkipEmpty();
+        }
+
+        // Allow converting a mutable iterator into a const iterator
+        template <bool kOther, typename = std::enable_if_t<kConst && !kOther>>
+        IteratorBase(const IteratorBase<kOther>& other)
+            : map_(other.map_), idx_(other.idx_) {}
+
+        // The cached proxy holds a reference, so copies only carry the
+        // position and rebuild the proxy lazily.
+        IteratorBase(const IteratorBase& other)
+            : map_(other.map_), idx_(other.idx_) {}
+        IteratorBase& operator=(const IteratorBase& other) {
+            map_ = other.map_;
+            idx_ = other.idx_;
+            proxy_.reset();
+            return *this;
+        }
+
+        value_type operator*() const {
+            const Slot& slot = map_->slots_[idx_];
+            return {slot.key(), slot.entry->value};
+        }
+
+        const value_type* operator->() const {
+            proxy_.reset();
+            proxy_.emplace(**this);
+            return &*proxy_;
+        }
+
+        IteratorBase& operator++() {
+            ++idx_;
+            SkipEmpty();
+            return *this;
+        }
+
+        IteratorBase operator++(int) {
+            IteratorBase prev = *this;
+            ++*this;
+            return prev;
+        }
+
+        bool operator==(const IteratorBase& other) const {
+            return idx_ == other.idx_;
+        }
+        bool operator!=(const IteratorBase& other) const {
+            return idx_ != other.idx_;
+        }
+
+       private:
+        friend class FlatMetadataMap;
+        template <bool>
+        friend class IteratorBase;
+
+        void SkipEmpty() {
+            while (idx_ < map_->capacity_ && map_->ctrl_[idx_] < 0) {
+                ++idx_;
+            }
+        }
+
+        map_type* map_{nullptr};
+        size_t idx_{0};
+        mutable std::optional<value_type> proxy_;
+    };
+
+    using iterator = IteratorBase<false>;
+    using const_iterator = IteratorBase<true>;
+
+    FlatMetadataMap() = default;
+    ~FlatMetadataMap() { clear(); }
+
+    FlatMetadataMap(const FlatMetadataMap&) = delete;
+    FlatMetadataMap& operator=(const FlatMetadataMap&) = delete;
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, capacity_); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, capacity_); }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    size_t capacity() const { return capacity_; }
+
+    iterator find(std::string_view key) {
+        size_t idx = FindIndex(key, Hash(key));
+        return idx == kNotFound ? end() : iterator(this, idx);
+    }
+
+    const_iterator find(std::string_view key) const {
+        size_t idx = FindIndex(key, Hash(key));
+        return idx == kNotFound ? end() : const_iterator(this, idx);
+    }
+
+    bool contains(std::string_view key) const {
+        return FindIndex(key, Hash(key)) != kNotFound;
+    }
+
+    /**
+     * @brief Construct the value in place if the key is absent.
+     * @return iterator to the element and whether an insertion happened
+     */
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(std::string_view key,
+                                          Args&&... args) {
+        const uint32_t hash = Hash(key);
+        size_t idx = FindIndex(key, hash);
+        if (idx != kNotFound) {
+            return {iterator(this, idx), false};
+        }
+        // Construct the value before touching the table so that an exception
+        // in the constructor leaves the map unchanged.
+        Entry* entry = NewEntry(key, std::forward<Args>(args)...);
+        ReserveForInsert();
+        idx = FindInsertIndex(hash);
+        if (ctrl_[idx] == kDeleted) {
+            --tombstones_;
+        }
+        Slot& slot = slots_[idx];
+        slot.hash = hash;
+        slot.key_len = static_cast<uint32_t>(key.size());
+        slot.entry = entry;
+        ctrl_[idx] = Tag(hash);
+        ++size_;
+        return {iterator(this, idx), true};
+    }
+
+    // std::unordered_map compatible piecewise emplace used by existing code
+    template <typename... KArgs, typename... VArgs>
+    std::pair<iterator, bool> emplace(std::piecewise_construct_t,
+                                      std::tuple<KArgs...> key_args,
+                                      std::tuple<VArgs...> value_args) {
+        return std::apply(
+            [&](auto&&... vargs) {
+                return try_emplace(std::string_view(std::get<0>(key_args)),
+                                   std::forward<decltype(vargs)>(vargs)...);
+            },
+            std::move(value_args));
+    }
+
+    iterator erase(iterator it) {
+        EraseIndex(it.idx_);
+        ++it;
+        return it;
+    }
+
+    size_t erase(std::string_view key) {
+        size_t idx = FindIndex(key, Hash(key));
+        if (idx == kNotFound) {
+            return 0;
+        }
+        EraseIndex(idx);
+        return 1;
+    }
+
+    void clear() {
+        for (size_t i = 0; i < capacity_; ++i) {
+            if (ctrl_[i] >= 0) {
+                FreeEntry(slots_[i].entry);
+            }
+        }
+        ctrl_.reset();
+        slots_.reset();
+        capacity_ = 0;
+        size_ = 0;
+        tombstones_ = 0;
+    }
+
+    void reserve(size_t count) {
+        size_t target = kMinCapacity;
+        while (target * kMaxLoadNum / kMaxLoadDen < count) {
+            target <<= 1;
+        }
+        if (target > capacity_) {
+            Rehash(target);
+        }
+    }
+
+   private:
+    static constexpr size_t kNotFound = static_cast<size_t>(-1);
+    // Maximum load factor (live + tombstones) of 7/8
+    static constexpr size_t kMaxLoadNum = 7;
+    static constexpr size_t kMaxLoadDen = 8;
+
+    template <typename... Args>
+    static Entry* NewEntry(std::string_view key, Args&&... args) {
+        void* memory = ::operator new(sizeof(Entry) + key.size());
+        Entry* entry;
+        try {
+            entry = new (memory) Entry(std::forward<Args>(args)...);
+        } catch (...) {
+            ::operator delete(memory);
+            throw;
+        }
+        std::memcpy(entry->key_data(), key.data(), key.size());
+        return entry;
+    }
+
+    static void FreeEntry(Entry* entry) {
+        entry->~Entry();
+        ::operator delete(entry);
+    }
+
+    static uint32_t Hash(std::string_view key) {
+        // MasterService shards by KeyHash % kNumShards, so all keys in a
+        // shard share the low bits. Mix the hash so the in-shard probe
+        // position does not depend on the shard selector bits.
+        uint64_t h = KeyHash(key);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return static_cast<uint32_t>(h);
+    }
+
+    static int8_t Tag(uint32_t hash) {
+        return static_cast<int8_t>(hash >> 25);  // top 7 bits, always >= 0
+    }
+
+    size_t FindIndex(std::string_view key, uint32_t hash) const {
+        if (capacity_ == 0) {
+            return kNotFound;
+        }
+        const int8_t tag = Tag(hash);
+        const size_t mask = capacity_ - 1;
+        size_t idx = hash & mask;
+        for (size_t probe = 0; probe < capacity_; ++probe) {
+            const int8_t ctrl = ctrl_[idx];
+            if (ctrl == kEmpty) {
+                return kNotFound;
+            }
+            if (ctrl == tag) {
+                const Slot& slot = slots_[idx];
+                if (slot.hash == hash && slot.key_len == key.size() &&
+                    std::memcmp(slot.entry->key_data(), key.data(),
+                                key.size()) == 0) {
+                    return idx;
+                }
+            }
+            idx = (idx + 1) & mask;
+        }
+        return kNotFound;
+    }
+
+    size_t FindInsertIndex(uint32_t hash) const {
+        const size_t mask = capacity_ - 1;
+        size_t idx = hash & mask;
+        while (ctrl_[idx] >= 0) {
+            idx = (idx + 1) & mask;
+        }
+        return idx;
+    }
+
+    void EraseIndex(size_t idx) {
+        FreeEntry(slots_[idx].entry);
+        slots_[idx].entry = nullptr;
+        --size_;
+        // With linear probing a slot can go straight back to empty if the
+        // next slot is empty, because no probe chain continues through it.
+        const size_t next = (idx + 1) & (capacity_ - 1);
+        if (ctrl_[next] == kEmpty) {
+            ctrl_[idx] = kEmpty;
+        } else {
+            ctrl_[idx] = kDeleted;
+            ++tombstones_;
+        }
+    }
+
+    void ReserveForInsert() {
+        if (capacity_ == 0) {
+            Rehash(kMinCapacity);
+            return;
+        }
+        if ((size_ + tombstones_ + 1) * kMaxLoadDen <=
+            capacity_ * kMaxLoadNum) {
+            return;
+        }
+        // Grow only if live entries dominate; otherwise just purge
+        // tombstones in place at the same capacity.
+        if ((size_ + 1) * 2 * kMaxLoadDen > capacity_ * kMaxLoadNum) {
+            Rehash(capacity_ * 2);
+        } else {
+            Rehash(capacity_);
+        }
+    }
+
+    void Rehash(size_t new_capacity) {
+        auto old_ctrl = std::move(ctrl_);
+        auto old_slots = std::move(slots_);
+        const size_t old_capacity = capacity_;
+
+        ctrl_ = std::make_unique<int8_t[]>(new_capacity);
+        std::memset(ctrl_.get(), kEmpty, new_capacity);
+        slots_ = std::make_unique<Slot[]>(new_capacity);
+        capacity_ = new_capacity;
+        tombstones_ = 0;
+
+        for (size_t i = 0; i < old_capacity; ++i) {
+            if (old_ctrl[i] < 0) {
+                continue;
+            }
+            // Slots are trivially relocatable: the hash is precomputed, so
+            // rehashing never touches the key bytes or the value.
+            size_t idx = FindInsertIndex(old_slots[i].hash);
+            std::memcpy(static_cast<void*>(&slots_[idx]), &old_slots[i],
+                        sizeof(Slot));
+            ctrl_[idx] = old_ctrl[i];
+        }
+    }
+
+    std::unique_ptr<int8_t[]> ctrl_;
+    std::unique_ptr<Slot[]> slots_;
+    size_t capacity_{0};
+    size_t size_{0};
+    size_t tombstones_{0};
+};
+
+}  // namespace mooncake
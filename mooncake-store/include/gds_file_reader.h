@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+namespace mooncake {
+
+class CUFileDescPool;
+
+/**
+ * @brief Reads disk replicas straight into GPU memory with GPUDirect
+ * Storage, without a bounce through host memory and a cudaMemcpy
+ *
+ * The slices of a read are submitted as one cuFile batch, through the
+ * descriptor pool of the NVMe-oF transport, in chunks of kMaxBatch slices.
+ * The file is registered with cuFile for the duration of the read.
+ *
+ * Needs a build with USE_NVMEOF, which links cuFile. Set MC_STORE_GDS=0 to
+ * read device slices through host memory instead.
+ */
+class GdsFileReader {
+   public:
+    static constexpr size_t kMaxBatch = 128;
+
+    /**
+     * @brief Open the cuFile driver
+     * @return nullptr if GPUDirect Storage is disabled or not available
+     */
+    static std::unique_ptr<GdsFileReader> Create();
+
+    ~GdsFileReader();
+
+    GdsFileReader(const GdsFileReader&) = delete;
+    GdsFileReader& operator=(const GdsFileReader&) = delete;
+
+    // Whether all slices are in GPU memory, so that Read can fill them
+    static bool IsDeviceMemory(const std::vector<Slice>& slices);
+
+    /**
+     * @brief Read the bytes of path at offset into slices, one after the
+     * other. Safe to call from several threads.
+     */
+    ErrorCode Read(const std::string& path, uint64_t offset,
+                   const std::vector<Slice>& slices);
+
+   private:
+    GdsFileReader();
+
+    std::unique_ptr<CUFileDescPool> desc_pool_;
+};
+
+}  // namespace mooncake
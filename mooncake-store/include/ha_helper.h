@@ -3,8 +3,11 @@
 
 #include <glog/logging.h>
 
+#include <atomic>
 #include <chrono>
 #include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
 #include <thread>
 #include <ylt/coro_rpc/coro_rpc_server.hpp>
@@ -18,6 +21,17 @@ namespace mooncake {
 // The key to store the master view in etcd
 inline const char* const MASTER_VIEW_KEY = "mooncake-store/master_view";
 
+// The key to store the number of master partitions in etcd, absent when the
+// metadata is not partitioned
+inline const char* const MASTER_PARTITION_NUM_KEY =
+    "mooncake-store/master_partitions";
+
+/*
+ * @brief The key of the master view of a partition. A single partition uses
+ *        MASTER_VIEW_KEY, so that unpartitioned clusters are unchanged.
+ */
+std::string MasterViewKey(size_t partition_id, size_t partition_num);
+
 /*
  * @brief A helper class for maintain and monitor the master view change.
  *        The cluster is assumed to have multiple master servers, but only
@@ -30,6 +44,7 @@ class MasterViewHelper {
     MasterViewHelper(const MasterViewHelper&) = delete;
     MasterViewHelper& operator=(const MasterViewHelper&) = delete;
     MasterViewHelper() = default;
+    ~MasterViewHelper();
 
     /*
      * @brief Connect to the etcd cluster. This function should be called at
@@ -45,9 +60,11 @@ class MasterViewHelper {
      * @param master_address: The ip:port address of the master to be elected.
      * @param version: Output param, the version of the new master view.
      * @param lease_id: Output param, the lease id of the leader.
+     * @param view_key: The key of the master view, see MasterViewKey().
      */
     void ElectLeader(const std::string& master_address, ViewVersionId& version,
-                     EtcdLeaseId& lease_id);
+                     EtcdLeaseId& lease_id,
+                     const std::string& view_key = MASTER_VIEW_KEY);
 
     /*
      * @brief Keep the master to be the leader. This function blocks until the
@@ -60,10 +77,51 @@ class MasterViewHelper {
      * @brief Get the current master view.
      * @param master: Output param, the ip:port address of the master.
      * @param version: Output param, the version of the master view.
+     * @param view_key: The key of the master view, see MasterViewKey().
      * @return: Error code.
      */
     ErrorCode GetMasterView(std::string& master_address,
-                            ViewVersionId& version);
+                            ViewVersionId& version,
+                            const std::string& view_key = MASTER_VIEW_KEY);
+
+    /*
+     * @brief Watch the master views of all the partitions. The callback is
+     *        called from a thread of this helper as soon as a master view
+     *        key changes, e.g. when a new leader is elected, with the changed
+     *        key, or with an empty key when changes may have been missed.
+     *        Only one watch runs at a time.
+     * @param on_change: Called on each change.
+     * @return: Error code.
+     */
+    ErrorCode WatchMasterViews(
+        std::function<void(const std::string& view_key)> on_change);
+
+    /*
+     * @brief Stop the watch started by WatchMasterViews, if any.
+     */
+    void StopWatchingMasterViews();
+
+    /*
+     * @brief Publish the number of master partitions, which clients read to
+     *        route keys. The first master to start creates the key, the
+     *        others check that they agree with it.
+     * @param partition_num: The number of partitions.
+     * @return: Error code, INVALID_PARAMS if another number is published.
+     */
+    ErrorCode PublishPartitionNum(size_t partition_num);
+
+    /*
+     * @brief Get the number of master partitions.
+     * @param partition_num: Output param, 1 if none is published.
+     * @return: Error code.
+     */
+    ErrorCode GetPartitionNum(size_t& partition_num);
+
+   private:
+    // Set by WatchMasterViews
+    int watch_id_ = 0;
+    std::atomic<bool> watch_running_{false};
+    std::thread watch_thread_;
 };
 
 /*
@@ -75,35 +133,31 @@ class MasterViewHelper {
  */
 class MasterServiceSupervisor {
    public:
+    // config is that of the master service once elected, which enables HA
+    // and takes the view version of the election
     MasterServiceSupervisor(
-        int rpc_port, size_t rpc_thread_num, bool enable_gc,
-        bool enable_metric_reporting, int metrics_port,
-        int64_t default_kv_lease_ttl, int64_t default_kv_soft_pin_ttl,
-        bool allow_evict_soft_pinned_objects,
-        double eviction_ratio, double eviction_high_watermark_ratio,
-        int64_t client_live_ttl_sec,
+        const WrappedMasterServiceConfig& config, int rpc_port,
+        size_t rpc_thread_num,
         const std::string& etcd_endpoints = "0.0.0.0:2379",
         const std::string& local_hostname = "0.0.0.0:50051",
         const std::string& rpc_address = "0.0.0.0",
         std::chrono::steady_clock::duration rpc_conn_timeout =
             std::chrono::seconds(
                 0),  // Client connection timeout. 0 = no timeout (infinite)
-        bool rpc_enable_tcp_no_delay = true,
-        const std::string& cluster_id = DEFAULT_CLUSTER_ID);
+        bool rpc_enable_tcp_no_delay = true, size_t partition_id = 0,
+        size_t partition_num = 1, bool rpc_enable_rdma = false,
+        const AdmissionConfig& admission_config = {});
     int Start();
     ~MasterServiceSupervisor();
 
    private:
+    // While following is set, keep a MetadataFollower on the current leader
+    // of the partition, for MasterService::RestoreMetadata once elected
+    void FollowLeader(const std::atomic<bool>& following,
+                      std::unique_ptr<MetadataFollower>& follower);
+
     // Master service parameters
-    bool enable_gc_;
-    bool enable_metric_reporting_;
-    int metrics_port_;
-    int64_t default_kv_lease_ttl_;
-    int64_t default_kv_soft_pin_ttl_;
-    bool allow_evict_soft_pinned_objects_;
-    double eviction_ratio_;
-    double eviction_high_watermark_ratio_;
-    int64_t client_live_ttl_sec_;
+    WrappedMasterServiceConfig config_;
 
     // RPC server configuration parameters
     const int rpc_port_;
@@ -111,6 +165,7 @@ class MasterServiceSupervisor {
     const std::string rpc_address_;
     const std::chrono::steady_clock::duration rpc_conn_timeout_;
     const bool rpc_enable_tcp_no_delay_;
+    const bool rpc_enable_rdma_;
 
     // coro_rpc server thread
     std::thread server_thread_;
@@ -121,7 +176,11 @@ class MasterServiceSupervisor {
     // Local hostname for leader election
     std::string local_hostname_;
 
-    std::string cluster_id_;
+    // Partition of the metadata served by this master
+    size_t partition_id_;
+    size_t partition_num_;
+
+    AdmissionConfig admission_config_;
 };
 
 }  // namespace mooncake
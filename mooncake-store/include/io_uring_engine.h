@@ -0,0 +1,135 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace mooncake {
+
+/**
+ * @brief Reads and writes whole files through an io_uring instance
+ *
+ * Files are transferred in chunks of kChunkSize bytes with up to
+ * queue_depth chunks in flight. Every chunk goes through a slot of a
+ * kAlignment-aligned staging buffer that is registered with the ring, so
+ * files opened with O_DIRECT work for any user buffers; the file being
+ * transferred is registered as a fixed file. Both registrations are
+ * optional, the engine uses plain requests where the kernel refuses them.
+ *
+ * The ring is driven with raw system calls, no liburing is needed. An
+ * engine is not thread-safe, use one per thread.
+ */
+class IoUringEngine {
+   public:
+    static constexpr size_t kChunkSize = 512 * 1024;
+    static constexpr size_t kAlignment = 4096;
+
+    /**
+     * @brief Set up a ring with queue_depth entries
+     * @return nullptr if io_uring is not available
+     */
+    static std::unique_ptr<IoUringEngine> Create(unsigned queue_depth);
+
+    ~IoUringEngine();
+
+    IoUringEngine(const IoUringEngine&) = delete;
+    IoUringEngine& operator=(const IoUringEngine&) = delete;
+
+    /**
+     * @brief Read the bytes of fd at offset into the buffers of iov. For
+     * files opened with O_DIRECT the offset must be kAlignment-aligned.
+     * @return Total bytes read, -1 on error or if the file is too short
+     */
+    ssize_t Read(int fd, const iovec* iov, int iovcnt, uint64_t offset = 0);
+
+    /**
+     * @brief Write the buffers of iov to the start of fd. Files opened with
+     * O_DIRECT are padded to kAlignment and truncated back afterwards.
+     * @return Total bytes written, -1 on error
+     */
+    ssize_t Write(int fd, const iovec* iov, int iovcnt);
+
+    /**
+     * @brief Write the buffers of iov to fd at offset, e.g. to append to a
+     * segment file. For files opened with O_DIRECT the offset must be
+     * aligned, and the data is padded with zeros to a multiple of
+     * kAlignment, which is left in the file.
+     * @return Total bytes written, without padding, -1 on error
+     */
+    ssize_t WriteAt(int fd, const iovec* iov, int iovcnt, uint64_t offset);
+
+    unsigned queue_depth() const { return depth_; }
+
+    // False after a failure that left the ring unusable
+    bool ok() const { return ring_fd_ >= 0; }
+
+   private:
+    struct Slot {
+        uint64_t offset;  // Offset in the file and in the iov
+        size_t len;       // Bytes of user data
+        size_t io_len;    // Bytes requested from the kernel
+    };
+
+    IoUringEngine() = default;
+
+    ssize_t Transfer(int fd, const iovec* iov, int iovcnt, uint64_t offset,
+                     bool write);
+    // Put fd, or -1 to clear, in the fixed file table
+    bool SetFile(int fd);
+    int Enter(unsigned to_submit, unsigned min_complete);
+
+    int ring_fd_ = -1;
+    unsigned depth_ = 0;
+
+    void* sq_ring_ = nullptr;
+    size_t sq_ring_size_ = 0;
+    void* cq_ring_ = nullptr;
+    size_t cq_ring_size_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned* sq_array_ = nullptr;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+
+    char* staging_ = nullptr;
+    bool buffers_registered_ = false;
+    // The fixed file table has a single entry, updated for every file
+    bool files_registered_ = false;
+    bool files_unsupported_ = false;
+    std::vector<Slot> slots_;
+    std::vector<iovec> slot_iovs_;
+};
+
+/**
+ * @brief Idle engines shared by the threads of one storage backend. Engines
+ * are created on demand; once creating one fails, Acquire() keeps returning
+ * nullptr so callers use their buffered I/O path.
+ */
+class IoUringEnginePool {
+   public:
+    // A queue depth of 0 disables io_uring
+    explicit IoUringEnginePool(unsigned queue_depth);
+
+    std::unique_ptr<IoUringEngine> Acquire();
+    void Release(std::unique_ptr<IoUringEngine> engine);
+
+   private:
+    const unsigned queue_depth_;
+    std::atomic<bool> unavailable_{false};
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<IoUringEngine>> idle_;
+};
+
+}  // namespace mooncake
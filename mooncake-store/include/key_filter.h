@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace mooncake {
+
+/**
+ * @brief Bloom filter of object keys, published by the master so that
+ * clients can answer existence probes of absent keys without an RPC
+ *
+ * MayContain never misses an added key, and finds a key that was not added
+ * with a probability set by bits_per_key (about 1% for 10). Keys cannot be
+ * removed; the master rebuilds the filter instead. The hash does not depend
+ * on the process or the build, as clients test the bits built by the
+ * master. Not thread-safe.
+ */
+class KeyFilter {
+   public:
+    static constexpr uint32_t kDefaultBitsPerKey = 10;
+
+    // A filter sized for expected_keys keys
+    KeyFilter(size_t expected_keys, uint32_t bits_per_key);
+
+    // The filter of words and num_hashes as published by the master
+    KeyFilter(std::vector<uint64_t> words, uint32_t num_hashes);
+
+    void Add(std::string_view key);
+
+    bool MayContain(std::string_view key) const;
+
+    const std::vector<uint64_t>& words() const { return words_; }
+    uint32_t num_hashes() const { return num_hashes_; }
+
+   private:
+    std::vector<uint64_t> words_;
+    uint32_t num_hashes_;
+};
+
+}  // namespace mooncake
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace mooncake {
+
+/**
+ * @brief 64-bit hash of an object key, wyhash (final 4) with its default
+ * secret.
+ *
+ * It mixes 16 bytes per multiplication, about twice as fast as the
+ * std::hash of libstdc++ on keys of a few dozen bytes, which matters as
+ * every key operation of the master hashes its key to pick a shard and
+ * again to probe the shard's table. It also does not depend on the
+ * standard library, so masters and followers built apart agree on it.
+ */
+inline uint64_t KeyHash(std::string_view key) {
+    constexpr uint64_t kSecret[4] = {0x2d358dccaa6c78a5ull,
+                                     0x8bb84b93962eacc9ull,
+                                     0x4b33a62ed433d4a3ull,
+                                     0x4d5a2da51de1aa47ull};
+    auto mum = [](uint64_t& a, uint64_t& b) {
+        const __uint128_t r = static_cast<__uint128_t>(a) * b;
+        a = static_cast<uint64_t>(r);
+        b = static_cast<uint64_t>(r >> 64);
+    };
+    auto mix = [&mum](uint64_t a, uint64_t b) {
+        mum(a, b);
+        return a ^ b;
+    };
+    auto read8 = [](const uint8_t* p) {
+        uint64_t v;
+        std::memcpy(&v, p, 8);
+        return v;
+    };
+    auto read4 = [](const uint8_t* p) {
+        uint32_t v;
+        std::memcpy(&v, p, 4);
+        return static_cast<uint64_t>(v);
+    };
+
+    const auto* p = reinterpret_cast<const uint8_t*>(key.data());
+    const size_t len = key.size();
+    uint64_t seed = mix(kSecret[0], kSecret[1]);
+    uint64_t a;
+    uint64_t b;
+    if (len <= 16) {
+        if (len >= 4) {
+            const size_t shift = (len >> 3) << 2;
+            a = (read4(p) << 32) | read4(p + shift);
+            b = (read4(p + len - 4) << 32) | read4(p + len - 4 - shift);
+        } else if (len > 0) {
+            a = (static_cast<uint64_t>(p[0]) << 16) |
+                (static_cast<uint64_t>(p[len >> 1]) << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed;
+            uint64_t see2 = seed;
+            do {
+                seed = mix(read8(p) ^ kSecret[1], read8(p + 8) ^ seed);
+                see1 = mix(read8(p + 16) ^ kSecret[2], read8(p + 24) ^ see1);
+                see2 = mix(read8(p + 32) ^ kSecret[3], read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = mix(read8(p) ^ kSecret[1], read8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = read8(p + i - 16);
+        b = read8(p + i - 8);
+    }
+    a ^= kSecret[1];
+    b ^= seed;
+    mum(a, b);
+    return mix(a ^ kSecret[0] ^ len, b ^ kSecret[1]);
+}
+
+// Hasher of the containers keyed by object key. Left without noexcept on
+// purpose: libstdc++ then stores the hash in each node of unordered
+// containers, so probing and rehashing compare stored hashes rather than
+// hash the keys again. Transparent, so that maps declared with
+// std::equal_to<> can be searched by string_view without a copy.
+struct KeyHasher {
+    using is_transparent = void;
+    size_t operator()(std::string_view key) const { return KeyHash(key); }
+};
+
+}  // namespace mooncake
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <sys/uio.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "io_uring_engine.h"
+#include "types.h"
+
+namespace mooncake {
+
+/**
+ * @brief Append-only disk store keeping objects in a few large segment files
+ *
+ * Objects are appended to the active segment, a preallocated data file of
+ * segment_size bytes, at kAlignment-aligned offsets so the data files can be
+ * used with O_DIRECT. Next to every data file an index file records the key,
+ * offset and length of each object once its data is written; removing an
+ * object sets a flag in its index record. Opening a store replays the index
+ * files, so recovery only reads a few small files instead of listing a
+ * directory per object.
+ *
+ * A background thread compacts sealed segments in which the removed objects
+ * take at least compaction_ratio of the written bytes: live objects are
+ * copied to the active segment and the old files are deleted.
+ *
+ * Keys are write-once like the file-per-object layout: storing a key that
+ * already exists fails until it is removed. All methods are thread-safe.
+ */
+class LogStructuredStore {
+   public:
+    static constexpr uint64_t kDefaultSegmentSize = 1ULL << 30;
+    static constexpr double kDefaultCompactionRatio = 0.5;
+
+    // Where an object lives, for disk replica descriptors
+    struct Location {
+        std::string path;
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    /**
+     * @brief Open the store in dir, creating dir if needed, and rebuild the
+     * index from the segment files found there
+     * @return nullptr if dir or a segment cannot be opened
+     */
+    static std::unique_ptr<LogStructuredStore> Open(
+        const std::string& dir, std::shared_ptr<IoUringEnginePool> uring_pool,
+        uint64_t segment_size = kDefaultSegmentSize,
+        double compaction_ratio = kDefaultCompactionRatio);
+
+    ~LogStructuredStore();
+
+    LogStructuredStore(const LogStructuredStore&) = delete;
+    LogStructuredStore& operator=(const LogStructuredStore&) = delete;
+
+    /**
+     * @return ErrorCode::FILE_OPEN_FAIL if the key exists or no segment can
+     * be created, ErrorCode::FILE_WRITE_FAIL if writing fails
+     */
+    ErrorCode Put(const ObjectKey& key, const std::vector<iovec>& iovs);
+
+    /**
+     * @brief Store several objects, writing those that land next to each
+     * other in a segment with a single write
+     * @return One error code per key, as for Put
+     */
+    std::vector<ErrorCode> BatchPut(
+        const std::vector<ObjectKey>& keys,
+        const std::vector<std::vector<iovec>>& values);
+
+    /**
+     * @brief Read the first bytes of an object into slices
+     * @return ErrorCode::FILE_NOT_FOUND if the key does not exist,
+     * ErrorCode::FILE_READ_FAIL if the object is shorter than the slices or
+     * reading fails
+     */
+    ErrorCode Get(const ObjectKey& key, std::vector<Slice>& slices);
+
+    /**
+     * @brief Read a whole object
+     */
+    ErrorCode Get(const ObjectKey& key, std::string& str);
+
+    std::optional<Location> Query(const ObjectKey& key) const;
+
+    /**
+     * @brief Every object of the store with its location, e.g. those
+     * recovered from the index files on open
+     */
+    std::vector<std::pair<ObjectKey, Location>> List() const;
+
+    void Remove(const ObjectKey& key);
+
+    void RemoveAll();
+
+    /**
+     * @brief Compact the sealed segments over the compaction ratio now
+     * @return Number of segments deleted
+     */
+    size_t Compact();
+
+    size_t SegmentCount() const;
+
+   private:
+    struct Segment {
+        ~Segment();
+
+        uint64_t id = 0;
+        std::string data_path;
+        std::string index_path;
+        int data_fd = -1;
+        int index_fd = -1;
+        bool direct = false;      // data_fd was opened with O_DIRECT
+        uint64_t capacity = 0;    // Bytes preallocated for data
+        uint64_t write_offset = 0;
+        uint64_t index_size = 0;
+        uint64_t live_bytes = 0;  // Aligned bytes of indexed objects
+        uint64_t dead_bytes = 0;  // Aligned bytes removed or never indexed
+        uint32_t pending = 0;     // Reserved writes not committed yet
+        bool removed = false;
+    };
+
+    struct Item {
+        std::shared_ptr<Segment> segment;
+        uint64_t offset;
+        uint64_t length;
+        uint64_t index_pos;  // Position of the index record
+    };
+
+    LogStructuredStore(std::string dir,
+                       std::shared_ptr<IoUringEnginePool> uring_pool,
+                       uint64_t segment_size, double compaction_ratio);
+
+    bool Recover();
+    bool LoadSegment(uint64_t id);
+    std::shared_ptr<Segment> OpenSegment(uint64_t id, uint64_t capacity,
+                                         bool create);
+
+    // Reserve aligned space for length bytes, rolling to a new segment when
+    // the active one is full. Called with mutex_ held.
+    std::shared_ptr<Segment> Reserve(uint64_t length, uint64_t& offset);
+    // Record an object whose data is written. Called with mutex_ held.
+    bool Commit(const ObjectKey& key, const std::shared_ptr<Segment>& segment,
+                uint64_t offset, uint64_t length);
+    // Called with mutex_ held
+    void Release(const Item& item);
+    // Takes a copy, the caller's reference may be the one in segments_
+    void DropSegment(std::shared_ptr<Segment> segment);
+
+    ssize_t WriteData(const Segment& segment, const std::vector<iovec>& iovs,
+                      uint64_t offset);
+    ssize_t ReadData(const Segment& segment, const std::vector<iovec>& iovs,
+                     uint64_t offset);
+
+    bool CompactSegment(const std::shared_ptr<Segment>& segment);
+    void CompactionThread();
+
+    const std::string dir_;
+    const std::shared_ptr<IoUringEnginePool> uring_pool_;
+    const uint64_t segment_size_;
+    const double compaction_ratio_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Item> index_;
+    // Keys being written, to reject concurrent puts of the same key
+    std::unordered_set<std::string> writing_;
+    std::map<uint64_t, std::shared_ptr<Segment>> segments_;
+    std::shared_ptr<Segment> active_;
+    uint64_t next_segment_id_ = 0;
+
+    bool stop_ = false;
+    std::condition_variable compaction_cv_;
+    std::thread compaction_thread_;
+};
+
+}  // namespace mooncake
@@ -1,10 +1,18 @@
 #pragma once
 
+#include <async_simple/coro/Lazy.h>
+
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <shared_mutex>
 #include <string>
+#include <thread>
 #include <vector>
+#include <ylt/coro_io/coro_io.hpp>
 #include <ylt/coro_rpc/coro_rpc_client.hpp>
 
+#include "request_coalescer.h"
 #include "rpc_service.h"
 #include "types.h"
 
@@ -34,6 +42,52 @@ class MasterClient {
     [[nodiscard]] ErrorCode Connect(
         const std::string& master_addr = kDefaultMasterAddress);
 
+    /**
+     * @brief Merge concurrent ExistKey and GetReplicaList calls into
+     * BatchExistKey and BatchGetReplicaList calls of up to max_keys keys,
+     * gathered for at most window. Must be called before the client is
+     * used by other threads.
+     */
+    void EnableCoalescing(std::chrono::microseconds window, size_t max_keys);
+
+    /**
+     * @brief Send ExistKey, BatchExistKey, GetReplicaList and
+     * BatchGetReplicaList to the follower masters at follower_addrs in turn,
+     * and the keys a follower cannot answer to the master. Must be called
+     * before the client is used by other threads.
+     * @return The number of followers connected to
+     */
+    size_t EnableFollowers(const std::vector<std::string>& follower_addrs);
+
+    /**
+     * @brief Send the RPCs over RDMA instead of TCP, to masters started with
+     * --rpc_enable_rdma, from the next Connect on. Applies to the followers
+     * enabled later.
+     * @return false if built without USE_RPC_RDMA, the RPCs then stay on TCP
+     */
+    bool EnableRdma();
+
+    // How a request picks its connection among several, see SetConnections
+    enum class ConnectionSelection {
+        ROUND_ROBIN,
+        LEAST_OUTSTANDING,  // The one with the fewest requests in flight
+    };
+
+    /**
+     * @brief Spread the RPCs over connection_num connections to the master,
+     * from the next Connect on, so that callers do not queue behind each
+     * other on one connection. Each connection pipelines its requests and
+     * has an I/O thread of its own. One connection, the default, shares the
+     * I/O threads of coro_rpc. Applies to the followers enabled later. Must
+     * be called before the client is used by other threads.
+     */
+    void SetConnections(size_t connection_num, ConnectionSelection selection);
+
+    /**
+     * @brief Requests in flight on each connection, in order
+     */
+    std::vector<int64_t> GetInFlightRequests() const;
+
     /**
      * @brief Checks if an object exists
      * @param object_key Key to query
@@ -50,6 +104,45 @@ class MasterClient {
     [[nodiscard]] std::vector<tl::expected<bool, ErrorCode>> BatchExistKey(
         const std::vector<std::string>& object_keys);
 
+    /**
+     * @brief Extends the leases of objects without reading them, see
+     * MasterService::BatchTouch
+     * @param ttl_ms Lease length, 0 for the master's default
+     * @param next_use_ms Expected time until the next read, 0 for no hint
+     */
+    [[nodiscard]] std::vector<tl::expected<void, ErrorCode>> BatchTouch(
+        const std::vector<std::string>& object_keys, uint64_t ttl_ms,
+        uint64_t next_use_ms = 0);
+
+    /**
+     * @brief Counts the leading keys that exist and are complete
+     * @param object_keys Keys in prefix order, e.g. the blocks of a sequence
+     * @param with_replicas Also return the replica lists of the matched keys
+     * @return The number of matched keys and their replica lists
+     */
+    [[nodiscard]] tl::expected<PrefixMatchResult, ErrorCode>
+    LongestPrefixMatch(const std::vector<std::string>& object_keys,
+                       bool with_replicas);
+
+    /**
+     * @brief Tells which segments hold each key
+     * @param object_keys Keys to locate, in prefix order for prefix hits
+     * @param with_prefix_hits Also count the leading keys of each segment
+     * @return The segment dictionary and the segments of each key
+     */
+    [[nodiscard]] tl::expected<KeyLocationResult, ErrorCode>
+    BatchQueryLocation(const std::vector<std::string>& object_keys,
+                       bool with_prefix_hits);
+
+    /**
+     * @brief Fetches a page of the keys starting with prefix, see
+     * MasterService::ScanKeys
+     * @param cursor Empty for the first page, then the previous next_cursor
+     * @param limit Most keys to return
+     */
+    [[nodiscard]] tl::expected<KeyScanResult, ErrorCode> ScanKeys(
+        const std::string& prefix, const std::string& cursor, uint64_t limit);
+
     /**
      * @brief Gets object metadata without transferring data
      * @param object_key Key to query
@@ -59,6 +152,14 @@ class MasterClient {
     [[nodiscard]] tl::expected<std::vector<Replica::Descriptor>, ErrorCode>
     GetReplicaList(const std::string& object_key);
 
+    /**
+     * @brief Like GetReplicaList, but always answered by the master itself:
+     * neither coalesced nor sent to a follower, whose copy may name the
+     * buffers of a previous value
+     */
+    [[nodiscard]] tl::expected<std::vector<Replica::Descriptor>, ErrorCode>
+    GetLeaderReplicaList(const std::string& object_key);
+
     /**
      * @brief Gets object metadata without transferring data
      * @param object_keys Keys to query
@@ -119,6 +220,27 @@ class MasterClient {
     [[nodiscard]] tl::expected<void, ErrorCode> PutRevoke(
         const std::string& key);
 
+    /**
+     * @brief Coroutine versions of GetReplicaList, PutStart, PutEnd and
+     * PutRevoke, suspended until the master replies instead of blocking the
+     * thread. Replica lists are read from a follower if there is one, but
+     * are not coalesced.
+     */
+    [[nodiscard]] coro::Lazy<
+        tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+    CoGetReplicaList(std::string object_key);
+
+    [[nodiscard]] coro::Lazy<
+        tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+    CoPutStart(std::string key, std::vector<size_t> slice_lengths,
+               ReplicateConfig config);
+
+    [[nodiscard]] coro::Lazy<tl::expected<void, ErrorCode>> CoPutEnd(
+        std::string key);
+
+    [[nodiscard]] coro::Lazy<tl::expected<void, ErrorCode>> CoPutRevoke(
+        std::string key);
+
     /**
      * @brief Revokes a put operation for a batch of objects
      * @param keys Vector of object keys
@@ -127,6 +249,168 @@ class MasterClient {
     [[nodiscard]] std::vector<tl::expected<void, ErrorCode>> BatchPutRevoke(
         const std::vector<std::string>& keys);
 
+    /**
+     * @brief Puts a small object in one call, its value kept in the
+     * master's metadata
+     * @param key Object key
+     * @param value Object value
+     * @param config Replication configuration
+     * @return tl::expected<void, ErrorCode> indicating success/failure
+     */
+    [[nodiscard]] tl::expected<void, ErrorCode> PutInline(
+        const std::string& key, const std::string& value,
+        const ReplicateConfig& config);
+
+    /**
+     * @brief Reserves an extent for the single replica puts of this client
+     * @param client_id The uuid of the client
+     * @param size Size of the extent in bytes
+     * @return The credit granted, see MasterService::GrantAllocationCredit
+     */
+    [[nodiscard]] tl::expected<AllocationCredit, ErrorCode>
+    GrantAllocationCredit(const UUID& client_id, uint64_t size);
+
+    /**
+     * @brief Registers objects already written inside a credit's extent
+     * @param client_id The uuid of the client
+     * @param credit_id Id of the credit
+     * @param puts Placement of each object in the extent
+     * @return Result of each put, in order
+     */
+    [[nodiscard]] std::vector<tl::expected<void, ErrorCode>> CommitCreditPuts(
+        const UUID& client_id, uint64_t credit_id,
+        const std::vector<CreditPut>& puts);
+
+    /**
+     * @brief Ends a credit before its ttl passes
+     * @param client_id The uuid of the client
+     * @param credit_id Id of the credit
+     * @return tl::expected<void, ErrorCode> indicating success/failure
+     */
+    [[nodiscard]] tl::expected<void, ErrorCode> ReturnAllocationCredit(
+        const UUID& client_id, uint64_t credit_id);
+
+    /**
+     * @brief Registers the copy of an object in the local storage backend
+     * @param key Object key
+     * @param disk Location of the copy
+     * @return tl::expected<void, ErrorCode> indicating success/failure
+     */
+    [[nodiscard]] tl::expected<void, ErrorCode> PutDiskReplica(
+        const std::string& key, const DiskDescriptor& disk);
+
+    /**
+     * @brief Registers the objects found in the local storage backend on
+     * startup, creating those the master does not know
+     * @param keys Object keys
+     * @param disks Location of the copy of each key
+     * @return One result per key
+     */
+    [[nodiscard]] std::vector<tl::expected<void, ErrorCode>>
+    BatchPutDiskReplica(const std::vector<std::string>& keys,
+                        const std::vector<DiskDescriptor>& disks);
+
+    /**
+     * @brief Starts copying an object that only has a disk replica back into
+     * memory, finished with PutEnd or PutRevoke
+     * @param key Object key
+     * @param slice_lengths Vector of slice lengths
+     * @param config Replication configuration
+     * @return tl::expected<std::vector<Replica::Descriptor>, ErrorCode>
+     * indicating success/failure
+     */
+    [[nodiscard]] tl::expected<std::vector<Replica::Descriptor>, ErrorCode>
+    PromoteStart(const std::string& key,
+                 const std::vector<size_t>& slice_lengths,
+                 const ReplicateConfig& config);
+
+    /**
+     * @brief Asks for a replica to copy or to move out of a fragmented
+     * segment
+     * @param segment_name Name of the segments this client mounted, whose
+     * copies it gets first
+     * @return tl::expected<CompactionTask, ErrorCode> the relocation, or
+     * OBJECT_NOT_FOUND if there is nothing to relocate
+     */
+    [[nodiscard]] tl::expected<CompactionTask, ErrorCode> CompactionStart(
+        const std::string& segment_name);
+
+    /**
+     * @brief Finishes a relocation once the target has been written
+     * @param key Object key
+     * @param target Address of the first buffer of the target, telling
+     * apart the copies of a broadcast
+     * @return tl::expected<void, ErrorCode> indicating success/failure
+     */
+    [[nodiscard]] tl::expected<void, ErrorCode> CompactionEnd(
+        const std::string& key, uint64_t target);
+
+    /**
+     * @brief Undoes a relocation whose copy failed
+     * @param key Object key
+     * @param target As for CompactionEnd
+     * @return tl::expected<void, ErrorCode> indicating success/failure
+     */
+    [[nodiscard]] tl::expected<void, ErrorCode> CompactionRevoke(
+        const std::string& key, uint64_t target);
+
+    /**
+     * @brief Has the master add a memory replica of an object on a segment,
+     * copied by the client of one of its replicas
+     * @param key Object key
+     * @param target_segment Segment of the new replica, empty for any
+     * segment without one
+     * @return tl::expected<void, ErrorCode> indicating whether the copy is
+     * queued
+     */
+    [[nodiscard]] tl::expected<void, ErrorCode> CopyReplica(
+        const std::string& key, const std::string& target_segment);
+
+    /**
+     * @brief Has the master move the memory replica of an object on one
+     * segment to another, copied by the client of the source segment
+     * @param key Object key
+     * @param source_segment Segment of the replica to move
+     * @param target_segment Segment of the new replica, empty for any
+     * segment without one
+     * @return tl::expected<void, ErrorCode> indicating whether the move is
+     * queued
+     */
+    [[nodiscard]] tl::expected<void, ErrorCode> MigrateReplica(
+        const std::string& key, const std::string& source_segment,
+        const std::string& target_segment);
+
+    /**
+     * @brief Has the master add a memory replica of an object on each of
+     * the target segments, copied along a binomial tree by the clients
+     * holding its replicas
+     * @param key Object key
+     * @param target_segments Segments of the new replicas, empty for every
+     * segment without one
+     * @return tl::expected<uint64_t, ErrorCode> the number of segments to
+     * get a replica
+     */
+    [[nodiscard]] tl::expected<uint64_t, ErrorCode> Broadcast(
+        const std::string& key,
+        const std::vector<std::string>& target_segments);
+
+    /**
+     * @brief Has the master copy objects to target_segment in the
+     * background, see MasterService::Prefetch
+     * @return For each key, whether its copy is queued or not needed
+     */
+    [[nodiscard]] std::vector<tl::expected<void, ErrorCode>> Prefetch(
+        const std::vector<std::string>& keys,
+        const std::string& target_segment);
+
+    /**
+     * @brief Drops the prefetches of keys not started yet
+     * @return For each key, whether a prefetch was dropped
+     */
+    [[nodiscard]] std::vector<tl::expected<bool, ErrorCode>> CancelPrefetch(
+        const std::vector<std::string>& keys,
+        const std::string& target_segment);
+
     /**
      * @brief Removes an object and all its replicas
      * @param key Key to remove
@@ -140,6 +424,24 @@ class MasterClient {
      */
     [[nodiscard]] tl::expected<long, ErrorCode> RemoveAll();
 
+    /**
+     * @brief Removes the objects put with the given ReplicateConfig::tag, in
+     * the background on the master
+     * @return tl::expected<long, ErrorCode> number of objects queued for
+     * removal or error
+     */
+    [[nodiscard]] tl::expected<long, ErrorCode> RemoveByTag(
+        const std::string& tag);
+
+    /**
+     * @brief Removes the objects whose key starts with prefix, skipping the
+     * leased ones
+     * @return tl::expected<long, ErrorCode> number of removed objects or
+     * error
+     */
+    [[nodiscard]] tl::expected<long, ErrorCode> RemoveByPrefix(
+        const std::string& prefix);
+
     /**
      * @brief Registers a segment to master for allocation
      * @param segment Segment to register
@@ -170,6 +472,44 @@ class MasterClient {
     [[nodiscard]] tl::expected<void, ErrorCode> UnmountSegment(
         const UUID& segment_id, const UUID& client_id);
 
+    /**
+     * @brief Stops allocations on a mounted segment and has the master move
+     * its replicas to other segments, ahead of an unmount
+     * @param segment_id ID of the segment to drain
+     * @return tl::expected<void, ErrorCode> indicating whether the drain
+     * started, or was running already
+     */
+    [[nodiscard]] tl::expected<void, ErrorCode> DrainSegment(
+        const UUID& segment_id);
+
+    /**
+     * @brief Bytes still allocated on a draining segment
+     * @param segment_id ID of the draining segment
+     * @return tl::expected<uint64_t, ErrorCode> 0 once it can be unmounted
+     * without losing data, SEGMENT_NOT_FOUND if it is not draining
+     */
+    [[nodiscard]] tl::expected<uint64_t, ErrorCode> QueryDrain(
+        const UUID& segment_id);
+
+    /**
+     * @brief Attaches a client to the segment mounted on shared memory
+     * @param memory_id ID of the shared memory, e.g. a CXL memory pool
+     * @param client_id ID of the attaching client
+     * @return tl::expected<Segment, ErrorCode> The segment mounted on the
+     * memory, SEGMENT_NOT_FOUND if there is none
+     */
+    [[nodiscard]] tl::expected<Segment, ErrorCode> AttachSegment(
+        const UUID& memory_id, const UUID& client_id);
+
+    /**
+     * @brief Detaches a client from the segment mounted on shared memory
+     * @param memory_id ID of the shared memory
+     * @param client_id ID of the detaching client
+     * @return tl::expected<void, ErrorCode> indicating success/failure
+     */
+    [[nodiscard]] tl::expected<void, ErrorCode> DetachSegment(
+        const UUID& memory_id, const UUID& client_id);
+
     /**
      * @brief Gets the cluster ID for the current client to use as subdirectory
      * name
@@ -177,6 +517,13 @@ class MasterClient {
      */
     [[nodiscard]] tl::expected<std::string, ErrorCode> GetFsdir();
 
+    /**
+     * @brief Gets the lease granted by GetReplicaList and the master's
+     * replica version, for caching replica lists
+     */
+    [[nodiscard]] tl::expected<ReplicaCacheInfo, ErrorCode>
+    GetReplicaCacheInfo();
+
     /**
      * @brief Pings master to check its availability
      * @param client_id The uuid of the client
@@ -187,30 +534,153 @@ class MasterClient {
                                ErrorCode>
     Ping(const UUID& client_id);
 
+    /**
+     * @brief Gets the keys changed on the master since seq, see
+     * MasterService::GetMetadataChanges
+     */
+    [[nodiscard]] tl::expected<MetadataChanges, ErrorCode> GetMetadataChanges(
+        uint64_t seq, uint64_t max_keys);
+
+    /**
+     * @brief Gets the objects of one part of the master's metadata, see
+     * MasterService::GetMetadataSnapshot
+     */
+    [[nodiscard]] tl::expected<MetadataSnapshot, ErrorCode>
+    GetMetadataSnapshot(uint64_t shard);
+
+    /**
+     * @brief Gets the changes of the master's key filter since seq, see
+     * MasterService::GetKeyFilter
+     */
+    [[nodiscard]] tl::expected<KeyFilterUpdate, ErrorCode> GetKeyFilter(
+        uint64_t seq);
+
    private:
+    // The reads below skip the followers
+    tl::expected<bool, ErrorCode> ExistKeyOnMaster(
+        const std::string& object_key);
+    std::vector<tl::expected<bool, ErrorCode>> BatchExistKeyOnMaster(
+        const std::vector<std::string>& object_keys);
+    tl::expected<std::vector<Replica::Descriptor>, ErrorCode>
+    GetReplicaListOnMaster(const std::string& object_key);
+    coro::Lazy<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+    CoGetReplicaListOnMaster(std::string object_key);
+    std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+    BatchGetReplicaListOnMaster(const std::vector<std::string>& object_keys);
+
+    // Sends read to a follower, then the keys it failed with RPC_FAIL to the
+    // master
+    template <typename T>
+    std::vector<T> BatchReadWithFollowers(
+        const std::vector<std::string>& keys,
+        std::vector<T> (MasterClient::*read)(const std::vector<std::string>&));
+
+    // The follower to send the next read to, null without followers
+    MasterClient* NextFollower() {
+        if (followers_.empty()) return nullptr;
+        return followers_[next_follower_.fetch_add(
+                              1, std::memory_order_relaxed) %
+                          followers_.size()]
+            .get();
+    }
+
+    // A connection to the master, with the thread running its I/O if it
+    // does not share the I/O threads of coro_rpc
+    struct Connection {
+        explicit Connection(bool own_io_thread);
+        ~Connection();
+
+        std::unique_ptr<asio::io_context> io_context;
+        std::unique_ptr<
+            asio::executor_work_guard<asio::io_context::executor_type>>
+            work_guard;
+        std::thread io_thread;
+        std::shared_ptr<coro_rpc_client> client;
+        std::atomic<int64_t> in_flight{0};
+    };
+
     /**
-     * @brief Accessor for the coro_rpc_client. Since coro_rpc_client cannot
-     * reconnect to a different address, a new coro_rpc_client is created if
+     * @brief Accessor for the connections. Since coro_rpc_client cannot
+     * reconnect to a different address, new connections are created if
      * the address is different from the current one.
      */
     class RpcClientAccessor {
        public:
-        void SetClient(std::shared_ptr<coro_rpc_client> client) {
+        // A connection lent to one request, which counts as in flight on it
+        // until the lease is dropped
+        class Lease {
+           public:
+            Lease() = default;
+            explicit Lease(std::shared_ptr<Connection> connection)
+                : connection_(std::move(connection)) {
+                connection_->in_flight.fetch_add(1,
+                                                 std::memory_order_relaxed);
+            }
+            ~Lease() {
+                if (connection_) {
+                    connection_->in_flight.fetch_sub(
+                        1, std::memory_order_relaxed);
+                }
+            }
+            Lease(Lease&& other) = default;
+            Lease(const Lease&) = delete;
+            Lease& operator=(const Lease&) = delete;
+
+            explicit operator bool() const {
+                return connection_ && connection_->client;
+            }
+            coro_rpc_client* operator->() const {
+                return connection_->client.get();
+            }
+
+           private:
+            std::shared_ptr<Connection> connection_;
+        };
+
+        void SetConnections(
+            std::vector<std::shared_ptr<Connection>> connections) {
             std::lock_guard<std::shared_mutex> lock(client_mutex_);
-            client_ = client;
+            connections_ = std::move(connections);
         }
 
-        std::shared_ptr<coro_rpc_client> GetClient() {
+        std::vector<std::shared_ptr<Connection>> GetConnections() const {
             std::shared_lock<std::shared_mutex> lock(client_mutex_);
-            return client_;
+            return connections_;
         }
 
+        void SetSelection(ConnectionSelection selection) {
+            selection_ = selection;
+        }
+
+        Lease GetClient();
+
        private:
         mutable std::shared_mutex client_mutex_;
-        std::shared_ptr<coro_rpc_client> client_;
+        std::vector<std::shared_ptr<Connection>> connections_;
+        ConnectionSelection selection_ = ConnectionSelection::ROUND_ROBIN;
+        std::atomic<size_t> next_connection_{0};
     };
     RpcClientAccessor client_accessor_;
 
+    // Set by EnableCoalescing
+    std::unique_ptr<RequestCoalescer<tl::expected<bool, ErrorCode>>>
+        exist_coalescer_;
+    std::unique_ptr<RequestCoalescer<
+        tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>>
+        replica_list_coalescer_;
+
+    // Set by EnableFollowers
+    std::vector<std::unique_ptr<MasterClient>> followers_;
+    std::atomic<size_t> next_follower_{0};
+
+    // Set by EnableRdma
+    bool use_rdma_ = false;
+
+    // Set by SetConnections
+    size_t connection_num_ = 1;
+    ConnectionSelection connection_selection_ =
+        ConnectionSelection::ROUND_ROBIN;
+
     // Mutex to insure the Connect function is atomic.
     mutable Mutex connect_mutex_;
     // The address which is passed to the coro_rpc_client
@@ -1,8 +1,17 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
+#include "sharded_metric.h"
+#include "tracepoint.h"
 #include "ylt/metric/counter.hpp"
 #include "ylt/metric/gauge.hpp"
 #include "ylt/metric/histogram.hpp"
@@ -71,6 +80,8 @@ class MasterMetricManager {
     void inc_batch_exist_key_failures(int64_t val = 1);
     void inc_batch_get_replica_list_requests(int64_t val = 1);
     void inc_batch_get_replica_list_failures(int64_t val = 1);
+    void inc_longest_prefix_match_requests(int64_t val = 1);
+    void inc_longest_prefix_match_failures(int64_t val = 1);
     void inc_batch_put_start_requests(int64_t val = 1);
     void inc_batch_put_start_failures(int64_t val = 1);
     void inc_batch_put_end_requests(int64_t val = 1);
@@ -108,6 +119,8 @@ class MasterMetricManager {
     int64_t get_batch_exist_key_failures();
     int64_t get_batch_get_replica_list_requests();
     int64_t get_batch_get_replica_list_failures();
+    int64_t get_longest_prefix_match_requests();
+    int64_t get_longest_prefix_match_failures();
     int64_t get_batch_put_start_requests();
     int64_t get_batch_put_start_failures();
     int64_t get_batch_put_end_requests();
@@ -115,6 +128,39 @@ class MasterMetricManager {
     int64_t get_batch_put_revoke_requests();
     int64_t get_batch_put_revoke_failures();
 
+    // Metadata Shard Lock Metrics
+    void inc_shard_read_contentions(int64_t val = 1);
+    void inc_shard_write_contentions(int64_t val = 1);
+    int64_t get_shard_read_contentions();
+    int64_t get_shard_write_contentions();
+    // Time a contended acquisition waited for the shard mutex
+    void observe_shard_lock_wait(int64_t wait_us);
+    // Time the mutex was held, for a sample of the acquisitions
+    void observe_shard_lock_hold(int64_t hold_us);
+
+    // Content Deduplication Metrics
+    void inc_dedup_hits(int64_t saved_bytes);
+    int64_t get_dedup_hits();
+    int64_t get_dedup_saved_bytes();
+
+    // Upsert Metrics
+    void inc_upserts();
+    void inc_upserts_in_place();
+    int64_t get_upserts();
+    int64_t get_upserts_in_place();
+
+    // Hot Replica Metrics
+    void inc_hot_replicas_created();
+    void inc_hot_replicas_retired();
+    int64_t get_hot_replicas_created();
+    int64_t get_hot_replicas_retired();
+
+    // Segment Drain Metrics
+    void set_draining_segments(int64_t count);
+    void set_drain_remaining_bytes(int64_t bytes);
+    void inc_drain_moved_bytes(int64_t bytes);
+    int64_t get_drain_moved_bytes();
+
     // Eviction Metrics
     void inc_eviction_success(int64_t key_count, int64_t size);
     void inc_eviction_fail(); // not a single object is evicted
@@ -125,6 +171,40 @@ class MasterMetricManager {
     int64_t get_evicted_key_count();
     int64_t get_evicted_size();
 
+    // Proactive Eviction Metrics
+    void set_allocation_rate(int64_t bytes_per_sec);
+    void set_eviction_headroom_target(int64_t bytes);
+    void inc_proactive_evictions();
+    int64_t get_proactive_evictions();
+
+    // Compaction Metrics
+    void inc_compaction_success(int64_t size);
+    void inc_compaction_fail();  // a relocation was revoked
+
+    // GC Metrics
+    void inc_gc_pending_tasks(int64_t val = 1);
+    void dec_gc_pending_tasks(int64_t val = 1);
+    // Time from the deletion time of a GC task to its processing
+    void observe_gc_lag(int64_t lag_ms);
+    int64_t get_gc_pending_tasks();
+    // Duration of a round of GC tasks and of an eviction pass
+    void observe_gc_duration(int64_t duration_us);
+    void observe_eviction_duration(int64_t duration_us);
+
+    // RPC Latency Metrics
+    // Histogram of an RPC of WrappedMasterService, nullptr if the RPC is not
+    // one of them
+    ShardedHistogram* rpc_latency_histogram(std::string_view rpc_name);
+
+    // Metrics of each namespace, labeled with its name and indexed as in
+    // the NamespaceTable. The namespaces come from the master flags, the
+    // first call registers them and later ones are ignored.
+    void set_namespaces(const std::vector<std::string>& names);
+    void set_namespace_usage(size_t ns, int64_t used_bytes,
+                             int64_t share_bytes);
+    void inc_namespace_gets(size_t ns, bool hit);
+    void inc_namespace_rejected_puts(size_t ns);
+
     // --- Serialization ---
     /**
      * @brief Serializes all managed metrics into Prometheus text format.
@@ -153,48 +233,72 @@ class MasterMetricManager {
     ylt::metric::gauge_t total_capacity_;  // Use update for gauge
 
     // Key/Value Metrics
-    ylt::metric::gauge_t key_count_;
-    ylt::metric::gauge_t soft_pin_key_count_;
-    ylt::metric::histogram_t value_size_distribution_;
+    ShardedCounter key_count_;
+    ShardedCounter soft_pin_key_count_;
+    ShardedHistogram value_size_distribution_;
 
     // Cluster Metrics
     ylt::metric::gauge_t active_clients_;
 
-    // Operation Statistics
-    ylt::metric::counter_t put_start_requests_;
-    ylt::metric::counter_t put_start_failures_;
-    ylt::metric::counter_t put_end_requests_;
-    ylt::metric::counter_t put_end_failures_;
-    ylt::metric::counter_t put_revoke_requests_;
-    ylt::metric::counter_t put_revoke_failures_;
-    ylt::metric::counter_t get_replica_list_requests_;
-    ylt::metric::counter_t get_replica_list_failures_;
-    ylt::metric::counter_t exist_key_requests_;
-    ylt::metric::counter_t exist_key_failures_;
-    ylt::metric::counter_t remove_requests_;
-    ylt::metric::counter_t remove_failures_;
-    ylt::metric::counter_t remove_all_requests_;
-    ylt::metric::counter_t remove_all_failures_;
-    ylt::metric::counter_t mount_segment_requests_;
-    ylt::metric::counter_t mount_segment_failures_;
-    ylt::metric::counter_t unmount_segment_requests_;
-    ylt::metric::counter_t unmount_segment_failures_;
-    ylt::metric::counter_t remount_segment_requests_;
-    ylt::metric::counter_t remount_segment_failures_;
-    ylt::metric::counter_t ping_requests_;
-    ylt::metric::counter_t ping_failures_;
+    // Operation Statistics, updated by every request and therefore sharded,
+    // see sharded_metric.h
+    ShardedCounter put_start_requests_;
+    ShardedCounter put_start_failures_;
+    ShardedCounter put_end_requests_;
+    ShardedCounter put_end_failures_;
+    ShardedCounter put_revoke_requests_;
+    ShardedCounter put_revoke_failures_;
+    ShardedCounter get_replica_list_requests_;
+    ShardedCounter get_replica_list_failures_;
+    ShardedCounter exist_key_requests_;
+    ShardedCounter exist_key_failures_;
+    ShardedCounter remove_requests_;
+    ShardedCounter remove_failures_;
+    ShardedCounter remove_all_requests_;
+    ShardedCounter remove_all_failures_;
+    ShardedCounter mount_segment_requests_;
+    ShardedCounter mount_segment_failures_;
+    ShardedCounter unmount_segment_requests_;
+    ShardedCounter unmount_segment_failures_;
+    ShardedCounter remount_segment_requests_;
+    ShardedCounter remount_segment_failures_;
+    ShardedCounter ping_requests_;
+    ShardedCounter ping_failures_;
 
     // Batch Operation Statistics
-    ylt::metric::counter_t batch_exist_key_requests_;
-    ylt::metric::counter_t batch_exist_key_failures_;
-    ylt::metric::counter_t batch_get_replica_list_requests_;
-    ylt::metric::counter_t batch_get_replica_list_failures_;
-    ylt::metric::counter_t batch_put_start_requests_;
-    ylt::metric::counter_t batch_put_start_failures_;
-    ylt::metric::counter_t batch_put_end_requests_;
-    ylt::metric::counter_t batch_put_end_failures_;
-    ylt::metric::counter_t batch_put_revoke_requests_;
-    ylt::metric::counter_t batch_put_revoke_failures_;
+    ShardedCounter batch_exist_key_requests_;
+    ShardedCounter batch_exist_key_failures_;
+    ShardedCounter batch_get_replica_list_requests_;
+    ShardedCounter batch_get_replica_list_failures_;
+    ShardedCounter longest_prefix_match_requests_;
+    ShardedCounter longest_prefix_match_failures_;
+    ShardedCounter batch_put_start_requests_;
+    ShardedCounter batch_put_start_failures_;
+    ShardedCounter batch_put_end_requests_;
+    ShardedCounter batch_put_end_failures_;
+    ShardedCounter batch_put_revoke_requests_;
+    ShardedCounter batch_put_revoke_failures_;
+
+    // Metadata Shard Lock Metrics
+    ylt::metric::counter_t shard_read_contentions_;
+    ylt::metric::counter_t shard_write_contentions_;
+
+    // Content Deduplication Metrics
+    ylt::metric::counter_t dedup_hits_;
+    ylt::metric::counter_t dedup_saved_bytes_;
+
+    // Upsert Metrics
+    ylt::metric::counter_t upserts_;
+    ylt::metric::counter_t upserts_in_place_;
+
+    // Hot Replica Metrics
+    ylt::metric::counter_t hot_replicas_created_;
+    ylt::metric::counter_t hot_replicas_retired_;
+
+    // Segment Drain Metrics
+    ylt::metric::gauge_t draining_segments_;
+    ylt::metric::gauge_t drain_remaining_bytes_;
+    ylt::metric::counter_t drain_moved_bytes_;
 
     // Eviction Metrics
     ylt::metric::counter_t eviction_success_;
@@ -202,9 +306,81 @@ class MasterMetricManager {
     ylt::metric::counter_t evicted_key_count_;
     ylt::metric::counter_t evicted_size_;
 
+    // Proactive Eviction Metrics
+    ylt::metric::gauge_t allocation_rate_;
+    ylt::metric::gauge_t eviction_headroom_target_;
+    ylt::metric::counter_t proactive_evictions_;
+
+    // Compaction Metrics
+    ylt::metric::counter_t compaction_relocations_;
+    ylt::metric::counter_t compaction_relocated_size_;
+    ylt::metric::counter_t compaction_failures_;
+
+    // GC Metrics
+    ylt::metric::gauge_t gc_pending_tasks_;
+    ylt::metric::histogram_t gc_lag_distribution_;
+    ylt::metric::histogram_t gc_duration_distribution_;
+    ylt::metric::histogram_t eviction_duration_distribution_;
+
+    // Shard Lock Timing Metrics
+    ylt::metric::histogram_t shard_lock_wait_distribution_;
+    ylt::metric::histogram_t shard_lock_hold_distribution_;
+
+    // RPC Latency Metrics, in the order of serialization. The map only
+    // points into them and is not modified after construction.
+    struct NamespaceMetrics {
+        std::string name;
+        ylt::metric::gauge_t used_bytes;
+        ylt::metric::gauge_t share_bytes;
+        ylt::metric::counter_t gets;
+        ylt::metric::counter_t hits;
+        ylt::metric::counter_t rejected_puts;
+    };
+    std::mutex namespace_mutex_;
+    std::vector<std::unique_ptr<NamespaceMetrics>> namespace_metrics_;
+    // Set once namespace_metrics_ is complete, it never changes afterwards
+    std::atomic<size_t> namespace_count_{0};
+
+    std::vector<std::unique_ptr<ShardedHistogram>> rpc_latencies_;
+    std::unordered_map<std::string_view, ShardedHistogram*>
+        rpc_latency_by_name_;
+
     // Some metrics are used only in HA mode. Use a flag to control the output
     // content.
     bool enable_ha_{false};
 };
 
+/**
+ * @brief Observes the latency of an RPC of WrappedMasterService in its
+ * histogram, and fires the master_rpc tracepoint, when it goes out of scope
+ */
+class ScopedRpcLatency {
+   public:
+    // rpc_name is a string literal, see kRpcNames
+    explicit ScopedRpcLatency(std::string_view rpc_name)
+        : rpc_name_(rpc_name.data()),
+          histogram_(
+              MasterMetricManager::instance().rpc_latency_histogram(rpc_name)),
+          start_(std::chrono::steady_clock::now()) {}
+
+    ~ScopedRpcLatency() {
+        const int64_t latency_us =
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start_)
+                .count();
+        MC_TRACE(master_rpc, rpc_name_, latency_us);
+        if (histogram_) {
+            histogram_->observe(latency_us);
+        }
+    }
+
+    ScopedRpcLatency(const ScopedRpcLatency&) = delete;
+    ScopedRpcLatency& operator=(const ScopedRpcLatency&) = delete;
+
+   private:
+    const char* rpc_name_;
+    ShardedHistogram* histogram_;
+    std::chrono::steady_clock::time_point start_;
+};
+
 }  // namespace mooncake
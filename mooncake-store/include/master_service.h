@@ -1,10 +1,14 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <boost/functional/hash.hpp>
 #include <boost/lockfree/queue.hpp>
 #include <chrono>
 #include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
 #include <memory>
 #include <optional>
 #include <shared_mutex>
@@ -17,9 +21,18 @@
 #include <ylt/util/tl/expected.hpp>
 
 #include "allocation_strategy.h"
+#include "art_metadata_map.h"
+#include "client_expiry_wheel.h"
+#include "eviction_strategy.h"
+#include "flat_metadata_map.h"
+#include "key_hash.h"
+#include "key_filter.h"
 #include "master_metric_manager.h"
+#include "metadata_change_log.h"
 #include "mutex.h"
+#include "namespace_table.h"
 #include "segment.h"
+#include "thread_pool.h"
 #include "types.h"
 
 namespace mooncake {
@@ -37,11 +50,67 @@ struct GCTask {
     GCTask(const std::string& k, std::chrono::milliseconds delay)
         : key(k), deletion_time(std::chrono::steady_clock::now() + delay) {}
 
-    bool is_ready() const {
-        return std::chrono::steady_clock::now() >= deletion_time;
+    bool is_ready(std::chrono::steady_clock::time_point now =
+                      std::chrono::steady_clock::now()) const {
+        return now >= deletion_time;
     }
 };
 
+// Lock statistics of a metadata shard since the master started. Holds and
+// acquisitions are sampled and scaled up, so they are estimates.
+struct ShardLockStats {
+    size_t shard = 0;
+    uint64_t acquisitions = 0;
+    uint64_t contentions = 0;
+    uint64_t wait_us = 0;
+    uint64_t hold_us = 0;
+};
+
+// Configuration of a MasterService. Built once from the flags of the master,
+// the fields left out keep their defaults.
+struct MasterServiceConfig {
+    bool enable_gc = true;
+    // Lease of objects after a read, in milliseconds
+    uint64_t default_kv_lease_ttl = DEFAULT_DEFAULT_KV_LEASE_TTL;
+    // Soft pin of objects put with it, in milliseconds
+    uint64_t default_kv_soft_pin_ttl = DEFAULT_KV_SOFT_PIN_TTL_MS;
+    bool allow_evict_soft_pinned_objects =
+        DEFAULT_ALLOW_EVICT_SOFT_PINNED_OBJECTS;
+    // Fraction of the objects evicted when the space is full
+    double eviction_ratio = DEFAULT_EVICTION_RATIO;
+    // Space usage above which eviction starts
+    double eviction_high_watermark_ratio =
+        DEFAULT_EVICTION_HIGH_WATERMARK_RATIO;
+    // Version of the master view this master was elected with, in HA mode
+    ViewVersionId view_version = 0;
+    // How long a client is alive after its last ping, in HA mode
+    int64_t client_live_ttl_sec = DEFAULT_CLIENT_LIVE_TTL_SEC;
+    bool enable_ha = false;
+    std::string cluster_id = DEFAULT_CLUSTER_ID;
+    EvictionEngine eviction_engine = DEFAULT_EVICTION_ENGINE;
+    AllocationStrategyType allocation_strategy = DEFAULT_ALLOCATION_STRATEGY;
+    // Demote evicted objects to their disk replica instead of dropping them
+    bool enable_disk_tier = false;
+    BufferAllocatorType buffer_allocator_type = DEFAULT_BUFFER_ALLOCATOR_TYPE;
+    // Free space fragmentation above which segments are compacted, 0 never
+    double compaction_fragmentation_ratio = 0.0;
+    // Delay the reuse of freed space while a restored copy may still use it
+    bool enable_failover_restore = false;
+    // Space usage eviction works down to ahead of the allocations, 0 off
+    double eviction_low_watermark_ratio = 0.0;
+    // Reads a second above which objects get an extra replica, 0 off
+    uint64_t hot_replica_read_rate = 0;
+    // Bytes a second each draining segment moves, 0 for no limit
+    uint64_t drain_rate_bytes = 0;
+    // Largest value PutInline keeps in the metadata, 0 off
+    uint64_t inline_object_max_size = 0;
+    NamespaceConfig namespace_config = {};
+    // Size from which the slices of an object go to distinct segments, 0 off
+    uint64_t stripe_min_size = 0;
+    // How long the replicas of an unmounted persistent segment are kept
+    uint64_t persistent_segment_ttl_sec = DEFAULT_PERSISTENT_SEGMENT_TTL_SEC;
+};
+
 /*
  * @brief MasterService is the main class for the master server.
  * Lock order: To avoid deadlocks, the following lock order should be followed:
@@ -53,26 +122,25 @@ class MasterService {
    private:
     // Comparator for GC tasks priority queue
     struct GCTaskComparator {
-        bool operator()(GCTask* a, GCTask* b) const {
-            return a->deletion_time > b->deletion_time;
+        bool operator()(const GCTask& a, const GCTask& b) const {
+            return a.deletion_time > b.deletion_time;
         }
     };
 
    public:
-    MasterService(bool enable_gc = true,
-                  uint64_t default_kv_lease_ttl = DEFAULT_DEFAULT_KV_LEASE_TTL,
-                  uint64_t default_kv_soft_pin_ttl = DEFAULT_KV_SOFT_PIN_TTL_MS,
-                  bool allow_evict_soft_pinned_objects =
-                      DEFAULT_ALLOW_EVICT_SOFT_PINNED_OBJECTS,
-                  double eviction_ratio = DEFAULT_EVICTION_RATIO,
-                  double eviction_high_watermark_ratio =
-                      DEFAULT_EVICTION_HIGH_WATERMARK_RATIO,
-                  ViewVersionId view_version = 0,
-                  int64_t client_live_ttl_sec = DEFAULT_CLIENT_LIVE_TTL_SEC,
-                  bool enable_ha = false,
-                  const std::string& cluster_id = DEFAULT_CLUSTER_ID);
+    explicit MasterService(const MasterServiceConfig& config = {});
     ~MasterService();
 
+    // Number of metadata shards
+    static constexpr size_t kNumMetadataShards = 1024;
+
+    /**
+     * @brief Metadata shard holding key, below kNumMetadataShards
+     */
+    static size_t ShardOf(std::string_view key) {
+        return KeyHash(key) % kNumMetadataShards;
+    }
+
     /**
      * @brief Mount a memory segment for buffer allocation. This function is
      * idempotent.
@@ -99,6 +167,56 @@ class MasterService {
     auto ReMountSegment(const std::vector<Segment>& segments,
                         const UUID& client_id) -> tl::expected<void, ErrorCode>;
 
+    /**
+     * @brief Stop allocating from a memory segment and move its replicas to
+     * other segments, at most drain_rate_bytes per second, so that the
+     * segment can be unmounted without losing them. The moves are queued for
+     * the client of the segment as MigrateReplica does, hot objects first.
+     * Replicas that find no room elsewhere are dropped if their object has
+     * another memory replica, and are left to the unmount otherwise. This
+     * function is idempotent.
+     * @return ErrorCode::OK on success,
+     *         ErrorCode::SEGMENT_NOT_FOUND if the segment is not mounted,
+     *         ErrorCode::UNAVAILABLE_IN_CURRENT_STATUS if the segment is
+     *         currently unmounting.
+     */
+    auto DrainSegment(const UUID& segment_id) -> tl::expected<void, ErrorCode>;
+
+    /**
+     * @brief Get the bytes still allocated in a draining segment, including
+     * moved replicas waiting for the leases on their objects
+     * @return The bytes on success,
+     *         ErrorCode::SEGMENT_NOT_FOUND if the segment is not draining.
+     */
+    auto QueryDrain(const UUID& segment_id)
+        -> tl::expected<uint64_t, ErrorCode>;
+
+    /**
+     * @brief Attach a client to the segment mounted on the shared memory
+     * memory_id, e.g. a CXL memory pool mapped by several hosts. The client
+     * reads and writes the segment with load/store through its own mapping
+     * of the memory. Attaching twice does nothing.
+     * @return The segment on success,
+     *         ErrorCode::INVALID_PARAMS if memory_id is {0, 0},
+     *         ErrorCode::SEGMENT_NOT_FOUND if no segment is mounted on it.
+     */
+    auto AttachSegment(const UUID& memory_id, const UUID& client_id)
+        -> tl::expected<Segment, ErrorCode>;
+
+    /**
+     * @brief Detach a client from the segment mounted on memory_id. This
+     * function is idempotent.
+     */
+    auto DetachSegment(const UUID& memory_id, const UUID& client_id)
+        -> tl::expected<void, ErrorCode>;
+
+    /**
+     * @brief Get the clients attached to a segment, besides its owner
+     * @return ErrorCode::SEGMENT_NOT_FOUND if the segment is not mounted
+     */
+    auto GetAttachedClients(const UUID& segment_id)
+        -> tl::expected<std::vector<UUID>, ErrorCode>;
+
     /**
      * @brief Unmount a memory segment. This function is idempotent.
      * @return ErrorCode::OK on success,
@@ -117,12 +235,70 @@ class MasterService {
     std::vector<tl::expected<bool, ErrorCode>> BatchExistKey(
         const std::vector<std::string>& keys);
 
+    /**
+     * @brief Extend the lease of objects, and their soft pin if they have
+     * one, as reading them would, but without building replica lists, so
+     * that a scheduler can keep the objects it will reuse from eviction
+     * @param ttl_ms Lease length, 0 for the default one, capped at
+     * kMaxTouchTtlMs
+     * @param next_use_ms When the objects are expected to be read again,
+     * 0 for no hint. The batch scan eviction approximates Belady's MIN with
+     * it: among expired objects, the one whose next use is farthest goes
+     * first. Objects without a hint, or whose hinted use has passed, are
+     * ranked by their lease timeout as before.
+     * @return For each key, ErrorCode::OBJECT_NOT_FOUND if it does not
+     * exist or ErrorCode::REPLICA_IS_NOT_READY if it is not complete yet
+     */
+    std::vector<tl::expected<void, ErrorCode>> BatchTouch(
+        const std::vector<std::string>& keys, uint64_t ttl_ms,
+        uint64_t next_use_ms = 0);
+
+    static constexpr uint64_t kMaxTouchTtlMs = 10 * 60 * 1000;
+
+    /**
+     * @brief Count the leading keys that exist and are complete, e.g. the
+     * blocks of a KV cache prefix, stopping at the first one that is not.
+     * The matched objects are leased as by ExistKey, or read as by
+     * GetReplicaList if with_replicas is set, in which case their replica
+     * lists are returned too.
+     */
+    auto LongestPrefixMatch(const std::vector<std::string>& keys,
+                            bool with_replicas)
+        -> tl::expected<PrefixMatchResult, ErrorCode>;
+
+    /**
+     * @brief Tell which segments hold each key, against a dictionary of the
+     * segments in the result, without leasing or reading the objects. A
+     * segment holds a key if a complete memory replica of it lies wholly
+     * on that segment. With with_prefix_hits, also count for each segment
+     * the leading keys it holds.
+     */
+    auto BatchQueryLocation(const std::vector<std::string>& keys,
+                            bool with_prefix_hits)
+        -> tl::expected<KeyLocationResult, ErrorCode>;
+
     /**
      * @brief Fetch all keys
      * @return ErrorCode::OK if exists
      */
     auto GetAllKeys() -> tl::expected<std::vector<std::string>, ErrorCode>;
 
+    /**
+     * @brief Fetch the keys starting with prefix, at most limit of them per
+     * call. The shards are scanned in order and the keys of a shard in
+     * lexicographic order; no lock is held between calls, so keys that
+     * exist during the whole scan are returned exactly once while keys put
+     * or removed meanwhile may be missed.
+     * @param cursor Empty for the first page, then the next_cursor of the
+     * previous one
+     * @param limit Most keys to return, capped at kMaxScanKeys
+     * @return ErrorCode::INVALID_PARAMS on a malformed cursor or a zero limit
+     */
+    auto ScanKeys(const std::string& prefix, const std::string& cursor,
+                  uint64_t limit) -> tl::expected<KeyScanResult, ErrorCode>;
+
+    static constexpr uint64_t kMaxScanKeys = 10000;
+
     /**
      * @brief Fetch all segments, each node has a unique real client with fixed
      * segment name : segment name, preferred format : {ip}:{port}, bad format :
@@ -167,16 +343,70 @@ class MasterService {
 
     /**
      * @brief Start a put operation for an object
+     *
+     * With config.content_hash set, key becomes an alias of the content
+     * object of that hash, which is shared by every key put with the same
+     * hash and slice lengths. The first put allocates it and proceeds as
+     * usual. Later ones only add the alias and fail with
+     * ErrorCode::OBJECT_ALREADY_EXISTS, so that the client skips the
+     * transfer. The content object is freed when its last alias is removed,
+     * or evicted for all of its aliases at once.
+     *
+     * With config.chain_replication set, only the first replica is
+     * allocated, and the object is readable from it once the put ends.
+     * Each of the other replica_num - 1 replicas is then queued as a copy
+     * of the last one finished, for CompactionStart to hand to the client
+     * holding it, so the data leaves the client of the put once.
+     *
+     * With config.upsert, a complete object under key gets the new value
+     * rather than failing with ErrorCode::OBJECT_ALREADY_EXISTS. If no
+     * reader holds a lease on it and each slice fits the buffer of its
+     * index in every memory replica, the replicas are handed out again to
+     * be written in place and the object reads as not ready until the put
+     * ends, as after a Remove and a put, but without allocating. Otherwise
+     * new replicas are allocated next to the old ones, which readers keep
+     * getting until PutEnd swaps them in; the old replicas are then freed
+     * once the leases granted on them expire. PutRevoke keeps the old value
+     * in that case and erases the object after an in-place write. Not used
+     * with content hashes, erasure coding or chain replication.
      * @param[out] replica_list Vector to store replica information for slices
      * @return ErrorCode::OK on success, ErrorCode::OBJECT_NOT_FOUND if exists,
      *         ErrorCode::NO_AVAILABLE_HANDLE if allocation fails,
-     *         ErrorCode::INVALID_PARAMS if slice size is invalid
+     *         ErrorCode::INVALID_PARAMS if slice size is invalid,
+     *         ErrorCode::REPLICA_IS_NOT_READY if an upserted object is
+     *         being written or relocated
      */
     auto PutStart(const std::string& key,
                   const std::vector<uint64_t>& slice_lengths,
                   const ReplicateConfig& config)
         -> tl::expected<std::vector<Replica::Descriptor>, ErrorCode>;
 
+    /**
+     * @brief Start put operations for a batch of objects. Keys are grouped by
+     * metadata shard so that each shard is locked once per phase, and the
+     * replicas of all keys are allocated within a single allocator access.
+     * With config.contiguous_batch, the keys are laid out one after another
+     * in groups of up to kMaxContiguousBatchExtent bytes, each group taking
+     * one extent per replica on a single segment, e.g. the writer's one if
+     * it is config.preferred_segment. The space of an extent is freed once
+     * all of its objects are gone. Groups that cannot get an extent are
+     * allocated key by key. Not used with erasure coding, chain
+     * replication or config.shard_segments.
+     * With config.skip_resident, the keys that exist are not allocated
+     * and succeed with no replicas, and with
+     * config.refresh_resident_lease they are touched as by BatchTouch.
+     * With config.upsert, the keys are put one by one as by PutStart.
+     * @return Per-key result with the same error codes as PutStart. All keys
+     *         fail with ErrorCode::INVALID_PARAMS if the sizes of keys and
+     *         slice_lengths differ.
+     */
+    std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+    BatchPutStart(const std::vector<std::string>& keys,
+                  const std::vector<std::vector<uint64_t>>& slice_lengths,
+                  const ReplicateConfig& config);
+
+    static constexpr uint64_t kMaxContiguousBatchExtent = 64 * 1024 * 1024;
+
     /**
      * @brief Complete a put operation
      * @return ErrorCode::OK on success, ErrorCode::OBJECT_NOT_FOUND if not
@@ -208,7 +438,234 @@ class MasterService {
         const std::vector<std::string>& keys);
 
     /**
-     * @brief Remove an object and its replicas
+     * @brief Put an object of at most inline_object_max_size bytes in one
+     * call. The value is kept in the metadata and returned by
+     * GetReplicaList, so that neither the put nor the readers allocate a
+     * buffer or transfer data. The object is complete on return and is
+     * evicted like any other.
+     * @return ErrorCode::OK on success, ErrorCode::OBJECT_ALREADY_EXISTS if
+     * exists, ErrorCode::INVALID_PARAMS if the value is empty or too large,
+     * ErrorCode::UNAVAILABLE_IN_CURRENT_MODE if inline objects are disabled
+     */
+    auto PutInline(const std::string& key, const std::string& value,
+                   const ReplicateConfig& config)
+        -> tl::expected<void, ErrorCode>;
+
+    /**
+     * @brief Reserve an extent of up to size bytes, at most
+     * kMaxAllocationCreditSize, for the single replica puts of a client
+     * until kAllocationCreditTtl passes. The client places objects in the
+     * extent itself and reports them with CommitCreditPuts. The extent is
+     * freed once the credit is over and all the objects placed in it are
+     * gone.
+     * @return ErrorCode::NO_AVAILABLE_HANDLE if no segment has room
+     */
+    auto GrantAllocationCredit(const UUID& client_id, uint64_t size)
+        -> tl::expected<AllocationCredit, ErrorCode>;
+
+    /**
+     * @brief Create the objects a client wrote into the extent of its
+     * credit, complete as after PutEnd
+     * @return One result per put: ErrorCode::OBJECT_ALREADY_EXISTS if the
+     * key exists, ErrorCode::INVALID_PARAMS if the put is out of the extent
+     * or the credit is unknown, expired or of another client
+     */
+    std::vector<tl::expected<void, ErrorCode>> CommitCreditPuts(
+        const UUID& client_id, uint64_t credit_id,
+        const std::vector<CreditPut>& puts);
+
+    /**
+     * @brief End a credit before it expires, e.g. when the client stops
+     */
+    auto ReturnAllocationCredit(const UUID& client_id, uint64_t credit_id)
+        -> tl::expected<void, ErrorCode>;
+
+    static constexpr uint64_t kMaxAllocationCreditSize = 64 * 1024 * 1024;
+    static constexpr std::chrono::seconds kAllocationCreditTtl{30};
+
+    /**
+     * @brief Record the copy of a complete object in a client's storage
+     * backend. With the disk tier enabled, evicting such an object only
+     * frees its memory replicas and leaves the disk replica for readers.
+     * @return ErrorCode::OK on success, ErrorCode::OBJECT_NOT_FOUND if not
+     * found, ErrorCode::REPLICA_IS_NOT_READY if a replica is not complete,
+     * ErrorCode::UNAVAILABLE_IN_CURRENT_MODE if the disk tier is disabled
+     */
+    auto PutDiskReplica(const std::string& key, const DiskDescriptor& disk)
+        -> tl::expected<void, ErrorCode>;
+
+    /**
+     * @brief Record the objects a client finds in its storage backend when
+     * it restarts. Like PutDiskReplica, except that a key unknown to the
+     * master, e.g. evicted from memory or lost with a master restart,
+     * becomes an object whose only replica is on disk.
+     * @return One result per key: ErrorCode::OBJECT_ALREADY_EXISTS if the
+     * key was put while it was registered, ErrorCode::INVALID_PARAMS if the
+     * file does not match the object, which then holds a newer value, or
+     * the errors of PutDiskReplica
+     */
+    auto BatchPutDiskReplica(const std::vector<std::string>& keys,
+                             const std::vector<DiskDescriptor>& disks)
+        -> std::vector<tl::expected<void, ErrorCode>>;
+
+    /**
+     * @brief Allocate memory replicas for an object that only has a disk
+     * replica, so a client can copy it back into memory. The promotion is
+     * finished with PutEnd or undone with PutRevoke; meanwhile readers keep
+     * using the disk replica.
+     * @return The new memory replicas on success,
+     *         ErrorCode::OBJECT_NOT_FOUND if not found,
+     *         ErrorCode::OBJECT_ALREADY_EXISTS if the object still has or is
+     *         getting memory replicas,
+     *         ErrorCode::INVALID_PARAMS if the slices do not add up to the
+     *         object size,
+     *         ErrorCode::UNAVAILABLE_IN_CURRENT_MODE if the disk tier is
+     *         disabled, or the errors of PutStart if allocation fails.
+     */
+    auto PromoteStart(const std::string& key,
+                      const std::vector<uint64_t>& slice_lengths,
+                      const ReplicateConfig& config)
+        -> tl::expected<std::vector<Replica::Descriptor>, ErrorCode>;
+
+    /**
+     * @brief Pick a memory replica in a segment whose free space is at least
+     * compaction_fragmentation_ratio fragmented, and allocate a new location
+     * for it. Readers keep using the source until the copy is finished with
+     * CompactionEnd or undone with CompactionRevoke; relocations that are
+     * neither are revoked after kCompactionTimeoutMs.
+     *
+     * Objects read more than hot_replica_read_rate times per second come
+     * first: the task copies one of their replicas into an extra replica on
+     * another segment, and the source stays. Extra replicas are retired
+     * again once the object cools down.
+     *
+     * Copies queued by CopyReplica and MigrateReplica come before both. The
+     * caller names the segment it mounted, so that it gets the tasks whose
+     * source it can write from its own memory; other callers get them once
+     * they waited kCopyHandoverMs.
+     * @return The relocation on success,
+     *         ErrorCode::OBJECT_NOT_FOUND if there is nothing to relocate,
+     *         ErrorCode::UNAVAILABLE_IN_CURRENT_MODE if compaction is
+     *         disabled and no queued copy is handed out, or the errors of
+     *         PutStart if allocation fails.
+     */
+    auto CompactionStart(const std::string& segment_name = "")
+        -> tl::expected<CompactionTask, ErrorCode>;
+
+    /**
+     * @brief Add a memory replica of an object on target_segment, or on any
+     * segment without one of its replicas if empty, copied from an existing
+     * memory replica. The copy is queued for CompactionStart and finished
+     * with CompactionEnd or CompactionRevoke like a relocation; readers see
+     * the new replica once it is finished.
+     * @return ErrorCode::OK once queued,
+     *         ErrorCode::OBJECT_NOT_FOUND if not found,
+     *         ErrorCode::REPLICA_IS_NOT_READY if a replica is not complete,
+     *         ErrorCode::INVALID_PARAMS if the object has no memory replica
+     *         or already has one on target_segment,
+     *         ErrorCode::SEGMENT_NOT_FOUND if target_segment is not mounted,
+     *         ErrorCode::NO_AVAILABLE_HANDLE if it has no room.
+     */
+    auto CopyReplica(const std::string& key, const std::string& target_segment)
+        -> tl::expected<void, ErrorCode>;
+
+    /**
+     * @brief Move the memory replica of an object on source_segment to
+     * target_segment, as CopyReplica does, then retire the source as
+     * CompactionEnd does for relocations
+     * @return The errors of CopyReplica, or ErrorCode::INVALID_PARAMS if the
+     *         object has no replica on source_segment
+     */
+    auto MigrateReplica(const std::string& key,
+                        const std::string& source_segment,
+                        const std::string& target_segment)
+        -> tl::expected<void, ErrorCode>;
+
+    /**
+     * @brief Add a memory replica of an object on each of target_segments,
+     * or on every mounted segment without one if empty. The copies are
+     * queued like those of CopyReplica along a binomial tree: every
+     * replica, once complete, is the source of the next copy, so the
+     * number of replicas doubles with each round of copies and N segments
+     * are reached in about log2(N) transfer times.
+     * @return The number of segments to get a replica on success,
+     *         ErrorCode::OBJECT_NOT_FOUND if not found,
+     *         ErrorCode::REPLICA_IS_NOT_READY if a replica is not complete,
+     *         ErrorCode::INVALID_PARAMS if the object has no memory replica
+     *         to copy,
+     *         ErrorCode::SEGMENT_NOT_FOUND if a target segment is not
+     *         mounted
+     */
+    auto Broadcast(const std::string& key,
+                   const std::vector<std::string>& target_segments)
+        -> tl::expected<uint64_t, ErrorCode>;
+
+    /**
+     * @brief Add a memory replica of each object on target_segment, usually
+     * the segment of the client about to read them, copied in the
+     * background as by CopyReplica so that the reads are local. Objects
+     * with a replica on target_segment, or one being copied there, are left
+     * as they are. At most kMaxPrefetchCopies prefetches are queued or in
+     * flight at once.
+     * @return For each key, ErrorCode::OK once queued or if there is
+     *         nothing to copy, ErrorCode::MASTER_BUSY if too many prefetches
+     *         are in flight, or the errors of CopyReplica
+     */
+    std::vector<tl::expected<void, ErrorCode>> Prefetch(
+        const std::vector<std::string>& keys,
+        const std::string& target_segment);
+
+    /**
+     * @brief Drop the prefetches of objects to target_segment, or to any
+     * segment if empty, that no client has started to copy yet
+     * @return For each key, whether a prefetch was dropped
+     */
+    std::vector<tl::expected<bool, ErrorCode>> CancelPrefetch(
+        const std::vector<std::string>& keys,
+        const std::string& target_segment);
+
+    static constexpr size_t kMaxPrefetchCopies = 1024;
+
+    /**
+     * @brief Make the copy of a relocated replica readable. The source is
+     * freed once the leases granted on the object expire, unless the copy
+     * is an extra replica of a hot object, of CopyReplica or of Broadcast.
+     * @param target Replica::address() of the copy, needed only while
+     * Broadcast has several copies of the object in flight
+     * @return ErrorCode::OK on success,
+     *         ErrorCode::OBJECT_NOT_FOUND if not found,
+     *         ErrorCode::INVALID_PARAMS if the object is not being relocated
+     */
+    auto CompactionEnd(const std::string& key, uint64_t target = 0)
+        -> tl::expected<void, ErrorCode>;
+
+    /**
+     * @brief Drop the copy of a relocated replica, the source stays
+     * @param target As for CompactionEnd
+     * @return ErrorCode::OK on success,
+     *         ErrorCode::OBJECT_NOT_FOUND if not found,
+     *         ErrorCode::INVALID_PARAMS if the object is not being relocated
+     */
+    auto CompactionRevoke(const std::string& key, uint64_t target = 0)
+        -> tl::expected<void, ErrorCode>;
+
+    /**
+     * @brief Fragmentation of the free space of each mounted segment, see
+     * BufferAllocator::fragmentation()
+     */
+    std::vector<std::pair<std::string, double>> GetSegmentFragmentation();
+
+    /**
+     * @brief Lock statistics of the limit shards whose mutex was waited for
+     * and held the longest, hottest first. Only single-key accesses are
+     * measured.
+     */
+    std::vector<ShardLockStats> GetHottestShards(size_t limit) const;
+
+    /**
+     * @brief Remove an object and its replicas. Removing an alias of a
+     * content object leaves the replicas to its other aliases, or to
+     * eviction while the last one is leased.
      * @return ErrorCode::OK on success, ErrorCode::OBJECT_NOT_FOUND if not
      * found
      */
@@ -220,6 +677,25 @@ class MasterService {
      */
     long RemoveAll();
 
+    /**
+     * @brief Remove the objects put with ReplicateConfig::tag equal to tag.
+     * Their keys come from the tag index of each shard and the GC thread
+     * removes them in the background, the leased ones once the lease expired.
+     * @return The number of objects queued for removal, ErrorCode::
+     * INVALID_PARAMS for an empty tag
+     */
+    auto RemoveByTag(const std::string& tag) -> tl::expected<long, ErrorCode>;
+
+    /**
+     * @brief Remove the objects whose key starts with prefix, as Remove
+     * would each of them; leased objects and objects still being written
+     * are kept.
+     * @return The number of objects removed, ErrorCode::INVALID_PARAMS for
+     * an empty prefix
+     */
+    auto RemoveByPrefix(const std::string& prefix)
+        -> tl::expected<long, ErrorCode>;
+
     /**
      * @brief Get the count of keys
      * @return The count of keys
@@ -244,6 +720,66 @@ class MasterService {
      */
     tl::expected<std::string, ErrorCode> GetFsdir() const;
 
+    /**
+     * @brief Get the lease granted by GetReplicaList and the replica version,
+     * which changes whenever replicas are dropped before their lease expires
+     */
+    ReplicaCacheInfo GetReplicaCacheInfo() const;
+
+    /**
+     * @brief Get the objects changed after seq, for follower masters. The
+     * first call starts recording changes and answers with reset set. Only
+     * the current state of each changed object is returned, no lease is
+     * granted.
+     * @param max_keys Most changes to return
+     */
+    auto GetMetadataChanges(uint64_t seq, uint64_t max_keys)
+        -> tl::expected<MetadataChanges, ErrorCode>;
+
+    /**
+     * @brief Get the readable objects of kSnapshotShards metadata shards from
+     * shard on, for follower masters reloading all objects
+     */
+    auto GetMetadataSnapshot(uint64_t shard)
+        -> tl::expected<MetadataSnapshot, ErrorCode>;
+
+    static constexpr size_t kSnapshotShards = 16;
+
+    /**
+     * @brief Bring a client's copy of the KeyFilter of all keys up to date.
+     * Sends the keys changed after seq when the change log still has them,
+     * otherwise a whole filter, rebuilt at most every
+     * kKeyFilterRebuildInterval so that removed keys age out. The first call
+     * starts recording changes.
+     * @param seq next_seq of the last update the client applied, 0 if none
+     */
+    auto GetKeyFilter(uint64_t seq) -> tl::expected<KeyFilterUpdate, ErrorCode>;
+
+    static constexpr std::chrono::seconds kKeyFilterRebuildInterval{10};
+    // More changed keys than this are sent as a whole filter instead
+    static constexpr size_t kMaxKeyFilterChanges = 64 * 1024;
+
+    // With enable_failover_restore, freed memory is only reused after this
+    // delay. A standby restores its copy of the metadata only if the copy
+    // was in sync within the delay, by then the failed leader has retired:
+    // the memory of the objects it still lists was not reused.
+    static constexpr auto kRestoreFreeDelay =
+        std::chrono::seconds(3 * ETCD_MASTER_VIEW_LEASE_TTL);
+
+    /**
+     * @brief Restore the objects of the failed leader from the copy of its
+     * metadata a standby kept, see MetadataFollower::Export. Disk replicas
+     * are restored right away. Memory replicas are restored at their
+     * addresses when their client remounts the segment, which needs
+     * BufferAllocatorType::OFFSET; the ones that cannot be placed or whose
+     * segment is not remounted within the client live TTL are dropped.
+     * Objects put since the failover are kept as they are.
+     * @return ErrorCode::UNAVAILABLE_IN_CURRENT_MODE without
+     *         enable_failover_restore
+     */
+    auto RestoreMetadata(std::vector<MetadataEntry> entries)
+        -> tl::expected<void, ErrorCode>;
+
    private:
     // GC thread function
     void GCThreadFunc();
@@ -258,13 +794,86 @@ class MasterService {
     // fulfill evict ratio lowerbound.
     void BatchEvict(double evict_ratio_target, double evict_ratio_lowerbound);
 
-    // Clear invalid handles in all shards
-    void ClearInvalidHandles();
+    // IncrementalEvict has the same two-pass semantics as BatchEvict, but
+    // instead of scanning every object it asks a per-shard eviction engine
+    // (the CLOCK hand or an EvictionPolicy) for victims and stops as soon as
+    // the shard's share of the target is evicted. Used for every
+    // eviction_engine_ other than EvictionEngine::BATCH_SCAN.
+    void IncrementalEvict(double evict_ratio_target,
+                          double evict_ratio_lowerbound);
+
+    // Runs the eviction of eviction_engine_ and records its duration
+    void Evict(double evict_ratio_target, double evict_ratio_lowerbound);
+
+    // Update eviction metrics and need_eviction_ after an eviction round
+    void FinishEviction(long evicted_count, long object_count,
+                        uint64_t total_freed_size);
+
+    // Mount segment under the segment mutex, returning in restored the
+    // replicas placed in it again
+    auto MountSegmentLocked(
+        const Segment& segment, const UUID& client_id,
+        std::vector<std::pair<std::string, Replica>>& restored)
+        -> tl::expected<void, ErrorCode>;
+
+    // Clear invalid handles in all shards. The complete replicas in
+    // the parking segments, unmounted segments in persistent memory, are
+    // parked for a client mounting that memory again.
+    void ClearInvalidHandles(const std::vector<Segment>& parking = {});
+
+    // Workers of the sweeps over all shards, ClearInvalidHandles and
+    // BatchEvict, so that they do not hold up allocations for long
+    static constexpr size_t kNumSweepWorkers = 8;
+    ThreadPool sweep_pool_{kNumSweepWorkers};
+
+    // Run fn on kNumSweepWorkers ranges [begin, end) of shard indexes in
+    // parallel, part being the index of the range, and wait for all of them
+    void ParallelForShards(
+        const std::function<void(size_t part, size_t begin, size_t end)>& fn);
+
+    // Keys of the objects of a shard by their ReplicateConfig::tag, so that
+    // RemoveByTag does not walk the metadata. Guarded by the shard mutex.
+    class TagIndex {
+       public:
+        using Handle = std::list<std::string>::iterator;
+
+        Handle Add(const std::string& tag, std::string_view key) {
+            auto& keys = keys_by_tag_[tag];
+            return keys.emplace(keys.end(), key);
+        }
+
+        void Remove(const std::string& tag, Handle handle) {
+            auto it = keys_by_tag_.find(tag);
+            it->second.erase(handle);
+            if (it->second.empty()) {
+                keys_by_tag_.erase(it);
+            }
+        }
+
+        const std::list<std::string>* Find(const std::string& tag) const {
+            auto it = keys_by_tag_.find(tag);
+            return it == keys_by_tag_.end() ? nullptr : &it->second;
+        }
+
+       private:
+        std::unordered_map<std::string, std::list<std::string>> keys_by_tag_;
+    };
 
     // Internal data structures
     struct ObjectMetadata {
         // RAII-style metric management
         ~ObjectMetadata() {
+            if (eviction_tracker) {
+                eviction_tracker->Remove(eviction_handle, !tracked);
+            }
+            if (tag_index) {
+                tag_index->Remove(tag, tag_handle);
+            }
+            if (!resident) {
+                --*disk_only_objects;
+            } else {
+                NamespaceTable::Release(namespace_usage, size);
+            }
             MasterMetricManager::instance().dec_key_count(1);
             if (soft_pin_timeout) {
                 MasterMetricManager::instance().dec_soft_pin_key_count(1);
@@ -274,17 +883,26 @@ class MasterService {
         ObjectMetadata() = delete;
 
         ObjectMetadata(size_t value_length, std::vector<Replica>&& reps,
-                       bool enable_soft_pin)
+                       bool enable_soft_pin, long* disk_only_count,
+                       NamespaceTable::Usage* usage)
             : replicas(std::move(reps)),
               size(value_length),
               lease_timeout(),
-              soft_pin_timeout(std::nullopt) {
+              soft_pin_timeout(std::nullopt),
+              next_use(),
+              eviction_tracker(nullptr),
+              disk_only_objects(disk_only_count),
+              namespace_usage(usage),
+              eviction_handle(0),
+              referenced(false),
+              tracked(false) {
             MasterMetricManager::instance().inc_key_count(1);
             if (enable_soft_pin) {
                 soft_pin_timeout.emplace();
                 MasterMetricManager::instance().inc_soft_pin_key_count(1);
             }
             MasterMetricManager::instance().observe_value_size(value_length);
+            NamespaceTable::Charge(namespace_usage, value_length);
         }
 
         ObjectMetadata(const ObjectMetadata&) = delete;
@@ -292,13 +910,131 @@ class MasterService {
         ObjectMetadata(ObjectMetadata&&) = delete;
         ObjectMetadata& operator=(ObjectMetadata&&) = delete;
 
+        // There is one per key: the fields are ordered to avoid padding and
+        // those most objects leave empty take no heap memory
         std::vector<Replica> replicas;
         size_t size;
+        // Lease timestamps are atomics so that read-only operations (holding
+        // the shard lock in shared mode) can extend leases concurrently.
         // Default constructor, creates a time_point representing
         // the Clock's epoch (i.e., time_since_epoch() is zero).
-        std::chrono::steady_clock::time_point lease_timeout;  // hard lease
-        std::optional<std::chrono::steady_clock::time_point>
+        mutable std::atomic<std::chrono::steady_clock::time_point>
+            lease_timeout;  // hard lease
+        mutable std::optional<
+            std::atomic<std::chrono::steady_clock::time_point>>
             soft_pin_timeout;  // optional soft pin, only set for vip objects
+        // Expected next read, the epoch without a hint
+        mutable std::atomic<std::chrono::steady_clock::time_point> next_use;
+        // Shard eviction policy tracking this object, null unless a policy
+        // based eviction engine is used. Set by Track.
+        EvictionTracker* eviction_tracker;
+        long* const disk_only_objects;
+        // Charged the size while the object is resident, null unless
+        // namespaces are enabled
+        NamespaceTable::Usage* const namespace_usage;
+        EvictionPolicy::Handle eviction_handle;
+        // CLOCK reference bit, set on every lease grant and cleared when the
+        // eviction hand passes by.
+        mutable std::atomic<bool> referenced;
+        // In the policy of eviction_tracker, which keeps the handle of an
+        // object while it is suspended
+        bool tracked;
+        // False while the object only has a disk replica. Such objects are
+        // not tracked by the eviction policy and are counted in the shard's
+        // disk_only_objects.
+        bool resident = true;
+        // Created by RestoreMetadata, more restored replicas may be added
+        bool restored = false;
+        // An upsert is writing new replicas, the processing ones, next to
+        // the complete ones of the previous value
+        bool upserting = false;
+        // Replicas of a chain replicated put still to be forwarded
+        size_t chain_copies = 0;
+        // Segments still to get a replica of Broadcast, in order. Not a
+        // deque, which allocates even while empty
+        std::vector<std::string> broadcast_segments;
+        // Shard index holding the object under tag, null for untagged objects
+        TagIndex* tag_index = nullptr;
+        std::string tag;
+        TagIndex::Handle tag_handle;
+
+        void SetTag(TagIndex* index, std::string_view key,
+                    const std::string& object_tag) {
+            tag_index = index;
+            tag = object_tag;
+            tag_handle = index->Add(tag, key);
+        }
+
+        bool HasMemoryReplica() const {
+            return std::any_of(
+                replicas.begin(), replicas.end(),
+                [](const Replica& replica) {
+                    return replica.is_memory_replica();
+                });
+        }
+
+        Replica* GetDiskReplica() {
+            for (auto& replica : replicas) {
+                if (!replica.is_memory_replica()) {
+                    return &replica;
+                }
+            }
+            return nullptr;
+        }
+
+        // Readers may use the object through its complete replicas: all of
+        // them once the put is finished, the disk replica while it is being
+        // promoted, the source while a replica is being relocated and the
+        // previous value while an upsert writes new replicas
+        bool IsReadable() const {
+            return std::any_of(
+                replicas.begin(), replicas.end(), [](const Replica& replica) {
+                    return replica.status() == ReplicaStatus::COMPLETE;
+                });
+        }
+
+        // Take the size of a new value, under the exclusive shard lock
+        void Resize(size_t value_length) {
+            if (resident) {
+                NamespaceTable::Release(namespace_usage, size);
+                NamespaceTable::Charge(namespace_usage, value_length);
+            }
+            size = value_length;
+        }
+
+        // Start tracking a new object in the shard eviction policy. The
+        // tracker keeps map_key, the key as stored in the metadata map,
+        // without copying it. Call it through EmplaceObject.
+        void Track(EvictionTracker* tracker, std::string_view map_key) {
+            eviction_tracker = tracker;
+            eviction_handle = tracker->Add(map_key);
+            tracked = true;
+        }
+
+        // Call after the replicas changed, under the exclusive shard lock
+        void UpdateResidency() {
+            const bool now_resident = HasMemoryReplica();
+            if (now_resident == resident) {
+                return;
+            }
+            resident = now_resident;
+            *disk_only_objects += resident ? -1 : 1;
+            if (resident) {
+                NamespaceTable::Charge(namespace_usage, size);
+            } else {
+                NamespaceTable::Release(namespace_usage, size);
+            }
+            if (!eviction_tracker) {
+                return;
+            }
+            if (resident && !tracked) {
+                eviction_tracker->Resume(eviction_handle);
+                tracked = true;
+            } else if (!resident && tracked) {
+                eviction_tracker->Suspend(eviction_handle);
+                tracked = false;
+            }
+        }
 
         // Check if there are some replicas with a different status than the
         // given value. If there are, return the status of the first replica
@@ -313,39 +1049,92 @@ class MasterService {
             return {};
         }
 
+        // Check if any replica points to an unmounted segment, which needs
+        // CleanupStaleHandles under the exclusive shard lock.
+        bool HasStaleHandles() const {
+            for (const auto& replica : replicas) {
+                if (replica.has_invalid_handle()) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        std::chrono::steady_clock::time_point GetLeaseTimeout() const {
+            return lease_timeout.load(std::memory_order_relaxed);
+        }
+
         // Grant a lease with timeout as now() + ttl, only update if the new
-        // timeout is larger
-        void GrantLease(const uint64_t ttl, const uint64_t soft_ttl) {
+        // timeout is larger. Safe to call under a shared shard lock.
+        void GrantLease(const uint64_t ttl, const uint64_t soft_ttl) const {
             std::chrono::steady_clock::time_point now =
                 std::chrono::steady_clock::now();
-            lease_timeout =
-                std::max(lease_timeout, now + std::chrono::milliseconds(ttl));
+            AtomicMax(lease_timeout, now + std::chrono::milliseconds(ttl));
+            // PutEnd grants a zero-length lease, which is not an access
+            if (ttl > 0) {
+                referenced.store(true, std::memory_order_relaxed);
+                if (tracked) {
+                    eviction_tracker->Access(eviction_handle);
+                }
+            }
             if (soft_pin_timeout) {
-                soft_pin_timeout =
-                    std::max(*soft_pin_timeout,
-                             now + std::chrono::milliseconds(soft_ttl));
+                AtomicMax(*soft_pin_timeout,
+                          now + std::chrono::milliseconds(soft_ttl));
             }
         }
 
+        // Record when the object is expected to be read again, replacing an
+        // older hint. Safe to call under a shared shard lock.
+        void HintNextUse(uint64_t next_use_ms) const {
+            next_use.store(std::chrono::steady_clock::now() +
+                               std::chrono::milliseconds(next_use_ms),
+                           std::memory_order_relaxed);
+        }
+
+        // Eviction order of the batch scan, smallest first: the lease
+        // timeout, or for a pending hint the time as far behind now as the
+        // hinted use is ahead, so that farther uses go first
+        std::chrono::steady_clock::time_point EvictionRank(
+            std::chrono::steady_clock::time_point now) const {
+            const auto hinted = next_use.load(std::memory_order_relaxed);
+            if (hinted <= now) {
+                return GetLeaseTimeout();
+            }
+            return now - (hinted - now);
+        }
+
         // Check if the lease has expired
         bool IsLeaseExpired() const {
-            return std::chrono::steady_clock::now() >= lease_timeout;
+            return std::chrono::steady_clock::now() >= GetLeaseTimeout();
         }
 
         // Check if the lease has expired
         bool IsLeaseExpired(std::chrono::steady_clock::time_point& now) const {
-            return now >= lease_timeout;
+            return now >= GetLeaseTimeout();
         }
 
         // Check if is in soft pin status
         bool IsSoftPinned() const {
             return soft_pin_timeout &&
-                   std::chrono::steady_clock::now() < *soft_pin_timeout;
+                   std::chrono::steady_clock::now() <
+                       soft_pin_timeout->load(std::memory_order_relaxed);
         }
 
         // Check if is in soft pin status
         bool IsSoftPinned(std::chrono::steady_clock::time_point& now) const {
-            return soft_pin_timeout && now < *soft_pin_timeout;
+            return soft_pin_timeout &&
+                   now < soft_pin_timeout->load(std::memory_order_relaxed);
+        }
+
+       private:
+        static void AtomicMax(
+            std::atomic<std::chrono::steady_clock::time_point>& target,
+            std::chrono::steady_clock::time_point value) {
+            auto current = target.load(std::memory_order_relaxed);
+            while (current < value &&
+                   !target.compare_exchange_weak(current, value,
+                                                 std::memory_order_relaxed)) {
+            }
         }
     };
 
@@ -353,32 +1142,255 @@ class MasterService {
     SegmentManager segment_manager_;
     std::shared_ptr<AllocationStrategy> allocation_strategy_;
 
-    static constexpr size_t kNumShards = 1024;  // Number of metadata shards
+    static constexpr size_t kNumShards = kNumMetadataShards;
 
-    // Sharded metadata maps and their mutexes
+    // Per-shard metadata container. Every backend keeps the keys at stable
+    // addresses, the eviction trackers hold views of them. The flat
+    // open-addressing map keeps the full hash of each key in a dense slot
+    // array, which removes the bucket indirection of lookups; each entry is
+    // still one allocation, holding the value and the key, so that neither
+    // moves. It is selected at build time with
+    // STORE_USE_FLAT_METADATA_MAP. The radix tree, selected with
+    // STORE_USE_ART_METADATA_MAP, compresses the prefixes keys share and
+    // keeps them ordered, so that ScanKeys and RemoveByPrefix only visit
+    // the keys of the prefix.
+#ifdef STORE_USE_FLAT_METADATA_MAP
+    using MetadataMap = FlatMetadataMap<ObjectMetadata>;
+#elif defined(STORE_USE_ART_METADATA_MAP)
+    using MetadataMap = ArtMetadataMap<ObjectMetadata>;
+#else
+    using MetadataMap = std::unordered_map<std::string, ObjectMetadata,
+                                           KeyHasher, std::equal_to<>>;
+#endif
+
+    // Sharded metadata maps and their mutexes. Read-only operations take the
+    // mutex in shared mode, mutations take it exclusively.
     struct MetadataShard {
-        mutable Mutex mutex;
-        std::unordered_map<std::string, ObjectMetadata> metadata
+        mutable SharedMutex mutex;
+        // Eviction policy of the shard, set once in the constructor for
+        // policy based engines. The tracker itself is guarded by mutex
+        // (OnAccess also runs under the shared lock). Declared before
+        // metadata so that it outlives the objects it tracks.
+        std::unique_ptr<EvictionTracker> eviction_tracker;
+        // Declared before metadata for the same reason
+        TagIndex tag_index GUARDED_BY(mutex);
+        MetadataMap metadata GUARDED_BY(mutex);
+        // Key the CLOCK eviction hand points at, empty to start from begin()
+        std::string clock_hand GUARDED_BY(mutex);
+        // Objects of metadata that only have a disk replica
+        long disk_only_objects GUARDED_BY(mutex) = 0;
+        // Keys of the shard put with a content hash, to their content key
+        std::unordered_map<std::string, std::string> aliases
+            GUARDED_BY(mutex);
+        // Content keys of the shard, to the number of aliases of them. Kept
+        // while the content object is evicted, its aliases may still be
+        // removed or find a new copy of the same content.
+        std::unordered_map<std::string, size_t> content_refs
             GUARDED_BY(mutex);
+        // Sampled reads of the objects of the shard in the current hot
+        // replica window. A leaf lock, taken under the shared shard lock.
+        mutable Mutex hot_mutex;
+        std::unordered_map<std::string, uint64_t> sampled_reads
+            GUARDED_BY(hot_mutex);
+        // Updated by the accessors without holding mutex
+        struct LockCounters {
+            std::atomic<uint64_t> sampled_acquisitions{0};
+            std::atomic<uint64_t> contentions{0};
+            std::atomic<uint64_t> wait_ns{0};
+            std::atomic<uint64_t> sampled_hold_ns{0};
+        };
+        mutable LockCounters lock_counters;
     };
+    // Namespaces of the keys, with their quotas and usage. Outlives the
+    // objects charged to it.
+    NamespaceTable namespaces_;
     std::array<MetadataShard, kNumShards> metadata_shards_;
 
     // Helper to get shard index from key
     size_t getShardIndex(const std::string& key) const {
-        return std::hash<std::string>{}(key) % kNumShards;
+        return ShardOf(key);
     }
 
     // Helper to clean up stale handles pointing to unmounted segments
     bool CleanupStaleHandles(ObjectMetadata& metadata);
 
+    // Find key in a shard whose mutex is held exclusively by the caller, and
+    // erase its metadata if all replicas turn out to be stale.
+    MetadataMap::iterator FindAndCleanup(MetadataShard& shard,
+                                         const std::string& key)
+        NO_THREAD_SAFETY_ANALYSIS;
+
+    // The first limit keys of a shard, in order, that start with prefix and
+    // come after after if set. The caller holds the shard mutex; the views
+    // point into the shard's map.
+    static std::vector<std::string_view> ShardKeysWithPrefix(
+        const MetadataShard& shard, std::string_view prefix,
+        std::optional<std::string_view> after, size_t limit)
+        NO_THREAD_SAFETY_ANALYSIS;
+
+    // Group key indices by shard, in ascending shard order, so that batch
+    // operations lock every touched shard exactly once.
+    std::vector<std::pair<size_t, std::vector<size_t>>> GroupByShard(
+        const std::vector<std::string>& keys) const;
+
+    // Validate put parameters and return the total object size
+    auto ValidatePutParams(const std::string& key,
+                           const std::vector<uint64_t>& slice_lengths,
+                           const ReplicateConfig& config)
+        -> tl::expected<uint64_t, ErrorCode>;
+
+    // Allocate config.replica_num replicas for an object, only the first
+    // one of a chain. Sets need_eviction_ if the allocation fails.
+    auto AllocateReplicas(ScopedAllocatorAccess& allocator_access,
+                          const std::string& key,
+                          const std::vector<uint64_t>& slice_lengths,
+                          const ReplicateConfig& config)
+        -> tl::expected<std::vector<Replica>, ErrorCode>;
+
+    // Allocate the replicas of the pending keys of a contiguous batch, see
+    // BatchPutStart, leaving replicas empty for the keys of the groups that
+    // got no extent
+    void AllocateContiguousBatch(
+        ScopedAllocatorAccess& allocator_access,
+        const std::vector<std::vector<uint64_t>>& slice_lengths,
+        const std::vector<uint64_t>& total_lengths,
+        const std::vector<bool>& pending, const ReplicateConfig& config,
+        std::vector<std::vector<Replica>>& replicas);
+
+    // Allocate a fragment of an erasure-coded object on a segment holding
+    // none of its other fragments, null if there is none with the space
+    auto AllocateFragment(ScopedAllocatorAccess& allocator_access,
+                          uint64_t size, const ReplicateConfig& config,
+                          const std::vector<std::string>& placed_segments)
+        -> std::unique_ptr<AllocatedBuffer>;
+
+    // Allocate a slice with the strategy from the allocators of one memory
+    // tier. Segments of GPU memory are kept for config.prefer_device_memory,
+    // which falls back to host segments when they are full. Other objects go
+    // to host segments, or to GPU ones when no host segment is mounted.
+    auto AllocateInTier(
+        const std::vector<std::shared_ptr<BufferAllocator>>& allocators,
+        const std::unordered_map<
+            std::string, std::vector<std::shared_ptr<BufferAllocator>>>&
+            allocators_by_name,
+        uint64_t size, const ReplicateConfig& config,
+        const std::vector<std::string>& placed_segments)
+        -> std::unique_ptr<AllocatedBuffer>;
+
+    // Replicas of a put forwarded along its chain instead of allocated by
+    // PutStart
+    static size_t ChainCopies(const ReplicateConfig& config) {
+        return config.chain_replication ? config.replica_num - 1 : 0;
+    }
+
+    // Mark all replicas complete, grant the initial lease and start
+    // forwarding a chain replicated put
+    void CompletePut(const std::string& key, ObjectMetadata& metadata);
+
+    // PutStart of config.upsert for an object that exists, under the
+    // exclusive lock of its shard
+    auto UpsertStart(const std::string& key, ObjectMetadata& metadata,
+                     const std::vector<uint64_t>& slice_lengths,
+                     uint64_t total_length, const ReplicateConfig& config)
+        -> tl::expected<std::vector<Replica::Descriptor>, ErrorCode>;
+
+    // Swap the new replicas of an upsert in for those of the previous
+    // value, which are retired until their leases expire
+    void FinishUpsert(const std::string& key, ObjectMetadata& metadata);
+
+    // Undo a put. Returns true if the object is to be erased, false if it
+    // keeps its disk replica and only the new memory replicas are dropped.
+    tl::expected<bool, ErrorCode> RevokePut(const std::string& key,
+                                            ObjectMetadata& metadata);
+
+    // Content objects of the puts with a content hash are stored under
+    // kContentKeyPrefix + hash, which cannot be put directly. Shard locks
+    // of an alias and of its content are taken one after the other, never
+    // together.
+    static constexpr std::string_view kContentKeyPrefix =
+        "__mooncake_content__/";
+
+    // PutStart of a key with a content hash
+    auto PutContentStart(const std::string& key,
+                         const std::vector<uint64_t>& slice_lengths,
+                         uint64_t total_length, const ReplicateConfig& config)
+        -> tl::expected<std::vector<Replica::Descriptor>, ErrorCode>;
+
+    // Call read with the content object of the alias key, or drop the alias
+    // if the content is gone
+    template <typename Read>
+    void ReadContent(const std::string& key, const std::string& content_key,
+                     Read&& read);
+
+    // Remove of an alias, the content stays while being put
+    auto RemoveAlias(const std::string& key, const std::string& content_key)
+        -> tl::expected<void, ErrorCode>;
+
+    // Drop the alias key if it still refers to content_key, and release its
+    // reference on the content
+    void DropAlias(const std::string& key, const std::string& content_key);
+
+    // Release a reference on content_key. The last one erases the content
+    // object unless it is leased.
+    void ReleaseContent(const std::string& content_key);
+
+    // Evict an object from a shard whose mutex is held exclusively. With
+    // the disk tier enabled an object with a disk replica only loses its
+    // memory replicas. Returns the iterator following it.
+    MetadataMap::iterator EvictObject(MetadataShard& shard,
+                                      MetadataMap::iterator it,
+                                      uint64_t& total_freed_size)
+        NO_THREAD_SAFETY_ANALYSIS;
+
+    // Insert the metadata of a new object into a locked shard, like
+    // try_emplace, and track it in the shard eviction policy
+    template <typename... Args>
+    static std::pair<MetadataMap::iterator, bool> EmplaceObject(
+        MetadataShard& shard, const std::string& key,
+        Args&&... args) NO_THREAD_SAFETY_ANALYSIS {
+        auto result =
+            shard.metadata.try_emplace(key, std::forward<Args>(args)...);
+        if (result.second && shard.eviction_tracker) {
+            result.first->second.Track(shard.eviction_tracker.get(),
+                                       result.first->first);
+        }
+        return result;
+    }
+
+    // Objects of a locked shard that hold memory, the base of the eviction
+    // targets
+    static long ResidentObjects(const MetadataShard& shard)
+        NO_THREAD_SAFETY_ANALYSIS {
+        return static_cast<long>(shard.metadata.size()) -
+               shard.disk_only_objects;
+    }
+
     // GC related members
-    static constexpr size_t kGCQueueSize = 10 * 1024;  // Size of the GC queue
-    boost::lockfree::queue<GCTask*> gc_queue_{kGCQueueSize};
+    // Tasks of MarkForGC, spread by key over heaps ordered by deletion time
+    // so that concurrent callers seldom share a mutex. The heaps are not
+    // bounded, a task is never dropped.
+    static constexpr size_t kNumGCShards = 64;
+    struct GCShard {
+        Mutex mutex;
+        std::vector<GCTask> tasks GUARDED_BY(mutex);
+    };
+    std::array<GCShard, kNumGCShards> gc_shards_;
+    // Remove the keys of the GC tasks that are due
+    void ProcessGCTasks();
     std::thread gc_thread_;
     std::atomic<bool> gc_running_{false};
     bool enable_gc_{true};  // Flag to enable/disable garbage collection
     static constexpr uint64_t kGCThreadSleepMs =
         10;  // 10 ms sleep between GC and eviction checks
+    // Keys and tags queued by RemoveByTag. Apart from the GC tasks as they
+    // are removed only while they keep the tag, and retried while leased.
+    static constexpr size_t kMaxTagRemovalsPerRound = 4096;
+    Mutex tag_removal_mutex_;
+    std::deque<std::pair<std::string, std::string>> tag_removals_
+        GUARDED_BY(tag_removal_mutex_);
+    // Remove up to kMaxTagRemovalsPerRound objects of tag_removals_, the
+    // ones still leased or being written are queued again
+    void RemoveTaggedObjects();
 
     // Lease related members
     const uint64_t default_kv_lease_ttl_;     // in milliseconds
@@ -390,6 +1402,342 @@ class MasterService {
         false};  // Set to trigger eviction when not enough space left
     const double eviction_ratio_;                 // in range [0.0, 1.0]
     const double eviction_high_watermark_ratio_;  // in range [0.0, 1.0]
+    const EvictionEngine eviction_engine_;
+
+    // Proactive eviction keeps room below the high watermark for the
+    // allocations expected within kEvictionHorizon, at the rate observed
+    // lately, without evicting below the low watermark. 0 disables it.
+    const double eviction_low_watermark_ratio_;  // in range [0.0, 1.0]
+    static constexpr auto kEvictionControlInterval =
+        std::chrono::milliseconds(100);
+    static constexpr auto kEvictionHorizon = std::chrono::seconds(1);
+    // Weight of the latest interval in the allocation rate
+    static constexpr double kAllocationRateSmoothing = 0.2;
+    // Bytes requested by AllocateReplicas so far
+    std::atomic<uint64_t> allocation_demand_bytes_{0};
+    // The controller state, GC thread only
+    uint64_t sampled_demand_bytes_ = 0;
+    std::chrono::steady_clock::time_point demand_sampled_at_{};
+    double allocation_rate_ = 0.0;  // bytes per second
+    // Evicts ahead of the allocations if the headroom is short, called on
+    // every GC round while no reactive eviction is needed
+    void ProactiveEvict();
+
+    // Whether the namespace of key has room for size more bytes, counting
+    // the put as rejected otherwise
+    bool NamespaceHasRoom(std::string_view key, uint64_t size);
+    // Count the get of key in its namespace, a hit if found
+    void RecordNamespaceGet(std::string_view key, bool hit);
+    // Evicts the objects of the namespaces above their share of the space
+    // below the high watermark, the least recently leased first, and
+    // updates the namespace metrics. Called on every GC round before the
+    // eviction of all namespaces, which it may make unnecessary.
+    void EvictNamespaceExcess();
+    // Demote evicted objects that have a disk replica instead of dropping
+    // them, and serve PutDiskReplica and PromoteStart
+    const bool enable_disk_tier_;
+
+    // Compaction related members
+    const double compaction_fragmentation_ratio_;  // 0 disables compaction
+    static constexpr uint64_t kCompactionTimeoutMs = 60 * 1000;
+    // Upper bound of objects visited by one CompactionStart
+    static constexpr size_t kMaxCompactionVisits = 1024;
+    enum class RelocationKind {
+        MOVE,         // The source is retired once the copy is finished
+        HOT_REPLICA,  // An extra replica of a hot object, the source stays
+        COPY,         // Of CopyReplica, the source stays
+        DRAIN,        // Out of a draining segment, as MOVE
+        CHAIN,        // Forwarded by a chain replicated put, as COPY
+        BROADCAST,    // Of Broadcast, as COPY
+        PREFETCH,     // Of Prefetch, as COPY
+    };
+    struct Relocation {
+        uintptr_t source;  // Replica::address() of the source and target
+        uintptr_t target;
+        std::chrono::steady_clock::time_point deadline;
+        RelocationKind kind = RelocationKind::MOVE;
+    };
+    // Sources of finished relocations, held until the leases granted on
+    // them expire
+    struct RetiredReplica {
+        Replica replica;
+        std::chrono::steady_clock::time_point lease_timeout;
+    };
+    // Taken after a shard mutex, never before
+    Mutex compaction_mutex_;
+    // One per object, except while Broadcast copies it
+    std::unordered_multimap<std::string, Relocation> relocations_
+        GUARDED_BY(compaction_mutex_);
+    std::vector<RetiredReplica> retired_replicas_
+        GUARDED_BY(compaction_mutex_);
+    // Shard the next CompactionStart scans first
+    std::atomic<size_t> compaction_shard_{0};
+    // Copies of CopyReplica and MigrateReplica waiting for a client, oldest
+    // first
+    struct QueuedCopy {
+        std::string source_segment;
+        CompactionTask task;
+        uintptr_t target;
+        std::chrono::steady_clock::time_point queued;
+    };
+    std::deque<QueuedCopy> queued_copies_ GUARDED_BY(compaction_mutex_);
+    // Relocations of kind PREFETCH, queued or in flight
+    size_t prefetch_copies_ GUARDED_BY(compaction_mutex_) = 0;
+    // How long a queued copy waits for the client of its source segment
+    static constexpr uint64_t kCopyHandoverMs = 5 * 1000;
+
+    // Allocate the target of a copy of the memory replica of key on
+    // source_segment, the first one if empty, or within source_range if not
+    // null, and queue it. Returns the size of the object.
+    auto QueueCopy(const std::string& key, const std::string& source_segment,
+                   const std::string& target_segment, RelocationKind kind,
+                   const Segment* source_range = nullptr)
+        -> tl::expected<uint64_t, ErrorCode>;
+    // Same for the object key, whose shard mutex is held exclusively
+    auto QueueCopy(const std::string& key, ObjectMetadata& metadata,
+                   const std::string& source_segment,
+                   const std::string& target_segment, RelocationKind kind,
+                   const Segment* source_range = nullptr)
+        -> tl::expected<uint64_t, ErrorCode>;
+
+    // Queue the copy of from forwarding the next replica of a chain
+    // replicated put, whose shard mutex is held exclusively
+    void ForwardChain(const std::string& key, ObjectMetadata& metadata,
+                      const Replica& from);
+
+    // Queue the copy of the replica on source_segment to the next segment
+    // of the Broadcast of key that can take it, whose shard mutex is held
+    // exclusively
+    void ForwardBroadcast(const std::string& key, ObjectMetadata& metadata,
+                          const std::string& source_segment);
+
+    // The key holding the replicas of key, its content key for an alias
+    std::string ObjectKeyOf(const std::string& key);
+
+    // The oldest queued copy for a client of segment_name
+    std::optional<CompactionTask> TakeQueuedCopy(
+        const std::string& segment_name);
+
+    // The first memory replica of metadata with a slice on segment_name, or
+    // the first one if empty
+    auto FindMemoryReplica(ObjectMetadata& metadata,
+                           const std::string& segment_name)
+        -> std::vector<Replica>::iterator;
+
+    // The first complete memory replica of metadata with a slice in segment
+    auto FindReplicaIn(ObjectMetadata& metadata, const Segment& segment)
+        -> std::vector<Replica>::iterator;
+    static bool IsReplicaIn(const Replica& replica, const Segment& segment);
+
+    // Segment of the first slice of a memory replica
+    static std::string SegmentOf(const Replica& replica);
+
+    // Buffers for a copy of source on target_segment, or on any segment
+    // without a memory replica of metadata if empty, not evicting for it.
+    // Hot copies prefer segments of GPU memory.
+    auto AllocateCopy(const ObjectMetadata& metadata, const Replica& source,
+                      const std::string& target_segment, bool hot = false)
+        -> tl::expected<std::vector<std::unique_ptr<AllocatedBuffer>>,
+                        ErrorCode>;
+
+    // Remove the relocation of key to target, or the first one if 0, whose
+    // shard mutex is held exclusively
+    std::optional<Relocation> TakeRelocation(const std::string& key,
+                                             uint64_t target = 0);
+
+    // Free the retired replicas whose leases expired and revoke the
+    // relocations past their deadline, called by the GC thread
+    void CompactionGC();
+
+    // Hot replica related members
+    const uint64_t hot_replica_read_rate_;  // reads per second, 0 disables
+    // One in kHotReadSampleInterval reads is counted
+    static constexpr uint64_t kHotReadSampleInterval = 8;
+    static constexpr uint64_t kHotWindowMs = 1000;
+    // Extra replicas of an object at most, one per hot_replica_read_rate
+    static constexpr size_t kMaxHotReplicas = 2;
+    // Objects hot in the last window, to the number of extra replicas they
+    // should have
+    std::unordered_map<std::string, size_t> hot_objects_
+        GUARDED_BY(compaction_mutex_);
+    // Addresses of the extra replicas of each object, newest last
+    std::unordered_map<std::string, std::vector<uintptr_t>> hot_replicas_
+        GUARDED_BY(compaction_mutex_);
+    // Only used by the GC thread
+    std::chrono::steady_clock::time_point hot_window_start_;
+
+    // Count a read of key, sampled
+    void SampleRead(std::string_view key);
+
+    // Allocate an extra replica for one of the hot objects, on a segment
+    // that has none of its replicas yet, copied from the replica on
+    // segment_name if there is one
+    std::optional<CompactionTask> HotReplicaStart(
+        const std::string& segment_name);
+
+    // Turn the sampled reads of the window into hot_objects_ and retire an
+    // extra replica of each object that cooled down, called by the GC
+    // thread
+    void HotReplicaGC();
+
+    // Retire the complete memory replica at address if the object has
+    // another one. Readers granted a lease before may still be reading it.
+    bool RetireReplica(const std::string& key, uintptr_t address);
+
+    // Drain related members
+    const uint64_t drain_rate_bytes_;  // per second and segment, 0 no limit
+    static constexpr uint64_t kDrainIntervalMs = 100;
+    // Moves of a segment queued or being copied at most
+    static constexpr size_t kMaxDrainMoves = 16;
+    struct Drain {
+        Segment segment;
+        std::chrono::steady_clock::time_point start;
+        uint64_t queued_bytes = 0;
+        // Shard the next scan starts from
+        size_t shard = 0;
+        // Objects being moved
+        std::unordered_set<std::string> moving;
+        // Set after a pass over all the shards found nothing to move
+        std::chrono::steady_clock::time_point next_pass;
+    };
+    // Taken before a shard mutex and compaction_mutex_, never after
+    Mutex drain_mutex_;
+    std::unordered_map<UUID, Drain, boost::hash<UUID>> drains_
+        GUARDED_BY(drain_mutex_);
+    // Only used by the GC thread
+    std::chrono::steady_clock::time_point last_drain_;
+
+    // Queue the next moves of every draining segment and forget the
+    // unmounted ones, called by the GC thread
+    void DrainGC();
+
+    // Queue moves out of the segment of drain, within its rate and
+    // kMaxDrainMoves
+    void DrainStep(Drain& drain) REQUIRES(drain_mutex_);
+
+    // Move the replica of key in the segment of drain, or drop it if there
+    // is no room elsewhere and the object has another memory replica
+    void DrainObject(Drain& drain, const std::string& key)
+        REQUIRES(drain_mutex_);
+
+    // Largest value of PutInline, 0 disables it
+    const uint64_t inline_object_max_size_;
+
+    // Smallest object whose slices are striped over distinct segments, 0
+    // disables striping
+    const uint64_t stripe_min_size_;
+
+    // How long the replicas of an unmounted segment in persistent memory
+    // wait for the memory to be mounted again
+    const uint64_t persistent_segment_ttl_sec_;
+    // Whether those replicas are kept at all: only the offset allocator
+    // can place them back at their offsets
+    const bool keep_persistent_replicas_;
+
+    // Allocation credits granted to clients, by id
+    struct Credit {
+        UUID client_id;
+        // Shared with the buffers of the objects placed in it
+        std::shared_ptr<AllocatedBuffer> extent;
+        std::chrono::steady_clock::time_point expiry;
+    };
+    Mutex credit_mutex_;
+    std::unordered_map<uint64_t, Credit> credits_ GUARDED_BY(credit_mutex_);
+    uint64_t next_credit_id_ GUARDED_BY(credit_mutex_) = 0;
+
+    // End the expired credits, called by the GC thread
+    void CreditGC();
+
+    // Do the frees the allocators queued, e.g. for removes and evictions
+    // under a metadata shard lock, called by the GC thread
+    void FreeGC();
+
+    // Failover restore related members
+    const bool enable_failover_restore_;
+    // A memory replica of RestoreMetadata waiting for its segment
+    struct PendingReplica {
+        std::string key;
+        Replica::Descriptor replica;
+    };
+    Mutex restore_mutex_;
+    // Segment name of the first buffer -> replicas
+    std::unordered_map<std::string, std::vector<PendingReplica>>
+        pending_replicas_ GUARDED_BY(restore_mutex_);
+    std::chrono::steady_clock::time_point restore_deadline_
+        GUARDED_BY(restore_mutex_);
+    // Replicas of an unmounted segment in persistent memory
+    struct ParkedSegment {
+        Segment segment;
+        std::chrono::steady_clock::time_point deadline;
+        std::vector<PendingReplica> replicas;
+    };
+    // Memory id -> its segment when it was unmounted
+    std::unordered_map<UUID, ParkedSegment, boost::hash<UUID>>
+        parked_segments_ GUARDED_BY(restore_mutex_);
+
+    // Place the parked replicas of the memory of segment, just mounted by a
+    // restarted client, at the same offsets in it, under the segment lock
+    std::vector<std::pair<std::string, Replica>> PlaceParkedReplicas(
+        const ScopedSegmentAccess& segment_access, const Segment& segment);
+
+    // Place the pending replicas of the remounted segments at their
+    // addresses, under the segment lock
+    std::vector<std::pair<std::string, Replica>> PlacePendingReplicas(
+        const ScopedSegmentAccess& segment_access,
+        const std::vector<Segment>& segments);
+
+    // Allocate the buffers of a memory replica at their addresses plus
+    // shift, in segment_name if it is not empty, nullopt if one is taken
+    std::optional<Replica> PlaceReplica(
+        const ScopedSegmentAccess& segment_access,
+        const Replica::Descriptor& descriptor,
+        const std::string& segment_name, uint64_t shift);
+
+    // Add a restored replica to its object, unless the object was put anew
+    void AddRestoredReplica(const std::string& key, Replica&& replica);
+
+    // Which objects an incremental eviction sweep may evict. All of them
+    // require an expired lease and complete replicas.
+    enum class SweepMode {
+        NO_PIN_UNREFERENCED,  // first pass: no soft pin, not recently used
+        NO_PIN,               // second pass: no soft pin
+        SOFT_PIN,             // second pass: soft pinned objects as well
+    };
+    // Upper bound of objects visited per object to evict, so that one sweep
+    // costs O(evicted) even if most objects are hot.
+    static constexpr long kMaxVisitsPerEviction = 16;
+
+    // Evict up to quota objects from a shard whose mutex is held
+    // exclusively, using the shard's policy if it has one and the CLOCK hand
+    // otherwise. Returns the number of evicted objects.
+    long SweepShard(MetadataShard& shard, long quota, SweepMode mode,
+                    std::chrono::steady_clock::time_point now,
+                    uint64_t& total_freed_size) NO_THREAD_SAFETY_ANALYSIS;
+    long ClockSweepShard(MetadataShard& shard, long quota, SweepMode mode,
+                         std::chrono::steady_clock::time_point now,
+                         uint64_t& total_freed_size) NO_THREAD_SAFETY_ANALYSIS;
+    long PolicySweepShard(MetadataShard& shard, long quota, SweepMode mode,
+                          std::chrono::steady_clock::time_point now,
+                          uint64_t& total_freed_size)
+        NO_THREAD_SAFETY_ANALYSIS;
+
+    // One in this many single-key accesses of each thread measures how long
+    // it holds the shard mutex
+    static constexpr uint32_t kLockSampleInterval = 64;
+
+    // Records the lock statistics of an access to shard, from after the
+    // mutex is acquired to before it is released
+    class ShardLockProbe {
+       public:
+        ShardLockProbe(const MetadataShard& shard, bool exclusive,
+                       bool contended, int64_t wait_ns);
+        ~ShardLockProbe();
+
+       private:
+        MetadataShard::LockCounters& counters_;
+        // Zero if the hold is not sampled
+        std::chrono::steady_clock::time_point hold_start_;
+    };
 
     // Helper class for accessing metadata with automatic locking and cleanup
     class MetadataAccessor {
@@ -398,16 +1746,17 @@ class MasterService {
             : service_(service),
               key_(key),
               shard_idx_(service_->getShardIndex(key)),
-              lock_(&service_->metadata_shards_[shard_idx_].mutex),
-              it_(service_->metadata_shards_[shard_idx_].metadata.find(key)) {
-            // Automatically clean up invalid handles
-            if (it_ != service_->metadata_shards_[shard_idx_].metadata.end()) {
-                if (service_->CleanupStaleHandles(it_->second)) {
-                    service_->metadata_shards_[shard_idx_].metadata.erase(it_);
-                    it_ = service_->metadata_shards_[shard_idx_].metadata.end();
-                }
-            }
-        }
+              lock_(&service_->metadata_shards_[shard_idx_].mutex, &contended_,
+                    &wait_ns_),
+              probe_(service_->metadata_shards_[shard_idx_], true, contended_,
+                     wait_ns_),
+              // Automatically clean up invalid handles
+              it_(service_->FindAndCleanup(
+                  service_->metadata_shards_[shard_idx_], key)) {}
+
+        // Any exclusive access may have changed the object, recorded while
+        // the shard is still locked
+        ~MetadataAccessor() { service_->change_log_.Record(key_); }
 
         // Check if metadata exists
         bool Exists() const NO_THREAD_SAFETY_ANALYSIS {
@@ -417,6 +1766,19 @@ class MasterService {
         // Get metadata (only call when Exists() is true)
         ObjectMetadata& Get() NO_THREAD_SAFETY_ANALYSIS { return it_->second; }
 
+        // The content key if the key is an alias (only call when Exists()
+        // is false)
+        std::optional<std::string> ContentKey() const
+            NO_THREAD_SAFETY_ANALYSIS {
+            const auto& aliases =
+                service_->metadata_shards_[shard_idx_].aliases;
+            auto it = aliases.find(key_);
+            if (it == aliases.end()) {
+                return std::nullopt;
+            }
+            return it->second;
+        }
+
         // Delete current metadata (for PutRevoke or Remove operations)
         void Erase() NO_THREAD_SAFETY_ANALYSIS {
             service_->metadata_shards_[shard_idx_].metadata.erase(it_);
@@ -427,13 +1789,108 @@ class MasterService {
         MasterService* service_;
         std::string key_;
         size_t shard_idx_;
-        MutexLocker lock_;
-        std::unordered_map<std::string, ObjectMetadata>::iterator it_;
+        bool contended_{false};
+        int64_t wait_ns_{0};
+        SharedMutexLocker lock_;
+        ShardLockProbe probe_;
+        MetadataMap::iterator it_;
     };
 
+    // Helper class for read-only metadata access. It holds the shard mutex in
+    // shared mode, so concurrent readers of the same shard do not block each
+    // other. It never cleans up stale handles; callers that see
+    // HasStaleHandles() must fall back to MetadataAccessor.
+    class MetadataReadAccessor {
+       public:
+        MetadataReadAccessor(const MasterService* service,
+                             const std::string& key)
+            : key_(key),
+              shard_(service->metadata_shards_[service->getShardIndex(key)]),
+              lock_(&shard_.mutex, shared_lock, &contended_, &wait_ns_),
+              probe_(shard_, false, contended_, wait_ns_),
+              it_(shard_.metadata.find(key)) {}
+
+        // Check if metadata exists
+        bool Exists() const NO_THREAD_SAFETY_ANALYSIS {
+            return it_ != shard_.metadata.end();
+        }
+
+        // Get metadata (only call when Exists() is true)
+        const ObjectMetadata& Get() const NO_THREAD_SAFETY_ANALYSIS {
+            return it_->second;
+        }
+
+        // The content key if the key is an alias (only call when Exists()
+        // is false)
+        std::optional<std::string> ContentKey() const
+            NO_THREAD_SAFETY_ANALYSIS {
+            auto it = shard_.aliases.find(key_);
+            if (it == shard_.aliases.end()) {
+                return std::nullopt;
+            }
+            return it->second;
+        }
+
+       private:
+        const std::string& key_;
+        const MetadataShard& shard_;
+        bool contended_{false};
+        int64_t wait_ns_{0};
+        SharedMutexLocker lock_;
+        ShardLockProbe probe_;
+        MetadataMap::const_iterator it_;
+    };
+
+    // GetReplicaList without counting the get in its namespace
+    auto LookupReplicaList(std::string_view key)
+        -> tl::expected<std::vector<Replica::Descriptor>, ErrorCode>;
+
+    // Shared body of GetReplicaList for both the shared and exclusive paths.
+    // object_key is the key of metadata if key is an alias.
+    tl::expected<std::vector<Replica::Descriptor>, ErrorCode>
+    ReadReplicaList(std::string_view key, const ObjectMetadata& metadata,
+                    std::string_view object_key = {});
+
+    // Report the transfer of a read to a load-aware allocation strategy
+    void RecordReadLoad(const Replica::Descriptor& replica);
+
+    // Shared body of ExistKey for both the shared and exclusive paths
+    tl::expected<bool, ErrorCode> CheckExist(const std::string& key,
+                                             const ObjectMetadata& metadata);
+
+    // Shared body of BatchTouch for both the shared and exclusive paths
+    tl::expected<void, ErrorCode> TouchObject(const std::string& key,
+                                              const ObjectMetadata& metadata,
+                                              uint64_t ttl_ms,
+                                              uint64_t next_use_ms);
+
+    // Add key to result if it is readable, false if the prefix ends there
+    bool MatchPrefixKey(const std::string& key, const ObjectMetadata& metadata,
+                        bool with_replicas, PrefixMatchResult& result,
+                        std::string_view object_key = {});
+
+    // The complete replicas of a readable object, for follower masters
+    static std::vector<Replica::Descriptor> FollowerReplicas(
+        const ObjectMetadata& metadata);
+
     friend class MetadataAccessor;
+    friend class MetadataReadAccessor;
 
     ViewVersionId view_version_;
+    // Incremented by ClearInvalidHandles, see GetReplicaCacheInfo
+    std::atomic<uint64_t> replica_version_{0};
+    // Keys changed under an exclusive shard lock, tailed by follower masters.
+    // Reset by the bulk changes of ClearInvalidHandles and RemoveAll.
+    MetadataChangeLog change_log_;
+
+    // Filter of all keys last built by GetKeyFilter, covering the changes up
+    // to key_filter_seq_
+    Mutex key_filter_mutex_;
+    std::optional<KeyFilter> key_filter_ GUARDED_BY(key_filter_mutex_);
+    uint64_t key_filter_seq_ GUARDED_BY(key_filter_mutex_) = 0;
+    std::chrono::steady_clock::time_point key_filter_built_
+        GUARDED_BY(key_filter_mutex_);
+    void RebuildKeyFilter() REQUIRES(key_filter_mutex_);
 
     // Client related members
     mutable std::shared_mutex client_mutex_;
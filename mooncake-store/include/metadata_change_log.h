@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "mutex.h"
+
+namespace mooncake {
+
+/**
+ * @brief Keys whose metadata changed on the master, in order, tailed by
+ * follower masters
+ *
+ * Every change gets the next sequence number. Only keys are kept: the
+ * followers get the current state of the changed keys, so changes of the
+ * same key merge and a key read after its change is always up to date.
+ * Nothing is recorded until Enable(), so masters without followers only pay
+ * an atomic load per change. At most capacity changes are kept; a follower
+ * that falls further behind, or that asks across a Reset(), has to reload
+ * the whole metadata.
+ *
+ * All methods are thread-safe.
+ */
+class MetadataChangeLog {
+   public:
+    static constexpr size_t kDefaultCapacity = 256 * 1024;
+
+    explicit MetadataChangeLog(size_t capacity = kDefaultCapacity);
+
+    MetadataChangeLog(const MetadataChangeLog&) = delete;
+    MetadataChangeLog& operator=(const MetadataChangeLog&) = delete;
+
+    // Start recording, if not yet. The changes before are unknown.
+    void Enable();
+
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+    void Record(std::string_view key);
+
+    // Forget the changes so far, e.g. after the metadata changed in bulk
+    void Reset();
+
+    /**
+     * @brief The keys changed after seq, oldest first
+     * @param max_keys Most keys to return
+     * @param next_seq Output, the sequence number to continue from
+     * @return False if the changes after seq are unknown, next_seq is then
+     * the current sequence number
+     */
+    bool Since(uint64_t seq, size_t max_keys, std::vector<std::string>& keys,
+               uint64_t& next_seq) const;
+
+    // The last assigned sequence number
+    uint64_t seq() const;
+
+   private:
+    const size_t capacity_;
+    std::atomic<bool> enabled_{false};
+    mutable Mutex mutex_;
+    std::deque<std::pair<uint64_t, std::string>> changes_ GUARDED_BY(mutex_);
+    // Last assigned sequence number
+    uint64_t seq_ GUARDED_BY(mutex_) = 0;
+    // The changes up to this one are unknown
+    uint64_t reset_seq_ GUARDED_BY(mutex_) = 0;
+};
+
+}  // namespace mooncake
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "key_hash.h"
+#include "master_client.h"
+#include "mutex.h"
+#include "types.h"
+
+namespace mooncake {
+
+/**
+ * @brief Read-only copy of the metadata of a master, serving ExistKey and
+ * GetReplicaList off the master
+ *
+ * A sync thread polls the master's change log (GetMetadataChanges) and
+ * applies the current state of the changed objects; when the log cannot
+ * tell what changed it reloads everything through GetMetadataSnapshot.
+ *
+ * The copy lags behind the master, so a replica list is only returned while
+ * the follower holds a lease on the object: the master neither evicts nor
+ * removes it before the lease expires, which makes the list as safe to use
+ * as one from the master. A list is returned only with at least half of the
+ * lease left, so callers must count on half of the lease only. Leases are
+ * requested from the master in batches by the sync thread, for the objects
+ * that were asked for, and renewed once a quarter of the lease has passed.
+ * Whatever the follower cannot answer safely fails with RPC_FAIL, and the
+ * client asks the master instead: an object without a valid lease, and a
+ * missing object when the copy is older than max_staleness.
+ */
+class MetadataFollower {
+   public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr uint64_t kMaxChangesPerPoll = 8192;
+    static constexpr auto kPollInterval = std::chrono::milliseconds(10);
+
+    MetadataFollower(std::string master_address,
+                     std::chrono::milliseconds max_staleness);
+    ~MetadataFollower();
+
+    MetadataFollower(const MetadataFollower&) = delete;
+    MetadataFollower& operator=(const MetadataFollower&) = delete;
+
+    // Start the sync thread, which connects to the master and retries until
+    // it succeeds
+    void Start();
+
+    void Stop();
+
+    tl::expected<bool, ErrorCode> ExistKey(const std::string& key);
+
+    std::vector<tl::expected<bool, ErrorCode>> BatchExistKey(
+        const std::vector<std::string>& keys);
+
+    tl::expected<std::vector<Replica::Descriptor>, ErrorCode> GetReplicaList(
+        const std::string& key);
+
+    std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+    BatchGetReplicaList(const std::vector<std::string>& keys);
+
+    size_t size() const;
+
+    /**
+     * @brief Moves the copy out, for a master taking over from the followed
+     * one, see MasterService::RestoreMetadata. Call after Stop.
+     * @return nullopt unless the copy had all the changes of the master
+     * within max_lag before now
+     */
+    std::optional<std::vector<MetadataEntry>> Export(Clock::duration max_lag);
+
+   private:
+    static constexpr size_t kNumShards = 64;
+    // Most keys per lease request
+    static constexpr size_t kMaxLeaseBatch = 1024;
+
+    struct Entry {
+        std::vector<Replica::Descriptor> replicas;
+        // End of the lease the follower holds on the object, counted from
+        // before the lease was requested
+        std::atomic<Clock::rep> lease_until{0};
+        // A lease request for the object is queued
+        std::atomic<bool> lease_pending{false};
+    };
+
+    struct Shard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::string, Entry, KeyHasher> entries;
+    };
+
+    Shard& ShardOf(const std::string& key) {
+        return shards_[KeyHash(key) % kNumShards];
+    }
+
+    // Replicas of key; with need_lease only while the lease is valid
+    tl::expected<std::vector<Replica::Descriptor>, ErrorCode> Lookup(
+        const std::string& key, bool need_lease);
+
+    // Queue a lease request for entry unless one is queued already
+    void RequestLease(const std::string& key, Entry& entry);
+
+    // Whether the copy was in sync with the master within max_staleness_
+    bool Fresh() const;
+
+    void SyncThreadFunc();
+    // Pull the changes of the master, false on failure
+    bool Sync();
+    bool Resync();
+    void Apply(std::vector<MetadataEntry>& entries);
+    void Clear();
+    void GrantLeases();
+
+    const std::string master_address_;
+    const std::chrono::milliseconds max_staleness_;
+    MasterClient master_;
+    std::array<Shard, kNumShards> shards_;
+
+    // Sync thread only
+    bool connected_ = false;
+    uint64_t seq_ = 0;
+
+    // Lease granted by the master, 0 until connected
+    std::atomic<uint64_t> lease_ttl_ms_{0};
+
+    // When the copy was last known to have all the changes of the master,
+    // 0 before the first sync
+    std::atomic<Clock::rep> synced_at_{0};
+
+    Mutex lease_mutex_;
+    std::vector<std::string> lease_requests_ GUARDED_BY(lease_mutex_);
+
+    std::atomic<bool> running_{false};
+    std::thread sync_thread_;
+};
+
+}  // namespace mooncake
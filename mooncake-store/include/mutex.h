@@ -1,7 +1,10 @@
 #ifndef THREAD_SAFETY_ANALYSIS_MUTEX_H
 #define THREAD_SAFETY_ANALYSIS_MUTEX_H
 
+#include <chrono>
+#include <cstdint>
 #include <mutex>
+#include <shared_mutex>
 
 // Enable thread safety attributes only with clang.
 // The attributes can be safely erased when compiling with other compilers.
@@ -34,9 +37,21 @@
 #define RELEASE(...) \
     THREAD_ANNOTATION_ATTRIBUTE__(release_capability(__VA_ARGS__))
 
+#define ACQUIRE_SHARED(...) \
+    THREAD_ANNOTATION_ATTRIBUTE__(acquire_shared_capability(__VA_ARGS__))
+
+#define RELEASE_SHARED(...) \
+    THREAD_ANNOTATION_ATTRIBUTE__(release_shared_capability(__VA_ARGS__))
+
 #define TRY_ACQUIRE(...) \
     THREAD_ANNOTATION_ATTRIBUTE__(try_acquire_capability(__VA_ARGS__))
 
+#define TRY_ACQUIRE_SHARED(...) \
+    THREAD_ANNOTATION_ATTRIBUTE__(try_acquire_shared_capability(__VA_ARGS__))
+
+#define REQUIRES_SHARED(...) \
+    THREAD_ANNOTATION_ATTRIBUTE__(requires_shared_capability(__VA_ARGS__))
+
 #define EXCLUDES(...) THREAD_ANNOTATION_ATTRIBUTE__(locks_excluded(__VA_ARGS__))
 
 #define ASSERT_CAPABILITY(x) THREAD_ANNOTATION_ATTRIBUTE__(assert_capability(x))
@@ -99,4 +114,105 @@ class SCOPED_CAPABILITY MutexLocker {
     }
 };
 
+// Reader-writer mutex using std::shared_mutex. Readers holding the lock in
+// shared mode do not block each other.
+class CAPABILITY("mutex") SharedMutex {
+   private:
+    std::shared_mutex mutex_;
+
+   public:
+    // Acquire/lock this mutex exclusively.
+    void lock() ACQUIRE() { mutex_.lock(); }
+
+    // Release/unlock the mutex from exclusive mode.
+    void unlock() RELEASE() { mutex_.unlock(); }
+
+    // Try to acquire the mutex exclusively.
+    bool try_lock() TRY_ACQUIRE(true) { return mutex_.try_lock(); }
+
+    // Acquire/lock this mutex in shared mode.
+    void lock_shared() ACQUIRE_SHARED() { mutex_.lock_shared(); }
+
+    // Release/unlock the mutex from shared mode.
+    void unlock_shared() RELEASE_SHARED() { mutex_.unlock_shared(); }
+
+    // Try to acquire the mutex in shared mode.
+    bool try_lock_shared() TRY_ACQUIRE_SHARED(true) {
+        return mutex_.try_lock_shared();
+    }
+
+    // For negative capabilities.
+    const SharedMutex &operator!() const { return *this; }
+};
+
+// Tag type to request a shared lock from SharedMutexLocker.
+struct shared_lock_t {
+    explicit shared_lock_t() = default;
+};
+inline constexpr shared_lock_t shared_lock{};
+
+// SharedMutexLocker is an RAII class that acquires a SharedMutex either
+// exclusively or in shared mode, and releases it in its destructor. If
+// contended is not null, it is set to true when the lock could not be
+// acquired without waiting, so callers can export contention metrics. If
+// wait_ns is not null, it is set to the nanoseconds spent waiting then; the
+// clock is only read on that slow path.
+class SCOPED_CAPABILITY SharedMutexLocker {
+   private:
+    SharedMutex *mut;
+    bool shared;
+
+   public:
+    // Acquire mu exclusively.
+    explicit SharedMutexLocker(SharedMutex *mu, bool *contended = nullptr,
+                               int64_t *wait_ns = nullptr) ACQUIRE(mu)
+        : mut(mu), shared(false) {
+        if (!mu->try_lock()) {
+            if (contended) {
+                *contended = true;
+            }
+            std::chrono::steady_clock::time_point start;
+            if (wait_ns) {
+                start = std::chrono::steady_clock::now();
+            }
+            mu->lock();
+            if (wait_ns) {
+                *wait_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+            }
+        }
+    }
+
+    // Acquire mu in shared mode.
+    SharedMutexLocker(SharedMutex *mu, shared_lock_t, bool *contended = nullptr,
+                      int64_t *wait_ns = nullptr) ACQUIRE_SHARED(mu)
+        : mut(mu), shared(true) {
+        if (!mu->try_lock_shared()) {
+            if (contended) {
+                *contended = true;
+            }
+            std::chrono::steady_clock::time_point start;
+            if (wait_ns) {
+                start = std::chrono::steady_clock::now();
+            }
+            mu->lock_shared();
+            if (wait_ns) {
+                *wait_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+            }
+        }
+    }
+
+    // Release *this and the associated mutex.
+    ~SharedMutexLocker() RELEASE() {
+        if (shared) {
+            mut->unlock_shared();
+        } else {
+            mut->unlock();
+        }
+    }
+};
+
 #endif  // THREAD_SAFETY_ANALYSIS_MUTEX_H
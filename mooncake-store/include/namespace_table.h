@@ -0,0 +1,141 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace mooncake {
+
+struct NamespaceQuota {
+    // Most bytes of objects in memory, 0 for no cap
+    uint64_t capacity = 0;
+    // Share of the space relative to the other namespaces when they
+    // contend for it
+    double weight = 1.0;
+};
+
+struct NamespaceConfig {
+    // Ends the namespace at the start of a key, e.g. with "/" the key
+    // "tenant-a/block-1" is in namespace "tenant-a". Empty disables
+    // namespaces.
+    std::string delimiter;
+    // Keys of a namespace not listed here, or without the delimiter, are in
+    // NamespaceTable::kDefaultNamespace, which may be listed too
+    std::unordered_map<std::string, NamespaceQuota> quotas;
+
+    bool enabled() const { return !delimiter.empty(); }
+
+    /**
+     * @brief Adds the quotas of a spec like "tenant-a:1073741824:2,
+     * tenant-b:0", each namespace with its capacity in bytes and an
+     * optional weight
+     * @return false if the spec is malformed
+     */
+    bool ParseQuotas(std::string_view spec);
+};
+
+/**
+ * @brief Tracks the memory used by the objects of each namespace, so that
+ * tenants sharing the store are kept to their quotas and to their fair
+ * share of it.
+ *
+ * An object is charged its value size while it has a memory replica, once
+ * whatever the number of replicas. The set of namespaces is fixed at
+ * construction, lookups take no lock.
+ */
+class NamespaceTable {
+   public:
+    static constexpr std::string_view kDefaultNamespace = "default";
+
+    class Usage {
+       public:
+        const std::string& name() const { return name_; }
+        // Position in the table, from 0
+        size_t index() const { return index_; }
+        const NamespaceQuota& quota() const { return quota_; }
+        uint64_t bytes() const {
+            return bytes_.load(std::memory_order_relaxed);
+        }
+        // As of the last UpdateShares
+        uint64_t share() const {
+            return share_.load(std::memory_order_relaxed);
+        }
+        uint64_t excess() const {
+            const uint64_t used = bytes();
+            const uint64_t fair = share();
+            return used > fair ? used - fair : 0;
+        }
+
+       private:
+        friend class NamespaceTable;
+
+        std::string name_;
+        size_t index_ = 0;
+        NamespaceQuota quota_;
+        std::atomic<uint64_t> bytes_{0};
+        std::atomic<uint64_t> share_{UINT64_MAX};
+    };
+
+    explicit NamespaceTable(const NamespaceConfig& config);
+
+    NamespaceTable(const NamespaceTable&) = delete;
+    NamespaceTable& operator=(const NamespaceTable&) = delete;
+
+    bool enabled() const { return !delimiter_.empty(); }
+
+    /**
+     * @brief Usage of the namespace of key, null when namespaces are
+     * disabled
+     */
+    Usage* Find(std::string_view key) const;
+
+    // Names of the namespaces in the order of their index
+    std::vector<std::string> Names() const;
+
+    // Whether size more bytes fit in the capacity of usage. Null has room.
+    static bool HasRoom(const Usage* usage, uint64_t size) {
+        return !usage || usage->quota_.capacity == 0 ||
+               usage->bytes() + size <= usage->quota_.capacity;
+    }
+
+    static void Charge(Usage* usage, uint64_t size) {
+        if (usage) {
+            usage->bytes_.fetch_add(size, std::memory_order_relaxed);
+        }
+    }
+
+    static void Release(Usage* usage, uint64_t size) {
+        if (usage) {
+            usage->bytes_.fetch_sub(size, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Shares space bytes out among the namespaces by weighted
+     * max-min fairness: those using less than their weighted part keep
+     * what they use and the rest is split among the others. A namespace
+     * never gets more than watermark_ratio of its capacity, so that it
+     * makes room for its own puts before they are refused.
+     * @return The bytes used above their share by all namespaces
+     */
+    uint64_t UpdateShares(uint64_t space, double watermark_ratio);
+
+    template <typename Fn>
+    void ForEach(Fn&& fn) const {
+        for (const auto& usage : usages_) {
+            fn(*usage);
+        }
+    }
+
+   private:
+    const std::string delimiter_;
+    std::vector<std::unique_ptr<Usage>> usages_;
+    std::unordered_map<std::string_view, Usage*> by_name_;
+    Usage* default_ = nullptr;
+};
+
+}  // namespace mooncake
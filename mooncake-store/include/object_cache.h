@@ -0,0 +1,86 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "types.h"
+
+namespace mooncake {
+
+/**
+ * @brief Client-side cache of the values of recently read objects
+ *
+ * Like ReplicaCache, an entry is only valid for the lease granted by the
+ * read that filled it: the master neither removes nor overwrites an object
+ * while it is leased. The owner invalidates an entry when it removes the
+ * key or a read of it fails, and clears the cache when the master changes.
+ *
+ * A value is admitted on its admit_reads-th read, so objects read once do
+ * not push out the hot ones. Holds at most capacity_bytes of values,
+ * dropping the least recently used ones when full. All methods are
+ * thread-safe.
+ */
+class ObjectCache {
+   public:
+    using Clock = std::chrono::steady_clock;
+
+    ObjectCache(size_t capacity_bytes, uint32_t admit_reads);
+
+    ObjectCache(const ObjectCache&) = delete;
+    ObjectCache& operator=(const ObjectCache&) = delete;
+
+    // Copy the unexpired value of key into slices, if cached with their size
+    bool Get(const ObjectKey& key, std::vector<Slice>& slices);
+
+    /**
+     * @brief Record a read of key, caching the value in slices until expiry
+     * once the key was read often enough
+     * @param generation Value of generation() taken before the read; the
+     * value is dropped if the cache was cleared since
+     */
+    void Put(const ObjectKey& key, const std::vector<Slice>& slices,
+             Clock::time_point expiry, uint64_t generation);
+
+    void Invalidate(const ObjectKey& key);
+
+    void Clear();
+
+    uint64_t generation() const;
+    size_t size_bytes() const;
+
+    uint64_t hits() const;
+    uint64_t misses() const;
+
+   private:
+    struct Entry {
+        std::string value;
+        Clock::time_point expiry;
+        std::list<ObjectKey>::iterator lru_it;
+    };
+
+    // Called with mutex_ held
+    void Erase(std::unordered_map<ObjectKey, Entry>::iterator it);
+    // Count a read of key, true once it reached admit_reads_
+    bool CountRead(const ObjectKey& key);
+
+    const size_t capacity_bytes_;
+    const uint32_t admit_reads_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<ObjectKey, Entry> entries_;
+    std::list<ObjectKey> lru_;  // Most recently used first
+    size_t size_bytes_ = 0;
+    // Reads of keys not cached yet, halved when it tracks too many keys
+    std::unordered_map<ObjectKey, uint32_t> read_counts_;
+    // Incremented whenever the whole cache is cleared
+    uint64_t generation_ = 0;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+};
+
+}  // namespace mooncake
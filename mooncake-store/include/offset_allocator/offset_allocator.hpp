@@ -2,8 +2,10 @@
 // (C) Sebastian Aaltonen 2023
 // MIT License (see file: LICENSE)
 
+#include <array>
 #include <memory>
 #include <optional>
+#include <vector>
 
 #include "mutex.h"
 
@@ -75,6 +77,11 @@ class OffsetAllocationHandle {
     // Get size
     uint64_t size() const { return requested_size; }
 
+    // Give up the allocation without freeing it, e.g. to keep it in less
+    // space than the handle takes. OffsetAllocator::adopt makes a handle of
+    // it again.
+    OffsetAllocation release();
+
    private:
     std::weak_ptr<OffsetAllocator> m_allocator;
     // The offset in m_allocation may not be equal to the real offset.
@@ -92,11 +99,20 @@ class OffsetAllocationHandle {
 // no difference when the allocated size is equal to a bin size, c) largely
 // improve the memory utilization ratio when the allocated size is mostly
 // uniform and not equal to any bin size.
+//
+// With enableThreadCache, freed blocks of the bins up to kMaxCachedSize are
+// kept in caches picked by the calling thread, so that allocating and freeing
+// common sizes from many threads mostly takes the lock of one cache instead
+// of the central m_mutex. A cache returns half of a bin to the central
+// allocator once it holds more than kCachedBlocksPerBin blocks of it, and
+// all caches are drained before an allocation fails. Cached blocks count as
+// allocated in the storage reports.
 class OffsetAllocator : public std::enable_shared_from_this<OffsetAllocator> {
    public:
     // Factory method to create shared_ptr<OffsetAllocator>
-    static std::shared_ptr<OffsetAllocator> create(uint64_t base, size_t size,
-                                             uint32 maxAllocs = 128 * 1024);
+    static std::shared_ptr<OffsetAllocator> create(
+        uint64_t base, size_t size, uint32 maxAllocs = 128 * 1024,
+        bool enableThreadCache = false);
 
     // Disable copy constructor and copy assignment
     OffsetAllocator(const OffsetAllocator&) = delete;
@@ -113,6 +129,18 @@ class OffsetAllocator : public std::enable_shared_from_this<OffsetAllocator> {
     [[nodiscard]]
     std::optional<OffsetAllocationHandle> allocate(size_t size);
 
+    // Allocate size bytes at address, e.g. to restore an allocation made
+    // by another allocator over the same range (thread-safe). Fails if the
+    // range is not free or address is not aligned to the allocation unit.
+    [[nodiscard]]
+    std::optional<OffsetAllocationHandle> allocateAt(uint64_t address,
+                                                     size_t size);
+
+    // Handle of an allocation of size bytes given up by
+    // OffsetAllocationHandle::release, freeing it once destroyed
+    [[nodiscard]]
+    OffsetAllocationHandle adopt(OffsetAllocation allocation, size_t size);
+
     // Get storage report (thread-safe)
     [[nodiscard]]
     OffsetAllocStorageReport storageReport() const;
@@ -124,8 +152,27 @@ class OffsetAllocator : public std::enable_shared_from_this<OffsetAllocator> {
    private:
     friend class OffsetAllocationHandle;
 
-    // Internal method for Handle to free allocation (thread-safe)
-    void freeAllocation(const OffsetAllocation& allocation);
+    static constexpr uint32 kThreadCaches = 16;
+    // Largest cached bin size, in units of m_multiplier bytes
+    static constexpr uint32 kMaxCachedSize = 4 * 1024 * 1024;
+    static constexpr uint32 kCachedBlocksPerBin = 16;
+
+    struct ThreadCache {
+        Mutex mutex;
+        // Freed blocks by bin index, only bins up to kMaxCachedSize are used
+        std::array<std::vector<OffsetAllocation>, NUM_LEAF_BINS> bins
+            GUARDED_BY(mutex);
+    };
+
+    // Internal method for Handle to free allocation (thread-safe), size is
+    // the requested size of the allocation
+    void freeAllocation(const OffsetAllocation& allocation, uint64_t size);
+
+    // Cache of the calling thread
+    ThreadCache& threadCache();
+
+    // Return every cached block to m_allocator, false if there were none
+    bool drainThreadCaches();
 
     std::unique_ptr<__Allocator> m_allocator GUARDED_BY(m_mutex);
     const uint64_t m_base;
@@ -133,9 +180,12 @@ class OffsetAllocator : public std::enable_shared_from_this<OffsetAllocator> {
     // m_multiplier
     const uint64_t m_multiplier;
     mutable Mutex m_mutex;
+    // Null unless enableThreadCache
+    std::unique_ptr<ThreadCache[]> m_threadCaches;
 
     // Private constructor - use create() factory method instead
-    OffsetAllocator(uint64_t base, size_t size, uint32 maxAllocs = 128 * 1024);
+    OffsetAllocator(uint64_t base, size_t size, uint32 maxAllocs = 128 * 1024,
+                    bool enableThreadCache = false);
 };
 
 class __Allocator {
@@ -146,6 +196,8 @@ class __Allocator {
      void reset();
  
      OffsetAllocation allocate(uint32 size);
+     // Allocate size at offset, which must be within a free region
+     OffsetAllocation allocateAt(uint32 offset, uint32 size);
      void free(OffsetAllocation allocation);
  
      uint32 allocationSize(OffsetAllocation allocation) const;
@@ -0,0 +1,370 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "master_client.h"
+#include "types.h"
+
+namespace mooncake {
+
+/**
+ * @brief Client for a mooncake master service whose metadata is partitioned
+ * by key hash over several active masters, each of which may be an HA group
+ * of its own. Every key is served by one partition; batch calls are split
+ * per partition and the parts run in parallel. Segments are shared by all the
+ * partitions: each one is split into one range per partition, so that the
+ * masters allocate from disjoint memory. With a single partition every call
+ * goes straight to its MasterClient.
+ */
+class PartitionedMasterClient {
+   public:
+    PartitionedMasterClient();
+    ~PartitionedMasterClient();
+
+    PartitionedMasterClient(const PartitionedMasterClient&) = delete;
+    PartitionedMasterClient& operator=(const PartitionedMasterClient&) =
+        delete;
+
+    /**
+     * @brief Partition serving key among partition_num partitions. The hash
+     * does not depend on the process or the build, as all clients must route
+     * alike.
+     */
+    static size_t PartitionOf(const std::string& key, size_t partition_num);
+
+    /**
+     * @brief Splits segment into partition_num ranges of equal size aligned
+     * to Slab::kSize, the one of partition i starting at base + i * size.
+     * The tail left by the rounding is not used. Empty if the segment is too
+     * small to give every partition a slab.
+     */
+    static std::vector<Segment> SplitSegment(const Segment& segment,
+                                             size_t partition_num);
+
+    /**
+     * @brief Connects to the masters of all partitions. The first call sets
+     * the number of partitions, it must be made before the client is used by
+     * other threads.
+     * @param master_addrs Master address of each partition, in order
+     * @return ErrorCode indicating success/failure
+     */
+    [[nodiscard]] ErrorCode Connect(
+        const std::vector<std::string>& master_addrs);
+
+    /**
+     * @brief Reconnects one partition, e.g. after its master failed over
+     */
+    [[nodiscard]] ErrorCode Connect(size_t partition,
+                                    const std::string& master_addr);
+
+    size_t partition_num() const { return partitions_.size(); }
+
+    /**
+     * @brief See MasterClient::EnableCoalescing, applies to every partition
+     */
+    void EnableCoalescing(std::chrono::microseconds window, size_t max_keys);
+
+    /**
+     * @brief See MasterClient::EnableFollowers, follower_addrs[i] lists the
+     * followers of partition i. Must be called after Connect.
+     * @return The number of followers connected to
+     */
+    size_t EnableFollowers(
+        const std::vector<std::vector<std::string>>& follower_addrs);
+
+    /**
+     * @brief See MasterClient::EnableRdma, applies to every partition. Must
+     * be called before Connect.
+     */
+    bool EnableRdma();
+
+    /**
+     * @brief See MasterClient::SetConnections, applies to every partition.
+     * Must be called before Connect.
+     */
+    void SetConnections(size_t connection_num,
+                        MasterClient::ConnectionSelection selection);
+
+    /**
+     * @brief Retry up to max_retries times the reads and writes that a
+     * master sheds with MASTER_BUSY, after a random wait of up to
+     * base_backoff, doubled on each retry, so that the clients shed
+     * together do not come back together. Coroutine calls are not
+     * retried. Must be called before the client is used by other threads.
+     */
+    void SetBusyRetry(int max_retries, std::chrono::microseconds base_backoff);
+
+    /**
+     * @brief Requests in flight on each connection of each partition
+     */
+    std::vector<std::vector<int64_t>> GetInFlightRequests() const;
+
+    [[nodiscard]] tl::expected<bool, ErrorCode> ExistKey(
+        const std::string& object_key);
+
+    [[nodiscard]] std::vector<tl::expected<bool, ErrorCode>> BatchExistKey(
+        const std::vector<std::string>& object_keys);
+
+    [[nodiscard]] std::vector<tl::expected<void, ErrorCode>> BatchTouch(
+        const std::vector<std::string>& object_keys, uint64_t ttl_ms,
+        uint64_t next_use_ms = 0);
+
+    /**
+     * @brief Counts the leading keys that exist and are complete. Each
+     * partition matches its own keys in order, the prefix ends at the first
+     * key its partition did not match.
+     */
+    [[nodiscard]] tl::expected<PrefixMatchResult, ErrorCode>
+    LongestPrefixMatch(const std::vector<std::string>& object_keys,
+                       bool with_replicas);
+
+    /**
+     * @brief Tells which segments hold each key. Each partition locates its
+     * own keys; their segment dictionaries are merged and the prefix hits
+     * counted over all the keys.
+     */
+    [[nodiscard]] tl::expected<KeyLocationResult, ErrorCode>
+    BatchQueryLocation(const std::vector<std::string>& object_keys,
+                       bool with_prefix_hits);
+
+    /**
+     * @brief Scans the partitions one after the other, the cursor names the
+     * partition. A page ends with the partition, so it may hold fewer than
+     * limit keys before the scan is over.
+     */
+    [[nodiscard]] tl::expected<KeyScanResult, ErrorCode> ScanKeys(
+        const std::string& prefix, const std::string& cursor, uint64_t limit);
+
+    [[nodiscard]] tl::expected<std::vector<Replica::Descriptor>, ErrorCode>
+    GetReplicaList(const std::string& object_key);
+
+    [[nodiscard]] tl::expected<std::vector<Replica::Descriptor>, ErrorCode>
+    GetLeaderReplicaList(const std::string& object_key);
+
+    [[nodiscard]]
+    std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+    BatchGetReplicaList(const std::vector<std::string>& object_keys);
+
+    [[nodiscard]] tl::expected<std::vector<Replica::Descriptor>, ErrorCode>
+    PutStart(const std::string& key, const std::vector<size_t>& slice_lengths,
+             const ReplicateConfig& config);
+
+    [[nodiscard]] std::vector<
+        tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+    BatchPutStart(const std::vector<std::string>& keys,
+                  const std::vector<std::vector<uint64_t>>& slice_lengths,
+                  const ReplicateConfig& config);
+
+    [[nodiscard]] tl::expected<void, ErrorCode> PutEnd(const std::string& key);
+
+    [[nodiscard]] std::vector<tl::expected<void, ErrorCode>> BatchPutEnd(
+        const std::vector<std::string>& keys);
+
+    [[nodiscard]] tl::expected<void, ErrorCode> PutRevoke(
+        const std::string& key);
+
+    /**
+     * @brief See MasterClient::CoGetReplicaList and the others, sent to the
+     * partition of the key
+     */
+    [[nodiscard]] coro::Lazy<
+        tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+    CoGetReplicaList(std::string object_key);
+
+    [[nodiscard]] coro::Lazy<
+        tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+    CoPutStart(std::string key, std::vector<size_t> slice_lengths,
+               ReplicateConfig config);
+
+    [[nodiscard]] coro::Lazy<tl::expected<void, ErrorCode>> CoPutEnd(
+        std::string key);
+
+    [[nodiscard]] coro::Lazy<tl::expected<void, ErrorCode>> CoPutRevoke(
+        std::string key);
+
+    [[nodiscard]] std::vector<tl::expected<void, ErrorCode>> BatchPutRevoke(
+        const std::vector<std::string>& keys);
+
+    [[nodiscard]] tl::expected<void, ErrorCode> PutInline(
+        const std::string& key, const std::string& value,
+        const ReplicateConfig& config);
+
+    [[nodiscard]] tl::expected<void, ErrorCode> PutDiskReplica(
+        const std::string& key, const DiskDescriptor& disk);
+
+    [[nodiscard]] std::vector<tl::expected<void, ErrorCode>>
+    BatchPutDiskReplica(const std::vector<std::string>& keys,
+                        const std::vector<DiskDescriptor>& disks);
+
+    [[nodiscard]] tl::expected<std::vector<Replica::Descriptor>, ErrorCode>
+    PromoteStart(const std::string& key,
+                 const std::vector<size_t>& slice_lengths,
+                 const ReplicateConfig& config);
+
+    /**
+     * @brief Asks the partitions in turn for a relocation, starting from a
+     * different one on each call
+     */
+    [[nodiscard]] tl::expected<CompactionTask, ErrorCode> CompactionStart(
+        const std::string& segment_name);
+
+    [[nodiscard]] tl::expected<void, ErrorCode> CompactionEnd(
+        const std::string& key, uint64_t target);
+
+    [[nodiscard]] tl::expected<void, ErrorCode> CompactionRevoke(
+        const std::string& key, uint64_t target);
+
+    [[nodiscard]] tl::expected<void, ErrorCode> CopyReplica(
+        const std::string& key, const std::string& target_segment);
+
+    [[nodiscard]] tl::expected<void, ErrorCode> MigrateReplica(
+        const std::string& key, const std::string& source_segment,
+        const std::string& target_segment);
+
+    [[nodiscard]] tl::expected<uint64_t, ErrorCode> Broadcast(
+        const std::string& key,
+        const std::vector<std::string>& target_segments);
+
+    [[nodiscard]] std::vector<tl::expected<void, ErrorCode>> Prefetch(
+        const std::vector<std::string>& keys,
+        const std::string& target_segment);
+
+    [[nodiscard]] std::vector<tl::expected<bool, ErrorCode>> CancelPrefetch(
+        const std::vector<std::string>& keys,
+        const std::string& target_segment);
+
+    [[nodiscard]] tl::expected<void, ErrorCode> Remove(const std::string& key);
+
+    /**
+     * @brief Removes all objects of all partitions
+     * @return tl::expected<long, ErrorCode> total number of removed objects
+     */
+    [[nodiscard]] tl::expected<long, ErrorCode> RemoveAll();
+
+    /**
+     * @brief Removes the objects of all partitions put with tag
+     * @return tl::expected<long, ErrorCode> total number of objects queued
+     * for removal
+     */
+    [[nodiscard]] tl::expected<long, ErrorCode> RemoveByTag(
+        const std::string& tag);
+
+    /**
+     * @brief Removes the objects of all partitions whose key starts with
+     * prefix
+     * @return tl::expected<long, ErrorCode> total number of removed objects
+     */
+    [[nodiscard]] tl::expected<long, ErrorCode> RemoveByPrefix(
+        const std::string& prefix);
+
+    /**
+     * @brief Mounts one range of segment on each partition
+     */
+    [[nodiscard]] tl::expected<void, ErrorCode> MountSegment(
+        const Segment& segment, const UUID& client_id);
+
+    [[nodiscard]] tl::expected<void, ErrorCode> ReMountSegment(
+        const std::vector<Segment>& segments, const UUID& client_id);
+
+    [[nodiscard]] tl::expected<void, ErrorCode> UnmountSegment(
+        const UUID& segment_id, const UUID& client_id);
+
+    /**
+     * @brief Drains the range of the segment on every partition
+     */
+    [[nodiscard]] tl::expected<void, ErrorCode> DrainSegment(
+        const UUID& segment_id);
+
+    /**
+     * @brief Bytes left on the ranges of the segment of all partitions
+     */
+    [[nodiscard]] tl::expected<uint64_t, ErrorCode> QueryDrain(
+        const UUID& segment_id);
+
+    /**
+     * @brief Attaches to the ranges of the segment of all partitions,
+     * returning the whole segment
+     */
+    [[nodiscard]] tl::expected<Segment, ErrorCode> AttachSegment(
+        const UUID& memory_id, const UUID& client_id);
+
+    [[nodiscard]] tl::expected<void, ErrorCode> DetachSegment(
+        const UUID& memory_id, const UUID& client_id);
+
+    [[nodiscard]] tl::expected<std::string, ErrorCode> GetFsdir();
+
+    /**
+     * @brief The shortest lease of the partitions, and a replica version
+     * that changes whenever the version of one of them does
+     */
+    [[nodiscard]] tl::expected<ReplicaCacheInfo, ErrorCode>
+    GetReplicaCacheInfo();
+
+    /**
+     * @brief See MasterClient::GetKeyFilter. Each partition filters its own
+     * keys, the filter of key is the one of PartitionOf(key).
+     */
+    [[nodiscard]] tl::expected<KeyFilterUpdate, ErrorCode> GetKeyFilter(
+        size_t partition, uint64_t seq);
+
+    /**
+     * @brief See MasterClient::GrantAllocationCredit. A credit covers the
+     * keys of one partition only, the one it was granted by.
+     */
+    [[nodiscard]] tl::expected<AllocationCredit, ErrorCode>
+    GrantAllocationCredit(size_t partition, const UUID& client_id,
+                          uint64_t size);
+
+    [[nodiscard]] std::vector<tl::expected<void, ErrorCode>> CommitCreditPuts(
+        size_t partition, const UUID& client_id, uint64_t credit_id,
+        const std::vector<CreditPut>& puts);
+
+    [[nodiscard]] tl::expected<void, ErrorCode> ReturnAllocationCredit(
+        size_t partition, const UUID& client_id, uint64_t credit_id);
+
+    /**
+     * @brief Pings the masters of all partitions. Fails if one of them does;
+     * the view version changes whenever the one of a partition does, and
+     * NEED_REMOUNT is returned when any partition needs it.
+     */
+    [[nodiscard]] tl::expected<std::pair<ViewVersionId, ClientStatus>,
+                               ErrorCode>
+    Ping(const UUID& client_id);
+
+   private:
+    MasterClient& Route(const std::string& key) {
+        return *partitions_[PartitionOf(key, partitions_.size())];
+    }
+
+    // Splits keys per partition, runs call on each part in parallel and
+    // puts the results back in the order of keys
+    template <typename T, typename Call>
+    std::vector<T> SplitBatch(const std::vector<std::string>& keys,
+                              Call&& call);
+
+    // Calls call again while the master sheds it, see SetBusyRetry
+    template <typename Call>
+    std::invoke_result_t<Call> RetryWhenBusy(Call&& call);
+
+    std::vector<std::unique_ptr<MasterClient>> partitions_;
+    // Set by EnableCoalescing, for the partitions created later
+    std::chrono::microseconds coalesce_window_{0};
+    size_t coalesce_max_keys_{0};
+    // Set by EnableRdma, for the partitions created later
+    bool use_rdma_{false};
+    // Set by SetConnections, for the partitions created later
+    size_t connection_num_{1};
+    MasterClient::ConnectionSelection connection_selection_{
+        MasterClient::ConnectionSelection::ROUND_ROBIN};
+    std::atomic<size_t> next_compaction_partition_{0};
+    // Set by SetBusyRetry
+    int busy_retries_{0};
+    std::chrono::microseconds busy_backoff_{0};
+};
+
+}  // namespace mooncake
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+namespace mooncake {
+
+/**
+ * @brief Encodes object payloads on the client, before they are transferred
+ * to the store, and decodes them after they are read back
+ *
+ * A codec sees the whole payload of an object at once. An encoded payload
+ * starts with a PayloadHeader naming its codec and sizes, so readers decode
+ * it without being told how it was written.
+ */
+class PayloadCodec {
+   public:
+    virtual ~PayloadCodec() = default;
+
+    virtual PayloadCodecId id() const = 0;
+    virtual std::string name() const = 0;
+
+    // Upper bound on the encoded size of size bytes
+    virtual size_t MaxEncodedSize(size_t size) const = 0;
+
+    // Encodes in into out, at least MaxEncodedSize(in.size()) bytes, and
+    // returns the encoded size
+    virtual tl::expected<size_t, ErrorCode> Encode(
+        std::span<const uint8_t> in, std::span<uint8_t> out) const = 0;
+
+    // Decodes in into out, exactly as large as the original payload
+    virtual ErrorCode Decode(std::span<const uint8_t> in,
+                             std::span<uint8_t> out) const = 0;
+};
+
+// The codec with this ID, null for NONE and unknown IDs. Codecs are never
+// unregistered, the pointer stays valid.
+const PayloadCodec* GetPayloadCodec(PayloadCodecId id);
+
+// Adds a codec with an ID of kFirstCustomPayloadCodec or more. Fails with
+// INVALID_PARAMS for other IDs and IDs already registered.
+ErrorCode RegisterPayloadCodec(std::unique_ptr<PayloadCodec> codec);
+
+struct PayloadHeader {
+    static constexpr uint32_t kMagic = 0x43504b4d;  // "MKPC"
+    static constexpr uint8_t kVersion = 1;
+
+    uint32_t magic = kMagic;
+    uint8_t version = kVersion;
+    PayloadCodecId codec = PayloadCodecId::NONE;
+    uint16_t reserved = 0;
+    uint64_t original_size = 0;
+    // Excluding the header
+    uint64_t encoded_size = 0;
+};
+static_assert(sizeof(PayloadHeader) == 24);
+
+// Upper bound on the stored size of size bytes encoded with codec
+size_t MaxEncodedPayloadSize(const PayloadCodec& codec, size_t size);
+
+// Encodes the concatenated slices into out, header included, and returns
+// the stored size
+tl::expected<size_t, ErrorCode> EncodePayload(const PayloadCodec& codec,
+                                              const std::vector<Slice>& slices,
+                                              std::span<uint8_t> out);
+
+// The header of stored_size bytes at data if they are an encoded payload
+// of a registered codec
+std::optional<PayloadHeader> ParsePayloadHeader(const void* data,
+                                                size_t stored_size);
+
+// Decodes an encoded payload into slices, which must hold the original
+// size, and returns that size
+tl::expected<size_t, ErrorCode> DecodePayload(
+    std::span<const uint8_t> encoded, const std::vector<Slice>& slices);
+
+// Decodes the stored_size bytes at buffer in place if they are an encoded
+// payload, and returns the size of the data left in buffer: the original
+// size, or stored_size for data that is not encoded. Fails with
+// BUFFER_OVERFLOW when the original size is over capacity.
+tl::expected<size_t, ErrorCode> DecodePayloadInPlace(void* buffer,
+                                                     size_t stored_size,
+                                                     size_t capacity);
+
+}  // namespace mooncake
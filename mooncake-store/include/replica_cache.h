@@ -0,0 +1,85 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "types.h"
+
+namespace mooncake {
+
+/**
+ * @brief Client-side cache of the replica lists returned by GetReplicaList
+ *
+ * The master does not evict or remove an object while the lease granted by
+ * GetReplicaList is valid, so a replica list can be reused until the lease
+ * expires. Every entry carries that deadline and is dropped once it passes.
+ * Replicas can still disappear within the lease when their segment is
+ * unmounted; the owner invalidates an entry whose transfer fails, and
+ * clears the cache when the master's replica version changes.
+ *
+ * Holds at most capacity entries, dropping the least recently used one
+ * when full. All methods are thread-safe.
+ */
+class ReplicaCache {
+   public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit ReplicaCache(size_t capacity);
+
+    ReplicaCache(const ReplicaCache&) = delete;
+    ReplicaCache& operator=(const ReplicaCache&) = delete;
+
+    // The unexpired replica list of key, if cached, and optionally its expiry
+    std::optional<std::vector<Replica::Descriptor>> Get(
+        const ObjectKey& key, Clock::time_point* expiry = nullptr);
+
+    /**
+     * @brief Cache the replica list of key until expiry
+     * @param generation Value of generation() taken before the replica list
+     * was requested; the entry is dropped if the cache was cleared since
+     */
+    void Put(const ObjectKey& key, std::vector<Replica::Descriptor> replicas,
+             Clock::time_point expiry, uint64_t generation);
+
+    void Invalidate(const ObjectKey& key);
+
+    void Clear();
+
+    // Record the master's replica version, clearing the cache if it changed
+    void SetVersion(uint64_t version);
+
+    uint64_t generation() const;
+    size_t size() const;
+
+    uint64_t hits() const;
+    uint64_t misses() const;
+
+   private:
+    struct Entry {
+        std::vector<Replica::Descriptor> replicas;
+        Clock::time_point expiry;
+        std::list<ObjectKey>::iterator lru_it;
+    };
+
+    // Called with mutex_ held
+    void Erase(std::unordered_map<ObjectKey, Entry>::iterator it);
+
+    const size_t capacity_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<ObjectKey, Entry> entries_;
+    std::list<ObjectKey> lru_;  // Most recently used first
+    // Incremented whenever the whole cache is cleared
+    uint64_t generation_ = 0;
+    std::optional<uint64_t> version_;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+};
+
+}  // namespace mooncake
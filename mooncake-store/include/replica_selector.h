@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "types.h"
+
+namespace mooncake {
+
+/**
+ * @brief Chooses which replica of an object a client reads.
+ *
+ * Complete replicas are ranked by locality first: replicas whose buffers all
+ * live in the client's own segment (read with memcpy), then replicas on
+ * another segment of the same host, then remote memory replicas, and disk
+ * replicas last. Replicas in the same tier are ranked by the expected cost of
+ * the transfer, the recent per-KiB latency of their endpoints scaled by the
+ * transfers still in flight to them, so concurrent readers of a hot object
+ * spread over its copies. Remaining ties keep the master's order.
+ *
+ * The host of a segment is its name without the port, the same default the
+ * client uses for the host label of its own segments. Buffers for which
+ * is_attached returns true, in segments of shared memory the client maps
+ * too, count as local.
+ *
+ * All methods are thread-safe.
+ */
+class ReplicaSelector {
+   public:
+    enum class Locality {
+        LOCAL = 0,      // All buffers in the local segment
+        SAME_HOST = 1,  // All buffers on segments of the local host
+        REMOTE = 2,     // Memory replica on other hosts
+        DISK = 3,       // Replica in the storage backend
+    };
+
+    struct EndpointStats {
+        std::atomic<int64_t> inflight{0};
+        // Exponentially weighted transfer latency, 0 until first measured
+        std::atomic<uint64_t> ns_per_kib{0};
+    };
+
+    /**
+     * @brief Tracks one transfer against the endpoints of a replica. The
+     * transfer counts as in flight until Finish() is called or the ticket
+     * is destroyed; only finished successful transfers update the latency.
+     */
+    class Ticket {
+       public:
+        Ticket() = default;
+        Ticket(std::vector<EndpointStats*> endpoints, uint64_t bytes);
+        ~Ticket();
+
+        Ticket(Ticket&& other) noexcept;
+        Ticket& operator=(Ticket&& other) noexcept;
+        Ticket(const Ticket&) = delete;
+        Ticket& operator=(const Ticket&) = delete;
+
+        void Finish(bool success);
+
+       private:
+        std::vector<EndpointStats*> endpoints_;
+        uint64_t bytes_{0};
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    using AttachedCheck =
+        std::function<bool(const AllocatedBuffer::Descriptor&)>;
+
+    explicit ReplicaSelector(std::string local_hostname,
+                             AttachedCheck is_attached = nullptr);
+
+    /**
+     * @brief Choose the complete replica that is cheapest to read
+     * @return ErrorCode::OK if found, ErrorCode::INVALID_REPLICA if no
+     * replica is complete
+     */
+    ErrorCode Select(const std::vector<Replica::Descriptor>& replica_list,
+                     Replica::Descriptor& replica) const;
+
+    Locality GetLocality(const Replica::Descriptor& replica) const;
+
+    /**
+     * @brief Start tracking a transfer to or from a memory replica
+     */
+    Ticket BeginTransfer(const Replica::Descriptor& replica);
+
+    /**
+     * @brief Expected cost of reading a memory replica, in nanoseconds
+     */
+    uint64_t EstimateCost(const Replica::Descriptor& replica) const;
+
+    // Host part of a segment name
+    static std::string_view HostOf(std::string_view segment_name);
+
+   private:
+    // Weight of a new latency sample, as a right shift: 1/8
+    static constexpr int kEwmaShift = 3;
+
+    const EndpointStats* FindStats(const std::string& segment_name) const;
+    EndpointStats* GetOrCreateStats(const std::string& segment_name);
+
+    const std::string local_hostname_;
+    const std::string local_host_;
+    const AttachedCheck is_attached_;
+
+    mutable std::shared_mutex stats_mutex_;
+    std::unordered_map<std::string, std::unique_ptr<EndpointStats>> stats_;
+};
+
+}  // namespace mooncake
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mooncake {
+
+/**
+ * @brief Merges concurrent single-key requests into batch requests
+ *
+ * The first caller of Submit() opens a batch and waits up to window for
+ * other callers to add their keys, or until max_keys keys are gathered. It
+ * then sends the whole batch with batch_fn and hands every caller the
+ * result at its index. Callers arriving while a batch is being sent open
+ * the next one, so at most one batch gathers keys at a time. There is no
+ * background thread: a caller that finds no one to merge with pays at most
+ * window of extra latency.
+ *
+ * batch_fn must return one result per key; if it does not, every caller of
+ * the batch gets error_result.
+ */
+template <typename Result>
+class RequestCoalescer {
+   public:
+    using BatchFn =
+        std::function<std::vector<Result>(const std::vector<std::string>&)>;
+
+    RequestCoalescer(BatchFn batch_fn, std::chrono::microseconds window,
+                     size_t max_keys, Result error_result)
+        : batch_fn_(std::move(batch_fn)),
+          window_(window),
+          max_keys_(max_keys > 0 ? max_keys : 1),
+          error_result_(std::move(error_result)) {}
+
+    RequestCoalescer(const RequestCoalescer&) = delete;
+    RequestCoalescer& operator=(const RequestCoalescer&) = delete;
+
+    Result Submit(const std::string& key) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (open_) {
+            // Join the batch gathering keys, its opener sends it
+            auto batch = open_;
+            const size_t index = batch->keys.size();
+            batch->keys.push_back(key);
+            if (batch->keys.size() >= max_keys_) {
+                open_.reset();
+                full_cv_.notify_all();
+            }
+            batch->done_cv.wait(lock, [&] { return batch->done; });
+            return std::move(batch->results[index]);
+        }
+
+        auto batch = std::make_shared<Batch>();
+        batch->keys.push_back(key);
+        if (max_keys_ > 1) {
+            open_ = batch;
+            full_cv_.wait_for(lock, window_, [&] { return open_ != batch; });
+            if (open_ == batch) {
+                open_.reset();
+            }
+        }
+        // No caller adds keys once the batch is closed
+        lock.unlock();
+
+        auto results = batch_fn_(batch->keys);
+        if (results.size() != batch->keys.size()) {
+            results.assign(batch->keys.size(), error_result_);
+        }
+
+        lock.lock();
+        batches_++;
+        keys_ += batch->keys.size();
+        batch->results = std::move(results);
+        batch->done = true;
+        batch->done_cv.notify_all();
+        return std::move(batch->results[0]);
+    }
+
+    // Batches sent and keys in them, for tests and logging
+    uint64_t batches() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return batches_;
+    }
+    uint64_t keys() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return keys_;
+    }
+
+   private:
+    struct Batch {
+        std::vector<std::string> keys;
+        std::vector<Result> results;
+        bool done = false;
+        std::condition_variable done_cv;
+    };
+
+    const BatchFn batch_fn_;
+    const std::chrono::microseconds window_;
+    const size_t max_keys_;
+    const Result error_result_;
+
+    mutable std::mutex mutex_;
+    // Wakes the opener of open_ once it is full
+    std::condition_variable full_cv_;
+    // The batch gathering keys, if any
+    std::shared_ptr<Batch> open_;
+    uint64_t batches_ = 0;
+    uint64_t keys_ = 0;
+};
+
+}  // namespace mooncake
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "types.h"
+
+namespace mooncake {
+
+// A timed stage of a traced request
+struct TraceSpan {
+    std::string name;
+    // Spans open when this one started
+    uint32_t depth = 0;
+    // From the start of the trace
+    int64_t offset_us = 0;
+    int64_t duration_us = 0;
+};
+
+struct Trace {
+    uint64_t trace_id = 0;
+    std::string operation;
+    std::string key;
+    // Microseconds since the epoch
+    int64_t start_us = 0;
+    int64_t duration_us = 0;
+    ErrorCode status = ErrorCode::OK;
+    std::vector<TraceSpan> spans;
+};
+
+/**
+ * @brief Samples client requests and keeps the stage timings of the traced
+ * ones in a ring buffer
+ *
+ * A ScopedTrace starts the trace of a request on the calling thread, one in
+ * sample_interval per thread. Code running on that thread for the request,
+ * such as the master RPCs and the transfers, adds its stages with a
+ * ScopedSpan, which costs a thread-local load when the request is not
+ * traced.
+ */
+class RequestTracer {
+   public:
+    /**
+     * @param sample_interval Trace one in this many requests of each
+     * thread, 0 to trace none
+     * @param capacity Finished traces kept, the oldest are dropped
+     */
+    RequestTracer(uint64_t sample_interval, size_t capacity);
+
+    RequestTracer(const RequestTracer&) = delete;
+    RequestTracer& operator=(const RequestTracer&) = delete;
+
+    bool enabled() const { return sample_interval_ > 0; }
+
+    // The kept traces, oldest first
+    std::vector<Trace> Recent() const;
+
+    // The kept traces as one JSON object per line, oldest first
+    std::string Dump() const;
+
+    // The ID of the trace of the calling thread, 0 if none
+    static uint64_t CurrentTraceId();
+
+    class ScopedTrace {
+       public:
+        // tracer may be null, nothing is traced then
+        ScopedTrace(RequestTracer* tracer, std::string_view operation,
+                    std::string_view key);
+        ~ScopedTrace();
+
+        ScopedTrace(const ScopedTrace&) = delete;
+        ScopedTrace& operator=(const ScopedTrace&) = delete;
+
+        void SetStatus(ErrorCode status) {
+            if (tracer_) {
+                trace_.status = status;
+            }
+        }
+
+       private:
+        RequestTracer* tracer_ = nullptr;
+        Trace trace_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    class ScopedSpan {
+       public:
+        // The span is named name, or name:detail with a detail
+        explicit ScopedSpan(std::string_view name,
+                            std::string_view detail = {});
+        ~ScopedSpan();
+
+        ScopedSpan(const ScopedSpan&) = delete;
+        ScopedSpan& operator=(const ScopedSpan&) = delete;
+
+       private:
+        size_t index_ = 0;
+        std::chrono::steady_clock::time_point start_;
+        bool active_ = false;
+    };
+
+   private:
+    void Finish(Trace trace);
+
+    const uint64_t sample_interval_;
+    const size_t capacity_;
+    mutable std::mutex mutex_;
+    std::vector<Trace> traces_;
+    // Where the next trace goes once traces_ is full
+    size_t next_ = 0;
+};
+
+}  // namespace mooncake
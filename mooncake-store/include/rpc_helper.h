@@ -7,6 +7,7 @@
 #include <ylt/reflection/user_reflect_macro.hpp>
 #include <ylt/util/tl/expected.hpp>
 
+#include "master_metric_manager.h"
 #include "types.h"
 #include "utils/scoped_vlog_timer.h"
 
@@ -43,6 +44,7 @@ auto execute_rpc(std::string_view rpc_name, RpcCallable&& rpc_call,
                  IncReqMetric&& inc_req_metric, IncFailMetric&& inc_fail_metric)
     requires TlExpected<std::invoke_result_t<RpcCallable>>
 {
+    ScopedRpcLatency latency(rpc_name);
     ScopedVLogTimer timer(1, rpc_name.data());
     log_request(timer);
 
@@ -1,34 +1,40 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <memory>
 #include <thread>
 #include <ylt/coro_http/coro_http_server.hpp>
 #include <ylt/coro_rpc/coro_rpc_server.hpp>
 #include <ylt/util/tl/expected.hpp>
 
+#include "admission_controller.h"
 #include "master_service.h"
+#include "shard_affinity_pool.h"
 #include "types.h"
 
 namespace mooncake {
 
 extern const uint64_t kMetricReportIntervalSeconds;
 
+class MetadataFollower;
+
+// Configuration of a WrappedMasterService: that of its MasterService and
+// of the RPC layer around it
+struct WrappedMasterServiceConfig {
+    MasterServiceConfig master = {};
+    bool enable_metric_reporting = true;
+    uint16_t http_port = 9003;
+    // Workers serving the key requests by shard, 0 to serve them on the RPC
+    // threads
+    size_t shard_affinity_threads = 0;
+};
+
 class WrappedMasterService {
    public:
-    WrappedMasterService(
-        bool enable_gc, uint64_t default_kv_lease_ttl,
-        uint64_t default_kv_soft_pin_ttl = DEFAULT_KV_SOFT_PIN_TTL_MS,
-        bool allow_evict_soft_pinned_objects =
-            DEFAULT_ALLOW_EVICT_SOFT_PINNED_OBJECTS,
-        bool enable_metric_reporting = true, uint16_t http_port = 9003,
-        double eviction_ratio = DEFAULT_EVICTION_RATIO,
-        double eviction_high_watermark_ratio =
-            DEFAULT_EVICTION_HIGH_WATERMARK_RATIO,
-        ViewVersionId view_version = 0,
-        int64_t client_live_ttl_sec = DEFAULT_CLIENT_LIVE_TTL_SEC,
-        bool enable_ha = false,
-        const std::string& cluster_id = DEFAULT_CLUSTER_ID);
+    explicit WrappedMasterService(
+        const WrappedMasterServiceConfig& config = {});
 
     ~WrappedMasterService();
 
@@ -39,12 +45,32 @@ class WrappedMasterService {
     std::vector<tl::expected<bool, ErrorCode>> BatchExistKey(
         const std::vector<std::string>& keys);
 
+    std::vector<tl::expected<void, ErrorCode>> BatchTouch(
+        const std::vector<std::string>& keys, uint64_t ttl_ms,
+        uint64_t next_use_ms);
+
+    tl::expected<PrefixMatchResult, ErrorCode> LongestPrefixMatch(
+        const std::vector<std::string>& keys, bool with_replicas);
+
+    tl::expected<KeyLocationResult, ErrorCode> BatchQueryLocation(
+        const std::vector<std::string>& keys, bool with_prefix_hits);
+
+    tl::expected<KeyScanResult, ErrorCode> ScanKeys(const std::string& prefix,
+                                                    const std::string& cursor,
+                                                    uint64_t limit);
+
     tl::expected<std::vector<Replica::Descriptor>, ErrorCode> GetReplicaList(
         const std::string& key);
 
     std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
     BatchGetReplicaList(const std::vector<std::string>& keys);
 
+    /**
+     * @brief BatchGetReplicaList with each segment name sent once
+     */
+    PackedReplicaLists BatchGetReplicaListPacked(
+        const std::vector<std::string>& keys);
+
     tl::expected<std::vector<Replica::Descriptor>, ErrorCode> PutStart(
         const std::string& key, const std::vector<uint64_t>& slice_lengths,
         const ReplicateConfig& config);
@@ -64,10 +90,67 @@ class WrappedMasterService {
     std::vector<tl::expected<void, ErrorCode>> BatchPutRevoke(
         const std::vector<std::string>& keys);
 
+    tl::expected<void, ErrorCode> PutInline(const std::string& key,
+                                            const std::string& value,
+                                            const ReplicateConfig& config);
+
+    tl::expected<AllocationCredit, ErrorCode> GrantAllocationCredit(
+        const UUID& client_id, uint64_t size);
+
+    std::vector<tl::expected<void, ErrorCode>> CommitCreditPuts(
+        const UUID& client_id, uint64_t credit_id,
+        const std::vector<CreditPut>& puts);
+
+    tl::expected<void, ErrorCode> ReturnAllocationCredit(
+        const UUID& client_id, uint64_t credit_id);
+
+    tl::expected<void, ErrorCode> PutDiskReplica(const std::string& key,
+                                                 const DiskDescriptor& disk);
+
+    std::vector<tl::expected<void, ErrorCode>> BatchPutDiskReplica(
+        const std::vector<std::string>& keys,
+        const std::vector<DiskDescriptor>& disks);
+
+    tl::expected<std::vector<Replica::Descriptor>, ErrorCode> PromoteStart(
+        const std::string& key, const std::vector<uint64_t>& slice_lengths,
+        const ReplicateConfig& config);
+
+    tl::expected<CompactionTask, ErrorCode> CompactionStart(
+        const std::string& segment_name);
+
+    tl::expected<void, ErrorCode> CompactionEnd(const std::string& key,
+                                                uint64_t target);
+
+    tl::expected<void, ErrorCode> CompactionRevoke(const std::string& key,
+                                                   uint64_t target);
+
+    tl::expected<void, ErrorCode> CopyReplica(
+        const std::string& key, const std::string& target_segment);
+
+    tl::expected<void, ErrorCode> MigrateReplica(
+        const std::string& key, const std::string& source_segment,
+        const std::string& target_segment);
+
+    tl::expected<uint64_t, ErrorCode> Broadcast(
+        const std::string& key,
+        const std::vector<std::string>& target_segments);
+
+    std::vector<tl::expected<void, ErrorCode>> Prefetch(
+        const std::vector<std::string>& keys,
+        const std::string& target_segment);
+
+    std::vector<tl::expected<bool, ErrorCode>> CancelPrefetch(
+        const std::vector<std::string>& keys,
+        const std::string& target_segment);
+
     tl::expected<void, ErrorCode> Remove(const std::string& key);
 
     long RemoveAll();
 
+    tl::expected<long, ErrorCode> RemoveByTag(const std::string& tag);
+
+    tl::expected<long, ErrorCode> RemoveByPrefix(const std::string& prefix);
+
     tl::expected<void, ErrorCode> MountSegment(const Segment& segment,
                                                const UUID& client_id);
 
@@ -77,13 +160,100 @@ class WrappedMasterService {
     tl::expected<void, ErrorCode> UnmountSegment(const UUID& segment_id,
                                                  const UUID& client_id);
 
+    tl::expected<void, ErrorCode> DrainSegment(const UUID& segment_id);
+
+    tl::expected<uint64_t, ErrorCode> QueryDrain(const UUID& segment_id);
+
+    tl::expected<Segment, ErrorCode> AttachSegment(const UUID& memory_id,
+                                                   const UUID& client_id);
+
+    tl::expected<void, ErrorCode> DetachSegment(const UUID& memory_id,
+                                                const UUID& client_id);
+
     tl::expected<std::string, ErrorCode> GetFsdir();
 
+    tl::expected<ReplicaCacheInfo, ErrorCode> GetReplicaCacheInfo();
+
     tl::expected<std::pair<ViewVersionId, ClientStatus>, ErrorCode> Ping(
         const UUID& client_id);
 
+    tl::expected<MetadataChanges, ErrorCode> GetMetadataChanges(
+        uint64_t seq, uint64_t max_keys);
+
+    tl::expected<MetadataSnapshot, ErrorCode> GetMetadataSnapshot(
+        uint64_t shard);
+
+    tl::expected<KeyFilterUpdate, ErrorCode> GetKeyFilter(uint64_t seq);
+
+    /**
+     * @brief Serve ExistKey, BatchExistKey, GetReplicaList and
+     * BatchGetReplicaList from a copy of the metadata of the master at
+     * master_addr instead of master_service_, see MetadataFollower. Must be
+     * called before the service is registered.
+     */
+    void FollowMaster(const std::string& master_addr,
+                      std::chrono::milliseconds max_staleness);
+
+    /**
+     * @brief Shed reads and writes with MASTER_BUSY when the master is
+     * overloaded, see AdmissionController. Reads are ExistKey,
+     * GetReplicaList, LongestPrefixMatch, BatchQueryLocation and the
+     * batches of the first two; writes are PutStart, BatchPutStart,
+     * PutInline and GrantAllocationCredit. The requests that finish or undo
+     * work already admitted are always served.
+     * Must be called before the service is registered.
+     */
+    void EnableAdmissionControl(const AdmissionConfig& config);
+
+    /**
+     * @brief See MasterService::RestoreMetadata, called by a new leader
+     * before the service is started
+     */
+    tl::expected<void, ErrorCode> RestoreMetadata(
+        std::vector<MetadataEntry> entries);
+
    private:
+    // Runs fn on the workers owning the shard of key, see ShardAffinityPool
+    template <typename F>
+    auto OnShardOf(const std::string& key, F&& fn) {
+        if (!shard_affinity_) {
+            return fn();
+        }
+        return shard_affinity_->Run(MasterService::ShardOf(key),
+                                    std::forward<F>(fn));
+    }
+
+    // Runs call(indices) on the workers owning the shards of the keys at
+    // indices, once per owner, and returns the results in the order of keys
+    template <typename T, typename Call>
+    std::vector<T> OnShardsOf(const std::vector<std::string>& keys,
+                              Call&& call) {
+        std::vector<size_t> shards;
+        shards.reserve(keys.size());
+        for (const auto& key : keys) {
+            shards.push_back(MasterService::ShardOf(key));
+        }
+        return shard_affinity_->RunBatch<T>(shards, std::forward<Call>(call));
+    }
+
+    template <typename T>
+    static std::vector<T> Select(const std::vector<T>& values,
+                                 const std::vector<size_t>& indices) {
+        std::vector<T> selected;
+        selected.reserve(indices.size());
+        for (size_t index : indices) {
+            selected.push_back(values[index]);
+        }
+        return selected;
+    }
+
     MasterService master_service_;
+    // Set with shard_affinity_threads, null to serve on the RPC threads
+    std::unique_ptr<ShardAffinityPool> shard_affinity_;
+    // Set by FollowMaster
+    std::unique_ptr<MetadataFollower> follower_;
+    // Set by EnableAdmissionControl
+    std::unique_ptr<AdmissionController> admission_;
     std::thread metric_report_thread_;
     coro_http::coro_http_server http_server_;
     std::atomic<bool> metric_report_running_;
@@ -92,4 +262,9 @@ class WrappedMasterService {
 void RegisterRpcService(coro_rpc::coro_rpc_server& server,
                         mooncake::WrappedMasterService& wrapped_master_service);
 
+// Registers the reads a follower master serves, see FollowMaster
+void RegisterFollowerRpcService(
+    coro_rpc::coro_rpc_server& server,
+    mooncake::WrappedMasterService& wrapped_master_service);
+
 }  // namespace mooncake
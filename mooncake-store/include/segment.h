@@ -1,6 +1,10 @@
 #pragma once
 
+#include <atomic>
 #include <boost/functional/hash.hpp>
+#include <chrono>
+#include <memory>
+#include <mutex>
 #include <ostream>
 #include <shared_mutex>
 #include <string>
@@ -20,6 +24,7 @@ enum class SegmentStatus {
     UNDEFINED = 0,  // Uninitialized
     OK,             // Segment is mounted and available for allocation
     UNMOUNTING,     // Segment is under unmounting
+    DRAINING,       // Segment is mounted, its objects are moved elsewhere
 };
 
 /**
@@ -30,7 +35,8 @@ inline std::ostream& operator<<(std::ostream& os,
     static const std::unordered_map<SegmentStatus, std::string_view>
         status_strings{{SegmentStatus::UNDEFINED, "UNDEFINED"},
                        {SegmentStatus::OK, "OK"},
-                       {SegmentStatus::UNMOUNTING, "UNMOUNTING"}};
+                       {SegmentStatus::UNMOUNTING, "UNMOUNTING"},
+                       {SegmentStatus::DRAINING, "DRAINING"}};
 
     os << (status_strings.count(status) ? status_strings.at(status)
                                         : "UNKNOWN");
@@ -41,6 +47,9 @@ struct MountedSegment {
     Segment segment;
     SegmentStatus status;
     std::shared_ptr<BufferAllocator> buf_allocator;
+    // Clients other than the owner mapping the memory of the segment, see
+    // ScopedSegmentAccess::AttachSegment
+    std::vector<UUID> attached_clients;
 };
 
 // Forward declarations
@@ -59,6 +68,12 @@ class ScopedSegmentAccess {
                                  std::shared_mutex& mutex)
         : segment_manager_(segment_manager), lock_(mutex) {}
 
+    /**
+     * @brief Publishes the allocators if they changed, then releases the
+     * lock
+     */
+    ~ScopedSegmentAccess();
+
     /**
      * @brief Mount a segment
      */
@@ -86,12 +101,59 @@ class ScopedSegmentAccess {
                                    const UUID& client_id,
                                    const size_t& metrics_dec_capacity);
 
+    /**
+     * @brief Stop allocating from a segment, leaving its allocated buffers
+     * in place. Draining a draining segment does nothing.
+     */
+    ErrorCode DrainSegment(const UUID& segment_id, Segment& segment);
+
+    /**
+     * @brief Get the bytes still allocated in a draining segment
+     */
+    ErrorCode GetDrainingUsage(const UUID& segment_id, size_t& used) const;
+
     /**
      * @brief Get all the segments of a client
      */
     ErrorCode GetClientSegments(const UUID& client_id,
                                 std::vector<Segment>& segments) const;
 
+    /**
+     * @brief Get a mounted segment by id
+     */
+    ErrorCode GetSegment(const UUID& segment_id, Segment& segment) const;
+
+    /**
+     * @brief Find the segment mounted on the persistent memory memory_id,
+     * and the client that mounted it
+     */
+    ErrorCode FindMemorySegment(const UUID& memory_id, Segment& segment,
+                                UUID& client_id) const;
+
+    /**
+     * @brief Record that client_id maps the shared memory memory_id, e.g.
+     * a CXL memory pool, and get the segment mounted on it. The
+     * attachment ends with the segment or the client.
+     */
+    ErrorCode AttachSegment(const UUID& memory_id, const UUID& client_id,
+                            Segment& segment);
+
+    /**
+     * @brief Forget that client_id maps the shared memory memory_id
+     */
+    void DetachSegment(const UUID& memory_id, const UUID& client_id);
+
+    /**
+     * @brief Forget every attachment of a client, e.g. once it expired
+     */
+    void DetachClient(const UUID& client_id);
+
+    /**
+     * @brief Get the clients attached to a mounted segment
+     */
+    ErrorCode GetAttachedClients(const UUID& segment_id,
+                                 std::vector<UUID>& clients) const;
+
     /**
      * @brief Get the names of all the segments
      */
@@ -104,46 +166,68 @@ class ScopedSegmentAccess {
     ErrorCode QuerySegments(const std::string& segment, size_t& used,
                             size_t& capacity);
 
+    /**
+     * @brief Get the allocators of the mounted segments named segment_name
+     */
+    std::vector<std::shared_ptr<BufferAllocator>> GetAllocators(
+        const std::string& segment_name) const;
+
    private:
+    // Remove the allocator of a segment from the allocators used for new
+    // allocations
+    void RemoveAllocator(const MountedSegment& mounted_segment);
+
     SegmentManager* segment_manager_;
     std::unique_lock<std::shared_mutex> lock_;
+    // Whether the allocators used for new allocations changed
+    bool allocators_changed_ = false;
+};
+
+/**
+ * @brief Immutable copy of the allocators used for new allocations
+ */
+struct AllocatorSet {
+    std::unordered_map<std::string,
+                       std::vector<std::shared_ptr<BufferAllocator>>>
+        allocators_by_name;  // segment name -> allocators
+    std::vector<std::shared_ptr<BufferAllocator>> allocators;
 };
 
 /**
- * @brief RAII-style access to allocators for thread-safe allocator usage
+ * @brief Access to the allocators for thread-safe allocator usage. It holds
+ * the snapshot of the allocators published last rather than a lock, so
+ * allocations never wait for mounts and unmounts, which publish a new
+ * snapshot instead of changing this one.
  */
 class ScopedAllocatorAccess {
    public:
     explicit ScopedAllocatorAccess(
-        std::unordered_map<std::string,
-                           std::vector<std::shared_ptr<BufferAllocator>>>&
-            allocators_by_name,
-        std::vector<std::shared_ptr<BufferAllocator>>& allocators,
-        std::shared_mutex& mutex)
-        : allocators_by_name_(allocators_by_name),
-          allocators_(allocators),
-          lock_(mutex) {}
+        std::shared_ptr<const AllocatorSet> allocator_set)
+        : allocator_set_(std::move(allocator_set)) {}
 
     const std::unordered_map<std::string,
                        std::vector<std::shared_ptr<BufferAllocator>>>&
     getAllocatorsByName() {
-        return allocators_by_name_;
+        return allocator_set_->allocators_by_name;
     }
 
     const std::vector<std::shared_ptr<BufferAllocator>>& getAllocators() {
-        return allocators_;
+        return allocator_set_->allocators;
     }
 
    private:
-    const std::unordered_map<std::string,
-                       std::vector<std::shared_ptr<BufferAllocator>>>&
-        allocators_by_name_;  // segment name -> allocators
-    const std::vector<std::shared_ptr<BufferAllocator>>& allocators_;
-    std::shared_lock<std::shared_mutex> lock_;
+    std::shared_ptr<const AllocatorSet> allocator_set_;
 };
 
 class SegmentManager {
    public:
+    explicit SegmentManager(
+        BufferAllocatorType buffer_allocator_type =
+            DEFAULT_BUFFER_ALLOCATOR_TYPE,
+        std::chrono::steady_clock::duration free_delay = {})
+        : buffer_allocator_type_(buffer_allocator_type),
+          free_delay_(free_delay) {}
+
     /**
      * @brief Get RAII-style access to segment management operations
      * @return ScopedSegmentAccess object that holds the lock
@@ -153,19 +237,36 @@ class SegmentManager {
     }
 
     /**
-     * @brief Get RAII-style access to use allocators
-     * @return ScopedAllocatorAccess object that holds the lock
+     * @brief Get access to use allocators, without taking the segment mutex
+     * @return ScopedAllocatorAccess object that holds the current snapshot
      */
     ScopedAllocatorAccess getAllocatorAccess() {
-        return ScopedAllocatorAccess(allocators_by_name_, allocators_,
-                                     segment_mutex_);
+        return ScopedAllocatorAccess(
+            allocator_set_.load(std::memory_order_acquire));
     }
 
+    /**
+     * @brief Wait for the allocations still using the allocators of older
+     * snapshots, so that a segment taken out of the allocators, e.g. to
+     * unmount it, gets no new buffer once this returns. Allocations are
+     * short, so is the wait. Must be called without the segment mutex.
+     */
+    void WaitForAllocations();
+
    private:
+    // Publish allocators_by_name_ and allocators_ as the snapshot of new
+    // allocations. Called with segment_mutex_ held exclusively.
+    void PublishAllocators();
+
     mutable std::shared_mutex segment_mutex_;
+    // Allocator of the space of the segments mounted from now on
+    const BufferAllocatorType buffer_allocator_type_;
+    // How long the allocators keep freed space, see BufferAllocator
+    const std::chrono::steady_clock::duration free_delay_;
     std::shared_ptr<AllocationStrategy> allocation_strategy_;
     // Each allocator is put into both of allocators_by_name_ and allocators_.
     // These two containers only contain allocators whose segment status is OK.
+    // Draining segments keep theirs in mounted_segments_ only.
     std::unordered_map<std::string,
                        std::vector<std::shared_ptr<BufferAllocator>>>
         allocators_by_name_;  // segment name -> allocators
@@ -174,6 +275,12 @@ class SegmentManager {
         mounted_segments_;  // segment_id -> mounted segment
     std::unordered_map<UUID, std::vector<UUID>, boost::hash<UUID>>
         client_segments_;  // client_id -> segment_ids
+    // Snapshot of allocators_by_name_ and allocators read by allocations
+    std::atomic<std::shared_ptr<const AllocatorSet>> allocator_set_{
+        std::make_shared<const AllocatorSet>()};
+    // Snapshots replaced by newer ones, alive while allocations use them
+    std::mutex retired_mutex_;
+    std::vector<std::weak_ptr<const AllocatorSet>> retired_sets_;
 
     friend class ScopedSegmentAccess;
     friend class SegmentTest; // for unit tests
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+namespace mooncake {
+
+class Topology;
+
+/**
+ * @brief Memory backing a segment mounted into the store
+ *
+ * Allocate() maps the segment with hugepages when configured, places it on
+ * a NUMA node and pre-faults it with several threads, so that registering it
+ * pins resident memory and the first transfers into it take no page faults.
+ * The memory is released when the object is destroyed.
+ *
+ * Configured through environment variables:
+ * - MC_STORE_HUGEPAGE_SIZE: "2MB" or "1GB" to map with hugepages of that
+ *   size. Falls back to regular pages when no hugepage can be reserved.
+ * - MC_STORE_PREFAULT_THREADS: threads touching the pages before the
+ *   segment is returned, default 8; 0 leaves faulting to first access.
+ * - MC_ENABLE_SHM: back the segment with a memfd, exported to ShmTransport
+ *   so that clients in other processes of the host can map it.
+ *
+ * AllocateDevice() instead allocates the segment in the memory of a GPU,
+ * which the transfer engine reaches with GPUDirect RDMA. It needs a build
+ * with USE_CUDA.
+ *
+ * AllocatePersistent() maps the segment from a file of /dev/shm, hugetlbfs
+ * or a DAX filesystem, whose content outlives the process. The file starts
+ * with a header naming the memory with a memory_id; mounted with it, the
+ * segment gets back from the master the replicas it held before a restart.
+ *
+ * AttachShared() maps the segment another host or process created with
+ * AllocatePersistent() in memory both map, e.g. the file of a CXL memory
+ * pool on a DAX filesystem, to attach to it with Client::AttachSegment.
+ */
+class SegmentMemory {
+   public:
+    ~SegmentMemory();
+
+    SegmentMemory(const SegmentMemory&) = delete;
+    SegmentMemory& operator=(const SegmentMemory&) = delete;
+
+    /**
+     * @brief Allocate a segment of size bytes
+     * @param size Multiple of the allocator's slab size
+     * @param numa_node Node to place the memory on, -1 for the default
+     * policy
+     * @return nullptr if the memory cannot be allocated
+     */
+    static std::unique_ptr<SegmentMemory> Allocate(size_t size,
+                                                   int numa_node = -1);
+
+    /**
+     * @brief Allocate a segment of size bytes in the memory of a GPU
+     * @param size Multiple of the allocator's slab size
+     * @param device CUDA device ordinal
+     * @return nullptr if the memory cannot be allocated, or without CUDA
+     */
+    static std::unique_ptr<SegmentMemory> AllocateDevice(size_t size,
+                                                         int device);
+
+    /**
+     * @brief Map a segment of size bytes from the file at path, created if
+     * missing, reusing its content if it holds a segment of that size
+     * @param size Multiple of the allocator's slab size
+     * @param numa_node Node to place new pages on, -1 for the default policy
+     * @return nullptr if the file cannot be mapped or another process holds
+     * it
+     * @note The file is locked while the segment exists and is kept when it
+     * is destroyed
+     */
+    static std::unique_ptr<SegmentMemory> AllocatePersistent(
+        const std::string& path, size_t size, int numa_node = -1);
+
+    /**
+     * @brief Map the segment held by the file at path, whose owner created
+     * it with AllocatePersistent, without locking the file or touching its
+     * content
+     * @return nullptr if the file cannot be mapped or holds no segment
+     */
+    static std::unique_ptr<SegmentMemory> AttachShared(
+        const std::string& path);
+
+    void* data() const { return data_; }
+    size_t size() const { return size_; }
+    // 4 KB unless the segment is backed by hugepages
+    size_t page_size() const { return page_size_; }
+    int numa_node() const { return numa_node_; }
+    // memfd backing a shared segment, -1 otherwise
+    int fd() const { return fd_; }
+    // CUDA device holding the segment, -1 for host memory
+    int device() const { return device_; }
+    // Location to register the segment with, "cuda:N" or kWildcardLocation
+    std::string location() const;
+    // Id of the persistent memory of the segment, {0, 0} otherwise
+    const UUID& memory_id() const { return memory_id_; }
+    // Whether the persistent memory was mapped with its previous content
+    bool recovered() const { return recovered_; }
+
+   private:
+    SegmentMemory(void* data, size_t size, void* map_addr, size_t map_length,
+                  size_t page_size, int numa_node, int fd, int device = -1)
+        : data_(data),
+          size_(size),
+          map_addr_(map_addr),
+          map_length_(map_length),
+          page_size_(page_size),
+          numa_node_(numa_node),
+          fd_(fd),
+          device_(device) {}
+
+    void* const data_;
+    const size_t size_;
+    void* const map_addr_;
+    const size_t map_length_;
+    const size_t page_size_;
+    const int numa_node_;
+    const int fd_;
+    const int device_;
+    UUID memory_id_{0, 0};
+    bool recovered_ = false;
+    // Locked file of a persistent segment, -1 otherwise
+    int file_fd_ = -1;
+};
+
+/**
+ * @brief NUMA nodes that segments should be spread over
+ *
+ * The nodes whose CPUs have preferred NICs in topology, in ascending order.
+ * Memory on such a node is served by a NIC attached to it. Empty if the
+ * topology has no NUMA-local NICs, e.g. without RDMA.
+ */
+std::vector<int> SegmentNumaNodes(const Topology& topology);
+
+/**
+ * @brief Discover the local topology and return its SegmentNumaNodes()
+ * @param device_names Comma-separated RDMA devices to consider, all if empty
+ */
+std::vector<int> SegmentNumaNodes(const std::string& device_names);
+
+}  // namespace mooncake
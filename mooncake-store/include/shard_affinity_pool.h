@@ -0,0 +1,158 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "ylt/metric/gauge.hpp"
+
+namespace mooncake {
+
+/**
+ * @brief Worker threads bound to NUMA nodes, each node owning a contiguous
+ * range of the metadata shards
+ *
+ * The master's RPC threads hand each request to a worker of the node owning
+ * the shard of its key, so that a shard's mutex and metadata stay in the
+ * caches of one socket. Batch requests are split by owner and the parts run
+ * in parallel. With a single group no worker is started and requests run
+ * on the calling thread.
+ */
+class ShardAffinityPool {
+   public:
+    /**
+     * @param num_threads Workers, spread over the groups
+     * @param num_groups 0 for one group per NUMA node. Groups are bound to
+     * a node only if there are as many nodes.
+     */
+    ShardAffinityPool(size_t num_shards, size_t num_threads,
+                      size_t num_groups = 0);
+    ~ShardAffinityPool();
+
+    ShardAffinityPool(const ShardAffinityPool&) = delete;
+    ShardAffinityPool& operator=(const ShardAffinityPool&) = delete;
+
+    // The number of node groups, 0 if requests run on the calling thread
+    size_t num_groups() const { return groups_.size(); }
+
+    size_t GroupOf(size_t shard) const {
+        return shard * groups_.size() / num_shards_;
+    }
+
+    /**
+     * @brief Runs fn on a worker of the group owning shard and returns its
+     * result
+     */
+    template <typename F>
+    std::invoke_result_t<F> Run(size_t shard, F&& fn);
+
+    /**
+     * @brief Runs call(indices) once per group owning some of shards, with
+     * the indices of its shards in order, and puts the results back in the
+     * order of shards. call returns one result per index.
+     */
+    template <typename T, typename Call>
+    std::vector<T> RunBatch(const std::vector<size_t>& shards, Call&& call);
+
+    size_t QueueDepth(size_t group) const;
+
+    // Prometheus text for the queue depth gauges of the groups
+    std::string SerializeMetrics();
+
+   private:
+    struct Group {
+        int numa_node = -1;
+        mutable std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<std::function<void()>> tasks;
+        bool stop = false;
+        std::vector<std::thread> workers;
+        std::unique_ptr<ylt::metric::gauge_t> queue_depth_gauge;
+    };
+
+    void Enqueue(Group& group, std::function<void()> task);
+    void WorkerThread(Group* group);
+
+    // The group of the calling thread if it is a worker
+    static thread_local const Group* current_group_;
+
+    const size_t num_shards_;
+    std::vector<std::unique_ptr<Group>> groups_;
+};
+
+template <typename F>
+std::invoke_result_t<F> ShardAffinityPool::Run(size_t shard, F&& fn) {
+    using R = std::invoke_result_t<F>;
+    if (groups_.empty()) {
+        return fn();
+    }
+    Group& group = *groups_[GroupOf(shard)];
+    if (current_group_ == &group) {
+        return fn();
+    }
+    auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(fn));
+    auto result = task->get_future();
+    Enqueue(group, [task] { (*task)(); });
+    return result.get();
+}
+
+template <typename T, typename Call>
+std::vector<T> ShardAffinityPool::RunBatch(const std::vector<size_t>& shards,
+                                           Call&& call) {
+    std::vector<std::vector<size_t>> parts(
+        std::max<size_t>(groups_.size(), 1));
+    for (size_t i = 0; i < shards.size(); ++i) {
+        parts[groups_.empty() ? 0 : GroupOf(shards[i])].push_back(i);
+    }
+    std::vector<size_t> busy;
+    for (size_t g = 0; g < parts.size(); ++g) {
+        if (!parts[g].empty()) {
+            busy.push_back(g);
+        }
+    }
+    if (busy.empty()) {
+        return {};
+    }
+
+    // All parts but the last are queued, the last one runs through Run
+    std::vector<std::vector<T>> part_results(parts.size());
+    std::vector<std::future<std::vector<T>>> futures;
+    for (size_t k = 0; k + 1 < busy.size(); ++k) {
+        const std::vector<size_t>& part = parts[busy[k]];
+        auto task = std::make_shared<std::packaged_task<std::vector<T>()>>(
+            [&call, &part] { return call(part); });
+        futures.push_back(task->get_future());
+        Enqueue(*groups_[busy[k]], [task] { (*task)(); });
+    }
+    const std::vector<size_t>& last = parts[busy.back()];
+    part_results[busy.back()] =
+        Run(shards[last.front()], [&call, &last] { return call(last); });
+    for (size_t k = 0; k < futures.size(); ++k) {
+        part_results[busy[k]] = futures[k].get();
+    }
+
+    std::vector<std::optional<T>> ordered(shards.size());
+    for (size_t g : busy) {
+        for (size_t j = 0; j < parts[g].size(); ++j) {
+            ordered[parts[g][j]].emplace(std::move(part_results[g][j]));
+        }
+    }
+    std::vector<T> results;
+    results.reserve(shards.size());
+    for (auto& result : ordered) {
+        results.push_back(std::move(*result));
+    }
+    return results;
+}
+
+}  // namespace mooncake
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mooncake {
+
+/**
+ * @brief Metrics updated by every request of many threads, e.g. the RPC
+ * counters of the master. Each thread updates the cell of its shard, so
+ * that threads on different cores do not bounce one cache line between
+ * them, and the cells are summed when the metric is read or scraped. The
+ * classes serialize like the ylt metrics they replace.
+ */
+class MetricShards {
+   public:
+    static constexpr size_t kShards = 32;
+    // Cells of a shard are padded to a cache line
+    static constexpr size_t kCellsPerLine = 64 / sizeof(int64_t);
+
+    // Shard of the calling thread, threads are spread over them in turn
+    static size_t ThisThread() {
+        static std::atomic<size_t> next_shard{0};
+        thread_local const size_t shard =
+            next_shard.fetch_add(1, std::memory_order_relaxed) % kShards;
+        return shard;
+    }
+};
+
+// Cells of kShards shards, cells_per_shard each, every shard on cache
+// lines of its own
+class ShardedCells {
+   public:
+    explicit ShardedCells(size_t cells_per_shard)
+        : stride_((cells_per_shard + MetricShards::kCellsPerLine - 1) /
+                  MetricShards::kCellsPerLine * MetricShards::kCellsPerLine),
+          cells_(new Line[stride_ / MetricShards::kCellsPerLine *
+                          MetricShards::kShards]) {}
+
+    void add(size_t cell, int64_t val) {
+        at(MetricShards::ThisThread(), cell)
+            .fetch_add(val, std::memory_order_relaxed);
+    }
+
+    int64_t sum(size_t cell) const {
+        int64_t total = 0;
+        for (size_t shard = 0; shard < MetricShards::kShards; ++shard) {
+            total += at(shard, cell).load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+   private:
+    struct alignas(64) Line {
+        std::atomic<int64_t> cells[MetricShards::kCellsPerLine]{};
+    };
+
+    std::atomic<int64_t>& at(size_t shard, size_t cell) const {
+        const size_t index = shard * stride_ + cell;
+        return cells_[index / MetricShards::kCellsPerLine]
+            .cells[index % MetricShards::kCellsPerLine];
+    }
+
+    size_t stride_;
+    std::unique_ptr<Line[]> cells_;
+};
+
+/**
+ * @brief A counter, or a gauge moved by increments and decrements only
+ */
+class ShardedCounter {
+   public:
+    // type is "counter" or "gauge", as written in the TYPE line
+    ShardedCounter(std::string name, std::string help,
+                   std::string type = "counter")
+        : name_(std::move(name)),
+          help_(std::move(help)),
+          type_(std::move(type)),
+          cells_(1) {}
+
+    void inc(int64_t val = 1) { cells_.add(0, val); }
+    void dec(int64_t val = 1) { cells_.add(0, -val); }
+    int64_t value() const { return cells_.sum(0); }
+
+    // Appends the metric in the Prometheus text format, nothing if it is 0
+    void serialize(std::string& out) const;
+
+   private:
+    std::string name_;
+    std::string help_;
+    std::string type_;
+    ShardedCells cells_;
+};
+
+/**
+ * @brief A histogram of integral observations, e.g. sizes or latencies
+ */
+class ShardedHistogram {
+   public:
+    ShardedHistogram(std::string name, std::string help,
+                     std::vector<double> buckets)
+        : name_(std::move(name)),
+          help_(std::move(help)),
+          buckets_(std::move(buckets)),
+          // One cell per bucket, one for +Inf and one for the sum
+          cells_(buckets_.size() + 2) {}
+
+    void observe(int64_t value) {
+        const size_t bucket = std::lower_bound(buckets_.begin(),
+                                               buckets_.end(), value) -
+                              buckets_.begin();
+        cells_.add(bucket, 1);
+        cells_.add(buckets_.size() + 1, value);
+    }
+
+    int64_t count() const;
+    int64_t sum() const { return cells_.sum(buckets_.size() + 1); }
+
+    // Appends the metric in the Prometheus text format, nothing if no value
+    // was observed
+    void serialize(std::string& out) const;
+
+   private:
+    std::string name_;
+    std::string help_;
+    std::vector<double> buckets_;
+    ShardedCells cells_;
+};
+
+}  // namespace mooncake
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "thread_pool.h"
+#include "types.h"
+
+namespace mooncake {
+
+/**
+ * @brief Reads objects from the files of a shared parallel filesystem such
+ * as 3FS, Lustre or GPFS
+ *
+ * On these filesystems opening a file is a round trip to a metadata server
+ * and a single stream of reads is far from the bandwidth of the storage
+ * servers. Open descriptors are therefore kept in an LRU cache of
+ * max_open_files files, and the bytes of a read are cut into stripes of
+ * stripe_size bytes that up to read_threads threads read in parallel, the
+ * caller reading the first one.
+ *
+ * Files are expected not to change once their bytes are read; a cached
+ * descriptor outlives the deletion of its file until it is evicted. A read
+ * that fails through a cached descriptor is retried once with a new one.
+ * All methods are thread-safe.
+ */
+class SharedFileReader {
+   public:
+    struct Options {
+        size_t stripe_size = 4 << 20;
+        size_t read_threads = 8;
+        size_t max_open_files = 256;
+
+        /**
+         * @brief Options from MC_STORE_SHARED_FS_STRIPE_KB,
+         * MC_STORE_SHARED_FS_READ_THREADS and MC_STORE_SHARED_FS_OPEN_FILES,
+         * the defaults for those unset
+         */
+        static Options FromEnv();
+    };
+
+    explicit SharedFileReader(const Options& options);
+    ~SharedFileReader();
+
+    SharedFileReader(const SharedFileReader&) = delete;
+    SharedFileReader& operator=(const SharedFileReader&) = delete;
+
+    /**
+     * @brief Read the bytes of path at offset into slices, one after the
+     * other
+     * @return ErrorCode::FILE_OPEN_FAIL if path cannot be opened,
+     * ErrorCode::FILE_READ_FAIL if reading fails or the file is too short
+     */
+    ErrorCode Read(const std::string& path, uint64_t offset,
+                   const std::vector<Slice>& slices);
+
+    // Descriptors in the cache
+    size_t OpenFiles() const;
+
+   private:
+    struct Handle {
+        explicit Handle(int fd) : fd(fd) {}
+        ~Handle();
+        const int fd;
+    };
+
+    struct Stripe {
+        uint64_t offset;
+        std::vector<iovec> iovs;
+    };
+
+    // Descriptor of path, opened if it is not cached, null on failure
+    std::shared_ptr<Handle> Acquire(const std::string& path);
+    void Evict(const std::string& path);
+
+    ErrorCode ReadStripes(const Handle& handle,
+                          const std::vector<Stripe>& stripes);
+    static bool ReadStripe(int fd, const Stripe& stripe);
+
+    const Options options_;
+    mutable std::mutex mutex_;
+    // Most recently used first
+    std::list<std::string> lru_;
+    struct Entry {
+        std::shared_ptr<Handle> handle;
+        std::list<std::string>::iterator position;
+    };
+    std::unordered_map<std::string, Entry> handles_;
+    // Null with a single read thread
+    std::unique_ptr<ThreadPool> pool_;
+};
+
+}  // namespace mooncake
@@ -9,6 +9,12 @@
 #include <filesystem>
 #include <thread>
 #include <chrono>
+#include <memory>
+#include <atomic>
+#include <optional>
+#include <io_uring_engine.h>
+#include <log_structured_store.h>
+#include <shared_file_reader.h>
 
 namespace mooncake {
 /**
@@ -16,6 +22,26 @@ namespace mooncake {
  * @brief Implementation of StorageBackend interface using local filesystem storage.
  * 
  * Provides thread-safe operations for storing and retrieving objects in a directory hierarchy.
+ *
+ * Object files are read and written through io_uring with O_DIRECT when the
+ * kernel and filesystem support it, see IoUringEngine. The queue depth is set
+ * with MC_STORE_URING_QUEUE_DEPTH, either a number for all devices or a list
+ * such as "/mnt/nvme0=64,/mnt/nvme1=16,32" keyed by root directory; 0
+ * disables io_uring and uses buffered stdio.
+ *
+ * By default every object is stored in a file of its own under
+ * root_dir/fsdir. With MC_STORE_DISK_ENGINE=log objects are appended to the
+ * segment files of a LogStructuredStore under root_dir/fsdir/log instead,
+ * with segments of MC_STORE_DISK_LOG_SEGMENT_MB megabytes (1024 by default).
+ * Its index lives in memory, so the layout suits local disks rather than
+ * directories shared between clients.
+ *
+ * MC_STORE_DISK_ENGINE=shared is the log structured layout for a parallel
+ * filesystem shared by the clients of several nodes: each client appends to
+ * a log of its own under root_dir/fsdir/log/<node>, and objects are read
+ * through a SharedFileReader, with cached descriptors and parallel striped
+ * reads. Since disk replicas carry the path and offset of their object, any
+ * client mounting the filesystem can read the objects of the others.
  */
 class StorageBackend  {
    public:
@@ -25,19 +51,28 @@ class StorageBackend  {
      * @param fsdir  subdirectory name
      * @note Directory existence is not checked in constructor
      */
-    explicit StorageBackend(const std::string& root_dir, const std::string& fsdir): root_dir_(root_dir), fsdir_(fsdir) {}
+    explicit StorageBackend(const std::string& root_dir,
+                            const std::string& fsdir)
+        : root_dir_(root_dir),
+          fsdir_(fsdir),
+          uring_pool_(std::make_shared<IoUringEnginePool>(
+              GetUringQueueDepth(root_dir))) {}
 
     /**
      * @brief Factory method to create a StorageBackend instance
      * @param root_dir Root directory path for object storage
      * @param fsdir  subdirectory name
+     * @param node Name of the client in a shared directory, the host name
+     * if empty
      * @return shared_ptr to new instance or nullptr if directory is invalid
      * 
      * Performs validation of the root directory before creating the instance:
      * - Verifies directory exists
      * - Verifies path is actually a directory
      */
-    static std::shared_ptr<StorageBackend> Create(const std::string& root_dir, const std::string& fsdir) {
+    static std::shared_ptr<StorageBackend> Create(
+        const std::string& root_dir, const std::string& fsdir,
+        const std::string& node = "") {
         namespace fs = std::filesystem;
         if (!fs::exists(root_dir)) {
             LOG(INFO) << "Root directory does not exist: " << root_dir;
@@ -50,7 +85,9 @@ class StorageBackend  {
             return nullptr;
         }
         std::string real_fsdir = "moon_" + fsdir;
-        return std::make_shared<StorageBackend>(root_dir, real_fsdir);
+        auto backend = std::make_shared<StorageBackend>(root_dir, real_fsdir);
+        backend->OpenLogStore(node);
+        return backend;
     }  
     
     /**
@@ -68,6 +105,19 @@ class StorageBackend  {
      * @return ErrorCode indicating operation status
      */
     ErrorCode StoreObject(const ObjectKey& key, const std::string& str) ;
+
+    /**
+     * @brief Stores several objects from strings
+     * @param keys Object identifiers
+     * @param values Object data, one string per key
+     * @return One ErrorCode per key
+     *
+     * With the log structured layout adjacent objects are written with a
+     * single sequential write, otherwise this is StoreObject in a loop.
+     */
+    std::vector<ErrorCode> BatchStoreObject(
+        const std::vector<ObjectKey>& keys,
+        const std::vector<std::string>& values);
     
     /**
      * @brief Loads an object into slices
@@ -81,9 +131,12 @@ class StorageBackend  {
      * @brief Loads an object into slices
      * @param key Object identifier
      * @param slices Output vector for loaded data slices
+     * @param path File holding the object, from its disk replica descriptor
+     * @param offset Offset of the object in the file
      * @return ErrorCode indicating operation status
      */
-    ErrorCode LoadObject(const ObjectKey& key, std::vector<Slice>& slices, std::string& path) ;
+    ErrorCode LoadObject(const ObjectKey& key, std::vector<Slice>& slices,
+                         std::string& path, uint64_t offset = 0);
     
     /**
      * @brief Loads an object as a string
@@ -109,6 +162,15 @@ class StorageBackend  {
      */
     std::unordered_map<ObjectKey, Replica::Descriptor> BatchQueryKey(const std::vector<ObjectKey>& keys);
 
+    /**
+     * @brief Lists the objects already on disk, e.g. to register them with
+     * the master after a restart
+     * @return Each key with its disk descriptor. Only the log structured
+     * layout keeps the keys; file names are sanitized keys that cannot be
+     * turned back into them, so the file-per-object layout lists nothing.
+     */
+    std::vector<std::pair<ObjectKey, DiskDescriptor>> ListObjects() const;
+
     /**
      * @brief Checks if an object with the given key exists
      * @param key Object identifier
@@ -145,7 +207,29 @@ class StorageBackend  {
     std::string ResolvePath(const ObjectKey& key) const;
 
     ErrorCode LoadObjectInPath(const std::string& path,
-                                    std::vector<Slice>& slices);
+                                    std::vector<Slice>& slices,
+                                    uint64_t offset = 0);
+
+    /**
+     * @brief Switch to the log structured layout if MC_STORE_DISK_ENGINE is
+     * log, or shared to also read through a SharedFileReader
+     */
+    void OpenLogStore(const std::string& node);
+
+    /**
+     * @brief Queue depth configured for root_dir, 0 if io_uring is disabled
+     */
+    static unsigned GetUringQueueDepth(const std::string& root_dir);
+
+    ErrorCode StoreWithUring(IoUringEngine& engine, const std::string& path,
+                             const std::vector<iovec>& iovs);
+    ErrorCode LoadWithUring(IoUringEngine& engine, const std::string& path,
+                            const std::vector<iovec>& iovs, uint64_t offset);
+
+    std::shared_ptr<IoUringEnginePool> uring_pool_;
+    std::unique_ptr<LogStructuredStore> log_store_;
+    // Set with MC_STORE_DISK_ENGINE=shared
+    std::unique_ptr<SharedFileReader> shared_reader_;
 
 };
 
@@ -1,28 +1,44 @@
 // ThreadPool.h
+#pragma once
 
+#include <cstddef>
 #include <vector>
-#include <queue>
 #include <functional>
+#include <memory>
+#include <new>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
 namespace mooncake {
 /**
  * @class ThreadPool
- * @brief A thread pool implementation for concurrent task execution.
- * 
- * Manages a fixed number of worker threads that process tasks from a queue.
+ * @brief A work-stealing thread pool for concurrent task execution.
+ *
+ * Each worker owns a queue of tasks. Tasks enqueued by a worker go to its own
+ * queue, the others are spread over the queues in turn, and idle workers
+ * steal from the queues of the others, those on their NUMA node first. Small
+ * tasks are stored inline, so enqueueing them does not allocate.
  * Supports task enqueueing and graceful shutdown.
  */
 class ThreadPool {
 public:
-    /// Constructs a thread pool with specified number of worker threads
-    explicit ThreadPool(size_t num_threads);
-    
+    /**
+     * @brief Constructs a thread pool with specified number of worker threads
+     * @param bind_numa_nodes Spread the workers over the NUMA nodes in turn,
+     * each bound to the CPUs of its node
+     */
+    explicit ThreadPool(size_t num_threads, bool bind_numa_nodes = false);
+
     /// Destructor (stops all threads and completes pending tasks)
     ~ThreadPool();
 
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
     /**
      * @brief Enqueues a task for execution
      * @tparam F Callable type
@@ -38,32 +54,140 @@ public:
     void stop();
 
 private:
-    std::vector<std::thread> workers;       ///< Worker thread pool
-    std::queue<std::function<void()>> tasks; ///< Task queue
-    
-    std::mutex queue_mutex;                 ///< Protects task queue access
-    std::condition_variable condition;      ///< Synchronizes task assignment
+    /// Move-only void() callable, holding closures of up to kInlineSize
+    /// bytes without a heap allocation
+    class Task {
+    public:
+        static constexpr size_t kInlineSize = 96;
+
+        Task() = default;
+
+        template<class F, class = std::enable_if_t<
+                              !std::is_same_v<std::decay_t<F>, Task>>>
+        explicit Task(F&& f) {
+            using T = std::decay_t<F>;
+            if constexpr (sizeof(T) <= kInlineSize &&
+                          alignof(T) <= alignof(std::max_align_t) &&
+                          std::is_nothrow_move_constructible_v<T>) {
+                new (storage_) T(std::forward<F>(f));
+                ops_ = &kInlineOps<T>;
+            } else {
+                new (storage_) T*(new T(std::forward<F>(f)));
+                ops_ = &kHeapOps<T>;
+            }
+        }
+
+        Task(Task&& other) noexcept { take(other); }
+
+        Task& operator=(Task&& other) noexcept {
+            if (this != &other) {
+                reset();
+                take(other);
+            }
+            return *this;
+        }
+
+        ~Task() { reset(); }
+
+        void operator()() { ops_->invoke(storage_); }
+
+    private:
+        struct Ops {
+            void (*invoke)(void*);
+            // Move constructs at dst from src and destroys src
+            void (*relocate)(void* dst, void* src);
+            void (*destroy)(void*);
+        };
+
+        template<class T>
+        static constexpr Ops kInlineOps = {
+            [](void* p) { (*static_cast<T*>(p))(); },
+            [](void* dst, void* src) {
+                new (dst) T(std::move(*static_cast<T*>(src)));
+                static_cast<T*>(src)->~T();
+            },
+            [](void* p) { static_cast<T*>(p)->~T(); }};
+
+        template<class T>
+        static constexpr Ops kHeapOps = {
+            [](void* p) { (**static_cast<T**>(p))(); },
+            [](void* dst, void* src) {
+                new (dst) T*(*static_cast<T**>(src));
+            },
+            [](void* p) { delete *static_cast<T**>(p); }};
+
+        void take(Task& other) {
+            ops_ = other.ops_;
+            if (ops_) {
+                ops_->relocate(storage_, other.storage_);
+                other.ops_ = nullptr;
+            }
+        }
+
+        void reset() {
+            if (ops_) {
+                ops_->destroy(storage_);
+                ops_ = nullptr;
+            }
+        }
+
+        alignas(std::max_align_t) unsigned char storage_[kInlineSize];
+        const Ops* ops_ = nullptr;
+    };
+
+    /// Queue of a worker, a ring buffer that only grows. The owner takes
+    /// from the front, thieves from the back.
+    struct Worker {
+        std::mutex mutex;
+        std::vector<Task> ring;
+        size_t head = 0;
+        size_t count = 0;
+        int numa_node = -1;
+        std::thread thread;
+
+        void push(Task task);
+        bool popFront(Task& task);
+        bool popBack(Task& task);
+    };
+
+    void push(Task task);
+
+    /// Runs a task of worker self, or one stolen from another worker
+    bool runOne(size_t self);
+
+    void workerLoop(size_t self);
+
+    std::vector<std::unique_ptr<Worker>> workers;   ///< Worker threads
+    std::atomic<size_t> next_worker{0};     ///< Queue of the next outside task
+    std::atomic<size_t> pending{0};         ///< Tasks queued and not taken
+
+    std::mutex sleep_mutex;                 ///< Guards idle workers' sleep
+    std::condition_variable condition;      ///< Wakes idle workers
+    std::atomic<size_t> idle{0};            ///< Workers asleep or about to be
     std::atomic<bool> stop_flag;            ///< Termination signal
+
+    /// Pool and worker index of the calling thread if it is a worker
+    static thread_local const ThreadPool* current_pool;
+    static thread_local size_t current_worker;
 };
 
 /**
  * @brief Enqueues a task by wrapping it in a void() function object
- * @details Locks the queue, checks stop condition, and notifies a worker
+ * @details Queues it to the calling worker, or to the workers in turn, and
+ * wakes a worker if any is idle
  */
 template<class F, class... Args>
 void ThreadPool::enqueue(F&& f, Args&&... args) {
-    auto task = std::make_shared<std::function<void()>>(
-        [f = std::forward<F>(f), ...args = std::forward<Args>(args)]() mutable {
-            std::invoke(f, args...);  
-        }
-    );
-    {
-        std::unique_lock<std::mutex> lock(queue_mutex);
-        if(stop_flag) {
-            throw std::runtime_error("enqueue on stopped ThreadPool");
-        }
-        tasks.emplace([task]{(*task)();});
+    if (stop_flag) {
+        throw std::runtime_error("enqueue on stopped ThreadPool");
+    }
+    if constexpr (sizeof...(Args) == 0) {
+        push(Task(std::forward<F>(f)));
+    } else {
+        push(Task(
+            [f = std::forward<F>(f), ...args = std::forward<Args>(args)]() mutable {
+                std::invoke(f, args...);
+            }));
     }
-    condition.notify_one();  ///< Wake one waiting worker
 }
 }
@@ -1,17 +1,26 @@
 #pragma once
 
+#include <async_simple/Executor.h>
+
 #include <atomic>
 #include <condition_variable>
+#include <coroutine>
 #include <cstring>
+#include <functional>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <optional>
 #include <ostream>
 #include <queue>
+#include <shared_mutex>
 #include <string>
 #include <thread>
+#include <utility>
 #include <vector>
 
+#include "gds_file_reader.h"
+#include "replica_selector.h"
 #include "transfer_engine.h"
 #include "transport/transport.h"
 #include "types.h"
@@ -28,23 +37,27 @@ enum class TransferStrategy {
     FILE_READ = 2      // File read operation
 };
 
-/**
- * @brief Stream operator for TransferStrategy
- */
-inline std::ostream& operator<<(std::ostream& os,
-                                const TransferStrategy& strategy) noexcept {
+inline const char* toString(TransferStrategy strategy) noexcept {
     switch (strategy) {
         case TransferStrategy::LOCAL_MEMCPY:
-            return os << "LOCAL_MEMCPY";
+            return "LOCAL_MEMCPY";
         case TransferStrategy::TRANSFER_ENGINE:
-            return os << "TRANSFER_ENGINE";
+            return "TRANSFER_ENGINE";
         case TransferStrategy::FILE_READ:
-            return os << "FILE_READ";
+            return "FILE_READ";
         default:
-            return os << "UNKNOWN";
+            return "UNKNOWN";
     }
 }
 
+/**
+ * @brief Stream operator for TransferStrategy
+ */
+inline std::ostream& operator<<(std::ostream& os,
+                                const TransferStrategy& strategy) noexcept {
+    return os << toString(strategy);
+}
+
 /**
  * @brief Abstract base class for operation state management
  *
@@ -89,10 +102,31 @@ class OperationState {
      */
     virtual void wait_for_completion() = 0;
 
+    /**
+     * @brief Register a callback run with the result once the operation
+     * completes, or right away if it already has
+     * @return false if this kind of operation does not support callbacks
+     */
+    virtual bool add_callback(std::function<void(ErrorCode)> /*callback*/) {
+        return false;
+    }
+
    protected:
+    /**
+     * @brief Record the result, then wake the waiters and run the callbacks
+     * outside the lock. For the states completed from outside.
+     */
+    void complete(ErrorCode error_code);
+
+    /**
+     * @brief add_callback of the states completed by complete()
+     */
+    bool queue_callback(std::function<void(ErrorCode)> callback);
+
     std::optional<ErrorCode> result_ = std::nullopt;
     mutable std::mutex mutex_;
     std::condition_variable cv_;
+    std::vector<std::function<void(ErrorCode)>> callbacks_;
 };
 
 /**
@@ -105,14 +139,7 @@ class MemcpyOperationState : public OperationState {
         return result_.has_value();
     }
 
-    void set_completed(ErrorCode error_code) {
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            assert(!result_.has_value());
-            result_.emplace(error_code);
-        }
-        cv_.notify_all();
-    }
+    void set_completed(ErrorCode error_code) { complete(error_code); }
 
     void wait_for_completion() override {
         std::unique_lock<std::mutex> lock(mutex_);
@@ -122,6 +149,10 @@ class MemcpyOperationState : public OperationState {
     TransferStrategy get_strategy() const override {
         return TransferStrategy::LOCAL_MEMCPY;
     }
+
+    bool add_callback(std::function<void(ErrorCode)> callback) override {
+        return queue_callback(std::move(callback));
+    }
 };
 
 class FilereadOperationState : public OperationState {
@@ -132,14 +163,7 @@ class FilereadOperationState : public OperationState {
         return result_.has_value();
     }
 
-    void set_completed(ErrorCode error_code) {
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            assert(!result_.has_value());
-            result_.emplace(error_code);
-        }
-        cv_.notify_all();
-    }
+    void set_completed(ErrorCode error_code) { complete(error_code); }
 
     void wait_for_completion() override {
         std::unique_lock<std::mutex> lock(mutex_);
@@ -149,21 +173,113 @@ class FilereadOperationState : public OperationState {
     TransferStrategy get_strategy() const override {
         return TransferStrategy::FILE_READ;
     }
+
+    bool add_callback(std::function<void(ErrorCode)> callback) override {
+        return queue_callback(std::move(callback));
+    }
 };
 
 /**
- * @brief Operation state for transfer engine operations
+ * @brief Operation state of an asynchronous client operation
+ *
+ * Completed by the client once all steps of the operation (master calls and
+ * the transfers of every replica) are done. Callbacks run on the completing
+ * thread, outside the state lock.
  */
-class TransferEngineOperationState : public OperationState {
+class AsyncOperationState : public OperationState {
    public:
-    TransferEngineOperationState(TransferEngine& engine, BatchID batch_id,
-                                 size_t batch_size)
+    explicit AsyncOperationState(TransferStrategy strategy)
+        : strategy_(strategy) {}
+
+    bool is_completed() override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return result_.has_value();
+    }
+
+    void set_completed(ErrorCode error_code) { complete(error_code); }
+
+    void wait_for_completion() override {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return result_.has_value(); });
+    }
+
+    TransferStrategy get_strategy() const override { return strategy_; }
+
+    bool add_callback(std::function<void(ErrorCode)> callback) override {
+        return queue_callback(std::move(callback));
+    }
+
+   private:
+    const TransferStrategy strategy_;
+};
+
+/**
+ * @brief A batch of the transfer engine, freed once the last operation
+ * waiting on its tasks is gone
+ */
+class EngineBatch {
+   public:
+    EngineBatch(TransferEngine& engine, BatchID batch_id, size_t batch_size)
         : engine_(engine), batch_id_(batch_id), batch_size_(batch_size) {
         CHECK(batch_id_ != Transport::INVALID_BATCH_ID)
             << "Invalid batch ID for transfer engine operation";
     }
 
-    ~TransferEngineOperationState() { engine_.freeBatchID(batch_id_); }
+    ~EngineBatch() { engine_.freeBatchID(batch_id_); }
+
+    EngineBatch(const EngineBatch&) = delete;
+    EngineBatch& operator=(const EngineBatch&) = delete;
+
+    TransferEngine& engine() const { return engine_; }
+    BatchID id() const { return batch_id_; }
+    size_t size() const { return batch_size_; }
+
+    /**
+     * @brief Run callback from the notifier thread of the engine once every
+     * task of the batch is done. The batch must be fully submitted.
+     * @return false if the engine cannot watch the batch
+     */
+    bool notifyWhenDone(std::function<void()> callback);
+
+   private:
+    // Shared with the engine callback, which may outlive the batch
+    struct Waiters {
+        std::mutex mutex;
+        std::vector<std::function<void()>> callbacks;
+        bool watching = false;
+    };
+
+    TransferEngine& engine_;
+    const BatchID batch_id_;
+    const size_t batch_size_;
+    const std::shared_ptr<Waiters> waiters_ = std::make_shared<Waiters>();
+};
+
+/**
+ * @brief Operation state for transfer engine operations
+ *
+ * Waits for the tasks [first_task, first_task + task_count) of its batch,
+ * so that the transfers of several objects can share one batch and still
+ * complete one by one. Callbacks run from the notifier thread of the engine
+ * once the whole batch is done, without a thread polling for them.
+ */
+class TransferEngineOperationState
+    : public OperationState,
+      public std::enable_shared_from_this<TransferEngineOperationState> {
+   public:
+    TransferEngineOperationState(TransferEngine& engine, BatchID batch_id,
+                                 size_t batch_size)
+        : TransferEngineOperationState(
+              std::make_shared<EngineBatch>(engine, batch_id, batch_size), 0,
+              batch_size) {}
+
+    TransferEngineOperationState(std::shared_ptr<EngineBatch> batch,
+                                 size_t first_task, size_t task_count)
+        : batch_(std::move(batch)),
+          engine_(batch_->engine()),
+          batch_id_(batch_->id()),
+          first_task_(first_task),
+          task_count_(task_count) {}
 
     bool is_completed() override;
 
@@ -173,6 +289,8 @@ class TransferEngineOperationState : public OperationState {
         return TransferStrategy::TRANSFER_ENGINE;
     }
 
+    bool add_callback(std::function<void(ErrorCode)> callback) override;
+
    private:
     /**
      * @brief Check the current completion status of the task, make sure to lock
@@ -183,9 +301,11 @@ class TransferEngineOperationState : public OperationState {
 
     void set_result_internal(ErrorCode error_code);
 
+    const std::shared_ptr<EngineBatch> batch_;
     TransferEngine& engine_;
-    BatchID batch_id_;
-    size_t batch_size_;
+    const BatchID batch_id_;
+    const size_t first_task_;
+    const size_t task_count_;
 };
 
 /**
@@ -229,8 +349,67 @@ class TransferFuture {
      */
     TransferStrategy strategy() const;
 
+    /**
+     * @brief Run a callback with the result once the operation completes
+     * @return false if the operation does not support callbacks; futures
+     * returned by the asynchronous Client API always do
+     */
+    bool then(std::function<void(ErrorCode)> callback);
+
+    /**
+     * @brief Wait for all futures to complete
+     * @return ErrorCode::OK, or the first error in the order of the futures
+     */
+    static ErrorCode waitAll(std::vector<TransferFuture>& futures);
+
+    /**
+     * @brief Wait until at least one of the futures is ready
+     * @return Index of a ready future, or futures.size() if there is none
+     */
+    static size_t waitAny(std::vector<TransferFuture>& futures);
+
+    /**
+     * @brief Keep the endpoints of the transfer marked as busy until the
+     * operation completes and is waited for
+     */
+    void attachTicket(ReplicaSelector::Ticket ticket);
+
+    class Awaiter;
+
+    /**
+     * @brief Await the result in a coroutine, `co_await std::move(future)`
+     * yields the ErrorCode. The coroutine is suspended until the operation
+     * completes, without blocking a thread, and resumes on the executor of
+     * the async_simple Lazy awaiting it, or on the completing thread if it
+     * has none.
+     */
+    Awaiter coAwait(async_simple::Executor* executor) &&;
+    Awaiter operator co_await() &&;
+
    private:
     std::shared_ptr<OperationState> state_;
+    std::optional<ReplicaSelector::Ticket> ticket_;
+};
+
+class TransferFuture::Awaiter {
+   public:
+    Awaiter(TransferFuture future, async_simple::Executor* executor)
+        : future_(std::move(future)), executor_(executor) {}
+
+    bool await_ready() const { return future_.isReady(); }
+
+    /**
+     * @brief Resume from a callback of the operation, or right away if the
+     * operation completed meanwhile or does not support callbacks, in which
+     * case await_resume blocks
+     */
+    bool await_suspend(std::coroutine_handle<> handle);
+
+    ErrorCode await_resume() { return future_.wait(); }
+
+   private:
+    TransferFuture future_;
+    async_simple::Executor* executor_;
 };
 
 /**
@@ -260,12 +439,20 @@ struct MemcpyTask {
 /**
  * @brief Thread pool for asynchronous memcpy operations
  *
- * This class manages a single worker thread that executes memcpy operations
- * asynchronously.
+ * Workers are spread evenly over the NUMA nodes and bound to them, each node
+ * with its own task queue. A task is queued on the node holding its
+ * destination buffer, and large tasks are split into chunks that the workers
+ * of that node copy in parallel. Chunks of at least kNonTemporalThreshold
+ * bytes are copied with non-temporal stores to avoid polluting the caches,
+ * or offloaded to DSA when MC_DSA_WQ names a work queue, see DsaEngine.
  */
 class MemcpyWorkerPool {
    public:
-    explicit MemcpyWorkerPool();
+    // Tasks smaller than this are not split
+    static constexpr size_t kMinChunkSize = 4 * 1024 * 1024;
+    static constexpr size_t kNonTemporalThreshold = 1024 * 1024;
+
+    explicit MemcpyWorkerPool(size_t num_workers = 1);
     ~MemcpyWorkerPool();
 
     // Non-copyable, non-movable
@@ -280,13 +467,40 @@ class MemcpyWorkerPool {
      */
     void submitTask(MemcpyTask task);
 
-   private:
-    void workerThread();
+    size_t workerCount() const { return workers_.size(); }
 
+    /**
+     * @brief Copy size bytes, with non-temporal stores for large copies
+     */
+    static void copy(void* dest, const void* src, size_t size);
+
+   private:
+    // A chunk of a task, the task completes when all its chunks are done
+    struct Chunk {
+        struct Group {
+            std::shared_ptr<MemcpyOperationState> state;
+            std::atomic<size_t> remaining;
+            std::atomic<bool> failed{false};
+        };
+        std::vector<MemcpyOperation> operations;
+        std::shared_ptr<Group> group;
+    };
+
+    struct NodeQueue {
+        int numa_node = -1;
+        size_t num_workers = 0;
+        std::queue<Chunk> chunks;
+        std::mutex mutex;
+        std::condition_variable cv;
+    };
+
+    void workerThread(NodeQueue* queue);
+    NodeQueue& selectQueue(const MemcpyTask& task);
+    static void runChunk(Chunk& chunk);
+
+    std::vector<std::unique_ptr<NodeQueue>> queues_;
     std::vector<std::thread> workers_;
-    std::queue<MemcpyTask> task_queue_;
-    std::mutex queue_mutex_;
-    std::condition_variable queue_cv_;
+    std::atomic<size_t> next_queue_{0};
     std::atomic<bool> shutdown_;
 };
 
@@ -298,15 +512,18 @@ struct FilereadTask {
     size_t file_size;
     std::vector<Slice> slices;
     std::shared_ptr<FilereadOperationState> state;
+    uint64_t file_offset;
 
     FilereadTask(const std::string &path,
             size_t size,
             const std::vector<Slice>& slices_ref,
-            std::shared_ptr<FilereadOperationState> s)
+            std::shared_ptr<FilereadOperationState> s,
+            uint64_t offset = 0)
     : file_path(path),
         file_size(size),
         slices(slices_ref),
-        state(std::move(s)) {}
+        state(std::move(s)),
+        file_offset(offset) {}
 };
 
 /**
@@ -341,6 +558,8 @@ class FilereadWorkerPool {
     std::condition_variable queue_cv_;
     std::atomic<bool> shutdown_;
     std::shared_ptr<StorageBackend> backend_;
+    // Reads into GPU memory, null without GPUDirect Storage
+    std::unique_ptr<GdsFileReader> gds_reader_;
 };
 
 /**
@@ -373,12 +592,152 @@ class TransferSubmitter {
         const Replica::Descriptor& replica,
         std::vector<Slice>& slices, Transport::TransferRequest::OpCode op_code);
 
+    /**
+     * @brief Submit a transfer from the cheapest complete replica in the list
+     * @return TransferFuture, or nullopt if no replica is complete or the
+     * submission failed
+     */
+    std::optional<TransferFuture> submit(
+        const std::vector<Replica::Descriptor>& replica_list,
+        std::vector<Slice>& slices, Transport::TransferRequest::OpCode op_code);
+
+    /**
+     * @brief Read or write disjoint stripes of one object through several
+     * complete memory replicas in parallel
+     *
+     * The buffers of the object are split into contiguous stripes of about
+     * the same size, one per replica, and each stripe is submitted as its
+     * own transfer, so a large object is not capped by the bandwidth of a
+     * single remote NIC. Only replicas with the same buffer layout take
+     * part. The caller must wait for all returned futures.
+     *
+     * @return One future per stripe, or nullopt if the object is not worth
+     * striping (a local replica exists, fewer than two usable replicas, or a
+     * single buffer) or a stripe failed to submit
+     */
+    std::optional<std::vector<TransferFuture>> submitStriped(
+        const std::vector<Replica::Descriptor>& replica_list,
+        std::vector<Slice>& slices, Transport::TransferRequest::OpCode op_code);
+
+    /**
+     * @brief An object to transfer with submitBatch, both pointers must
+     * stay valid until its future completes
+     */
+    struct BatchItem {
+        const Replica::Descriptor* replica;
+        std::vector<Slice>* slices;
+    };
+
+    /**
+     * @brief Submit the transfers of several objects at once
+     *
+     * The objects that go through the transfer engine share one engine
+     * batch, so that a batch of N keys costs one batch allocation and one
+     * submission instead of N. Each object still gets its own future,
+     * waiting only for its own tasks. Requests that continue the previous
+     * one on both the local and the remote side are merged into it (see
+     * mergeRequest), so objects packed next to each other, read into
+     * adjacent buffers, take one request; their futures then share it.
+     * Local, inline and disk replicas are submitted as submit does.
+     *
+     * @return One future per item, nullopt for the items that failed to
+     * submit
+     */
+    std::vector<std::optional<TransferFuture>> submitBatch(
+        const std::vector<BatchItem>& items,
+        Transport::TransferRequest::OpCode op_code);
+
+    /**
+     * @brief Split buffers into at most stripe_count contiguous ranges of
+     * about equal bytes, each holding at least one buffer
+     * @return The start index of each range followed by handles.size()
+     */
+    static std::vector<size_t> planStripes(
+        const std::vector<AllocatedBuffer::Descriptor>& handles,
+        size_t stripe_count);
+
+    // Largest request merged from adjacent ones. Merging thus makes no
+    // request larger than the largest buffer of an unmerged object.
+    static constexpr uint64_t kMaxMergedRequestSize = kMaxSliceSize;
+
+    /**
+     * @brief Extend prev by next if next continues it on both the local and
+     * the remote side and the merged request stays within
+     * kMaxMergedRequestSize
+     * @return Whether next was merged into prev
+     */
+    static bool mergeRequest(Transport::TransferRequest& prev,
+                             const Transport::TransferRequest& next);
+
+    /**
+     * @brief Choose the replica to read, see ReplicaSelector
+     */
+    ErrorCode selectReplica(
+        const std::vector<Replica::Descriptor>& replica_list,
+        Replica::Descriptor& replica) const;
+
+    /**
+     * @brief Mark a local segment as GPU memory, which the CPU cannot copy
+     * so that its transfers go through the transfer engine (GPUDirect RDMA
+     * or NVLink) even with memcpy enabled
+     */
+    void addDeviceMemory(uintptr_t base, size_t size);
+    void removeDeviceMemory(uintptr_t base);
+
+    /**
+     * @brief Map the segment segment_name mounted at [base, base + size)
+     * by its owner to local_base, where this client maps the same memory,
+     * e.g. a CXL memory pool shared by several hosts. Transfers whose
+     * buffers are all in attached segments are copied with the CPU,
+     * whatever MC_STORE_MEMCPY says, and their replicas rank as local.
+     */
+    void addAttachedSegment(const std::string& segment_name, uintptr_t base,
+                            size_t size, uintptr_t local_base);
+    void removeAttachedSegment(const std::string& segment_name,
+                               uintptr_t base);
+
+    /**
+     * @brief Address in this process of a buffer in a local segment of
+     * host memory or in an attached segment
+     * @return nullopt if the buffer is elsewhere, e.g. in GPU memory or on
+     * another host
+     */
+    std::optional<uintptr_t> localAddress(
+        const AllocatedBuffer::Descriptor& handle) const;
+
    private:
     TransferEngine& engine_;
     const std::string local_hostname_;
+    ReplicaSelector replica_selector_;
     std::unique_ptr<MemcpyWorkerPool> memcpy_pool_;
     std::unique_ptr<FilereadWorkerPool> fileread_pool_;
     bool memcpy_enabled_;
+    // Local segments in GPU memory by base address, with their sizes
+    mutable std::shared_mutex device_memory_mutex_;
+    std::map<uintptr_t, size_t> device_memory_;
+    std::atomic<bool> has_device_memory_{false};
+    struct AttachedSegment {
+        size_t size;
+        uintptr_t local_base;
+    };
+    // Attached segments by segment name and base address in their owner
+    mutable std::shared_mutex attached_segments_mutex_;
+    std::map<std::pair<std::string, uintptr_t>, AttachedSegment>
+        attached_segments_;
+    std::atomic<bool> has_attached_segments_{false};
+
+    /**
+     * @brief Local address of a buffer in an attached segment
+     * @return nullopt if the buffer is in no attached segment
+     */
+    std::optional<uintptr_t> attachedAddress(
+        const AllocatedBuffer::Descriptor& handle) const;
+
+    /**
+     * @brief Check if all handles are in attached segments
+     */
+    bool isAttachedTransfer(
+        const std::vector<AllocatedBuffer::Descriptor>& handles) const;
 
     /**
      * @brief Select the optimal transfer strategy
@@ -388,7 +747,7 @@ class TransferSubmitter {
         const std::vector<Slice>& slices) const;
 
     /**
-     * @brief Check if all handles refer to local segments
+     * @brief Check if all handles refer to local segments in host memory
      */
     bool isLocalTransfer(
         const std::vector<AllocatedBuffer::Descriptor>& handles) const;
@@ -407,6 +766,16 @@ class TransferSubmitter {
         const std::vector<AllocatedBuffer::Descriptor>& handles,
         std::vector<Slice>& slices, Transport::TransferRequest::OpCode op_code);
 
+    /**
+     * @brief Append the transfer engine requests moving slices to or from
+     * handles
+     * @return false if a segment cannot be opened
+     */
+    bool appendTransferRequests(
+        const std::vector<AllocatedBuffer::Descriptor>& handles,
+        std::vector<Slice>& slices, Transport::TransferRequest::OpCode op_code,
+        std::vector<Transport::TransferRequest>& requests);
+
     /**
      * @brief Submit transfer engine operation asynchronously
      */
@@ -414,6 +783,14 @@ class TransferSubmitter {
         const std::vector<AllocatedBuffer::Descriptor>& handles,
         std::vector<Slice>& slices, Transport::TransferRequest::OpCode op_code);
 
+    /**
+     * @brief Copy the value of an inline object into slices, completed on
+     * return
+     */
+    std::optional<TransferFuture> submitInlineRead(
+        const MemoryDescriptor& mem_desc, std::vector<Slice>& slices,
+        Transport::TransferRequest::OpCode op_code);
+
     std::optional<TransferFuture> submitFileReadOperation(
     const Replica::Descriptor& replica, std::vector<Slice>& slices, 
     Transport::TransferRequest::OpCode op_code);
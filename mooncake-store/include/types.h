@@ -5,12 +5,16 @@
 #include <cstdint>
 #include <map>
 #include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <variant>
 #include <vector>
+#include <ylt/util/tl/expected.hpp>
 
 #include "Slab.h"
+#include "offset_allocator/offset_allocator.hpp"
 #include "ylt/struct_json/json_reader.h"
 #include "ylt/struct_json/json_writer.h"
 
@@ -33,8 +37,45 @@ static constexpr double DEFAULT_EVICTION_RATIO = 0.1;
 static constexpr double DEFAULT_EVICTION_HIGH_WATERMARK_RATIO = 1.0;
 static constexpr int64_t ETCD_MASTER_VIEW_LEASE_TTL = 5;    // in seconds
 static constexpr int64_t DEFAULT_CLIENT_LIVE_TTL_SEC = 10;  // in seconds
+static constexpr uint64_t DEFAULT_PERSISTENT_SEGMENT_TTL_SEC =
+    600;  // in seconds
 static const std::string DEFAULT_CLUSTER_ID = "mooncake_cluster";
 
+/**
+ * @brief Eviction engine used by the master when space runs low
+ */
+enum class EvictionEngine {
+    BATCH_SCAN = 0,  // Scan all objects, evict by lease timeout or hint
+    CLOCK,           // Per-shard CLOCK sweep, cost proportional to evictions
+    SIEVE,           // Per-shard SIEVE policy
+    S3FIFO,          // Per-shard S3-FIFO policy
+    W_TINYLFU,       // Per-shard W-TinyLFU policy
+};
+static constexpr EvictionEngine DEFAULT_EVICTION_ENGINE =
+    EvictionEngine::BATCH_SCAN;
+
+/**
+ * @brief Strategy used by the master to choose a segment for each slice
+ */
+enum class AllocationStrategyType {
+    RANDOM = 0,      // Uniformly random segment
+    CAPACITY_AWARE,  // Power of two choices, prefer more free space
+    LOAD_AWARE,      // Power of two choices, prefer less recent transfer load
+    TOPOLOGY_AWARE,  // Replicas in distinct failure domains, near the client
+};
+static constexpr AllocationStrategyType DEFAULT_ALLOCATION_STRATEGY =
+    AllocationStrategyType::RANDOM;
+
+/**
+ * @brief Allocator managing the space of each segment in the master
+ */
+enum class BufferAllocatorType {
+    CACHELIB = 0,  // Slab classes, sizes round up to the class size
+    OFFSET,        // TLSF-style OffsetAllocator, no size classes
+};
+static constexpr BufferAllocatorType DEFAULT_BUFFER_ALLOCATOR_TYPE =
+    BufferAllocatorType::CACHELIB;
+
 // Forward declarations
 class BufferAllocator;
 class AllocatedBuffer;
@@ -113,7 +154,8 @@ enum class ErrorCode : int32_t {
     TRANSFER_FAIL = -800,  ///< Transfer operation failed.
 
     // RPC errors (Range: -900 to -999)
-    RPC_FAIL = -900,  ///< RPC operation failed.
+    RPC_FAIL = -900,     ///< RPC operation failed.
+    MASTER_BUSY = -901,  ///< Master is overloaded, retry later.
 
     // High availability errors (Range: -1000 to -1099)
     ETCD_OPERATION_ERROR = -1000,   ///< etcd operation failed.
@@ -204,6 +246,22 @@ inline std::ostream& operator<<(std::ostream& os,
     return os;
 }
 
+/**
+ * @brief Codecs the client can encode object payloads with, see
+ * payload_codec.h
+ */
+enum class PayloadCodecId : uint8_t {
+    NONE = 0,
+    // Lossless, byte planes of 16-bit elements with nibble codes
+    BYTE_PLANE = 1,
+    // Lossy, FP16 or BF16 elements quantized to FP8 E4M3 with block scales
+    FP8_FROM_FP16 = 2,
+    FP8_FROM_BF16 = 3,
+};
+
+// IDs from this one on are free for codecs registered by applications
+static constexpr uint8_t kFirstCustomPayloadCodec = 128;
+
 /**
  * @brief Configuration for replica management
  */
@@ -211,30 +269,113 @@ struct ReplicateConfig {
     size_t replica_num{1};
     bool with_soft_pin{false};
     std::string preferred_segment{};  // Preferred segment for allocation
+    std::string tag{};  // Groups objects for MasterService::RemoveByTag
+    // Encodes the payload on the client before it is transferred
+    PayloadCodecId codec{PayloadCodecId::NONE};
+    // Hash of the payload, e.g. of a KV block and its prefix. Puts of equal
+    // hashes share one stored copy, see MasterService::PutStart.
+    std::string content_hash{};
+    // Stores the object as this many data fragments plus
+    // ec_parity_fragments parity fragments on distinct segments instead of
+    // full replicas, see erasure_code.h. 0 for full replicas.
+    size_t ec_data_fragments{0};
+    size_t ec_parity_fragments{0};
+    // With replica_num above 1, the client writes one replica and the
+    // others are forwarded from replica to replica, see
+    // MasterService::PutStart
+    bool chain_replication{false};
+    // Places the replicas in segments of GPU memory while they have room,
+    // e.g. for hot KV blocks, see MasterService::AllocateInTier
+    bool prefer_device_memory{false};
+    // Places the objects of a BatchPutStart one after another in one
+    // extent per replica, so that the batch is written and read with few
+    // large transfers, see MasterService::BatchPutStart
+    bool contiguous_batch{false};
+    // Keys of a BatchPutStart that are already stored, or being written,
+    // succeed with no replicas instead of failing with
+    // OBJECT_ALREADY_EXISTS, so that only the missing keys are transferred
+    bool skip_resident{false};
+    // With skip_resident, grants the skipped keys a new lease, as a read
+    // or BatchTouch would
+    bool refresh_resident_lease{false};
+    // Makes the slices the shards of a sharded object, e.g. the heads of a
+    // KV block of each tensor-parallel rank. The first replica of slice i
+    // goes to shard_segments[i] if it has room, e.g. the segment of the
+    // rank reading it with Client::GetShard; empty entries place freely.
+    // Empty for an object of plain slices.
+    std::vector<std::string> shard_segments{};
+    // Expected time until the object is read again, e.g. known from the
+    // queued requests of a scheduler. The batch scan eviction evicts the
+    // objects whose next use is farthest first; 0 for no hint, leaving
+    // the object to recency. See MasterService::BatchTouch.
+    uint64_t next_use_ms{0};
+    // Replaces the value of a key that exists instead of failing with
+    // OBJECT_ALREADY_EXISTS, reusing its buffers when the new value fits
+    // them, see MasterService::PutStart
+    bool upsert{false};
 
     friend std::ostream& operator<<(std::ostream& os,
                                     const ReplicateConfig& config) noexcept {
         return os << "ReplicateConfig: { replica_num: " << config.replica_num
                   << ", with_soft_pin: " << config.with_soft_pin
                   << ", preferred_segment: " << config.preferred_segment
-                  << " }";
+                  << ", tag: " << config.tag
+                  << ", codec: " << static_cast<int>(config.codec)
+                  << ", content_hash: " << config.content_hash
+                  << ", ec_data_fragments: " << config.ec_data_fragments
+                  << ", ec_parity_fragments: " << config.ec_parity_fragments
+                  << ", chain_replication: " << config.chain_replication
+                  << ", prefer_device_memory: "
+                  << config.prefer_device_memory
+                  << ", contiguous_batch: " << config.contiguous_batch
+                  << ", skip_resident: " << config.skip_resident
+                  << ", refresh_resident_lease: "
+                  << config.refresh_resident_lease
+                  << ", shards: " << config.shard_segments.size()
+                  << ", next_use_ms: " << config.next_use_ms
+                  << ", upsert: " << config.upsert << " }";
     }
 };
 
+/**
+ * @brief Interns the names of the segments buffers are allocated in, so that
+ * each AllocatedBuffer keeps a 32-bit ID rather than its own copy of the
+ * name. Names are never dropped, there are only as many as the segments
+ * ever mounted.
+ */
+class SegmentNameTable {
+   public:
+    // ID of name, interned on first use. The empty name is 0
+    static uint32_t Intern(std::string_view name);
+
+    // Name of an ID returned by Intern, without taking a lock
+    static const std::string& Name(uint32_t id);
+};
+
 class AllocatedBuffer {
    public:
     friend class BufferAllocator;
     // Forward declaration of the descriptor struct
     struct Descriptor;
 
+    // segment_id is the SegmentNameTable ID of the segment name
     AllocatedBuffer(std::shared_ptr<BufferAllocator> allocator,
-                    std::string segment_name, void* buffer_ptr,
-                    std::size_t size)
+                    uint32_t segment_id, void* buffer_ptr, std::size_t size)
         : allocator_(std::move(allocator)),
-          segment_name_(std::move(segment_name)),
+          segment_id_(segment_id),
           buffer_ptr_(buffer_ptr),
           size_(size) {}
 
+    // A part of parent, e.g. an object a client placed in the extent of an
+    // allocation credit. Its space is freed with parent, once parent's
+    // owner and all of its parts released it.
+    AllocatedBuffer(std::shared_ptr<AllocatedBuffer> parent, void* buffer_ptr,
+                    std::size_t size)
+        : segment_id_(parent->segment_id_),
+          buffer_ptr_(buffer_ptr),
+          size_(size),
+          parent_(std::move(parent)) {}
+
     ~AllocatedBuffer();
 
     AllocatedBuffer(const AllocatedBuffer&) = delete;
@@ -246,8 +387,14 @@ class AllocatedBuffer {
 
     [[nodiscard]] std::size_t size() const noexcept { return this->size_; }
 
+    [[nodiscard]] const std::string& segment_name() const {
+        return SegmentNameTable::Name(segment_id_);
+    }
+
+    [[nodiscard]] uint32_t segment_id() const noexcept { return segment_id_; }
+
     [[nodiscard]] bool isAllocatorValid() const {
-        return !allocator_.expired();
+        return parent_ ? parent_->isAllocatorValid() : !allocator_.expired();
     }
 
     // Serialize the buffer into a descriptor for transfer
@@ -267,18 +414,25 @@ class AllocatedBuffer {
     };
 
     void mark_complete() { status = BufStatus::COMPLETE; }
+    void mark_init() { status = BufStatus::INIT; }
 
    private:
+    // Kept for every stored object, so laid out without padding
     std::weak_ptr<BufferAllocator> allocator_;
-    std::string segment_name_;
+    uint32_t segment_id_;
     BufStatus status{BufStatus::INIT};
     void* buffer_ptr_{nullptr};
     std::size_t size_{0};
+    // Set when allocated by the offset allocator, which takes it back into
+    // a handle to free the space, see BufferAllocator::deallocate
+    offset_allocator::OffsetAllocation offset_allocation_;
+    // Set for a part of another buffer
+    std::shared_ptr<AllocatedBuffer> parent_;
 };
 
 // Implementation of get_descriptor
 inline AllocatedBuffer::Descriptor AllocatedBuffer::get_descriptor() const {
-    return {segment_name_, static_cast<uint64_t>(size()),
+    return {segment_name(), static_cast<uint64_t>(size()),
             reinterpret_cast<uintptr_t>(buffer_ptr_), status};
 }
 
@@ -286,7 +440,7 @@ inline AllocatedBuffer::Descriptor AllocatedBuffer::get_descriptor() const {
 inline std::ostream& operator<<(std::ostream& os,
                                 const AllocatedBuffer& buffer) {
     return os << "AllocatedBuffer: { "
-              << "segment_name: " << buffer.segment_name_ << ", "
+              << "segment_name: " << buffer.segment_name() << ", "
               << "size: " << buffer.size() << ", "
               << "status: " << buffer.status << ", "
               << "buffer_ptr: " << static_cast<void*>(buffer.data()) << " }";
@@ -294,13 +448,28 @@ inline std::ostream& operator<<(std::ostream& os,
 
 struct MemoryDescriptor {
     std::vector<AllocatedBuffer::Descriptor> buffer_descriptors;
-    YLT_REFL(MemoryDescriptor, buffer_descriptors);
+    // Value of an object kept in the master's metadata by PutInline. Its
+    // single buffer then only gives the size and belongs to no segment.
+    std::string inline_data;
+    // Parity fragments of an erasure-coded object, whose buffer_descriptors
+    // are then its data fragments. Fragments on unmounted segments have the
+    // UNREGISTERED status.
+    std::vector<AllocatedBuffer::Descriptor> parity_descriptors;
+    YLT_REFL(MemoryDescriptor, buffer_descriptors, inline_data,
+             parity_descriptors);
+
+    bool is_inline() const noexcept { return !inline_data.empty(); }
+    bool is_erasure_coded() const noexcept {
+        return !parity_descriptors.empty();
+    }
 };
 
 struct DiskDescriptor {
     std::string file_path{};
     uint64_t file_size = 0;
-    YLT_REFL(DiskDescriptor, file_path, file_size);
+    // Offset of the object in the file, non-zero for log structured storage
+    uint64_t file_offset = 0;
+    YLT_REFL(DiskDescriptor, file_path, file_size, file_offset);
 };
 
 class Replica {
@@ -311,21 +480,109 @@ class Replica {
     Replica(std::vector<std::unique_ptr<AllocatedBuffer>> buffers,
             ReplicaStatus status)
         : buffers_(std::move(buffers)), status_(status) {}
+    // The fragments of an erasure-coded object, the last parity_fragments
+    // buffers being the parity ones
+    Replica(std::vector<std::unique_ptr<AllocatedBuffer>> buffers,
+            ReplicaStatus status, size_t parity_fragments)
+        : buffers_(std::move(buffers)),
+          parity_fragments_(static_cast<uint32_t>(parity_fragments)),
+          status_(status) {}
+    // A copy of the object in a client's storage backend
+    Replica(DiskDescriptor disk, ReplicaStatus status)
+        : disk_(std::make_unique<DiskDescriptor>(std::move(disk))),
+          status_(status) {}
+    // A small object held in the metadata itself, complete from the start
+    explicit Replica(std::string inline_data)
+        : inline_data_(std::make_unique<std::string>(std::move(inline_data))),
+          status_(ReplicaStatus::COMPLETE) {}
 
     void reset() noexcept {
         buffers_.clear();
+        disk_.reset();
+        inline_data_.reset();
+        parity_fragments_ = 0;
         status_ = ReplicaStatus::UNDEFINED;
     }
 
+    [[nodiscard]] bool is_memory_replica() const noexcept { return !disk_; }
+
+    [[nodiscard]] bool is_inline() const noexcept {
+        return inline_data_ && !inline_data_->empty();
+    }
+
+    [[nodiscard]] bool is_erasure_coded() const noexcept {
+        return parity_fragments_ > 0;
+    }
+
     [[nodiscard]] Descriptor get_descriptor() const;
 
     [[nodiscard]] ReplicaStatus status() const { return status_; }
 
+    // Address of the first buffer, which identifies a memory replica within
+    // its object, 0 for a disk replica
+    [[nodiscard]] uintptr_t address() const {
+        return buffers_.empty()
+                   ? 0
+                   : reinterpret_cast<uintptr_t>(buffers_.front()->data());
+    }
+
+    // SegmentNameTable ID of the segment holding all the buffers of a
+    // memory replica, nullopt if they are spread over several segments or
+    // the replica is inline or on disk
+    [[nodiscard]] std::optional<uint32_t> segment_id() const {
+        if (disk_ || inline_data_ || buffers_.empty()) {
+            return std::nullopt;
+        }
+        const uint32_t id = buffers_.front()->segment_id();
+        for (const auto& buf_ptr : buffers_) {
+            if (buf_ptr->segment_id() != id) {
+                return std::nullopt;
+            }
+        }
+        return id;
+    }
+
+    // An erasure-coded replica is only invalid once it lost more fragments
+    // than it has parity ones
     [[nodiscard]] bool has_invalid_handle() const {
-        return std::any_of(buffers_.begin(), buffers_.end(),
-                           [](const std::unique_ptr<AllocatedBuffer>& buf_ptr) {
-                               return !buf_ptr->isAllocatorValid();
-                           });
+        return static_cast<size_t>(std::count_if(
+                   buffers_.begin(), buffers_.end(),
+                   [](const std::unique_ptr<AllocatedBuffer>& buf_ptr) {
+                       return !buf_ptr->isAllocatorValid();
+                   })) > parity_fragments_;
+    }
+
+    // Whether a value of slice_lengths fits the buffers of this memory
+    // replica, slice i in buffer i, so that it can be written in place
+    [[nodiscard]] bool fits(const std::vector<uint64_t>& slice_lengths) const {
+        if (disk_ || is_inline() || is_erasure_coded() ||
+            buffers_.size() != slice_lengths.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < buffers_.size(); ++i) {
+            if (!buffers_[i] || slice_lengths[i] > buffers_[i]->size()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Hand the buffers out again for a value that fits them, e.g. for an
+    // upsert. A shorter slice gets the head of its buffer as a part, the
+    // rest of the space is freed with the buffer.
+    void rewrite(const std::vector<uint64_t>& slice_lengths) {
+        for (size_t i = 0; i < buffers_.size(); ++i) {
+            auto& buf_ptr = buffers_[i];
+            if (slice_lengths[i] == buf_ptr->size()) {
+                buf_ptr->mark_init();
+                continue;
+            }
+            void* data = buf_ptr->data();
+            std::shared_ptr<AllocatedBuffer> whole(std::move(buf_ptr));
+            buf_ptr = std::make_unique<AllocatedBuffer>(std::move(whole), data,
+                                                        slice_lengths[i]);
+        }
+        status_ = ReplicaStatus::PROCESSING;
     }
 
     void mark_complete() {
@@ -389,27 +646,62 @@ class Replica {
     };
 
    private:
+    // Kept for every stored object: the fields of the rarer disk and inline
+    // replicas are out of line, so that a memory replica stays small
     std::vector<std::unique_ptr<AllocatedBuffer>> buffers_;
+    std::unique_ptr<DiskDescriptor> disk_;
+    std::unique_ptr<std::string> inline_data_;
+    uint32_t parity_fragments_ = 0;
     ReplicaStatus status_{ReplicaStatus::UNDEFINED};
 };
 
 inline Replica::Descriptor Replica::get_descriptor() const {
     Replica::Descriptor desc;
     desc.status = status_;
+    if (disk_) {
+        desc.descriptor_variant = *disk_;
+        return desc;
+    }
     MemoryDescriptor mem_desc;
+    if (is_inline()) {
+        mem_desc.buffer_descriptors.push_back(
+            {"", inline_data_->size(), 0, BufStatus::COMPLETE});
+        mem_desc.inline_data = *inline_data_;
+        desc.descriptor_variant = std::move(mem_desc);
+        return desc;
+    }
     mem_desc.buffer_descriptors.reserve(buffers_.size());
-    for (const auto& buf_ptr : buffers_) {
-        if (buf_ptr) {
+    const size_t data_fragments = buffers_.size() - parity_fragments_;
+    for (size_t i = 0; i < buffers_.size(); ++i) {
+        const auto& buf_ptr = buffers_[i];
+        if (!buf_ptr) {
+            continue;
+        }
+        if (parity_fragments_ == 0) {
             mem_desc.buffer_descriptors.push_back(buf_ptr->get_descriptor());
+            continue;
         }
+        auto fragment = buf_ptr->get_descriptor();
+        if (!buf_ptr->isAllocatorValid()) {
+            fragment.status_ = BufStatus::UNREGISTERED;
+        }
+        (i < data_fragments ? mem_desc.buffer_descriptors
+                            : mem_desc.parity_descriptors)
+            .push_back(std::move(fragment));
     }
     desc.descriptor_variant = std::move(mem_desc);
     return desc;
 }
 
 inline std::ostream& operator<<(std::ostream& os, const Replica& replica) {
-    os << "Replica: { " << "status: " << replica.status_ << ", "
-       << "buffers: [";
+    os << "Replica: { " << "status: " << replica.status_ << ", ";
+    if (replica.disk_) {
+        return os << "file: " << replica.disk_->file_path << " }";
+    }
+    if (replica.is_inline()) {
+        return os << "inline: " << replica.inline_data_->size() << " bytes }";
+    }
+    os << "buffers: [";
     for (const auto& buf_ptr : replica.buffers_) {
         if (buf_ptr) {
             os << *buf_ptr;
@@ -434,18 +726,224 @@ const static uint64_t kMaxSliceSize =
 /**
  * @brief Represents a contiguous memory region
  */
+/**
+ * @brief Placement labels of a segment, reported by the client when it
+ * mounts the segment. Empty labels are unknown.
+ */
+struct SegmentTopology {
+    std::string host{};  // Physical host, the segment name if unset
+    std::string rack{};  // Rack or other failure domain above the host
+    std::string nic{};   // NIC or NUMA node the buffer is attached to
+    // GPU whose memory backs the segment, e.g. "cuda:0", empty for host memory
+    std::string device{};
+};
+YLT_REFL(SegmentTopology, host, rack, nic, device);
+
 struct Segment {
     UUID id{0, 0};
     std::string name{};  // The name of the segment, also might be the hostname
                          // of the server that owns the segment
     uintptr_t base{0};
     size_t size{0};
+    SegmentTopology topology{};
+    // Identity of the persistent memory backing the segment, which outlives
+    // the client; zero for memory that goes away with it
+    UUID memory_id{0, 0};
     Segment() = default;
     Segment(const UUID& id, const std::string& name, uintptr_t base,
             size_t size)
         : id(id), name(name), base(base), size(size) {}
 };
-YLT_REFL(Segment, id, name, base, size);
+YLT_REFL(Segment, id, name, base, size, topology, memory_id);
+
+/**
+ * @brief What clients need to cache replica lists: the lease granted by
+ * GetReplicaList, and a version the master increments whenever replicas are
+ * dropped regardless of leases, i.e. when segments are unmounted
+ */
+struct ReplicaCacheInfo {
+    uint64_t lease_ttl_ms{0};
+    uint64_t replica_version{0};
+};
+YLT_REFL(ReplicaCacheInfo, lease_ttl_ms, replica_version);
+
+/**
+ * @brief A memory replica the master wants moved out of a fragmented segment:
+ * the client copies source into target and reports back with CompactionEnd,
+ * or CompactionRevoke if the copy failed
+ */
+struct CompactionTask {
+    std::string key;
+    Replica::Descriptor source;
+    Replica::Descriptor target;
+};
+YLT_REFL(CompactionTask, key, source, target);
+
+/**
+ * @brief Result of LongestPrefixMatch: the number of leading keys that exist
+ * and are complete, and their replica lists if they were asked for
+ */
+struct PrefixMatchResult {
+    uint64_t matched = 0;
+    std::vector<std::vector<Replica::Descriptor>> replica_lists;
+};
+YLT_REFL(PrefixMatchResult, matched, replica_lists);
+
+/**
+ * @brief Result of BatchQueryLocation: where each key is held, as indices
+ * into a dictionary of the segments of the response rather than as replica
+ * descriptors, e.g. for a router picking the node holding most of a prefix
+ */
+struct KeyLocationResult {
+    // Names of the segments the indices of locations refer to
+    std::vector<std::string> segments;
+    // Per key, the segments holding a whole complete memory replica of it,
+    // empty if it is missing or only on disk
+    std::vector<std::vector<uint32_t>> locations;
+    // Per segment, if asked for, the number of leading keys it holds
+    std::vector<uint64_t> prefix_hits;
+
+    // Fills prefix_hits from locations
+    void CountPrefixHits() {
+        prefix_hits.assign(segments.size(), 0);
+        for (size_t i = 0; i < locations.size(); ++i) {
+            for (uint32_t segment : locations[i]) {
+                // Only grows while the segment held every key before
+                if (prefix_hits[segment] == i) {
+                    prefix_hits[segment]++;
+                }
+            }
+        }
+    }
+};
+YLT_REFL(KeyLocationResult, segments, locations, prefix_hits);
+
+/**
+ * @brief A page of ScanKeys: the keys found and the cursor of the next page,
+ * empty once the scan is over
+ */
+struct KeyScanResult {
+    std::vector<std::string> keys;
+    std::string next_cursor;
+};
+YLT_REFL(KeyScanResult, keys, next_cursor);
+
+/**
+ * @brief State of an object sent to follower masters: the complete replicas
+ * of a readable object, none if it is not readable or was removed
+ */
+struct MetadataEntry {
+    std::string key;
+    std::vector<Replica::Descriptor> replicas;
+};
+YLT_REFL(MetadataEntry, key, replicas);
+
+/**
+ * @brief Objects changed after a sequence number of the master's change log.
+ * With reset set the changes are unknown, and the follower reloads all
+ * objects with GetMetadataSnapshot before continuing from next_seq.
+ */
+struct MetadataChanges {
+    uint64_t next_seq = 0;
+    bool reset = false;
+    std::vector<MetadataEntry> entries;
+};
+YLT_REFL(MetadataChanges, next_seq, reset, entries);
+
+/**
+ * @brief The readable objects of some metadata shards, next_shard is 0 after
+ * the last shard
+ */
+struct MetadataSnapshot {
+    uint64_t next_shard = 0;
+    std::vector<MetadataEntry> entries;
+};
+YLT_REFL(MetadataSnapshot, next_shard, entries);
+
+/**
+ * @brief Brings a client's copy of the master's KeyFilter up to next_seq of
+ * its change log. With reset set the copy is replaced by the filter of words
+ * and num_hashes, otherwise words is empty. The keys changed since are then
+ * added to the copy.
+ */
+struct KeyFilterUpdate {
+    uint64_t next_seq = 0;
+    bool reset = false;
+    std::vector<uint64_t> words;
+    uint32_t num_hashes = 0;
+    std::vector<std::string> keys;
+};
+YLT_REFL(KeyFilterUpdate, next_seq, reset, words, num_hashes, keys);
+
+/**
+ * @brief Space of a segment the master reserved for one client until it
+ * expires. The client places small objects in the extent itself and
+ * reports them with CommitCreditPuts, instead of a PutStart and a PutEnd
+ * per object.
+ */
+struct AllocationCredit {
+    uint64_t id = 0;
+    AllocatedBuffer::Descriptor extent;
+    uint64_t ttl_ms = 0;
+};
+YLT_REFL(AllocationCredit, id, extent, ttl_ms);
+
+/**
+ * @brief An object a client wrote into the extent of its allocation
+ * credit, its slices stored one after the other from offset
+ */
+struct CreditPut {
+    std::string key;
+    uint64_t offset = 0;
+    std::vector<uint64_t> slice_lengths;
+    bool with_soft_pin = false;
+};
+YLT_REFL(CreditPut, key, offset, slice_lengths, with_soft_pin);
+
+/**
+ * @brief A buffer of PackedReplicaLists, naming its segment by its index in
+ * PackedReplicaLists::segments
+ */
+struct PackedBuffer {
+    uint32_t segment = 0;
+    uint64_t size = 0;
+    uint64_t buffer_address = 0;
+    BufStatus status = BufStatus::INIT;
+};
+YLT_REFL(PackedBuffer, segment, size, buffer_address, status);
+
+/**
+ * @brief A replica of PackedReplicaLists: the buffers of a memory replica,
+ * or the file of a disk replica
+ */
+struct PackedReplica {
+    ReplicaStatus status = ReplicaStatus::UNDEFINED;
+    std::vector<PackedBuffer> buffers;
+    std::optional<DiskDescriptor> disk;
+    std::string inline_data;
+};
+YLT_REFL(PackedReplica, status, buffers, disk, inline_data);
+
+/**
+ * @brief Result of BatchGetReplicaList sending each segment name once. The
+ * buffers of a batch mostly sit in a few segments, so this takes a fraction
+ * of the bytes of the descriptors, which repeat the name in every buffer.
+ */
+struct PackedReplicaLists {
+    std::vector<std::string> segments;
+    // Per key, OK if its replicas are in replica_lists
+    std::vector<ErrorCode> errors;
+    std::vector<std::vector<PackedReplica>> replica_lists;
+
+    static PackedReplicaLists Pack(
+        const std::vector<
+            tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>&
+            results);
+
+    std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+    Unpack() const;
+};
+YLT_REFL(PackedReplicaLists, segments, errors, replica_lists);
 
 /**
  * @brief Client status from the master's perspective
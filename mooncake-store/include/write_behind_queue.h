@@ -0,0 +1,99 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "storage_backend.h"
+#include "types.h"
+#include "ylt/metric/gauge.hpp"
+
+namespace mooncake {
+
+/**
+ * @brief Writes objects to a storage backend in the background
+ *
+ * Push() copies an object into a staging buffer and returns; worker threads
+ * take the queued objects in batches of up to batch_bytes and store each
+ * batch with StorageBackend::BatchStoreObject, which the log structured
+ * layout turns into large sequential writes. Staging buffers are reused.
+ *
+ * The bytes queued or being written never exceed budget_bytes, except for a
+ * single object larger than the budget: Push() blocks until enough earlier
+ * objects are stored, which applies backpressure to the writers.
+ */
+class WriteBehindQueue {
+   public:
+    // Called on a worker thread for every object stored successfully
+    using StoredCallback = std::function<void(const ObjectKey&)>;
+
+    static constexpr uint64_t kDefaultBudgetBytes = 1ULL << 30;
+    static constexpr uint64_t kDefaultBatchBytes = 4ULL << 20;
+
+    WriteBehindQueue(std::shared_ptr<StorageBackend> backend,
+                     size_t num_threads,
+                     uint64_t budget_bytes = kDefaultBudgetBytes,
+                     uint64_t batch_bytes = kDefaultBatchBytes,
+                     StoredCallback on_stored = nullptr);
+
+    // Stores the queued objects before returning
+    ~WriteBehindQueue();
+
+    WriteBehindQueue(const WriteBehindQueue&) = delete;
+    WriteBehindQueue& operator=(const WriteBehindQueue&) = delete;
+
+    /**
+     * @brief Queue a copy of the object, waiting while the budget is used up
+     * @return false if the queue is stopped
+     */
+    bool Push(const ObjectKey& key, const std::vector<Slice>& slices);
+
+    // Block until every object pushed so far is stored or has failed
+    void Flush();
+
+    // Store the queued objects and join the workers
+    void Stop();
+
+    size_t queue_depth() const;
+    uint64_t bytes_in_flight() const;
+
+    // Prometheus text for the queue depth and bytes in flight gauges
+    std::string SerializeMetrics();
+
+   private:
+    struct Item {
+        ObjectKey key;
+        std::string value;
+    };
+
+    void WorkerThread();
+    // Called with mutex_ held
+    std::string AcquireBuffer(size_t size);
+    void ReleaseBuffer(std::string buffer);
+
+    const std::shared_ptr<StorageBackend> backend_;
+    const uint64_t budget_bytes_;
+    const uint64_t batch_bytes_;
+    const StoredCallback on_stored_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable work_cv_;   // Workers wait for objects
+    std::condition_variable space_cv_;  // Push() and Flush() wait for space
+    std::deque<Item> queue_;
+    // Bytes of queued objects and of those being written
+    uint64_t bytes_in_flight_ = 0;
+    std::vector<std::string> free_buffers_;
+    bool stop_ = false;
+    std::vector<std::thread> workers_;
+
+    ylt::metric::gauge_t queue_depth_gauge_;
+    ylt::metric::gauge_t bytes_in_flight_gauge_;
+};
+
+}  // namespace mooncake
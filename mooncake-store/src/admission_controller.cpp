@@ -0,0 +1,114 @@
+#include "admission_controller.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+
+namespace mooncake {
+
+AdmissionController::AdmissionController(const AdmissionConfig& config)
+    : config_(config),
+      interval_start_(Clock::now()),
+      shed_reads_("master_admission_shed_reads_total",
+                  "Total number of read requests shed as the master is "
+                  "overloaded"),
+      shed_writes_("master_admission_shed_writes_total",
+                   "Total number of write requests shed as the master is "
+                   "overloaded") {
+    const double interval_sec =
+        std::chrono::duration<double>(config_.interval).count();
+    const uint64_t rates[] = {config_.read_rate, config_.write_rate};
+    for (size_t i = 0; i < buckets_.size(); ++i) {
+        buckets_[i].rate = static_cast<double>(rates[i]);
+        buckets_[i].burst = std::max(buckets_[i].rate * interval_sec, 1.0);
+        buckets_[i].tokens = buckets_[i].burst;
+        buckets_[i].last = interval_start_;
+    }
+    LOG(INFO) << "admission_read_rate=" << config_.read_rate
+              << " admission_write_rate=" << config_.write_rate
+              << " admission_target_latency_us="
+              << config_.target_latency.count()
+              << " admission_interval_ms=" << config_.interval.count();
+}
+
+bool AdmissionController::TokenBucket::Take(uint64_t cost,
+                                            Clock::time_point now) {
+    if (rate <= 0) {
+        return true;
+    }
+    if (now > last) {
+        tokens = std::min(
+            burst,
+            tokens + rate * std::chrono::duration<double>(now - last).count());
+        last = now;
+    }
+    if (tokens < 1) {
+        return false;
+    }
+    tokens -= static_cast<double>(cost);
+    return true;
+}
+
+void AdmissionController::RollInterval(Clock::time_point now) {
+    if (now - interval_start_ < config_.interval) {
+        return;
+    }
+    int level = 0;
+    if (config_.target_latency.count() > 0 &&
+        interval_min_latency_ != Clock::duration::max()) {
+        if (interval_min_latency_ >
+            config_.target_latency * kReadShedFactor) {
+            level = 2;
+        } else if (interval_min_latency_ > config_.target_latency) {
+            level = 1;
+        }
+    }
+    if (level != level_.load(std::memory_order_relaxed)) {
+        LOG(WARNING) << "Master overload level " << level
+                     << ", shortest latency "
+                     << std::chrono::duration_cast<std::chrono::microseconds>(
+                            interval_min_latency_)
+                            .count()
+                     << " us";
+    }
+    level_.store(level, std::memory_order_relaxed);
+    interval_start_ = now;
+    interval_min_latency_ = Clock::duration::max();
+}
+
+bool AdmissionController::Admit(OpClass op, uint64_t cost,
+                                Clock::time_point now) {
+    bool admitted;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        RollInterval(now);
+        const int level = level_.load(std::memory_order_relaxed);
+        admitted = op == OpClass::READ ? level < 2 : level < 1;
+        // Shed requests take no tokens
+        admitted = admitted &&
+                   buckets_[static_cast<size_t>(op)].Take(cost, now);
+    }
+    if (!admitted) {
+        (op == OpClass::READ ? shed_reads_ : shed_writes_).inc();
+    }
+    return admitted;
+}
+
+void AdmissionController::Complete(Clock::duration latency,
+                                   Clock::time_point now) {
+    if (config_.target_latency.count() <= 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    RollInterval(now);
+    interval_min_latency_ = std::min(interval_min_latency_, latency);
+}
+
+std::string AdmissionController::SerializeMetrics() {
+    std::string metrics;
+    shed_reads_.serialize(metrics);
+    shed_writes_.serialize(metrics);
+    return metrics;
+}
+
+}  // namespace mooncake
@@ -3,17 +3,25 @@
 
 #include <glog/logging.h>
 
+#include <algorithm>
 #include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
 
 #include "master_metric_manager.h"
 
 namespace mooncake {
 
 AllocatedBuffer::~AllocatedBuffer() {
+    if (parent_) {
+        // The space is freed with the parent
+        return;
+    }
     auto alloc = allocator_.lock();
     if (alloc) {
         alloc->deallocate(this);
-        VLOG(1) << "buf_handle_deallocated segment_name=" << segment_name_
+        VLOG(1) << "buf_handle_deallocated segment_name=" << segment_name()
                 << " size=" << size_;
     } else {
         MasterMetricManager::instance().dec_allocated_size(size_);
@@ -23,14 +31,37 @@ AllocatedBuffer::~AllocatedBuffer() {
 
 // Removed allocated_bytes parameter and member initialization
 BufferAllocator::BufferAllocator(std::string segment_name, size_t base,
-                                 size_t size)
+                                 size_t size, SegmentTopology topology,
+                                 BufferAllocatorType type,
+                                 std::chrono::steady_clock::duration free_delay)
     : segment_name_(segment_name),
+      segment_id_(SegmentNameTable::Intern(segment_name)),
+      topology_(std::move(topology)),
       base_(base),
       total_size_(size),
-      cur_size_(0) {
+      cur_size_(0),
+      type_(type),
+      free_delay_(free_delay) {
     VLOG(1) << "initializing_buffer_allocator segment_name=" << segment_name
             << " base_address=" << reinterpret_cast<void*>(base)
-            << " size=" << size;
+            << " size=" << size << " type=" << static_cast<int>(type);
+
+    if (topology_.host.empty()) {
+        topology_.host = segment_name_;
+    }
+
+    if (type_ == BufferAllocatorType::OFFSET) {
+        // One node per allocation, enough for 64KB objects on average
+        // within bounds that keep the node array small
+        const uint64_t max_allocs = std::clamp<uint64_t>(
+            size / kOffsetAllocatorAvgObjectSize, kOffsetAllocatorMinAllocs,
+            kOffsetAllocatorMaxAllocs);
+        offset_allocator_ =
+            offset_allocator::OffsetAllocator::create(base, size, max_allocs);
+        VLOG(1) << "buffer_allocator_initialized type=offset max_allocs="
+                << max_allocs;
+        return;
+    }
 
     // Calculate the size of the header region.
     header_region_size_ =
@@ -61,11 +92,16 @@ BufferAllocator::BufferAllocator(std::string segment_name, size_t base,
 BufferAllocator::~BufferAllocator() = default;
 
 std::unique_ptr<AllocatedBuffer> BufferAllocator::allocate(size_t size) {
+    if (type_ == BufferAllocatorType::OFFSET) return allocateOffset(size);
+    releasePendingFrees();
     void* buffer = nullptr;
     try {
         // Allocate memory using CacheLib.
         size_t padding_size = std::max(size, kMinSliceSize);
         buffer = memory_allocator_->allocate(pool_id_, padding_size);
+        if (!buffer && rebalanceSlabs(padding_size)) {
+            buffer = memory_allocator_->allocate(pool_id_, padding_size);
+        }
         if (!buffer) {
             LOG(WARNING) << "allocation_failed size=" << size
                          << " segment=" << segment_name_
@@ -83,20 +119,167 @@ std::unique_ptr<AllocatedBuffer> BufferAllocator::allocate(size_t size) {
             << " segment=" << segment_name_ << " address=" << buffer;
     cur_size_.fetch_add(size);
     MasterMetricManager::instance().inc_allocated_size(size);
-    return std::make_unique<AllocatedBuffer>(shared_from_this(), segment_name_,
+    return std::make_unique<AllocatedBuffer>(shared_from_this(), segment_id_,
                                              buffer, size);
 }
 
+bool BufferAllocator::rebalanceSlabs(size_t size) {
+    using facebook::cachelib::ClassId;
+    using facebook::cachelib::Slab;
+    using facebook::cachelib::SlabReleaseMode;
+
+    const auto& pool = memory_allocator_->getPool(pool_id_);
+    const ClassId receiver = pool.getAllocationClassId(size);
+
+    struct Candidate {
+        ClassId class_id;
+        const Slab* slab;
+        double occupancy;
+    };
+    std::vector<Candidate> candidates;
+    int64_t releasing = 0;
+    for (ClassId cid = 0; cid < static_cast<ClassId>(pool.getNumClassId());
+         ++cid) {
+        const auto& alloc_class = pool.getAllocationClass(cid);
+        releasing += alloc_class.getNumActiveReleases();
+        if (cid == receiver) continue;
+        auto [slab, active] = alloc_class.getLeastUsedSlab();
+        if (!slab) continue;
+        double occupancy = static_cast<double>(active) /
+                           static_cast<double>(alloc_class.getAllocsPerSlab());
+        if (occupancy <= kSlabRebalanceMaxOccupancy) {
+            candidates.push_back({cid, slab, occupancy});
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const Candidate& a, const Candidate& b) {
+                  return a.occupancy < b.occupancy;
+              });
+
+    bool released = false;
+    for (const auto& candidate : candidates) {
+        if (candidate.occupancy > 0.0 && releasing >= kMaxReleasingSlabs) {
+            break;
+        }
+        try {
+            auto context = memory_allocator_->startSlabRelease(
+                pool_id_, candidate.class_id, Slab::kInvalidClassId,
+                SlabReleaseMode::kResize, candidate.slab);
+            if (context.isReleased()) {
+                released = true;
+            } else {
+                ++releasing;
+            }
+            VLOG(1) << "slab_release_started segment=" << segment_name_
+                    << " class_id=" << static_cast<int>(candidate.class_id)
+                    << " occupancy=" << candidate.occupancy
+                    << " released=" << context.isReleased();
+        } catch (const std::exception& e) {
+            // The slab changed since it was picked
+            VLOG(1) << "slab_release_skipped segment=" << segment_name_
+                    << " error=" << e.what();
+        }
+    }
+    return released;
+}
+
+void BufferAllocator::releasePendingFrees() {
+    std::vector<PendingFree> released;
+    {
+        MutexLocker lock(&pending_frees_mutex_);
+        const auto now = std::chrono::steady_clock::now();
+        while (!pending_frees_.empty() &&
+               pending_frees_.front().release_at <= now) {
+            released.push_back(std::move(pending_frees_.front()));
+            pending_frees_.pop_front();
+        }
+    }
+    if (released.empty()) {
+        return;
+    }
+    // Freed after the lock is released, the handles free their ranges
+    // when released is destroyed
+    for (auto& pending : released) {
+        if (pending.handle) {
+            continue;
+        }
+        try {
+            // Deallocate memory using CacheLib.
+            memory_allocator_->free(pending.buffer);
+        } catch (const std::exception& e) {
+            LOG(ERROR) << "deallocation_exception error=" << e.what();
+        }
+    }
+    VLOG(1) << "pending_frees_released count=" << released.size()
+            << " segment=" << segment_name_;
+}
+
+std::unique_ptr<AllocatedBuffer> BufferAllocator::allocateOffset(
+    size_t size) {
+    releasePendingFrees();
+    auto handle = offset_allocator_->allocate(size);
+    if (!handle) {
+        LOG(WARNING) << "allocation_failed size=" << size
+                     << " segment=" << segment_name_
+                     << " current_size=" << cur_size_;
+        return nullptr;
+    }
+    void* buffer = handle->ptr();
+    VLOG(1) << "allocation_succeeded size=" << size
+            << " segment=" << segment_name_ << " address=" << buffer;
+    cur_size_.fetch_add(size);
+    MasterMetricManager::instance().inc_allocated_size(size);
+    auto allocated = std::make_unique<AllocatedBuffer>(
+        shared_from_this(), segment_id_, buffer, size);
+    allocated->offset_allocation_ = handle->release();
+    return allocated;
+}
+
+std::unique_ptr<AllocatedBuffer> BufferAllocator::allocateAt(
+    uintptr_t address, size_t size) {
+    if (type_ != BufferAllocatorType::OFFSET || address < base_ ||
+        address - base_ + size > total_size_) {
+        return nullptr;
+    }
+    releasePendingFrees();
+    auto handle = offset_allocator_->allocateAt(address, size);
+    if (!handle) {
+        VLOG(1) << "allocation_at_failed size=" << size
+                << " segment=" << segment_name_ << " address=" << address;
+        return nullptr;
+    }
+    cur_size_.fetch_add(size);
+    MasterMetricManager::instance().inc_allocated_size(size);
+    auto allocated = std::make_unique<AllocatedBuffer>(
+        shared_from_this(), segment_id_, handle->ptr(), size);
+    allocated->offset_allocation_ = handle->release();
+    return allocated;
+}
+
 void BufferAllocator::deallocate(AllocatedBuffer* handle) {
     try {
-        // Deallocate memory using CacheLib.
-        memory_allocator_->free(handle->buffer_ptr_);
+        PendingFree pending{std::chrono::steady_clock::now(), std::nullopt,
+                            nullptr};
+        if (handle->offset_allocation_.offset !=
+            offset_allocator::OffsetAllocation::NO_SPACE) {
+            pending.release_at += free_delay_;
+            pending.handle.emplace(offset_allocator_->adopt(
+                std::exchange(handle->offset_allocation_, {}),
+                handle->size_));
+        } else {
+            pending.buffer = handle->buffer_ptr_;
+        }
+        {
+            MutexLocker lock(&pending_frees_mutex_);
+            pending_frees_.push_back(std::move(pending));
+        }
         handle->status = BufStatus::UNREGISTERED;
-        size_t freed_size =
-            handle->size_;  // Store size before handle might become invalid
+        // Counted as free, so that eviction does not go on while the freed
+        // space is queued or held back
+        size_t freed_size = handle->size_;
         cur_size_.fetch_sub(freed_size);
         MasterMetricManager::instance().dec_allocated_size(freed_size);
-        VLOG(1) << "deallocation_succeeded address=" << handle->buffer_ptr_
+        VLOG(1) << "deallocation_queued address=" << handle->buffer_ptr_
                 << " size=" << freed_size << " segment=" << segment_name_;
     } catch (const std::exception& e) {
         LOG(ERROR) << "deallocation_exception error=" << e.what();
@@ -105,6 +288,19 @@ void BufferAllocator::deallocate(AllocatedBuffer* handle) {
     }
 }
 
+double BufferAllocator::fragmentation() {
+    if (!offset_allocator_) {
+        return 0.0;
+    }
+    releasePendingFrees();
+    auto report = offset_allocator_->storageReport();
+    if (report.totalFreeSpace == 0) {
+        return 0.0;
+    }
+    return 1.0 - static_cast<double>(report.largestFreeRegion) /
+                     static_cast<double>(report.totalFreeSpace);
+}
+
 SimpleAllocator::SimpleAllocator(size_t size) {
     LOG(INFO) << "initializing_simple_allocator size=" << size;
 
@@ -140,6 +140,8 @@ void* AllocationClass::allocateLocked() {
     XDCHECK(memoryInfo != nullptr);
     freedAllocations_.pop_front();
     memoryInfo->allocated = false;
+    ++slabActiveAllocs_[getSlabPtrValue(
+        slabAlloc_.getSlabForMemory(memoryInfo->memory))];
     return reinterpret_cast<void*>(memoryInfo->memory);
   } else {
     return NULL;
@@ -185,6 +187,25 @@ const Slab* AllocationClass::getSlabForReleaseLocked() const noexcept {
   return nullptr;
 }
 
+std::pair<const Slab*, unsigned int> AllocationClass::getLeastUsedSlab()
+    const {
+  std::unique_lock l(lock_);
+  if (!freeSlabs_.empty()) {
+    return {freeSlabs_.front(), 0};
+  }
+  const Slab* leastUsed = nullptr;
+  unsigned int leastActive = 0;
+  for (const auto* slab : allocatedSlabs_) {
+    const auto it = slabActiveAllocs_.find(getSlabPtrValue(slab));
+    const unsigned int active = it == slabActiveAllocs_.end() ? 0 : it->second;
+    if (leastUsed == nullptr || active < leastActive) {
+      leastUsed = slab;
+      leastActive = active;
+    }
+  }
+  return {leastUsed, leastActive};
+}
+
 SlabReleaseContext AllocationClass::startSlabRelease(
     SlabReleaseMode mode, const void* hint, SlabReleaseAbortFn shouldAbortFn) {
   using LockHolder = std::unique_lock<std::mutex>;
@@ -248,13 +269,14 @@ SlabReleaseContext AllocationClass::startSlabRelease(
       freeSlabs_.pop_back();
       header->classId = Slab::kInvalidClassId;
       header->allocSize = 0;
+      slabAllocMap_.erase(getSlabPtrValue(slab));
+      slabActiveAllocs_.erase(getSlabPtrValue(slab));
       return SlabReleaseContext{slab, header->poolId, header->classId, mode};
     }
 
-    // The slab is actively used, so we create a new release alloc map
-    // and mark the slab for release
+    // The slab is actively used, so we mark it for release. Its alloc map
+    // already tracks the freed allocations.
     header->setMarkedForRelease(true);
-    createSlabReleaseAllocMapLocked(slab);
     // remove this slab from the allocatedSlab_ if it exists.
     auto allocIt =
         std::find(allocatedSlabs_.begin(), allocatedSlabs_.end(), slab);
@@ -271,24 +293,23 @@ SlabReleaseContext AllocationClass::startSlabRelease(
     *allocIt = allocatedSlabs_.back();
     allocatedSlabs_.pop_back();
 
-    // if slab is being carved currently, then update slabReleaseAllocMap
-    // allocState with free Allocs info, and then reset it
-    if (currSlab_ == slab) {
-      const auto it = slabAllocMap_.find(getSlabPtrValue(slab));
-      auto& allocState = it->second;
-      XDCHECK_EQ(allocState.size(), getAllocsPerSlab());
-      for (size_t i = currOffset_ / allocationSize_; i < allocState.size();
-           i++) {
-        allocState[i].allocated = true;
+    // all the allocations of the slab are on the free list from the time it
+    // is carved, so withdraw the freed ones and collect the active ones
+    auto& allocState = getSlabReleaseAllocMapLocked(slab);
+    activeAllocations.clear();
+    for (auto& alloc : allocState) {
+      if (alloc.allocated) {
+        freedAllocations_.release(&alloc);
+      } else {
+        activeAllocations.push_back(alloc.memory);
       }
+    }
 
+    if (currSlab_ == slab) {
       currSlab_ = nullptr;
       currOffset_ = 0;
     }
-  } // alloc lock scope
 
-  std::unique_lock l(lock_);
-  return ([&]() {
     if (activeAllocations.empty()) {
       header->classId = Slab::kInvalidClassId;
       header->allocSize = 0;
@@ -297,13 +318,13 @@ SlabReleaseContext AllocationClass::startSlabRelease(
       // released from this AllocationClass. This means we also do not need
       // to keep the slabFreeState
       slabAllocMap_.erase(getSlabPtrValue(slab));
+      slabActiveAllocs_.erase(getSlabPtrValue(slab));
       return SlabReleaseContext{slab, header->poolId, header->classId, mode};
-    } else {
-      ++activeReleases_;
-      return SlabReleaseContext{slab, header->poolId, header->classId,
-                                std::move(activeAllocations), mode};
     }
-  })();
+    ++activeReleases_;
+    return SlabReleaseContext{slab, header->poolId, header->classId,
+                              std::move(activeAllocations), mode};
+  } // alloc lock scope
 }
 
 void* AllocationClass::getAllocForIdx(const Slab* slab, size_t idx) const {
@@ -494,14 +515,15 @@ void AllocationClass::abortSlabRelease(const SlabReleaseContext& context) {
 
   std::unique_lock l(lock_);
   ([&]() {
-    const auto it = slabAllocMap_.find(getSlabPtrValue(slab));
+    const auto it = slabAllocMap_.find(slabPtrVal);
     bool inserted = false;
     if (it != slabAllocMap_.end()) {
-      const auto& allocState = it->second;
+      // the alloc map keeps tracking the slab, so its freed allocations are
+      // put back on the free list
+      auto& allocState = it->second;
       for (size_t idx = 0; idx < allocState.size(); idx++) {
         if (allocState[idx].allocated) {
-          auto alloc = getAllocForIdx(slab, idx);
-          // freedAllocations_.push_front(alloc);
+          freedAllocations_.push_front(&allocState[idx]);
           inserted = true;
         }
       }
@@ -509,7 +531,6 @@ void AllocationClass::abortSlabRelease(const SlabReleaseContext& context) {
     if (inserted) {
       canAllocate_ = true;
     }
-    slabAllocMap_.erase(slabPtrVal);
     allocatedSlabs_.push_back(const_cast<Slab*>(slab));
     // restore the classId and allocSize
     header->classId = classId_;
@@ -541,6 +562,7 @@ bool AllocationClass::completeSlabRelease(const SlabReleaseContext& context) {
     if (allFreed(slab)) {
       const auto slabPtrVal = getSlabPtrValue(slab);
       slabAllocMap_.erase(slabPtrVal);
+      slabActiveAllocs_.erase(slabPtrVal);
 
       header->classId = Slab::kInvalidClassId;
       header->allocSize = 0;
@@ -674,45 +696,50 @@ bool AllocationClass::free(void* memory) {
         fmt::format("Allocation {} is already marked as free", memory));
   }
   allocState[idx].allocated = true;
-
-  int size = allocState.size();
-  for (int i = 0; i < size; i++) {
-    if (!allocState[i].allocated) {
-      freedAllocations_.push_front(&allocState[i]);
+  const bool markedForRelease = header->isMarkedForRelease();
+  if (--slabActiveAllocs_[slabPtrVal] > 0) {
+    // a slab being released does not take allocations anymore
+    if (!markedForRelease) {
+      freedAllocations_.push_front(&allocState[idx]);
       canAllocate_ = true;
-      return false;
     }
+    return false;
   }
-  // free slab memory from freeAllocation_
-  for (int i = 0; i < size; i++) {
-    freedAllocations_.release(&allocState[i]);
-  }
-  // release slab
-  auto allocIt =
-      std::find(allocatedSlabs_.begin(), allocatedSlabs_.end(), slab);
-  if (allocIt == allocatedSlabs_.end()) {
-    // not a part of free slabs and not part of allocated slab. This is an
-    // error, return to caller. This should not happen. throw a run time
-    // error.
-    throw std::runtime_error(
-        fmt::format("Slab {} belongs to class {}. But its not present in "
-                    "the free list or "
-                    "allocated list.",
-                    (void*)slab, getId()));
-  }
-  *allocIt = allocatedSlabs_.back();
-  allocatedSlabs_.pop_back();
-  // remove all from free list
 
-  if (currSlab_ == slab) {
-    currSlab_ = nullptr;
-    currOffset_ = 0;
+  if (markedForRelease) {
+    // the slab was already taken off the free list and allocatedSlabs_
+    --activeReleases_;
+  } else {
+    // free slab memory from freeAllocation_
+    for (auto& alloc : allocState) {
+      freedAllocations_.release(&alloc);
+    }
+    // release slab
+    auto allocIt =
+        std::find(allocatedSlabs_.begin(), allocatedSlabs_.end(), slab);
+    if (allocIt == allocatedSlabs_.end()) {
+      // not a part of free slabs and not part of allocated slab. This is an
+      // error, return to caller. This should not happen. throw a run time
+      // error.
+      throw std::runtime_error(
+          fmt::format("Slab {} belongs to class {}. But its not present in "
+                      "the free list or "
+                      "allocated list.",
+                      (void*)slab, getId()));
+    }
+    *allocIt = allocatedSlabs_.back();
+    allocatedSlabs_.pop_back();
+
+    if (currSlab_ == slab) {
+      currSlab_ = nullptr;
+      currOffset_ = 0;
+    }
   }
   slabAllocMap_.erase(slabPtrVal);
+  slabActiveAllocs_.erase(slabPtrVal);
   header->classId = Slab::kInvalidClassId;
   header->allocSize = 0;
   header->setMarkedForRelease(false);
-  --activeReleases_;
   return true;
   // })();
 }
@@ -725,8 +752,9 @@ void AllocationClass::createSlabReleaseAllocMapLocked(const Slab* slab) {
   std::vector<MemoryAllocInfo_> allocState;
   for (int i = 0; i < size; i++) {
     allocState.push_back(
-        MemoryAllocInfo_{getAllocForIdx(slab, i), false, NULL, NULL});
+        MemoryAllocInfo_{getAllocForIdx(slab, i), true, NULL, NULL});
   }
+  slabActiveAllocs_[slabPtrVal] = 0;
   const auto res = slabAllocMap_.insert({slabPtrVal, std::move(allocState)});
   if (!res.second) {
     // this should never happen. we must always be able to insert.
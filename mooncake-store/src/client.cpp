@@ -6,10 +6,18 @@
 #include <cassert>
 #include <chrono>
 #include <cstdint>
+#include <cstring>
+#include <deque>
 #include <optional>
 #include <ranges>
+#include <unordered_set>
 
+#include "config.h"
+#include "erasure_code.h"
+#include "flight_recorder.h"
+#include "payload_codec.h"
 #include "transfer_engine.h"
+#include "tracepoint.h"
 #include "transfer_task.h"
 #include "transport/transport.h"
 #include "types.h"
@@ -32,31 +40,390 @@ namespace mooncake {
     return slice_size;
 }
 
+// Whether slices can take the replica as it is stored. Objects put with a
+// codec are stored in another layout than slices of the decoded data.
+static bool MatchesStoredLayout(const Replica::Descriptor& replica,
+                                const std::vector<Slice>& slices) {
+    if (!replica.is_memory_replica()) {
+        return CalculateSliceSize(slices) ==
+               replica.get_disk_descriptor().file_size;
+    }
+    const auto& handles = replica.get_memory_descriptor().buffer_descriptors;
+    if (handles.size() > slices.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < handles.size(); ++i) {
+        if (handles[i].size_ != slices[i].size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The erasure-coded replica of replica_list if the data has to be rebuilt
+// from its fragments to fill slices: a data fragment is lost, or slices are
+// laid out differently
+static const Replica::Descriptor* ErasureCodedToRebuild(
+    const std::vector<Replica::Descriptor>& replica_list,
+    const std::vector<Slice>& slices) {
+    for (const auto& replica : replica_list) {
+        if (!replica.is_memory_replica() ||
+            !replica.get_memory_descriptor().is_erasure_coded()) {
+            continue;
+        }
+        const auto& data = replica.get_memory_descriptor().buffer_descriptors;
+        const bool lost = std::any_of(
+            data.begin(), data.end(), [](const auto& fragment) {
+                return fragment.status_ == BufStatus::UNREGISTERED;
+            });
+        if (lost || !MatchesStoredLayout(replica, slices)) {
+            return &replica;
+        }
+    }
+    return nullptr;
+}
+
+// Bytes of the object as the replica stores them
+static uint64_t StoredSize(const Replica::Descriptor& replica) {
+    if (!replica.is_memory_replica()) {
+        return replica.get_disk_descriptor().file_size;
+    }
+    uint64_t size = 0;
+    for (const auto& handle :
+         replica.get_memory_descriptor().buffer_descriptors) {
+        size += handle.size_;
+    }
+    return size;
+}
+
+// Resize staging to the object and split it like the replica stores it
+static std::vector<Slice> StoredLayoutSlices(
+    const Replica::Descriptor& replica, std::vector<uint8_t>& staging) {
+    staging.resize(StoredSize(replica));
+    std::vector<Slice> slices;
+    if (replica.is_memory_replica()) {
+        size_t offset = 0;
+        for (const auto& handle :
+             replica.get_memory_descriptor().buffer_descriptors) {
+            slices.push_back(Slice{staging.data() + offset, handle.size_});
+            offset += handle.size_;
+        }
+        return slices;
+    }
+    for (size_t offset = 0; offset < staging.size(); offset += kMaxSliceSize) {
+        slices.push_back(
+            Slice{staging.data() + offset,
+                  std::min<size_t>(kMaxSliceSize, staging.size() - offset)});
+    }
+    return slices;
+}
+
+// Object offset of a shard of size bytes, taken from the buffers of a
+// memory replica since the slices of a sharded object are its shards.
+// Nullopt if no memory replica has such a shard.
+static std::optional<uint64_t> ShardOffset(
+    const std::vector<Replica::Descriptor>& replica_list, size_t shard,
+    uint64_t size) {
+    for (const auto& replica : replica_list) {
+        if (!replica.is_memory_replica() ||
+            replica.get_memory_descriptor().is_inline()) {
+            continue;
+        }
+        const auto& buffers =
+            replica.get_memory_descriptor().buffer_descriptors;
+        if (shard >= buffers.size() || buffers[shard].size_ != size) {
+            return std::nullopt;
+        }
+        uint64_t offset = 0;
+        for (size_t i = 0; i < shard; ++i) {
+            offset += buffers[i].size_;
+        }
+        return offset;
+    }
+    return std::nullopt;
+}
+
+static bool IsWithinObject(const Replica::Descriptor& replica,
+                           uint64_t offset, uint64_t length) {
+    const uint64_t size = StoredSize(replica);
+    return offset <= size && length <= size - offset;
+}
+
+// The part of a memory replica holding the bytes from offset on that dests
+// take, with slices splitting dests at the buffer boundaries so that each
+// slice takes the part of one buffer, e.g. when dests are scattered pages.
+// Nullopt if the range is read with the rest of the object: from a disk
+// replica, or with a lost data fragment of an erasure-coded one.
+static std::optional<Replica::Descriptor> NarrowToRange(
+    const Replica::Descriptor& replica, uint64_t offset,
+    const std::vector<Slice>& dests, std::vector<Slice>& slices) {
+    if (!replica.is_memory_replica()) {
+        return std::nullopt;
+    }
+    const auto& mem_desc = replica.get_memory_descriptor();
+    const uint64_t end = offset + CalculateSliceSize(dests);
+    MemoryDescriptor range;
+    if (mem_desc.is_inline()) {
+        range.inline_data = mem_desc.inline_data.substr(offset, end - offset);
+        slices.insert(slices.end(), dests.begin(), dests.end());
+    } else {
+        // Object offset of dests[d]
+        size_t d = 0;
+        uint64_t dest_start = offset;
+        uint64_t start = 0;
+        for (const auto& handle : mem_desc.buffer_descriptors) {
+            const uint64_t lo = std::max(start, offset);
+            const uint64_t hi = std::min(start + handle.size_, end);
+            if (lo < hi && handle.status_ == BufStatus::UNREGISTERED) {
+                return std::nullopt;
+            }
+            for (uint64_t pos = lo; pos < hi;) {
+                while (dest_start + dests[d].size <= pos) {
+                    dest_start += dests[d].size;
+                    ++d;
+                }
+                const uint64_t cut = std::min(hi, dest_start + dests[d].size);
+                auto part = handle;
+                part.buffer_address_ += pos - start;
+                part.size_ = cut - pos;
+                range.buffer_descriptors.push_back(std::move(part));
+                slices.push_back(
+                    Slice{static_cast<char*>(dests[d].ptr) + (pos - dest_start),
+                          static_cast<size_t>(cut - pos)});
+                pos = cut;
+            }
+            start += handle.size_;
+        }
+    }
+    Replica::Descriptor narrowed;
+    narrowed.status = replica.status;
+    narrowed.descriptor_variant = std::move(range);
+    return narrowed;
+}
+
+static bool get_striped_read() {
+    const char* ev_sr = std::getenv("MC_STORE_STRIPED_READ");
+    if (ev_sr && std::atoi(ev_sr) == 1) {
+        LOG(INFO) << "striped read set by env MC_STORE_STRIPED_READ";
+        return true;
+    }
+    return false;
+}
+
+// Threads of the write-behind queue
+static constexpr size_t kWriteBehindThreads = 2;
+// Objects recovered from disk registered with the master per request
+static constexpr size_t kDiskRegisterBatch = 4096;
+// Keys merged into one master RPC by default when coalescing is enabled
+static constexpr uint64_t kDefaultCoalesceKeys = 64;
+// Traces kept by default when tracing is enabled
+static constexpr uint64_t kDefaultTraceBuffer = 1024;
+// Values put inline by default, if the master keeps inline objects
+static constexpr uint64_t kDefaultInlineMaxSize = 4096;
+// Reads of a key before the near cache keeps its value, by default
+static constexpr uint64_t kDefaultNearCacheAdmitReads = 2;
+// Values put into allocation credits by default, if credits are enabled
+static constexpr uint64_t kDefaultAllocCreditMaxObject = 64 * 1024;
+// Wait after a master refused an allocation credit
+static constexpr std::chrono::seconds kAllocCreditRetryInterval{1};
+
+// Space an object takes in the extent of an allocation credit, objects are
+// placed one after another, 8-byte aligned
+static uint64_t AlignCreditPut(uint64_t size) {
+    return (size + 7) & ~uint64_t{7};
+}
+
+// Read a positive integer from the environment variable name
+static uint64_t GetEnvSize(const char* name, uint64_t default_value) {
+    const char* env_value = std::getenv(name);
+    if (env_value == nullptr) {
+        return default_value;
+    }
+    char* end = nullptr;
+    const long long value = std::strtoll(env_value, &end, 10);
+    if (end == env_value || *end != '\0' || value <= 0) {
+        LOG(WARNING) << "Invalid value for " << name << ": " << env_value
+                     << ", defaulting to " << default_value;
+        return default_value;
+    }
+    return static_cast<uint64_t>(value);
+}
+
 Client::Client(const std::string& local_hostname,
                const std::string& metadata_connstring,
                const std::string& storage_root_dir)
     : local_hostname_(local_hostname),
       metadata_connstring_(metadata_connstring),
       storage_root_dir_(storage_root_dir),
-      write_thread_pool_(2) {
+      striped_read_(get_striped_read()),
+      inline_max_size_(
+          GetEnvSize("MC_STORE_INLINE_MAX_SIZE", kDefaultInlineMaxSize)),
+      write_thread_pool_(2),
+      async_thread_pool_(4) {
     client_id_ = generate_uuid();
     LOG(INFO) << "client_id=" << client_id_;
+    // Merging single-key master RPCs is opt-in, it delays a lone caller
+    const uint64_t coalesce_us = GetEnvSize("MC_STORE_MASTER_COALESCE_US", 0);
+    if (coalesce_us > 0) {
+        master_client_.EnableCoalescing(
+            std::chrono::microseconds(coalesce_us),
+            GetEnvSize("MC_STORE_MASTER_COALESCE_KEYS", kDefaultCoalesceKeys));
+    }
+    // For masters started with --rpc_enable_rdma
+    const char* rdma = std::getenv("MC_STORE_MASTER_RDMA");
+    if (rdma && std::atoi(rdma) == 1) {
+        master_client_.EnableRdma();
+    }
+    // More connections to the master keep busy callers from queueing
+    // behind each other, each costs an I/O thread
+    const uint64_t master_connections =
+        GetEnvSize("MC_STORE_MASTER_CONNECTIONS", 1);
+    if (master_connections > 1) {
+        const char* selection =
+            std::getenv("MC_STORE_MASTER_CONNECTION_SELECTION");
+        master_client_.SetConnections(
+            master_connections,
+            selection && std::string(selection) == "round_robin"
+                ? MasterClient::ConnectionSelection::ROUND_ROBIN
+                : MasterClient::ConnectionSelection::LEAST_OUTSTANDING);
+    }
+    // Reads and writes shed by an overloaded master are retried after a
+    // jittered backoff
+    master_client_.SetBusyRetry(
+        static_cast<int>(GetEnvSize("MC_STORE_MASTER_BUSY_RETRIES", 3)),
+        std::chrono::microseconds(
+            GetEnvSize("MC_STORE_MASTER_BUSY_BACKOFF_US", 1000)));
+    // Tracing is opt-in, the sampled requests pay for the clock reads
+    const uint64_t trace_sample_interval =
+        GetEnvSize("MC_STORE_TRACE_SAMPLE_INTERVAL", 0);
+    if (trace_sample_interval > 0) {
+        tracer_ = std::make_unique<RequestTracer>(
+            trace_sample_interval,
+            GetEnvSize("MC_STORE_TRACE_BUFFER", kDefaultTraceBuffer));
+        const uint64_t trace_port = GetEnvSize("MC_STORE_TRACE_PORT", 0);
+        if (trace_port > 0 && trace_port <= UINT16_MAX) {
+            trace_http_server_ = std::make_unique<coro_http::coro_http_server>(
+                1, static_cast<uint16_t>(trace_port));
+            trace_http_server_->set_http_handler<coro_http::GET>(
+                "/traces", [this](coro_http::coro_http_request& req,
+                                  coro_http::coro_http_response& resp) {
+                    resp.add_header("Content-Type", "application/x-ndjson");
+                    resp.set_status_and_content(coro_http::status_type::ok,
+                                                tracer_->Dump());
+                });
+            trace_http_server_->async_start();
+            LOG(INFO) << "trace_http_server_started port=" << trace_port;
+        }
+    }
+    const uint64_t te_metrics_port = GetEnvSize("MC_STORE_TE_METRICS_PORT", 0);
+    if (te_metrics_port > 0 && te_metrics_port <= UINT16_MAX) {
+        te_metrics_http_server_ = std::make_unique<coro_http::coro_http_server>(
+            1, static_cast<uint16_t>(te_metrics_port));
+        te_metrics_http_server_->set_http_handler<coro_http::GET>(
+            "/metrics", [this](coro_http::coro_http_request& req,
+                               coro_http::coro_http_response& resp) {
+                resp.add_header("Content-Type", "text/plain; version=0.0.4");
+                resp.set_status_and_content(
+                    coro_http::status_type::ok,
+                    transfer_engine_.getMetricsText() +
+                        MasterClientMetricsText());
+            });
+        te_metrics_http_server_->set_http_handler<coro_http::GET>(
+            "/flight_recorder", [](coro_http::coro_http_request& req,
+                                   coro_http::coro_http_response& resp) {
+                resp.add_header("Content-Type", "text/plain");
+                resp.set_status_and_content(coro_http::status_type::ok,
+                                            FlightRecorder::dump());
+            });
+        te_metrics_http_server_->async_start();
+        LOG(INFO) << "te_metrics_http_server_started port=" << te_metrics_port;
+    }
+    put_end_thread_ = std::thread(&Client::PutEndThreadFunc, this);
+}
+
+std::string Client::MasterClientMetricsText() {
+    std::string out =
+        "# HELP mooncake_master_rpc_in_flight Master RPCs in flight on each "
+        "connection\n"
+        "# TYPE mooncake_master_rpc_in_flight gauge\n";
+    const auto in_flight = master_client_.GetInFlightRequests();
+    for (size_t partition = 0; partition < in_flight.size(); ++partition) {
+        for (size_t connection = 0; connection < in_flight[partition].size();
+             ++connection) {
+            out += "mooncake_master_rpc_in_flight{partition=\"" +
+                   std::to_string(partition) + "\",connection=\"" +
+                   std::to_string(connection) + "\"} " +
+                   std::to_string(in_flight[partition][connection]) + "\n";
+        }
+    }
+    return out;
 }
 
 Client::~Client() {
+    if (trace_http_server_) {
+        trace_http_server_->stop();
+    }
+    if (te_metrics_http_server_) {
+        te_metrics_http_server_->stop();
+    }
+    {
+        std::lock_guard<std::mutex> lock(compaction_mutex_);
+        compaction_running_ = false;
+    }
+    compaction_cv_.notify_all();
+    if (compaction_thread_.joinable()) {
+        compaction_thread_.join();
+    }
+    // Let pending asynchronous operations, write-through copies and
+    // promotions finish while segments are mounted
+    async_thread_pool_.stop();
+    {
+        std::lock_guard<std::mutex> lock(put_end_mutex_);
+        put_end_running_ = false;
+    }
+    put_end_cv_.notify_all();
+    if (put_end_thread_.joinable()) {
+        put_end_thread_.join();
+    }
+    if (write_behind_) {
+        write_behind_->Stop();
+    }
+    write_thread_pool_.stop();
+    // No put writes into the extents anymore
+    ReturnAllocationCredits();
+
     // Make a copy of mounted_segments_ to avoid modifying while iterating
     std::vector<Segment> segments_to_unmount;
+    std::vector<UUID> segments_to_detach;
     {
         std::lock_guard<std::mutex> lock(mounted_segments_mutex_);
+        for (auto& entry : attached_segments_) {
+            segments_to_detach.push_back(entry.first);
+        }
         segments_to_unmount.reserve(mounted_segments_.size());
         for (auto& entry : mounted_segments_) {
             segments_to_unmount.emplace_back(entry.second);
         }
     }
 
+    for (auto& memory_id : segments_to_detach) {
+        auto result = DetachSegment(memory_id);
+        if (!result) {
+            LOG(ERROR) << "Failed to detach segment: "
+                       << toString(result.error());
+        }
+    }
+
+    // Moves the objects out first when asked, so that they survive
+    const std::chrono::milliseconds drain_timeout(
+        GetEnvSize("MC_STORE_DRAIN_TIMEOUT_MS", 0));
     for (auto& segment : segments_to_unmount) {
         auto result =
-            UnmountSegment(reinterpret_cast<void*>(segment.base), segment.size);
+            drain_timeout.count() > 0
+                ? DrainSegment(reinterpret_cast<void*>(segment.base),
+                               segment.size, drain_timeout)
+                : UnmountSegment(reinterpret_cast<void*>(segment.base),
+                                 segment.size);
         if (!result) {
             LOG(ERROR) << "Failed to unmount segment: "
                        << toString(result.error());
@@ -70,8 +437,13 @@ Client::~Client() {
     }
 
     // Stop ping thread only after no need to contact master anymore
+    master_view_helper_.StopWatchingMasterViews();
     if (ping_running_) {
-        ping_running_ = false;
+        {
+            std::lock_guard<std::mutex> lock(ping_mutex_);
+            ping_running_ = false;
+        }
+        ping_cv_.notify_all();
         if (ping_thread_.joinable()) {
             ping_thread_.join();
         }
@@ -90,6 +462,25 @@ static bool get_auto_discover() {
     return false;
 }
 
+// Placement labels of the segments this client mounts. The host defaults to
+// the local hostname without its port, so clients sharing a machine share a
+// failure domain.
+static SegmentTopology get_segment_topology(const std::string& hostname) {
+    SegmentTopology topology;
+    if (const char* host = std::getenv("MC_STORE_HOST")) {
+        topology.host = host;
+    } else {
+        topology.host = ReplicaSelector::HostOf(hostname);
+    }
+    if (const char* rack = std::getenv("MC_STORE_RACK")) {
+        topology.rack = rack;
+    }
+    if (const char* nic = std::getenv("MC_STORE_NIC")) {
+        topology.nic = nic;
+    }
+    return topology;
+}
+
 static inline void ltrim(std::string& s) {
     s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](unsigned char ch) {
                 return !std::isspace(ch);
@@ -144,28 +535,78 @@ ErrorCode Client::ConnectToMaster(const std::string& master_server_entry) {
             LOG(ERROR) << "Failed to connect to etcd";
             return err;
         }
-        std::string master_address;
-        ViewVersionId master_version = 0;
-        err = master_view_helper_.GetMasterView(master_address, master_version);
+        size_t partition_num = 1;
+        err = master_view_helper_.GetPartitionNum(partition_num);
         if (err != ErrorCode::OK) {
-            LOG(ERROR) << "Failed to get master address";
+            LOG(ERROR) << "Failed to get master partition number";
             return err;
         }
+        std::vector<std::string> master_addresses(partition_num);
+        for (size_t i = 0; i < partition_num; ++i) {
+            ViewVersionId master_version = 0;
+            err = master_view_helper_.GetMasterView(
+                master_addresses[i], master_version,
+                MasterViewKey(i, partition_num));
+            if (err != ErrorCode::OK) {
+                LOG(ERROR) << "Failed to get master address of partition "
+                           << i;
+                return err;
+            }
+        }
 
-        err = master_client_.Connect(master_address);
+        err = master_client_.Connect(master_addresses);
         if (err != ErrorCode::OK) {
             LOG(ERROR) << "Failed to connect to master";
             return err;
         }
 
+        ConnectToFollowers();
+        // Before the ping thread, which refreshes the replica cache
+        PrepareReplicaCache();
+        PrepareKeyFilter();
+        PrepareAllocationCredits();
+
         // Start Ping thread to monitor master view changes and remount segments
         // if needed
+        master_addresses_ = std::move(master_addresses);
         ping_running_ = true;
         ping_thread_ = std::thread(&Client::PingThreadFunc, this);
 
+        // Reconnect as soon as a new master is elected rather than after
+        // the pings fail. The pings still reconnect if the watch fails.
+        err = master_view_helper_.WatchMasterViews(
+            [this](const std::string&) {
+                {
+                    std::lock_guard<std::mutex> lock(ping_mutex_);
+                    master_view_changed_ = true;
+                }
+                ping_cv_.notify_all();
+            });
+        if (err != ErrorCode::OK) {
+            LOG(WARNING) << "Failed to watch the master views, master "
+                            "changes are found by pings only";
+        }
+
         return ErrorCode::OK;
     } else {
-        return master_client_.Connect(master_server_entry);
+        // The masters of the partitions, separated by commas
+        std::vector<std::string> master_addresses;
+        size_t start = 0;
+        while (true) {
+            size_t pos = master_server_entry.find(',', start);
+            master_addresses.push_back(
+                master_server_entry.substr(start, pos - start));
+            if (pos == std::string::npos) break;
+            start = pos + 1;
+        }
+        ErrorCode err = master_client_.Connect(master_addresses);
+        if (err == ErrorCode::OK) {
+            ConnectToFollowers();
+            PrepareReplicaCache();
+            PrepareKeyFilter();
+            PrepareAllocationCredits();
+        }
+        return err;
     }
 }
 
@@ -203,6 +644,14 @@ ErrorCode Client::InitTransferEngine(const std::string& local_hostname,
     }
     CHECK(transport) << "Failed to install transport";
 
+    // After the protocol transport, whose segment it publishes into
+    if (globalConfig().enable_shm &&
+        !transfer_engine_.installTransport("shm", nullptr)) {
+        LOG(WARNING) << "shm_transport_install_failed, same-host transfers "
+                        "use "
+                     << protocol;
+    }
+
     // Initialize TransferSubmitter after transfer engine is ready
     transfer_submitter_ = std::make_unique<TransferSubmitter>(
         transfer_engine_, local_hostname, storage_backend_);
@@ -249,16 +698,65 @@ std::optional<std::shared_ptr<Client>> Client::Create(
         return std::nullopt;
     }
 
+    // Relocating replicas out of fragmented segments is opt-in
+    const uint64_t compaction_interval_ms =
+        GetEnvSize("MC_STORE_COMPACTION_INTERVAL_MS", 0);
+    if (compaction_interval_ms > 0) {
+        client->compaction_running_ = true;
+        client->compaction_thread_ =
+            std::thread(&Client::CompactionThreadFunc, client.get(),
+                        std::chrono::milliseconds(compaction_interval_ms));
+    }
+
     return client;
 }
 
 tl::expected<void, ErrorCode> Client::Get(const std::string& object_key,
                                           std::vector<Slice>& slices) {
-    auto query_result = Query(object_key);
+    const uint64_t size = CalculateSliceSize(slices);
+    MC_TRACE(store_get_begin, object_key.c_str(), size);
+    auto result = DoGet(object_key, slices);
+    MC_TRACE(store_get_end, object_key.c_str(), size,
+             result ? 0 : static_cast<int>(result.error()));
+    return result;
+}
+
+tl::expected<void, ErrorCode> Client::DoGet(const std::string& object_key,
+                                            std::vector<Slice>& slices) {
+    RequestTracer::ScopedTrace trace(tracer_.get(), "Get", object_key);
+    if (near_cache_ && near_cache_->Get(object_key, slices)) {
+        return {};
+    }
+    const uint64_t near_cache_generation =
+        near_cache_ ? near_cache_->generation() : 0;
+    bool from_cache = false;
+    // No lease by default, so that the value is not cached
+    ReplicaCache::Clock::time_point lease_expiry{};
+    auto query_result = QueryReplicas(object_key, &from_cache, &lease_expiry);
     if (!query_result) {
+        trace.SetStatus(query_result.error());
         return tl::unexpected(query_result.error());
     }
-    return Get(object_key, query_result.value(), slices);
+    auto result = Get(object_key, query_result.value(), slices);
+    if (!result && from_cache) {
+        // The cached replicas may be gone, ask the master again
+        VLOG(1) << "action=retry_without_replica_cache key=" << object_key;
+        InvalidateReplicaCache(object_key);
+        lease_expiry = {};
+        query_result = QueryReplicas(object_key, nullptr, &lease_expiry);
+        if (!query_result) {
+            trace.SetStatus(query_result.error());
+            return tl::unexpected(query_result.error());
+        }
+        result = Get(object_key, query_result.value(), slices);
+    }
+    if (!result) {
+        trace.SetStatus(result.error());
+    } else if (near_cache_) {
+        near_cache_->Put(object_key, slices, lease_expiry,
+                         near_cache_generation);
+    }
+    return result;
 }
 
 std::vector<tl::expected<void, ErrorCode>> Client::BatchGet(
@@ -311,7 +809,34 @@ std::vector<tl::expected<void, ErrorCode>> Client::BatchGet(
 
 tl::expected<std::vector<Replica::Descriptor>, ErrorCode> Client::Query(
     const std::string& object_key) {
+    return QueryReplicas(object_key, nullptr);
+}
+
+tl::expected<std::vector<Replica::Descriptor>, ErrorCode>
+Client::QueryReplicas(const std::string& object_key, bool* from_cache,
+                      ReplicaCache::Clock::time_point* lease_expiry) {
+    RequestTracer::ScopedSpan span("query_replicas");
+    uint64_t generation = 0;
+    if (replica_cache_) {
+        if (auto cached = replica_cache_->Get(object_key, lease_expiry)) {
+            if (from_cache) {
+                *from_cache = true;
+            }
+            return std::move(*cached);
+        }
+        generation = replica_cache_->generation();
+    }
+
+    // The lease is granted after this, so it outlives the cache entry
+    const auto lease_start = ReplicaCache::Clock::now();
     auto result = master_client_.GetReplicaList(object_key);
+    if (result && replica_cache_) {
+        replica_cache_->Put(object_key, result.value(),
+                            lease_start + replica_cache_ttl_, generation);
+    }
+    if (result && lease_expiry && replica_cache_ttl_.count() > 0) {
+        *lease_expiry = lease_start + replica_cache_ttl_;
+    }
     if (!result) {
         // Check storage backend if master query fails
         if (storage_backend_) {
@@ -326,7 +851,49 @@ tl::expected<std::vector<Replica::Descriptor>, ErrorCode> Client::Query(
 
 std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
 Client::BatchQuery(const std::vector<std::string>& object_keys) {
-    auto response = master_client_.BatchGetReplicaList(object_keys);
+    // Only ask the master for the keys missing from the replica cache
+    std::vector<std::optional<std::vector<Replica::Descriptor>>> cached;
+    std::vector<std::string> missing_keys;
+    uint64_t generation = 0;
+    if (replica_cache_) {
+        generation = replica_cache_->generation();
+        cached.reserve(object_keys.size());
+        for (const auto& key : object_keys) {
+            cached.push_back(replica_cache_->Get(key));
+            if (!cached.back()) {
+                missing_keys.push_back(key);
+            }
+        }
+    }
+    const auto& query_keys = replica_cache_ ? missing_keys : object_keys;
+
+    const auto lease_start = ReplicaCache::Clock::now();
+    auto response = query_keys.empty()
+                        ? std::vector<tl::expected<
+                              std::vector<Replica::Descriptor>, ErrorCode>>{}
+                        : master_client_.BatchGetReplicaList(query_keys);
+    if (replica_cache_ && response.size() == query_keys.size()) {
+        std::vector<
+            tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+            merged;
+        merged.reserve(object_keys.size());
+        size_t next = 0;
+        for (size_t i = 0; i < object_keys.size(); ++i) {
+            if (cached[i]) {
+                merged.emplace_back(std::move(*cached[i]));
+                continue;
+            }
+            if (response[next]) {
+                replica_cache_->Put(object_keys[i], response[next].value(),
+                                    lease_start + replica_cache_ttl_,
+                                    generation);
+            }
+            merged.push_back(std::move(response[next++]));
+        }
+        response = std::move(merged);
+    } else if (replica_cache_) {
+        response.clear();
+    }
 
     // Check if we got the expected number of responses
     if (response.size() != object_keys.size()) {
@@ -362,9 +929,48 @@ tl::expected<void, ErrorCode> Client::Get(
     const std::string& object_key,
     const std::vector<Replica::Descriptor>& replica_list,
     std::vector<Slice>& slices) {
-    // Find the first complete replica
+    if (const auto* coded = ErasureCodedToRebuild(replica_list, slices)) {
+        return GetErasureCoded(object_key, *coded, slices);
+    }
+    if (!replica_list.empty() &&
+        !MatchesStoredLayout(replica_list[0], slices) &&
+        CalculateSliceSize(slices) != StoredSize(replica_list[0])) {
+        return GetEncoded(object_key, replica_list, slices);
+    }
+
+    if (striped_read_) {
+        CHECK(transfer_submitter_) << "TransferSubmitter not initialized";
+        std::optional<std::vector<TransferFuture>> futures;
+        {
+            RequestTracer::ScopedSpan span("transfer_submit", "striped");
+            futures = transfer_submitter_->submitStriped(
+                replica_list, slices, TransferRequest::READ);
+        }
+        if (futures) {
+            RequestTracer::ScopedSpan span("transfer_wait", "striped");
+            ErrorCode result = ErrorCode::OK;
+            for (auto& future : *futures) {
+                ErrorCode stripe_result = future.get();
+                if (stripe_result != ErrorCode::OK) {
+                    result = stripe_result;
+                }
+            }
+            if (result == ErrorCode::OK) {
+                return {};
+            }
+            LOG(WARNING) << "striped_read_failed key=" << object_key
+                         << " error=" << result
+                         << ", retrying from a single replica";
+        }
+    }
+
+    // Choose the cheapest complete replica
     Replica::Descriptor replica;
-    ErrorCode err = FindFirstCompleteReplica(replica_list, replica);
+    ErrorCode err;
+    {
+        RequestTracer::ScopedSpan span("select_replica");
+        err = SelectReplica(replica_list, replica);
+    }
     if (err != ErrorCode::OK) {
         if (err == ErrorCode::INVALID_REPLICA) {
             LOG(ERROR) << "no_complete_replicas_found key=" << object_key;
@@ -372,11 +978,30 @@ tl::expected<void, ErrorCode> Client::Get(
         return tl::unexpected(err);
     }
 
-    err = TransferRead(replica, slices);
+    // Slices laid out otherwise, e.g. scattered pages, take the parts of
+    // the buffers they overlap
+    std::vector<Slice> scattered;
+    if (!MatchesStoredLayout(replica, slices)) {
+        auto narrowed = NarrowToRange(replica, 0, slices, scattered);
+        if (!narrowed) {
+            return tl::unexpected(ErrorCode::INVALID_PARAMS);
+        }
+        err = TransferRead(*narrowed, scattered);
+    } else {
+        err = TransferRead(replica, slices);
+    }
+    if (err != ErrorCode::OK && replica.is_memory_replica() &&
+        replica.get_memory_descriptor().is_erasure_coded()) {
+        LOG(WARNING) << "transfer_read_failed key=" << object_key
+                     << ", rebuilding from the fragments";
+        return GetErasureCoded(object_key, replica, slices);
+    }
     if (err != ErrorCode::OK) {
         LOG(ERROR) << "transfer_read_failed key=" << object_key;
+        InvalidateReplicaCache(object_key);
         return tl::unexpected(err);
     }
+    PromoteFromDisk(object_key, replica, slices);
     return {};
 }
 
@@ -400,11 +1025,22 @@ std::vector<tl::expected<void, ErrorCode>> Client::BatchGet(
     }
 
     // Collect all transfer operations for parallel execution
-    std::vector<std::tuple<size_t, std::string, TransferFuture>>
+    std::vector<std::tuple<size_t, std::string, Replica::Descriptor,
+                           TransferFuture>>
         pending_transfers;
     std::vector<tl::expected<void, ErrorCode>> results(object_keys.size());
+    // Keys to read and their chosen replicas, submitted together below
+    std::vector<size_t> indices;
+    std::vector<Replica::Descriptor> replicas;
+    std::vector<TransferSubmitter::BatchItem> items;
+    // Replicas and slices split for scattered slices. The items point into
+    // these vectors, which must not reallocate.
+    std::vector<Replica::Descriptor> narrowed_replicas;
+    std::vector<std::vector<Slice>> scattered;
+    replicas.reserve(object_keys.size());
+    narrowed_replicas.reserve(object_keys.size());
+    scattered.reserve(object_keys.size());
 
-    // Submit all transfers in parallel
     for (size_t i = 0; i < object_keys.size(); ++i) {
         const auto& key = object_keys[i];
         const auto& replica_list = replica_lists[i];
@@ -416,9 +1052,22 @@ std::vector<tl::expected<void, ErrorCode>> Client::BatchGet(
             continue;
         }
 
-        // Find the first complete replica for this key
+        if (const auto* coded =
+                ErasureCodedToRebuild(replica_list, slices_it->second)) {
+            results[i] = GetErasureCoded(key, *coded, slices_it->second);
+            continue;
+        }
+        if (!replica_list.empty() &&
+            !MatchesStoredLayout(replica_list[0], slices_it->second) &&
+            CalculateSliceSize(slices_it->second) !=
+                StoredSize(replica_list[0])) {
+            results[i] = GetEncoded(key, replica_list, slices_it->second);
+            continue;
+        }
+
+        // Choose the cheapest complete replica for this key
         Replica::Descriptor replica;
-        ErrorCode err = FindFirstCompleteReplica(replica_list, replica);
+        ErrorCode err = SelectReplica(replica_list, replica);
         if (err != ErrorCode::OK) {
             if (err == ErrorCode::INVALID_REPLICA) {
                 LOG(ERROR) << "no_complete_replicas_found key=" << key;
@@ -426,33 +1075,59 @@ std::vector<tl::expected<void, ErrorCode>> Client::BatchGet(
             results[i] = tl::unexpected(err);
             continue;
         }
+        indices.push_back(i);
+        replicas.push_back(std::move(replica));
+        if (MatchesStoredLayout(replicas.back(), slices_it->second)) {
+            items.push_back({&replicas.back(), &slices_it->second});
+            continue;
+        }
+        // Scattered slices, read the parts of the buffers they overlap
+        scattered.emplace_back();
+        auto narrowed = NarrowToRange(replicas.back(), 0, slices_it->second,
+                                      scattered.back());
+        if (!narrowed) {
+            indices.pop_back();
+            replicas.pop_back();
+            scattered.pop_back();
+            results[i] = tl::unexpected(ErrorCode::INVALID_PARAMS);
+            continue;
+        }
+        narrowed_replicas.push_back(std::move(*narrowed));
+        items.push_back({&narrowed_replicas.back(), &scattered.back()});
+    }
 
-        // Submit transfer operation asynchronously
-        auto future = transfer_submitter_->submit(replica, slices_it->second,
-                                                  TransferRequest::READ);
-        if (!future) {
+    // The remote reads of all keys share one transfer engine batch
+    auto futures =
+        transfer_submitter_->submitBatch(items, TransferRequest::READ);
+    for (size_t j = 0; j < items.size(); ++j) {
+        const size_t i = indices[j];
+        const auto& key = object_keys[i];
+        if (!futures[j]) {
             LOG(ERROR) << "Failed to submit transfer operation for key: "
                        << key;
             results[i] = tl::unexpected(ErrorCode::TRANSFER_FAIL);
             continue;
         }
 
-        VLOG(1) << "Submitted transfer for key " << key
-                << " using strategy: " << static_cast<int>(future->strategy());
+        VLOG(1) << "Submitted transfer for key " << key << " using strategy: "
+                << static_cast<int>(futures[j]->strategy());
 
-        pending_transfers.emplace_back(i, key, std::move(*future));
+        pending_transfers.emplace_back(i, key, std::move(replicas[j]),
+                                       std::move(*futures[j]));
     }
 
     // Wait for all transfers to complete
-    for (auto& [index, key, future] : pending_transfers) {
+    for (auto& [index, key, replica, future] : pending_transfers) {
         ErrorCode result = future.get();
         if (result != ErrorCode::OK) {
             LOG(ERROR) << "Transfer failed for key: " << key
                        << " with error: " << static_cast<int>(result);
+            InvalidateReplicaCache(key);
             results[index] = tl::unexpected(result);
         } else {
             VLOG(1) << "Transfer completed successfully for key: " << key;
             results[index] = {};
+            PromoteFromDisk(key, replica, slices.at(key));
         }
     }
 
@@ -460,310 +1135,1072 @@ std::vector<tl::expected<void, ErrorCode>> Client::BatchGet(
     return results;
 }
 
-tl::expected<void, ErrorCode> Client::Put(const ObjectKey& key,
-                                          std::vector<Slice>& slices,
-                                          const ReplicateConfig& config) {
-    // Prepare slice lengths
-    std::vector<size_t> slice_lengths;
-    for (size_t i = 0; i < slices.size(); ++i) {
-        slice_lengths.emplace_back(slices[i].size);
+tl::expected<void, ErrorCode> Client::GetRange(const std::string& object_key,
+                                               uint64_t offset, Slice dest) {
+    RequestTracer::ScopedTrace trace(tracer_.get(), "GetRange", object_key);
+    bool from_cache = false;
+    auto query_result = QueryReplicas(object_key, &from_cache);
+    if (!query_result) {
+        trace.SetStatus(query_result.error());
+        return tl::unexpected(query_result.error());
     }
-
-    // Start put operation
-    auto start_result = master_client_.PutStart(key, slice_lengths, config);
-    if (!start_result) {
-        ErrorCode err = start_result.error();
-        if (err == ErrorCode::OBJECT_ALREADY_EXISTS) {
-            VLOG(1) << "object_already_exists key=" << key;
-            return {};
+    auto result = GetRange(object_key, query_result.value(), offset, dest);
+    if (!result && from_cache) {
+        // The cached replicas may be gone, ask the master again
+        VLOG(1) << "action=retry_without_replica_cache key=" << object_key;
+        InvalidateReplicaCache(object_key);
+        query_result = QueryReplicas(object_key, nullptr);
+        if (!query_result) {
+            trace.SetStatus(query_result.error());
+            return tl::unexpected(query_result.error());
         }
-        LOG(ERROR) << "Failed to start put operation: " << err;
-        return tl::unexpected(err);
+        result = GetRange(object_key, query_result.value(), offset, dest);
     }
+    if (!result) {
+        trace.SetStatus(result.error());
+    }
+    return result;
+}
 
-    // Transfer data using allocated handles from all replicas
-    for (const auto& replica : start_result.value()) {
-        ErrorCode transfer_err = TransferWrite(replica, slices);
-        if (transfer_err != ErrorCode::OK) {
-            // Revoke put operation
-            auto revoke_result = master_client_.PutRevoke(key);
-            if (!revoke_result) {
-                LOG(ERROR) << "Failed to revoke put operation";
-                return tl::unexpected(revoke_result.error());
-            }
-            return tl::unexpected(transfer_err);
+tl::expected<void, ErrorCode> Client::GetRange(
+    const std::string& object_key,
+    const std::vector<Replica::Descriptor>& replica_list, uint64_t offset,
+    Slice dest) {
+    Replica::Descriptor replica;
+    ErrorCode err = SelectReplica(replica_list, replica);
+    if (err != ErrorCode::OK) {
+        if (err == ErrorCode::INVALID_REPLICA) {
+            LOG(ERROR) << "no_complete_replicas_found key=" << object_key;
         }
+        return tl::unexpected(err);
+    }
+    if (!IsWithinObject(replica, offset, dest.size)) {
+        LOG(ERROR) << "Range of " << dest.size << " bytes at " << offset
+                   << " ends past key=" << object_key << " of "
+                   << StoredSize(replica) << " bytes";
+        return tl::unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    if (dest.size == 0) {
+        return {};
     }
 
-    // End put operation
-    auto end_result = master_client_.PutEnd(key);
-    if (!end_result) {
-        ErrorCode err = end_result.error();
-        LOG(ERROR) << "Failed to end put operation: " << err;
+    std::vector<Slice> slices;
+    auto narrowed = NarrowToRange(replica, offset, {dest}, slices);
+    if (!narrowed) {
+        return GetRangeStaged(object_key, replica_list, offset, dest);
+    }
+    err = TransferRead(*narrowed, slices);
+    if (err != ErrorCode::OK) {
+        LOG(ERROR) << "transfer_read_failed key=" << object_key
+                   << " offset=" << offset << " length=" << dest.size;
+        InvalidateReplicaCache(object_key);
         return tl::unexpected(err);
     }
-
-    // Store to local file if storage backend is available
-    PutToLocalFile(key, slices);
-
     return {};
 }
 
-// TODO: `client.cpp` is too long, consider split it into multiple files
-enum class PutOperationState {
-    PENDING,
-    MASTER_FAILED,
-    TRANSFER_FAILED,
-    FINALIZE_FAILED,
-    SUCCESS
-};
-
-class PutOperation {
-   public:
-    PutOperation(std::string_view k, const std::vector<Slice>& s)
-        : key(k), slices(s) {
-        value_length = CalculateSliceSize(slices);
-        // Initialize with a pending error state to ensure result is always set
-        result = tl::unexpected(ErrorCode::INTERNAL_ERROR);
+tl::expected<void, ErrorCode> Client::GetShard(const std::string& object_key,
+                                               size_t shard, Slice dest) {
+    RequestTracer::ScopedTrace trace(tracer_.get(), "GetShard", object_key);
+    auto query_result = QueryReplicas(object_key, nullptr);
+    if (!query_result) {
+        trace.SetStatus(query_result.error());
+        return tl::unexpected(query_result.error());
     }
+    auto offset = ShardOffset(query_result.value(), shard, dest.size);
+    if (!offset) {
+        LOG(ERROR) << "No shard " << shard << " of " << dest.size
+                   << " bytes in key=" << object_key;
+        trace.SetStatus(ErrorCode::INVALID_PARAMS);
+        return tl::unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    auto result = GetRange(object_key, query_result.value(), *offset, dest);
+    if (!result) {
+        trace.SetStatus(result.error());
+    }
+    return result;
+}
 
-    std::string key;
-    std::vector<Slice> slices;
-    size_t value_length;
-
-    // Enhanced state tracking
-    PutOperationState state = PutOperationState::PENDING;
-    tl::expected<void, ErrorCode> result;
-    std::vector<Replica::Descriptor> replicas;
-    std::vector<TransferFuture> pending_transfers;
-
-    // Error context for debugging
-    std::optional<std::string> failure_context;
-
-    // Helper methods for robust state management
-    void SetSuccess() {
-        state = PutOperationState::SUCCESS;
-        result = {};
-        failure_context.reset();
+tl::expected<ObjectView, ErrorCode> Client::GetView(
+    const std::string& object_key) {
+    RequestTracer::ScopedTrace trace(tracer_.get(), "GetView", object_key);
+    // Leased first, so that the replicas listed next stay in place
+    auto touched = master_client_.BatchTouch({object_key}, kViewLeaseMs);
+    if (touched.size() != 1 || !touched[0]) {
+        const auto err =
+            touched.size() != 1 ? ErrorCode::RPC_FAIL : touched[0].error();
+        trace.SetStatus(err);
+        return tl::unexpected(err);
+    }
+    // From the master itself, a cached list or a follower may still name
+    // the buffers of a previous value
+    auto replicas = master_client_.GetLeaderReplicaList(object_key);
+    if (!replicas) {
+        trace.SetStatus(replicas.error());
+        return tl::unexpected(replicas.error());
     }
 
-    void SetError(ErrorCode error, const std::string& context = "") {
-        result = tl::unexpected(error);
-        if (!context.empty()) {
-            failure_context = toString(error) + ": " + context + "; " +
-                              failure_context.value_or("");
+    for (const auto& replica : replicas.value()) {
+        if (!replica.is_memory_replica() ||
+            replica.status != ReplicaStatus::COMPLETE) {
+            continue;
         }
-
-        // Update state based on current processing stage
-        if (replicas.empty()) {
-            state = PutOperationState::MASTER_FAILED;
-        } else if (pending_transfers.empty()) {
-            state = PutOperationState::TRANSFER_FAILED;
-        } else {
-            state = PutOperationState::FINALIZE_FAILED;
+        const auto& memory = replica.get_memory_descriptor();
+        if (memory.is_inline() || memory.is_erasure_coded()) {
+            continue;
         }
-        LOG(WARNING) << "Put operation failed for key " << key << ", context: "
-                     << failure_context.value_or("unknown error");
-    }
-
-    bool IsResolved() const { return state != PutOperationState::PENDING; }
-
-    bool IsSuccessful() const {
-        return state == PutOperationState::SUCCESS && result.has_value();
+        ObjectView view;
+        for (const auto& buffer : memory.buffer_descriptors) {
+            auto address = transfer_submitter_->localAddress(buffer);
+            if (!address) {
+                break;
+            }
+            view.buffers.push_back(
+                {reinterpret_cast<void*>(*address), buffer.size_});
+        }
+        if (view.buffers.size() != memory.buffer_descriptors.size()) {
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(views_mutex_);
+        view.handle = ++next_view_handle_;
+        views_.emplace(view.handle, object_key);
+        return view;
     }
-};
+    VLOG(1) << "no_local_replica key=" << object_key;
+    trace.SetStatus(ErrorCode::INVALID_REPLICA);
+    return tl::unexpected(ErrorCode::INVALID_REPLICA);
+}
 
-std::vector<PutOperation> Client::CreatePutOperations(
-    const std::vector<ObjectKey>& keys,
-    const std::vector<std::vector<Slice>>& batched_slices) {
-    std::vector<PutOperation> ops;
-    ops.reserve(keys.size());
-    for (size_t i = 0; i < keys.size(); ++i) {
-        ops.emplace_back(keys[i], batched_slices[i]);
-    }
-    return ops;
+void Client::ReleaseView(uint64_t handle) {
+    std::lock_guard<std::mutex> lock(views_mutex_);
+    views_.erase(handle);
 }
 
-void Client::StartBatchPut(std::vector<PutOperation>& ops,
-                           const ReplicateConfig& config) {
+void Client::RenewViews() {
     std::vector<std::string> keys;
-    std::vector<std::vector<uint64_t>> slice_lengths;
-
-    keys.reserve(ops.size());
-    slice_lengths.reserve(ops.size());
-
-    for (const auto& op : ops) {
-        keys.emplace_back(op.key);
-
-        std::vector<uint64_t> slice_sizes;
-        slice_sizes.reserve(op.slices.size());
-        for (const auto& slice : op.slices) {
-            slice_sizes.emplace_back(slice.size);
+    {
+        std::lock_guard<std::mutex> lock(views_mutex_);
+        std::unordered_set<std::string> unique;
+        for (const auto& [handle, key] : views_) {
+            if (unique.insert(key).second) {
+                keys.push_back(key);
+            }
         }
-        slice_lengths.emplace_back(std::move(slice_sizes));
     }
-
-    auto start_responses =
-        master_client_.BatchPutStart(keys, slice_lengths, config);
-
-    // Ensure response size matches request size
-    if (start_responses.size() != ops.size()) {
-        LOG(ERROR) << "BatchPutStart response size mismatch: expected "
-                   << ops.size() << ", got " << start_responses.size();
-        for (auto& op : ops) {
-            op.SetError(ErrorCode::RPC_FAIL,
-                        "BatchPutStart response size mismatch");
-        }
+    if (keys.empty()) {
         return;
     }
-
-    // Process individual responses with robust error handling
-    for (size_t i = 0; i < ops.size(); ++i) {
-        if (!start_responses[i]) {
-            ops[i].SetError(start_responses[i].error(),
-                            "Master failed to start put operation");
-        } else {
-            ops[i].replicas = start_responses[i].value();
-            // Operation continues to next stage - result remains INTERNAL_ERROR
-            // until fully successful
-            VLOG(1) << "Successfully started put for key " << ops[i].key
-                    << " with " << ops[i].replicas.size() << " replicas";
+    auto results = master_client_.BatchTouch(keys, kViewLeaseMs);
+    for (size_t i = 0; i < results.size() && i < keys.size(); ++i) {
+        if (!results[i]) {
+            LOG(WARNING) << "view_lease_renew_failed key=" << keys[i]
+                         << " error=" << results[i].error();
         }
     }
 }
 
-void Client::SubmitTransfers(std::vector<PutOperation>& ops) {
+std::vector<tl::expected<void, ErrorCode>> Client::BatchGetRange(
+    const std::vector<std::string>& object_keys,
+    const std::vector<uint64_t>& offsets, const std::vector<Slice>& dests) {
     CHECK(transfer_submitter_) << "TransferSubmitter not initialized";
 
-    for (auto& op : ops) {
-        // Skip operations that already failed in previous stages
-        if (op.IsResolved()) {
+    if (offsets.size() != object_keys.size() ||
+        dests.size() != object_keys.size()) {
+        LOG(ERROR) << "Offsets (" << offsets.size() << ") or dests ("
+                   << dests.size() << ") don't match object keys ("
+                   << object_keys.size() << ")";
+        return std::vector<tl::expected<void, ErrorCode>>(
+            object_keys.size(), tl::unexpected(ErrorCode::INVALID_PARAMS));
+    }
+
+    std::vector<tl::expected<void, ErrorCode>> results(object_keys.size());
+    auto query_results = BatchQuery(object_keys);
+
+    // Narrowed replicas of the keys to read, submitted together below. The
+    // items point into replicas and slices, which must not reallocate.
+    std::vector<size_t> indices;
+    std::vector<Replica::Descriptor> replicas;
+    std::vector<std::vector<Slice>> slices;
+    std::vector<TransferSubmitter::BatchItem> items;
+    replicas.reserve(object_keys.size());
+    slices.reserve(object_keys.size());
+
+    for (size_t i = 0; i < object_keys.size(); ++i) {
+        const auto& key = object_keys[i];
+        if (!query_results[i]) {
+            results[i] = tl::unexpected(query_results[i].error());
             continue;
         }
+        const auto& replica_list = query_results[i].value();
 
-        // Skip operations that don't have replicas (failed in StartBatchPut)
-        if (op.replicas.empty()) {
-            op.SetError(ErrorCode::INTERNAL_ERROR,
-                        "No replicas available for transfer");
+        Replica::Descriptor replica;
+        ErrorCode err = SelectReplica(replica_list, replica);
+        if (err != ErrorCode::OK) {
+            if (err == ErrorCode::INVALID_REPLICA) {
+                LOG(ERROR) << "no_complete_replicas_found key=" << key;
+            }
+            results[i] = tl::unexpected(err);
+            continue;
+        }
+        if (!IsWithinObject(replica, offsets[i], dests[i].size)) {
+            LOG(ERROR) << "Range of " << dests[i].size << " bytes at "
+                       << offsets[i] << " ends past key=" << key << " of "
+                       << StoredSize(replica) << " bytes";
+            results[i] = tl::unexpected(ErrorCode::INVALID_PARAMS);
+            continue;
+        }
+        if (dests[i].size == 0) {
             continue;
         }
 
-        bool all_transfers_submitted = true;
-        std::string failure_context;
+        std::vector<Slice> range_slices;
+        auto narrowed =
+            NarrowToRange(replica, offsets[i], {dests[i]}, range_slices);
+        if (!narrowed) {
+            results[i] =
+                GetRangeStaged(key, replica_list, offsets[i], dests[i]);
+            continue;
+        }
+        indices.push_back(i);
+        replicas.push_back(std::move(*narrowed));
+        slices.push_back(std::move(range_slices));
+        items.push_back({&replicas.back(), &slices.back()});
+    }
 
-        for (size_t replica_idx = 0; replica_idx < op.replicas.size();
-             ++replica_idx) {
-            const auto& replica = op.replicas[replica_idx];
+    auto futures =
+        transfer_submitter_->submitBatch(items, TransferRequest::READ);
+    for (size_t j = 0; j < items.size(); ++j) {
+        const size_t i = indices[j];
+        if (!futures[j]) {
+            LOG(ERROR) << "Failed to submit transfer operation for key: "
+                       << object_keys[i];
+            results[i] = tl::unexpected(ErrorCode::TRANSFER_FAIL);
+        }
+    }
+    for (size_t j = 0; j < items.size(); ++j) {
+        if (!futures[j]) {
+            continue;
+        }
+        const size_t i = indices[j];
+        ErrorCode result = futures[j]->get();
+        if (result != ErrorCode::OK) {
+            LOG(ERROR) << "Transfer failed for key: " << object_keys[i]
+                       << " with error: " << static_cast<int>(result);
+            InvalidateReplicaCache(object_keys[i]);
+            results[i] = tl::unexpected(result);
+        }
+    }
+    return results;
+}
 
-            auto submit_result = transfer_submitter_->submit(
-                replica, op.slices, TransferRequest::WRITE);
+tl::expected<void, ErrorCode> Client::GetRangeStaged(
+    const std::string& object_key,
+    const std::vector<Replica::Descriptor>& replica_list, uint64_t offset,
+    Slice dest) {
+    if (!IsWithinObject(replica_list.front(), offset, dest.size)) {
+        return tl::unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    // Read in the stored layout so that Get neither decodes nor rejects it
+    std::vector<uint8_t> staging;
+    auto stored_slices = StoredLayoutSlices(replica_list.front(), staging);
+
+    if (transfer_engine_.registerLocalMemory(staging.data(), staging.size(),
+                                             kWildcardLocation, false,
+                                             false) != 0) {
+        LOG(ERROR) << "register_staging_buffer_failed key=" << object_key;
+        return tl::unexpected(ErrorCode::INTERNAL_ERROR);
+    }
+    auto result = Get(object_key, replica_list, stored_slices);
+    transfer_engine_.unregisterLocalMemory(staging.data(), false);
+    if (!result) {
+        return result;
+    }
+    std::memcpy(dest.ptr, staging.data() + offset, dest.size);
+    return {};
+}
 
-            if (!submit_result) {
-                failure_context = "Failed to submit transfer for replica " +
-                                  std::to_string(replica_idx);
-                all_transfers_submitted = false;
-                break;
-            }
+tl::expected<void, ErrorCode> Client::Put(const ObjectKey& key,
+                                          std::vector<Slice>& slices,
+                                          const ReplicateConfig& config) {
+    const uint64_t size = CalculateSliceSize(slices);
+    MC_TRACE(store_put_begin, key.c_str(), size);
+    auto result = DoPut(key, slices, config);
+    MC_TRACE(store_put_end, key.c_str(), size,
+             result ? 0 : static_cast<int>(result.error()));
+    return result;
+}
 
-            op.pending_transfers.emplace_back(std::move(submit_result.value()));
+tl::expected<void, ErrorCode> Client::DoPut(const ObjectKey& key,
+                                            std::vector<Slice>& slices,
+                                            const ReplicateConfig& config) {
+    if (config.codec != PayloadCodecId::NONE) {
+        std::vector<uint8_t> staging;
+        auto encoded = EncodePayloads(config.codec, {slices}, staging);
+        if (!encoded) {
+            return tl::unexpected(encoded.error());
         }
+        ReplicateConfig stored_config = config;
+        stored_config.codec = PayloadCodecId::NONE;
+        auto result = DoPut(key, encoded.value()[0], stored_config);
+        transfer_engine_.unregisterLocalMemory(staging.data(), false);
+        return result;
+    }
+    if (config.ec_data_fragments > 0 || config.ec_parity_fragments > 0) {
+        return PutErasureCoded(key, slices, config);
+    }
 
-        if (!all_transfers_submitted) {
-            LOG(ERROR) << "Transfer submission failed for key " << op.key
-                       << ": " << failure_context;
-            op.SetError(ErrorCode::TRANSFER_FAIL, failure_context);
-            op.pending_transfers.clear();
-        } else {
-            VLOG(1) << "Successfully submitted " << op.pending_transfers.size()
-                    << " transfers for key " << op.key;
-        }
+    // Prepare slice lengths
+    std::vector<size_t> slice_lengths;
+    for (size_t i = 0; i < slices.size(); ++i) {
+        slice_lengths.emplace_back(slices[i].size);
     }
-}
 
-void Client::WaitForTransfers(std::vector<PutOperation>& ops) {
-    for (auto& op : ops) {
-        // Skip operations that already failed or completed
-        if (op.IsResolved()) {
-            continue;
+    // Small values go to the master with the put, no buffer to write
+    const size_t total_size = CalculateSliceSize(slices);
+    if (total_size > 0 && total_size <= inline_max_size_ &&
+        config.content_hash.empty() && config.shard_segments.empty() &&
+        !config.upsert) {
+        std::string value;
+        value.reserve(total_size);
+        for (const auto& slice : slices) {
+            value.append(static_cast<const char*>(slice.ptr), slice.size);
         }
-
-        // Skip operations with no pending transfers (failed in SubmitTransfers)
-        if (op.pending_transfers.empty()) {
-            op.SetError(ErrorCode::INTERNAL_ERROR,
-                        "No pending transfers to wait for");
-            continue;
+        auto inline_result = master_client_.PutInline(key, value, config);
+        if (inline_result) {
+            PutToLocalFile(key, slices);
+            return {};
+        }
+        ErrorCode err = inline_result.error();
+        if (err == ErrorCode::OBJECT_ALREADY_EXISTS) {
+            VLOG(1) << "object_already_exists key=" << key;
+            return {};
+        }
+        if (err == ErrorCode::UNAVAILABLE_IN_CURRENT_MODE) {
+            LOG(INFO) << "Inline objects are disabled on the master";
+            inline_max_size_ = 0;
         }
+        // Otherwise the master's limit is lower, put it as usual
+    }
 
-        bool all_transfers_succeeded = true;
-        ErrorCode first_error = ErrorCode::OK;
-        size_t failed_transfer_idx = 0;
+    // Small single replica values go into an extent reserved beforehand,
+    // without a PutStart
+    if (PutWithCredit(key, slices, config)) {
+        return {};
+    }
 
-        for (size_t i = 0; i < op.pending_transfers.size(); ++i) {
-            ErrorCode transfer_result = op.pending_transfers[i].get();
-            if (transfer_result != ErrorCode::OK) {
-                if (all_transfers_succeeded) {
-                    // Record the first error for reporting
-                    first_error = transfer_result;
-                    failed_transfer_idx = i;
-                    all_transfers_succeeded = false;
-                }
-                // Continue waiting for all transfers to avoid resource leaks
-            }
+    // Start put operation
+    auto start_result = master_client_.PutStart(key, slice_lengths, config);
+    if (!start_result) {
+        ErrorCode err = start_result.error();
+        if (err == ErrorCode::OBJECT_ALREADY_EXISTS) {
+            VLOG(1) << "object_already_exists key=" << key;
+            return {};
         }
+        LOG(ERROR) << "Failed to start put operation: " << err;
+        return tl::unexpected(err);
+    }
 
-        if (all_transfers_succeeded) {
-            VLOG(1) << "All transfers completed successfully for key "
-                    << op.key;
-            // Transfer phase successful - continue to finalization
-            // Note: Don't mark as SUCCESS yet, need to complete finalization
-        } else {
-            std::string error_context =
-                "Transfer " + std::to_string(failed_transfer_idx) + " failed";
-            LOG(ERROR) << "Transfer failed for key " << op.key << ": "
-                       << toString(first_error) << " (" << error_context << ")";
-            op.SetError(first_error, error_context);
+    // Transfer data using allocated handles from all replicas
+    for (const auto& replica : start_result.value()) {
+        ErrorCode transfer_err = TransferWrite(replica, slices);
+        if (transfer_err != ErrorCode::OK) {
+            // Revoke put operation
+            auto revoke_result = master_client_.PutRevoke(key);
+            if (!revoke_result) {
+                LOG(ERROR) << "Failed to revoke put operation";
+                return tl::unexpected(revoke_result.error());
+            }
+            return tl::unexpected(transfer_err);
         }
     }
-}
 
-void Client::FinalizeBatchPut(std::vector<PutOperation>& ops) {
-    // For each operation,
-    // If transfers completed successfully, we need to call BatchPutEnd
-    // If the operation failed but has allocated replicas, we need to call
-    // BatchPutRevoke
+    // End put operation
+    auto end_result = master_client_.PutEnd(key);
+    if (!end_result) {
+        ErrorCode err = end_result.error();
+        LOG(ERROR) << "Failed to end put operation: " << err;
+        return tl::unexpected(err);
+    }
+    // A cached replica list would still name the previous value
+    if (config.upsert) {
+        InvalidateReplicaCache(key);
+    }
 
-    std::vector<std::string> successful_keys;
-    std::vector<size_t> successful_indices;
-    std::vector<std::string> failed_keys;
-    std::vector<size_t> failed_indices;
+    // Store to local file if storage backend is available
+    PutToLocalFile(key, slices);
 
-    // Reserve space to avoid reallocations
-    successful_keys.reserve(ops.size());
-    successful_indices.reserve(ops.size());
-    failed_keys.reserve(ops.size());
-    failed_indices.reserve(ops.size());
+    return {};
+}
 
-    for (size_t i = 0; i < ops.size(); ++i) {
-        auto& op = ops[i];
+TransferFuture Client::GetAsync(const std::string& object_key,
+                                std::vector<Slice>& slices) {
+    auto query_result = Query(object_key);
+    if (!query_result) {
+        return MakeReadyFuture(query_result.error());
+    }
+    return GetAsync(object_key, query_result.value(), slices);
+}
 
-        // Check if operation completed transfers successfully and needs
-        // finalization
-        if (!op.IsResolved() && !op.replicas.empty() &&
-            !op.pending_transfers.empty()) {
-            // Transfers completed, needs BatchPutEnd
-            successful_keys.emplace_back(op.key);
-            successful_indices.emplace_back(i);
-        } else if (op.state != PutOperationState::PENDING &&
-                   !op.replicas.empty()) {
-            // Operation failed but has allocated replicas, needs BatchPutRevoke
-            failed_keys.emplace_back(op.key);
-            failed_indices.emplace_back(i);
+TransferFuture Client::GetAsync(
+    const std::string& object_key,
+    const std::vector<Replica::Descriptor>& replica_list,
+    std::vector<Slice>& slices) {
+    CHECK(transfer_submitter_) << "TransferSubmitter not initialized";
+
+    Replica::Descriptor replica;
+    ErrorCode err = SelectReplica(replica_list, replica);
+    if (err != ErrorCode::OK) {
+        if (err == ErrorCode::INVALID_REPLICA) {
+            LOG(ERROR) << "no_complete_replicas_found key=" << object_key;
         }
-        // Operations without replicas (early failures) don't need finalization
+        return MakeReadyFuture(err);
     }
 
-    // Process successful operations
-    if (!successful_keys.empty()) {
+    auto future =
+        transfer_submitter_->submit(replica, slices, TransferRequest::READ);
+    if (!future) {
+        LOG(ERROR) << "transfer_submit_failed key=" << object_key;
+        return MakeReadyFuture(ErrorCode::TRANSFER_FAIL);
+    }
+    std::vector<TransferFuture> transfers;
+    transfers.push_back(std::move(*future));
+    if (replica.is_memory_replica() && !replica_cache_) {
+        return CompleteAsync(std::move(transfers));
+    }
+    return CompleteAsync(
+        std::move(transfers),
+        [this, object_key, replica, slices](ErrorCode result) {
+            if (result == ErrorCode::OK) {
+                PromoteFromDisk(object_key, replica, slices);
+            } else {
+                InvalidateReplicaCache(object_key);
+            }
+            return result;
+        });
+}
+
+std::vector<TransferFuture> Client::BatchGetAsync(
+    const std::vector<std::string>& object_keys,
+    std::unordered_map<std::string, std::vector<Slice>>& slices) {
+    auto batched_query_results = BatchQuery(object_keys);
+
+    std::vector<TransferFuture> futures;
+    futures.reserve(object_keys.size());
+    for (size_t i = 0; i < object_keys.size(); ++i) {
+        const auto& key = object_keys[i];
+        if (i >= batched_query_results.size()) {
+            futures.push_back(MakeReadyFuture(ErrorCode::RPC_FAIL));
+            continue;
+        }
+        if (!batched_query_results[i]) {
+            futures.push_back(
+                MakeReadyFuture(batched_query_results[i].error()));
+            continue;
+        }
+        auto slices_it = slices.find(key);
+        if (slices_it == slices.end()) {
+            LOG(ERROR) << "Slices not found for key: " << key;
+            futures.push_back(MakeReadyFuture(ErrorCode::INVALID_PARAMS));
+            continue;
+        }
+        futures.push_back(GetAsync(key, batched_query_results[i].value(),
+                                   slices_it->second));
+    }
+    return futures;
+}
+
+TransferFuture Client::PutAsync(const ObjectKey& key,
+                                std::vector<Slice>& slices,
+                                const ReplicateConfig& config) {
+    CHECK(transfer_submitter_) << "TransferSubmitter not initialized";
+    if (config.codec != PayloadCodecId::NONE) {
+        LOG(ERROR) << "Payload codecs are only supported by Put and BatchPut";
+        return MakeReadyFuture(ErrorCode::INVALID_PARAMS);
+    }
+    if (config.ec_data_fragments > 0 || config.ec_parity_fragments > 0) {
+        LOG(ERROR) << "Erasure coding is only supported by Put";
+        return MakeReadyFuture(ErrorCode::INVALID_PARAMS);
+    }
+
+    std::vector<size_t> slice_lengths;
+    for (const auto& slice : slices) {
+        slice_lengths.emplace_back(slice.size);
+    }
+
+    auto start_result = master_client_.PutStart(key, slice_lengths, config);
+    if (!start_result) {
+        ErrorCode err = start_result.error();
+        if (err == ErrorCode::OBJECT_ALREADY_EXISTS) {
+            VLOG(1) << "object_already_exists key=" << key;
+            return MakeReadyFuture(ErrorCode::OK);
+        }
+        LOG(ERROR) << "Failed to start put operation: " << err;
+        return MakeReadyFuture(err);
+    }
+
+    // Transfers already submitted must finish before the put is revoked
+    std::vector<TransferFuture> transfers;
+    ErrorCode submit_err = ErrorCode::OK;
+    for (const auto& replica : start_result.value()) {
+        auto future = transfer_submitter_->submit(replica, slices,
+                                                  TransferRequest::WRITE);
+        if (!future) {
+            LOG(ERROR) << "transfer_submit_failed key=" << key;
+            submit_err = ErrorCode::TRANSFER_FAIL;
+            break;
+        }
+        transfers.push_back(std::move(*future));
+    }
+
+    return CompleteAsync(
+        std::move(transfers),
+        [this, key, slices, submit_err](ErrorCode result) mutable {
+            if (result == ErrorCode::OK) {
+                result = submit_err;
+            }
+            if (result != ErrorCode::OK) {
+                auto revoke_result = master_client_.PutRevoke(key);
+                if (!revoke_result) {
+                    LOG(ERROR) << "Failed to revoke put operation";
+                    return revoke_result.error();
+                }
+                return result;
+            }
+            auto end_result = master_client_.PutEnd(key);
+            if (!end_result) {
+                LOG(ERROR) << "Failed to end put operation: "
+                           << end_result.error();
+                return end_result.error();
+            }
+            PutToLocalFile(key, slices);
+            return ErrorCode::OK;
+        });
+}
+
+async_simple::coro::Lazy<tl::expected<void, ErrorCode>> Client::CoGet(
+    std::string object_key, std::vector<Slice>& slices) {
+    CHECK(transfer_submitter_) << "TransferSubmitter not initialized";
+
+    // As QueryReplicas, with the master call awaited
+    std::optional<std::vector<Replica::Descriptor>> replica_list;
+    uint64_t generation = 0;
+    if (replica_cache_) {
+        replica_list = replica_cache_->Get(object_key);
+        generation = replica_cache_->generation();
+    }
+    if (!replica_list) {
+        const auto lease_start = ReplicaCache::Clock::now();
+        auto result = co_await master_client_.CoGetReplicaList(object_key);
+        if (result) {
+            if (replica_cache_) {
+                replica_cache_->Put(object_key, result.value(),
+                                    lease_start + replica_cache_ttl_,
+                                    generation);
+            }
+            replica_list = std::move(result.value());
+        } else if (storage_backend_) {
+            if (auto desc_opt = storage_backend_->Querykey(object_key)) {
+                replica_list.emplace();
+                replica_list->push_back(std::move(*desc_opt));
+            }
+        }
+        if (!replica_list) {
+            co_return tl::unexpected(result.error());
+        }
+    }
+
+    // Rebuilding from fragments and decoding wait for transfers on the
+    // calling thread, which may be one that must not be blocked
+    if (ErasureCodedToRebuild(*replica_list, slices)) {
+        LOG(ERROR) << "Rebuilding erasure-coded objects is only supported "
+                      "by Get, key="
+                   << object_key;
+        co_return tl::unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    if (!replica_list->empty() &&
+        !MatchesStoredLayout((*replica_list)[0], slices) &&
+        CalculateSliceSize(slices) != StoredSize((*replica_list)[0])) {
+        LOG(ERROR) << "Encoded payloads are only supported by Get, key="
+                   << object_key;
+        co_return tl::unexpected(ErrorCode::INVALID_PARAMS);
+    }
+
+    Replica::Descriptor replica;
+    ErrorCode err = SelectReplica(*replica_list, replica);
+    if (err != ErrorCode::OK) {
+        if (err == ErrorCode::INVALID_REPLICA) {
+            LOG(ERROR) << "no_complete_replicas_found key=" << object_key;
+        }
+        co_return tl::unexpected(err);
+    }
+
+    // Slices laid out otherwise, e.g. scattered pages, take the parts of
+    // the buffers they overlap, as in Get
+    std::vector<Slice> scattered;
+    std::optional<Replica::Descriptor> narrowed;
+    if (!MatchesStoredLayout(replica, slices)) {
+        narrowed = NarrowToRange(replica, 0, slices, scattered);
+        if (!narrowed) {
+            co_return tl::unexpected(ErrorCode::INVALID_PARAMS);
+        }
+    }
+    auto future = narrowed ? transfer_submitter_->submit(
+                                 *narrowed, scattered, TransferRequest::READ)
+                           : transfer_submitter_->submit(
+                                 replica, slices, TransferRequest::READ);
+    if (!future) {
+        LOG(ERROR) << "transfer_submit_failed key=" << object_key;
+        co_return tl::unexpected(ErrorCode::TRANSFER_FAIL);
+    }
+    ErrorCode result = co_await std::move(*future);
+    if (!replica.is_memory_replica() || replica_cache_) {
+        if (result == ErrorCode::OK) {
+            PromoteFromDisk(object_key, replica, slices);
+        } else {
+            InvalidateReplicaCache(object_key);
+        }
+    }
+    if (result != ErrorCode::OK) {
+        co_return tl::unexpected(result);
+    }
+    co_return tl::expected<void, ErrorCode>{};
+}
+
+async_simple::coro::Lazy<tl::expected<void, ErrorCode>> Client::CoPut(
+    ObjectKey key, std::vector<Slice>& slices, ReplicateConfig config) {
+    CHECK(transfer_submitter_) << "TransferSubmitter not initialized";
+    if (config.codec != PayloadCodecId::NONE) {
+        LOG(ERROR) << "Payload codecs are only supported by Put and BatchPut";
+        co_return tl::unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    if (config.ec_data_fragments > 0 || config.ec_parity_fragments > 0) {
+        LOG(ERROR) << "Erasure coding is only supported by Put";
+        co_return tl::unexpected(ErrorCode::INVALID_PARAMS);
+    }
+
+    std::vector<size_t> slice_lengths;
+    for (const auto& slice : slices) {
+        slice_lengths.emplace_back(slice.size);
+    }
+
+    auto start_result =
+        co_await master_client_.CoPutStart(key, slice_lengths, config);
+    if (!start_result) {
+        ErrorCode err = start_result.error();
+        if (err == ErrorCode::OBJECT_ALREADY_EXISTS) {
+            VLOG(1) << "object_already_exists key=" << key;
+            co_return tl::expected<void, ErrorCode>{};
+        }
+        LOG(ERROR) << "Failed to start put operation: " << err;
+        co_return tl::unexpected(err);
+    }
+
+    // Transfers already submitted must finish before the put is revoked
+    std::vector<TransferFuture> transfers;
+    ErrorCode result = ErrorCode::OK;
+    for (const auto& replica : start_result.value()) {
+        auto future = transfer_submitter_->submit(replica, slices,
+                                                  TransferRequest::WRITE);
+        if (!future) {
+            LOG(ERROR) << "transfer_submit_failed key=" << key;
+            result = ErrorCode::TRANSFER_FAIL;
+            break;
+        }
+        transfers.push_back(std::move(*future));
+    }
+    for (auto& transfer : transfers) {
+        ErrorCode transfer_result = co_await std::move(transfer);
+        if (result == ErrorCode::OK) {
+            result = transfer_result;
+        }
+    }
+
+    if (result != ErrorCode::OK) {
+        auto revoke_result = co_await master_client_.CoPutRevoke(key);
+        if (!revoke_result) {
+            LOG(ERROR) << "Failed to revoke put operation";
+            co_return tl::unexpected(revoke_result.error());
+        }
+        co_return tl::unexpected(result);
+    }
+    auto end_result = co_await master_client_.CoPutEnd(key);
+    if (!end_result) {
+        LOG(ERROR) << "Failed to end put operation: " << end_result.error();
+        co_return tl::unexpected(end_result.error());
+    }
+    PutToLocalFile(key, slices);
+    co_return tl::expected<void, ErrorCode>{};
+}
+
+TransferFuture Client::CompleteAsync(
+    std::vector<TransferFuture> transfers,
+    std::function<ErrorCode(ErrorCode)> finalize) {
+    auto state = std::make_shared<AsyncOperationState>(
+        transfers.empty() ? TransferStrategy::TRANSFER_ENGINE
+                          : transfers.front().strategy());
+    // Tasks of the thread pool must be copyable
+    auto pending =
+        std::make_shared<std::vector<TransferFuture>>(std::move(transfers));
+    async_thread_pool_.enqueue([state, pending, finalize]() {
+        ErrorCode result = TransferFuture::waitAll(*pending);
+        pending->clear();
+        if (finalize) {
+            result = finalize(result);
+        }
+        state->set_completed(result);
+    });
+    return TransferFuture(state);
+}
+
+TransferFuture Client::MakeReadyFuture(ErrorCode error_code) {
+    auto state =
+        std::make_shared<AsyncOperationState>(TransferStrategy::LOCAL_MEMCPY);
+    state->set_completed(error_code);
+    return TransferFuture(state);
+}
+
+// TODO: `client.cpp` is too long, consider split it into multiple files
+enum class PutOperationState {
+    PENDING,
+    MASTER_FAILED,
+    TRANSFER_FAILED,
+    FINALIZE_FAILED,
+    SUCCESS
+};
+
+class PutOperation {
+   public:
+    PutOperation(std::string_view k, const std::vector<Slice>& s)
+        : key(k), slices(s) {
+        value_length = CalculateSliceSize(slices);
+        // Initialize with a pending error state to ensure result is always set
+        result = tl::unexpected(ErrorCode::INTERNAL_ERROR);
+    }
+
+    std::string key;
+    std::vector<Slice> slices;
+    size_t value_length;
+
+    // Enhanced state tracking
+    PutOperationState state = PutOperationState::PENDING;
+    tl::expected<void, ErrorCode> result;
+    std::vector<Replica::Descriptor> replicas;
+    std::vector<TransferFuture> pending_transfers;
+
+    // Error context for debugging
+    std::optional<std::string> failure_context;
+
+    // Helper methods for robust state management
+    void SetSuccess() {
+        state = PutOperationState::SUCCESS;
+        result = {};
+        failure_context.reset();
+    }
+
+    void SetError(ErrorCode error, const std::string& context = "") {
+        result = tl::unexpected(error);
+        if (!context.empty()) {
+            failure_context = toString(error) + ": " + context + "; " +
+                              failure_context.value_or("");
+        }
+
+        // Update state based on current processing stage
+        if (replicas.empty()) {
+            state = PutOperationState::MASTER_FAILED;
+        } else if (pending_transfers.empty()) {
+            state = PutOperationState::TRANSFER_FAILED;
+        } else {
+            state = PutOperationState::FINALIZE_FAILED;
+        }
+        LOG(WARNING) << "Put operation failed for key " << key << ", context: "
+                     << failure_context.value_or("unknown error");
+    }
+
+    bool IsResolved() const { return state != PutOperationState::PENDING; }
+
+    bool IsSuccessful() const {
+        return state == PutOperationState::SUCCESS && result.has_value();
+    }
+};
+
+std::vector<PutOperation> Client::CreatePutOperations(
+    const std::vector<ObjectKey>& keys,
+    const std::vector<std::vector<Slice>>& batched_slices) {
+    std::vector<PutOperation> ops;
+    ops.reserve(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        ops.emplace_back(keys[i], batched_slices[i]);
+    }
+    return ops;
+}
+
+void Client::StartBatchPut(std::vector<PutOperation>& ops,
+                           const ReplicateConfig& config) {
+    // The encoded payloads must outlive the transfers, only BatchPut keeps
+    // them, and it encodes before it gets here
+    if (config.codec != PayloadCodecId::NONE) {
+        for (auto& op : ops) {
+            op.SetError(ErrorCode::INVALID_PARAMS,
+                        "Payload codecs are only supported by BatchPut");
+        }
+        return;
+    }
+    if (config.ec_data_fragments > 0 || config.ec_parity_fragments > 0) {
+        for (auto& op : ops) {
+            op.SetError(ErrorCode::INVALID_PARAMS,
+                        "Erasure coding is only supported by Put");
+        }
+        return;
+    }
+
+    std::vector<std::string> keys;
+    std::vector<std::vector<uint64_t>> slice_lengths;
+    // Operations to start, those put into allocation credits are done
+    std::vector<size_t> started;
+
+    keys.reserve(ops.size());
+    slice_lengths.reserve(ops.size());
+    started.reserve(ops.size());
+
+    for (size_t i = 0; i < ops.size(); ++i) {
+        const auto& op = ops[i];
+        if (op.IsResolved()) {
+            continue;
+        }
+        started.push_back(i);
+        keys.emplace_back(op.key);
+
+        std::vector<uint64_t> slice_sizes;
+        slice_sizes.reserve(op.slices.size());
+        for (const auto& slice : op.slices) {
+            slice_sizes.emplace_back(slice.size);
+        }
+        slice_lengths.emplace_back(std::move(slice_sizes));
+    }
+
+    if (keys.empty()) {
+        return;
+    }
+    auto start_responses =
+        master_client_.BatchPutStart(keys, slice_lengths, config);
+
+    // Ensure response size matches request size
+    if (start_responses.size() != keys.size()) {
+        LOG(ERROR) << "BatchPutStart response size mismatch: expected "
+                   << keys.size() << ", got " << start_responses.size();
+        for (size_t i : started) {
+            ops[i].SetError(ErrorCode::RPC_FAIL,
+                            "BatchPutStart response size mismatch");
+        }
+        return;
+    }
+
+    // Process individual responses with robust error handling
+    for (size_t j = 0; j < started.size(); ++j) {
+        auto& op = ops[started[j]];
+        if (!start_responses[j]) {
+            op.SetError(start_responses[j].error(),
+                        "Master failed to start put operation");
+        } else if (config.skip_resident && start_responses[j]->empty()) {
+            // Already stored, nothing to transfer
+            VLOG(1) << "Skipped resident key " << op.key;
+            op.SetSuccess();
+        } else {
+            op.replicas = start_responses[j].value();
+            // Operation continues to next stage - result remains INTERNAL_ERROR
+            // until fully successful
+            VLOG(1) << "Successfully started put for key " << op.key
+                    << " with " << op.replicas.size() << " replicas";
+        }
+    }
+}
+
+void Client::SubmitTransfers(std::vector<PutOperation>& ops) {
+    CHECK(transfer_submitter_) << "TransferSubmitter not initialized";
+
+    // The writes of every replica of every key share one transfer engine
+    // batch
+    std::vector<size_t> op_of_item;
+    std::vector<TransferSubmitter::BatchItem> items;
+    for (size_t i = 0; i < ops.size(); ++i) {
+        auto& op = ops[i];
+        if (op.IsResolved()) {
+            continue;
+        }
+        if (op.replicas.empty()) {
+            op.SetError(ErrorCode::INTERNAL_ERROR,
+                        "No replicas available for transfer");
+            continue;
+        }
+        for (const auto& replica : op.replicas) {
+            op_of_item.push_back(i);
+            items.push_back({&replica, &op.slices});
+        }
+    }
+    if (items.empty()) {
+        return;
+    }
+
+    auto futures =
+        transfer_submitter_->submitBatch(items, TransferRequest::WRITE);
+    std::vector<bool> failed(ops.size(), false);
+    for (size_t j = 0; j < items.size(); ++j) {
+        auto& op = ops[op_of_item[j]];
+        if (futures[j]) {
+            op.pending_transfers.emplace_back(std::move(*futures[j]));
+        } else {
+            failed[op_of_item[j]] = true;
+        }
+    }
+    for (size_t i = 0; i < ops.size(); ++i) {
+        auto& op = ops[i];
+        if (!failed[i]) {
+            if (!op.pending_transfers.empty()) {
+                VLOG(1) << "Successfully submitted "
+                        << op.pending_transfers.size()
+                        << " transfers for key " << op.key;
+            }
+            continue;
+        }
+        LOG(ERROR) << "Transfer submission failed for key " << op.key;
+        op.SetError(ErrorCode::TRANSFER_FAIL,
+                    "Failed to submit transfer for a replica");
+        // The replicas are revoked, let the submitted writes finish first
+        TransferFuture::waitAll(op.pending_transfers);
+        op.pending_transfers.clear();
+    }
+}
+
+void Client::SubmitTransfers(PutOperation& op) {
+    CHECK(transfer_submitter_) << "TransferSubmitter not initialized";
+
+    // Skip operations that already failed in previous stages
+    if (op.IsResolved()) {
+        return;
+    }
+
+    // Skip operations that don't have replicas (failed in StartBatchPut)
+    if (op.replicas.empty()) {
+        op.SetError(ErrorCode::INTERNAL_ERROR,
+                    "No replicas available for transfer");
+        return;
+    }
+
+    bool all_transfers_submitted = true;
+    std::string failure_context;
+
+    for (size_t replica_idx = 0; replica_idx < op.replicas.size();
+         ++replica_idx) {
+        const auto& replica = op.replicas[replica_idx];
+
+        auto submit_result = transfer_submitter_->submit(
+            replica, op.slices, TransferRequest::WRITE);
+
+        if (!submit_result) {
+            failure_context = "Failed to submit transfer for replica " +
+                              std::to_string(replica_idx);
+            all_transfers_submitted = false;
+            break;
+        }
+
+        op.pending_transfers.emplace_back(std::move(submit_result.value()));
+    }
+
+    if (!all_transfers_submitted) {
+        LOG(ERROR) << "Transfer submission failed for key " << op.key << ": "
+                   << failure_context;
+        op.SetError(ErrorCode::TRANSFER_FAIL, failure_context);
+        op.pending_transfers.clear();
+    } else {
+        VLOG(1) << "Successfully submitted " << op.pending_transfers.size()
+                << " transfers for key " << op.key;
+    }
+}
+
+void Client::WaitForTransfers(std::vector<PutOperation>& ops) {
+    for (auto& op : ops) {
+        // Skip operations that already failed or completed
+        if (op.IsResolved()) {
+            continue;
+        }
+
+        // Skip operations with no pending transfers (failed in SubmitTransfers)
+        if (op.pending_transfers.empty()) {
+            op.SetError(ErrorCode::INTERNAL_ERROR,
+                        "No pending transfers to wait for");
+            continue;
+        }
+
+        bool all_transfers_succeeded = true;
+        ErrorCode first_error = ErrorCode::OK;
+        size_t failed_transfer_idx = 0;
+
+        for (size_t i = 0; i < op.pending_transfers.size(); ++i) {
+            ErrorCode transfer_result = op.pending_transfers[i].get();
+            if (transfer_result != ErrorCode::OK) {
+                if (all_transfers_succeeded) {
+                    // Record the first error for reporting
+                    first_error = transfer_result;
+                    failed_transfer_idx = i;
+                    all_transfers_succeeded = false;
+                }
+                // Continue waiting for all transfers to avoid resource leaks
+            }
+        }
+
+        if (all_transfers_succeeded) {
+            VLOG(1) << "All transfers completed successfully for key "
+                    << op.key;
+            // Transfer phase successful - continue to finalization
+            // Note: Don't mark as SUCCESS yet, need to complete finalization
+        } else {
+            std::string error_context =
+                "Transfer " + std::to_string(failed_transfer_idx) + " failed";
+            LOG(ERROR) << "Transfer failed for key " << op.key << ": "
+                       << toString(first_error) << " (" << error_context << ")";
+            op.SetError(first_error, error_context);
+        }
+    }
+}
+
+void Client::FinalizeBatchPut(std::vector<PutOperation>& ops) {
+    // For each operation,
+    // If transfers completed successfully, we need to call BatchPutEnd
+    // If the operation failed but has allocated replicas, we need to call
+    // BatchPutRevoke
+
+    std::vector<std::string> successful_keys;
+    std::vector<size_t> successful_indices;
+    std::vector<std::string> failed_keys;
+    std::vector<size_t> failed_indices;
+
+    // Reserve space to avoid reallocations
+    successful_keys.reserve(ops.size());
+    successful_indices.reserve(ops.size());
+    failed_keys.reserve(ops.size());
+    failed_indices.reserve(ops.size());
+
+    for (size_t i = 0; i < ops.size(); ++i) {
+        auto& op = ops[i];
+
+        // Check if operation completed transfers successfully and needs
+        // finalization
+        if (!op.IsResolved() && !op.replicas.empty() &&
+            !op.pending_transfers.empty()) {
+            // Transfers completed, needs BatchPutEnd
+            successful_keys.emplace_back(op.key);
+            successful_indices.emplace_back(i);
+        } else if (op.state != PutOperationState::PENDING &&
+                   !op.replicas.empty()) {
+            // Operation failed but has allocated replicas, needs BatchPutRevoke
+            failed_keys.emplace_back(op.key);
+            failed_indices.emplace_back(i);
+        }
+        // Operations without replicas (early failures) don't need finalization
+    }
+
+    // Process successful operations
+    if (!successful_keys.empty()) {
         auto end_responses = master_client_.BatchPutEnd(successful_keys);
         if (end_responses.size() != successful_keys.size()) {
             LOG(ERROR) << "BatchPutEnd response size mismatch: expected "
@@ -774,316 +2211,2078 @@ void Client::FinalizeBatchPut(std::vector<PutOperation>& ops) {
                                   "BatchPutEnd response size mismatch");
             }
         } else {
-            // Process individual responses
-            for (size_t i = 0; i < end_responses.size(); ++i) {
-                const size_t op_idx = successful_indices[i];
-                if (!end_responses[i]) {
+            // Process individual responses
+            for (size_t i = 0; i < end_responses.size(); ++i) {
+                const size_t op_idx = successful_indices[i];
+                if (!end_responses[i]) {
+                    LOG(ERROR) << "Failed to finalize put for key "
+                               << successful_keys[i] << ": "
+                               << toString(end_responses[i].error());
+                    ops[op_idx].SetError(end_responses[i].error(),
+                                         "BatchPutEnd failed");
+                } else {
+                    // Operation fully successful
+                    ops[op_idx].SetSuccess();
+                    VLOG(1) << "Successfully completed put for key "
+                            << successful_keys[i];
+                }
+            }
+        }
+    }
+
+    // Process failed operations that need cleanup
+    if (!failed_keys.empty()) {
+        auto revoke_responses = master_client_.BatchPutRevoke(failed_keys);
+        if (revoke_responses.size() != failed_keys.size()) {
+            LOG(ERROR) << "BatchPutRevoke response size mismatch: expected "
+                       << failed_keys.size() << ", got "
+                       << revoke_responses.size();
+            // Mark all failed operations with revoke RPC failure
+            for (size_t idx : failed_indices) {
+                ops[idx].SetError(ErrorCode::RPC_FAIL,
+                                  "BatchPutRevoke response size mismatch");
+            }
+        } else {
+            // Process individual revoke responses
+            for (size_t i = 0; i < revoke_responses.size(); ++i) {
+                const size_t op_idx = failed_indices[i];
+                if (!revoke_responses[i]) {
+                    LOG(ERROR)
+                        << "Failed to revoke put for key " << failed_keys[i]
+                        << ": " << toString(revoke_responses[i].error());
+                    // Preserve original error but note revoke failure in
+                    // context
+                    std::string original_context =
+                        ops[op_idx].failure_context.value_or("unknown error");
+                    ops[op_idx].failure_context =
+                        original_context + "; revoke also failed";
+                } else {
+                    LOG(INFO) << "Successfully revoked failed put for key "
+                              << failed_keys[i];
+                }
+            }
+        }
+    }
+
+    // Ensure all operations have definitive results
+    for (auto& op : ops) {
+        if (!op.IsResolved()) {
+            op.SetError(ErrorCode::INTERNAL_ERROR,
+                        "Operation not resolved after finalization");
+            LOG(ERROR) << "Operation for key " << op.key
+                       << " was not properly resolved";
+        }
+    }
+}
+
+std::vector<tl::expected<void, ErrorCode>> Client::CollectResults(
+    const std::vector<PutOperation>& ops) {
+    std::vector<tl::expected<void, ErrorCode>> results;
+    results.reserve(ops.size());
+
+    for (const auto& op : ops) {
+        // With the new structure, result is always set (never nullopt)
+        results.emplace_back(op.result);
+
+        // Additional validation and logging for debugging
+        if (!op.result.has_value()) {
+            // if error == object already exist, consider as ok
+            if (op.result.error() == ErrorCode::OBJECT_ALREADY_EXISTS) {
+                results.back() = {};
+                continue;
+            }
+            LOG(ERROR) << "Operation for key " << op.key
+                       << " failed: " << toString(op.result.error())
+                       << (op.failure_context
+                               ? (" (" + *op.failure_context + ")")
+                               : "");
+        } else {
+            VLOG(1) << "Operation for key " << op.key
+                    << " completed successfully";
+        }
+    }
+
+    return results;
+}
+
+std::vector<tl::expected<void, ErrorCode>> Client::BatchPut(
+    const std::vector<ObjectKey>& keys,
+    std::vector<std::vector<Slice>>& batched_slices,
+    const ReplicateConfig& config) {
+    if (config.codec != PayloadCodecId::NONE) {
+        std::vector<uint8_t> staging;
+        auto encoded = EncodePayloads(config.codec, batched_slices, staging);
+        if (!encoded) {
+            return std::vector<tl::expected<void, ErrorCode>>(
+                keys.size(), tl::unexpected(encoded.error()));
+        }
+        ReplicateConfig stored_config = config;
+        stored_config.codec = PayloadCodecId::NONE;
+        auto results = BatchPut(keys, encoded.value(), stored_config);
+        transfer_engine_.unregisterLocalMemory(staging.data(), false);
+        return results;
+    }
+
+    std::vector<PutOperation> ops = CreatePutOperations(keys, batched_slices);
+    PackPutsWithCredit(ops, config);
+    StartBatchPut(ops, config);
+    SubmitTransfers(ops);
+    WaitForTransfers(ops);
+    FinalizeBatchPut(ops);
+    if (config.upsert) {
+        for (const auto& key : keys) {
+            InvalidateReplicaCache(key);
+        }
+    }
+    return CollectResults(ops);
+}
+
+tl::expected<std::vector<std::vector<Slice>>, ErrorCode>
+Client::EncodePayloads(PayloadCodecId codec_id,
+                       const std::vector<std::vector<Slice>>& batched_slices,
+                       std::vector<uint8_t>& staging) {
+    const PayloadCodec* codec = GetPayloadCodec(codec_id);
+    if (!codec) {
+        LOG(ERROR) << "unknown_payload_codec codec="
+                   << static_cast<int>(codec_id);
+        return tl::unexpected(ErrorCode::INVALID_PARAMS);
+    }
+
+    std::vector<size_t> offsets;
+    offsets.reserve(batched_slices.size());
+    size_t total = 0;
+    for (const auto& slices : batched_slices) {
+        offsets.push_back(total);
+        total += MaxEncodedPayloadSize(*codec, CalculateSliceSize(slices));
+    }
+    staging.resize(total);
+
+    std::vector<std::vector<Slice>> encoded(batched_slices.size());
+    for (size_t i = 0; i < batched_slices.size(); ++i) {
+        auto stored_size = EncodePayload(
+            *codec, batched_slices[i],
+            std::span<uint8_t>(staging).subspan(offsets[i]));
+        if (!stored_size) {
+            LOG(ERROR) << "encode_payload_failed codec=" << codec->name()
+                       << " error=" << stored_size.error();
+            return tl::unexpected(stored_size.error());
+        }
+        // Slices of at most kMaxSliceSize, like the ones of callers
+        for (size_t offset = 0; offset < stored_size.value();
+             offset += kMaxSliceSize) {
+            encoded[i].push_back(
+                Slice{staging.data() + offsets[i] + offset,
+                      std::min<size_t>(kMaxSliceSize,
+                                       stored_size.value() - offset)});
+        }
+    }
+
+    if (transfer_engine_.registerLocalMemory(staging.data(), staging.size(),
+                                             kWildcardLocation, false,
+                                             false) != 0) {
+        LOG(ERROR) << "register_staging_buffer_failed size=" << staging.size();
+        return tl::unexpected(ErrorCode::INTERNAL_ERROR);
+    }
+    return encoded;
+}
+
+tl::expected<void, ErrorCode> Client::GetEncoded(
+    const std::string& object_key,
+    const std::vector<Replica::Descriptor>& replica_list,
+    std::vector<Slice>& slices) {
+    Replica::Descriptor replica;
+    ErrorCode err = SelectReplica(replica_list, replica);
+    if (err != ErrorCode::OK) {
+        if (err == ErrorCode::INVALID_REPLICA) {
+            LOG(ERROR) << "no_complete_replicas_found key=" << object_key;
+        }
+        return tl::unexpected(err);
+    }
+
+    // Slices laid out like the stored object
+    std::vector<uint8_t> staging;
+    auto stored_slices = StoredLayoutSlices(replica, staging);
+
+    if (transfer_engine_.registerLocalMemory(staging.data(), staging.size(),
+                                             kWildcardLocation, false,
+                                             false) != 0) {
+        LOG(ERROR) << "register_staging_buffer_failed key=" << object_key;
+        return tl::unexpected(ErrorCode::INTERNAL_ERROR);
+    }
+    err = TransferRead(replica, stored_slices);
+    transfer_engine_.unregisterLocalMemory(staging.data(), false);
+    if (err != ErrorCode::OK) {
+        LOG(ERROR) << "transfer_read_failed key=" << object_key;
+        InvalidateReplicaCache(object_key);
+        return tl::unexpected(err);
+    }
+
+    if (!ParsePayloadHeader(staging.data(), staging.size())) {
+        // Not encoded, e.g. a disk replica read into larger slices
+        if (replica.is_memory_replica() ||
+            CalculateSliceSize(slices) < staging.size()) {
+            LOG(ERROR) << "Slices of " << CalculateSliceSize(slices)
+                       << " bytes do not match key=" << object_key << " of "
+                       << staging.size() << " bytes";
+            return tl::unexpected(ErrorCode::INVALID_PARAMS);
+        }
+        size_t offset = 0;
+        for (auto& slice : slices) {
+            const size_t size =
+                std::min<size_t>(slice.size, staging.size() - offset);
+            std::memcpy(slice.ptr, staging.data() + offset, size);
+            offset += size;
+        }
+        return {};
+    }
+    auto decoded = DecodePayload(staging, slices);
+    if (!decoded) {
+        LOG(ERROR) << "decode_payload_failed key=" << object_key
+                   << " error=" << decoded.error();
+        return tl::unexpected(decoded.error());
+    }
+    return {};
+}
+
+tl::expected<void, ErrorCode> Client::PutErasureCoded(
+    const ObjectKey& key, std::vector<Slice>& slices,
+    const ReplicateConfig& config) {
+    const size_t k = config.ec_data_fragments;
+    const size_t m = config.ec_parity_fragments;
+    const uint64_t size = CalculateSliceSize(slices);
+    if (!IsValidErasureCode(size, k, m) || config.replica_num != 1 ||
+        !config.content_hash.empty()) {
+        LOG(ERROR) << "invalid_erasure_code key=" << key << " size=" << size
+                   << " " << config;
+        return tl::unexpected(ErrorCode::INVALID_PARAMS);
+    }
+
+    // The data fragments and then the parity fragments, one after another
+    const auto data_sizes = ErasureDataFragmentSizes(size, k);
+    const uint64_t parity_size = data_sizes.front();
+    std::vector<uint8_t> staging(size + m * parity_size);
+    size_t offset = 0;
+    for (const auto& slice : slices) {
+        std::memcpy(staging.data() + offset, slice.ptr, slice.size);
+        offset += slice.size;
+    }
+    std::vector<Slice> fragments;
+    std::vector<uint64_t> fragment_lengths;
+    offset = 0;
+    for (size_t i = 0; i < k + m; ++i) {
+        const uint64_t length = i < k ? data_sizes[i] : parity_size;
+        fragments.push_back(Slice{staging.data() + offset, length});
+        fragment_lengths.push_back(length);
+        offset += length;
+    }
+    std::vector<Slice> data(fragments.begin(), fragments.begin() + k);
+    std::vector<Slice> parity(fragments.begin() + k, fragments.end());
+    ErasureEncode(data, parity);
+
+    if (transfer_engine_.registerLocalMemory(staging.data(), staging.size(),
+                                             kWildcardLocation, false,
+                                             false) != 0) {
+        LOG(ERROR) << "register_staging_buffer_failed key=" << key;
+        return tl::unexpected(ErrorCode::INTERNAL_ERROR);
+    }
+    auto result = [&]() -> tl::expected<void, ErrorCode> {
+        auto start_result =
+            master_client_.PutStart(key, fragment_lengths, config);
+        if (!start_result) {
+            ErrorCode err = start_result.error();
+            if (err == ErrorCode::OBJECT_ALREADY_EXISTS) {
+                VLOG(1) << "object_already_exists key=" << key;
+                return {};
+            }
+            LOG(ERROR) << "Failed to start put operation: " << err;
+            return tl::unexpected(err);
+        }
+        // All fragments are written in one go
+        Replica::Descriptor replica = start_result.value().front();
+        auto& memory = replica.get_memory_descriptor();
+        memory.buffer_descriptors.insert(memory.buffer_descriptors.end(),
+                                         memory.parity_descriptors.begin(),
+                                         memory.parity_descriptors.end());
+        memory.parity_descriptors.clear();
+        ErrorCode err = TransferWrite(replica, fragments);
+        if (err != ErrorCode::OK) {
+            auto revoke_result = master_client_.PutRevoke(key);
+            if (!revoke_result) {
+                LOG(ERROR) << "Failed to revoke put operation";
+                return tl::unexpected(revoke_result.error());
+            }
+            return tl::unexpected(err);
+        }
+        auto end_result = master_client_.PutEnd(key);
+        if (!end_result) {
+            LOG(ERROR) << "Failed to end put operation: "
+                       << end_result.error();
+            return tl::unexpected(end_result.error());
+        }
+        PutToLocalFile(key, slices);
+        return {};
+    }();
+    transfer_engine_.unregisterLocalMemory(staging.data(), false);
+    return result;
+}
+
+tl::expected<void, ErrorCode> Client::GetErasureCoded(
+    const std::string& object_key, const Replica::Descriptor& replica,
+    std::vector<Slice>& slices) {
+    const auto& memory = replica.get_memory_descriptor();
+    const size_t k = memory.buffer_descriptors.size();
+    std::vector<AllocatedBuffer::Descriptor> fragments =
+        memory.buffer_descriptors;
+    fragments.insert(fragments.end(), memory.parity_descriptors.begin(),
+                     memory.parity_descriptors.end());
+    uint64_t size = 0;
+    for (size_t i = 0; i < k; ++i) {
+        size += fragments[i].size_;
+    }
+    if (CalculateSliceSize(slices) < size) {
+        LOG(ERROR) << "Slices of " << CalculateSliceSize(slices)
+                   << " bytes do not match key=" << object_key << " of "
+                   << size << " bytes";
+        return tl::unexpected(ErrorCode::INVALID_PARAMS);
+    }
+
+    // Each fragment is read on its own, so that a lost one fails alone
+    const uint64_t stride = fragments.front().size_;
+    std::vector<uint8_t> staging(stride * fragments.size());
+    std::vector<Slice> fragment_slices;
+    std::vector<std::vector<Slice>> read_slices;
+    for (size_t i = 0; i < fragments.size(); ++i) {
+        fragment_slices.push_back(
+            Slice{staging.data() + i * stride, fragments[i].size_});
+        read_slices.push_back({fragment_slices.back()});
+    }
+    if (transfer_engine_.registerLocalMemory(staging.data(), staging.size(),
+                                             kWildcardLocation, false,
+                                             false) != 0) {
+        LOG(ERROR) << "register_staging_buffer_failed key=" << object_key;
+        return tl::unexpected(ErrorCode::INTERNAL_ERROR);
+    }
+    std::vector<std::optional<TransferFuture>> reads(fragments.size());
+    for (size_t i = 0; i < fragments.size(); ++i) {
+        if (fragments[i].status_ == BufStatus::UNREGISTERED) {
+            continue;
+        }
+        MemoryDescriptor fragment_memory;
+        fragment_memory.buffer_descriptors.push_back(fragments[i]);
+        Replica::Descriptor fragment;
+        fragment.descriptor_variant = std::move(fragment_memory);
+        fragment.status = ReplicaStatus::COMPLETE;
+        reads[i] = transfer_submitter_->submit(fragment, read_slices[i],
+                                               TransferRequest::READ);
+    }
+    std::vector<bool> present(fragments.size(), false);
+    size_t present_count = 0;
+    for (size_t i = 0; i < fragments.size(); ++i) {
+        present[i] = reads[i] && reads[i]->get() == ErrorCode::OK;
+        present_count += present[i];
+    }
+    transfer_engine_.unregisterLocalMemory(staging.data(), false);
+    if (present_count < k) {
+        LOG(ERROR) << "erasure_decode_failed key=" << object_key
+                   << " fragments_read=" << present_count << " of "
+                   << fragments.size() << ", needed=" << k;
+        InvalidateReplicaCache(object_key);
+        return tl::unexpected(ErrorCode::TRANSFER_FAIL);
+    }
+    ErrorCode err = ErasureDecode(fragment_slices, k, present);
+    if (err != ErrorCode::OK) {
+        LOG(ERROR) << "erasure_decode_failed key=" << object_key
+                   << " error=" << err;
+        return tl::unexpected(err);
+    }
+
+    // Data fragments in order into the slices
+    size_t slice_index = 0;
+    size_t slice_offset = 0;
+    for (size_t i = 0; i < k; ++i) {
+        const auto* src = static_cast<const uint8_t*>(fragment_slices[i].ptr);
+        size_t left = fragment_slices[i].size;
+        while (left > 0) {
+            auto& slice = slices[slice_index];
+            const size_t length = std::min(left, slice.size - slice_offset);
+            std::memcpy(static_cast<uint8_t*>(slice.ptr) + slice_offset, src,
+                        length);
+            src += length;
+            left -= length;
+            slice_offset += length;
+            if (slice_offset == slice.size) {
+                ++slice_index;
+                slice_offset = 0;
+            }
+        }
+    }
+    return {};
+}
+
+PutGroup::PutGroup() = default;
+
+PutGroup::~PutGroup() {
+    if (!ended_) {
+        LOG(WARNING) << "Put group of " << ops_.size()
+                     << " objects destroyed without EndPutGroup";
+    }
+}
+
+size_t PutGroup::size() const { return ops_.size(); }
+
+std::shared_ptr<PutGroup> Client::StartPutGroup(
+    const std::vector<ObjectKey>& keys,
+    std::vector<std::vector<Slice>>& batched_slices,
+    const ReplicateConfig& config) {
+    std::shared_ptr<PutGroup> group(new PutGroup());
+    group->ops_ = CreatePutOperations(keys, batched_slices);
+    group->submitted_.assign(keys.size(), false);
+    if (!group->ops_.empty()) {
+        StartBatchPut(group->ops_, config);
+    }
+    return group;
+}
+
+ErrorCode Client::SubmitPutGroup(PutGroup& group, size_t first,
+                                 size_t count) {
+    if (group.ended_ || first > group.ops_.size() ||
+        count > group.ops_.size() - first) {
+        LOG(ERROR) << "Invalid put group range " << first << "+" << count
+                   << " of " << group.ops_.size() << " objects";
+        return ErrorCode::INVALID_PARAMS;
+    }
+    for (size_t i = first; i < first + count; ++i) {
+        if (!group.submitted_[i]) {
+            group.submitted_[i] = true;
+            SubmitTransfers(group.ops_[i]);
+        }
+    }
+    return ErrorCode::OK;
+}
+
+std::vector<tl::expected<void, ErrorCode>> Client::EndPutGroup(
+    PutGroup& group) {
+    if (group.ended_) {
+        LOG(ERROR) << "Put group already ended";
+        return std::vector<tl::expected<void, ErrorCode>>(
+            group.ops_.size(), tl::unexpected(ErrorCode::INVALID_PARAMS));
+    }
+    SubmitPutGroup(group, 0, group.ops_.size());
+    group.ended_ = true;
+    WaitForTransfers(group.ops_);
+    FinalizeBatchPut(group.ops_);
+    return CollectResults(group.ops_);
+}
+
+MultipartPut::~MultipartPut() {
+    if (!ended_) {
+        LOG(WARNING) << "Multipart put of key=" << key_
+                     << " destroyed without EndMultipartPut";
+    }
+}
+
+tl::expected<std::shared_ptr<MultipartPut>, ErrorCode>
+Client::StartMultipartPut(const ObjectKey& key, uint64_t size,
+                          uint64_t part_size, const ReplicateConfig& config) {
+    if (size == 0 || part_size == 0 || config.codec != PayloadCodecId::NONE ||
+        config.ec_data_fragments > 0 || config.ec_parity_fragments > 0) {
+        LOG(ERROR) << "Invalid multipart put of key=" << key
+                   << " size=" << size << " part_size=" << part_size;
+        return tl::unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    // Slices of at most kMaxSliceSize, like the ones of callers
+    std::vector<size_t> slice_lengths;
+    for (uint64_t offset = 0; offset < size; offset += kMaxSliceSize) {
+        slice_lengths.push_back(
+            std::min<uint64_t>(kMaxSliceSize, size - offset));
+    }
+    auto start_result = master_client_.PutStart(key, slice_lengths, config);
+    if (!start_result) {
+        ErrorCode err = start_result.error();
+        if (err != ErrorCode::OBJECT_ALREADY_EXISTS) {
+            LOG(ERROR) << "Failed to start multipart put: " << err;
+        }
+        return tl::unexpected(err);
+    }
+
+    std::shared_ptr<MultipartPut> put(new MultipartPut());
+    put->key_ = key;
+    put->size_ = size;
+    put->part_size_ = part_size;
+    put->replicas_ = std::move(start_result.value());
+    put->written_.assign((size + part_size - 1) / part_size, false);
+    return put;
+}
+
+ErrorCode Client::PutPart(MultipartPut& put, size_t n, Slice data) {
+    CHECK(transfer_submitter_) << "TransferSubmitter not initialized";
+    if (put.ended_ || n >= put.written_.size()) {
+        LOG(ERROR) << "Invalid part " << n << " of multipart put of key="
+                   << put.key_;
+        return ErrorCode::INVALID_PARAMS;
+    }
+    const uint64_t offset = n * put.part_size_;
+    if (data.size != std::min(put.part_size_, put.size_ - offset)) {
+        LOG(ERROR) << "Part " << n << " of " << data.size
+                   << " bytes does not match multipart put of key="
+                   << put.key_;
+        return ErrorCode::INVALID_PARAMS;
+    }
+
+    // Submit the part to every replica, then wait for all of them. The
+    // slices are referenced by the transfers until they are done.
+    std::vector<std::vector<Slice>> slices(put.replicas_.size());
+    std::vector<std::optional<TransferFuture>> futures;
+    ErrorCode err = ErrorCode::OK;
+    for (size_t i = 0; i < put.replicas_.size(); ++i) {
+        auto narrowed =
+            NarrowToRange(put.replicas_[i], offset, {data}, slices[i]);
+        if (!narrowed) {
+            err = ErrorCode::INVALID_REPLICA;
+            break;
+        }
+        futures.push_back(transfer_submitter_->submit(
+            *narrowed, slices[i], TransferRequest::WRITE));
+        if (!futures.back()) {
+            err = ErrorCode::TRANSFER_FAIL;
+            break;
+        }
+    }
+    for (auto& future : futures) {
+        if (future) {
+            ErrorCode result = future->get();
+            if (result != ErrorCode::OK && err == ErrorCode::OK) {
+                err = result;
+            }
+        }
+    }
+    if (err != ErrorCode::OK) {
+        LOG(ERROR) << "Failed to write part " << n
+                   << " of multipart put of key=" << put.key_
+                   << ", error=" << err;
+        return err;
+    }
+    put.written_[n] = true;
+    return ErrorCode::OK;
+}
+
+tl::expected<void, ErrorCode> Client::EndMultipartPut(MultipartPut& put) {
+    if (put.ended_) {
+        LOG(ERROR) << "Multipart put of key=" << put.key_ << " already ended";
+        return tl::unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    put.ended_ = true;
+    if (std::find(put.written_.begin(), put.written_.end(), false) !=
+        put.written_.end()) {
+        LOG(ERROR) << "Multipart put of key=" << put.key_
+                   << " ended with parts missing, revoking it";
+        auto revoke_result = master_client_.PutRevoke(put.key_);
+        if (!revoke_result) {
+            return tl::unexpected(revoke_result.error());
+        }
+        return tl::unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    auto end_result = master_client_.PutEnd(put.key_);
+    if (!end_result) {
+        LOG(ERROR) << "Failed to end multipart put: " << end_result.error();
+        return tl::unexpected(end_result.error());
+    }
+    return {};
+}
+
+tl::expected<void, ErrorCode> Client::GetStream(
+    const std::string& object_key, const std::vector<Slice>& buffers,
+    const std::function<bool(uint64_t offset, Slice part)>& on_part) {
+    CHECK(transfer_submitter_) << "TransferSubmitter not initialized";
+    if (buffers.empty() ||
+        std::any_of(buffers.begin(), buffers.end(),
+                    [](const Slice& buffer) { return buffer.size == 0; })) {
+        LOG(ERROR) << "Empty stream buffer for key=" << object_key;
+        return tl::unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    RequestTracer::ScopedTrace trace(tracer_.get(), "GetStream", object_key);
+    auto query_result = QueryReplicas(object_key, nullptr);
+    if (!query_result) {
+        trace.SetStatus(query_result.error());
+        return tl::unexpected(query_result.error());
+    }
+    const auto& replica_list = query_result.value();
+    Replica::Descriptor replica;
+    ErrorCode err = SelectReplica(replica_list, replica);
+    if (err != ErrorCode::OK) {
+        trace.SetStatus(err);
+        return tl::unexpected(err);
+    }
+    const uint64_t size = StoredSize(replica);
+
+    // Parts being read, oldest first. A part that cannot be narrowed to its
+    // range, e.g. from a disk replica, is read with GetRange instead.
+    struct Part {
+        uint64_t offset;
+        Slice data;
+        std::vector<Slice> slices;
+        std::optional<TransferFuture> future;
+        ErrorCode err = ErrorCode::OK;
+    };
+    std::deque<Part> parts;
+    uint64_t next = 0;
+    size_t next_buffer = 0;
+    auto read_next = [&]() {
+        const Slice& buffer = buffers[next_buffer];
+        next_buffer = (next_buffer + 1) % buffers.size();
+        auto& part = parts.emplace_back();
+        part.offset = next;
+        part.data = Slice{buffer.ptr, std::min<uint64_t>(buffer.size,
+                                                         size - next)};
+        next += part.data.size;
+        auto narrowed =
+            NarrowToRange(replica, part.offset, {part.data}, part.slices);
+        if (narrowed) {
+            part.future = transfer_submitter_->submit(
+                *narrowed, part.slices, TransferRequest::READ);
+            if (!part.future) {
+                part.err = ErrorCode::TRANSFER_FAIL;
+            }
+        } else {
+            auto result =
+                GetRange(object_key, replica_list, part.offset, part.data);
+            part.err = result ? ErrorCode::OK : result.error();
+        }
+    };
+
+    bool stopped = false;
+    while (next < size && parts.size() < buffers.size()) {
+        read_next();
+    }
+    while (!parts.empty()) {
+        Part& part = parts.front();
+        if (part.future) {
+            part.err = part.future->get();
+        }
+        if (part.err == ErrorCode::OK && err == ErrorCode::OK && !stopped) {
+            stopped = !on_part(part.offset, part.data);
+        } else if (part.err != ErrorCode::OK && err == ErrorCode::OK) {
+            err = part.err;
+        }
+        parts.pop_front();
+        // The buffers stay in use until the reads into them are done, even
+        // after an error
+        if (err == ErrorCode::OK && !stopped && next < size) {
+            read_next();
+        }
+    }
+    if (err != ErrorCode::OK) {
+        LOG(ERROR) << "transfer_read_failed key=" << object_key
+                   << ", error=" << err;
+        InvalidateReplicaCache(object_key);
+        trace.SetStatus(err);
+        return tl::unexpected(err);
+    }
+    return {};
+}
+
+std::vector<TransferFuture> Client::BatchPutAsync(
+    const std::vector<ObjectKey>& keys,
+    std::vector<std::vector<Slice>>& batched_slices,
+    const ReplicateConfig& config) {
+    CHECK(transfer_submitter_) << "TransferSubmitter not initialized";
+    std::vector<PutOperation> ops = CreatePutOperations(keys, batched_slices);
+    StartBatchPut(ops, config);
+
+    std::vector<TransferFuture> futures;
+    futures.reserve(ops.size());
+    std::vector<PendingPutEnd> pending;
+    for (auto& op : ops) {
+        if (op.replicas.empty()) {
+            // The master did not start the put, or skipped a resident key
+            ErrorCode err = op.result ? ErrorCode::OK : op.result.error();
+            futures.push_back(MakeReadyFuture(
+                err == ErrorCode::OBJECT_ALREADY_EXISTS ? ErrorCode::OK
+                                                        : err));
+            continue;
+        }
+        PendingPutEnd put;
+        put.key = op.key;
+        put.slices = op.slices;
+        // Transfers already submitted must finish before the put is revoked
+        for (const auto& replica : op.replicas) {
+            auto future = transfer_submitter_->submit(replica, op.slices,
+                                                      TransferRequest::WRITE);
+            if (!future) {
+                LOG(ERROR) << "transfer_submit_failed key=" << op.key;
+                put.submit_result = ErrorCode::TRANSFER_FAIL;
+                break;
+            }
+            put.transfers.push_back(std::move(*future));
+        }
+        put.state = std::make_shared<AsyncOperationState>(
+            put.transfers.empty() ? TransferStrategy::TRANSFER_ENGINE
+                                  : put.transfers.front().strategy());
+        futures.emplace_back(put.state);
+        pending.push_back(std::move(put));
+    }
+
+    if (!pending.empty()) {
+        {
+            std::lock_guard<std::mutex> lock(put_end_mutex_);
+            for (auto& put : pending) {
+                put_end_queue_.push_back(std::move(put));
+            }
+        }
+        put_end_cv_.notify_one();
+    }
+    return futures;
+}
+
+void Client::PutEndThreadFunc() {
+    while (true) {
+        std::vector<PendingPutEnd> puts;
+        {
+            std::unique_lock<std::mutex> lock(put_end_mutex_);
+            put_end_cv_.wait(lock, [this] {
+                return !put_end_running_ || !put_end_queue_.empty();
+            });
+            if (put_end_queue_.empty()) {
+                // Stopped and drained
+                return;
+            }
+            puts.swap(put_end_queue_);
+        }
+
+        // Puts are queued in submission order, so waiting for them in order
+        // does not delay the ones that finish first by much
+        std::vector<std::string> end_keys, revoke_keys;
+        std::vector<size_t> end_indices, revoke_indices;
+        std::vector<ErrorCode> results(puts.size());
+        for (size_t i = 0; i < puts.size(); ++i) {
+            results[i] = TransferFuture::waitAll(puts[i].transfers);
+            puts[i].transfers.clear();
+            if (results[i] == ErrorCode::OK) {
+                results[i] = puts[i].submit_result;
+            }
+            if (results[i] == ErrorCode::OK) {
+                end_keys.push_back(puts[i].key);
+                end_indices.push_back(i);
+            } else {
+                revoke_keys.push_back(puts[i].key);
+                revoke_indices.push_back(i);
+            }
+        }
+
+        if (!end_keys.empty()) {
+            auto end_responses = master_client_.BatchPutEnd(end_keys);
+            for (size_t i = 0; i < end_indices.size(); ++i) {
+                const size_t idx = end_indices[i];
+                if (end_responses.size() != end_keys.size()) {
+                    results[idx] = ErrorCode::RPC_FAIL;
+                } else if (!end_responses[i]) {
                     LOG(ERROR) << "Failed to finalize put for key "
-                               << successful_keys[i] << ": "
+                               << end_keys[i] << ": "
                                << toString(end_responses[i].error());
-                    ops[op_idx].SetError(end_responses[i].error(),
-                                         "BatchPutEnd failed");
+                    results[idx] = end_responses[i].error();
                 } else {
-                    // Operation fully successful
-                    ops[op_idx].SetSuccess();
-                    VLOG(1) << "Successfully completed put for key "
-                            << successful_keys[i];
+                    PutToLocalFile(puts[idx].key, puts[idx].slices);
+                }
+            }
+        }
+        if (!revoke_keys.empty()) {
+            auto revoke_responses = master_client_.BatchPutRevoke(revoke_keys);
+            for (size_t i = 0; i < revoke_responses.size(); ++i) {
+                if (!revoke_responses[i]) {
+                    LOG(ERROR) << "Failed to revoke put for key "
+                               << revoke_keys[i] << ": "
+                               << toString(revoke_responses[i].error());
                 }
             }
         }
+        VLOG(1) << "action=batch_put_end, finalized=" << end_keys.size()
+                << ", revoked=" << revoke_keys.size();
+
+        for (size_t i = 0; i < puts.size(); ++i) {
+            puts[i].state->set_completed(results[i]);
+        }
+    }
+}
+
+tl::expected<void, ErrorCode> Client::Remove(const ObjectKey& key) {
+    InvalidateReplicaCache(key);
+    auto result = master_client_.Remove(key);
+    if (storage_backend_) {
+        storage_backend_->RemoveFile(key);
+    }
+    if (!result) {
+        return tl::unexpected(result.error());
+    }
+    return {};
+}
+
+tl::expected<long, ErrorCode> Client::RemoveAll() {
+    ClearReplicaCache();
+    if (storage_backend_) {
+        storage_backend_->RemoveAll();
+    }
+    return master_client_.RemoveAll();
+}
+
+tl::expected<long, ErrorCode> Client::RemoveByTag(const std::string& tag) {
+    return master_client_.RemoveByTag(tag);
+}
+
+tl::expected<long, ErrorCode> Client::RemoveByPrefix(
+    const std::string& prefix) {
+    return master_client_.RemoveByPrefix(prefix);
+}
+
+tl::expected<void, ErrorCode> Client::CopyReplica(
+    const ObjectKey& key, const std::string& target_segment) {
+    return master_client_.CopyReplica(key, target_segment);
+}
+
+tl::expected<void, ErrorCode> Client::MigrateReplica(
+    const ObjectKey& key, const std::string& source_segment,
+    const std::string& target_segment) {
+    return master_client_.MigrateReplica(key, source_segment, target_segment);
+}
+
+tl::expected<uint64_t, ErrorCode> Client::Broadcast(
+    const ObjectKey& key, const std::vector<std::string>& target_segments) {
+    return master_client_.Broadcast(key, target_segments);
+}
+
+std::vector<tl::expected<void, ErrorCode>> Client::Prefetch(
+    const std::vector<ObjectKey>& keys, const std::string& target_segment) {
+    if (keys.empty()) {
+        return {};
+    }
+    return master_client_.Prefetch(
+        keys, target_segment.empty() ? local_hostname_ : target_segment);
+}
+
+std::vector<tl::expected<bool, ErrorCode>> Client::CancelPrefetch(
+    const std::vector<ObjectKey>& keys, const std::string& target_segment) {
+    if (keys.empty()) {
+        return {};
+    }
+    return master_client_.CancelPrefetch(
+        keys, target_segment.empty() ? local_hostname_ : target_segment);
+}
+
+// GPU holding a segment, "cuda:N", or empty for host memory
+static std::string SegmentDevice(const void* buffer,
+                                 const std::string& location) {
+    std::string name = location;
+    if (name == kWildcardLocation) {
+        // The first page tells, a GPU buffer is on a single device
+        auto entries = getMemoryLocation(const_cast<void*>(buffer), 1);
+        if (!entries.empty()) {
+            name = entries.front().location;
+        }
+    }
+    return name.rfind("cuda:", 0) == 0 ? name : "";
+}
+
+tl::expected<void, ErrorCode> Client::MountSegment(
+    const void* buffer, size_t size, const std::string& location,
+    const UUID& memory_id) {
+    if (buffer == nullptr || size == 0 ||
+        reinterpret_cast<uintptr_t>(buffer) % facebook::cachelib::Slab::kSize ||
+        size % facebook::cachelib::Slab::kSize) {
+        LOG(ERROR) << "buffer=" << buffer << " or size=" << size
+                   << " is not aligned to " << facebook::cachelib::Slab::kSize;
+        return tl::unexpected(ErrorCode::INVALID_PARAMS);
+    }
+
+    std::lock_guard<std::mutex> lock(mounted_segments_mutex_);
+
+    // Check if the segment overlaps with any existing segment
+    for (auto& it : mounted_segments_) {
+        auto& mtseg = it.second;
+        uintptr_t l1 = reinterpret_cast<uintptr_t>(mtseg.base);
+        uintptr_t r1 = reinterpret_cast<uintptr_t>(mtseg.size) + l1;
+        uintptr_t l2 = reinterpret_cast<uintptr_t>(buffer);
+        uintptr_t r2 = reinterpret_cast<uintptr_t>(size) + l2;
+        if (std::max(l1, l2) < std::min(r1, r2)) {
+            LOG(ERROR) << "segment_overlaps base1=" << mtseg.base
+                       << " size1=" << mtseg.size << " base2=" << buffer
+                       << " size2=" << size;
+            return tl::unexpected(ErrorCode::INVALID_PARAMS);
+        }
+    }
+
+    int rc = transfer_engine_.registerLocalMemory((void*)buffer, size,
+                                                  location, true, true);
+    if (rc != 0) {
+        LOG(ERROR) << "register_local_memory_failed base=" << buffer
+                   << " size=" << size << ", error=" << rc;
+        return tl::unexpected(ErrorCode::INVALID_PARAMS);
+    }
+
+    Segment segment(generate_uuid(), local_hostname_,
+                    reinterpret_cast<uintptr_t>(buffer), size);
+    segment.topology = get_segment_topology(local_hostname_);
+    segment.topology.device = SegmentDevice(buffer, location);
+    segment.memory_id = memory_id;
+    if (!segment.topology.device.empty()) {
+        transfer_submitter_->addDeviceMemory(segment.base, size);
+    }
+
+    auto mount_result = master_client_.MountSegment(segment, client_id_);
+    if (!mount_result) {
+        ErrorCode err = mount_result.error();
+        LOG(ERROR) << "mount_segment_to_master_failed base=" << buffer
+                   << " size=" << size << ", error=" << err;
+        if (!segment.topology.device.empty()) {
+            transfer_submitter_->removeDeviceMemory(segment.base);
+        }
+        return tl::unexpected(err);
+    }
+
+    mounted_segments_[segment.id] = segment;
+    return {};
+}
+
+tl::expected<void, ErrorCode> Client::UnmountSegment(const void* buffer,
+                                                     size_t size) {
+    std::lock_guard<std::mutex> lock(mounted_segments_mutex_);
+    auto segment = mounted_segments_.end();
+
+    for (auto it = mounted_segments_.begin(); it != mounted_segments_.end();
+         ++it) {
+        if (it->second.base == reinterpret_cast<uintptr_t>(buffer) &&
+            it->second.size == size) {
+            segment = it;
+            break;
+        }
+    }
+    if (segment == mounted_segments_.end()) {
+        LOG(ERROR) << "segment_not_found base=" << buffer << " size=" << size;
+        return tl::unexpected(ErrorCode::INVALID_PARAMS);
+    }
+
+    auto unmount_result =
+        master_client_.UnmountSegment(segment->second.id, client_id_);
+    if (!unmount_result) {
+        ErrorCode err = unmount_result.error();
+        LOG(ERROR) << "Failed to unmount segment from master: "
+                   << toString(err);
+        return tl::unexpected(err);
+    }
+
+    int rc = transfer_engine_.unregisterLocalMemory(
+        reinterpret_cast<void*>(segment->second.base));
+    if (rc != 0) {
+        LOG(ERROR) << "Failed to unregister transfer buffer with transfer "
+                      "engine ret is "
+                   << rc;
+        if (rc != ERR_ADDRESS_NOT_REGISTERED) {
+            return tl::unexpected(ErrorCode::INTERNAL_ERROR);
+        }
+        // Otherwise, the segment is already unregistered from transfer
+        // engine, we can continue
+    }
+    if (!segment->second.topology.device.empty()) {
+        transfer_submitter_->removeDeviceMemory(segment->second.base);
+    }
+
+    mounted_segments_.erase(segment);
+    return {};
+}
+
+tl::expected<void, ErrorCode> Client::AttachSegment(const void* buffer,
+                                                    size_t size,
+                                                    const UUID& memory_id) {
+    if (buffer == nullptr || size == 0 || memory_id == UUID{0, 0}) {
+        LOG(ERROR) << "buffer=" << buffer << " size=" << size
+                   << " memory_id=" << memory_id << " is invalid";
+        return tl::unexpected(ErrorCode::INVALID_PARAMS);
+    }
+
+    std::lock_guard<std::mutex> lock(mounted_segments_mutex_);
+    if (attached_segments_.count(memory_id)) {
+        return {};
+    }
+    auto attach_result = master_client_.AttachSegment(memory_id, client_id_);
+    if (!attach_result) {
+        LOG(ERROR) << "attach_segment_failed memory_id=" << memory_id
+                   << ", error=" << attach_result.error();
+        return tl::unexpected(attach_result.error());
+    }
+    const Segment& segment = attach_result.value();
+    if (segment.size > size) {
+        LOG(ERROR) << "attached_segment_too_large memory_id=" << memory_id
+                   << " segment_size=" << segment.size
+                   << " mapped_size=" << size;
+        auto detach_result = master_client_.DetachSegment(memory_id,
+                                                          client_id_);
+        if (!detach_result) {
+            LOG(WARNING) << "detach_segment_failed memory_id=" << memory_id;
+        }
+        return tl::unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    const auto local_base = reinterpret_cast<uintptr_t>(buffer);
+    transfer_submitter_->addAttachedSegment(segment.name, segment.base,
+                                            segment.size, local_base);
+    attached_segments_[memory_id] = {segment, local_base, size};
+    LOG(INFO) << "segment_name=" << segment.name
+              << ", memory_id=" << memory_id << ", action=attach_segment";
+    return {};
+}
+
+tl::expected<void, ErrorCode> Client::DetachSegment(const UUID& memory_id) {
+    std::lock_guard<std::mutex> lock(mounted_segments_mutex_);
+    auto it = attached_segments_.find(memory_id);
+    if (it == attached_segments_.end()) {
+        LOG(ERROR) << "attached_segment_not_found memory_id=" << memory_id;
+        return tl::unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    // Transfers go through the transfer engine before the master forgets
+    // the attachment
+    transfer_submitter_->removeAttachedSegment(it->second.segment.name,
+                                               it->second.segment.base);
+    attached_segments_.erase(it);
+    auto detach_result = master_client_.DetachSegment(memory_id, client_id_);
+    if (!detach_result) {
+        LOG(ERROR) << "Failed to detach segment from master: "
+                   << toString(detach_result.error());
+        return tl::unexpected(detach_result.error());
+    }
+    return {};
+}
+
+tl::expected<void, ErrorCode> Client::DrainSegment(
+    const void* buffer, size_t size, std::chrono::milliseconds timeout) {
+    UUID segment_id;
+    {
+        std::lock_guard<std::mutex> lock(mounted_segments_mutex_);
+        auto segment = std::find_if(
+            mounted_segments_.begin(), mounted_segments_.end(),
+            [buffer, size](const auto& entry) {
+                return entry.second.base ==
+                           reinterpret_cast<uintptr_t>(buffer) &&
+                       entry.second.size == size;
+            });
+        if (segment == mounted_segments_.end()) {
+            LOG(ERROR) << "segment_not_found base=" << buffer
+                       << " size=" << size;
+            return tl::unexpected(ErrorCode::INVALID_PARAMS);
+        }
+        segment_id = segment->second.id;
     }
 
-    // Process failed operations that need cleanup
-    if (!failed_keys.empty()) {
-        auto revoke_responses = master_client_.BatchPutRevoke(failed_keys);
-        if (revoke_responses.size() != failed_keys.size()) {
-            LOG(ERROR) << "BatchPutRevoke response size mismatch: expected "
-                       << failed_keys.size() << ", got "
-                       << revoke_responses.size();
-            // Mark all failed operations with revoke RPC failure
-            for (size_t idx : failed_indices) {
-                ops[idx].SetError(ErrorCode::RPC_FAIL,
-                                  "BatchPutRevoke response size mismatch");
+    auto drain_result = master_client_.DrainSegment(segment_id);
+    if (!drain_result) {
+        LOG(ERROR) << "Failed to drain segment: "
+                   << toString(drain_result.error());
+        return tl::unexpected(drain_result.error());
+    }
+    auto wait_result = WaitForDrain(
+        {segment_id}, std::chrono::steady_clock::now() + timeout);
+    if (!wait_result) {
+        return wait_result;
+    }
+    return UnmountSegment(buffer, size);
+}
+
+tl::expected<void, ErrorCode> Client::WaitForDrain(
+    const std::vector<UUID>& segment_ids,
+    std::chrono::steady_clock::time_point deadline) {
+    while (true) {
+        size_t remaining_bytes = 0;
+        for (const auto& segment_id : segment_ids) {
+            auto remaining = master_client_.QueryDrain(segment_id);
+            if (!remaining) {
+                LOG(ERROR) << "Failed to query drain: "
+                           << toString(remaining.error());
+                return tl::unexpected(remaining.error());
             }
+            remaining_bytes += remaining.value();
+        }
+        if (remaining_bytes == 0) {
+            return {};
+        }
+        if (std::chrono::steady_clock::now() >= deadline) {
+            LOG(WARNING) << "segment_drain_timeout segments="
+                         << segment_ids.size()
+                         << " remaining_bytes=" << remaining_bytes;
+            return {};
+        }
+        // The replicas of the segment are copied by its own client
+        auto task = master_client_.CompactionStart(local_hostname_);
+        if (task) {
+            Relocate(task.value());
         } else {
-            // Process individual revoke responses
-            for (size_t i = 0; i < revoke_responses.size(); ++i) {
-                const size_t op_idx = failed_indices[i];
-                if (!revoke_responses[i]) {
-                    LOG(ERROR)
-                        << "Failed to revoke put for key " << failed_keys[i]
-                        << ": " << toString(revoke_responses[i].error());
-                    // Preserve original error but note revoke failure in
-                    // context
-                    std::string original_context =
-                        ops[op_idx].failure_context.value_or("unknown error");
-                    ops[op_idx].failure_context =
-                        original_context + "; revoke also failed";
-                } else {
-                    LOG(INFO) << "Successfully revoked failed put for key "
-                              << failed_keys[i];
-                }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+}
+
+tl::expected<void, ErrorCode> Client::ResizeSegment(
+    const void* buffer, size_t size, size_t new_size,
+    std::chrono::milliseconds timeout) {
+    const auto base = reinterpret_cast<uintptr_t>(buffer);
+    // The extents of the segment, by address
+    std::vector<Segment> extents;
+    {
+        std::lock_guard<std::mutex> lock(mounted_segments_mutex_);
+        for (const auto& [id, segment] : mounted_segments_) {
+            if (segment.base >= base && segment.base < base + size) {
+                extents.push_back(segment);
             }
         }
     }
+    std::sort(extents.begin(), extents.end(),
+              [](const Segment& a, const Segment& b) {
+                  return a.base < b.base;
+              });
+    uintptr_t end = base;
+    for (const auto& extent : extents) {
+        if (extent.base != end) {
+            break;
+        }
+        end += extent.size;
+    }
+    if (extents.empty() || end != base + size) {
+        LOG(ERROR) << "segment_not_found base=" << buffer << " size=" << size;
+        return tl::unexpected(ErrorCode::INVALID_PARAMS);
+    }
 
-    // Ensure all operations have definitive results
-    for (auto& op : ops) {
-        if (!op.IsResolved()) {
-            op.SetError(ErrorCode::INTERNAL_ERROR,
-                        "Operation not resolved after finalization");
-            LOG(ERROR) << "Operation for key " << op.key
-                       << " was not properly resolved";
+    if (new_size == size) {
+        return {};
+    }
+    if (new_size > size) {
+        // Device segments extend into the memory of the same device
+        const std::string location =
+            extents.front().topology.device.empty()
+                ? kWildcardLocation
+                : extents.front().topology.device;
+        return MountSegment(reinterpret_cast<const char*>(buffer) + size,
+                            new_size - size, location);
+    }
+
+    if (new_size == 0) {
+        LOG(ERROR) << "resize_to_zero base=" << buffer
+                   << ", use UnmountSegment or DrainSegment instead";
+        return tl::unexpected(ErrorCode::INVALID_PARAMS);
+    }
+
+    // Shrinking releases whole extents from the tail
+    std::vector<Segment> tail;
+    for (const auto& extent : extents) {
+        if (extent.base >= base + new_size) {
+            tail.push_back(extent);
+        } else if (extent.base + extent.size > base + new_size) {
+            LOG(ERROR) << "resize_not_on_extent_boundary base=" << buffer
+                       << " new_size=" << new_size;
+            return tl::unexpected(ErrorCode::INVALID_PARAMS);
+        }
+    }
+
+    std::vector<UUID> tail_ids;
+    for (const auto& extent : tail) {
+        auto drain_result = master_client_.DrainSegment(extent.id);
+        if (!drain_result) {
+            LOG(ERROR) << "Failed to drain segment: "
+                       << toString(drain_result.error());
+            return tl::unexpected(drain_result.error());
         }
+        tail_ids.push_back(extent.id);
     }
+    auto wait_result = WaitForDrain(
+        tail_ids, std::chrono::steady_clock::now() + timeout);
+    if (!wait_result) {
+        return wait_result;
+    }
+    for (const auto& extent : tail) {
+        auto unmount_result = UnmountSegment(
+            reinterpret_cast<const void*>(extent.base), extent.size);
+        if (!unmount_result) {
+            return unmount_result;
+        }
+    }
+    return {};
 }
 
-std::vector<tl::expected<void, ErrorCode>> Client::CollectResults(
-    const std::vector<PutOperation>& ops) {
-    std::vector<tl::expected<void, ErrorCode>> results;
-    results.reserve(ops.size());
+tl::expected<void, ErrorCode> Client::RegisterLocalMemory(
+    void* addr, size_t length, const std::string& location,
+    bool remote_accessible, bool update_metadata) {
+    if (this->transfer_engine_.registerLocalMemory(
+            addr, length, location, remote_accessible, update_metadata) != 0) {
+        return tl::unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    return {};
+}
 
-    for (const auto& op : ops) {
-        // With the new structure, result is always set (never nullopt)
-        results.emplace_back(op.result);
+tl::expected<void, ErrorCode> Client::unregisterLocalMemory(
+    void* addr, bool update_metadata) {
+    if (this->transfer_engine_.unregisterLocalMemory(addr, update_metadata) !=
+        0) {
+        return tl::unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    return {};
+}
 
-        // Additional validation and logging for debugging
-        if (!op.result.has_value()) {
-            // if error == object already exist, consider as ok
-            if (op.result.error() == ErrorCode::OBJECT_ALREADY_EXISTS) {
-                results.back() = {};
+#ifdef USE_CUDA
+tl::expected<uint64_t, ErrorCode> Client::HoldStream(cudaStream_t stream) {
+    uint64_t handle = 0;
+    Status s = transfer_engine_.holdStream(stream, handle);
+    if (!s.ok()) {
+        LOG(ERROR) << "Failed to hold the stream: " << s.ToString();
+        return tl::unexpected(ErrorCode::INTERNAL_ERROR);
+    }
+    return handle;
+}
+
+void Client::ReleaseStream(uint64_t handle) {
+    transfer_engine_.releaseStream(handle);
+}
+#endif
+
+tl::expected<bool, ErrorCode> Client::IsExist(const std::string& key) {
+    if (!MayExist({key})[0]) {
+        return false;
+    }
+    auto result = master_client_.ExistKey(key);
+    if (!result) {
+        return tl::unexpected(result.error());
+    }
+    return result.value();
+}
+
+std::vector<tl::expected<bool, ErrorCode>> Client::BatchIsExist(
+    const std::vector<std::string>& keys) {
+    // Only ask the masters about the keys their key filters may contain
+    const auto may_exist = MayExist(keys);
+    std::vector<std::string> probe_keys;
+    std::vector<size_t> probe_indices;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (may_exist[i]) {
+            probe_indices.push_back(i);
+        }
+    }
+    const bool probe_all = probe_indices.size() == keys.size();
+    if (!probe_all) {
+        probe_keys.reserve(probe_indices.size());
+        for (size_t i : probe_indices) {
+            probe_keys.push_back(keys[i]);
+        }
+    }
+    const auto& query_keys = probe_all ? keys : probe_keys;
+    auto response =
+        query_keys.empty()
+            ? std::vector<tl::expected<bool, ErrorCode>>{}
+            : master_client_.BatchExistKey(query_keys);
+
+    // Check if we got the expected number of responses
+    if (response.size() != query_keys.size()) {
+        LOG(ERROR) << "BatchExistKey response size mismatch. Expected: "
+                   << query_keys.size() << ", Got: " << response.size();
+        // Return vector of RPC_FAIL errors
+        std::vector<tl::expected<bool, ErrorCode>> results;
+        results.reserve(keys.size());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            results.emplace_back(tl::unexpected(ErrorCode::RPC_FAIL));
+        }
+        return results;
+    }
+
+    // Return the response directly as it's already in the correct
+    // format
+    if (probe_all) {
+        return response;
+    }
+    std::vector<tl::expected<bool, ErrorCode>> results(keys.size(), false);
+    for (size_t i = 0; i < probe_indices.size(); ++i) {
+        results[probe_indices[i]] = std::move(response[i]);
+    }
+    return results;
+}
+
+std::vector<tl::expected<void, ErrorCode>> Client::BatchTouch(
+    const std::vector<std::string>& keys, uint64_t ttl_ms,
+    uint64_t next_use_ms) {
+    if (keys.empty()) {
+        return {};
+    }
+    return master_client_.BatchTouch(keys, ttl_ms, next_use_ms);
+}
+
+tl::expected<PrefixMatchResult, ErrorCode> Client::LongestPrefixMatch(
+    const std::vector<std::string>& all_keys, bool with_replicas) {
+    // The prefix ends before the first key the key filters rule out
+    const auto may_exist = MayExist(all_keys);
+    const size_t prefix = static_cast<size_t>(
+        std::find(may_exist.begin(), may_exist.end(), false) -
+        may_exist.begin());
+    if (prefix == 0) {
+        return PrefixMatchResult{};
+    }
+    const std::vector<std::string> truncated_keys =
+        prefix < all_keys.size()
+            ? std::vector<std::string>(all_keys.begin(),
+                                       all_keys.begin() + prefix)
+            : std::vector<std::string>{};
+    const auto& keys = prefix < all_keys.size() ? truncated_keys : all_keys;
+
+    const uint64_t generation =
+        replica_cache_ ? replica_cache_->generation() : 0;
+    const auto lease_start = ReplicaCache::Clock::now();
+    auto result = master_client_.LongestPrefixMatch(keys, with_replicas);
+    if (!result) {
+        return tl::unexpected(result.error());
+    }
+    if (result->matched > keys.size() ||
+        (with_replicas && result->replica_lists.size() != result->matched)) {
+        LOG(ERROR) << "LongestPrefixMatch response size mismatch. Keys: "
+                   << keys.size() << ", matched: " << result->matched
+                   << ", replica lists: " << result->replica_lists.size();
+        return tl::unexpected(ErrorCode::RPC_FAIL);
+    }
+    if (replica_cache_) {
+        for (size_t i = 0; i < result->replica_lists.size(); ++i) {
+            replica_cache_->Put(keys[i], result->replica_lists[i],
+                                lease_start + replica_cache_ttl_, generation);
+        }
+    }
+    return result;
+}
+
+tl::expected<KeyLocationResult, ErrorCode> Client::BatchQueryLocation(
+    const std::vector<std::string>& keys, bool with_prefix_hits) {
+    if (keys.empty()) {
+        return KeyLocationResult{};
+    }
+    auto result = master_client_.BatchQueryLocation(keys, with_prefix_hits);
+    if (result && result->locations.size() != keys.size()) {
+        LOG(ERROR) << "BatchQueryLocation response size mismatch. Keys: "
+                   << keys.size()
+                   << ", locations: " << result->locations.size();
+        return tl::unexpected(ErrorCode::RPC_FAIL);
+    }
+    return result;
+}
+
+tl::expected<KeyScanResult, ErrorCode> Client::ScanKeys(
+    const std::string& prefix, const std::string& cursor, uint64_t limit) {
+    return master_client_.ScanKeys(prefix, cursor, limit);
+}
+
+void Client::PrepareStorageBackend(const std::string& storage_root_dir,
+                                   const std::string& fsdir) {
+    // Initialize storage backend
+    storage_backend_ =
+        StorageBackend::Create(storage_root_dir, fsdir, local_hostname_);
+    if (!storage_backend_) {
+        LOG(INFO) << "Failed to initialize storage backend";
+        return;
+    }
+    const uint64_t budget_bytes =
+        GetEnvSize("MC_STORE_WRITE_BEHIND_MB",
+                   WriteBehindQueue::kDefaultBudgetBytes >> 20)
+        << 20;
+    const uint64_t batch_bytes =
+        GetEnvSize("MC_STORE_WRITE_BEHIND_BATCH_KB",
+                   WriteBehindQueue::kDefaultBatchBytes >> 10)
+        << 10;
+    write_behind_ = std::make_unique<WriteBehindQueue>(
+        storage_backend_, kWriteBehindThreads, budget_bytes, batch_bytes,
+        [this](const ObjectKey& key) { OnStoredToLocalFile(key); });
+    RegisterDiskObjects();
+}
+
+void Client::RegisterDiskObjects() {
+    auto objects = storage_backend_->ListObjects();
+    if (objects.empty()) {
+        return;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    size_t registered = 0;
+    size_t stale = 0;
+    for (size_t first = 0; first < objects.size();
+         first += kDiskRegisterBatch) {
+        const size_t last =
+            std::min(objects.size(), first + kDiskRegisterBatch);
+        std::vector<std::string> keys;
+        std::vector<DiskDescriptor> disks;
+        keys.reserve(last - first);
+        disks.reserve(last - first);
+        for (size_t i = first; i < last; ++i) {
+            keys.push_back(objects[i].first);
+            disks.push_back(objects[i].second);
+        }
+        auto results = master_client_.BatchPutDiskReplica(keys, disks);
+        for (size_t i = 0; i < results.size(); ++i) {
+            if (results[i]) {
+                ++registered;
                 continue;
             }
-            LOG(ERROR) << "Operation for key " << op.key
-                       << " failed: " << toString(op.result.error())
-                       << (op.failure_context
-                               ? (" (" + *op.failure_context + ")")
-                               : "");
+            switch (results[i].error()) {
+                case ErrorCode::UNAVAILABLE_IN_CURRENT_MODE:
+                    LOG(INFO) << "Disk tier is disabled on the master";
+                    disk_tier_ = false;
+                    return;
+                case ErrorCode::INVALID_PARAMS:
+                    // The key was put again with another value
+                    storage_backend_->RemoveFile(keys[i]);
+                    ++stale;
+                    break;
+                default:
+                    VLOG(1) << "disk_object_not_registered key=" << keys[i]
+                            << ", error=" << results[i].error();
+                    break;
+            }
+        }
+    }
+    LOG(INFO) << "action=disk_objects_registered, objects=" << objects.size()
+              << ", registered=" << registered << ", stale=" << stale
+              << ", elapsed_ms="
+              << std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+}
+
+ErrorCode Client::GetFromLocalFile(const std::string& object_key,
+                                   std::vector<Slice>& slices,
+                                   std::vector<Replica::Descriptor>& replicas) {
+    if (!storage_backend_) {
+        return ErrorCode::FILE_READ_FAIL;
+    }
+
+    ErrorCode err = storage_backend_->LoadObject(object_key, slices);
+    if (err != ErrorCode::OK) {
+        return err;
+    }
+
+    return ErrorCode::OK;
+}
+
+void Client::PutToLocalFile(const std::string& key,
+                            std::vector<Slice>& slices) {
+    if (!write_behind_) return;
+
+    if (!write_behind_->Push(key, slices)) {
+        LOG(WARNING) << "Write-behind queue is stopped, not persisting "
+                     << key;
+    }
+}
+
+void Client::OnStoredToLocalFile(const std::string& key) {
+    if (!disk_tier_) {
+        return;
+    }
+    auto desc = storage_backend_->Querykey(key);
+    if (!desc) {
+        return;
+    }
+    auto result =
+        master_client_.PutDiskReplica(key, desc->get_disk_descriptor());
+    if (!result &&
+        result.error() == ErrorCode::UNAVAILABLE_IN_CURRENT_MODE) {
+        LOG(INFO) << "Disk tier is disabled on the master";
+        disk_tier_ = false;
+    }
+}
+
+void Client::ConnectToFollowers() {
+    // The followers of each partition, separated by semicolons, and the
+    // addresses of a partition by commas
+    const char* env_value = std::getenv("MC_STORE_MASTER_FOLLOWERS");
+    if (env_value == nullptr || *env_value == '\0') {
+        return;
+    }
+    std::vector<std::vector<std::string>> follower_addrs(1);
+    std::string addr;
+    for (const char* c = env_value;; ++c) {
+        if (*c == ',' || *c == ';' || *c == '\0') {
+            if (!addr.empty()) {
+                follower_addrs.back().push_back(std::move(addr));
+                addr.clear();
+            }
+            if (*c == '\0') break;
+            if (*c == ';') follower_addrs.emplace_back();
         } else {
-            VLOG(1) << "Operation for key " << op.key
-                    << " completed successfully";
+            addr.push_back(*c);
         }
     }
+    read_from_followers_ = master_client_.EnableFollowers(follower_addrs) > 0;
+}
 
-    return results;
+void Client::PrepareReplicaCache() {
+    // Caching replica lists and values is opt-in
+    const uint64_t entries = GetEnvSize("MC_STORE_REPLICA_CACHE_ENTRIES", 0);
+    const uint64_t near_cache_bytes =
+        GetEnvSize("MC_STORE_NEAR_CACHE_BYTES", 0);
+    if (entries == 0 && near_cache_bytes == 0) {
+        return;
+    }
+    auto info = master_client_.GetReplicaCacheInfo();
+    if (!info) {
+        LOG(WARNING) << "Failed to get replica cache info from master, "
+                        "replica cache disabled: "
+                     << info.error();
+        return;
+    }
+    if (info->lease_ttl_ms == 0) {
+        LOG(INFO) << "Master grants no lease, replica cache disabled";
+        return;
+    }
+    replica_cache_ttl_ = std::chrono::milliseconds(info->lease_ttl_ms);
+    if (read_from_followers_) {
+        // A follower only promises half of the lease, see MetadataFollower
+        replica_cache_ttl_ /= 2;
+    }
+    if (entries > 0) {
+        replica_cache_ = std::make_unique<ReplicaCache>(entries);
+        replica_cache_->SetVersion(info->replica_version);
+    }
+    if (near_cache_bytes > 0) {
+        const uint64_t admit_reads = GetEnvSize(
+            "MC_STORE_NEAR_CACHE_ADMIT_READS", kDefaultNearCacheAdmitReads);
+        near_cache_ = std::make_unique<ObjectCache>(near_cache_bytes,
+                                                    admit_reads);
+        LOG(INFO) << "near_cache_bytes=" << near_cache_bytes
+                  << " near_cache_admit_reads=" << admit_reads;
+    }
+    LOG(INFO) << "replica_cache_entries=" << entries
+              << " replica_cache_ttl_ms=" << replica_cache_ttl_.count();
 }
 
-std::vector<tl::expected<void, ErrorCode>> Client::BatchPut(
-    const std::vector<ObjectKey>& keys,
-    std::vector<std::vector<Slice>>& batched_slices,
-    const ReplicateConfig& config) {
-    std::vector<PutOperation> ops = CreatePutOperations(keys, batched_slices);
-    StartBatchPut(ops, config);
-    SubmitTransfers(ops);
-    WaitForTransfers(ops);
-    FinalizeBatchPut(ops);
-    return CollectResults(ops);
+void Client::InvalidateReplicaCache(const std::string& object_key) {
+    if (replica_cache_) {
+        replica_cache_->Invalidate(object_key);
+    }
+    if (near_cache_) {
+        near_cache_->Invalidate(object_key);
+    }
 }
 
-tl::expected<void, ErrorCode> Client::Remove(const ObjectKey& key) {
-    auto result = master_client_.Remove(key);
-    if (storage_backend_) {
-        storage_backend_->RemoveFile(key);
+void Client::ClearReplicaCache() {
+    if (replica_cache_) {
+        replica_cache_->Clear();
+    }
+    if (near_cache_) {
+        near_cache_->Clear();
+    }
+}
+
+void Client::PrepareKeyFilter() {
+    // Following the key filters is opt-in, a key put by another client is
+    // reported missing until the next refresh
+    const uint64_t refresh_ms = GetEnvSize("MC_STORE_KEY_FILTER_REFRESH_MS", 0);
+    if (refresh_ms == 0) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(key_filter_mutex_);
+        key_filters_.assign(master_client_.partition_num(),
+                            PartitionKeyFilter{});
+    }
+    key_filter_refresh_ = std::chrono::milliseconds(refresh_ms);
+    LOG(INFO) << "key_filter_refresh_ms=" << refresh_ms;
+}
+
+std::vector<bool> Client::MayExist(const std::vector<std::string>& keys) {
+    std::vector<bool> may_exist(keys.size(), true);
+    if (key_filter_refresh_.count() == 0) {
+        return may_exist;
+    }
+    RefreshKeyFilters();
+    std::lock_guard<std::mutex> lock(key_filter_mutex_);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        const auto& part = key_filters_[PartitionedMasterClient::PartitionOf(
+            keys[i], key_filters_.size())];
+        may_exist[i] = !part.filter || part.filter->MayContain(keys[i]);
+    }
+    return may_exist;
+}
+
+void Client::RefreshKeyFilters() {
+    std::unique_lock<std::mutex> refresh_lock(key_filter_refresh_mutex_,
+                                              std::try_to_lock);
+    if (!refresh_lock.owns_lock()) {
+        // Another thread is refreshing, use the current copies
+        return;
     }
-    if (!result) {
-        return tl::unexpected(result.error());
+    const auto now = std::chrono::steady_clock::now();
+    if (now - key_filter_refreshed_ < key_filter_refresh_) {
+        return;
+    }
+    key_filter_refreshed_ = now;
+    for (size_t partition = 0; partition < key_filters_.size(); ++partition) {
+        uint64_t seq = 0;
+        uint64_t generation = 0;
+        {
+            std::lock_guard<std::mutex> lock(key_filter_mutex_);
+            seq = key_filters_[partition].seq;
+            generation = key_filter_generation_;
+        }
+        auto update = master_client_.GetKeyFilter(partition, seq);
+        std::lock_guard<std::mutex> lock(key_filter_mutex_);
+        if (generation != key_filter_generation_) {
+            return;
+        }
+        auto& part = key_filters_[partition];
+        if (!update) {
+            // A copy that is not updated misses the new keys, stop using it
+            VLOG(1) << "action=key_filter_dropped partition=" << partition
+                    << " error=" << update.error();
+            part = PartitionKeyFilter{};
+            continue;
+        }
+        if (update->reset) {
+            part.filter.emplace(std::move(update->words), update->num_hashes);
+        }
+        if (!part.filter) {
+            continue;
+        }
+        for (const auto& key : update->keys) {
+            part.filter->Add(key);
+        }
+        part.seq = update->next_seq;
     }
-    return {};
 }
 
-tl::expected<long, ErrorCode> Client::RemoveAll() {
-    if (storage_backend_) {
-        storage_backend_->RemoveAll();
+void Client::ResetKeyFilters() {
+    std::lock_guard<std::mutex> lock(key_filter_mutex_);
+    for (auto& part : key_filters_) {
+        part = PartitionKeyFilter{};
     }
-    return master_client_.RemoveAll();
+    key_filter_generation_++;
 }
 
-tl::expected<void, ErrorCode> Client::MountSegment(const void* buffer,
-                                                   size_t size) {
-    if (buffer == nullptr || size == 0 ||
-        reinterpret_cast<uintptr_t>(buffer) % facebook::cachelib::Slab::kSize ||
-        size % facebook::cachelib::Slab::kSize) {
-        LOG(ERROR) << "buffer=" << buffer << " or size=" << size
-                   << " is not aligned to " << facebook::cachelib::Slab::kSize;
-        return tl::unexpected(ErrorCode::INVALID_PARAMS);
+void Client::PrepareAllocationCredits() {
+    // Allocation credits are opt-in, the unused part of an extent stays
+    // reserved until its credit ends
+    const uint64_t credit_bytes = GetEnvSize("MC_STORE_ALLOC_CREDIT_BYTES", 0);
+    if (credit_bytes == 0) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(credit_mutex_);
+        credits_.assign(master_client_.partition_num(), PartitionCredit{});
     }
+    credit_max_object_ =
+        std::min(GetEnvSize("MC_STORE_ALLOC_CREDIT_MAX_OBJECT",
+                            kDefaultAllocCreditMaxObject),
+                 credit_bytes);
+    credit_bytes_ = credit_bytes;
+    LOG(INFO) << "alloc_credit_bytes=" << credit_bytes_
+              << ", alloc_credit_max_object=" << credit_max_object_;
+}
 
-    std::lock_guard<std::mutex> lock(mounted_segments_mutex_);
+bool Client::CanPutWithCredit(const ReplicateConfig& config) const {
+    return credit_bytes_ != 0 && config.replica_num == 1 &&
+           config.preferred_segment.empty() && config.tag.empty() &&
+           config.content_hash.empty() && config.shard_segments.empty() &&
+           config.next_use_ms == 0 && !config.upsert;
+}
 
-    // Check if the segment overlaps with any existing segment
-    for (auto& it : mounted_segments_) {
-        auto& mtseg = it.second;
-        uintptr_t l1 = reinterpret_cast<uintptr_t>(mtseg.base);
-        uintptr_t r1 = reinterpret_cast<uintptr_t>(mtseg.size) + l1;
-        uintptr_t l2 = reinterpret_cast<uintptr_t>(buffer);
-        uintptr_t r2 = reinterpret_cast<uintptr_t>(size) + l2;
-        if (std::max(l1, l2) < std::min(r1, r2)) {
-            LOG(ERROR) << "segment_overlaps base1=" << mtseg.base
-                       << " size1=" << mtseg.size << " base2=" << buffer
-                       << " size2=" << size;
-            return tl::unexpected(ErrorCode::INVALID_PARAMS);
+bool Client::ReserveCredit(size_t partition, uint64_t reserved,
+                           AllocationCredit& credit, uint64_t& offset) {
+    std::lock_guard<std::mutex> lock(credit_mutex_);
+    auto& part = credits_[partition];
+    const auto now = std::chrono::steady_clock::now();
+    if (part.credit && (now >= part.usable_until ||
+                        part.used + reserved > part.credit->extent.size_)) {
+        // Not returned, puts may still be writing into it. The master
+        // ends it when it expires.
+        part.credit.reset();
+    }
+    if (!part.credit) {
+        if (now < part.retry_at) {
+            return false;
+        }
+        auto granted = master_client_.GrantAllocationCredit(
+            partition, client_id_, credit_bytes_);
+        if (!granted) {
+            VLOG(1) << "partition=" << partition
+                    << ", error=" << granted.error()
+                    << ", action=alloc_credit_refused";
+            part.retry_at = now + kAllocCreditRetryInterval;
+            return false;
         }
+        part.credit = std::move(granted.value());
+        part.used = 0;
+        part.usable_until =
+            now + std::chrono::milliseconds(part.credit->ttl_ms / 2);
     }
+    if (part.used + reserved > part.credit->extent.size_) {
+        return false;
+    }
+    credit = *part.credit;
+    offset = part.used;
+    part.used += reserved;
+    return true;
+}
 
-    int rc = transfer_engine_.registerLocalMemory(
-        (void*)buffer, size, kWildcardLocation, true, true);
-    if (rc != 0) {
-        LOG(ERROR) << "register_local_memory_failed base=" << buffer
-                   << " size=" << size << ", error=" << rc;
-        return tl::unexpected(ErrorCode::INVALID_PARAMS);
+void Client::DropCredit(size_t partition, uint64_t credit_id) {
+    std::lock_guard<std::mutex> lock(credit_mutex_);
+    auto& part = credits_[partition];
+    if (part.credit && part.credit->id == credit_id) {
+        part.credit.reset();
     }
+}
 
-    Segment segment(generate_uuid(), local_hostname_,
-                    reinterpret_cast<uintptr_t>(buffer), size);
+bool Client::PutWithCredit(const ObjectKey& key, std::vector<Slice>& slices,
+                           const ReplicateConfig& config) {
+    const size_t total_size = CalculateSliceSize(slices);
+    if (!CanPutWithCredit(config) || total_size == 0 ||
+        total_size > credit_max_object_) {
+        return false;
+    }
+    const size_t partition =
+        PartitionedMasterClient::PartitionOf(key, credits_.size());
+
+    AllocationCredit credit;
+    uint64_t offset = 0;
+    if (!ReserveCredit(partition, AlignCreditPut(total_size), credit,
+                       offset)) {
+        return false;
+    }
 
-    auto mount_result = master_client_.MountSegment(segment, client_id_);
-    if (!mount_result) {
-        ErrorCode err = mount_result.error();
-        LOG(ERROR) << "mount_segment_to_master_failed base=" << buffer
-                   << " size=" << size << ", error=" << err;
-        return tl::unexpected(err);
+    CreditPut put{key, offset, {}, config.with_soft_pin};
+    MemoryDescriptor memory;
+    uintptr_t address = credit.extent.buffer_address_ + offset;
+    for (const auto& slice : slices) {
+        memory.buffer_descriptors.push_back(AllocatedBuffer::Descriptor{
+            credit.extent.segment_name_, slice.size, address,
+            BufStatus::INIT});
+        put.slice_lengths.push_back(slice.size);
+        address += slice.size;
     }
+    Replica::Descriptor replica;
+    replica.descriptor_variant = std::move(memory);
+    replica.status = ReplicaStatus::PROCESSING;
 
-    mounted_segments_[segment.id] = segment;
-    return {};
+    // The space of a failed put is left unused, there is nothing to revoke
+    ErrorCode err = TransferWrite(replica, slices);
+    if (err != ErrorCode::OK) {
+        LOG(WARNING) << "key=" << key << ", credit_id=" << credit.id
+                     << ", error=" << err << ", action=credit_put_failed";
+        return false;
+    }
+    auto results = master_client_.CommitCreditPuts(partition, client_id_,
+                                                   credit.id, {put});
+    if (results.size() == 1 && results[0]) {
+        PutToLocalFile(key, slices);
+        return true;
+    }
+    if (results.size() == 1 &&
+        results[0].error() == ErrorCode::OBJECT_ALREADY_EXISTS) {
+        VLOG(1) << "object_already_exists key=" << key;
+        return true;
+    }
+    LOG(WARNING) << "key=" << key << ", credit_id=" << credit.id
+                 << ", action=credit_commit_failed";
+    // E.g. the credit expired, ask for a new one
+    DropCredit(partition, credit.id);
+    return false;
 }
 
-tl::expected<void, ErrorCode> Client::UnmountSegment(const void* buffer,
-                                                     size_t size) {
-    std::lock_guard<std::mutex> lock(mounted_segments_mutex_);
-    auto segment = mounted_segments_.end();
-
-    for (auto it = mounted_segments_.begin(); it != mounted_segments_.end();
-         ++it) {
-        if (it->second.base == reinterpret_cast<uintptr_t>(buffer) &&
-            it->second.size == size) {
-            segment = it;
-            break;
+void Client::PackPutsWithCredit(std::vector<PutOperation>& ops,
+                                const ReplicateConfig& config) {
+    if (!CanPutWithCredit(config)) {
+        return;
+    }
+    std::vector<std::vector<size_t>> packable(credits_.size());
+    for (size_t i = 0; i < ops.size(); ++i) {
+        if (!ops[i].IsResolved() && ops[i].value_length > 0 &&
+            ops[i].value_length <= credit_max_object_) {
+            packable[PartitionedMasterClient::PartitionOf(
+                         ops[i].key, credits_.size())]
+                .push_back(i);
         }
     }
-    if (segment == mounted_segments_.end()) {
-        LOG(ERROR) << "segment_not_found base=" << buffer << " size=" << size;
-        return tl::unexpected(ErrorCode::INVALID_PARAMS);
+    for (size_t partition = 0; partition < packable.size(); ++partition) {
+        const auto& indices = packable[partition];
+        // Packs of at most the size of a credit
+        size_t begin = 0;
+        while (begin < indices.size()) {
+            size_t end = begin;
+            uint64_t reserved = 0;
+            while (end < indices.size()) {
+                const uint64_t size =
+                    AlignCreditPut(ops[indices[end]].value_length);
+                if (end > begin && reserved + size > credit_bytes_) {
+                    break;
+                }
+                reserved += size;
+                ++end;
+            }
+            PutPackWithCredit(
+                ops, partition,
+                std::span<const size_t>(indices).subspan(begin, end - begin),
+                reserved, config);
+            begin = end;
+        }
     }
+}
 
-    auto unmount_result =
-        master_client_.UnmountSegment(segment->second.id, client_id_);
-    if (!unmount_result) {
-        ErrorCode err = unmount_result.error();
-        LOG(ERROR) << "Failed to unmount segment from master: "
-                   << toString(err);
-        return tl::unexpected(err);
+void Client::PutPackWithCredit(std::vector<PutOperation>& ops,
+                               size_t partition,
+                               std::span<const size_t> pack, uint64_t reserved,
+                               const ReplicateConfig& config) {
+    AllocationCredit credit;
+    uint64_t offset = 0;
+    if (!ReserveCredit(partition, reserved, credit, offset)) {
+        return;
     }
 
-    int rc = transfer_engine_.unregisterLocalMemory(
-        reinterpret_cast<void*>(segment->second.base));
-    if (rc != 0) {
-        LOG(ERROR) << "Failed to unregister transfer buffer with transfer "
-                      "engine ret is "
-                   << rc;
-        if (rc != ERR_ADDRESS_NOT_REGISTERED) {
-            return tl::unexpected(ErrorCode::INTERNAL_ERROR);
+    // One replica holding the slices of all the objects, written by one
+    // transfer, whose requests to adjacent addresses the submitter merges
+    MemoryDescriptor memory;
+    std::vector<Slice> slices;
+    std::vector<CreditPut> puts;
+    puts.reserve(pack.size());
+    for (size_t index : pack) {
+        const auto& op = ops[index];
+        CreditPut put{op.key, offset, {}, config.with_soft_pin};
+        uintptr_t address = credit.extent.buffer_address_ + offset;
+        for (const auto& slice : op.slices) {
+            memory.buffer_descriptors.push_back(AllocatedBuffer::Descriptor{
+                credit.extent.segment_name_, slice.size, address,
+                BufStatus::INIT});
+            put.slice_lengths.push_back(slice.size);
+            slices.push_back(slice);
+            address += slice.size;
         }
-        // Otherwise, the segment is already unregistered from transfer
-        // engine, we can continue
+        puts.push_back(std::move(put));
+        offset += AlignCreditPut(op.value_length);
     }
+    Replica::Descriptor replica;
+    replica.descriptor_variant = std::move(memory);
+    replica.status = ReplicaStatus::PROCESSING;
 
-    mounted_segments_.erase(segment);
-    return {};
+    // Objects not put here are put as usual afterwards
+    ErrorCode err = TransferWrite(replica, slices);
+    if (err != ErrorCode::OK) {
+        LOG(WARNING) << "objects=" << pack.size()
+                     << ", credit_id=" << credit.id << ", error=" << err
+                     << ", action=credit_pack_failed";
+        return;
+    }
+    auto results = master_client_.CommitCreditPuts(partition, client_id_,
+                                                   credit.id, puts);
+    bool failed = results.size() != puts.size();
+    for (size_t i = 0; i < results.size() && !failed; ++i) {
+        if (results[i] ||
+            results[i].error() == ErrorCode::OBJECT_ALREADY_EXISTS) {
+            ops[pack[i]].SetSuccess();
+        } else {
+            failed = true;
+        }
+    }
+    if (failed) {
+        LOG(WARNING) << "objects=" << pack.size()
+                     << ", credit_id=" << credit.id
+                     << ", action=credit_commit_failed";
+        DropCredit(partition, credit.id);
+    }
 }
 
-tl::expected<void, ErrorCode> Client::RegisterLocalMemory(
-    void* addr, size_t length, const std::string& location,
-    bool remote_accessible, bool update_metadata) {
-    if (this->transfer_engine_.registerLocalMemory(
-            addr, length, location, remote_accessible, update_metadata) != 0) {
-        return tl::unexpected(ErrorCode::INVALID_PARAMS);
+void Client::ReturnAllocationCredits() {
+    std::vector<std::pair<size_t, uint64_t>> returned;
+    {
+        std::lock_guard<std::mutex> lock(credit_mutex_);
+        for (size_t i = 0; i < credits_.size(); ++i) {
+            if (credits_[i].credit) {
+                returned.emplace_back(i, credits_[i].credit->id);
+                credits_[i].credit.reset();
+            }
+        }
+    }
+    for (const auto& [partition, credit_id] : returned) {
+        auto result = master_client_.ReturnAllocationCredit(
+            partition, client_id_, credit_id);
+        if (!result) {
+            VLOG(1) << "partition=" << partition << ", credit_id=" << credit_id
+                    << ", error=" << result.error()
+                    << ", action=alloc_credit_return_failed";
+        }
     }
-    return {};
 }
 
-tl::expected<void, ErrorCode> Client::unregisterLocalMemory(
-    void* addr, bool update_metadata) {
-    if (this->transfer_engine_.unregisterLocalMemory(addr, update_metadata) !=
-        0) {
-        return tl::unexpected(ErrorCode::INVALID_PARAMS);
+void Client::ResetAllocationCredits() {
+    std::lock_guard<std::mutex> lock(credit_mutex_);
+    for (auto& part : credits_) {
+        part = PartitionCredit{};
     }
-    return {};
 }
 
-tl::expected<bool, ErrorCode> Client::IsExist(const std::string& key) {
-    auto result = master_client_.ExistKey(key);
-    if (!result) {
-        return tl::unexpected(result.error());
+void Client::PromoteFromDisk(const std::string& key,
+                             const Replica::Descriptor& replica,
+                             const std::vector<Slice>& slices) {
+    if (replica.is_memory_replica() || !disk_tier_) {
+        return;
     }
-    return result.value();
+    // The caller owns slices, copy them before returning
+    std::string value;
+    value.reserve(CalculateSliceSize(slices));
+    for (const auto& slice : slices) {
+        value.append(static_cast<char*>(slice.ptr), slice.size);
+    }
+    write_thread_pool_.enqueue(
+        [this, key, value = std::move(value)]() mutable {
+            Promote(key, value);
+        });
 }
 
-std::vector<tl::expected<bool, ErrorCode>> Client::BatchIsExist(
-    const std::vector<std::string>& keys) {
-    auto response = master_client_.BatchExistKey(keys);
+void Client::Promote(const std::string& key, std::string& value) {
+    std::vector<Slice> slices;
+    std::vector<size_t> slice_lengths;
+    for (size_t offset = 0; offset < value.size(); offset += kMaxSliceSize) {
+        const size_t length = std::min<size_t>(kMaxSliceSize,
+                                               value.size() - offset);
+        slices.push_back({value.data() + offset, length});
+        slice_lengths.push_back(length);
+    }
 
-    // Check if we got the expected number of responses
-    if (response.size() != keys.size()) {
-        LOG(ERROR) << "BatchExistKey response size mismatch. Expected: "
-                   << keys.size() << ", Got: " << response.size();
-        // Return vector of RPC_FAIL errors
-        std::vector<tl::expected<bool, ErrorCode>> results;
-        results.reserve(keys.size());
-        for (size_t i = 0; i < keys.size(); ++i) {
-            results.emplace_back(tl::unexpected(ErrorCode::RPC_FAIL));
+    auto start_result =
+        master_client_.PromoteStart(key, slice_lengths, ReplicateConfig{});
+    if (!start_result) {
+        // Another reader promoted it first, or it has been removed
+        if (start_result.error() == ErrorCode::UNAVAILABLE_IN_CURRENT_MODE) {
+            disk_tier_ = false;
         }
-        return results;
+        VLOG(1) << "promote_skipped key=" << key
+                << " error=" << start_result.error();
+        return;
     }
 
-    // Return the response directly as it's already in the correct
-    // format
-    return response;
-}
+    // The source of the transfers, only used by this client
+    ErrorCode err = ErrorCode::OK;
+    if (transfer_engine_.registerLocalMemory(value.data(), value.size(),
+                                             kWildcardLocation, false,
+                                             false) == 0) {
+        for (const auto& replica : start_result.value()) {
+            err = TransferWrite(replica, slices);
+            if (err != ErrorCode::OK) {
+                break;
+            }
+        }
+        transfer_engine_.unregisterLocalMemory(value.data(), false);
+    } else {
+        LOG(ERROR) << "register_promote_buffer_failed key=" << key;
+        err = ErrorCode::INTERNAL_ERROR;
+    }
 
-void Client::PrepareStorageBackend(const std::string& storage_root_dir,
-                                   const std::string& fsdir) {
-    // Initialize storage backend
-    storage_backend_ = StorageBackend::Create(storage_root_dir, fsdir);
-    if (!storage_backend_) {
-        LOG(INFO) << "Failed to initialize storage backend";
+    auto end_result = err == ErrorCode::OK ? master_client_.PutEnd(key)
+                                           : master_client_.PutRevoke(key);
+    if (err != ErrorCode::OK || !end_result) {
+        LOG(WARNING) << "promote_failed key=" << key << " error="
+                     << (err != ErrorCode::OK ? err : end_result.error());
+        return;
     }
+    // Read the new memory replicas from now on
+    InvalidateReplicaCache(key);
+    VLOG(1) << "promoted key=" << key;
 }
 
-ErrorCode Client::GetFromLocalFile(const std::string& object_key,
-                                   std::vector<Slice>& slices,
-                                   std::vector<Replica::Descriptor>& replicas) {
-    if (!storage_backend_) {
-        return ErrorCode::FILE_READ_FAIL;
+void Client::CompactionThreadFunc(std::chrono::milliseconds interval) {
+    bool logged_disabled = false;
+    std::unique_lock<std::mutex> lock(compaction_mutex_);
+    while (compaction_running_) {
+        lock.unlock();
+        auto task = master_client_.CompactionStart(local_hostname_);
+        if (task) {
+            Relocate(task.value());
+        }
+        lock.lock();
+        if (task) {
+            continue;
+        }
+        // Copies of CopyReplica and MigrateReplica still come
+        if (task.error() == ErrorCode::UNAVAILABLE_IN_CURRENT_MODE &&
+            !logged_disabled) {
+            LOG(INFO) << "Compaction is disabled by the master, only copying "
+                         "replicas";
+            logged_disabled = true;
+        }
+        compaction_cv_.wait_for(lock, interval,
+                                [this] { return !compaction_running_; });
     }
+}
 
-    ErrorCode err = storage_backend_->LoadObject(object_key, slices);
-    if (err != ErrorCode::OK) {
-        return err;
+bool Client::IsLocalReplica(const Replica::Descriptor& replica) {
+    if (!replica.is_memory_replica()) {
+        return false;
     }
-
-    return ErrorCode::OK;
+    std::lock_guard<std::mutex> lock(mounted_segments_mutex_);
+    for (const auto& buffer :
+         replica.get_memory_descriptor().buffer_descriptors) {
+        const bool mounted = std::any_of(
+            mounted_segments_.begin(), mounted_segments_.end(),
+            [&buffer](const auto& entry) {
+                const Segment& segment = entry.second;
+                return buffer.buffer_address_ >= segment.base &&
+                       buffer.buffer_address_ + buffer.size_ <=
+                           segment.base + segment.size;
+            });
+        if (buffer.segment_name_ != local_hostname_ || !mounted) {
+            return false;
+        }
+    }
+    return true;
 }
 
-void Client::PutToLocalFile(const std::string& key,
-                            std::vector<Slice>& slices) {
-    if (!storage_backend_) return;
+void Client::Relocate(const CompactionTask& task) {
+    const auto& buffers =
+        task.source.get_memory_descriptor().buffer_descriptors;
+    // Written from the segment, one transfer instead of a read and a write
+    if (IsLocalReplica(task.source)) {
+        std::vector<Slice> slices;
+        for (const auto& buffer : buffers) {
+            slices.push_back({reinterpret_cast<void*>(buffer.buffer_address_),
+                              buffer.size_});
+        }
+        FinishRelocation(task, TransferWrite(task.target, slices));
+        return;
+    }
 
     size_t total_size = 0;
-    for (const auto& slice : slices) {
-        total_size += slice.size;
+    for (const auto& buffer : buffers) {
+        total_size += buffer.size_;
+    }
+    std::string value(total_size, '\0');
+    std::vector<Slice> slices;
+    size_t offset = 0;
+    for (const auto& buffer : buffers) {
+        slices.push_back({value.data() + offset, buffer.size_});
+        offset += buffer.size_;
     }
 
-    std::string value;
-    value.reserve(total_size);
-    for (const auto& slice : slices) {
-        value.append(static_cast<char*>(slice.ptr), slice.size);
+    // The staging buffer of the copy, only used by this client
+    ErrorCode err = ErrorCode::OK;
+    if (transfer_engine_.registerLocalMemory(value.data(), value.size(),
+                                             kWildcardLocation, false,
+                                             false) == 0) {
+        err = TransferRead(task.source, slices);
+        if (err == ErrorCode::OK) {
+            err = TransferWrite(task.target, slices);
+        }
+        transfer_engine_.unregisterLocalMemory(value.data(), false);
+    } else {
+        LOG(ERROR) << "register_compaction_buffer_failed key=" << task.key;
+        err = ErrorCode::INTERNAL_ERROR;
     }
+    FinishRelocation(task, err);
+}
 
-    write_thread_pool_.enqueue(
-        [backend = storage_backend_, key, value = std::move(value)] {
-            backend->StoreObject(key, value);
-        });
+void Client::FinishRelocation(const CompactionTask& task, ErrorCode err) {
+    // Tells apart the copies of a broadcast
+    const uint64_t target = task.target.get_memory_descriptor()
+                                .buffer_descriptors.front()
+                                .buffer_address_;
+    auto end_result = err == ErrorCode::OK
+                          ? master_client_.CompactionEnd(task.key, target)
+                          : master_client_.CompactionRevoke(task.key, target);
+    if (err != ErrorCode::OK || !end_result) {
+        LOG(WARNING) << "relocation_failed key=" << task.key << " error="
+                     << (err != ErrorCode::OK ? err : end_result.error());
+        return;
+    }
+    // Read the new replica from now on
+    InvalidateReplicaCache(task.key);
+    VLOG(1) << "relocated key=" << task.key;
 }
 
 ErrorCode Client::TransferData(const Replica::Descriptor& replica_descriptor,
@@ -1091,8 +4290,12 @@ ErrorCode Client::TransferData(const Replica::Descriptor& replica_descriptor,
                                TransferRequest::OpCode op_code) {
     CHECK(transfer_submitter_) << "TransferSubmitter not initialized";
 
-    auto future =
-        transfer_submitter_->submit(replica_descriptor, slices, op_code);
+    std::optional<TransferFuture> future;
+    {
+        RequestTracer::ScopedSpan span("transfer_submit");
+        future =
+            transfer_submitter_->submit(replica_descriptor, slices, op_code);
+    }
     if (!future) {
         LOG(ERROR) << "Failed to submit transfer operation";
         return ErrorCode::TRANSFER_FAIL;
@@ -1100,6 +4303,9 @@ ErrorCode Client::TransferData(const Replica::Descriptor& replica_descriptor,
 
     VLOG(1) << "Using transfer strategy: " << future->strategy();
 
+    // Named by strategy, FILE_READ is the read from the storage backend
+    RequestTracer::ScopedSpan span("transfer_wait",
+                                   toString(future->strategy()));
     return future->get();
 }
 
@@ -1140,6 +4346,8 @@ void Client::PingThreadFunc() {
     const int fail_ping_interval_ms = 1000;
     // Increment after a ping failure, reset after a ping success
     int ping_fail_count = 0;
+    // Master view the caches and key filters were filled under
+    ViewVersionId cached_view_version = 0;
 
     auto remount_segment = [this]() {
         // This lock must be held until the remount rpc is finished,
@@ -1158,11 +4366,76 @@ void Client::PingThreadFunc() {
             ErrorCode err = remount_result.error();
             LOG(ERROR) << "Failed to remount segments: " << err;
         }
+        // The master dropped the attachments with the expired client, and
+        // the owner of a segment may have remounted it since
+        for (auto& [memory_id, attached] : attached_segments_) {
+            auto attach_result =
+                master_client_.AttachSegment(memory_id, client_id_);
+            if (!attach_result) {
+                LOG(ERROR) << "Failed to reattach segment: "
+                           << attach_result.error();
+                continue;
+            }
+            const Segment& segment = attach_result.value();
+            transfer_submitter_->removeAttachedSegment(
+                attached.segment.name, attached.segment.base);
+            if (segment.size > attached.local_size) {
+                LOG(ERROR) << "attached_segment_too_large memory_id="
+                           << memory_id << " segment_size=" << segment.size;
+                continue;
+            }
+            transfer_submitter_->addAttachedSegment(
+                segment.name, segment.base, segment.size, attached.local_base);
+            attached.segment = segment;
+        }
     };
     // Use another thread to remount segments to avoid blocking the ping
     // thread
     std::future<void> remount_segment_future;
 
+    // Sleep until the next ping, returns true if the master views changed
+    // in the meantime
+    auto wait_for_next_ping = [this](int interval_ms) {
+        std::unique_lock<std::mutex> lock(ping_mutex_);
+        ping_cv_.wait_for(lock, std::chrono::milliseconds(interval_ms), [&]() {
+            return !ping_running_ || master_view_changed_;
+        });
+        return std::exchange(master_view_changed_, false);
+    };
+
+    // Connect each partition to its latest master. With only_changed, the
+    // partitions whose master is the same are left alone, so that a view
+    // change of one partition does not disturb the others.
+    auto reconnect = [this](bool only_changed) {
+        const size_t partition_num = master_client_.partition_num();
+        master_addresses_.resize(partition_num);
+        for (size_t i = 0; i < partition_num; ++i) {
+            std::string master_address;
+            ViewVersionId next_version = 0;
+            auto err = master_view_helper_.GetMasterView(
+                master_address, next_version, MasterViewKey(i, partition_num));
+            if (err != ErrorCode::OK) {
+                LOG(ERROR) << "Failed to get new master view: "
+                           << toString(err);
+                return false;
+            }
+            if (only_changed && master_address == master_addresses_[i]) {
+                continue;
+            }
+
+            err = master_client_.Connect(i, master_address);
+            if (err != ErrorCode::OK) {
+                LOG(ERROR) << "Failed to connect to master " << master_address
+                           << ": " << toString(err);
+                return false;
+            }
+            master_addresses_[i] = master_address;
+            LOG(INFO) << "Reconnected to master " << master_address;
+        }
+        return true;
+    };
+    bool view_changed = false;
+
     while (ping_running_) {
         // Join the remount segment thread if it is ready
         if (remount_segment_future.valid() &&
@@ -1171,56 +4444,69 @@ void Client::PingThreadFunc() {
             remount_segment_future = std::future<void>();
         }
 
+        // A new master was elected, connect to it before the requests to
+        // the old one fail
+        if (view_changed) {
+            view_changed = false;
+            if (!reconnect(true)) {
+                // The watch does not repeat the change, retry next round
+                wait_for_next_ping(fail_ping_interval_ms);
+                view_changed = true;
+                continue;
+            }
+        }
+
         // Ping master
         auto ping_result = master_client_.Ping(client_id_);
         if (ping_result) {
             // Reset ping failure count
             ping_fail_count = 0;
             auto [view_version, client_status] = ping_result.value();
+            // A new master has no leases on the cached replicas, nor the
+            // change log the key filters follow
+            if (view_version != cached_view_version) {
+                ClearReplicaCache();
+                ResetKeyFilters();
+                ResetAllocationCredits();
+                cached_view_version = view_version;
+            }
+            if (replica_cache_ || near_cache_) {
+                auto info = master_client_.GetReplicaCacheInfo();
+                if (!info) {
+                    ClearReplicaCache();
+                } else if (replica_cache_) {
+                    // Moved replicas hold the same values, near_cache_
+                    // stays valid
+                    replica_cache_->SetVersion(info->replica_version);
+                }
+            }
+            RenewViews();
             if (client_status == ClientStatus::NEED_REMOUNT &&
                 !remount_segment_future.valid()) {
                 // Ensure at most one remount segment thread is running
                 remount_segment_future =
                     std::async(std::launch::async, remount_segment);
             }
-            std::this_thread::sleep_for(
-                std::chrono::milliseconds(success_ping_interval_ms));
+            view_changed = wait_for_next_ping(success_ping_interval_ms);
             continue;
         }
 
         ping_fail_count++;
         if (ping_fail_count < max_ping_fail_count) {
             LOG(ERROR) << "Failed to ping master";
-            std::this_thread::sleep_for(
-                std::chrono::milliseconds(fail_ping_interval_ms));
+            view_changed = wait_for_next_ping(fail_ping_interval_ms);
             continue;
         }
 
         // Too many ping failures, we need to check if the master view
-        // has changed
+        // has changed. The ping does not tell which partition failed, so
+        // every partition is reconnected to its latest master.
         LOG(ERROR) << "Failed to ping master for " << ping_fail_count
                    << " times, try to get latest master view and reconnect";
-        std::string master_address;
-        ViewVersionId next_version = 0;
-        auto err =
-            master_view_helper_.GetMasterView(master_address, next_version);
-        if (err != ErrorCode::OK) {
-            LOG(ERROR) << "Failed to get new master view: " << toString(err);
-            std::this_thread::sleep_for(
-                std::chrono::milliseconds(fail_ping_interval_ms));
-            continue;
-        }
-
-        err = master_client_.Connect(master_address);
-        if (err != ErrorCode::OK) {
-            LOG(ERROR) << "Failed to connect to master " << master_address
-                       << ": " << toString(err);
-            std::this_thread::sleep_for(
-                std::chrono::milliseconds(fail_ping_interval_ms));
+        if (!reconnect(false)) {
+            view_changed = wait_for_next_ping(fail_ping_interval_ms);
             continue;
         }
-
-        LOG(INFO) << "Reconnected to master " << master_address;
         ping_fail_count = 0;
     }
     // Explicitly wait for the remount segment thread to finish
@@ -1229,19 +4515,11 @@ void Client::PingThreadFunc() {
     }
 }
 
-ErrorCode Client::FindFirstCompleteReplica(
+ErrorCode Client::SelectReplica(
     const std::vector<Replica::Descriptor>& replica_list,
     Replica::Descriptor& replica) {
-    // Find the first complete replica
-    for (size_t i = 0; i < replica_list.size(); ++i) {
-        if (replica_list[i].status == ReplicaStatus::COMPLETE) {
-            replica = replica_list[i];
-            return ErrorCode::OK;
-        }
-    }
-
-    // No complete replica found
-    return ErrorCode::INVALID_REPLICA;
+    CHECK(transfer_submitter_) << "TransferSubmitter not initialized";
+    return transfer_submitter_->selectReplica(replica_list, replica);
 }
 
 }  // namespace mooncake
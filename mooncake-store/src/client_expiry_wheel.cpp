@@ -0,0 +1,51 @@
+#include "client_expiry_wheel.h"
+
+#include <algorithm>
+
+namespace mooncake {
+
+ClientExpiryWheel::ClientExpiryWheel(Clock::duration tick, Clock::duration ttl,
+                                     Clock::time_point now)
+    : tick_(std::max(tick, Clock::duration(1))),
+      ttl_(ttl),
+      start_(now),
+      // A deadline is at most this many slots ahead of the current tick
+      slots_((ttl_ + tick_ - Clock::duration(1)) / tick_ + 2) {}
+
+void ClientExpiryWheel::Touch(const UUID& client_id, Clock::time_point now) {
+    const auto deadline = now + ttl_ - start_;
+    uint64_t tick = static_cast<uint64_t>(
+        (deadline + tick_ - Clock::duration(1)) / tick_);
+    tick = std::max(tick, next_tick_);
+    auto [it, inserted] = deadlines_.try_emplace(client_id, tick);
+    if (!inserted) {
+        // Moved to its new slot once the wheel reaches the old one
+        it->second = tick;
+        return;
+    }
+    slots_[tick % slots_.size()].push_back(client_id);
+}
+
+std::vector<UUID> ClientExpiryWheel::Advance(Clock::time_point now) {
+    std::vector<UUID> expired;
+    if (now < start_) {
+        return expired;
+    }
+    const uint64_t now_tick = TickOf(now);
+    for (; next_tick_ <= now_tick; ++next_tick_) {
+        std::vector<UUID> clients;
+        clients.swap(slots_[next_tick_ % slots_.size()]);
+        for (const auto& client_id : clients) {
+            auto it = deadlines_.find(client_id);
+            if (it->second <= next_tick_) {
+                expired.push_back(client_id);
+                deadlines_.erase(it);
+            } else {
+                slots_[it->second % slots_.size()].push_back(client_id);
+            }
+        }
+    }
+    return expired;
+}
+
+}  // namespace mooncake
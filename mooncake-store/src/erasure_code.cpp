@@ -0,0 +1,204 @@
+#include "erasure_code.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace mooncake {
+
+namespace {
+
+// GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1 and generator 2
+struct GaloisField {
+    std::array<uint8_t, 512> exp{};
+    std::array<uint8_t, 256> log{};
+
+    GaloisField() {
+        unsigned value = 1;
+        for (size_t i = 0; i < 255; ++i) {
+            exp[i] = static_cast<uint8_t>(value);
+            log[value] = static_cast<uint8_t>(i);
+            value <<= 1;
+            if (value & 0x100) {
+                value ^= 0x11d;
+            }
+        }
+        // Products index up to 254 + 254 without a modulo
+        for (size_t i = 255; i < exp.size(); ++i) {
+            exp[i] = exp[i - 255];
+        }
+    }
+
+    uint8_t Mul(uint8_t a, uint8_t b) const {
+        if (a == 0 || b == 0) {
+            return 0;
+        }
+        return exp[log[a] + log[b]];
+    }
+
+    uint8_t Inv(uint8_t a) const { return exp[255 - log[a]]; }
+};
+
+const GaloisField& Field() {
+    static const GaloisField field;
+    return field;
+}
+
+// Element of the Cauchy matrix weighting data fragment i in parity fragment
+// j, with distinct points j + k and i so that every square submatrix of the
+// systematic matrix is invertible
+uint8_t Coefficient(size_t data_fragments, size_t j, size_t i) {
+    return Field().Inv(static_cast<uint8_t>((data_fragments + j) ^ i));
+}
+
+// dst[0, size) += c * src[0, size)
+void MulAdd(uint8_t* dst, const uint8_t* src, uint8_t c, size_t size) {
+    if (c == 0) {
+        return;
+    }
+    if (c == 1) {
+        for (size_t b = 0; b < size; ++b) {
+            dst[b] ^= src[b];
+        }
+        return;
+    }
+    std::array<uint8_t, 256> product;
+    for (size_t x = 0; x < product.size(); ++x) {
+        product[x] = Field().Mul(c, static_cast<uint8_t>(x));
+    }
+    for (size_t b = 0; b < size; ++b) {
+        dst[b] ^= product[src[b]];
+    }
+}
+
+// Inverts the n x n row-major matrix in place, false if it is singular
+bool Invert(std::vector<uint8_t>& matrix, size_t n) {
+    const auto& field = Field();
+    std::vector<uint8_t> inverse(n * n, 0);
+    for (size_t i = 0; i < n; ++i) {
+        inverse[i * n + i] = 1;
+    }
+    for (size_t col = 0; col < n; ++col) {
+        size_t pivot = col;
+        while (pivot < n && matrix[pivot * n + col] == 0) {
+            ++pivot;
+        }
+        if (pivot == n) {
+            return false;
+        }
+        if (pivot != col) {
+            for (size_t c = 0; c < n; ++c) {
+                std::swap(matrix[pivot * n + c], matrix[col * n + c]);
+                std::swap(inverse[pivot * n + c], inverse[col * n + c]);
+            }
+        }
+        const uint8_t scale = field.Inv(matrix[col * n + col]);
+        for (size_t c = 0; c < n; ++c) {
+            matrix[col * n + c] = field.Mul(matrix[col * n + c], scale);
+            inverse[col * n + c] = field.Mul(inverse[col * n + c], scale);
+        }
+        for (size_t r = 0; r < n; ++r) {
+            const uint8_t factor = matrix[r * n + col];
+            if (r == col || factor == 0) {
+                continue;
+            }
+            for (size_t c = 0; c < n; ++c) {
+                matrix[r * n + c] ^= field.Mul(factor, matrix[col * n + c]);
+                inverse[r * n + c] ^= field.Mul(factor, inverse[col * n + c]);
+            }
+        }
+    }
+    matrix = std::move(inverse);
+    return true;
+}
+
+}  // namespace
+
+bool IsValidErasureCode(uint64_t size, size_t data_fragments,
+                        size_t parity_fragments) {
+    if (data_fragments == 0 || parity_fragments == 0 ||
+        data_fragments + parity_fragments > kMaxErasureFragments ||
+        size < data_fragments) {
+        return false;
+    }
+    // The largest fragment, as large as the parity ones
+    return (size + data_fragments - 1) / data_fragments <= kMaxSliceSize;
+}
+
+std::vector<uint64_t> ErasureDataFragmentSizes(uint64_t size,
+                                               size_t data_fragments) {
+    std::vector<uint64_t> sizes(data_fragments, size / data_fragments);
+    for (size_t i = 0; i < size % data_fragments; ++i) {
+        ++sizes[i];
+    }
+    return sizes;
+}
+
+void ErasureEncode(const std::vector<Slice>& data, std::vector<Slice>& parity) {
+    for (size_t j = 0; j < parity.size(); ++j) {
+        auto* out = static_cast<uint8_t*>(parity[j].ptr);
+        std::memset(out, 0, parity[j].size);
+        for (size_t i = 0; i < data.size(); ++i) {
+            MulAdd(out, static_cast<const uint8_t*>(data[i].ptr),
+                   Coefficient(data.size(), j, i),
+                   std::min(data[i].size, parity[j].size));
+        }
+    }
+}
+
+ErrorCode ErasureDecode(std::vector<Slice>& fragments, size_t data_fragments,
+                        const std::vector<bool>& present) {
+    const size_t k = data_fragments;
+    if (k == 0 || fragments.size() < k || present.size() != fragments.size()) {
+        return ErrorCode::INVALID_PARAMS;
+    }
+    std::vector<size_t> missing;
+    for (size_t i = 0; i < k; ++i) {
+        if (!present[i]) {
+            missing.push_back(i);
+        }
+    }
+    if (missing.empty()) {
+        return ErrorCode::OK;
+    }
+
+    // k of the fragments read, the data ones first, and the rows of the
+    // systematic matrix that give them from the data
+    std::vector<size_t> rows;
+    for (size_t i = 0; i < fragments.size() && rows.size() < k; ++i) {
+        if (present[i]) {
+            rows.push_back(i);
+        }
+    }
+    if (rows.size() < k) {
+        return ErrorCode::INVALID_PARAMS;
+    }
+    std::vector<uint8_t> matrix(k * k, 0);
+    for (size_t r = 0; r < k; ++r) {
+        if (rows[r] < k) {
+            matrix[r * k + rows[r]] = 1;
+            continue;
+        }
+        for (size_t c = 0; c < k; ++c) {
+            matrix[r * k + c] = Coefficient(k, rows[r] - k, c);
+        }
+    }
+    if (!Invert(matrix, k)) {
+        return ErrorCode::INTERNAL_ERROR;
+    }
+
+    const size_t length = fragments.front().size;
+    std::vector<uint8_t> out(length);
+    for (size_t i : missing) {
+        std::fill(out.begin(), out.end(), 0);
+        for (size_t r = 0; r < k; ++r) {
+            const auto& fragment = fragments[rows[r]];
+            MulAdd(out.data(), static_cast<const uint8_t*>(fragment.ptr),
+                   matrix[i * k + r], std::min(fragment.size, length));
+        }
+        std::memcpy(fragments[i].ptr, out.data(), fragments[i].size);
+    }
+    return ErrorCode::OK;
+}
+
+}  // namespace mooncake
@@ -128,6 +128,42 @@ ErrorCode EtcdHelper::CancelWatch(const char* key, const size_t key_size) {
     return ErrorCode::OK;
 }
 
+ErrorCode EtcdHelper::WatchPrefix(const char* prefix,
+                                  const size_t prefix_size, int& watch_id) {
+    char* err_msg = nullptr;
+    if (0 != EtcdStoreWatchPrefixWrapper((char*)prefix, (int)prefix_size,
+                                         &watch_id, &err_msg)) {
+        LOG(ERROR) << "prefix=" << std::string(prefix, prefix_size)
+                   << ", error=" << err_msg;
+        free(err_msg);
+        return ErrorCode::ETCD_OPERATION_ERROR;
+    }
+    return ErrorCode::OK;
+}
+
+ErrorCode EtcdHelper::NextWatchEvent(int watch_id, int timeout_ms,
+                                     bool& changed, std::string& key) {
+    char* err_msg = nullptr;
+    char* changed_key = nullptr;
+    int err_code =
+        EtcdNextWatchEventWrapper(watch_id, timeout_ms, &changed_key, &err_msg);
+    if (err_code < 0) {
+        LOG(ERROR) << "watch_id=" << watch_id << ", error=" << err_msg;
+        free(err_msg);
+        return ErrorCode::ETCD_OPERATION_ERROR;
+    }
+    changed = err_code == 0;
+    if (changed) {
+        key = changed_key;
+        free(changed_key);
+    }
+    return ErrorCode::OK;
+}
+
+void EtcdHelper::CancelWatchPrefix(int watch_id) {
+    EtcdCancelWatchPrefixWrapper(watch_id);
+}
+
 ErrorCode EtcdHelper::KeepAlive(EtcdLeaseId lease_id) {
     char* err_msg = nullptr;
     int err_code = EtcdStoreKeepAliveWrapper(lease_id, &err_msg);
@@ -189,6 +225,22 @@ ErrorCode EtcdHelper::CancelWatch(const char* key, const size_t key_size) {
     return ErrorCode::ETCD_OPERATION_ERROR;
 }
 
+ErrorCode EtcdHelper::WatchPrefix(const char* prefix,
+                                  const size_t prefix_size, int& watch_id) {
+    LOG(FATAL) << "Etcd is not enabled in compilation";
+    return ErrorCode::ETCD_OPERATION_ERROR;
+}
+
+ErrorCode EtcdHelper::NextWatchEvent(int watch_id, int timeout_ms,
+                                     bool& changed, std::string& key) {
+    LOG(FATAL) << "Etcd is not enabled in compilation";
+    return ErrorCode::ETCD_OPERATION_ERROR;
+}
+
+void EtcdHelper::CancelWatchPrefix(int watch_id) {
+    LOG(FATAL) << "Etcd is not enabled in compilation";
+}
+
 ErrorCode EtcdHelper::KeepAlive(EtcdLeaseId lease_id) {
     LOG(FATAL) << "Etcd is not enabled in compilation";
     return ErrorCode::ETCD_OPERATION_ERROR;
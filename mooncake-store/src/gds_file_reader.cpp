@@ -0,0 +1,147 @@
+#include "gds_file_reader.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <thread>
+
+#ifdef USE_NVMEOF
+#include <cuda_runtime.h>
+
+#include "transport/nvmeof_transport/cufile_context.h"
+#include "transport/nvmeof_transport/cufile_desc_pool.h"
+#endif
+
+namespace mooncake {
+
+#ifdef USE_NVMEOF
+
+namespace {
+
+bool IsFinished(CUfileStatus_t status) {
+    return status != CUFILE_WAITING && status != CUFILE_PENDING;
+}
+
+}  // namespace
+
+GdsFileReader::GdsFileReader() = default;
+
+GdsFileReader::~GdsFileReader() = default;
+
+std::unique_ptr<GdsFileReader> GdsFileReader::Create() {
+    const char* env = std::getenv("MC_STORE_GDS");
+    if (env && std::strcmp(env, "0") == 0) {
+        return nullptr;
+    }
+    try {
+        CUFILE_CHECK(cuFileDriverOpen());
+        std::unique_ptr<GdsFileReader> reader(new GdsFileReader());
+        reader->desc_pool_ = std::make_unique<CUFileDescPool>();
+        LOG(INFO) << "Reading disk replicas into GPU memory with GPUDirect "
+                     "Storage";
+        return reader;
+    } catch (const std::exception& e) {
+        LOG(WARNING) << "GPUDirect Storage is not available: " << e.what();
+        return nullptr;
+    }
+}
+
+bool GdsFileReader::IsDeviceMemory(const std::vector<Slice>& slices) {
+    if (slices.empty()) {
+        return false;
+    }
+    for (const auto& slice : slices) {
+        cudaPointerAttributes attributes;
+        if (cudaPointerGetAttributes(&attributes, slice.ptr) != cudaSuccess) {
+            // Plain host memory on older CUDA versions
+            cudaGetLastError();
+            return false;
+        }
+        if (attributes.type != cudaMemoryTypeDevice) {
+            return false;
+        }
+    }
+    return true;
+}
+
+ErrorCode GdsFileReader::Read(const std::string& path, uint64_t offset,
+                              const std::vector<Slice>& slices) {
+    try {
+        CuFileContext file(path.c_str());
+        for (size_t begin = 0; begin < slices.size(); begin += kMaxBatch) {
+            const size_t end = std::min(slices.size(), begin + kMaxBatch);
+            // Descriptors are taken by thread, wait for ours to be free
+            int idx;
+            while ((idx = desc_pool_->allocCUfileDesc(end - begin)) < 0) {
+                std::this_thread::yield();
+            }
+            uint64_t file_offset = offset;
+            for (size_t i = begin; i < end; ++i) {
+                CUfileIOParams_t params;
+                params.mode = CUFILE_BATCH;
+                params.opcode = CUFILE_READ;
+                params.u.batch.devPtr_base = slices[i].ptr;
+                params.u.batch.devPtr_offset = 0;
+                params.u.batch.file_offset = file_offset;
+                params.u.batch.size = slices[i].size;
+                params.fh = file.getHandle();
+                desc_pool_->pushParams(idx, params);
+                file_offset += slices[i].size;
+            }
+            desc_pool_->submitBatch(idx);
+
+            bool ok = true;
+            for (size_t i = begin; i < end; ++i) {
+                auto event = desc_pool_->getTransferStatus(idx, i - begin);
+                while (!IsFinished(event.status)) {
+                    std::this_thread::yield();
+                    event = desc_pool_->getTransferStatus(idx, i - begin);
+                }
+                if (event.status != CUFILE_COMPLETE ||
+                    event.ret != static_cast<ssize_t>(slices[i].size)) {
+                    LOG(ERROR) << "GDS read failed for: " << path
+                               << ", status: " << event.status
+                               << ", expected: " << slices[i].size
+                               << ", got: " << event.ret;
+                    ok = false;
+                }
+            }
+            desc_pool_->freeCUfileDesc(idx);
+            if (!ok) {
+                return ErrorCode::FILE_READ_FAIL;
+            }
+            offset = file_offset;
+        }
+        return ErrorCode::OK;
+    } catch (const std::exception& e) {
+        LOG(ERROR) << "GDS read failed for: " << path << ": " << e.what();
+        return ErrorCode::FILE_OPEN_FAIL;
+    }
+}
+
+#else
+
+// Never created without cuFile
+class CUFileDescPool {};
+
+GdsFileReader::GdsFileReader() = default;
+
+GdsFileReader::~GdsFileReader() = default;
+
+std::unique_ptr<GdsFileReader> GdsFileReader::Create() { return nullptr; }
+
+bool GdsFileReader::IsDeviceMemory(const std::vector<Slice>&) {
+    return false;
+}
+
+ErrorCode GdsFileReader::Read(const std::string&, uint64_t,
+                              const std::vector<Slice>&) {
+    return ErrorCode::FILE_READ_FAIL;
+}
+
+#endif
+
+}  // namespace mooncake
@@ -1,19 +1,30 @@
 #include "ha_helper.h"
 
+#include "metadata_follower.h"
+
 namespace mooncake {
 
+std::string MasterViewKey(size_t partition_id, size_t partition_num) {
+    if (partition_num <= 1) {
+        return MASTER_VIEW_KEY;
+    }
+    return std::string(MASTER_VIEW_KEY) + "/partition_" +
+           std::to_string(partition_id);
+}
+
 ErrorCode MasterViewHelper::ConnectToEtcd(const std::string& etcd_endpoints) {
     return EtcdHelper::ConnectToEtcdStoreClient(etcd_endpoints);
 }
 
 void MasterViewHelper::ElectLeader(const std::string& master_address,
                                    ViewVersionId& version,
-                                   EtcdLeaseId& lease_id) {
+                                   EtcdLeaseId& lease_id,
+                                   const std::string& view_key) {
     while (true) {
         // Check if there is already a leader
         ViewVersionId current_version = 0;
         std::string current_master;
-        auto ret = EtcdHelper::Get(MASTER_VIEW_KEY, strlen(MASTER_VIEW_KEY),
+        auto ret = EtcdHelper::Get(view_key.c_str(), view_key.size(),
                                    current_master, current_version);
         if (ret != ErrorCode::OK && ret != ErrorCode::ETCD_KEY_NOT_EXIST) {
             LOG(ERROR) << "Failed to get current leader: " << ret;
@@ -25,8 +36,8 @@ void MasterViewHelper::ElectLeader(const std::string& master_address,
             // In rare cases, the leader may be ourselves, but it does not
             // matter. We will watch the key until it's deleted.
             LOG(INFO) << "Waiting for leadership change...";
-            auto ret = EtcdHelper::WatchUntilDeleted(MASTER_VIEW_KEY,
-                                                     strlen(MASTER_VIEW_KEY));
+            auto ret = EtcdHelper::WatchUntilDeleted(view_key.c_str(),
+                                                     view_key.size());
             if (ret != ErrorCode::OK) {
                 LOG(ERROR) << "Etcd error when waiting for leadership change: "
                            << ret;
@@ -50,7 +61,7 @@ void MasterViewHelper::ElectLeader(const std::string& master_address,
         }
 
         ret = EtcdHelper::CreateWithLease(
-            MASTER_VIEW_KEY, strlen(MASTER_VIEW_KEY), master_address.c_str(),
+            view_key.c_str(), view_key.size(), master_address.c_str(),
             master_address.size(), lease_id, version);
         if (ret == ErrorCode::ETCD_TRANSACTION_FAIL) {
             LOG(INFO) << "Failed to elect self as leader: " << ret;
@@ -72,8 +83,9 @@ void MasterViewHelper::KeepLeader(EtcdLeaseId lease_id) {
 }
 
 ErrorCode MasterViewHelper::GetMasterView(std::string& master_address,
-                                          ViewVersionId& version) {
-    auto err_code = EtcdHelper::Get(MASTER_VIEW_KEY, strlen(MASTER_VIEW_KEY),
+                                          ViewVersionId& version,
+                                          const std::string& view_key) {
+    auto err_code = EtcdHelper::Get(view_key.c_str(), view_key.size(),
                                     master_address, version);
     if (err_code != ErrorCode::OK) {
         if (err_code == ErrorCode::ETCD_KEY_NOT_EXIST) {
@@ -89,35 +101,148 @@ ErrorCode MasterViewHelper::GetMasterView(std::string& master_address,
     }
 }
 
+ErrorCode MasterViewHelper::PublishPartitionNum(size_t partition_num) {
+    const std::string value = std::to_string(partition_num);
+    EtcdRevisionId revision = 0;
+    // Lease 0 binds the key to no lease, it outlives the masters
+    auto err = EtcdHelper::CreateWithLease(
+        MASTER_PARTITION_NUM_KEY, strlen(MASTER_PARTITION_NUM_KEY),
+        value.c_str(), value.size(), 0, revision);
+    if (err == ErrorCode::OK) {
+        LOG(INFO) << "Published master partition number " << partition_num;
+        return ErrorCode::OK;
+    } else if (err != ErrorCode::ETCD_TRANSACTION_FAIL) {
+        LOG(ERROR) << "Failed to publish master partition number: " << err;
+        return err;
+    }
+    size_t published = 0;
+    err = GetPartitionNum(published);
+    if (err != ErrorCode::OK) {
+        return err;
+    }
+    if (published != partition_num) {
+        LOG(ERROR) << "Master partition number " << partition_num
+                   << " differs from the published " << published
+                   << ", delete " << MASTER_PARTITION_NUM_KEY
+                   << " from etcd to change it";
+        return ErrorCode::INVALID_PARAMS;
+    }
+    return ErrorCode::OK;
+}
+
+ErrorCode MasterViewHelper::GetPartitionNum(size_t& partition_num) {
+    std::string value;
+    EtcdRevisionId revision = 0;
+    auto err = EtcdHelper::Get(MASTER_PARTITION_NUM_KEY,
+                               strlen(MASTER_PARTITION_NUM_KEY), value,
+                               revision);
+    if (err == ErrorCode::ETCD_KEY_NOT_EXIST) {
+        partition_num = 1;
+        return ErrorCode::OK;
+    } else if (err != ErrorCode::OK) {
+        LOG(ERROR) << "Failed to get master partition number: " << err;
+        return err;
+    }
+    try {
+        partition_num = std::stoull(value);
+    } catch (const std::exception&) {
+        partition_num = 0;
+    }
+    if (partition_num == 0) {
+        LOG(ERROR) << "Invalid master partition number: " << value;
+        return ErrorCode::INVALID_PARAMS;
+    }
+    return ErrorCode::OK;
+}
+
+ErrorCode MasterViewHelper::WatchMasterViews(
+    std::function<void(const std::string& view_key)> on_change) {
+    StopWatchingMasterViews();
+    auto err = EtcdHelper::WatchPrefix(MASTER_VIEW_KEY,
+                                       strlen(MASTER_VIEW_KEY), watch_id_);
+    if (err != ErrorCode::OK) {
+        LOG(ERROR) << "Failed to watch the master views: " << err;
+        return err;
+    }
+    watch_running_ = true;
+    watch_thread_ = std::thread([this, on_change = std::move(on_change)]() {
+        while (watch_running_) {
+            bool changed = false;
+            std::string key;
+            // Times out every second so that the watch can be stopped
+            auto err =
+                EtcdHelper::NextWatchEvent(watch_id_, 1000, changed, key);
+            if (err != ErrorCode::OK) {
+                LOG(WARNING) << "Stopped watching the master views: " << err;
+                return;
+            }
+            if (changed) {
+                VLOG(1) << "Master view changed, key=" << key;
+                on_change(key);
+            }
+        }
+    });
+    return ErrorCode::OK;
+}
+
+void MasterViewHelper::StopWatchingMasterViews() {
+    if (!watch_running_.exchange(false)) {
+        return;
+    }
+    if (watch_thread_.joinable()) {
+        watch_thread_.join();
+    }
+    EtcdHelper::CancelWatchPrefix(watch_id_);
+}
+
+MasterViewHelper::~MasterViewHelper() { StopWatchingMasterViews(); }
+
 MasterServiceSupervisor::MasterServiceSupervisor(
-    int rpc_port, size_t rpc_thread_num, bool enable_gc,
-    bool enable_metric_reporting, int metrics_port,
-    int64_t default_kv_lease_ttl, int64_t default_kv_soft_pin_ttl,
-    bool allow_evict_soft_pinned_objects,
-    double eviction_ratio, double eviction_high_watermark_ratio,
-    int64_t client_live_ttl_sec, const std::string& etcd_endpoints,
+    const WrappedMasterServiceConfig& config, int rpc_port,
+    size_t rpc_thread_num, const std::string& etcd_endpoints,
     const std::string& local_hostname, const std::string& rpc_address,
     std::chrono::steady_clock::duration rpc_conn_timeout,
-    bool rpc_enable_tcp_no_delay,
-    const std::string& cluster_id)
-    : enable_gc_(enable_gc),
-      enable_metric_reporting_(enable_metric_reporting),
-      metrics_port_(metrics_port),
-      default_kv_lease_ttl_(default_kv_lease_ttl),
-      default_kv_soft_pin_ttl_(default_kv_soft_pin_ttl),
-      allow_evict_soft_pinned_objects_(allow_evict_soft_pinned_objects),
-      eviction_ratio_(eviction_ratio),
-      eviction_high_watermark_ratio_(eviction_high_watermark_ratio),
-      client_live_ttl_sec_(client_live_ttl_sec),
+    bool rpc_enable_tcp_no_delay, size_t partition_id, size_t partition_num,
+    bool rpc_enable_rdma, const AdmissionConfig& admission_config)
+    : config_(config),
       rpc_port_(rpc_port),
       rpc_thread_num_(rpc_thread_num > 0 ? rpc_thread_num
                                          : std::thread::hardware_concurrency()),
       rpc_address_(rpc_address),
       rpc_conn_timeout_(rpc_conn_timeout),
       rpc_enable_tcp_no_delay_(rpc_enable_tcp_no_delay),
+      rpc_enable_rdma_(rpc_enable_rdma),
       etcd_endpoints_(etcd_endpoints),
       local_hostname_(local_hostname),
-      cluster_id_(cluster_id) {}
+      partition_id_(partition_id),
+      partition_num_(partition_num),
+      admission_config_(admission_config) {
+    config_.master.enable_ha = true;
+}
+
+void MasterServiceSupervisor::FollowLeader(
+    const std::atomic<bool>& following,
+    std::unique_ptr<MetadataFollower>& follower) {
+    const std::string view_key = MasterViewKey(partition_id_, partition_num_);
+    std::string followed;
+    while (following) {
+        std::string leader;
+        ViewVersionId version = 0;
+        auto err = EtcdHelper::Get(view_key.c_str(), view_key.size(), leader,
+                                   version);
+        if (err == ErrorCode::OK && leader != local_hostname_ &&
+            leader != followed) {
+            LOG(INFO) << "Following leader " << leader
+                      << " for failover restore";
+            follower.reset();
+            follower = std::make_unique<MetadataFollower>(
+                leader, std::chrono::milliseconds(0));
+            follower->Start();
+            followed = leader;
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+}
 
 int MasterServiceSupervisor::Start() {
     while (true) {
@@ -125,6 +250,11 @@ int MasterServiceSupervisor::Start() {
         coro_rpc::coro_rpc_server server(rpc_thread_num_, rpc_port_,
                                          rpc_address_, rpc_conn_timeout_,
                                          rpc_enable_tcp_no_delay_);
+#ifdef YLT_ENABLE_IBV
+        if (rpc_enable_rdma_) {
+            server.init_ibv();
+        }
+#endif
         LOG(INFO) << "Init leader election helper...";
         MasterViewHelper mv_helper;
         if (mv_helper.ConnectToEtcd(etcd_endpoints_) != ErrorCode::OK) {
@@ -132,10 +262,26 @@ int MasterServiceSupervisor::Start() {
                        << etcd_endpoints_;
             return -1;
         }
-        LOG(INFO) << "Trying to elect self as leader...";
+        if (partition_num_ > 1 &&
+            mv_helper.PublishPartitionNum(partition_num_) != ErrorCode::OK) {
+            return -1;
+        }
+        LOG(INFO) << "Trying to elect self as leader of partition "
+                  << partition_id_ << "/" << partition_num_ << "...";
+        // The standby follows the leader until the old leader retired, see
+        // MasterService::kRestoreFreeDelay
+        std::atomic<bool> following{config_.master.enable_failover_restore};
+        std::unique_ptr<MetadataFollower> follower;
+        std::thread follow_thread;
+        if (config_.master.enable_failover_restore) {
+            follow_thread = std::thread([this, &following, &follower]() {
+                FollowLeader(following, follower);
+            });
+        }
         ViewVersionId version = 0;
         EtcdLeaseId lease_id = 0;
-        mv_helper.ElectLeader(local_hostname_, version, lease_id);
+        mv_helper.ElectLeader(local_hostname_, version, lease_id,
+                              MasterViewKey(partition_id_, partition_num_));
 
         // Start a thread to keep the leader alive
         auto keep_leader_thread =
@@ -150,13 +296,32 @@ int MasterServiceSupervisor::Start() {
         const int waiting_time = ETCD_MASTER_VIEW_LEASE_TTL;
         std::this_thread::sleep_for(std::chrono::seconds(waiting_time));
 
+        std::optional<std::vector<MetadataEntry>> restored;
+        if (follow_thread.joinable()) {
+            following = false;
+            follow_thread.join();
+        }
+        if (follower) {
+            follower->Stop();
+            restored = follower->Export(MasterService::kRestoreFreeDelay);
+            follower.reset();
+        }
+
         LOG(INFO) << "Starting master service...";
-        bool enable_ha = true;
-        mooncake::WrappedMasterService wrapped_master_service(
-            enable_gc_, default_kv_lease_ttl_, default_kv_soft_pin_ttl_,
-            allow_evict_soft_pinned_objects_, enable_metric_reporting_,
-            metrics_port_, eviction_ratio_, eviction_high_watermark_ratio_,
-            version, client_live_ttl_sec_, enable_ha, cluster_id_);
+        WrappedMasterServiceConfig config = config_;
+        config.master.view_version = version;
+        mooncake::WrappedMasterService wrapped_master_service(config);
+        if (admission_config_.enabled()) {
+            wrapped_master_service.EnableAdmissionControl(admission_config_);
+        }
+        if (restored) {
+            auto restore_result =
+                wrapped_master_service.RestoreMetadata(std::move(*restored));
+            if (!restore_result) {
+                LOG(ERROR) << "Failed to restore metadata: "
+                           << restore_result.error();
+            }
+        }
         mooncake::RegisterRpcService(server, wrapped_master_service);
         // Metric reporting is now handled by WrappedMasterService.
 
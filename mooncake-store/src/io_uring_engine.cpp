@@ -0,0 +1,351 @@
+#include "io_uring_engine.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+namespace mooncake {
+
+namespace {
+
+int SysSetup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int SysRegister(int ring_fd, unsigned opcode, const void* arg,
+                unsigned nr_args) {
+    return static_cast<int>(
+        syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args));
+}
+
+size_t AlignUp(size_t value) {
+    return (value + IoUringEngine::kAlignment - 1) &
+           ~(IoUringEngine::kAlignment - 1);
+}
+
+// Copy between the bytes [offset, offset + len) of the iov and buf
+void CopyIov(const iovec* iov, int iovcnt, uint64_t offset, char* buf,
+             size_t len, bool to_iov) {
+    for (int i = 0; i < iovcnt && len > 0; ++i) {
+        if (offset >= iov[i].iov_len) {
+            offset -= iov[i].iov_len;
+            continue;
+        }
+        const size_t n = std::min(len, iov[i].iov_len - offset);
+        char* base = static_cast<char*>(iov[i].iov_base) + offset;
+        if (to_iov) {
+            std::memcpy(base, buf, n);
+        } else {
+            std::memcpy(buf, base, n);
+        }
+        buf += n;
+        len -= n;
+        offset = 0;
+    }
+}
+
+}  // namespace
+
+std::unique_ptr<IoUringEngine> IoUringEngine::Create(unsigned queue_depth) {
+    if (queue_depth == 0) {
+        return nullptr;
+    }
+    std::unique_ptr<IoUringEngine> engine(new IoUringEngine());
+
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    engine->ring_fd_ = SysSetup(queue_depth, &params);
+    if (engine->ring_fd_ < 0) {
+        PLOG(WARNING) << "io_uring_setup failed, queue_depth=" << queue_depth;
+        return nullptr;
+    }
+    // The kernel rounds the depth up to a power of two
+    engine->depth_ = std::min(params.sq_entries, params.cq_entries);
+
+    engine->sq_ring_size_ =
+        params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    engine->cq_ring_size_ =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    engine->sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+
+    void* sq_ring = mmap(nullptr, engine->sq_ring_size_,
+                         PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         engine->ring_fd_, IORING_OFF_SQ_RING);
+    void* cq_ring = mmap(nullptr, engine->cq_ring_size_,
+                         PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         engine->ring_fd_, IORING_OFF_CQ_RING);
+    void* sqes = mmap(nullptr, engine->sqes_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, engine->ring_fd_,
+                      IORING_OFF_SQES);
+    engine->sq_ring_ = sq_ring == MAP_FAILED ? nullptr : sq_ring;
+    engine->cq_ring_ = cq_ring == MAP_FAILED ? nullptr : cq_ring;
+    engine->sqes_ = sqes == MAP_FAILED ? nullptr
+                                       : static_cast<io_uring_sqe*>(sqes);
+    if (!engine->sq_ring_ || !engine->cq_ring_ || !engine->sqes_) {
+        PLOG(WARNING) << "Failed to map io_uring rings";
+        return nullptr;
+    }
+
+    auto* sq = static_cast<char*>(engine->sq_ring_);
+    engine->sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    engine->sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    engine->sq_mask_ =
+        *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    engine->sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    auto* cq = static_cast<char*>(engine->cq_ring_);
+    engine->cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    engine->cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    engine->cq_mask_ =
+        *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    engine->cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    const size_t staging_size = engine->depth_ * kChunkSize;
+    engine->staging_ =
+        static_cast<char*>(std::aligned_alloc(kAlignment, staging_size));
+    if (!engine->staging_) {
+        LOG(WARNING) << "Failed to allocate io_uring staging buffer, size="
+                     << staging_size;
+        return nullptr;
+    }
+    iovec staging_iov{engine->staging_, staging_size};
+    engine->buffers_registered_ =
+        SysRegister(engine->ring_fd_, IORING_REGISTER_BUFFERS, &staging_iov,
+                    1) == 0;
+    if (!engine->buffers_registered_) {
+        // Usually RLIMIT_MEMLOCK, the staging buffer works unregistered
+        PLOG(INFO) << "io_uring buffer registration failed";
+    }
+
+    engine->slots_.resize(engine->depth_);
+    engine->slot_iovs_.resize(engine->depth_);
+    for (unsigned i = 0; i < engine->depth_; ++i) {
+        engine->slot_iovs_[i].iov_base = engine->staging_ + i * kChunkSize;
+    }
+    VLOG(1) << "io_uring engine created, queue_depth=" << engine->depth_
+            << ", registered_buffers=" << engine->buffers_registered_;
+    return engine;
+}
+
+IoUringEngine::~IoUringEngine() {
+    // Closing the ring waits for requests still in flight
+    if (ring_fd_ >= 0) {
+        close(ring_fd_);
+    }
+    if (sqes_) {
+        munmap(sqes_, sqes_size_);
+    }
+    if (cq_ring_) {
+        munmap(cq_ring_, cq_ring_size_);
+    }
+    if (sq_ring_) {
+        munmap(sq_ring_, sq_ring_size_);
+    }
+    std::free(staging_);
+}
+
+ssize_t IoUringEngine::Read(int fd, const iovec* iov, int iovcnt,
+                            uint64_t offset) {
+    return Transfer(fd, iov, iovcnt, offset, false);
+}
+
+ssize_t IoUringEngine::Write(int fd, const iovec* iov, int iovcnt) {
+    const ssize_t total = Transfer(fd, iov, iovcnt, 0, true);
+    const bool padded = total >= 0 &&
+                        AlignUp(static_cast<size_t>(total)) !=
+                            static_cast<size_t>(total) &&
+                        (fcntl(fd, F_GETFL) & O_DIRECT) != 0;
+    if (padded && ftruncate(fd, total) != 0) {
+        PLOG(ERROR) << "Failed to truncate padded file to " << total;
+        return -1;
+    }
+    return total;
+}
+
+ssize_t IoUringEngine::WriteAt(int fd, const iovec* iov, int iovcnt,
+                               uint64_t offset) {
+    return Transfer(fd, iov, iovcnt, offset, true);
+}
+
+bool IoUringEngine::SetFile(int fd) {
+    if (files_unsupported_) {
+        return false;
+    }
+    int ret;
+    if (!files_registered_) {
+        ret = SysRegister(ring_fd_, IORING_REGISTER_FILES, &fd, 1);
+    } else {
+        io_uring_files_update update;
+        std::memset(&update, 0, sizeof(update));
+        update.fds = reinterpret_cast<uint64_t>(&fd);
+        ret = SysRegister(ring_fd_, IORING_REGISTER_FILES_UPDATE, &update, 1);
+        ret = ret == 1 ? 0 : -1;
+    }
+    if (ret != 0) {
+        VLOG(1) << "io_uring file registration unsupported, errno=" << errno;
+        files_unsupported_ = true;
+        return false;
+    }
+    files_registered_ = true;
+    return true;
+}
+
+int IoUringEngine::Enter(unsigned to_submit, unsigned min_complete) {
+    while (true) {
+        int ret = static_cast<int>(
+            syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete,
+                    min_complete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+        if (ret >= 0 || errno != EINTR) {
+            return ret;
+        }
+        // Interrupted after the submission was consumed, only wait again
+        to_submit = 0;
+    }
+}
+
+ssize_t IoUringEngine::Transfer(int fd, const iovec* iov, int iovcnt,
+                                uint64_t file_offset, bool write) {
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+        total += iov[i].iov_len;
+    }
+    const bool direct = (fcntl(fd, F_GETFL) & O_DIRECT) != 0;
+    const bool fixed_file = SetFile(fd);
+
+    std::vector<unsigned> free_slots(depth_);
+    for (unsigned i = 0; i < depth_; ++i) {
+        free_slots[i] = depth_ - 1 - i;
+    }
+    uint64_t next = 0;
+    unsigned inflight = 0;
+    bool failed = false;
+
+    while ((next < total && !failed) || inflight > 0) {
+        unsigned to_submit = 0;
+        unsigned tail = *sq_tail_;
+        while (!failed && next < total && !free_slots.empty()) {
+            const unsigned slot_id = free_slots.back();
+            free_slots.pop_back();
+            Slot& slot = slots_[slot_id];
+            char* buf = static_cast<char*>(slot_iovs_[slot_id].iov_base);
+            slot.offset = next;
+            slot.len = std::min<size_t>(kChunkSize, total - next);
+            // O_DIRECT needs aligned lengths, reads past the end are short
+            slot.io_len = direct || !write ? AlignUp(slot.len) : slot.len;
+            if (write) {
+                CopyIov(iov, iovcnt, slot.offset, buf, slot.len, false);
+                std::memset(buf + slot.len, 0, slot.io_len - slot.len);
+            }
+            slot_iovs_[slot_id].iov_len = slot.io_len;
+
+            const unsigned index = tail & sq_mask_;
+            io_uring_sqe* sqe = &sqes_[index];
+            std::memset(sqe, 0, sizeof(*sqe));
+            if (buffers_registered_) {
+                sqe->opcode =
+                    write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+                sqe->addr = reinterpret_cast<uint64_t>(buf);
+                sqe->len = slot.io_len;
+                sqe->buf_index = 0;
+            } else {
+                sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+                sqe->addr = reinterpret_cast<uint64_t>(&slot_iovs_[slot_id]);
+                sqe->len = 1;
+            }
+            sqe->fd = fixed_file ? 0 : fd;
+            sqe->flags = fixed_file ? IOSQE_FIXED_FILE : 0;
+            sqe->off = file_offset + slot.offset;
+            sqe->user_data = slot_id;
+            sq_array_[index] = index;
+            ++tail;
+            ++to_submit;
+            ++inflight;
+            next += slot.len;
+        }
+        __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+        if (Enter(to_submit, inflight > 0 ? 1 : 0) < 0) {
+            PLOG(ERROR) << "io_uring_enter failed";
+            // Requests may still be in flight, the ring cannot be reused
+            close(ring_fd_);
+            ring_fd_ = -1;
+            return -1;
+        }
+
+        unsigned head = *cq_head_;
+        const unsigned cq_tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        for (; head != cq_tail; ++head) {
+            const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+            const auto slot_id = static_cast<unsigned>(cqe.user_data);
+            const Slot& slot = slots_[slot_id];
+            if (cqe.res < 0) {
+                LOG(ERROR) << "io_uring " << (write ? "write" : "read")
+                           << " failed at offset "
+                           << file_offset + slot.offset
+                           << ", error: " << std::strerror(-cqe.res);
+                failed = true;
+            } else if (static_cast<size_t>(cqe.res) <
+                       (write ? slot.io_len : slot.len)) {
+                LOG(ERROR) << "io_uring short " << (write ? "write" : "read")
+                           << " at offset " << file_offset + slot.offset
+                           << ", expected: "
+                           << slot.len << ", got: " << cqe.res;
+                failed = true;
+            } else if (!write) {
+                CopyIov(iov, iovcnt, slot.offset,
+                        static_cast<char*>(slot_iovs_[slot_id].iov_base),
+                        slot.len, true);
+            }
+            free_slots.push_back(slot_id);
+            --inflight;
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+
+    // Do not keep the file open through the table
+    if (fixed_file) {
+        SetFile(-1);
+    }
+    return failed ? -1 : static_cast<ssize_t>(total);
+}
+
+
+IoUringEnginePool::IoUringEnginePool(unsigned queue_depth)
+    : queue_depth_(queue_depth) {}
+
+std::unique_ptr<IoUringEngine> IoUringEnginePool::Acquire() {
+    if (queue_depth_ == 0 || unavailable_.load()) {
+        return nullptr;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!idle_.empty()) {
+            auto engine = std::move(idle_.back());
+            idle_.pop_back();
+            return engine;
+        }
+    }
+    auto engine = IoUringEngine::Create(queue_depth_);
+    if (!engine) {
+        LOG(WARNING) << "io_uring is not available, falling back to "
+                        "buffered I/O";
+        unavailable_.store(true);
+    }
+    return engine;
+}
+
+void IoUringEnginePool::Release(std::unique_ptr<IoUringEngine> engine) {
+    if (!engine->ok()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.push_back(std::move(engine));
+}
+
+}  // namespace mooncake
@@ -0,0 +1,80 @@
+#include "key_filter.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace mooncake {
+
+namespace {
+
+constexpr uint32_t kMaxHashes = 16;
+
+// FNV-1a, std::hash may differ between the standard libraries of clients
+uint64_t HashKey(std::string_view key) {
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// The finalizer of splitmix64, spreads the FNV bits over the whole word
+uint64_t Mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+}  // namespace
+
+KeyFilter::KeyFilter(size_t expected_keys, uint32_t bits_per_key)
+    : words_((std::max<size_t>(expected_keys, 1) *
+                  std::max<uint32_t>(bits_per_key, 1) +
+              63) /
+             64),
+      // k = ln(2) * bits per key minimizes the false positives
+      num_hashes_(std::clamp<uint32_t>(
+          static_cast<uint32_t>(std::lround(bits_per_key * 0.69)), 1,
+          kMaxHashes)) {}
+
+KeyFilter::KeyFilter(std::vector<uint64_t> words, uint32_t num_hashes)
+    : words_(std::move(words)),
+      num_hashes_(std::clamp<uint32_t>(num_hashes, 1, kMaxHashes)) {}
+
+void KeyFilter::Add(std::string_view key) {
+    if (words_.empty()) {
+        return;
+    }
+    const uint64_t bits = words_.size() * 64;
+    const uint64_t hash = HashKey(key);
+    const uint64_t h1 = Mix(hash);
+    const uint64_t h2 = Mix(h1 ^ hash) | 1;
+    for (uint32_t i = 0; i < num_hashes_; ++i) {
+        const uint64_t bit = (h1 + i * h2) % bits;
+        words_[bit / 64] |= 1ull << (bit % 64);
+    }
+}
+
+bool KeyFilter::MayContain(std::string_view key) const {
+    if (words_.empty()) {
+        // Nothing is known about an empty filter
+        return true;
+    }
+    const uint64_t bits = words_.size() * 64;
+    const uint64_t hash = HashKey(key);
+    const uint64_t h1 = Mix(hash);
+    const uint64_t h2 = Mix(h1 ^ hash) | 1;
+    for (uint32_t i = 0; i < num_hashes_; ++i) {
+        const uint64_t bit = (h1 + i * h2) % bits;
+        if (!(words_[bit / 64] & (1ull << (bit % 64)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace mooncake
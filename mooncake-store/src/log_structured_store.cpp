@@ -0,0 +1,777 @@
+#include "log_structured_store.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+
+namespace mooncake {
+
+namespace {
+
+constexpr uint32_t kIndexMagic = 0x534c434d;  // "MCLS"
+constexpr uint64_t kAlignment = IoUringEngine::kAlignment;
+constexpr auto kCompactionInterval = std::chrono::seconds(10);
+
+// Fills the gaps between objects written together by BatchPut
+alignas(kAlignment) char kZeroPadding[kAlignment];
+
+// Followed by key_size bytes of key
+struct IndexRecord {
+    uint32_t magic;
+    uint32_t key_size;
+    uint64_t offset;
+    uint64_t length;
+    uint8_t deleted;
+    uint8_t reserved[7];
+};
+static_assert(sizeof(IndexRecord) == 32, "IndexRecord is stored on disk");
+
+uint64_t AlignUp(uint64_t value) {
+    return (value + kAlignment - 1) & ~(kAlignment - 1);
+}
+
+uint64_t TotalSize(const std::vector<iovec>& iovs) {
+    uint64_t total = 0;
+    for (const auto& iov : iovs) {
+        total += iov.iov_len;
+    }
+    return total;
+}
+
+std::string SegmentPath(const std::string& dir, uint64_t id,
+                        const char* extension) {
+    char name[32];
+    snprintf(name, sizeof(name), "%010lu%s", static_cast<unsigned long>(id),
+             extension);
+    return (std::filesystem::path(dir) / name).string();
+}
+
+bool PwriteAll(int fd, const char* data, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t ret = pwrite(fd, data, len, offset);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return false;
+        }
+        data += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return true;
+}
+
+bool PreadAll(int fd, char* data, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t ret = pread(fd, data, len, offset);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return false;
+        }
+        data += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return true;
+}
+
+struct AlignedFree {
+    void operator()(char* ptr) const { std::free(ptr); }
+};
+
+}  // namespace
+
+LogStructuredStore::Segment::~Segment() {
+    if (data_fd >= 0) {
+        close(data_fd);
+    }
+    if (index_fd >= 0) {
+        close(index_fd);
+    }
+}
+
+LogStructuredStore::LogStructuredStore(
+    std::string dir, std::shared_ptr<IoUringEnginePool> uring_pool,
+    uint64_t segment_size, double compaction_ratio)
+    : dir_(std::move(dir)),
+      uring_pool_(std::move(uring_pool)),
+      segment_size_(AlignUp(std::max<uint64_t>(segment_size, 1))),
+      compaction_ratio_(compaction_ratio) {}
+
+std::unique_ptr<LogStructuredStore> LogStructuredStore::Open(
+    const std::string& dir, std::shared_ptr<IoUringEnginePool> uring_pool,
+    uint64_t segment_size, double compaction_ratio) {
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    if (ec) {
+        LOG(ERROR) << "Failed to create log directory: " << dir
+                   << ", error: " << ec.message();
+        return nullptr;
+    }
+    std::unique_ptr<LogStructuredStore> store(new LogStructuredStore(
+        dir, std::move(uring_pool), segment_size, compaction_ratio));
+    if (!store->Recover()) {
+        return nullptr;
+    }
+    store->compaction_thread_ =
+        std::thread(&LogStructuredStore::CompactionThread, store.get());
+    return store;
+}
+
+LogStructuredStore::~LogStructuredStore() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    compaction_cv_.notify_all();
+    if (compaction_thread_.joinable()) {
+        compaction_thread_.join();
+    }
+}
+
+bool LogStructuredStore::Recover() {
+    namespace fs = std::filesystem;
+    std::vector<uint64_t> ids;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(dir_, ec)) {
+        const auto& path = entry.path();
+        char* end = nullptr;
+        const std::string stem = path.stem().string();
+        uint64_t id = std::strtoull(stem.c_str(), &end, 10);
+        if (stem.empty() || *end != '\0') {
+            continue;
+        }
+        if (path.extension() == ".idx") {
+            ids.push_back(id);
+        } else if (path.extension() == ".log" &&
+                   !fs::exists(SegmentPath(dir_, id, ".idx"))) {
+            // Created just before a crash, it holds no indexed object
+            fs::remove(path, ec);
+        }
+    }
+    if (ec) {
+        LOG(ERROR) << "Failed to list log directory: " << dir_
+                   << ", error: " << ec.message();
+        return false;
+    }
+    std::sort(ids.begin(), ids.end());
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (uint64_t id : ids) {
+        if (!LoadSegment(id)) {
+            return false;
+        }
+        next_segment_id_ = id + 1;
+    }
+    if (!segments_.empty()) {
+        auto& last = segments_.rbegin()->second;
+        if (last->write_offset < last->capacity) {
+            active_ = last;
+        }
+    }
+    LOG(INFO) << "Recovered log structured store at " << dir_ << ", objects="
+              << index_.size() << ", segments=" << segments_.size();
+    return true;
+}
+
+bool LogStructuredStore::LoadSegment(uint64_t id) {
+    auto segment = OpenSegment(id, 0, false);
+    if (!segment) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(segment->index_fd, &st) != 0) {
+        PLOG(ERROR) << "Failed to stat " << segment->index_path;
+        return false;
+    }
+    std::vector<char> records(st.st_size);
+    if (!PreadAll(segment->index_fd, records.data(), records.size(), 0)) {
+        PLOG(ERROR) << "Failed to read " << segment->index_path;
+        return false;
+    }
+    segments_[id] = segment;
+
+    uint64_t pos = 0;
+    while (pos + sizeof(IndexRecord) <= records.size()) {
+        IndexRecord record;
+        std::memcpy(&record, records.data() + pos, sizeof(record));
+        const uint64_t record_size = sizeof(record) + record.key_size;
+        if (record.magic != kIndexMagic ||
+            pos + record_size > records.size()) {
+            break;
+        }
+        std::string key(records.data() + pos + sizeof(record),
+                        record.key_size);
+        const uint64_t aligned = AlignUp(record.length);
+        segment->write_offset =
+            std::max(segment->write_offset, record.offset + aligned);
+        if (record.deleted || record.offset + aligned > segment->capacity) {
+            segment->dead_bytes += aligned;
+        } else {
+            // Left behind by a compaction, the later copy wins
+            auto it = index_.find(key);
+            if (it != index_.end()) {
+                Item old = it->second;
+                index_.erase(it);
+                Release(old);
+            }
+            index_[key] = {segment, record.offset, record.length, pos};
+            segment->live_bytes += aligned;
+        }
+        pos += record_size;
+    }
+    segment->index_size = pos;
+    if (pos < records.size() && ftruncate(segment->index_fd, pos) != 0) {
+        PLOG(WARNING) << "Failed to drop torn index records of "
+                      << segment->index_path;
+    }
+    if (segment->live_bytes == 0) {
+        DropSegment(segment);
+    }
+    return true;
+}
+
+std::shared_ptr<LogStructuredStore::Segment> LogStructuredStore::OpenSegment(
+    uint64_t id, uint64_t capacity, bool create) {
+    auto segment = std::make_shared<Segment>();
+    segment->id = id;
+    segment->data_path = SegmentPath(dir_, id, ".log");
+    segment->index_path = SegmentPath(dir_, id, ".idx");
+
+    const int flags = O_RDWR | (create ? O_CREAT | O_EXCL : 0);
+    // Create the data file first, a data file without index is dropped
+    segment->data_fd = open(segment->data_path.c_str(), flags | O_DIRECT, 0644);
+    segment->direct = segment->data_fd >= 0;
+    if (segment->data_fd < 0 && errno == EINVAL) {
+        segment->data_fd = open(segment->data_path.c_str(), flags, 0644);
+    }
+    if (segment->data_fd < 0) {
+        PLOG(ERROR) << "Failed to open " << segment->data_path;
+        return nullptr;
+    }
+    if (create) {
+        if (fallocate(segment->data_fd, 0, 0, capacity) != 0 &&
+            ftruncate(segment->data_fd, capacity) != 0) {
+            PLOG(ERROR) << "Failed to preallocate " << segment->data_path;
+            unlink(segment->data_path.c_str());
+            return nullptr;
+        }
+        segment->capacity = capacity;
+    } else {
+        struct stat st;
+        if (fstat(segment->data_fd, &st) != 0) {
+            PLOG(ERROR) << "Failed to stat " << segment->data_path;
+            return nullptr;
+        }
+        segment->capacity = st.st_size;
+    }
+
+    segment->index_fd = open(segment->index_path.c_str(), flags, 0644);
+    if (segment->index_fd < 0) {
+        PLOG(ERROR) << "Failed to open " << segment->index_path;
+        if (create) {
+            unlink(segment->data_path.c_str());
+        }
+        return nullptr;
+    }
+    return segment;
+}
+
+std::shared_ptr<LogStructuredStore::Segment> LogStructuredStore::Reserve(
+    uint64_t length, uint64_t& offset) {
+    const uint64_t aligned = AlignUp(length);
+    if (!active_ || active_->write_offset + aligned > active_->capacity) {
+        auto segment = OpenSegment(next_segment_id_,
+                                   std::max(segment_size_, aligned), true);
+        if (!segment) {
+            return nullptr;
+        }
+        ++next_segment_id_;
+        segments_[segment->id] = segment;
+        active_ = segment;
+        // The sealed segment may be ready for compaction
+        compaction_cv_.notify_one();
+    }
+    offset = active_->write_offset;
+    active_->write_offset += aligned;
+    active_->pending++;
+    return active_;
+}
+
+bool LogStructuredStore::Commit(const ObjectKey& key,
+                                const std::shared_ptr<Segment>& segment,
+                                uint64_t offset, uint64_t length) {
+    segment->pending--;
+    if (segment->removed) {
+        return false;
+    }
+    IndexRecord record;
+    std::memset(&record, 0, sizeof(record));
+    record.magic = kIndexMagic;
+    record.key_size = static_cast<uint32_t>(key.size());
+    record.offset = offset;
+    record.length = length;
+    std::string buf(reinterpret_cast<const char*>(&record), sizeof(record));
+    buf.append(key);
+    if (!PwriteAll(segment->index_fd, buf.data(), buf.size(),
+                   segment->index_size)) {
+        PLOG(ERROR) << "Failed to append to " << segment->index_path;
+        segment->dead_bytes += AlignUp(length);
+        return false;
+    }
+    index_[key] = {segment, offset, length, segment->index_size};
+    segment->index_size += buf.size();
+    segment->live_bytes += AlignUp(length);
+    return true;
+}
+
+void LogStructuredStore::Release(const Item& item) {
+    const auto& segment = item.segment;
+    const uint64_t aligned = AlignUp(item.length);
+    segment->live_bytes -= aligned;
+    segment->dead_bytes += aligned;
+    const uint8_t deleted = 1;
+    if (!segment->removed &&
+        !PwriteAll(segment->index_fd, reinterpret_cast<const char*>(&deleted),
+                   1, item.index_pos + offsetof(IndexRecord, deleted))) {
+        PLOG(WARNING) << "Failed to mark object removed in "
+                      << segment->index_path;
+    }
+    if (segment == active_ || segment->removed || segment->pending > 0) {
+        return;
+    }
+    if (segment->live_bytes == 0) {
+        DropSegment(segment);
+    } else if (segment->dead_bytes >=
+               compaction_ratio_ *
+                   (segment->live_bytes + segment->dead_bytes)) {
+        compaction_cv_.notify_one();
+    }
+}
+
+void LogStructuredStore::DropSegment(std::shared_ptr<Segment> segment) {
+    // Readers still holding the segment keep its files open
+    segment->removed = true;
+    unlink(segment->index_path.c_str());
+    unlink(segment->data_path.c_str());
+    segments_.erase(segment->id);
+    if (active_ == segment) {
+        active_.reset();
+    }
+}
+
+ssize_t LogStructuredStore::WriteData(const Segment& segment,
+                                      const std::vector<iovec>& iovs,
+                                      uint64_t offset) {
+    if (auto engine = uring_pool_->Acquire()) {
+        ssize_t ret = engine->WriteAt(segment.data_fd, iovs.data(),
+                                      static_cast<int>(iovs.size()), offset);
+        uring_pool_->Release(std::move(engine));
+        return ret;
+    }
+    const uint64_t total = TotalSize(iovs);
+    if (!segment.direct) {
+        for (const auto& iov : iovs) {
+            if (!PwriteAll(segment.data_fd,
+                           static_cast<const char*>(iov.iov_base),
+                           iov.iov_len, offset)) {
+                return -1;
+            }
+            offset += iov.iov_len;
+        }
+        return total;
+    }
+    // O_DIRECT needs an aligned buffer
+    std::unique_ptr<char, AlignedFree> buf(static_cast<char*>(
+        std::aligned_alloc(kAlignment, std::max(AlignUp(total), kAlignment))));
+    if (!buf) {
+        return -1;
+    }
+    char* ptr = buf.get();
+    for (const auto& iov : iovs) {
+        std::memcpy(ptr, iov.iov_base, iov.iov_len);
+        ptr += iov.iov_len;
+    }
+    std::memset(ptr, 0, AlignUp(total) - total);
+    return PwriteAll(segment.data_fd, buf.get(), AlignUp(total), offset)
+               ? static_cast<ssize_t>(total)
+               : -1;
+}
+
+ssize_t LogStructuredStore::ReadData(const Segment& segment,
+                                     const std::vector<iovec>& iovs,
+                                     uint64_t offset) {
+    if (auto engine = uring_pool_->Acquire()) {
+        ssize_t ret = engine->Read(segment.data_fd, iovs.data(),
+                                   static_cast<int>(iovs.size()), offset);
+        uring_pool_->Release(std::move(engine));
+        return ret;
+    }
+    const uint64_t total = TotalSize(iovs);
+    if (!segment.direct) {
+        for (const auto& iov : iovs) {
+            if (!PreadAll(segment.data_fd, static_cast<char*>(iov.iov_base),
+                          iov.iov_len, offset)) {
+                return -1;
+            }
+            offset += iov.iov_len;
+        }
+        return total;
+    }
+    std::unique_ptr<char, AlignedFree> buf(static_cast<char*>(
+        std::aligned_alloc(kAlignment, std::max(AlignUp(total), kAlignment))));
+    if (!buf ||
+        !PreadAll(segment.data_fd, buf.get(), AlignUp(total), offset)) {
+        return -1;
+    }
+    const char* ptr = buf.get();
+    for (const auto& iov : iovs) {
+        std::memcpy(iov.iov_base, ptr, iov.iov_len);
+        ptr += iov.iov_len;
+    }
+    return total;
+}
+
+ErrorCode LogStructuredStore::Put(const ObjectKey& key,
+                                  const std::vector<iovec>& iovs) {
+    const uint64_t total = TotalSize(iovs);
+    std::shared_ptr<Segment> segment;
+    uint64_t offset = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (index_.count(key) || writing_.count(key)) {
+            return ErrorCode::FILE_OPEN_FAIL;
+        }
+        segment = Reserve(total, offset);
+        if (!segment) {
+            return ErrorCode::FILE_OPEN_FAIL;
+        }
+        writing_.insert(key);
+    }
+
+    ssize_t ret = WriteData(*segment, iovs, offset);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    writing_.erase(key);
+    if (ret != static_cast<ssize_t>(total)) {
+        LOG(ERROR) << "Failed to write object " << key << " to "
+                   << segment->data_path;
+        segment->pending--;
+        segment->dead_bytes += AlignUp(total);
+        return ErrorCode::FILE_WRITE_FAIL;
+    }
+    if (!Commit(key, segment, offset, total)) {
+        return ErrorCode::FILE_WRITE_FAIL;
+    }
+    return ErrorCode::OK;
+}
+
+std::vector<ErrorCode> LogStructuredStore::BatchPut(
+    const std::vector<ObjectKey>& keys,
+    const std::vector<std::vector<iovec>>& values) {
+    struct Reservation {
+        std::shared_ptr<Segment> segment;
+        uint64_t offset = 0;
+        uint64_t length = 0;
+    };
+    std::vector<ErrorCode> results(keys.size(), ErrorCode::OK);
+    std::vector<Reservation> reservations(keys.size());
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < keys.size(); ++i) {
+            auto& reservation = reservations[i];
+            if (index_.count(keys[i]) || writing_.count(keys[i])) {
+                results[i] = ErrorCode::FILE_OPEN_FAIL;
+                continue;
+            }
+            reservation.length = TotalSize(values[i]);
+            reservation.segment = Reserve(reservation.length,
+                                          reservation.offset);
+            if (!reservation.segment) {
+                results[i] = ErrorCode::FILE_OPEN_FAIL;
+                continue;
+            }
+            writing_.insert(keys[i]);
+        }
+    }
+
+    // Reservations made in a row are contiguous unless the active segment
+    // rolled over, so write each run of them at once
+    std::vector<bool> written(keys.size(), false);
+    size_t begin = 0;
+    while (begin < keys.size()) {
+        if (!reservations[begin].segment) {
+            ++begin;
+            continue;
+        }
+        const auto& segment = reservations[begin].segment;
+        std::vector<iovec> iovs;
+        uint64_t run_total = 0;
+        uint64_t next_offset = reservations[begin].offset;
+        size_t end = begin;
+        for (; end < keys.size(); ++end) {
+            const auto& reservation = reservations[end];
+            if (!reservation.segment) {
+                continue;
+            }
+            if (reservation.segment != segment ||
+                reservation.offset != next_offset) {
+                break;
+            }
+            if (run_total > 0) {
+                // Pad the previous object to the alignment
+                const uint64_t padding = AlignUp(run_total) - run_total;
+                if (padding > 0) {
+                    iovs.push_back({kZeroPadding, padding});
+                    run_total += padding;
+                }
+            }
+            iovs.insert(iovs.end(), values[end].begin(), values[end].end());
+            run_total += reservation.length;
+            next_offset = reservation.offset + AlignUp(reservation.length);
+        }
+        const bool ok =
+            WriteData(*segment, iovs, reservations[begin].offset) ==
+            static_cast<ssize_t>(run_total);
+        if (!ok) {
+            LOG(ERROR) << "Failed to write " << end - begin
+                       << " objects to " << segment->data_path;
+        }
+        for (size_t i = begin; i < end; ++i) {
+            written[i] = ok && reservations[i].segment;
+        }
+        begin = end;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        const auto& reservation = reservations[i];
+        if (!reservation.segment) {
+            continue;
+        }
+        writing_.erase(keys[i]);
+        if (!written[i]) {
+            reservation.segment->pending--;
+            reservation.segment->dead_bytes += AlignUp(reservation.length);
+            results[i] = ErrorCode::FILE_WRITE_FAIL;
+        } else if (!Commit(keys[i], reservation.segment, reservation.offset,
+                           reservation.length)) {
+            results[i] = ErrorCode::FILE_WRITE_FAIL;
+        }
+    }
+    return results;
+}
+
+ErrorCode LogStructuredStore::Get(const ObjectKey& key,
+                                  std::vector<Slice>& slices) {
+    Item item;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(key);
+        if (it == index_.end()) {
+            return ErrorCode::FILE_NOT_FOUND;
+        }
+        item = it->second;
+    }
+    std::vector<iovec> iovs;
+    iovs.reserve(slices.size());
+    for (const auto& slice : slices) {
+        iovs.push_back({slice.ptr, slice.size});
+    }
+    const uint64_t total = TotalSize(iovs);
+    if (total > item.length) {
+        LOG(INFO) << "Read size mismatch for: " << key
+                  << ", expected: " << total << ", got: " << item.length;
+        return ErrorCode::FILE_READ_FAIL;
+    }
+    if (ReadData(*item.segment, iovs, item.offset) !=
+        static_cast<ssize_t>(total)) {
+        LOG(INFO) << "Failed to read object " << key << " from "
+                  << item.segment->data_path;
+        return ErrorCode::FILE_READ_FAIL;
+    }
+    return ErrorCode::OK;
+}
+
+ErrorCode LogStructuredStore::Get(const ObjectKey& key, std::string& str) {
+    uint64_t length;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = index_.find(key);
+        if (it == index_.end()) {
+            return ErrorCode::FILE_NOT_FOUND;
+        }
+        length = it->second.length;
+    }
+    str.resize(length);
+    std::vector<Slice> slices{{str.data(), length}};
+    return Get(key, slices);
+}
+
+std::optional<LogStructuredStore::Location> LogStructuredStore::Query(
+    const ObjectKey& key) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+        return std::nullopt;
+    }
+    return Location{it->second.segment->data_path, it->second.offset,
+                    it->second.length};
+}
+
+std::vector<std::pair<ObjectKey, LogStructuredStore::Location>>
+LogStructuredStore::List() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::pair<ObjectKey, Location>> objects;
+    objects.reserve(index_.size());
+    for (const auto& [key, item] : index_) {
+        objects.emplace_back(
+            key, Location{item.segment->data_path, item.offset, item.length});
+    }
+    return objects;
+}
+
+void LogStructuredStore::Remove(const ObjectKey& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+        return;
+    }
+    Item item = std::move(it->second);
+    index_.erase(it);
+    Release(item);
+}
+
+void LogStructuredStore::RemoveAll() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    index_.clear();
+    while (!segments_.empty()) {
+        DropSegment(segments_.begin()->second);
+    }
+}
+
+size_t LogStructuredStore::SegmentCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return segments_.size();
+}
+
+size_t LogStructuredStore::Compact() {
+    std::vector<std::shared_ptr<Segment>> candidates;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& [id, segment] : segments_) {
+            const uint64_t written = segment->live_bytes + segment->dead_bytes;
+            if (segment != active_ && segment->pending == 0 && written > 0 &&
+                segment->dead_bytes >= compaction_ratio_ * written) {
+                candidates.push_back(segment);
+            }
+        }
+    }
+    size_t dropped = 0;
+    for (const auto& segment : candidates) {
+        if (CompactSegment(segment)) {
+            ++dropped;
+        }
+    }
+    if (dropped > 0) {
+        LOG(INFO) << "Compacted " << dropped << " log segments in " << dir_;
+    }
+    return dropped;
+}
+
+bool LogStructuredStore::CompactSegment(
+    const std::shared_ptr<Segment>& segment) {
+    std::vector<std::pair<std::string, Item>> items;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (segment->removed) {
+            return false;
+        }
+        for (const auto& [key, item] : index_) {
+            if (item.segment == segment) {
+                items.emplace_back(key, item);
+            }
+        }
+    }
+
+    for (const auto& [key, item] : items) {
+        std::vector<char> buf(item.length);
+        std::vector<iovec> iovs{{buf.data(), buf.size()}};
+        if (ReadData(*segment, iovs, item.offset) !=
+            static_cast<ssize_t>(item.length)) {
+            LOG(ERROR) << "Failed to read object " << key
+                       << " for compaction from " << segment->data_path;
+            return false;
+        }
+
+        // Only move objects that were not removed in the meantime
+        auto unchanged = [&, &key = key, &item = item] {
+            auto it = index_.find(key);
+            return it != index_.end() && it->second.segment == segment &&
+                   it->second.offset == item.offset;
+        };
+        std::shared_ptr<Segment> target;
+        uint64_t offset = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!unchanged()) {
+                continue;
+            }
+            target = Reserve(item.length, offset);
+            if (!target) {
+                return false;
+            }
+        }
+
+        ssize_t ret = WriteData(*target, iovs, offset);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (ret != static_cast<ssize_t>(item.length) || !unchanged()) {
+            target->pending--;
+            target->dead_bytes += AlignUp(item.length);
+            if (ret != static_cast<ssize_t>(item.length)) {
+                return false;
+            }
+            continue;
+        }
+        if (!Commit(key, target, offset, item.length)) {
+            return false;
+        }
+        // Drops the segment once its last object has moved
+        Release(item);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!segment->removed && segment->live_bytes == 0 &&
+        segment->pending == 0) {
+        DropSegment(segment);
+    }
+    return segment->removed;
+}
+
+void LogStructuredStore::CompactionThread() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_) {
+        compaction_cv_.wait_for(lock, kCompactionInterval);
+        if (stop_) {
+            break;
+        }
+        lock.unlock();
+        Compact();
+        lock.lock();
+    }
+}
+
+}  // namespace mooncake
@@ -2,6 +2,7 @@
 
 #include <chrono>  // For std::chrono
 #include <thread>  // For std::thread
+#include <unordered_map>
 #include <ylt/coro_rpc/coro_rpc_server.hpp>
 #include <ylt/easylog/record.hpp>
 
@@ -33,6 +34,19 @@ DEFINE_double(eviction_ratio, mooncake::DEFAULT_EVICTION_RATIO,
 DEFINE_double(eviction_high_watermark_ratio,
               mooncake::DEFAULT_EVICTION_HIGH_WATERMARK_RATIO,
               "Ratio of high watermark trigger eviction");
+DEFINE_double(eviction_low_watermark_ratio, 0.0,
+              "Evict ahead of the allocations, keeping room below the high "
+              "watermark for the allocation rate seen lately but evicting no "
+              "further than this ratio; 0 disables it");
+DEFINE_string(eviction_engine, "batch_scan",
+              "Eviction engine: batch_scan (scan all objects), clock "
+              "(per-shard CLOCK sweep, cheaper with many objects), or one of "
+              "the per-shard policies sieve, s3fifo and w_tinylfu");
+DEFINE_string(allocation_strategy, "random",
+              "Segment allocation strategy: random, capacity (prefer segments "
+              "with more free space), load (prefer segments with less "
+              "recent transfer load) or topology (replicas in distinct "
+              "failure domains, near the client)");
 // RPC server configuration parameters (new, preferred)
 // TODO: deprecate port and max_threads in the future
 DEFINE_int32(rpc_thread_num, 0,
@@ -47,6 +61,13 @@ DEFINE_int32(rpc_conn_timeout_seconds, 0,
              "Connection timeout in seconds (0 = no timeout)");
 DEFINE_bool(rpc_enable_tcp_no_delay, true,
             "Enable TCP_NODELAY for RPC connections");
+DEFINE_bool(rpc_enable_rdma, false,
+            "Serve the RPCs over RDMA, for clients setting "
+            "MC_STORE_MASTER_RDMA=1; needs a build with USE_RPC_RDMA");
+DEFINE_int32(rpc_shard_affinity_threads, 0,
+             "Serve the key requests on this many workers split over the "
+             "NUMA nodes, each node owning a range of the metadata shards; "
+             "0 serves them on the RPC threads");
 
 DEFINE_validator(eviction_ratio, [](const char* flagname, double value) {
     if (value < 0.0 || value > 1.0) {
@@ -55,6 +76,119 @@ DEFINE_validator(eviction_ratio, [](const char* flagname, double value) {
     }
     return true;
 });
+static const std::unordered_map<std::string, mooncake::EvictionEngine>
+    kEvictionEngines = {
+        {"batch_scan", mooncake::EvictionEngine::BATCH_SCAN},
+        {"clock", mooncake::EvictionEngine::CLOCK},
+        {"sieve", mooncake::EvictionEngine::SIEVE},
+        {"s3fifo", mooncake::EvictionEngine::S3FIFO},
+        {"w_tinylfu", mooncake::EvictionEngine::W_TINYLFU},
+};
+DEFINE_validator(eviction_engine, [](const char* flagname,
+                                     const std::string& value) {
+    if (!kEvictionEngines.count(value)) {
+        LOG(FATAL) << "Eviction engine must be one of batch_scan, clock, "
+                      "sieve, s3fifo and w_tinylfu";
+        return false;
+    }
+    return true;
+});
+static const std::unordered_map<std::string, mooncake::AllocationStrategyType>
+    kAllocationStrategies = {
+        {"random", mooncake::AllocationStrategyType::RANDOM},
+        {"capacity", mooncake::AllocationStrategyType::CAPACITY_AWARE},
+        {"load", mooncake::AllocationStrategyType::LOAD_AWARE},
+        {"topology", mooncake::AllocationStrategyType::TOPOLOGY_AWARE},
+};
+DEFINE_validator(allocation_strategy, [](const char* flagname,
+                                         const std::string& value) {
+    if (!kAllocationStrategies.count(value)) {
+        LOG(FATAL) << "Allocation strategy must be one of random, capacity, "
+                      "load and topology";
+        return false;
+    }
+    return true;
+});
+DEFINE_string(buffer_allocator, "cachelib",
+              "Allocator of the space of each segment: cachelib (slab "
+              "classes) or offset (OffsetAllocator, less fragmentation for "
+              "objects of varying sizes)");
+static const std::unordered_map<std::string, mooncake::BufferAllocatorType>
+    kBufferAllocatorTypes = {
+        {"cachelib", mooncake::BufferAllocatorType::CACHELIB},
+        {"offset", mooncake::BufferAllocatorType::OFFSET},
+};
+DEFINE_validator(buffer_allocator, [](const char* flagname,
+                                      const std::string& value) {
+    if (!kBufferAllocatorTypes.count(value)) {
+        LOG(FATAL) << "Buffer allocator must be one of cachelib and offset";
+        return false;
+    }
+    return true;
+});
+DEFINE_bool(enable_disk_tier, false,
+            "Demote evicted objects that have a copy in a client's storage "
+            "backend to that disk replica instead of dropping them; reads "
+            "promote them back into memory");
+DEFINE_double(compaction_fragmentation_ratio, 0.0,
+              "Relocate objects out of segments whose free space is more "
+              "fragmented than this ratio (1 - largest free region / free "
+              "space), 0 to disable compaction");
+DEFINE_uint64(hot_replica_read_rate, 0,
+              "Add a memory replica, on another segment, to objects read more "
+              "than this many times a second, up to 2 extra replicas, and "
+              "remove them when the reads drop; done by the clients' "
+              "compaction threads, 0 disables it");
+DEFINE_uint64(drain_rate_mb, 0,
+              "Megabytes per second each drained segment moves to other "
+              "segments before it is unmounted, 0 for no limit");
+DEFINE_uint64(inline_object_max_size, 0,
+              "Keep values of at most this many bytes put by PutInline in the "
+              "metadata and return them with their replica list, 0 disables "
+              "inline objects");
+DEFINE_uint64(stripe_min_size, 0,
+              "Place the slices of objects of at least this many bytes on "
+              "distinct segments, so that their transfers spread over the "
+              "NICs of several hosts, 0 disables striping");
+DEFINE_uint64(persistent_segment_ttl_sec,
+              mooncake::DEFAULT_PERSISTENT_SEGMENT_TTL_SEC,
+              "Seconds the replicas of an unmounted segment backed by "
+              "persistent memory are kept for a restarted client that maps "
+              "the same memory again. Requires --buffer_allocator=offset, "
+              "with cachelib the replicas are dropped on unmount");
+DEFINE_uint64(admission_read_rate, 0,
+              "Keys per second of ExistKey, GetReplicaList and their "
+              "batches served before the others are shed with MASTER_BUSY, "
+              "0 for no limit");
+DEFINE_uint64(admission_write_rate, 0,
+              "Keys per second of PutStart, BatchPutStart, PutInline and "
+              "allocation credits served before the others are shed with "
+              "MASTER_BUSY, 0 for no limit");
+DEFINE_uint64(admission_target_latency_us, 0,
+              "Shed writes while even the fastest request of an interval "
+              "takes longer, and reads too above 4 times it, 0 disables "
+              "latency-based shedding");
+DEFINE_uint64(admission_interval_ms, 100,
+              "Interval over which admission control measures the shortest "
+              "latency and refills its token buckets");
+DEFINE_string(namespace_delimiter, "",
+              "Split keys into tenant namespaces at the first occurrence of "
+              "this string, e.g. \"/\" puts \"tenant-a/block-1\" in "
+              "namespace tenant-a; empty disables namespaces");
+DEFINE_string(namespace_quotas, "",
+              "Namespaces as name:capacity_bytes[:weight], separated by "
+              "commas; the others share namespace default. A capacity of 0 "
+              "is unlimited, weights (default 1) divide the space when "
+              "namespaces contend for it");
+DEFINE_validator(compaction_fragmentation_ratio, [](const char* flagname,
+                                                    double value) {
+    if (value < 0.0 || value > 1.0) {
+        LOG(FATAL) << "Compaction fragmentation ratio must be between 0.0 "
+                      "and 1.0";
+        return false;
+    }
+    return true;
+});
 DEFINE_bool(enable_ha, false,
             "Enable high availability, which depends on etcd");
 DEFINE_string(
@@ -66,6 +200,22 @@ DEFINE_int64(client_ttl, mooncake::DEFAULT_CLIENT_LIVE_TTL_SEC,
 
 DEFINE_string(cluster_id, mooncake::DEFAULT_CLUSTER_ID,
               "Cluster ID for the master service, used for kvcache persistence in HA mode");
+DEFINE_int32(partition_num, 1,
+             "Number of masters the metadata is partitioned over by key "
+             "hash, only used in HA mode; non-HA clients list the master "
+             "of each partition in their master address");
+DEFINE_int32(partition_id, 0,
+             "Partition served by this master, from 0 to partition_num - 1");
+DEFINE_string(follow_master, "",
+              "Address of a master to follow: serve reads from a copy of its "
+              "metadata instead of acting as a master, not used in HA mode");
+DEFINE_uint64(follower_max_staleness_ms, 1000,
+              "How long a follower may go without syncing with its master "
+              "before it stops answering that objects do not exist");
+DEFINE_bool(enable_failover_restore, false,
+            "Standbys keep a copy of the leader's metadata and a new leader "
+            "restores it instead of starting empty, only used in HA mode; "
+            "set it on all masters, it delays the reuse of freed memory");
 
 int main(int argc, char* argv[]) {
     easylog::set_min_severity(easylog::Severity::WARN);
@@ -84,6 +234,27 @@ int main(int argc, char* argv[]) {
               << ", eviction_ratio=" << FLAGS_eviction_ratio
               << ", eviction_high_watermark_ratio="
               << FLAGS_eviction_high_watermark_ratio
+              << ", eviction_low_watermark_ratio="
+              << FLAGS_eviction_low_watermark_ratio
+              << ", eviction_engine=" << FLAGS_eviction_engine
+              << ", allocation_strategy=" << FLAGS_allocation_strategy
+              << ", buffer_allocator=" << FLAGS_buffer_allocator
+              << ", enable_disk_tier=" << FLAGS_enable_disk_tier
+              << ", compaction_fragmentation_ratio="
+              << FLAGS_compaction_fragmentation_ratio
+              << ", hot_replica_read_rate=" << FLAGS_hot_replica_read_rate
+              << ", drain_rate_mb=" << FLAGS_drain_rate_mb
+              << ", inline_object_max_size=" << FLAGS_inline_object_max_size
+              << ", stripe_min_size=" << FLAGS_stripe_min_size
+              << ", persistent_segment_ttl_sec="
+              << FLAGS_persistent_segment_ttl_sec
+              << ", admission_read_rate=" << FLAGS_admission_read_rate
+              << ", admission_write_rate=" << FLAGS_admission_write_rate
+              << ", admission_target_latency_us="
+              << FLAGS_admission_target_latency_us
+              << ", admission_interval_ms=" << FLAGS_admission_interval_ms
+              << ", namespace_delimiter=" << FLAGS_namespace_delimiter
+              << ", namespace_quotas=" << FLAGS_namespace_quotas
               << ", enable_ha=" << FLAGS_enable_ha
               << ", etcd_endpoints=" << FLAGS_etcd_endpoints
               << ", client_ttl=" << FLAGS_client_ttl
@@ -92,7 +263,16 @@ int main(int argc, char* argv[]) {
               << ", rpc_address=" << FLAGS_rpc_address
               << ", rpc_conn_timeout_seconds=" << FLAGS_rpc_conn_timeout_seconds
               << ", rpc_enable_tcp_no_delay=" << FLAGS_rpc_enable_tcp_no_delay
-              << ", cluster_id=" << FLAGS_cluster_id;
+              << ", rpc_enable_rdma=" << FLAGS_rpc_enable_rdma
+              << ", rpc_shard_affinity_threads="
+              << FLAGS_rpc_shard_affinity_threads
+              << ", cluster_id=" << FLAGS_cluster_id
+              << ", partition_id=" << FLAGS_partition_id
+              << ", partition_num=" << FLAGS_partition_num
+              << ", follow_master=" << FLAGS_follow_master
+              << ", follower_max_staleness_ms="
+              << FLAGS_follower_max_staleness_ms
+              << ", enable_failover_restore=" << FLAGS_enable_failover_restore;
 
     int server_thread_num =
         std::min(FLAGS_max_threads,
@@ -119,6 +299,8 @@ int main(int argc, char* argv[]) {
     } else {
         rpc_thread_num = static_cast<size_t>(server_thread_num);
     }
+    const size_t shard_affinity_threads =
+        static_cast<size_t>(std::max(FLAGS_rpc_shard_affinity_threads, 0));
 
     // Determine RPC server port with compatibility warnings
     int rpc_port;
@@ -138,6 +320,13 @@ int main(int argc, char* argv[]) {
     auto rpc_conn_timeout =
         std::chrono::seconds(FLAGS_rpc_conn_timeout_seconds);
 
+    const mooncake::EvictionEngine eviction_engine =
+        kEvictionEngines.at(FLAGS_eviction_engine);
+    const mooncake::AllocationStrategyType allocation_strategy =
+        kAllocationStrategies.at(FLAGS_allocation_strategy);
+    const mooncake::BufferAllocatorType buffer_allocator_type =
+        kBufferAllocatorTypes.at(FLAGS_buffer_allocator);
+
     if (FLAGS_enable_ha && FLAGS_etcd_endpoints.empty()) {
         LOG(FATAL) << "Etcd endpoints must be set when enable_ha is true";
         return 1;
@@ -146,6 +335,83 @@ int main(int argc, char* argv[]) {
         LOG(WARNING)
             << "Etcd endpoints are set but will not be used in non-HA mode";
     }
+    if (FLAGS_partition_num < 1 || FLAGS_partition_id < 0 ||
+        FLAGS_partition_id >= FLAGS_partition_num) {
+        LOG(FATAL) << "Partition id must be between 0 and partition_num - 1";
+        return 1;
+    }
+    if (FLAGS_enable_ha && !FLAGS_follow_master.empty()) {
+        LOG(FATAL) << "A follower master cannot run in HA mode";
+        return 1;
+    }
+#ifndef YLT_ENABLE_IBV
+    if (FLAGS_rpc_enable_rdma) {
+        LOG(FATAL) << "Built without USE_RPC_RDMA, rpc_enable_rdma is not "
+                      "available";
+        return 1;
+    }
+#endif
+    if (FLAGS_rpc_enable_rdma && FLAGS_enable_failover_restore) {
+        // The standbys follow the leader over TCP
+        LOG(FATAL) << "Failover restore cannot be used with rpc_enable_rdma";
+        return 1;
+    }
+    if (FLAGS_enable_failover_restore && !FLAGS_enable_ha) {
+        LOG(WARNING) << "Failover restore is only used in HA mode";
+    }
+
+    mooncake::AdmissionConfig admission_config;
+    admission_config.read_rate = FLAGS_admission_read_rate;
+    admission_config.write_rate = FLAGS_admission_write_rate;
+    admission_config.target_latency =
+        std::chrono::microseconds(FLAGS_admission_target_latency_us);
+    admission_config.interval = std::chrono::milliseconds(
+        std::max<uint64_t>(FLAGS_admission_interval_ms, 1));
+
+    mooncake::NamespaceConfig namespace_config;
+    namespace_config.delimiter = FLAGS_namespace_delimiter;
+    if (!namespace_config.ParseQuotas(FLAGS_namespace_quotas)) {
+        LOG(FATAL) << "Invalid namespace_quotas: " << FLAGS_namespace_quotas;
+        return 1;
+    }
+    if (!namespace_config.enabled() && !namespace_config.quotas.empty()) {
+        LOG(WARNING) << "namespace_quotas is ignored without "
+                        "namespace_delimiter";
+    }
+
+    mooncake::WrappedMasterServiceConfig config;
+    config.master.enable_gc = FLAGS_enable_gc;
+    config.master.default_kv_lease_ttl = FLAGS_default_kv_lease_ttl;
+    config.master.default_kv_soft_pin_ttl = FLAGS_default_kv_soft_pin_ttl;
+    config.master.allow_evict_soft_pinned_objects =
+        FLAGS_allow_evict_soft_pinned_objects;
+    config.master.eviction_ratio = FLAGS_eviction_ratio;
+    config.master.eviction_high_watermark_ratio =
+        FLAGS_eviction_high_watermark_ratio;
+    config.master.client_live_ttl_sec = FLAGS_client_ttl;
+    config.master.enable_ha = FLAGS_enable_ha;
+    config.master.cluster_id = FLAGS_cluster_id;
+    config.master.eviction_engine = eviction_engine;
+    config.master.allocation_strategy = allocation_strategy;
+    config.master.enable_disk_tier = FLAGS_enable_disk_tier;
+    config.master.buffer_allocator_type = buffer_allocator_type;
+    config.master.compaction_fragmentation_ratio =
+        FLAGS_compaction_fragmentation_ratio;
+    // Only the standbys of HA mode keep a copy of the leader's metadata
+    config.master.enable_failover_restore =
+        FLAGS_enable_ha && FLAGS_enable_failover_restore;
+    config.master.eviction_low_watermark_ratio =
+        FLAGS_eviction_low_watermark_ratio;
+    config.master.hot_replica_read_rate = FLAGS_hot_replica_read_rate;
+    config.master.drain_rate_bytes = FLAGS_drain_rate_mb << 20;
+    config.master.inline_object_max_size = FLAGS_inline_object_max_size;
+    config.master.namespace_config = namespace_config;
+    config.master.stripe_min_size = FLAGS_stripe_min_size;
+    config.master.persistent_segment_ttl_sec =
+        FLAGS_persistent_segment_ttl_sec;
+    config.enable_metric_reporting = FLAGS_enable_metric_reporting;
+    config.http_port = FLAGS_metrics_port;
+    config.shard_affinity_threads = shard_affinity_threads;
 
     if (FLAGS_enable_ha) {
         // Construct local hostname from rpc_address and rpc_port
@@ -153,29 +419,34 @@ int main(int argc, char* argv[]) {
             FLAGS_rpc_address + ":" + std::to_string(rpc_port);
 
         mooncake::MasterServiceSupervisor supervisor(
-            rpc_port, rpc_thread_num, FLAGS_enable_gc,
-            FLAGS_enable_metric_reporting, FLAGS_metrics_port,
-            FLAGS_default_kv_lease_ttl, FLAGS_default_kv_soft_pin_ttl,
-            FLAGS_allow_evict_soft_pinned_objects, FLAGS_eviction_ratio,
-            FLAGS_eviction_high_watermark_ratio, FLAGS_client_ttl,
-            FLAGS_etcd_endpoints, local_hostname, FLAGS_rpc_address,
-            rpc_conn_timeout, FLAGS_rpc_enable_tcp_no_delay, FLAGS_cluster_id);
+            config, rpc_port, rpc_thread_num, FLAGS_etcd_endpoints,
+            local_hostname, FLAGS_rpc_address, rpc_conn_timeout,
+            FLAGS_rpc_enable_tcp_no_delay, FLAGS_partition_id,
+            FLAGS_partition_num, FLAGS_rpc_enable_rdma, admission_config);
 
         return supervisor.Start();
     } else {
-        // version is not used in non-HA mode, just pass a dummy value
-        mooncake::ViewVersionId version = 0;
         coro_rpc::coro_rpc_server server(rpc_thread_num, rpc_port,
                                          FLAGS_rpc_address, rpc_conn_timeout,
                                          FLAGS_rpc_enable_tcp_no_delay);
-        mooncake::WrappedMasterService wrapped_master_service(
-            FLAGS_enable_gc, FLAGS_default_kv_lease_ttl,
-            FLAGS_default_kv_soft_pin_ttl,
-            FLAGS_allow_evict_soft_pinned_objects,
-            FLAGS_enable_metric_reporting, FLAGS_metrics_port,
-            FLAGS_eviction_ratio, FLAGS_eviction_high_watermark_ratio, version,
-            FLAGS_client_ttl, FLAGS_enable_ha, FLAGS_cluster_id);
+#ifdef YLT_ENABLE_IBV
+        if (FLAGS_rpc_enable_rdma) {
+            server.init_ibv();
+        }
+#endif
+        mooncake::WrappedMasterService wrapped_master_service(config);
+        if (admission_config.enabled()) {
+            wrapped_master_service.EnableAdmissionControl(admission_config);
+        }
 
+        if (!FLAGS_follow_master.empty()) {
+            wrapped_master_service.FollowMaster(
+                FLAGS_follow_master,
+                std::chrono::milliseconds(FLAGS_follower_max_staleness_ms));
+            mooncake::RegisterFollowerRpcService(server,
+                                                 wrapped_master_service);
+            return server.start();
+        }
         mooncake::RegisterRpcService(server, wrapped_master_service);
         return server.start();
     }
@@ -4,12 +4,14 @@
 #include <async_simple/coro/Lazy.h>
 #include <async_simple/coro/SyncAwait.h>
 
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <ylt/coro_rpc/impl/coro_rpc_client.hpp>
 #include <ylt/util/tl/expected.hpp>
 
 #include "mutex.h"
+#include "request_tracer.h"
 #include "rpc_service.h"
 #include "types.h"
 #include "utils/scoped_vlog_timer.h"
@@ -22,43 +24,229 @@ using namespace async_simple::coro;
 MasterClient::MasterClient() = default;
 MasterClient::~MasterClient() = default;
 
+MasterClient::Connection::Connection(bool own_io_thread) {
+    if (!own_io_thread) {
+        client = std::make_shared<coro_rpc_client>();
+        return;
+    }
+    io_context = std::make_unique<asio::io_context>();
+    work_guard = std::make_unique<
+        asio::executor_work_guard<asio::io_context::executor_type>>(
+        io_context->get_executor());
+    io_thread = std::thread([this]() { io_context->run(); });
+    client = std::make_shared<coro_rpc_client>(io_context->get_executor());
+}
+
+MasterClient::Connection::~Connection() {
+    // The client closes its socket on the I/O thread, which must still run
+    client.reset();
+    if (io_context) {
+        work_guard.reset();
+        io_context->stop();
+        if (io_thread.joinable()) {
+            io_thread.join();
+        }
+    }
+}
+
+MasterClient::RpcClientAccessor::Lease
+MasterClient::RpcClientAccessor::GetClient() {
+    std::shared_lock<std::shared_mutex> lock(client_mutex_);
+    if (connections_.empty()) {
+        return Lease();
+    }
+    const size_t num = connections_.size();
+    size_t index =
+        num == 1 ? 0
+                 : next_connection_.fetch_add(1, std::memory_order_relaxed) %
+                       num;
+    if (selection_ == ConnectionSelection::LEAST_OUTSTANDING) {
+        // Starting from the next in turn, so that ties are spread out
+        int64_t least = connections_[index]->in_flight.load(
+            std::memory_order_relaxed);
+        for (size_t i = 1; i < num && least > 0; ++i) {
+            const size_t candidate = (index + i) % num;
+            const int64_t in_flight = connections_[candidate]->in_flight.load(
+                std::memory_order_relaxed);
+            if (in_flight < least) {
+                least = in_flight;
+                index = candidate;
+            }
+        }
+    }
+    return Lease(connections_[index]);
+}
+
 ErrorCode MasterClient::Connect(const std::string& master_addr) {
     ScopedVLogTimer timer(1, "MasterClient::Connect");
+    RequestTracer::ScopedSpan span("master_rpc", "Connect");
     timer.LogRequest("master_addr=", master_addr);
 
     MutexLocker lock(&connect_mutex_);
     if (client_addr_param_ == master_addr) {
-        auto client = client_accessor_.GetClient();
-        auto result = coro::syncAwait(client->connect(master_addr));
-        if (result.val() != 0) {
-            LOG(ERROR) << "Failed to connect to master: " << result.message();
-            timer.LogResponse("error_code=", ErrorCode::RPC_FAIL);
-            return ErrorCode::RPC_FAIL;
+        for (auto& connection : client_accessor_.GetConnections()) {
+            auto result =
+                coro::syncAwait(connection->client->connect(master_addr));
+            if (result.val() != 0) {
+                LOG(ERROR) << "Failed to connect to master: "
+                           << result.message();
+                timer.LogResponse("error_code=", ErrorCode::RPC_FAIL);
+                return ErrorCode::RPC_FAIL;
+            }
         }
         timer.LogResponse("error_code=", ErrorCode::OK);
         return ErrorCode::OK;
     } else {
         // Once connected to address A, the coro_rpc_client does not support
-        // connect to a new address B. So we need to create a new
-        // coro_rpc_client if the address is different from the current one.
-        auto client = std::make_shared<coro_rpc_client>();
-        auto result = coro::syncAwait(client->connect(master_addr));
-        if (result.val() != 0) {
-            LOG(ERROR) << "Failed to connect to master: " << result.message();
-            timer.LogResponse("error_code=", ErrorCode::RPC_FAIL);
-            return ErrorCode::RPC_FAIL;
+        // connect to a new address B. So we need to create new connections
+        // if the address is different from the current one.
+        std::vector<std::shared_ptr<Connection>> connections;
+        for (size_t i = 0; i < connection_num_; ++i) {
+            auto connection =
+                std::make_shared<Connection>(connection_num_ > 1);
+#ifdef YLT_ENABLE_IBV
+            if (use_rdma_) {
+                connection->client->init_ibv();
+            }
+#endif
+            auto result =
+                coro::syncAwait(connection->client->connect(master_addr));
+            if (result.val() != 0) {
+                LOG(ERROR) << "Failed to connect to master: "
+                           << result.message();
+                timer.LogResponse("error_code=", ErrorCode::RPC_FAIL);
+                return ErrorCode::RPC_FAIL;
+            }
+            connections.push_back(std::move(connection));
         }
-        // Set the client to the accessor and update the address parameter
-        client_accessor_.SetClient(client);
+        // Set the connections to the accessor and update the address
+        // parameter
+        client_accessor_.SetConnections(std::move(connections));
         client_addr_param_ = master_addr;
         timer.LogResponse("error_code=", ErrorCode::OK);
         return ErrorCode::OK;
     }
 }
 
+void MasterClient::SetConnections(size_t connection_num,
+                                  ConnectionSelection selection) {
+    MutexLocker lock(&connect_mutex_);
+    connection_num_ = std::max<size_t>(connection_num, 1);
+    connection_selection_ = selection;
+    client_accessor_.SetSelection(selection);
+    // Connect keeps the connections of the current address
+    client_addr_param_.clear();
+    LOG(INFO) << "master_rpc_connections=" << connection_num_
+              << " selection="
+              << (selection == ConnectionSelection::LEAST_OUTSTANDING
+                      ? "least_outstanding"
+                      : "round_robin");
+}
+
+std::vector<int64_t> MasterClient::GetInFlightRequests() const {
+    std::vector<int64_t> in_flight;
+    for (const auto& connection : client_accessor_.GetConnections()) {
+        in_flight.push_back(
+            connection->in_flight.load(std::memory_order_relaxed));
+    }
+    return in_flight;
+}
+
+void MasterClient::EnableCoalescing(std::chrono::microseconds window,
+                                    size_t max_keys) {
+    exist_coalescer_ =
+        std::make_unique<RequestCoalescer<tl::expected<bool, ErrorCode>>>(
+            [this](const std::vector<std::string>& keys) {
+                return BatchExistKey(keys);
+            },
+            window, max_keys, tl::make_unexpected(ErrorCode::RPC_FAIL));
+    replica_list_coalescer_ = std::make_unique<RequestCoalescer<
+        tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>>(
+        [this](const std::vector<std::string>& keys) {
+            return BatchGetReplicaList(keys);
+        },
+        window, max_keys, tl::make_unexpected(ErrorCode::RPC_FAIL));
+    LOG(INFO) << "master_rpc_coalescing window_us=" << window.count()
+              << " max_keys=" << max_keys;
+}
+
+size_t MasterClient::EnableFollowers(
+    const std::vector<std::string>& follower_addrs) {
+    for (const auto& addr : follower_addrs) {
+        auto follower = std::make_unique<MasterClient>();
+        follower->use_rdma_ = use_rdma_;
+        follower->connection_num_ = connection_num_;
+        follower->connection_selection_ = connection_selection_;
+        follower->client_accessor_.SetSelection(connection_selection_);
+        if (follower->Connect(addr) != ErrorCode::OK) {
+            LOG(WARNING) << "Failed to connect to follower master " << addr
+                         << ", not reading from it";
+            continue;
+        }
+        followers_.push_back(std::move(follower));
+    }
+    LOG(INFO) << "master_followers=" << followers_.size();
+    return followers_.size();
+}
+
+bool MasterClient::EnableRdma() {
+#ifdef YLT_ENABLE_IBV
+    MutexLocker lock(&connect_mutex_);
+    use_rdma_ = true;
+    // Connect keeps the client of the current address
+    client_addr_param_.clear();
+    return true;
+#else
+    LOG(WARNING) << "Built without USE_RPC_RDMA, master RPCs stay on TCP";
+    return false;
+#endif
+}
+
+template <typename T>
+std::vector<T> MasterClient::BatchReadWithFollowers(
+    const std::vector<std::string>& keys,
+    std::vector<T> (MasterClient::*read)(const std::vector<std::string>&)) {
+    MasterClient* follower = NextFollower();
+    if (!follower) {
+        return (this->*read)(keys);
+    }
+    auto results = (follower->*read)(keys);
+    std::vector<size_t> retry_indices;
+    std::vector<std::string> retry_keys;
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (!results[i] && results[i].error() == ErrorCode::RPC_FAIL) {
+            retry_indices.push_back(i);
+            retry_keys.push_back(keys[i]);
+        }
+    }
+    if (retry_keys.empty()) {
+        return results;
+    }
+    auto retried = (this->*read)(retry_keys);
+    for (size_t i = 0; i < retry_indices.size(); ++i) {
+        results[retry_indices[i]] = std::move(retried[i]);
+    }
+    return results;
+}
+
 tl::expected<bool, ErrorCode> MasterClient::ExistKey(
+    const std::string& object_key) {
+    if (exist_coalescer_) {
+        return exist_coalescer_->Submit(object_key);
+    }
+    if (MasterClient* follower = NextFollower()) {
+        auto result = follower->ExistKeyOnMaster(object_key);
+        if (result || result.error() != ErrorCode::RPC_FAIL) {
+            return result;
+        }
+    }
+    return ExistKeyOnMaster(object_key);
+}
+
+tl::expected<bool, ErrorCode> MasterClient::ExistKeyOnMaster(
     const std::string& object_key) {
     ScopedVLogTimer timer(1, "MasterClient::ExistKey");
+    RequestTracer::ScopedSpan span("master_rpc", "ExistKey");
     timer.LogRequest("object_key=", object_key);
 
     auto client = client_accessor_.GetClient();
@@ -86,8 +274,15 @@ tl::expected<bool, ErrorCode> MasterClient::ExistKey(
 }
 
 std::vector<tl::expected<bool, ErrorCode>> MasterClient::BatchExistKey(
+    const std::vector<std::string>& object_keys) {
+    return BatchReadWithFollowers(object_keys,
+                                  &MasterClient::BatchExistKeyOnMaster);
+}
+
+std::vector<tl::expected<bool, ErrorCode>> MasterClient::BatchExistKeyOnMaster(
     const std::vector<std::string>& object_keys) {
     ScopedVLogTimer timer(1, "MasterClient::BatchExistKey");
+    RequestTracer::ScopedSpan span("master_rpc", "BatchExistKey");
     timer.LogRequest("keys_count=", object_keys.size());
 
     auto client = client_accessor_.GetClient();
@@ -120,10 +315,12 @@ std::vector<tl::expected<bool, ErrorCode>> MasterClient::BatchExistKey(
     return result;
 }
 
-tl::expected<std::vector<Replica::Descriptor>, ErrorCode>
-MasterClient::GetReplicaList(const std::string& object_key) {
-    ScopedVLogTimer timer(1, "MasterClient::GetReplicaList");
-    timer.LogRequest("object_key=", object_key);
+tl::expected<PrefixMatchResult, ErrorCode> MasterClient::LongestPrefixMatch(
+    const std::vector<std::string>& object_keys, bool with_replicas) {
+    ScopedVLogTimer timer(1, "MasterClient::LongestPrefixMatch");
+    RequestTracer::ScopedSpan span("master_rpc", "LongestPrefixMatch");
+    timer.LogRequest("keys_count=", object_keys.size(),
+                     ", with_replicas=", with_replicas);
 
     auto client = client_accessor_.GetClient();
     if (!client) {
@@ -133,14 +330,44 @@ MasterClient::GetReplicaList(const std::string& object_key) {
     }
 
     auto request_result =
-        client->send_request<&WrappedMasterService::GetReplicaList>(object_key);
+        client->send_request<&WrappedMasterService::LongestPrefixMatch>(
+            object_keys, with_replicas);
+    auto result = coro::syncAwait(
+        [&]() -> coro::Lazy<tl::expected<PrefixMatchResult, ErrorCode>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to match key prefix: "
+                           << result.error().msg;
+                co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+            }
+            co_return result->result();
+        }());
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<KeyLocationResult, ErrorCode> MasterClient::BatchQueryLocation(
+    const std::vector<std::string>& object_keys, bool with_prefix_hits) {
+    ScopedVLogTimer timer(1, "MasterClient::BatchQueryLocation");
+    RequestTracer::ScopedSpan span("master_rpc", "BatchQueryLocation");
+    timer.LogRequest("keys_count=", object_keys.size(),
+                     ", with_prefix_hits=", with_prefix_hits);
 
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+
+    auto request_result =
+        client->send_request<&WrappedMasterService::BatchQueryLocation>(
+            object_keys, with_prefix_hits);
     auto result = coro::syncAwait(
-        [&]() -> coro::Lazy<
-                  tl::expected<std::vector<Replica::Descriptor>, ErrorCode>> {
+        [&]() -> coro::Lazy<tl::expected<KeyLocationResult, ErrorCode>> {
             auto result = co_await co_await request_result;
             if (!result) {
-                LOG(ERROR) << "Failed to get replica list: "
+                LOG(ERROR) << "Failed to query key locations: "
                            << result.error().msg;
                 co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
             }
@@ -150,9 +377,108 @@ MasterClient::GetReplicaList(const std::string& object_key) {
     return result;
 }
 
+tl::expected<KeyScanResult, ErrorCode> MasterClient::ScanKeys(
+    const std::string& prefix, const std::string& cursor, uint64_t limit) {
+    ScopedVLogTimer timer(1, "MasterClient::ScanKeys");
+    RequestTracer::ScopedSpan span("master_rpc", "ScanKeys");
+    timer.LogRequest("prefix=", prefix, ", cursor=", cursor,
+                     ", limit=", limit);
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+
+    auto request_result = client->send_request<&WrappedMasterService::ScanKeys>(
+        prefix, cursor, limit);
+    auto result = coro::syncAwait(
+        [&]() -> coro::Lazy<tl::expected<KeyScanResult, ErrorCode>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to scan keys: " << result.error().msg;
+                co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+            }
+            co_return result->result();
+        }());
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<std::vector<Replica::Descriptor>, ErrorCode>
+MasterClient::GetReplicaList(const std::string& object_key) {
+    if (replica_list_coalescer_) {
+        return replica_list_coalescer_->Submit(object_key);
+    }
+    if (MasterClient* follower = NextFollower()) {
+        auto result = follower->GetReplicaListOnMaster(object_key);
+        if (result || result.error() != ErrorCode::RPC_FAIL) {
+            return result;
+        }
+    }
+    return GetReplicaListOnMaster(object_key);
+}
+
+tl::expected<std::vector<Replica::Descriptor>, ErrorCode>
+MasterClient::GetLeaderReplicaList(const std::string& object_key) {
+    return GetReplicaListOnMaster(object_key);
+}
+
+tl::expected<std::vector<Replica::Descriptor>, ErrorCode>
+MasterClient::GetReplicaListOnMaster(const std::string& object_key) {
+    RequestTracer::ScopedSpan span("master_rpc", "GetReplicaList");
+    return coro::syncAwait(CoGetReplicaListOnMaster(object_key));
+}
+
+coro::Lazy<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+MasterClient::CoGetReplicaList(std::string object_key) {
+    if (MasterClient* follower = NextFollower()) {
+        auto result = co_await follower->CoGetReplicaListOnMaster(object_key);
+        if (result || result.error() != ErrorCode::RPC_FAIL) {
+            co_return result;
+        }
+    }
+    co_return co_await CoGetReplicaListOnMaster(std::move(object_key));
+}
+
+coro::Lazy<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+MasterClient::CoGetReplicaListOnMaster(std::string object_key) {
+    ScopedVLogTimer timer(1, "MasterClient::GetReplicaList");
+    timer.LogRequest("object_key=", object_key);
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+
+    auto response = co_await co_await client
+                        ->send_request<&WrappedMasterService::GetReplicaList>(
+                            object_key);
+    tl::expected<std::vector<Replica::Descriptor>, ErrorCode> result =
+        tl::make_unexpected(ErrorCode::RPC_FAIL);
+    if (!response) {
+        LOG(ERROR) << "Failed to get replica list: " << response.error().msg;
+    } else {
+        result = response->result();
+    }
+    timer.LogResponseExpected(result);
+    co_return result;
+}
+
 std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
 MasterClient::BatchGetReplicaList(const std::vector<std::string>& object_keys) {
+    return BatchReadWithFollowers(object_keys,
+                                  &MasterClient::BatchGetReplicaListOnMaster);
+}
+
+std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+MasterClient::BatchGetReplicaListOnMaster(
+    const std::vector<std::string>& object_keys) {
     ScopedVLogTimer timer(1, "MasterClient::BatchGetReplicaList");
+    RequestTracer::ScopedSpan span("master_rpc", "BatchGetReplicaList");
     timer.LogRequest("keys_count=", object_keys.size());
 
     auto client = client_accessor_.GetClient();
@@ -169,8 +495,9 @@ MasterClient::BatchGetReplicaList(const std::vector<std::string>& object_keys) {
         return error_results;
     }
 
+    // The packed form repeats no segment name, see PackedReplicaLists
     auto request_result =
-        client->send_request<&WrappedMasterService::BatchGetReplicaList>(
+        client->send_request<&WrappedMasterService::BatchGetReplicaListPacked>(
             object_keys);
     auto result = coro::syncAwait(
         [&]() -> coro::Lazy<std::vector<
@@ -189,7 +516,15 @@ MasterClient::BatchGetReplicaList(const std::vector<std::string>& object_keys) {
                 }
                 co_return error_results;
             }
-            co_return result->result();
+            auto results = result->result().Unpack();
+            if (results.size() != object_keys.size()) {
+                LOG(ERROR) << "Batch replica list has " << results.size()
+                           << " results for " << object_keys.size()
+                           << " keys";
+                results.assign(object_keys.size(),
+                               tl::make_unexpected(ErrorCode::RPC_FAIL));
+            }
+            co_return results;
         }());
 
     timer.LogResponse("result=", result.size(), " operations");
@@ -200,6 +535,13 @@ tl::expected<std::vector<Replica::Descriptor>, ErrorCode>
 MasterClient::PutStart(const std::string& key,
                        const std::vector<size_t>& slice_lengths,
                        const ReplicateConfig& config) {
+    RequestTracer::ScopedSpan span("master_rpc", "PutStart");
+    return coro::syncAwait(CoPutStart(key, slice_lengths, config));
+}
+
+coro::Lazy<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+MasterClient::CoPutStart(std::string key, std::vector<size_t> slice_lengths,
+                         ReplicateConfig config) {
     ScopedVLogTimer timer(1, "MasterClient::PutStart");
     timer.LogRequest("key=", key, ", slice_count=", slice_lengths.size());
 
@@ -207,7 +549,7 @@ MasterClient::PutStart(const std::string& key,
     if (!client) {
         LOG(ERROR) << "Client not available";
         timer.LogResponse("error=Client not available");
-        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+        co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
     }
 
     // Convert size_t to uint64_t for RPC
@@ -217,21 +559,19 @@ MasterClient::PutStart(const std::string& key,
         rpc_slice_lengths.push_back(length);
     }
 
-    auto request_result = client->send_request<&WrappedMasterService::PutStart>(
-        key, rpc_slice_lengths, config);
-    auto result = coro::syncAwait(
-        [&]() -> coro::Lazy<
-                  tl::expected<std::vector<Replica::Descriptor>, ErrorCode>> {
-            auto result = co_await co_await request_result;
-            if (!result) {
-                LOG(ERROR) << "Failed to start put operation: "
-                           << result.error().msg;
-                co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
-            }
-            co_return result->result();
-        }());
+    auto response =
+        co_await co_await client->send_request<&WrappedMasterService::PutStart>(
+            key, rpc_slice_lengths, config);
+    tl::expected<std::vector<Replica::Descriptor>, ErrorCode> result =
+        tl::make_unexpected(ErrorCode::RPC_FAIL);
+    if (!response) {
+        LOG(ERROR) << "Failed to start put operation: "
+                   << response.error().msg;
+    } else {
+        result = response->result();
+    }
     timer.LogResponseExpected(result);
-    return result;
+    co_return result;
 }
 
 std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
@@ -240,6 +580,7 @@ MasterClient::BatchPutStart(
     const std::vector<std::vector<uint64_t>>& slice_lengths,
     const ReplicateConfig& config) {
     ScopedVLogTimer timer(1, "MasterClient::BatchPutStart");
+    RequestTracer::ScopedSpan span("master_rpc", "BatchPutStart");
     timer.LogRequest("keys_count=", keys.size());
 
     auto client = client_accessor_.GetClient();
@@ -278,6 +619,12 @@ MasterClient::BatchPutStart(
 }
 
 tl::expected<void, ErrorCode> MasterClient::PutEnd(const std::string& key) {
+    RequestTracer::ScopedSpan span("master_rpc", "PutEnd");
+    return coro::syncAwait(CoPutEnd(key));
+}
+
+coro::Lazy<tl::expected<void, ErrorCode>> MasterClient::CoPutEnd(
+    std::string key) {
     ScopedVLogTimer timer(1, "MasterClient::PutEnd");
     timer.LogRequest("key=", key);
 
@@ -285,28 +632,27 @@ tl::expected<void, ErrorCode> MasterClient::PutEnd(const std::string& key) {
     if (!client) {
         LOG(ERROR) << "Client not available";
         timer.LogResponse("error=Client not available");
-        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+        co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
     }
 
-    auto request_result =
-        client->send_request<&WrappedMasterService::PutEnd>(key);
-    auto result =
-        coro::syncAwait([&]() -> coro::Lazy<tl::expected<void, ErrorCode>> {
-            auto result = co_await co_await request_result;
-            if (!result) {
-                LOG(ERROR) << "Failed to end put operation: "
-                           << result.error().msg;
-                co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
-            }
-            co_return result->result();
-        }());
+    auto response =
+        co_await co_await client->send_request<&WrappedMasterService::PutEnd>(
+            key);
+    tl::expected<void, ErrorCode> result =
+        tl::make_unexpected(ErrorCode::RPC_FAIL);
+    if (!response) {
+        LOG(ERROR) << "Failed to end put operation: " << response.error().msg;
+    } else {
+        result = response->result();
+    }
     timer.LogResponseExpected(result);
-    return result;
+    co_return result;
 }
 
 std::vector<tl::expected<void, ErrorCode>> MasterClient::BatchPutEnd(
     const std::vector<std::string>& keys) {
     ScopedVLogTimer timer(1, "MasterClient::BatchPutEnd");
+    RequestTracer::ScopedSpan span("master_rpc", "BatchPutEnd");
     timer.LogRequest("keys_count=", keys.size());
 
     auto client = client_accessor_.GetClient();
@@ -344,36 +690,77 @@ std::vector<tl::expected<void, ErrorCode>> MasterClient::BatchPutEnd(
     return result;
 }
 
-tl::expected<void, ErrorCode> MasterClient::PutRevoke(const std::string& key) {
-    ScopedVLogTimer timer(1, "MasterClient::PutRevoke");
-    timer.LogRequest("key=", key);
+std::vector<tl::expected<void, ErrorCode>> MasterClient::BatchTouch(
+    const std::vector<std::string>& object_keys, uint64_t ttl_ms,
+    uint64_t next_use_ms) {
+    ScopedVLogTimer timer(1, "MasterClient::BatchTouch");
+    RequestTracer::ScopedSpan span("master_rpc", "BatchTouch");
+    timer.LogRequest("keys_count=", object_keys.size(), ", ttl_ms=", ttl_ms,
+                     ", next_use_ms=", next_use_ms);
 
     auto client = client_accessor_.GetClient();
     if (!client) {
         LOG(ERROR) << "Client not available";
         timer.LogResponse("error=Client not available");
-        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+        return std::vector<tl::expected<void, ErrorCode>>(
+            object_keys.size(), tl::make_unexpected(ErrorCode::RPC_FAIL));
     }
 
     auto request_result =
-        client->send_request<&WrappedMasterService::PutRevoke>(key);
-    auto result =
-        coro::syncAwait([&]() -> coro::Lazy<tl::expected<void, ErrorCode>> {
+        client->send_request<&WrappedMasterService::BatchTouch>(
+            object_keys, ttl_ms, next_use_ms);
+    auto result = coro::syncAwait(
+        [&]() -> coro::Lazy<std::vector<tl::expected<void, ErrorCode>>> {
             auto result = co_await co_await request_result;
             if (!result) {
-                LOG(ERROR) << "Failed to revoke put operation: "
+                LOG(ERROR) << "Failed to touch objects: "
                            << result.error().msg;
-                co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+                co_return std::vector<tl::expected<void, ErrorCode>>(
+                    object_keys.size(),
+                    tl::make_unexpected(ErrorCode::RPC_FAIL));
             }
             co_return result->result();
         }());
-    timer.LogResponseExpected(result);
+    timer.LogResponse("result=", result.size(), " operations");
     return result;
 }
 
+tl::expected<void, ErrorCode> MasterClient::PutRevoke(const std::string& key) {
+    RequestTracer::ScopedSpan span("master_rpc", "PutRevoke");
+    return coro::syncAwait(CoPutRevoke(key));
+}
+
+coro::Lazy<tl::expected<void, ErrorCode>> MasterClient::CoPutRevoke(
+    std::string key) {
+    ScopedVLogTimer timer(1, "MasterClient::PutRevoke");
+    timer.LogRequest("key=", key);
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+
+    auto response =
+        co_await co_await client->send_request<&WrappedMasterService::PutRevoke>(
+            key);
+    tl::expected<void, ErrorCode> result =
+        tl::make_unexpected(ErrorCode::RPC_FAIL);
+    if (!response) {
+        LOG(ERROR) << "Failed to revoke put operation: "
+                   << response.error().msg;
+    } else {
+        result = response->result();
+    }
+    timer.LogResponseExpected(result);
+    co_return result;
+}
+
 std::vector<tl::expected<void, ErrorCode>> MasterClient::BatchPutRevoke(
     const std::vector<std::string>& keys) {
     ScopedVLogTimer timer(1, "MasterClient::BatchPutRevoke");
+    RequestTracer::ScopedSpan span("master_rpc", "BatchPutRevoke");
     timer.LogRequest("keys_count=", keys.size());
 
     auto client = client_accessor_.GetClient();
@@ -411,9 +798,12 @@ std::vector<tl::expected<void, ErrorCode>> MasterClient::BatchPutRevoke(
     return result;
 }
 
-tl::expected<void, ErrorCode> MasterClient::Remove(const std::string& key) {
-    ScopedVLogTimer timer(1, "MasterClient::Remove");
-    timer.LogRequest("key=", key);
+tl::expected<void, ErrorCode> MasterClient::PutInline(
+    const std::string& key, const std::string& value,
+    const ReplicateConfig& config) {
+    ScopedVLogTimer timer(1, "MasterClient::PutInline");
+    RequestTracer::ScopedSpan span("master_rpc", "PutInline");
+    timer.LogRequest("key=", key, ", value_length=", value.size());
 
     auto client = client_accessor_.GetClient();
     if (!client) {
@@ -423,12 +813,14 @@ tl::expected<void, ErrorCode> MasterClient::Remove(const std::string& key) {
     }
 
     auto request_result =
-        client->send_request<&WrappedMasterService::Remove>(key);
+        client->send_request<&WrappedMasterService::PutInline>(key, value,
+                                                               config);
     auto result =
         coro::syncAwait([&]() -> coro::Lazy<tl::expected<void, ErrorCode>> {
             auto result = co_await co_await request_result;
             if (!result) {
-                LOG(ERROR) << "Failed to remove object: " << result.error().msg;
+                LOG(ERROR) << "Failed to put inline object: "
+                           << result.error().msg;
                 co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
             }
             co_return result->result();
@@ -437,9 +829,11 @@ tl::expected<void, ErrorCode> MasterClient::Remove(const std::string& key) {
     return result;
 }
 
-tl::expected<long, ErrorCode> MasterClient::RemoveAll() {
-    ScopedVLogTimer timer(1, "MasterClient::RemoveAll");
-    timer.LogRequest("action=remove_all_objects");
+tl::expected<AllocationCredit, ErrorCode> MasterClient::GrantAllocationCredit(
+    const UUID& client_id, uint64_t size) {
+    ScopedVLogTimer timer(1, "MasterClient::GrantAllocationCredit");
+    RequestTracer::ScopedSpan span("master_rpc", "GrantAllocationCredit");
+    timer.LogRequest("client_id=", client_id, ", size=", size);
 
     auto client = client_accessor_.GetClient();
     if (!client) {
@@ -449,57 +843,65 @@ tl::expected<long, ErrorCode> MasterClient::RemoveAll() {
     }
 
     auto request_result =
-        client->send_request<&WrappedMasterService::RemoveAll>();
-    auto result =
-        coro::syncAwait([&]() -> coro::Lazy<tl::expected<long, ErrorCode>> {
+        client->send_request<&WrappedMasterService::GrantAllocationCredit>(
+            client_id, size);
+    auto result = coro::syncAwait(
+        [&]() -> coro::Lazy<tl::expected<AllocationCredit, ErrorCode>> {
             auto result = co_await co_await request_result;
             if (!result) {
-                LOG(ERROR) << "Failed to remove all objects: "
+                LOG(ERROR) << "Failed to grant allocation credit: "
                            << result.error().msg;
                 co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
             }
             co_return result->result();
         }());
-
-    timer.LogResponseExpected(result);
+    if (result) {
+        timer.LogResponse("credit_id=", result->id,
+                          ", ttl_ms=", result->ttl_ms);
+    } else {
+        timer.LogResponse("error_code=", result.error());
+    }
     return result;
 }
 
-tl::expected<void, ErrorCode> MasterClient::MountSegment(
-    const Segment& segment, const UUID& client_id) {
-    ScopedVLogTimer timer(1, "MasterClient::MountSegment");
-    timer.LogRequest("base=", segment.base, ", size=", segment.size,
-                     ", name=", segment.name, ", id=", segment.id,
-                     ", client_id=", client_id);
+std::vector<tl::expected<void, ErrorCode>> MasterClient::CommitCreditPuts(
+    const UUID& client_id, uint64_t credit_id,
+    const std::vector<CreditPut>& puts) {
+    ScopedVLogTimer timer(1, "MasterClient::CommitCreditPuts");
+    RequestTracer::ScopedSpan span("master_rpc", "CommitCreditPuts");
+    timer.LogRequest("credit_id=", credit_id, ", puts_count=", puts.size());
 
     auto client = client_accessor_.GetClient();
     if (!client) {
         LOG(ERROR) << "Client not available";
         timer.LogResponse("error=Client not available");
-        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+        return std::vector<tl::expected<void, ErrorCode>>(
+            puts.size(), tl::make_unexpected(ErrorCode::RPC_FAIL));
     }
 
-    auto result = syncAwait([&]() -> coro::Lazy<tl::expected<void, ErrorCode>> {
-        Lazy<async_rpc_result<tl::expected<void, ErrorCode>>> handler =
-            co_await client->send_request<&WrappedMasterService::MountSegment>(
-                segment, client_id);
-        async_rpc_result<tl::expected<void, ErrorCode>> result =
-            co_await handler;
-        if (!result) {
-            LOG(ERROR) << "Failed to mount segment due to rpc error";
-            co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
-        }
-        co_return result->result();
-    }());
-    timer.LogResponseExpected(result);
+    auto request_result =
+        client->send_request<&WrappedMasterService::CommitCreditPuts>(
+            client_id, credit_id, puts);
+    auto result = coro::syncAwait(
+        [&]() -> coro::Lazy<std::vector<tl::expected<void, ErrorCode>>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to commit credit puts: "
+                           << result.error().msg;
+                co_return std::vector<tl::expected<void, ErrorCode>>(
+                    puts.size(), tl::make_unexpected(ErrorCode::RPC_FAIL));
+            }
+            co_return result->result();
+        }());
+    timer.LogResponse("result=", result.size(), " operations");
     return result;
 }
 
-tl::expected<void, ErrorCode> MasterClient::ReMountSegment(
-    const std::vector<Segment>& segments, const UUID& client_id) {
-    ScopedVLogTimer timer(1, "MasterClient::ReMountSegment");
-    timer.LogRequest("segments_num=", segments.size(),
-                     ", client_id=", client_id);
+tl::expected<void, ErrorCode> MasterClient::ReturnAllocationCredit(
+    const UUID& client_id, uint64_t credit_id) {
+    ScopedVLogTimer timer(1, "MasterClient::ReturnAllocationCredit");
+    RequestTracer::ScopedSpan span("master_rpc", "ReturnAllocationCredit");
+    timer.LogRequest("credit_id=", credit_id);
 
     auto client = client_accessor_.GetClient();
     if (!client) {
@@ -508,17 +910,539 @@ tl::expected<void, ErrorCode> MasterClient::ReMountSegment(
         return tl::make_unexpected(ErrorCode::RPC_FAIL);
     }
 
-    auto result = syncAwait([&]() -> coro::Lazy<tl::expected<void, ErrorCode>> {
-        Lazy<async_rpc_result<tl::expected<void, ErrorCode>>> handler =
-            co_await client
-                ->send_request<&WrappedMasterService::ReMountSegment>(
-                    segments, client_id);
-        async_rpc_result<tl::expected<void, ErrorCode>> result =
-            co_await handler;
-        if (!result) {
-            LOG(ERROR) << "Failed to remount segment due to rpc error";
-            co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
-        }
+    auto request_result =
+        client->send_request<&WrappedMasterService::ReturnAllocationCredit>(
+            client_id, credit_id);
+    auto result =
+        coro::syncAwait([&]() -> coro::Lazy<tl::expected<void, ErrorCode>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to return allocation credit: "
+                           << result.error().msg;
+                co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+            }
+            co_return result->result();
+        }());
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<void, ErrorCode> MasterClient::PutDiskReplica(
+    const std::string& key, const DiskDescriptor& disk) {
+    ScopedVLogTimer timer(1, "MasterClient::PutDiskReplica");
+    RequestTracer::ScopedSpan span("master_rpc", "PutDiskReplica");
+    timer.LogRequest("key=", key, ", file_path=", disk.file_path);
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+
+    auto request_result =
+        client->send_request<&WrappedMasterService::PutDiskReplica>(key, disk);
+    auto result =
+        coro::syncAwait([&]() -> coro::Lazy<tl::expected<void, ErrorCode>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to put disk replica: "
+                           << result.error().msg;
+                co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+            }
+            co_return result->result();
+        }());
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+std::vector<tl::expected<void, ErrorCode>> MasterClient::BatchPutDiskReplica(
+    const std::vector<std::string>& keys,
+    const std::vector<DiskDescriptor>& disks) {
+    ScopedVLogTimer timer(1, "MasterClient::BatchPutDiskReplica");
+    RequestTracer::ScopedSpan span("master_rpc", "BatchPutDiskReplica");
+    timer.LogRequest("keys_count=", keys.size());
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return std::vector<tl::expected<void, ErrorCode>>(
+            keys.size(), tl::make_unexpected(ErrorCode::RPC_FAIL));
+    }
+
+    auto request_result =
+        client->send_request<&WrappedMasterService::BatchPutDiskReplica>(
+            keys, disks);
+    auto result = coro::syncAwait(
+        [&]() -> coro::Lazy<std::vector<tl::expected<void, ErrorCode>>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to put disk replicas: "
+                           << result.error().msg;
+                co_return std::vector<tl::expected<void, ErrorCode>>(
+                    keys.size(), tl::make_unexpected(ErrorCode::RPC_FAIL));
+            }
+            co_return result->result();
+        }());
+    timer.LogResponse("result=", result.size(), " operations");
+    return result;
+}
+
+tl::expected<std::vector<Replica::Descriptor>, ErrorCode>
+MasterClient::PromoteStart(const std::string& key,
+                           const std::vector<size_t>& slice_lengths,
+                           const ReplicateConfig& config) {
+    ScopedVLogTimer timer(1, "MasterClient::PromoteStart");
+    RequestTracer::ScopedSpan span("master_rpc", "PromoteStart");
+    timer.LogRequest("key=", key, ", slice_count=", slice_lengths.size());
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+
+    std::vector<uint64_t> rpc_slice_lengths(slice_lengths.begin(),
+                                            slice_lengths.end());
+    auto request_result =
+        client->send_request<&WrappedMasterService::PromoteStart>(
+            key, rpc_slice_lengths, config);
+    auto result = coro::syncAwait(
+        [&]() -> coro::Lazy<
+                  tl::expected<std::vector<Replica::Descriptor>, ErrorCode>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to start promotion: "
+                           << result.error().msg;
+                co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+            }
+            co_return result->result();
+        }());
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<CompactionTask, ErrorCode> MasterClient::CompactionStart(
+    const std::string& segment_name) {
+    ScopedVLogTimer timer(1, "MasterClient::CompactionStart");
+    RequestTracer::ScopedSpan span("master_rpc", "CompactionStart");
+    timer.LogRequest("segment_name=", segment_name);
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+
+    auto request_result =
+        client->send_request<&WrappedMasterService::CompactionStart>(
+            segment_name);
+    auto result = coro::syncAwait(
+        [&]() -> coro::Lazy<tl::expected<CompactionTask, ErrorCode>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to start compaction: "
+                           << result.error().msg;
+                co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+            }
+            co_return result->result();
+        }());
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<void, ErrorCode> MasterClient::CompactionEnd(
+    const std::string& key, uint64_t target) {
+    ScopedVLogTimer timer(1, "MasterClient::CompactionEnd");
+    RequestTracer::ScopedSpan span("master_rpc", "CompactionEnd");
+    timer.LogRequest("key=", key, ", target=", target);
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+
+    auto request_result =
+        client->send_request<&WrappedMasterService::CompactionEnd>(key,
+                                                                   target);
+    auto result =
+        coro::syncAwait([&]() -> coro::Lazy<tl::expected<void, ErrorCode>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to end compaction: "
+                           << result.error().msg;
+                co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+            }
+            co_return result->result();
+        }());
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<void, ErrorCode> MasterClient::CompactionRevoke(
+    const std::string& key, uint64_t target) {
+    ScopedVLogTimer timer(1, "MasterClient::CompactionRevoke");
+    RequestTracer::ScopedSpan span("master_rpc", "CompactionRevoke");
+    timer.LogRequest("key=", key, ", target=", target);
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+
+    auto request_result =
+        client->send_request<&WrappedMasterService::CompactionRevoke>(
+            key, target);
+    auto result =
+        coro::syncAwait([&]() -> coro::Lazy<tl::expected<void, ErrorCode>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to revoke compaction: "
+                           << result.error().msg;
+                co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+            }
+            co_return result->result();
+        }());
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<void, ErrorCode> MasterClient::CopyReplica(
+    const std::string& key, const std::string& target_segment) {
+    ScopedVLogTimer timer(1, "MasterClient::CopyReplica");
+    RequestTracer::ScopedSpan span("master_rpc", "CopyReplica");
+    timer.LogRequest("key=", key, ", target_segment=", target_segment);
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+
+    auto request_result =
+        client->send_request<&WrappedMasterService::CopyReplica>(
+            key, target_segment);
+    auto result =
+        coro::syncAwait([&]() -> coro::Lazy<tl::expected<void, ErrorCode>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to copy replica: "
+                           << result.error().msg;
+                co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+            }
+            co_return result->result();
+        }());
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<void, ErrorCode> MasterClient::MigrateReplica(
+    const std::string& key, const std::string& source_segment,
+    const std::string& target_segment) {
+    ScopedVLogTimer timer(1, "MasterClient::MigrateReplica");
+    RequestTracer::ScopedSpan span("master_rpc", "MigrateReplica");
+    timer.LogRequest("key=", key, ", source_segment=", source_segment,
+                     ", target_segment=", target_segment);
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+
+    auto request_result =
+        client->send_request<&WrappedMasterService::MigrateReplica>(
+            key, source_segment, target_segment);
+    auto result =
+        coro::syncAwait([&]() -> coro::Lazy<tl::expected<void, ErrorCode>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to migrate replica: "
+                           << result.error().msg;
+                co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+            }
+            co_return result->result();
+        }());
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<uint64_t, ErrorCode> MasterClient::Broadcast(
+    const std::string& key, const std::vector<std::string>& target_segments) {
+    ScopedVLogTimer timer(1, "MasterClient::Broadcast");
+    RequestTracer::ScopedSpan span("master_rpc", "Broadcast");
+    timer.LogRequest("key=", key,
+                     ", target_segment_count=", target_segments.size());
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+
+    auto request_result =
+        client->send_request<&WrappedMasterService::Broadcast>(
+            key, target_segments);
+    auto result = coro::syncAwait(
+        [&]() -> coro::Lazy<tl::expected<uint64_t, ErrorCode>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to broadcast: " << result.error().msg;
+                co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+            }
+            co_return result->result();
+        }());
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+std::vector<tl::expected<void, ErrorCode>> MasterClient::Prefetch(
+    const std::vector<std::string>& keys, const std::string& target_segment) {
+    ScopedVLogTimer timer(1, "MasterClient::Prefetch");
+    RequestTracer::ScopedSpan span("master_rpc", "Prefetch");
+    timer.LogRequest("keys_count=", keys.size(),
+                     ", target_segment=", target_segment);
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return std::vector<tl::expected<void, ErrorCode>>(
+            keys.size(), tl::make_unexpected(ErrorCode::RPC_FAIL));
+    }
+
+    auto request_result =
+        client->send_request<&WrappedMasterService::Prefetch>(keys,
+                                                              target_segment);
+    auto result = coro::syncAwait(
+        [&]() -> coro::Lazy<std::vector<tl::expected<void, ErrorCode>>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to prefetch: " << result.error().msg;
+                co_return std::vector<tl::expected<void, ErrorCode>>(
+                    keys.size(), tl::make_unexpected(ErrorCode::RPC_FAIL));
+            }
+            co_return result->result();
+        }());
+    timer.LogResponse("result=", result.size(), " operations");
+    return result;
+}
+
+std::vector<tl::expected<bool, ErrorCode>> MasterClient::CancelPrefetch(
+    const std::vector<std::string>& keys, const std::string& target_segment) {
+    ScopedVLogTimer timer(1, "MasterClient::CancelPrefetch");
+    RequestTracer::ScopedSpan span("master_rpc", "CancelPrefetch");
+    timer.LogRequest("keys_count=", keys.size(),
+                     ", target_segment=", target_segment);
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return std::vector<tl::expected<bool, ErrorCode>>(
+            keys.size(), tl::make_unexpected(ErrorCode::RPC_FAIL));
+    }
+
+    auto request_result =
+        client->send_request<&WrappedMasterService::CancelPrefetch>(
+            keys, target_segment);
+    auto result = coro::syncAwait(
+        [&]() -> coro::Lazy<std::vector<tl::expected<bool, ErrorCode>>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to cancel prefetch: "
+                           << result.error().msg;
+                co_return std::vector<tl::expected<bool, ErrorCode>>(
+                    keys.size(), tl::make_unexpected(ErrorCode::RPC_FAIL));
+            }
+            co_return result->result();
+        }());
+    timer.LogResponse("result=", result.size(), " operations");
+    return result;
+}
+
+tl::expected<void, ErrorCode> MasterClient::Remove(const std::string& key) {
+    ScopedVLogTimer timer(1, "MasterClient::Remove");
+    RequestTracer::ScopedSpan span("master_rpc", "Remove");
+    timer.LogRequest("key=", key);
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+
+    auto request_result =
+        client->send_request<&WrappedMasterService::Remove>(key);
+    auto result =
+        coro::syncAwait([&]() -> coro::Lazy<tl::expected<void, ErrorCode>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to remove object: " << result.error().msg;
+                co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+            }
+            co_return result->result();
+        }());
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<long, ErrorCode> MasterClient::RemoveAll() {
+    ScopedVLogTimer timer(1, "MasterClient::RemoveAll");
+    RequestTracer::ScopedSpan span("master_rpc", "RemoveAll");
+    timer.LogRequest("action=remove_all_objects");
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+
+    auto request_result =
+        client->send_request<&WrappedMasterService::RemoveAll>();
+    auto result =
+        coro::syncAwait([&]() -> coro::Lazy<tl::expected<long, ErrorCode>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to remove all objects: "
+                           << result.error().msg;
+                co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+            }
+            co_return result->result();
+        }());
+
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<long, ErrorCode> MasterClient::RemoveByTag(
+    const std::string& tag) {
+    ScopedVLogTimer timer(1, "MasterClient::RemoveByTag");
+    RequestTracer::ScopedSpan span("master_rpc", "RemoveByTag");
+    timer.LogRequest("tag=", tag);
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+
+    auto request_result =
+        client->send_request<&WrappedMasterService::RemoveByTag>(tag);
+    auto result =
+        coro::syncAwait([&]() -> coro::Lazy<tl::expected<long, ErrorCode>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to remove objects by tag: "
+                           << result.error().msg;
+                co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+            }
+            co_return result->result();
+        }());
+
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<long, ErrorCode> MasterClient::RemoveByPrefix(
+    const std::string& prefix) {
+    ScopedVLogTimer timer(1, "MasterClient::RemoveByPrefix");
+    RequestTracer::ScopedSpan span("master_rpc", "RemoveByPrefix");
+    timer.LogRequest("prefix=", prefix);
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+
+    auto request_result =
+        client->send_request<&WrappedMasterService::RemoveByPrefix>(prefix);
+    auto result =
+        coro::syncAwait([&]() -> coro::Lazy<tl::expected<long, ErrorCode>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to remove objects by prefix: "
+                           << result.error().msg;
+                co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+            }
+            co_return result->result();
+        }());
+
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<void, ErrorCode> MasterClient::MountSegment(
+    const Segment& segment, const UUID& client_id) {
+    ScopedVLogTimer timer(1, "MasterClient::MountSegment");
+    RequestTracer::ScopedSpan span("master_rpc", "MountSegment");
+    timer.LogRequest("base=", segment.base, ", size=", segment.size,
+                     ", name=", segment.name, ", id=", segment.id,
+                     ", client_id=", client_id);
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+
+    auto result = syncAwait([&]() -> coro::Lazy<tl::expected<void, ErrorCode>> {
+        Lazy<async_rpc_result<tl::expected<void, ErrorCode>>> handler =
+            co_await client->send_request<&WrappedMasterService::MountSegment>(
+                segment, client_id);
+        async_rpc_result<tl::expected<void, ErrorCode>> result =
+            co_await handler;
+        if (!result) {
+            LOG(ERROR) << "Failed to mount segment due to rpc error";
+            co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+        }
+        co_return result->result();
+    }());
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<void, ErrorCode> MasterClient::ReMountSegment(
+    const std::vector<Segment>& segments, const UUID& client_id) {
+    ScopedVLogTimer timer(1, "MasterClient::ReMountSegment");
+    RequestTracer::ScopedSpan span("master_rpc", "ReMountSegment");
+    timer.LogRequest("segments_num=", segments.size(),
+                     ", client_id=", client_id);
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+
+    auto result = syncAwait([&]() -> coro::Lazy<tl::expected<void, ErrorCode>> {
+        Lazy<async_rpc_result<tl::expected<void, ErrorCode>>> handler =
+            co_await client
+                ->send_request<&WrappedMasterService::ReMountSegment>(
+                    segments, client_id);
+        async_rpc_result<tl::expected<void, ErrorCode>> result =
+            co_await handler;
+        if (!result) {
+            LOG(ERROR) << "Failed to remount segment due to rpc error";
+            co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+        }
         co_return result->result();
     }());
     timer.LogResponseExpected(result);
@@ -528,6 +1452,7 @@ tl::expected<void, ErrorCode> MasterClient::ReMountSegment(
 tl::expected<void, ErrorCode> MasterClient::UnmountSegment(
     const UUID& segment_id, const UUID& client_id) {
     ScopedVLogTimer timer(1, "MasterClient::UnmountSegment");
+    RequestTracer::ScopedSpan span("master_rpc", "UnmountSegment");
     timer.LogRequest("segment_id=", segment_id, ", client_id=", client_id);
 
     auto client = client_accessor_.GetClient();
@@ -554,9 +1479,128 @@ tl::expected<void, ErrorCode> MasterClient::UnmountSegment(
     return result;
 }
 
+tl::expected<void, ErrorCode> MasterClient::DrainSegment(
+    const UUID& segment_id) {
+    ScopedVLogTimer timer(1, "MasterClient::DrainSegment");
+    RequestTracer::ScopedSpan span("master_rpc", "DrainSegment");
+    timer.LogRequest("segment_id=", segment_id);
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+
+    auto request_result =
+        client->send_request<&WrappedMasterService::DrainSegment>(segment_id);
+    auto result =
+        coro::syncAwait([&]() -> coro::Lazy<tl::expected<void, ErrorCode>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to drain segment: "
+                           << result.error().msg;
+                co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+            }
+            co_return result->result();
+        }());
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<uint64_t, ErrorCode> MasterClient::QueryDrain(
+    const UUID& segment_id) {
+    ScopedVLogTimer timer(1, "MasterClient::QueryDrain");
+    RequestTracer::ScopedSpan span("master_rpc", "QueryDrain");
+    timer.LogRequest("segment_id=", segment_id);
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+
+    auto request_result =
+        client->send_request<&WrappedMasterService::QueryDrain>(segment_id);
+    auto result = coro::syncAwait(
+        [&]() -> coro::Lazy<tl::expected<uint64_t, ErrorCode>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to query drain: "
+                           << result.error().msg;
+                co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+            }
+            co_return result->result();
+        }());
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<Segment, ErrorCode> MasterClient::AttachSegment(
+    const UUID& memory_id, const UUID& client_id) {
+    ScopedVLogTimer timer(1, "MasterClient::AttachSegment");
+    RequestTracer::ScopedSpan span("master_rpc", "AttachSegment");
+    timer.LogRequest("memory_id=", memory_id, ", client_id=", client_id);
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+
+    auto request_result =
+        client->send_request<&WrappedMasterService::AttachSegment>(
+            memory_id, client_id);
+    auto result = coro::syncAwait(
+        [&]() -> coro::Lazy<tl::expected<Segment, ErrorCode>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to attach segment: "
+                           << result.error().msg;
+                co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+            }
+            co_return result->result();
+        }());
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<void, ErrorCode> MasterClient::DetachSegment(
+    const UUID& memory_id, const UUID& client_id) {
+    ScopedVLogTimer timer(1, "MasterClient::DetachSegment");
+    RequestTracer::ScopedSpan span("master_rpc", "DetachSegment");
+    timer.LogRequest("memory_id=", memory_id, ", client_id=", client_id);
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+
+    auto request_result =
+        client->send_request<&WrappedMasterService::DetachSegment>(
+            memory_id, client_id);
+    auto result = coro::syncAwait(
+        [&]() -> coro::Lazy<tl::expected<void, ErrorCode>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to detach segment: "
+                           << result.error().msg;
+                co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+            }
+            co_return result->result();
+        }());
+    timer.LogResponseExpected(result);
+    return result;
+}
+
 tl::expected<std::pair<ViewVersionId, ClientStatus>, ErrorCode>
 MasterClient::Ping(const UUID& client_id) {
     ScopedVLogTimer timer(1, "MasterClient::Ping");
+    RequestTracer::ScopedSpan span("master_rpc", "Ping");
     timer.LogRequest("client_id=", client_id);
 
     auto client = client_accessor_.GetClient();
@@ -585,6 +1629,7 @@ MasterClient::Ping(const UUID& client_id) {
 
 tl::expected<std::string, ErrorCode> MasterClient::GetFsdir() {
     ScopedVLogTimer timer(1, "MasterClient::GetFsdir");
+    RequestTracer::ScopedSpan span("master_rpc", "GetFsdir");
     timer.LogRequest("action=get_fsdir");
 
     auto client = client_accessor_.GetClient();
@@ -610,4 +1655,140 @@ tl::expected<std::string, ErrorCode> MasterClient::GetFsdir() {
     return result;
 }
 
+tl::expected<ReplicaCacheInfo, ErrorCode>
+MasterClient::GetReplicaCacheInfo() {
+    ScopedVLogTimer timer(1, "MasterClient::GetReplicaCacheInfo");
+    RequestTracer::ScopedSpan span("master_rpc", "GetReplicaCacheInfo");
+    timer.LogRequest("action=get_replica_cache_info");
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+
+    auto request_result =
+        client->send_request<&WrappedMasterService::GetReplicaCacheInfo>();
+    auto result = coro::syncAwait(
+        [&]() -> coro::Lazy<tl::expected<ReplicaCacheInfo, ErrorCode>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to get replica cache info: "
+                           << result.error().msg;
+                co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+            }
+            co_return result->result();
+        }());
+
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<MetadataChanges, ErrorCode> MasterClient::GetMetadataChanges(
+    uint64_t seq, uint64_t max_keys) {
+    ScopedVLogTimer timer(1, "MasterClient::GetMetadataChanges");
+    RequestTracer::ScopedSpan span("master_rpc", "GetMetadataChanges");
+    timer.LogRequest("seq=", seq, ", max_keys=", max_keys);
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+
+    auto request_result =
+        client->send_request<&WrappedMasterService::GetMetadataChanges>(
+            seq, max_keys);
+    auto result = coro::syncAwait(
+        [&]() -> coro::Lazy<tl::expected<MetadataChanges, ErrorCode>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to get metadata changes: "
+                           << result.error().msg;
+                co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+            }
+            co_return result->result();
+        }());
+    if (result) {
+        timer.LogResponse("next_seq=", result->next_seq,
+                          ", reset=", result->reset,
+                          ", entries=", result->entries.size());
+    } else {
+        timer.LogResponse("error_code=", result.error());
+    }
+    return result;
+}
+
+tl::expected<MetadataSnapshot, ErrorCode> MasterClient::GetMetadataSnapshot(
+    uint64_t shard) {
+    ScopedVLogTimer timer(1, "MasterClient::GetMetadataSnapshot");
+    RequestTracer::ScopedSpan span("master_rpc", "GetMetadataSnapshot");
+    timer.LogRequest("shard=", shard);
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+
+    auto request_result =
+        client->send_request<&WrappedMasterService::GetMetadataSnapshot>(
+            shard);
+    auto result = coro::syncAwait(
+        [&]() -> coro::Lazy<tl::expected<MetadataSnapshot, ErrorCode>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to get metadata snapshot: "
+                           << result.error().msg;
+                co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+            }
+            co_return result->result();
+        }());
+    if (result) {
+        timer.LogResponse("next_shard=", result->next_shard,
+                          ", entries=", result->entries.size());
+    } else {
+        timer.LogResponse("error_code=", result.error());
+    }
+    return result;
+}
+
+tl::expected<KeyFilterUpdate, ErrorCode> MasterClient::GetKeyFilter(
+    uint64_t seq) {
+    ScopedVLogTimer timer(1, "MasterClient::GetKeyFilter");
+    RequestTracer::ScopedSpan span("master_rpc", "GetKeyFilter");
+    timer.LogRequest("seq=", seq);
+
+    auto client = client_accessor_.GetClient();
+    if (!client) {
+        LOG(ERROR) << "Client not available";
+        timer.LogResponse("error=Client not available");
+        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+
+    auto request_result =
+        client->send_request<&WrappedMasterService::GetKeyFilter>(seq);
+    auto result = coro::syncAwait(
+        [&]() -> coro::Lazy<tl::expected<KeyFilterUpdate, ErrorCode>> {
+            auto result = co_await co_await request_result;
+            if (!result) {
+                LOG(ERROR) << "Failed to get key filter: "
+                           << result.error().msg;
+                co_return tl::make_unexpected(ErrorCode::RPC_FAIL);
+            }
+            co_return result->result();
+        }());
+    if (result) {
+        timer.LogResponse("next_seq=", result->next_seq,
+                          ", reset=", result->reset,
+                          ", keys=", result->keys.size());
+    } else {
+        timer.LogResponse("error_code=", result.error());
+    }
+    return result;
+}
+
 }  // namespace mooncake
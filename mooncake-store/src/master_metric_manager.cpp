@@ -1,11 +1,53 @@
 #include "master_metric_manager.h"
 
+#include <array>
+#include <cctype>
 #include <iomanip>  // For std::fixed, std::setprecision
+#include <map>
 #include <sstream>  // For string building during serialization
 #include <vector>   // Required by histogram serialization
 
 namespace mooncake {
 
+namespace {
+
+// The RPCs of WrappedMasterService that get a latency histogram
+constexpr std::array<std::string_view, 45> kRpcNames = {
+    "ExistKey",         "BatchExistKey",       "LongestPrefixMatch",
+    "ScanKeys",         "GetReplicaList",      "BatchGetReplicaList",
+    "PutStart",         "PutEnd",              "PutRevoke",
+    "BatchPutStart",    "BatchPutEnd",         "BatchPutRevoke",
+    "PutDiskReplica",   "PromoteStart",        "CompactionStart",
+    "CompactionEnd",    "CompactionRevoke",    "CopyReplica",
+    "MigrateReplica",   "Remove",              "RemoveAll",
+    "RemoveByTag",      "MountSegment",        "ReMountSegment",
+    "UnmountSegment",   "DrainSegment",        "QueryDrain",
+    "GetFsdir",         "Ping",                "GetReplicaCacheInfo",
+    "GetMetadataChanges", "GetMetadataSnapshot", "GetKeyFilter",
+    "GrantAllocationCredit", "CommitCreditPuts", "ReturnAllocationCredit",
+    "Broadcast",        "RemoveByPrefix",      "BatchTouch",
+    "Prefetch",         "CancelPrefetch",      "BatchPutDiskReplica",
+    "BatchQueryLocation", "AttachSegment",    "DetachSegment"};
+
+// PutStart -> put_start
+std::string ToSnakeCase(std::string_view name) {
+    std::string snake;
+    for (size_t i = 0; i < name.size(); ++i) {
+        if (std::isupper(static_cast<unsigned char>(name[i]))) {
+            if (i > 0) {
+                snake += '_';
+            }
+            snake += static_cast<char>(
+                std::tolower(static_cast<unsigned char>(name[i])));
+        } else {
+            snake += name[i];
+        }
+    }
+    return snake;
+}
+
+}  // namespace
+
 // --- Singleton Instance ---
 MasterMetricManager& MasterMetricManager::instance() {
     // Guaranteed to be lazy initialized and thread-safe in C++11+
@@ -21,9 +63,10 @@ MasterMetricManager::MasterMetricManager()
       total_capacity_("master_total_capacity_bytes",
                       "Total capacity across all mounted segments"),
       key_count_("master_key_count",
-                 "Total number of keys managed by the master"),
+                 "Total number of keys managed by the master", "gauge"),
       soft_pin_key_count_("master_soft_pin_key_count",
-                          "Total number of soft-pinned keys managed by the master"),
+                          "Total number of soft-pinned keys managed by the master",
+                          "gauge"),
       // Initialize Histogram (4KB, 64KB, 256KB, 1MB, 4MB, 16MB, 64MB)
       value_size_distribution_("master_value_size_bytes",
                                "Distribution of object value sizes",
@@ -97,6 +140,10 @@ MasterMetricManager::MasterMetricManager()
                                        "Total number of BatchGetReplicaList requests received"),
       batch_get_replica_list_failures_("master_batch_get_replica_list_failures_total",
                                        "Total number of failed BatchGetReplicaList requests"),
+      longest_prefix_match_requests_("master_longest_prefix_match_requests_total",
+                                     "Total number of LongestPrefixMatch requests received"),
+      longest_prefix_match_failures_("master_longest_prefix_match_failures_total",
+                                     "Total number of failed LongestPrefixMatch requests"),
       batch_put_start_requests_("master_batch_put_start_requests_total",
                                 "Total number of BatchPutStart requests received"),
       batch_put_start_failures_("master_batch_put_start_failures_total",
@@ -110,6 +157,47 @@ MasterMetricManager::MasterMetricManager()
       batch_put_revoke_failures_("master_batch_put_revoke_failures_total",
                                  "Total number of failed BatchPutRevoke requests"),
 
+      // Initialize Metadata Shard Lock Counters
+      shard_read_contentions_(
+          "master_shard_read_lock_contentions_total",
+          "Total number of shared metadata shard lock acquisitions that had "
+          "to wait"),
+      shard_write_contentions_(
+          "master_shard_write_lock_contentions_total",
+          "Total number of exclusive metadata shard lock acquisitions that "
+          "had to wait"),
+
+      // Initialize Content Deduplication Counters
+      dedup_hits_("master_dedup_hits_total",
+                  "Total number of puts that found their content stored "
+                  "already"),
+      dedup_saved_bytes_("master_dedup_saved_bytes_total",
+                         "Total bytes that deduplicated puts did not store"),
+
+      // Initialize Upsert Counters
+      upserts_("master_upserts_total",
+               "Total number of puts that replaced an existing object"),
+      upserts_in_place_("master_upserts_in_place_total",
+                        "Total number of upserts written into the buffers "
+                        "of the previous value"),
+
+      // Initialize Hot Replica Counters
+      hot_replicas_created_("master_hot_replicas_created_total",
+                            "Total number of extra replicas made of objects "
+                            "read often"),
+      hot_replicas_retired_("master_hot_replicas_retired_total",
+                            "Total number of extra replicas removed after "
+                            "their objects cooled down"),
+
+      // Initialize Segment Drain Metrics
+      draining_segments_("master_draining_segments",
+                         "Number of segments being drained"),
+      drain_remaining_bytes_("master_drain_remaining_bytes",
+                             "Bytes still allocated on draining segments"),
+      drain_moved_bytes_("master_drain_moved_bytes_total",
+                         "Total bytes of replicas moved off draining "
+                         "segments"),
+
       // Initialize Eviction Counters
       eviction_success_("master_successful_evictions_total",
                        "Total number of successful eviction operations"),
@@ -118,7 +206,63 @@ MasterMetricManager::MasterMetricManager()
       evicted_key_count_("master_evicted_key_count",
                         "Total number of keys evicted"),
       evicted_size_("master_evicted_size_bytes",
-                    "Total bytes of evicted objects") {}
+                    "Total bytes of evicted objects"),
+
+      // Initialize Proactive Eviction Metrics
+      allocation_rate_("master_allocation_rate_bytes",
+                       "Bytes per second requested from the allocators, "
+                       "smoothed, as seen by the proactive eviction"),
+      eviction_headroom_target_(
+          "master_eviction_headroom_target_bytes",
+          "Free space the proactive eviction keeps below the high watermark"),
+      proactive_evictions_("master_proactive_evictions_total",
+                           "Total number of proactive eviction rounds"),
+
+      // Initialize Compaction Counters
+      compaction_relocations_("master_compaction_relocations_total",
+                              "Total number of replicas relocated out of "
+                              "fragmented segments"),
+      compaction_relocated_size_("master_compaction_relocated_size_bytes",
+                                 "Total bytes of relocated replicas"),
+      compaction_failures_("master_compaction_failures_total",
+                           "Total number of revoked relocations"),
+
+      // Initialize GC Metrics (1ms, 10ms, 100ms, 1s, 10s)
+      gc_pending_tasks_("master_gc_pending_tasks",
+                        "Number of GC tasks waiting for their deletion time"),
+      gc_lag_distribution_("master_gc_lag_milliseconds",
+                           "Delay between the deletion time of GC tasks and "
+                           "their processing",
+                           {1, 10, 100, 1000, 10000}),
+      // Durations in microseconds (100us, 1ms, 10ms, 100ms, 1s, 10s)
+      gc_duration_distribution_("master_gc_duration_microseconds",
+                                "Duration of a round of GC task processing",
+                                {100, 1000, 10000, 100000, 1000000, 10000000}),
+      eviction_duration_distribution_(
+          "master_eviction_duration_microseconds",
+          "Duration of an eviction pass",
+          {100, 1000, 10000, 100000, 1000000, 10000000}),
+
+      // Initialize Shard Lock Timing Metrics (1us to 100ms)
+      shard_lock_wait_distribution_(
+          "master_shard_lock_wait_microseconds",
+          "Time contended acquisitions waited for a metadata shard mutex",
+          {1, 10, 100, 1000, 10000, 100000}),
+      shard_lock_hold_distribution_(
+          "master_shard_lock_hold_microseconds",
+          "Time a metadata shard mutex was held, sampled",
+          {1, 10, 100, 1000, 10000, 100000}) {
+    // Latencies from 10us to 1s
+    for (std::string_view rpc_name : kRpcNames) {
+        auto histogram = std::make_unique<ShardedHistogram>(
+            "master_rpc_" + ToSnakeCase(rpc_name) + "_latency_microseconds",
+            "Latency of " + std::string(rpc_name) + " in the master",
+            std::vector<double>{10, 50, 100, 500, 1000, 5000, 10000, 100000,
+                                1000000});
+        rpc_latency_by_name_.emplace(rpc_name, histogram.get());
+        rpc_latencies_.push_back(std::move(histogram));
+    }
+}
 
 // --- Metric Interface Methods ---
 
@@ -267,6 +411,12 @@ void MasterMetricManager::inc_batch_get_replica_list_requests(int64_t val) {
 void MasterMetricManager::inc_batch_get_replica_list_failures(int64_t val) {
     batch_get_replica_list_failures_.inc(val);
 }
+void MasterMetricManager::inc_longest_prefix_match_requests(int64_t val) {
+    longest_prefix_match_requests_.inc(val);
+}
+void MasterMetricManager::inc_longest_prefix_match_failures(int64_t val) {
+    longest_prefix_match_failures_.inc(val);
+}
 void MasterMetricManager::inc_batch_put_start_requests(int64_t val) {
     batch_put_start_requests_.inc(val);
 }
@@ -390,6 +540,14 @@ int64_t MasterMetricManager::get_batch_get_replica_list_failures() {
     return batch_get_replica_list_failures_.value();
 }
 
+int64_t MasterMetricManager::get_longest_prefix_match_requests() {
+    return longest_prefix_match_requests_.value();
+}
+
+int64_t MasterMetricManager::get_longest_prefix_match_failures() {
+    return longest_prefix_match_failures_.value();
+}
+
 int64_t MasterMetricManager::get_batch_put_start_requests() {
     return batch_put_start_requests_.value();
 }
@@ -414,6 +572,88 @@ int64_t MasterMetricManager::get_batch_put_revoke_failures() {
     return batch_put_revoke_failures_.value();
 }
 
+// Metadata Shard Lock Metrics
+void MasterMetricManager::inc_shard_read_contentions(int64_t val) {
+    shard_read_contentions_.inc(val);
+}
+
+void MasterMetricManager::inc_shard_write_contentions(int64_t val) {
+    shard_write_contentions_.inc(val);
+}
+
+void MasterMetricManager::observe_shard_lock_wait(int64_t wait_us) {
+    shard_lock_wait_distribution_.observe(wait_us);
+}
+
+void MasterMetricManager::observe_shard_lock_hold(int64_t hold_us) {
+    shard_lock_hold_distribution_.observe(hold_us);
+}
+
+int64_t MasterMetricManager::get_shard_read_contentions() {
+    return shard_read_contentions_.value();
+}
+
+int64_t MasterMetricManager::get_shard_write_contentions() {
+    return shard_write_contentions_.value();
+}
+
+// Content Deduplication Metrics
+void MasterMetricManager::inc_dedup_hits(int64_t saved_bytes) {
+    dedup_hits_.inc();
+    dedup_saved_bytes_.inc(saved_bytes);
+}
+
+int64_t MasterMetricManager::get_dedup_hits() { return dedup_hits_.value(); }
+
+int64_t MasterMetricManager::get_dedup_saved_bytes() {
+    return dedup_saved_bytes_.value();
+}
+
+// Upsert Metrics
+void MasterMetricManager::inc_upserts() { upserts_.inc(); }
+
+void MasterMetricManager::inc_upserts_in_place() { upserts_in_place_.inc(); }
+
+int64_t MasterMetricManager::get_upserts() { return upserts_.value(); }
+
+int64_t MasterMetricManager::get_upserts_in_place() {
+    return upserts_in_place_.value();
+}
+
+// Hot Replica Metrics
+void MasterMetricManager::inc_hot_replicas_created() {
+    hot_replicas_created_.inc();
+}
+
+void MasterMetricManager::inc_hot_replicas_retired() {
+    hot_replicas_retired_.inc();
+}
+
+int64_t MasterMetricManager::get_hot_replicas_created() {
+    return hot_replicas_created_.value();
+}
+
+int64_t MasterMetricManager::get_hot_replicas_retired() {
+    return hot_replicas_retired_.value();
+}
+
+// Segment Drain Metrics
+void MasterMetricManager::set_draining_segments(int64_t count) {
+    draining_segments_.update(count);
+}
+
+void MasterMetricManager::set_drain_remaining_bytes(int64_t bytes) {
+    drain_remaining_bytes_.update(bytes);
+}
+
+void MasterMetricManager::inc_drain_moved_bytes(int64_t bytes) {
+    drain_moved_bytes_.inc(bytes);
+}
+
+int64_t MasterMetricManager::get_drain_moved_bytes() {
+    return drain_moved_bytes_.value();
+}
+
 // Eviction Metrics
 void MasterMetricManager::inc_eviction_success(int64_t key_count, int64_t size) {
     evicted_key_count_.inc(key_count);
@@ -426,6 +666,123 @@ void MasterMetricManager::inc_eviction_fail() {
     eviction_attempts_.inc();
 }
 
+// Proactive Eviction Metrics
+void MasterMetricManager::set_allocation_rate(int64_t bytes_per_sec) {
+    allocation_rate_.update(bytes_per_sec);
+}
+
+void MasterMetricManager::set_eviction_headroom_target(int64_t bytes) {
+    eviction_headroom_target_.update(bytes);
+}
+
+void MasterMetricManager::inc_proactive_evictions() {
+    proactive_evictions_.inc();
+}
+
+int64_t MasterMetricManager::get_proactive_evictions() {
+    return proactive_evictions_.value();
+}
+
+// Compaction Metrics
+void MasterMetricManager::inc_compaction_success(int64_t size) {
+    compaction_relocations_.inc();
+    compaction_relocated_size_.inc(size);
+}
+
+void MasterMetricManager::inc_compaction_fail() {
+    compaction_failures_.inc();
+}
+
+// GC Metrics
+void MasterMetricManager::inc_gc_pending_tasks(int64_t val) {
+    gc_pending_tasks_.inc(val);
+}
+
+void MasterMetricManager::dec_gc_pending_tasks(int64_t val) {
+    gc_pending_tasks_.dec(val);
+}
+
+void MasterMetricManager::observe_gc_lag(int64_t lag_ms) {
+    gc_lag_distribution_.observe(lag_ms);
+}
+
+void MasterMetricManager::observe_gc_duration(int64_t duration_us) {
+    gc_duration_distribution_.observe(duration_us);
+}
+
+void MasterMetricManager::observe_eviction_duration(int64_t duration_us) {
+    eviction_duration_distribution_.observe(duration_us);
+}
+
+ShardedHistogram* MasterMetricManager::rpc_latency_histogram(
+    std::string_view rpc_name) {
+    auto it = rpc_latency_by_name_.find(rpc_name);
+    return it == rpc_latency_by_name_.end() ? nullptr : it->second;
+}
+
+void MasterMetricManager::set_namespaces(
+    const std::vector<std::string>& names) {
+    std::lock_guard<std::mutex> lock(namespace_mutex_);
+    if (!namespace_metrics_.empty()) {
+        return;
+    }
+    for (const auto& name : names) {
+        const std::map<std::string, std::string> labels{{"namespace", name}};
+        namespace_metrics_.push_back(
+            std::unique_ptr<NamespaceMetrics>(new NamespaceMetrics{
+                name,
+                ylt::metric::gauge_t("master_namespace_used_bytes",
+                                     "Bytes of the objects of the namespace "
+                                     "in memory",
+                                     labels),
+                ylt::metric::gauge_t("master_namespace_share_bytes",
+                                     "Fair share of the namespace of the "
+                                     "space below the high watermark",
+                                     labels),
+                ylt::metric::counter_t("master_namespace_gets_total",
+                                       "Total number of replica list "
+                                       "lookups in the namespace",
+                                       labels),
+                ylt::metric::counter_t("master_namespace_hits_total",
+                                       "Total number of replica list "
+                                       "lookups that found the object",
+                                       labels),
+                ylt::metric::counter_t("master_namespace_rejected_puts_total",
+                                       "Total number of puts refused as the "
+                                       "namespace was at its capacity",
+                                       labels)}));
+    }
+    namespace_count_.store(namespace_metrics_.size(),
+                           std::memory_order_release);
+}
+
+void MasterMetricManager::set_namespace_usage(size_t ns, int64_t used_bytes,
+                                              int64_t share_bytes) {
+    if (ns < namespace_count_.load(std::memory_order_acquire)) {
+        namespace_metrics_[ns]->used_bytes.update(used_bytes);
+        namespace_metrics_[ns]->share_bytes.update(share_bytes);
+    }
+}
+
+void MasterMetricManager::inc_namespace_gets(size_t ns, bool hit) {
+    if (ns < namespace_count_.load(std::memory_order_acquire)) {
+        namespace_metrics_[ns]->gets.inc();
+        if (hit) {
+            namespace_metrics_[ns]->hits.inc();
+        }
+    }
+}
+
+void MasterMetricManager::inc_namespace_rejected_puts(size_t ns) {
+    if (ns < namespace_count_.load(std::memory_order_acquire)) {
+        namespace_metrics_[ns]->rejected_puts.inc();
+    }
+}
+
+int64_t MasterMetricManager::get_gc_pending_tasks() {
+    return gc_pending_tasks_.value();
+}
+
 int64_t MasterMetricManager::get_eviction_success() {
     return eviction_success_.value();
 }
@@ -504,6 +861,8 @@ std::string MasterMetricManager::serialize_metrics() {
     serialize_metric(batch_exist_key_failures_);
     serialize_metric(batch_get_replica_list_requests_);
     serialize_metric(batch_get_replica_list_failures_);
+    serialize_metric(longest_prefix_match_requests_);
+    serialize_metric(longest_prefix_match_failures_);
     serialize_metric(batch_put_start_requests_);
     serialize_metric(batch_put_start_failures_);
     serialize_metric(batch_put_end_requests_);
@@ -511,12 +870,67 @@ std::string MasterMetricManager::serialize_metrics() {
     serialize_metric(batch_put_revoke_requests_);
     serialize_metric(batch_put_revoke_failures_);
 
+    // Serialize Metadata Shard Lock Counters
+    serialize_metric(shard_read_contentions_);
+    serialize_metric(shard_write_contentions_);
+    serialize_metric(shard_lock_wait_distribution_);
+    serialize_metric(shard_lock_hold_distribution_);
+
+    // Serialize Content Deduplication Counters
+    serialize_metric(dedup_hits_);
+    serialize_metric(dedup_saved_bytes_);
+
+    // Serialize Upsert Counters
+    serialize_metric(upserts_);
+    serialize_metric(upserts_in_place_);
+
+    // Serialize Hot Replica Counters
+    serialize_metric(hot_replicas_created_);
+    serialize_metric(hot_replicas_retired_);
+
+    // Serialize Segment Drain Metrics
+    serialize_metric(draining_segments_);
+    serialize_metric(drain_remaining_bytes_);
+    serialize_metric(drain_moved_bytes_);
+
     // Serialize Eviction Counters
     serialize_metric(eviction_success_);
     serialize_metric(eviction_attempts_);
     serialize_metric(evicted_key_count_);
     serialize_metric(evicted_size_);
 
+    // Serialize Proactive Eviction Metrics
+    serialize_metric(allocation_rate_);
+    serialize_metric(eviction_headroom_target_);
+    serialize_metric(proactive_evictions_);
+
+    // Serialize Compaction Counters
+    serialize_metric(compaction_relocations_);
+    serialize_metric(compaction_relocated_size_);
+    serialize_metric(compaction_failures_);
+
+    // Serialize GC Metrics
+    serialize_metric(gc_pending_tasks_);
+    serialize_metric(gc_lag_distribution_);
+    serialize_metric(gc_duration_distribution_);
+    serialize_metric(eviction_duration_distribution_);
+
+    // Serialize RPC Latency Metrics
+    for (auto& histogram : rpc_latencies_) {
+        serialize_metric(*histogram);
+    }
+
+    // Serialize Namespace Metrics
+    const size_t namespaces = namespace_count_.load(std::memory_order_acquire);
+    for (size_t ns = 0; ns < namespaces; ++ns) {
+        auto& metrics = *namespace_metrics_[ns];
+        serialize_metric(metrics.used_bytes);
+        serialize_metric(metrics.share_bytes);
+        serialize_metric(metrics.gets);
+        serialize_metric(metrics.hits);
+        serialize_metric(metrics.rejected_puts);
+    }
+
     return ss.str();
 }
 
@@ -602,6 +1016,22 @@ std::string MasterMetricManager::get_summary_string() {
         << "keys=" << evicted_key_count << ", "
         << "size=" << format_bytes(evicted_size);
 
+    // Namespace summary: memory used and hit rate of the lookups
+    const size_t namespaces = namespace_count_.load(std::memory_order_acquire);
+    if (namespaces > 0) {
+        ss << " | Namespaces: ";
+    }
+    for (size_t ns = 0; ns < namespaces; ++ns) {
+        auto& metrics = *namespace_metrics_[ns];
+        const int64_t gets = metrics.gets.value();
+        ss << (ns > 0 ? ", " : "") << metrics.name << "="
+           << format_bytes(metrics.used_bytes.value());
+        if (gets > 0) {
+            ss << " (hits " << std::fixed << std::setprecision(1)
+               << (double)metrics.hits.value() / (double)gets * 100.0 << "%)";
+        }
+    }
+
     return ss.str();
 }
 
@@ -1,34 +1,55 @@
 #include "master_service.h"
 
+#include <algorithm>
 #include <cassert>
+#include <charconv>
 #include <cstdint>
-#include <queue>
+#include <iterator>
+#include <latch>
+#include <limits>
 #include <shared_mutex>
 #include <ylt/util/tl/expected.hpp>
 
+#include "erasure_code.h"
 #include "master_metric_manager.h"
+#include "tracepoint.h"
 #include "types.h"
 
 namespace mooncake {
 
-MasterService::MasterService(bool enable_gc, uint64_t default_kv_lease_ttl,
-                             uint64_t default_kv_soft_pin_ttl,
-                             bool allow_evict_soft_pinned_objects,
-                             double eviction_ratio,
-                             double eviction_high_watermark_ratio,
-                             ViewVersionId view_version,
-                             int64_t client_live_ttl_sec, bool enable_ha,
-                             const std::string& cluster_id)
-    : allocation_strategy_(std::make_shared<RandomAllocationStrategy>()),
-      enable_gc_(enable_gc),
-      default_kv_lease_ttl_(default_kv_lease_ttl),
-      default_kv_soft_pin_ttl_(default_kv_soft_pin_ttl),
-      allow_evict_soft_pinned_objects_(allow_evict_soft_pinned_objects),
-      eviction_ratio_(eviction_ratio),
-      eviction_high_watermark_ratio_(eviction_high_watermark_ratio),
-      client_live_ttl_sec_(client_live_ttl_sec),
-      enable_ha_(enable_ha),
-      cluster_id_(cluster_id) {
+MasterService::MasterService(const MasterServiceConfig& config)
+    : segment_manager_(config.buffer_allocator_type,
+                       config.enable_failover_restore
+                           ? std::chrono::steady_clock::duration(
+                                 kRestoreFreeDelay)
+                           : std::chrono::steady_clock::duration::zero()),
+      allocation_strategy_(
+          CreateAllocationStrategy(config.allocation_strategy)),
+      namespaces_(config.namespace_config),
+      enable_gc_(config.enable_gc),
+      default_kv_lease_ttl_(config.default_kv_lease_ttl),
+      default_kv_soft_pin_ttl_(config.default_kv_soft_pin_ttl),
+      allow_evict_soft_pinned_objects_(config.allow_evict_soft_pinned_objects),
+      eviction_ratio_(config.eviction_ratio),
+      eviction_high_watermark_ratio_(config.eviction_high_watermark_ratio),
+      eviction_engine_(config.eviction_engine),
+      eviction_low_watermark_ratio_(config.eviction_low_watermark_ratio),
+      enable_disk_tier_(config.enable_disk_tier),
+      compaction_fragmentation_ratio_(config.compaction_fragmentation_ratio),
+      hot_replica_read_rate_(config.hot_replica_read_rate),
+      hot_window_start_(std::chrono::steady_clock::now()),
+      drain_rate_bytes_(config.drain_rate_bytes),
+      last_drain_(std::chrono::steady_clock::now()),
+      inline_object_max_size_(config.inline_object_max_size),
+      stripe_min_size_(config.stripe_min_size),
+      persistent_segment_ttl_sec_(config.persistent_segment_ttl_sec),
+      keep_persistent_replicas_(config.buffer_allocator_type ==
+                                BufferAllocatorType::OFFSET),
+      enable_failover_restore_(config.enable_failover_restore),
+      view_version_(config.view_version),
+      client_live_ttl_sec_(config.client_live_ttl_sec),
+      enable_ha_(config.enable_ha),
+      cluster_id_(config.cluster_id) {
     if (eviction_ratio_ < 0.0 || eviction_ratio_ > 1.0) {
         LOG(ERROR) << "Eviction ratio must be between 0.0 and 1.0, "
                    << "current value: " << eviction_ratio_;
@@ -41,11 +62,35 @@ MasterService::MasterService(bool enable_gc, uint64_t default_kv_lease_ttl,
             << "current value: " << eviction_high_watermark_ratio_;
         throw std::invalid_argument("Invalid eviction high watermark ratio");
     }
+    if (eviction_low_watermark_ratio_ < 0.0 ||
+        eviction_low_watermark_ratio_ > eviction_high_watermark_ratio_) {
+        LOG(ERROR) << "Eviction low watermark ratio must be between 0.0 and "
+                   << "the high watermark ratio, current value: "
+                   << eviction_low_watermark_ratio_;
+        throw std::invalid_argument("Invalid eviction low watermark ratio");
+    }
+    if (compaction_fragmentation_ratio_ < 0.0 ||
+        compaction_fragmentation_ratio_ > 1.0) {
+        LOG(ERROR)
+            << "Compaction fragmentation ratio must be between 0.0 and 1.0, "
+            << "current value: " << compaction_fragmentation_ratio_;
+        throw std::invalid_argument("Invalid compaction fragmentation ratio");
+    }
+    if (namespaces_.enabled()) {
+        MasterMetricManager::instance().set_namespaces(namespaces_.Names());
+    }
+    for (auto& shard : metadata_shards_) {
+        if (auto policy = CreateEvictionPolicy(eviction_engine_)) {
+            shard.eviction_tracker =
+                std::make_unique<EvictionTracker>(std::move(policy));
+        }
+    }
+
     gc_running_ = true;
     gc_thread_ = std::thread(&MasterService::GCThreadFunc, this);
     VLOG(1) << "action=start_gc_thread";
 
-    if (enable_ha) {
+    if (enable_ha_) {
         client_monitor_running_ = true;
         client_monitor_thread_ =
             std::thread(&MasterService::ClientMonitorFunc, this);
@@ -64,16 +109,60 @@ MasterService::~MasterService() {
         client_monitor_thread_.join();
     }
 
-    // Clean up any remaining GC tasks
-    GCTask* task = nullptr;
-    while (gc_queue_.pop(task)) {
-        if (task) {
-            delete task;
-        }
+    for (auto& shard : gc_shards_) {
+        MutexLocker lock(&shard.mutex);
+        MasterMetricManager::instance().dec_gc_pending_tasks(
+            shard.tasks.size());
     }
 }
 
 auto MasterService::MountSegment(const Segment& segment, const UUID& client_id)
+    -> tl::expected<void, ErrorCode> {
+    const bool persistent = segment.memory_id != UUID{0, 0};
+    if (persistent && !keep_persistent_replicas_) {
+        LOG(WARNING) << "segment_name=" << segment.name
+                     << ", memory_id=" << segment.memory_id
+                     << ", warn=persistent_segment_needs_offset_allocator"
+                     << ", its replicas are dropped on unmount";
+    }
+    if (persistent) {
+        // A restarted client may map the memory before its predecessor
+        // expires: take the memory over, parking the replicas in it
+        Segment previous;
+        UUID owner;
+        ErrorCode err;
+        {
+            ScopedSegmentAccess segment_access =
+                segment_manager_.getSegmentAccess();
+            err = segment_access.FindMemorySegment(segment.memory_id,
+                                                   previous, owner);
+        }
+        if (err == ErrorCode::OK && previous.id != segment.id) {
+            LOG(INFO) << "segment_name=" << segment.name
+                      << ", previous_client_id=" << owner
+                      << ", action=take_over_persistent_segment";
+            auto result = UnmountSegment(previous.id, owner);
+            if (!result) {
+                return result;
+            }
+        }
+    }
+
+    std::vector<std::pair<std::string, Replica>> restored;
+    auto result = MountSegmentLocked(segment, client_id, restored);
+    if (!result) {
+        return result;
+    }
+    // Placed under the segment mutex, added to their objects without it
+    for (auto& [key, replica] : restored) {
+        AddRestoredReplica(key, std::move(replica));
+    }
+    return {};
+}
+
+auto MasterService::MountSegmentLocked(
+    const Segment& segment, const UUID& client_id,
+    std::vector<std::pair<std::string, Replica>>& restored)
     -> tl::expected<void, ErrorCode> {
     ScopedSegmentAccess segment_access = segment_manager_.getSegmentAccess();
 
@@ -106,6 +195,15 @@ auto MasterService::MountSegment(const Segment& segment, const UUID& client_id)
     } else if (err != ErrorCode::OK) {
         return tl::make_unexpected(err);
     }
+    if (enable_failover_restore_) {
+        // A new segment of the name belongs to a restarted client, the
+        // memory of the restored replicas is gone
+        MutexLocker lock(&restore_mutex_);
+        pending_replicas_.erase(segment.name);
+    }
+    if (segment.memory_id != UUID{0, 0}) {
+        restored = PlaceParkedReplicas(segment_access, segment);
+    }
     return {};
 }
 
@@ -125,31 +223,41 @@ auto MasterService::ReMountSegment(const std::vector<Segment>& segments,
         return {};
     }
 
-    ScopedSegmentAccess segment_access = segment_manager_.getSegmentAccess();
+    std::vector<std::pair<std::string, Replica>> restored;
+    {
+        ScopedSegmentAccess segment_access =
+            segment_manager_.getSegmentAccess();
 
-    // Tell the client monitor thread to start timing for this client. To
-    // avoid the following undesired situations, this message must be sent
-    // after locking the segment mutex or client mutex and before the remounting
-    // operation completes:
-    // 1. Sending the message before the lock: the client expires and
-    // unmouting invokes before this remounting are completed, which prevents
-    // this segment being able to be unmounted forever;
-    // 2. Sending the message after remounting the segments: After remounting
-    // these segments, when trying to push id to the queue, the queue is
-    // already full. However, at this point, the message must be sent,
-    // otherwise this client cannot be monitored and expired.
-    PodUUID pod_client_id;
-    pod_client_id.first = client_id.first;
-    pod_client_id.second = client_id.second;
-    if (!client_ping_queue_.push(pod_client_id)) {
-        LOG(ERROR) << "client_id=" << client_id
-                   << ", error=client_ping_queue_full";
-        return tl::make_unexpected(ErrorCode::INTERNAL_ERROR);
-    }
+        // Tell the client monitor thread to start timing for this client. To
+        // avoid the following undesired situations, this message must be
+        // sent after locking the segment mutex or client mutex and before the
+        // remounting operation completes:
+        // 1. Sending the message before the lock: the client expires and
+        // unmouting invokes before this remounting are completed, which
+        // prevents this segment being able to be unmounted forever;
+        // 2. Sending the message after remounting the segments: After
+        // remounting these segments, when trying to push id to the queue, the
+        // queue is already full. However, at this point, the message must be
+        // sent, otherwise this client cannot be monitored and expired.
+        PodUUID pod_client_id;
+        pod_client_id.first = client_id.first;
+        pod_client_id.second = client_id.second;
+        if (!client_ping_queue_.push(pod_client_id)) {
+            LOG(ERROR) << "client_id=" << client_id
+                       << ", error=client_ping_queue_full";
+            return tl::make_unexpected(ErrorCode::INTERNAL_ERROR);
+        }
 
-    ErrorCode err = segment_access.ReMountSegment(segments, client_id);
-    if (err != ErrorCode::OK) {
-        return tl::make_unexpected(err);
+        ErrorCode err = segment_access.ReMountSegment(segments, client_id);
+        if (err != ErrorCode::OK) {
+            return tl::make_unexpected(err);
+        }
+        if (enable_failover_restore_) {
+            restored = PlacePendingReplicas(segment_access, segments);
+        }
+    }  // Release the segment mutex before taking the shard mutexes
+    for (auto& [key, replica] : restored) {
+        AddRestoredReplica(key, std::move(replica));
     }
 
     // Change the client status to OK
@@ -159,26 +267,96 @@ auto MasterService::ReMountSegment(const std::vector<Segment>& segments,
     return {};
 }
 
-void MasterService::ClearInvalidHandles() {
-    for (auto& shard : metadata_shards_) {
-        MutexLocker lock(&shard.mutex);
-        auto it = shard.metadata.begin();
-        while (it != shard.metadata.end()) {
-            // Check if the object has any invalid replicas
-            bool has_invalid = false;
-            for (auto& replica : it->second.replicas) {
-                if (replica.has_invalid_handle()) {
+void MasterService::ClearInvalidHandles(const std::vector<Segment>& parking) {
+    // Index in parking of the segment holding all the buffers of a complete
+    // memory replica, -1 if there is none
+    auto parking_index = [&parking](const Replica& replica) -> int {
+        if (!replica.is_memory_replica() || replica.is_inline() ||
+            replica.is_erasure_coded() ||
+            replica.status() != ReplicaStatus::COMPLETE) {
+            return -1;
+        }
+        const auto desc = replica.get_descriptor();
+        const auto& buffers = desc.get_memory_descriptor().buffer_descriptors;
+        for (size_t p = 0; p < parking.size(); ++p) {
+            const Segment& segment = parking[p];
+            if (std::all_of(buffers.begin(), buffers.end(),
+                            [&segment](const auto& buffer) {
+                                return buffer.segment_name_ == segment.name &&
+                                       buffer.buffer_address_ >= segment.base &&
+                                       buffer.buffer_address_ + buffer.size_ <=
+                                           segment.base + segment.size;
+                            })) {
+                return static_cast<int>(p);
+            }
+        }
+        return -1;
+    };
+    std::vector<std::vector<PendingReplica>> parked(parking.size());
+    std::mutex parked_mutex;
+
+    ParallelForShards([&, this](size_t, size_t begin, size_t end) {
+        std::vector<std::vector<PendingReplica>> local(parking.size());
+        for (size_t i = begin; i < end; ++i) {
+            auto& shard = metadata_shards_[i];
+            SharedMutexLocker lock(&shard.mutex);
+            auto it = shard.metadata.begin();
+            while (it != shard.metadata.end()) {
+                // Check if the object has any invalid replicas
+                bool has_invalid = false;
+                for (auto& replica : it->second.replicas) {
+                    if (!replica.has_invalid_handle()) {
+                        continue;
+                    }
                     has_invalid = true;
-                    break;
+                    if (parking.empty()) {
+                        break;
+                    }
+                    const int p = parking_index(replica);
+                    if (p >= 0) {
+                        local[p].push_back(
+                            {std::string(it->first), replica.get_descriptor()});
+                    }
+                }
+                // Remove the object if it has no valid replicas. An object
+                // with a disk replica only loses the replicas on unmounted
+                // segments.
+                if (CleanupStaleHandles(it->second) ||
+                    (has_invalid && !it->second.GetDiskReplica())) {
+                    it = shard.metadata.erase(it);
+                } else {
+                    it->second.UpdateResidency();
+                    ++it;
                 }
-            }
-            // Remove the object if it has no valid replicas
-            if (has_invalid || CleanupStaleHandles(it->second)) {
-                it = shard.metadata.erase(it);
-            } else {
-                ++it;
             }
         }
+        std::lock_guard<std::mutex> lock(parked_mutex);
+        for (size_t p = 0; p < local.size(); ++p) {
+            std::move(local[p].begin(), local[p].end(),
+                      std::back_inserter(parked[p]));
+        }
+    });
+    // Clients may cache replicas on the unmounted segments
+    replica_version_.fetch_add(1);
+    change_log_.Reset();
+
+    if (parking.empty()) {
+        return;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    MutexLocker lock(&restore_mutex_);
+    std::erase_if(parked_segments_, [now](const auto& entry) {
+        return entry.second.deadline < now;
+    });
+    for (size_t p = 0; p < parking.size(); ++p) {
+        LOG(INFO) << "segment_name=" << parking[p].name
+                  << ", memory_id=" << parking[p].memory_id
+                  << ", replicas=" << parked[p].size()
+                  << ", action=replicas_parked";
+        parked_segments_[parking[p].memory_id] = {
+            parking[p],
+            now + std::chrono::seconds(persistent_segment_ttl_sec_),
+            std::move(parked[p])};
     }
 }
 
@@ -186,11 +364,18 @@ auto MasterService::UnmountSegment(const UUID& segment_id,
                                    const UUID& client_id)
     -> tl::expected<void, ErrorCode> {
     size_t metrics_dec_capacity = 0;  // to update the metrics
+    std::vector<Segment> parking;
 
     // 1. Prepare to unmount the segment by deleting its allocator
     {
         ScopedSegmentAccess segment_access =
             segment_manager_.getSegmentAccess();
+        Segment segment;
+        if (keep_persistent_replicas_ &&
+            segment_access.GetSegment(segment_id, segment) == ErrorCode::OK &&
+            segment.memory_id != UUID{0, 0}) {
+            parking.push_back(std::move(segment));
+        }
         ErrorCode err = segment_access.PrepareUnmountSegment(
             segment_id, metrics_dec_capacity);
         if (err == ErrorCode::SEGMENT_NOT_FOUND) {
@@ -203,8 +388,10 @@ auto MasterService::UnmountSegment(const UUID& segment_id,
     }  // Release the segment mutex before long-running step 2 and avoid
        // deadlocks
 
-    // 2. Remove the metadata of the related objects
-    ClearInvalidHandles();
+    // 2. Remove the metadata of the related objects, once no allocation
+    // can place one in the segment anymore
+    segment_manager_.WaitForAllocations();
+    ClearInvalidHandles(parking);
 
     // 3. Commit the unmount operation
     ScopedSegmentAccess segment_access = segment_manager_.getSegmentAccess();
@@ -216,17 +403,140 @@ auto MasterService::UnmountSegment(const UUID& segment_id,
     return {};
 }
 
+auto MasterService::DrainSegment(const UUID& segment_id)
+    -> tl::expected<void, ErrorCode> {
+    Segment segment;
+    {
+        ScopedSegmentAccess segment_access =
+            segment_manager_.getSegmentAccess();
+        ErrorCode err = segment_access.DrainSegment(segment_id, segment);
+        if (err != ErrorCode::OK) {
+            return tl::make_unexpected(err);
+        }
+    }
+    // The drain then sees every replica allocated in the segment
+    segment_manager_.WaitForAllocations();
+    MutexLocker lock(&drain_mutex_);
+    if (drains_.count(segment_id)) {
+        return {};
+    }
+    Drain drain;
+    drain.segment = segment;
+    drain.start = std::chrono::steady_clock::now();
+    drains_.emplace(segment_id, std::move(drain));
+    LOG(INFO) << "segment_name=" << segment.name << ", segment_id="
+              << segment_id << ", action=drain_start";
+    return {};
+}
+
+auto MasterService::QueryDrain(const UUID& segment_id)
+    -> tl::expected<uint64_t, ErrorCode> {
+    size_t used = 0;
+    ScopedSegmentAccess segment_access = segment_manager_.getSegmentAccess();
+    ErrorCode err = segment_access.GetDrainingUsage(segment_id, used);
+    if (err != ErrorCode::OK) {
+        return tl::make_unexpected(err);
+    }
+    return used;
+}
+
+auto MasterService::AttachSegment(const UUID& memory_id,
+                                  const UUID& client_id)
+    -> tl::expected<Segment, ErrorCode> {
+    if (memory_id == UUID{0, 0}) {
+        return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    Segment segment;
+    ScopedSegmentAccess segment_access = segment_manager_.getSegmentAccess();
+    ErrorCode err =
+        segment_access.AttachSegment(memory_id, client_id, segment);
+    if (err != ErrorCode::OK) {
+        return tl::make_unexpected(err);
+    }
+    return segment;
+}
+
+auto MasterService::DetachSegment(const UUID& memory_id,
+                                  const UUID& client_id)
+    -> tl::expected<void, ErrorCode> {
+    ScopedSegmentAccess segment_access = segment_manager_.getSegmentAccess();
+    segment_access.DetachSegment(memory_id, client_id);
+    return {};
+}
+
+auto MasterService::GetAttachedClients(const UUID& segment_id)
+    -> tl::expected<std::vector<UUID>, ErrorCode> {
+    std::vector<UUID> clients;
+    ScopedSegmentAccess segment_access = segment_manager_.getSegmentAccess();
+    ErrorCode err = segment_access.GetAttachedClients(segment_id, clients);
+    if (err != ErrorCode::OK) {
+        return tl::make_unexpected(err);
+    }
+    return clients;
+}
+
+template <typename Read>
+void MasterService::ReadContent(const std::string& key,
+                                const std::string& content_key, Read&& read) {
+    {
+        MetadataReadAccessor accessor(this, content_key);
+        if (accessor.Exists() && !accessor.Get().HasStaleHandles()) {
+            read(accessor.Get());
+            return;
+        }
+    }
+    {
+        MetadataAccessor accessor(this, content_key);
+        if (accessor.Exists()) {
+            read(accessor.Get());
+            return;
+        }
+    }
+    // Evicted, or revoked by the put that allocated it
+    VLOG(1) << "key=" << key << ", content_key=" << content_key
+            << ", info=content_not_found";
+    DropAlias(key, content_key);
+}
+
 auto MasterService::ExistKey(const std::string& key)
     -> tl::expected<bool, ErrorCode> {
+    // Fast path: shared shard lock, concurrent with other readers.
+    std::optional<std::string> content_key;
+    {
+        MetadataReadAccessor accessor(this, key);
+        if (!accessor.Exists()) {
+            content_key = accessor.ContentKey();
+            if (!content_key) {
+                VLOG(1) << "key=" << key << ", info=object_not_found";
+                return false;
+            }
+        } else if (!accessor.Get().HasStaleHandles()) {
+            return CheckExist(key, accessor.Get());
+        }
+    }
+    if (content_key) {
+        tl::expected<bool, ErrorCode> result = false;
+        ReadContent(key, *content_key, [&](const ObjectMetadata& metadata) {
+            result = CheckExist(key, metadata);
+        });
+        return result;
+    }
+
+    // Slow path: stale handles need to be cleaned up exclusively.
     MetadataAccessor accessor(this, key);
     if (!accessor.Exists()) {
         VLOG(1) << "key=" << key << ", info=object_not_found";
         return false;
     }
+    return CheckExist(key, accessor.Get());
+}
 
-    auto& metadata = accessor.Get();
-    if (auto status = metadata.HasDiffRepStatus(ReplicaStatus::COMPLETE)) {
-        LOG(WARNING) << "key=" << key << ", status=" << *status
+auto MasterService::CheckExist(const std::string& key,
+                               const ObjectMetadata& metadata)
+    -> tl::expected<bool, ErrorCode> {
+    if (!metadata.IsReadable()) {
+        LOG(WARNING) << "key=" << key << ", status="
+                     << *metadata.HasDiffRepStatus(ReplicaStatus::COMPLETE)
                      << ", error=replica_not_ready";
         return tl::make_unexpected(ErrorCode::REPLICA_IS_NOT_READY);
     }
@@ -239,26 +549,321 @@ auto MasterService::ExistKey(const std::string& key)
 
 std::vector<tl::expected<bool, ErrorCode>> MasterService::BatchExistKey(
     const std::vector<std::string>& keys) {
-    std::vector<tl::expected<bool, ErrorCode>> results;
-    results.reserve(keys.size());
-    for (const auto& key : keys) {
-        results.emplace_back(ExistKey(key));
+    std::vector<tl::expected<bool, ErrorCode>> results(keys.size(), false);
+    std::vector<size_t> slow_path;  // aliases and keys with stale handles
+    for (const auto& [shard_idx, indices] : GroupByShard(keys)) {
+        auto& shard = metadata_shards_[shard_idx];
+        SharedMutexLocker lock(&shard.mutex, shared_lock);
+        for (size_t idx : indices) {
+            auto it = shard.metadata.find(keys[idx]);
+            if (it == shard.metadata.end()) {
+                if (shard.aliases.contains(keys[idx])) {
+                    slow_path.push_back(idx);
+                    continue;
+                }
+                VLOG(1) << "key=" << keys[idx] << ", info=object_not_found";
+                results[idx] = false;
+            } else if (it->second.HasStaleHandles()) {
+                slow_path.push_back(idx);
+            } else {
+                results[idx] = CheckExist(keys[idx], it->second);
+            }
+        }
+    }
+    for (size_t idx : slow_path) {
+        results[idx] = ExistKey(keys[idx]);
+    }
+    return results;
+}
+
+std::vector<tl::expected<void, ErrorCode>> MasterService::BatchTouch(
+    const std::vector<std::string>& keys, uint64_t ttl_ms,
+    uint64_t next_use_ms) {
+    ttl_ms = ttl_ms == 0 ? default_kv_lease_ttl_
+                         : std::min(ttl_ms, kMaxTouchTtlMs);
+    std::vector<tl::expected<void, ErrorCode>> results(keys.size());
+    std::vector<size_t> stale;
+    std::vector<std::pair<size_t, std::string>> aliases;
+    for (const auto& [shard_idx, indices] : GroupByShard(keys)) {
+        auto& shard = metadata_shards_[shard_idx];
+        SharedMutexLocker lock(&shard.mutex, shared_lock);
+        for (size_t idx : indices) {
+            auto it = shard.metadata.find(keys[idx]);
+            if (it != shard.metadata.end()) {
+                if (it->second.HasStaleHandles()) {
+                    stale.push_back(idx);
+                } else {
+                    results[idx] = TouchObject(keys[idx], it->second, ttl_ms,
+                                               next_use_ms);
+                }
+                continue;
+            }
+            auto alias = shard.aliases.find(keys[idx]);
+            if (alias != shard.aliases.end()) {
+                aliases.emplace_back(idx, alias->second);
+                continue;
+            }
+            VLOG(1) << "key=" << keys[idx] << ", info=object_not_found";
+            results[idx] = tl::make_unexpected(ErrorCode::OBJECT_NOT_FOUND);
+        }
+    }
+    // Stale handles need to be cleaned up exclusively
+    for (size_t idx : stale) {
+        MetadataAccessor accessor(this, keys[idx]);
+        if (accessor.Exists()) {
+            results[idx] = TouchObject(keys[idx], accessor.Get(), ttl_ms,
+                                       next_use_ms);
+        } else {
+            results[idx] = tl::make_unexpected(ErrorCode::OBJECT_NOT_FOUND);
+        }
+    }
+    for (const auto& [idx, content_key] : aliases) {
+        auto& result = results[idx];
+        const std::string& key = keys[idx];
+        result = tl::make_unexpected(ErrorCode::OBJECT_NOT_FOUND);
+        ReadContent(key, content_key, [&](const ObjectMetadata& metadata) {
+            result = TouchObject(key, metadata, ttl_ms, next_use_ms);
+        });
     }
     return results;
 }
 
+auto MasterService::TouchObject(const std::string& key,
+                                const ObjectMetadata& metadata,
+                                uint64_t ttl_ms, uint64_t next_use_ms)
+    -> tl::expected<void, ErrorCode> {
+    if (!metadata.IsReadable()) {
+        VLOG(1) << "key=" << key << ", info=replica_not_ready";
+        return tl::make_unexpected(ErrorCode::REPLICA_IS_NOT_READY);
+    }
+    metadata.GrantLease(ttl_ms, std::max(ttl_ms, default_kv_soft_pin_ttl_));
+    if (next_use_ms > 0) {
+        metadata.HintNextUse(next_use_ms);
+    }
+    return {};
+}
+
+auto MasterService::LongestPrefixMatch(const std::vector<std::string>& keys,
+                                       bool with_replicas)
+    -> tl::expected<PrefixMatchResult, ErrorCode> {
+    PrefixMatchResult result;
+    if (with_replicas) {
+        result.replica_lists.reserve(keys.size());
+    }
+    for (const auto& key : keys) {
+        std::optional<std::string> content_key;
+        {
+            MetadataReadAccessor accessor(this, key);
+            if (!accessor.Exists()) {
+                content_key = accessor.ContentKey();
+                if (!content_key) {
+                    break;
+                }
+            } else if (!accessor.Get().HasStaleHandles()) {
+                if (!MatchPrefixKey(key, accessor.Get(), with_replicas,
+                                    result)) {
+                    break;
+                }
+                continue;
+            }
+        }
+        if (content_key) {
+            bool matched = false;
+            ReadContent(key, *content_key, [&](const ObjectMetadata& metadata) {
+                matched = MatchPrefixKey(key, metadata, with_replicas, result,
+                                         *content_key);
+            });
+            if (!matched) {
+                break;
+            }
+            continue;
+        }
+
+        // Stale handles need to be cleaned up exclusively.
+        MetadataAccessor accessor(this, key);
+        if (!accessor.Exists() ||
+            !MatchPrefixKey(key, accessor.Get(), with_replicas, result)) {
+            break;
+        }
+    }
+    VLOG(1) << "keys_count=" << keys.size() << ", matched=" << result.matched
+            << ", action=longest_prefix_match";
+    return result;
+}
+
+bool MasterService::MatchPrefixKey(const std::string& key,
+                                   const ObjectMetadata& metadata,
+                                   bool with_replicas,
+                                   PrefixMatchResult& result,
+                                   std::string_view object_key) {
+    // Not being ready is where the prefix ends rather than an error
+    if (!metadata.IsReadable()) {
+        return false;
+    }
+    if (with_replicas) {
+        auto replica_list = ReadReplicaList(key, metadata, object_key);
+        if (!replica_list) {
+            return false;
+        }
+        result.replica_lists.push_back(std::move(replica_list.value()));
+    } else {
+        metadata.GrantLease(default_kv_lease_ttl_, default_kv_soft_pin_ttl_);
+    }
+    result.matched++;
+    return true;
+}
+
+auto MasterService::BatchQueryLocation(const std::vector<std::string>& keys,
+                                       bool with_prefix_hits)
+    -> tl::expected<KeyLocationResult, ErrorCode> {
+    KeyLocationResult result;
+    result.locations.resize(keys.size());
+    // SegmentNameTable ID -> index in result.segments
+    std::unordered_map<uint32_t, uint32_t> segment_index;
+    auto locate = [&](size_t i, const ObjectMetadata& metadata) {
+        auto& location = result.locations[i];
+        for (const auto& replica : metadata.replicas) {
+            if (replica.status() != ReplicaStatus::COMPLETE ||
+                replica.has_invalid_handle()) {
+                continue;
+            }
+            auto segment_id = replica.segment_id();
+            if (!segment_id) {
+                continue;
+            }
+            auto [it, inserted] =
+                segment_index.emplace(*segment_id, result.segments.size());
+            if (inserted) {
+                result.segments.push_back(SegmentNameTable::Name(*segment_id));
+            }
+            if (std::find(location.begin(), location.end(), it->second) ==
+                location.end()) {
+                location.push_back(it->second);
+            }
+        }
+    };
+    for (size_t i = 0; i < keys.size(); ++i) {
+        std::optional<std::string> content_key;
+        {
+            MetadataReadAccessor accessor(this, keys[i]);
+            if (accessor.Exists()) {
+                locate(i, accessor.Get());
+                continue;
+            }
+            content_key = accessor.ContentKey();
+        }
+        if (content_key) {
+            ReadContent(keys[i], *content_key,
+                        [&](const ObjectMetadata& metadata) {
+                            locate(i, metadata);
+                        });
+        }
+    }
+    if (with_prefix_hits) {
+        result.CountPrefixHits();
+    }
+    VLOG(1) << "keys_count=" << keys.size()
+            << ", segments=" << result.segments.size()
+            << ", action=batch_query_location";
+    return result;
+}
+
 auto MasterService::GetAllKeys()
     -> tl::expected<std::vector<std::string>, ErrorCode> {
     std::vector<std::string> all_keys;
     for (size_t i = 0; i < kNumShards; i++) {
-        MutexLocker lock(&metadata_shards_[i].mutex);
+        SharedMutexLocker lock(&metadata_shards_[i].mutex, shared_lock);
         for (const auto& item : metadata_shards_[i].metadata) {
-            all_keys.push_back(item.first);
+            all_keys.emplace_back(item.first);
         }
     }
     return all_keys;
 }
 
+auto MasterService::ScanKeys(const std::string& prefix,
+                             const std::string& cursor, uint64_t limit)
+    -> tl::expected<KeyScanResult, ErrorCode> {
+    if (limit == 0) {
+        return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    limit = std::min(limit, kMaxScanKeys);
+
+    // The cursor is the shard to scan, followed by ':' and the last key
+    // returned from it if it was only scanned in part
+    size_t shard = 0;
+    std::optional<std::string_view> last_key;
+    if (!cursor.empty()) {
+        const size_t sep = std::min(cursor.find(':'), cursor.size());
+        auto [end, ec] =
+            std::from_chars(cursor.data(), cursor.data() + sep, shard);
+        if (ec != std::errc() || end != cursor.data() + sep ||
+            shard >= kNumShards) {
+            return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+        }
+        if (sep < cursor.size()) {
+            last_key = std::string_view(cursor).substr(sep + 1);
+        }
+    }
+
+    KeyScanResult result;
+    for (; shard < kNumShards; ++shard, last_key.reset()) {
+        const size_t wanted = limit - result.keys.size();
+        auto& metadata_shard = metadata_shards_[shard];
+        SharedMutexLocker lock(&metadata_shard.mutex, shared_lock);
+        // One more than wanted tells whether the shard has keys left
+        auto keys =
+            ShardKeysWithPrefix(metadata_shard, prefix, last_key, wanted + 1);
+        if (keys.size() > wanted) {
+            result.keys.insert(result.keys.end(), keys.begin(),
+                               keys.begin() + wanted);
+            result.next_cursor =
+                std::to_string(shard) + ":" + result.keys.back();
+            return result;
+        }
+        result.keys.insert(result.keys.end(), keys.begin(), keys.end());
+        if (result.keys.size() == limit) {
+            if (shard + 1 < kNumShards) {
+                result.next_cursor = std::to_string(shard + 1);
+            }
+            return result;
+        }
+    }
+    return result;
+}
+
+std::vector<std::string_view> MasterService::ShardKeysWithPrefix(
+    const MetadataShard& shard, std::string_view prefix,
+    std::optional<std::string_view> after, size_t limit) {
+    std::vector<std::string_view> keys;
+#ifdef STORE_USE_ART_METADATA_MAP
+    // The tree is ordered, only the keys of the prefix are visited
+    auto it = shard.metadata.lower_bound(
+        after && *after >= prefix ? *after : prefix);
+    if (it != shard.metadata.end() && after && it->first == *after) {
+        ++it;
+    }
+    for (; it != shard.metadata.end() && keys.size() < limit &&
+           it->first.starts_with(prefix);
+         ++it) {
+        keys.push_back(it->first);
+    }
+#else
+    for (const auto& item : shard.metadata) {
+        std::string_view key = item.first;
+        if (key.starts_with(prefix) && (!after || key > *after)) {
+            keys.push_back(key);
+        }
+    }
+    if (keys.size() > limit) {
+        std::partial_sort(keys.begin(), keys.begin() + limit, keys.end());
+        keys.resize(limit);
+    } else {
+        std::sort(keys.begin(), keys.end());
+    }
+#endif
+    return keys;
+}
+
 auto MasterService::GetAllSegments()
     -> tl::expected<std::vector<std::string>, ErrorCode> {
     ScopedSegmentAccess segment_access = segment_manager_.getSegmentAccess();
@@ -283,22 +888,92 @@ auto MasterService::QuerySegments(const std::string& segment)
 
 auto MasterService::GetReplicaList(std::string_view key)
     -> tl::expected<std::vector<Replica::Descriptor>, ErrorCode> {
-    MetadataAccessor accessor(this, std::string(key));
+    auto result = LookupReplicaList(key);
+    RecordNamespaceGet(key, result.has_value());
+    return result;
+}
+
+auto MasterService::LookupReplicaList(std::string_view key)
+    -> tl::expected<std::vector<Replica::Descriptor>, ErrorCode> {
+    const std::string key_str(key);
+    // Fast path: shared shard lock, concurrent with other readers. Leases are
+    // atomics, so they can be granted without the exclusive lock.
+    std::optional<std::string> content_key;
+    {
+        MetadataReadAccessor accessor(this, key_str);
+        if (!accessor.Exists()) {
+            content_key = accessor.ContentKey();
+            if (!content_key) {
+                VLOG(1) << "key=" << key << ", info=object_not_found";
+                return tl::make_unexpected(ErrorCode::OBJECT_NOT_FOUND);
+            }
+        } else if (!accessor.Get().HasStaleHandles()) {
+            return ReadReplicaList(key, accessor.Get());
+        }
+    }
+    if (content_key) {
+        // Read as the alias, so that GC removes the alias and not the content
+        tl::expected<std::vector<Replica::Descriptor>, ErrorCode> result =
+            tl::make_unexpected(ErrorCode::OBJECT_NOT_FOUND);
+        ReadContent(key_str, *content_key,
+                    [&](const ObjectMetadata& metadata) {
+                        result =
+                            ReadReplicaList(key, metadata, *content_key);
+                    });
+        return result;
+    }
+
+    // Slow path: some replicas point to unmounted segments, take the shard
+    // exclusively so MetadataAccessor can clean them up.
+    MetadataAccessor accessor(this, key_str);
     if (!accessor.Exists()) {
         VLOG(1) << "key=" << key << ", info=object_not_found";
         return tl::make_unexpected(ErrorCode::OBJECT_NOT_FOUND);
     }
-    auto& metadata = accessor.Get();
-    if (auto status = metadata.HasDiffRepStatus(ReplicaStatus::COMPLETE)) {
-        LOG(WARNING) << "key=" << key << ", status=" << *status
+    return ReadReplicaList(key, accessor.Get());
+}
+
+auto MasterService::ReadReplicaList(std::string_view key,
+                                    const ObjectMetadata& metadata,
+                                    std::string_view object_key)
+    -> tl::expected<std::vector<Replica::Descriptor>, ErrorCode> {
+    if (!metadata.IsReadable()) {
+        LOG(WARNING) << "key=" << key << ", status="
+                     << *metadata.HasDiffRepStatus(ReplicaStatus::COMPLETE)
                      << ", error=replica_not_ready";
         return tl::make_unexpected(ErrorCode::REPLICA_IS_NOT_READY);
     }
 
+    // Memory replicas still being promoted or upserted are left out
     std::vector<Replica::Descriptor> replica_list;
     replica_list.reserve(metadata.replicas.size());
     for (const auto& replica : metadata.replicas) {
-        replica_list.emplace_back(replica.get_descriptor());
+        if (replica.status() == ReplicaStatus::COMPLETE) {
+            replica_list.emplace_back(replica.get_descriptor());
+        }
+    }
+    if (hot_replica_read_rate_ > 0) {
+        thread_local uint64_t reads = 0;
+        if (++reads % kHotReadSampleInterval == 0) {
+            SampleRead(object_key.empty() ? key : object_key);
+        }
+        // Readers that rank the memory copies alike take the first one,
+        // start every reader at another
+        auto memory_end = std::stable_partition(
+            replica_list.begin(), replica_list.end(),
+            [](const Replica::Descriptor& replica) {
+                return replica.is_memory_replica();
+            });
+        const auto memory_replicas = memory_end - replica_list.begin();
+        if (memory_replicas > 1) {
+            std::rotate(replica_list.begin(),
+                        replica_list.begin() + reads % memory_replicas,
+                        memory_end);
+        }
+    }
+    // Clients read the first complete replica
+    if (allocation_strategy_->TracksTransferLoad() && !replica_list.empty()) {
+        RecordReadLoad(replica_list.front());
     }
 
     // Only mark for GC if enabled
@@ -314,29 +989,131 @@ auto MasterService::GetReplicaList(std::string_view key)
     return replica_list;
 }
 
-std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
-MasterService::BatchGetReplicaList(const std::vector<std::string>& keys) {
-    std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
-        results;
-    results.reserve(keys.size());
-    for (const auto& key : keys) {
-        results.emplace_back(GetReplicaList(key));
+void MasterService::RecordReadLoad(const Replica::Descriptor& replica) {
+    if (!replica.is_memory_replica() ||
+        replica.get_memory_descriptor().is_inline()) {
+        return;
+    }
+    for (const auto& buffer :
+         replica.get_memory_descriptor().buffer_descriptors) {
+        allocation_strategy_->RecordTransfer(buffer.segment_name_,
+                                             buffer.size_);
     }
-    return results;
 }
 
-auto MasterService::PutStart(const std::string& key,
-                             const std::vector<uint64_t>& slice_lengths,
-                             const ReplicateConfig& config)
-    -> tl::expected<std::vector<Replica::Descriptor>, ErrorCode> {
+std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+MasterService::BatchGetReplicaList(const std::vector<std::string>& keys) {
+    std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+        results(keys.size(), tl::make_unexpected(ErrorCode::OBJECT_NOT_FOUND));
+    std::vector<size_t> slow_path;  // aliases and keys with stale handles
+    for (const auto& [shard_idx, indices] : GroupByShard(keys)) {
+        auto& shard = metadata_shards_[shard_idx];
+        SharedMutexLocker lock(&shard.mutex, shared_lock);
+        for (size_t idx : indices) {
+            auto it = shard.metadata.find(keys[idx]);
+            if (it == shard.metadata.end()) {
+                if (shard.aliases.contains(keys[idx])) {
+                    slow_path.push_back(idx);
+                } else {
+                    VLOG(1) << "key=" << keys[idx]
+                            << ", info=object_not_found";
+                }
+            } else if (it->second.HasStaleHandles()) {
+                slow_path.push_back(idx);
+            } else {
+                results[idx] = ReadReplicaList(keys[idx], it->second);
+            }
+        }
+    }
+    // Stale handles are cleaned up by the exclusive single-key path, which
+    // also resolves aliases.
+    for (size_t idx : slow_path) {
+        results[idx] = LookupReplicaList(keys[idx]);
+    }
+    if (namespaces_.enabled()) {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            RecordNamespaceGet(keys[i], results[i].has_value());
+        }
+    }
+    return results;
+}
+
+void MasterService::RecordNamespaceGet(std::string_view key, bool hit) {
+    if (const auto* usage = namespaces_.Find(key)) {
+        MasterMetricManager::instance().inc_namespace_gets(usage->index(),
+                                                           hit);
+    }
+}
+
+bool MasterService::NamespaceHasRoom(std::string_view key, uint64_t size) {
+    const auto* usage = namespaces_.Find(key);
+    if (NamespaceTable::HasRoom(usage, size)) {
+        return true;
+    }
+    VLOG(1) << "key=" << key << ", namespace=" << usage->name()
+            << ", used=" << usage->bytes()
+            << ", capacity=" << usage->quota().capacity
+            << ", value_length=" << size << ", error=namespace_quota_exceeded";
+    MasterMetricManager::instance().inc_namespace_rejected_puts(
+        usage->index());
+    return false;
+}
+
+auto MasterService::ValidatePutParams(
+    const std::string& key, const std::vector<uint64_t>& slice_lengths,
+    const ReplicateConfig& config) -> tl::expected<uint64_t, ErrorCode> {
     if (config.replica_num == 0 || key.empty() || slice_lengths.empty()) {
         LOG(ERROR) << "key=" << key << ", replica_num=" << config.replica_num
                    << ", slice_count=" << slice_lengths.size()
                    << ", key_size=" << key.size() << ", error=invalid_params";
         return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
     }
+    if (key.starts_with(kContentKeyPrefix)) {
+        LOG(ERROR) << "key=" << key << ", error=reserved_key_prefix";
+        return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    // Aliases share the object of their content, it has no tag of its own
+    if (!config.content_hash.empty() && !config.tag.empty()) {
+        LOG(ERROR) << "key=" << key << ", tag=" << config.tag
+                   << ", error=tagged_content_hash";
+        return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    // The slices of an erasure-coded object are its data fragments followed
+    // by its parity fragments
+    const size_t fragments =
+        config.ec_data_fragments + config.ec_parity_fragments;
+    if (fragments > 0 &&
+        (config.ec_data_fragments == 0 || config.ec_parity_fragments == 0 ||
+         fragments > kMaxErasureFragments ||
+         slice_lengths.size() != fragments || config.replica_num != 1 ||
+         !config.content_hash.empty())) {
+        LOG(ERROR) << "key=" << key
+                   << ", ec_data_fragments=" << config.ec_data_fragments
+                   << ", ec_parity_fragments=" << config.ec_parity_fragments
+                   << ", slice_count=" << slice_lengths.size()
+                   << ", error=invalid_erasure_code";
+        return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    // An upsert rewrites the replicas of one object of its own
+    if (config.upsert &&
+        (!config.content_hash.empty() || fragments > 0 ||
+         ChainCopies(config) > 0 || config.skip_resident)) {
+        LOG(ERROR) << "key=" << key << ", config=" << config
+                   << ", error=invalid_upsert";
+        return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+    }
+
+    if (!config.shard_segments.empty() &&
+        (config.shard_segments.size() != slice_lengths.size() ||
+         fragments > 0)) {
+        LOG(ERROR) << "key=" << key
+                   << ", shard_count=" << config.shard_segments.size()
+                   << ", slice_count=" << slice_lengths.size()
+                   << ", error=invalid_shard_segments";
+        return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+    }
 
-    // Validate slice lengths
+    // Validate slice lengths, the object size leaves out parity fragments
     uint64_t total_length = 0;
     for (size_t i = 0; i < slice_lengths.size(); ++i) {
         if (slice_lengths[i] > kMaxSliceSize) {
@@ -346,162 +1123,2450 @@ auto MasterService::PutStart(const std::string& key,
                        << ", error=invalid_slice_size";
             return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
         }
-        total_length += slice_lengths[i];
+        if (i < slice_lengths.size() - config.ec_parity_fragments) {
+            total_length += slice_lengths[i];
+        }
+    }
+    return total_length;
+}
+
+auto MasterService::AllocateReplicas(ScopedAllocatorAccess& allocator_access,
+                                     const std::string& key,
+                                     const std::vector<uint64_t>& slice_lengths,
+                                     const ReplicateConfig& config)
+    -> tl::expected<std::vector<Replica>, ErrorCode> {
+    auto& allocators = allocator_access.getAllocators();
+    auto& allocators_by_name = allocator_access.getAllocatorsByName();
+    // The other replicas of a chain are allocated as they are forwarded
+    const size_t replica_num = config.replica_num - ChainCopies(config);
+
+    // Failed requests count too, they are what the headroom was short of
+    uint64_t demand = 0;
+    for (auto length : slice_lengths) {
+        demand += length;
+    }
+    allocation_demand_bytes_.fetch_add(demand * replica_num,
+                                       std::memory_order_relaxed);
+
+    // Each fragment of an erasure-coded object goes to its own segment, so
+    // that losing a segment costs one fragment
+    const bool erasure_coded = config.ec_parity_fragments > 0;
+    if (erasure_coded && allocators_by_name.size() < slice_lengths.size()) {
+        LOG(ERROR) << "key=" << key << ", fragments=" << slice_lengths.size()
+                   << ", segments=" << allocators_by_name.size()
+                   << ", error=not_enough_segments";
+        return tl::make_unexpected(ErrorCode::SEGMENT_NOT_FOUND);
+    }
+
+    // The slices of a large object are its stripes, each on a segment of
+    // its own as long as there are segments left, so that its transfers
+    // spread over the NICs of several hosts
+    const bool sharded = !config.shard_segments.empty();
+    const bool striped = !erasure_coded && !sharded && stripe_min_size_ > 0 &&
+                         slice_lengths.size() > 1 &&
+                         demand >= stripe_min_size_;
+
+    std::vector<Replica> replicas;
+    replicas.reserve(replica_num);
+    // Segments of the replicas allocated so far
+    std::vector<std::string> placed_segments;
+    for (size_t i = 0; i < replica_num; ++i) {
+        std::vector<std::unique_ptr<AllocatedBuffer>> handles;
+        handles.reserve(slice_lengths.size());
+        // Segments of the stripes of this replica since the last wrap
+        std::vector<std::string> stripe_segments;
+
+        // Allocate space for each slice
+        for (size_t j = 0; j < slice_lengths.size(); ++j) {
+            auto chunk_size = slice_lengths[j];
+
+            // Use the unified allocation strategy with replica config
+            std::unique_ptr<AllocatedBuffer> handle;
+            if (erasure_coded) {
+                handle = AllocateFragment(allocator_access, chunk_size,
+                                          config, placed_segments);
+            } else if (striped) {
+                handle = AllocateFragment(allocator_access, chunk_size,
+                                          config, stripe_segments);
+                if (!handle) {
+                    // Every segment has a stripe or no other one has room
+                    stripe_segments.clear();
+                }
+            } else if (sharded && i == 0 &&
+                       !config.shard_segments[j].empty()) {
+                // The first replica of a shard goes next to its reader
+                ReplicateConfig shard_config = config;
+                shard_config.preferred_segment = config.shard_segments[j];
+                handle = AllocateInTier(allocators, allocators_by_name,
+                                        chunk_size, shard_config,
+                                        placed_segments);
+            }
+            if (!handle && !erasure_coded) {
+                handle = AllocateInTier(allocators, allocators_by_name,
+                                        chunk_size, config, placed_segments);
+            }
+
+            if (!handle) {
+                LOG(ERROR) << "key=" << key << ", replica_id=" << i
+                           << ", slice_index=" << j
+                           << ", error=allocation_failed";
+                // If the allocation failed, we need to evict some objects
+                // to free up space for future allocations.
+                need_eviction_ = true;
+                return tl::make_unexpected(ErrorCode::NO_AVAILABLE_HANDLE);
+            }
+
+            VLOG(1) << "key=" << key << ", replica_id=" << i
+                    << ", slice_index=" << j << ", handle=" << *handle
+                    << ", action=slice_allocated";
+            if (erasure_coded) {
+                placed_segments.push_back(
+                    handle->get_descriptor().segment_name_);
+            } else if (striped) {
+                stripe_segments.push_back(handle->segment_name());
+            }
+            handles.emplace_back(std::move(handle));
+        }
+
+        if (erasure_coded) {
+            replicas.emplace_back(std::move(handles),
+                                  ReplicaStatus::PROCESSING,
+                                  config.ec_parity_fragments);
+            continue;
+        }
+        if (i + 1 < replica_num) {
+            for (const auto& handle : handles) {
+                placed_segments.push_back(
+                    handle->get_descriptor().segment_name_);
+            }
+        }
+        replicas.emplace_back(std::move(handles), ReplicaStatus::PROCESSING);
+    }
+    return replicas;
+}
+
+void MasterService::AllocateContiguousBatch(
+    ScopedAllocatorAccess& allocator_access,
+    const std::vector<std::vector<uint64_t>>& slice_lengths,
+    const std::vector<uint64_t>& total_lengths,
+    const std::vector<bool>& pending, const ReplicateConfig& config,
+    std::vector<std::vector<Replica>>& replicas) {
+    // Objects start 8-byte aligned within an extent
+    const auto aligned = [](uint64_t size) {
+        return (size + 7) & ~uint64_t{7};
+    };
+    std::vector<size_t> group;
+    uint64_t group_size = 0;
+
+    const auto allocate_group = [&]() {
+        // A single key gains nothing from an extent of its own
+        if (group.size() < 2) {
+            return;
+        }
+        allocation_demand_bytes_.fetch_add(group_size * config.replica_num,
+                                           std::memory_order_relaxed);
+        std::vector<std::shared_ptr<AllocatedBuffer>> extents;
+        std::vector<std::string> placed_segments;
+        for (size_t i = 0; i < config.replica_num; ++i) {
+            std::shared_ptr<AllocatedBuffer> extent = AllocateInTier(
+                allocator_access.getAllocators(),
+                allocator_access.getAllocatorsByName(), group_size, config,
+                placed_segments);
+            if (!extent) {
+                VLOG(1) << "keys=" << group.size() << ", size=" << group_size
+                        << ", replica_id=" << i
+                        << ", info=contiguous_batch_extent_unavailable";
+                return;
+            }
+            placed_segments.push_back(extent->segment_name());
+            extents.push_back(std::move(extent));
+        }
+        uint64_t offset = 0;
+        for (size_t idx : group) {
+            for (const auto& extent : extents) {
+                std::vector<std::unique_ptr<AllocatedBuffer>> handles;
+                handles.reserve(slice_lengths[idx].size());
+                char* address = static_cast<char*>(extent->data()) + offset;
+                for (uint64_t length : slice_lengths[idx]) {
+                    handles.emplace_back(std::make_unique<AllocatedBuffer>(
+                        extent, address, length));
+                    address += length;
+                }
+                replicas[idx].emplace_back(std::move(handles),
+                                           ReplicaStatus::PROCESSING);
+            }
+            offset += aligned(total_lengths[idx]);
+        }
+        VLOG(1) << "keys=" << group.size() << ", size=" << group_size
+                << ", segment=" << extents.front()->segment_name()
+                << ", action=contiguous_batch_allocated";
+    };
+
+    for (size_t i = 0; i < pending.size(); ++i) {
+        if (!pending[i] || total_lengths[i] == 0 ||
+            total_lengths[i] > kMaxContiguousBatchExtent) {
+            continue;
+        }
+        const uint64_t size = aligned(total_lengths[i]);
+        if (group_size + size > kMaxContiguousBatchExtent) {
+            allocate_group();
+            group.clear();
+            group_size = 0;
+        }
+        group.push_back(i);
+        group_size += size;
+    }
+    allocate_group();
+}
+
+auto MasterService::AllocateFragment(
+    ScopedAllocatorAccess& allocator_access, uint64_t size,
+    const ReplicateConfig& config,
+    const std::vector<std::string>& placed_segments)
+    -> std::unique_ptr<AllocatedBuffer> {
+    std::vector<std::shared_ptr<BufferAllocator>> allocators;
+    std::unordered_map<std::string,
+                       std::vector<std::shared_ptr<BufferAllocator>>>
+        allocators_by_name;
+    for (const auto& allocator : allocator_access.getAllocators()) {
+        const auto& name = allocator->getSegmentName();
+        if (std::find(placed_segments.begin(), placed_segments.end(), name) ==
+            placed_segments.end()) {
+            allocators.push_back(allocator);
+            allocators_by_name[name].push_back(allocator);
+        }
+    }
+    if (allocators.empty()) {
+        return nullptr;
+    }
+    return AllocateInTier(allocators, allocators_by_name, size, config,
+                          placed_segments);
+}
+
+auto MasterService::AllocateInTier(
+    const std::vector<std::shared_ptr<BufferAllocator>>& allocators,
+    const std::unordered_map<std::string,
+                             std::vector<std::shared_ptr<BufferAllocator>>>&
+        allocators_by_name,
+    uint64_t size, const ReplicateConfig& config,
+    const std::vector<std::string>& placed_segments)
+    -> std::unique_ptr<AllocatedBuffer> {
+    const auto on_device = [](const std::shared_ptr<BufferAllocator>& a) {
+        return !a->getTopology().device.empty();
+    };
+    const auto device_count = static_cast<size_t>(
+        std::count_if(allocators.begin(), allocators.end(), on_device));
+    // A single tier, as without GPU segments, needs no filtering
+    if (device_count == 0 || device_count == allocators.size()) {
+        return allocation_strategy_->AllocateReplicaSlice(
+            allocators, allocators_by_name, size, config, placed_segments);
+    }
+
+    const auto allocate_from = [&](bool device) {
+        std::vector<std::shared_ptr<BufferAllocator>> tier;
+        std::unordered_map<std::string,
+                           std::vector<std::shared_ptr<BufferAllocator>>>
+            tier_by_name;
+        for (const auto& allocator : allocators) {
+            if (on_device(allocator) == device) {
+                tier.push_back(allocator);
+                tier_by_name[allocator->getSegmentName()].push_back(allocator);
+            }
+        }
+        return allocation_strategy_->AllocateReplicaSlice(
+            tier, tier_by_name, size, config, placed_segments);
+    };
+    if (config.prefer_device_memory) {
+        if (auto buffer = allocate_from(true)) {
+            return buffer;
+        }
+    }
+    return allocate_from(false);
+}
+
+auto MasterService::PutStart(const std::string& key,
+                             const std::vector<uint64_t>& slice_lengths,
+                             const ReplicateConfig& config)
+    -> tl::expected<std::vector<Replica::Descriptor>, ErrorCode> {
+    auto total_length = ValidatePutParams(key, slice_lengths, config);
+    if (!total_length) {
+        return tl::make_unexpected(total_length.error());
     }
 
-    VLOG(1) << "key=" << key << ", value_length=" << total_length
+    VLOG(1) << "key=" << key << ", value_length=" << *total_length
             << ", slice_count=" << slice_lengths.size() << ", config=" << config
             << ", action=put_start_begin";
 
+    if (!config.content_hash.empty()) {
+        return PutContentStart(key, slice_lengths, *total_length, config);
+    }
+
     // Lock the shard and check if object already exists
-    size_t shard_idx = getShardIndex(key);
-    MutexLocker lock(&metadata_shards_[shard_idx].mutex);
+    auto& shard = metadata_shards_[getShardIndex(key)];
+    SharedMutexLocker lock(&shard.mutex);
 
-    auto it = metadata_shards_[shard_idx].metadata.find(key);
-    if (it != metadata_shards_[shard_idx].metadata.end() &&
-        !CleanupStaleHandles(it->second)) {
+    auto existing = FindAndCleanup(shard, key);
+    if (config.upsert && existing != shard.metadata.end()) {
+        return UpsertStart(key, existing->second, slice_lengths,
+                           *total_length, config);
+    }
+    if (config.upsert && shard.aliases.contains(key)) {
+        LOG(ERROR) << "key=" << key << ", error=upsert_of_content_alias";
+        return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    if (existing != shard.metadata.end() || shard.aliases.contains(key)) {
         LOG(INFO) << "key=" << key << ", info=object_already_exists";
         return tl::make_unexpected(ErrorCode::OBJECT_ALREADY_EXISTS);
     }
+    if (!NamespaceHasRoom(key, *total_length)) {
+        return tl::make_unexpected(ErrorCode::NO_AVAILABLE_HANDLE);
+    }
 
     // Allocate replicas
-    std::vector<Replica> replicas;
-    replicas.reserve(config.replica_num);
+    tl::expected<std::vector<Replica>, ErrorCode> replicas;
     {
         ScopedAllocatorAccess allocator_access =
             segment_manager_.getAllocatorAccess();
-        auto& allocators = allocator_access.getAllocators();
-        auto& allocators_by_name = allocator_access.getAllocatorsByName();
-        for (size_t i = 0; i < config.replica_num; ++i) {
-            std::vector<std::unique_ptr<AllocatedBuffer>> handles;
-            handles.reserve(slice_lengths.size());
+        replicas =
+            AllocateReplicas(allocator_access, key, slice_lengths, config);
+    }
+    if (!replicas) {
+        return tl::make_unexpected(replicas.error());
+    }
+
+    std::vector<Replica::Descriptor> replica_list;
+    replica_list.reserve(replicas->size());
+    for (const auto& replica : *replicas) {
+        replica_list.emplace_back(replica.get_descriptor());
+    }
+
+    // No need to set lease here. The object will not be evicted until
+    // PutEnd is called.
+    auto it = EmplaceObject(shard, key, *total_length, std::move(*replicas),
+                            config.with_soft_pin, &shard.disk_only_objects,
+                            namespaces_.Find(key))
+                  .first;
+    if (!config.tag.empty()) {
+        it->second.SetTag(&shard.tag_index, key, config.tag);
+    }
+    if (config.next_use_ms > 0) {
+        it->second.HintNextUse(config.next_use_ms);
+    }
+    it->second.chain_copies = ChainCopies(config);
+    return replica_list;
+}
+
+auto MasterService::UpsertStart(const std::string& key,
+                                ObjectMetadata& metadata,
+                                const std::vector<uint64_t>& slice_lengths,
+                                uint64_t total_length,
+                                const ReplicateConfig& config)
+    -> tl::expected<std::vector<Replica::Descriptor>, ErrorCode> {
+    // Objects being written, promoted or relocated are refused
+    if (auto status = metadata.HasDiffRepStatus(ReplicaStatus::COMPLETE)) {
+        LOG(WARNING) << "key=" << key << ", status=" << *status
+                     << ", error=replica_not_ready";
+        return tl::make_unexpected(ErrorCode::REPLICA_IS_NOT_READY);
+    }
+    if (total_length > metadata.size &&
+        !NamespaceHasRoom(key, total_length - metadata.size)) {
+        return tl::make_unexpected(ErrorCode::NO_AVAILABLE_HANDLE);
+    }
+
+    std::vector<Replica::Descriptor> replica_list;
+    // Without a lease no reader can be using the buffers, nor have their
+    // replica list cached
+    const bool in_place =
+        metadata.IsLeaseExpired() && metadata.HasMemoryReplica() &&
+        std::all_of(metadata.replicas.begin(), metadata.replicas.end(),
+                    [&slice_lengths](const Replica& replica) {
+                        return !replica.is_memory_replica() ||
+                               replica.fits(slice_lengths);
+                    });
+    if (in_place) {
+        // A disk replica would keep the previous value
+        std::erase_if(metadata.replicas, [](const Replica& replica) {
+            return !replica.is_memory_replica();
+        });
+        for (auto& replica : metadata.replicas) {
+            replica.rewrite(slice_lengths);
+            replica_list.emplace_back(replica.get_descriptor());
+        }
+        metadata.Resize(total_length);
+        change_log_.Record(key);
+        MasterMetricManager::instance().inc_upserts_in_place();
+        VLOG(1) << "key=" << key << ", action=upsert_in_place";
+    } else {
+        tl::expected<std::vector<Replica>, ErrorCode> replicas;
+        {
+            ScopedAllocatorAccess allocator_access =
+                segment_manager_.getAllocatorAccess();
+            replicas = AllocateReplicas(allocator_access, key, slice_lengths,
+                                        config);
+        }
+        if (!replicas) {
+            return tl::make_unexpected(replicas.error());
+        }
+        for (auto& replica : *replicas) {
+            replica_list.emplace_back(replica.get_descriptor());
+            metadata.replicas.emplace_back(std::move(replica));
+        }
+        metadata.upserting = true;
+        VLOG(1) << "key=" << key << ", action=upsert_start";
+    }
+    if (config.next_use_ms > 0) {
+        metadata.HintNextUse(config.next_use_ms);
+    }
+    MasterMetricManager::instance().inc_upserts();
+    return replica_list;
+}
+
+void MasterService::FinishUpsert(const std::string& key,
+                                 ObjectMetadata& metadata) {
+    metadata.upserting = false;
+    // Readers granted a lease before now may still be reading the previous
+    // value
+    const bool leased = !metadata.IsLeaseExpired();
+    std::vector<RetiredReplica> retired;
+    std::vector<Replica> current;
+    for (auto& replica : metadata.replicas) {
+        if (replica.status() == ReplicaStatus::PROCESSING) {
+            current.push_back(std::move(replica));
+        } else if (leased && replica.is_memory_replica() &&
+                   !replica.is_inline()) {
+            retired.push_back({std::move(replica), metadata.GetLeaseTimeout()});
+        }
+    }
+    metadata.replicas = std::move(current);
+
+    uint64_t size = 0;
+    const auto descriptor = metadata.replicas.front().get_descriptor();
+    for (const auto& buffer :
+         descriptor.get_memory_descriptor().buffer_descriptors) {
+        size += buffer.size_;
+    }
+    metadata.Resize(size);
+    metadata.UpdateResidency();
+
+    MutexLocker compaction_lock(&compaction_mutex_);
+    std::move(retired.begin(), retired.end(),
+              std::back_inserter(retired_replicas_));
+    // The extra replicas went with the previous value
+    hot_replicas_.erase(key);
+}
+
+std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+MasterService::BatchPutStart(
+    const std::vector<std::string>& keys,
+    const std::vector<std::vector<uint64_t>>& slice_lengths,
+    const ReplicateConfig& config) {
+    std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+        results(keys.size(), tl::make_unexpected(ErrorCode::INVALID_PARAMS));
+    if (keys.size() != slice_lengths.size()) {
+        LOG(ERROR) << "keys_count=" << keys.size()
+                   << ", slice_lengths_count=" << slice_lengths.size()
+                   << ", error=invalid_params";
+        return results;
+    }
+    // Keys that exist with config.skip_resident, touched once the shard
+    // locks are released
+    std::vector<std::string> resident;
+    auto skip_resident = [&](size_t idx) {
+        VLOG(1) << "key=" << keys[idx] << ", info=resident_skipped";
+        results[idx] = std::vector<Replica::Descriptor>{};
+        if (config.refresh_resident_lease) {
+            resident.push_back(keys[idx]);
+        }
+    };
+    auto refresh_resident = [&]() {
+        if (!resident.empty()) {
+            BatchTouch(resident, 0, config.next_use_ms);
+        }
+    };
+    // Keys that exist are rewritten one by one
+    if (config.upsert) {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            results[i] = PutStart(keys[i], slice_lengths[i], config);
+        }
+        return results;
+    }
+    // Every key would be an alias of the same content
+    if (!config.content_hash.empty()) {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            results[i] = PutStart(keys[i], slice_lengths[i], config);
+            if (config.skip_resident && !results[i] &&
+                results[i].error() == ErrorCode::OBJECT_ALREADY_EXISTS) {
+                skip_resident(i);
+            }
+        }
+        refresh_resident();
+        return results;
+    }
+
+    std::vector<uint64_t> total_lengths(keys.size(), 0);
+    std::vector<bool> pending(keys.size(), false);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        auto total_length = ValidatePutParams(keys[i], slice_lengths[i], config);
+        if (total_length) {
+            total_lengths[i] = *total_length;
+            pending[i] = true;
+        }
+    }
+
+    // 1. Reject or skip keys that already exist, visiting every shard
+    // once. This pass also drops metadata whose replicas are all stale.
+    const auto groups = GroupByShard(keys);
+    for (const auto& [shard_idx, indices] : groups) {
+        auto& shard = metadata_shards_[shard_idx];
+        SharedMutexLocker lock(&shard.mutex);
+        for (size_t idx : indices) {
+            if (pending[idx] &&
+                (FindAndCleanup(shard, keys[idx]) != shard.metadata.end() ||
+                 shard.aliases.contains(keys[idx]))) {
+                pending[idx] = false;
+                if (config.skip_resident) {
+                    skip_resident(idx);
+                    continue;
+                }
+                LOG(INFO) << "key=" << keys[idx]
+                          << ", info=object_already_exists";
+                results[idx] =
+                    tl::make_unexpected(ErrorCode::OBJECT_ALREADY_EXISTS);
+            }
+        }
+    }
+    // The keys of a namespace must fit in its capacity together
+    if (namespaces_.enabled()) {
+        std::unordered_map<const NamespaceTable::Usage*, uint64_t> batch_bytes;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (!pending[i]) {
+                continue;
+            }
+            uint64_t& bytes = batch_bytes[namespaces_.Find(keys[i])];
+            if (!NamespaceHasRoom(keys[i], bytes + total_lengths[i])) {
+                results[i] =
+                    tl::make_unexpected(ErrorCode::NO_AVAILABLE_HANDLE);
+                pending[i] = false;
+                continue;
+            }
+            bytes += total_lengths[i];
+        }
+    }
+
+    // 2. Allocate replicas of all remaining keys in one allocator access
+    // scope. No shard lock is held here, which keeps the lock order of
+    // shard mutex before segment mutex.
+    std::vector<std::vector<Replica>> replicas(keys.size());
+    {
+        ScopedAllocatorAccess allocator_access =
+            segment_manager_.getAllocatorAccess();
+        if (config.contiguous_batch && config.ec_parity_fragments == 0 &&
+            config.shard_segments.empty() && ChainCopies(config) == 0) {
+            AllocateContiguousBatch(allocator_access, slice_lengths,
+                                    total_lengths, pending, config, replicas);
+        }
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (!pending[i] || !replicas[i].empty()) {
+                continue;
+            }
+            auto allocated = AllocateReplicas(allocator_access, keys[i],
+                                              slice_lengths[i], config);
+            if (!allocated) {
+                results[i] = tl::make_unexpected(allocated.error());
+                pending[i] = false;
+                continue;
+            }
+            replicas[i] = std::move(*allocated);
+        }
+    }
+
+    // 3. Publish the metadata, again one lock acquisition per shard. A
+    // concurrent PutStart may have won the race for a key in the meantime;
+    // its replicas are released when they go out of scope.
+    for (const auto& [shard_idx, indices] : groups) {
+        auto& shard = metadata_shards_[shard_idx];
+        SharedMutexLocker lock(&shard.mutex);
+        for (size_t idx : indices) {
+            if (!pending[idx]) {
+                continue;
+            }
+            std::vector<Replica::Descriptor> replica_list;
+            replica_list.reserve(replicas[idx].size());
+            for (const auto& replica : replicas[idx]) {
+                replica_list.emplace_back(replica.get_descriptor());
+            }
+            bool inserted = false;
+            if (FindAndCleanup(shard, keys[idx]) == shard.metadata.end() &&
+                !shard.aliases.contains(keys[idx])) {
+                auto emplaced =
+                    EmplaceObject(shard, keys[idx], total_lengths[idx],
+                                  std::move(replicas[idx]),
+                                  config.with_soft_pin,
+                                  &shard.disk_only_objects,
+                                  namespaces_.Find(keys[idx]));
+                inserted = emplaced.second;
+                if (inserted && !config.tag.empty()) {
+                    emplaced.first->second.SetTag(&shard.tag_index, keys[idx],
+                                                  config.tag);
+                }
+                if (inserted) {
+                    emplaced.first->second.chain_copies = ChainCopies(config);
+                    if (config.next_use_ms > 0) {
+                        emplaced.first->second.HintNextUse(
+                            config.next_use_ms);
+                    }
+                }
+            }
+            if (inserted) {
+                results[idx] = std::move(replica_list);
+            } else if (config.skip_resident) {
+                skip_resident(idx);
+            } else {
+                LOG(INFO) << "key=" << keys[idx]
+                          << ", info=object_already_exists";
+                results[idx] =
+                    tl::make_unexpected(ErrorCode::OBJECT_ALREADY_EXISTS);
+            }
+        }
+    }
+    refresh_resident();
+    return results;
+}
+
+auto MasterService::PutContentStart(const std::string& key,
+                                    const std::vector<uint64_t>& slice_lengths,
+                                    uint64_t total_length,
+                                    const ReplicateConfig& config)
+    -> tl::expected<std::vector<Replica::Descriptor>, ErrorCode> {
+    auto& key_shard = metadata_shards_[getShardIndex(key)];
+    {
+        SharedMutexLocker lock(&key_shard.mutex);
+        if (FindAndCleanup(key_shard, key) != key_shard.metadata.end() ||
+            key_shard.aliases.contains(key)) {
+            LOG(INFO) << "key=" << key << ", info=object_already_exists";
+            return tl::make_unexpected(ErrorCode::OBJECT_ALREADY_EXISTS);
+        }
+    }
+
+    // 1. Take a reference on the content object, allocating it on first use
+    const std::string content_key =
+        std::string(kContentKeyPrefix) + config.content_hash;
+    bool allocated = false;
+    bool shared = false;
+    std::vector<Replica::Descriptor> replica_list;
+    {
+        auto& shard = metadata_shards_[getShardIndex(content_key)];
+        SharedMutexLocker lock(&shard.mutex);
+        auto it = FindAndCleanup(shard, content_key);
+        if (it != shard.metadata.end()) {
+            // Readers get the slices of the content object, which must be
+            // laid out like this put
+            std::vector<uint64_t> stored_lengths;
+            for (const auto& replica : it->second.replicas) {
+                if (replica.is_memory_replica()) {
+                    const auto descriptor = replica.get_descriptor();
+                    for (const auto& buffer :
+                         descriptor.get_memory_descriptor()
+                             .buffer_descriptors) {
+                        stored_lengths.push_back(buffer.size_);
+                    }
+                    break;
+                }
+            }
+            shared = it->second.size == total_length &&
+                     (stored_lengths.empty() ||
+                      stored_lengths == slice_lengths);
+        } else {
+            // The content is charged to the namespace of its first key
+            if (!NamespaceHasRoom(key, total_length)) {
+                return tl::make_unexpected(ErrorCode::NO_AVAILABLE_HANDLE);
+            }
+            tl::expected<std::vector<Replica>, ErrorCode> replicas;
+            {
+                ScopedAllocatorAccess allocator_access =
+                    segment_manager_.getAllocatorAccess();
+                replicas = AllocateReplicas(allocator_access, content_key,
+                                            slice_lengths, config);
+            }
+            if (!replicas) {
+                return tl::make_unexpected(replicas.error());
+            }
+            replica_list.reserve(replicas->size());
+            for (const auto& replica : *replicas) {
+                replica_list.emplace_back(replica.get_descriptor());
+            }
+            auto& metadata =
+                EmplaceObject(shard, content_key, total_length,
+                              std::move(*replicas), config.with_soft_pin,
+                              &shard.disk_only_objects, namespaces_.Find(key))
+                    .first->second;
+            metadata.chain_copies = ChainCopies(config);
+            if (config.next_use_ms > 0) {
+                metadata.HintNextUse(config.next_use_ms);
+            }
+            change_log_.Record(content_key);
+            allocated = true;
+        }
+        if (allocated || shared) {
+            shard.content_refs[content_key]++;
+        }
+    }
+    if (!allocated && !shared) {
+        // A hash collision or a client bug, the put is not deduplicated
+        LOG(WARNING) << "key=" << key << ", content_key=" << content_key
+                     << ", error=content_layout_mismatch";
+        ReplicateConfig unshared = config;
+        unshared.content_hash.clear();
+        return PutStart(key, slice_lengths, unshared);
+    }
+
+    // 2. Publish the alias. A concurrent put may have won the race for the
+    // key, the reference is given back then.
+    bool inserted = false;
+    {
+        SharedMutexLocker lock(&key_shard.mutex);
+        if (FindAndCleanup(key_shard, key) == key_shard.metadata.end()) {
+            inserted = key_shard.aliases.try_emplace(key, content_key).second;
+        }
+    }
+    if (!inserted) {
+        if (allocated) {
+            PutRevoke(content_key);
+        }
+        ReleaseContent(content_key);
+        LOG(INFO) << "key=" << key << ", info=object_already_exists";
+        return tl::make_unexpected(ErrorCode::OBJECT_ALREADY_EXISTS);
+    }
+
+    if (shared) {
+        // The content is stored or being stored, nothing to transfer
+        MasterMetricManager::instance().inc_dedup_hits(total_length *
+                                                       config.replica_num);
+        VLOG(1) << "key=" << key << ", content_key=" << content_key
+                << ", info=content_deduplicated";
+        return tl::make_unexpected(ErrorCode::OBJECT_ALREADY_EXISTS);
+    }
+    return replica_list;
+}
 
-            // Allocate space for each slice
-            for (size_t j = 0; j < slice_lengths.size(); ++j) {
-                auto chunk_size = slice_lengths[j];
+auto MasterService::PutEnd(const std::string& key)
+    -> tl::expected<void, ErrorCode> {
+    std::optional<std::string> content_key;
+    {
+        MetadataAccessor accessor(this, key);
+        if (accessor.Exists()) {
+            CompletePut(key, accessor.Get());
+            return {};
+        }
+        content_key = accessor.ContentKey();
+    }
+    if (!content_key) {
+        LOG(ERROR) << "key=" << key << ", error=object_not_found";
+        return tl::make_unexpected(ErrorCode::OBJECT_NOT_FOUND);
+    }
+    // Ends the put that allocated the content object
+    return PutEnd(*content_key);
+}
 
-                // Use the unified allocation strategy with replica config
-                auto handle = allocation_strategy_->Allocate(
-                    allocators, allocators_by_name, chunk_size, config);
+void MasterService::CompletePut(const std::string& key,
+                                ObjectMetadata& metadata) {
+    if (metadata.upserting) {
+        FinishUpsert(key, metadata);
+    }
+    for (auto& replica : metadata.replicas) {
+        // The disk replica of a promoted object is complete already
+        if (replica.is_memory_replica()) {
+            replica.mark_complete();
+        }
+    }
+    // 1. Set lease timeout to now, indicating that the object has no lease
+    // at beginning. 2. If this object has soft pin enabled, set it to be soft
+    // pinned.
+    metadata.GrantLease(0, default_kv_soft_pin_ttl_);
+    if (metadata.chain_copies > 0) {
+        ForwardChain(key, metadata, metadata.replicas.front());
+    }
+}
+
+void MasterService::ForwardChain(const std::string& key,
+                                 ObjectMetadata& metadata, const Replica& from) {
+    const std::string segment = SegmentOf(from);
+    auto queued =
+        QueueCopy(key, metadata, segment, "", RelocationKind::CHAIN);
+    if (!queued) {
+        // The object keeps the replicas forwarded so far
+        LOG(WARNING) << "key=" << key << ", source_segment=" << segment
+                     << ", chain_copies=" << metadata.chain_copies
+                     << ", error=chain_forward_failed, error_code="
+                     << queued.error();
+        metadata.chain_copies = 0;
+        return;
+    }
+    --metadata.chain_copies;
+}
+
+auto MasterService::PutRevoke(const std::string& key)
+    -> tl::expected<void, ErrorCode> {
+    std::optional<std::string> content_key;
+    {
+        MetadataAccessor accessor(this, key);
+        if (accessor.Exists()) {
+            auto erase = RevokePut(key, accessor.Get());
+            if (!erase) {
+                return tl::make_unexpected(erase.error());
+            }
+            if (*erase) {
+                accessor.Erase();
+            }
+            return {};
+        }
+        content_key = accessor.ContentKey();
+    }
+    if (!content_key) {
+        LOG(INFO) << "key=" << key << ", info=object_not_found";
+        return tl::make_unexpected(ErrorCode::OBJECT_NOT_FOUND);
+    }
+
+    // The content object goes with the put that allocated it, aliases added
+    // meanwhile find it gone
+    auto revoked = PutRevoke(*content_key);
+    if (!revoked && revoked.error() != ErrorCode::OBJECT_NOT_FOUND) {
+        return revoked;
+    }
+    DropAlias(key, *content_key);
+    return {};
+}
+
+auto MasterService::RevokePut(const std::string& key,
+                              ObjectMetadata& metadata)
+    -> tl::expected<bool, ErrorCode> {
+    // A failed upsert, the object keeps its previous value
+    if (metadata.upserting) {
+        std::erase_if(metadata.replicas, [](const Replica& replica) {
+            return replica.status() == ReplicaStatus::PROCESSING;
+        });
+        metadata.upserting = false;
+        return false;
+    }
+    bool has_disk_replica = false;
+    for (const auto& replica : metadata.replicas) {
+        if (!replica.is_memory_replica()) {
+            has_disk_replica = true;
+        } else if (replica.status() != ReplicaStatus::PROCESSING) {
+            LOG(ERROR) << "key=" << key << ", status=" << replica.status()
+                       << ", error=invalid_replica_status";
+            return tl::make_unexpected(ErrorCode::INVALID_WRITE);
+        }
+    }
+    if (!has_disk_replica) {
+        return true;
+    }
+
+    // A failed promotion, the object stays on disk
+    std::erase_if(metadata.replicas, [](const Replica& replica) {
+        return replica.is_memory_replica();
+    });
+    metadata.UpdateResidency();
+    return false;
+}
+
+std::vector<tl::expected<void, ErrorCode>> MasterService::BatchPutEnd(
+    const std::vector<std::string>& keys) {
+    std::vector<tl::expected<void, ErrorCode>> results(keys.size());
+    std::vector<size_t> aliases;
+    for (const auto& [shard_idx, indices] : GroupByShard(keys)) {
+        auto& shard = metadata_shards_[shard_idx];
+        SharedMutexLocker lock(&shard.mutex);
+        for (size_t idx : indices) {
+            auto it = FindAndCleanup(shard, keys[idx]);
+            if (it == shard.metadata.end()) {
+                if (shard.aliases.contains(keys[idx])) {
+                    aliases.push_back(idx);
+                    continue;
+                }
+                LOG(ERROR) << "key=" << keys[idx]
+                           << ", error=object_not_found";
+                results[idx] = tl::make_unexpected(ErrorCode::OBJECT_NOT_FOUND);
+                continue;
+            }
+            CompletePut(keys[idx], it->second);
+            change_log_.Record(keys[idx]);
+        }
+    }
+    for (size_t idx : aliases) {
+        results[idx] = PutEnd(keys[idx]);
+    }
+    return results;
+}
+
+std::vector<tl::expected<void, ErrorCode>> MasterService::BatchPutRevoke(
+    const std::vector<std::string>& keys) {
+    std::vector<tl::expected<void, ErrorCode>> results(keys.size());
+    std::vector<size_t> aliases;
+    for (const auto& [shard_idx, indices] : GroupByShard(keys)) {
+        auto& shard = metadata_shards_[shard_idx];
+        SharedMutexLocker lock(&shard.mutex);
+        for (size_t idx : indices) {
+            auto it = FindAndCleanup(shard, keys[idx]);
+            if (it == shard.metadata.end()) {
+                if (shard.aliases.contains(keys[idx])) {
+                    aliases.push_back(idx);
+                    continue;
+                }
+                LOG(INFO) << "key=" << keys[idx]
+                          << ", info=object_not_found";
+                results[idx] = tl::make_unexpected(ErrorCode::OBJECT_NOT_FOUND);
+                continue;
+            }
+            auto erase = RevokePut(keys[idx], it->second);
+            if (!erase) {
+                results[idx] = tl::make_unexpected(erase.error());
+            } else if (*erase) {
+                shard.metadata.erase(it);
+            }
+            change_log_.Record(keys[idx]);
+        }
+    }
+    for (size_t idx : aliases) {
+        results[idx] = PutRevoke(keys[idx]);
+    }
+    return results;
+}
+
+auto MasterService::PutInline(const std::string& key, const std::string& value,
+                              const ReplicateConfig& config)
+    -> tl::expected<void, ErrorCode> {
+    if (inline_object_max_size_ == 0) {
+        return tl::make_unexpected(ErrorCode::UNAVAILABLE_IN_CURRENT_MODE);
+    }
+    auto total_length = ValidatePutParams(key, {value.size()}, config);
+    if (!total_length) {
+        return tl::make_unexpected(total_length.error());
+    }
+    // Aliases of a content hash share an allocated object
+    if (value.empty() || *total_length > inline_object_max_size_ ||
+        !config.content_hash.empty()) {
+        VLOG(1) << "key=" << key << ", value_length=" << *total_length
+                << ", info=not_inlined";
+        return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+    }
+
+    auto& shard = metadata_shards_[getShardIndex(key)];
+    SharedMutexLocker lock(&shard.mutex);
+    if (FindAndCleanup(shard, key) != shard.metadata.end() ||
+        shard.aliases.contains(key)) {
+        LOG(INFO) << "key=" << key << ", info=object_already_exists";
+        return tl::make_unexpected(ErrorCode::OBJECT_ALREADY_EXISTS);
+    }
+    if (!NamespaceHasRoom(key, *total_length)) {
+        return tl::make_unexpected(ErrorCode::NO_AVAILABLE_HANDLE);
+    }
+
+    std::vector<Replica> replicas;
+    replicas.emplace_back(value);
+    auto it = EmplaceObject(shard, key, *total_length, std::move(replicas),
+                            config.with_soft_pin, &shard.disk_only_objects,
+                            namespaces_.Find(key))
+                  .first;
+    if (!config.tag.empty()) {
+        it->second.SetTag(&shard.tag_index, key, config.tag);
+    }
+    if (config.next_use_ms > 0) {
+        it->second.HintNextUse(config.next_use_ms);
+    }
+    // As CompletePut does, the replica is complete already
+    it->second.GrantLease(0, default_kv_soft_pin_ttl_);
+    change_log_.Record(key);
+    VLOG(1) << "key=" << key << ", value_length=" << *total_length
+            << ", action=inline_put";
+    return {};
+}
+
+auto MasterService::GrantAllocationCredit(const UUID& client_id,
+                                          uint64_t size)
+    -> tl::expected<AllocationCredit, ErrorCode> {
+    if (size == 0) {
+        return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    size = std::min(size, kMaxAllocationCreditSize);
+    std::unique_ptr<AllocatedBuffer> extent;
+    {
+        ScopedAllocatorAccess allocator_access =
+            segment_manager_.getAllocatorAccess();
+        extent = AllocateInTier(allocator_access.getAllocators(),
+                                allocator_access.getAllocatorsByName(), size,
+                                ReplicateConfig{}, {});
+    }
+    if (!extent) {
+        VLOG(1) << "client_id=" << client_id << ", size=" << size
+                << ", error=credit_allocation_failed";
+        need_eviction_ = true;
+        return tl::make_unexpected(ErrorCode::NO_AVAILABLE_HANDLE);
+    }
+
+    AllocationCredit credit;
+    credit.extent = extent->get_descriptor();
+    credit.ttl_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        kAllocationCreditTtl)
+                        .count();
+    MutexLocker lock(&credit_mutex_);
+    credit.id = ++next_credit_id_;
+    credits_.emplace(credit.id,
+                     Credit{client_id, std::move(extent),
+                            std::chrono::steady_clock::now() +
+                                kAllocationCreditTtl});
+    VLOG(1) << "client_id=" << client_id << ", credit_id=" << credit.id
+            << ", extent=" << credit.extent.segment_name_ << "@"
+            << credit.extent.buffer_address_ << "+" << credit.extent.size_
+            << ", action=credit_granted";
+    return credit;
+}
+
+std::vector<tl::expected<void, ErrorCode>> MasterService::CommitCreditPuts(
+    const UUID& client_id, uint64_t credit_id,
+    const std::vector<CreditPut>& puts) {
+    std::vector<tl::expected<void, ErrorCode>> results(
+        puts.size(), tl::make_unexpected(ErrorCode::INVALID_PARAMS));
+    std::shared_ptr<AllocatedBuffer> extent;
+    {
+        MutexLocker lock(&credit_mutex_);
+        auto it = credits_.find(credit_id);
+        if (it != credits_.end() && it->second.client_id == client_id &&
+            it->second.expiry > std::chrono::steady_clock::now()) {
+            extent = it->second.extent;
+        }
+    }
+    if (!extent || !extent->isAllocatorValid()) {
+        LOG(WARNING) << "client_id=" << client_id
+                     << ", credit_id=" << credit_id
+                     << ", error=credit_not_found";
+        return results;
+    }
+
+    ReplicateConfig config;
+    for (size_t i = 0; i < puts.size(); ++i) {
+        const auto& put = puts[i];
+        config.with_soft_pin = put.with_soft_pin;
+        auto total_length =
+            ValidatePutParams(put.key, put.slice_lengths, config);
+        if (!total_length) {
+            results[i] = tl::make_unexpected(total_length.error());
+            continue;
+        }
+        if (put.offset > extent->size() ||
+            *total_length > extent->size() - put.offset) {
+            LOG(ERROR) << "key=" << put.key << ", credit_id=" << credit_id
+                       << ", offset=" << put.offset
+                       << ", value_length=" << *total_length
+                       << ", error=out_of_credit_extent";
+            continue;
+        }
+
+        auto& shard = metadata_shards_[getShardIndex(put.key)];
+        SharedMutexLocker lock(&shard.mutex);
+        if (FindAndCleanup(shard, put.key) != shard.metadata.end() ||
+            shard.aliases.contains(put.key)) {
+            VLOG(1) << "key=" << put.key << ", info=object_already_exists";
+            results[i] =
+                tl::make_unexpected(ErrorCode::OBJECT_ALREADY_EXISTS);
+            continue;
+        }
+        if (!NamespaceHasRoom(put.key, *total_length)) {
+            results[i] = tl::make_unexpected(ErrorCode::NO_AVAILABLE_HANDLE);
+            continue;
+        }
+        std::vector<std::unique_ptr<AllocatedBuffer>> handles;
+        handles.reserve(put.slice_lengths.size());
+        char* address = static_cast<char*>(extent->data()) + put.offset;
+        for (uint64_t length : put.slice_lengths) {
+            handles.emplace_back(
+                std::make_unique<AllocatedBuffer>(extent, address, length));
+            address += length;
+        }
+        std::vector<Replica> replicas;
+        replicas.emplace_back(std::move(handles), ReplicaStatus::PROCESSING);
+        auto it = EmplaceObject(shard, put.key, *total_length,
+                                std::move(replicas), put.with_soft_pin,
+                                &shard.disk_only_objects,
+                                namespaces_.Find(put.key))
+                      .first;
+        CompletePut(put.key, it->second);
+        change_log_.Record(put.key);
+        results[i] = {};
+    }
+    VLOG(1) << "client_id=" << client_id << ", credit_id=" << credit_id
+            << ", puts=" << puts.size() << ", action=credit_puts_committed";
+    return results;
+}
+
+auto MasterService::ReturnAllocationCredit(const UUID& client_id,
+                                           uint64_t credit_id)
+    -> tl::expected<void, ErrorCode> {
+    // Freed after the lock is released
+    std::shared_ptr<AllocatedBuffer> extent;
+    MutexLocker lock(&credit_mutex_);
+    auto it = credits_.find(credit_id);
+    if (it == credits_.end() || it->second.client_id != client_id) {
+        return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    extent = std::move(it->second.extent);
+    credits_.erase(it);
+    VLOG(1) << "client_id=" << client_id << ", credit_id=" << credit_id
+            << ", action=credit_returned";
+    return {};
+}
+
+void MasterService::CreditGC() {
+    const auto now = std::chrono::steady_clock::now();
+    // Freed after the lock is released
+    std::vector<std::shared_ptr<AllocatedBuffer>> extents;
+    {
+        MutexLocker lock(&credit_mutex_);
+        for (auto it = credits_.begin(); it != credits_.end();) {
+            if (it->second.expiry <= now) {
+                extents.push_back(std::move(it->second.extent));
+                it = credits_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    if (!extents.empty()) {
+        VLOG(1) << "expired_credits=" << extents.size()
+                << ", action=credits_expired";
+    }
+}
+
+auto MasterService::PutDiskReplica(const std::string& key,
+                                   const DiskDescriptor& disk)
+    -> tl::expected<void, ErrorCode> {
+    if (!enable_disk_tier_) {
+        return tl::make_unexpected(ErrorCode::UNAVAILABLE_IN_CURRENT_MODE);
+    }
+    MetadataAccessor accessor(this, key);
+    if (!accessor.Exists()) {
+        VLOG(1) << "key=" << key << ", info=object_not_found";
+        return tl::make_unexpected(ErrorCode::OBJECT_NOT_FOUND);
+    }
+
+    auto& metadata = accessor.Get();
+    if (auto status = metadata.HasDiffRepStatus(ReplicaStatus::COMPLETE)) {
+        LOG(WARNING) << "key=" << key << ", status=" << *status
+                     << ", error=replica_not_ready";
+        return tl::make_unexpected(ErrorCode::REPLICA_IS_NOT_READY);
+    }
+    if (disk.file_size != metadata.size) {
+        LOG(ERROR) << "key=" << key << ", file_size=" << disk.file_size
+                   << ", object_size=" << metadata.size
+                   << ", error=invalid_disk_replica";
+        return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+    }
+
+    // The latest copy wins, older files may have been removed since
+    if (auto* replica = metadata.GetDiskReplica()) {
+        *replica = Replica(disk, ReplicaStatus::COMPLETE);
+    } else {
+        metadata.replicas.emplace_back(disk, ReplicaStatus::COMPLETE);
+    }
+    VLOG(1) << "key=" << key << ", file_path=" << disk.file_path
+            << ", action=disk_replica_added";
+    return {};
+}
+
+auto MasterService::BatchPutDiskReplica(
+    const std::vector<std::string>& keys,
+    const std::vector<DiskDescriptor>& disks)
+    -> std::vector<tl::expected<void, ErrorCode>> {
+    if (!enable_disk_tier_) {
+        return std::vector<tl::expected<void, ErrorCode>>(
+            keys.size(),
+            tl::make_unexpected(ErrorCode::UNAVAILABLE_IN_CURRENT_MODE));
+    }
+    if (disks.size() != keys.size()) {
+        LOG(ERROR) << "keys=" << keys.size() << ", disks=" << disks.size()
+                   << ", error=invalid_params";
+        return std::vector<tl::expected<void, ErrorCode>>(
+            keys.size(), tl::make_unexpected(ErrorCode::INVALID_PARAMS));
+    }
+
+    std::vector<tl::expected<void, ErrorCode>> results;
+    results.reserve(keys.size());
+    size_t created = 0;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        const auto& key = keys[i];
+        const auto& disk = disks[i];
+        auto result = PutDiskReplica(key, disk);
+        if (result || result.error() != ErrorCode::OBJECT_NOT_FOUND) {
+            results.push_back(std::move(result));
+            continue;
+        }
+        if (disk.file_size == 0) {
+            results.push_back(tl::make_unexpected(ErrorCode::INVALID_PARAMS));
+            continue;
+        }
+
+        // The file is all that is left of the object
+        auto& shard = metadata_shards_[getShardIndex(key)];
+        SharedMutexLocker lock(&shard.mutex);
+        if (FindAndCleanup(shard, key) != shard.metadata.end() ||
+            shard.aliases.contains(key)) {
+            results.push_back(
+                tl::make_unexpected(ErrorCode::OBJECT_ALREADY_EXISTS));
+            continue;
+        }
+        std::vector<Replica> replicas;
+        replicas.emplace_back(disk, ReplicaStatus::COMPLETE);
+        auto it = EmplaceObject(shard, key, disk.file_size,
+                                std::move(replicas), false,
+                                &shard.disk_only_objects,
+                                namespaces_.Find(key))
+                      .first;
+        it->second.UpdateResidency();
+        change_log_.Record(key);
+        ++created;
+        results.emplace_back();
+    }
+    if (created > 0) {
+        LOG(INFO) << "action=disk_objects_registered, created=" << created
+                  << ", keys=" << keys.size();
+    }
+    return results;
+}
+
+auto MasterService::PromoteStart(const std::string& key,
+                                 const std::vector<uint64_t>& slice_lengths,
+                                 const ReplicateConfig& config)
+    -> tl::expected<std::vector<Replica::Descriptor>, ErrorCode> {
+    if (!enable_disk_tier_) {
+        return tl::make_unexpected(ErrorCode::UNAVAILABLE_IN_CURRENT_MODE);
+    }
+    auto total_length = ValidatePutParams(key, slice_lengths, config);
+    if (!total_length) {
+        return tl::make_unexpected(total_length.error());
+    }
+
+    MetadataAccessor accessor(this, key);
+    if (!accessor.Exists()) {
+        VLOG(1) << "key=" << key << ", info=object_not_found";
+        return tl::make_unexpected(ErrorCode::OBJECT_NOT_FOUND);
+    }
+    auto& metadata = accessor.Get();
+    if (metadata.HasMemoryReplica()) {
+        VLOG(1) << "key=" << key << ", info=object_in_memory";
+        return tl::make_unexpected(ErrorCode::OBJECT_ALREADY_EXISTS);
+    }
+    if (*total_length != metadata.size) {
+        LOG(ERROR) << "key=" << key << ", value_length=" << *total_length
+                   << ", object_size=" << metadata.size
+                   << ", error=invalid_params";
+        return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+    }
+
+    tl::expected<std::vector<Replica>, ErrorCode> replicas;
+    {
+        ScopedAllocatorAccess allocator_access =
+            segment_manager_.getAllocatorAccess();
+        replicas =
+            AllocateReplicas(allocator_access, key, slice_lengths, config);
+    }
+    if (!replicas) {
+        return tl::make_unexpected(replicas.error());
+    }
+
+    std::vector<Replica::Descriptor> replica_list;
+    replica_list.reserve(replicas->size());
+    for (auto& replica : *replicas) {
+        replica_list.emplace_back(replica.get_descriptor());
+        metadata.replicas.emplace_back(std::move(replica));
+    }
+    metadata.UpdateResidency();
+    VLOG(1) << "key=" << key << ", action=promote_start";
+    return replica_list;
+}
+
+auto MasterService::CompactionStart(const std::string& segment_name)
+    -> tl::expected<CompactionTask, ErrorCode> {
+    if (auto task = TakeQueuedCopy(segment_name)) {
+        return std::move(*task);
+    }
+    if (compaction_fragmentation_ratio_ <= 0.0 && hot_replica_read_rate_ == 0) {
+        return tl::make_unexpected(ErrorCode::UNAVAILABLE_IN_CURRENT_MODE);
+    }
+    if (hot_replica_read_rate_ > 0) {
+        if (auto task = HotReplicaStart(segment_name)) {
+            return std::move(*task);
+        }
+    }
+    if (compaction_fragmentation_ratio_ <= 0.0) {
+        return tl::make_unexpected(ErrorCode::OBJECT_NOT_FOUND);
+    }
+    std::unordered_set<std::string> fragmented;
+    for (const auto& [segment, fragmentation] : GetSegmentFragmentation()) {
+        if (fragmentation >= compaction_fragmentation_ratio_) {
+            fragmented.insert(segment);
+        }
+    }
+    if (fragmented.empty()) {
+        return tl::make_unexpected(ErrorCode::OBJECT_NOT_FOUND);
+    }
+    auto in_fragmented_segment = [&fragmented](const Replica& replica) {
+        if (!replica.is_memory_replica() || replica.is_erasure_coded()) {
+            return false;
+        }
+        const auto descriptor = replica.get_descriptor();
+        for (const auto& buffer :
+             descriptor.get_memory_descriptor().buffer_descriptors) {
+            if (fragmented.count(buffer.segment_name_)) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // Resume where the previous call stopped, so that every object gets its
+    // turn
+    const size_t first_shard = compaction_shard_.load();
+    size_t visits = 0;
+    for (size_t i = 0; i < kNumShards && visits < kMaxCompactionVisits; ++i) {
+        const size_t shard_idx = (first_shard + i) % kNumShards;
+        compaction_shard_.store(shard_idx);
+        auto& shard = metadata_shards_[shard_idx];
+        SharedMutexLocker lock(&shard.mutex);
+        for (auto it = shard.metadata.begin();
+             it != shard.metadata.end() && visits < kMaxCompactionVisits;
+             ++it, ++visits) {
+            auto& metadata = it->second;
+            // Objects being written, promoted or relocated are skipped
+            if (metadata.HasDiffRepStatus(ReplicaStatus::COMPLETE) ||
+                metadata.HasStaleHandles()) {
+                continue;
+            }
+            auto source =
+                std::find_if(metadata.replicas.begin(), metadata.replicas.end(),
+                             in_fragmented_segment);
+            if (source == metadata.replicas.end()) {
+                continue;
+            }
+
+            const std::string key(it->first);
+            auto source_descriptor = source->get_descriptor();
+            std::vector<uint64_t> slice_lengths;
+            for (const auto& buffer :
+                 source_descriptor.get_memory_descriptor().buffer_descriptors) {
+                slice_lengths.push_back(buffer.size_);
+            }
+            ReplicateConfig config;
+            config.replica_num = 1;
+            tl::expected<std::vector<Replica>, ErrorCode> replicas;
+            {
+                ScopedAllocatorAccess allocator_access =
+                    segment_manager_.getAllocatorAccess();
+                replicas = AllocateReplicas(allocator_access, key,
+                                            slice_lengths, config);
+            }
+            if (!replicas) {
+                return tl::make_unexpected(replicas.error());
+            }
+
+            auto& target = replicas->front();
+            CompactionTask task{key, std::move(source_descriptor),
+                                target.get_descriptor()};
+            Relocation relocation{
+                source->address(), target.address(),
+                std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(kCompactionTimeoutMs)};
+            metadata.replicas.emplace_back(std::move(target));
+            {
+                MutexLocker compaction_lock(&compaction_mutex_);
+                relocations_.emplace(key, relocation);
+            }
+            VLOG(1) << "key=" << key << ", action=compaction_start";
+            return task;
+        }
+    }
+    return tl::make_unexpected(ErrorCode::OBJECT_NOT_FOUND);
+}
+
+auto MasterService::CompactionEnd(const std::string& key, uint64_t target)
+    -> tl::expected<void, ErrorCode> {
+    MetadataAccessor accessor(this, key);
+    auto relocation = TakeRelocation(key, target);
+    if (!accessor.Exists()) {
+        LOG(ERROR) << "key=" << key << ", error=object_not_found";
+        return tl::make_unexpected(ErrorCode::OBJECT_NOT_FOUND);
+    }
+
+    auto& metadata = accessor.Get();
+    auto& replicas = metadata.replicas;
+    auto find_replica = [&replicas](uintptr_t address, ReplicaStatus status) {
+        return std::find_if(replicas.begin(), replicas.end(),
+                            [&](const Replica& replica) {
+                                return replica.is_memory_replica() &&
+                                       replica.address() == address &&
+                                       replica.status() == status;
+                            });
+    };
+    auto copy =
+        relocation
+            ? find_replica(relocation->target, ReplicaStatus::PROCESSING)
+            : replicas.end();
+    if (copy == replicas.end()) {
+        LOG(ERROR) << "key=" << key << ", error=object_not_relocating";
+        return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    copy->mark_complete();
+    if (relocation->kind == RelocationKind::COPY ||
+        relocation->kind == RelocationKind::PREFETCH) {
+        VLOG(1) << "key=" << key << ", action=copy_end";
+        return {};
+    }
+    if (relocation->kind == RelocationKind::CHAIN) {
+        VLOG(1) << "key=" << key << ", chain_copies=" << metadata.chain_copies
+                << ", action=chain_copy_end";
+        if (metadata.chain_copies > 0) {
+            ForwardChain(key, metadata, *copy);
+        }
+        return {};
+    }
+    if (relocation->kind == RelocationKind::BROADCAST) {
+        VLOG(1) << "key=" << key << ", segments_left="
+                << metadata.broadcast_segments.size()
+                << ", action=broadcast_copy_end";
+        // Both ends copy on
+        std::vector<std::string> sources = {SegmentOf(*copy)};
+        auto source = find_replica(relocation->source, ReplicaStatus::COMPLETE);
+        if (source != replicas.end()) {
+            sources.push_back(SegmentOf(*source));
+        }
+        for (const auto& segment : sources) {
+            ForwardBroadcast(key, metadata, segment);
+        }
+        return {};
+    }
+    if (relocation->kind == RelocationKind::HOT_REPLICA) {
+        MutexLocker compaction_lock(&compaction_mutex_);
+        hot_replicas_[key].push_back(relocation->target);
+        MasterMetricManager::instance().inc_hot_replicas_created();
+        VLOG(1) << "key=" << key << ", action=hot_replica_end";
+        return {};
+    }
+
+    // Readers granted a lease before now may still be reading the source
+    auto source = find_replica(relocation->source, ReplicaStatus::COMPLETE);
+    if (source != replicas.end()) {
+        RetiredReplica retired{std::move(*source), metadata.GetLeaseTimeout()};
+        replicas.erase(source);
+        MutexLocker compaction_lock(&compaction_mutex_);
+        if (!metadata.IsLeaseExpired()) {
+            retired_replicas_.push_back(std::move(retired));
+        }
+        // An extra replica moved along
+        if (auto hot = hot_replicas_.find(key); hot != hot_replicas_.end()) {
+            std::replace(hot->second.begin(), hot->second.end(),
+                         relocation->source, relocation->target);
+        }
+    }
+    if (relocation->kind == RelocationKind::DRAIN) {
+        MasterMetricManager::instance().inc_drain_moved_bytes(metadata.size);
+    } else {
+        MasterMetricManager::instance().inc_compaction_success(metadata.size);
+    }
+    VLOG(1) << "key=" << key << ", action=compaction_end";
+    return {};
+}
+
+auto MasterService::CompactionRevoke(const std::string& key, uint64_t target)
+    -> tl::expected<void, ErrorCode> {
+    MetadataAccessor accessor(this, key);
+    auto relocation = TakeRelocation(key, target);
+    if (!accessor.Exists()) {
+        LOG(INFO) << "key=" << key << ", info=object_not_found";
+        return tl::make_unexpected(ErrorCode::OBJECT_NOT_FOUND);
+    }
+
+    auto& metadata = accessor.Get();
+    const size_t dropped =
+        relocation ? std::erase_if(metadata.replicas,
+                                   [&](const Replica& replica) {
+                                       return replica.is_memory_replica() &&
+                                              replica.address() ==
+                                                  relocation->target &&
+                                              replica.status() ==
+                                                  ReplicaStatus::PROCESSING;
+                                   })
+                   : 0;
+    if (dropped == 0) {
+        LOG(ERROR) << "key=" << key << ", error=object_not_relocating";
+        return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    MasterMetricManager::instance().inc_compaction_fail();
+    // The source may have been on an unmounted segment meanwhile
+    if (metadata.replicas.empty()) {
+        accessor.Erase();
+    } else if (relocation->kind == RelocationKind::BROADCAST) {
+        // The source copies to the next segment instead
+        auto source = std::find_if(
+            metadata.replicas.begin(), metadata.replicas.end(),
+            [&](const Replica& replica) {
+                return replica.is_memory_replica() &&
+                       replica.address() == relocation->source &&
+                       replica.status() == ReplicaStatus::COMPLETE;
+            });
+        if (source != metadata.replicas.end()) {
+            ForwardBroadcast(key, metadata, SegmentOf(*source));
+        }
+    }
+    VLOG(1) << "key=" << key << ", action=compaction_revoke";
+    return {};
+}
+
+auto MasterService::TakeRelocation(const std::string& key, uint64_t target)
+    -> std::optional<Relocation> {
+    MutexLocker compaction_lock(&compaction_mutex_);
+    auto [begin, end] = relocations_.equal_range(key);
+    auto it = std::find_if(begin, end, [target](const auto& entry) {
+        return target == 0 || entry.second.target == target;
+    });
+    if (it == end) {
+        return std::nullopt;
+    }
+    Relocation relocation = it->second;
+    relocations_.erase(it);
+    if (relocation.kind == RelocationKind::PREFETCH) {
+        prefetch_copies_--;
+    }
+    return relocation;
+}
+
+void MasterService::CompactionGC() {
+    const auto now = std::chrono::steady_clock::now();
+    // Freed after the mutex is released
+    std::vector<RetiredReplica> expired;
+    std::vector<std::pair<std::string, uintptr_t>> overdue;
+    {
+        MutexLocker compaction_lock(&compaction_mutex_);
+        auto it = std::partition(retired_replicas_.begin(),
+                                 retired_replicas_.end(),
+                                 [&now](const RetiredReplica& retired) {
+                                     return now < retired.lease_timeout;
+                                 });
+        std::move(it, retired_replicas_.end(), std::back_inserter(expired));
+        retired_replicas_.erase(it, retired_replicas_.end());
+        for (const auto& [key, relocation] : relocations_) {
+            if (relocation.deadline <= now) {
+                overdue.emplace_back(key, relocation.target);
+            }
+        }
+    }
+    for (const auto& [key, target] : overdue) {
+        LOG(WARNING) << "key=" << key << ", error=compaction_timeout";
+        auto result = CompactionRevoke(key, target);
+        if (!result && result.error() != ErrorCode::OBJECT_NOT_FOUND) {
+            LOG(WARNING) << "key=" << key
+                         << ", error=compaction_revoke_failed, error_code="
+                         << result.error();
+        }
+    }
+}
+
+void MasterService::SampleRead(std::string_view key) {
+    const std::string key_str(key);
+    auto& shard = metadata_shards_[getShardIndex(key_str)];
+    MutexLocker lock(&shard.hot_mutex);
+    shard.sampled_reads[key_str]++;
+}
+
+std::optional<CompactionTask> MasterService::HotReplicaStart(
+    const std::string& segment_name) {
+    while (true) {
+        std::string key;
+        {
+            MutexLocker compaction_lock(&compaction_mutex_);
+            if (hot_objects_.empty()) {
+                return std::nullopt;
+            }
+            // One extra replica per object and window
+            auto it = hot_objects_.begin();
+            key = it->first;
+            const size_t wanted = it->second;
+            hot_objects_.erase(it);
+            auto hot = hot_replicas_.find(key);
+            if (relocations_.count(key) ||
+                (hot != hot_replicas_.end() && hot->second.size() >= wanted)) {
+                continue;
+            }
+        }
+
+        MetadataAccessor accessor(this, key);
+        if (!accessor.Exists()) {
+            continue;
+        }
+        auto& metadata = accessor.Get();
+        if (metadata.HasDiffRepStatus(ReplicaStatus::COMPLETE) ||
+            metadata.HasStaleHandles()) {
+            continue;
+        }
+        auto source = FindMemoryReplica(metadata, segment_name);
+        if (source == metadata.replicas.end()) {
+            source = FindMemoryReplica(metadata, "");
+        }
+        if (source == metadata.replicas.end()) {
+            continue;
+        }
+        // Hot replicas are not worth an eviction
+        auto buffers = AllocateCopy(metadata, *source, "", true);
+        if (!buffers) {
+            VLOG(1) << "key=" << key << ", info=no_segment_for_hot_replica";
+            continue;
+        }
+
+        Replica target(std::move(*buffers), ReplicaStatus::PROCESSING);
+        CompactionTask task{key, source->get_descriptor(),
+                            target.get_descriptor()};
+        Relocation relocation{
+            source->address(), target.address(),
+            std::chrono::steady_clock::now() +
+                std::chrono::milliseconds(kCompactionTimeoutMs),
+            RelocationKind::HOT_REPLICA};
+        metadata.replicas.emplace_back(std::move(target));
+        {
+            MutexLocker compaction_lock(&compaction_mutex_);
+            relocations_.emplace(key, relocation);
+        }
+        VLOG(1) << "key=" << key << ", action=hot_replica_start";
+        return task;
+    }
+}
+
+auto MasterService::FindMemoryReplica(ObjectMetadata& metadata,
+                                      const std::string& segment_name)
+    -> std::vector<Replica>::iterator {
+    return std::find_if(
+        metadata.replicas.begin(), metadata.replicas.end(),
+        [&segment_name](const Replica& replica) {
+            // An inline replica has no buffer to copy from, the fragments
+            // of an erasure-coded one are no copy of the value
+            if (!replica.is_memory_replica() || replica.is_inline() ||
+                replica.is_erasure_coded()) {
+                return false;
+            }
+            if (segment_name.empty()) {
+                return true;
+            }
+            const auto descriptor = replica.get_descriptor();
+            const auto& buffers =
+                descriptor.get_memory_descriptor().buffer_descriptors;
+            return std::any_of(buffers.begin(), buffers.end(),
+                               [&segment_name](const auto& buffer) {
+                                   return buffer.segment_name_ == segment_name;
+                               });
+        });
+}
+
+auto MasterService::FindReplicaIn(ObjectMetadata& metadata,
+                                  const Segment& segment)
+    -> std::vector<Replica>::iterator {
+    return std::find_if(metadata.replicas.begin(), metadata.replicas.end(),
+                        [&segment](const Replica& replica) {
+                            return IsReplicaIn(replica, segment);
+                        });
+}
+
+bool MasterService::IsReplicaIn(const Replica& replica,
+                                const Segment& segment) {
+    // A drain leaves the fragment of an erasure-coded replica behind, its
+    // parity covers for it
+    if (!replica.is_memory_replica() || replica.is_erasure_coded() ||
+        replica.status() != ReplicaStatus::COMPLETE) {
+        return false;
+    }
+    const auto descriptor = replica.get_descriptor();
+    const auto& buffers = descriptor.get_memory_descriptor().buffer_descriptors;
+    return std::any_of(
+        buffers.begin(), buffers.end(), [&segment](const auto& buffer) {
+            return buffer.segment_name_ == segment.name &&
+                   buffer.buffer_address_ >= segment.base &&
+                   buffer.buffer_address_ < segment.base + segment.size;
+        });
+}
+
+auto MasterService::AllocateCopy(const ObjectMetadata& metadata,
+                                 const Replica& source,
+                                 const std::string& target_segment, bool hot)
+    -> tl::expected<std::vector<std::unique_ptr<AllocatedBuffer>>,
+                    ErrorCode> {
+    // A copy next to another replica would share its NIC
+    std::unordered_set<std::string> placed;
+    for (const auto& replica : metadata.replicas) {
+        if (!replica.is_memory_replica()) {
+            continue;
+        }
+        const auto descriptor = replica.get_descriptor();
+        for (const auto& buffer :
+             descriptor.get_memory_descriptor().buffer_descriptors) {
+            placed.insert(buffer.segment_name_);
+        }
+    }
+    if (!target_segment.empty() && placed.count(target_segment)) {
+        return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+    }
+
+    ScopedAllocatorAccess allocator_access =
+        segment_manager_.getAllocatorAccess();
+    std::vector<std::shared_ptr<BufferAllocator>> allocators;
+    std::unordered_map<std::string,
+                       std::vector<std::shared_ptr<BufferAllocator>>>
+        allocators_by_name;
+    for (const auto& allocator : allocator_access.getAllocators()) {
+        const auto& name = allocator->getSegmentName();
+        if (target_segment.empty() ? !placed.count(name)
+                                   : name == target_segment) {
+            allocators.push_back(allocator);
+            allocators_by_name[name].push_back(allocator);
+        }
+    }
+    if (allocators.empty()) {
+        return tl::make_unexpected(target_segment.empty()
+                                       ? ErrorCode::NO_AVAILABLE_HANDLE
+                                       : ErrorCode::SEGMENT_NOT_FOUND);
+    }
+    ReplicateConfig config;
+    config.prefer_device_memory = hot;
+    std::vector<std::unique_ptr<AllocatedBuffer>> buffers;
+    const auto descriptor = source.get_descriptor();
+    for (const auto& buffer :
+         descriptor.get_memory_descriptor().buffer_descriptors) {
+        auto handle = AllocateInTier(allocators, allocators_by_name,
+                                     buffer.size_, config, {});
+        if (!handle) {
+            return tl::make_unexpected(ErrorCode::NO_AVAILABLE_HANDLE);
+        }
+        buffers.push_back(std::move(handle));
+    }
+    return buffers;
+}
+
+auto MasterService::CopyReplica(const std::string& key,
+                                const std::string& target_segment)
+    -> tl::expected<void, ErrorCode> {
+    auto queued = QueueCopy(key, "", target_segment, RelocationKind::COPY);
+    if (!queued) {
+        return tl::make_unexpected(queued.error());
+    }
+    return {};
+}
+
+auto MasterService::MigrateReplica(const std::string& key,
+                                   const std::string& source_segment,
+                                   const std::string& target_segment)
+    -> tl::expected<void, ErrorCode> {
+    if (source_segment.empty()) {
+        LOG(ERROR) << "key=" << key << ", error=empty_source_segment";
+        return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    auto queued = QueueCopy(key, source_segment, target_segment,
+                            RelocationKind::MOVE);
+    if (!queued) {
+        return tl::make_unexpected(queued.error());
+    }
+    return {};
+}
+
+auto MasterService::Broadcast(const std::string& key,
+                              const std::vector<std::string>& target_segments)
+    -> tl::expected<uint64_t, ErrorCode> {
+    const std::string object_key = ObjectKeyOf(key);
+    MetadataAccessor accessor(this, object_key);
+    if (!accessor.Exists()) {
+        VLOG(1) << "key=" << key << ", error=object_not_found";
+        return tl::make_unexpected(ErrorCode::OBJECT_NOT_FOUND);
+    }
+    auto& metadata = accessor.Get();
+    if (auto status = metadata.HasDiffRepStatus(ReplicaStatus::COMPLETE)) {
+        LOG(ERROR) << "key=" << key << ", status=" << *status
+                   << ", error=invalid_replica_status";
+        return tl::make_unexpected(ErrorCode::REPLICA_IS_NOT_READY);
+    }
+
+    // Every replica that can be copied starts a tree
+    std::vector<std::string> sources;
+    std::unordered_set<std::string> placed;
+    for (const auto& replica : metadata.replicas) {
+        if (!replica.is_memory_replica()) {
+            continue;
+        }
+        const auto descriptor = replica.get_descriptor();
+        for (const auto& buffer :
+             descriptor.get_memory_descriptor().buffer_descriptors) {
+            placed.insert(buffer.segment_name_);
+        }
+        if (!replica.is_inline() && !replica.is_erasure_coded()) {
+            sources.push_back(SegmentOf(replica));
+        }
+    }
+    if (sources.empty()) {
+        LOG(ERROR) << "key=" << key << ", error=no_memory_replica";
+        return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+    }
+
+    std::vector<std::string> targets;
+    {
+        ScopedSegmentAccess segment_access =
+            segment_manager_.getSegmentAccess();
+        std::vector<std::string> mounted;
+        segment_access.GetAllSegments(mounted);
+        std::unordered_set<std::string> mounted_set(mounted.begin(),
+                                                    mounted.end());
+        for (const auto& segment :
+             target_segments.empty() ? mounted : target_segments) {
+            if (!mounted_set.count(segment)) {
+                LOG(ERROR) << "key=" << key << ", target_segment=" << segment
+                           << ", error=segment_not_found";
+                return tl::make_unexpected(ErrorCode::SEGMENT_NOT_FOUND);
+            }
+            if (placed.insert(segment).second) {
+                targets.push_back(segment);
+            }
+        }
+    }
+    const uint64_t count = targets.size();
+    metadata.broadcast_segments = std::move(targets);
+    for (const auto& source : sources) {
+        ForwardBroadcast(object_key, metadata, source);
+    }
+    VLOG(1) << "key=" << key << ", sources=" << sources.size()
+            << ", targets=" << count << ", action=broadcast_start";
+    return count;
+}
+
+std::vector<tl::expected<void, ErrorCode>> MasterService::Prefetch(
+    const std::vector<std::string>& keys, const std::string& target_segment) {
+    std::vector<tl::expected<void, ErrorCode>> results(keys.size());
+    if (target_segment.empty()) {
+        LOG(ERROR) << "error=empty_target_segment";
+        std::fill(results.begin(), results.end(),
+                  tl::make_unexpected(ErrorCode::INVALID_PARAMS));
+        return results;
+    }
+    size_t queued = 0;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        const std::string object_key = ObjectKeyOf(keys[i]);
+        MetadataAccessor accessor(this, object_key);
+        if (!accessor.Exists()) {
+            VLOG(1) << "key=" << keys[i] << ", error=object_not_found";
+            results[i] = tl::make_unexpected(ErrorCode::OBJECT_NOT_FOUND);
+            continue;
+        }
+        auto& metadata = accessor.Get();
+        if (FindMemoryReplica(metadata, target_segment) !=
+            metadata.replicas.end()) {
+            continue;
+        }
+        {
+            MutexLocker compaction_lock(&compaction_mutex_);
+            if (prefetch_copies_ >= kMaxPrefetchCopies) {
+                results[i] = tl::make_unexpected(ErrorCode::MASTER_BUSY);
+                continue;
+            }
+        }
+        auto copied = QueueCopy(object_key, metadata, "", target_segment,
+                                RelocationKind::PREFETCH);
+        if (!copied) {
+            results[i] = tl::make_unexpected(copied.error());
+            continue;
+        }
+        queued++;
+    }
+    VLOG(1) << "keys=" << keys.size() << ", queued=" << queued
+            << ", target_segment=" << target_segment
+            << ", action=prefetch_start";
+    return results;
+}
+
+std::vector<tl::expected<bool, ErrorCode>> MasterService::CancelPrefetch(
+    const std::vector<std::string>& keys, const std::string& target_segment) {
+    std::vector<tl::expected<bool, ErrorCode>> results(keys.size(), false);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        const std::string object_key = ObjectKeyOf(keys[i]);
+        MetadataAccessor accessor(this, object_key);
+        if (!accessor.Exists()) {
+            continue;
+        }
+        // Copies handed out already are being written, so only the queued
+        // ones are dropped
+        std::unordered_set<uintptr_t> dropped;
+        {
+            MutexLocker compaction_lock(&compaction_mutex_);
+            std::erase_if(queued_copies_, [&](const QueuedCopy& copy) {
+                if (copy.task.key != object_key ||
+                    (!target_segment.empty() &&
+                     copy.task.target.get_memory_descriptor()
+                             .buffer_descriptors.front()
+                             .segment_name_ != target_segment)) {
+                    return false;
+                }
+                auto [begin, end] = relocations_.equal_range(object_key);
+                auto it = std::find_if(begin, end, [&copy](const auto& entry) {
+                    return entry.second.target == copy.target &&
+                           entry.second.kind == RelocationKind::PREFETCH;
+                });
+                if (it == end) {
+                    return false;
+                }
+                relocations_.erase(it);
+                prefetch_copies_--;
+                dropped.insert(copy.target);
+                return true;
+            });
+        }
+        std::erase_if(accessor.Get().replicas, [&](const Replica& replica) {
+            return replica.is_memory_replica() &&
+                   replica.status() == ReplicaStatus::PROCESSING &&
+                   dropped.count(replica.address());
+        });
+        results[i] = !dropped.empty();
+    }
+    return results;
+}
+
+void MasterService::ForwardBroadcast(const std::string& key,
+                                     ObjectMetadata& metadata,
+                                     const std::string& source_segment) {
+    // Segments that cannot take the copy are skipped
+    while (!metadata.broadcast_segments.empty()) {
+        std::string target = std::move(metadata.broadcast_segments.front());
+        metadata.broadcast_segments.erase(
+            metadata.broadcast_segments.begin());
+        auto queued = QueueCopy(key, metadata, source_segment, target,
+                                RelocationKind::BROADCAST);
+        if (queued) {
+            return;
+        }
+        LOG(WARNING) << "key=" << key << ", target_segment=" << target
+                     << ", error=broadcast_copy_failed, error_code="
+                     << queued.error();
+    }
+}
+
+std::string MasterService::ObjectKeyOf(const std::string& key) {
+    // Aliases of deduplicated puts share the replicas of their content
+    MetadataReadAccessor accessor(this, key);
+    if (!accessor.Exists()) {
+        if (auto content_key = accessor.ContentKey()) {
+            return std::move(*content_key);
+        }
+    }
+    return key;
+}
+
+std::string MasterService::SegmentOf(const Replica& replica) {
+    return replica.get_descriptor()
+        .get_memory_descriptor()
+        .buffer_descriptors.front()
+        .segment_name_;
+}
+
+auto MasterService::QueueCopy(const std::string& key,
+                              const std::string& source_segment,
+                              const std::string& target_segment,
+                              RelocationKind kind, const Segment* source_range)
+    -> tl::expected<uint64_t, ErrorCode> {
+    const std::string object_key = ObjectKeyOf(key);
+    MetadataAccessor accessor(this, object_key);
+    if (!accessor.Exists()) {
+        VLOG(1) << "key=" << key << ", error=object_not_found";
+        return tl::make_unexpected(ErrorCode::OBJECT_NOT_FOUND);
+    }
+    return QueueCopy(object_key, accessor.Get(), source_segment,
+                     target_segment, kind, source_range);
+}
+
+auto MasterService::QueueCopy(const std::string& key, ObjectMetadata& metadata,
+                              const std::string& source_segment,
+                              const std::string& target_segment,
+                              RelocationKind kind, const Segment* source_range)
+    -> tl::expected<uint64_t, ErrorCode> {
+    // Drains retry the objects they could not move, quietly
+    const bool quiet = source_range != nullptr;
+    // Also refuses objects being copied or relocated already, but for the
+    // other copies of a broadcast
+    auto status = metadata.HasDiffRepStatus(ReplicaStatus::COMPLETE);
+    if (status && kind != RelocationKind::BROADCAST) {
+        if (!quiet) {
+            LOG(ERROR) << "key=" << key << ", status=" << *status
+                       << ", error=invalid_replica_status";
+        }
+        return tl::make_unexpected(ErrorCode::REPLICA_IS_NOT_READY);
+    }
+    auto source = source_range ? FindReplicaIn(metadata, *source_range)
+                               : FindMemoryReplica(metadata, source_segment);
+    if (source == metadata.replicas.end()) {
+        if (!quiet) {
+            LOG(ERROR) << "key=" << key << ", source_segment="
+                       << source_segment << ", error=no_memory_replica";
+        }
+        return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    auto buffers = AllocateCopy(metadata, *source, target_segment);
+    if (!buffers) {
+        if (!quiet) {
+            LOG(ERROR) << "key=" << key << ", target_segment="
+                       << target_segment
+                       << ", error=copy_allocation_failed, error_code="
+                       << buffers.error();
+        }
+        return tl::make_unexpected(buffers.error());
+    }
+
+    // The client of the segment of the first slice writes from its memory
+    auto source_descriptor = source->get_descriptor();
+    std::string owner = source_range ? source_range->name : source_segment;
+    if (owner.empty()) {
+        owner = source_descriptor.get_memory_descriptor()
+                    .buffer_descriptors.front()
+                    .segment_name_;
+    }
+    Replica target(std::move(*buffers), ReplicaStatus::PROCESSING);
+    const auto now = std::chrono::steady_clock::now();
+    Relocation relocation{source->address(), target.address(),
+                          now + std::chrono::milliseconds(kCompactionTimeoutMs),
+                          kind};
+    CompactionTask task{key, std::move(source_descriptor),
+                        target.get_descriptor()};
+    metadata.replicas.emplace_back(std::move(target));
+    {
+        MutexLocker compaction_lock(&compaction_mutex_);
+        relocations_.emplace(key, relocation);
+        queued_copies_.push_back(
+            {std::move(owner), std::move(task), relocation.target, now});
+        if (kind == RelocationKind::PREFETCH) {
+            prefetch_copies_++;
+        }
+    }
+    VLOG(1) << "key=" << key << ", source_segment=" << source_segment
+            << ", target_segment=" << target_segment
+            << ", action=copy_queued";
+    return metadata.size;
+}
+
+std::optional<CompactionTask> MasterService::TakeQueuedCopy(
+    const std::string& segment_name) {
+    MutexLocker compaction_lock(&compaction_mutex_);
+    // Revoked while queued
+    std::erase_if(queued_copies_, [this](const QueuedCopy& copy) {
+        auto [begin, end] = relocations_.equal_range(copy.task.key);
+        return std::none_of(begin, end, [&copy](const auto& entry) {
+            return entry.second.target == copy.target;
+        });
+    });
+    if (queued_copies_.empty()) {
+        return std::nullopt;
+    }
+    auto copy = queued_copies_.end();
+    if (!segment_name.empty()) {
+        copy = std::find_if(queued_copies_.begin(), queued_copies_.end(),
+                            [&segment_name](const QueuedCopy& copy) {
+                                return copy.source_segment == segment_name;
+                            });
+    }
+    // Left by the client of its source for too long
+    if (copy == queued_copies_.end() &&
+        std::chrono::steady_clock::now() - queued_copies_.front().queued >=
+            std::chrono::milliseconds(kCopyHandoverMs)) {
+        copy = queued_copies_.begin();
+    }
+    if (copy == queued_copies_.end()) {
+        return std::nullopt;
+    }
+    CompactionTask task = std::move(copy->task);
+    queued_copies_.erase(copy);
+    return task;
+}
+
+void MasterService::HotReplicaGC() {
+    const auto now = std::chrono::steady_clock::now();
+    if (now - hot_window_start_ < std::chrono::milliseconds(kHotWindowMs)) {
+        return;
+    }
+    const double seconds =
+        std::chrono::duration<double>(now - hot_window_start_).count();
+    hot_window_start_ = now;
+
+    // Read rate of every object read in the window, in units of
+    // hot_replica_read_rate
+    std::unordered_map<std::string, double> heat;
+    for (auto& shard : metadata_shards_) {
+        std::unordered_map<std::string, uint64_t> sampled_reads;
+        {
+            MutexLocker lock(&shard.hot_mutex);
+            sampled_reads.swap(shard.sampled_reads);
+        }
+        for (const auto& [key, reads] : sampled_reads) {
+            heat[key] = reads * kHotReadSampleInterval / seconds /
+                        hot_replica_read_rate_;
+        }
+    }
+
+    std::vector<std::pair<std::string, uintptr_t>> cooled;
+    {
+        MutexLocker compaction_lock(&compaction_mutex_);
+        hot_objects_.clear();
+        for (const auto& [key, level] : heat) {
+            const size_t wanted =
+                std::min(kMaxHotReplicas, static_cast<size_t>(level));
+            if (wanted > 0) {
+                hot_objects_[key] = wanted;
+            }
+        }
+        // Replicas are kept down to half of the rate they were made at, so
+        // that an object near the threshold does not flap
+        for (auto it = hot_replicas_.begin(); it != hot_replicas_.end();) {
+            auto found = heat.find(it->first);
+            const double level = found == heat.end() ? 0.0 : found->second;
+            const size_t kept =
+                std::min(kMaxHotReplicas, static_cast<size_t>(level * 2));
+            if (it->second.size() > kept) {
+                cooled.emplace_back(it->first, it->second.back());
+                it->second.pop_back();
+            }
+            if (it->second.empty()) {
+                it = hot_replicas_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    for (const auto& [key, address] : cooled) {
+        if (RetireReplica(key, address)) {
+            MasterMetricManager::instance().inc_hot_replicas_retired();
+            VLOG(1) << "key=" << key << ", action=hot_replica_retired";
+        }
+    }
+}
+
+bool MasterService::RetireReplica(const std::string& key,
+                                  uintptr_t address) {
+    MetadataAccessor accessor(this, key);
+    if (!accessor.Exists()) {
+        return false;
+    }
+    auto& metadata = accessor.Get();
+    auto& replicas = metadata.replicas;
+    const auto memory_replicas = std::count_if(
+        replicas.begin(), replicas.end(),
+        [](const Replica& replica) { return replica.is_memory_replica(); });
+    auto replica = std::find_if(
+        replicas.begin(), replicas.end(), [address](const Replica& replica) {
+            return replica.is_memory_replica() &&
+                   replica.address() == address &&
+                   replica.status() == ReplicaStatus::COMPLETE;
+        });
+    // Gone with an unmounted segment, or the last copy left
+    if (replica == replicas.end() || memory_replicas < 2) {
+        return false;
+    }
+    RetiredReplica retired{std::move(*replica), metadata.GetLeaseTimeout()};
+    replicas.erase(replica);
+    if (!metadata.IsLeaseExpired()) {
+        MutexLocker compaction_lock(&compaction_mutex_);
+        retired_replicas_.push_back(std::move(retired));
+    }
+    return true;
+}
+
+void MasterService::DrainGC() {
+    const auto now = std::chrono::steady_clock::now();
+    if (now - last_drain_ < std::chrono::milliseconds(kDrainIntervalMs)) {
+        return;
+    }
+    last_drain_ = now;
+
+    MutexLocker lock(&drain_mutex_);
+    if (drains_.empty()) {
+        return;
+    }
+    uint64_t remaining = 0;
+    for (auto it = drains_.begin(); it != drains_.end();) {
+        size_t used = 0;
+        ErrorCode err;
+        {
+            ScopedSegmentAccess segment_access =
+                segment_manager_.getSegmentAccess();
+            err = segment_access.GetDrainingUsage(it->first, used);
+        }
+        // Unmounted, by its client or on its expiry
+        if (err != ErrorCode::OK) {
+            LOG(INFO) << "segment_name=" << it->second.segment.name
+                      << ", action=drain_end";
+            it = drains_.erase(it);
+            continue;
+        }
+        remaining += used;
+        DrainStep(it->second);
+        ++it;
+    }
+    MasterMetricManager::instance().set_draining_segments(drains_.size());
+    MasterMetricManager::instance().set_drain_remaining_bytes(remaining);
+}
+
+void MasterService::DrainStep(Drain& drain) {
+    {
+        MutexLocker compaction_lock(&compaction_mutex_);
+        std::erase_if(drain.moving, [this](const std::string& key) {
+            return !relocations_.count(key);
+        });
+    }
+    const auto now = std::chrono::steady_clock::now();
+    if (now < drain.next_pass) {
+        return;
+    }
+    const double elapsed =
+        std::chrono::duration<double>(now - drain.start).count();
+    auto full = [&]() {
+        return drain.moving.size() >= kMaxDrainMoves ||
+               (drain_rate_bytes_ > 0 &&
+                drain.queued_bytes >= drain_rate_bytes_ * elapsed);
+    };
+
+    // Hot objects first, their readers would miss the most
+    std::vector<std::string> hot;
+    {
+        MutexLocker compaction_lock(&compaction_mutex_);
+        for (const auto& [key, wanted] : hot_objects_) {
+            hot.push_back(key);
+        }
+        for (const auto& [key, addresses] : hot_replicas_) {
+            hot.push_back(key);
+        }
+    }
+    for (const auto& key : hot) {
+        if (full()) {
+            return;
+        }
+        if (!drain.moving.count(key)) {
+            DrainObject(drain, key);
+        }
+    }
 
-                if (!handle) {
-                    LOG(ERROR)
-                        << "key=" << key << ", replica_id=" << i
-                        << ", slice_index=" << j << ", error=allocation_failed";
-                    // If the allocation failed, we need to evict some objects
-                    // to free up space for future allocations.
-                    need_eviction_ = true;
-                    return tl::make_unexpected(ErrorCode::NO_AVAILABLE_HANDLE);
+    for (size_t i = 0; i < kNumShards; ++i) {
+        const size_t shard_idx = (drain.shard + i) % kNumShards;
+        std::vector<std::string> keys;
+        {
+            auto& shard = metadata_shards_[shard_idx];
+            SharedMutexLocker lock(&shard.mutex, shared_lock);
+            for (const auto& [key, metadata] : shard.metadata) {
+                if (std::any_of(metadata.replicas.begin(),
+                                metadata.replicas.end(),
+                                [&drain](const Replica& replica) {
+                                    return IsReplicaIn(replica, drain.segment);
+                                })) {
+                    keys.emplace_back(key);
                 }
-
-                VLOG(1) << "key=" << key << ", replica_id=" << i
-                        << ", slice_index=" << j << ", handle=" << *handle
-                        << ", action=slice_allocated";
-                handles.emplace_back(std::move(handle));
             }
-
-            replicas.emplace_back(std::move(handles),
-                                  ReplicaStatus::PROCESSING);
+        }
+        for (const auto& key : keys) {
+            // The shard is scanned again by the next step
+            if (full()) {
+                drain.shard = shard_idx;
+                return;
+            }
+            if (!drain.moving.count(key)) {
+                DrainObject(drain, key);
+            }
         }
     }
-
-    std::vector<Replica::Descriptor> replica_list;
-    replica_list.reserve(replicas.size());
-    for (const auto& replica : replicas) {
-        replica_list.emplace_back(replica.get_descriptor());
-    }
-
-    // No need to set lease here. The object will not be evicted until
-    // PutEnd is called.
-    metadata_shards_[shard_idx].metadata.emplace(
-        std::piecewise_construct, std::forward_as_tuple(key),
-        std::forward_as_tuple(total_length, std::move(replicas),
-                              config.with_soft_pin));
-    return replica_list;
+    // What is left cannot move for now
+    drain.next_pass = now + std::chrono::seconds(1);
 }
 
-auto MasterService::PutEnd(const std::string& key)
-    -> tl::expected<void, ErrorCode> {
-    MetadataAccessor accessor(this, key);
-    if (!accessor.Exists()) {
-        LOG(ERROR) << "key=" << key << ", error=object_not_found";
-        return tl::make_unexpected(ErrorCode::OBJECT_NOT_FOUND);
+void MasterService::DrainObject(Drain& drain, const std::string& key) {
+    auto queued = QueueCopy(key, "", "", RelocationKind::DRAIN, &drain.segment);
+    if (queued) {
+        drain.queued_bytes += queued.value();
+        drain.moving.insert(key);
+        return;
     }
-
-    auto& metadata = accessor.Get();
-    for (auto& replica : metadata.replicas) {
-        replica.mark_complete();
+    if (queued.error() != ErrorCode::NO_AVAILABLE_HANDLE) {
+        return;
+    }
+    // No room elsewhere, the other replicas are kept
+    std::optional<uintptr_t> address;
+    {
+        MetadataAccessor accessor(this, key);
+        if (!accessor.Exists()) {
+            return;
+        }
+        auto replica = FindReplicaIn(accessor.Get(), drain.segment);
+        if (replica != accessor.Get().replicas.end()) {
+            address = replica->address();
+        }
+    }
+    if (address && RetireReplica(key, *address)) {
+        VLOG(1) << "key=" << key << ", segment_name=" << drain.segment.name
+                << ", action=drain_dropped_replica";
     }
-    // 1. Set lease timeout to now, indicating that the object has no lease
-    // at beginning. 2. If this object has soft pin enabled, set it to be soft
-    // pinned.
-    metadata.GrantLease(0, default_kv_soft_pin_ttl_);
-    return {};
 }
 
-auto MasterService::PutRevoke(const std::string& key)
-    -> tl::expected<void, ErrorCode> {
-    MetadataAccessor accessor(this, key);
-    if (!accessor.Exists()) {
-        LOG(INFO) << "key=" << key << ", info=object_not_found";
-        return tl::make_unexpected(ErrorCode::OBJECT_NOT_FOUND);
+std::vector<std::pair<std::string, double>>
+MasterService::GetSegmentFragmentation() {
+    ScopedAllocatorAccess allocator_access =
+        segment_manager_.getAllocatorAccess();
+    std::vector<std::pair<std::string, double>> fragmentation;
+    for (const auto& [segment, allocators] :
+         allocator_access.getAllocatorsByName()) {
+        double ratio = 0.0;
+        for (const auto& allocator : allocators) {
+            ratio = std::max(ratio, allocator->fragmentation());
+        }
+        fragmentation.emplace_back(segment, ratio);
     }
+    return fragmentation;
+}
 
-    auto& metadata = accessor.Get();
-    if (auto status = metadata.HasDiffRepStatus(ReplicaStatus::PROCESSING)) {
-        LOG(ERROR) << "key=" << key << ", status=" << *status
-                   << ", error=invalid_replica_status";
-        return tl::make_unexpected(ErrorCode::INVALID_WRITE);
+std::vector<ShardLockStats> MasterService::GetHottestShards(
+    size_t limit) const {
+    std::vector<ShardLockStats> stats(kNumShards);
+    for (size_t i = 0; i < kNumShards; ++i) {
+        const auto& counters = metadata_shards_[i].lock_counters;
+        stats[i].shard = i;
+        stats[i].acquisitions =
+            counters.sampled_acquisitions.load(std::memory_order_relaxed) *
+            kLockSampleInterval;
+        stats[i].contentions =
+            counters.contentions.load(std::memory_order_relaxed);
+        stats[i].wait_us =
+            counters.wait_ns.load(std::memory_order_relaxed) / 1000;
+        stats[i].hold_us =
+            counters.sampled_hold_ns.load(std::memory_order_relaxed) *
+            kLockSampleInterval / 1000;
     }
-
-    accessor.Erase();
-    return {};
+    limit = std::min(limit, stats.size());
+    std::partial_sort(stats.begin(), stats.begin() + limit, stats.end(),
+                      [](const ShardLockStats& a, const ShardLockStats& b) {
+                          return a.wait_us + a.hold_us > b.wait_us + b.hold_us;
+                      });
+    stats.resize(limit);
+    return stats;
 }
 
-std::vector<tl::expected<void, ErrorCode>> MasterService::BatchPutEnd(
-    const std::vector<std::string>& keys) {
-    std::vector<tl::expected<void, ErrorCode>> results;
-    results.reserve(keys.size());
-    for (const auto& key : keys) {
-        results.emplace_back(PutEnd(key));
+MasterService::ShardLockProbe::ShardLockProbe(const MetadataShard& shard,
+                                              bool exclusive, bool contended,
+                                              int64_t wait_ns)
+    : counters_(shard.lock_counters) {
+    // Counted per thread, so that sampling adds no shared write
+    thread_local uint32_t accesses = 0;
+    if (contended) {
+        auto& metrics = MasterMetricManager::instance();
+        if (exclusive) {
+            metrics.inc_shard_write_contentions();
+        } else {
+            metrics.inc_shard_read_contentions();
+        }
+        metrics.observe_shard_lock_wait(wait_ns / 1000);
+        counters_.contentions.fetch_add(1, std::memory_order_relaxed);
+        counters_.wait_ns.fetch_add(wait_ns, std::memory_order_relaxed);
+    }
+    if (++accesses % kLockSampleInterval == 0) {
+        counters_.sampled_acquisitions.fetch_add(1, std::memory_order_relaxed);
+        hold_start_ = std::chrono::steady_clock::now();
     }
-    return results;
 }
 
-std::vector<tl::expected<void, ErrorCode>> MasterService::BatchPutRevoke(
-    const std::vector<std::string>& keys) {
-    std::vector<tl::expected<void, ErrorCode>> results;
-    results.reserve(keys.size());
-    for (const auto& key : keys) {
-        results.emplace_back(PutRevoke(key));
+MasterService::ShardLockProbe::~ShardLockProbe() {
+    if (hold_start_ == std::chrono::steady_clock::time_point()) {
+        return;
     }
-    return results;
+    const auto hold_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now() - hold_start_)
+                             .count();
+    counters_.sampled_hold_ns.fetch_add(hold_ns, std::memory_order_relaxed);
+    MasterMetricManager::instance().observe_shard_lock_hold(hold_ns / 1000);
 }
 
 auto MasterService::Remove(const std::string& key)
     -> tl::expected<void, ErrorCode> {
-    MetadataAccessor accessor(this, key);
-    if (!accessor.Exists()) {
+    std::optional<std::string> content_key;
+    {
+        MetadataAccessor accessor(this, key);
+        if (accessor.Exists()) {
+            auto& metadata = accessor.Get();
+
+            if (!metadata.IsLeaseExpired()) {
+                VLOG(1) << "key=" << key << ", error=object_has_lease";
+                return tl::make_unexpected(ErrorCode::OBJECT_HAS_LEASE);
+            }
+
+            if (auto status =
+                    metadata.HasDiffRepStatus(ReplicaStatus::COMPLETE)) {
+                LOG(ERROR) << "key=" << key << ", status=" << *status
+                           << ", error=invalid_replica_status";
+                return tl::make_unexpected(ErrorCode::REPLICA_IS_NOT_READY);
+            }
+
+            // Remove object metadata
+            accessor.Erase();
+            return {};
+        }
+        content_key = accessor.ContentKey();
+    }
+    if (!content_key) {
         VLOG(1) << "key=" << key << ", error=object_not_found";
         return tl::make_unexpected(ErrorCode::OBJECT_NOT_FOUND);
     }
+    return RemoveAlias(key, *content_key);
+}
 
-    auto& metadata = accessor.Get();
-
-    if (!metadata.IsLeaseExpired()) {
-        VLOG(1) << "key=" << key << ", error=object_has_lease";
-        return tl::make_unexpected(ErrorCode::OBJECT_HAS_LEASE);
+auto MasterService::RemoveAlias(const std::string& key,
+                                const std::string& content_key)
+    -> tl::expected<void, ErrorCode> {
+    // Its buffers are being written, as for a put that is not finished
+    {
+        MetadataReadAccessor accessor(this, content_key);
+        if (accessor.Exists()) {
+            if (auto status =
+                    accessor.Get().HasDiffRepStatus(ReplicaStatus::COMPLETE)) {
+                LOG(ERROR) << "key=" << key << ", content_key=" << content_key
+                           << ", status=" << *status
+                           << ", error=invalid_replica_status";
+                return tl::make_unexpected(ErrorCode::REPLICA_IS_NOT_READY);
+            }
+        }
     }
+    DropAlias(key, content_key);
+    return {};
+}
 
-    if (auto status = metadata.HasDiffRepStatus(ReplicaStatus::COMPLETE)) {
-        LOG(ERROR) << "key=" << key << ", status=" << *status
-                   << ", error=invalid_replica_status";
-        return tl::make_unexpected(ErrorCode::REPLICA_IS_NOT_READY);
+void MasterService::DropAlias(const std::string& key,
+                              const std::string& content_key) {
+    {
+        auto& shard = metadata_shards_[getShardIndex(key)];
+        SharedMutexLocker lock(&shard.mutex);
+        auto it = shard.aliases.find(key);
+        if (it == shard.aliases.end() || it->second != content_key) {
+            return;
+        }
+        shard.aliases.erase(it);
     }
+    ReleaseContent(content_key);
+}
 
-    // Remove object metadata
-    accessor.Erase();
-    return {};
+void MasterService::ReleaseContent(const std::string& content_key) {
+    auto& shard = metadata_shards_[getShardIndex(content_key)];
+    SharedMutexLocker lock(&shard.mutex);
+    auto refs = shard.content_refs.find(content_key);
+    if (refs == shard.content_refs.end() || --refs->second > 0) {
+        return;
+    }
+    shard.content_refs.erase(refs);
+    // A leased object is left to eviction, a later put may share it again
+    auto it = FindAndCleanup(shard, content_key);
+    if (it != shard.metadata.end() && it->second.IsLeaseExpired() &&
+        !it->second.HasDiffRepStatus(ReplicaStatus::COMPLETE)) {
+        shard.metadata.erase(it);
+        change_log_.Record(content_key);
+        VLOG(1) << "content_key=" << content_key
+                << ", action=content_released";
+    }
 }
 
 long MasterService::RemoveAll() {
@@ -512,7 +3577,10 @@ long MasterService::RemoveAll() {
     auto now = std::chrono::steady_clock::now();
 
     for (auto& shard : metadata_shards_) {
-        MutexLocker lock(&shard.mutex);
+        SharedMutexLocker lock(&shard.mutex);
+        // Content objects that stay for their leases are left to eviction
+        shard.aliases.clear();
+        shard.content_refs.clear();
         if (shard.metadata.empty()) {
             continue;
         }
@@ -531,26 +3599,155 @@ long MasterService::RemoveAll() {
         }
     }
 
+    change_log_.Reset();
     VLOG(1) << "action=remove_all_objects"
             << ", removed_count=" << removed_count
             << ", total_freed_size=" << total_freed_size;
     return removed_count;
 }
 
+auto MasterService::RemoveByTag(const std::string& tag)
+    -> tl::expected<long, ErrorCode> {
+    if (tag.empty()) {
+        LOG(ERROR) << "error=empty_tag";
+        return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    std::vector<std::pair<std::string, std::string>> removals;
+    for (auto& shard : metadata_shards_) {
+        SharedMutexLocker lock(&shard.mutex, shared_lock);
+        const auto* keys = shard.tag_index.Find(tag);
+        if (keys == nullptr) {
+            continue;
+        }
+        for (const auto& key : *keys) {
+            removals.emplace_back(key, tag);
+        }
+    }
+    const long count = static_cast<long>(removals.size());
+    {
+        MutexLocker lock(&tag_removal_mutex_);
+        tag_removals_.insert(tag_removals_.end(),
+                             std::make_move_iterator(removals.begin()),
+                             std::make_move_iterator(removals.end()));
+    }
+    VLOG(1) << "action=remove_by_tag, tag=" << tag << ", count=" << count;
+    return count;
+}
+
+auto MasterService::RemoveByPrefix(const std::string& prefix)
+    -> tl::expected<long, ErrorCode> {
+    if (prefix.empty()) {
+        LOG(ERROR) << "error=empty_prefix";
+        return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    std::vector<std::string> keys;
+    for (auto& shard : metadata_shards_) {
+        SharedMutexLocker lock(&shard.mutex, shared_lock);
+        for (std::string_view key : ShardKeysWithPrefix(
+                 shard, prefix, std::nullopt,
+                 std::numeric_limits<size_t>::max())) {
+            keys.emplace_back(key);
+        }
+        // Keys put with a content hash are not in the metadata
+        for (const auto& alias : shard.aliases) {
+            if (alias.first.starts_with(prefix)) {
+                keys.push_back(alias.first);
+            }
+        }
+    }
+    long removed = 0;
+    for (const auto& key : keys) {
+        if (Remove(key).has_value()) {
+            removed++;
+        }
+    }
+    VLOG(1) << "action=remove_by_prefix, prefix=" << prefix
+            << ", matched=" << keys.size() << ", removed=" << removed;
+    return removed;
+}
+
+void MasterService::RemoveTaggedObjects() {
+    std::vector<std::pair<std::string, std::string>> batch;
+    {
+        MutexLocker lock(&tag_removal_mutex_);
+        const auto end =
+            tag_removals_.begin() +
+            std::min(tag_removals_.size(), kMaxTagRemovalsPerRound);
+        batch.assign(std::make_move_iterator(tag_removals_.begin()),
+                     std::make_move_iterator(end));
+        tag_removals_.erase(tag_removals_.begin(), end);
+    }
+    std::vector<std::pair<std::string, std::string>> retries;
+    for (auto& removal : batch) {
+        MetadataAccessor accessor(this, removal.first);
+        // Removed already, or put again without the tag
+        if (!accessor.Exists() || accessor.Get().tag != removal.second) {
+            continue;
+        }
+        auto& metadata = accessor.Get();
+        if (!metadata.IsLeaseExpired() ||
+            metadata.HasDiffRepStatus(ReplicaStatus::COMPLETE)) {
+            retries.push_back(std::move(removal));
+            continue;
+        }
+        accessor.Erase();
+    }
+    if (!retries.empty()) {
+        MutexLocker lock(&tag_removal_mutex_);
+        tag_removals_.insert(tag_removals_.end(),
+                             std::make_move_iterator(retries.begin()),
+                             std::make_move_iterator(retries.end()));
+    }
+}
+
 auto MasterService::MarkForGC(const std::string& key, uint64_t delay_ms)
     -> tl::expected<void, ErrorCode> {
-    // Create a new GC task and add it to the queue
-    GCTask* task = new GCTask(key, std::chrono::milliseconds(delay_ms));
-    if (!gc_queue_.push(task)) {
-        // Queue is full, delete the task to avoid memory leak
-        delete task;
-        LOG(ERROR) << "key=" << key << ", error=gc_queue_full";
-        return tl::make_unexpected(ErrorCode::INTERNAL_ERROR);
+    auto& shard = gc_shards_[getShardIndex(key) % kNumGCShards];
+    {
+        MutexLocker lock(&shard.mutex);
+        shard.tasks.emplace_back(key, std::chrono::milliseconds(delay_ms));
+        std::push_heap(shard.tasks.begin(), shard.tasks.end(),
+                       GCTaskComparator());
     }
-
+    MasterMetricManager::instance().inc_gc_pending_tasks(1);
     return {};
 }
 
+void MasterService::ProcessGCTasks() {
+    std::vector<GCTask> ready;
+    for (auto& shard : gc_shards_) {
+        const auto now = std::chrono::steady_clock::now();
+        ready.clear();
+        {
+            MutexLocker lock(&shard.mutex);
+            while (!shard.tasks.empty() && shard.tasks.front().is_ready(now)) {
+                std::pop_heap(shard.tasks.begin(), shard.tasks.end(),
+                              GCTaskComparator());
+                ready.push_back(std::move(shard.tasks.back()));
+                shard.tasks.pop_back();
+            }
+        }
+        if (ready.empty()) {
+            continue;
+        }
+        MasterMetricManager::instance().dec_gc_pending_tasks(ready.size());
+        for (const auto& task : ready) {
+            MasterMetricManager::instance().observe_gc_lag(
+                std::chrono::duration_cast<std::chrono::milliseconds>(
+                    now - task.deletion_time)
+                    .count());
+            VLOG(1) << "key=" << task.key << ", action=gc_removing_key";
+            auto result = Remove(task.key);
+            if (!result && result.error() != ErrorCode::OBJECT_NOT_FOUND &&
+                result.error() != ErrorCode::OBJECT_HAS_LEASE) {
+                LOG(WARNING) << "key=" << task.key
+                             << ", error=gc_remove_failed, error_code="
+                             << result.error();
+            }
+        }
+    }
+}
+
 bool MasterService::CleanupStaleHandles(ObjectMetadata& metadata) {
     // Iterate through replicas and remove those with invalid allocators
     auto replica_it = metadata.replicas.begin();
@@ -565,84 +3762,444 @@ bool MasterService::CleanupStaleHandles(ObjectMetadata& metadata) {
             ++replica_it;
         }
     }
-
-    // Return true if no valid replicas remain after cleanup
-    return metadata.replicas.empty();
+
+    // Return true if no valid replicas remain after cleanup
+    return metadata.replicas.empty();
+}
+
+MasterService::MetadataMap::iterator MasterService::FindAndCleanup(
+    MetadataShard& shard, const std::string& key) {
+    auto it = shard.metadata.find(key);
+    if (it == shard.metadata.end()) {
+        return it;
+    }
+    if (CleanupStaleHandles(it->second)) {
+        shard.metadata.erase(it);
+        change_log_.Record(key);
+        return shard.metadata.end();
+    }
+    it->second.UpdateResidency();
+    return it;
+}
+
+std::vector<std::pair<size_t, std::vector<size_t>>>
+MasterService::GroupByShard(const std::vector<std::string>& keys) const {
+    std::vector<std::pair<size_t, size_t>> shard_of_key;  // (shard, index)
+    shard_of_key.reserve(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        shard_of_key.emplace_back(getShardIndex(keys[i]), i);
+    }
+    std::sort(shard_of_key.begin(), shard_of_key.end());
+
+    std::vector<std::pair<size_t, std::vector<size_t>>> groups;
+    for (const auto& [shard_idx, key_idx] : shard_of_key) {
+        if (groups.empty() || groups.back().first != shard_idx) {
+            groups.emplace_back(shard_idx, std::vector<size_t>{});
+        }
+        groups.back().second.push_back(key_idx);
+    }
+    return groups;
+}
+
+size_t MasterService::GetKeyCount() const {
+    size_t total = 0;
+    for (const auto& shard : metadata_shards_) {
+        SharedMutexLocker lock(&shard.mutex, shared_lock);
+        total += shard.metadata.size();
+    }
+    return total;
+}
+
+auto MasterService::Ping(const UUID& client_id)
+    -> tl::expected<std::pair<ViewVersionId, ClientStatus>, ErrorCode> {
+    if (!enable_ha_) {
+        LOG(ERROR) << "Ping is only available in HA mode";
+        return tl::make_unexpected(ErrorCode::UNAVAILABLE_IN_CURRENT_MODE);
+    }
+
+    std::shared_lock<std::shared_mutex> lock(client_mutex_);
+    ClientStatus client_status;
+    auto it = ok_client_.find(client_id);
+    if (it != ok_client_.end()) {
+        client_status = ClientStatus::OK;
+    } else {
+        client_status = ClientStatus::NEED_REMOUNT;
+    }
+    PodUUID pod_client_id = {client_id.first, client_id.second};
+    if (!client_ping_queue_.push(pod_client_id)) {
+        // Queue is full
+        LOG(ERROR) << "client_id=" << client_id
+                   << ", error=client_ping_queue_full";
+        return tl::make_unexpected(ErrorCode::INTERNAL_ERROR);
+    }
+    return std::make_pair(view_version_, client_status);
+}
+
+tl::expected<std::string, ErrorCode> MasterService::GetFsdir() const {
+    if (cluster_id_.empty()) {
+        LOG(ERROR) << "Cluster ID is not initialized";
+        return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    return cluster_id_;
+}
+
+ReplicaCacheInfo MasterService::GetReplicaCacheInfo() const {
+    return {default_kv_lease_ttl_, replica_version_.load()};
+}
+
+std::vector<Replica::Descriptor> MasterService::FollowerReplicas(
+    const ObjectMetadata& metadata) {
+    std::vector<Replica::Descriptor> replicas;
+    // Stale handles are only cleaned up by the exclusive paths of the leader
+    if (!metadata.IsReadable() || metadata.HasStaleHandles()) {
+        return replicas;
+    }
+    for (const auto& replica : metadata.replicas) {
+        if (replica.status() == ReplicaStatus::COMPLETE) {
+            replicas.emplace_back(replica.get_descriptor());
+        }
+    }
+    return replicas;
+}
+
+auto MasterService::GetMetadataChanges(uint64_t seq, uint64_t max_keys)
+    -> tl::expected<MetadataChanges, ErrorCode> {
+    MetadataChanges changes;
+    if (!change_log_.enabled()) {
+        change_log_.Enable();
+        LOG(INFO) << "action=metadata_change_log_enabled";
+    }
+    std::vector<std::string> keys;
+    if (!change_log_.Since(seq, max_keys, keys, changes.next_seq)) {
+        changes.reset = true;
+        return changes;
+    }
+
+    // A key changed several times is sent once, in its current state
+    std::unordered_set<std::string> seen;
+    std::erase_if(keys, [&seen](const std::string& key) {
+        return !seen.insert(key).second;
+    });
+    changes.entries.resize(keys.size());
+    for (const auto& [shard_idx, indices] : GroupByShard(keys)) {
+        auto& shard = metadata_shards_[shard_idx];
+        SharedMutexLocker lock(&shard.mutex, shared_lock);
+        for (size_t idx : indices) {
+            auto it = shard.metadata.find(keys[idx]);
+            if (it != shard.metadata.end()) {
+                changes.entries[idx].replicas = FollowerReplicas(it->second);
+            }
+        }
+    }
+    for (size_t i = 0; i < keys.size(); ++i) {
+        changes.entries[i].key = std::move(keys[i]);
+    }
+    return changes;
+}
+
+auto MasterService::GetKeyFilter(uint64_t seq)
+    -> tl::expected<KeyFilterUpdate, ErrorCode> {
+    KeyFilterUpdate update;
+    if (!change_log_.enabled()) {
+        change_log_.Enable();
+        LOG(INFO) << "action=metadata_change_log_enabled";
+    }
+    std::vector<std::string> keys;
+    if (!change_log_.Since(seq, kMaxKeyFilterChanges, keys,
+                           update.next_seq) ||
+        keys.size() >= kMaxKeyFilterChanges) {
+        keys.clear();
+        MutexLocker lock(&key_filter_mutex_);
+        if (!key_filter_ ||
+            std::chrono::steady_clock::now() - key_filter_built_ >=
+                kKeyFilterRebuildInterval ||
+            !change_log_.Since(key_filter_seq_, kMaxKeyFilterChanges, keys,
+                               update.next_seq) ||
+            keys.size() >= kMaxKeyFilterChanges) {
+            keys.clear();
+            RebuildKeyFilter();
+            if (!change_log_.Since(key_filter_seq_, kMaxKeyFilterChanges,
+                                   keys, update.next_seq)) {
+                // Reset while rebuilding, the client starts over next time
+                update.next_seq = 0;
+            }
+        }
+        update.reset = true;
+        update.words = key_filter_->words();
+        update.num_hashes = key_filter_->num_hashes();
+    }
+
+    // A key changed several times is sent once
+    std::unordered_set<std::string> seen;
+    std::erase_if(keys, [&seen](const std::string& key) {
+        return !seen.insert(key).second;
+    });
+    update.keys = std::move(keys);
+    return update;
+}
+
+void MasterService::RebuildKeyFilter() {
+    // Keys changed during the scan are sent as changes after this
+    key_filter_seq_ = change_log_.seq();
+    size_t num_keys = 0;
+    for (auto& shard : metadata_shards_) {
+        SharedMutexLocker lock(&shard.mutex, shared_lock);
+        num_keys += shard.metadata.size() + shard.aliases.size();
+    }
+    KeyFilter filter(num_keys, KeyFilter::kDefaultBitsPerKey);
+    for (auto& shard : metadata_shards_) {
+        SharedMutexLocker lock(&shard.mutex, shared_lock);
+        for (const auto& [key, metadata] : shard.metadata) {
+            filter.Add(key);
+        }
+        for (const auto& [key, content_key] : shard.aliases) {
+            filter.Add(key);
+        }
+    }
+    key_filter_.emplace(std::move(filter));
+    key_filter_built_ = std::chrono::steady_clock::now();
+    VLOG(1) << "action=key_filter_rebuilt keys=" << num_keys
+            << " seq=" << key_filter_seq_;
+}
+
+auto MasterService::GetMetadataSnapshot(uint64_t shard)
+    -> tl::expected<MetadataSnapshot, ErrorCode> {
+    if (shard >= kNumShards) {
+        return tl::make_unexpected(ErrorCode::SHARD_INDEX_OUT_OF_RANGE);
+    }
+    MetadataSnapshot snapshot;
+    const size_t end = std::min<size_t>(shard + kSnapshotShards, kNumShards);
+    for (size_t i = shard; i < end; ++i) {
+        auto& metadata_shard = metadata_shards_[i];
+        SharedMutexLocker lock(&metadata_shard.mutex, shared_lock);
+        for (const auto& [key, metadata] : metadata_shard.metadata) {
+            auto replicas = FollowerReplicas(metadata);
+            if (!replicas.empty()) {
+                snapshot.entries.push_back(
+                    {std::string(key), std::move(replicas)});
+            }
+        }
+    }
+    snapshot.next_shard = end < kNumShards ? end : 0;
+    return snapshot;
+}
+
+auto MasterService::RestoreMetadata(std::vector<MetadataEntry> entries)
+    -> tl::expected<void, ErrorCode> {
+    if (!enable_failover_restore_) {
+        LOG(ERROR) << "RestoreMetadata requires enable_failover_restore";
+        return tl::make_unexpected(ErrorCode::UNAVAILABLE_IN_CURRENT_MODE);
+    }
+    std::unordered_map<std::string, std::vector<PendingReplica>> pending;
+    size_t disk_replicas = 0;
+    size_t memory_replicas = 0;
+    size_t inline_replicas = 0;
+    for (auto& entry : entries) {
+        for (auto& replica : entry.replicas) {
+            if (!replica.is_memory_replica()) {
+                AddRestoredReplica(
+                    entry.key, Replica(std::move(replica.get_disk_descriptor()),
+                                       ReplicaStatus::COMPLETE));
+                ++disk_replicas;
+                continue;
+            }
+            // Carried by the metadata, nothing to wait for
+            if (replica.get_memory_descriptor().is_inline()) {
+                AddRestoredReplica(
+                    entry.key,
+                    Replica(std::move(
+                        replica.get_memory_descriptor().inline_data)));
+                ++inline_replicas;
+                continue;
+            }
+            const auto& buffers =
+                replica.get_memory_descriptor().buffer_descriptors;
+            // The fragments of an erasure-coded replica come back on
+            // different segments, it is not restored
+            if (buffers.empty() ||
+                replica.get_memory_descriptor().is_erasure_coded()) {
+                continue;
+            }
+            pending[buffers.front().segment_name_].push_back(
+                {entry.key, std::move(replica)});
+            ++memory_replicas;
+        }
+    }
+    {
+        MutexLocker lock(&restore_mutex_);
+        pending_replicas_ = std::move(pending);
+        restore_deadline_ = std::chrono::steady_clock::now() +
+                            std::chrono::seconds(client_live_ttl_sec_);
+    }
+    LOG(INFO) << "action=metadata_restored, objects=" << entries.size()
+              << ", disk_replicas=" << disk_replicas
+              << ", inline_replicas=" << inline_replicas
+              << ", pending_memory_replicas=" << memory_replicas;
+    return {};
+}
+
+std::vector<std::pair<std::string, Replica>>
+MasterService::PlacePendingReplicas(const ScopedSegmentAccess& segment_access,
+                                    const std::vector<Segment>& segments) {
+    std::vector<std::pair<std::string, Replica>> placed;
+    MutexLocker lock(&restore_mutex_);
+    if (pending_replicas_.empty()) {
+        return placed;
+    }
+    if (std::chrono::steady_clock::now() > restore_deadline_) {
+        LOG(INFO) << "action=pending_replicas_dropped, segments="
+                  << pending_replicas_.size();
+        pending_replicas_.clear();
+        return placed;
+    }
+    size_t dropped = 0;
+    for (const auto& segment : segments) {
+        auto it = pending_replicas_.find(segment.name);
+        if (it == pending_replicas_.end()) {
+            continue;
+        }
+        for (const auto& pending : it->second) {
+            auto replica = PlaceReplica(segment_access, pending.replica, "", 0);
+            if (!replica) {
+                ++dropped;
+                continue;
+            }
+            placed.emplace_back(pending.key, std::move(*replica));
+        }
+        pending_replicas_.erase(it);
+    }
+    if (!placed.empty() || dropped > 0) {
+        LOG(INFO) << "action=memory_replicas_restored, restored="
+                  << placed.size() << ", dropped=" << dropped;
+    }
+    return placed;
 }
 
-size_t MasterService::GetKeyCount() const {
-    size_t total = 0;
-    for (const auto& shard : metadata_shards_) {
-        MutexLocker lock(&shard.mutex);
-        total += shard.metadata.size();
+std::vector<std::pair<std::string, Replica>>
+MasterService::PlaceParkedReplicas(const ScopedSegmentAccess& segment_access,
+                                   const Segment& segment) {
+    std::vector<std::pair<std::string, Replica>> placed;
+    MutexLocker lock(&restore_mutex_);
+    auto it = parked_segments_.find(segment.memory_id);
+    if (it == parked_segments_.end()) {
+        return placed;
     }
-    return total;
+    const ParkedSegment parked = std::move(it->second);
+    parked_segments_.erase(it);
+    if (std::chrono::steady_clock::now() > parked.deadline) {
+        LOG(INFO) << "segment_name=" << segment.name
+                  << ", replicas=" << parked.replicas.size()
+                  << ", action=parked_replicas_expired";
+        return placed;
+    }
+    if (segment.size < parked.segment.size) {
+        LOG(WARNING) << "segment_name=" << segment.name
+                     << ", size=" << segment.size
+                     << ", parked_size=" << parked.segment.size
+                     << ", action=parked_replicas_dropped";
+        return placed;
+    }
+    // The memory may be mapped at another address by the new process
+    const uint64_t shift = segment.base - parked.segment.base;
+    size_t dropped = 0;
+    for (const auto& pending : parked.replicas) {
+        auto replica =
+            PlaceReplica(segment_access, pending.replica, segment.name, shift);
+        if (!replica) {
+            ++dropped;
+            continue;
+        }
+        placed.emplace_back(pending.key, std::move(*replica));
+    }
+    LOG(INFO) << "segment_name=" << segment.name
+              << ", memory_id=" << segment.memory_id
+              << ", restored=" << placed.size() << ", dropped=" << dropped
+              << ", action=parked_replicas_restored";
+    return placed;
 }
 
-auto MasterService::Ping(const UUID& client_id)
-    -> tl::expected<std::pair<ViewVersionId, ClientStatus>, ErrorCode> {
-    if (!enable_ha_) {
-        LOG(ERROR) << "Ping is only available in HA mode";
-        return tl::make_unexpected(ErrorCode::UNAVAILABLE_IN_CURRENT_MODE);
+std::optional<Replica> MasterService::PlaceReplica(
+    const ScopedSegmentAccess& segment_access,
+    const Replica::Descriptor& descriptor, const std::string& segment_name,
+    uint64_t shift) {
+    std::vector<std::unique_ptr<AllocatedBuffer>> buffers;
+    for (const auto& desc :
+         descriptor.get_memory_descriptor().buffer_descriptors) {
+        const auto& name =
+            segment_name.empty() ? desc.segment_name_ : segment_name;
+        std::unique_ptr<AllocatedBuffer> buffer;
+        for (const auto& allocator : segment_access.GetAllocators(name)) {
+            buffer = allocator->allocateAt(desc.buffer_address_ + shift,
+                                           desc.size_);
+            if (buffer) {
+                break;
+            }
+        }
+        if (!buffer) {
+            return std::nullopt;
+        }
+        buffers.push_back(std::move(buffer));
     }
+    if (buffers.empty()) {
+        return std::nullopt;
+    }
+    Replica replica(std::move(buffers), ReplicaStatus::PROCESSING);
+    replica.mark_complete();
+    return replica;
+}
 
-    std::shared_lock<std::shared_mutex> lock(client_mutex_);
-    ClientStatus client_status;
-    auto it = ok_client_.find(client_id);
-    if (it != ok_client_.end()) {
-        client_status = ClientStatus::OK;
+void MasterService::AddRestoredReplica(const std::string& key,
+                                       Replica&& replica) {
+    size_t size = 0;
+    const auto desc = replica.get_descriptor();
+    if (desc.is_memory_replica()) {
+        for (const auto& buffer :
+             desc.get_memory_descriptor().buffer_descriptors) {
+            size += buffer.size_;
+        }
     } else {
-        client_status = ClientStatus::NEED_REMOUNT;
-    }
-    PodUUID pod_client_id = {client_id.first, client_id.second};
-    if (!client_ping_queue_.push(pod_client_id)) {
-        // Queue is full
-        LOG(ERROR) << "client_id=" << client_id
-                   << ", error=client_ping_queue_full";
-        return tl::make_unexpected(ErrorCode::INTERNAL_ERROR);
+        size = desc.get_disk_descriptor().file_size;
     }
-    return std::make_pair(view_version_, client_status);
-}
 
-tl::expected<std::string, ErrorCode> MasterService::GetFsdir() const {
-    if (cluster_id_.empty()) {
-        LOG(ERROR) << "Cluster ID is not initialized";
-        return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+    auto& shard = metadata_shards_[getShardIndex(key)];
+    SharedMutexLocker lock(&shard.mutex);
+    auto it = shard.metadata.find(key);
+    if (it == shard.metadata.end()) {
+        std::vector<Replica> replicas;
+        replicas.push_back(std::move(replica));
+        it = EmplaceObject(shard, key, size, std::move(replicas), false,
+                           &shard.disk_only_objects, namespaces_.Find(key))
+                 .first;
+        it->second.restored = true;
+    } else if (it->second.restored && it->second.size == size) {
+        it->second.replicas.push_back(std::move(replica));
+    } else {
+        // Put again since the failover, the restored replica is stale
+        return;
     }
-    return cluster_id_;
+    it->second.UpdateResidency();
+    change_log_.Record(key);
 }
 
 void MasterService::GCThreadFunc() {
     VLOG(1) << "action=gc_thread_started";
 
-    std::priority_queue<GCTask*, std::vector<GCTask*>, GCTaskComparator>
-        local_pq;
-
     while (gc_running_) {
-        GCTask* task = nullptr;
-        while (gc_queue_.pop(task)) {
-            if (task) {
-                local_pq.push(task);
-            }
-        }
-
-        while (!local_pq.empty()) {
-            task = local_pq.top();
-            if (!task->is_ready()) {
-                break;
-            }
-
-            local_pq.pop();
-            VLOG(1) << "key=" << task->key << ", action=gc_removing_key";
-            auto result = Remove(task->key);
-            if (!result && result.error() != ErrorCode::OBJECT_NOT_FOUND &&
-                result.error() != ErrorCode::OBJECT_HAS_LEASE) {
-                LOG(WARNING) << "key=" << task->key
-                             << ", error=gc_remove_failed, error_code="
-                             << result.error();
-            }
-            delete task;
+        const auto gc_start = std::chrono::steady_clock::now();
+        ProcessGCTasks();
+        MasterMetricManager::instance().observe_gc_duration(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - gc_start)
+                .count());
+        RemoveTaggedObjects();
+        if (hot_replica_read_rate_ > 0) {
+            HotReplicaGC();
         }
+        // Copies are queued in every mode
+        CompactionGC();
+        DrainGC();
+        CreditGC();
+        EvictNamespaceExcess();
         double used_ratio =
             MasterMetricManager::instance().get_global_used_ratio();
         if (used_ratio > eviction_high_watermark_ratio_ ||
@@ -653,19 +4210,227 @@ void MasterService::GCThreadFunc() {
             double evict_ratio_lowerbound =
                 std::max(evict_ratio_target * 0.5,
                          used_ratio - eviction_high_watermark_ratio_);
-            BatchEvict(evict_ratio_target, evict_ratio_lowerbound);
+            Evict(evict_ratio_target, evict_ratio_lowerbound);
+        } else if (eviction_low_watermark_ratio_ > 0.0) {
+            ProactiveEvict();
         }
+        FreeGC();
 
         std::this_thread::sleep_for(
             std::chrono::milliseconds(kGCThreadSleepMs));
     }
 
-    while (!local_pq.empty()) {
-        delete local_pq.top();
-        local_pq.pop();
+    VLOG(1) << "action=gc_thread_stopped";
+}
+
+void MasterService::FreeGC() {
+    ScopedAllocatorAccess allocator_access =
+        segment_manager_.getAllocatorAccess();
+    for (const auto& allocator : allocator_access.getAllocators()) {
+        allocator->releasePendingFrees();
     }
+}
 
-    VLOG(1) << "action=gc_thread_stopped";
+void MasterService::ProactiveEvict() {
+    const auto now = std::chrono::steady_clock::now();
+    const auto elapsed = now - demand_sampled_at_;
+    if (elapsed < kEvictionControlInterval) {
+        return;
+    }
+    const uint64_t demand =
+        allocation_demand_bytes_.load(std::memory_order_relaxed);
+    if (demand_sampled_at_.time_since_epoch().count() != 0) {
+        const double rate =
+            (demand - sampled_demand_bytes_) /
+            std::chrono::duration<double>(elapsed).count();
+        allocation_rate_ = kAllocationRateSmoothing * rate +
+                           (1.0 - kAllocationRateSmoothing) * allocation_rate_;
+    }
+    sampled_demand_bytes_ = demand;
+    demand_sampled_at_ = now;
+
+    auto& metrics = MasterMetricManager::instance();
+    const double headroom =
+        allocation_rate_ *
+        std::chrono::duration<double>(kEvictionHorizon).count();
+    metrics.set_allocation_rate(static_cast<int64_t>(allocation_rate_));
+    metrics.set_eviction_headroom_target(static_cast<int64_t>(headroom));
+
+    // The space of this master only, the metrics add up all the masters
+    // of the process
+    double capacity = 0.0;
+    double allocated = 0.0;
+    {
+        ScopedAllocatorAccess allocator_access =
+            segment_manager_.getAllocatorAccess();
+        for (const auto& allocator : allocator_access.getAllocators()) {
+            capacity += allocator->capacity();
+            allocated += allocator->size();
+        }
+    }
+    if (capacity <= 0.0 || allocated <= 0.0) {
+        return;
+    }
+    const double shortfall =
+        allocated + headroom - capacity * eviction_high_watermark_ratio_;
+    const double evictable =
+        allocated - capacity * eviction_low_watermark_ratio_;
+    const double to_free = std::min(shortfall, evictable);
+    if (to_free <= 0.0) {
+        return;
+    }
+    // The evictions count objects, assume an average object size
+    const double ratio = std::min(1.0, to_free / allocated);
+    VLOG(1) << "action=proactive_evict, allocation_rate=" << allocation_rate_
+            << ", headroom=" << headroom << ", to_free=" << to_free
+            << ", ratio=" << ratio;
+    metrics.inc_proactive_evictions();
+    Evict(ratio, ratio);
+}
+
+void MasterService::EvictNamespaceExcess() {
+    if (!namespaces_.enabled()) {
+        return;
+    }
+    uint64_t capacity = 0;
+    {
+        ScopedAllocatorAccess allocator_access =
+            segment_manager_.getAllocatorAccess();
+        for (const auto& allocator : allocator_access.getAllocators()) {
+            capacity += allocator->capacity();
+        }
+    }
+    const uint64_t excess = namespaces_.UpdateShares(
+        static_cast<uint64_t>(capacity * eviction_high_watermark_ratio_),
+        eviction_high_watermark_ratio_);
+    auto& metrics = MasterMetricManager::instance();
+    namespaces_.ForEach([&](const NamespaceTable::Usage& usage) {
+        metrics.set_namespace_usage(usage.index(), usage.bytes(),
+                                    usage.share());
+    });
+    if (excess == 0) {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    auto evictable = [&](const ObjectMetadata& object) {
+        return object.namespace_usage &&
+               object.namespace_usage->excess() > 0 &&
+               object.IsLeaseExpired(now) && !object.IsSoftPinned(now) &&
+               !object.HasDiffRepStatus(ReplicaStatus::COMPLETE) &&
+               object.HasMemoryReplica();
+    };
+
+    // 1. Find, for each namespace above its share, the lease timeout up to
+    // which evicting its objects brings it back to its share
+    struct Candidate {
+        const NamespaceTable::Usage* usage;
+        std::chrono::steady_clock::time_point lease_timeout;
+        uint64_t size;
+    };
+    std::vector<std::vector<Candidate>> parts(kNumSweepWorkers);
+    ParallelForShards([&](size_t part, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            auto& shard = metadata_shards_[i];
+            SharedMutexLocker lock(&shard.mutex, shared_lock);
+            for (const auto& item : shard.metadata) {
+                const auto& object = item.second;
+                if (evictable(object)) {
+                    parts[part].push_back({object.namespace_usage,
+                                           object.GetLeaseTimeout(),
+                                           object.size});
+                }
+            }
+        }
+    });
+    std::vector<Candidate> candidates;
+    for (auto& part : parts) {
+        candidates.insert(candidates.end(), part.begin(), part.end());
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const Candidate& a, const Candidate& b) {
+                  return a.lease_timeout < b.lease_timeout;
+              });
+    std::unordered_map<const NamespaceTable::Usage*, uint64_t> to_free;
+    std::unordered_map<const NamespaceTable::Usage*,
+                       std::chrono::steady_clock::time_point>
+        cutoffs;
+    for (const auto& candidate : candidates) {
+        auto it =
+            to_free.try_emplace(candidate.usage, candidate.usage->excess())
+                .first;
+        if (it->second > 0) {
+            cutoffs[candidate.usage] = candidate.lease_timeout;
+            it->second -= std::min(it->second, candidate.size);
+        }
+    }
+    if (cutoffs.empty()) {
+        return;
+    }
+
+    // 2. Evict them, stopping at the share in case objects were removed
+    // meanwhile
+    std::vector<long> evicted(kNumSweepWorkers, 0);
+    std::vector<uint64_t> freed(kNumSweepWorkers, 0);
+    ParallelForShards([&](size_t part, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            auto& shard = metadata_shards_[i];
+            SharedMutexLocker lock(&shard.mutex);
+            auto it = shard.metadata.begin();
+            while (it != shard.metadata.end()) {
+                auto cutoff = cutoffs.find(it->second.namespace_usage);
+                if (cutoff == cutoffs.end() || !evictable(it->second) ||
+                    it->second.GetLeaseTimeout() > cutoff->second) {
+                    ++it;
+                    continue;
+                }
+                it = EvictObject(shard, it, freed[part]);
+                evicted[part]++;
+            }
+        }
+    });
+    long evicted_count = 0;
+    uint64_t freed_size = 0;
+    for (size_t part = 0; part < kNumSweepWorkers; ++part) {
+        evicted_count += evicted[part];
+        freed_size += freed[part];
+    }
+    if (evicted_count > 0) {
+        metrics.inc_eviction_success(evicted_count, freed_size);
+    }
+    VLOG(1) << "action=evict_namespace_excess, excess=" << excess
+            << ", evicted_count=" << evicted_count
+            << ", total_freed_size=" << freed_size;
+}
+
+void MasterService::Evict(double evict_ratio_target,
+                          double evict_ratio_lowerbound) {
+    const auto start = std::chrono::steady_clock::now();
+    if (eviction_engine_ == EvictionEngine::BATCH_SCAN) {
+        BatchEvict(evict_ratio_target, evict_ratio_lowerbound);
+    } else {
+        IncrementalEvict(evict_ratio_target, evict_ratio_lowerbound);
+    }
+    const int64_t duration_us =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count();
+    MC_TRACE(evict_round, duration_us);
+    MasterMetricManager::instance().observe_eviction_duration(duration_us);
+}
+
+void MasterService::ParallelForShards(
+    const std::function<void(size_t part, size_t begin, size_t end)>& fn) {
+    std::latch done(kNumSweepWorkers);
+    for (size_t part = 0; part < kNumSweepWorkers; ++part) {
+        const size_t begin = kNumShards * part / kNumSweepWorkers;
+        const size_t end = kNumShards * (part + 1) / kNumSweepWorkers;
+        sweep_pool_.enqueue([&fn, &done, part, begin, end] {
+            fn(part, begin, end);
+            done.count_down();
+        });
+    }
+    done.wait();
 }
 
 void MasterService::BatchEvict(double evict_ratio_target,
@@ -678,91 +4443,121 @@ void MasterService::BatchEvict(double evict_ratio_target,
     }
 
     auto now = std::chrono::steady_clock::now();
-    long evicted_count = 0;
-    long object_count = 0;
-    uint64_t total_freed_size = 0;
 
-    // Candidates for second pass eviction
-    std::vector<std::chrono::steady_clock::time_point> no_pin_objects;
-    std::vector<std::chrono::steady_clock::time_point> soft_pin_objects;
+    // What the sweep of one range of shards found and evicted
+    struct SweepPart {
+        long evicted_count = 0;
+        long object_count = 0;
+        uint64_t total_freed_size = 0;
+        // Candidates for second pass eviction
+        std::vector<std::chrono::steady_clock::time_point> no_pin_objects;
+        std::vector<std::chrono::steady_clock::time_point> soft_pin_objects;
+    };
+    std::vector<SweepPart> parts(kNumSweepWorkers);
 
     // Randomly select a starting shard to avoid imbalance eviction between
     // shards. No need to use expensive random_device here.
     size_t start_idx = rand() % metadata_shards_.size();
+    auto shard_at = [&](size_t i) -> MetadataShard& {
+        return metadata_shards_[(start_idx + i) % metadata_shards_.size()];
+    };
 
-    // First pass: evict objects without soft pin and lease expired
-    for (size_t i = 0; i < metadata_shards_.size(); i++) {
-        auto& shard =
-            metadata_shards_[(start_idx + i) % metadata_shards_.size()];
-        MutexLocker lock(&shard.mutex);
+    // First pass: evict objects without soft pin and lease expired. Each
+    // range of shards aims at evict_ratio_target on its own.
+    ParallelForShards([&](size_t part_idx, size_t begin, size_t end) {
+        auto& part = parts[part_idx];
+        for (size_t i = begin; i < end; i++) {
+            auto& shard = shard_at(i);
+            SharedMutexLocker lock(&shard.mutex);
 
-        // object_count must be updated at beginning as it will be used later
-        // to compute ideal_evict_num
-        object_count += shard.metadata.size();
+            // object_count must be updated at beginning as it will be used
+            // later to compute ideal_evict_num
+            part.object_count += ResidentObjects(shard);
 
-        // To achieve evicted_count / object_count = evict_ratio_target,
-        // ideally how many object should be evicted in this shard
-        const long ideal_evict_num =
-            std::ceil(object_count * evict_ratio_target) - evicted_count;
+            // To achieve evicted_count / object_count = evict_ratio_target,
+            // ideally how many object should be evicted in this shard
+            const long ideal_evict_num =
+                std::ceil(part.object_count * evict_ratio_target) -
+                part.evicted_count;
 
-        std::vector<std::chrono::steady_clock::time_point>
-            candidates;  // can be removed
-        for (auto it = shard.metadata.begin(); it != shard.metadata.end();
-             it++) {
-            // Skip objects that are not expired or have incomplete replicas
-            if (!it->second.IsLeaseExpired(now) ||
-                it->second.HasDiffRepStatus(ReplicaStatus::COMPLETE)) {
-                continue;
-            }
-            if (!it->second.IsSoftPinned(now)) {
-                if (ideal_evict_num > 0) {
-                    // first pass candidates
-                    candidates.push_back(it->second.lease_timeout);
-                } else {
-                    // No need to evict any object in this shard, put to
-                    // second pass candidates
-                    no_pin_objects.push_back(it->second.lease_timeout);
-                }
-            } else if (allow_evict_soft_pinned_objects_) {
-                // second pass candidates, only if
-                // allow_evict_soft_pinned_objects_ is true
-                soft_pin_objects.push_back(it->second.lease_timeout);
-            }
-        }
-
-        if (ideal_evict_num > 0 && !candidates.empty()) {
-            long evict_num = std::min(ideal_evict_num, (long)candidates.size());
-            long shard_evicted_count =
-                0;  // number of objects evicted from this shard
-            std::nth_element(candidates.begin(),
-                             candidates.begin() + (evict_num - 1),
-                             candidates.end());
-            auto target_timeout = candidates[evict_num - 1];
-            // Evict objects with lease timeout less than or equal to target.
-            auto it = shard.metadata.begin();
-            while (it != shard.metadata.end()) {
-                // Skip objects that are not allowed to be evicted in the first
-                // pass
+            std::vector<std::chrono::steady_clock::time_point>
+                candidates;  // can be removed
+            for (auto it = shard.metadata.begin(); it != shard.metadata.end();
+                 it++) {
+                // Skip objects that are not expired, have incomplete replicas
+                // or hold no memory
                 if (!it->second.IsLeaseExpired(now) ||
-                    it->second.IsSoftPinned(now) ||
-                    it->second.HasDiffRepStatus(ReplicaStatus::COMPLETE)) {
-                    ++it;
+                    it->second.HasDiffRepStatus(ReplicaStatus::COMPLETE) ||
+                    !it->second.HasMemoryReplica()) {
                     continue;
                 }
-                if (it->second.lease_timeout <= target_timeout) {
-                    // Evict this object
-                    total_freed_size +=
-                        it->second.size * it->second.replicas.size();
-                    it = shard.metadata.erase(it);
-                    shard_evicted_count++;
-                } else {
-                    // second pass candidates
-                    no_pin_objects.push_back(it->second.lease_timeout);
-                    ++it;
+                if (!it->second.IsSoftPinned(now)) {
+                    if (ideal_evict_num > 0) {
+                        // first pass candidates
+                        candidates.push_back(it->second.EvictionRank(now));
+                    } else {
+                        // No need to evict any object in this shard, put to
+                        // second pass candidates
+                        part.no_pin_objects.push_back(
+                            it->second.EvictionRank(now));
+                    }
+                } else if (allow_evict_soft_pinned_objects_) {
+                    // second pass candidates, only if
+                    // allow_evict_soft_pinned_objects_ is true
+                    part.soft_pin_objects.push_back(
+                        it->second.EvictionRank(now));
+                }
+            }
+
+            if (ideal_evict_num > 0 && !candidates.empty()) {
+                long evict_num =
+                    std::min(ideal_evict_num, (long)candidates.size());
+                std::nth_element(candidates.begin(),
+                                 candidates.begin() + (evict_num - 1),
+                                 candidates.end());
+                auto target_timeout = candidates[evict_num - 1];
+                // Evict objects with eviction rank less than or equal to
+                // target, see ObjectMetadata::EvictionRank.
+                auto it = shard.metadata.begin();
+                while (it != shard.metadata.end()) {
+                    // Skip objects that are not allowed to be evicted in the
+                    // first pass
+                    if (!it->second.IsLeaseExpired(now) ||
+                        it->second.IsSoftPinned(now) ||
+                        it->second.HasDiffRepStatus(ReplicaStatus::COMPLETE) ||
+                        !it->second.HasMemoryReplica()) {
+                        ++it;
+                        continue;
+                    }
+                    if (it->second.EvictionRank(now) <= target_timeout) {
+                        // Evict this object
+                        it = EvictObject(shard, it, part.total_freed_size);
+                        part.evicted_count++;
+                    } else {
+                        // second pass candidates
+                        part.no_pin_objects.push_back(
+                            it->second.EvictionRank(now));
+                        ++it;
+                    }
                 }
             }
-            evicted_count += shard_evicted_count;
         }
+    });
+
+    long evicted_count = 0;
+    long object_count = 0;
+    std::vector<std::chrono::steady_clock::time_point> no_pin_objects;
+    std::vector<std::chrono::steady_clock::time_point> soft_pin_objects;
+    for (auto& part : parts) {
+        evicted_count += part.evicted_count;
+        object_count += part.object_count;
+        no_pin_objects.insert(no_pin_objects.end(),
+                              part.no_pin_objects.begin(),
+                              part.no_pin_objects.end());
+        soft_pin_objects.insert(soft_pin_objects.end(),
+                                part.soft_pin_objects.begin(),
+                                part.soft_pin_objects.end());
+        part.evicted_count = 0;
     }
 
     // The ideal number of objects to evict in the second pass
@@ -773,6 +4568,38 @@ void MasterService::BatchEvict(double evict_ratio_target,
         std::min(target_evict_num,
                  (long)no_pin_objects.size() + (long)soft_pin_objects.size());
 
+    // Evicts the objects for which evictable returns true from all shards
+    // in parallel, until target_evict_num objects are evicted
+    auto second_pass = [&](const auto& evictable) {
+        std::atomic<long> remaining{target_evict_num};
+        ParallelForShards([&](size_t part_idx, size_t begin, size_t end) {
+            auto& part = parts[part_idx];
+            for (size_t i = begin;
+                 i < end && remaining.load(std::memory_order_relaxed) > 0;
+                 i++) {
+                auto& shard = shard_at(i);
+                SharedMutexLocker lock(&shard.mutex);
+                auto it = shard.metadata.begin();
+                while (it != shard.metadata.end()) {
+                    if (!evictable(it->second)) {
+                        ++it;
+                        continue;
+                    }
+                    // Claim one of the remaining evictions
+                    if (remaining.fetch_sub(1, std::memory_order_relaxed) <=
+                        0) {
+                        return;
+                    }
+                    it = EvictObject(shard, it, part.total_freed_size);
+                    part.evicted_count++;
+                }
+            }
+        });
+        for (const auto& part : parts) {
+            evicted_count += part.evicted_count;
+        }
+    };
+
     // Do second pass eviction only if 1). there are candidates that can be
     // evicted AND 2). The evicted number in the first pass is less than
     // evict_ratio_lowerbound.
@@ -790,29 +4617,14 @@ void MasterService::BatchEvict(double evict_ratio_target,
                              no_pin_objects.end());
             auto target_timeout = no_pin_objects[target_evict_num - 1];
 
-            // Evict objects with lease timeout less than or equal to target.
+            // Evict objects with eviction rank less than or equal to target.
             // Stop when the target is reached.
-            for (size_t i = 0;
-                 i < metadata_shards_.size() && target_evict_num > 0; i++) {
-                auto& shard =
-                    metadata_shards_[(start_idx + i) % metadata_shards_.size()];
-                MutexLocker lock(&shard.mutex);
-                auto it = shard.metadata.begin();
-                while (it != shard.metadata.end() && target_evict_num > 0) {
-                    if (it->second.lease_timeout <= target_timeout &&
-                        !it->second.IsSoftPinned(now) &&
-                        !it->second.HasDiffRepStatus(ReplicaStatus::COMPLETE)) {
-                        // Evict this object
-                        total_freed_size +=
-                            it->second.size * it->second.replicas.size();
-                        it = shard.metadata.erase(it);
-                        evicted_count++;
-                        target_evict_num--;
-                    } else {
-                        ++it;
-                    }
-                }
-            }
+            second_pass([&](const ObjectMetadata& object) {
+                return object.EvictionRank(now) <= target_timeout &&
+                       !object.IsSoftPinned(now) &&
+                       !object.HasDiffRepStatus(ReplicaStatus::COMPLETE) &&
+                       object.HasMemoryReplica();
+            });
         } else if (!soft_pin_objects.empty()) {
             // Second pass B: Prioritize evicting objects without soft pin, but
             // also allow to evict soft pinned objects. The following code is
@@ -821,7 +4633,7 @@ void MasterService::BatchEvict(double evict_ratio_target,
             const long soft_pin_evict_num =
                 target_evict_num - static_cast<long>(no_pin_objects.size());
             // For soft pin objects, prioritize to evict the ones with smaller
-            // lease timeout.
+            // eviction rank.
             std::nth_element(
                 soft_pin_objects.begin(),
                 soft_pin_objects.begin() + (soft_pin_evict_num - 1),
@@ -829,35 +4641,19 @@ void MasterService::BatchEvict(double evict_ratio_target,
             auto soft_target_timeout = soft_pin_objects[soft_pin_evict_num - 1];
 
             // Stop when the target is reached.
-            for (size_t i = 0;
-                 i < metadata_shards_.size() && target_evict_num > 0; i++) {
-                auto& shard =
-                    metadata_shards_[(start_idx + i) % metadata_shards_.size()];
-                MutexLocker lock(&shard.mutex);
-
-                auto it = shard.metadata.begin();
-                while (it != shard.metadata.end() && target_evict_num > 0) {
-                    // Skip objects that are not expired or have incomplete
-                    // replicas
-                    if (!it->second.IsLeaseExpired(now) ||
-                        it->second.HasDiffRepStatus(ReplicaStatus::COMPLETE)) {
-                        ++it;
-                        continue;
-                    }
-                    // Evict objects with 1). no soft pin OR 2). with soft pin
-                    // and lease timeout less than or equal to target.
-                    if (!it->second.IsSoftPinned(now) ||
-                        it->second.lease_timeout <= soft_target_timeout) {
-                        total_freed_size +=
-                            it->second.size * it->second.replicas.size();
-                        it = shard.metadata.erase(it);
-                        evicted_count++;
-                        target_evict_num--;
-                    } else {
-                        ++it;
-                    }
+            second_pass([&](const ObjectMetadata& object) {
+                // Skip objects that are not expired, have incomplete
+                // replicas or hold no memory
+                if (!object.IsLeaseExpired(now) ||
+                    object.HasDiffRepStatus(ReplicaStatus::COMPLETE) ||
+                    !object.HasMemoryReplica()) {
+                    return false;
                 }
-            }
+                // Evict objects with 1). no soft pin OR 2). with soft pin
+                // and eviction rank less than or equal to target.
+                return !object.IsSoftPinned(now) ||
+                       object.EvictionRank(now) <= soft_target_timeout;
+            });
         } else {
             // This should not happen.
             LOG(ERROR) << "Error in second pass eviction: target_evict_num="
@@ -872,6 +4668,225 @@ void MasterService::BatchEvict(double evict_ratio_target,
         }
     }
 
+    uint64_t total_freed_size = 0;
+    for (const auto& part : parts) {
+        total_freed_size += part.total_freed_size;
+    }
+    FinishEviction(evicted_count, object_count, total_freed_size);
+}
+
+void MasterService::IncrementalEvict(double evict_ratio_target,
+                                     double evict_ratio_lowerbound) {
+    if (evict_ratio_target < evict_ratio_lowerbound) {
+        LOG(ERROR) << "evict_ratio_target=" << evict_ratio_target
+                   << ", evict_ratio_lowerbound=" << evict_ratio_lowerbound
+                   << ", error=invalid_params";
+        evict_ratio_lowerbound = evict_ratio_target;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    long evicted_count = 0;
+    long object_count = 0;
+    uint64_t total_freed_size = 0;
+
+    // Randomly select a starting shard to avoid imbalance eviction between
+    // shards. No need to use expensive random_device here.
+    const size_t start_idx = rand() % metadata_shards_.size();
+
+    // First pass: evict objects without soft pin that have not been used
+    // recently, as judged by the engine. As in BatchEvict, each shard gets
+    // its share of the target based on the running object count.
+    for (size_t i = 0; i < metadata_shards_.size(); i++) {
+        auto& shard =
+            metadata_shards_[(start_idx + i) % metadata_shards_.size()];
+        SharedMutexLocker lock(&shard.mutex);
+        object_count += ResidentObjects(shard);
+        const long ideal_evict_num =
+            std::ceil(object_count * evict_ratio_target) - evicted_count;
+        evicted_count += SweepShard(shard, ideal_evict_num,
+                                    SweepMode::NO_PIN_UNREFERENCED, now,
+                                    total_freed_size);
+    }
+
+    // Sweep all shards once more, spreading target_num over the shards in
+    // proportion to their sizes.
+    auto sweep_all = [&](SweepMode mode, long target_num) {
+        long seen_count = 0;
+        long sweep_evicted = 0;
+        for (size_t i = 0;
+             i < metadata_shards_.size() && sweep_evicted < target_num; i++) {
+            auto& shard =
+                metadata_shards_[(start_idx + i) % metadata_shards_.size()];
+            SharedMutexLocker lock(&shard.mutex);
+            seen_count += ResidentObjects(shard);
+            const long ideal_evict_num =
+                std::ceil(static_cast<double>(seen_count) * target_num /
+                          std::max(object_count, 1L)) -
+                sweep_evicted;
+            sweep_evicted += SweepShard(shard, ideal_evict_num, mode, now,
+                                        total_freed_size);
+        }
+        return sweep_evicted;
+    };
+
+    // Second pass: fulfill evict_ratio_lowerbound, first ignoring reference
+    // bits, then allowing soft pinned objects if configured.
+    long target_evict_num =
+        static_cast<long>(std::ceil(object_count * evict_ratio_lowerbound)) -
+        evicted_count;
+    if (target_evict_num > 0) {
+        long evicted = sweep_all(SweepMode::NO_PIN, target_evict_num);
+        evicted_count += evicted;
+        target_evict_num -= evicted;
+    }
+    if (target_evict_num > 0 && allow_evict_soft_pinned_objects_) {
+        evicted_count += sweep_all(SweepMode::SOFT_PIN, target_evict_num);
+    }
+
+    FinishEviction(evicted_count, object_count, total_freed_size);
+}
+
+long MasterService::SweepShard(MetadataShard& shard, long quota,
+                               SweepMode mode,
+                               std::chrono::steady_clock::time_point now,
+                               uint64_t& total_freed_size) {
+    if (shard.eviction_tracker) {
+        return PolicySweepShard(shard, quota, mode, now, total_freed_size);
+    }
+    return ClockSweepShard(shard, quota, mode, now, total_freed_size);
+}
+
+long MasterService::PolicySweepShard(MetadataShard& shard, long quota,
+                                     SweepMode mode,
+                                     std::chrono::steady_clock::time_point now,
+                                     uint64_t& total_freed_size) {
+    auto& metadata = shard.metadata;
+    auto& tracker = *shard.eviction_tracker;
+    if (quota <= 0 || metadata.empty()) {
+        return 0;
+    }
+
+    // The policy orders the candidates; this predicate only enforces leases,
+    // completeness and the soft pin rules of the current pass.
+    auto evictable = [&](EvictionPolicy::Handle handle) {
+        auto it = metadata.find(tracker.Key(handle));
+        if (it == metadata.end()) {
+            return false;
+        }
+        auto& object = it->second;
+        if (!object.IsLeaseExpired(now) ||
+            object.HasDiffRepStatus(ReplicaStatus::COMPLETE) ||
+            !object.HasMemoryReplica()) {
+            return false;
+        }
+        return mode == SweepMode::SOFT_PIN || !object.IsSoftPinned(now);
+    };
+
+    size_t budget =
+        std::min(metadata.size() * 2,
+                 static_cast<size_t>(quota * kMaxVisitsPerEviction));
+    long evicted = 0;
+    while (evicted < quota) {
+        auto victim = tracker.Evict(evictable, budget);
+        if (!victim) {
+            break;
+        }
+        // Destroying or demoting the metadata removes the handle from the
+        // tracker
+        EvictObject(shard, metadata.find(tracker.Key(*victim)),
+                    total_freed_size);
+        evicted++;
+    }
+    return evicted;
+}
+
+long MasterService::ClockSweepShard(MetadataShard& shard, long quota,
+                                    SweepMode mode,
+                                    std::chrono::steady_clock::time_point now,
+                                    uint64_t& total_freed_size) {
+    auto& metadata = shard.metadata;
+    if (quota <= 0 || metadata.empty()) {
+        return 0;
+    }
+
+    auto it = shard.clock_hand.empty() ? metadata.end()
+                                       : metadata.find(shard.clock_hand);
+    if (it == metadata.end()) {
+        it = metadata.begin();
+    }
+
+    // Two revolutions are enough to clear every reference bit and come back
+    const long max_visits =
+        std::min(static_cast<long>(metadata.size()) * 2,
+                 quota * kMaxVisitsPerEviction);
+    long evicted = 0;
+    for (long visits = 0;
+         visits < max_visits && evicted < quota && !metadata.empty();
+         visits++) {
+        if (it == metadata.end()) {
+            it = metadata.begin();
+        }
+        auto& object = it->second;
+        bool evict = false;
+        if (mode == SweepMode::NO_PIN_UNREFERENCED) {
+            // Clear the reference bit of every object the hand passes, so
+            // only objects untouched for a full revolution are evicted.
+            const bool referenced =
+                object.referenced.exchange(false, std::memory_order_relaxed);
+            evict = !referenced && object.IsLeaseExpired(now) &&
+                    !object.IsSoftPinned(now) &&
+                    !object.HasDiffRepStatus(ReplicaStatus::COMPLETE) &&
+                    object.HasMemoryReplica();
+        } else if (object.IsLeaseExpired(now) &&
+                   !object.HasDiffRepStatus(ReplicaStatus::COMPLETE) &&
+                   object.HasMemoryReplica()) {
+            evict = object.IsSoftPinned(now) ==
+                    (mode == SweepMode::SOFT_PIN);
+        }
+
+        if (evict) {
+            it = EvictObject(shard, it, total_freed_size);
+            evicted++;
+        } else {
+            ++it;
+        }
+    }
+
+    if (it == metadata.end()) {
+        shard.clock_hand.clear();
+    } else {
+        shard.clock_hand = std::string(it->first);
+    }
+    return evicted;
+}
+
+MasterService::MetadataMap::iterator MasterService::EvictObject(
+    MetadataShard& shard, MetadataMap::iterator it,
+    uint64_t& total_freed_size) {
+    auto& object = it->second;
+    const size_t memory_replicas =
+        std::count_if(object.replicas.begin(), object.replicas.end(),
+                      [](const Replica& replica) {
+                          return replica.is_memory_replica();
+                      });
+    total_freed_size += object.size * memory_replicas;
+    change_log_.Record(it->first);
+    if (!enable_disk_tier_ || !object.GetDiskReplica()) {
+        return shard.metadata.erase(it);
+    }
+
+    // Demote to the disk tier, a later read promotes it again
+    std::erase_if(object.replicas, [](const Replica& replica) {
+        return replica.is_memory_replica();
+    });
+    object.UpdateResidency();
+    VLOG(1) << "key=" << it->first << ", action=object_demoted";
+    return ++it;
+}
+
+void MasterService::FinishEviction(long evicted_count, long object_count,
+                                   uint64_t total_freed_size) {
+    MC_TRACE(evict_done, evicted_count, object_count, total_freed_size);
     if (evicted_count > 0) {
         need_eviction_ = false;
         MasterMetricManager::instance().inc_eviction_success(evicted_count,
@@ -889,9 +4904,9 @@ void MasterService::BatchEvict(double evict_ratio_target,
 }
 
 void MasterService::ClientMonitorFunc() {
-    std::unordered_map<UUID, std::chrono::steady_clock::time_point,
-                       boost::hash<UUID>>
-        client_ttl;
+    ClientExpiryWheel client_ttl{
+        std::chrono::milliseconds(kClientMonitorSleepMs),
+        std::chrono::seconds(client_live_ttl_sec_)};
     while (client_monitor_running_) {
         auto now = std::chrono::steady_clock::now();
 
@@ -899,21 +4914,14 @@ void MasterService::ClientMonitorFunc() {
         PodUUID pod_client_id;
         while (client_ping_queue_.pop(pod_client_id)) {
             UUID client_id = {pod_client_id.first, pod_client_id.second};
-            client_ttl[client_id] =
-                now + std::chrono::seconds(client_live_ttl_sec_);
+            client_ttl.Touch(client_id, now);
         }
 
         // Find out expired clients
-        std::vector<UUID> expired_clients;
-        for (auto it = client_ttl.begin(); it != client_ttl.end();) {
-            if (it->second < now) {
-                LOG(INFO) << "client_id=" << it->first
-                          << ", action=client_expired";
-                expired_clients.push_back(it->first);
-                it = client_ttl.erase(it);
-            } else {
-                ++it;
-            }
+        std::vector<UUID> expired_clients = client_ttl.Advance(now);
+        for (const auto& client_id : expired_clients) {
+            LOG(INFO) << "client_id=" << client_id
+                      << ", action=client_expired";
         }
 
         // Update the client status to NEED_REMOUNT
@@ -924,6 +4932,7 @@ void MasterService::ClientMonitorFunc() {
             std::vector<size_t> dec_capacities;
             std::vector<UUID> client_ids;
             std::vector<std::string> segment_names;
+            std::vector<Segment> parking;
             {
                 // Lock client_mutex and segment_mutex
                 std::unique_lock<std::shared_mutex> lock(client_mutex_);
@@ -938,6 +4947,7 @@ void MasterService::ClientMonitorFunc() {
                 ScopedSegmentAccess segment_access =
                     segment_manager_.getSegmentAccess();
                 for (auto& client_id : expired_clients) {
+                    segment_access.DetachClient(client_id);
                     std::vector<Segment> segments;
                     segment_access.GetClientSegments(client_id, segments);
                     for (auto& seg : segments) {
@@ -949,6 +4959,10 @@ void MasterService::ClientMonitorFunc() {
                             dec_capacities.push_back(metrics_dec_capacity);
                             client_ids.push_back(client_id);
                             segment_names.push_back(seg.name);
+                            if (keep_persistent_replicas_ &&
+                                seg.memory_id != UUID{0, 0}) {
+                                parking.push_back(seg);
+                            }
                         } else {
                             LOG(ERROR) << "client_id=" << client_id
                                        << ", segment_name=" << seg.name
@@ -962,7 +4976,7 @@ void MasterService::ClientMonitorFunc() {
                // avoid deadlocks
 
             if (!unmount_segments.empty()) {
-                ClearInvalidHandles();
+                ClearInvalidHandles(parking);
 
                 ScopedSegmentAccess segment_access =
                     segment_manager_.getSegmentAccess();
@@ -0,0 +1,64 @@
+#include "metadata_change_log.h"
+
+namespace mooncake {
+
+MetadataChangeLog::MetadataChangeLog(size_t capacity) : capacity_(capacity) {}
+
+void MetadataChangeLog::Enable() {
+    if (enabled()) {
+        return;
+    }
+    MutexLocker lock(&mutex_);
+    if (!enabled_.load(std::memory_order_relaxed)) {
+        reset_seq_ = ++seq_;
+        enabled_.store(true, std::memory_order_relaxed);
+    }
+}
+
+void MetadataChangeLog::Record(std::string_view key) {
+    if (!enabled()) {
+        return;
+    }
+    MutexLocker lock(&mutex_);
+    changes_.emplace_back(++seq_, key);
+    if (changes_.size() > capacity_) {
+        changes_.pop_front();
+    }
+}
+
+void MetadataChangeLog::Reset() {
+    if (!enabled()) {
+        return;
+    }
+    MutexLocker lock(&mutex_);
+    changes_.clear();
+    reset_seq_ = ++seq_;
+}
+
+bool MetadataChangeLog::Since(uint64_t seq, size_t max_keys,
+                              std::vector<std::string>& keys,
+                              uint64_t& next_seq) const {
+    MutexLocker lock(&mutex_);
+    // After a trim the oldest kept change must directly follow seq. A seq
+    // ahead of this log comes from another master.
+    if (!enabled() || seq < reset_seq_ || seq > seq_ ||
+        (!changes_.empty() && changes_.front().first > seq + 1)) {
+        next_seq = seq_;
+        return false;
+    }
+    // Sequence numbers are consecutive since the last reset
+    auto it = changes_.end() - (seq_ - seq);
+    next_seq = seq;
+    for (; it != changes_.end() && keys.size() < max_keys; ++it) {
+        keys.push_back(it->second);
+        next_seq = it->first;
+    }
+    return true;
+}
+
+uint64_t MetadataChangeLog::seq() const {
+    MutexLocker lock(&mutex_);
+    return seq_;
+}
+
+}  // namespace mooncake
@@ -0,0 +1,267 @@
+#include "metadata_follower.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <mutex>
+#include <utility>
+
+namespace mooncake {
+
+MetadataFollower::MetadataFollower(std::string master_address,
+                                   std::chrono::milliseconds max_staleness)
+    : master_address_(std::move(master_address)),
+      max_staleness_(max_staleness) {}
+
+MetadataFollower::~MetadataFollower() { Stop(); }
+
+void MetadataFollower::Start() {
+    if (running_.exchange(true)) {
+        return;
+    }
+    sync_thread_ = std::thread(&MetadataFollower::SyncThreadFunc, this);
+    LOG(INFO) << "action=follower_started, master=" << master_address_
+              << ", max_staleness_ms=" << max_staleness_.count();
+}
+
+void MetadataFollower::Stop() {
+    running_ = false;
+    if (sync_thread_.joinable()) {
+        sync_thread_.join();
+    }
+}
+
+tl::expected<std::vector<Replica::Descriptor>, ErrorCode>
+MetadataFollower::Lookup(const std::string& key, bool need_lease) {
+    auto& shard = ShardOf(key);
+    std::shared_lock lock(shard.mutex);
+    auto it = shard.entries.find(key);
+    if (it == shard.entries.end()) {
+        if (!Fresh()) {
+            return tl::make_unexpected(ErrorCode::RPC_FAIL);
+        }
+        return tl::make_unexpected(ErrorCode::OBJECT_NOT_FOUND);
+    }
+    Entry& entry = it->second;
+    const std::chrono::milliseconds ttl(
+        lease_ttl_ms_.load(std::memory_order_relaxed));
+    const auto left =
+        Clock::duration(entry.lease_until.load(std::memory_order_relaxed)) -
+        Clock::now().time_since_epoch();
+    if (left < ttl * 3 / 4) {
+        RequestLease(key, entry);
+    }
+    if (need_lease && (ttl.count() == 0 || left < ttl / 2)) {
+        return tl::make_unexpected(ErrorCode::RPC_FAIL);
+    }
+    return entry.replicas;
+}
+
+void MetadataFollower::RequestLease(const std::string& key, Entry& entry) {
+    if (entry.lease_pending.exchange(true, std::memory_order_relaxed)) {
+        return;
+    }
+    MutexLocker lock(&lease_mutex_);
+    lease_requests_.push_back(key);
+}
+
+bool MetadataFollower::Fresh() const {
+    const auto synced_at =
+        Clock::time_point(Clock::duration(synced_at_.load()));
+    return synced_at.time_since_epoch().count() != 0 &&
+           Clock::now() - synced_at <= max_staleness_;
+}
+
+tl::expected<bool, ErrorCode> MetadataFollower::ExistKey(
+    const std::string& key) {
+    auto replicas = Lookup(key, false);
+    if (replicas) {
+        return true;
+    }
+    if (replicas.error() == ErrorCode::OBJECT_NOT_FOUND) {
+        return false;
+    }
+    return tl::make_unexpected(replicas.error());
+}
+
+std::vector<tl::expected<bool, ErrorCode>> MetadataFollower::BatchExistKey(
+    const std::vector<std::string>& keys) {
+    std::vector<tl::expected<bool, ErrorCode>> results;
+    results.reserve(keys.size());
+    for (const auto& key : keys) {
+        results.emplace_back(ExistKey(key));
+    }
+    return results;
+}
+
+tl::expected<std::vector<Replica::Descriptor>, ErrorCode>
+MetadataFollower::GetReplicaList(const std::string& key) {
+    return Lookup(key, true);
+}
+
+std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+MetadataFollower::BatchGetReplicaList(const std::vector<std::string>& keys) {
+    std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+        results;
+    results.reserve(keys.size());
+    for (const auto& key : keys) {
+        results.emplace_back(Lookup(key, true));
+    }
+    return results;
+}
+
+size_t MetadataFollower::size() const {
+    size_t size = 0;
+    for (const auto& shard : shards_) {
+        std::shared_lock lock(shard.mutex);
+        size += shard.entries.size();
+    }
+    return size;
+}
+
+std::optional<std::vector<MetadataEntry>> MetadataFollower::Export(
+    Clock::duration max_lag) {
+    const auto synced_at =
+        Clock::time_point(Clock::duration(synced_at_.load()));
+    if (synced_at.time_since_epoch().count() == 0 ||
+        Clock::now() - synced_at > max_lag) {
+        LOG(WARNING) << "action=follower_export_skipped, master="
+                     << master_address_ << ", reason=copy_too_old";
+        return std::nullopt;
+    }
+    std::vector<MetadataEntry> entries;
+    entries.reserve(size());
+    for (auto& shard : shards_) {
+        std::unique_lock lock(shard.mutex);
+        for (auto& [key, entry] : shard.entries) {
+            entries.push_back({key, std::move(entry.replicas)});
+        }
+        shard.entries.clear();
+    }
+    return entries;
+}
+
+void MetadataFollower::SyncThreadFunc() {
+    while (running_) {
+        if (!Sync()) {
+            connected_ = false;
+        }
+        GrantLeases();
+        std::this_thread::sleep_for(kPollInterval);
+    }
+}
+
+bool MetadataFollower::Sync() {
+    if (!connected_) {
+        if (master_.Connect(master_address_) != ErrorCode::OK) {
+            return false;
+        }
+        auto info = master_.GetReplicaCacheInfo();
+        if (!info) {
+            return false;
+        }
+        lease_ttl_ms_ = info->lease_ttl_ms;
+        connected_ = true;
+    }
+    while (running_) {
+        const auto request_start = Clock::now();
+        auto changes = master_.GetMetadataChanges(seq_, kMaxChangesPerPoll);
+        if (!changes) {
+            return false;
+        }
+        if (changes->reset) {
+            LOG(INFO) << "action=follower_resync, master=" << master_address_
+                      << ", seq=" << seq_ << ", next_seq=" << changes->next_seq;
+            seq_ = changes->next_seq;
+            if (!Resync()) {
+                // Sequence 0 always asks for a reset
+                seq_ = 0;
+                return false;
+            }
+            continue;
+        }
+        seq_ = changes->next_seq;
+        const bool caught_up = changes->entries.size() < kMaxChangesPerPoll;
+        Apply(changes->entries);
+        if (caught_up) {
+            synced_at_ = request_start.time_since_epoch().count();
+            break;
+        }
+    }
+    return true;
+}
+
+bool MetadataFollower::Resync() {
+    // Nothing is served until the copy is complete again
+    synced_at_ = 0;
+    Clear();
+    uint64_t shard = 0;
+    do {
+        auto snapshot = master_.GetMetadataSnapshot(shard);
+        if (!snapshot) {
+            LOG(ERROR) << "action=follower_resync_failed, shard=" << shard
+                       << ", error=" << snapshot.error();
+            return false;
+        }
+        Apply(snapshot->entries);
+        shard = snapshot->next_shard;
+    } while (shard != 0 && running_);
+    LOG(INFO) << "action=follower_resync_done, objects=" << size();
+    return true;
+}
+
+void MetadataFollower::Apply(std::vector<MetadataEntry>& entries) {
+    for (auto& change : entries) {
+        auto& shard = ShardOf(change.key);
+        std::unique_lock lock(shard.mutex);
+        if (change.replicas.empty()) {
+            shard.entries.erase(change.key);
+            continue;
+        }
+        auto [it, inserted] = shard.entries.try_emplace(change.key);
+        it->second.replicas = std::move(change.replicas);
+    }
+}
+
+void MetadataFollower::Clear() {
+    for (auto& shard : shards_) {
+        std::unique_lock lock(shard.mutex);
+        shard.entries.clear();
+    }
+}
+
+void MetadataFollower::GrantLeases() {
+    std::vector<std::string> keys;
+    {
+        MutexLocker lock(&lease_mutex_);
+        keys.swap(lease_requests_);
+    }
+    for (size_t begin = 0; begin < keys.size(); begin += kMaxLeaseBatch) {
+        const size_t end = std::min(keys.size(), begin + kMaxLeaseBatch);
+        std::vector<std::string> batch(keys.begin() + begin,
+                                       keys.begin() + end);
+        // The master grants the lease after the request was sent
+        const auto lease_until =
+            (Clock::now() + std::chrono::milliseconds(lease_ttl_ms_.load()))
+                .time_since_epoch()
+                .count();
+        auto results = connected_ ? master_.BatchExistKey(batch)
+                                  : std::vector<tl::expected<bool, ErrorCode>>(
+                                        batch.size(), false);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            auto& shard = ShardOf(batch[i]);
+            std::shared_lock lock(shard.mutex);
+            auto it = shard.entries.find(batch[i]);
+            if (it == shard.entries.end()) {
+                continue;
+            }
+            if (i < results.size() && results[i] && *results[i]) {
+                it->second.lease_until.store(lease_until,
+                                             std::memory_order_relaxed);
+            }
+            it->second.lease_pending.store(false, std::memory_order_relaxed);
+        }
+    }
+}
+
+}  // namespace mooncake
@@ -0,0 +1,184 @@
+#include "namespace_table.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <charconv>
+
+namespace mooncake {
+
+namespace {
+
+std::string_view Trim(std::string_view text) {
+    const auto begin = text.find_first_not_of(" \t");
+    if (begin == std::string_view::npos) {
+        return {};
+    }
+    const auto end = text.find_last_not_of(" \t");
+    return text.substr(begin, end - begin + 1);
+}
+
+}  // namespace
+
+bool NamespaceConfig::ParseQuotas(std::string_view spec) {
+    while (!Trim(spec).empty()) {
+        const auto comma = spec.find(',');
+        std::string_view entry = Trim(spec.substr(0, comma));
+        spec = comma == std::string_view::npos ? std::string_view()
+                                               : spec.substr(comma + 1);
+
+        const auto colon = entry.find(':');
+        if (colon == std::string_view::npos || colon == 0) {
+            LOG(ERROR) << "namespace_quota=" << entry
+                       << ", error=invalid_namespace_quota";
+            return false;
+        }
+        std::string_view name = Trim(entry.substr(0, colon));
+        std::string_view rest = entry.substr(colon + 1);
+        const auto weight_colon = rest.find(':');
+        std::string_view capacity_text = Trim(rest.substr(0, weight_colon));
+
+        NamespaceQuota quota;
+        auto [end, ec] =
+            std::from_chars(capacity_text.data(),
+                            capacity_text.data() + capacity_text.size(),
+                            quota.capacity);
+        bool valid = ec == std::errc() &&
+                     end == capacity_text.data() + capacity_text.size();
+        if (valid && weight_colon != std::string_view::npos) {
+            const std::string weight_text(
+                Trim(rest.substr(weight_colon + 1)));
+            try {
+                size_t parsed = 0;
+                quota.weight = std::stod(weight_text, &parsed);
+                valid = parsed == weight_text.size() && quota.weight > 0;
+            } catch (const std::exception&) {
+                valid = false;
+            }
+        }
+        if (!valid || name.empty()) {
+            LOG(ERROR) << "namespace_quota=" << entry
+                       << ", error=invalid_namespace_quota";
+            return false;
+        }
+        quotas[std::string(name)] = quota;
+    }
+    return true;
+}
+
+NamespaceTable::NamespaceTable(const NamespaceConfig& config)
+    : delimiter_(config.delimiter) {
+    if (!enabled()) {
+        return;
+    }
+    auto add = [this](std::string_view name, const NamespaceQuota& quota) {
+        auto usage = std::make_unique<Usage>();
+        usage->name_ = std::string(name);
+        usage->index_ = usages_.size();
+        usage->quota_ = quota;
+        by_name_.emplace(usage->name_, usage.get());
+        usages_.push_back(std::move(usage));
+    };
+    // The default namespace comes first, then the others by name
+    auto it = config.quotas.find(std::string(kDefaultNamespace));
+    add(kDefaultNamespace,
+        it == config.quotas.end() ? NamespaceQuota{} : it->second);
+    default_ = usages_.front().get();
+
+    std::vector<std::string_view> names;
+    for (const auto& [name, quota] : config.quotas) {
+        if (name != kDefaultNamespace) {
+            names.push_back(name);
+        }
+    }
+    std::sort(names.begin(), names.end());
+    for (std::string_view name : names) {
+        add(name, config.quotas.at(std::string(name)));
+    }
+
+    for (const auto& usage : usages_) {
+        LOG(INFO) << "namespace=" << usage->name_
+                  << ", capacity=" << usage->quota_.capacity
+                  << ", weight=" << usage->quota_.weight;
+    }
+}
+
+NamespaceTable::Usage* NamespaceTable::Find(std::string_view key) const {
+    if (!enabled()) {
+        return nullptr;
+    }
+    const auto end = key.find(delimiter_);
+    if (end == std::string_view::npos) {
+        return default_;
+    }
+    auto it = by_name_.find(key.substr(0, end));
+    return it == by_name_.end() ? default_ : it->second;
+}
+
+std::vector<std::string> NamespaceTable::Names() const {
+    std::vector<std::string> names;
+    names.reserve(usages_.size());
+    for (const auto& usage : usages_) {
+        names.push_back(usage->name_);
+    }
+    return names;
+}
+
+uint64_t NamespaceTable::UpdateShares(uint64_t space,
+                                      double watermark_ratio) {
+    // What each namespace would use without contention: its usage up to
+    // its capacity
+    struct Claim {
+        Usage* usage;
+        double demand;
+    };
+    std::vector<Claim> unsettled;
+    for (const auto& usage : usages_) {
+        double demand = static_cast<double>(usage->bytes());
+        if (usage->quota_.capacity > 0) {
+            demand = std::min(
+                demand, usage->quota_.capacity * watermark_ratio);
+        }
+        unsettled.push_back({usage.get(), demand});
+    }
+
+    // Settle the namespaces that want less than their weighted part of the
+    // space left, until all that remain want more
+    double left = static_cast<double>(space);
+    while (!unsettled.empty()) {
+        double weights = 0;
+        for (const auto& claim : unsettled) {
+            weights += claim.usage->quota_.weight;
+        }
+        const double per_weight = left / weights;
+        double settled = 0;
+        const size_t count = unsettled.size();
+        std::erase_if(unsettled, [&](const Claim& claim) {
+            if (claim.demand > per_weight * claim.usage->quota_.weight) {
+                return false;
+            }
+            claim.usage->share_.store(static_cast<uint64_t>(claim.demand),
+                                      std::memory_order_relaxed);
+            settled += claim.demand;
+            return true;
+        });
+        if (unsettled.size() == count) {
+            for (const auto& claim : unsettled) {
+                claim.usage->share_.store(
+                    static_cast<uint64_t>(per_weight *
+                                          claim.usage->quota_.weight),
+                    std::memory_order_relaxed);
+            }
+            break;
+        }
+        left -= settled;
+    }
+
+    uint64_t excess = 0;
+    for (const auto& usage : usages_) {
+        excess += usage->excess();
+    }
+    return excess;
+}
+
+}  // namespace mooncake
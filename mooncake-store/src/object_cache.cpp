@@ -0,0 +1,150 @@
+#include "object_cache.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace mooncake {
+
+namespace {
+// Keys whose reads are counted per entry the cache can hold on average
+constexpr size_t kReadCountsPerEntry = 4;
+constexpr size_t kMinReadCounts = 1024;
+}  // namespace
+
+ObjectCache::ObjectCache(size_t capacity_bytes, uint32_t admit_reads)
+    : capacity_bytes_(capacity_bytes),
+      admit_reads_(std::max<uint32_t>(admit_reads, 1)) {}
+
+bool ObjectCache::Get(const ObjectKey& key, std::vector<Slice>& slices) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    if (it == entries_.end()) {
+        misses_++;
+        return false;
+    }
+    if (it->second.expiry <= Clock::now()) {
+        Erase(it);
+        misses_++;
+        return false;
+    }
+    const auto& value = it->second.value;
+    size_t total = 0;
+    for (const auto& slice : slices) {
+        total += slice.size;
+    }
+    if (total != value.size()) {
+        misses_++;
+        return false;
+    }
+    size_t offset = 0;
+    for (auto& slice : slices) {
+        std::memcpy(slice.ptr, value.data() + offset, slice.size);
+        offset += slice.size;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second.lru_it);
+    hits_++;
+    return true;
+}
+
+void ObjectCache::Put(const ObjectKey& key, const std::vector<Slice>& slices,
+                      Clock::time_point expiry, uint64_t generation) {
+    size_t total = 0;
+    for (const auto& slice : slices) {
+        total += slice.size;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (generation != generation_ || expiry <= Clock::now() || total == 0 ||
+        total > capacity_bytes_) {
+        return;
+    }
+    auto it = entries_.find(key);
+    if (it == entries_.end() && !CountRead(key)) {
+        return;
+    }
+    if (it != entries_.end()) {
+        Erase(it);
+    }
+    while (size_bytes_ + total > capacity_bytes_) {
+        Erase(entries_.find(lru_.back()));
+    }
+    std::string value;
+    value.reserve(total);
+    for (const auto& slice : slices) {
+        value.append(static_cast<const char*>(slice.ptr), slice.size);
+    }
+    lru_.push_front(key);
+    entries_.emplace(key, Entry{std::move(value), expiry, lru_.begin()});
+    size_bytes_ += total;
+}
+
+void ObjectCache::Invalidate(const ObjectKey& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+        Erase(it);
+    }
+}
+
+void ObjectCache::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    lru_.clear();
+    size_bytes_ = 0;
+    read_counts_.clear();
+    generation_++;
+}
+
+uint64_t ObjectCache::generation() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return generation_;
+}
+
+size_t ObjectCache::size_bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return size_bytes_;
+}
+
+uint64_t ObjectCache::hits() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hits_;
+}
+
+uint64_t ObjectCache::misses() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return misses_;
+}
+
+void ObjectCache::Erase(std::unordered_map<ObjectKey, Entry>::iterator it) {
+    size_bytes_ -= it->second.value.size();
+    lru_.erase(it->second.lru_it);
+    entries_.erase(it);
+}
+
+bool ObjectCache::CountRead(const ObjectKey& key) {
+    auto& count = read_counts_[key];
+    if (++count >= admit_reads_) {
+        read_counts_.erase(key);
+        return true;
+    }
+    const size_t limit =
+        std::max(kMinReadCounts, kReadCountsPerEntry * entries_.size());
+    if (read_counts_.size() > limit) {
+        // Age the counts so that keys read long ago are forgotten
+        for (auto count_it = read_counts_.begin();
+             count_it != read_counts_.end();) {
+            count_it->second /= 2;
+            if (count_it->second == 0) {
+                count_it = read_counts_.erase(count_it);
+            } else {
+                ++count_it;
+            }
+        }
+        VLOG(1) << "action=near_cache_read_counts_aged remaining="
+                << read_counts_.size();
+    }
+    return false;
+}
+
+}  // namespace mooncake
@@ -4,6 +4,7 @@
 #include "offset_allocator/offset_allocator.hpp"
 
 #include "mutex.h"
+#include <atomic>
 #include <iostream>
 
 #ifdef DEBUG
@@ -276,6 +277,75 @@ OffsetAllocation __Allocator::allocate(uint32 size) {
     return {.offset = node.dataOffset, .metadata = nodeIndex};
 }
 
+OffsetAllocation __Allocator::allocateAt(uint32 offset, uint32 size) {
+    // The free region is split in up to three nodes
+    if (m_freeOffset < 3 || size == 0) {
+        return {.offset = OffsetAllocation::NO_SPACE,
+                .metadata = OffsetAllocation::NO_SPACE};
+    }
+#ifdef OFFSET_ALLOCATOR_NOT_ROUND_UP
+    uint32 roundupSize = size;
+#else
+    // Rounded up like allocate(), so that the block is a full bin
+    uint32 roundupSize =
+        SmallFloat::floatToUint(SmallFloat::uintToFloatRoundUp(size));
+#endif
+    const uint64_t end = (uint64_t)offset + roundupSize;
+
+    // Find the free region holding the range
+    uint32 regionIndex = Node::unused;
+    for (uint32 i = 0; i < NUM_LEAF_BINS && regionIndex == Node::unused;
+         i++) {
+        for (uint32 nodeIndex = m_binIndices[i]; nodeIndex != Node::unused;
+             nodeIndex = m_nodes[nodeIndex].binListNext) {
+            const Node& node = m_nodes[nodeIndex];
+            if (node.dataOffset <= offset &&
+                end <= (uint64_t)node.dataOffset + node.dataSize) {
+                regionIndex = nodeIndex;
+                break;
+            }
+        }
+    }
+    if (regionIndex == Node::unused) {
+        return {.offset = OffsetAllocation::NO_SPACE,
+                .metadata = OffsetAllocation::NO_SPACE};
+    }
+
+    const Node region = m_nodes[regionIndex];
+    removeNodeFromBin(regionIndex);
+
+    uint32 nodeIndex = m_freeNodes[m_freeOffset--];
+    m_nodes[nodeIndex] = {.dataOffset = offset,
+                          .dataSize = roundupSize,
+                          .used = true};
+
+    // Free the parts of the region before and after the range
+    uint32 prevIndex = region.neighborPrev;
+    if (offset > region.dataOffset) {
+        uint32 headIndex =
+            insertNodeIntoBin(offset - region.dataOffset, region.dataOffset);
+        m_nodes[headIndex].neighborPrev = prevIndex;
+        if (prevIndex != Node::unused)
+            m_nodes[prevIndex].neighborNext = headIndex;
+        prevIndex = headIndex;
+    }
+    uint32 nextIndex = region.neighborNext;
+    const uint64_t regionEnd = (uint64_t)region.dataOffset + region.dataSize;
+    if (end < regionEnd) {
+        uint32 tailIndex = insertNodeIntoBin(regionEnd - end, end);
+        m_nodes[tailIndex].neighborNext = nextIndex;
+        if (nextIndex != Node::unused)
+            m_nodes[nextIndex].neighborPrev = tailIndex;
+        nextIndex = tailIndex;
+    }
+    m_nodes[nodeIndex].neighborPrev = prevIndex;
+    if (prevIndex != Node::unused) m_nodes[prevIndex].neighborNext = nodeIndex;
+    m_nodes[nodeIndex].neighborNext = nextIndex;
+    if (nextIndex != Node::unused) m_nodes[nextIndex].neighborPrev = nodeIndex;
+
+    return {.offset = offset, .metadata = nodeIndex};
+}
+
 void __Allocator::free(OffsetAllocation allocation) {
     ASSERT(allocation.metadata != OffsetAllocation::NO_SPACE);
     if (!m_nodes) return;
@@ -494,7 +564,7 @@ OffsetAllocationHandle& OffsetAllocationHandle::operator=(
         // Free current allocation if valid{
         auto allocator = m_allocator.lock();
         if (allocator) {
-            allocator->freeAllocation(m_allocation);
+            allocator->freeAllocation(m_allocation, requested_size);
         }
 
         // Move from other
@@ -514,10 +584,19 @@ OffsetAllocationHandle& OffsetAllocationHandle::operator=(
 OffsetAllocationHandle::~OffsetAllocationHandle() {
     auto allocator = m_allocator.lock();
     if (allocator) {
-        allocator->freeAllocation(m_allocation);
+        allocator->freeAllocation(m_allocation, requested_size);
     }
 }
 
+OffsetAllocation OffsetAllocationHandle::release() {
+    OffsetAllocation allocation = m_allocation;
+    m_allocator.reset();
+    m_allocation = {OffsetAllocation::NO_SPACE, OffsetAllocation::NO_SPACE};
+    real_base = 0;
+    requested_size = 0;
+    return allocation;
+}
+
 // Helper function to calculate the multiplier
 static uint64_t calculateMultiplier(size_t size) {
     uint64_t multiplier = 1;
@@ -527,24 +606,55 @@ static uint64_t calculateMultiplier(size_t size) {
 }
 
 // Thread-safe OffsetAllocator implementation
-std::shared_ptr<OffsetAllocator> OffsetAllocator::create(uint64_t base, size_t size,
-                                             uint32 maxAllocs) {
+std::shared_ptr<OffsetAllocator> OffsetAllocator::create(
+    uint64_t base, size_t size, uint32 maxAllocs, bool enableThreadCache) {
     // Use a custom deleter to allow private constructor
-    return std::shared_ptr<OffsetAllocator>(new OffsetAllocator(base, size, maxAllocs));
+    return std::shared_ptr<OffsetAllocator>(
+        new OffsetAllocator(base, size, maxAllocs, enableThreadCache));
 }
 
-OffsetAllocator::OffsetAllocator(uint64_t base, size_t size, uint32 maxAllocs)
+OffsetAllocator::OffsetAllocator(uint64_t base, size_t size, uint32 maxAllocs,
+                                 bool enableThreadCache)
     : m_base(base), m_multiplier(calculateMultiplier(size)) {
     m_allocator = std::make_unique<__Allocator>(size / m_multiplier, maxAllocs);
+#ifndef OFFSET_ALLOCATOR_NOT_ROUND_UP
+    // A cached block serves any size of its bin only if allocations are
+    // rounded up to the bin size
+    if (enableThreadCache) {
+        m_threadCaches = std::make_unique<ThreadCache[]>(kThreadCaches);
+    }
+#endif
 }
 
-std::optional<OffsetAllocationHandle> OffsetAllocator::allocate(size_t size) {
-    if (size == 0) {
-        return std::nullopt;
+OffsetAllocator::ThreadCache& OffsetAllocator::threadCache() {
+    // Threads are spread over the caches in the order they first use one
+    static std::atomic<uint32> nextThread{0};
+    thread_local const uint32 threadIndex = nextThread.fetch_add(1);
+    return m_threadCaches[threadIndex % kThreadCaches];
+}
+
+bool OffsetAllocator::drainThreadCaches() {
+    std::vector<OffsetAllocation> blocks;
+    for (uint32 i = 0; i < kThreadCaches; i++) {
+        ThreadCache& cache = m_threadCaches[i];
+        MutexLocker guard(&cache.mutex);
+        for (auto& bin : cache.bins) {
+            blocks.insert(blocks.end(), bin.begin(), bin.end());
+            bin.clear();
+        }
     }
+    if (blocks.empty()) {
+        return false;
+    }
+    MutexLocker lock(&m_mutex);
+    for (const auto& block : blocks) {
+        m_allocator->free(block);
+    }
+    return true;
+}
 
-    MutexLocker guard(&m_mutex);
-    if (!m_allocator) {
+std::optional<OffsetAllocationHandle> OffsetAllocator::allocate(size_t size) {
+    if (size == 0) {
         return std::nullopt;
     }
 
@@ -555,7 +665,33 @@ std::optional<OffsetAllocationHandle> OffsetAllocator::allocate(size_t size) {
         return std::nullopt;
     }
 
-    OffsetAllocation allocation = m_allocator->allocate(fake_size);
+    if (m_threadCaches && fake_size <= kMaxCachedSize) {
+        ThreadCache& cache = threadCache();
+        MutexLocker guard(&cache.mutex);
+        auto& blocks = cache.bins[SmallFloat::uintToFloatRoundUp(fake_size)];
+        if (!blocks.empty()) {
+            OffsetAllocation allocation = blocks.back();
+            blocks.pop_back();
+            return OffsetAllocationHandle(
+                shared_from_this(), allocation,
+                m_base + allocation.offset * m_multiplier, size);
+        }
+    }
+
+    OffsetAllocation allocation;
+    {
+        MutexLocker guard(&m_mutex);
+        if (!m_allocator) {
+            return std::nullopt;
+        }
+        allocation = m_allocator->allocate(fake_size);
+    }
+    // The space may be held by the caches
+    if (allocation.offset == OffsetAllocation::NO_SPACE && m_threadCaches &&
+        drainThreadCaches()) {
+        MutexLocker guard(&m_mutex);
+        allocation = m_allocator->allocate(fake_size);
+    }
     if (allocation.offset == OffsetAllocation::NO_SPACE) {
         return std::nullopt;
     }
@@ -566,6 +702,48 @@ std::optional<OffsetAllocationHandle> OffsetAllocator::allocate(size_t size) {
                             size);
 }
 
+OffsetAllocationHandle OffsetAllocator::adopt(OffsetAllocation allocation,
+                                              size_t size) {
+    return OffsetAllocationHandle(shared_from_this(), allocation,
+                                  m_base + allocation.offset * m_multiplier,
+                                  size);
+}
+
+std::optional<OffsetAllocationHandle> OffsetAllocator::allocateAt(
+    uint64_t address, size_t size) {
+    if (size == 0 || address < m_base ||
+        (address - m_base) % m_multiplier != 0) {
+        return std::nullopt;
+    }
+    const uint64_t fake_offset = (address - m_base) / m_multiplier;
+    size_t fake_size =
+        m_multiplier > 1 ? (size + m_multiplier - 1) / m_multiplier : size;
+    if (fake_size > SmallFloat::MAX_BIN_SIZE ||
+        fake_offset > OffsetAllocation::NO_SPACE - 1) {
+        return std::nullopt;
+    }
+
+    OffsetAllocation allocation;
+    {
+        MutexLocker guard(&m_mutex);
+        if (!m_allocator) {
+            return std::nullopt;
+        }
+        allocation = m_allocator->allocateAt(fake_offset, fake_size);
+    }
+    // The range may be held by the caches
+    if (allocation.offset == OffsetAllocation::NO_SPACE && m_threadCaches &&
+        drainThreadCaches()) {
+        MutexLocker guard(&m_mutex);
+        allocation = m_allocator->allocateAt(fake_offset, fake_size);
+    }
+    if (allocation.offset == OffsetAllocation::NO_SPACE) {
+        return std::nullopt;
+    }
+    return OffsetAllocationHandle(shared_from_this(), allocation, address,
+                                  size);
+}
+
 OffsetAllocStorageReport OffsetAllocator::storageReport() const {
     MutexLocker guard(&m_mutex);
     if (!m_allocator) {
@@ -590,7 +768,33 @@ OffsetAllocStorageReportFull OffsetAllocator::storageReportFull() const {
     return report;
 }
 
-void OffsetAllocator::freeAllocation(const OffsetAllocation& allocation) {
+void OffsetAllocator::freeAllocation(const OffsetAllocation& allocation,
+                                     uint64_t size) {
+    size_t fake_size =
+        m_multiplier > 1 ? (size + m_multiplier - 1) / m_multiplier : size;
+    if (m_threadCaches && fake_size <= kMaxCachedSize) {
+        std::vector<OffsetAllocation> overflow;
+        {
+            ThreadCache& cache = threadCache();
+            MutexLocker guard(&cache.mutex);
+            auto& blocks =
+                cache.bins[SmallFloat::uintToFloatRoundUp(fake_size)];
+            blocks.push_back(allocation);
+            if (blocks.size() <= kCachedBlocksPerBin) {
+                return;
+            }
+            // Return the oldest half in one batch
+            const size_t count = blocks.size() / 2;
+            overflow.assign(blocks.begin(), blocks.begin() + count);
+            blocks.erase(blocks.begin(), blocks.begin() + count);
+        }
+        MutexLocker lock(&m_mutex);
+        for (const auto& block : overflow) {
+            m_allocator->free(block);
+        }
+        return;
+    }
+
     MutexLocker lock(&m_mutex);
     if (m_allocator) {
         m_allocator->free(allocation);
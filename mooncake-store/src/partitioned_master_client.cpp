@@ -0,0 +1,896 @@
+#include "partitioned_master_client.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <charconv>
+#include <future>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace mooncake {
+
+PartitionedMasterClient::PartitionedMasterClient() {
+    partitions_.push_back(std::make_unique<MasterClient>());
+}
+
+PartitionedMasterClient::~PartitionedMasterClient() = default;
+
+size_t PartitionedMasterClient::PartitionOf(const std::string& key,
+                                            size_t partition_num) {
+    if (partition_num <= 1) {
+        return 0;
+    }
+    // FNV-1a, std::hash may differ between the standard libraries of clients
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash % partition_num;
+}
+
+std::vector<Segment> PartitionedMasterClient::SplitSegment(
+    const Segment& segment, size_t partition_num) {
+    if (partition_num <= 1) {
+        return {segment};
+    }
+    const size_t alignment = facebook::cachelib::Slab::kSize;
+    const size_t part_size = segment.size / partition_num / alignment *
+                             alignment;
+    if (part_size == 0) {
+        return {};
+    }
+    std::vector<Segment> parts(partition_num, segment);
+    for (size_t i = 0; i < partition_num; ++i) {
+        parts[i].base = segment.base + i * part_size;
+        parts[i].size = part_size;
+    }
+    return parts;
+}
+
+ErrorCode PartitionedMasterClient::Connect(
+    const std::vector<std::string>& master_addrs) {
+    if (master_addrs.empty()) {
+        LOG(ERROR) << "No master address given";
+        return ErrorCode::INVALID_PARAMS;
+    }
+    if (master_addrs.size() != partitions_.size()) {
+        partitions_.clear();
+        for (size_t i = 0; i < master_addrs.size(); ++i) {
+            partitions_.push_back(std::make_unique<MasterClient>());
+            if (coalesce_window_.count() > 0) {
+                partitions_.back()->EnableCoalescing(coalesce_window_,
+                                                     coalesce_max_keys_);
+            }
+            if (use_rdma_) {
+                partitions_.back()->EnableRdma();
+            }
+            if (connection_num_ > 1) {
+                partitions_.back()->SetConnections(connection_num_,
+                                                   connection_selection_);
+            }
+        }
+    }
+    for (size_t i = 0; i < master_addrs.size(); ++i) {
+        auto err = partitions_[i]->Connect(master_addrs[i]);
+        if (err != ErrorCode::OK) {
+            LOG(ERROR) << "Failed to connect to the master of partition " << i
+                       << ": " << master_addrs[i];
+            return err;
+        }
+    }
+    if (partitions_.size() > 1) {
+        LOG(INFO) << "master_partitions=" << partitions_.size();
+    }
+    return ErrorCode::OK;
+}
+
+ErrorCode PartitionedMasterClient::Connect(size_t partition,
+                                           const std::string& master_addr) {
+    if (partition >= partitions_.size()) {
+        LOG(ERROR) << "Invalid partition " << partition << ", there are "
+                   << partitions_.size();
+        return ErrorCode::INVALID_PARAMS;
+    }
+    return partitions_[partition]->Connect(master_addr);
+}
+
+void PartitionedMasterClient::EnableCoalescing(
+    std::chrono::microseconds window, size_t max_keys) {
+    coalesce_window_ = window;
+    coalesce_max_keys_ = max_keys;
+    for (auto& partition : partitions_) {
+        partition->EnableCoalescing(window, max_keys);
+    }
+}
+
+bool PartitionedMasterClient::EnableRdma() {
+#ifdef YLT_ENABLE_IBV
+    use_rdma_ = true;
+    for (auto& partition : partitions_) {
+        partition->EnableRdma();
+    }
+    return true;
+#else
+    LOG(WARNING) << "Built without USE_RPC_RDMA, master RPCs stay on TCP";
+    return false;
+#endif
+}
+
+void PartitionedMasterClient::SetConnections(
+    size_t connection_num, MasterClient::ConnectionSelection selection) {
+    connection_num_ = connection_num;
+    connection_selection_ = selection;
+    for (auto& partition : partitions_) {
+        partition->SetConnections(connection_num, selection);
+    }
+}
+
+void PartitionedMasterClient::SetBusyRetry(
+    int max_retries, std::chrono::microseconds base_backoff) {
+    busy_retries_ = std::max(max_retries, 0);
+    busy_backoff_ = base_backoff;
+}
+
+std::vector<std::vector<int64_t>>
+PartitionedMasterClient::GetInFlightRequests() const {
+    std::vector<std::vector<int64_t>> in_flight;
+    for (const auto& partition : partitions_) {
+        in_flight.push_back(partition->GetInFlightRequests());
+    }
+    return in_flight;
+}
+
+size_t PartitionedMasterClient::EnableFollowers(
+    const std::vector<std::vector<std::string>>& follower_addrs) {
+    if (follower_addrs.size() != partitions_.size()) {
+        LOG(ERROR) << "Followers are listed for " << follower_addrs.size()
+                   << " partitions, but there are " << partitions_.size();
+        return 0;
+    }
+    size_t followers = 0;
+    for (size_t i = 0; i < partitions_.size(); ++i) {
+        followers += partitions_[i]->EnableFollowers(follower_addrs[i]);
+    }
+    return followers;
+}
+
+template <typename T, typename Call>
+std::vector<T> PartitionedMasterClient::SplitBatch(
+    const std::vector<std::string>& keys, Call&& call) {
+    const size_t partition_num = partitions_.size();
+    if (partition_num == 1) {
+        std::vector<size_t> indices(keys.size());
+        for (size_t i = 0; i < keys.size(); ++i) indices[i] = i;
+        return call(*partitions_[0], indices, keys);
+    }
+
+    std::vector<std::vector<size_t>> indices(partition_num);
+    std::vector<std::vector<std::string>> part_keys(partition_num);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        size_t partition = PartitionOf(keys[i], partition_num);
+        indices[partition].push_back(i);
+        part_keys[partition].push_back(keys[i]);
+    }
+
+    // The caller runs the last non-empty part itself
+    std::vector<std::future<std::vector<T>>> futures(partition_num);
+    size_t last = partition_num;
+    for (size_t p = 0; p < partition_num; ++p) {
+        if (!part_keys[p].empty()) last = p;
+    }
+    for (size_t p = 0; p < last; ++p) {
+        if (part_keys[p].empty()) continue;
+        futures[p] = std::async(std::launch::async, [&, p]() {
+            return call(*partitions_[p], indices[p], part_keys[p]);
+        });
+    }
+
+    std::vector<T> results(keys.size(),
+                           tl::make_unexpected(ErrorCode::RPC_FAIL));
+    auto collect = [&](size_t p, std::vector<T> part) {
+        if (part.size() != indices[p].size()) {
+            LOG(ERROR) << "Partition " << p << " returned " << part.size()
+                       << " results for " << indices[p].size() << " keys";
+            return;
+        }
+        for (size_t i = 0; i < part.size(); ++i) {
+            results[indices[p][i]] = std::move(part[i]);
+        }
+    };
+    if (last < partition_num) {
+        collect(last, call(*partitions_[last], indices[last], part_keys[last]));
+    }
+    for (size_t p = 0; p < last; ++p) {
+        if (futures[p].valid()) collect(p, futures[p].get());
+    }
+    return results;
+}
+
+template <typename T>
+static bool IsBusy(const tl::expected<T, ErrorCode>& result) {
+    return !result && result.error() == ErrorCode::MASTER_BUSY;
+}
+
+// A master sheds a batch as a whole
+template <typename T>
+static bool IsBusy(const std::vector<T>& results) {
+    return !results.empty() &&
+           std::all_of(results.begin(), results.end(),
+                       [](const T& result) { return IsBusy(result); });
+}
+
+template <typename Call>
+std::invoke_result_t<Call> PartitionedMasterClient::RetryWhenBusy(
+    Call&& call) {
+    auto result = call();
+    for (int retry = 0; retry < busy_retries_ && IsBusy(result); ++retry) {
+        // Full jitter over an exponentially growing window
+        thread_local std::mt19937_64 generator(std::random_device{}());
+        const int64_t window = busy_backoff_.count() << std::min(retry, 16);
+        std::uniform_int_distribution<int64_t> backoff(0, window);
+        std::this_thread::sleep_for(
+            std::chrono::microseconds(backoff(generator)));
+        result = call();
+    }
+    return result;
+}
+
+tl::expected<bool, ErrorCode> PartitionedMasterClient::ExistKey(
+    const std::string& object_key) {
+    return RetryWhenBusy(
+        [&] { return Route(object_key).ExistKey(object_key); });
+}
+
+std::vector<tl::expected<bool, ErrorCode>>
+PartitionedMasterClient::BatchExistKey(
+    const std::vector<std::string>& object_keys) {
+    return SplitBatch<tl::expected<bool, ErrorCode>>(
+        object_keys,
+        [this](MasterClient& client, const std::vector<size_t>&,
+               const std::vector<std::string>& keys) {
+            return RetryWhenBusy([&] { return client.BatchExistKey(keys); });
+        });
+}
+
+std::vector<tl::expected<void, ErrorCode>> PartitionedMasterClient::BatchTouch(
+    const std::vector<std::string>& object_keys, uint64_t ttl_ms,
+    uint64_t next_use_ms) {
+    return SplitBatch<tl::expected<void, ErrorCode>>(
+        object_keys,
+        [this, ttl_ms, next_use_ms](MasterClient& client,
+                                    const std::vector<size_t>&,
+                                    const std::vector<std::string>& keys) {
+            return RetryWhenBusy([&] {
+                return client.BatchTouch(keys, ttl_ms, next_use_ms);
+            });
+        });
+}
+
+tl::expected<PrefixMatchResult, ErrorCode>
+PartitionedMasterClient::LongestPrefixMatch(
+    const std::vector<std::string>& object_keys, bool with_replicas) {
+    const size_t partition_num = partitions_.size();
+    if (partition_num == 1) {
+        return RetryWhenBusy([&] {
+            return partitions_[0]->LongestPrefixMatch(object_keys,
+                                                      with_replicas);
+        });
+    }
+
+    using PartResult = tl::expected<PrefixMatchResult, ErrorCode>;
+    std::vector<std::vector<std::string>> part_keys(partition_num);
+    std::vector<size_t> partition_of(object_keys.size());
+    for (size_t i = 0; i < object_keys.size(); ++i) {
+        partition_of[i] = PartitionOf(object_keys[i], partition_num);
+        part_keys[partition_of[i]].push_back(object_keys[i]);
+    }
+    std::vector<std::future<PartResult>> futures(partition_num);
+    for (size_t p = 0; p < partition_num; ++p) {
+        if (part_keys[p].empty()) continue;
+        futures[p] = std::async(std::launch::async, [&, p]() {
+            return RetryWhenBusy([&] {
+                return partitions_[p]->LongestPrefixMatch(part_keys[p],
+                                                          with_replicas);
+            });
+        });
+    }
+    std::vector<PartResult> parts(partition_num, PrefixMatchResult{});
+    for (size_t p = 0; p < partition_num; ++p) {
+        if (futures[p].valid()) parts[p] = futures[p].get();
+    }
+
+    // Walk the keys in order, each consumes the next match of its partition
+    PrefixMatchResult result;
+    std::vector<size_t> consumed(partition_num, 0);
+    for (size_t i = 0; i < object_keys.size(); ++i) {
+        auto& part = parts[partition_of[i]];
+        if (!part) {
+            // Keys past a failed partition cannot be told apart from misses
+            if (i == 0) return tl::make_unexpected(part.error());
+            break;
+        }
+        size_t& next = consumed[partition_of[i]];
+        if (next >= part->matched) break;
+        if (with_replicas) {
+            if (next >= part->replica_lists.size()) {
+                return tl::make_unexpected(ErrorCode::RPC_FAIL);
+            }
+            result.replica_lists.push_back(
+                std::move(part->replica_lists[next]));
+        }
+        ++next;
+        ++result.matched;
+    }
+    return result;
+}
+
+tl::expected<KeyLocationResult, ErrorCode>
+PartitionedMasterClient::BatchQueryLocation(
+    const std::vector<std::string>& object_keys, bool with_prefix_hits) {
+    const size_t partition_num = partitions_.size();
+    if (partition_num == 1) {
+        return RetryWhenBusy([&] {
+            return partitions_[0]->BatchQueryLocation(object_keys,
+                                                      with_prefix_hits);
+        });
+    }
+
+    using PartResult = tl::expected<KeyLocationResult, ErrorCode>;
+    std::vector<std::vector<std::string>> part_keys(partition_num);
+    std::vector<size_t> partition_of(object_keys.size());
+    for (size_t i = 0; i < object_keys.size(); ++i) {
+        partition_of[i] = PartitionOf(object_keys[i], partition_num);
+        part_keys[partition_of[i]].push_back(object_keys[i]);
+    }
+    // The prefix hits of a partition only cover its own keys, they are
+    // counted once the locations are merged
+    std::vector<std::future<PartResult>> futures(partition_num);
+    for (size_t p = 0; p < partition_num; ++p) {
+        if (part_keys[p].empty()) continue;
+        futures[p] = std::async(std::launch::async, [&, p]() {
+            return RetryWhenBusy([&] {
+                return partitions_[p]->BatchQueryLocation(part_keys[p],
+                                                          false);
+            });
+        });
+    }
+    std::vector<PartResult> parts(partition_num, KeyLocationResult{});
+    for (size_t p = 0; p < partition_num; ++p) {
+        if (futures[p].valid()) parts[p] = futures[p].get();
+        if (!parts[p]) return tl::make_unexpected(parts[p].error());
+        if (parts[p]->locations.size() != part_keys[p].size()) {
+            return tl::make_unexpected(ErrorCode::RPC_FAIL);
+        }
+    }
+
+    // Partitions share the segments, each name gets one merged index
+    KeyLocationResult result;
+    std::unordered_map<std::string, uint32_t> merged_index;
+    std::vector<std::vector<uint32_t>> remap(partition_num);
+    for (size_t p = 0; p < partition_num; ++p) {
+        for (const auto& name : parts[p]->segments) {
+            auto [it, inserted] =
+                merged_index.emplace(name, result.segments.size());
+            if (inserted) result.segments.push_back(name);
+            remap[p].push_back(it->second);
+        }
+    }
+    result.locations.reserve(object_keys.size());
+    std::vector<size_t> consumed(partition_num, 0);
+    for (size_t i = 0; i < object_keys.size(); ++i) {
+        const size_t p = partition_of[i];
+        auto& location = result.locations.emplace_back(
+            std::move(parts[p]->locations[consumed[p]++]));
+        for (auto& segment : location) {
+            if (segment >= remap[p].size()) {
+                return tl::make_unexpected(ErrorCode::RPC_FAIL);
+            }
+            segment = remap[p][segment];
+        }
+    }
+    if (with_prefix_hits) {
+        result.CountPrefixHits();
+    }
+    return result;
+}
+
+tl::expected<KeyScanResult, ErrorCode> PartitionedMasterClient::ScanKeys(
+    const std::string& prefix, const std::string& cursor, uint64_t limit) {
+    const size_t partition_num = partitions_.size();
+    if (partition_num == 1) {
+        return partitions_[0]->ScanKeys(prefix, cursor, limit);
+    }
+
+    // The cursor is the partition, ':' and the cursor of its master
+    size_t partition = 0;
+    std::string part_cursor;
+    if (!cursor.empty()) {
+        const size_t sep = cursor.find(':');
+        if (sep == std::string::npos) {
+            return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+        }
+        auto [end, ec] =
+            std::from_chars(cursor.data(), cursor.data() + sep, partition);
+        if (ec != std::errc() || end != cursor.data() + sep ||
+            partition >= partition_num) {
+            return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+        }
+        part_cursor = cursor.substr(sep + 1);
+    }
+    auto result = partitions_[partition]->ScanKeys(prefix, part_cursor, limit);
+    if (!result) {
+        return result;
+    }
+    if (!result->next_cursor.empty()) {
+        result->next_cursor =
+            std::to_string(partition) + ":" + result->next_cursor;
+    } else if (partition + 1 < partition_num) {
+        result->next_cursor = std::to_string(partition + 1) + ":";
+    }
+    return result;
+}
+
+tl::expected<std::vector<Replica::Descriptor>, ErrorCode>
+PartitionedMasterClient::GetReplicaList(const std::string& object_key) {
+    return RetryWhenBusy(
+        [&] { return Route(object_key).GetReplicaList(object_key); });
+}
+
+tl::expected<std::vector<Replica::Descriptor>, ErrorCode>
+PartitionedMasterClient::GetLeaderReplicaList(const std::string& object_key) {
+    return RetryWhenBusy(
+        [&] { return Route(object_key).GetLeaderReplicaList(object_key); });
+}
+
+std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+PartitionedMasterClient::BatchGetReplicaList(
+    const std::vector<std::string>& object_keys) {
+    return SplitBatch<
+        tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>(
+        object_keys, [this](MasterClient& client, const std::vector<size_t>&,
+                            const std::vector<std::string>& keys) {
+            return RetryWhenBusy(
+                [&] { return client.BatchGetReplicaList(keys); });
+        });
+}
+
+tl::expected<std::vector<Replica::Descriptor>, ErrorCode>
+PartitionedMasterClient::PutStart(const std::string& key,
+                                  const std::vector<size_t>& slice_lengths,
+                                  const ReplicateConfig& config) {
+    return RetryWhenBusy(
+        [&] { return Route(key).PutStart(key, slice_lengths, config); });
+}
+
+std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+PartitionedMasterClient::BatchPutStart(
+    const std::vector<std::string>& keys,
+    const std::vector<std::vector<uint64_t>>& slice_lengths,
+    const ReplicateConfig& config) {
+    if (partitions_.size() == 1 || slice_lengths.size() != keys.size()) {
+        // The master reports mismatched sizes
+        return RetryWhenBusy([&] {
+            return partitions_[0]->BatchPutStart(keys, slice_lengths, config);
+        });
+    }
+    return SplitBatch<
+        tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>(
+        keys, [&](MasterClient& client, const std::vector<size_t>& indices,
+                  const std::vector<std::string>& part_keys) {
+            std::vector<std::vector<uint64_t>> part_lengths;
+            part_lengths.reserve(indices.size());
+            for (size_t i : indices) part_lengths.push_back(slice_lengths[i]);
+            return RetryWhenBusy([&] {
+                return client.BatchPutStart(part_keys, part_lengths, config);
+            });
+        });
+}
+
+tl::expected<void, ErrorCode> PartitionedMasterClient::PutEnd(
+    const std::string& key) {
+    return Route(key).PutEnd(key);
+}
+
+std::vector<tl::expected<void, ErrorCode>> PartitionedMasterClient::BatchPutEnd(
+    const std::vector<std::string>& keys) {
+    return SplitBatch<tl::expected<void, ErrorCode>>(
+        keys, [](MasterClient& client, const std::vector<size_t>&,
+                 const std::vector<std::string>& part_keys) {
+            return client.BatchPutEnd(part_keys);
+        });
+}
+
+tl::expected<void, ErrorCode> PartitionedMasterClient::PutRevoke(
+    const std::string& key) {
+    return Route(key).PutRevoke(key);
+}
+
+coro::Lazy<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+PartitionedMasterClient::CoGetReplicaList(std::string object_key) {
+    MasterClient& client = Route(object_key);
+    return client.CoGetReplicaList(std::move(object_key));
+}
+
+coro::Lazy<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+PartitionedMasterClient::CoPutStart(std::string key,
+                                    std::vector<size_t> slice_lengths,
+                                    ReplicateConfig config) {
+    MasterClient& client = Route(key);
+    return client.CoPutStart(std::move(key), std::move(slice_lengths),
+                             std::move(config));
+}
+
+coro::Lazy<tl::expected<void, ErrorCode>> PartitionedMasterClient::CoPutEnd(
+    std::string key) {
+    MasterClient& client = Route(key);
+    return client.CoPutEnd(std::move(key));
+}
+
+coro::Lazy<tl::expected<void, ErrorCode>> PartitionedMasterClient::CoPutRevoke(
+    std::string key) {
+    MasterClient& client = Route(key);
+    return client.CoPutRevoke(std::move(key));
+}
+
+std::vector<tl::expected<void, ErrorCode>>
+PartitionedMasterClient::BatchPutRevoke(const std::vector<std::string>& keys) {
+    return SplitBatch<tl::expected<void, ErrorCode>>(
+        keys, [](MasterClient& client, const std::vector<size_t>&,
+                 const std::vector<std::string>& part_keys) {
+            return client.BatchPutRevoke(part_keys);
+        });
+}
+
+tl::expected<void, ErrorCode> PartitionedMasterClient::PutInline(
+    const std::string& key, const std::string& value,
+    const ReplicateConfig& config) {
+    return RetryWhenBusy(
+        [&] { return Route(key).PutInline(key, value, config); });
+}
+
+tl::expected<void, ErrorCode> PartitionedMasterClient::PutDiskReplica(
+    const std::string& key, const DiskDescriptor& disk) {
+    return Route(key).PutDiskReplica(key, disk);
+}
+
+std::vector<tl::expected<void, ErrorCode>>
+PartitionedMasterClient::BatchPutDiskReplica(
+    const std::vector<std::string>& keys,
+    const std::vector<DiskDescriptor>& disks) {
+    if (partitions_.size() == 1 || disks.size() != keys.size()) {
+        // The master reports mismatched sizes
+        return RetryWhenBusy([&] {
+            return partitions_[0]->BatchPutDiskReplica(keys, disks);
+        });
+    }
+    return SplitBatch<tl::expected<void, ErrorCode>>(
+        keys, [&](MasterClient& client, const std::vector<size_t>& indices,
+                  const std::vector<std::string>& part_keys) {
+            std::vector<DiskDescriptor> part_disks;
+            part_disks.reserve(indices.size());
+            for (size_t i : indices) part_disks.push_back(disks[i]);
+            return RetryWhenBusy([&] {
+                return client.BatchPutDiskReplica(part_keys, part_disks);
+            });
+        });
+}
+
+tl::expected<std::vector<Replica::Descriptor>, ErrorCode>
+PartitionedMasterClient::PromoteStart(const std::string& key,
+                                      const std::vector<size_t>& slice_lengths,
+                                      const ReplicateConfig& config) {
+    return Route(key).PromoteStart(key, slice_lengths, config);
+}
+
+tl::expected<CompactionTask, ErrorCode>
+PartitionedMasterClient::CompactionStart(const std::string& segment_name) {
+    const size_t partition_num = partitions_.size();
+    const size_t first = next_compaction_partition_.fetch_add(1) %
+                         partition_num;
+    // Partitions with compaction disabled may still have copies queued
+    ErrorCode error = ErrorCode::UNAVAILABLE_IN_CURRENT_MODE;
+    for (size_t i = 0; i < partition_num; ++i) {
+        auto task = partitions_[(first + i) % partition_num]->CompactionStart(
+            segment_name);
+        if (task) {
+            return task;
+        }
+        if (task.error() == ErrorCode::OBJECT_NOT_FOUND) {
+            error = ErrorCode::OBJECT_NOT_FOUND;
+        } else if (task.error() != ErrorCode::UNAVAILABLE_IN_CURRENT_MODE) {
+            return task;
+        }
+    }
+    return tl::make_unexpected(error);
+}
+
+tl::expected<void, ErrorCode> PartitionedMasterClient::CompactionEnd(
+    const std::string& key, uint64_t target) {
+    return Route(key).CompactionEnd(key, target);
+}
+
+tl::expected<void, ErrorCode> PartitionedMasterClient::CompactionRevoke(
+    const std::string& key, uint64_t target) {
+    return Route(key).CompactionRevoke(key, target);
+}
+
+tl::expected<void, ErrorCode> PartitionedMasterClient::CopyReplica(
+    const std::string& key, const std::string& target_segment) {
+    return Route(key).CopyReplica(key, target_segment);
+}
+
+tl::expected<void, ErrorCode> PartitionedMasterClient::MigrateReplica(
+    const std::string& key, const std::string& source_segment,
+    const std::string& target_segment) {
+    return Route(key).MigrateReplica(key, source_segment, target_segment);
+}
+
+tl::expected<uint64_t, ErrorCode> PartitionedMasterClient::Broadcast(
+    const std::string& key, const std::vector<std::string>& target_segments) {
+    return Route(key).Broadcast(key, target_segments);
+}
+
+std::vector<tl::expected<void, ErrorCode>> PartitionedMasterClient::Prefetch(
+    const std::vector<std::string>& keys, const std::string& target_segment) {
+    return SplitBatch<tl::expected<void, ErrorCode>>(
+        keys, [this, &target_segment](MasterClient& client,
+                                      const std::vector<size_t>&,
+                                      const std::vector<std::string>& part) {
+            return RetryWhenBusy(
+                [&] { return client.Prefetch(part, target_segment); });
+        });
+}
+
+std::vector<tl::expected<bool, ErrorCode>>
+PartitionedMasterClient::CancelPrefetch(const std::vector<std::string>& keys,
+                                        const std::string& target_segment) {
+    return SplitBatch<tl::expected<bool, ErrorCode>>(
+        keys, [&target_segment](MasterClient& client,
+                                const std::vector<size_t>&,
+                                const std::vector<std::string>& part) {
+            return client.CancelPrefetch(part, target_segment);
+        });
+}
+
+tl::expected<void, ErrorCode> PartitionedMasterClient::Remove(
+    const std::string& key) {
+    return Route(key).Remove(key);
+}
+
+tl::expected<long, ErrorCode> PartitionedMasterClient::RemoveAll() {
+    long removed = 0;
+    for (auto& partition : partitions_) {
+        auto result = partition->RemoveAll();
+        if (!result) {
+            return result;
+        }
+        removed += result.value();
+    }
+    return removed;
+}
+
+tl::expected<long, ErrorCode> PartitionedMasterClient::RemoveByTag(
+    const std::string& tag) {
+    long queued = 0;
+    for (auto& partition : partitions_) {
+        auto result = partition->RemoveByTag(tag);
+        if (!result) {
+            return result;
+        }
+        queued += result.value();
+    }
+    return queued;
+}
+
+tl::expected<long, ErrorCode> PartitionedMasterClient::RemoveByPrefix(
+    const std::string& prefix) {
+    // Keys of a prefix hash to any partition
+    long removed = 0;
+    for (auto& partition : partitions_) {
+        auto result = partition->RemoveByPrefix(prefix);
+        if (!result) {
+            return result;
+        }
+        removed += result.value();
+    }
+    return removed;
+}
+
+tl::expected<void, ErrorCode> PartitionedMasterClient::MountSegment(
+    const Segment& segment, const UUID& client_id) {
+    auto parts = SplitSegment(segment, partitions_.size());
+    if (parts.empty()) {
+        LOG(ERROR) << "Segment of size " << segment.size
+                   << " is too small for " << partitions_.size()
+                   << " partitions";
+        return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    for (size_t i = 0; i < parts.size(); ++i) {
+        auto result = partitions_[i]->MountSegment(parts[i], client_id);
+        if (!result) {
+            // Leave no partition with a part of a segment reported unmounted
+            for (size_t j = 0; j < i; ++j) {
+                auto unmount = partitions_[j]->UnmountSegment(segment.id,
+                                                              client_id);
+                if (!unmount) {
+                    LOG(ERROR) << "Failed to unmount segment from partition "
+                               << j << ": " << unmount.error();
+                }
+            }
+            return result;
+        }
+    }
+    return {};
+}
+
+tl::expected<void, ErrorCode> PartitionedMasterClient::ReMountSegment(
+    const std::vector<Segment>& segments, const UUID& client_id) {
+    const size_t partition_num = partitions_.size();
+    std::vector<std::vector<Segment>> parts(partition_num);
+    for (const auto& segment : segments) {
+        auto split = SplitSegment(segment, partition_num);
+        for (size_t i = 0; i < split.size(); ++i) {
+            parts[i].push_back(std::move(split[i]));
+        }
+    }
+    tl::expected<void, ErrorCode> result;
+    for (size_t i = 0; i < partition_num; ++i) {
+        auto part_result = partitions_[i]->ReMountSegment(parts[i], client_id);
+        if (!part_result) {
+            LOG(ERROR) << "Failed to remount segments on partition " << i
+                       << ": " << part_result.error();
+            result = part_result;
+        }
+    }
+    return result;
+}
+
+tl::expected<void, ErrorCode> PartitionedMasterClient::UnmountSegment(
+    const UUID& segment_id, const UUID& client_id) {
+    tl::expected<void, ErrorCode> result;
+    for (size_t i = 0; i < partitions_.size(); ++i) {
+        auto part_result =
+            partitions_[i]->UnmountSegment(segment_id, client_id);
+        if (!part_result) {
+            LOG(ERROR) << "Failed to unmount segment from partition " << i
+                       << ": " << part_result.error();
+            result = part_result;
+        }
+    }
+    return result;
+}
+
+tl::expected<void, ErrorCode> PartitionedMasterClient::DrainSegment(
+    const UUID& segment_id) {
+    tl::expected<void, ErrorCode> result;
+    for (size_t i = 0; i < partitions_.size(); ++i) {
+        auto part_result = partitions_[i]->DrainSegment(segment_id);
+        if (!part_result) {
+            LOG(ERROR) << "Failed to drain segment on partition " << i
+                       << ": " << part_result.error();
+            result = part_result;
+        }
+    }
+    return result;
+}
+
+tl::expected<uint64_t, ErrorCode> PartitionedMasterClient::QueryDrain(
+    const UUID& segment_id) {
+    uint64_t remaining = 0;
+    for (auto& partition : partitions_) {
+        auto part_result = partition->QueryDrain(segment_id);
+        if (!part_result) {
+            return part_result;
+        }
+        remaining += part_result.value();
+    }
+    return remaining;
+}
+
+tl::expected<Segment, ErrorCode> PartitionedMasterClient::AttachSegment(
+    const UUID& memory_id, const UUID& client_id) {
+    std::optional<Segment> segment;
+    for (auto& partition : partitions_) {
+        auto part_result = partition->AttachSegment(memory_id, client_id);
+        if (!part_result) {
+            return part_result;
+        }
+        if (!segment) {
+            segment = std::move(part_result.value());
+            continue;
+        }
+        // The ranges of a split segment tile it
+        const uintptr_t end =
+            std::max(segment->base + segment->size,
+                     part_result->base + part_result->size);
+        segment->base = std::min(segment->base, part_result->base);
+        segment->size = end - segment->base;
+    }
+    return segment.value();
+}
+
+tl::expected<void, ErrorCode> PartitionedMasterClient::DetachSegment(
+    const UUID& memory_id, const UUID& client_id) {
+    tl::expected<void, ErrorCode> result;
+    for (auto& partition : partitions_) {
+        auto part_result = partition->DetachSegment(memory_id, client_id);
+        if (!part_result) {
+            result = part_result;
+        }
+    }
+    return result;
+}
+
+tl::expected<std::string, ErrorCode> PartitionedMasterClient::GetFsdir() {
+    return partitions_[0]->GetFsdir();
+}
+
+tl::expected<ReplicaCacheInfo, ErrorCode>
+PartitionedMasterClient::GetReplicaCacheInfo() {
+    ReplicaCacheInfo info;
+    for (size_t i = 0; i < partitions_.size(); ++i) {
+        auto part = partitions_[i]->GetReplicaCacheInfo();
+        if (!part) {
+            return part;
+        }
+        if (i == 0 || part->lease_ttl_ms < info.lease_ttl_ms) {
+            info.lease_ttl_ms = part->lease_ttl_ms;
+        }
+        info.replica_version += part->replica_version;
+    }
+    return info;
+}
+
+tl::expected<KeyFilterUpdate, ErrorCode>
+PartitionedMasterClient::GetKeyFilter(size_t partition, uint64_t seq) {
+    return partitions_[partition]->GetKeyFilter(seq);
+}
+
+tl::expected<AllocationCredit, ErrorCode>
+PartitionedMasterClient::GrantAllocationCredit(size_t partition,
+                                               const UUID& client_id,
+                                               uint64_t size) {
+    return RetryWhenBusy([&] {
+        return partitions_[partition]->GrantAllocationCredit(client_id, size);
+    });
+}
+
+std::vector<tl::expected<void, ErrorCode>>
+PartitionedMasterClient::CommitCreditPuts(size_t partition,
+                                          const UUID& client_id,
+                                          uint64_t credit_id,
+                                          const std::vector<CreditPut>& puts) {
+    return partitions_[partition]->CommitCreditPuts(client_id, credit_id,
+                                                    puts);
+}
+
+tl::expected<void, ErrorCode> PartitionedMasterClient::ReturnAllocationCredit(
+    size_t partition, const UUID& client_id, uint64_t credit_id) {
+    return partitions_[partition]->ReturnAllocationCredit(client_id,
+                                                          credit_id);
+}
+
+tl::expected<std::pair<ViewVersionId, ClientStatus>, ErrorCode>
+PartitionedMasterClient::Ping(const UUID& client_id) {
+    ViewVersionId view_version = 0;
+    ClientStatus status = ClientStatus::OK;
+    for (auto& partition : partitions_) {
+        auto result = partition->Ping(client_id);
+        if (!result) {
+            return result;
+        }
+        view_version += result->first;
+        if (result->second == ClientStatus::NEED_REMOUNT) {
+            status = ClientStatus::NEED_REMOUNT;
+        }
+    }
+    return std::make_pair(view_version, status);
+}
+
+}  // namespace mooncake
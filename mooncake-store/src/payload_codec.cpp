@@ -0,0 +1,552 @@
+#include "payload_codec.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <numeric>
+
+namespace mooncake {
+
+namespace {
+
+// Plane bytes coded together, so that the nibble table follows the data
+constexpr size_t kPlaneBlock = 64 * 1024;
+constexpr uint8_t kRawBlock = 0;
+constexpr uint8_t kNibbleBlock = 1;
+// Nibble codes of the table, the last code escapes to a literal
+constexpr size_t kNibbleTable = 15;
+constexpr uint8_t kEscape = 15;
+constexpr size_t kNibbleBlockHeader = 1 + kNibbleTable + sizeof(uint32_t);
+
+// Elements sharing one FP8 scale
+constexpr size_t kFp8Group = 128;
+constexpr float kFp8Max = 448.0f;
+
+size_t BlockCount(size_t count) {
+    return (count + kPlaneBlock - 1) / kPlaneBlock;
+}
+
+// One block of plane bytes, as raw bytes or as nibble codes of its 15 most
+// frequent bytes, whichever is smaller
+uint8_t* EncodePlaneBlock(const uint8_t* bytes, size_t count, uint8_t* out) {
+    std::array<uint32_t, 256> histogram{};
+    for (size_t i = 0; i < count; ++i) {
+        histogram[bytes[i]]++;
+    }
+    std::array<uint8_t, 256> order;
+    std::iota(order.begin(), order.end(), 0);
+    std::partial_sort(order.begin(), order.begin() + kNibbleTable,
+                      order.end(), [&](uint8_t a, uint8_t b) {
+                          return histogram[a] > histogram[b];
+                      });
+    size_t coded = 0;
+    for (size_t i = 0; i < kNibbleTable; ++i) {
+        coded += histogram[order[i]];
+    }
+    const size_t escapes = count - coded;
+    const size_t nibble_size =
+        kNibbleBlockHeader + (count + 1) / 2 + escapes;
+    if (nibble_size >= 1 + count) {
+        *out++ = kRawBlock;
+        std::memcpy(out, bytes, count);
+        return out + count;
+    }
+
+    std::array<uint8_t, 256> codes;
+    codes.fill(kEscape);
+    *out++ = kNibbleBlock;
+    for (size_t i = 0; i < kNibbleTable; ++i) {
+        codes[order[i]] = i;
+        *out++ = order[i];
+    }
+    const uint32_t escape_count = escapes;
+    std::memcpy(out, &escape_count, sizeof(escape_count));
+    out += sizeof(escape_count);
+    uint8_t* nibbles = out;
+    uint8_t* literals = out + (count + 1) / 2;
+    for (size_t i = 0; i + 1 < count; i += 2) {
+        nibbles[i / 2] = codes[bytes[i]] | codes[bytes[i + 1]] << 4;
+    }
+    if (count % 2) {
+        nibbles[count / 2] = codes[bytes[count - 1]];
+    }
+    // Every byte is stored, only escaped ones move the position on
+    size_t literal = 0;
+    for (size_t i = 0; i < count && literal < escapes; ++i) {
+        literals[literal] = bytes[i];
+        literal += codes[bytes[i]] == kEscape;
+    }
+    return literals + escapes;
+}
+
+// The block at in, of count plane bytes, or null if it is malformed
+const uint8_t* DecodePlaneBlock(const uint8_t* in, const uint8_t* end,
+                                size_t count, uint8_t* bytes) {
+    if (in >= end) {
+        return nullptr;
+    }
+    const uint8_t mode = *in++;
+    if (mode == kRawBlock) {
+        if (static_cast<size_t>(end - in) < count) {
+            return nullptr;
+        }
+        std::memcpy(bytes, in, count);
+        return in + count;
+    }
+    if (mode != kNibbleBlock ||
+        static_cast<size_t>(end - in) < kNibbleBlockHeader - 1) {
+        return nullptr;
+    }
+    const uint8_t* table = in;
+    uint32_t escapes = 0;
+    std::memcpy(&escapes, in + kNibbleTable, sizeof(escapes));
+    const uint8_t* nibbles = in + kNibbleTable + sizeof(escapes);
+    if (escapes > count ||
+        static_cast<size_t>(end - nibbles) < (count + 1) / 2 + escapes) {
+        return nullptr;
+    }
+    const uint8_t* literals = nibbles + (count + 1) / 2;
+    // The escape code reads the next literal, one past the last one is the
+    // end of the block or a zero
+    std::array<uint8_t, 16> symbols;
+    std::memcpy(symbols.data(), table, kNibbleTable);
+    size_t literal = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const uint8_t code = (nibbles[i / 2] >> (4 * (i & 1))) & 0xf;
+        symbols[kEscape] = literal < escapes ? literals[literal] : 0;
+        bytes[i] = symbols[code];
+        literal += code == kEscape;
+    }
+    return literal == escapes ? literals + escapes : nullptr;
+}
+
+// Splits 16-bit elements into a plane of low bytes and one of high bytes.
+// The high bytes of FP16 and BF16 tensors, sign and exponent, take few
+// values and code well.
+class BytePlaneCodec : public PayloadCodec {
+   public:
+    PayloadCodecId id() const override { return PayloadCodecId::BYTE_PLANE; }
+    std::string name() const override { return "byte_plane"; }
+
+    size_t MaxEncodedSize(size_t size) const override {
+        const size_t elements = size / 2;
+        return 2 * (elements + BlockCount(elements)) + size % 2;
+    }
+
+    tl::expected<size_t, ErrorCode> Encode(
+        std::span<const uint8_t> in, std::span<uint8_t> out) const override {
+        if (out.size() < MaxEncodedSize(in.size())) {
+            return tl::make_unexpected(ErrorCode::BUFFER_OVERFLOW);
+        }
+        const size_t elements = in.size() / 2;
+        std::vector<uint8_t> plane(std::min(elements, kPlaneBlock));
+        uint8_t* pos = out.data();
+        for (size_t byte = 0; byte < 2; ++byte) {
+            for (size_t first = 0; first < elements; first += kPlaneBlock) {
+                const size_t count = std::min(kPlaneBlock, elements - first);
+                const uint8_t* src = in.data() + 2 * first + byte;
+                for (size_t i = 0; i < count; ++i) {
+                    plane[i] = src[2 * i];
+                }
+                pos = EncodePlaneBlock(plane.data(), count, pos);
+            }
+        }
+        if (in.size() % 2) {
+            *pos++ = in.back();
+        }
+        return pos - out.data();
+    }
+
+    ErrorCode Decode(std::span<const uint8_t> in,
+                     std::span<uint8_t> out) const override {
+        const size_t elements = out.size() / 2;
+        std::vector<uint8_t> plane(std::min(elements, kPlaneBlock));
+        const uint8_t* pos = in.data();
+        const uint8_t* end = in.data() + in.size();
+        for (size_t byte = 0; byte < 2; ++byte) {
+            for (size_t first = 0; first < elements; first += kPlaneBlock) {
+                const size_t count = std::min(kPlaneBlock, elements - first);
+                pos = DecodePlaneBlock(pos, end, count, plane.data());
+                if (!pos) {
+                    return ErrorCode::INVALID_PARAMS;
+                }
+                uint8_t* dst = out.data() + 2 * first + byte;
+                for (size_t i = 0; i < count; ++i) {
+                    dst[2 * i] = plane[i];
+                }
+            }
+        }
+        if (out.size() % 2) {
+            if (pos >= end) {
+                return ErrorCode::INVALID_PARAMS;
+            }
+            out.back() = *pos++;
+        }
+        return pos == end ? ErrorCode::OK : ErrorCode::INVALID_PARAMS;
+    }
+};
+
+float BitsToFloat(uint32_t bits) {
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+uint32_t FloatToBits(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+float HalfToFloat(uint16_t half) {
+    const uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+    const uint32_t exponent = (half >> 10) & 0x1f;
+    const uint32_t mantissa = half & 0x3ff;
+    if (exponent == 0) {
+        const float value = std::ldexp(static_cast<float>(mantissa), -24);
+        return sign ? -value : value;
+    }
+    if (exponent == 0x1f) {
+        return BitsToFloat(sign | 0x7f800000 | (mantissa << 13));
+    }
+    return BitsToFloat(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+// Selects instead of branching, so that loops over elements vectorize
+uint16_t FloatToHalf(float value) {
+    const uint32_t bits = FloatToBits(value);
+    const uint16_t sign = (bits >> 16) & 0x8000;
+    const uint32_t magnitude = bits & 0x7fffffff;
+    // Below 2^-14, subnormal halves count units of 2^-24
+    const uint32_t subnormal = static_cast<uint32_t>(
+        BitsToFloat(std::min(magnitude, 0x38800000u)) * 0x1p24f + 0.5f);
+    // Round to nearest even, a carry out of the mantissa bumps the exponent
+    const uint32_t rounded = magnitude + 0xfff + ((magnitude >> 13) & 1);
+    uint32_t half = magnitude < 0x38800000 ? subnormal
+                                           : (rounded - 0x38000000) >> 13;
+    // 65520 and more round to infinity
+    half = magnitude >= 0x477ff000 ? 0x7c00 : half;
+    half = magnitude > 0x7f800000 ? 0x7e00 : half;
+    return sign | half;
+}
+
+// Every FP16 value as a float, cheaper than converting each element
+const std::vector<float>& HalfValues() {
+    static const std::vector<float> values = [] {
+        std::vector<float> table(1 << 16);
+        for (uint32_t half = 0; half < table.size(); ++half) {
+            table[half] = HalfToFloat(half);
+        }
+        return table;
+    }();
+    return values;
+}
+
+float Bf16ToFloat(uint16_t bf16) {
+    return BitsToFloat(static_cast<uint32_t>(bf16) << 16);
+}
+
+uint16_t FloatToBf16(float value) {
+    const uint32_t bits = FloatToBits(value);
+    if ((bits & 0x7fffffff) > 0x7f800000) {
+        return (bits >> 16) | 0x40;
+    }
+    return (bits + 0x7fff + ((bits >> 16) & 1)) >> 16;
+}
+
+// FP8 E4M3 without infinities, saturating at 448
+uint8_t FloatToE4M3(float value) {
+    const uint32_t bits = FloatToBits(value);
+    const uint8_t sign = (bits >> 24) & 0x80;
+    const uint32_t magnitude = bits & 0x7fffffff;
+    // Below 2^-6, subnormals count units of 2^-9
+    const uint32_t subnormal = static_cast<uint32_t>(
+        BitsToFloat(std::min(magnitude, 0x3c800000u)) * 512.0f + 0.5f);
+    const uint32_t rounded = magnitude + 0x7ffff + ((magnitude >> 20) & 1);
+    uint32_t code = magnitude < 0x3c800000
+                        ? subnormal
+                        : std::min<uint32_t>(
+                              (rounded - (120u << 23)) >> 20, 0x7e);
+    code = magnitude > 0x7f800000 ? 0x7f : code;
+    return sign | code;
+}
+
+const std::array<float, 256>& E4M3Values() {
+    static const std::array<float, 256> values = [] {
+        std::array<float, 256> table;
+        for (int code = 0; code < 256; ++code) {
+            const int exponent = (code >> 3) & 0xf;
+            const int mantissa = code & 0x7;
+            float value;
+            if (exponent == 0) {
+                value = std::ldexp(static_cast<float>(mantissa), -9);
+            } else if (exponent == 0xf && mantissa == 0x7) {
+                value = std::nanf("");
+            } else {
+                value = std::ldexp(1.0f + mantissa / 8.0f, exponent - 7);
+            }
+            table[code] = (code & 0x80) ? -value : value;
+        }
+        return table;
+    }();
+    return values;
+}
+
+// Quantizes FP16 or BF16 elements to FP8 E4M3, each group of kFp8Group
+// elements scaled by its absolute maximum, the scale kept as a float
+class Fp8Codec : public PayloadCodec {
+   public:
+    explicit Fp8Codec(bool bf16)
+        : bf16_(bf16), half_values_(bf16 ? nullptr : HalfValues().data()) {}
+
+    PayloadCodecId id() const override {
+        return bf16_ ? PayloadCodecId::FP8_FROM_BF16
+                     : PayloadCodecId::FP8_FROM_FP16;
+    }
+    std::string name() const override {
+        return bf16_ ? "fp8_from_bf16" : "fp8_from_fp16";
+    }
+
+    size_t MaxEncodedSize(size_t size) const override {
+        const size_t elements = size / 2;
+        const size_t groups = (elements + kFp8Group - 1) / kFp8Group;
+        return groups * sizeof(float) + elements + size % 2;
+    }
+
+    tl::expected<size_t, ErrorCode> Encode(
+        std::span<const uint8_t> in, std::span<uint8_t> out) const override {
+        const size_t encoded_size = MaxEncodedSize(in.size());
+        if (out.size() < encoded_size) {
+            return tl::make_unexpected(ErrorCode::BUFFER_OVERFLOW);
+        }
+        const size_t elements = in.size() / 2;
+        std::array<float, kFp8Group> values;
+        uint8_t* pos = out.data();
+        for (size_t first = 0; first < elements; first += kFp8Group) {
+            const size_t count = std::min(kFp8Group, elements - first);
+            float amax = 0.0f;
+            for (size_t i = 0; i < count; ++i) {
+                uint16_t element;
+                std::memcpy(&element, in.data() + 2 * (first + i), 2);
+                values[i] = ToFloat(element);
+                if (std::isfinite(values[i])) {
+                    amax = std::max(amax, std::fabs(values[i]));
+                }
+            }
+            const float scale = amax / kFp8Max;
+            const float inverse = scale > 0.0f ? 1.0f / scale : 0.0f;
+            std::memcpy(pos, &scale, sizeof(scale));
+            pos += sizeof(scale);
+            for (size_t i = 0; i < count; ++i) {
+                pos[i] = FloatToE4M3(values[i] * inverse);
+            }
+            pos += count;
+        }
+        if (in.size() % 2) {
+            *pos++ = in.back();
+        }
+        return encoded_size;
+    }
+
+    ErrorCode Decode(std::span<const uint8_t> in,
+                     std::span<uint8_t> out) const override {
+        if (in.size() != MaxEncodedSize(out.size())) {
+            return ErrorCode::INVALID_PARAMS;
+        }
+        const auto& e4m3 = E4M3Values();
+        const size_t elements = out.size() / 2;
+        const uint8_t* pos = in.data();
+        for (size_t first = 0; first < elements; first += kFp8Group) {
+            const size_t count = std::min(kFp8Group, elements - first);
+            float scale;
+            std::memcpy(&scale, pos, sizeof(scale));
+            pos += sizeof(scale);
+            for (size_t i = 0; i < count; ++i) {
+                const uint16_t element = FromFloat(e4m3[pos[i]] * scale);
+                std::memcpy(out.data() + 2 * (first + i), &element, 2);
+            }
+            pos += count;
+        }
+        if (out.size() % 2) {
+            out.back() = *pos;
+        }
+        return ErrorCode::OK;
+    }
+
+   private:
+    float ToFloat(uint16_t element) const {
+        return bf16_ ? Bf16ToFloat(element) : half_values_[element];
+    }
+    uint16_t FromFloat(float value) const {
+        return bf16_ ? FloatToBf16(value) : FloatToHalf(value);
+    }
+
+    const bool bf16_;
+    const float* const half_values_;
+};
+
+struct CodecRegistry {
+    CodecRegistry() {
+        Add(std::make_unique<BytePlaneCodec>());
+        Add(std::make_unique<Fp8Codec>(/*bf16=*/false));
+        Add(std::make_unique<Fp8Codec>(/*bf16=*/true));
+    }
+
+    void Add(std::unique_ptr<PayloadCodec> codec) {
+        codecs[static_cast<uint8_t>(codec->id())] = std::move(codec);
+    }
+
+    std::mutex mutex;
+    std::array<std::unique_ptr<PayloadCodec>, 256> codecs;
+};
+
+CodecRegistry& Registry() {
+    static CodecRegistry registry;
+    return registry;
+}
+
+size_t TotalSize(const std::vector<Slice>& slices) {
+    size_t total = 0;
+    for (const auto& slice : slices) {
+        total += slice.size;
+    }
+    return total;
+}
+
+}  // namespace
+
+const PayloadCodec* GetPayloadCodec(PayloadCodecId id) {
+    auto& registry = Registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    return registry.codecs[static_cast<uint8_t>(id)].get();
+}
+
+ErrorCode RegisterPayloadCodec(std::unique_ptr<PayloadCodec> codec) {
+    if (!codec ||
+        static_cast<uint8_t>(codec->id()) < kFirstCustomPayloadCodec) {
+        LOG(ERROR) << "Payload codec IDs below "
+                   << static_cast<int>(kFirstCustomPayloadCodec)
+                   << " are reserved";
+        return ErrorCode::INVALID_PARAMS;
+    }
+    auto& registry = Registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    auto& slot = registry.codecs[static_cast<uint8_t>(codec->id())];
+    if (slot) {
+        LOG(ERROR) << "Payload codec " << static_cast<int>(codec->id())
+                   << " is already registered as " << slot->name();
+        return ErrorCode::INVALID_PARAMS;
+    }
+    slot = std::move(codec);
+    return ErrorCode::OK;
+}
+
+size_t MaxEncodedPayloadSize(const PayloadCodec& codec, size_t size) {
+    return sizeof(PayloadHeader) + codec.MaxEncodedSize(size);
+}
+
+tl::expected<size_t, ErrorCode> EncodePayload(const PayloadCodec& codec,
+                                              const std::vector<Slice>& slices,
+                                              std::span<uint8_t> out) {
+    const size_t original_size = TotalSize(slices);
+    if (out.size() < MaxEncodedPayloadSize(codec, original_size)) {
+        return tl::make_unexpected(ErrorCode::BUFFER_OVERFLOW);
+    }
+    // Codecs see the payload in one piece
+    std::vector<uint8_t> gathered;
+    std::span<const uint8_t> in;
+    if (slices.size() == 1) {
+        in = {static_cast<const uint8_t*>(slices[0].ptr), slices[0].size};
+    } else {
+        gathered.resize(original_size);
+        size_t offset = 0;
+        for (const auto& slice : slices) {
+            std::memcpy(gathered.data() + offset, slice.ptr, slice.size);
+            offset += slice.size;
+        }
+        in = gathered;
+    }
+    auto encoded = codec.Encode(in, out.subspan(sizeof(PayloadHeader)));
+    if (!encoded) {
+        return encoded;
+    }
+    PayloadHeader header;
+    header.codec = codec.id();
+    header.original_size = original_size;
+    header.encoded_size = encoded.value();
+    std::memcpy(out.data(), &header, sizeof(header));
+    return sizeof(header) + encoded.value();
+}
+
+std::optional<PayloadHeader> ParsePayloadHeader(const void* data,
+                                                size_t stored_size) {
+    PayloadHeader header;
+    if (stored_size < sizeof(header)) {
+        return std::nullopt;
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if (header.magic != PayloadHeader::kMagic ||
+        header.version != PayloadHeader::kVersion ||
+        header.encoded_size != stored_size - sizeof(header) ||
+        !GetPayloadCodec(header.codec)) {
+        return std::nullopt;
+    }
+    return header;
+}
+
+tl::expected<size_t, ErrorCode> DecodePayload(
+    std::span<const uint8_t> encoded, const std::vector<Slice>& slices) {
+    auto header = ParsePayloadHeader(encoded.data(), encoded.size());
+    if (!header) {
+        return tl::make_unexpected(ErrorCode::INVALID_PARAMS);
+    }
+    const size_t original_size = header->original_size;
+    if (TotalSize(slices) < original_size) {
+        return tl::make_unexpected(ErrorCode::BUFFER_OVERFLOW);
+    }
+    const PayloadCodec* codec = GetPayloadCodec(header->codec);
+    auto body = encoded.subspan(sizeof(PayloadHeader));
+    if (!slices.empty() && slices[0].size >= original_size) {
+        auto err = codec->Decode(
+            body, {static_cast<uint8_t*>(slices[0].ptr), original_size});
+        if (err != ErrorCode::OK) {
+            return tl::make_unexpected(err);
+        }
+        return original_size;
+    }
+    std::vector<uint8_t> decoded(original_size);
+    auto err = codec->Decode(body, decoded);
+    if (err != ErrorCode::OK) {
+        return tl::make_unexpected(err);
+    }
+    size_t offset = 0;
+    for (const auto& slice : slices) {
+        const size_t size = std::min(slice.size, original_size - offset);
+        std::memcpy(slice.ptr, decoded.data() + offset, size);
+        offset += size;
+    }
+    return original_size;
+}
+
+tl::expected<size_t, ErrorCode> DecodePayloadInPlace(void* buffer,
+                                                     size_t stored_size,
+                                                     size_t capacity) {
+    auto header = ParsePayloadHeader(buffer, stored_size);
+    if (!header) {
+        return stored_size;
+    }
+    if (header->original_size > capacity) {
+        LOG(ERROR) << "Buffer of " << capacity << " bytes is too small for "
+                   << header->original_size << " decoded bytes";
+        return tl::make_unexpected(ErrorCode::BUFFER_OVERFLOW);
+    }
+    std::vector<uint8_t> encoded(static_cast<uint8_t*>(buffer),
+                                 static_cast<uint8_t*>(buffer) + stored_size);
+    return DecodePayload(encoded, {Slice{buffer, capacity}});
+}
+
+}  // namespace mooncake
@@ -0,0 +1,109 @@
+#include "replica_cache.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+
+namespace mooncake {
+
+ReplicaCache::ReplicaCache(size_t capacity)
+    : capacity_(std::max<size_t>(capacity, 1)) {}
+
+std::optional<std::vector<Replica::Descriptor>> ReplicaCache::Get(
+    const ObjectKey& key, Clock::time_point* expiry) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    if (it == entries_.end()) {
+        misses_++;
+        return std::nullopt;
+    }
+    if (it->second.expiry <= Clock::now()) {
+        Erase(it);
+        misses_++;
+        return std::nullopt;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second.lru_it);
+    hits_++;
+    if (expiry) {
+        *expiry = it->second.expiry;
+    }
+    return it->second.replicas;
+}
+
+void ReplicaCache::Put(const ObjectKey& key,
+                       std::vector<Replica::Descriptor> replicas,
+                       Clock::time_point expiry, uint64_t generation) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (generation != generation_ || expiry <= Clock::now()) {
+        return;
+    }
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+        it->second.replicas = std::move(replicas);
+        it->second.expiry = expiry;
+        lru_.splice(lru_.begin(), lru_, it->second.lru_it);
+        return;
+    }
+    if (entries_.size() >= capacity_) {
+        Erase(entries_.find(lru_.back()));
+    }
+    lru_.push_front(key);
+    entries_.emplace(key, Entry{std::move(replicas), expiry, lru_.begin()});
+}
+
+void ReplicaCache::Invalidate(const ObjectKey& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+        Erase(it);
+    }
+}
+
+void ReplicaCache::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    lru_.clear();
+    generation_++;
+}
+
+void ReplicaCache::SetVersion(uint64_t version) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (version_ == version) {
+        return;
+    }
+    if (version_) {
+        VLOG(1) << "action=replica_cache_cleared old_version=" << *version_
+                << " new_version=" << version;
+        entries_.clear();
+        lru_.clear();
+        generation_++;
+    }
+    version_ = version;
+}
+
+uint64_t ReplicaCache::generation() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return generation_;
+}
+
+size_t ReplicaCache::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
+uint64_t ReplicaCache::hits() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hits_;
+}
+
+uint64_t ReplicaCache::misses() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return misses_;
+}
+
+void ReplicaCache::Erase(std::unordered_map<ObjectKey, Entry>::iterator it) {
+    lru_.erase(it->second.lru_it);
+    entries_.erase(it);
+}
+
+}  // namespace mooncake
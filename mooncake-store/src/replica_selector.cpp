@@ -0,0 +1,212 @@
+#include "replica_selector.h"
+
+#include <algorithm>
+#include <cctype>
+#include <limits>
+#include <mutex>
+#include <utility>
+
+namespace mooncake {
+
+namespace {
+
+// Assumed latency of endpoints without samples yet, about 10 GB/s
+constexpr uint64_t kDefaultNsPerKib = 100;
+
+}  // namespace
+
+ReplicaSelector::Ticket::Ticket(std::vector<EndpointStats*> endpoints,
+                                uint64_t bytes)
+    : endpoints_(std::move(endpoints)),
+      bytes_(bytes),
+      start_(std::chrono::steady_clock::now()) {
+    for (auto* stats : endpoints_) {
+        stats->inflight.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+ReplicaSelector::Ticket::~Ticket() { Finish(false); }
+
+ReplicaSelector::Ticket::Ticket(Ticket&& other) noexcept
+    : endpoints_(std::move(other.endpoints_)),
+      bytes_(other.bytes_),
+      start_(other.start_) {
+    other.endpoints_.clear();
+}
+
+ReplicaSelector::Ticket& ReplicaSelector::Ticket::operator=(
+    Ticket&& other) noexcept {
+    if (this != &other) {
+        Finish(false);
+        endpoints_ = std::move(other.endpoints_);
+        bytes_ = other.bytes_;
+        start_ = other.start_;
+        other.endpoints_.clear();
+    }
+    return *this;
+}
+
+void ReplicaSelector::Ticket::Finish(bool success) {
+    if (endpoints_.empty()) {
+        return;
+    }
+    uint64_t sample = 0;
+    if (success && bytes_ > 0) {
+        const auto elapsed =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start_)
+                .count();
+        sample = std::max<uint64_t>(
+            1, static_cast<uint64_t>(elapsed) * 1024 / bytes_);
+    }
+    for (auto* stats : endpoints_) {
+        stats->inflight.fetch_sub(1, std::memory_order_relaxed);
+        if (sample == 0) {
+            continue;
+        }
+        // Racing updates may drop a sample, which is fine for an average
+        const uint64_t old = stats->ns_per_kib.load(std::memory_order_relaxed);
+        const uint64_t updated =
+            old == 0 ? sample
+                     : old - (old >> kEwmaShift) + (sample >> kEwmaShift);
+        stats->ns_per_kib.store(updated, std::memory_order_relaxed);
+    }
+    endpoints_.clear();
+}
+
+ReplicaSelector::ReplicaSelector(std::string local_hostname,
+                                 AttachedCheck is_attached)
+    : local_hostname_(std::move(local_hostname)),
+      local_host_(HostOf(local_hostname_)),
+      is_attached_(std::move(is_attached)) {}
+
+std::string_view ReplicaSelector::HostOf(std::string_view segment_name) {
+    auto colon = segment_name.rfind(':');
+    if (colon == std::string_view::npos || colon + 1 == segment_name.size()) {
+        return segment_name;
+    }
+    const bool is_port =
+        std::all_of(segment_name.begin() + colon + 1, segment_name.end(),
+                    [](unsigned char ch) { return std::isdigit(ch); });
+    return is_port ? segment_name.substr(0, colon) : segment_name;
+}
+
+ReplicaSelector::Locality ReplicaSelector::GetLocality(
+    const Replica::Descriptor& replica) const {
+    if (!replica.is_memory_replica()) {
+        return Locality::DISK;
+    }
+    // Copied from the replica list itself
+    if (replica.get_memory_descriptor().is_inline()) {
+        return Locality::LOCAL;
+    }
+    const auto& buffers = replica.get_memory_descriptor().buffer_descriptors;
+    bool local = true;
+    for (const auto& buffer : buffers) {
+        if (buffer.segment_name_ == local_hostname_ ||
+            (is_attached_ && is_attached_(buffer))) {
+            continue;
+        }
+        local = false;
+        if (HostOf(buffer.segment_name_) != local_host_) {
+            return Locality::REMOTE;
+        }
+    }
+    return local ? Locality::LOCAL : Locality::SAME_HOST;
+}
+
+uint64_t ReplicaSelector::EstimateCost(
+    const Replica::Descriptor& replica) const {
+    if (!replica.is_memory_replica()) {
+        return 0;
+    }
+    uint64_t cost = 0;
+    std::shared_lock lock(stats_mutex_);
+    for (const auto& buffer :
+         replica.get_memory_descriptor().buffer_descriptors) {
+        uint64_t ns_per_kib = kDefaultNsPerKib;
+        int64_t inflight = 0;
+        if (const auto* stats = FindStats(buffer.segment_name_)) {
+            if (auto measured =
+                    stats->ns_per_kib.load(std::memory_order_relaxed)) {
+                ns_per_kib = measured;
+            }
+            inflight = std::max<int64_t>(
+                0, stats->inflight.load(std::memory_order_relaxed));
+        }
+        const uint64_t kib = std::max<uint64_t>(1, buffer.size_ / 1024);
+        cost += ns_per_kib * kib * (inflight + 1);
+    }
+    return cost;
+}
+
+ErrorCode ReplicaSelector::Select(
+    const std::vector<Replica::Descriptor>& replica_list,
+    Replica::Descriptor& replica) const {
+    const Replica::Descriptor* best = nullptr;
+    Locality best_locality = Locality::DISK;
+    uint64_t best_cost = std::numeric_limits<uint64_t>::max();
+    for (const auto& candidate : replica_list) {
+        if (candidate.status != ReplicaStatus::COMPLETE) {
+            continue;
+        }
+        const Locality locality = GetLocality(candidate);
+        if (best != nullptr && locality > best_locality) {
+            continue;
+        }
+        // A local replica is read with memcpy, no need to compare costs
+        const uint64_t cost =
+            locality == Locality::LOCAL ? 0 : EstimateCost(candidate);
+        if (best == nullptr || locality < best_locality || cost < best_cost) {
+            best = &candidate;
+            best_locality = locality;
+            best_cost = cost;
+        }
+    }
+    if (best == nullptr) {
+        return ErrorCode::INVALID_REPLICA;
+    }
+    replica = *best;
+    return ErrorCode::OK;
+}
+
+ReplicaSelector::Ticket ReplicaSelector::BeginTransfer(
+    const Replica::Descriptor& replica) {
+    if (!replica.is_memory_replica()) {
+        return {};
+    }
+    const auto& buffers = replica.get_memory_descriptor().buffer_descriptors;
+    std::vector<EndpointStats*> endpoints;
+    endpoints.reserve(buffers.size());
+    uint64_t bytes = 0;
+    for (const auto& buffer : buffers) {
+        endpoints.push_back(GetOrCreateStats(buffer.segment_name_));
+        bytes += buffer.size_;
+    }
+    return Ticket(std::move(endpoints), bytes);
+}
+
+const ReplicaSelector::EndpointStats* ReplicaSelector::FindStats(
+    const std::string& segment_name) const {
+    auto it = stats_.find(segment_name);
+    return it == stats_.end() ? nullptr : it->second.get();
+}
+
+ReplicaSelector::EndpointStats* ReplicaSelector::GetOrCreateStats(
+    const std::string& segment_name) {
+    {
+        std::shared_lock lock(stats_mutex_);
+        auto it = stats_.find(segment_name);
+        if (it != stats_.end()) {
+            return it->second.get();
+        }
+    }
+    std::unique_lock lock(stats_mutex_);
+    auto& stats = stats_[segment_name];
+    if (!stats) {
+        stats = std::make_unique<EndpointStats>();
+    }
+    return stats.get();
+}
+
+}  // namespace mooncake
@@ -0,0 +1,176 @@
+#include "request_tracer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+namespace mooncake {
+
+namespace {
+
+// The request traced on this thread
+struct ThreadTrace {
+    Trace* trace = nullptr;
+    std::chrono::steady_clock::time_point start;
+    uint32_t depth = 0;
+    uint64_t requests = 0;
+};
+
+thread_local ThreadTrace current_trace;
+
+int64_t MicrosecondsBetween(std::chrono::steady_clock::time_point from,
+                            std::chrono::steady_clock::time_point to) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(to - from)
+        .count();
+}
+
+uint64_t NewTraceId() {
+    thread_local std::mt19937_64 generator(std::random_device{}());
+    uint64_t id = 0;
+    while (id == 0) {
+        id = generator();
+    }
+    return id;
+}
+
+void AppendJsonString(std::string& out, std::string_view value) {
+    out += '"';
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+}  // namespace
+
+RequestTracer::RequestTracer(uint64_t sample_interval, size_t capacity)
+    : sample_interval_(sample_interval),
+      capacity_(std::max<size_t>(capacity, 1)) {}
+
+uint64_t RequestTracer::CurrentTraceId() {
+    return current_trace.trace ? current_trace.trace->trace_id : 0;
+}
+
+std::vector<Trace> RequestTracer::Recent() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<Trace> traces;
+    traces.reserve(traces_.size());
+    for (size_t i = 0; i < traces_.size(); ++i) {
+        traces.push_back(traces_[(next_ + i) % traces_.size()]);
+    }
+    return traces;
+}
+
+std::string RequestTracer::Dump() const {
+    std::string out;
+    for (const auto& trace : Recent()) {
+        char id[17];
+        std::snprintf(id, sizeof(id), "%016llx",
+                      static_cast<unsigned long long>(trace.trace_id));
+        out += "{\"trace_id\":\"";
+        out += id;
+        out += "\",\"operation\":";
+        AppendJsonString(out, trace.operation);
+        out += ",\"key\":";
+        AppendJsonString(out, trace.key);
+        out += ",\"start_us\":" + std::to_string(trace.start_us);
+        out += ",\"duration_us\":" + std::to_string(trace.duration_us);
+        out += ",\"status\":";
+        AppendJsonString(out, toString(trace.status));
+        out += ",\"spans\":[";
+        for (size_t i = 0; i < trace.spans.size(); ++i) {
+            const auto& span = trace.spans[i];
+            out += i ? ",{\"name\":" : "{\"name\":";
+            AppendJsonString(out, span.name);
+            out += ",\"depth\":" + std::to_string(span.depth);
+            out += ",\"offset_us\":" + std::to_string(span.offset_us);
+            out += ",\"duration_us\":" + std::to_string(span.duration_us);
+            out += '}';
+        }
+        out += "]}\n";
+    }
+    return out;
+}
+
+void RequestTracer::Finish(Trace trace) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (traces_.size() < capacity_) {
+        traces_.push_back(std::move(trace));
+        return;
+    }
+    traces_[next_] = std::move(trace);
+    next_ = (next_ + 1) % capacity_;
+}
+
+RequestTracer::ScopedTrace::ScopedTrace(RequestTracer* tracer,
+                                        std::string_view operation,
+                                        std::string_view key) {
+    // A request made while serving a traced one belongs to that trace
+    if (!tracer || !tracer->enabled() || current_trace.trace) {
+        return;
+    }
+    if (++current_trace.requests % tracer->sample_interval_ != 0) {
+        return;
+    }
+    tracer_ = tracer;
+    start_ = std::chrono::steady_clock::now();
+    trace_.trace_id = NewTraceId();
+    trace_.operation = operation;
+    trace_.key = key;
+    trace_.start_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                          std::chrono::system_clock::now().time_since_epoch())
+                          .count();
+    current_trace.trace = &trace_;
+    current_trace.start = start_;
+    current_trace.depth = 0;
+}
+
+RequestTracer::ScopedTrace::~ScopedTrace() {
+    if (!tracer_) {
+        return;
+    }
+    current_trace.trace = nullptr;
+    trace_.duration_us =
+        MicrosecondsBetween(start_, std::chrono::steady_clock::now());
+    tracer_->Finish(std::move(trace_));
+}
+
+RequestTracer::ScopedSpan::ScopedSpan(std::string_view name,
+                                      std::string_view detail) {
+    Trace* trace = current_trace.trace;
+    if (!trace) {
+        return;
+    }
+    active_ = true;
+    start_ = std::chrono::steady_clock::now();
+    index_ = trace->spans.size();
+    TraceSpan& span = trace->spans.emplace_back();
+    span.name = name;
+    if (!detail.empty()) {
+        span.name += ':';
+        span.name += detail;
+    }
+    span.depth = current_trace.depth++;
+    span.offset_us = MicrosecondsBetween(current_trace.start, start_);
+}
+
+RequestTracer::ScopedSpan::~ScopedSpan() {
+    if (!active_) {
+        return;
+    }
+    // The trace is still open, spans are scoped inside it
+    current_trace.depth--;
+    current_trace.trace->spans[index_].duration_us =
+        MicrosecondsBetween(start_, std::chrono::steady_clock::now());
+}
+
+}  // namespace mooncake
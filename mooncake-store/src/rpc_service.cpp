@@ -6,6 +6,7 @@
 #include <atomic>
 #include <chrono>
 #include <cstdint>
+#include <cstdlib>
 #include <thread>
 #include <ylt/coro_http/coro_http_client.hpp>
 #include <ylt/coro_http/coro_http_server.hpp>
@@ -13,8 +14,10 @@
 #include <ylt/reflection/user_reflect_macro.hpp>
 #include <ylt/util/tl/expected.hpp>
 
+#include "admission_controller.h"
 #include "master_metric_manager.h"
 #include "master_service.h"
+#include "metadata_follower.h"
 #include "rpc_helper.h"
 #include "types.h"
 #include "utils/scoped_vlog_timer.h"
@@ -22,24 +25,24 @@
 namespace mooncake {
 
 const uint64_t kMetricReportIntervalSeconds = 10;
+// Shards listed by /metrics/shards without a limit
+const size_t kDefaultHottestShards = 10;
 
 WrappedMasterService::WrappedMasterService(
-    bool enable_gc, uint64_t default_kv_lease_ttl,
-    uint64_t default_kv_soft_pin_ttl, bool allow_evict_soft_pinned_objects,
-    bool enable_metric_reporting, uint16_t http_port, double eviction_ratio,
-    double eviction_high_watermark_ratio, ViewVersionId view_version,
-    int64_t client_live_ttl_sec, bool enable_ha, const std::string& cluster_id)
-    : master_service_(enable_gc, default_kv_lease_ttl, default_kv_soft_pin_ttl,
-                      allow_evict_soft_pinned_objects, eviction_ratio,
-                      eviction_high_watermark_ratio, view_version,
-                      client_live_ttl_sec, enable_ha, cluster_id),
-      http_server_(4, http_port),
-      metric_report_running_(enable_metric_reporting) {
+    const WrappedMasterServiceConfig& config)
+    : master_service_(config.master),
+      shard_affinity_(config.shard_affinity_threads > 0
+                          ? std::make_unique<ShardAffinityPool>(
+                                MasterService::kNumMetadataShards,
+                                config.shard_affinity_threads)
+                          : nullptr),
+      http_server_(4, config.http_port),
+      metric_report_running_(config.enable_metric_reporting) {
     init_http_server();
 
-    MasterMetricManager::instance().set_enable_ha(enable_ha);
+    MasterMetricManager::instance().set_enable_ha(config.master.enable_ha);
 
-    if (enable_metric_reporting) {
+    if (config.enable_metric_reporting) {
         metric_report_thread_ = std::thread([this]() {
             while (metric_report_running_) {
                 std::string metrics_summary =
@@ -53,6 +56,9 @@ WrappedMasterService::WrappedMasterService(
 }
 
 WrappedMasterService::~WrappedMasterService() {
+    if (follower_) {
+        follower_->Stop();
+    }
     metric_report_running_ = false;
     if (metric_report_thread_.joinable()) {
         metric_report_thread_.join();
@@ -64,9 +70,15 @@ void WrappedMasterService::init_http_server() {
     using namespace coro_http;
 
     http_server_.set_http_handler<GET>(
-        "/metrics", [](coro_http_request& req, coro_http_response& resp) {
+        "/metrics", [this](coro_http_request& req, coro_http_response& resp) {
             std::string metrics =
                 MasterMetricManager::instance().serialize_metrics();
+            if (shard_affinity_) {
+                metrics += shard_affinity_->SerializeMetrics();
+            }
+            if (admission_) {
+                metrics += admission_->SerializeMetrics();
+            }
             resp.add_header("Content-Type", "text/plain; version=0.0.4");
             resp.set_status_and_content(status_type::ok, std::move(metrics));
         });
@@ -169,6 +181,47 @@ void WrappedMasterService::init_http_server() {
             }
         });
 
+    http_server_.set_http_handler<GET>(
+        "/segment_fragmentation",
+        [&](coro_http_request& req, coro_http_response& resp) {
+            resp.add_header("Content-Type", "text/plain; version=0.0.4");
+            std::string ss =
+                "# HELP master_segment_fragmentation_ratio 1 - largest free "
+                "region / free space of the segment\n"
+                "# TYPE master_segment_fragmentation_ratio gauge\n";
+            for (const auto& [segment, ratio] :
+                 master_service_.GetSegmentFragmentation()) {
+                ss += "master_segment_fragmentation_ratio{segment=\"";
+                ss += segment;
+                ss += "\"} ";
+                ss += std::to_string(ratio);
+                ss += "\n";
+            }
+            resp.set_status_and_content(status_type::ok, std::move(ss));
+        });
+
+    http_server_.set_http_handler<GET>(
+        "/metrics/shards",
+        [&](coro_http_request& req, coro_http_response& resp) {
+            resp.add_header("Content-Type", "text/plain; version=0.0.4");
+            size_t limit = kDefaultHottestShards;
+            auto limit_param = req.get_query_value("limit");
+            if (!limit_param.empty()) {
+                limit = std::strtoull(std::string(limit_param).c_str(),
+                                      nullptr, 10);
+            }
+            std::string ss;
+            for (const auto& stats : master_service_.GetHottestShards(limit)) {
+                ss += "shard=" + std::to_string(stats.shard);
+                ss += " acquisitions=" + std::to_string(stats.acquisitions);
+                ss += " contentions=" + std::to_string(stats.contentions);
+                ss += " wait_us=" + std::to_string(stats.wait_us);
+                ss += " hold_us=" + std::to_string(stats.hold_us);
+                ss += "\n";
+            }
+            resp.set_status_and_content(status_type::ok, std::move(ss));
+        });
+
     http_server_.set_http_handler<GET>(
         "/health", [](coro_http_request& req, coro_http_response& resp) {
             resp.add_header("Content-Type", "text/plain; version=0.0.4");
@@ -181,8 +234,20 @@ void WrappedMasterService::init_http_server() {
 
 tl::expected<bool, ErrorCode> WrappedMasterService::ExistKey(
     const std::string& key) {
+    ScopedAdmission admission(admission_.get(),
+                              AdmissionController::OpClass::READ, 1);
+    if (!admission.admitted()) {
+        return tl::make_unexpected(ErrorCode::MASTER_BUSY);
+    }
     return execute_rpc(
-        "ExistKey", [&] { return master_service_.ExistKey(key); },
+        "ExistKey",
+        [&] {
+            if (follower_) {
+                return follower_->ExistKey(key);
+            }
+            return OnShardOf(key,
+                             [&] { return master_service_.ExistKey(key); });
+        },
         [&](auto& timer) { timer.LogRequest("key=", key); },
         [] { MasterMetricManager::instance().inc_exist_key_requests(); },
         [] { MasterMetricManager::instance().inc_exist_key_failures(); });
@@ -190,11 +255,29 @@ tl::expected<bool, ErrorCode> WrappedMasterService::ExistKey(
 
 std::vector<tl::expected<bool, ErrorCode>> WrappedMasterService::BatchExistKey(
     const std::vector<std::string>& keys) {
+    ScopedRpcLatency latency("BatchExistKey");
     ScopedVLogTimer timer(1, "BatchExistKey");
     timer.LogRequest("keys_count=", keys.size());
     MasterMetricManager::instance().inc_batch_exist_key_requests();
+    ScopedAdmission admission(admission_.get(),
+                              AdmissionController::OpClass::READ, keys.size());
+    if (!admission.admitted()) {
+        timer.LogResponse("error_code=", ErrorCode::MASTER_BUSY);
+        return std::vector<tl::expected<bool, ErrorCode>>(
+            keys.size(), tl::make_unexpected(ErrorCode::MASTER_BUSY));
+    }
 
-    auto result = master_service_.BatchExistKey(keys);
+    std::vector<tl::expected<bool, ErrorCode>> result;
+    if (follower_) {
+        result = follower_->BatchExistKey(keys);
+    } else if (shard_affinity_) {
+        result = OnShardsOf<tl::expected<bool, ErrorCode>>(
+            keys, [&](const std::vector<size_t>& part) {
+                return master_service_.BatchExistKey(Select(keys, part));
+            });
+    } else {
+        result = master_service_.BatchExistKey(keys);
+    }
 
     size_t failure_count = 0;
     for (size_t i = 0; i < result.size(); ++i) {
@@ -212,10 +295,128 @@ std::vector<tl::expected<bool, ErrorCode>> WrappedMasterService::BatchExistKey(
     return result;
 }
 
+std::vector<tl::expected<void, ErrorCode>> WrappedMasterService::BatchTouch(
+    const std::vector<std::string>& keys, uint64_t ttl_ms,
+    uint64_t next_use_ms) {
+    ScopedRpcLatency latency("BatchTouch");
+    ScopedVLogTimer timer(1, "BatchTouch");
+    timer.LogRequest("keys_count=", keys.size(), ", ttl_ms=", ttl_ms,
+                     ", next_use_ms=", next_use_ms);
+    ScopedAdmission admission(admission_.get(),
+                              AdmissionController::OpClass::READ, keys.size());
+    if (!admission.admitted()) {
+        timer.LogResponse("error_code=", ErrorCode::MASTER_BUSY);
+        return std::vector<tl::expected<void, ErrorCode>>(
+            keys.size(), tl::make_unexpected(ErrorCode::MASTER_BUSY));
+    }
+
+    std::vector<tl::expected<void, ErrorCode>> result;
+    if (shard_affinity_) {
+        result = OnShardsOf<tl::expected<void, ErrorCode>>(
+            keys, [&](const std::vector<size_t>& part) {
+                return master_service_.BatchTouch(Select(keys, part), ttl_ms,
+                                                  next_use_ms);
+            });
+    } else {
+        result = master_service_.BatchTouch(keys, ttl_ms, next_use_ms);
+    }
+
+    // Missing keys are expected, e.g. evicted since they were scheduled
+    size_t failure_count = 0;
+    for (const auto& touched : result) {
+        if (!touched.has_value()) {
+            failure_count++;
+        }
+    }
+    timer.LogResponse("total=", result.size(),
+                      ", success=", result.size() - failure_count,
+                      ", failures=", failure_count);
+    return result;
+}
+
+tl::expected<PrefixMatchResult, ErrorCode>
+WrappedMasterService::LongestPrefixMatch(const std::vector<std::string>& keys,
+                                         bool with_replicas) {
+    ScopedAdmission admission(admission_.get(),
+                              AdmissionController::OpClass::READ, keys.size());
+    if (!admission.admitted()) {
+        return tl::make_unexpected(ErrorCode::MASTER_BUSY);
+    }
+    return execute_rpc(
+        "LongestPrefixMatch",
+        [&] {
+            return master_service_.LongestPrefixMatch(keys, with_replicas);
+        },
+        [&](auto& timer) {
+            timer.LogRequest("keys_count=", keys.size(),
+                             ", with_replicas=", with_replicas);
+        },
+        [] {
+            MasterMetricManager::instance().inc_longest_prefix_match_requests();
+        },
+        [] {
+            MasterMetricManager::instance().inc_longest_prefix_match_failures();
+        });
+}
+
+tl::expected<KeyLocationResult, ErrorCode>
+WrappedMasterService::BatchQueryLocation(const std::vector<std::string>& keys,
+                                         bool with_prefix_hits) {
+    ScopedRpcLatency latency("BatchQueryLocation");
+    ScopedVLogTimer timer(1, "BatchQueryLocation");
+    timer.LogRequest("keys_count=", keys.size(),
+                     ", with_prefix_hits=", with_prefix_hits);
+    ScopedAdmission admission(admission_.get(),
+                              AdmissionController::OpClass::READ, keys.size());
+    if (!admission.admitted()) {
+        timer.LogResponse("error_code=", ErrorCode::MASTER_BUSY);
+        return tl::make_unexpected(ErrorCode::MASTER_BUSY);
+    }
+
+    auto result = master_service_.BatchQueryLocation(keys, with_prefix_hits);
+
+    if (result) {
+        timer.LogResponse("segments=", result->segments.size());
+    } else {
+        timer.LogResponse("error_code=", result.error());
+    }
+    return result;
+}
+
+tl::expected<KeyScanResult, ErrorCode> WrappedMasterService::ScanKeys(
+    const std::string& prefix, const std::string& cursor, uint64_t limit) {
+    ScopedRpcLatency latency("ScanKeys");
+    ScopedVLogTimer timer(1, "ScanKeys");
+    timer.LogRequest("prefix=", prefix, ", cursor=", cursor,
+                     ", limit=", limit);
+
+    auto result = master_service_.ScanKeys(prefix, cursor, limit);
+
+    if (result) {
+        timer.LogResponse("keys=", result->keys.size(),
+                          ", next_cursor=", result->next_cursor);
+    } else {
+        timer.LogResponse("error_code=", result.error());
+    }
+    return result;
+}
+
 tl::expected<std::vector<Replica::Descriptor>, ErrorCode>
 WrappedMasterService::GetReplicaList(const std::string& key) {
+    ScopedAdmission admission(admission_.get(),
+                              AdmissionController::OpClass::READ, 1);
+    if (!admission.admitted()) {
+        return tl::make_unexpected(ErrorCode::MASTER_BUSY);
+    }
     return execute_rpc(
-        "GetReplicaList", [&] { return master_service_.GetReplicaList(key); },
+        "GetReplicaList",
+        [&] {
+            if (follower_) {
+                return follower_->GetReplicaList(key);
+            }
+            return OnShardOf(
+                key, [&] { return master_service_.GetReplicaList(key); });
+        },
         [&](auto& timer) { timer.LogRequest("key=", key); },
         [] { MasterMetricManager::instance().inc_get_replica_list_requests(); },
         [] {
@@ -226,16 +427,31 @@ WrappedMasterService::GetReplicaList(const std::string& key) {
 std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
 WrappedMasterService::BatchGetReplicaList(
     const std::vector<std::string>& keys) {
+    ScopedRpcLatency latency("BatchGetReplicaList");
     ScopedVLogTimer timer(1, "BatchGetReplicaList");
     timer.LogRequest("keys_count=", keys.size());
     MasterMetricManager::instance().inc_batch_get_replica_list_requests();
+    ScopedAdmission admission(admission_.get(),
+                              AdmissionController::OpClass::READ, keys.size());
+    if (!admission.admitted()) {
+        timer.LogResponse("error_code=", ErrorCode::MASTER_BUSY);
+        return std::vector<
+            tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>(
+            keys.size(), tl::make_unexpected(ErrorCode::MASTER_BUSY));
+    }
 
     std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
         results;
-    results.reserve(keys.size());
-
-    for (const auto& key : keys) {
-        results.emplace_back(master_service_.GetReplicaList(key));
+    if (follower_) {
+        results = follower_->BatchGetReplicaList(keys);
+    } else if (shard_affinity_) {
+        results = OnShardsOf<
+            tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>(
+            keys, [&](const std::vector<size_t>& part) {
+                return master_service_.BatchGetReplicaList(Select(keys, part));
+            });
+    } else {
+        results = master_service_.BatchGetReplicaList(keys);
     }
 
     size_t failure_count = 0;
@@ -255,13 +471,27 @@ WrappedMasterService::BatchGetReplicaList(
     return results;
 }
 
+PackedReplicaLists WrappedMasterService::BatchGetReplicaListPacked(
+    const std::vector<std::string>& keys) {
+    return PackedReplicaLists::Pack(BatchGetReplicaList(keys));
+}
+
 tl::expected<std::vector<Replica::Descriptor>, ErrorCode>
 WrappedMasterService::PutStart(const std::string& key,
                                const std::vector<uint64_t>& slice_lengths,
                                const ReplicateConfig& config) {
+    ScopedAdmission admission(admission_.get(),
+                              AdmissionController::OpClass::WRITE, 1);
+    if (!admission.admitted()) {
+        return tl::make_unexpected(ErrorCode::MASTER_BUSY);
+    }
     return execute_rpc(
         "PutStart",
-        [&] { return master_service_.PutStart(key, slice_lengths, config); },
+        [&] {
+            return OnShardOf(key, [&] {
+                return master_service_.PutStart(key, slice_lengths, config);
+            });
+        },
         [&](auto& timer) {
             timer.LogRequest("key=", key,
                              ", slice_lengths=", slice_lengths.size());
@@ -273,7 +503,10 @@ WrappedMasterService::PutStart(const std::string& key,
 tl::expected<void, ErrorCode> WrappedMasterService::PutEnd(
     const std::string& key) {
     return execute_rpc(
-        "PutEnd", [&] { return master_service_.PutEnd(key); },
+        "PutEnd",
+        [&] {
+            return OnShardOf(key, [&] { return master_service_.PutEnd(key); });
+        },
         [&](auto& timer) { timer.LogRequest("key=", key); },
         [] { MasterMetricManager::instance().inc_put_end_requests(); },
         [] { MasterMetricManager::instance().inc_put_end_failures(); });
@@ -282,7 +515,11 @@ tl::expected<void, ErrorCode> WrappedMasterService::PutEnd(
 tl::expected<void, ErrorCode> WrappedMasterService::PutRevoke(
     const std::string& key) {
     return execute_rpc(
-        "PutRevoke", [&] { return master_service_.PutRevoke(key); },
+        "PutRevoke",
+        [&] {
+            return OnShardOf(key,
+                             [&] { return master_service_.PutRevoke(key); });
+        },
         [&](auto& timer) { timer.LogRequest("key=", key); },
         [] { MasterMetricManager::instance().inc_put_revoke_requests(); },
         [] { MasterMetricManager::instance().inc_put_revoke_failures(); });
@@ -293,17 +530,32 @@ WrappedMasterService::BatchPutStart(
     const std::vector<std::string>& keys,
     const std::vector<std::vector<uint64_t>>& slice_lengths,
     const ReplicateConfig& config) {
+    ScopedRpcLatency latency("BatchPutStart");
     ScopedVLogTimer timer(1, "BatchPutStart");
     timer.LogRequest("keys_count=", keys.size());
     MasterMetricManager::instance().inc_batch_put_start_requests();
+    ScopedAdmission admission(admission_.get(),
+                              AdmissionController::OpClass::WRITE,
+                              keys.size());
+    if (!admission.admitted()) {
+        timer.LogResponse("error_code=", ErrorCode::MASTER_BUSY);
+        return std::vector<
+            tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>(
+            keys.size(), tl::make_unexpected(ErrorCode::MASTER_BUSY));
+    }
 
     std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
         results;
-    results.reserve(keys.size());
-
-    for (size_t i = 0; i < keys.size(); ++i) {
-        results.emplace_back(
-            master_service_.PutStart(keys[i], slice_lengths[i], config));
+    // Mismatched sizes are rejected for all keys by the master service
+    if (shard_affinity_ && keys.size() == slice_lengths.size()) {
+        results = OnShardsOf<
+            tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>(
+            keys, [&](const std::vector<size_t>& part) {
+                return master_service_.BatchPutStart(
+                    Select(keys, part), Select(slice_lengths, part), config);
+            });
+    } else {
+        results = master_service_.BatchPutStart(keys, slice_lengths, config);
     }
 
     size_t failure_count = 0;
@@ -324,15 +576,19 @@ WrappedMasterService::BatchPutStart(
 
 std::vector<tl::expected<void, ErrorCode>> WrappedMasterService::BatchPutEnd(
     const std::vector<std::string>& keys) {
+    ScopedRpcLatency latency("BatchPutEnd");
     ScopedVLogTimer timer(1, "BatchPutEnd");
     timer.LogRequest("keys_count=", keys.size());
     MasterMetricManager::instance().inc_batch_put_end_requests();
 
     std::vector<tl::expected<void, ErrorCode>> results;
-    results.reserve(keys.size());
-
-    for (const auto& key : keys) {
-        results.emplace_back(master_service_.PutEnd(key));
+    if (shard_affinity_) {
+        results = OnShardsOf<tl::expected<void, ErrorCode>>(
+            keys, [&](const std::vector<size_t>& part) {
+                return master_service_.BatchPutEnd(Select(keys, part));
+            });
+    } else {
+        results = master_service_.BatchPutEnd(keys);
     }
 
     size_t failure_count = 0;
@@ -353,15 +609,19 @@ std::vector<tl::expected<void, ErrorCode>> WrappedMasterService::BatchPutEnd(
 
 std::vector<tl::expected<void, ErrorCode>> WrappedMasterService::BatchPutRevoke(
     const std::vector<std::string>& keys) {
+    ScopedRpcLatency latency("BatchPutRevoke");
     ScopedVLogTimer timer(1, "BatchPutRevoke");
     timer.LogRequest("keys_count=", keys.size());
     MasterMetricManager::instance().inc_batch_put_revoke_requests();
 
     std::vector<tl::expected<void, ErrorCode>> results;
-    results.reserve(keys.size());
-
-    for (const auto& key : keys) {
-        results.emplace_back(master_service_.PutRevoke(key));
+    if (shard_affinity_) {
+        results = OnShardsOf<tl::expected<void, ErrorCode>>(
+            keys, [&](const std::vector<size_t>& part) {
+                return master_service_.BatchPutRevoke(Select(keys, part));
+            });
+    } else {
+        results = master_service_.BatchPutRevoke(keys);
     }
 
     size_t failure_count = 0;
@@ -381,16 +641,289 @@ std::vector<tl::expected<void, ErrorCode>> WrappedMasterService::BatchPutRevoke(
     return results;
 }
 
+tl::expected<void, ErrorCode> WrappedMasterService::PutInline(
+    const std::string& key, const std::string& value,
+    const ReplicateConfig& config) {
+    ScopedRpcLatency latency("PutInline");
+    ScopedVLogTimer timer(1, "PutInline");
+    timer.LogRequest("key=", key, ", value_length=", value.size());
+    ScopedAdmission admission(admission_.get(),
+                              AdmissionController::OpClass::WRITE, 1);
+    if (!admission.admitted()) {
+        timer.LogResponse("error_code=", ErrorCode::MASTER_BUSY);
+        return tl::make_unexpected(ErrorCode::MASTER_BUSY);
+    }
+
+    auto result = OnShardOf(
+        key, [&] { return master_service_.PutInline(key, value, config); });
+
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<AllocationCredit, ErrorCode>
+WrappedMasterService::GrantAllocationCredit(const UUID& client_id,
+                                            uint64_t size) {
+    ScopedRpcLatency latency("GrantAllocationCredit");
+    ScopedVLogTimer timer(1, "GrantAllocationCredit");
+    timer.LogRequest("client_id=", client_id, ", size=", size);
+    ScopedAdmission admission(admission_.get(),
+                              AdmissionController::OpClass::WRITE, 1);
+    if (!admission.admitted()) {
+        timer.LogResponse("error_code=", ErrorCode::MASTER_BUSY);
+        return tl::make_unexpected(ErrorCode::MASTER_BUSY);
+    }
+
+    auto result = master_service_.GrantAllocationCredit(client_id, size);
+
+    if (result) {
+        timer.LogResponse("credit_id=", result->id,
+                          ", ttl_ms=", result->ttl_ms);
+    } else {
+        timer.LogResponse("error_code=", result.error());
+    }
+    return result;
+}
+
+std::vector<tl::expected<void, ErrorCode>>
+WrappedMasterService::CommitCreditPuts(const UUID& client_id,
+                                       uint64_t credit_id,
+                                       const std::vector<CreditPut>& puts) {
+    ScopedRpcLatency latency("CommitCreditPuts");
+    ScopedVLogTimer timer(1, "CommitCreditPuts");
+    timer.LogRequest("client_id=", client_id, ", credit_id=", credit_id,
+                     ", puts_count=", puts.size());
+
+    auto results =
+        master_service_.CommitCreditPuts(client_id, credit_id, puts);
+
+    size_t failure_count = 0;
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (!results[i].has_value() &&
+            results[i].error() != ErrorCode::OBJECT_ALREADY_EXISTS) {
+            failure_count++;
+            LOG(ERROR) << "CommitCreditPuts failed for key[" << i << "] '"
+                       << puts[i].key << "': " << toString(results[i].error());
+        }
+    }
+
+    timer.LogResponse("total=", results.size(),
+                      ", success=", results.size() - failure_count,
+                      ", failures=", failure_count);
+    return results;
+}
+
+tl::expected<void, ErrorCode> WrappedMasterService::ReturnAllocationCredit(
+    const UUID& client_id, uint64_t credit_id) {
+    ScopedRpcLatency latency("ReturnAllocationCredit");
+    ScopedVLogTimer timer(1, "ReturnAllocationCredit");
+    timer.LogRequest("client_id=", client_id, ", credit_id=", credit_id);
+
+    auto result = master_service_.ReturnAllocationCredit(client_id, credit_id);
+
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<void, ErrorCode> WrappedMasterService::PutDiskReplica(
+    const std::string& key, const DiskDescriptor& disk) {
+    ScopedRpcLatency latency("PutDiskReplica");
+    ScopedVLogTimer timer(1, "PutDiskReplica");
+    timer.LogRequest("key=", key, ", file_path=", disk.file_path);
+
+    auto result = master_service_.PutDiskReplica(key, disk);
+
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+std::vector<tl::expected<void, ErrorCode>>
+WrappedMasterService::BatchPutDiskReplica(
+    const std::vector<std::string>& keys,
+    const std::vector<DiskDescriptor>& disks) {
+    ScopedRpcLatency latency("BatchPutDiskReplica");
+    ScopedVLogTimer timer(1, "BatchPutDiskReplica");
+    timer.LogRequest("keys_count=", keys.size());
+    ScopedAdmission admission(admission_.get(),
+                              AdmissionController::OpClass::WRITE,
+                              keys.size());
+    if (!admission.admitted()) {
+        timer.LogResponse("error_code=", ErrorCode::MASTER_BUSY);
+        return std::vector<tl::expected<void, ErrorCode>>(
+            keys.size(), tl::make_unexpected(ErrorCode::MASTER_BUSY));
+    }
+
+    std::vector<tl::expected<void, ErrorCode>> results;
+    // Mismatched sizes are rejected for all keys by the master service
+    if (shard_affinity_ && keys.size() == disks.size()) {
+        results = OnShardsOf<tl::expected<void, ErrorCode>>(
+            keys, [&](const std::vector<size_t>& part) {
+                return master_service_.BatchPutDiskReplica(
+                    Select(keys, part), Select(disks, part));
+            });
+    } else {
+        results = master_service_.BatchPutDiskReplica(keys, disks);
+    }
+
+    size_t failure_count = 0;
+    for (const auto& result : results) {
+        if (!result.has_value()) {
+            failure_count++;
+        }
+    }
+    timer.LogResponse("total=", results.size(),
+                      ", success=", results.size() - failure_count,
+                      ", failures=", failure_count);
+    return results;
+}
+
+tl::expected<std::vector<Replica::Descriptor>, ErrorCode>
+WrappedMasterService::PromoteStart(const std::string& key,
+                                   const std::vector<uint64_t>& slice_lengths,
+                                   const ReplicateConfig& config) {
+    ScopedRpcLatency latency("PromoteStart");
+    ScopedVLogTimer timer(1, "PromoteStart");
+    timer.LogRequest("key=", key, ", slice_count=", slice_lengths.size());
+
+    auto result = master_service_.PromoteStart(key, slice_lengths, config);
+
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<CompactionTask, ErrorCode>
+WrappedMasterService::CompactionStart(const std::string& segment_name) {
+    ScopedRpcLatency latency("CompactionStart");
+    ScopedVLogTimer timer(1, "CompactionStart");
+    timer.LogRequest("segment_name=", segment_name);
+
+    auto result = master_service_.CompactionStart(segment_name);
+
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<void, ErrorCode> WrappedMasterService::CompactionEnd(
+    const std::string& key, uint64_t target) {
+    ScopedRpcLatency latency("CompactionEnd");
+    ScopedVLogTimer timer(1, "CompactionEnd");
+    timer.LogRequest("key=", key, ", target=", target);
+
+    auto result = master_service_.CompactionEnd(key, target);
+
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<void, ErrorCode> WrappedMasterService::CompactionRevoke(
+    const std::string& key, uint64_t target) {
+    ScopedRpcLatency latency("CompactionRevoke");
+    ScopedVLogTimer timer(1, "CompactionRevoke");
+    timer.LogRequest("key=", key, ", target=", target);
+
+    auto result = master_service_.CompactionRevoke(key, target);
+
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<void, ErrorCode> WrappedMasterService::CopyReplica(
+    const std::string& key, const std::string& target_segment) {
+    ScopedRpcLatency latency("CopyReplica");
+    ScopedVLogTimer timer(1, "CopyReplica");
+    timer.LogRequest("key=", key, ", target_segment=", target_segment);
+
+    auto result = master_service_.CopyReplica(key, target_segment);
+
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<void, ErrorCode> WrappedMasterService::MigrateReplica(
+    const std::string& key, const std::string& source_segment,
+    const std::string& target_segment) {
+    ScopedRpcLatency latency("MigrateReplica");
+    ScopedVLogTimer timer(1, "MigrateReplica");
+    timer.LogRequest("key=", key, ", source_segment=", source_segment,
+                     ", target_segment=", target_segment);
+
+    auto result =
+        master_service_.MigrateReplica(key, source_segment, target_segment);
+
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<uint64_t, ErrorCode> WrappedMasterService::Broadcast(
+    const std::string& key, const std::vector<std::string>& target_segments) {
+    ScopedRpcLatency latency("Broadcast");
+    ScopedVLogTimer timer(1, "Broadcast");
+    timer.LogRequest("key=", key,
+                     ", target_segment_count=", target_segments.size());
+
+    auto result = master_service_.Broadcast(key, target_segments);
+
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+std::vector<tl::expected<void, ErrorCode>> WrappedMasterService::Prefetch(
+    const std::vector<std::string>& keys, const std::string& target_segment) {
+    ScopedRpcLatency latency("Prefetch");
+    ScopedVLogTimer timer(1, "Prefetch");
+    timer.LogRequest("keys_count=", keys.size(),
+                     ", target_segment=", target_segment);
+    // Prefetches allocate like puts
+    ScopedAdmission admission(admission_.get(),
+                              AdmissionController::OpClass::WRITE,
+                              keys.size());
+    if (!admission.admitted()) {
+        timer.LogResponse("error_code=", ErrorCode::MASTER_BUSY);
+        return std::vector<tl::expected<void, ErrorCode>>(
+            keys.size(), tl::make_unexpected(ErrorCode::MASTER_BUSY));
+    }
+
+    auto result = master_service_.Prefetch(keys, target_segment);
+
+    size_t failure_count = 0;
+    for (const auto& queued : result) {
+        if (!queued.has_value()) {
+            failure_count++;
+        }
+    }
+    timer.LogResponse("total=", result.size(),
+                      ", success=", result.size() - failure_count,
+                      ", failures=", failure_count);
+    return result;
+}
+
+std::vector<tl::expected<bool, ErrorCode>> WrappedMasterService::CancelPrefetch(
+    const std::vector<std::string>& keys, const std::string& target_segment) {
+    ScopedRpcLatency latency("CancelPrefetch");
+    ScopedVLogTimer timer(1, "CancelPrefetch");
+    timer.LogRequest("keys_count=", keys.size(),
+                     ", target_segment=", target_segment);
+
+    auto result = master_service_.CancelPrefetch(keys, target_segment);
+
+    timer.LogResponse("total=", result.size());
+    return result;
+}
+
 tl::expected<void, ErrorCode> WrappedMasterService::Remove(
     const std::string& key) {
     return execute_rpc(
-        "Remove", [&] { return master_service_.Remove(key); },
+        "Remove",
+        [&] {
+            return OnShardOf(key, [&] { return master_service_.Remove(key); });
+        },
         [&](auto& timer) { timer.LogRequest("key=", key); },
         [] { MasterMetricManager::instance().inc_remove_requests(); },
         [] { MasterMetricManager::instance().inc_remove_failures(); });
 }
 
 long WrappedMasterService::RemoveAll() {
+    ScopedRpcLatency latency("RemoveAll");
     ScopedVLogTimer timer(1, "RemoveAll");
     timer.LogRequest("action=remove_all_objects");
     MasterMetricManager::instance().inc_remove_all_requests();
@@ -399,6 +932,30 @@ long WrappedMasterService::RemoveAll() {
     return result;
 }
 
+tl::expected<long, ErrorCode> WrappedMasterService::RemoveByTag(
+    const std::string& tag) {
+    ScopedRpcLatency latency("RemoveByTag");
+    ScopedVLogTimer timer(1, "RemoveByTag");
+    timer.LogRequest("tag=", tag);
+
+    auto result = master_service_.RemoveByTag(tag);
+
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<long, ErrorCode> WrappedMasterService::RemoveByPrefix(
+    const std::string& prefix) {
+    ScopedRpcLatency latency("RemoveByPrefix");
+    ScopedVLogTimer timer(1, "RemoveByPrefix");
+    timer.LogRequest("prefix=", prefix);
+
+    auto result = master_service_.RemoveByPrefix(prefix);
+
+    timer.LogResponseExpected(result);
+    return result;
+}
+
 tl::expected<void, ErrorCode> WrappedMasterService::MountSegment(
     const Segment& segment, const UUID& client_id) {
     return execute_rpc(
@@ -439,7 +996,56 @@ tl::expected<void, ErrorCode> WrappedMasterService::UnmountSegment(
         [] { MasterMetricManager::instance().inc_unmount_segment_failures(); });
 }
 
+tl::expected<void, ErrorCode> WrappedMasterService::DrainSegment(
+    const UUID& segment_id) {
+    ScopedRpcLatency latency("DrainSegment");
+    ScopedVLogTimer timer(1, "DrainSegment");
+    timer.LogRequest("segment_id=", segment_id);
+
+    auto result = master_service_.DrainSegment(segment_id);
+
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<uint64_t, ErrorCode> WrappedMasterService::QueryDrain(
+    const UUID& segment_id) {
+    ScopedRpcLatency latency("QueryDrain");
+    ScopedVLogTimer timer(1, "QueryDrain");
+    timer.LogRequest("segment_id=", segment_id);
+
+    auto result = master_service_.QueryDrain(segment_id);
+
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<Segment, ErrorCode> WrappedMasterService::AttachSegment(
+    const UUID& memory_id, const UUID& client_id) {
+    ScopedRpcLatency latency("AttachSegment");
+    ScopedVLogTimer timer(1, "AttachSegment");
+    timer.LogRequest("memory_id=", memory_id, ", client_id=", client_id);
+
+    auto result = master_service_.AttachSegment(memory_id, client_id);
+
+    timer.LogResponseExpected(result);
+    return result;
+}
+
+tl::expected<void, ErrorCode> WrappedMasterService::DetachSegment(
+    const UUID& memory_id, const UUID& client_id) {
+    ScopedRpcLatency latency("DetachSegment");
+    ScopedVLogTimer timer(1, "DetachSegment");
+    timer.LogRequest("memory_id=", memory_id, ", client_id=", client_id);
+
+    auto result = master_service_.DetachSegment(memory_id, client_id);
+
+    timer.LogResponseExpected(result);
+    return result;
+}
+
 tl::expected<std::string, ErrorCode> WrappedMasterService::GetFsdir() {
+    ScopedRpcLatency latency("GetFsdir");
     ScopedVLogTimer timer(1, "GetFsdir");
     timer.LogRequest("action=get_fsdir");
 
@@ -449,8 +1055,22 @@ tl::expected<std::string, ErrorCode> WrappedMasterService::GetFsdir() {
     return result;
 }
 
+tl::expected<ReplicaCacheInfo, ErrorCode>
+WrappedMasterService::GetReplicaCacheInfo() {
+    ScopedRpcLatency latency("GetReplicaCacheInfo");
+    ScopedVLogTimer timer(1, "GetReplicaCacheInfo");
+    timer.LogRequest("action=get_replica_cache_info");
+
+    tl::expected<ReplicaCacheInfo, ErrorCode> result =
+        master_service_.GetReplicaCacheInfo();
+
+    timer.LogResponseExpected(result);
+    return result;
+}
+
 tl::expected<std::pair<ViewVersionId, ClientStatus>, ErrorCode>
 WrappedMasterService::Ping(const UUID& client_id) {
+    ScopedRpcLatency latency("Ping");
     ScopedVLogTimer timer(1, "Ping");
     timer.LogRequest("client_id=", client_id);
 
@@ -462,6 +1082,75 @@ WrappedMasterService::Ping(const UUID& client_id) {
     return result;
 }
 
+tl::expected<MetadataChanges, ErrorCode>
+WrappedMasterService::GetMetadataChanges(uint64_t seq, uint64_t max_keys) {
+    ScopedRpcLatency latency("GetMetadataChanges");
+    ScopedVLogTimer timer(1, "GetMetadataChanges");
+    timer.LogRequest("seq=", seq, ", max_keys=", max_keys);
+
+    auto result = master_service_.GetMetadataChanges(seq, max_keys);
+
+    if (result) {
+        timer.LogResponse("next_seq=", result->next_seq,
+                          ", reset=", result->reset,
+                          ", entries=", result->entries.size());
+    } else {
+        timer.LogResponse("error_code=", result.error());
+    }
+    return result;
+}
+
+tl::expected<MetadataSnapshot, ErrorCode>
+WrappedMasterService::GetMetadataSnapshot(uint64_t shard) {
+    ScopedRpcLatency latency("GetMetadataSnapshot");
+    ScopedVLogTimer timer(1, "GetMetadataSnapshot");
+    timer.LogRequest("shard=", shard);
+
+    auto result = master_service_.GetMetadataSnapshot(shard);
+
+    if (result) {
+        timer.LogResponse("next_shard=", result->next_shard,
+                          ", entries=", result->entries.size());
+    } else {
+        timer.LogResponse("error_code=", result.error());
+    }
+    return result;
+}
+
+tl::expected<KeyFilterUpdate, ErrorCode> WrappedMasterService::GetKeyFilter(
+    uint64_t seq) {
+    ScopedRpcLatency latency("GetKeyFilter");
+    ScopedVLogTimer timer(1, "GetKeyFilter");
+    timer.LogRequest("seq=", seq);
+
+    auto result = master_service_.GetKeyFilter(seq);
+
+    if (result) {
+        timer.LogResponse("next_seq=", result->next_seq,
+                          ", reset=", result->reset,
+                          ", keys=", result->keys.size());
+    } else {
+        timer.LogResponse("error_code=", result.error());
+    }
+    return result;
+}
+
+void WrappedMasterService::FollowMaster(
+    const std::string& master_addr, std::chrono::milliseconds max_staleness) {
+    follower_ = std::make_unique<MetadataFollower>(master_addr, max_staleness);
+    follower_->Start();
+}
+
+void WrappedMasterService::EnableAdmissionControl(
+    const AdmissionConfig& config) {
+    admission_ = std::make_unique<AdmissionController>(config);
+}
+
+tl::expected<void, ErrorCode> WrappedMasterService::RestoreMetadata(
+    std::vector<MetadataEntry> entries) {
+    return master_service_.RestoreMetadata(std::move(entries));
+}
+
 void RegisterRpcService(
     coro_rpc::coro_rpc_server& server,
     mooncake::WrappedMasterService& wrapped_master_service) {
@@ -472,6 +1161,9 @@ void RegisterRpcService(
     server
         .register_handler<&mooncake::WrappedMasterService::BatchGetReplicaList>(
             &wrapped_master_service);
+    server.register_handler<
+        &mooncake::WrappedMasterService::BatchGetReplicaListPacked>(
+        &wrapped_master_service);
     server.register_handler<&mooncake::WrappedMasterService::PutStart>(
         &wrapped_master_service);
     server.register_handler<&mooncake::WrappedMasterService::PutEnd>(
@@ -488,18 +1180,101 @@ void RegisterRpcService(
         &wrapped_master_service);
     server.register_handler<&mooncake::WrappedMasterService::RemoveAll>(
         &wrapped_master_service);
+    server.register_handler<&mooncake::WrappedMasterService::RemoveByTag>(
+        &wrapped_master_service);
+    server.register_handler<&mooncake::WrappedMasterService::RemoveByPrefix>(
+        &wrapped_master_service);
     server.register_handler<&mooncake::WrappedMasterService::MountSegment>(
         &wrapped_master_service);
     server.register_handler<&mooncake::WrappedMasterService::ReMountSegment>(
         &wrapped_master_service);
     server.register_handler<&mooncake::WrappedMasterService::UnmountSegment>(
         &wrapped_master_service);
+    server.register_handler<&mooncake::WrappedMasterService::DrainSegment>(
+        &wrapped_master_service);
+    server.register_handler<&mooncake::WrappedMasterService::QueryDrain>(
+        &wrapped_master_service);
+    server.register_handler<&mooncake::WrappedMasterService::AttachSegment>(
+        &wrapped_master_service);
+    server.register_handler<&mooncake::WrappedMasterService::DetachSegment>(
+        &wrapped_master_service);
     server.register_handler<&mooncake::WrappedMasterService::Ping>(
         &wrapped_master_service);
     server.register_handler<&mooncake::WrappedMasterService::GetFsdir>(
         &wrapped_master_service);
+    server.register_handler<
+        &mooncake::WrappedMasterService::GetReplicaCacheInfo>(
+        &wrapped_master_service);
+    server.register_handler<&mooncake::WrappedMasterService::BatchExistKey>(
+        &wrapped_master_service);
+    server.register_handler<&mooncake::WrappedMasterService::BatchTouch>(
+        &wrapped_master_service);
+    server.register_handler<
+        &mooncake::WrappedMasterService::LongestPrefixMatch>(
+        &wrapped_master_service);
+    server.register_handler<
+        &mooncake::WrappedMasterService::BatchQueryLocation>(
+        &wrapped_master_service);
+    server.register_handler<&mooncake::WrappedMasterService::ScanKeys>(
+        &wrapped_master_service);
+    server.register_handler<&mooncake::WrappedMasterService::PutInline>(
+        &wrapped_master_service);
+    server.register_handler<
+        &mooncake::WrappedMasterService::GrantAllocationCredit>(
+        &wrapped_master_service);
+    server.register_handler<&mooncake::WrappedMasterService::CommitCreditPuts>(
+        &wrapped_master_service);
+    server.register_handler<
+        &mooncake::WrappedMasterService::ReturnAllocationCredit>(
+        &wrapped_master_service);
+    server.register_handler<&mooncake::WrappedMasterService::PutDiskReplica>(
+        &wrapped_master_service);
+    server.register_handler<
+        &mooncake::WrappedMasterService::BatchPutDiskReplica>(
+        &wrapped_master_service);
+    server.register_handler<&mooncake::WrappedMasterService::PromoteStart>(
+        &wrapped_master_service);
+    server.register_handler<&mooncake::WrappedMasterService::CompactionStart>(
+        &wrapped_master_service);
+    server.register_handler<&mooncake::WrappedMasterService::CompactionEnd>(
+        &wrapped_master_service);
+    server.register_handler<&mooncake::WrappedMasterService::CompactionRevoke>(
+        &wrapped_master_service);
+    server.register_handler<&mooncake::WrappedMasterService::CopyReplica>(
+        &wrapped_master_service);
+    server.register_handler<&mooncake::WrappedMasterService::MigrateReplica>(
+        &wrapped_master_service);
+    server.register_handler<&mooncake::WrappedMasterService::Broadcast>(
+        &wrapped_master_service);
+    server.register_handler<&mooncake::WrappedMasterService::Prefetch>(
+        &wrapped_master_service);
+    server.register_handler<&mooncake::WrappedMasterService::CancelPrefetch>(
+        &wrapped_master_service);
+    server.register_handler<
+        &mooncake::WrappedMasterService::GetMetadataChanges>(
+        &wrapped_master_service);
+    server.register_handler<
+        &mooncake::WrappedMasterService::GetMetadataSnapshot>(
+        &wrapped_master_service);
+    server.register_handler<&mooncake::WrappedMasterService::GetKeyFilter>(
+        &wrapped_master_service);
+}
+
+void RegisterFollowerRpcService(
+    coro_rpc::coro_rpc_server& server,
+    mooncake::WrappedMasterService& wrapped_master_service) {
+    server.register_handler<&mooncake::WrappedMasterService::ExistKey>(
+        &wrapped_master_service);
     server.register_handler<&mooncake::WrappedMasterService::BatchExistKey>(
         &wrapped_master_service);
+    server.register_handler<&mooncake::WrappedMasterService::GetReplicaList>(
+        &wrapped_master_service);
+    server
+        .register_handler<&mooncake::WrappedMasterService::BatchGetReplicaList>(
+            &wrapped_master_service);
+    server.register_handler<
+        &mooncake::WrappedMasterService::BatchGetReplicaListPacked>(
+        &wrapped_master_service);
 }
 
 }  // namespace mooncake
\ No newline at end of file
@@ -1,9 +1,40 @@
 #include "segment.h"
 
+#include <thread>
+
 #include "master_metric_manager.h"
 
 namespace mooncake {
 
+ScopedSegmentAccess::~ScopedSegmentAccess() {
+    if (allocators_changed_) {
+        segment_manager_->PublishAllocators();
+    }
+}
+
+void SegmentManager::PublishAllocators() {
+    auto old = allocator_set_.exchange(std::make_shared<const AllocatorSet>(
+        AllocatorSet{allocators_by_name_, allocators_}));
+    std::lock_guard<std::mutex> lock(retired_mutex_);
+    std::erase_if(retired_sets_,
+                  [](const auto& set) { return set.expired(); });
+    retired_sets_.push_back(old);
+}
+
+void SegmentManager::WaitForAllocations() {
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(retired_mutex_);
+            std::erase_if(retired_sets_,
+                          [](const auto& set) { return set.expired(); });
+            if (retired_sets_.empty()) {
+                return;
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
 ErrorCode ScopedSegmentAccess::MountSegment(const Segment& segment,
                                             const UUID& client_id) {
     const uintptr_t buffer = segment.base;
@@ -38,8 +69,10 @@ ErrorCode ScopedSegmentAccess::MountSegment(const Segment& segment,
     try {
         // SlabAllocator may throw an exception if the size or base is invalid
         // for the slab allocator.
-        allocator =
-            std::make_shared<BufferAllocator>(segment.name, buffer, size);
+        allocator = std::make_shared<BufferAllocator>(
+            segment.name, buffer, size, segment.topology,
+            segment_manager_->buffer_allocator_type_,
+            segment_manager_->free_delay_);
         if (!allocator) {
             LOG(ERROR) << "segment_name=" << segment.name
                        << ", error=failed_to_create_allocator";
@@ -53,6 +86,7 @@ ErrorCode ScopedSegmentAccess::MountSegment(const Segment& segment,
 
     segment_manager_->allocators_.push_back(allocator);
     segment_manager_->allocators_by_name_[segment.name].push_back(allocator);
+    allocators_changed_ = true;
     segment_manager_->client_segments_[client_id].push_back(segment.id);
     segment_manager_->mounted_segments_[segment.id] = {
         segment, SegmentStatus::OK, std::move(allocator)};
@@ -109,8 +143,24 @@ ErrorCode ScopedSegmentAccess::PrepareUnmountSegment(
     auto& segment = mounted_segment.segment;
     metrics_dec_capacity = segment.size;
 
-    // Remove the allocator from the segment manager
-    std::shared_ptr<BufferAllocator> allocator = mounted_segment.buf_allocator;
+    // Draining segments are out of the allocators already
+    if (mounted_segment.status == SegmentStatus::OK) {
+        RemoveAllocator(mounted_segment);
+    }
+
+    // 3. Remove from mounted_segment
+    mounted_segment.buf_allocator.reset();
+
+    // Set the segment status to UNMOUNTING
+    mounted_segment.status = SegmentStatus::UNMOUNTING;
+
+    return ErrorCode::OK;
+}
+
+void ScopedSegmentAccess::RemoveAllocator(
+    const MountedSegment& mounted_segment) {
+    const auto& segment = mounted_segment.segment;
+    const auto& allocator = mounted_segment.buf_allocator;
 
     // 1. Remove from allocators
     auto alloc_it = std::find(segment_manager_->allocators_.begin(),
@@ -122,6 +172,8 @@ ErrorCode ScopedSegmentAccess::PrepareUnmountSegment(
                    << ", error=allocator_not_found_in_allocators";
     }
 
+    allocators_changed_ = true;
+
     // 2. Remove from allocators_by_name
     bool found_in_allocators_by_name = false;
     auto name_it = segment_manager_->allocators_by_name_.find(segment.name);
@@ -141,13 +193,38 @@ ErrorCode ScopedSegmentAccess::PrepareUnmountSegment(
         LOG(ERROR) << "segment_name=" << segment.name
                    << ", error=allocator_not_found_in_allocators_by_name";
     }
+}
 
-    // 3. Remove from mounted_segment
-    mounted_segment.buf_allocator.reset();
-
-    // Set the segment status to UNMOUNTING
-    mounted_segment.status = SegmentStatus::UNMOUNTING;
+ErrorCode ScopedSegmentAccess::DrainSegment(const UUID& segment_id,
+                                            Segment& segment) {
+    auto it = segment_manager_->mounted_segments_.find(segment_id);
+    if (it == segment_manager_->mounted_segments_.end()) {
+        LOG(WARNING) << "segment_id=" << segment_id
+                     << ", warn=segment_not_found";
+        return ErrorCode::SEGMENT_NOT_FOUND;
+    }
+    auto& mounted_segment = it->second;
+    if (mounted_segment.status == SegmentStatus::UNMOUNTING) {
+        LOG(ERROR) << "segment_id=" << segment_id
+                   << ", error=segment_is_unmounting";
+        return ErrorCode::UNAVAILABLE_IN_CURRENT_STATUS;
+    }
+    if (mounted_segment.status == SegmentStatus::OK) {
+        RemoveAllocator(mounted_segment);
+        mounted_segment.status = SegmentStatus::DRAINING;
+    }
+    segment = mounted_segment.segment;
+    return ErrorCode::OK;
+}
 
+ErrorCode ScopedSegmentAccess::GetDrainingUsage(const UUID& segment_id,
+                                                size_t& used) const {
+    auto it = segment_manager_->mounted_segments_.find(segment_id);
+    if (it == segment_manager_->mounted_segments_.end() ||
+        it->second.status != SegmentStatus::DRAINING) {
+        return ErrorCode::SEGMENT_NOT_FOUND;
+    }
+    used = it->second.buf_allocator->size();
     return ErrorCode::OK;
 }
 
@@ -199,6 +276,79 @@ ErrorCode ScopedSegmentAccess::GetClientSegments(
     return ErrorCode::OK;
 }
 
+ErrorCode ScopedSegmentAccess::GetSegment(const UUID& segment_id,
+                                          Segment& segment) const {
+    auto it = segment_manager_->mounted_segments_.find(segment_id);
+    if (it == segment_manager_->mounted_segments_.end()) {
+        return ErrorCode::SEGMENT_NOT_FOUND;
+    }
+    segment = it->second.segment;
+    return ErrorCode::OK;
+}
+
+ErrorCode ScopedSegmentAccess::FindMemorySegment(const UUID& memory_id,
+                                                 Segment& segment,
+                                                 UUID& client_id) const {
+    for (const auto& [owner, segment_ids] :
+         segment_manager_->client_segments_) {
+        for (const auto& segment_id : segment_ids) {
+            auto it = segment_manager_->mounted_segments_.find(segment_id);
+            if (it != segment_manager_->mounted_segments_.end() &&
+                it->second.status != SegmentStatus::UNMOUNTING &&
+                it->second.segment.memory_id == memory_id) {
+                segment = it->second.segment;
+                client_id = owner;
+                return ErrorCode::OK;
+            }
+        }
+    }
+    return ErrorCode::SEGMENT_NOT_FOUND;
+}
+
+ErrorCode ScopedSegmentAccess::AttachSegment(const UUID& memory_id,
+                                             const UUID& client_id,
+                                             Segment& segment) {
+    UUID owner;
+    ErrorCode err = FindMemorySegment(memory_id, segment, owner);
+    if (err != ErrorCode::OK || owner == client_id) {
+        return err;
+    }
+    auto& attached =
+        segment_manager_->mounted_segments_[segment.id].attached_clients;
+    if (std::find(attached.begin(), attached.end(), client_id) ==
+        attached.end()) {
+        attached.push_back(client_id);
+    }
+    return ErrorCode::OK;
+}
+
+void ScopedSegmentAccess::DetachSegment(const UUID& memory_id,
+                                        const UUID& client_id) {
+    for (auto& [segment_id, mounted_segment] :
+         segment_manager_->mounted_segments_) {
+        if (mounted_segment.segment.memory_id == memory_id) {
+            std::erase(mounted_segment.attached_clients, client_id);
+        }
+    }
+}
+
+void ScopedSegmentAccess::DetachClient(const UUID& client_id) {
+    for (auto& [segment_id, mounted_segment] :
+         segment_manager_->mounted_segments_) {
+        std::erase(mounted_segment.attached_clients, client_id);
+    }
+}
+
+ErrorCode ScopedSegmentAccess::GetAttachedClients(
+    const UUID& segment_id, std::vector<UUID>& clients) const {
+    auto it = segment_manager_->mounted_segments_.find(segment_id);
+    if (it == segment_manager_->mounted_segments_.end()) {
+        return ErrorCode::SEGMENT_NOT_FOUND;
+    }
+    clients = it->second.attached_clients;
+    return ErrorCode::OK;
+}
+
 ErrorCode ScopedSegmentAccess::GetAllSegments(
     std::vector<std::string>& all_segments) {
     all_segments.clear();
@@ -215,10 +365,14 @@ ErrorCode ScopedSegmentAccess::QuerySegments(const std::string& segment,
     const auto& allocators =
         segment_manager_->allocators_by_name_.find(segment);
     if (allocators != segment_manager_->allocators_by_name_.end()) {
-        // Allocators Only contains the segments with OK status, so just return
-        // the first one.
-        capacity = allocators->second[0]->capacity();
-        used = allocators->second[0]->size();
+        // Allocators only contain the segments with OK status. A segment
+        // grown with ResizeSegment has one per extent, all under its name.
+        capacity = 0;
+        used = 0;
+        for (const auto& allocator : allocators->second) {
+            capacity += allocator->capacity();
+            used += allocator->size();
+        }
     } else {
         VLOG(1) << "### DEBUG ### MasterService::QuerySegments(" << segment
                 << ") not found!";
@@ -226,4 +380,13 @@ ErrorCode ScopedSegmentAccess::QuerySegments(const std::string& segment,
         }
     return ErrorCode::OK;
 }
+
+std::vector<std::shared_ptr<BufferAllocator>>
+ScopedSegmentAccess::GetAllocators(const std::string& segment_name) const {
+    auto it = segment_manager_->allocators_by_name_.find(segment_name);
+    if (it == segment_manager_->allocators_by_name_.end()) {
+        return {};
+    }
+    return it->second;
+}
 }  // namespace mooncake
\ No newline at end of file
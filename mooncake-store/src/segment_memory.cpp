@@ -0,0 +1,508 @@
+#include "segment_memory.h"
+
+#include <Slab.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <numa.h>
+#include <numaif.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <sstream>
+#include <thread>
+
+#include "config.h"
+#include "memory_location.h"
+#include "topology.h"
+#include "transport/shm_transport/shm_transport.h"
+
+#ifdef USE_CUDA
+#include <cuda_runtime.h>
+#endif
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+#ifndef MFD_HUGE_SHIFT
+#define MFD_HUGE_SHIFT 26
+#endif
+
+#ifndef HUGETLBFS_MAGIC
+#define HUGETLBFS_MAGIC 0x958458f6
+#endif
+
+namespace mooncake {
+
+namespace {
+
+constexpr size_t kHugePage2M = 2ull << 20;
+constexpr size_t kHugePage1G = 1ull << 30;
+
+constexpr uint64_t kPersistentMagic = 0x4d4f4f4e53454731ull;  // "MOONSEG1"
+constexpr uint32_t kPersistentVersion = 1;
+
+// Header of the file of a persistent segment, in its first page
+struct PersistentHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t memory_id_first;
+    uint64_t memory_id_second;
+    uint64_t size;
+};
+
+size_t ConfiguredHugePageSize() {
+    const char* env = std::getenv("MC_STORE_HUGEPAGE_SIZE");
+    if (!env) {
+        return 0;
+    }
+    std::string value(env);
+    if (value == "2MB" || value == "2M") {
+        return kHugePage2M;
+    }
+    if (value == "1GB" || value == "1G") {
+        return kHugePage1G;
+    }
+    LOG(WARNING) << "Ignore value from environment variable "
+                    "MC_STORE_HUGEPAGE_SIZE: "
+                 << value;
+    return 0;
+}
+
+size_t ConfiguredPrefaultThreads() {
+    const char* env = std::getenv("MC_STORE_PREFAULT_THREADS");
+    if (!env) {
+        return 8;
+    }
+    int value = atoi(env);
+    if (value < 0 || value > 256) {
+        LOG(WARNING) << "Ignore value from environment variable "
+                        "MC_STORE_PREFAULT_THREADS: "
+                     << env;
+        return 8;
+    }
+    return value;
+}
+
+size_t RoundUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// Prefer numa_node for the pages of [data, data + length), -1 if it cannot
+int BindToNode(char* data, size_t length, int numa_node) {
+    if (numa_node < 0 || numa_available() < 0 || numa_node > numa_max_node()) {
+        return -1;
+    }
+    // Preferred rather than bound: a node short of (huge)pages falls back
+    // to others instead of failing page faults. Set before any page is
+    // faulted in
+    unsigned long nodemask[16] = {};
+    nodemask[numa_node / (8 * sizeof(unsigned long))] |=
+        1ul << (numa_node % (8 * sizeof(unsigned long)));
+    if (mbind(data, length, MPOL_PREFERRED, nodemask, sizeof(nodemask) * 8,
+              0)) {
+        PLOG(WARNING) << "Failed to place segment on NUMA node " << numa_node;
+        return -1;
+    }
+    return numa_node;
+}
+
+// Map length bytes of anonymous memory, with hugepages of hugepage_size if
+// not 0. With fd, the memory is a memfd other processes can map, returned
+// in *fd.
+void* MapMemory(size_t length, size_t hugepage_size, int* fd) {
+    const int huge_shift = hugepage_size == kHugePage1G ? 30 : 21;
+    if (!fd) {
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+        if (hugepage_size) {
+            flags |= MAP_HUGETLB | (huge_shift << MAP_HUGE_SHIFT);
+        }
+        return mmap(nullptr, length, PROT_READ | PROT_WRITE, flags, -1, 0);
+    }
+    unsigned int memfd_flags = MFD_CLOEXEC;
+    if (hugepage_size) {
+        memfd_flags |= MFD_HUGETLB | (huge_shift << MFD_HUGE_SHIFT);
+    }
+    *fd = memfd_create("mooncake-segment", memfd_flags);
+    if (*fd < 0) {
+        return MAP_FAILED;
+    }
+    void* addr = MAP_FAILED;
+    if (ftruncate(*fd, length) == 0) {
+        addr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, *fd,
+                    0);
+    }
+    if (addr == MAP_FAILED) {
+        const int saved_errno = errno;
+        close(*fd);
+        *fd = -1;
+        errno = saved_errno;
+    }
+    return addr;
+}
+
+// Touch one byte per page, with the pages split evenly between threads.
+// Reading rather than writing keeps the content of persistent memory
+void Prefault(char* data, size_t size, size_t page_size, size_t threads,
+              bool read = false) {
+    const size_t pages = size / page_size;
+    threads = std::min(threads, pages);
+    if (threads == 0) {
+        return;
+    }
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back([=] {
+            const size_t begin = pages * i / threads;
+            const size_t end = pages * (i + 1) / threads;
+            auto* bytes = reinterpret_cast<volatile char*>(data);
+            for (size_t page = begin; page < end; ++page) {
+                if (read) {
+                    (void)bytes[page * page_size];
+                } else {
+                    bytes[page * page_size] = 0;
+                }
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+// Map length bytes of fd from offset, at an address aligned to alignment
+// in a range reserved at map_addr. Returns nullptr on failure.
+char* MapFileData(int fd, size_t offset, size_t length, size_t alignment,
+                  void*& map_addr, size_t& map_length) {
+    map_length = length + alignment;
+    map_addr = mmap(nullptr, map_length, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (map_addr == MAP_FAILED) {
+        return nullptr;
+    }
+    char* data = reinterpret_cast<char*>(
+        RoundUp(reinterpret_cast<uintptr_t>(map_addr), alignment));
+    if (mmap(data, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+             fd, offset) == MAP_FAILED) {
+        munmap(map_addr, map_length);
+        return nullptr;
+    }
+    return data;
+}
+
+// Page size of the mappings of a file, the block size on hugetlbfs
+size_t FilePageSize(int fd) {
+    struct statfs fs;
+    if (fstatfs(fd, &fs)) {
+        return 0;
+    }
+    return fs.f_type == HUGETLBFS_MAGIC
+               ? static_cast<size_t>(fs.f_bsize)
+               : static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+}  // namespace
+
+std::unique_ptr<SegmentMemory> SegmentMemory::Allocate(size_t size,
+                                                       int numa_node) {
+    // The buffer allocator requires slab-aligned segments
+    const size_t alignment = facebook::cachelib::Slab::kSize;
+    if (size < alignment) {
+        LOG(ERROR) << "Segment size must be at least " << alignment;
+        return nullptr;
+    }
+
+    size_t page_size = ConfiguredHugePageSize();
+    const bool shared = globalConfig().enable_shm;
+    int fd = -1;
+    void* map_addr = MAP_FAILED;
+    size_t map_length = 0;
+    if (page_size) {
+        // Hugepage mappings are aligned to the page size; over-map to reach
+        // the slab alignment when it is the larger one
+        map_length = RoundUp(size, page_size) +
+                     (alignment > page_size ? alignment : 0);
+        map_addr = MapMemory(map_length, page_size, shared ? &fd : nullptr);
+        if (map_addr == MAP_FAILED) {
+            PLOG(WARNING) << "Failed to map " << map_length
+                          << " bytes of hugepages of size " << page_size
+                          << ", falling back to regular pages";
+        }
+    }
+    if (map_addr == MAP_FAILED) {
+        page_size = sysconf(_SC_PAGESIZE);
+        map_length = RoundUp(size, page_size) + alignment;
+        map_addr = MapMemory(map_length, 0, shared ? &fd : nullptr);
+        if (map_addr == MAP_FAILED) {
+            PLOG(ERROR) << "Failed to map " << map_length << " bytes";
+            return nullptr;
+        }
+    }
+    char* data = reinterpret_cast<char*>(
+        RoundUp(reinterpret_cast<uintptr_t>(map_addr), alignment));
+
+    numa_node = BindToNode(data, RoundUp(size, page_size), numa_node);
+
+    Prefault(data, RoundUp(size, page_size), page_size,
+             ConfiguredPrefaultThreads());
+    if (fd >= 0) {
+        ShmTransport::exportSharedMemory(
+            data, size, "/proc/self/fd/" + std::to_string(fd),
+            data - static_cast<char*>(map_addr));
+    }
+    VLOG(1) << "action=segment_memory_allocated size=" << size
+            << " page_size=" << page_size << " numa_node=" << numa_node
+            << " shared=" << (fd >= 0);
+    return std::unique_ptr<SegmentMemory>(new SegmentMemory(
+        data, size, map_addr, map_length, page_size, numa_node, fd));
+}
+
+std::unique_ptr<SegmentMemory> SegmentMemory::AllocatePersistent(
+    const std::string& path, size_t size, int numa_node) {
+    const size_t alignment = facebook::cachelib::Slab::kSize;
+    if (size < alignment) {
+        LOG(ERROR) << "Segment size must be at least " << alignment;
+        return nullptr;
+    }
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        PLOG(ERROR) << "Failed to open segment file " << path;
+        return nullptr;
+    }
+    // A process still holding the file may write into it
+    if (flock(fd, LOCK_EX | LOCK_NB)) {
+        PLOG(ERROR) << "Segment file " << path << " is in use";
+        close(fd);
+        return nullptr;
+    }
+    auto fail = [&](const char* what) {
+        PLOG(ERROR) << what << " segment file " << path;
+        close(fd);
+        return nullptr;
+    };
+
+    // Files of hugetlbfs are mapped with pages of its block size, and only
+    // at offsets multiple of it
+    const size_t page_size = FilePageSize(fd);
+    if (page_size == 0) {
+        return fail("Failed to stat filesystem of");
+    }
+    const size_t header_size = page_size;
+    const size_t data_length = RoundUp(size, page_size);
+    struct stat st;
+    if (fstat(fd, &st)) {
+        return fail("Failed to stat");
+    }
+    if (static_cast<size_t>(st.st_size) != header_size + data_length &&
+        ftruncate(fd, header_size + data_length)) {
+        return fail("Failed to resize");
+    }
+
+    void* map_addr;
+    size_t map_length;
+    char* data =
+        MapFileData(fd, header_size, data_length,
+                    std::max(alignment, page_size), map_addr, map_length);
+    if (!data) {
+        return fail("Failed to map");
+    }
+    // Read and written through a mapping, hugetlbfs has no write()
+    void* header_addr = mmap(nullptr, header_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED, fd, 0);
+    if (header_addr == MAP_FAILED) {
+        munmap(map_addr, map_length);
+        return fail("Failed to map the header of");
+    }
+    auto* header = static_cast<PersistentHeader*>(header_addr);
+    UUID memory_id{header->memory_id_first, header->memory_id_second};
+    const bool recovered = header->magic == kPersistentMagic &&
+                           header->version == kPersistentVersion &&
+                           header->size == size && memory_id != UUID{0, 0};
+    if (!recovered) {
+        // A new memory: the master holds no replica of a new id
+        memory_id = generate_uuid();
+        header->magic = 0;
+        header->version = kPersistentVersion;
+        header->memory_id_first = memory_id.first;
+        header->memory_id_second = memory_id.second;
+        header->size = size;
+        header->magic = kPersistentMagic;
+        msync(header_addr, header_size, MS_SYNC);
+    }
+    munmap(header_addr, header_size);
+
+    numa_node = BindToNode(data, data_length, numa_node);
+    Prefault(data, data_length, page_size, ConfiguredPrefaultThreads(),
+             /*read=*/true);
+    LOG(INFO) << "action=persistent_segment_mapped path=" << path
+              << " size=" << size << " page_size=" << page_size
+              << " memory_id=" << memory_id << " recovered=" << recovered;
+    std::unique_ptr<SegmentMemory> memory(new SegmentMemory(
+        data, size, map_addr, map_length, page_size, numa_node, -1));
+    memory->memory_id_ = memory_id;
+    memory->recovered_ = recovered;
+    memory->file_fd_ = fd;
+    return memory;
+}
+
+std::unique_ptr<SegmentMemory> SegmentMemory::AttachShared(
+    const std::string& path) {
+    // The owner holds the lock and writes the header, this mapping only
+    // reads it
+    int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        PLOG(ERROR) << "Failed to open segment file " << path;
+        return nullptr;
+    }
+    auto fail = [&](const char* what) {
+        PLOG(ERROR) << what << " segment file " << path;
+        close(fd);
+        return nullptr;
+    };
+
+    const size_t page_size = FilePageSize(fd);
+    if (page_size == 0) {
+        return fail("Failed to stat filesystem of");
+    }
+    const size_t header_size = page_size;
+    void* header_addr =
+        mmap(nullptr, header_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (header_addr == MAP_FAILED) {
+        return fail("Failed to map the header of");
+    }
+    const PersistentHeader header =
+        *static_cast<const PersistentHeader*>(header_addr);
+    munmap(header_addr, header_size);
+    const UUID memory_id{header.memory_id_first, header.memory_id_second};
+    if (header.magic != kPersistentMagic ||
+        header.version != kPersistentVersion || memory_id == UUID{0, 0}) {
+        LOG(ERROR) << "No segment in segment file " << path;
+        close(fd);
+        return nullptr;
+    }
+
+    const size_t alignment = facebook::cachelib::Slab::kSize;
+    void* map_addr;
+    size_t map_length;
+    char* data = MapFileData(fd, header_size, RoundUp(header.size, page_size),
+                             std::max(alignment, page_size), map_addr,
+                             map_length);
+    if (!data) {
+        return fail("Failed to map");
+    }
+    LOG(INFO) << "action=shared_segment_attached path=" << path
+              << " size=" << header.size << " memory_id=" << memory_id;
+    std::unique_ptr<SegmentMemory> memory(new SegmentMemory(
+        data, header.size, map_addr, map_length, page_size, -1, -1));
+    memory->memory_id_ = memory_id;
+    memory->recovered_ = true;
+    memory->file_fd_ = fd;
+    return memory;
+}
+
+std::unique_ptr<SegmentMemory> SegmentMemory::AllocateDevice(size_t size,
+                                                             int device) {
+    const size_t alignment = facebook::cachelib::Slab::kSize;
+    if (size < alignment) {
+        LOG(ERROR) << "Segment size must be at least " << alignment;
+        return nullptr;
+    }
+#ifdef USE_CUDA
+    cudaError_t err = cudaSetDevice(device);
+    if (err != cudaSuccess) {
+        LOG(ERROR) << "Failed to select CUDA device " << device << ": "
+                   << cudaGetErrorString(err);
+        return nullptr;
+    }
+    // cudaMalloc only aligns to 256 bytes
+    const size_t map_length = size + alignment;
+    void* map_addr = nullptr;
+    err = cudaMalloc(&map_addr, map_length);
+    if (err != cudaSuccess) {
+        LOG(ERROR) << "Failed to allocate " << map_length
+                   << " bytes on CUDA device " << device << ": "
+                   << cudaGetErrorString(err);
+        return nullptr;
+    }
+    char* data = reinterpret_cast<char*>(
+        RoundUp(reinterpret_cast<uintptr_t>(map_addr), alignment));
+    VLOG(1) << "action=segment_memory_allocated size=" << size
+            << " device=" << device;
+    return std::unique_ptr<SegmentMemory>(new SegmentMemory(
+        data, size, map_addr, map_length, 0, -1, -1, device));
+#else
+    LOG(ERROR) << "Segments in GPU memory need a build with USE_CUDA";
+    return nullptr;
+#endif
+}
+
+std::string SegmentMemory::location() const {
+    return device_ >= 0 ? "cuda:" + std::to_string(device_)
+                        : kWildcardLocation;
+}
+
+SegmentMemory::~SegmentMemory() {
+#ifdef USE_CUDA
+    if (device_ >= 0) {
+        cudaError_t err = cudaFree(map_addr_);
+        if (err != cudaSuccess) {
+            LOG(ERROR) << "Failed to free segment memory at " << data_ << ": "
+                       << cudaGetErrorString(err);
+        }
+        return;
+    }
+#endif
+    if (fd_ >= 0) {
+        ShmTransport::unexportSharedMemory(data_);
+    }
+    if (munmap(map_addr_, map_length_)) {
+        PLOG(ERROR) << "Failed to unmap segment memory at " << data_;
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+    if (file_fd_ >= 0) {
+        // Releases the lock, the file stays for the next process
+        close(file_fd_);
+    }
+}
+
+std::vector<int> SegmentNumaNodes(const Topology& topology) {
+    static const std::string kCpuPrefix = "cpu:";
+    std::vector<int> nodes;
+    for (const auto& entry : topology.getMatrix()) {
+        if (entry.first.compare(0, kCpuPrefix.size(), kCpuPrefix) != 0 ||
+            entry.second.preferred_hca.empty()) {
+            continue;
+        }
+        nodes.push_back(atoi(entry.first.c_str() + kCpuPrefix.size()));
+    }
+    std::sort(nodes.begin(), nodes.end());
+    return nodes;
+}
+
+std::vector<int> SegmentNumaNodes(const std::string& device_names) {
+    std::vector<std::string> filter;
+    std::stringstream ss(device_names);
+    std::string item;
+    while (getline(ss, item, ',')) {
+        if (!item.empty()) {
+            filter.push_back(item);
+        }
+    }
+    Topology topology;
+    if (topology.discover(filter)) {
+        return {};
+    }
+    return SegmentNumaNodes(topology);
+}
+
+}  // namespace mooncake
@@ -0,0 +1,116 @@
+#include "shard_affinity_pool.h"
+
+#include <glog/logging.h>
+#include <numa.h>
+
+namespace mooncake {
+
+thread_local const ShardAffinityPool::Group*
+    ShardAffinityPool::current_group_ = nullptr;
+
+ShardAffinityPool::ShardAffinityPool(size_t num_shards, size_t num_threads,
+                                     size_t num_groups)
+    : num_shards_(std::max<size_t>(num_shards, 1)) {
+    std::vector<int> nodes;
+    if (numa_available() >= 0) {
+        for (int node = 0; node <= numa_max_node(); ++node) {
+            if (numa_bitmask_isbitset(numa_all_nodes_ptr, node)) {
+                nodes.push_back(node);
+            }
+        }
+    }
+    if (num_groups == 0) {
+        num_groups = nodes.size();
+    }
+    // Without several groups there is no cache traffic between sockets to
+    // save, and the hop to a worker would only add latency
+    num_groups = std::min(num_groups, num_threads);
+    if (num_groups < 2) {
+        LOG(INFO) << "shard_affinity_groups=0";
+        return;
+    }
+    // Groups are only bound if there is a node for each
+    nodes.resize(nodes.size() >= num_groups ? num_groups : 0);
+    nodes.resize(num_groups, -1);
+    for (size_t g = 0; g < nodes.size(); ++g) {
+        auto group = std::make_unique<Group>();
+        group->numa_node = nodes[g];
+        // One name per group, a scrape rejects a repeated HELP line
+        group->queue_depth_gauge = std::make_unique<ylt::metric::gauge_t>(
+            "master_rpc_worker_queue_depth_group" + std::to_string(g),
+            "Requests waiting for the workers of shard group " +
+                std::to_string(g));
+        groups_.push_back(std::move(group));
+    }
+    for (size_t i = 0; i < num_threads; ++i) {
+        Group* group = groups_[i % groups_.size()].get();
+        group->workers.emplace_back(&ShardAffinityPool::WorkerThread, this,
+                                    group);
+    }
+    LOG(INFO) << "shard_affinity_groups=" << groups_.size()
+              << " threads=" << num_threads
+              << " numa_bound=" << (nodes.front() >= 0);
+}
+
+ShardAffinityPool::~ShardAffinityPool() {
+    for (auto& group : groups_) {
+        {
+            std::lock_guard<std::mutex> lock(group->mutex);
+            group->stop = true;
+        }
+        group->cv.notify_all();
+    }
+    for (auto& group : groups_) {
+        for (auto& worker : group->workers) {
+            worker.join();
+        }
+    }
+}
+
+size_t ShardAffinityPool::QueueDepth(size_t group) const {
+    std::lock_guard<std::mutex> lock(groups_[group]->mutex);
+    return groups_[group]->tasks.size();
+}
+
+std::string ShardAffinityPool::SerializeMetrics() {
+    std::string metrics;
+    for (auto& group : groups_) {
+        group->queue_depth_gauge->serialize(metrics);
+    }
+    return metrics;
+}
+
+void ShardAffinityPool::Enqueue(Group& group, std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(group.mutex);
+        group.tasks.push_back(std::move(task));
+        group.queue_depth_gauge->update(group.tasks.size());
+    }
+    group.cv.notify_one();
+}
+
+void ShardAffinityPool::WorkerThread(Group* group) {
+    if (group->numa_node >= 0 && numa_run_on_node(group->numa_node) != 0) {
+        PLOG(WARNING) << "Failed to bind RPC worker to NUMA node "
+                      << group->numa_node;
+    }
+    current_group_ = group;
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(group->mutex);
+            group->cv.wait(
+                lock, [group] { return group->stop || !group->tasks.empty(); });
+            // Queued requests are still served, their callers wait for them
+            if (group->tasks.empty()) {
+                return;
+            }
+            task = std::move(group->tasks.front());
+            group->tasks.pop_front();
+            group->queue_depth_gauge->update(group->tasks.size());
+        }
+        task();
+    }
+}
+
+}  // namespace mooncake
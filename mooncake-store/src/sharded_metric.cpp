@@ -0,0 +1,57 @@
+#include "sharded_metric.h"
+
+#include <sstream>
+
+namespace mooncake {
+
+void ShardedCounter::serialize(std::string& out) const {
+    const int64_t total = value();
+    if (total == 0) {
+        return;
+    }
+    out.append("# HELP ").append(name_).append(" ").append(help_);
+    out.append("\n# TYPE ").append(name_).append(" ").append(type_);
+    out.append("\n").append(name_).append(" ");
+    out.append(std::to_string(total)).append("\n");
+}
+
+int64_t ShardedHistogram::count() const {
+    int64_t total = 0;
+    for (size_t bucket = 0; bucket <= buckets_.size(); ++bucket) {
+        total += cells_.sum(bucket);
+    }
+    return total;
+}
+
+void ShardedHistogram::serialize(std::string& out) const {
+    // Each bucket is summed once, so that the cumulative counts and the
+    // total agree even while observations come in
+    std::vector<int64_t> counts(buckets_.size() + 1);
+    int64_t total = 0;
+    for (size_t bucket = 0; bucket < counts.size(); ++bucket) {
+        counts[bucket] = cells_.sum(bucket);
+        total += counts[bucket];
+    }
+    if (total == 0) {
+        return;
+    }
+    std::ostringstream ss;
+    ss << "# HELP " << name_ << " " << help_ << "\n# TYPE " << name_
+       << " histogram\n";
+    int64_t cumulative = 0;
+    for (size_t bucket = 0; bucket < counts.size(); ++bucket) {
+        cumulative += counts[bucket];
+        ss << name_ << "_bucket{le=\"";
+        if (bucket < buckets_.size()) {
+            ss << buckets_[bucket];
+        } else {
+            ss << "+Inf";
+        }
+        ss << "\"} " << cumulative << "\n";
+    }
+    ss << name_ << "_sum " << sum() << "\n"
+       << name_ << "_count " << total << "\n";
+    out.append(ss.str());
+}
+
+}  // namespace mooncake
@@ -0,0 +1,219 @@
+#include "shared_file_reader.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+
+namespace mooncake {
+
+namespace {
+
+size_t GetEnvCount(const char* name, size_t default_value) {
+    const char* env_value = std::getenv(name);
+    if (env_value == nullptr) {
+        return default_value;
+    }
+    char* end = nullptr;
+    const long long value = std::strtoll(env_value, &end, 10);
+    if (end == env_value || *end != '\0' || value <= 0) {
+        LOG(WARNING) << "Invalid value for " << name << ": " << env_value
+                     << ", defaulting to " << default_value;
+        return default_value;
+    }
+    return static_cast<size_t>(value);
+}
+
+}  // namespace
+
+SharedFileReader::Options SharedFileReader::Options::FromEnv() {
+    Options options;
+    options.stripe_size =
+        GetEnvCount("MC_STORE_SHARED_FS_STRIPE_KB", options.stripe_size >> 10)
+        << 10;
+    options.read_threads =
+        GetEnvCount("MC_STORE_SHARED_FS_READ_THREADS", options.read_threads);
+    options.max_open_files =
+        GetEnvCount("MC_STORE_SHARED_FS_OPEN_FILES", options.max_open_files);
+    return options;
+}
+
+SharedFileReader::Handle::~Handle() { ::close(fd); }
+
+SharedFileReader::SharedFileReader(const Options& options)
+    : options_(options) {
+    // The caller reads a stripe too
+    if (options_.read_threads > 1) {
+        pool_ = std::make_unique<ThreadPool>(options_.read_threads - 1);
+    }
+    LOG(INFO) << "Reading the shared filesystem with stripes of "
+              << options_.stripe_size << " bytes, " << options_.read_threads
+              << " threads and up to " << options_.max_open_files
+              << " open files";
+}
+
+SharedFileReader::~SharedFileReader() {
+    if (pool_) {
+        pool_->stop();
+    }
+}
+
+size_t SharedFileReader::OpenFiles() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return handles_.size();
+}
+
+std::shared_ptr<SharedFileReader::Handle> SharedFileReader::Acquire(
+    const std::string& path) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = handles_.find(path);
+        if (it != handles_.end()) {
+            lru_.splice(lru_.begin(), lru_, it->second.position);
+            return it->second.handle;
+        }
+    }
+    // Open outside the lock, it can take a round trip
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        PLOG(WARNING) << "Failed to open file for reading: " << path;
+        return nullptr;
+    }
+    auto handle = std::make_shared<Handle>(fd);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto [it, inserted] = handles_.try_emplace(path);
+    if (!inserted) {
+        // Opened by another thread in the meantime
+        lru_.splice(lru_.begin(), lru_, it->second.position);
+        return it->second.handle;
+    }
+    lru_.push_front(path);
+    it->second = {handle, lru_.begin()};
+    while (handles_.size() > options_.max_open_files) {
+        handles_.erase(lru_.back());
+        lru_.pop_back();
+    }
+    return handle;
+}
+
+void SharedFileReader::Evict(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = handles_.find(path);
+    if (it != handles_.end()) {
+        lru_.erase(it->second.position);
+        handles_.erase(it);
+    }
+}
+
+ErrorCode SharedFileReader::Read(const std::string& path, uint64_t offset,
+                                 const std::vector<Slice>& slices) {
+    // Cut the slices at every stripe boundary of the object
+    std::vector<Stripe> stripes;
+    uint64_t object_offset = 0;
+    for (const auto& slice : slices) {
+        size_t done = 0;
+        while (done < slice.size) {
+            if (object_offset % options_.stripe_size == 0) {
+                stripes.push_back({offset + object_offset, {}});
+            }
+            const size_t len = std::min<size_t>(
+                slice.size - done,
+                options_.stripe_size - object_offset % options_.stripe_size);
+            stripes.back().iovs.push_back(
+                {static_cast<char*>(slice.ptr) + done, len});
+            done += len;
+            object_offset += len;
+        }
+    }
+
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        auto handle = Acquire(path);
+        if (!handle) {
+            return ErrorCode::FILE_OPEN_FAIL;
+        }
+        if (ReadStripes(*handle, stripes) == ErrorCode::OK) {
+            return ErrorCode::OK;
+        }
+        // The cached descriptor may be stale, e.g. ESTALE on NFS
+        Evict(path);
+    }
+    LOG(ERROR) << "Failed to read " << object_offset << " bytes at offset "
+               << offset << " of " << path;
+    return ErrorCode::FILE_READ_FAIL;
+}
+
+ErrorCode SharedFileReader::ReadStripes(const Handle& handle,
+                                        const std::vector<Stripe>& stripes) {
+    if (stripes.empty()) {
+        return ErrorCode::OK;
+    }
+    std::atomic<bool> ok{true};
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t pending = 0;
+    if (pool_) {
+        pending = stripes.size() - 1;
+        for (size_t i = 1; i < stripes.size(); ++i) {
+            pool_->enqueue([&, i] {
+                if (!ReadStripe(handle.fd, stripes[i])) {
+                    ok.store(false, std::memory_order_relaxed);
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--pending == 0) {
+                    cv.notify_one();
+                }
+            });
+        }
+    } else {
+        for (size_t i = 1; i < stripes.size(); ++i) {
+            if (!ReadStripe(handle.fd, stripes[i])) {
+                ok.store(false, std::memory_order_relaxed);
+            }
+        }
+    }
+    if (!ReadStripe(handle.fd, stripes[0])) {
+        ok.store(false, std::memory_order_relaxed);
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&] { return pending == 0; });
+    return ok.load(std::memory_order_relaxed) ? ErrorCode::OK
+                                              : ErrorCode::FILE_READ_FAIL;
+}
+
+bool SharedFileReader::ReadStripe(int fd, const Stripe& stripe) {
+    std::vector<iovec> iovs = stripe.iovs;
+    uint64_t offset = stripe.offset;
+    size_t first = 0;
+    while (first < iovs.size()) {
+        ssize_t ret = ::preadv(fd, iovs.data() + first,
+                               static_cast<int>(iovs.size() - first), offset);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            // Error, or the file ends before the object
+            return false;
+        }
+        offset += ret;
+        // Skip what was read, the filesystem may return short reads
+        while (ret > 0) {
+            auto& iov = iovs[first];
+            const size_t len = std::min<size_t>(ret, iov.iov_len);
+            iov.iov_base = static_cast<char*>(iov.iov_base) + len;
+            iov.iov_len -= len;
+            ret -= len;
+            if (iov.iov_len == 0) {
+                ++first;
+            }
+        }
+    }
+    return true;
+}
+
+}  // namespace mooncake
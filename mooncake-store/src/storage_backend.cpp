@@ -3,7 +3,9 @@
 #include "storage_backend.h"
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/file.h>
 #include <sys/uio.h>
+#include <cstdlib>
 #include <string>
 #include <vector>
 
@@ -12,16 +14,37 @@ namespace mooncake {
   
 ErrorCode StorageBackend::StoreObject(const ObjectKey& key,
                                      const std::vector<Slice>& slices) {
+    if (log_store_) {
+        std::vector<iovec> iovs;
+        for (const auto& slice : slices) {
+            iovs.push_back({slice.ptr, slice.size});
+        }
+        return log_store_->Put(key, iovs);
+    }
+
     std::string path = ResolvePath(key);
 
     if(std::filesystem::exists(path) == true) {
         return ErrorCode::FILE_OPEN_FAIL;
     }
 
-    FILE* file = fopen(path.c_str(), "wb");
     size_t slices_total_size = 0;
     std::vector<iovec> iovs;
 
+    for (const auto& slice : slices) {
+        iovec io{ slice.ptr, slice.size };
+        iovs.push_back(io);
+        slices_total_size += slice.size;
+    }
+
+    if (auto engine = uring_pool_->Acquire()) {
+        ErrorCode ec = StoreWithUring(*engine, path, iovs);
+        uring_pool_->Release(std::move(engine));
+        return ec;
+    }
+
+    FILE* file = fopen(path.c_str(), "wb");
+
     if (!file) {
         LOG(INFO) << "Failed to open file for writing: " << path;
         return ErrorCode::FILE_OPEN_FAIL;
@@ -29,12 +52,6 @@ ErrorCode StorageBackend::StoreObject(const ObjectKey& key,
 
     LocalFile local_file(path,file,ErrorCode::OK);
 
-    for (const auto& slice : slices) {
-        iovec io{ slice.ptr, slice.size };
-        iovs.push_back(io);
-        slices_total_size += slice.size;
-    }
-
     ssize_t ret = local_file.pwritev(iovs.data(), static_cast<int>(iovs.size()), 0);
 
     if (ret < 0) {
@@ -60,11 +77,23 @@ ErrorCode StorageBackend::StoreObject(const ObjectKey& key,
 
 ErrorCode StorageBackend::StoreObject(const ObjectKey& key,
                                     const std::string& str) {
+    if (log_store_) {
+        return log_store_->Put(
+            key, {{const_cast<char*>(str.data()), str.size()}});
+    }
+
     std::string path = ResolvePath(key);
 
     if(std::filesystem::exists(path) == true) {
         return ErrorCode::FILE_OPEN_FAIL;
     }
+
+    if (auto engine = uring_pool_->Acquire()) {
+        std::vector<iovec> iovs{{const_cast<char*>(str.data()), str.size()}};
+        ErrorCode ec = StoreWithUring(*engine, path, iovs);
+        uring_pool_->Release(std::move(engine));
+        return ec;
+    }
     
     FILE* file = fopen(path.c_str(), "wb");
     size_t file_total_size=str.size();
@@ -95,23 +124,65 @@ ErrorCode StorageBackend::StoreObject(const ObjectKey& key,
     return ErrorCode::OK;
 }
       
+std::vector<ErrorCode> StorageBackend::BatchStoreObject(
+    const std::vector<ObjectKey>& keys,
+    const std::vector<std::string>& values) {
+    if (log_store_) {
+        std::vector<std::vector<iovec>> iovs;
+        iovs.reserve(values.size());
+        for (const auto& value : values) {
+            iovs.push_back({{const_cast<char*>(value.data()), value.size()}});
+        }
+        return log_store_->BatchPut(keys, iovs);
+    }
+
+    std::vector<ErrorCode> results;
+    results.reserve(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        results.push_back(StoreObject(keys[i], values[i]));
+    }
+    return results;
+}
+
 ErrorCode StorageBackend::LoadObject(const ObjectKey& key,
                                     std::vector<Slice>& slices) {
+    if (log_store_) {
+        return log_store_->Get(key, slices);
+    }
     std::string path = ResolvePath(key);
     return LoadObjectInPath(path,slices);
 }
 
 ErrorCode StorageBackend::LoadObject(const ObjectKey& key,
-                                    std::vector<Slice>& slices, std::string& path) {
-    return LoadObjectInPath(path, slices);
+                                     std::vector<Slice>& slices,
+                                     std::string& path, uint64_t offset) {
+    return LoadObjectInPath(path, slices, offset);
 }
 
 ErrorCode StorageBackend::LoadObjectInPath(const std::string& path,
-                                    std::vector<Slice>& slices) {
-    FILE* file = fopen(path.c_str(), "rb");
+                                    std::vector<Slice>& slices,
+                                    uint64_t offset) {
+    if (shared_reader_) {
+        return shared_reader_->Read(path, offset, slices);
+    }
+
     size_t slices_total_size=0;
     std::vector<iovec> iovs;
 
+    for (const auto& slice : slices) {
+        iovec io{ slice.ptr, slice.size };
+        iovs.push_back(io);
+        slices_total_size += slice.size;
+    }
+
+    if (auto engine = uring_pool_->Acquire()) {
+        ErrorCode ec = LoadWithUring(*engine, path, iovs, offset);
+        uring_pool_->Release(std::move(engine));
+        return ec;
+    }
+
+    FILE* file = fopen(path.c_str(), "rb");
+
     if (!file) {
         LOG(INFO) << "Failed to open file for reading: " << path;
         return ErrorCode::FILE_OPEN_FAIL;
@@ -119,13 +190,7 @@ ErrorCode StorageBackend::LoadObjectInPath(const std::string& path,
 
     LocalFile local_file(path,file,ErrorCode::OK);
 
-    for (const auto& slice : slices) {
-        iovec io{ slice.ptr, slice.size };
-        iovs.push_back(io);
-        slices_total_size += slice.size;
-    }
-
-    ssize_t ret = local_file.preadv(iovs.data(), static_cast<int>(iovs.size()), 0);
+    ssize_t ret = local_file.preadv(iovs.data(), static_cast<int>(iovs.size()), offset);
 
     if (ret < 0) {
         LOG(INFO) << "preadv failed for: " << path;
@@ -147,6 +212,9 @@ ErrorCode StorageBackend::LoadObjectInPath(const std::string& path,
 
 ErrorCode StorageBackend::LoadObject(const ObjectKey& key,
                                     std::string& str) {
+    if (log_store_) {
+        return log_store_->Get(key, str);
+    }
     std::string path = ResolvePath(key);
     FILE* file = fopen(path.c_str(), "rb");
     size_t file_total_size=0;
@@ -180,7 +248,178 @@ ErrorCode StorageBackend::LoadObject(const ObjectKey& key,
     return ErrorCode::OK;
 }
 
+unsigned StorageBackend::GetUringQueueDepth(const std::string& root_dir) {
+    constexpr unsigned kDefaultQueueDepth = 32;
+    const char* env_value = std::getenv("MC_STORE_URING_QUEUE_DEPTH");
+    if (env_value == nullptr) {
+        return kDefaultQueueDepth;
+    }
+    // Entries are "<root_dir>=<depth>" or a bare default depth
+    std::optional<unsigned> fallback;
+    std::string_view entries(env_value);
+    while (!entries.empty()) {
+        size_t comma = entries.find(',');
+        std::string_view entry = entries.substr(0, comma);
+        entries = comma == std::string_view::npos ? std::string_view()
+                                                  : entries.substr(comma + 1);
+        size_t eq = entry.rfind('=');
+        std::string_view dir;
+        std::string depth_str(entry);
+        if (eq != std::string_view::npos) {
+            dir = entry.substr(0, eq);
+            depth_str = std::string(entry.substr(eq + 1));
+        }
+        char* end = nullptr;
+        unsigned long depth = std::strtoul(depth_str.c_str(), &end, 10);
+        if (depth_str.empty() || *end != '\0') {
+            LOG(WARNING) << "Invalid entry in MC_STORE_URING_QUEUE_DEPTH: "
+                         << entry;
+            continue;
+        }
+        if (dir.empty()) {
+            fallback = static_cast<unsigned>(depth);
+        } else if (std::filesystem::path(dir).lexically_normal() ==
+                   std::filesystem::path(root_dir).lexically_normal()) {
+            return static_cast<unsigned>(depth);
+        }
+    }
+    return fallback.value_or(kDefaultQueueDepth);
+}
+
+// Open with O_DIRECT where the filesystem supports it
+static int OpenDirect(const std::string& path, int flags) {
+    int fd = ::open(path.c_str(), flags | O_DIRECT, 0666);
+    if (fd < 0 && errno == EINVAL) {
+        fd = ::open(path.c_str(), flags, 0666);
+    }
+    return fd;
+}
+
+ErrorCode StorageBackend::StoreWithUring(IoUringEngine& engine,
+                                         const std::string& path,
+                                         const std::vector<iovec>& iovs) {
+    int fd = OpenDirect(path, O_WRONLY | O_CREAT | O_TRUNC);
+    if (fd < 0) {
+        LOG(INFO) << "Failed to open file for writing: " << path;
+        return ErrorCode::FILE_OPEN_FAIL;
+    }
+    if (flock(fd, LOCK_EX) == -1) {
+        ::close(fd);
+        return ErrorCode::FILE_LOCK_FAIL;
+    }
+    ssize_t ret = engine.Write(fd, iovs.data(), static_cast<int>(iovs.size()));
+    ::close(fd);
+    if (ret < 0) {
+        LOG(INFO) << "io_uring write failed for: " << path;
+        // Do not leave a partial object behind
+        ::unlink(path.c_str());
+        return ErrorCode::FILE_WRITE_FAIL;
+    }
+    return ErrorCode::OK;
+}
+
+ErrorCode StorageBackend::LoadWithUring(IoUringEngine& engine,
+                                        const std::string& path,
+                                        const std::vector<iovec>& iovs,
+                                        uint64_t offset) {
+    int fd = OpenDirect(path, O_RDONLY);
+    if (fd < 0) {
+        LOG(INFO) << "Failed to open file for reading: " << path;
+        return ErrorCode::FILE_OPEN_FAIL;
+    }
+    if (flock(fd, LOCK_SH) == -1) {
+        ::close(fd);
+        return ErrorCode::FILE_LOCK_FAIL;
+    }
+    ssize_t ret = engine.Read(fd, iovs.data(), static_cast<int>(iovs.size()),
+                              offset);
+    ::close(fd);
+    if (ret < 0) {
+        LOG(INFO) << "io_uring read failed for: " << path;
+        return ErrorCode::FILE_READ_FAIL;
+    }
+    return ErrorCode::OK;
+}
+
+void StorageBackend::OpenLogStore(const std::string& node) {
+    const char* engine = std::getenv("MC_STORE_DISK_ENGINE");
+    if (engine == nullptr) {
+        return;
+    }
+    const bool shared = std::string_view(engine) == "shared";
+    if (!shared && std::string_view(engine) != "log") {
+        LOG(WARNING) << "Ignore value from environment variable "
+                        "MC_STORE_DISK_ENGINE: "
+                     << engine;
+        return;
+    }
+    uint64_t segment_size = LogStructuredStore::kDefaultSegmentSize;
+    if (const char* mb = std::getenv("MC_STORE_DISK_LOG_SEGMENT_MB")) {
+        uint64_t value = std::strtoull(mb, nullptr, 10);
+        if (value > 0) {
+            segment_size = value << 20;
+        } else {
+            LOG(WARNING) << "Invalid value for MC_STORE_DISK_LOG_SEGMENT_MB: "
+                         << mb;
+        }
+    }
+    auto dir = std::filesystem::path(root_dir_) / fsdir_ / "log";
+    if (shared) {
+        // Every client appends to a log of its own
+        std::string name = node;
+        if (name.empty()) {
+            char hostname[256] = {};
+            gethostname(hostname, sizeof(hostname) - 1);
+            name = hostname;
+        }
+        dir /= SanitizeKey(name);
+    }
+    log_store_ =
+        LogStructuredStore::Open(dir.string(), uring_pool_, segment_size);
+    if (!log_store_) {
+        LOG(WARNING) << "Failed to open log structured store at " << dir
+                     << ", storing one file per object";
+        return;
+    }
+    if (shared) {
+        shared_reader_ = std::make_unique<SharedFileReader>(
+            SharedFileReader::Options::FromEnv());
+    }
+}
+
+std::vector<std::pair<ObjectKey, DiskDescriptor>>
+StorageBackend::ListObjects() const {
+    std::vector<std::pair<ObjectKey, DiskDescriptor>> objects;
+    if (!log_store_) {
+        return objects;
+    }
+    auto locations = log_store_->List();
+    objects.reserve(locations.size());
+    for (auto& [key, location] : locations) {
+        DiskDescriptor disk;
+        disk.file_path = std::move(location.path);
+        disk.file_size = location.length;
+        disk.file_offset = location.offset;
+        objects.emplace_back(std::move(key), std::move(disk));
+    }
+    return objects;
+}
+
 std::optional<Replica::Descriptor> StorageBackend::Querykey(const ObjectKey& key) {
+    if (log_store_) {
+        auto location = log_store_->Query(key);
+        if (!location) {
+            return std::nullopt;
+        }
+        Replica::Descriptor desc;
+        auto& disk_desc = desc.descriptor_variant.emplace<DiskDescriptor>();
+        disk_desc.file_path = std::move(location->path);
+        disk_desc.file_size = location->length;
+        disk_desc.file_offset = location->offset;
+        desc.status = ReplicaStatus::COMPLETE;
+        return desc;
+    }
+
     std::string path = ResolvePath(key);
     namespace fs = std::filesystem;
 
@@ -205,6 +444,16 @@ StorageBackend::BatchQueryKey(const std::vector<ObjectKey>& keys) {
     std::unordered_map<ObjectKey, Replica::Descriptor> result;
 
     for (const auto& key : keys) {
+        if (log_store_) {
+            auto desc = Querykey(key);
+            if (!desc) {
+                LOG(WARNING) << "Key not found: " << key << ", skipping...";
+                return {};
+            }
+            result.emplace(key, std::move(*desc));
+            continue;
+        }
+
         std::string path = ResolvePath(key);
 
         if (!fs::exists(path)) {
@@ -225,6 +474,10 @@ StorageBackend::BatchQueryKey(const std::vector<ObjectKey>& keys) {
 }
 
 ErrorCode StorageBackend::Existkey(const ObjectKey& key) {
+    if (log_store_) {
+        return log_store_->Query(key) ? ErrorCode::OK
+                                      : ErrorCode::FILE_NOT_FOUND;
+    }
     std::string path = ResolvePath(key);
     namespace fs = std::filesystem;
 
@@ -237,6 +490,10 @@ ErrorCode StorageBackend::Existkey(const ObjectKey& key) {
 }
 
 void StorageBackend::RemoveFile(const ObjectKey& key) {
+    if (log_store_) {
+        log_store_->Remove(key);
+        return;
+    }
     std::string path = ResolvePath(key);
     namespace fs = std::filesystem;
     // TODO: attention: this function is not thread-safe, need to add lock if used in multi-thread environment
@@ -254,6 +511,10 @@ void StorageBackend::RemoveFile(const ObjectKey& key) {
 }
 
 void StorageBackend::RemoveAll() {
+    if (log_store_) {
+        log_store_->RemoveAll();
+        return;
+    }
     namespace fs = std::filesystem;
     // Iterate through the root directory and remove all files
     for (const auto& entry : fs::directory_iterator(root_dir_)) {
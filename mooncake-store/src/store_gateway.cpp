@@ -0,0 +1,450 @@
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+#include <ylt/coro_http/coro_http_server.hpp>
+
+#include "client.h"
+#include "types.h"
+#include "utils.h"
+
+// A REST gateway to the store, serving the routes of
+// mooncake_store_service.py from a native Client. Values travel as raw
+// bytes rather than JSON strings: request bodies are copied into registered
+// staging buffers and put from there, and objects are read back into them
+// and written to the socket as chunks straight from that memory. Objects
+// larger than a staging buffer are put with a multipart put and read a
+// range at a time, so a request holds at most one buffer whatever its size.
+//
+// Routes:
+//   PUT    /api/put/{key}[?size=N&replicas=R]  body is the value
+//   GET    /api/get/{key}                       chunked value
+//   GET    /api/exist/{key}
+//   DELETE /api/remove/{key}
+//   DELETE /api/remove_all
+//
+// A chunked PUT larger than a staging buffer needs its size in ?size=,
+// which the multipart put allocates upfront. The store calls block the
+// HTTP thread serving the request, --http_threads bounds the concurrency.
+
+DEFINE_string(local_hostname, "localhost", "Hostname of the store client");
+DEFINE_string(metadata_server, "P2PHANDSHAKE",
+              "Connection string of the transfer engine metadata");
+DEFINE_string(master_server_address, "localhost:50051",
+              "Master entry, IP:Port or etcd://IP:Port;... in HA mode");
+DEFINE_string(protocol, "tcp", "Transfer protocol: rdma|tcp");
+DEFINE_string(device_name, "", "RDMA devices, for the rdma protocol");
+DEFINE_uint64(global_segment_size, 3355443200,
+              "Bytes of the segment mounted to the store, 0 mounts none");
+DEFINE_uint64(buffer_size, 16 << 20,
+              "Bytes of each registered staging buffer, the part size of "
+              "the multipart puts and of the chunks of the gets");
+DEFINE_int32(buffer_count, 0,
+             "Staging buffers, requests past them get 503; 0 for two per "
+             "HTTP thread");
+DEFINE_int32(http_port, 8080, "Port of the REST API");
+DEFINE_int32(http_threads, 8, "Threads serving the REST API");
+DEFINE_int32(replica_num, 1, "Replicas of each put, unless ?replicas= is set");
+
+namespace mooncake {
+namespace {
+
+using coro_http::coro_http_request;
+using coro_http::coro_http_response;
+using coro_http::status_type;
+
+// Bytes of the object as the replica stores them
+uint64_t StoredSize(const Replica::Descriptor& replica) {
+    if (!replica.is_memory_replica()) {
+        return replica.get_disk_descriptor().file_size;
+    }
+    uint64_t size = 0;
+    for (const auto& handle :
+         replica.get_memory_descriptor().buffer_descriptors) {
+        size += handle.size_;
+    }
+    return size;
+}
+
+void ReplyJson(coro_http_response& resp, status_type status,
+               const std::string& json) {
+    resp.add_header("Content-Type", "application/json");
+    resp.set_status_and_content(status, json);
+}
+
+void ReplyError(coro_http_response& resp, status_type status,
+                const std::string& error) {
+    ReplyJson(resp, status, "{\"error\": \"" + error + "\"}");
+}
+
+void ReplyError(coro_http_response& resp, ErrorCode error) {
+    status_type status = status_type::internal_server_error;
+    if (error == ErrorCode::OBJECT_NOT_FOUND) {
+        status = status_type::not_found;
+    } else if (error == ErrorCode::INVALID_PARAMS ||
+               error == ErrorCode::OBJECT_ALREADY_EXISTS) {
+        status = status_type::bad_request;
+    }
+    ReplyError(resp, status, toString(error));
+}
+
+// Registered buffers handed to one request at a time
+class StagingPool {
+   public:
+    class Lease {
+       public:
+        Lease(StagingPool* pool, char* buffer) : pool_(pool), buffer_(buffer) {}
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        ~Lease() {
+            if (buffer_) pool_->Release(buffer_);
+        }
+
+        explicit operator bool() const { return buffer_ != nullptr; }
+        char* data() const { return buffer_; }
+        size_t size() const { return pool_->buffer_size_; }
+
+       private:
+        StagingPool* pool_;
+        char* buffer_;
+    };
+
+    ~StagingPool() { free(region_); }
+
+    bool Init(Client& client, size_t buffer_size, size_t count) {
+        buffer_size_ = buffer_size;
+        region_ = static_cast<char*>(
+            allocate_buffer_allocator_memory(buffer_size * count));
+        if (!region_) {
+            LOG(ERROR) << "Failed to allocate " << count
+                       << " staging buffers of " << buffer_size << " bytes";
+            return false;
+        }
+        auto registered = client.RegisterLocalMemory(
+            region_, buffer_size * count, kWildcardLocation, false, false);
+        if (!registered) {
+            LOG(ERROR) << "Failed to register the staging buffers: "
+                       << toString(registered.error());
+            return false;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            free_.push_back(region_ + i * buffer_size);
+        }
+        return true;
+    }
+
+    // An empty lease if every buffer is in use
+    Lease Acquire() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_.empty()) return Lease(this, nullptr);
+        char* buffer = free_.back();
+        free_.pop_back();
+        return Lease(this, buffer);
+    }
+
+   private:
+    void Release(char* buffer) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(buffer);
+    }
+
+    std::mutex mutex_;
+    std::vector<char*> free_;
+    char* region_ = nullptr;
+    size_t buffer_size_ = 0;
+};
+
+class StoreGateway {
+   public:
+    StoreGateway(std::shared_ptr<Client> client)
+        : client_(std::move(client)),
+          server_(FLAGS_http_threads, FLAGS_http_port) {}
+
+    bool Init() {
+        size_t count = FLAGS_buffer_count > 0 ? FLAGS_buffer_count
+                                              : 2 * FLAGS_http_threads;
+        if (!pool_.Init(*client_, FLAGS_buffer_size, count)) return false;
+        server_.set_http_handler<coro_http::PUT>(
+            "/api/put/:key",
+            [this](coro_http_request& req, coro_http_response& resp)
+                -> async_simple::coro::Lazy<void> {
+                co_await HandlePut(req, resp);
+            });
+        server_.set_http_handler<coro_http::GET>(
+            "/api/get/:key",
+            [this](coro_http_request& req, coro_http_response& resp)
+                -> async_simple::coro::Lazy<void> {
+                co_await HandleGet(req, resp);
+            });
+        server_.set_http_handler<coro_http::GET>(
+            "/api/exist/:key",
+            [this](coro_http_request& req, coro_http_response& resp) {
+                auto exist = client_->IsExist(req.params_["key"]);
+                if (!exist) return ReplyError(resp, exist.error());
+                ReplyJson(resp, status_type::ok,
+                          std::string("{\"exists\": ") +
+                              (exist.value() ? "true" : "false") + "}");
+            });
+        server_.set_http_handler<coro_http::DEL>(
+            "/api/remove/:key",
+            [this](coro_http_request& req, coro_http_response& resp) {
+                auto removed = client_->Remove(req.params_["key"]);
+                if (!removed) return ReplyError(resp, removed.error());
+                ReplyJson(resp, status_type::ok, "{\"status\": \"success\"}");
+            });
+        server_.set_http_handler<coro_http::DEL>(
+            "/api/remove_all",
+            [this](coro_http_request& req, coro_http_response& resp) {
+                auto removed = client_->RemoveAll();
+                if (!removed) return ReplyError(resp, removed.error());
+                ReplyJson(resp, status_type::ok,
+                          "{\"status\": \"success removed " +
+                              std::to_string(removed.value()) + " keys\"}");
+            });
+        return true;
+    }
+
+    std::errc Run() {
+        LOG(INFO) << "Store gateway listening on port " << FLAGS_http_port;
+        return server_.sync_start();
+    }
+
+   private:
+    ReplicateConfig PutConfig(coro_http_request& req) {
+        ReplicateConfig config;
+        config.replica_num = FLAGS_replica_num;
+        auto replicas = req.get_query_value("replicas");
+        if (!replicas.empty()) {
+            config.replica_num = std::strtoul(
+                std::string(replicas).c_str(), nullptr, 10);
+        }
+        return config;
+    }
+
+    // Puts size bytes fed a piece at a time through the staging buffer:
+    // with one Put if they fit in it, part by part otherwise
+    class PutWriter {
+       public:
+        PutWriter(Client& client, StagingPool::Lease& lease,
+                  const std::string& key, const ReplicateConfig& config)
+            : client_(client), lease_(lease), key_(key), config_(config) {}
+
+        // size is 0 if unknown, the put then fails past one buffer
+        ErrorCode Start(uint64_t size) {
+            if (size <= lease_.size()) return ErrorCode::OK;
+            auto put = client_.StartMultipartPut(key_, size, lease_.size(),
+                                                 config_);
+            if (!put) return put.error();
+            put_ = std::move(put.value());
+            return ErrorCode::OK;
+        }
+
+        ErrorCode Write(std::string_view data) {
+            while (!data.empty()) {
+                size_t length = std::min(data.size(), lease_.size() - filled_);
+                std::memcpy(lease_.data() + filled_, data.data(), length);
+                filled_ += length;
+                data.remove_prefix(length);
+                if (filled_ < lease_.size() || (data.empty() && !put_)) {
+                    continue;
+                }
+                if (!put_) return ErrorCode::INVALID_PARAMS;
+                ErrorCode err = client_.PutPart(
+                    *put_, part_++, Slice{lease_.data(), filled_});
+                if (err != ErrorCode::OK) return err;
+                filled_ = 0;
+            }
+            return ErrorCode::OK;
+        }
+
+        ErrorCode End() {
+            if (!put_) {
+                if (filled_ == 0) return ErrorCode::INVALID_PARAMS;
+                std::vector<Slice> slices{Slice{lease_.data(), filled_}};
+                auto result = client_.Put(key_, slices, config_);
+                return result ? ErrorCode::OK : result.error();
+            }
+            if (filled_ > 0) {
+                ErrorCode err = client_.PutPart(
+                    *put_, part_++, Slice{lease_.data(), filled_});
+                if (err != ErrorCode::OK) {
+                    Abort();
+                    return err;
+                }
+            }
+            // Revokes the object if a part is missing
+            auto result = client_.EndMultipartPut(*put_);
+            return result ? ErrorCode::OK : result.error();
+        }
+
+        // Revokes the multipart put after a failed Write
+        void Abort() {
+            if (put_) client_.EndMultipartPut(*put_);
+            put_.reset();
+        }
+
+       private:
+        Client& client_;
+        StagingPool::Lease& lease_;
+        const std::string& key_;
+        const ReplicateConfig& config_;
+        std::shared_ptr<MultipartPut> put_;
+        size_t filled_ = 0;
+        size_t part_ = 0;
+    };
+
+    async_simple::coro::Lazy<void> HandlePut(coro_http_request& req,
+                                             coro_http_response& resp) {
+        const std::string key = req.params_["key"];
+        const ReplicateConfig config = PutConfig(req);
+        auto lease = pool_.Acquire();
+        if (!lease) {
+            ReplyError(resp, status_type::service_unavailable,
+                       "No staging buffer available");
+            co_return;
+        }
+        PutWriter writer(*client_, lease, key, config);
+        ErrorCode err = ErrorCode::OK;
+        if (req.get_content_type() != coro_http::content_type::chunked) {
+            // The server has read the whole body already
+            std::string_view body = req.get_body();
+            if (body.empty()) {
+                ReplyError(resp, status_type::bad_request, "Missing value");
+                co_return;
+            }
+            err = writer.Start(body.size());
+            if (err == ErrorCode::OK) err = writer.Write(body);
+        } else {
+            auto size = req.get_query_value("size");
+            err = writer.Start(
+                size.empty() ? 0
+                             : std::strtoull(std::string(size).c_str(),
+                                             nullptr, 10));
+            // The body is read to its end even after an error, so that
+            // the connection stays usable
+            while (true) {
+                auto result = co_await req.get_conn()->read_chunked();
+                if (result.ec) {
+                    writer.Abort();
+                    co_return;
+                }
+                if (result.eof) break;
+                if (err == ErrorCode::OK) err = writer.Write(result.data);
+            }
+        }
+        if (err == ErrorCode::OK) {
+            err = writer.End();
+        } else {
+            writer.Abort();
+        }
+        if (err != ErrorCode::OK) {
+            LOG(ERROR) << "PUT of key=" << key << " failed: " << err;
+            ReplyError(resp, err);
+            co_return;
+        }
+        ReplyJson(resp, status_type::ok, "{\"status\": \"success\"}");
+    }
+
+    async_simple::coro::Lazy<void> HandleGet(coro_http_request& req,
+                                             coro_http_response& resp) {
+        const std::string key = req.params_["key"];
+        auto replicas = client_->Query(key);
+        if (!replicas || replicas->empty()) {
+            ReplyError(resp, replicas ? ErrorCode::OBJECT_NOT_FOUND
+                                      : replicas.error());
+            co_return;
+        }
+        auto lease = pool_.Acquire();
+        if (!lease) {
+            ReplyError(resp, status_type::service_unavailable,
+                       "No staging buffer available");
+            co_return;
+        }
+        // Objects put with a codec are served as their stored bytes
+        const uint64_t size = StoredSize(replicas->front());
+        auto* conn = resp.get_conn();
+        resp.add_header("Content-Type", "application/octet-stream");
+        resp.set_format_type(coro_http::format_type::chunked);
+        if (!co_await conn->begin_chunked()) co_return;
+        for (uint64_t offset = 0; offset < size;) {
+            size_t length = std::min<uint64_t>(lease.size(), size - offset);
+            auto result = client_->GetRange(key, *replicas, offset,
+                                            Slice{lease.data(), length});
+            if (!result) {
+                // Headers are out, the client sees a truncated body
+                LOG(ERROR) << "GET of key=" << key << " failed at offset "
+                           << offset << ": " << result.error();
+                co_return;
+            }
+            if (!co_await conn->write_chunked(
+                    std::string_view(lease.data(), length))) {
+                co_return;
+            }
+            offset += length;
+        }
+        co_await conn->end_chunked();
+    }
+
+    std::shared_ptr<Client> client_;
+    StagingPool pool_;
+    coro_http::coro_http_server server_;
+};
+
+}  // namespace
+}  // namespace mooncake
+
+int main(int argc, char* argv[]) {
+    google::InitGoogleLogging(argv[0]);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+    void** args = FLAGS_protocol == "rdma"
+                      ? mooncake::rdma_args(FLAGS_device_name)
+                      : nullptr;
+    auto client_opt = mooncake::Client::Create(
+        FLAGS_local_hostname, FLAGS_metadata_server, FLAGS_protocol, args,
+        FLAGS_master_server_address);
+    if (!client_opt) {
+        LOG(ERROR) << "Failed to create the store client";
+        return 1;
+    }
+    auto client = *client_opt;
+
+    void* segment = nullptr;
+    if (FLAGS_global_segment_size > 0) {
+        segment = mooncake::allocate_buffer_allocator_memory(
+            FLAGS_global_segment_size);
+        if (!segment) {
+            LOG(ERROR) << "Failed to allocate the segment";
+            return 1;
+        }
+        auto mounted =
+            client->MountSegment(segment, FLAGS_global_segment_size);
+        if (!mounted) {
+            LOG(ERROR) << "Failed to mount the segment: "
+                       << mooncake::toString(mounted.error());
+            return 1;
+        }
+    }
+
+    mooncake::StoreGateway gateway(client);
+    if (!gateway.Init()) return 1;
+    std::errc ec = gateway.Run();
+    if (ec != std::errc{}) {
+        LOG(ERROR) << "Store gateway stopped: "
+                   << std::make_error_code(ec).message();
+    }
+    if (segment) {
+        client->UnmountSegment(segment, FLAGS_global_segment_size);
+    }
+    client.reset();
+    free(segment);
+    return ec == std::errc{} ? 0 : 1;
+}
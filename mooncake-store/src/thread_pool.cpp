@@ -1,43 +1,162 @@
 // ThreadPool.cpp
 #include "thread_pool.h"
-#include <stdexcept>
+
+#include <glog/logging.h>
+#include <numa.h>
+
+#include <algorithm>
+
 namespace mooncake {
-ThreadPool::ThreadPool(size_t num_threads) : stop_flag(false) {
-    for(size_t i = 0; i < num_threads; ++i) {
-        workers.emplace_back([this] {
-            while(true) {
-                std::function<void()> task;
-                {
-                    std::unique_lock<std::mutex> lock(this->queue_mutex);
-                    this->condition.wait(lock, [this] {
-                        return this->stop_flag || !this->tasks.empty();
-                    });
-                    
-                    if(this->stop_flag && this->tasks.empty())
-                        return;
-                    
-                    task = std::move(this->tasks.front());
-                    this->tasks.pop();
-                }
-                task();
+
+thread_local const ThreadPool* ThreadPool::current_pool = nullptr;
+thread_local size_t ThreadPool::current_worker = 0;
+
+void ThreadPool::Worker::push(Task task) {
+    if (count == ring.size()) {
+        // Unroll the ring into a larger one
+        std::vector<Task> larger(std::max<size_t>(16, ring.size() * 2));
+        for (size_t i = 0; i < count; ++i) {
+            larger[i] = std::move(ring[(head + i) % ring.size()]);
+        }
+        ring = std::move(larger);
+        head = 0;
+    }
+    ring[(head + count) % ring.size()] = std::move(task);
+    ++count;
+}
+
+bool ThreadPool::Worker::popFront(Task& task) {
+    if (count == 0) {
+        return false;
+    }
+    task = std::move(ring[head]);
+    head = (head + 1) % ring.size();
+    --count;
+    return true;
+}
+
+bool ThreadPool::Worker::popBack(Task& task) {
+    if (count == 0) {
+        return false;
+    }
+    task = std::move(ring[(head + count - 1) % ring.size()]);
+    --count;
+    return true;
+}
+
+ThreadPool::ThreadPool(size_t num_threads, bool bind_numa_nodes)
+    : stop_flag(false) {
+    std::vector<int> nodes;
+    if (bind_numa_nodes && numa_available() >= 0) {
+        for (int node = 0; node <= numa_max_node(); ++node) {
+            if (numa_bitmask_isbitset(numa_all_nodes_ptr, node)) {
+                nodes.push_back(node);
             }
+        }
+    }
+    for (size_t i = 0; i < num_threads; ++i) {
+        auto worker = std::make_unique<Worker>();
+        if (!nodes.empty()) {
+            worker->numa_node = nodes[i % nodes.size()];
+        }
+        workers.push_back(std::move(worker));
+    }
+    // Every queue exists before a worker may steal from it
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i]->thread = std::thread([this, i] { workerLoop(i); });
+    }
+}
+
+void ThreadPool::push(Task task) {
+    if (workers.empty()) {
+        task();
+        return;
+    }
+    size_t index = current_pool == this
+                       ? current_worker
+                       : next_worker.fetch_add(1, std::memory_order_relaxed) %
+                             workers.size();
+    {
+        std::lock_guard<std::mutex> lock(workers[index]->mutex);
+        workers[index]->push(std::move(task));
+    }
+    pending.fetch_add(1);
+    if (idle.load() > 0) {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        condition.notify_one();
+    }
+}
+
+bool ThreadPool::runOne(size_t self) {
+    Task task;
+    bool found;
+    {
+        std::lock_guard<std::mutex> lock(workers[self]->mutex);
+        found = workers[self]->popFront(task);
+    }
+    // Steal from the workers of the same node first
+    const int node = workers[self]->numa_node;
+    for (int pass = 0; pass < 2 && !found; ++pass) {
+        for (size_t i = 1; i < workers.size() && !found; ++i) {
+            Worker& victim = *workers[(self + i) % workers.size()];
+            if ((victim.numa_node == node) != (pass == 0)) {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            found = victim.popBack(task);
+        }
+    }
+    if (!found) {
+        return false;
+    }
+    pending.fetch_sub(1);
+    task();
+    return true;
+}
+
+void ThreadPool::workerLoop(size_t self) {
+    current_pool = this;
+    current_worker = self;
+    const int node = workers[self]->numa_node;
+    if (node >= 0 && numa_run_on_node(node) != 0) {
+        LOG(WARNING) << "thread_pool_numa_bind_failed node=" << node;
+    }
+    while (true) {
+        if (runOne(self)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        idle.fetch_add(1);
+        condition.wait(lock, [this] {
+            return stop_flag || pending.load() > 0;
         });
+        idle.fetch_sub(1);
+        if (stop_flag && pending.load() == 0) {
+            return;
+        }
     }
 }
 
 void ThreadPool::stop() {
     {
-        std::unique_lock<std::mutex> lock(queue_mutex);
+        std::unique_lock<std::mutex> lock(sleep_mutex);
         stop_flag = true;
     }
     condition.notify_all();
-    for(std::thread &worker : workers) {
-        if(worker.joinable())
-            worker.join();
+    for (auto& worker : workers) {
+        if (worker->thread.joinable())
+            worker->thread.join();
+    }
+    // Tasks enqueued while the workers were exiting
+    for (auto& worker : workers) {
+        Task task;
+        while (worker->popFront(task)) {
+            task();
+        }
     }
 }
 
 ThreadPool::~ThreadPool() {
     stop();
 }
-}
\ No newline at end of file
+}
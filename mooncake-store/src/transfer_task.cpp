@@ -1,10 +1,21 @@
 #include "transfer_task.h"
 
 #include <glog/logging.h>
+#include <numa.h>
+#include <numaif.h>
+#include <sched.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#endif
 
 #include <algorithm>
+#include <chrono>
 #include <cstdlib>
 
+#include "dsa_engine.h"
+#include "flight_recorder.h"
 #include "utils.h"
 
 namespace mooncake {
@@ -18,6 +29,7 @@ constexpr int kDefaultFilereadWorkers = 8;
 FilereadWorkerPool::FilereadWorkerPool(std::shared_ptr<StorageBackend>& backend) : shutdown_(false) {
     VLOG(1) << "Creating FilereadWorkerPool with " << kDefaultFilereadWorkers
             << " workers";
+    gds_reader_ = GdsFileReader::Create();
 
     // Start worker threads
     workers_.reserve(kDefaultFilereadWorkers);
@@ -91,7 +103,16 @@ void FilereadWorkerPool::workerThread() {
                     continue; 
                 }
 
-                auto error_code = backend_->LoadObject("", task.slices, task.file_path);
+                ErrorCode error_code;
+                if (gds_reader_ &&
+                    GdsFileReader::IsDeviceMemory(task.slices)) {
+                    // Straight into GPU memory, no bounce through the host
+                    error_code = gds_reader_->Read(
+                        task.file_path, task.file_offset, task.slices);
+                } else {
+                    error_code = backend_->LoadObject(
+                        "", task.slices, task.file_path, task.file_offset);
+                }
                 if(error_code == ErrorCode::OK){
                     VLOG(2) << "Fileread task completed successfully with "
                             << task.file_path;
@@ -115,27 +136,45 @@ void FilereadWorkerPool::workerThread() {
 // ============================================================================
 // MemcpyWorkerPool Implementation
 // ============================================================================
-// Since memcpy is bound by memory bandwidth, we only need one worker thread.
-constexpr int kDefaultMemcpyWorkers = 1;
+MemcpyWorkerPool::MemcpyWorkerPool(size_t num_workers) : shutdown_(false) {
+    num_workers = std::max<size_t>(1, num_workers);
+
+    std::vector<int> nodes;
+    if (num_workers > 1 && numa_available() >= 0) {
+        for (int node = 0; node <= numa_max_node(); ++node) {
+            if (numa_bitmask_isbitset(numa_all_nodes_ptr, node)) {
+                nodes.push_back(node);
+            }
+        }
+    }
+    // A single queue is not bound, its workers serve buffers on any node
+    const size_t num_queues =
+        nodes.size() > 1 ? std::min(nodes.size(), num_workers) : 1;
+    for (size_t i = 0; i < num_queues; ++i) {
+        auto queue = std::make_unique<NodeQueue>();
+        queue->numa_node = num_queues > 1 ? nodes[i] : -1;
+        queues_.push_back(std::move(queue));
+    }
 
-MemcpyWorkerPool::MemcpyWorkerPool() : shutdown_(false) {
-    VLOG(1) << "Creating MemcpyWorkerPool with " << kDefaultMemcpyWorkers
-            << " workers";
+    VLOG(1) << "Creating MemcpyWorkerPool with " << num_workers
+            << " workers on " << num_queues << " NUMA nodes";
 
     // Start worker threads
-    workers_.reserve(kDefaultMemcpyWorkers);
-    for (int i = 0; i < kDefaultMemcpyWorkers; ++i) {
-        workers_.emplace_back(&MemcpyWorkerPool::workerThread, this);
+    workers_.reserve(num_workers);
+    for (size_t i = 0; i < num_workers; ++i) {
+        NodeQueue* queue = queues_[i % num_queues].get();
+        queue->num_workers++;
+        workers_.emplace_back(&MemcpyWorkerPool::workerThread, this, queue);
     }
 }
 
 MemcpyWorkerPool::~MemcpyWorkerPool() {
     // Signal shutdown
-    {
-        std::lock_guard<std::mutex> lock(queue_mutex_);
-        shutdown_.store(true);
+    shutdown_.store(true);
+    for (auto& queue : queues_) {
+        { std::lock_guard<std::mutex> lock(queue->mutex); }
+        queue->cv.notify_all();
     }
-    queue_cv_.notify_all();
 
     // Wait for all workers to finish
     for (auto& worker : workers_) {
@@ -147,61 +186,260 @@ MemcpyWorkerPool::~MemcpyWorkerPool() {
     VLOG(1) << "MemcpyWorkerPool destroyed";
 }
 
+void MemcpyWorkerPool::copy(void* dest, const void* src, size_t size) {
+#if defined(__x86_64__)
+    if (size >= kNonTemporalThreshold) {
+        auto* d = static_cast<char*>(dest);
+        const auto* s = static_cast<const char*>(src);
+        // Streaming stores need a 16-byte aligned destination
+        const size_t head = (16 - (reinterpret_cast<uintptr_t>(d) & 15)) & 15;
+        std::memcpy(d, s, head);
+        d += head;
+        s += head;
+        size -= head;
+        for (; size >= 64; size -= 64, d += 64, s += 64) {
+            const auto* in = reinterpret_cast<const __m128i*>(s);
+            auto* out = reinterpret_cast<__m128i*>(d);
+            __m128i v0 = _mm_loadu_si128(in);
+            __m128i v1 = _mm_loadu_si128(in + 1);
+            __m128i v2 = _mm_loadu_si128(in + 2);
+            __m128i v3 = _mm_loadu_si128(in + 3);
+            _mm_stream_si128(out, v0);
+            _mm_stream_si128(out + 1, v1);
+            _mm_stream_si128(out + 2, v2);
+            _mm_stream_si128(out + 3, v3);
+        }
+        std::memcpy(d, s, size);
+        // Order the streaming stores before the completion is published
+        _mm_sfence();
+        return;
+    }
+#endif
+    std::memcpy(dest, src, size);
+}
+
+MemcpyWorkerPool::NodeQueue& MemcpyWorkerPool::selectQueue(
+    const MemcpyTask& task) {
+    if (queues_.size() == 1) {
+        return *queues_[0];
+    }
+    int node = -1;
+    if (!task.operations.empty()) {
+        const auto& first = task.operations.front();
+        if (first.size >= kMinChunkSize) {
+            // Query the node holding the first destination page, this fails
+            // for pages that are not faulted in yet
+            static const uintptr_t kPageSize = sysconf(_SC_PAGESIZE);
+            void* page = reinterpret_cast<void*>(
+                reinterpret_cast<uintptr_t>(first.dest) & ~(kPageSize - 1));
+            int status = -1;
+            if (numa_move_pages(0, 1, &page, nullptr, &status, 0) == 0) {
+                node = status;
+            }
+        } else {
+            // Small copies stay on the node of the submitting thread
+            const int cpu = sched_getcpu();
+            node = cpu >= 0 ? numa_node_of_cpu(cpu) : -1;
+        }
+    }
+    for (auto& queue : queues_) {
+        if (queue->numa_node == node) {
+            return *queue;
+        }
+    }
+    return *queues_[next_queue_.fetch_add(1, std::memory_order_relaxed) %
+                    queues_.size()];
+}
+
 void MemcpyWorkerPool::submitTask(MemcpyTask task) {
+    NodeQueue& queue = selectQueue(task);
+
+    size_t total_bytes = 0;
+    for (const auto& op : task.operations) {
+        total_bytes += op.size;
+    }
+    const size_t num_chunks = std::clamp<size_t>(
+        total_bytes / kMinChunkSize, 1, queue.num_workers);
+
+    auto group = std::make_shared<Chunk::Group>();
+    group->state = std::move(task.state);
+    std::vector<Chunk> chunks;
+    if (num_chunks == 1) {
+        chunks.push_back({std::move(task.operations), group});
+    } else {
+        // Cut the operations into chunks of about the same size, on page
+        // boundaries
+        constexpr size_t kAlign = 4096;
+        const size_t chunk_bytes =
+            ((total_bytes + num_chunks - 1) / num_chunks + kAlign - 1) /
+            kAlign * kAlign;
+        chunks.resize(1);
+        size_t chunk_fill = 0;
+        for (const auto& op : task.operations) {
+            size_t offset = 0;
+            while (offset < op.size) {
+                if (chunk_fill == chunk_bytes) {
+                    chunks.emplace_back();
+                    chunk_fill = 0;
+                }
+                const size_t len =
+                    std::min(op.size - offset, chunk_bytes - chunk_fill);
+                chunks.back().operations.emplace_back(
+                    static_cast<char*>(op.dest) + offset,
+                    static_cast<const char*>(op.src) + offset, len);
+                offset += len;
+                chunk_fill += len;
+            }
+        }
+        for (auto& chunk : chunks) {
+            chunk.group = group;
+        }
+    }
+    group->remaining.store(chunks.size());
+
     {
-        std::lock_guard<std::mutex> lock(queue_mutex_);
+        std::lock_guard<std::mutex> lock(queue.mutex);
         if (shutdown_.load()) {
             LOG(WARNING)
                 << "Attempting to submit task to shutdown MemcpyWorkerPool";
-            task.state->set_completed(ErrorCode::TRANSFER_FAIL);
+            group->state->set_completed(ErrorCode::TRANSFER_FAIL);
             return;
         }
-        task_queue_.push(std::move(task));
+        for (auto& chunk : chunks) {
+            queue.chunks.push(std::move(chunk));
+        }
+    }
+    if (chunks.size() == 1) {
+        queue.cv.notify_one();
+    } else {
+        queue.cv.notify_all();
     }
-    queue_cv_.notify_one();
 }
 
-void MemcpyWorkerPool::workerThread() {
-    VLOG(2) << "MemcpyWorkerPool worker thread started";
+void MemcpyWorkerPool::runChunk(Chunk& chunk) {
+    try {
+        // Large copies go to DSA when available, in one submission
+        DsaEngine* dsa = DsaEngine::get();
+        std::vector<DsaEngine::Operation> offloaded;
+        for (const auto& op : chunk.operations) {
+            if (dsa && op.size >= dsa->minSize()) {
+                offloaded.push_back({op.dest, op.src, op.size});
+            } else {
+                copy(op.dest, op.src, op.size);
+            }
+        }
+        if (!offloaded.empty()) {
+            dsa->copy(offloaded);
+        }
+    } catch (const std::exception& e) {
+        LOG(ERROR) << "Exception during async memcpy: " << e.what();
+        chunk.group->failed.store(true);
+    }
+    if (chunk.group->remaining.fetch_sub(1) == 1) {
+        const bool failed = chunk.group->failed.load();
+        VLOG(2) << "Memcpy task completed, failed=" << failed;
+        chunk.group->state->set_completed(failed ? ErrorCode::TRANSFER_FAIL
+                                                 : ErrorCode::OK);
+    }
+}
+
+void MemcpyWorkerPool::workerThread(NodeQueue* queue) {
+    VLOG(2) << "MemcpyWorkerPool worker thread started, numa_node="
+            << queue->numa_node;
+    if (queue->numa_node >= 0 && numa_run_on_node(queue->numa_node) != 0) {
+        PLOG(WARNING) << "Failed to bind memcpy worker to NUMA node "
+                      << queue->numa_node;
+    }
 
     while (true) {
-        MemcpyTask task({}, nullptr);
+        Chunk chunk;
 
         // Wait for task or shutdown signal
         {
-            std::unique_lock<std::mutex> lock(queue_mutex_);
-            queue_cv_.wait(lock, [this] {
-                return shutdown_.load() || !task_queue_.empty();
+            std::unique_lock<std::mutex> lock(queue->mutex);
+            queue->cv.wait(lock, [this, queue] {
+                return shutdown_.load() || !queue->chunks.empty();
             });
 
-            if (shutdown_.load() && task_queue_.empty()) {
+            if (shutdown_.load() && queue->chunks.empty()) {
                 break;
             }
 
-            if (!task_queue_.empty()) {
-                task = std::move(task_queue_.front());
-                task_queue_.pop();
-            }
+            chunk = std::move(queue->chunks.front());
+            queue->chunks.pop();
         }
 
-        // Execute the task if we have one
-        if (task.state) {
-            try {
-                for (const auto& op : task.operations) {
-                    std::memcpy(op.dest, op.src, op.size);
-                }
+        // Execute the chunk
+        runChunk(chunk);
+    }
 
-                VLOG(2) << "Memcpy task completed successfully with "
-                        << task.operations.size() << " operations";
-                task.state->set_completed(ErrorCode::OK);
-            } catch (const std::exception& e) {
-                LOG(ERROR) << "Exception during async memcpy: " << e.what();
-                task.state->set_completed(ErrorCode::TRANSFER_FAIL);
-            }
+    VLOG(2) << "MemcpyWorkerPool worker thread exiting";
+}
+
+// ============================================================================
+// OperationState Implementation
+// ============================================================================
+
+void OperationState::complete(ErrorCode error_code) {
+    std::vector<std::function<void(ErrorCode)>> callbacks;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        assert(!result_.has_value());
+        result_.emplace(error_code);
+        callbacks.swap(callbacks_);
+    }
+    cv_.notify_all();
+    for (auto& callback : callbacks) {
+        callback(error_code);
+    }
+}
+
+bool OperationState::queue_callback(std::function<void(ErrorCode)> callback) {
+    std::optional<ErrorCode> result;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!result_.has_value()) {
+            callbacks_.push_back(std::move(callback));
+            return true;
         }
+        result = result_;
     }
+    callback(*result);
+    return true;
+}
 
-    VLOG(2) << "MemcpyWorkerPool worker thread exiting";
+// ============================================================================
+// EngineBatch Implementation
+// ============================================================================
+
+bool EngineBatch::notifyWhenDone(std::function<void()> callback) {
+    std::lock_guard<std::mutex> lock(waiters_->mutex);
+    waiters_->callbacks.push_back(std::move(callback));
+    if (waiters_->watching) {
+        return true;
+    }
+    // The engine runs its callback outside of its lock, so it may take ours
+    Status s = engine_.setBatchCallback(
+        batch_id_, [waiters = waiters_](BatchID, const TransferStatus&) {
+            std::vector<std::function<void()>> callbacks;
+            {
+                std::lock_guard<std::mutex> lock(waiters->mutex);
+                callbacks.swap(waiters->callbacks);
+                waiters->watching = false;
+            }
+            // May release the last reference to the batch, freeing it
+            for (auto& callback : callbacks) {
+                callback();
+            }
+        });
+    if (!s.ok()) {
+        LOG(ERROR) << "Failed to watch batch " << batch_id_ << ": "
+                   << s.message();
+        waiters_->callbacks.pop_back();
+        return false;
+    }
+    waiters_->watching = true;
+    return true;
 }
 
 // ============================================================================
@@ -219,11 +457,40 @@ bool TransferEngineOperationState::is_completed() {
 }
 
 void TransferEngineOperationState::check_task_status() {
+    // A batch of its own is answered by the counters of the engine, without
+    // checking the transfers one by one
+    if (first_task_ == 0 && task_count_ == batch_->size()) {
+        TransferStatus status;
+        Status s = engine_.getBatchTransferStatus(batch_id_, status);
+        if (!s.ok()) {
+            LOG(ERROR) << "Failed to get transfer status for batch "
+                       << batch_id_ << " with error " << s.message();
+            set_result_internal(ErrorCode::TRANSFER_FAIL);
+            return;
+        }
+        switch (status.s) {
+            case TransferStatusEnum::COMPLETED:
+                set_result_internal(ErrorCode::OK);
+                break;
+            case TransferStatusEnum::FAILED:
+            case TransferStatusEnum::CANCELED:
+            case TransferStatusEnum::TIMEOUT:
+            case TransferStatusEnum::INVALID:
+                LOG(ERROR) << "Transfer failed for batch " << batch_id_
+                           << " with status " << static_cast<int>(status.s);
+                set_result_internal(ErrorCode::TRANSFER_FAIL);
+                break;
+            default:
+                break;
+        }
+        return;
+    }
+
     // Check all transfers in the batch
     bool all_completed = true;
     bool has_failure = false;
 
-    for (size_t i = 0; i < batch_size_; ++i) {
+    for (size_t i = first_task_; i < first_task_ + task_count_; ++i) {
         TransferStatus status;
         Status s = engine_.getTransferStatus(batch_id_, i, status);
         if (!s.ok()) {
@@ -240,6 +507,7 @@ void TransferEngineOperationState::check_task_status() {
                 break;
             case TransferStatusEnum::FAILED:
             case TransferStatusEnum::CANCELED:
+            case TransferStatusEnum::TIMEOUT:
             case TransferStatusEnum::INVALID:
                 LOG(ERROR) << "Transfer failed for batch " << batch_id_
                            << " task " << i << " with status "
@@ -285,6 +553,56 @@ void TransferEngineOperationState::set_result_internal(ErrorCode error_code) {
     cv_.notify_all();
 }
 
+bool TransferEngineOperationState::add_callback(
+    std::function<void(ErrorCode)> callback) {
+    std::optional<ErrorCode> result;
+    bool watch = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!result_.has_value()) {
+            check_task_status();
+        }
+        if (!result_.has_value()) {
+            callbacks_.push_back(std::move(callback));
+            watch = callbacks_.size() == 1;
+        } else {
+            result = result_;
+        }
+    }
+    if (result.has_value()) {
+        callback(*result);
+        return true;
+    }
+    if (!watch) {
+        return true;
+    }
+    bool watched = batch_->notifyWhenDone([self = shared_from_this()]() {
+        std::vector<std::function<void(ErrorCode)>> callbacks;
+        ErrorCode result;
+        {
+            std::lock_guard<std::mutex> lock(self->mutex_);
+            if (!self->result_.has_value()) {
+                self->check_task_status();
+            }
+            if (!self->result_.has_value()) {
+                // The batch is done, so are its tasks
+                self->set_result_internal(ErrorCode::TRANSFER_FAIL);
+            }
+            result = *self->result_;
+            callbacks.swap(self->callbacks_);
+        }
+        for (auto& callback : callbacks) {
+            callback(result);
+        }
+    });
+    if (!watched) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        callbacks_.clear();
+        return false;
+    }
+    return true;
+}
+
 void TransferEngineOperationState::wait_for_completion() {
     if (is_completed()) {
         return;
@@ -293,29 +611,50 @@ void TransferEngineOperationState::wait_for_completion() {
     VLOG(1) << "Starting transfer engine polling for batch " << batch_id_;
     constexpr int64_t timeout_seconds = 60;
     constexpr int64_t kOneSecondInNano = 1000 * 1000 * 1000;
+    // Poll briefly first, small transfers usually finish within this time
+    constexpr int64_t kSpinNano = 20 * 1000;
+    // Bound each sleep, so that slice timeouts and transports which only
+    // detect completion when polled are still noticed
+    constexpr int64_t kMaxSleepNano = 1000 * 1000;
 
     const int64_t start_ts = getCurrentTimeInNano();
 
     while (true) {
-        if (getCurrentTimeInNano() - start_ts >
-            timeout_seconds * kOneSecondInNano) {
+        // Read before checking, so progress made after the check wakes us
+        const uint32_t progress = engine_.getBatchProgress(batch_id_);
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            check_task_status();
+            if (result_.has_value()) {
+                VLOG(1) << "Transfer engine operation completed for batch "
+                        << batch_id_ << " with result: "
+                        << static_cast<int>(result_.value());
+                break;
+            }
+        }
+
+        const int64_t elapsed = getCurrentTimeInNano() - start_ts;
+        if (elapsed > timeout_seconds * kOneSecondInNano) {
             LOG(ERROR) << "Failed to complete transfers after "
                        << timeout_seconds << " seconds for batch " << batch_id_;
+            FlightRecorder::record(FlightEvent::kTimeout, batch_id_,
+                                   task_count_, timeout_seconds);
+            FlightRecorder::dumpToLog("transfer batch " +
+                                      std::to_string(batch_id_) +
+                                      " timed out");
+            // The transfers not started yet no longer take the bandwidth,
+            // unless they belong to other operations
+            if (task_count_ == batch_->size()) {
+                engine_.cancelBatch(batch_id_);
+            }
+            std::unique_lock<std::mutex> lock(mutex_);
             set_result_internal(ErrorCode::TRANSFER_FAIL);
             return;
         }
-
-        std::unique_lock<std::mutex> lock(mutex_);
-        check_task_status();
-        if (result_.has_value()) {
-            VLOG(1) << "Transfer engine operation completed for batch "
-                    << batch_id_
-                    << " with result: " << static_cast<int>(result_.value());
-            break;
+        if (elapsed < kSpinNano) {
+            continue;
         }
-        // Continue polling
-        VLOG(1) << "Transfer engine operation still pending for batch "
-                << batch_id_;
+        engine_.waitBatchProgress(batch_id_, progress, kMaxSleepNano);
     }
 }
 
@@ -334,7 +673,12 @@ ErrorCode TransferFuture::wait() {
     if (!isReady()) {
         state_->wait_for_completion();
     }
-    return state_->get_result();
+    ErrorCode result = state_->get_result();
+    if (ticket_) {
+        ticket_->Finish(result == ErrorCode::OK);
+        ticket_.reset();
+    }
+    return result;
 }
 
 ErrorCode TransferFuture::get() { return wait(); }
@@ -343,16 +687,105 @@ TransferStrategy TransferFuture::strategy() const {
     return state_->get_strategy();
 }
 
+bool TransferFuture::then(std::function<void(ErrorCode)> callback) {
+    return state_->add_callback(std::move(callback));
+}
+
+ErrorCode TransferFuture::waitAll(std::vector<TransferFuture>& futures) {
+    ErrorCode result = ErrorCode::OK;
+    for (auto& future : futures) {
+        ErrorCode error_code = future.wait();
+        if (result == ErrorCode::OK) {
+            result = error_code;
+        }
+    }
+    return result;
+}
+
+size_t TransferFuture::waitAny(std::vector<TransferFuture>& futures) {
+    if (futures.empty()) {
+        return 0;
+    }
+    // Transfer engine operations only complete when polled
+    constexpr int kSpinRounds = 64;
+    constexpr auto kPollInterval = std::chrono::microseconds(20);
+    for (int round = 0;; ++round) {
+        for (size_t i = 0; i < futures.size(); ++i) {
+            if (futures[i].isReady()) {
+                return i;
+            }
+        }
+        if (round < kSpinRounds) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(kPollInterval);
+        }
+    }
+}
+
+void TransferFuture::attachTicket(ReplicaSelector::Ticket ticket) {
+    ticket_.emplace(std::move(ticket));
+}
+
+TransferFuture::Awaiter TransferFuture::coAwait(
+    async_simple::Executor* executor) && {
+    return Awaiter(std::move(*this), executor);
+}
+
+TransferFuture::Awaiter TransferFuture::operator co_await() && {
+    return Awaiter(std::move(*this), nullptr);
+}
+
+bool TransferFuture::Awaiter::await_suspend(std::coroutine_handle<> handle) {
+    // Set by the callback and by this function, whichever comes second
+    // resumes the coroutine
+    auto raced = std::make_shared<std::atomic<bool>>(false);
+    bool supported = future_.then(
+        [raced, handle, executor = executor_](ErrorCode) {
+            if (!raced->exchange(true)) {
+                return;
+            }
+            if (executor && executor->schedule([handle] { handle.resume(); })) {
+                return;
+            }
+            handle.resume();
+        });
+    return supported && !raced->exchange(true);
+}
+
 // ============================================================================
 // TransferSubmitter Implementation
 // ============================================================================
 
+// Read MC_STORE_MEMCPY_WORKERS, the number of threads copying to and from
+// local segments, default to 4
+static size_t getMemcpyWorkers() {
+    constexpr size_t kDefaultMemcpyWorkers = 4;
+    const char* env_value = std::getenv("MC_STORE_MEMCPY_WORKERS");
+    if (env_value == nullptr) {
+        return kDefaultMemcpyWorkers;
+    }
+    char* end = nullptr;
+    const long workers = std::strtol(env_value, &end, 10);
+    if (end == env_value || *end != '\0' || workers <= 0) {
+        LOG(WARNING) << "Invalid value for MC_STORE_MEMCPY_WORKERS: "
+                     << env_value << ", defaulting to "
+                     << kDefaultMemcpyWorkers;
+        return kDefaultMemcpyWorkers;
+    }
+    return static_cast<size_t>(workers);
+}
+
 TransferSubmitter::TransferSubmitter(TransferEngine& engine,
                                      const std::string& local_hostname,
                                      std::shared_ptr<StorageBackend>& backend)
     : engine_(engine),
       local_hostname_(local_hostname),
-      memcpy_pool_(std::make_unique<MemcpyWorkerPool>()),
+      replica_selector_(local_hostname,
+                        [this](const AllocatedBuffer::Descriptor& buffer) {
+                            return attachedAddress(buffer).has_value();
+                        }),
+      memcpy_pool_(std::make_unique<MemcpyWorkerPool>(getMemcpyWorkers())),
       fileread_pool_(std::make_unique<FilereadWorkerPool>(backend)) {
     CHECK(!local_hostname_.empty()) << "Local hostname cannot be empty";
 
@@ -389,6 +822,10 @@ std::optional<TransferFuture> TransferSubmitter::submit(
     if(replica.is_memory_replica()) {
         std::vector<AllocatedBuffer::Descriptor> handles;
         auto& mem_desc = replica.get_memory_descriptor();
+        // The value came with the replica list
+        if (mem_desc.is_inline()) {
+            return submitInlineRead(mem_desc, slices, op_code);
+        }
         handles = mem_desc.buffer_descriptors;
 
         if (!validateTransferParams(handles, slices)) {
@@ -397,20 +834,237 @@ std::optional<TransferFuture> TransferSubmitter::submit(
 
         TransferStrategy strategy = selectStrategy(handles, slices);
 
+        std::optional<TransferFuture> future;
         switch (strategy) {
             case TransferStrategy::LOCAL_MEMCPY:
-                return submitMemcpyOperation(handles, slices, op_code);
+                future = submitMemcpyOperation(handles, slices, op_code);
+                break;
             case TransferStrategy::TRANSFER_ENGINE:
-                return submitTransferEngineOperation(handles, slices, op_code);
+                future =
+                    submitTransferEngineOperation(handles, slices, op_code);
+                break;
             default:
                 LOG(ERROR) << "Unknown transfer strategy: " << strategy;
                 return std::nullopt;
         }
+        if (future) {
+            future->attachTicket(replica_selector_.BeginTransfer(replica));
+        }
+        return future;
     }else{
         return submitFileReadOperation(replica, slices, op_code);
     }
 }
 
+std::optional<TransferFuture> TransferSubmitter::submit(
+    const std::vector<Replica::Descriptor>& replica_list,
+    std::vector<Slice>& slices, Transport::TransferRequest::OpCode op_code) {
+    Replica::Descriptor replica;
+    if (selectReplica(replica_list, replica) != ErrorCode::OK) {
+        LOG(ERROR) << "no_complete_replica_to_transfer";
+        return std::nullopt;
+    }
+    return submit(replica, slices, op_code);
+}
+
+std::optional<std::vector<TransferFuture>> TransferSubmitter::submitStriped(
+    const std::vector<Replica::Descriptor>& replica_list,
+    std::vector<Slice>& slices, Transport::TransferRequest::OpCode op_code) {
+    auto same_layout = [](const Replica::Descriptor& a,
+                          const Replica::Descriptor& b) {
+        const auto& lhs = a.get_memory_descriptor().buffer_descriptors;
+        const auto& rhs = b.get_memory_descriptor().buffer_descriptors;
+        return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+                          [](const auto& x, const auto& y) {
+                              return x.size_ == y.size_;
+                          });
+    };
+
+    std::vector<const Replica::Descriptor*> replicas;
+    for (const auto& replica : replica_list) {
+        if (replica.status != ReplicaStatus::COMPLETE ||
+            !replica.is_memory_replica()) {
+            continue;
+        }
+        // A local replica is copied with memcpy, faster than any stripe
+        if (replica_selector_.GetLocality(replica) ==
+            ReplicaSelector::Locality::LOCAL) {
+            return std::nullopt;
+        }
+        if (replicas.empty() || same_layout(*replicas.front(), replica)) {
+            replicas.push_back(&replica);
+        }
+    }
+    if (replicas.size() < 2) {
+        return std::nullopt;
+    }
+    const auto& layout =
+        replicas.front()->get_memory_descriptor().buffer_descriptors;
+    if (layout.size() < 2 || !validateTransferParams(layout, slices)) {
+        return std::nullopt;
+    }
+
+    // With more replicas than buffers, stripe over the cheapest ones
+    std::stable_sort(replicas.begin(), replicas.end(),
+                     [this](const Replica::Descriptor* a,
+                            const Replica::Descriptor* b) {
+                         return replica_selector_.EstimateCost(*a) <
+                                replica_selector_.EstimateCost(*b);
+                     });
+    const auto bounds = planStripes(layout, replicas.size());
+
+    std::vector<TransferFuture> futures;
+    futures.reserve(bounds.size() - 1);
+    for (size_t i = 0; i + 1 < bounds.size(); ++i) {
+        const auto& handles =
+            replicas[i]->get_memory_descriptor().buffer_descriptors;
+        Replica::Descriptor stripe;
+        stripe.status = ReplicaStatus::COMPLETE;
+        stripe.descriptor_variant = MemoryDescriptor{
+            {handles.begin() + bounds[i], handles.begin() + bounds[i + 1]}};
+        std::vector<Slice> stripe_slices(slices.begin() + bounds[i],
+                                         slices.begin() + bounds[i + 1]);
+
+        auto future = submit(stripe, stripe_slices, op_code);
+        if (!future) {
+            LOG(ERROR) << "striped_transfer_submit_failed stripe=" << i;
+            for (auto& submitted : futures) {
+                submitted.wait();
+            }
+            return std::nullopt;
+        }
+        futures.push_back(std::move(*future));
+    }
+    return futures;
+}
+
+bool TransferSubmitter::mergeRequest(Transport::TransferRequest& prev,
+                                     const Transport::TransferRequest& next) {
+    if (prev.opcode != next.opcode || prev.target_id != next.target_id ||
+        prev.traffic_class != next.traffic_class ||
+        static_cast<char*>(prev.source) + prev.length != next.source ||
+        prev.target_offset + prev.length != next.target_offset ||
+        prev.length + next.length > kMaxMergedRequestSize) {
+        return false;
+    }
+    prev.length += next.length;
+    return true;
+}
+
+std::vector<std::optional<TransferFuture>> TransferSubmitter::submitBatch(
+    const std::vector<BatchItem>& items,
+    Transport::TransferRequest::OpCode op_code) {
+    std::vector<std::optional<TransferFuture>> futures(items.size());
+    // Tasks of each item in the shared batch
+    struct TaskRange {
+        size_t item;
+        size_t first;
+        size_t count;
+    };
+    std::vector<TaskRange> ranges;
+    std::vector<Transport::TransferRequest> requests;
+    std::vector<Transport::TransferRequest> item_requests;
+
+    for (size_t i = 0; i < items.size(); ++i) {
+        const auto& replica = *items[i].replica;
+        auto& slices = *items[i].slices;
+        if (!replica.is_memory_replica() ||
+            replica.get_memory_descriptor().is_inline()) {
+            futures[i] = submit(replica, slices, op_code);
+            continue;
+        }
+        const auto& handles =
+            replica.get_memory_descriptor().buffer_descriptors;
+        if (!validateTransferParams(handles, slices)) {
+            continue;
+        }
+        if (selectStrategy(handles, slices) !=
+            TransferStrategy::TRANSFER_ENGINE) {
+            futures[i] = submit(replica, slices, op_code);
+            continue;
+        }
+        item_requests.clear();
+        if (!appendTransferRequests(handles, slices, op_code,
+                                    item_requests)) {
+            continue;
+        }
+        // A request continuing the previous one on both ends, e.g. for
+        // objects packed next to each other, extends it, and the items
+        // share the merged request
+        size_t first = requests.size();
+        for (const auto& request : item_requests) {
+            if (!requests.empty() && mergeRequest(requests.back(), request)) {
+                first = std::min(first, requests.size() - 1);
+            } else {
+                requests.push_back(request);
+            }
+        }
+        ranges.push_back({i, first, requests.size() - first});
+    }
+    if (ranges.empty()) {
+        return futures;
+    }
+
+    BatchID batch_id = engine_.allocateBatchID(requests.size());
+    if (batch_id == Transport::INVALID_BATCH_ID) {
+        LOG(ERROR) << "Failed to allocate batch ID";
+        return futures;
+    }
+    Status s = engine_.submitTransfer(batch_id, requests);
+    if (!s.ok()) {
+        LOG(ERROR) << "Failed to submit all transfers, error code is "
+                   << s.code();
+        engine_.freeBatchID(batch_id);
+        return futures;
+    }
+    auto batch =
+        std::make_shared<EngineBatch>(engine_, batch_id, requests.size());
+    for (const auto& range : ranges) {
+        TransferFuture future(std::make_shared<TransferEngineOperationState>(
+            batch, range.first, range.count));
+        future.attachTicket(
+            replica_selector_.BeginTransfer(*items[range.item].replica));
+        futures[range.item] = std::move(future);
+    }
+    VLOG(1) << "Submitted " << ranges.size() << " transfers as one batch of "
+            << requests.size() << " requests";
+    return futures;
+}
+
+std::vector<size_t> TransferSubmitter::planStripes(
+    const std::vector<AllocatedBuffer::Descriptor>& handles,
+    size_t stripe_count) {
+    const size_t count = handles.size();
+    stripe_count = std::max<size_t>(1, std::min(stripe_count, count));
+    uint64_t total = 0;
+    for (const auto& handle : handles) {
+        total += handle.size_;
+    }
+
+    std::vector<size_t> bounds{0};
+    size_t end = 0;
+    uint64_t covered = 0;
+    for (size_t i = 0; i < stripe_count && end < count; ++i) {
+        const uint64_t target = total / stripe_count * (i + 1) +
+                                total % stripe_count * (i + 1) / stripe_count;
+        // Leave at least one buffer for each of the remaining stripes
+        const size_t limit = count - (stripe_count - 1 - i);
+        do {
+            covered += handles[end].size_;
+            ++end;
+        } while (end < limit && covered < target);
+        bounds.push_back(end);
+    }
+    bounds.back() = count;
+    return bounds;
+}
+
+ErrorCode TransferSubmitter::selectReplica(
+    const std::vector<Replica::Descriptor>& replica_list,
+    Replica::Descriptor& replica) const {
+    return replica_selector_.Select(replica_list, replica);
+}
+
 std::optional<TransferFuture> TransferSubmitter::submitMemcpyOperation(
     const std::vector<AllocatedBuffer::Descriptor>& handles,
     std::vector<Slice>& slices, Transport::TransferRequest::OpCode op_code) {
@@ -426,16 +1080,20 @@ std::optional<TransferFuture> TransferSubmitter::submitMemcpyOperation(
 
         void* dest;
         const void* src;
+        // Buffers of attached segments are at their address in this
+        // process rather than in their owner
+        const uintptr_t address =
+            attachedAddress(handle).value_or(handle.buffer_address_);
 
         if (op_code == Transport::TransferRequest::READ) {
             // READ: from handle (remote buffer) to slice (local
             // buffer)
             dest = slice.ptr;
-            src = reinterpret_cast<const void*>(handle.buffer_address_);
+            src = reinterpret_cast<const void*>(address);
         } else {
             // WRITE: from slice (local buffer) to handle (remote
             // buffer)
-            dest = reinterpret_cast<void*>(handle.buffer_address_);
+            dest = reinterpret_cast<void*>(address);
             src = slice.ptr;
         }
 
@@ -452,13 +1110,11 @@ std::optional<TransferFuture> TransferSubmitter::submitMemcpyOperation(
     return TransferFuture(state);
 }
 
-std::optional<TransferFuture> TransferSubmitter::submitTransferEngineOperation(
+bool TransferSubmitter::appendTransferRequests(
     const std::vector<AllocatedBuffer::Descriptor>& handles,
-    std::vector<Slice>& slices, Transport::TransferRequest::OpCode op_code) {
-    // Create transfer requests
-    std::vector<Transport::TransferRequest> requests;
-    requests.reserve(handles.size());
-
+    std::vector<Slice>& slices, Transport::TransferRequest::OpCode op_code,
+    std::vector<Transport::TransferRequest>& requests) {
+    const size_t first = requests.size();
     for (size_t i = 0; i < handles.size(); ++i) {
         const auto& handle = handles[i];
         const auto& slice = slices[i];
@@ -467,7 +1123,7 @@ std::optional<TransferFuture> TransferSubmitter::submitTransferEngineOperation(
             engine_.openSegment(handle.segment_name_);
         if (seg == static_cast<uint64_t>(ERR_INVALID_ARGUMENT)) {
             LOG(ERROR) << "Failed to open segment " << handle.segment_name_;
-            return std::nullopt;
+            return false;
         }
 
         Transport::TransferRequest request;
@@ -477,7 +1133,24 @@ std::optional<TransferFuture> TransferSubmitter::submitTransferEngineOperation(
         request.target_offset = handle.buffer_address_;
         request.length = handle.size_;
 
-        requests.emplace_back(request);
+        // Buffers adjacent on both sides, e.g. the slices of an object
+        // copied from one local buffer, go in one request
+        if (requests.size() <= first ||
+            !mergeRequest(requests.back(), request)) {
+            requests.emplace_back(request);
+        }
+    }
+    return true;
+}
+
+std::optional<TransferFuture> TransferSubmitter::submitTransferEngineOperation(
+    const std::vector<AllocatedBuffer::Descriptor>& handles,
+    std::vector<Slice>& slices, Transport::TransferRequest::OpCode op_code) {
+    // Create transfer requests
+    std::vector<Transport::TransferRequest> requests;
+    requests.reserve(handles.size());
+    if (!appendTransferRequests(handles, slices, op_code, requests)) {
+        return std::nullopt;
     }
 
     // Allocate batch ID
@@ -508,6 +1181,35 @@ std::optional<TransferFuture> TransferSubmitter::submitTransferEngineOperation(
     return TransferFuture(state);
 }
 
+std::optional<TransferFuture> TransferSubmitter::submitInlineRead(
+    const MemoryDescriptor& mem_desc, std::vector<Slice>& slices,
+    Transport::TransferRequest::OpCode op_code) {
+    if (op_code != Transport::TransferRequest::READ) {
+        LOG(ERROR) << "Inline objects are written by PutInline only";
+        return std::nullopt;
+    }
+    const std::string& data = mem_desc.inline_data;
+    size_t offset = 0;
+    for (auto& slice : slices) {
+        if (offset == data.size()) {
+            break;
+        }
+        const size_t length = std::min(slice.size, data.size() - offset);
+        std::memcpy(slice.ptr, data.data() + offset, length);
+        offset += length;
+    }
+    if (offset != data.size()) {
+        LOG(ERROR) << "Slices of " << offset << " bytes are smaller than the "
+                   << "inline object of " << data.size() << " bytes";
+        return std::nullopt;
+    }
+
+    auto state =
+        std::make_shared<AsyncOperationState>(TransferStrategy::LOCAL_MEMCPY);
+    state->set_completed(ErrorCode::OK);
+    return TransferFuture(state);
+}
+
 std::optional<TransferFuture> TransferSubmitter::submitFileReadOperation(
     const Replica::Descriptor& replica, std::vector<Slice>& slices, 
     Transport::TransferRequest::OpCode op_code) {
@@ -517,7 +1219,8 @@ std::optional<TransferFuture> TransferSubmitter::submitFileReadOperation(
     size_t file_length = disk_replica.file_size;
 
     // Submit memcpy operations to worker pool for async execution
-    FilereadTask task(file_path, file_length, slices, state);
+    FilereadTask task(file_path, file_length, slices, state,
+                      disk_replica.file_offset);
     fileread_pool_->submitTask(std::move(task));
 
     VLOG(1) << "Fileread transfer submitted to worker pool with "
@@ -529,6 +1232,12 @@ std::optional<TransferFuture> TransferSubmitter::submitFileReadOperation(
 TransferStrategy TransferSubmitter::selectStrategy(
     const std::vector<AllocatedBuffer::Descriptor>& handles,
     const std::vector<Slice>& slices) const {
+    // Shared memory mapped here is reached with load/store, there is no
+    // NIC path to prefer
+    if (isAttachedTransfer(handles)) {
+        return TransferStrategy::LOCAL_MEMCPY;
+    }
+
     // Check if memcpy operations are enabled via environment variable
     if (!memcpy_enabled_) {
         VLOG(2) << "Memcpy operations disabled via MC_STORE_MEMCPY environment "
@@ -546,12 +1255,96 @@ TransferStrategy TransferSubmitter::selectStrategy(
 
 bool TransferSubmitter::isLocalTransfer(
     const std::vector<AllocatedBuffer::Descriptor>& handles) const {
+    if (!std::all_of(handles.begin(), handles.end(),
+                     [this](const auto& handle) {
+                         return handle.segment_name_ == local_hostname_;
+                     })) {
+        return false;
+    }
+    if (!has_device_memory_.load(std::memory_order_acquire)) {
+        return true;
+    }
+    std::shared_lock<std::shared_mutex> lock(device_memory_mutex_);
+    return std::none_of(
+        handles.begin(), handles.end(), [this](const auto& handle) {
+            auto it = device_memory_.upper_bound(handle.buffer_address_);
+            return it != device_memory_.begin() &&
+                   handle.buffer_address_ <
+                       std::prev(it)->first + std::prev(it)->second;
+        });
+}
+
+void TransferSubmitter::addDeviceMemory(uintptr_t base, size_t size) {
+    std::unique_lock<std::shared_mutex> lock(device_memory_mutex_);
+    device_memory_[base] = size;
+    has_device_memory_.store(true, std::memory_order_release);
+}
+
+void TransferSubmitter::removeDeviceMemory(uintptr_t base) {
+    std::unique_lock<std::shared_mutex> lock(device_memory_mutex_);
+    device_memory_.erase(base);
+    has_device_memory_.store(!device_memory_.empty(),
+                             std::memory_order_release);
+}
+
+std::optional<uintptr_t> TransferSubmitter::attachedAddress(
+    const AllocatedBuffer::Descriptor& handle) const {
+    if (!has_attached_segments_.load(std::memory_order_acquire)) {
+        return std::nullopt;
+    }
+    std::shared_lock<std::shared_mutex> lock(attached_segments_mutex_);
+    auto it = attached_segments_.upper_bound(
+        {handle.segment_name_, handle.buffer_address_});
+    if (it == attached_segments_.begin()) {
+        return std::nullopt;
+    }
+    --it;
+    const auto& [name, base] = it->first;
+    if (name != handle.segment_name_ ||
+        handle.buffer_address_ + handle.size_ > base + it->second.size) {
+        return std::nullopt;
+    }
+    return it->second.local_base + (handle.buffer_address_ - base);
+}
+
+std::optional<uintptr_t> TransferSubmitter::localAddress(
+    const AllocatedBuffer::Descriptor& handle) const {
+    if (auto attached = attachedAddress(handle)) {
+        return attached;
+    }
+    if (isLocalTransfer({handle})) {
+        return handle.buffer_address_;
+    }
+    return std::nullopt;
+}
+
+bool TransferSubmitter::isAttachedTransfer(
+    const std::vector<AllocatedBuffer::Descriptor>& handles) const {
+    if (!has_attached_segments_.load(std::memory_order_acquire)) {
+        return false;
+    }
     return std::all_of(handles.begin(), handles.end(),
                        [this](const auto& handle) {
-                           return handle.segment_name_ == local_hostname_;
+                           return attachedAddress(handle).has_value();
                        });
 }
 
+void TransferSubmitter::addAttachedSegment(const std::string& segment_name,
+                                           uintptr_t base, size_t size,
+                                           uintptr_t local_base) {
+    std::unique_lock<std::shared_mutex> lock(attached_segments_mutex_);
+    attached_segments_[{segment_name, base}] = {size, local_base};
+    has_attached_segments_.store(true, std::memory_order_release);
+}
+
+void TransferSubmitter::removeAttachedSegment(
+    const std::string& segment_name, uintptr_t base) {
+    std::unique_lock<std::shared_mutex> lock(attached_segments_mutex_);
+    attached_segments_.erase({segment_name, base});
+    has_attached_segments_.store(!attached_segments_.empty(),
+                                 std::memory_order_release);
+}
+
 bool TransferSubmitter::validateTransferParams(
     const std::vector<AllocatedBuffer::Descriptor>& handles,
     const std::vector<Slice>& slices) const {
@@ -4,6 +4,9 @@
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
 
+#include <array>
+#include <mutex>
+
 namespace mooncake {
 
 const std::string& toString(ErrorCode errorCode) noexcept {
@@ -28,6 +31,7 @@ const std::string& toString(ErrorCode errorCode) noexcept {
         {ErrorCode::OBJECT_HAS_LEASE, "OBJECT_HAS_LEASE"},
         {ErrorCode::TRANSFER_FAIL, "TRANSFER_FAIL"},
         {ErrorCode::RPC_FAIL, "RPC_FAIL"},
+        {ErrorCode::MASTER_BUSY, "MASTER_BUSY"},
         {ErrorCode::ETCD_OPERATION_ERROR, "ETCD_OPERATION_ERROR"},
         {ErrorCode::ETCD_KEY_NOT_EXIST, "ETCD_KEY_NOT_EXIST"},
         {ErrorCode::ETCD_TRANSACTION_FAIL, "ETCD_TRANSACTION_FAIL"},
@@ -56,6 +60,147 @@ ErrorCode fromInt(int32_t errorCode) noexcept {
     return static_cast<ErrorCode>(errorCode);
 }
 
+PackedReplicaLists PackedReplicaLists::Pack(
+    const std::vector<tl::expected<std::vector<Replica::Descriptor>,
+                                   ErrorCode>>& results) {
+    PackedReplicaLists packed;
+    packed.errors.reserve(results.size());
+    packed.replica_lists.resize(results.size());
+    std::unordered_map<std::string_view, uint32_t> segment_index;
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (!results[i]) {
+            packed.errors.push_back(results[i].error());
+            continue;
+        }
+        packed.errors.push_back(ErrorCode::OK);
+        auto& replicas = packed.replica_lists[i];
+        replicas.reserve(results[i]->size());
+        for (const auto& descriptor : *results[i]) {
+            auto& replica = replicas.emplace_back();
+            replica.status = descriptor.status;
+            if (!descriptor.is_memory_replica()) {
+                replica.disk = descriptor.get_disk_descriptor();
+                continue;
+            }
+            const auto& memory = descriptor.get_memory_descriptor();
+            replica.inline_data = memory.inline_data;
+            const auto& buffers = memory.buffer_descriptors;
+            replica.buffers.reserve(buffers.size());
+            for (const auto& buffer : buffers) {
+                // The names live in results, which outlive the index
+                auto [it, inserted] = segment_index.try_emplace(
+                    buffer.segment_name_, packed.segments.size());
+                if (inserted) {
+                    packed.segments.push_back(buffer.segment_name_);
+                }
+                replica.buffers.push_back({it->second, buffer.size_,
+                                           buffer.buffer_address_,
+                                           buffer.status_});
+            }
+        }
+    }
+    return packed;
+}
+
+std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+PackedReplicaLists::Unpack() const {
+    std::vector<tl::expected<std::vector<Replica::Descriptor>, ErrorCode>>
+        results;
+    results.reserve(errors.size());
+    for (size_t i = 0; i < errors.size(); ++i) {
+        if (errors[i] != ErrorCode::OK) {
+            results.emplace_back(tl::make_unexpected(errors[i]));
+            continue;
+        }
+        if (i >= replica_lists.size()) {
+            results.emplace_back(tl::make_unexpected(ErrorCode::RPC_FAIL));
+            continue;
+        }
+        std::vector<Replica::Descriptor> descriptors;
+        descriptors.reserve(replica_lists[i].size());
+        bool valid = true;
+        for (const auto& replica : replica_lists[i]) {
+            auto& descriptor = descriptors.emplace_back();
+            descriptor.status = replica.status;
+            if (replica.disk) {
+                descriptor.descriptor_variant = *replica.disk;
+                continue;
+            }
+            MemoryDescriptor memory;
+            memory.inline_data = replica.inline_data;
+            memory.buffer_descriptors.reserve(replica.buffers.size());
+            for (const auto& buffer : replica.buffers) {
+                if (buffer.segment >= segments.size()) {
+                    valid = false;
+                    break;
+                }
+                memory.buffer_descriptors.push_back(
+                    {segments[buffer.segment], buffer.size,
+                     buffer.buffer_address, buffer.status});
+            }
+            descriptor.descriptor_variant = std::move(memory);
+        }
+        if (!valid) {
+            results.emplace_back(tl::make_unexpected(ErrorCode::RPC_FAIL));
+            continue;
+        }
+        results.emplace_back(std::move(descriptors));
+    }
+    return results;
+}
+
+namespace {
+
+constexpr size_t kSegmentNameChunk = 1024;
+constexpr size_t kMaxSegmentNameChunks = 4096;
+
+struct SegmentNameStore {
+    SegmentNameStore() {
+        chunks[0].reset(new std::string[kSegmentNameChunk]);
+        ids.emplace("", 0);
+        count = 1;
+    }
+
+    std::mutex mutex;
+    std::unordered_map<std::string, uint32_t> ids;
+    // Filled in order and never moved, so that names are read without the
+    // lock: an ID is only seen after its name was stored
+    std::array<std::unique_ptr<std::string[]>, kMaxSegmentNameChunks> chunks;
+    uint32_t count;
+};
+
+// Never destroyed, buffers may outlive static destruction
+SegmentNameStore& GetSegmentNameStore() {
+    static SegmentNameStore* store = new SegmentNameStore();
+    return *store;
+}
+
+}  // namespace
+
+uint32_t SegmentNameTable::Intern(std::string_view name) {
+    SegmentNameStore& store = GetSegmentNameStore();
+    std::lock_guard<std::mutex> lock(store.mutex);
+    std::string key(name);
+    auto it = store.ids.find(key);
+    if (it != store.ids.end()) {
+        return it->second;
+    }
+    const uint32_t id = store.count;
+    auto& chunk = store.chunks.at(id / kSegmentNameChunk);
+    if (!chunk) {
+        chunk.reset(new std::string[kSegmentNameChunk]);
+    }
+    chunk[id % kSegmentNameChunk] = key;
+    store.ids.emplace(std::move(key), id);
+    ++store.count;
+    return id;
+}
+
+const std::string& SegmentNameTable::Name(uint32_t id) {
+    return GetSegmentNameStore()
+        .chunks[id / kSegmentNameChunk][id % kSegmentNameChunk];
+}
+
 UUID generate_uuid() {
     UUID pair_uuid;
     boost::uuids::random_generator gen;
@@ -0,0 +1,203 @@
+#include "write_behind_queue.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+
+namespace mooncake {
+
+namespace {
+
+// Staging buffers kept for reuse, in multiples of the batch size
+constexpr uint64_t kFreeBufferBatches = 4;
+
+}  // namespace
+
+WriteBehindQueue::WriteBehindQueue(std::shared_ptr<StorageBackend> backend,
+                                   size_t num_threads, uint64_t budget_bytes,
+                                   uint64_t batch_bytes,
+                                   StoredCallback on_stored)
+    : backend_(std::move(backend)),
+      budget_bytes_(std::max<uint64_t>(budget_bytes, 1)),
+      batch_bytes_(std::max<uint64_t>(batch_bytes, 1)),
+      on_stored_(std::move(on_stored)),
+      queue_depth_gauge_("client_write_behind_queue_depth",
+                         "Objects waiting to be written to the storage "
+                         "backend"),
+      bytes_in_flight_gauge_("client_write_behind_bytes_in_flight",
+                             "Bytes queued for or being written to the "
+                             "storage backend") {
+    num_threads = std::max<size_t>(num_threads, 1);
+    workers_.reserve(num_threads);
+    for (size_t i = 0; i < num_threads; ++i) {
+        workers_.emplace_back(&WriteBehindQueue::WorkerThread, this);
+    }
+}
+
+WriteBehindQueue::~WriteBehindQueue() { Stop(); }
+
+bool WriteBehindQueue::Push(const ObjectKey& key,
+                            const std::vector<Slice>& slices) {
+    uint64_t size = 0;
+    for (const auto& slice : slices) {
+        size += slice.size;
+    }
+
+    std::string value;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        // Admit an object larger than the budget once the queue is empty
+        space_cv_.wait(lock, [&] {
+            return stop_ || bytes_in_flight_ == 0 ||
+                   bytes_in_flight_ + size <= budget_bytes_;
+        });
+        if (stop_) {
+            return false;
+        }
+        bytes_in_flight_ += size;
+        bytes_in_flight_gauge_.update(bytes_in_flight_);
+        value = AcquireBuffer(size);
+    }
+
+    // Copy outside the lock, the budget is already reserved
+    for (const auto& slice : slices) {
+        value.append(static_cast<const char*>(slice.ptr), slice.size);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back({key, std::move(value)});
+        queue_depth_gauge_.update(queue_.size());
+    }
+    work_cv_.notify_one();
+    return true;
+}
+
+void WriteBehindQueue::Flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    space_cv_.wait(lock, [&] { return bytes_in_flight_ == 0; });
+}
+
+void WriteBehindQueue::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stop_ && workers_.empty()) {
+            return;
+        }
+        stop_ = true;
+    }
+    work_cv_.notify_all();
+    space_cv_.notify_all();
+    for (auto& worker : workers_) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+    workers_.clear();
+}
+
+size_t WriteBehindQueue::queue_depth() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.size();
+}
+
+uint64_t WriteBehindQueue::bytes_in_flight() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_in_flight_;
+}
+
+std::string WriteBehindQueue::SerializeMetrics() {
+    std::string metrics;
+    queue_depth_gauge_.serialize(metrics);
+    bytes_in_flight_gauge_.serialize(metrics);
+    return metrics;
+}
+
+void WriteBehindQueue::WorkerThread() {
+    std::vector<ObjectKey> keys;
+    std::vector<std::string> values;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            work_cv_.wait(lock, [&] { return stop_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                // Stopped and drained
+                return;
+            }
+            // Take at least one object, then fill the batch
+            uint64_t batch_size = 0;
+            while (!queue_.empty() &&
+                   (keys.empty() ||
+                    batch_size + queue_.front().value.size() <=
+                        batch_bytes_)) {
+                batch_size += queue_.front().value.size();
+                keys.push_back(std::move(queue_.front().key));
+                values.push_back(std::move(queue_.front().value));
+                queue_.pop_front();
+            }
+            queue_depth_gauge_.update(queue_.size());
+        }
+
+        auto results = backend_->BatchStoreObject(keys, values);
+        uint64_t stored_bytes = 0;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            stored_bytes += values[i].size();
+            if (results[i] != ErrorCode::OK) {
+                LOG(WARNING) << "Failed to write object " << keys[i]
+                             << " to the storage backend, error="
+                             << results[i];
+            } else if (on_stored_) {
+                on_stored_(keys[i]);
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto& value : values) {
+                ReleaseBuffer(std::move(value));
+            }
+            bytes_in_flight_ -= stored_bytes;
+            bytes_in_flight_gauge_.update(bytes_in_flight_);
+        }
+        space_cv_.notify_all();
+        keys.clear();
+        values.clear();
+    }
+}
+
+std::string WriteBehindQueue::AcquireBuffer(size_t size) {
+    // Smallest free buffer that fits
+    auto best = free_buffers_.end();
+    for (auto it = free_buffers_.begin(); it != free_buffers_.end(); ++it) {
+        if (it->capacity() >= size &&
+            (best == free_buffers_.end() ||
+             it->capacity() < best->capacity())) {
+            best = it;
+        }
+    }
+    std::string buffer;
+    if (best != free_buffers_.end()) {
+        buffer = std::move(*best);
+        free_buffers_.erase(best);
+    } else {
+        buffer.reserve(size);
+    }
+    return buffer;
+}
+
+void WriteBehindQueue::ReleaseBuffer(std::string buffer) {
+    if (buffer.capacity() > batch_bytes_) {
+        return;
+    }
+    uint64_t free_bytes = buffer.capacity();
+    for (const auto& free_buffer : free_buffers_) {
+        free_bytes += free_buffer.capacity();
+    }
+    if (free_bytes > kFreeBufferBatches * batch_bytes_) {
+        return;
+    }
+    buffer.clear();
+    free_buffers_.push_back(std::move(buffer));
+}
+
+}  // namespace mooncake
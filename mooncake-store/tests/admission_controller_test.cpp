@@ -0,0 +1,120 @@
+#include "admission_controller.h"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <chrono>
+
+namespace mooncake {
+
+using OpClass = AdmissionController::OpClass;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+
+class AdmissionControllerTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        google::InitGoogleLogging("AdmissionControllerTest");
+        FLAGS_logtostderr = 1;
+    }
+
+    void TearDown() override { google::ShutdownGoogleLogging(); }
+};
+
+TEST_F(AdmissionControllerTest, TokenBucketLimitsRate) {
+    AdmissionConfig config;
+    config.write_rate = 1000;  // 100 tokens per 100 ms interval
+    AdmissionController controller(config);
+    auto now = AdmissionController::Clock::now();
+
+    int admitted = 0;
+    for (int i = 0; i < 200; ++i) {
+        admitted += controller.Admit(OpClass::WRITE, 1, now);
+    }
+    EXPECT_EQ(admitted, 100);
+    // Reads have no limit
+    EXPECT_TRUE(controller.Admit(OpClass::READ, 1000000, now));
+
+    // Refilled at the rate
+    now += milliseconds(10);
+    admitted = 0;
+    for (int i = 0; i < 20; ++i) {
+        admitted += controller.Admit(OpClass::WRITE, 1, now);
+    }
+    EXPECT_EQ(admitted, 10);
+}
+
+TEST_F(AdmissionControllerTest, LargeBatchPutsBucketInDebt) {
+    AdmissionConfig config;
+    config.read_rate = 1000;
+    AdmissionController controller(config);
+    auto now = AdmissionController::Clock::now();
+
+    // Larger than the burst, admitted while tokens are left
+    EXPECT_TRUE(controller.Admit(OpClass::READ, 300, now));
+    EXPECT_FALSE(controller.Admit(OpClass::READ, 1, now));
+    // The 200 tokens of debt take 200 ms to repay
+    now += milliseconds(150);
+    EXPECT_FALSE(controller.Admit(OpClass::READ, 1, now));
+    now += milliseconds(60);
+    EXPECT_TRUE(controller.Admit(OpClass::READ, 1, now));
+}
+
+TEST_F(AdmissionControllerTest, ShedsWritesBeforeReads) {
+    AdmissionConfig config;
+    config.target_latency = microseconds(1000);
+    config.interval = milliseconds(100);
+    AdmissionController controller(config);
+    auto now = AdmissionController::Clock::now();
+
+    // A standing queue: even the fastest request is above the target
+    controller.Complete(microseconds(2000), now);
+    controller.Complete(microseconds(3000), now);
+    now += milliseconds(100);
+    EXPECT_TRUE(controller.Admit(OpClass::READ, 1, now));
+    EXPECT_EQ(controller.OverloadLevel(), 1);
+    EXPECT_FALSE(controller.Admit(OpClass::WRITE, 1, now));
+
+    // Far above the target, reads are shed as well
+    controller.Complete(microseconds(5000), now);
+    now += milliseconds(100);
+    EXPECT_FALSE(controller.Admit(OpClass::READ, 1, now));
+    EXPECT_EQ(controller.OverloadLevel(), 2);
+    EXPECT_FALSE(controller.Admit(OpClass::WRITE, 1, now));
+
+    // An interval without completions ends the shedding
+    now += milliseconds(100);
+    EXPECT_TRUE(controller.Admit(OpClass::WRITE, 1, now));
+    EXPECT_EQ(controller.OverloadLevel(), 0);
+}
+
+TEST_F(AdmissionControllerTest, BurstDoesNotShed) {
+    AdmissionConfig config;
+    config.target_latency = microseconds(1000);
+    AdmissionController controller(config);
+    auto now = AdmissionController::Clock::now();
+
+    // Slow requests behind a burst, but some went through right away
+    controller.Complete(microseconds(5000), now);
+    controller.Complete(microseconds(200), now);
+    now += milliseconds(100);
+    EXPECT_TRUE(controller.Admit(OpClass::WRITE, 1, now));
+    EXPECT_EQ(controller.OverloadLevel(), 0);
+}
+
+TEST_F(AdmissionControllerTest, ScopedAdmissionReportsLatency) {
+    AdmissionConfig config;
+    config.write_rate = 10;
+    AdmissionController controller(config);
+    {
+        ScopedAdmission admission(&controller, OpClass::WRITE, 1);
+        EXPECT_TRUE(admission.admitted());
+    }
+    ScopedAdmission shed(&controller, OpClass::WRITE, 1);
+    EXPECT_FALSE(shed.admitted());
+
+    ScopedAdmission unlimited(nullptr, OpClass::WRITE, 1);
+    EXPECT_TRUE(unlimited.admitted());
+}
+
+}  // namespace mooncake
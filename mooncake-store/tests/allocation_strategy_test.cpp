@@ -2,8 +2,11 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <chrono>
 #include <memory>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -238,4 +241,216 @@ TEST_F(AllocationStrategyTest, VeryLargeSizeAllocation) {
     EXPECT_EQ(result, nullptr);  // Should fail due to insufficient capacity
 }
 
+// Test that the capacity-aware strategy avoids the fuller segment
+TEST_F(AllocationStrategyTest, CapacityAwarePrefersFreeSpace) {
+    auto allocator1 = CreateTestAllocator("segment1", 0);
+    auto allocator2 = CreateTestAllocator("segment2", 0x10000000ULL);
+
+    std::unordered_map<std::string, std::vector<std::shared_ptr<BufferAllocator>>>
+        allocators_by_name;
+    std::vector<std::shared_ptr<BufferAllocator>> allocators;
+
+    allocators_by_name["segment1"].push_back(allocator1);
+    allocators_by_name["segment2"].push_back(allocator2);
+    allocators.push_back(allocator1);
+    allocators.push_back(allocator2);
+
+    // Fill 8MB of segment1 directly
+    std::vector<std::unique_ptr<AllocatedBuffer>> fillers;
+    for (int i = 0; i < 128; ++i) {
+        fillers.push_back(allocator1->allocate(64 * 1024));
+        ASSERT_NE(fillers.back(), nullptr);
+    }
+
+    CapacityAwareAllocationStrategy strategy;
+    ReplicateConfig config{1, false, ""};
+    std::vector<std::unique_ptr<AllocatedBuffer>> buffers;
+    for (int i = 0; i < 20; ++i) {
+        auto result = strategy.Allocate(allocators, allocators_by_name,
+                                        64 * 1024, config);
+        ASSERT_NE(result, nullptr);
+        EXPECT_EQ(result->get_descriptor().segment_name_, "segment2");
+        buffers.push_back(std::move(result));
+    }
+
+    // The preferred segment still wins when it has space
+    ReplicateConfig preferred_config{1, false, "segment1"};
+    auto result = strategy.Allocate(allocators, allocators_by_name, 64 * 1024,
+                                    preferred_config);
+    ASSERT_NE(result, nullptr);
+    EXPECT_EQ(result->get_descriptor().segment_name_, "segment1");
+}
+
+// Test that two choices keep the utilization of many segments close
+TEST_F(AllocationStrategyTest, CapacityAwareBalancesSegments) {
+    constexpr int kNumSegments = 16;
+    constexpr size_t kSegmentSize = 1024 * 1024 * 16;
+    constexpr size_t kObjectSize = 256 * 1024;
+
+    auto fill = [&](AllocationStrategy& strategy) {
+        std::unordered_map<std::string,
+                           std::vector<std::shared_ptr<BufferAllocator>>>
+            allocators_by_name;
+        std::vector<std::shared_ptr<BufferAllocator>> allocators;
+        for (int i = 0; i < kNumSegments; ++i) {
+            auto allocator = CreateTestAllocator(
+                "segment" + std::to_string(i), i * 0x10000000ULL);
+            allocators_by_name[allocator->getSegmentName()].push_back(
+                allocator);
+            allocators.push_back(allocator);
+        }
+        // Fill half of the total capacity
+        ReplicateConfig config{1, false, ""};
+        std::vector<std::unique_ptr<AllocatedBuffer>> buffers;
+        const size_t count = kNumSegments * kSegmentSize / kObjectSize / 2;
+        for (size_t i = 0; i < count; ++i) {
+            auto buffer = strategy.Allocate(allocators, allocators_by_name,
+                                            kObjectSize, config);
+            EXPECT_NE(buffer, nullptr);
+            buffers.push_back(std::move(buffer));
+        }
+        auto [min_it, max_it] = std::minmax_element(
+            allocators.begin(), allocators.end(),
+            [](const auto& a, const auto& b) { return a->size() < b->size(); });
+        return (*max_it)->size() - (*min_it)->size();
+    };
+
+    // With two choices the gap stays within a few objects, random placement
+    // typically ends up 20 objects apart here
+    CapacityAwareAllocationStrategy capacity_aware;
+    EXPECT_LE(fill(capacity_aware), 8 * kObjectSize);
+}
+
+// Test that the load-aware strategy avoids segments with recent transfers
+TEST_F(AllocationStrategyTest, LoadAwareAvoidsBusySegment) {
+    auto allocator1 = CreateTestAllocator("segment1", 0);
+    auto allocator2 = CreateTestAllocator("segment2", 0x10000000ULL);
+
+    std::unordered_map<std::string, std::vector<std::shared_ptr<BufferAllocator>>>
+        allocators_by_name;
+    std::vector<std::shared_ptr<BufferAllocator>> allocators;
+
+    allocators_by_name["segment1"].push_back(allocator1);
+    allocators_by_name["segment2"].push_back(allocator2);
+    allocators.push_back(allocator1);
+    allocators.push_back(allocator2);
+
+    LoadAwareAllocationStrategy strategy(std::chrono::hours(1));
+    EXPECT_TRUE(strategy.TracksTransferLoad());
+    strategy.RecordTransfer("segment1", 1ULL << 30);
+
+    ReplicateConfig config{1, false, ""};
+    std::vector<std::unique_ptr<AllocatedBuffer>> buffers;
+    for (int i = 0; i < 20; ++i) {
+        auto result =
+            strategy.Allocate(allocators, allocators_by_name, 1024, config);
+        ASSERT_NE(result, nullptr);
+        EXPECT_EQ(result->get_descriptor().segment_name_, "segment2");
+        buffers.push_back(std::move(result));
+    }
+    // Allocations count as write load on the chosen segment
+    EXPECT_GE(strategy.Load("segment2"), 10 * 1024);
+
+    // A busy segment is still used when the other one has no space left
+    while (auto filler = allocator2->allocate(1024)) {
+        buffers.push_back(std::move(filler));
+    }
+    auto result =
+        strategy.Allocate(allocators, allocators_by_name, 1024, config);
+    ASSERT_NE(result, nullptr);
+    EXPECT_EQ(result->get_descriptor().segment_name_, "segment1");
+}
+
+// Test that recorded load fades out after two windows
+TEST_F(AllocationStrategyTest, SegmentLoadTrackerDecays) {
+    SegmentLoadTracker tracker(std::chrono::milliseconds(50));
+    EXPECT_EQ(tracker.Load("segment1"), 0);
+    tracker.Record("segment1", 1000);
+    tracker.Record("segment1", 1000);
+    const uint64_t load = tracker.Load("segment1");
+    // Less than 2000 only if the window rolled over in between
+    EXPECT_GE(load, 1000);
+    EXPECT_LE(load, 2000);
+    EXPECT_EQ(tracker.Load("segment2"), 0);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(120));
+    EXPECT_EQ(tracker.Load("segment1"), 0);
+}
+
+// Test that replicas land in distinct failure domains close to the client
+TEST_F(AllocationStrategyTest, TopologyAwareSpreadsReplicas) {
+    struct Node {
+        std::string name;
+        SegmentTopology topology;
+    };
+    const std::vector<Node> nodes = {
+        {"a0", {"host_a", "rack1", "nic0"}},
+        {"a1", {"host_a", "rack1", "nic1"}},
+        {"b0", {"host_b", "rack1", ""}},
+        {"c0", {"host_c", "rack2", ""}},
+        {"d0", {"host_d", "rack2", ""}},
+    };
+    std::unordered_map<std::string, std::vector<std::shared_ptr<BufferAllocator>>>
+        allocators_by_name;
+    std::vector<std::shared_ptr<BufferAllocator>> allocators;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        auto allocator = std::make_shared<BufferAllocator>(
+            nodes[i].name, 0x100000000ULL + i * 0x10000000ULL,
+            1024 * 1024 * 16, nodes[i].topology);
+        allocators_by_name[nodes[i].name].push_back(allocator);
+        allocators.push_back(allocator);
+    }
+    auto topology_of = [&](const std::unique_ptr<AllocatedBuffer>& buffer) {
+        return allocators_by_name.at(buffer->get_descriptor().segment_name_)
+            .front()
+            ->getTopology();
+    };
+
+    TopologyAwareAllocationStrategy strategy;
+    ReplicateConfig config{3, false, "a0"};
+    std::vector<std::unique_ptr<AllocatedBuffer>> buffers;
+    for (int round = 0; round < 10; ++round) {
+        // The first replica stays on the client's segment
+        auto first = strategy.AllocateReplicaSlice(
+            allocators, allocators_by_name, 1024, config, {});
+        ASSERT_NE(first, nullptr);
+        EXPECT_EQ(first->get_descriptor().segment_name_, "a0");
+
+        // The second one leaves the client's host and rack
+        auto second = strategy.AllocateReplicaSlice(
+            allocators, allocators_by_name, 1024, config, {"a0"});
+        ASSERT_NE(second, nullptr);
+        EXPECT_EQ(topology_of(second).rack, "rack2");
+
+        // With both racks used, the third prefers the client's rack
+        auto third = strategy.AllocateReplicaSlice(
+            allocators, allocators_by_name, 1024, config,
+            {"a0", second->get_descriptor().segment_name_});
+        ASSERT_NE(third, nullptr);
+        EXPECT_EQ(third->get_descriptor().segment_name_, "b0");
+
+        buffers.push_back(std::move(first));
+        buffers.push_back(std::move(second));
+        buffers.push_back(std::move(third));
+    }
+
+    // Without a usable preferred segment, the client's host still wins
+    while (auto filler = allocators[0]->allocate(1024)) {
+        buffers.push_back(std::move(filler));
+    }
+    auto result = strategy.AllocateReplicaSlice(
+        allocators, allocators_by_name, 1024, config, {});
+    ASSERT_NE(result, nullptr);
+    EXPECT_EQ(result->get_descriptor().segment_name_, "a1");
+
+    // Sharing a host with an earlier replica is the last resort
+    std::vector<std::shared_ptr<BufferAllocator>> only_a1 = {allocators[1]};
+    std::unordered_map<std::string, std::vector<std::shared_ptr<BufferAllocator>>>
+        only_a1_by_name = {{"a1", only_a1}};
+    auto fallback = strategy.AllocateReplicaSlice(only_a1, only_a1_by_name,
+                                                  1024, config, {"a1"});
+    ASSERT_NE(fallback, nullptr);
+    EXPECT_EQ(fallback->get_descriptor().segment_name_, "a1");
+}
+
 }  // namespace mooncake
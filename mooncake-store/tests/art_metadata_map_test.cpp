@@ -0,0 +1,231 @@
+#include "art_metadata_map.h"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace mooncake::test {
+
+namespace {
+
+// Non-movable value type that tracks live instances, mirroring the
+// constraints of MasterService::ObjectMetadata.
+struct TrackedValue {
+    static inline int live = 0;
+
+    explicit TrackedValue(int v) : value(v) { ++live; }
+    ~TrackedValue() { --live; }
+
+    TrackedValue(const TrackedValue&) = delete;
+    TrackedValue& operator=(const TrackedValue&) = delete;
+    TrackedValue(TrackedValue&&) = delete;
+    TrackedValue& operator=(TrackedValue&&) = delete;
+
+    int value;
+};
+
+// Keys shaped like those of KV caches: model, tenant, layer, block
+std::string MakeKey(size_t model, size_t layer, size_t block) {
+    return "model_" + std::to_string(model) + "/tenant_a/layer_" +
+           std::to_string(layer) + "/block_" + std::to_string(block);
+}
+
+std::vector<std::string> Keys(const ArtMetadataMap<TrackedValue>& map) {
+    std::vector<std::string> keys;
+    for (const auto& item : map) {
+        keys.emplace_back(item.first);
+    }
+    return keys;
+}
+
+}  // namespace
+
+class ArtMetadataMapTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        google::InitGoogleLogging("ArtMetadataMapTest");
+        FLAGS_logtostderr = 1;
+        TrackedValue::live = 0;
+    }
+
+    void TearDown() override { google::ShutdownGoogleLogging(); }
+};
+
+TEST_F(ArtMetadataMapTest, InsertFindErase) {
+    ArtMetadataMap<TrackedValue> map;
+    EXPECT_TRUE(map.empty());
+    EXPECT_EQ(map.find("missing"), map.end());
+
+    auto [it, inserted] = map.try_emplace("key", 42);
+    EXPECT_TRUE(inserted);
+    EXPECT_EQ(it->first, "key");
+    EXPECT_EQ(it->second.value, 42);
+
+    auto [it2, inserted2] = map.try_emplace("key", 7);
+    EXPECT_FALSE(inserted2);
+    EXPECT_EQ(it2->second.value, 42);
+    EXPECT_EQ(TrackedValue::live, 1);
+
+    EXPECT_EQ(map.erase("key"), 1u);
+    EXPECT_EQ(map.erase("key"), 0u);
+    EXPECT_TRUE(map.empty());
+    EXPECT_EQ(TrackedValue::live, 0);
+}
+
+TEST_F(ArtMetadataMapTest, KeysThatArePrefixesOfOthers) {
+    ArtMetadataMap<TrackedValue> map;
+    const std::vector<std::string> keys = {"", "a", "ab", "abc", "abd", "b"};
+    for (size_t i = 0; i < keys.size(); ++i) {
+        map.try_emplace(keys[keys.size() - 1 - i], static_cast<int>(i));
+    }
+    EXPECT_EQ(Keys(map), keys);
+    EXPECT_FALSE(map.contains("abcd"));
+    EXPECT_FALSE(map.contains("aa"));
+
+    EXPECT_EQ(map.erase("ab"), 1u);
+    EXPECT_EQ(map.erase("a"), 1u);
+    EXPECT_EQ(Keys(map), (std::vector<std::string>{"", "abc", "abd", "b"}));
+    EXPECT_TRUE(map.contains("abd"));
+}
+
+TEST_F(ArtMetadataMapTest, LongSharedPrefixes) {
+    ArtMetadataMap<TrackedValue> map;
+    const std::string base(100, 'p');
+    map.try_emplace(base + "x", 1);
+    map.try_emplace(base + "y", 2);
+    // Differs from the others past the prefix bytes stored in a node
+    std::string other = base + "x";
+    other[50] = 'q';
+    EXPECT_FALSE(map.contains(other));
+    map.try_emplace(other, 3);
+    EXPECT_EQ(map.find(base + "x")->second.value, 1);
+    EXPECT_EQ(map.find(other)->second.value, 3);
+    EXPECT_EQ(Keys(map),
+              (std::vector<std::string>{base + "x", base + "y", other}));
+
+    EXPECT_EQ(map.erase(base + "y"), 1u);
+    EXPECT_EQ(map.find(base + "x")->second.value, 1);
+    EXPECT_EQ(map.lower_bound(base)->first, base + "x");
+    EXPECT_EQ(map.lower_bound(base + "y")->first, other);
+}
+
+TEST_F(ArtMetadataMapTest, LowerBoundScansPrefix) {
+    ArtMetadataMap<TrackedValue> map;
+    for (size_t model = 0; model < 3; ++model) {
+        for (size_t block = 0; block < 300; ++block) {
+            map.try_emplace(MakeKey(model, 0, block), 0);
+        }
+    }
+    const std::string prefix = "model_1/";
+    std::vector<std::string> scanned;
+    for (auto it = map.lower_bound(prefix);
+         it != map.end() && it->first.starts_with(prefix); ++it) {
+        scanned.emplace_back(it->first);
+    }
+    ASSERT_EQ(scanned.size(), 300u);
+    EXPECT_TRUE(std::is_sorted(scanned.begin(), scanned.end()));
+    EXPECT_EQ(map.lower_bound("model_9"), map.end());
+    EXPECT_EQ(map.lower_bound("")->first, MakeKey(0, 0, 0));
+}
+
+TEST_F(ArtMetadataMapTest, ReferencesSurviveChanges) {
+    ArtMetadataMap<TrackedValue> map;
+    TrackedValue& first = map.try_emplace("first", 1).first->second;
+    for (size_t i = 0; i < 10000; ++i) {
+        map.try_emplace(MakeKey(i % 7, i % 61, i), static_cast<int>(i));
+    }
+    for (size_t i = 0; i < 10000; i += 2) {
+        map.erase(MakeKey(i % 7, i % 61, i));
+    }
+    EXPECT_EQ(&first, &map.find("first")->second);
+    EXPECT_EQ(map.size(), 5001u);
+}
+
+TEST_F(ArtMetadataMapTest, EraseWhileIterating) {
+    ArtMetadataMap<TrackedValue> map;
+    for (size_t i = 0; i < 1000; ++i) {
+        map.try_emplace(MakeKey(0, i % 10, i), static_cast<int>(i));
+    }
+    size_t visited = 0;
+    for (auto it = map.begin(); it != map.end();) {
+        ++visited;
+        if (it->second.value % 2 == 0) {
+            it = map.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    EXPECT_EQ(visited, 1000u);
+    EXPECT_EQ(map.size(), 500u);
+    for (size_t i = 0; i < 1000; ++i) {
+        EXPECT_EQ(map.contains(MakeKey(0, i % 10, i)), i % 2 == 1);
+    }
+}
+
+TEST_F(ArtMetadataMapTest, RandomizedAgainstMap) {
+    ArtMetadataMap<TrackedValue> map;
+    std::map<std::string, int> reference;
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<size_t> key_dist(0, 4096);
+    std::uniform_int_distribution<int> op_dist(0, 3);
+
+    for (int step = 0; step < 200000; ++step) {
+        const size_t n = key_dist(rng);
+        // Sparse and full fan-outs, and keys that are prefixes of others
+        std::string key;
+        if (step % 3 == 0) {
+            key = MakeKey(n % 5, n % 300, n);
+        } else if (step % 3 == 1) {
+            key = {static_cast<char>(n % 256), static_cast<char>(n / 256)};
+        } else {
+            key = std::string(n % 40, 'k') + std::to_string(n % 97);
+        }
+        switch (op_dist(rng)) {
+            case 0: {
+                bool inserted = map.try_emplace(key, step).second;
+                EXPECT_EQ(inserted, reference.emplace(key, step).second);
+                break;
+            }
+            case 1:
+                EXPECT_EQ(map.erase(key), reference.erase(key));
+                break;
+            case 2: {
+                auto it = map.lower_bound(key);
+                auto ref_it = reference.lower_bound(key);
+                ASSERT_EQ(it == map.end(), ref_it == reference.end());
+                if (ref_it != reference.end()) {
+                    EXPECT_EQ(it->first, ref_it->first);
+                }
+                break;
+            }
+            default: {
+                auto it = map.find(key);
+                auto ref_it = reference.find(key);
+                ASSERT_EQ(it == map.end(), ref_it == reference.end());
+                if (ref_it != reference.end()) {
+                    EXPECT_EQ(it->second.value, ref_it->second);
+                }
+            }
+        }
+    }
+    EXPECT_EQ(map.size(), reference.size());
+    EXPECT_EQ(TrackedValue::live, static_cast<int>(reference.size()));
+
+    auto ref_it = reference.begin();
+    for (const auto& item : map) {
+        ASSERT_NE(ref_it, reference.end());
+        EXPECT_EQ(item.first, ref_it->first);
+        EXPECT_EQ(item.second.value, ref_it->second);
+        ++ref_it;
+    }
+    EXPECT_EQ(ref_it, reference.end());
+    map.clear();
+    EXPECT_EQ(TrackedValue::live, 0);
+}
+
+}  // namespace mooncake::test
@@ -2,7 +2,9 @@
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
+#include <map>
 #include <memory>
+#include <vector>
 
 #include "allocator.h"
 
@@ -87,6 +89,132 @@ TEST_F(BufferAllocatorTest, AllocateTooLarge) {
     EXPECT_EQ(bufHandle, nullptr);
 }
 
+// The offset allocator serves objects larger than a slab, packs them and
+// reuses the space once they are freed
+TEST_F(BufferAllocatorTest, OffsetAllocatorPacksVaryingSizes) {
+    std::string segment_name = "4";
+    const size_t base = 0x400000000;
+    const size_t size = 1024 * 1024 * 16;  // 16MB
+
+    auto allocator = std::make_shared<BufferAllocator>(
+        segment_name, base, size, SegmentTopology{},
+        BufferAllocatorType::OFFSET);
+    EXPECT_EQ(allocator->getType(), BufferAllocatorType::OFFSET);
+
+    // Three 5MB objects leave no room for a fourth
+    const size_t alloc_size = 5 * 1024 * 1024;
+    std::vector<std::unique_ptr<AllocatedBuffer>> handles;
+    for (int i = 0; i < 3; ++i) {
+        auto handle = allocator->allocate(alloc_size);
+        ASSERT_NE(handle, nullptr);
+        auto address = reinterpret_cast<uintptr_t>(handle->data());
+        EXPECT_GE(address, base);
+        EXPECT_LE(address + alloc_size, base + size);
+        for (const auto& other : handles) {
+            auto other_address = reinterpret_cast<uintptr_t>(other->data());
+            EXPECT_TRUE(address + alloc_size <= other_address ||
+                        other_address + alloc_size <= address);
+        }
+        handles.push_back(std::move(handle));
+    }
+    EXPECT_EQ(allocator->size(), 3 * alloc_size);
+    EXPECT_EQ(allocator->allocate(alloc_size), nullptr);
+
+    handles.pop_back();
+    EXPECT_EQ(allocator->size(), 2 * alloc_size);
+    auto handle = allocator->allocate(alloc_size);
+    ASSERT_NE(handle, nullptr);
+    EXPECT_EQ(handle->get_descriptor().size_, alloc_size);
+
+    handles.clear();
+    handle.reset();
+    EXPECT_EQ(allocator->size(), 0);
+    EXPECT_NE(allocator->allocate(size), nullptr);
+}
+
+// Slabs left mostly empty by one size stop taking allocations once another
+// size runs out of space, and serve it when their last objects are freed
+TEST_F(BufferAllocatorTest, RebalanceSlabsAcrossSizes) {
+    std::string segment_name = "5";
+    const size_t base = 0x500000000;
+    const size_t size = 4 * facebook::cachelib::Slab::kSize;
+    const size_t small_size = 1024 * 1024;
+    const size_t large_size = facebook::cachelib::Slab::kSize / 2;
+
+    auto allocator =
+        std::make_shared<BufferAllocator>(segment_name, base, size);
+
+    auto slab_of = [&](const std::unique_ptr<AllocatedBuffer>& handle) {
+        return (reinterpret_cast<uintptr_t>(handle->data()) - base) /
+               facebook::cachelib::Slab::kSize;
+    };
+
+    // Fill the segment with small objects, then keep one per slab
+    std::vector<std::unique_ptr<AllocatedBuffer>> handles;
+    while (auto handle = allocator->allocate(small_size)) {
+        handles.push_back(std::move(handle));
+    }
+    ASSERT_FALSE(handles.empty());
+    const size_t total = handles.size();
+    std::map<uintptr_t, std::unique_ptr<AllocatedBuffer>> kept;
+    for (auto& handle : handles) {
+        auto slab = slab_of(handle);
+        if (!kept.count(slab)) kept[slab] = std::move(handle);
+    }
+    handles.clear();
+    const size_t per_slab = total / kept.size();
+    ASSERT_GT(per_slab, 1u);
+
+    // No slab is free, one of the small ones is drained
+    EXPECT_EQ(allocator->allocate(large_size), nullptr);
+
+    // The drained slab does not take small objects anymore
+    while (auto handle = allocator->allocate(small_size)) {
+        handles.push_back(std::move(handle));
+    }
+    EXPECT_EQ(handles.size(), (kept.size() - 1) * (per_slab - 1));
+
+    // Once its last object is freed it serves the large size
+    std::unique_ptr<AllocatedBuffer> large;
+    for (auto it = kept.begin(); it != kept.end() && !large;) {
+        it = kept.erase(it);
+        large = allocator->allocate(large_size);
+    }
+    ASSERT_NE(large, nullptr);
+    EXPECT_EQ(large->get_descriptor().size_, large_size);
+}
+
+// Frees are queued, the space counts as free at once and the next
+// allocations reuse it
+TEST_F(BufferAllocatorTest, QueuedFreesAreReused) {
+    const size_t size = 1024 * 1024 * 16;
+    const size_t alloc_size = 1024 * 1024;
+    size_t base = 0x600000000;
+    for (auto type :
+         {BufferAllocatorType::CACHELIB, BufferAllocatorType::OFFSET}) {
+        auto allocator = std::make_shared<BufferAllocator>(
+            "6", base, size, SegmentTopology{}, type);
+        base += size;
+
+        std::vector<std::unique_ptr<AllocatedBuffer>> handles;
+        while (auto handle = allocator->allocate(alloc_size)) {
+            handles.push_back(std::move(handle));
+        }
+        const size_t total = handles.size();
+        ASSERT_GT(total, 0u);
+        handles.clear();
+        EXPECT_EQ(allocator->size(), 0u);
+
+        while (auto handle = allocator->allocate(alloc_size)) {
+            handles.push_back(std::move(handle));
+        }
+        EXPECT_EQ(handles.size(), total);
+        handles.clear();
+        allocator->releasePendingFrees();
+        EXPECT_EQ(allocator->size(), 0u);
+    }
+}
+
 // Test fixture for SimpleAllocator tests
 class SimpleAllocatorTest : public ::testing::Test {
    protected:
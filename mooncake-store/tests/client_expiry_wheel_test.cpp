@@ -0,0 +1,81 @@
+#include "client_expiry_wheel.h"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <set>
+#include <vector>
+
+namespace mooncake {
+
+class ClientExpiryWheelTest : public ::testing::Test {
+   protected:
+    using Clock = ClientExpiryWheel::Clock;
+
+    void SetUp() override {
+        google::InitGoogleLogging("ClientExpiryWheelTest");
+        FLAGS_logtostderr = 1;
+    }
+
+    void TearDown() override { google::ShutdownGoogleLogging(); }
+};
+
+TEST_F(ClientExpiryWheelTest, ExpiresAfterTtl) {
+    const auto start = Clock::now();
+    ClientExpiryWheel wheel(std::chrono::seconds(1), std::chrono::seconds(10),
+                            start);
+    const UUID client{1, 1};
+    wheel.Touch(client, start);
+    EXPECT_EQ(wheel.size(), 1);
+    EXPECT_TRUE(wheel.Advance(start + std::chrono::seconds(9)).empty());
+    auto expired = wheel.Advance(start + std::chrono::seconds(10));
+    ASSERT_EQ(expired.size(), 1);
+    EXPECT_EQ(expired[0], client);
+    EXPECT_EQ(wheel.size(), 0);
+    EXPECT_TRUE(wheel.Advance(start + std::chrono::seconds(30)).empty());
+}
+
+TEST_F(ClientExpiryWheelTest, TouchExtends) {
+    const auto start = Clock::now();
+    ClientExpiryWheel wheel(std::chrono::seconds(1), std::chrono::seconds(10),
+                            start);
+    const UUID pinging{1, 1};
+    const UUID silent{2, 2};
+    wheel.Touch(pinging, start);
+    wheel.Touch(silent, start);
+    // Pings every second for longer than the wheel has slots
+    for (int second = 1; second < 40; ++second) {
+        const auto now = start + std::chrono::seconds(second);
+        wheel.Touch(pinging, now);
+        auto expired = wheel.Advance(now);
+        if (second == 10) {
+            ASSERT_EQ(expired.size(), 1);
+            EXPECT_EQ(expired[0], silent);
+        } else {
+            EXPECT_TRUE(expired.empty()) << "second=" << second;
+        }
+    }
+    EXPECT_EQ(wheel.size(), 1);
+    // Expires ttl after the last ping, at most one tick late
+    EXPECT_TRUE(wheel.Advance(start + std::chrono::seconds(48)).empty());
+    auto expired = wheel.Advance(start + std::chrono::seconds(50));
+    ASSERT_EQ(expired.size(), 1);
+    EXPECT_EQ(expired[0], pinging);
+}
+
+TEST_F(ClientExpiryWheelTest, ManyClientsAndLateAdvance) {
+    const auto start = Clock::now();
+    ClientExpiryWheel wheel(std::chrono::milliseconds(100),
+                            std::chrono::seconds(1), start);
+    for (uint64_t i = 0; i < 1000; ++i) {
+        wheel.Touch({i, i}, start + std::chrono::milliseconds(i));
+    }
+    // The monitor fell far behind, every client is found at once
+    auto expired = wheel.Advance(start + std::chrono::seconds(5));
+    EXPECT_EQ(expired.size(), 1000);
+    EXPECT_EQ(std::set<UUID>(expired.begin(), expired.end()).size(), 1000);
+    EXPECT_EQ(wheel.size(), 0);
+}
+
+}  // namespace mooncake
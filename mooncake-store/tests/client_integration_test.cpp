@@ -2,13 +2,19 @@
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "allocator.h"
 #include "client.h"
+#include "segment_memory.h"
 #include "types.h"
 #include "utils.h"
 
@@ -519,6 +525,232 @@ TEST_F(ClientIntegrationTest, BatchPutGetOperations) {
     }
 }
 
+// Test streaming BatchPutAsync with several batches in flight
+TEST_F(ClientIntegrationTest, StreamingBatchPut) {
+    const int num_batches = 8;
+    const int batch_sz = 16;
+    std::vector<std::string> data_list;
+    std::vector<std::vector<std::string>> batch_keys(num_batches);
+    std::vector<std::vector<std::vector<Slice>>> batch_slices(num_batches);
+    for (int b = 0; b < num_batches; b++) {
+        for (int i = 0; i < batch_sz; i++) {
+            std::string key = "test_key_stream_put_" + std::to_string(b) +
+                              "_" + std::to_string(i);
+            std::string data(1024 + i, static_cast<char>('a' + b));
+            void* buffer = client_buffer_allocator_->allocate(data.size());
+            memcpy(buffer, data.data(), data.size());
+            batch_keys[b].push_back(key);
+            batch_slices[b].push_back({Slice{buffer, data.size()}});
+            data_list.push_back(data);
+        }
+    }
+
+    // Issue all batches back to back, then wait
+    ReplicateConfig config;
+    config.replica_num = 1;
+    std::vector<TransferFuture> futures;
+    for (int b = 0; b < num_batches; b++) {
+        auto batch_futures =
+            test_client_->BatchPutAsync(batch_keys[b], batch_slices[b], config);
+        ASSERT_EQ(batch_futures.size(), static_cast<size_t>(batch_sz));
+        for (auto& future : batch_futures) {
+            futures.push_back(std::move(future));
+        }
+    }
+    for (auto& future : futures) {
+        ASSERT_EQ(future.get(), ErrorCode::OK);
+    }
+
+    for (int b = 0; b < num_batches; b++) {
+        for (int i = 0; i < batch_sz; i++) {
+            const auto& data = data_list[b * batch_sz + i];
+            void* target = client_buffer_allocator_->allocate(data.size());
+            std::vector<Slice> slices{Slice{target, data.size()}};
+            auto get_result = test_client_->Get(batch_keys[b][i], slices);
+            ASSERT_TRUE(get_result.has_value())
+                << "Get operation failed: " << toString(get_result.error());
+            ASSERT_EQ(memcmp(target, data.data(), data.size()), 0);
+            client_buffer_allocator_->deallocate(target, data.size());
+            client_buffer_allocator_->deallocate(batch_slices[b][i][0].ptr,
+                                                 data.size());
+        }
+    }
+}
+
+// Test a group put submitted part by part, as layers of a block group
+TEST_F(ClientIntegrationTest, PutGroupByParts) {
+    const size_t num_parts = 4;
+    const size_t keys_per_part = 8;
+    std::vector<std::string> keys;
+    std::vector<std::string> data_list;
+    std::vector<std::vector<Slice>> batched_slices;
+    for (size_t p = 0; p < num_parts; p++) {
+        for (size_t i = 0; i < keys_per_part; i++) {
+            keys.push_back("test_key_put_group_" + std::to_string(p) + "_" +
+                           std::to_string(i));
+            data_list.emplace_back(2048 + i, static_cast<char>('a' + p));
+            void* buffer =
+                client_buffer_allocator_->allocate(data_list.back().size());
+            batched_slices.push_back({Slice{buffer, data_list.back().size()}});
+        }
+    }
+
+    ReplicateConfig config;
+    config.replica_num = 1;
+    auto group = test_client_->StartPutGroup(keys, batched_slices, config);
+    ASSERT_EQ(group->size(), keys.size());
+    // Fill and submit the parts one after the other, the last one is left
+    // to EndPutGroup
+    for (size_t p = 0; p < num_parts; p++) {
+        for (size_t i = p * keys_per_part; i < (p + 1) * keys_per_part; i++) {
+            memcpy(batched_slices[i][0].ptr, data_list[i].data(),
+                   data_list[i].size());
+        }
+        if (p + 1 < num_parts) {
+            ASSERT_EQ(test_client_->SubmitPutGroup(*group, p * keys_per_part,
+                                                   keys_per_part),
+                      ErrorCode::OK);
+        }
+    }
+    ASSERT_EQ(test_client_->SubmitPutGroup(*group, keys.size(), 1),
+              ErrorCode::INVALID_PARAMS);
+    auto results = test_client_->EndPutGroup(*group);
+    ASSERT_EQ(results.size(), keys.size());
+    for (const auto& result : results) {
+        ASSERT_TRUE(result.has_value())
+            << "Group put failed: " << toString(result.error());
+    }
+    ASSERT_EQ(test_client_->SubmitPutGroup(*group, 0, 1),
+              ErrorCode::INVALID_PARAMS);
+
+    for (size_t i = 0; i < keys.size(); i++) {
+        const auto& data = data_list[i];
+        void* target = client_buffer_allocator_->allocate(data.size());
+        std::vector<Slice> slices{Slice{target, data.size()}};
+        auto get_result = test_client_->Get(keys[i], slices);
+        ASSERT_TRUE(get_result.has_value())
+            << "Get operation failed: " << toString(get_result.error());
+        ASSERT_EQ(memcmp(target, data.data(), data.size()), 0);
+        client_buffer_allocator_->deallocate(target, data.size());
+        client_buffer_allocator_->deallocate(batched_slices[i][0].ptr,
+                                             data.size());
+    }
+}
+
+// Test a multipart put streamed through one small buffer, parts out of
+// order, read back through a ring of two buffers
+TEST_F(ClientIntegrationTest, MultipartPutAndGetStream) {
+    const std::string key = "test_key_multipart";
+    const size_t part_size = 4096;
+    const size_t size = 5 * part_size + 100;
+    std::string data(size, '\0');
+    for (size_t i = 0; i < size; i++) {
+        data[i] = static_cast<char>(i % 251);
+    }
+
+    ReplicateConfig config;
+    config.replica_num = 1;
+    auto put = test_client_->StartMultipartPut(key, size, part_size, config);
+    ASSERT_TRUE(put.has_value())
+        << "StartMultipartPut failed: " << toString(put.error());
+    ASSERT_EQ(put.value()->part_count(), 6);
+    void* buffer = client_buffer_allocator_->allocate(part_size);
+    for (size_t n : {5, 0, 3, 1, 4, 2}) {
+        const size_t length = std::min(part_size, size - n * part_size);
+        memcpy(buffer, data.data() + n * part_size, length);
+        ASSERT_EQ(test_client_->PutPart(*put.value(), n, {buffer, length}),
+                  ErrorCode::OK);
+    }
+    // Only the last part may be short
+    ASSERT_EQ(test_client_->PutPart(*put.value(), 0, {buffer, 100}),
+              ErrorCode::INVALID_PARAMS);
+    ASSERT_TRUE(test_client_->EndMultipartPut(*put.value()).has_value());
+    ASSERT_EQ(test_client_->PutPart(*put.value(), 0, {buffer, part_size}),
+              ErrorCode::INVALID_PARAMS);
+    client_buffer_allocator_->deallocate(buffer, part_size);
+
+    const size_t ring_size = 3000;
+    std::vector<Slice> ring;
+    for (int i = 0; i < 2; i++) {
+        ring.push_back({client_buffer_allocator_->allocate(ring_size),
+                        ring_size});
+    }
+    std::string streamed;
+    auto result = test_client_->GetStream(
+        key, ring, [&](uint64_t offset, Slice part) {
+            EXPECT_EQ(offset, streamed.size());
+            streamed.append(static_cast<char*>(part.ptr), part.size);
+            return true;
+        });
+    ASSERT_TRUE(result.has_value())
+        << "GetStream failed: " << toString(result.error());
+    ASSERT_EQ(streamed, data);
+
+    // Stopping after the first part
+    size_t calls = 0;
+    result = test_client_->GetStream(key, ring, [&](uint64_t, Slice) {
+        ++calls;
+        return false;
+    });
+    ASSERT_TRUE(result.has_value());
+    ASSERT_EQ(calls, 1);
+    for (const auto& slice : ring) {
+        client_buffer_allocator_->deallocate(slice.ptr, ring_size);
+    }
+
+    // A put ended with a part missing is revoked
+    put = test_client_->StartMultipartPut(key + "_missing", size, part_size,
+                                          config);
+    ASSERT_TRUE(put.has_value());
+    ASSERT_FALSE(test_client_->EndMultipartPut(*put.value()).has_value());
+    ASSERT_FALSE(test_client_->IsExist(key + "_missing").value_or(true));
+}
+
+TEST_F(ClientIntegrationTest, PutGetWithCodec) {
+    // BF16 elements of a few values, which the byte planes compress
+    const size_t size = 64 * 1024;
+    std::string data(size, '\0');
+    for (size_t i = 0; i < size; i += 2) {
+        data[i] = static_cast<char>((i / 2 % 5) << 4);
+        data[i + 1] = 0x3f;
+    }
+    void* buffer = client_buffer_allocator_->allocate(size);
+    memcpy(buffer, data.data(), size);
+
+    ReplicateConfig config;
+    config.codec = PayloadCodecId::BYTE_PLANE;
+    std::vector<Slice> slices{Slice{buffer, size}};
+    const std::string key = "test_key_put_codec";
+    auto put_result = test_client_->Put(key, slices, config);
+    ASSERT_TRUE(put_result.has_value())
+        << "Put operation failed: " << toString(put_result.error());
+
+    // Stored encoded, in fewer bytes
+    auto query_result = test_client_->Query(key);
+    ASSERT_TRUE(query_result.has_value());
+    size_t stored_size = 0;
+    for (const auto& handle :
+         query_result.value()[0].get_memory_descriptor().buffer_descriptors) {
+        stored_size += handle.size_;
+    }
+    EXPECT_LT(stored_size, size);
+
+    void* target = client_buffer_allocator_->allocate(size);
+    std::vector<Slice> target_slices{Slice{target, size}};
+    auto get_result = test_client_->Get(key, target_slices);
+    ASSERT_TRUE(get_result.has_value())
+        << "Get operation failed: " << toString(get_result.error());
+    EXPECT_EQ(memcmp(target, data.data(), size), 0);
+
+    // Asynchronous puts do not keep a staging buffer
+    EXPECT_EQ(test_client_->PutAsync("test_key_put_codec_async", slices,
+                                     config)
+                  .get(),
+              ErrorCode::INVALID_PARAMS);
+    client_buffer_allocator_->deallocate(target, size);
+    client_buffer_allocator_->deallocate(buffer, size);
+}
+
 // Test batch IsExist operations through the client
 TEST_F(ClientIntegrationTest, BatchIsExistOperations) {
     int batch_size = 50;
@@ -648,6 +880,517 @@ TEST_F(ClientIntegrationTest, BatchPutDuplicateKeys) {
     ASSERT_TRUE(remove_result);
 }
 
+// Puts value from the registered buffer in num_slices slices of about the
+// same size
+static void PutValue(const std::shared_ptr<Client>& client,
+                     SimpleAllocator& allocator, const std::string& key,
+                     const std::string& value, const ReplicateConfig& config,
+                     size_t num_slices = 1) {
+    void* buffer = allocator.allocate(value.size());
+    ASSERT_TRUE(buffer != nullptr);
+    memcpy(buffer, value.data(), value.size());
+    std::vector<Slice> slices;
+    const size_t slice_size = (value.size() + num_slices - 1) / num_slices;
+    for (size_t offset = 0; offset < value.size(); offset += slice_size) {
+        slices.push_back(
+            Slice{static_cast<char*>(buffer) + offset,
+                  std::min(slice_size, value.size() - offset)});
+    }
+    auto put_result = client->Put(key, slices, config);
+    allocator.deallocate(buffer, value.size());
+    ASSERT_TRUE(put_result.has_value())
+        << "Put operation failed: " << toString(put_result.error());
+}
+
+// Copies the buffers of a view into a string
+static std::string ViewBytes(const ObjectView& view) {
+    std::string bytes;
+    for (const auto& buffer : view.buffers) {
+        bytes.append(static_cast<const char*>(buffer.ptr), buffer.size);
+    }
+    return bytes;
+}
+
+// Whether all the buffers of a view lie in [base, base + size)
+static bool ViewWithin(const ObjectView& view, const void* base,
+                       size_t size) {
+    const auto begin = reinterpret_cast<uintptr_t>(base);
+    for (const auto& buffer : view.buffers) {
+        const auto address = reinterpret_cast<uintptr_t>(buffer.ptr);
+        if (address < begin || address + buffer.size > begin + size) {
+            return false;
+        }
+    }
+    return !view.buffers.empty();
+}
+
+// A view of a replica in the client's own segment points into the memory
+// it mounted, one buffer per slice
+TEST_F(ClientIntegrationTest, GetViewOfLocalReplica) {
+    const std::string key = "view_local_key";
+    const std::string value(64 * 1024, 'v');
+    ReplicateConfig config;
+    config.replica_num = 1;
+    config.preferred_segment = "localhost:17813";
+    ASSERT_NO_FATAL_FAILURE(PutValue(test_client_, *client_buffer_allocator_,
+                                     key, value, config, 2));
+
+    auto view = test_client_->GetView(key);
+    ASSERT_TRUE(view.has_value())
+        << "GetView failed: " << toString(view.error());
+    EXPECT_NE(view->handle, 0u);
+    EXPECT_EQ(view->buffers.size(), 2);
+    EXPECT_TRUE(ViewWithin(*view, test_client_segment_ptr_,
+                           test_client_ram_buffer_size_));
+    EXPECT_EQ(ViewBytes(*view), value);
+
+    // Each view has a handle of its own
+    auto second = test_client_->GetView(key);
+    ASSERT_TRUE(second.has_value());
+    EXPECT_NE(second->handle, view->handle);
+    test_client_->ReleaseView(second->handle);
+    test_client_->ReleaseView(view->handle);
+}
+
+// A view of a replica in an attached segment goes through this client's
+// mapping of the memory, not the address the owner mounted it at
+TEST_F(ClientIntegrationTest, GetViewOfAttachedReplica) {
+    const std::string path =
+        "/dev/shm/mooncake_view_test_" + std::to_string(getpid());
+    constexpr size_t kSegmentSize = 64 * 1024 * 1024;
+    auto owned = SegmentMemory::AllocatePersistent(path, kSegmentSize);
+    ASSERT_TRUE(owned != nullptr);
+    auto owner_client = CreateClient("localhost:17814");
+    ASSERT_TRUE(owner_client != nullptr);
+    ASSERT_TRUE(owner_client
+                    ->MountSegment(owned->data(), owned->size(),
+                                   kWildcardLocation, owned->memory_id())
+                    .has_value());
+
+    auto shared = SegmentMemory::AttachShared(path);
+    ASSERT_TRUE(shared != nullptr);
+    ASSERT_NE(shared->data(), owned->data());
+    ASSERT_TRUE(test_client_
+                    ->AttachSegment(shared->data(), shared->size(),
+                                    owned->memory_id())
+                    .has_value());
+
+    const std::string key = "view_attached_key";
+    const std::string value(64 * 1024, 'a');
+    ReplicateConfig config;
+    config.replica_num = 1;
+    config.preferred_segment = "localhost:17814";
+    ASSERT_NO_FATAL_FAILURE(PutValue(test_client_, *client_buffer_allocator_,
+                                     key, value, config));
+
+    auto view = test_client_->GetView(key);
+    ASSERT_TRUE(view.has_value())
+        << "GetView failed: " << toString(view.error());
+    EXPECT_TRUE(ViewWithin(*view, shared->data(), shared->size()));
+    EXPECT_FALSE(ViewWithin(*view, owned->data(), owned->size()));
+    EXPECT_EQ(ViewBytes(*view), value);
+    test_client_->ReleaseView(view->handle);
+
+    // Detached, the segment is remote again
+    ASSERT_TRUE(test_client_->DetachSegment(owned->memory_id()).has_value());
+    auto remote = test_client_->GetView(key);
+    ASSERT_FALSE(remote.has_value());
+    EXPECT_EQ(remote.error(), ErrorCode::INVALID_REPLICA);
+
+    // Unmounting drops the replica, leased or not
+    ASSERT_TRUE(owner_client->UnmountSegment(owned->data(), owned->size())
+                    .has_value());
+    owner_client.reset();
+    shared.reset();
+    owned.reset();
+    unlink(path.c_str());
+}
+
+// Replicas whose bytes are not all in memory of this process as they are
+// read cannot be viewed
+TEST_F(ClientIntegrationTest, GetViewSkipsUnviewableReplicas) {
+    const std::string value(64 * 1024, 'u');
+
+    // In a segment of another client
+    ReplicateConfig remote_config;
+    remote_config.replica_num = 1;
+    remote_config.preferred_segment = "localhost:17812";
+    ASSERT_NO_FATAL_FAILURE(PutValue(test_client_, *client_buffer_allocator_,
+                                     "view_remote_key", value,
+                                     remote_config));
+    auto remote = test_client_->GetView("view_remote_key");
+    ASSERT_FALSE(remote.has_value());
+    EXPECT_EQ(remote.error(), ErrorCode::INVALID_REPLICA);
+
+    // Partly local: the first shard in this client's segment, the second
+    // in another
+    ReplicateConfig sharded_config;
+    sharded_config.replica_num = 1;
+    sharded_config.shard_segments = {"localhost:17813", "localhost:17812"};
+    ASSERT_NO_FATAL_FAILURE(PutValue(test_client_, *client_buffer_allocator_,
+                                     "view_partly_local_key", value,
+                                     sharded_config, 2));
+    auto replicas = test_client_->Query("view_partly_local_key");
+    ASSERT_TRUE(replicas.has_value());
+    ASSERT_EQ(replicas->size(), 1);
+    const auto& buffers =
+        (*replicas)[0].get_memory_descriptor().buffer_descriptors;
+    ASSERT_EQ(buffers.size(), 2);
+    ASSERT_EQ(buffers[0].segment_name_, "localhost:17813");
+    ASSERT_EQ(buffers[1].segment_name_, "localhost:17812");
+    auto partly_local = test_client_->GetView("view_partly_local_key");
+    ASSERT_FALSE(partly_local.has_value());
+    EXPECT_EQ(partly_local.error(), ErrorCode::INVALID_REPLICA);
+
+    // Erasure coded, even with a fragment in this client's segment
+    ReplicateConfig ec_config;
+    ec_config.replica_num = 1;
+    ec_config.ec_data_fragments = 1;
+    ec_config.ec_parity_fragments = 1;
+    ASSERT_NO_FATAL_FAILURE(PutValue(test_client_, *client_buffer_allocator_,
+                                     "view_erasure_coded_key", value,
+                                     ec_config));
+    auto erasure_coded = test_client_->GetView("view_erasure_coded_key");
+    ASSERT_FALSE(erasure_coded.has_value());
+    EXPECT_EQ(erasure_coded.error(), ErrorCode::INVALID_REPLICA);
+
+    // Missing
+    auto missing = test_client_->GetView("view_missing_key");
+    ASSERT_FALSE(missing.has_value());
+    EXPECT_EQ(missing.error(), ErrorCode::OBJECT_NOT_FOUND);
+}
+
+// Values the master keeps inline have no buffer to view
+TEST_F(ClientIntegrationTest, GetViewSkipsInlineReplicas) {
+    const std::string key = "view_inline_key";
+    ReplicateConfig config;
+    config.replica_num = 1;
+    ASSERT_NO_FATAL_FAILURE(PutValue(test_client_, *client_buffer_allocator_,
+                                     key, "tiny", config));
+    auto replicas = test_client_->Query(key);
+    ASSERT_TRUE(replicas.has_value());
+    ASSERT_EQ(replicas->size(), 1);
+    if (!(*replicas)[0].is_inline()) {
+        GTEST_SKIP() << "The master keeps no inline objects, see "
+                        "--inline_object_max_size";
+    }
+    auto view = test_client_->GetView(key);
+    ASSERT_FALSE(view.has_value());
+    EXPECT_EQ(view.error(), ErrorCode::INVALID_REPLICA);
+}
+
+// The pings renew the lease of an open view past kViewLeaseMs, so that the
+// object cannot be removed; once released, the lease runs out
+TEST_F(ClientIntegrationTest, ViewLeaseRenewedUntilReleased) {
+    const std::string key = "view_lease_key";
+    const std::string value(64 * 1024, 'l');
+    ReplicateConfig config;
+    config.replica_num = 1;
+    config.preferred_segment = "localhost:17813";
+    ASSERT_NO_FATAL_FAILURE(PutValue(test_client_, *client_buffer_allocator_,
+                                     key, value, config));
+
+    auto view = test_client_->GetView(key);
+    ASSERT_TRUE(view.has_value())
+        << "GetView failed: " << toString(view.error());
+    const auto lease = std::chrono::milliseconds(Client::kViewLeaseMs);
+    const auto margin = std::chrono::seconds(2);
+    std::this_thread::sleep_for(lease + margin);
+    auto remove_result = test_client_->Remove(key);
+    ASSERT_FALSE(remove_result.has_value());
+    EXPECT_EQ(remove_result.error(), ErrorCode::OBJECT_HAS_LEASE);
+    EXPECT_EQ(ViewBytes(*view), value);
+
+    test_client_->ReleaseView(view->handle);
+    std::this_thread::sleep_for(lease + margin);
+    remove_result = test_client_->Remove(key);
+    EXPECT_TRUE(remove_result.has_value())
+        << "Remove operation failed: " << toString(remove_result.error());
+}
+
+// Bytes that differ from one offset to the next, so that a range read from
+// the wrong place shows
+static std::string PatternValue(size_t size) {
+    std::string value(size, '\0');
+    for (size_t i = 0; i < size; ++i) {
+        value[i] = static_cast<char>(i % 251);
+    }
+    return value;
+}
+
+// Ranges of an object of three buffers, put in another client's segment so
+// that the narrowed buffers go through the transfer engine
+TEST_F(ClientIntegrationTest, GetRangeOfBuffers) {
+    const std::string key = "get_range_key";
+    constexpr size_t kBufferSize = 16 * 1024;
+    const std::string value = PatternValue(3 * kBufferSize);
+    ReplicateConfig config;
+    config.replica_num = 1;
+    config.preferred_segment = "localhost:17812";
+    ASSERT_NO_FATAL_FAILURE(PutValue(test_client_, *client_buffer_allocator_,
+                                     key, value, config, 3));
+
+    struct Range {
+        const char* name;
+        uint64_t offset;
+        size_t length;
+    };
+    const Range ranges[] = {
+        {"inside_one_buffer", 100, 1000},
+        {"across_a_boundary", kBufferSize - 500, 1000},
+        {"across_two_boundaries", 1000, 2 * kBufferSize},
+        {"buffer_aligned", kBufferSize, kBufferSize},
+        {"object_tail", value.size() - 700, 700},
+        {"whole_object", 0, value.size()},
+    };
+    // One byte more, to check that nothing is written past the range
+    const size_t dest_size = value.size() + 1;
+    char* dest =
+        static_cast<char*>(client_buffer_allocator_->allocate(dest_size));
+    ASSERT_TRUE(dest != nullptr);
+    for (const auto& range : ranges) {
+        memset(dest, 0xff, dest_size);
+        auto result = test_client_->GetRange(
+            key, range.offset, Slice{dest, range.length});
+        ASSERT_TRUE(result.has_value())
+            << range.name << ": " << toString(result.error());
+        EXPECT_EQ(std::string(dest, range.length),
+                  value.substr(range.offset, range.length))
+            << range.name;
+        EXPECT_EQ(static_cast<unsigned char>(dest[range.length]), 0xff)
+            << range.name;
+    }
+
+    // Empty ranges read nothing, up to the end of the object
+    memset(dest, 0xff, dest_size);
+    EXPECT_TRUE(test_client_->GetRange(key, 1234, Slice{dest, 0}));
+    EXPECT_TRUE(test_client_->GetRange(key, value.size(), Slice{dest, 0}));
+    EXPECT_EQ(static_cast<unsigned char>(dest[0]), 0xff);
+
+    // Ranges ending past the object
+    auto past_end =
+        test_client_->GetRange(key, value.size() - 10, Slice{dest, 20});
+    ASSERT_FALSE(past_end.has_value());
+    EXPECT_EQ(past_end.error(), ErrorCode::INVALID_PARAMS);
+    past_end = test_client_->GetRange(key, value.size() + 1, Slice{dest, 0});
+    ASSERT_FALSE(past_end.has_value());
+    EXPECT_EQ(past_end.error(), ErrorCode::INVALID_PARAMS);
+    client_buffer_allocator_->deallocate(dest, dest_size);
+}
+
+// The ranges of a batch are read together, each failing on its own
+TEST_F(ClientIntegrationTest, BatchGetRange) {
+    constexpr size_t kBufferSize = 16 * 1024;
+    const std::string value = PatternValue(2 * kBufferSize);
+    const std::vector<std::string> keys = {"batch_range_key_a",
+                                           "batch_range_key_b"};
+    ReplicateConfig config;
+    config.replica_num = 1;
+    config.preferred_segment = "localhost:17812";
+    for (const auto& key : keys) {
+        ASSERT_NO_FATAL_FAILURE(PutValue(test_client_,
+                                         *client_buffer_allocator_, key,
+                                         value, config, 2));
+    }
+
+    constexpr size_t kLength = 1000;
+    char* dest =
+        static_cast<char*>(client_buffer_allocator_->allocate(4 * kLength));
+    ASSERT_TRUE(dest != nullptr);
+    const std::vector<std::string> batch_keys = {
+        keys[0], keys[1], keys[0], "batch_range_missing_key"};
+    const std::vector<uint64_t> offsets = {kBufferSize - kLength / 2,
+                                           value.size() - kLength,
+                                           value.size() - kLength / 2, 0};
+    std::vector<Slice> dests;
+    for (size_t i = 0; i < batch_keys.size(); ++i) {
+        dests.push_back(Slice{dest + i * kLength, kLength});
+    }
+    auto results = test_client_->BatchGetRange(batch_keys, offsets, dests);
+    ASSERT_EQ(results.size(), batch_keys.size());
+    ASSERT_TRUE(results[0].has_value()) << toString(results[0].error());
+    EXPECT_EQ(std::string(dest, kLength), value.substr(offsets[0], kLength));
+    ASSERT_TRUE(results[1].has_value()) << toString(results[1].error());
+    EXPECT_EQ(std::string(dest + kLength, kLength),
+              value.substr(offsets[1], kLength));
+    ASSERT_FALSE(results[2].has_value());
+    EXPECT_EQ(results[2].error(), ErrorCode::INVALID_PARAMS);
+    ASSERT_FALSE(results[3].has_value());
+    EXPECT_EQ(results[3].error(), ErrorCode::OBJECT_NOT_FOUND);
+
+    // Offsets and dests must match the keys
+    results = test_client_->BatchGetRange(keys, {0}, {dests[0]});
+    ASSERT_EQ(results.size(), keys.size());
+    for (const auto& result : results) {
+        ASSERT_FALSE(result.has_value());
+        EXPECT_EQ(result.error(), ErrorCode::INVALID_PARAMS);
+    }
+    client_buffer_allocator_->deallocate(dest, 4 * kLength);
+}
+
+// A range over a lost data fragment cannot be narrowed: the object is read
+// whole into a staging buffer, rebuilt from its parity, and the range
+// copied out
+TEST_F(ClientIntegrationTest, GetRangeStagedOverLostFragment) {
+    const std::string key = "get_range_staged_key";
+    const std::string value = PatternValue(32 * 1024);
+    ReplicateConfig config;
+    config.replica_num = 1;
+    config.ec_data_fragments = 1;
+    config.ec_parity_fragments = 1;
+    ASSERT_NO_FATAL_FAILURE(PutValue(test_client_, *client_buffer_allocator_,
+                                     key, value, config));
+
+    auto replicas = test_client_->Query(key);
+    ASSERT_TRUE(replicas.has_value());
+    ASSERT_EQ(replicas->size(), 1);
+    auto& memory = (*replicas)[0].get_memory_descriptor();
+    ASSERT_TRUE(memory.is_erasure_coded());
+    memory.buffer_descriptors[0].status_ = BufStatus::UNREGISTERED;
+
+    constexpr uint64_t kOffset = 5000;
+    constexpr size_t kLength = 7000;
+    char* dest =
+        static_cast<char*>(client_buffer_allocator_->allocate(kLength));
+    ASSERT_TRUE(dest != nullptr);
+    auto result =
+        test_client_->GetRange(key, *replicas, kOffset, Slice{dest, kLength});
+    ASSERT_TRUE(result.has_value()) << toString(result.error());
+    EXPECT_EQ(std::string(dest, kLength), value.substr(kOffset, kLength));
+    client_buffer_allocator_->deallocate(dest, kLength);
+}
+
+
+// Slices of the given sizes, scattered over dest with a gap of kSliceGap
+// bytes after each
+static constexpr size_t kSliceGap = 64;
+
+static std::vector<Slice> ScatteredSlices(char* dest,
+                                          const std::vector<size_t>& sizes) {
+    std::vector<Slice> slices;
+    for (size_t size : sizes) {
+        slices.push_back(Slice{dest, size});
+        dest += size + kSliceGap;
+    }
+    return slices;
+}
+
+// The bytes of the slices, concatenated
+static std::string SlicesBytes(const std::vector<Slice>& slices) {
+    std::string bytes;
+    for (const auto& slice : slices) {
+        bytes.append(static_cast<const char*>(slice.ptr), slice.size);
+    }
+    return bytes;
+}
+
+// Whether the gaps after the slices still hold the 0xff fill
+static bool GapsUntouched(const std::vector<Slice>& slices) {
+    for (const auto& slice : slices) {
+        const auto* gap = static_cast<const unsigned char*>(slice.ptr) +
+                          slice.size;
+        for (size_t i = 0; i < kSliceGap; ++i) {
+            if (gap[i] != 0xff) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Slices laid out otherwise than the three buffers of an object each take
+// the parts of the buffers they overlap
+TEST_F(ClientIntegrationTest, GetIntoScatteredSlices) {
+    const std::string key = "get_scattered_key";
+    constexpr size_t kBufferSize = 16 * 1024;
+    const std::string value = PatternValue(3 * kBufferSize);
+    ReplicateConfig config;
+    config.replica_num = 1;
+    config.preferred_segment = "localhost:17812";
+    ASSERT_NO_FATAL_FAILURE(PutValue(test_client_, *client_buffer_allocator_,
+                                     key, value, config, 3));
+
+    struct Layout {
+        const char* name;
+        std::vector<size_t> sizes;
+    };
+    const Layout layouts[] = {
+        {"misaligned", {5000, 20000, 20000, 4152}},
+        {"around_boundaries",
+         {kBufferSize - 1, 1, kBufferSize + 1, kBufferSize - 1}},
+        {"one_slice", {value.size()}},
+        {"pages", std::vector<size_t>(12, 4096)},
+    };
+    const size_t dest_size = value.size() + 12 * kSliceGap;
+    char* dest =
+        static_cast<char*>(client_buffer_allocator_->allocate(dest_size));
+    ASSERT_TRUE(dest != nullptr);
+    for (const auto& layout : layouts) {
+        memset(dest, 0xff, dest_size);
+        auto slices = ScatteredSlices(dest, layout.sizes);
+        auto result = test_client_->Get(key, slices);
+        ASSERT_TRUE(result.has_value())
+            << layout.name << ": " << toString(result.error());
+        EXPECT_EQ(SlicesBytes(slices), value) << layout.name;
+        EXPECT_TRUE(GapsUntouched(slices)) << layout.name;
+    }
+
+    // Slices must add up to the object size
+    for (size_t total : {value.size() - 1, value.size() + 1}) {
+        memset(dest, 0xff, dest_size);
+        auto slices = ScatteredSlices(dest, {5000, total - 5000});
+        auto result = test_client_->Get(key, slices);
+        ASSERT_FALSE(result.has_value()) << total;
+        EXPECT_EQ(result.error(), ErrorCode::INVALID_PARAMS) << total;
+    }
+    client_buffer_allocator_->deallocate(dest, dest_size);
+}
+
+// Scattered slices of a batch are read together, a key whose slices do not
+// add up to its size failing on its own
+TEST_F(ClientIntegrationTest, BatchGetIntoScatteredSlices) {
+    constexpr size_t kBufferSize = 16 * 1024;
+    const std::string value = PatternValue(2 * kBufferSize);
+    const std::vector<std::string> keys = {"batch_scattered_key_a",
+                                           "batch_scattered_key_b",
+                                           "batch_scattered_key_c"};
+    ReplicateConfig config;
+    config.replica_num = 1;
+    config.preferred_segment = "localhost:17812";
+    for (const auto& key : keys) {
+        ASSERT_NO_FATAL_FAILURE(PutValue(test_client_,
+                                         *client_buffer_allocator_, key,
+                                         value, config, 2));
+    }
+
+    const std::vector<std::vector<size_t>> sizes = {
+        {3000, kBufferSize, kBufferSize - 3000},
+        {kBufferSize, kBufferSize},
+        {3000, value.size() - 3001},
+    };
+    const size_t dest_size = keys.size() * (value.size() + 3 * kSliceGap);
+    char* dest =
+        static_cast<char*>(client_buffer_allocator_->allocate(dest_size));
+    ASSERT_TRUE(dest != nullptr);
+    memset(dest, 0xff, dest_size);
+    std::unordered_map<std::string, std::vector<Slice>> slices;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        slices[keys[i]] = ScatteredSlices(
+            dest + i * (value.size() + 3 * kSliceGap), sizes[i]);
+    }
+    auto results = test_client_->BatchGet(keys, slices);
+    ASSERT_EQ(results.size(), keys.size());
+    for (size_t i = 0; i < 2; ++i) {
+        ASSERT_TRUE(results[i].has_value())
+            << keys[i] << ": " << toString(results[i].error());
+        EXPECT_EQ(SlicesBytes(slices[keys[i]]), value) << keys[i];
+        EXPECT_TRUE(GapsUntouched(slices[keys[i]])) << keys[i];
+    }
+    ASSERT_FALSE(results[2].has_value());
+    EXPECT_EQ(results[2].error(), ErrorCode::INVALID_PARAMS);
+    client_buffer_allocator_->deallocate(dest, dest_size);
+}
+
 }  // namespace testing
 
 }  // namespace mooncake
@@ -0,0 +1,475 @@
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "client_wrapper.h"
+#include "e2e_utils.h"
+#include "ha_helper.h"
+#include "process_handler.h"
+#include "types.h"
+#include "utils.h"
+
+// Performance under failure: runs a steady put/get load through
+// ClientTestWrapper against a cluster of masters and segment clients, and
+// injects the failures of --events one after the other. For each event it
+// reports, against the baseline measured just before it, how deep the
+// throughput dipped, how long it took to recover, the peak miss rate of the
+// gets and the P99 latency until recovery.
+
+USE_engine_flags;
+FLAG_etcd_endpoints;
+FLAG_master_path;
+FLAG_client_path;
+FLAG_out_dir;
+DEFINE_int32(master_num, 3, "Number of master instances (must be > 1)");
+DEFINE_int32(segment_clients, 2,
+             "client_runner processes mounting segments, killed by "
+             "client_death");
+DEFINE_int32(holder_segments, 2,
+             "Segments mounted by the bench itself, unmounted by "
+             "segment_unmount");
+DEFINE_int32(load_threads, 4, "Threads putting and getting, one client each");
+DEFINE_int32(value_size, 4096, "Bytes of each value put");
+DEFINE_int32(get_ratio, 80, "Percentage of gets in the load");
+DEFINE_int32(key_window, 1024, "Last keys put by a thread its gets pick from");
+DEFINE_string(events, "master_failover,client_death,segment_unmount",
+              "Comma-separated failures to inject: master_failover, "
+              "client_death, segment_unmount");
+DEFINE_int32(warmup_sec, 30, "Load before the first event");
+DEFINE_int32(baseline_sec, 10,
+             "Seconds before each event its baseline is measured over");
+DEFINE_int32(event_window_sec, 60,
+             "Seconds observed after each event, before it is undone");
+DEFINE_int32(bucket_ms, 200, "Width of the throughput samples");
+DEFINE_double(recovery_ratio, 0.9,
+              "Fraction of the baseline throughput counted as recovered");
+DEFINE_string(output, "", "File to write the JSON report to, logged if empty");
+
+constexpr int master_port_base = 50051;
+constexpr int client_port_base = 12888;
+constexpr size_t kSegmentSize = 1024 * 1024 * 128;
+
+namespace mooncake {
+namespace testing {
+
+// Operations finished within one --bucket_ms of the run
+struct Bucket {
+    uint64_t completed = 0;
+    uint64_t failed = 0;
+    uint64_t gets = 0;
+    uint64_t misses = 0;
+    std::vector<double> latencies_us;
+};
+
+class LoadThread {
+   public:
+    LoadThread(std::shared_ptr<ClientTestWrapper> client, int index)
+        : client_(std::move(client)), index_(index), rng_(index) {}
+
+    void Run(std::chrono::steady_clock::time_point start,
+             const std::atomic<bool>& stop) {
+        const std::string value(FLAGS_value_size, 'a' + index_ % 26);
+        std::vector<std::string> keys;
+        uint64_t next_key = 0;
+        std::string got;
+        while (!stop.load(std::memory_order_relaxed)) {
+            const bool get =
+                !keys.empty() && int(rng_() % 100) < FLAGS_get_ratio;
+            std::string key;
+            auto op_start = std::chrono::steady_clock::now();
+            ErrorCode error;
+            if (get) {
+                key = keys[rng_() % keys.size()];
+                error = client_->Get(key, got);
+            } else {
+                key = "bench_" + std::to_string(index_) + "_" +
+                      std::to_string(next_key++);
+                error = client_->Put(key, value);
+            }
+            auto now = std::chrono::steady_clock::now();
+            auto& bucket = BucketAt(now - start);
+            bucket.latencies_us.push_back(
+                std::chrono::duration<double, std::micro>(now - op_start)
+                    .count());
+            if (get) {
+                bucket.gets++;
+            }
+            if (get && error == ErrorCode::OBJECT_NOT_FOUND) {
+                bucket.misses++;
+                bucket.completed++;
+            } else if (error != ErrorCode::OK) {
+                bucket.failed++;
+                // Back off while the cluster is down, as a real caller
+                // would
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            } else {
+                bucket.completed++;
+                if (!get) {
+                    keys.push_back(key);
+                    if (keys.size() > size_t(FLAGS_key_window)) {
+                        keys.erase(keys.begin());
+                    }
+                }
+            }
+        }
+    }
+
+    const std::vector<Bucket>& buckets() const { return buckets_; }
+
+   private:
+    Bucket& BucketAt(std::chrono::steady_clock::duration elapsed) {
+        size_t index =
+            std::chrono::duration_cast<std::chrono::milliseconds>(elapsed)
+                .count() /
+            FLAGS_bucket_ms;
+        if (index >= buckets_.size()) {
+            buckets_.resize(index + 1);
+        }
+        return buckets_[index];
+    }
+
+    std::shared_ptr<ClientTestWrapper> client_;
+    int index_;
+    std::mt19937 rng_;
+    std::vector<Bucket> buckets_;
+};
+
+struct EventReport {
+    std::string name;
+    double at_s = 0;
+    double baseline_ops = 0;
+    double min_ops = 0;
+    double dip = 0;
+    // Negative if the throughput had not recovered by the end of the window
+    double recovery_s = 0;
+    double baseline_miss_rate = 0;
+    double peak_miss_rate = 0;
+    double baseline_p99_us = 0;
+    double p99_us = 0;
+    uint64_t failed_ops = 0;
+};
+
+double P99(std::vector<double> latencies) {
+    if (latencies.empty()) {
+        return 0;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    size_t index = static_cast<size_t>(std::ceil(latencies.size() * 0.99) - 1);
+    return latencies[std::min(index, latencies.size() - 1)];
+}
+
+std::vector<double> Latencies(const std::vector<Bucket>& buckets,
+                              size_t first, size_t last) {
+    std::vector<double> latencies;
+    for (size_t i = first; i < last && i < buckets.size(); ++i) {
+        latencies.insert(latencies.end(), buckets[i].latencies_us.begin(),
+                         buckets[i].latencies_us.end());
+    }
+    return latencies;
+}
+
+double MissRate(const std::vector<Bucket>& buckets, size_t first,
+                size_t last) {
+    uint64_t gets = 0, misses = 0;
+    for (size_t i = first; i < last && i < buckets.size(); ++i) {
+        gets += buckets[i].gets;
+        misses += buckets[i].misses;
+    }
+    return gets ? double(misses) / gets : 0;
+}
+
+EventReport AnalyzeEvent(const std::vector<Bucket>& buckets,
+                         const std::string& name, double at_s) {
+    EventReport report;
+    report.name = name;
+    report.at_s = at_s;
+    const double bucket_s = FLAGS_bucket_ms / 1000.0;
+    const size_t event = static_cast<size_t>(at_s / bucket_s);
+    const size_t baseline_buckets =
+        std::max<size_t>(FLAGS_baseline_sec / bucket_s, 1);
+    const size_t window_buckets =
+        std::max<size_t>(FLAGS_event_window_sec / bucket_s, 1);
+    const size_t baseline_first =
+        event > baseline_buckets ? event - baseline_buckets : 0;
+    const size_t window_end = std::min(event + window_buckets, buckets.size());
+    auto ops = [&](size_t i) { return buckets[i].completed / bucket_s; };
+
+    uint64_t completed = 0;
+    for (size_t i = baseline_first; i < event; ++i) {
+        completed += buckets[i].completed;
+    }
+    report.baseline_ops =
+        event > baseline_first ? completed / ((event - baseline_first) *
+                                              bucket_s)
+                               : 0;
+    report.baseline_miss_rate = MissRate(buckets, baseline_first, event);
+    report.baseline_p99_us = P99(Latencies(buckets, baseline_first, event));
+
+    // Recovered after the last sample below the threshold
+    const double threshold = report.baseline_ops * FLAGS_recovery_ratio;
+    report.min_ops = report.baseline_ops;
+    size_t recovered = event;
+    for (size_t i = event; i < window_end; ++i) {
+        report.min_ops = std::min(report.min_ops, ops(i));
+        report.failed_ops += buckets[i].failed;
+        report.peak_miss_rate =
+            std::max(report.peak_miss_rate, MissRate(buckets, i, i + 1));
+        if (ops(i) < threshold) {
+            recovered = i + 1;
+        }
+    }
+    report.dip = report.baseline_ops > 0
+                     ? 1 - report.min_ops / report.baseline_ops
+                     : 0;
+    report.recovery_s = recovered >= window_end && recovered > event
+                            ? -1
+                            : (recovered - event) * bucket_s;
+    // Until the recovery, or as long as the baseline if it never dipped
+    const size_t p99_end =
+        recovered > event ? recovered : event + baseline_buckets;
+    report.p99_us = P99(Latencies(buckets, event, p99_end));
+    return report;
+}
+
+std::string ToJson(const std::vector<EventReport>& reports) {
+    std::ostringstream out;
+    out << "{\n  \"load_threads\": " << FLAGS_load_threads
+        << ",\n  \"value_size\": " << FLAGS_value_size
+        << ",\n  \"get_ratio\": " << FLAGS_get_ratio
+        << ",\n  \"bucket_ms\": " << FLAGS_bucket_ms << ",\n  \"events\": [";
+    for (size_t i = 0; i < reports.size(); ++i) {
+        const auto& report = reports[i];
+        out << (i ? "," : "") << "\n    {\"event\": \"" << report.name
+            << "\", \"at_s\": " << report.at_s
+            << ", \"baseline_ops_per_sec\": " << report.baseline_ops
+            << ", \"min_ops_per_sec\": " << report.min_ops
+            << ", \"dip\": " << report.dip
+            << ", \"recovery_s\": " << report.recovery_s
+            << ", \"baseline_miss_rate\": " << report.baseline_miss_rate
+            << ", \"peak_miss_rate\": " << report.peak_miss_rate
+            << ", \"baseline_p99_us\": " << report.baseline_p99_us
+            << ", \"p99_us\": " << report.p99_us
+            << ", \"failed_ops\": " << report.failed_ops << "}";
+    }
+    out << "\n  ]\n}\n";
+    return out.str();
+}
+
+// Index of the leading master, -1 if unknown
+int LeaderIndex(MasterViewHelper& master_view_helper) {
+    std::string master_address;
+    ViewVersionId version;
+    if (master_view_helper.GetMasterView(master_address, version) !=
+        ErrorCode::OK) {
+        return -1;
+    }
+    size_t colon_pos = master_address.find(':');
+    if (colon_pos == std::string::npos) {
+        return -1;
+    }
+    return std::atoi(master_address.c_str() + colon_pos + 1) -
+           master_port_base;
+}
+
+std::shared_ptr<ClientTestWrapper> CreateClientWrapper(int port) {
+    auto client_opt = ClientTestWrapper::CreateClientWrapper(
+        "0.0.0.0:" + std::to_string(port), FLAGS_engine_meta_url,
+        FLAGS_protocol, FLAGS_device_name, "etcd://" + FLAGS_etcd_endpoints);
+    if (!client_opt.has_value()) {
+        LOG(ERROR) << "Failed to create client on port " << port;
+        return nullptr;
+    }
+    return *client_opt;
+}
+
+int Run() {
+    MasterViewHelper master_view_helper;
+    if (master_view_helper.ConnectToEtcd(FLAGS_etcd_endpoints) !=
+        ErrorCode::OK) {
+        LOG(ERROR) << "Failed to connect to etcd";
+        return 1;
+    }
+    std::vector<std::unique_ptr<MasterProcessHandler>> masters;
+    for (int i = 0; i < FLAGS_master_num; ++i) {
+        masters.emplace_back(std::make_unique<MasterProcessHandler>(
+            FLAGS_master_path, FLAGS_etcd_endpoints, master_port_base + i, i,
+            FLAGS_out_dir));
+        masters.back()->start();
+    }
+    sleep(ETCD_MASTER_VIEW_LEASE_TTL * 3);
+
+    std::vector<std::unique_ptr<ClientProcessHandler>> segment_clients;
+    for (int i = 0; i < FLAGS_segment_clients; ++i) {
+        ClientRunnerConfig config{
+            .put_prob = 0,
+            .get_prob = 0,
+            .mount_prob = 1000,
+            .unmount_prob = 0,
+            .port = client_port_base + i,
+            .master_server_entry = "etcd://" + FLAGS_etcd_endpoints,
+            .engine_meta_url = FLAGS_engine_meta_url,
+            .protocol = FLAGS_protocol,
+            .device_name = FLAGS_device_name,
+        };
+        segment_clients.emplace_back(std::make_unique<ClientProcessHandler>(
+            FLAGS_client_path, i, FLAGS_out_dir, config));
+        segment_clients.back()->start();
+    }
+    // Let them mount their segments
+    sleep(10);
+
+    int port = client_port_base + FLAGS_segment_clients;
+    auto holder = CreateClientWrapper(port++);
+    if (!holder) {
+        return 1;
+    }
+    std::vector<void*> holder_buffers;
+    for (int i = 0; i < FLAGS_holder_segments; ++i) {
+        void* buffer = nullptr;
+        if (holder->Mount(kSegmentSize, buffer) != ErrorCode::OK) {
+            LOG(ERROR) << "Failed to mount a segment of the bench";
+            return 1;
+        }
+        holder_buffers.push_back(buffer);
+    }
+
+    std::vector<std::unique_ptr<LoadThread>> loads;
+    for (int i = 0; i < FLAGS_load_threads; ++i) {
+        auto client = CreateClientWrapper(port++);
+        if (!client) {
+            return 1;
+        }
+        loads.emplace_back(std::make_unique<LoadThread>(client, i));
+    }
+    std::atomic<bool> stop{false};
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (auto& load : loads) {
+        threads.emplace_back(
+            [&, load = load.get()] { load->Run(start, stop); });
+    }
+    sleep(FLAGS_warmup_sec);
+
+    std::vector<std::pair<std::string, double>> events;
+    std::stringstream event_list(FLAGS_events);
+    std::string event;
+    size_t killed_client = 0;
+    while (std::getline(event_list, event, ',')) {
+        const double at_s = std::chrono::duration<double>(
+                                std::chrono::steady_clock::now() - start)
+                                .count();
+        LOG(INFO) << "Injecting " << event << " at " << at_s << " s";
+        std::function<void()> undo;
+        if (event == "master_failover") {
+            int leader = LeaderIndex(master_view_helper);
+            if (leader < 0 || leader >= FLAGS_master_num ||
+                !masters[leader]->kill()) {
+                LOG(ERROR) << "Failed to kill the leading master";
+                continue;
+            }
+            undo = [&, leader] { masters[leader]->start(); };
+        } else if (event == "client_death") {
+            if (segment_clients.empty()) {
+                LOG(ERROR) << "No segment client to kill";
+                continue;
+            }
+            auto& client =
+                segment_clients[killed_client++ % segment_clients.size()];
+            if (!client->kill()) {
+                LOG(ERROR) << "Failed to kill a segment client";
+                continue;
+            }
+            undo = [&client] { client->start(); };
+        } else if (event == "segment_unmount") {
+            if (holder_buffers.empty() ||
+                holder->Unmount(holder_buffers.back()) != ErrorCode::OK) {
+                LOG(ERROR) << "Failed to unmount a segment";
+                continue;
+            }
+            holder_buffers.pop_back();
+            undo = [&] {
+                void* buffer = nullptr;
+                if (holder->Mount(kSegmentSize, buffer) == ErrorCode::OK) {
+                    holder_buffers.push_back(buffer);
+                }
+            };
+        } else {
+            LOG(ERROR) << "Unknown event " << event;
+            continue;
+        }
+        events.emplace_back(event, at_s);
+        sleep(FLAGS_event_window_sec);
+        // Undone out of the window of the event, and settled before the
+        // baseline of the next one
+        undo();
+        sleep(FLAGS_baseline_sec);
+    }
+
+    stop.store(true);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::vector<Bucket> buckets;
+    for (auto& load : loads) {
+        const auto& thread_buckets = load->buckets();
+        if (thread_buckets.size() > buckets.size()) {
+            buckets.resize(thread_buckets.size());
+        }
+        for (size_t i = 0; i < thread_buckets.size(); ++i) {
+            auto& bucket = buckets[i];
+            bucket.completed += thread_buckets[i].completed;
+            bucket.failed += thread_buckets[i].failed;
+            bucket.gets += thread_buckets[i].gets;
+            bucket.misses += thread_buckets[i].misses;
+            bucket.latencies_us.insert(bucket.latencies_us.end(),
+                                       thread_buckets[i].latencies_us.begin(),
+                                       thread_buckets[i].latencies_us.end());
+        }
+    }
+    std::vector<EventReport> reports;
+    for (auto& [name, at_s] : events) {
+        reports.push_back(AnalyzeEvent(buckets, name, at_s));
+        const auto& report = reports.back();
+        LOG(INFO) << name << ": baseline " << report.baseline_ops
+                  << " ops/s, dip " << report.dip * 100 << "%, recovery "
+                  << report.recovery_s << " s, peak miss rate "
+                  << report.peak_miss_rate << ", p99 " << report.p99_us
+                  << " us (baseline " << report.baseline_p99_us << " us), "
+                  << report.failed_ops << " failed ops";
+    }
+
+    const std::string json = ToJson(reports);
+    if (FLAGS_output.empty()) {
+        LOG(INFO) << "Chaos benchmark report:\n" << json;
+    } else {
+        std::ofstream out(FLAGS_output);
+        out << json;
+    }
+    return 0;
+}
+
+}  // namespace testing
+}  // namespace mooncake
+
+int main(int argc, char* argv[]) {
+    google::InitGoogleLogging(argv[0]);
+    google::SetStderrLogging(google::INFO);
+    gflags::ParseCommandLineFlags(&argc, &argv, true);
+    int ret = mooncake::testing::Run();
+    google::ShutdownGoogleLogging();
+    return ret;
+}
@@ -0,0 +1,112 @@
+#include "erasure_code.h"
+
+#include <gtest/gtest.h>
+
+#include <numeric>
+#include <random>
+#include <vector>
+
+namespace mooncake {
+
+namespace {
+
+// A value split into its data fragments, followed by the parity fragments
+struct Encoded {
+    std::vector<uint8_t> value;
+    std::vector<std::vector<uint8_t>> fragments;
+
+    std::vector<Slice> Slices() {
+        std::vector<Slice> slices;
+        for (auto& fragment : fragments) {
+            slices.push_back({fragment.data(), fragment.size()});
+        }
+        return slices;
+    }
+};
+
+Encoded Encode(uint64_t size, size_t k, size_t m) {
+    Encoded encoded;
+    std::mt19937 rng(static_cast<uint32_t>(size * 31 + k * 7 + m));
+    encoded.value.resize(size);
+    for (auto& byte : encoded.value) {
+        byte = static_cast<uint8_t>(rng());
+    }
+    uint64_t offset = 0;
+    for (uint64_t length : ErasureDataFragmentSizes(size, k)) {
+        encoded.fragments.emplace_back(encoded.value.begin() + offset,
+                                       encoded.value.begin() + offset + length);
+        offset += length;
+    }
+    const size_t parity_size = encoded.fragments.front().size();
+    for (size_t j = 0; j < m; ++j) {
+        encoded.fragments.emplace_back(parity_size);
+    }
+    auto slices = encoded.Slices();
+    std::vector<Slice> data(slices.begin(), slices.begin() + k);
+    std::vector<Slice> parity(slices.begin() + k, slices.end());
+    ErasureEncode(data, parity);
+    return encoded;
+}
+
+std::vector<uint8_t> Join(const Encoded& encoded, size_t k) {
+    std::vector<uint8_t> value;
+    for (size_t i = 0; i < k; ++i) {
+        value.insert(value.end(), encoded.fragments[i].begin(),
+                     encoded.fragments[i].end());
+    }
+    return value;
+}
+
+}  // namespace
+
+TEST(ErasureCodeTest, SplitsIntoNearlyEqualFragments) {
+    auto sizes = ErasureDataFragmentSizes(10, 4);
+    EXPECT_EQ(sizes, (std::vector<uint64_t>{3, 3, 2, 2}));
+    EXPECT_EQ(std::accumulate(sizes.begin(), sizes.end(), uint64_t{0}), 10u);
+
+    EXPECT_TRUE(IsValidErasureCode(4, 4, 2));
+    // Some data fragment would be empty
+    EXPECT_FALSE(IsValidErasureCode(3, 4, 2));
+    EXPECT_FALSE(IsValidErasureCode(100, 4, 0));
+    EXPECT_FALSE(IsValidErasureCode(100, 0, 2));
+    EXPECT_FALSE(IsValidErasureCode(100, kMaxErasureFragments, 1));
+}
+
+TEST(ErasureCodeTest, RebuildsAnyLostFragments) {
+    const size_t k = 4, m = 2;
+    for (uint64_t size : {4, 9, 1000, 4097}) {
+        // Every pair of fragments lost
+        for (size_t a = 0; a < k + m; ++a) {
+            for (size_t b = a + 1; b < k + m; ++b) {
+                auto encoded = Encode(size, k, m);
+                std::vector<bool> present(k + m, true);
+                present[a] = present[b] = false;
+                std::fill(encoded.fragments[a].begin(),
+                          encoded.fragments[a].end(), 0xee);
+                std::fill(encoded.fragments[b].begin(),
+                          encoded.fragments[b].end(), 0xee);
+                auto slices = encoded.Slices();
+                ASSERT_EQ(ErasureDecode(slices, k, present), ErrorCode::OK);
+                EXPECT_EQ(Join(encoded, k), encoded.value)
+                    << "size=" << size << " lost=" << a << "," << b;
+            }
+        }
+    }
+}
+
+TEST(ErasureCodeTest, FailsWithTooFewFragments) {
+    const size_t k = 3, m = 2;
+    auto encoded = Encode(300, k, m);
+    std::vector<bool> present(k + m, true);
+    present[0] = present[1] = present[4] = false;
+    auto slices = encoded.Slices();
+    EXPECT_EQ(ErasureDecode(slices, k, present), ErrorCode::INVALID_PARAMS);
+
+    // Nothing to rebuild when the data fragments are all there
+    present.assign(k + m, false);
+    present[0] = present[1] = present[2] = true;
+    EXPECT_EQ(ErasureDecode(slices, k, present), ErrorCode::OK);
+    EXPECT_EQ(Join(encoded, k), encoded.value);
+}
+
+}  // namespace mooncake
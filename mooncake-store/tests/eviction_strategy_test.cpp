@@ -2,7 +2,11 @@
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
+#include <functional>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "eviction_strategy.h"
 
@@ -126,6 +130,149 @@ TEST_F(EvictionStrategyTest, FIFOEvictKey) {
     eviction_strategy.CleanUp();
 }
 
+namespace {
+
+std::vector<EvictionEngine> PolicyEngines() {
+    return {EvictionEngine::SIEVE, EvictionEngine::S3FIFO,
+            EvictionEngine::W_TINYLFU};
+}
+
+// Replay accesses against a cache of the given capacity, returning hits
+size_t Replay(EvictionTracker& tracker, size_t capacity,
+              const std::vector<std::string>& accesses,
+              const std::function<bool(const std::string&)>& count_hit) {
+    std::unordered_map<std::string, EvictionTracker::Handle> cache;
+    size_t hits = 0;
+    for (const auto& key : accesses) {
+        auto it = cache.find(key);
+        if (it != cache.end()) {
+            tracker.Access(it->second);
+            hits += count_hit(key);
+            continue;
+        }
+        if (cache.size() >= capacity) {
+            size_t budget = SIZE_MAX;
+            auto victim = tracker.Evict([](auto) { return true; }, budget);
+            EXPECT_TRUE(victim.has_value());
+            cache.erase(std::string(tracker.Key(*victim)));
+            tracker.Remove(*victim);
+        }
+        // The tracker keeps a view of the key, accesses outlives it
+        cache.emplace(key, tracker.Add(key));
+    }
+    return hits;
+}
+
+}  // namespace
+
+TEST_F(EvictionStrategyTest, SieveEvictsUnvisitedFirst) {
+    EvictionTracker tracker(CreateEvictionPolicy(EvictionEngine::SIEVE));
+    const std::vector<std::string> keys = {"key0", "key1", "key2", "key3",
+                                           "key4"};
+    std::vector<EvictionTracker::Handle> handles;
+    for (int i = 0; i < 4; ++i) {
+        handles.push_back(tracker.Add(keys[i]));
+    }
+    tracker.Access(handles[0]);
+    tracker.Access(handles[2]);
+
+    auto always = [](EvictionPolicy::Handle) { return true; };
+    size_t budget = 100;
+    auto victim = tracker.Evict(always, budget);
+    ASSERT_TRUE(victim.has_value());
+    EXPECT_EQ(tracker.Key(*victim), "key1");
+    tracker.Remove(*victim);
+
+    victim = tracker.Evict(always, budget);
+    ASSERT_TRUE(victim.has_value());
+    EXPECT_EQ(tracker.Key(*victim), "key3");
+    tracker.Remove(*victim);
+    EXPECT_EQ(tracker.Size(), 2);
+
+    // Freed handles are reused
+    EXPECT_EQ(tracker.Add(keys[4]), *victim);
+}
+
+TEST_F(EvictionStrategyTest, TrackerKeepsViewsAcrossSuspend) {
+    for (auto engine : PolicyEngines()) {
+        EvictionTracker tracker(CreateEvictionPolicy(engine));
+        const std::vector<std::string> keys = {"key0", "key1", "key2"};
+        std::vector<EvictionTracker::Handle> handles;
+        for (const auto& key : keys) {
+            handles.push_back(tracker.Add(key));
+        }
+        // Views of the keys of the caller, not copies
+        EXPECT_EQ(tracker.Key(handles[1]).data(), keys[1].data());
+
+        // A suspended object is never a victim but keeps its handle
+        tracker.Suspend(handles[1]);
+        EXPECT_EQ(tracker.Size(), 2);
+        auto always = [](EvictionPolicy::Handle) { return true; };
+        size_t budget = 100;
+        auto victim = tracker.Evict(always, budget);
+        ASSERT_TRUE(victim.has_value());
+        EXPECT_NE(*victim, handles[1]);
+        tracker.Remove(*victim);
+
+        tracker.Resume(handles[1]);
+        EXPECT_EQ(tracker.Size(), 2);
+        EXPECT_EQ(tracker.Key(handles[1]), "key1");
+        tracker.Suspend(handles[1]);
+        tracker.Remove(handles[1], /*suspended=*/true);
+        EXPECT_EQ(tracker.Size(), 1);
+    }
+}
+
+TEST_F(EvictionStrategyTest, PoliciesRespectEvictablePredicate) {
+    for (auto engine : PolicyEngines()) {
+        EvictionTracker tracker(CreateEvictionPolicy(engine));
+        std::vector<std::string> keys;
+        for (int i = 0; i < 10; ++i) {
+            keys.push_back("key" + std::to_string(i));
+        }
+        for (const auto& key : keys) {
+            tracker.Add(key);
+        }
+        size_t budget = 1000;
+        auto victim = tracker.Evict(
+            [&](EvictionPolicy::Handle handle) {
+                return tracker.Key(handle) == "key7";
+            },
+            budget);
+        ASSERT_TRUE(victim.has_value());
+        EXPECT_EQ(tracker.Key(*victim), "key7");
+        tracker.Remove(*victim);
+
+        // Nothing is evictable, the budget bounds the work
+        budget = 50;
+        victim = tracker.Evict([](EvictionPolicy::Handle) { return false; },
+                               budget);
+        EXPECT_FALSE(victim.has_value());
+        EXPECT_EQ(budget, 0);
+        EXPECT_EQ(tracker.Size(), 9);
+    }
+}
+
+TEST_F(EvictionStrategyTest, PoliciesKeepHotKeysUnderScan) {
+    // A small hot set interleaved with a stream of one-off keys
+    std::vector<std::string> accesses;
+    for (int i = 0; i < 20000; ++i) {
+        accesses.push_back("hot" + std::to_string(i % 8));
+        accesses.push_back("scan" + std::to_string(i));
+        accesses.push_back("scan" + std::to_string(i) + "_b");
+    }
+    auto is_hot = [](const std::string& key) {
+        return key.rfind("hot", 0) == 0;
+    };
+    for (auto engine : PolicyEngines()) {
+        EvictionTracker tracker(CreateEvictionPolicy(engine));
+        size_t hot_hits = Replay(tracker, 32, accesses, is_hot);
+        EXPECT_GT(hot_hits, 20000 * 9 / 10)
+            << "engine=" << static_cast<int>(engine);
+        EXPECT_EQ(tracker.Size(), 32);
+    }
+}
+
 }  // namespace mooncake
 
 int main(int argc, char** argv) {
@@ -0,0 +1,165 @@
+#include "flat_metadata_map.h"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mooncake::test {
+
+namespace {
+
+// Non-movable value type that tracks live instances, mirroring the
+// constraints of MasterService::ObjectMetadata.
+struct TrackedValue {
+    static inline int live = 0;
+
+    explicit TrackedValue(int v) : value(v) { ++live; }
+    ~TrackedValue() { --live; }
+
+    TrackedValue(const TrackedValue&) = delete;
+    TrackedValue& operator=(const TrackedValue&) = delete;
+    TrackedValue(TrackedValue&&) = delete;
+    TrackedValue& operator=(TrackedValue&&) = delete;
+
+    int value;
+};
+
+std::string MakeKey(size_t i, size_t padding) {
+    return std::string(padding, 'k') + "_" + std::to_string(i);
+}
+
+}  // namespace
+
+class FlatMetadataMapTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        google::InitGoogleLogging("FlatMetadataMapTest");
+        FLAGS_logtostderr = 1;
+        TrackedValue::live = 0;
+    }
+
+    void TearDown() override { google::ShutdownGoogleLogging(); }
+};
+
+TEST_F(FlatMetadataMapTest, InsertFindErase) {
+    FlatMetadataMap<TrackedValue> map;
+    EXPECT_TRUE(map.empty());
+    EXPECT_EQ(map.find("missing"), map.end());
+
+    auto [it, inserted] = map.try_emplace("key", 42);
+    EXPECT_TRUE(inserted);
+    EXPECT_EQ(it->first, "key");
+    EXPECT_EQ(it->second.value, 42);
+
+    auto [it2, inserted2] = map.try_emplace("key", 7);
+    EXPECT_FALSE(inserted2);
+    EXPECT_EQ(it2->second.value, 42);
+    EXPECT_EQ(TrackedValue::live, 1);
+
+    EXPECT_EQ(map.erase("key"), 1u);
+    EXPECT_EQ(map.erase("key"), 0u);
+    EXPECT_TRUE(map.empty());
+    EXPECT_EQ(TrackedValue::live, 0);
+}
+
+TEST_F(FlatMetadataMapTest, ShortAndLongKeys) {
+    FlatMetadataMap<TrackedValue> map;
+    const std::string short_key(8, 's');
+    const std::string long_key(300, 'l');
+    map.try_emplace(short_key, 1);
+    map.try_emplace(long_key, 2);
+    EXPECT_EQ(map.find(short_key)->second.value, 1);
+    EXPECT_EQ(map.find(long_key)->second.value, 2);
+    EXPECT_EQ(map.find(long_key)->first, long_key);
+    map.clear();
+    EXPECT_EQ(TrackedValue::live, 0);
+}
+
+TEST_F(FlatMetadataMapTest, ReferencesSurviveRehash) {
+    FlatMetadataMap<TrackedValue> map;
+    TrackedValue& first = map.try_emplace("first", 1).first->second;
+    for (size_t i = 0; i < 10000; ++i) {
+        map.try_emplace(MakeKey(i, i % 64), static_cast<int>(i));
+    }
+    EXPECT_EQ(&first, &map.find("first")->second);
+    EXPECT_EQ(map.size(), 10001u);
+}
+
+TEST_F(FlatMetadataMapTest, KeysSurviveRehash) {
+    FlatMetadataMap<TrackedValue> map;
+    std::string_view first = map.try_emplace("first", 1).first->first;
+    std::string_view long_key =
+        map.try_emplace(std::string(100, 'x'), 2).first->first;
+    for (size_t i = 0; i < 10000; ++i) {
+        map.try_emplace(MakeKey(i, i % 64), static_cast<int>(i));
+    }
+    EXPECT_EQ(first.data(), map.find("first")->first.data());
+    EXPECT_EQ(first, "first");
+    EXPECT_EQ(long_key, std::string(100, 'x'));
+}
+
+TEST_F(FlatMetadataMapTest, EraseWhileIterating) {
+    FlatMetadataMap<TrackedValue> map;
+    for (size_t i = 0; i < 1000; ++i) {
+        map.try_emplace(MakeKey(i, 8), static_cast<int>(i));
+    }
+    size_t visited = 0;
+    for (auto it = map.begin(); it != map.end();) {
+        ++visited;
+        if (it->second.value % 2 == 0) {
+            it = map.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    EXPECT_EQ(visited, 1000u);
+    EXPECT_EQ(map.size(), 500u);
+    for (size_t i = 0; i < 1000; ++i) {
+        EXPECT_EQ(map.contains(MakeKey(i, 8)), i % 2 == 1);
+    }
+}
+
+TEST_F(FlatMetadataMapTest, RandomizedAgainstUnorderedMap) {
+    FlatMetadataMap<TrackedValue> map;
+    std::unordered_map<std::string, int> reference;
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<size_t> key_dist(0, 4096);
+    std::uniform_int_distribution<int> op_dist(0, 2);
+
+    for (int step = 0; step < 200000; ++step) {
+        const std::string key = MakeKey(key_dist(rng), step % 3 * 30);
+        switch (op_dist(rng)) {
+            case 0: {
+                bool inserted = map.try_emplace(key, step).second;
+                EXPECT_EQ(inserted, reference.emplace(key, step).second);
+                break;
+            }
+            case 1:
+                EXPECT_EQ(map.erase(key), reference.erase(key));
+                break;
+            default: {
+                auto it = map.find(key);
+                auto ref_it = reference.find(key);
+                ASSERT_EQ(it == map.end(), ref_it == reference.end());
+                if (ref_it != reference.end()) {
+                    EXPECT_EQ(it->second.value, ref_it->second);
+                }
+            }
+        }
+    }
+    EXPECT_EQ(map.size(), reference.size());
+    EXPECT_EQ(TrackedValue::live, static_cast<int>(reference.size()));
+
+    size_t iterated = 0;
+    for (const auto& item : map) {
+        ++iterated;
+        EXPECT_EQ(reference.at(std::string(item.first)), item.second.value);
+    }
+    EXPECT_EQ(iterated, reference.size());
+}
+
+}  // namespace mooncake::test
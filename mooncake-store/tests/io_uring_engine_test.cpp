@@ -0,0 +1,167 @@
+#include "io_uring_engine.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "storage_backend.h"
+
+namespace mooncake {
+
+class IoUringEngineTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        google::InitGoogleLogging("IoUringEngineTest");
+        FLAGS_logtostderr = 1;
+        test_dir_ = std::filesystem::temp_directory_path() /
+                    ("io_uring_engine_test_" + std::to_string(getpid()));
+        std::filesystem::create_directories(test_dir_);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove_all(test_dir_);
+        google::ShutdownGoogleLogging();
+    }
+
+    // Buffers of odd sizes that span several chunks
+    static std::vector<std::vector<char>> MakeBuffers() {
+        const std::vector<size_t> sizes = {
+            13, IoUringEngine::kChunkSize * 2 + 777, 4096,
+            IoUringEngine::kChunkSize - 1};
+        std::vector<std::vector<char>> buffers;
+        for (size_t i = 0; i < sizes.size(); ++i) {
+            buffers.emplace_back(sizes[i]);
+            for (size_t j = 0; j < sizes[i]; ++j) {
+                buffers[i][j] = static_cast<char>((i * 31 + j * 7) & 0xff);
+            }
+        }
+        return buffers;
+    }
+
+    static std::vector<iovec> MakeIovs(std::vector<std::vector<char>>& bufs) {
+        std::vector<iovec> iovs;
+        for (auto& buf : bufs) {
+            iovs.push_back({buf.data(), buf.size()});
+        }
+        return iovs;
+    }
+
+    void RoundTrip(int extra_flags) {
+        auto engine = IoUringEngine::Create(4);
+        if (!engine) {
+            GTEST_SKIP() << "io_uring is not available";
+        }
+        const std::string path = (test_dir_ / "object").string();
+        int fd = ::open(path.c_str(),
+                        O_WRONLY | O_CREAT | O_TRUNC | extra_flags, 0644);
+        if (fd < 0 && extra_flags != 0) {
+            GTEST_SKIP() << "Filesystem does not support these flags";
+        }
+        ASSERT_GE(fd, 0);
+
+        auto src = MakeBuffers();
+        auto src_iovs = MakeIovs(src);
+        size_t total = 0;
+        for (const auto& iov : src_iovs) {
+            total += iov.iov_len;
+        }
+        EXPECT_EQ(engine->Write(fd, src_iovs.data(), src_iovs.size()),
+                  static_cast<ssize_t>(total));
+        ::close(fd);
+        // Padding of O_DIRECT writes is truncated away
+        EXPECT_EQ(std::filesystem::file_size(path), total);
+
+        fd = ::open(path.c_str(), O_RDONLY | extra_flags);
+        ASSERT_GE(fd, 0);
+        auto dest = MakeBuffers();
+        for (auto& buf : dest) {
+            std::fill(buf.begin(), buf.end(), 0);
+        }
+        auto dest_iovs = MakeIovs(dest);
+        EXPECT_EQ(engine->Read(fd, dest_iovs.data(), dest_iovs.size()),
+                  static_cast<ssize_t>(total));
+        EXPECT_EQ(dest, src);
+
+        // Reading more than the file holds fails
+        std::vector<char> extra(1);
+        dest_iovs.push_back({extra.data(), extra.size()});
+        EXPECT_EQ(engine->Read(fd, dest_iovs.data(), dest_iovs.size()), -1);
+        ::close(fd);
+        EXPECT_TRUE(engine->ok());
+    }
+
+    std::filesystem::path test_dir_;
+};
+
+TEST_F(IoUringEngineTest, BufferedRoundTrip) { RoundTrip(0); }
+
+TEST_F(IoUringEngineTest, DirectRoundTrip) { RoundTrip(O_DIRECT); }
+
+TEST_F(IoUringEngineTest, DirectWriteAtKeepsPadding) {
+    auto engine = IoUringEngine::Create(4);
+    if (!engine) {
+        GTEST_SKIP() << "io_uring is not available";
+    }
+    const std::string path = (test_dir_ / "segment").string();
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (fd < 0) {
+        GTEST_SKIP() << "Filesystem does not support O_DIRECT";
+    }
+
+    // Two appends at aligned offsets, as the log-structured store does
+    std::vector<char> first(100, 'a');
+    std::vector<char> second(5000, 'b');
+    iovec first_iov{first.data(), first.size()};
+    iovec second_iov{second.data(), second.size()};
+    const uint64_t second_offset = IoUringEngine::kAlignment;
+    EXPECT_EQ(engine->WriteAt(fd, &first_iov, 1, 0), 100);
+    EXPECT_EQ(engine->WriteAt(fd, &second_iov, 1, second_offset), 5000);
+    // The padding of the last write stays, the file is not truncated
+    EXPECT_EQ(std::filesystem::file_size(path),
+              second_offset + 2 * IoUringEngine::kAlignment);
+
+    std::vector<char> dest(second.size());
+    iovec dest_iov{dest.data(), dest.size()};
+    EXPECT_EQ(engine->Read(fd, &dest_iov, 1, second_offset), 5000);
+    EXPECT_EQ(dest, second);
+    dest.assign(first.size(), 0);
+    dest_iov = {dest.data(), dest.size()};
+    EXPECT_EQ(engine->Read(fd, &dest_iov, 1, 0), 100);
+    EXPECT_EQ(dest, first);
+    ::close(fd);
+}
+
+TEST_F(IoUringEngineTest, StorageBackendRoundTrip) {
+    // With io_uring, then with the buffered fallback
+    for (const char* depth : {"8", "0"}) {
+        setenv("MC_STORE_URING_QUEUE_DEPTH", depth, 1);
+        auto backend = StorageBackend::Create(test_dir_.string(),
+                                              std::string("fs") + depth);
+        ASSERT_NE(backend, nullptr);
+
+        auto src = MakeBuffers();
+        std::vector<Slice> slices;
+        for (auto& buf : src) {
+            slices.push_back({buf.data(), buf.size()});
+        }
+        ASSERT_EQ(backend->StoreObject("key", slices), ErrorCode::OK);
+
+        auto dest = MakeBuffers();
+        std::vector<Slice> dest_slices;
+        for (auto& buf : dest) {
+            std::fill(buf.begin(), buf.end(), 0);
+            dest_slices.push_back({buf.data(), buf.size()});
+        }
+        ASSERT_EQ(backend->LoadObject("key", dest_slices), ErrorCode::OK);
+        EXPECT_EQ(dest, src);
+    }
+    unsetenv("MC_STORE_URING_QUEUE_DEPTH");
+}
+
+}  // namespace mooncake
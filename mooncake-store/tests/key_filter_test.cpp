@@ -0,0 +1,51 @@
+#include "key_filter.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+namespace mooncake {
+
+TEST(KeyFilterTest, NeverMissesAddedKeys) {
+    KeyFilter filter(1000, KeyFilter::kDefaultBitsPerKey);
+    for (int i = 0; i < 1000; ++i) {
+        filter.Add("key_" + std::to_string(i));
+    }
+    for (int i = 0; i < 1000; ++i) {
+        EXPECT_TRUE(filter.MayContain("key_" + std::to_string(i)));
+    }
+}
+
+TEST(KeyFilterTest, RejectsMostAbsentKeys) {
+    KeyFilter filter(1000, KeyFilter::kDefaultBitsPerKey);
+    for (int i = 0; i < 1000; ++i) {
+        filter.Add("key_" + std::to_string(i));
+    }
+    int false_positives = 0;
+    for (int i = 0; i < 10000; ++i) {
+        if (filter.MayContain("absent_" + std::to_string(i))) {
+            false_positives++;
+        }
+    }
+    // About 1% with 10 bits per key
+    EXPECT_LT(false_positives, 300);
+}
+
+TEST(KeyFilterTest, CopiesKeepTheKeys) {
+    KeyFilter filter(100, KeyFilter::kDefaultBitsPerKey);
+    filter.Add("a");
+    filter.Add("b");
+
+    // As sent to a client
+    KeyFilter copy(filter.words(), filter.num_hashes());
+    EXPECT_TRUE(copy.MayContain("a"));
+    EXPECT_TRUE(copy.MayContain("b"));
+    copy.Add("c");
+    EXPECT_TRUE(copy.MayContain("c"));
+
+    // A filter without bits rejects nothing
+    KeyFilter empty(std::vector<uint64_t>{}, 1);
+    EXPECT_TRUE(empty.MayContain("a"));
+}
+
+}  // namespace mooncake
@@ -0,0 +1,93 @@
+#include "key_hash.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "master_service.h"
+
+namespace mooncake {
+
+// Values of the reference wyhash (final 4) with seed 0 and its default
+// secret, one or more keys per code path: empty, 1 to 3 bytes, 4 to 16,
+// 17 to 48, and the 48-byte rounds of longer keys with their boundaries
+TEST(KeyHashTest, MatchesReferenceWyhash) {
+    struct Vector {
+        std::string key;
+        uint64_t hash;
+    };
+    const std::string hex = "0123456789abcdef";
+    const Vector vectors[] = {
+        {"", 0x93228a4de0eec5a2ull},
+        {"a", 0xaced12527fe5bff8ull},
+        {"ab", 0xe9c28c2968258c7dull},
+        {"abc", 0x989b4a209c1011c9ull},
+        {"abcd", 0x6d9a9834037410ebull},
+        {"message", 0x92f0f4485992f760ull},
+        {"abcdefgh", 0xb9a4994f5b68615cull},
+        {"message digest", 0x309ab4c045215e8full},
+        {hex, 0x88de385a856cfb95ull},
+        {hex + "g", 0x14f37288a5f8073aull},
+        {"abcdefghijklmnopqrstuvwxyz", 0xccaeadc12a061176ull},
+        {hex + hex, 0x90d607c9b02557fbull},
+        {hex + hex + hex, 0x0b32d2627b7e7b1full},
+        {hex + hex + hex + "g", 0x962f028eef7b7e29ull},
+        {"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+         0x1fdd130ecb5b4709ull},
+        {"1234567890123456789012345678901234567890"
+         "1234567890123456789012345678901234567890",
+         0x7e22da19f1a6055aull},
+        {hex + hex + hex + hex + hex + hex, 0x84daf2d5d3de4572ull},
+    };
+    for (const auto& vector : vectors) {
+        EXPECT_EQ(KeyHash(vector.key), vector.hash)
+            << "key of " << vector.key.size() << " bytes: " << vector.key;
+    }
+}
+
+// Keys differing only after a shared prefix, e.g. the blocks of one
+// model, still spread evenly over the shards of the master and of its
+// followers
+TEST(KeyHashTest, SpreadsKeysSharingAPrefixOverShards) {
+    constexpr size_t kNumKeys = 64 * 1024;
+    const std::string long_prefix(60, 'p');
+    const std::vector<std::function<std::string(size_t)>> families = {
+        [](size_t i) { return "key_" + std::to_string(i); },
+        [&long_prefix](size_t i) { return long_prefix + std::to_string(i); },
+        [](size_t i) {
+            return "llama-70b/tp_0/layer_" + std::to_string(i / 1024) +
+                   "/block_" + std::to_string(i % 1024);
+        },
+    };
+    // Shards of the master, and of a metadata follower
+    for (size_t num_shards : {MasterService::kNumMetadataShards, size_t{64}}) {
+        for (size_t f = 0; f < families.size(); ++f) {
+            std::vector<size_t> counts(num_shards);
+            for (size_t i = 0; i < kNumKeys; ++i) {
+                ++counts[KeyHash(families[f](i)) % num_shards];
+            }
+            // Chi-squared statistic, within 6 standard deviations of its
+            // mean for uniformly spread keys
+            const double expected = static_cast<double>(kNumKeys) / num_shards;
+            double chi_squared = 0;
+            for (size_t count : counts) {
+                chi_squared += (count - expected) * (count - expected) /
+                               expected;
+            }
+            const double dof = num_shards - 1;
+            EXPECT_LT(chi_squared, dof + 6 * std::sqrt(2 * dof))
+                << "family " << f << " over " << num_shards << " shards";
+            for (size_t count : counts) {
+                EXPECT_GT(count, 0u);
+                EXPECT_LT(count, 2 * expected);
+            }
+        }
+    }
+    EXPECT_EQ(MasterService::ShardOf("key_1"),
+              KeyHash("key_1") % MasterService::kNumMetadataShards);
+}
+
+}  // namespace mooncake
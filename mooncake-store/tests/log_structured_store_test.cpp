@@ -0,0 +1,272 @@
+#include "log_structured_store.h"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "storage_backend.h"
+
+namespace mooncake {
+
+class LogStructuredStoreTest : public ::testing::Test {
+   protected:
+    static constexpr uint64_t kSegmentSize = 64 * 1024;
+
+    void SetUp() override {
+        google::InitGoogleLogging("LogStructuredStoreTest");
+        FLAGS_logtostderr = 1;
+        test_dir_ = std::filesystem::temp_directory_path() /
+                    ("log_structured_store_test_" + std::to_string(getpid()));
+        std::filesystem::create_directories(test_dir_);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove_all(test_dir_);
+        google::ShutdownGoogleLogging();
+    }
+
+    // queue_depth 0 uses plain reads and writes instead of io_uring
+    std::unique_ptr<LogStructuredStore> OpenStore(unsigned queue_depth) {
+        return LogStructuredStore::Open(
+            (test_dir_ / "log").string(),
+            std::make_shared<IoUringEnginePool>(queue_depth), kSegmentSize);
+    }
+
+    static std::string MakeValue(size_t index) {
+        return std::string(1000 + index * 37,
+                           static_cast<char>('a' + index % 26));
+    }
+
+    static ErrorCode PutString(LogStructuredStore& store,
+                               const std::string& key, std::string value) {
+        return store.Put(key, {{value.data(), value.size()}});
+    }
+
+    static std::string GetString(LogStructuredStore& store,
+                                 const std::string& key) {
+        std::string value;
+        EXPECT_EQ(store.Get(key, value), ErrorCode::OK) << key;
+        return value;
+    }
+
+    std::filesystem::path test_dir_;
+};
+
+TEST_F(LogStructuredStoreTest, PutGetRemove) {
+    for (unsigned queue_depth : {0u, 8u}) {
+        auto store = OpenStore(queue_depth);
+        ASSERT_NE(store, nullptr);
+
+        std::string first(3000, 'x');
+        std::string second(5000, 'y');
+        ASSERT_EQ(store->Put("key", {{first.data(), first.size()},
+                                     {second.data(), second.size()}}),
+                  ErrorCode::OK);
+        EXPECT_EQ(PutString(*store, "key", "again"), ErrorCode::FILE_OPEN_FAIL);
+
+        auto location = store->Query("key");
+        ASSERT_TRUE(location.has_value());
+        EXPECT_EQ(location->length, first.size() + second.size());
+        EXPECT_EQ(location->offset % IoUringEngine::kAlignment, 0u);
+
+        // Read back into slices of other sizes
+        std::vector<char> head(4000), tail(4000);
+        std::vector<Slice> slices{{head.data(), head.size()},
+                                  {tail.data(), tail.size()}};
+        ASSERT_EQ(store->Get("key", slices), ErrorCode::OK);
+        EXPECT_EQ(std::string(head.data(), head.size()),
+                  first + second.substr(0, 1000));
+        EXPECT_EQ(std::string(tail.data(), tail.size()), second.substr(1000));
+
+        std::vector<char> too_long(first.size() + second.size() + 1);
+        std::vector<Slice> long_slices{{too_long.data(), too_long.size()}};
+        EXPECT_EQ(store->Get("key", long_slices), ErrorCode::FILE_READ_FAIL);
+
+        store->Remove("key");
+        EXPECT_FALSE(store->Query("key").has_value());
+        std::string value;
+        EXPECT_EQ(store->Get("key", value), ErrorCode::FILE_NOT_FOUND);
+        EXPECT_EQ(PutString(*store, "key", "again"), ErrorCode::OK);
+        EXPECT_EQ(GetString(*store, "key"), "again");
+
+        store->RemoveAll();
+        EXPECT_EQ(store->SegmentCount(), 0u);
+        EXPECT_FALSE(store->Query("key").has_value());
+    }
+}
+
+TEST_F(LogStructuredStoreTest, RecoversAfterReopen) {
+    constexpr size_t kObjects = 100;
+    {
+        auto store = OpenStore(8);
+        ASSERT_NE(store, nullptr);
+        for (size_t i = 0; i < kObjects; ++i) {
+            ASSERT_EQ(PutString(*store, "key" + std::to_string(i),
+                                MakeValue(i)),
+                      ErrorCode::OK);
+        }
+        // Objects are spread over several segments
+        EXPECT_GT(store->SegmentCount(), 1u);
+        for (size_t i = 0; i < kObjects; i += 3) {
+            store->Remove("key" + std::to_string(i));
+        }
+    }
+
+    auto store = OpenStore(8);
+    ASSERT_NE(store, nullptr);
+    for (size_t i = 0; i < kObjects; ++i) {
+        const std::string key = "key" + std::to_string(i);
+        if (i % 3 == 0) {
+            EXPECT_FALSE(store->Query(key).has_value()) << key;
+        } else {
+            EXPECT_EQ(GetString(*store, key), MakeValue(i));
+        }
+    }
+    EXPECT_EQ(store->List().size(), kObjects - (kObjects + 2) / 3);
+    // New objects go after the recovered ones
+    ASSERT_EQ(PutString(*store, "new", "value"), ErrorCode::OK);
+    EXPECT_EQ(GetString(*store, "key1"), MakeValue(1));
+    EXPECT_EQ(GetString(*store, "new"), "value");
+}
+
+TEST_F(LogStructuredStoreTest, CompactionReclaimsSegments) {
+    constexpr size_t kObjects = 200;
+    auto store = OpenStore(0);
+    ASSERT_NE(store, nullptr);
+    for (size_t i = 0; i < kObjects; ++i) {
+        ASSERT_EQ(PutString(*store, "key" + std::to_string(i), MakeValue(i)),
+                  ErrorCode::OK);
+    }
+    const size_t segments = store->SegmentCount();
+    // Keep one object in every tenth
+    for (size_t i = 0; i < kObjects; ++i) {
+        if (i % 10 != 0) {
+            store->Remove("key" + std::to_string(i));
+        }
+    }
+    store->Compact();
+    EXPECT_LT(store->SegmentCount(), segments / 2);
+    for (size_t i = 0; i < kObjects; i += 10) {
+        EXPECT_EQ(GetString(*store, "key" + std::to_string(i)), MakeValue(i));
+    }
+
+    // Moved objects survive a restart
+    store.reset();
+    store = OpenStore(0);
+    ASSERT_NE(store, nullptr);
+    for (size_t i = 0; i < kObjects; ++i) {
+        const std::string key = "key" + std::to_string(i);
+        if (i % 10 == 0) {
+            EXPECT_EQ(GetString(*store, key), MakeValue(i));
+        } else {
+            EXPECT_FALSE(store->Query(key).has_value()) << key;
+        }
+    }
+}
+
+TEST_F(LogStructuredStoreTest, StorageBackendUsesLog) {
+    setenv("MC_STORE_DISK_ENGINE", "log", 1);
+    auto backend = StorageBackend::Create(test_dir_.string(), "fs");
+    unsetenv("MC_STORE_DISK_ENGINE");
+    ASSERT_NE(backend, nullptr);
+
+    ASSERT_EQ(backend->StoreObject("first", std::string(5000, 'a')),
+              ErrorCode::OK);
+    ASSERT_EQ(backend->StoreObject("second", std::string(3000, 'b')),
+              ErrorCode::OK);
+    EXPECT_EQ(backend->Existkey("second"), ErrorCode::OK);
+    // No file per object
+    EXPECT_FALSE(std::filesystem::exists(test_dir_ / "moon_fs" / "a"));
+
+    // Read through the disk replica, as FilereadWorkerPool does
+    auto desc = backend->Querykey("second");
+    ASSERT_TRUE(desc.has_value());
+    const auto& disk = desc->get_disk_descriptor();
+    EXPECT_EQ(disk.file_size, 3000u);
+    EXPECT_GT(disk.file_offset, 0u);
+    std::vector<char> buf(disk.file_size);
+    std::vector<Slice> slices{{buf.data(), buf.size()}};
+    std::string path = disk.file_path;
+    ASSERT_EQ(backend->LoadObject("", slices, path, disk.file_offset),
+              ErrorCode::OK);
+    EXPECT_EQ(std::string(buf.data(), buf.size()), std::string(3000, 'b'));
+
+    backend->RemoveFile("second");
+    EXPECT_EQ(backend->Existkey("second"), ErrorCode::FILE_NOT_FOUND);
+    std::string value;
+    ASSERT_EQ(backend->LoadObject("first", value), ErrorCode::OK);
+    EXPECT_EQ(value, std::string(5000, 'a'));
+
+    // A restarted client lists what it recovered to register it
+    backend.reset();
+    setenv("MC_STORE_DISK_ENGINE", "log", 1);
+    backend = StorageBackend::Create(test_dir_.string(), "fs");
+    unsetenv("MC_STORE_DISK_ENGINE");
+    ASSERT_NE(backend, nullptr);
+    auto objects = backend->ListObjects();
+    ASSERT_EQ(objects.size(), 1u);
+    EXPECT_EQ(objects[0].first, "first");
+    EXPECT_EQ(objects[0].second.file_size, 5000u);
+}
+
+TEST_F(LogStructuredStoreTest, SharedFilesystemReadsAcrossNodes) {
+    setenv("MC_STORE_DISK_ENGINE", "shared", 1);
+    setenv("MC_STORE_SHARED_FS_STRIPE_KB", "4", 1);
+    setenv("MC_STORE_SHARED_FS_OPEN_FILES", "1", 1);
+    setenv("MC_STORE_DISK_LOG_SEGMENT_MB", "1", 1);
+    auto writer = StorageBackend::Create(test_dir_.string(), "fs", "node:1");
+    auto reader = StorageBackend::Create(test_dir_.string(), "fs", "node:2");
+    unsetenv("MC_STORE_DISK_ENGINE");
+    unsetenv("MC_STORE_SHARED_FS_STRIPE_KB");
+    unsetenv("MC_STORE_SHARED_FS_OPEN_FILES");
+    unsetenv("MC_STORE_DISK_LOG_SEGMENT_MB");
+    ASSERT_NE(writer, nullptr);
+    ASSERT_NE(reader, nullptr);
+    // A log per node
+    EXPECT_TRUE(std::filesystem::is_directory(test_dir_ / "moon_fs" / "log" /
+                                              "node_1"));
+
+    std::string value;
+    for (size_t i = 0; i < 20000; ++i) {
+        value.push_back(static_cast<char>('a' + i % 23));
+    }
+    ASSERT_EQ(writer->StoreObject("striped", value), ErrorCode::OK);
+    ASSERT_EQ(writer->StoreObject("small", std::string(100, 'z')),
+              ErrorCode::OK);
+    EXPECT_EQ(reader->Existkey("striped"), ErrorCode::FILE_NOT_FOUND);
+
+    // The other node reads through the disk replica, in stripes of 4 KB
+    // over slices that do not line up with them
+    auto desc = writer->Querykey("striped");
+    ASSERT_TRUE(desc.has_value());
+    const auto& disk = desc->get_disk_descriptor();
+    std::string path = disk.file_path;
+    std::vector<char> buf(value.size());
+    std::vector<Slice> slices{{buf.data(), 3000},
+                              {buf.data() + 3000, 10000},
+                              {buf.data() + 13000, value.size() - 13000}};
+    ASSERT_EQ(reader->LoadObject("", slices, path, disk.file_offset),
+              ErrorCode::OK);
+    EXPECT_EQ(std::string(buf.data(), buf.size()), value);
+
+    auto small = writer->Querykey("small")->get_disk_descriptor();
+    std::vector<char> small_buf(small.file_size);
+    std::vector<Slice> small_slices{{small_buf.data(), small_buf.size()}};
+    ASSERT_EQ(reader->LoadObject("", small_slices, small.file_path,
+                                 small.file_offset),
+              ErrorCode::OK);
+    EXPECT_EQ(std::string(small_buf.data(), small_buf.size()),
+              std::string(100, 'z'));
+
+    // Reading past the end of the 1 MB segment fails
+    std::vector<Slice> past_end{{buf.data(), buf.size()}};
+    EXPECT_EQ(reader->LoadObject("", past_end, path, 2 << 20),
+              ErrorCode::FILE_READ_FAIL);
+}
+
+}  // namespace mooncake
@@ -4,11 +4,13 @@
 #include <atomic>
 #include <memory>
 #include <random>
+#include <string>
 #include <thread>
 #include <vector>
 
 #include "master_service.h"
 #include "rpc_service.h"
+#include "sharded_metric.h"
 #include "types.h"
 
 namespace mooncake::test {
@@ -79,7 +81,9 @@ TEST_F(MasterMetricsTest, BasicRequestTest) {
     const uint64_t default_kv_lease_ttl = 100;
     auto& metrics = MasterMetricManager::instance();
     // Use a wrapped master service to test the metrics manager
-    WrappedMasterService service_(false, default_kv_lease_ttl, true);
+    WrappedMasterService service_(
+        {.master = {.enable_gc = false,
+                    .default_kv_lease_ttl = default_kv_lease_ttl}});
 
     constexpr size_t kBufferAddress = 0x300000000;
     constexpr size_t kSegmentSize = 1024 * 1024 * 16;
@@ -187,7 +191,9 @@ TEST_F(MasterMetricsTest, BasicRequestTest) {
 TEST_F(MasterMetricsTest, BatchRequestTest) {
     const uint64_t default_kv_lease_ttl = 100;
     auto& metrics = MasterMetricManager::instance();
-    WrappedMasterService service_(false, default_kv_lease_ttl, true);
+    WrappedMasterService service_(
+        {.master = {.enable_gc = false,
+                    .default_kv_lease_ttl = default_kv_lease_ttl}});
 
     constexpr size_t kBufferAddress = 0x300000000;
     constexpr size_t kSegmentSize = 1024 * 1024 * 64;
@@ -253,6 +259,69 @@ TEST_F(MasterMetricsTest, BatchRequestTest) {
     ASSERT_EQ(metrics.get_batch_put_revoke_failures(), 3);
 }
 
+TEST_F(MasterMetricsTest, ShardedCounterTest) {
+    ShardedCounter counter("test_sharded_total", "A sharded counter");
+    std::string out;
+    counter.serialize(out);
+    ASSERT_TRUE(out.empty());
+
+    // Threads land on different shards, the value is their sum
+    constexpr int kThreads = 8;
+    constexpr int kIncrements = 10000;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kThreads; ++i) {
+        threads.emplace_back([&counter]() {
+            for (int j = 0; j < kIncrements; ++j) {
+                counter.inc();
+            }
+            counter.dec(10);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    ASSERT_EQ(counter.value(), kThreads * (kIncrements - 10));
+
+    counter.serialize(out);
+    EXPECT_NE(out.find("# TYPE test_sharded_total counter"),
+              std::string::npos);
+    EXPECT_NE(out.find("test_sharded_total " +
+                       std::to_string(kThreads * (kIncrements - 10))),
+              std::string::npos);
+}
+
+TEST_F(MasterMetricsTest, ShardedHistogramTest) {
+    ShardedHistogram histogram("test_sharded_latency", "A histogram",
+                               {10, 100});
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&histogram]() {
+            histogram.observe(5);
+            histogram.observe(10);
+            histogram.observe(50);
+            histogram.observe(1000);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    ASSERT_EQ(histogram.count(), 16);
+    ASSERT_EQ(histogram.sum(), 4 * (5 + 10 + 50 + 1000));
+
+    // Bucket counts are cumulative, a value equal to a bound is in its bucket
+    std::string out;
+    histogram.serialize(out);
+    EXPECT_NE(out.find("# TYPE test_sharded_latency histogram"),
+              std::string::npos);
+    EXPECT_NE(out.find("test_sharded_latency_bucket{le=\"10\"} 8"),
+              std::string::npos);
+    EXPECT_NE(out.find("test_sharded_latency_bucket{le=\"100\"} 12"),
+              std::string::npos);
+    EXPECT_NE(out.find("test_sharded_latency_bucket{le=\"+Inf\"} 16"),
+              std::string::npos);
+    EXPECT_NE(out.find("test_sharded_latency_count 16"), std::string::npos);
+}
+
 }  // namespace mooncake::test
 
 int main(int argc, char** argv) {
@@ -3,10 +3,13 @@
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
+#include <algorithm>
 #include <atomic>
 #include <memory>
 #include <random>
+#include <set>
 #include <thread>
+#include <unordered_set>
 #include <vector>
 
 #include "cachelib_memory_allocator/AllocationClass.h"
@@ -448,7 +451,8 @@ TEST_F(MasterServiceTest, RandomRemoveObject) {
 TEST_F(MasterServiceTest, RemoveAll) {
     const uint64_t kv_lease_ttl = 50;
     std::unique_ptr<MasterService> service_(
-        new MasterService(false, kv_lease_ttl));
+        new MasterService({.enable_gc = false,
+                           .default_kv_lease_ttl = kv_lease_ttl}));
     // Mount segment and put 10 objects
     constexpr size_t buffer = 0x300000000;
     constexpr size_t size = 1024 * 1024 * 16;
@@ -671,6 +675,33 @@ TEST_F(MasterServiceTest, ConcurrentGarbageCollectionTest) {
     EXPECT_EQ(0, found_count);
 }
 
+TEST_F(MasterServiceTest, GarbageCollectionIsNotBounded) {
+    std::unique_ptr<MasterService> service_(new MasterService());
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t size = 1024 * 1024 * 256;
+    Segment segment(generate_uuid(), "gc_segment", buffer, size);
+    UUID client_id = generate_uuid();
+    ASSERT_TRUE(service_->MountSegment(segment, client_id).has_value());
+
+    // More tasks than the GC used to queue
+    constexpr size_t total_objects = 20000;
+    ReplicateConfig config;
+    config.replica_num = 1;
+    for (size_t i = 0; i < total_objects; ++i) {
+        std::string key = "gc_key_" + std::to_string(i);
+        ASSERT_TRUE(service_->PutStart(key, {1024}, config).has_value());
+        ASSERT_TRUE(service_->PutEnd(key).has_value());
+        // Marks the object for GC
+        ASSERT_TRUE(service_->GetReplicaList(key).has_value());
+    }
+
+    for (int i = 0; i < 50 && service_->GetKeyCount() > 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    EXPECT_EQ(0, service_->GetKeyCount());
+    EXPECT_EQ(0, MasterMetricManager::instance().get_gc_pending_tasks());
+}
+
 TEST_F(MasterServiceTest, CleanupStaleHandlesTest) {
     std::unique_ptr<MasterService> service_(new MasterService());
 
@@ -817,7 +848,8 @@ TEST_F(MasterServiceTest, ConcurrentReadAndRemoveAll) {
     // set a large kv_lease_ttl so the granted lease will not quickly expire
     const uint64_t kv_lease_ttl = 200;
     std::unique_ptr<MasterService> service_(
-        new MasterService(false, kv_lease_ttl));
+        new MasterService({.enable_gc = false,
+                           .default_kv_lease_ttl = kv_lease_ttl}));
     constexpr size_t buffer = 0x300000000;
     constexpr size_t size = 1024 * 1024 * 256;  // 256MB for concurrent testing
     std::string segment_name = "concurrent_segment";
@@ -1070,7 +1102,8 @@ TEST_F(MasterServiceTest, UnmountSegmentPerformance) {
 TEST_F(MasterServiceTest, RemoveLeasedObject) {
     const uint64_t kv_lease_ttl = 50;
     std::unique_ptr<MasterService> service_(
-        new MasterService(false, kv_lease_ttl));
+        new MasterService({.enable_gc = false,
+                           .default_kv_lease_ttl = kv_lease_ttl}));
     // Mount segment and put an object
     constexpr size_t buffer = 0x300000000;
     constexpr size_t size = 1024 * 1024 * 16;
@@ -1153,10 +1186,212 @@ TEST_F(MasterServiceTest, RemoveLeasedObject) {
     EXPECT_EQ(ErrorCode::OBJECT_NOT_FOUND, get_result4.error());
 }
 
+TEST_F(MasterServiceTest, BatchTouchGrantsLease) {
+    const uint64_t kv_lease_ttl = 50;
+    std::unique_ptr<MasterService> service_(
+        new MasterService({.enable_gc = false,
+                           .default_kv_lease_ttl = kv_lease_ttl}));
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t size = 1024 * 1024 * 16;
+    Segment segment(generate_uuid(), "test_segment", buffer, size);
+    UUID client_id = generate_uuid();
+    ASSERT_TRUE(service_->MountSegment(segment, client_id).has_value());
+
+    std::vector<uint64_t> slice_lengths = {1024};
+    ReplicateConfig config;
+    config.replica_num = 1;
+    for (const std::string key : {"key_a", "key_b"}) {
+        ASSERT_TRUE(service_->PutStart(key, slice_lengths, config));
+        ASSERT_TRUE(service_->PutEnd(key));
+    }
+    ASSERT_TRUE(service_->PutStart("key_pending", slice_lengths, config));
+
+    // The default lease
+    auto results = service_->BatchTouch(
+        {"key_a", "key_missing", "key_pending", "key_b"}, 0);
+    ASSERT_EQ(results.size(), 4);
+    EXPECT_TRUE(results[0].has_value());
+    EXPECT_EQ(results[1].error(), ErrorCode::OBJECT_NOT_FOUND);
+    EXPECT_EQ(results[2].error(), ErrorCode::REPLICA_IS_NOT_READY);
+    EXPECT_TRUE(results[3].has_value());
+    EXPECT_EQ(service_->Remove("key_a").error(), ErrorCode::OBJECT_HAS_LEASE);
+    std::this_thread::sleep_for(std::chrono::milliseconds(kv_lease_ttl));
+    EXPECT_TRUE(service_->Remove("key_a").has_value());
+
+    // A longer lease than reads grant
+    results = service_->BatchTouch({"key_b"}, 4 * kv_lease_ttl);
+    ASSERT_EQ(results.size(), 1);
+    EXPECT_TRUE(results[0].has_value());
+    std::this_thread::sleep_for(std::chrono::milliseconds(2 * kv_lease_ttl));
+    EXPECT_EQ(service_->Remove("key_b").error(), ErrorCode::OBJECT_HAS_LEASE);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2 * kv_lease_ttl));
+    EXPECT_TRUE(service_->Remove("key_b").has_value());
+}
+
+TEST_F(MasterServiceTest, BatchPutStartSkipsResidentKeys) {
+    const uint64_t kv_lease_ttl = 50;
+    std::unique_ptr<MasterService> service_(
+        new MasterService({.enable_gc = false,
+                           .default_kv_lease_ttl = kv_lease_ttl}));
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t size = 1024 * 1024 * 16;
+    Segment segment(generate_uuid(), "test_segment", buffer, size);
+    UUID client_id = generate_uuid();
+    ASSERT_TRUE(service_->MountSegment(segment, client_id).has_value());
+
+    ReplicateConfig config;
+    config.replica_num = 1;
+    ASSERT_TRUE(service_->PutStart("key_a", {1024}, config));
+    ASSERT_TRUE(service_->PutEnd("key_a"));
+    ASSERT_TRUE(service_->PutStart("key_pending", {1024}, config));
+
+    // Without the option the existing keys fail
+    auto results = service_->BatchPutStart({"key_a", "key_b"},
+                                           {{1024}, {1024}}, config);
+    ASSERT_EQ(results.size(), 2);
+    EXPECT_EQ(results[0].error(), ErrorCode::OBJECT_ALREADY_EXISTS);
+    ASSERT_TRUE(results[1].has_value());
+    EXPECT_EQ(results[1]->size(), 1);
+    ASSERT_TRUE(service_->PutEnd("key_b"));
+
+    // Resident and pending keys succeed with no replicas, only the
+    // missing one is allocated
+    config.skip_resident = true;
+    config.refresh_resident_lease = true;
+    results = service_->BatchPutStart(
+        {"key_a", "key_pending", "key_c"}, {{1024}, {1024}, {1024}}, config);
+    ASSERT_EQ(results.size(), 3);
+    ASSERT_TRUE(results[0].has_value());
+    EXPECT_TRUE(results[0]->empty());
+    ASSERT_TRUE(results[1].has_value());
+    EXPECT_TRUE(results[1]->empty());
+    ASSERT_TRUE(results[2].has_value());
+    EXPECT_EQ(results[2]->size(), 1);
+    ASSERT_TRUE(service_->PutEnd("key_c"));
+
+    // key_a got a lease, key_b did not
+    EXPECT_EQ(service_->Remove("key_a").error(), ErrorCode::OBJECT_HAS_LEASE);
+    EXPECT_TRUE(service_->Remove("key_b").has_value());
+    std::this_thread::sleep_for(std::chrono::milliseconds(kv_lease_ttl));
+    EXPECT_TRUE(service_->Remove("key_a").has_value());
+}
+
+TEST_F(MasterServiceTest, UpsertReusesBuffersOrKeepsPreviousValue) {
+    const uint64_t kv_lease_ttl = 50;
+    // Values of several sizes share the segment, which cachelib only
+    // allows with a slab per size
+    std::unique_ptr<MasterService> service_(new MasterService(
+        {.enable_gc = false,
+         .default_kv_lease_ttl = kv_lease_ttl,
+         .buffer_allocator_type = BufferAllocatorType::OFFSET}));
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t size = 1024 * 1024 * 16;
+    Segment segment(generate_uuid(), "test_segment", buffer, size);
+    UUID client_id = generate_uuid();
+    ASSERT_TRUE(service_->MountSegment(segment, client_id).has_value());
+
+    auto buffer_of = [](const std::vector<Replica::Descriptor>& replicas) {
+        return replicas.at(0).get_memory_descriptor().buffer_descriptors.at(0);
+    };
+    ReplicateConfig config;
+    config.replica_num = 1;
+    auto put = service_->PutStart("key", {2048}, config);
+    ASSERT_TRUE(put.has_value());
+    const uintptr_t first = buffer_of(*put).buffer_address_;
+    ASSERT_TRUE(service_->PutEnd("key"));
+
+    // Not read since the put, a smaller value is written in place
+    config.upsert = true;
+    put = service_->PutStart("key", {1024}, config);
+    ASSERT_TRUE(put.has_value());
+    EXPECT_EQ(buffer_of(*put).buffer_address_, first);
+    EXPECT_EQ(buffer_of(*put).size_, 1024);
+    EXPECT_EQ(service_->GetReplicaList("key").error(),
+              ErrorCode::REPLICA_IS_NOT_READY);
+    ASSERT_TRUE(service_->PutEnd("key"));
+
+    // Read, so a larger value gets new replicas while readers keep the
+    // previous one
+    auto read = service_->GetReplicaList("key");
+    ASSERT_TRUE(read.has_value());
+    EXPECT_EQ(buffer_of(*read).size_, 1024);
+    put = service_->PutStart("key", {4096}, config);
+    ASSERT_TRUE(put.has_value());
+    const uintptr_t second = buffer_of(*put).buffer_address_;
+    EXPECT_NE(second, first);
+    read = service_->GetReplicaList("key");
+    ASSERT_TRUE(read.has_value());
+    ASSERT_EQ(read->size(), 1);
+    EXPECT_EQ(buffer_of(*read).buffer_address_, first);
+    ASSERT_TRUE(service_->PutEnd("key"));
+    read = service_->GetReplicaList("key");
+    ASSERT_TRUE(read.has_value());
+    ASSERT_EQ(read->size(), 1);
+    EXPECT_EQ(buffer_of(*read).buffer_address_, second);
+    EXPECT_EQ(buffer_of(*read).size_, 4096);
+
+    // A revoked upsert leaves the previous value
+    put = service_->PutStart("key", {4096}, config);
+    ASSERT_TRUE(put.has_value());
+    ASSERT_TRUE(service_->PutRevoke("key"));
+    read = service_->GetReplicaList("key");
+    ASSERT_TRUE(read.has_value());
+    ASSERT_EQ(read->size(), 1);
+    EXPECT_EQ(buffer_of(*read).buffer_address_, second);
+
+    // Objects still being written are refused, as are content aliases
+    config.upsert = false;
+    ASSERT_TRUE(service_->PutStart("pending", {1024}, config));
+    config.upsert = true;
+    EXPECT_EQ(service_->PutStart("pending", {1024}, config).error(),
+              ErrorCode::REPLICA_IS_NOT_READY);
+    config.content_hash = "hash";
+    EXPECT_EQ(service_->PutStart("key", {1024}, config).error(),
+              ErrorCode::INVALID_PARAMS);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(kv_lease_ttl));
+    EXPECT_TRUE(service_->Remove("key").has_value());
+}
+
+TEST_F(MasterServiceTest, PutStartPlacesShardsOnTheirSegments) {
+    std::unique_ptr<MasterService> service_(new MasterService());
+    // Several slabs per segment, so that each has room whatever the
+    // allocation class of the slices placed on it before
+    constexpr size_t size = 1024 * 1024 * 64;
+    const std::vector<std::string> names = {"seg_a", "seg_b", "seg_c"};
+    for (size_t i = 0; i < names.size(); ++i) {
+        Segment segment(generate_uuid(), names[i], 0x300000000 + i * size,
+                        size);
+        ASSERT_TRUE(service_->MountSegment(segment, generate_uuid()));
+    }
+
+    ReplicateConfig config;
+    config.replica_num = 1;
+    config.shard_segments = {"seg_c", "", "seg_b"};
+    auto result = service_->PutStart("key", {1024, 1024, 1024}, config);
+    ASSERT_TRUE(result.has_value());
+    ASSERT_EQ(result->size(), 1);
+    const auto& buffers =
+        (*result)[0].get_memory_descriptor().buffer_descriptors;
+    ASSERT_EQ(buffers.size(), 3);
+    EXPECT_EQ(buffers[0].segment_name_, "seg_c");
+    // The unpinned slice goes wherever the allocation strategy puts it
+    EXPECT_EQ(buffers[1].size_, 1024);
+    EXPECT_NE(std::find(names.begin(), names.end(), buffers[1].segment_name_),
+              names.end());
+    EXPECT_EQ(buffers[2].segment_name_, "seg_b");
+
+    // One segment per slice
+    config.shard_segments = {"seg_a"};
+    EXPECT_EQ(service_->PutStart("other", {1024, 1024}, config).error(),
+              ErrorCode::INVALID_PARAMS);
+}
+
 TEST_F(MasterServiceTest, RemoveAllLeasedObject) {
     const uint64_t kv_lease_ttl = 50;
     std::unique_ptr<MasterService> service_(
-        new MasterService(false, kv_lease_ttl));
+        new MasterService({.enable_gc = false,
+                           .default_kv_lease_ttl = kv_lease_ttl}));
     // Mount segment and put 10 objects, with 5 of them having lease
     constexpr size_t buffer = 0x300000000;
     constexpr size_t size = 1024 * 1024 * 16;
@@ -1195,11 +1430,202 @@ TEST_F(MasterServiceTest, RemoveAllLeasedObject) {
     }
 }
 
+TEST_F(MasterServiceTest, RemoveByTag) {
+    const uint64_t kv_lease_ttl = 300;
+    std::unique_ptr<MasterService> service_(
+        new MasterService({.enable_gc = false,
+                           .default_kv_lease_ttl = kv_lease_ttl}));
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t size = 1024 * 1024 * 16;
+    Segment segment(generate_uuid(), "test_segment", buffer, size);
+    UUID client_id = generate_uuid();
+    ASSERT_TRUE(service_->MountSegment(segment, client_id).has_value());
+
+    ReplicateConfig config;
+    config.replica_num = 1;
+    config.tag = "v1";
+    for (int i = 0; i < 4; ++i) {
+        std::string key = "v1_key" + std::to_string(i);
+        ASSERT_TRUE(service_->PutStart(key, {1024}, config).has_value());
+        ASSERT_TRUE(service_->PutEnd(key).has_value());
+    }
+    config.tag = "v2";
+    std::vector<std::string> v2_keys = {"v2_key0", "v2_key1"};
+    auto start_results =
+        service_->BatchPutStart(v2_keys, {{1024}, {1024}}, config);
+    for (const auto& result : start_results) {
+        ASSERT_TRUE(result.has_value());
+    }
+    for (const auto& result : service_->BatchPutEnd(v2_keys)) {
+        ASSERT_TRUE(result.has_value());
+    }
+    config.tag.clear();
+    ASSERT_TRUE(service_->PutStart("untagged", {1024}, config).has_value());
+    ASSERT_TRUE(service_->PutEnd("untagged").has_value());
+    ASSERT_EQ(7, service_->GetKeyCount());
+
+    // A leased object is removed once its lease expired
+    ASSERT_TRUE(service_->GetReplicaList("v1_key0").has_value());
+
+    auto empty_result = service_->RemoveByTag("");
+    ASSERT_FALSE(empty_result.has_value());
+    EXPECT_EQ(ErrorCode::INVALID_PARAMS, empty_result.error());
+    auto unknown_result = service_->RemoveByTag("v3");
+    ASSERT_TRUE(unknown_result.has_value());
+    EXPECT_EQ(0, unknown_result.value());
+    auto remove_result = service_->RemoveByTag("v1");
+    ASSERT_TRUE(remove_result.has_value());
+    EXPECT_EQ(4, remove_result.value());
+
+    // Removed by the GC thread. ExistKey is not used as it grants leases.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_EQ(4, service_->GetKeyCount());
+    std::this_thread::sleep_for(std::chrono::milliseconds(kv_lease_ttl));
+    EXPECT_EQ(3, service_->GetKeyCount());
+    for (const auto& key : v2_keys) {
+        auto exist_result = service_->ExistKey(key);
+        ASSERT_TRUE(exist_result.has_value());
+        EXPECT_TRUE(exist_result.value());
+    }
+
+    // The index forgets removed objects
+    remove_result = service_->RemoveByTag("v1");
+    ASSERT_TRUE(remove_result.has_value());
+    EXPECT_EQ(0, remove_result.value());
+}
+
+TEST_F(MasterServiceTest, RemoveByPrefix) {
+    const uint64_t kv_lease_ttl = 300;
+    std::unique_ptr<MasterService> service_(
+        new MasterService({.enable_gc = false,
+                           .default_kv_lease_ttl = kv_lease_ttl}));
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t size = 1024 * 1024 * 16;
+    Segment segment(generate_uuid(), "test_segment", buffer, size);
+    UUID client_id = generate_uuid();
+    ASSERT_TRUE(service_->MountSegment(segment, client_id).has_value());
+
+    ReplicateConfig config;
+    config.replica_num = 1;
+    for (const std::string model : {"model_a/", "model_b/"}) {
+        for (int i = 0; i < 20; ++i) {
+            std::string key = model + "block_" + std::to_string(i);
+            ASSERT_TRUE(service_->PutStart(key, {1024}, config).has_value());
+            ASSERT_TRUE(service_->PutEnd(key).has_value());
+        }
+    }
+    // The key equal to the prefix is matched too
+    ASSERT_TRUE(service_->PutStart("model_a/", {1024}, config).has_value());
+    ASSERT_TRUE(service_->PutEnd("model_a/").has_value());
+    // A leased object is kept
+    ASSERT_TRUE(service_->GetReplicaList("model_a/block_3").has_value());
+
+    auto empty_result = service_->RemoveByPrefix("");
+    ASSERT_FALSE(empty_result.has_value());
+    EXPECT_EQ(ErrorCode::INVALID_PARAMS, empty_result.error());
+    auto remove_result = service_->RemoveByPrefix("model_a/");
+    ASSERT_TRUE(remove_result.has_value());
+    EXPECT_EQ(20, remove_result.value());
+    EXPECT_EQ(21, service_->GetKeyCount());
+
+    auto page = service_->ScanKeys("model_a/", "", 100);
+    ASSERT_TRUE(page.has_value());
+    EXPECT_EQ(page->keys, std::vector<std::string>{"model_a/block_3"});
+    page = service_->ScanKeys("model_b/", "", 100);
+    ASSERT_TRUE(page.has_value());
+    EXPECT_EQ(page->keys.size(), 20u);
+}
+
+TEST_F(MasterServiceTest, ContentDeduplication) {
+    std::unique_ptr<MasterService> service_(
+        new MasterService({.enable_gc = false, .default_kv_lease_ttl = 0}));
+    constexpr size_t buffer = 0x300000000;
+    // Room for a slab of every slice size
+    constexpr size_t size = 1024 * 1024 * 64;
+    Segment segment(generate_uuid(), "test_segment", buffer, size);
+    UUID client_id = generate_uuid();
+    ASSERT_TRUE(service_->MountSegment(segment, client_id).has_value());
+
+    auto first_address = [&](const std::string& key) -> uintptr_t {
+        auto replicas = service_->GetReplicaList(key);
+        EXPECT_TRUE(replicas.has_value());
+        if (!replicas) {
+            return 0;
+        }
+        return replicas.value()[0]
+            .get_memory_descriptor()
+            .buffer_descriptors[0]
+            .buffer_address_;
+    };
+
+    ReplicateConfig config;
+    config.content_hash = "prefix_block_0";
+    ASSERT_TRUE(service_->PutStart("tenant_a", {1024, 2048}, config));
+    // Shared while being put, and after
+    auto shared_result = service_->PutStart("tenant_b", {1024, 2048}, config);
+    ASSERT_FALSE(shared_result.has_value());
+    EXPECT_EQ(ErrorCode::OBJECT_ALREADY_EXISTS, shared_result.error());
+    ASSERT_TRUE(service_->PutEnd("tenant_a").has_value());
+    shared_result = service_->PutStart("tenant_c", {1024, 2048}, config);
+    ASSERT_FALSE(shared_result.has_value());
+    EXPECT_EQ(ErrorCode::OBJECT_ALREADY_EXISTS, shared_result.error());
+    EXPECT_EQ(1, service_->GetKeyCount());
+    EXPECT_EQ(first_address("tenant_a"), first_address("tenant_b"));
+    for (const auto& result :
+         service_->BatchExistKey({"tenant_a", "tenant_b", "tenant_d"})) {
+        ASSERT_TRUE(result.has_value());
+    }
+    EXPECT_TRUE(service_->ExistKey("tenant_c").value());
+
+    // Aliases are keys of their own
+    ReplicateConfig plain;
+    auto exists_result = service_->PutStart("tenant_b", {3072}, plain);
+    ASSERT_FALSE(exists_result.has_value());
+    EXPECT_EQ(ErrorCode::OBJECT_ALREADY_EXISTS, exists_result.error());
+    // Another layout is not shared
+    ASSERT_TRUE(service_->PutStart("tenant_d", {3072}, config));
+    ASSERT_TRUE(service_->PutEnd("tenant_d").has_value());
+    EXPECT_EQ(2, service_->GetKeyCount());
+    EXPECT_NE(first_address("tenant_a"), first_address("tenant_d"));
+
+    // The content stays until its last alias is removed
+    ASSERT_TRUE(service_->Remove("tenant_a").has_value());
+    ASSERT_TRUE(service_->Remove("tenant_b").has_value());
+    EXPECT_FALSE(service_->ExistKey("tenant_a").value());
+    EXPECT_TRUE(service_->ExistKey("tenant_c").value());
+    EXPECT_EQ(2, service_->GetKeyCount());
+    ASSERT_TRUE(service_->Remove("tenant_c").has_value());
+    EXPECT_EQ(1, service_->GetKeyCount());
+    auto removed_result = service_->Remove("tenant_c");
+    ASSERT_FALSE(removed_result.has_value());
+    EXPECT_EQ(ErrorCode::OBJECT_NOT_FOUND, removed_result.error());
+
+    // Aliases of a revoked put find the content gone
+    config.content_hash = "prefix_block_1";
+    ASSERT_TRUE(service_->PutStart("tenant_e", {4096}, config));
+    ASSERT_FALSE(service_->PutStart("tenant_f", {4096}, config));
+    ASSERT_TRUE(service_->PutRevoke("tenant_e").has_value());
+    EXPECT_FALSE(service_->ExistKey("tenant_e").value());
+    EXPECT_FALSE(service_->ExistKey("tenant_f").value());
+    EXPECT_EQ(1, service_->GetKeyCount());
+
+    // Content keys and tagged aliases are refused
+    auto reserved_result =
+        service_->PutStart("__mooncake_content__/x", {1024}, plain);
+    ASSERT_FALSE(reserved_result.has_value());
+    EXPECT_EQ(ErrorCode::INVALID_PARAMS, reserved_result.error());
+    config.tag = "v1";
+    auto tagged_result = service_->PutStart("tenant_g", {1024}, config);
+    ASSERT_FALSE(tagged_result.has_value());
+    EXPECT_EQ(ErrorCode::INVALID_PARAMS, tagged_result.error());
+}
+
 TEST_F(MasterServiceTest, EvictObject) {
     // set a large kv_lease_ttl so the granted lease will not quickly expire
     const uint64_t kv_lease_ttl = 2000;
     std::unique_ptr<MasterService> service_(
-        new MasterService(false, kv_lease_ttl));
+        new MasterService({.enable_gc = false,
+                           .default_kv_lease_ttl = kv_lease_ttl}));
     // Mount a segment that can hold about 1024 * 16 objects.
     // As the eviction is processed separately for each shard,
     // we need to fill each shard with enough objects to thoroughly
@@ -1235,11 +1661,94 @@ TEST_F(MasterServiceTest, EvictObject) {
     service_->RemoveAll();
 }
 
+TEST_F(MasterServiceTest, EvictFarthestHintedUseFirst) {
+    const uint64_t kv_lease_ttl = 50;
+    const double eviction_ratio = 0.2;
+    std::unique_ptr<MasterService> service_(
+        new MasterService({.enable_gc = false,
+                           .default_kv_lease_ttl = kv_lease_ttl,
+                           .allow_evict_soft_pinned_objects = false,
+                           .eviction_ratio = eviction_ratio}));
+    // About 16 objects per shard, so that each shard has a choice
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t size = 1024 * 1024 * 16 * 15;
+    constexpr size_t object_size = 1024 * 15;
+    Segment segment(generate_uuid(), "test_segment", buffer, size);
+    ASSERT_TRUE(service_->MountSegment(segment, generate_uuid()).has_value());
+
+    // Objects put one after another, every other one needed much later
+    ReplicateConfig near_config;
+    near_config.replica_num = 1;
+    near_config.next_use_ms = 60 * 1000;
+    ReplicateConfig far_config = near_config;
+    far_config.next_use_ms = 10 * 60 * 1000;
+    int puts = 0;
+    for (; puts < 1024 * 16 + 50; ++puts) {
+        const std::string key = "test_key" + std::to_string(puts);
+        const auto& config = puts % 2 ? far_config : near_config;
+        if (!service_->PutStart(key, {object_size}, config).has_value()) {
+            break;
+        }
+        ASSERT_TRUE(service_->PutEnd(key).has_value());
+    }
+    // wait for gc thread to do eviction
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    int near_alive = 0;
+    int far_alive = 0;
+    for (int i = 0; i < puts; ++i) {
+        if (service_->ExistKey("test_key" + std::to_string(i)).value_or(
+                false)) {
+            (i % 2 ? far_alive : near_alive)++;
+        }
+    }
+    EXPECT_LT(near_alive + far_alive, puts);
+    EXPECT_GT(near_alive - far_alive, puts / 20);
+    std::this_thread::sleep_for(std::chrono::milliseconds(kv_lease_ttl));
+    service_->RemoveAll();
+}
+
+TEST_F(MasterServiceTest, ProactiveEvictObject) {
+    // Evict ahead of the puts, down to half of the segment at most
+    std::unique_ptr<MasterService> service_(
+        new MasterService({.eviction_high_watermark_ratio = 0.9,
+                           .eviction_low_watermark_ratio = 0.5}));
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t size = 1024 * 1024 * 16;
+    constexpr size_t object_size = 1024 * 64;
+    Segment segment(generate_uuid(), "test_segment", buffer, size);
+    UUID client_id = generate_uuid();
+    ASSERT_TRUE(service_->MountSegment(segment, client_id).has_value());
+
+    // Fill the segment below the high watermark, fast enough that the
+    // expected allocations do not fit in the room left
+    const int64_t evictions_before =
+        MasterMetricManager::instance().get_proactive_evictions();
+    constexpr int total_objects = 200;
+    ReplicateConfig config;
+    config.replica_num = 1;
+    for (int i = 0; i < total_objects; ++i) {
+        std::string key = "test_key" + std::to_string(i);
+        ASSERT_TRUE(service_->PutStart(key, {object_size}, config).has_value());
+        ASSERT_TRUE(service_->PutEnd(key).has_value());
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    EXPECT_GT(MasterMetricManager::instance().get_proactive_evictions(),
+              evictions_before);
+    EXPECT_LT(service_->GetKeyCount(), total_objects);
+    // Not far below the low watermark, the eviction rounds up per shard
+    EXPECT_GE(service_->GetKeyCount() * object_size, size / 4);
+    service_->RemoveAll();
+}
+
 TEST_F(MasterServiceTest, TryEvictLeasedObject) {
     // set a large kv_lease_ttl so the granted lease will not quickly expire
     const uint64_t kv_lease_ttl = 500;
     std::unique_ptr<MasterService> service_(
-        new MasterService(false, kv_lease_ttl));
+        new MasterService({.enable_gc = false,
+                           .default_kv_lease_ttl = kv_lease_ttl}));
     constexpr size_t buffer = 0x300000000;
     constexpr size_t size = 1024 * 1024 * 16;
     constexpr size_t object_size = 1024 * 1024;
@@ -1284,13 +1793,58 @@ TEST_F(MasterServiceTest, TryEvictLeasedObject) {
     service_->RemoveAll();
 }
 
+// The lease of a view, see Client::GetView: a BatchTouch longer than the
+// leases of reads keeps the object from eviction after they ran out
+TEST_F(MasterServiceTest, TouchedObjectIsNotEvicted) {
+    const uint64_t kv_lease_ttl = 50;
+    std::unique_ptr<MasterService> service_(
+        new MasterService({.enable_gc = false,
+                           .default_kv_lease_ttl = kv_lease_ttl}));
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t size = 1024 * 1024 * 16;
+    constexpr size_t object_size = 1024 * 1024;
+    Segment segment(generate_uuid(), "test_segment", buffer, size);
+    UUID client_id = generate_uuid();
+    ASSERT_TRUE(service_->MountSegment(segment, client_id).has_value());
+
+    std::vector<uint64_t> slice_lengths = {object_size};
+    ReplicateConfig config;
+    config.replica_num = 1;
+    ASSERT_TRUE(service_->PutStart("viewed_key", slice_lengths, config));
+    ASSERT_TRUE(service_->PutEnd("viewed_key"));
+    auto touched = service_->BatchTouch({"viewed_key"}, 100 * kv_lease_ttl);
+    ASSERT_EQ(touched.size(), 1);
+    ASSERT_TRUE(touched[0].has_value());
+    std::this_thread::sleep_for(std::chrono::milliseconds(2 * kv_lease_ttl));
+
+    // Three times what the segment holds, evicting all the others
+    int success_puts = 0;
+    for (int i = 0; i < 16 * 3; ++i) {
+        std::string key = "test_key" + std::to_string(i);
+        if (service_->PutStart(key, slice_lengths, config)) {
+            ASSERT_TRUE(service_->PutEnd(key));
+            success_puts++;
+        } else {
+            // wait for gc thread to work
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    }
+    EXPECT_GT(success_puts, 16);
+    auto exist = service_->ExistKey("viewed_key");
+    ASSERT_TRUE(exist.has_value());
+    EXPECT_TRUE(exist.value());
+}
+
 TEST_F(MasterServiceTest, RemoveSoftPinObject) {
     const uint64_t kv_lease_ttl = 200;
     // set a large soft_pin_ttl so the granted soft pin will not quickly expire
     const uint64_t kv_soft_pin_ttl = 10000;
     const bool allow_evict_soft_pinned_objects = true;
     std::unique_ptr<MasterService> service_(new MasterService(
-        false, kv_lease_ttl, kv_soft_pin_ttl, allow_evict_soft_pinned_objects));
+        {.enable_gc = false,
+         .default_kv_lease_ttl = kv_lease_ttl,
+         .default_kv_soft_pin_ttl = kv_soft_pin_ttl,
+         .allow_evict_soft_pinned_objects = allow_evict_soft_pinned_objects}));
     // Mount segment and put an object
     constexpr size_t buffer = 0x300000000;
     constexpr size_t size = 1024 * 1024 * 16;
@@ -1323,8 +1877,12 @@ TEST_F(MasterServiceTest, SoftPinObjectsNotEvictedBeforeOtherObjects) {
     const double eviction_ratio = 0.5;
     const bool allow_evict_soft_pinned_objects = true;
     std::unique_ptr<MasterService> service_(
-        new MasterService(false, kv_lease_ttl, kv_soft_pin_ttl,
-                          allow_evict_soft_pinned_objects, eviction_ratio));
+        new MasterService(
+            {.enable_gc = false,
+             .default_kv_lease_ttl = kv_lease_ttl,
+             .default_kv_soft_pin_ttl = kv_soft_pin_ttl,
+             .allow_evict_soft_pinned_objects = allow_evict_soft_pinned_objects,
+             .eviction_ratio = eviction_ratio}));
 
     // Mount segment and put an object
     constexpr size_t buffer = 0x300000000;
@@ -1387,7 +1945,10 @@ TEST_F(MasterServiceTest, SoftPinObjectsCanBeEvicted) {
     const uint64_t kv_soft_pin_ttl = 10000;
     const bool allow_evict_soft_pinned_objects = true;
     std::unique_ptr<MasterService> service_(new MasterService(
-        false, kv_lease_ttl, kv_soft_pin_ttl, allow_evict_soft_pinned_objects));
+        {.enable_gc = false,
+         .default_kv_lease_ttl = kv_lease_ttl,
+         .default_kv_soft_pin_ttl = kv_soft_pin_ttl,
+         .allow_evict_soft_pinned_objects = allow_evict_soft_pinned_objects}));
 
     // Mount segment and put an object
     constexpr size_t buffer = 0x300000000;
@@ -1430,8 +1991,12 @@ TEST_F(MasterServiceTest, SoftPinExtendedOnGet) {
     const double eviction_ratio = 0.5;
     const bool allow_evict_soft_pinned_objects = true;
     std::unique_ptr<MasterService> service_(
-        new MasterService(false, kv_lease_ttl, kv_soft_pin_ttl,
-                          allow_evict_soft_pinned_objects, eviction_ratio));
+        new MasterService(
+            {.enable_gc = false,
+             .default_kv_lease_ttl = kv_lease_ttl,
+             .default_kv_soft_pin_ttl = kv_soft_pin_ttl,
+             .allow_evict_soft_pinned_objects = allow_evict_soft_pinned_objects,
+             .eviction_ratio = eviction_ratio}));
 
     // Mount segment and put an object
     constexpr size_t buffer = 0x300000000;
@@ -1505,7 +2070,10 @@ TEST_F(MasterServiceTest, SoftPinObjectsNotAllowEvict) {
     // pinned objects
     const bool allow_evict_soft_pinned_objects = false;
     std::unique_ptr<MasterService> service_(new MasterService(
-        false, kv_lease_ttl, kv_soft_pin_ttl, allow_evict_soft_pinned_objects));
+        {.enable_gc = false,
+         .default_kv_lease_ttl = kv_lease_ttl,
+         .default_kv_soft_pin_ttl = kv_soft_pin_ttl,
+         .allow_evict_soft_pinned_objects = allow_evict_soft_pinned_objects}));
 
     // Mount segment and put an object
     constexpr size_t buffer = 0x300000000;
@@ -1541,59 +2109,16 @@ TEST_F(MasterServiceTest, SoftPinObjectsNotAllowEvict) {
     service_->RemoveAll();
 }
 
-TEST_F(MasterServiceTest, BatchExistKeyTest) {
-    std::unique_ptr<MasterService> service_(new MasterService());
-
-    // Mount a segment
-    constexpr size_t buffer = 0x300000000;
-    constexpr size_t size = 1024 * 1024 * 128;
-    constexpr size_t value_size = 1024;
-    std::string segment_name = "test_segment";
-    Segment segment(generate_uuid(), segment_name, buffer, size);
-    UUID client_id = generate_uuid();
-    auto mount_result = service_->MountSegment(segment, client_id);
-    ASSERT_TRUE(mount_result.has_value());
-
-    int test_object_num = 10;
-    std::vector<std::string> test_keys;
-    for (int i = 0; i < test_object_num; ++i) {
-        test_keys.push_back("test_key" + std::to_string(i));
-        ReplicateConfig config;
-        config.replica_num = 1;
-        std::vector<uint64_t> slice_lengths = {value_size};
-        auto put_start_result =
-            service_->PutStart(test_keys[i], slice_lengths, config);
-        ASSERT_TRUE(put_start_result.has_value());
-        auto put_end_result = service_->PutEnd(test_keys[i]);
-        ASSERT_TRUE(put_end_result.has_value());
-    }
-
-    // Test individual ExistKey calls to verify the underlying functionality
-    for (int i = 0; i < test_object_num; ++i) {
-        auto exist_result = service_->ExistKey(test_keys[i]);
-        EXPECT_TRUE(exist_result.value());
-    }
-
-    // Tets batch
-    test_keys.push_back("non_existent_key");
-    auto exist_resp = service_->BatchExistKey(test_keys);
-    for (int i = 0; i < test_object_num; ++i) {
-        ASSERT_TRUE(exist_resp[i].value());
-    }
-    ASSERT_FALSE(exist_resp[test_object_num].value());
-}
-
-TEST_F(MasterServiceTest, ReleaseSlabTest) {
+TEST_F(MasterServiceTest, ClockEvictObject) {
     // set a large kv_lease_ttl so the granted lease will not quickly expire
-    // const uint64_t kv_lease_ttl = 2000;
-    std::unique_ptr<MasterService> service_(new MasterService(false));
-    // Mount a segment that can hold about 1024 * 16 objects.
-    // As the eviction is processed separately for each shard,
-    // we need to fill each shard with enough objects to thoroughly
-    // test the eviction process.
+    const uint64_t kv_lease_ttl = 2000;
+    std::unique_ptr<MasterService> service_(
+        new MasterService({.enable_gc = false,
+                           .default_kv_lease_ttl = kv_lease_ttl,
+                           .eviction_engine = EvictionEngine::CLOCK}));
     constexpr size_t buffer = 0x300000000;
-    constexpr size_t size = 1024 * 1024 * 16;
-    constexpr size_t object_size = 1024 * 1024;
+    constexpr size_t size = 1024 * 1024 * 16 * 15;
+    constexpr size_t object_size = 1024 * 15;
     std::string segment_name = "test_segment";
     Segment segment(generate_uuid(), segment_name, buffer, size);
     UUID client_id = generate_uuid();
@@ -1602,7 +2127,7 @@ TEST_F(MasterServiceTest, ReleaseSlabTest) {
 
     // Verify if we can put objects more than the segment can hold
     int success_puts = 0;
-    for (int i = 0; i < 13; ++i) {
+    for (int i = 0; i < 1024 * 16 + 50; ++i) {
         std::string key = "test_key" + std::to_string(i);
         std::vector<uint64_t> slice_lengths = {object_size};
         ReplicateConfig config;
@@ -1617,31 +2142,2129 @@ TEST_F(MasterServiceTest, ReleaseSlabTest) {
             std::this_thread::sleep_for(std::chrono::milliseconds(50));
         }
     }
+    ASSERT_GT(success_puts, 1024 * 16);
+    std::this_thread::sleep_for(std::chrono::milliseconds(kv_lease_ttl));
+    service_->RemoveAll();
+}
 
-    // put a larger kv
-    {
-        std::string key = "large_test_key";
-        std::vector<uint64_t> slice_lengths = {object_size * 2};
+TEST_F(MasterServiceTest, PolicyEvictObject) {
+    const uint64_t kv_lease_ttl = 200;
+    for (auto engine : {EvictionEngine::SIEVE, EvictionEngine::S3FIFO,
+                        EvictionEngine::W_TINYLFU}) {
+        std::unique_ptr<MasterService> service_(
+            new MasterService({.enable_gc = false,
+                               .default_kv_lease_ttl = kv_lease_ttl,
+                               .eviction_engine = engine}));
+        constexpr size_t buffer = 0x300000000;
+        constexpr size_t size = 1024 * 1024 * 16;
+        constexpr size_t object_size = 1024 * 1024;
+        Segment segment(generate_uuid(), "test_segment", buffer, size);
+        UUID client_id = generate_uuid();
+        ASSERT_TRUE(service_->MountSegment(segment, client_id).has_value());
+
+        // A leased object must survive eviction
         ReplicateConfig config;
         config.replica_num = 1;
-        while (1) {
-            auto put_start_result =
-                service_->PutStart(key, slice_lengths, config);
-            if (put_start_result.has_value()) {
-                auto put_end_result = service_->PutEnd(key);
-                ASSERT_TRUE(put_end_result.has_value());
+        ASSERT_TRUE(service_->PutStart("leased_key", {object_size}, config)
+                        .has_value());
+        ASSERT_TRUE(service_->PutEnd("leased_key").has_value());
+        ASSERT_TRUE(service_->GetReplicaList("leased_key").has_value());
+
+        // Verify if we can put objects more than the segment can hold
+        int success_puts = 0;
+        for (int i = 0; i < 16 + 50; ++i) {
+            std::string key = "test_key" + std::to_string(i);
+            if (service_->PutStart(key, {object_size}, config).has_value()) {
+                ASSERT_TRUE(service_->PutEnd(key).has_value());
                 success_puts++;
-                LOG(INFO) << "large key put success";
-                break;
             } else {
                 // wait for gc thread to work
-                // LOG(ERROR) << "large key put fail";
-                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            if (i == 0) {
+                EXPECT_TRUE(
+                    service_->GetReplicaList("leased_key").has_value());
             }
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        EXPECT_GT(success_puts, 16) << "engine=" << static_cast<int>(engine);
+        std::this_thread::sleep_for(std::chrono::milliseconds(kv_lease_ttl));
+        service_->RemoveAll();
     }
-    service_->RemoveAll();
+}
+
+TEST_F(MasterServiceTest, DiskTierDemotesAndPromotes) {
+    const uint64_t kv_lease_ttl = 50;
+    for (auto engine : {EvictionEngine::BATCH_SCAN, EvictionEngine::CLOCK,
+                        EvictionEngine::SIEVE}) {
+        std::unique_ptr<MasterService> service_(
+            new MasterService({.enable_gc = false,
+                               .default_kv_lease_ttl = kv_lease_ttl,
+                               .eviction_engine = engine,
+                               .enable_disk_tier = true}));
+        constexpr size_t buffer = 0x300000000;
+        constexpr size_t size = 1024 * 1024 * 16;
+        constexpr uint64_t object_size = 1024 * 1024;
+        Segment segment(generate_uuid(), "test_segment", buffer, size);
+        UUID client_id = generate_uuid();
+        ASSERT_TRUE(service_->MountSegment(segment, client_id).has_value());
+
+        ReplicateConfig config;
+        config.replica_num = 1;
+        auto put = [&](const std::string& key) {
+            for (int attempt = 0; attempt < 100; ++attempt) {
+                if (service_->PutStart(key, {object_size}, config)) {
+                    return service_->PutEnd(key).has_value();
+                }
+                // wait for gc thread to work
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            return false;
+        };
+        auto on_disk_only = [&](const std::string& key) {
+            auto replicas = service_->GetReplicaList(key);
+            return replicas && replicas->size() == 1 &&
+                   !replicas->front().is_memory_replica();
+        };
+
+        // Objects with a write-through copy are demoted, not dropped
+        constexpr int kDiskObjects = 16;
+        for (int i = 0; i < kDiskObjects; ++i) {
+            std::string key = "disk_key" + std::to_string(i);
+            ASSERT_TRUE(put(key));
+            DiskDescriptor disk{"/data/" + key, object_size};
+            ASSERT_TRUE(service_->PutDiskReplica(key, disk).has_value());
+        }
+        EXPECT_EQ(service_->PutDiskReplica("disk_key0", {"/data/x", 1})
+                      .error(),
+                  ErrorCode::INVALID_PARAMS);
+        for (int i = 0; i < 32; ++i) {
+            ASSERT_TRUE(put("mem_key" + std::to_string(i)));
+        }
+        int demoted = 0;
+        for (int i = 0; i < kDiskObjects; ++i) {
+            std::string key = "disk_key" + std::to_string(i);
+            ASSERT_TRUE(service_->ExistKey(key).value()) << key;
+            demoted += on_disk_only(key);
+        }
+        ASSERT_GT(demoted, 0) << "engine=" << static_cast<int>(engine);
+
+        // Promote a demoted object. Readers keep using the disk replica
+        // until the copy is complete.
+        std::string key;
+        for (int i = 0; i < kDiskObjects && key.empty(); ++i) {
+            if (on_disk_only("disk_key" + std::to_string(i))) {
+                key = "disk_key" + std::to_string(i);
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(kv_lease_ttl));
+        EXPECT_EQ(service_->PromoteStart(key, {object_size / 2}, config)
+                      .error(),
+                  ErrorCode::INVALID_PARAMS);
+        tl::expected<std::vector<Replica::Descriptor>, ErrorCode> promoted;
+        for (int attempt = 0; attempt < 100; ++attempt) {
+            promoted = service_->PromoteStart(key, {object_size}, config);
+            if (promoted) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        ASSERT_TRUE(promoted.has_value());
+        ASSERT_EQ(promoted->size(), 1u);
+        EXPECT_TRUE(promoted->front().is_memory_replica());
+        EXPECT_EQ(service_->PromoteStart(key, {object_size}, config).error(),
+                  ErrorCode::OBJECT_ALREADY_EXISTS);
+        EXPECT_TRUE(on_disk_only(key));
+        ASSERT_TRUE(service_->PutEnd(key).has_value());
+        auto replicas = service_->GetReplicaList(key);
+        ASSERT_TRUE(replicas.has_value());
+        EXPECT_EQ(replicas->size(), 2u);
+
+        // A revoked promotion leaves the object on disk
+        std::string other;
+        for (int i = 0; i < kDiskObjects && other.empty(); ++i) {
+            std::string candidate = "disk_key" + std::to_string(i);
+            if (candidate != key && on_disk_only(candidate)) {
+                other = candidate;
+            }
+        }
+        if (!other.empty()) {
+            for (int attempt = 0; attempt < 100; ++attempt) {
+                if (service_->PromoteStart(other, {object_size}, config)) {
+                    ASSERT_TRUE(service_->PutRevoke(other).has_value());
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            EXPECT_TRUE(on_disk_only(other));
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(kv_lease_ttl));
+        service_->RemoveAll();
+        EXPECT_EQ(service_->GetKeyCount(), 0u);
+    }
+}
+
+TEST_F(MasterServiceTest, DiskTierDisabled) {
+    std::unique_ptr<MasterService> service_(new MasterService());
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t size = 1024 * 1024 * 16;
+    Segment segment(generate_uuid(), "test_segment", buffer, size);
+    UUID client_id = generate_uuid();
+    ASSERT_TRUE(service_->MountSegment(segment, client_id).has_value());
+
+    ReplicateConfig config;
+    config.replica_num = 1;
+    ASSERT_TRUE(service_->PutStart("key", {1024}, config).has_value());
+    ASSERT_TRUE(service_->PutEnd("key").has_value());
+    EXPECT_EQ(service_->PutDiskReplica("key", {"/data/key", 1024}).error(),
+              ErrorCode::UNAVAILABLE_IN_CURRENT_MODE);
+    EXPECT_EQ(service_->PromoteStart("key", {1024}, config).error(),
+              ErrorCode::UNAVAILABLE_IN_CURRENT_MODE);
+}
+
+TEST_F(MasterServiceTest, BatchPutDiskReplicaRegistersRecoveredObjects) {
+    std::unique_ptr<MasterService> service_(
+        new MasterService({.enable_gc = false, .enable_disk_tier = true}));
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t size = 1024 * 1024 * 16;
+    Segment segment(generate_uuid(), "test_segment", buffer, size);
+    ASSERT_TRUE(service_->MountSegment(segment, generate_uuid()).has_value());
+    ReplicateConfig config;
+    config.replica_num = 1;
+    ASSERT_TRUE(service_->PutStart("in_memory", {1024}, config).has_value());
+    ASSERT_TRUE(service_->PutEnd("in_memory").has_value());
+
+    auto results = service_->BatchPutDiskReplica(
+        {"in_memory", "recovered", "empty"},
+        {{"/data/log/0.data", 1024, 0},
+         {"/data/log/0.data", 2048, 4096},
+         {"/data/log/0.data", 0, 8192}});
+    ASSERT_EQ(results.size(), 3);
+    EXPECT_TRUE(results[0].has_value());
+    EXPECT_TRUE(results[1].has_value());
+    EXPECT_EQ(results[2].error(), ErrorCode::INVALID_PARAMS);
+
+    // The known object gains a disk replica, the unknown one is on disk only
+    auto replicas = service_->GetReplicaList("in_memory");
+    ASSERT_TRUE(replicas.has_value());
+    EXPECT_EQ(replicas->size(), 2);
+    replicas = service_->GetReplicaList("recovered");
+    ASSERT_TRUE(replicas.has_value());
+    ASSERT_EQ(replicas->size(), 1);
+    ASSERT_FALSE(replicas->front().is_memory_replica());
+    EXPECT_EQ(replicas->front().get_disk_descriptor().file_offset, 4096);
+
+    // A file of another size than the object is stale
+    results =
+        service_->BatchPutDiskReplica({"in_memory"}, {{"/data/old", 512, 0}});
+    EXPECT_EQ(results[0].error(), ErrorCode::INVALID_PARAMS);
+
+    std::unique_ptr<MasterService> disabled(new MasterService());
+    results = disabled->BatchPutDiskReplica({"recovered"},
+                                            {{"/data/log/0.data", 2048, 0}});
+    EXPECT_EQ(results[0].error(), ErrorCode::UNAVAILABLE_IN_CURRENT_MODE);
+}
+
+TEST_F(MasterServiceTest, CompactionRelocatesFragmentedSegment) {
+    const uint64_t kv_lease_ttl = 100;
+    std::unique_ptr<MasterService> service_(
+        new MasterService({.enable_gc = false,
+                           .default_kv_lease_ttl = kv_lease_ttl,
+                           .buffer_allocator_type = BufferAllocatorType::OFFSET,
+                           .compaction_fragmentation_ratio = 0.3}));
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t segment_size = 1024 * 1024 * 16;
+    constexpr size_t value_size = 1024 * 1024;
+    Segment segment(generate_uuid(), "test_segment", buffer, segment_size);
+    ASSERT_TRUE(service_->MountSegment(segment, generate_uuid()).has_value());
+
+    // Nothing to do while the free space is one region
+    ReplicateConfig config;
+    config.replica_num = 1;
+    for (int i = 0; i < 12; ++i) {
+        std::string key = "key" + std::to_string(i);
+        ASSERT_TRUE(service_->PutStart(key, {value_size}, config).has_value());
+        ASSERT_TRUE(service_->PutEnd(key).has_value());
+    }
+    EXPECT_EQ(service_->CompactionStart().error(),
+              ErrorCode::OBJECT_NOT_FOUND);
+
+    // Punch holes in the segment
+    for (int i = 0; i < 12; i += 2) {
+        ASSERT_TRUE(service_->Remove("key" + std::to_string(i)).has_value());
+    }
+    auto fragmentation = service_->GetSegmentFragmentation();
+    ASSERT_EQ(fragmentation.size(), 1u);
+    EXPECT_GT(fragmentation[0].second, 0.3);
+
+    // Readers use the source until the copy is finished
+    auto task = service_->CompactionStart();
+    ASSERT_TRUE(task.has_value());
+    auto source = task->source.get_memory_descriptor().buffer_descriptors;
+    auto target = task->target.get_memory_descriptor().buffer_descriptors;
+    ASSERT_EQ(source.size(), 1u);
+    ASSERT_EQ(target.size(), 1u);
+    EXPECT_EQ(target[0].size_, value_size);
+    EXPECT_NE(target[0].buffer_address_, source[0].buffer_address_);
+    auto replicas = service_->GetReplicaList(task->key);
+    ASSERT_TRUE(replicas.has_value());
+    ASSERT_EQ(replicas->size(), 1u);
+    EXPECT_EQ(replicas->front()
+                  .get_memory_descriptor()
+                  .buffer_descriptors[0]
+                  .buffer_address_,
+              source[0].buffer_address_);
+    EXPECT_EQ(service_->Remove(task->key).error(),
+              ErrorCode::OBJECT_HAS_LEASE);
+
+    // The source is freed once the lease granted above expires
+    auto used = service_->QuerySegments("test_segment");
+    ASSERT_TRUE(used.has_value());
+    EXPECT_EQ(used->first, 7 * value_size);
+    ASSERT_TRUE(service_->CompactionEnd(task->key).has_value());
+    EXPECT_EQ(service_->CompactionEnd(task->key).error(),
+              ErrorCode::INVALID_PARAMS);
+    replicas = service_->GetReplicaList(task->key);
+    ASSERT_TRUE(replicas.has_value());
+    ASSERT_EQ(replicas->size(), 1u);
+    EXPECT_EQ(replicas->front()
+                  .get_memory_descriptor()
+                  .buffer_descriptors[0]
+                  .buffer_address_,
+              target[0].buffer_address_);
+    EXPECT_EQ(service_->QuerySegments("test_segment")->first,
+              7 * value_size);
+    std::this_thread::sleep_for(std::chrono::milliseconds(kv_lease_ttl * 3));
+    EXPECT_EQ(service_->QuerySegments("test_segment")->first,
+              6 * value_size);
+
+    // A revoked relocation leaves the object where it was
+    auto revoked = service_->CompactionStart();
+    ASSERT_TRUE(revoked.has_value());
+    ASSERT_TRUE(service_->CompactionRevoke(revoked->key).has_value());
+    EXPECT_EQ(service_->CompactionRevoke(revoked->key).error(),
+              ErrorCode::INVALID_PARAMS);
+    replicas = service_->GetReplicaList(revoked->key);
+    ASSERT_TRUE(replicas.has_value());
+    ASSERT_EQ(replicas->size(), 1u);
+    EXPECT_EQ(replicas->front()
+                  .get_memory_descriptor()
+                  .buffer_descriptors[0]
+                  .buffer_address_,
+              revoked->source.get_memory_descriptor()
+                  .buffer_descriptors[0]
+                  .buffer_address_);
+    EXPECT_EQ(service_->CompactionEnd("missing").error(),
+              ErrorCode::OBJECT_NOT_FOUND);
+}
+
+TEST_F(MasterServiceTest, HotKeyReplication) {
+    const uint64_t kv_lease_ttl = 100;
+    std::unique_ptr<MasterService> service_(
+        new MasterService({.enable_gc = false,
+                           .default_kv_lease_ttl = kv_lease_ttl,
+                           .buffer_allocator_type = BufferAllocatorType::OFFSET,
+                           .hot_replica_read_rate = 100}));
+    constexpr size_t segment_size = 1024 * 1024 * 16;
+    constexpr size_t value_size = 1024 * 1024;
+    for (int i = 0; i < 2; ++i) {
+        Segment segment(generate_uuid(), "segment" + std::to_string(i),
+                        0x300000000 + i * segment_size, segment_size);
+        ASSERT_TRUE(
+            service_->MountSegment(segment, generate_uuid()).has_value());
+    }
+    ReplicateConfig config;
+    config.replica_num = 1;
+    ASSERT_TRUE(service_->PutStart("hot", {value_size}, config).has_value());
+    ASSERT_TRUE(service_->PutEnd("hot").has_value());
+    ASSERT_TRUE(service_->PutStart("cold", {value_size}, config).has_value());
+    ASSERT_TRUE(service_->PutEnd("cold").has_value());
+    auto placed = service_->GetReplicaList("hot");
+    ASSERT_TRUE(placed.has_value());
+    const std::string source_segment = placed->front()
+                                           .get_memory_descriptor()
+                                           .buffer_descriptors[0]
+                                           .segment_name_;
+
+    // Nothing is hot before a window of reads is over
+    for (int i = 0; i < 2000; ++i) {
+        ASSERT_TRUE(service_->GetReplicaList("hot").has_value());
+    }
+    EXPECT_EQ(service_->CompactionStart().error(),
+              ErrorCode::OBJECT_NOT_FOUND);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1200));
+
+    // A copy on the other segment, the source stays
+    auto task = service_->CompactionStart();
+    ASSERT_TRUE(task.has_value());
+    EXPECT_EQ(task->key, "hot");
+    auto target = task->target.get_memory_descriptor().buffer_descriptors;
+    ASSERT_EQ(target.size(), 1u);
+    EXPECT_NE(target[0].segment_name_, source_segment);
+    const auto target_used =
+        service_->QuerySegments(target[0].segment_name_)->first;
+    EXPECT_EQ(service_->CompactionStart().error(),
+              ErrorCode::OBJECT_NOT_FOUND);
+    ASSERT_TRUE(service_->CompactionEnd("hot").has_value());
+
+    // Readers are spread over both copies
+    std::unordered_set<std::string> first_segments;
+    for (int i = 0; i < 4; ++i) {
+        auto replicas = service_->GetReplicaList("hot");
+        ASSERT_TRUE(replicas.has_value());
+        ASSERT_EQ(replicas->size(), 2u);
+        first_segments.insert(replicas->front()
+                                  .get_memory_descriptor()
+                                  .buffer_descriptors[0]
+                                  .segment_name_);
+    }
+    EXPECT_EQ(first_segments.size(), 2u);
+    auto replicas = service_->GetReplicaList("cold");
+    ASSERT_TRUE(replicas.has_value());
+    EXPECT_EQ(replicas->size(), 1u);
+
+    // The copy is removed once the reads stop, and freed after the lease
+    std::this_thread::sleep_for(std::chrono::milliseconds(2200));
+    replicas = service_->GetReplicaList("hot");
+    ASSERT_TRUE(replicas.has_value());
+    ASSERT_EQ(replicas->size(), 1u);
+    EXPECT_EQ(replicas->front()
+                  .get_memory_descriptor()
+                  .buffer_descriptors[0]
+                  .segment_name_,
+              source_segment);
+    std::this_thread::sleep_for(std::chrono::milliseconds(kv_lease_ttl * 3));
+    EXPECT_EQ(service_->QuerySegments(target[0].segment_name_)->first,
+              target_used - value_size);
+}
+
+TEST_F(MasterServiceTest, CopyAndMigrateReplica) {
+    const uint64_t kv_lease_ttl = 100;
+    std::unique_ptr<MasterService> service_(new MasterService(
+        {.enable_gc = false,
+         .default_kv_lease_ttl = kv_lease_ttl,
+         .buffer_allocator_type = BufferAllocatorType::OFFSET}));
+    constexpr size_t segment_size = 1024 * 1024 * 16;
+    constexpr size_t value_size = 1024 * 1024;
+    for (int i = 0; i < 3; ++i) {
+        Segment segment(generate_uuid(), "segment" + std::to_string(i),
+                        0x300000000 + i * segment_size, segment_size);
+        ASSERT_TRUE(
+            service_->MountSegment(segment, generate_uuid()).has_value());
+    }
+    ReplicateConfig config;
+    config.replica_num = 1;
+    ASSERT_TRUE(service_->PutStart("key", {value_size}, config).has_value());
+    ASSERT_TRUE(service_->PutEnd("key").has_value());
+    auto segment_of = [](const Replica::Descriptor& replica) {
+        return replica.get_memory_descriptor()
+            .buffer_descriptors[0]
+            .segment_name_;
+    };
+    auto replica_segments = [&]() {
+        std::set<std::string> segments;
+        auto replicas = service_->GetReplicaList("key");
+        EXPECT_TRUE(replicas.has_value());
+        if (replicas) {
+            for (const auto& replica : *replicas) {
+                segments.insert(segment_of(replica));
+            }
+        }
+        return segments;
+    };
+    const std::string source = *replica_segments().begin();
+    const std::string target = source == "segment0" ? "segment1" : "segment0";
+
+    EXPECT_EQ(service_->CopyReplica("missing", target).error(),
+              ErrorCode::OBJECT_NOT_FOUND);
+    EXPECT_EQ(service_->CopyReplica("key", source).error(),
+              ErrorCode::INVALID_PARAMS);
+    EXPECT_EQ(service_->CopyReplica("key", "segment9").error(),
+              ErrorCode::SEGMENT_NOT_FOUND);
+    EXPECT_EQ(service_->MigrateReplica("key", target, "").error(),
+              ErrorCode::INVALID_PARAMS);
+
+    // Queued for the client of the source, even with compaction disabled
+    ASSERT_TRUE(service_->CopyReplica("key", target).has_value());
+    EXPECT_EQ(service_->CopyReplica("key", target).error(),
+              ErrorCode::REPLICA_IS_NOT_READY);
+    EXPECT_EQ(service_->CompactionStart(target).error(),
+              ErrorCode::UNAVAILABLE_IN_CURRENT_MODE);
+    auto task = service_->CompactionStart(source);
+    ASSERT_TRUE(task.has_value());
+    EXPECT_EQ(task->key, "key");
+    EXPECT_EQ(segment_of(task->source), source);
+    EXPECT_EQ(segment_of(task->target), target);
+    EXPECT_EQ(replica_segments(), std::set<std::string>{source});
+    ASSERT_TRUE(service_->CompactionEnd("key").has_value());
+    EXPECT_EQ(replica_segments(), (std::set<std::string>{source, target}));
+
+    // The source is freed once the leases expire
+    ASSERT_TRUE(service_->MigrateReplica("key", source, "").has_value());
+    task = service_->CompactionStart(source);
+    ASSERT_TRUE(task.has_value());
+    EXPECT_EQ(segment_of(task->source), source);
+    const std::string third = segment_of(task->target);
+    EXPECT_NE(third, source);
+    EXPECT_NE(third, target);
+    ASSERT_TRUE(service_->CompactionEnd("key").has_value());
+    EXPECT_EQ(replica_segments(), (std::set<std::string>{target, third}));
+    std::this_thread::sleep_for(std::chrono::milliseconds(kv_lease_ttl * 3));
+    EXPECT_EQ(service_->QuerySegments(source)->first, 0u);
+}
+
+TEST_F(MasterServiceTest, PrefetchAndCancel) {
+    std::unique_ptr<MasterService> service_(new MasterService());
+    constexpr size_t segment_size = 1024 * 1024 * 16;
+    constexpr size_t value_size = 1024 * 1024;
+    for (int i = 0; i < 2; ++i) {
+        Segment segment(generate_uuid(), "segment" + std::to_string(i),
+                        0x300000000 + i * segment_size, segment_size);
+        ASSERT_TRUE(
+            service_->MountSegment(segment, generate_uuid()).has_value());
+    }
+    ReplicateConfig config;
+    config.replica_num = 1;
+    for (const std::string key : {"key0", "key1"}) {
+        ASSERT_TRUE(service_->PutStart(key, {value_size}, config));
+        ASSERT_TRUE(service_->PutEnd(key));
+    }
+    auto segment_of = [&](const std::string& key) {
+        auto replicas = service_->GetReplicaList(key);
+        EXPECT_TRUE(replicas.has_value());
+        return replicas->front()
+            .get_memory_descriptor()
+            .buffer_descriptors[0]
+            .segment_name_;
+    };
+    const std::string source = segment_of("key0");
+    const std::string target = source == "segment0" ? "segment1" : "segment0";
+
+    auto results = service_->Prefetch({"key0"}, "");
+    EXPECT_EQ(results[0].error(), ErrorCode::INVALID_PARAMS);
+    results = service_->Prefetch({"key0", "missing"}, target);
+    ASSERT_EQ(results.size(), 2u);
+    EXPECT_TRUE(results[0].has_value());
+    EXPECT_EQ(results[1].error(), ErrorCode::OBJECT_NOT_FOUND);
+    // Being copied, or there already
+    EXPECT_TRUE(service_->Prefetch({"key0"}, target)[0].has_value());
+    EXPECT_TRUE(service_->Prefetch({"key0"}, source)[0].has_value());
+
+    auto task = service_->CompactionStart(source);
+    ASSERT_TRUE(task.has_value());
+    EXPECT_EQ(task->key, "key0");
+    ASSERT_TRUE(service_->CompactionEnd("key0").has_value());
+    EXPECT_EQ(service_->GetReplicaList("key0")->size(), 2u);
+
+    // Only prefetches not handed out yet are dropped
+    const std::string source1 = segment_of("key1");
+    const std::string target1 =
+        source1 == "segment0" ? "segment1" : "segment0";
+    ASSERT_TRUE(service_->Prefetch({"key1"}, target1)[0].has_value());
+    auto cancelled = service_->CancelPrefetch({"key1", "key0"}, target1);
+    ASSERT_EQ(cancelled.size(), 2u);
+    EXPECT_TRUE(cancelled[0].value());
+    EXPECT_FALSE(cancelled[1].value());
+    EXPECT_FALSE(service_->CompactionStart(source1).has_value());
+    EXPECT_EQ(service_->GetReplicaList("key1")->size(), 1u);
+    ASSERT_TRUE(service_->Prefetch({"key1"}, target1)[0].has_value());
+    task = service_->CompactionStart(source1);
+    ASSERT_TRUE(task.has_value());
+    EXPECT_FALSE(service_->CancelPrefetch({"key1"}, "")[0].value());
+    ASSERT_TRUE(service_->CompactionEnd("key1").has_value());
+    EXPECT_EQ(service_->GetReplicaList("key1")->size(), 2u);
+}
+
+TEST_F(MasterServiceTest, ChainReplication) {
+    std::unique_ptr<MasterService> service_(new MasterService());
+    constexpr size_t segment_size = 1024 * 1024 * 16;
+    constexpr size_t value_size = 1024 * 1024;
+    for (int i = 0; i < 3; ++i) {
+        Segment segment(generate_uuid(), "segment" + std::to_string(i),
+                        0x300000000 + i * segment_size, segment_size);
+        ASSERT_TRUE(
+            service_->MountSegment(segment, generate_uuid()).has_value());
+    }
+    auto segment_of = [](const Replica::Descriptor& replica) {
+        return replica.get_memory_descriptor()
+            .buffer_descriptors[0]
+            .segment_name_;
+    };
+
+    // The client writes the head of the chain only
+    ReplicateConfig config;
+    config.replica_num = 3;
+    config.chain_replication = true;
+    auto head = service_->PutStart("key", {value_size}, config);
+    ASSERT_TRUE(head.has_value());
+    ASSERT_EQ(head->size(), 1u);
+    std::string previous = segment_of(head->front());
+    EXPECT_EQ(service_->CompactionStart(previous).error(),
+              ErrorCode::UNAVAILABLE_IN_CURRENT_MODE);
+    ASSERT_TRUE(service_->PutEnd("key").has_value());
+    ASSERT_EQ(service_->GetReplicaList("key")->size(), 1u);
+
+    // Each replica is forwarded by the client holding the one before
+    std::set<std::string> segments{previous};
+    for (size_t replicas = 2; replicas <= 3; ++replicas) {
+        auto task = service_->CompactionStart(previous);
+        ASSERT_TRUE(task.has_value());
+        EXPECT_EQ(task->key, "key");
+        EXPECT_EQ(segment_of(task->source), previous);
+        previous = segment_of(task->target);
+        EXPECT_TRUE(segments.insert(previous).second);
+        ASSERT_TRUE(service_->CompactionEnd("key").has_value());
+        auto replica_list = service_->GetReplicaList("key");
+        ASSERT_TRUE(replica_list.has_value());
+        EXPECT_EQ(replica_list->size(), replicas);
+    }
+    EXPECT_EQ(service_->CompactionStart(previous).error(),
+              ErrorCode::UNAVAILABLE_IN_CURRENT_MODE);
+
+    // A revoked forward ends the chain, the object keeps its head
+    ASSERT_TRUE(service_->PutStart("broken", {value_size}, config));
+    ASSERT_TRUE(service_->PutEnd("broken").has_value());
+    tl::expected<CompactionTask, ErrorCode> task =
+        tl::make_unexpected(ErrorCode::OBJECT_NOT_FOUND);
+    for (const auto& segment : {"segment0", "segment1", "segment2"}) {
+        task = service_->CompactionStart(segment);
+        if (task) {
+            break;
+        }
+    }
+    ASSERT_TRUE(task.has_value());
+    ASSERT_TRUE(service_->CompactionRevoke("broken").has_value());
+    EXPECT_EQ(service_->GetReplicaList("broken")->size(), 1u);
+    for (const auto& segment : {"segment0", "segment1", "segment2"}) {
+        EXPECT_FALSE(service_->CompactionStart(segment).has_value());
+    }
+}
+
+TEST_F(MasterServiceTest, BroadcastReplica) {
+    std::unique_ptr<MasterService> service_(new MasterService());
+    constexpr size_t segment_size = 1024 * 1024 * 16;
+    constexpr size_t value_size = 1024 * 1024;
+    constexpr size_t kSegments = 8;
+    for (size_t i = 0; i < kSegments; ++i) {
+        Segment segment(generate_uuid(), "segment" + std::to_string(i),
+                        0x300000000 + i * segment_size, segment_size);
+        ASSERT_TRUE(
+            service_->MountSegment(segment, generate_uuid()).has_value());
+    }
+    ReplicateConfig config;
+    ASSERT_TRUE(service_->PutStart("key", {value_size}, config).has_value());
+    ASSERT_TRUE(service_->PutEnd("key").has_value());
+    auto first_buffer = [](const Replica::Descriptor& replica) {
+        return replica.get_memory_descriptor().buffer_descriptors[0];
+    };
+
+    EXPECT_EQ(service_->Broadcast("missing", {}).error(),
+              ErrorCode::OBJECT_NOT_FOUND);
+    EXPECT_EQ(service_->Broadcast("key", {"segment1", "segment9"}).error(),
+              ErrorCode::SEGMENT_NOT_FOUND);
+    auto count = service_->Broadcast("key", {});
+    ASSERT_TRUE(count.has_value());
+    EXPECT_EQ(*count, kSegments - 1);
+
+    // Every replica copies once per round, all copies of a round in flight
+    // together
+    size_t replicas = 1;
+    int rounds = 0;
+    while (true) {
+        std::vector<CompactionTask> tasks;
+        for (size_t i = 0; i < kSegments; ++i) {
+            const std::string segment = "segment" + std::to_string(i);
+            auto task = service_->CompactionStart(segment);
+            if (task) {
+                EXPECT_EQ(first_buffer(task->source).segment_name_, segment);
+                tasks.push_back(std::move(*task));
+            }
+        }
+        if (tasks.empty()) {
+            break;
+        }
+        ++rounds;
+        EXPECT_EQ(tasks.size(), std::min(replicas, kSegments - replicas));
+        for (const auto& task : tasks) {
+            ASSERT_TRUE(service_
+                            ->CompactionEnd(task.key,
+                                            first_buffer(task.target)
+                                                .buffer_address_)
+                            .has_value());
+        }
+        replicas += tasks.size();
+    }
+    EXPECT_EQ(rounds, 3);
+    auto replica_list = service_->GetReplicaList("key");
+    ASSERT_TRUE(replica_list.has_value());
+    std::set<std::string> segments;
+    for (const auto& replica : *replica_list) {
+        segments.insert(first_buffer(replica).segment_name_);
+    }
+    EXPECT_EQ(segments.size(), kSegments);
+    EXPECT_EQ(service_->Broadcast("key", {}).value(), 0u);
+}
+
+TEST_F(MasterServiceTest, DrainSegment) {
+    const uint64_t kv_lease_ttl = 100;
+    std::unique_ptr<MasterService> service_(new MasterService(
+        {.enable_gc = false,
+         .default_kv_lease_ttl = kv_lease_ttl,
+         .buffer_allocator_type = BufferAllocatorType::OFFSET}));
+    constexpr size_t segment_size = 1024 * 1024 * 16;
+    constexpr size_t value_size = 1024 * 1024;
+    std::vector<Segment> segments;
+    const UUID client_id = generate_uuid();
+    for (int i = 0; i < 3; ++i) {
+        segments.emplace_back(generate_uuid(), "segment" + std::to_string(i),
+                              0x300000000 + i * segment_size, segment_size);
+        ASSERT_TRUE(
+            service_->MountSegment(segments.back(), client_id).has_value());
+    }
+    ReplicateConfig config;
+    config.replica_num = 1;
+    for (int i = 0; i < 12; ++i) {
+        const std::string key = "key" + std::to_string(i);
+        ASSERT_TRUE(service_->PutStart(key, {value_size}, config).has_value());
+        ASSERT_TRUE(service_->PutEnd(key).has_value());
+    }
+    const Segment& drained = segments[0];
+    auto used = service_->QuerySegments(drained.name);
+    ASSERT_TRUE(used.has_value());
+    ASSERT_GT(used->first, 0u);
+
+    EXPECT_EQ(service_->QueryDrain(drained.id).error(),
+              ErrorCode::SEGMENT_NOT_FOUND);
+    EXPECT_EQ(service_->DrainSegment(generate_uuid()).error(),
+              ErrorCode::SEGMENT_NOT_FOUND);
+    ASSERT_TRUE(service_->DrainSegment(drained.id).has_value());
+    ASSERT_TRUE(service_->DrainSegment(drained.id).has_value());
+    EXPECT_EQ(service_->QueryDrain(drained.id).value(), used->first);
+
+    // New objects go elsewhere
+    for (int i = 0; i < 4; ++i) {
+        const std::string key = "new_key" + std::to_string(i);
+        auto replicas = service_->PutStart(key, {value_size}, config);
+        ASSERT_TRUE(replicas.has_value());
+        EXPECT_NE(replicas->front()
+                      .get_memory_descriptor()
+                      .buffer_descriptors[0]
+                      .segment_name_,
+                  drained.name);
+        ASSERT_TRUE(service_->PutEnd(key).has_value());
+    }
+
+    // The client of the segment copies what the master queues
+    for (int round = 0; round < 100; ++round) {
+        auto task = service_->CompactionStart(drained.name);
+        if (task) {
+            ASSERT_TRUE(service_->CompactionEnd(task->key).has_value());
+            continue;
+        }
+        if (service_->QueryDrain(drained.id).value() == 0) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    EXPECT_EQ(service_->QueryDrain(drained.id).value(), 0u);
+
+    ASSERT_TRUE(
+        service_->UnmountSegment(drained.id, client_id).has_value());
+    for (int i = 0; i < 12; ++i) {
+        EXPECT_TRUE(
+            service_->GetReplicaList("key" + std::to_string(i)).has_value());
+    }
+}
+
+TEST_F(MasterServiceTest, CompactionDisabled) {
+    std::unique_ptr<MasterService> service_(new MasterService());
+    EXPECT_EQ(service_->CompactionStart().error(),
+              ErrorCode::UNAVAILABLE_IN_CURRENT_MODE);
+}
+
+TEST_F(MasterServiceTest, ClockEvictSoftPinObjectsLast) {
+    const uint64_t kv_lease_ttl = 200;
+    // set a large soft_pin_ttl so the granted soft pin will not quickly expire
+    const uint64_t kv_soft_pin_ttl = 10000;
+    const double eviction_ratio = 0.5;
+    std::unique_ptr<MasterService> service_(
+        new MasterService({.enable_gc = false,
+                           .default_kv_lease_ttl = kv_lease_ttl,
+                           .default_kv_soft_pin_ttl = kv_soft_pin_ttl,
+                           .allow_evict_soft_pinned_objects = true,
+                           .eviction_ratio = eviction_ratio,
+                           .eviction_engine = EvictionEngine::CLOCK}));
+
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t segment_size = 1024 * 1024 * 16;
+    constexpr size_t value_size = 1024 * 1024;
+    std::string segment_name = "test_segment";
+    Segment segment(generate_uuid(), segment_name, buffer, segment_size);
+    UUID client_id = generate_uuid();
+    ASSERT_TRUE(service_->MountSegment(segment, client_id).has_value());
+
+    for (int i = 0; i < 2; i++) {
+        std::string pin_key = "pin_key" + std::to_string(i);
+        ReplicateConfig soft_pin_config;
+        soft_pin_config.replica_num = 1;
+        soft_pin_config.with_soft_pin = true;
+        ASSERT_TRUE(service_->PutStart(pin_key, {value_size}, soft_pin_config)
+                        .has_value());
+        ASSERT_TRUE(service_->PutEnd(pin_key).has_value());
+    }
+
+    // Fill the segment to trigger eviction
+    int failed_puts = 0;
+    for (int i = 0; i < 20; i++) {
+        std::string key = "key" + std::to_string(i);
+        ReplicateConfig config;
+        config.replica_num = 1;
+        if (service_->PutStart(key, {value_size}, config).has_value()) {
+            ASSERT_TRUE(service_->PutEnd(key).has_value());
+        } else {
+            failed_puts++;
+        }
+    }
+    ASSERT_GT(failed_puts, 0);
+    // wait for gc thread to do eviction
+    std::this_thread::sleep_for(std::chrono::milliseconds(kv_lease_ttl + 1000));
+    // Evicting unpinned objects is enough, so pinned objects must survive
+    for (int i = 0; i < 2; i++) {
+        std::string pin_key = "pin_key" + std::to_string(i);
+        ASSERT_TRUE(service_->GetReplicaList(pin_key).has_value());
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(kv_lease_ttl));
+    service_->RemoveAll();
+}
+
+TEST_F(MasterServiceTest, BatchExistKeyTest) {
+    std::unique_ptr<MasterService> service_(new MasterService());
+
+    // Mount a segment
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t size = 1024 * 1024 * 128;
+    constexpr size_t value_size = 1024;
+    std::string segment_name = "test_segment";
+    Segment segment(generate_uuid(), segment_name, buffer, size);
+    UUID client_id = generate_uuid();
+    auto mount_result = service_->MountSegment(segment, client_id);
+    ASSERT_TRUE(mount_result.has_value());
+
+    int test_object_num = 10;
+    std::vector<std::string> test_keys;
+    for (int i = 0; i < test_object_num; ++i) {
+        test_keys.push_back("test_key" + std::to_string(i));
+        ReplicateConfig config;
+        config.replica_num = 1;
+        std::vector<uint64_t> slice_lengths = {value_size};
+        auto put_start_result =
+            service_->PutStart(test_keys[i], slice_lengths, config);
+        ASSERT_TRUE(put_start_result.has_value());
+        auto put_end_result = service_->PutEnd(test_keys[i]);
+        ASSERT_TRUE(put_end_result.has_value());
+    }
+
+    // Test individual ExistKey calls to verify the underlying functionality
+    for (int i = 0; i < test_object_num; ++i) {
+        auto exist_result = service_->ExistKey(test_keys[i]);
+        EXPECT_TRUE(exist_result.value());
+    }
+
+    // Tets batch
+    test_keys.push_back("non_existent_key");
+    auto exist_resp = service_->BatchExistKey(test_keys);
+    for (int i = 0; i < test_object_num; ++i) {
+        ASSERT_TRUE(exist_resp[i].value());
+    }
+    ASSERT_FALSE(exist_resp[test_object_num].value());
+}
+
+TEST_F(MasterServiceTest, LongestPrefixMatchTest) {
+    std::unique_ptr<MasterService> service_(new MasterService());
+
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t size = 1024 * 1024 * 128;
+    constexpr size_t value_size = 1024;
+    Segment segment(generate_uuid(), "test_segment", buffer, size);
+    UUID client_id = generate_uuid();
+    ASSERT_TRUE(service_->MountSegment(segment, client_id).has_value());
+
+    ReplicateConfig config;
+    config.replica_num = 1;
+    std::vector<uint64_t> slice_lengths = {value_size};
+    std::vector<std::string> keys;
+    for (int i = 0; i < 6; ++i) {
+        keys.push_back("block_" + std::to_string(i));
+    }
+    // block_0..2 are complete, block_3 is missing, block_4 is complete
+    for (int i : {0, 1, 2, 4}) {
+        ASSERT_TRUE(
+            service_->PutStart(keys[i], slice_lengths, config).has_value());
+        ASSERT_TRUE(service_->PutEnd(keys[i]).has_value());
+    }
+
+    auto result = service_->LongestPrefixMatch(keys, false);
+    ASSERT_TRUE(result.has_value());
+    EXPECT_EQ(result->matched, 3);
+    EXPECT_TRUE(result->replica_lists.empty());
+
+    result = service_->LongestPrefixMatch(keys, true);
+    ASSERT_TRUE(result.has_value());
+    EXPECT_EQ(result->matched, 3);
+    ASSERT_EQ(result->replica_lists.size(), 3);
+    for (const auto& replicas : result->replica_lists) {
+        ASSERT_EQ(replicas.size(), 1);
+        EXPECT_TRUE(replicas[0].is_memory_replica());
+    }
+
+    // A key still being written stops the match as well
+    ASSERT_TRUE(
+        service_->PutStart(keys[3], slice_lengths, config).has_value());
+    result = service_->LongestPrefixMatch(keys, false);
+    ASSERT_TRUE(result.has_value());
+    EXPECT_EQ(result->matched, 3);
+
+    ASSERT_TRUE(service_->PutEnd(keys[3]).has_value());
+    result = service_->LongestPrefixMatch(keys, false);
+    ASSERT_TRUE(result.has_value());
+    EXPECT_EQ(result->matched, 5);
+
+    result = service_->LongestPrefixMatch({}, true);
+    ASSERT_TRUE(result.has_value());
+    EXPECT_EQ(result->matched, 0);
+    EXPECT_TRUE(result->replica_lists.empty());
+}
+
+TEST_F(MasterServiceTest, BatchQueryLocationTest) {
+    std::unique_ptr<MasterService> service_(new MasterService());
+
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t size = 1024 * 1024 * 128;
+    constexpr size_t value_size = 1024;
+    Segment segment_a(generate_uuid(), "segment_a", buffer, size);
+    Segment segment_b(generate_uuid(), "segment_b", buffer + size, size);
+    UUID client_id = generate_uuid();
+    ASSERT_TRUE(service_->MountSegment(segment_a, client_id).has_value());
+    ASSERT_TRUE(service_->MountSegment(segment_b, client_id).has_value());
+
+    std::vector<uint64_t> slice_lengths = {value_size};
+    std::vector<std::string> keys;
+    for (int i = 0; i < 5; ++i) {
+        keys.push_back("block_" + std::to_string(i));
+    }
+    // block_0 on both segments, block_1 and block_4 on segment_a, block_2
+    // on segment_b, block_3 missing
+    ReplicateConfig config;
+    config.replica_num = 2;
+    ASSERT_TRUE(
+        service_->PutStart(keys[0], slice_lengths, config).has_value());
+    ASSERT_TRUE(service_->PutEnd(keys[0]).has_value());
+    config.replica_num = 1;
+    const std::vector<std::pair<int, std::string>> placements = {
+        {1, "segment_a"}, {2, "segment_b"}, {4, "segment_a"}};
+    for (const auto& [i, segment_name] : placements) {
+        config.preferred_segment = segment_name;
+        ASSERT_TRUE(
+            service_->PutStart(keys[i], slice_lengths, config).has_value());
+        ASSERT_TRUE(service_->PutEnd(keys[i]).has_value());
+    }
+
+    auto result = service_->BatchQueryLocation(keys, true);
+    ASSERT_TRUE(result.has_value());
+    ASSERT_EQ(result->segments.size(), 2);
+    ASSERT_EQ(result->locations.size(), keys.size());
+    ASSERT_EQ(result->prefix_hits.size(), 2);
+    auto names_of = [&](size_t i) {
+        std::set<std::string> names;
+        for (uint32_t segment : result->locations[i]) {
+            names.insert(result->segments.at(segment));
+        }
+        return names;
+    };
+    EXPECT_EQ(names_of(0),
+              (std::set<std::string>{"segment_a", "segment_b"}));
+    EXPECT_EQ(names_of(1), std::set<std::string>{"segment_a"});
+    EXPECT_EQ(names_of(2), std::set<std::string>{"segment_b"});
+    EXPECT_TRUE(result->locations[3].empty());
+    EXPECT_EQ(names_of(4), std::set<std::string>{"segment_a"});
+    for (size_t segment = 0; segment < result->segments.size(); ++segment) {
+        EXPECT_EQ(result->prefix_hits[segment],
+                  result->segments[segment] == "segment_a" ? 2 : 1);
+    }
+
+    // Objects still being written are not located
+    ASSERT_TRUE(
+        service_->PutStart(keys[3], slice_lengths, config).has_value());
+    result = service_->BatchQueryLocation(keys, false);
+    ASSERT_TRUE(result.has_value());
+    EXPECT_TRUE(result->locations[3].empty());
+    EXPECT_TRUE(result->prefix_hits.empty());
+
+    result = service_->BatchQueryLocation({}, true);
+    ASSERT_TRUE(result.has_value());
+    EXPECT_TRUE(result->segments.empty());
+    EXPECT_TRUE(result->locations.empty());
+}
+
+TEST_F(MasterServiceTest, ScanKeysTest) {
+    std::unique_ptr<MasterService> service_(new MasterService());
+
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t size = 1024 * 1024 * 16;
+    constexpr size_t value_size = 1024;
+    Segment segment(generate_uuid(), "test_segment", buffer, size);
+    UUID client_id = generate_uuid();
+    ASSERT_TRUE(service_->MountSegment(segment, client_id).has_value());
+
+    ReplicateConfig config;
+    config.replica_num = 1;
+    std::set<std::string> expected;
+    for (int i = 0; i < 100; ++i) {
+        for (const std::string prefix : {"a/", "b/"}) {
+            std::string key = prefix + std::to_string(i);
+            ASSERT_TRUE(service_->PutStart(key, {value_size}, config));
+            ASSERT_TRUE(service_->PutEnd(key));
+            if (prefix == "a/") {
+                expected.insert(key);
+            }
+        }
+    }
+
+    // Pages end within shards and across them, every key comes once
+    std::set<std::string> scanned;
+    std::string cursor;
+    int pages = 0;
+    do {
+        auto page = service_->ScanKeys("a/", cursor, 7);
+        ASSERT_TRUE(page.has_value());
+        EXPECT_LE(page->keys.size(), 7);
+        for (const auto& key : page->keys) {
+            EXPECT_TRUE(scanned.insert(key).second) << key;
+        }
+        cursor = page->next_cursor;
+        ++pages;
+    } while (!cursor.empty());
+    EXPECT_EQ(scanned, expected);
+    EXPECT_GE(pages, 100 / 7);
+
+    auto all = service_->ScanKeys("", "", MasterService::kMaxScanKeys);
+    ASSERT_TRUE(all.has_value());
+    EXPECT_EQ(all->keys.size(), 200);
+    EXPECT_TRUE(all->next_cursor.empty());
+
+    EXPECT_EQ(service_->ScanKeys("", "", 0).error(),
+              ErrorCode::INVALID_PARAMS);
+    EXPECT_EQ(service_->ScanKeys("", "x:key", 10).error(),
+              ErrorCode::INVALID_PARAMS);
+    EXPECT_EQ(service_->ScanKeys("", "1048576", 10).error(),
+              ErrorCode::INVALID_PARAMS);
+}
+
+TEST_F(MasterServiceTest, MetadataChangesTest) {
+    std::unique_ptr<MasterService> service_(new MasterService());
+
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t size = 1024 * 1024 * 16;
+    constexpr size_t value_size = 1024;
+    Segment segment(generate_uuid(), "test_segment", buffer, size);
+    UUID client_id = generate_uuid();
+    ASSERT_TRUE(service_->MountSegment(segment, client_id).has_value());
+
+    ReplicateConfig config;
+    config.replica_num = 1;
+    ASSERT_TRUE(service_->PutStart("old_key", {value_size}, config));
+    ASSERT_TRUE(service_->PutEnd("old_key"));
+
+    // The first call has no history, the follower reloads a snapshot
+    auto changes = service_->GetMetadataChanges(0, 100);
+    ASSERT_TRUE(changes.has_value());
+    EXPECT_TRUE(changes->reset);
+    uint64_t seq = changes->next_seq;
+    std::vector<MetadataEntry> snapshot;
+    uint64_t shard = 0;
+    do {
+        auto part = service_->GetMetadataSnapshot(shard);
+        ASSERT_TRUE(part.has_value());
+        snapshot.insert(snapshot.end(), part->entries.begin(),
+                        part->entries.end());
+        shard = part->next_shard;
+    } while (shard != 0);
+    ASSERT_EQ(snapshot.size(), 1);
+    EXPECT_EQ(snapshot[0].key, "old_key");
+    EXPECT_EQ(snapshot[0].replicas.size(), 1);
+    EXPECT_FALSE(service_->GetMetadataSnapshot(1 << 20).has_value());
+
+    // An object being written is not readable yet, it changes with PutEnd
+    ASSERT_TRUE(service_->PutStart("new_key", {value_size}, config));
+    changes = service_->GetMetadataChanges(seq, 100);
+    ASSERT_TRUE(changes.has_value());
+    EXPECT_FALSE(changes->reset);
+    EXPECT_TRUE(changes->entries.empty());
+    ASSERT_TRUE(service_->PutEnd("new_key"));
+    changes = service_->GetMetadataChanges(seq, 100);
+    ASSERT_TRUE(changes.has_value());
+    ASSERT_EQ(changes->entries.size(), 1);
+    EXPECT_EQ(changes->entries[0].key, "new_key");
+    EXPECT_EQ(changes->entries[0].replicas.size(), 1);
+    EXPECT_EQ(changes->entries[0].replicas[0].status,
+              ReplicaStatus::COMPLETE);
+    seq = changes->next_seq;
+
+    ASSERT_TRUE(service_->Remove("old_key"));
+    changes = service_->GetMetadataChanges(seq, 100);
+    ASSERT_TRUE(changes.has_value());
+    ASSERT_EQ(changes->entries.size(), 1);
+    EXPECT_EQ(changes->entries[0].key, "old_key");
+    EXPECT_TRUE(changes->entries[0].replicas.empty());
+    seq = changes->next_seq;
+
+    changes = service_->GetMetadataChanges(seq, 100);
+    ASSERT_TRUE(changes.has_value());
+    EXPECT_TRUE(changes->entries.empty());
+    EXPECT_EQ(changes->next_seq, seq);
+
+    // Bulk changes are not logged one by one
+    service_->RemoveAll();
+    changes = service_->GetMetadataChanges(seq, 100);
+    ASSERT_TRUE(changes.has_value());
+    EXPECT_TRUE(changes->reset);
+}
+
+TEST_F(MasterServiceTest, KeyFilterTest) {
+    std::unique_ptr<MasterService> service_(new MasterService());
+
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t size = 1024 * 1024 * 16;
+    constexpr size_t value_size = 1024;
+    Segment segment(generate_uuid(), "test_segment", buffer, size);
+    UUID client_id = generate_uuid();
+    ASSERT_TRUE(service_->MountSegment(segment, client_id).has_value());
+
+    ReplicateConfig config;
+    config.replica_num = 1;
+    ASSERT_TRUE(service_->PutStart("old_key", {value_size}, config));
+    ASSERT_TRUE(service_->PutEnd("old_key"));
+
+    // The first call sends the whole filter
+    auto update = service_->GetKeyFilter(0);
+    ASSERT_TRUE(update.has_value());
+    ASSERT_TRUE(update->reset);
+    KeyFilter filter(update->words, update->num_hashes);
+    EXPECT_TRUE(filter.MayContain("old_key"));
+    EXPECT_FALSE(filter.MayContain("new_key"));
+    uint64_t seq = update->next_seq;
+
+    // Later keys are sent as changes
+    ASSERT_TRUE(service_->PutStart("new_key", {value_size}, config));
+    ASSERT_TRUE(service_->PutEnd("new_key"));
+    update = service_->GetKeyFilter(seq);
+    ASSERT_TRUE(update.has_value());
+    EXPECT_FALSE(update->reset);
+    EXPECT_TRUE(update->words.empty());
+    ASSERT_EQ(update->keys.size(), 1);
+    EXPECT_EQ(update->keys[0], "new_key");
+    seq = update->next_seq;
+
+    update = service_->GetKeyFilter(seq);
+    ASSERT_TRUE(update.has_value());
+    EXPECT_TRUE(update->keys.empty());
+    EXPECT_EQ(update->next_seq, seq);
+
+    // Past a bulk change the whole filter is sent again
+    service_->RemoveAll();
+    update = service_->GetKeyFilter(seq);
+    ASSERT_TRUE(update.has_value());
+    EXPECT_TRUE(update->reset);
+}
+
+TEST_F(MasterServiceTest, RestoreMetadataAfterFailover) {
+    auto make_service = [](bool enable_ha) {
+        return std::make_unique<MasterService>(MasterServiceConfig{
+            .enable_ha = enable_ha,
+            .buffer_allocator_type = BufferAllocatorType::OFFSET,
+            .enable_failover_restore = true,
+        });
+    };
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t size = 1024 * 1024 * 16;
+    constexpr size_t value_size = 1024 * 1024;
+    Segment segment(generate_uuid(), "test_segment", buffer, size);
+    UUID client_id = generate_uuid();
+
+    // The copy a standby made of the old leader's metadata
+    std::vector<MetadataEntry> entries;
+    {
+        auto leader = make_service(false);
+        ASSERT_TRUE(leader->MountSegment(segment, client_id).has_value());
+        ReplicateConfig config;
+        config.replica_num = 1;
+        for (const std::string key : {"gap", "key"}) {
+            ASSERT_TRUE(leader->PutStart(key, {value_size}, config));
+            ASSERT_TRUE(leader->PutEnd(key));
+        }
+        // The memory of a removed object is not reused right away
+        ASSERT_TRUE(leader->Remove("gap"));
+        auto reput = leader->PutStart("reput", {value_size}, config);
+        ASSERT_TRUE(reput.has_value());
+        EXPECT_NE((*reput)[0]
+                      .get_memory_descriptor()
+                      .buffer_descriptors[0]
+                      .buffer_address_,
+                  buffer);
+        uint64_t shard = 0;
+        do {
+            auto part = leader->GetMetadataSnapshot(shard);
+            ASSERT_TRUE(part.has_value());
+            entries.insert(entries.end(), part->entries.begin(),
+                           part->entries.end());
+            shard = part->next_shard;
+        } while (shard != 0);
+        ASSERT_EQ(entries.size(), 1);
+        EXPECT_EQ(entries[0].key, "key");
+    }
+    const auto old_replicas = entries[0].replicas;
+    Replica::Descriptor disk;
+    disk.descriptor_variant = DiskDescriptor{"/data/disk_key", 1024};
+    disk.status = ReplicaStatus::COMPLETE;
+    entries.push_back({"disk_key", {disk}});
+
+    auto disabled = std::make_unique<MasterService>();
+    EXPECT_EQ(disabled->RestoreMetadata(entries).error(),
+              ErrorCode::UNAVAILABLE_IN_CURRENT_MODE);
+
+    // Disk replicas are restored right away, memory replicas once their
+    // client remounts the segment
+    auto service_ = make_service(true);
+    ASSERT_TRUE(service_->RestoreMetadata(entries).has_value());
+    EXPECT_TRUE(service_->ExistKey("disk_key").value());
+    EXPECT_FALSE(service_->ExistKey("key").value());
+    ASSERT_TRUE(service_->ReMountSegment({segment}, client_id).has_value());
+    auto replicas = service_->GetReplicaList("key");
+    ASSERT_TRUE(replicas.has_value());
+    ASSERT_EQ(replicas->size(), 1);
+    EXPECT_EQ((*replicas)[0]
+                  .get_memory_descriptor()
+                  .buffer_descriptors[0]
+                  .buffer_address_,
+              old_replicas[0]
+                  .get_memory_descriptor()
+                  .buffer_descriptors[0]
+                  .buffer_address_);
+
+    // New objects are not placed over the restored ones
+    ReplicateConfig config;
+    config.replica_num = 1;
+    for (int i = 0; i < 15; ++i) {
+        auto put = service_->PutStart("new_key" + std::to_string(i),
+                                      {value_size}, config);
+        ASSERT_TRUE(put.has_value());
+        const auto& desc = (*put)[0].get_memory_descriptor();
+        EXPECT_NE(desc.buffer_descriptors[0].buffer_address_,
+                  old_replicas[0]
+                      .get_memory_descriptor()
+                      .buffer_descriptors[0]
+                      .buffer_address_);
+    }
+    EXPECT_FALSE(
+        service_->PutStart("full", {value_size}, config).has_value());
+}
+
+TEST_F(MasterServiceTest, ClientExpiresWithoutPing) {
+    const int64_t client_live_ttl_sec = 1;
+    std::unique_ptr<MasterService> service_(
+        new MasterService({.enable_gc = false,
+                           .client_live_ttl_sec = client_live_ttl_sec,
+                           .enable_ha = true}));
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t size = 1024 * 1024 * 16;
+    UUID pinging_client = generate_uuid();
+    UUID silent_client = generate_uuid();
+    Segment pinging_segment(generate_uuid(), "pinging_segment", buffer, size);
+    Segment silent_segment(generate_uuid(), "silent_segment", buffer + size,
+                           size);
+    // In HA mode a client is OK once it remounted its segments
+    ASSERT_TRUE(service_->ReMountSegment({pinging_segment}, pinging_client)
+                    .has_value());
+    ASSERT_TRUE(
+        service_->ReMountSegment({silent_segment}, silent_client).has_value());
+
+    for (int i = 0; i < 6; ++i) {
+        auto ping_result = service_->Ping(pinging_client);
+        ASSERT_TRUE(ping_result.has_value());
+        EXPECT_EQ(ClientStatus::OK, ping_result->second);
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    }
+    auto ping_result = service_->Ping(silent_client);
+    ASSERT_TRUE(ping_result.has_value());
+    EXPECT_EQ(ClientStatus::NEED_REMOUNT, ping_result->second);
+    // The segment of the expired client is unmounted
+    auto segments = service_->GetAllSegments();
+    ASSERT_TRUE(segments.has_value());
+    EXPECT_EQ(std::vector<std::string>{"pinging_segment"}, segments.value());
+}
+
+TEST_F(MasterServiceTest, BatchPutAndGetTest) {
+    std::unique_ptr<MasterService> service_(new MasterService());
+
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t size = 1024 * 1024 * 16;
+    constexpr size_t value_size = 1024;
+    std::string segment_name = "test_segment";
+    Segment segment(generate_uuid(), segment_name, buffer, size);
+    UUID client_id = generate_uuid();
+    auto mount_result = service_->MountSegment(segment, client_id);
+    ASSERT_TRUE(mount_result.has_value());
+
+    ReplicateConfig config;
+    config.replica_num = 1;
+    ASSERT_TRUE(
+        service_->PutStart("existing_key", {value_size}, config).has_value());
+
+    // Enough keys to hit many shards, plus an existing, a duplicated, an
+    // invalid and an oversized key.
+    constexpr int test_object_num = 256;
+    std::vector<std::string> keys;
+    std::vector<std::vector<uint64_t>> slice_lengths;
+    for (int i = 0; i < test_object_num; ++i) {
+        keys.push_back("batch_key" + std::to_string(i));
+        slice_lengths.push_back({value_size});
+    }
+    keys.push_back("existing_key");
+    slice_lengths.push_back({value_size});
+    keys.push_back("batch_key0");
+    slice_lengths.push_back({value_size});
+    keys.push_back("");
+    slice_lengths.push_back({value_size});
+    keys.push_back("too_large_key");
+    slice_lengths.push_back({kMaxSliceSize + 1});
+
+    auto start_results = service_->BatchPutStart(keys, slice_lengths, config);
+    ASSERT_EQ(keys.size(), start_results.size());
+    for (int i = 0; i < test_object_num; ++i) {
+        ASSERT_TRUE(start_results[i].has_value());
+        EXPECT_EQ(1, start_results[i]->size());
+    }
+    EXPECT_EQ(ErrorCode::OBJECT_ALREADY_EXISTS,
+              start_results[test_object_num].error());
+    EXPECT_EQ(ErrorCode::OBJECT_ALREADY_EXISTS,
+              start_results[test_object_num + 1].error());
+    EXPECT_EQ(ErrorCode::INVALID_PARAMS,
+              start_results[test_object_num + 2].error());
+    EXPECT_EQ(ErrorCode::INVALID_PARAMS,
+              start_results[test_object_num + 3].error());
+
+    // Mismatched argument sizes fail every key
+    auto mismatch_results =
+        service_->BatchPutStart({"a", "b"}, {{value_size}}, config);
+    for (const auto& result : mismatch_results) {
+        EXPECT_EQ(ErrorCode::INVALID_PARAMS, result.error());
+    }
+
+    // Complete the even keys and revoke the odd ones
+    std::vector<std::string> end_keys, revoke_keys;
+    for (int i = 0; i < test_object_num; ++i) {
+        (i % 2 == 0 ? end_keys : revoke_keys).push_back(keys[i]);
+    }
+    end_keys.push_back("non_existent_key");
+    auto end_results = service_->BatchPutEnd(end_keys);
+    for (size_t i = 0; i + 1 < end_keys.size(); ++i) {
+        EXPECT_TRUE(end_results[i].has_value());
+    }
+    EXPECT_EQ(ErrorCode::OBJECT_NOT_FOUND, end_results.back().error());
+    // Completed objects can no longer be revoked
+    auto revoke_complete = service_->BatchPutRevoke({end_keys[0]});
+    EXPECT_EQ(ErrorCode::INVALID_WRITE, revoke_complete[0].error());
+    for (const auto& result : service_->BatchPutRevoke(revoke_keys)) {
+        EXPECT_TRUE(result.has_value());
+    }
+
+    auto get_results = service_->BatchGetReplicaList(keys);
+    ASSERT_EQ(keys.size(), get_results.size());
+    for (int i = 0; i < test_object_num; ++i) {
+        if (i % 2 == 0) {
+            ASSERT_TRUE(get_results[i].has_value());
+            EXPECT_EQ(1, get_results[i]->size());
+        } else {
+            EXPECT_EQ(ErrorCode::OBJECT_NOT_FOUND, get_results[i].error());
+        }
+    }
+    // existing_key has not been completed yet
+    EXPECT_EQ(ErrorCode::REPLICA_IS_NOT_READY,
+              get_results[test_object_num].error());
+}
+
+TEST_F(MasterServiceTest, PackedReplicaLists) {
+    std::unique_ptr<MasterService> service_(new MasterService());
+    constexpr size_t size = 1024 * 1024 * 64;
+    for (int i = 0; i < 2; ++i) {
+        Segment segment(generate_uuid(), "segment_" + std::to_string(i),
+                        0x300000000 + i * size, size);
+        ASSERT_TRUE(
+            service_->MountSegment(segment, generate_uuid()).has_value());
+    }
+    std::vector<std::string> keys;
+    ReplicateConfig config;
+    config.replica_num = 2;
+    for (int i = 0; i < 8; ++i) {
+        keys.push_back("packed_key_" + std::to_string(i));
+        ASSERT_TRUE(
+            service_->PutStart(keys.back(), {1024, 2048, 4096}, config)
+                .has_value());
+        ASSERT_TRUE(service_->PutEnd(keys.back()).has_value());
+    }
+    keys.push_back("non_existent_key");
+
+    auto results = service_->BatchGetReplicaList(keys);
+    // A disk replica next to the memory ones
+    ASSERT_TRUE(results[0].has_value());
+    Replica::Descriptor disk;
+    disk.descriptor_variant = DiskDescriptor{"/tmp/packed_key_0", 7168, 0};
+    disk.status = ReplicaStatus::COMPLETE;
+    results[0]->push_back(disk);
+
+    auto packed = PackedReplicaLists::Pack(results);
+    EXPECT_EQ(2, packed.segments.size());
+    auto unpacked = packed.Unpack();
+    ASSERT_EQ(results.size(), unpacked.size());
+    for (size_t i = 0; i < results.size(); ++i) {
+        ASSERT_EQ(results[i].has_value(), unpacked[i].has_value());
+        if (!results[i]) {
+            EXPECT_EQ(results[i].error(), unpacked[i].error());
+            continue;
+        }
+        ASSERT_EQ(results[i]->size(), unpacked[i]->size());
+        for (size_t j = 0; j < results[i]->size(); ++j) {
+            const auto& expected = (*results[i])[j];
+            const auto& actual = (*unpacked[i])[j];
+            EXPECT_EQ(expected.status, actual.status);
+            ASSERT_EQ(expected.is_memory_replica(), actual.is_memory_replica());
+            if (!expected.is_memory_replica()) {
+                EXPECT_EQ(expected.get_disk_descriptor().file_path,
+                          actual.get_disk_descriptor().file_path);
+                EXPECT_EQ(expected.get_disk_descriptor().file_size,
+                          actual.get_disk_descriptor().file_size);
+                continue;
+            }
+            const auto& expected_buffers =
+                expected.get_memory_descriptor().buffer_descriptors;
+            const auto& actual_buffers =
+                actual.get_memory_descriptor().buffer_descriptors;
+            ASSERT_EQ(expected_buffers.size(), actual_buffers.size());
+            for (size_t k = 0; k < expected_buffers.size(); ++k) {
+                EXPECT_EQ(expected_buffers[k].segment_name_,
+                          actual_buffers[k].segment_name_);
+                EXPECT_EQ(expected_buffers[k].size_, actual_buffers[k].size_);
+                EXPECT_EQ(expected_buffers[k].buffer_address_,
+                          actual_buffers[k].buffer_address_);
+                EXPECT_EQ(expected_buffers[k].status_,
+                          actual_buffers[k].status_);
+            }
+        }
+    }
+
+    // A segment index out of range fails its key only
+    packed.replica_lists[1][0].buffers[0].segment = 2;
+    unpacked = packed.Unpack();
+    EXPECT_TRUE(unpacked[0].has_value());
+    EXPECT_EQ(ErrorCode::RPC_FAIL, unpacked[1].error());
+    EXPECT_TRUE(unpacked[2].has_value());
+}
+
+TEST_F(MasterServiceTest, ReleaseSlabTest) {
+    // set a large kv_lease_ttl so the granted lease will not quickly expire
+    // const uint64_t kv_lease_ttl = 2000;
+    std::unique_ptr<MasterService> service_(
+        new MasterService({.enable_gc = false}));
+    // Mount a segment that can hold about 1024 * 16 objects.
+    // As the eviction is processed separately for each shard,
+    // we need to fill each shard with enough objects to thoroughly
+    // test the eviction process.
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t size = 1024 * 1024 * 16;
+    constexpr size_t object_size = 1024 * 1024;
+    std::string segment_name = "test_segment";
+    Segment segment(generate_uuid(), segment_name, buffer, size);
+    UUID client_id = generate_uuid();
+    auto mount_result = service_->MountSegment(segment, client_id);
+    ASSERT_TRUE(mount_result.has_value());
+
+    // Verify if we can put objects more than the segment can hold
+    int success_puts = 0;
+    for (int i = 0; i < 13; ++i) {
+        std::string key = "test_key" + std::to_string(i);
+        std::vector<uint64_t> slice_lengths = {object_size};
+        ReplicateConfig config;
+        config.replica_num = 1;
+        auto put_start_result = service_->PutStart(key, slice_lengths, config);
+        if (put_start_result.has_value()) {
+            auto put_end_result = service_->PutEnd(key);
+            ASSERT_TRUE(put_end_result.has_value());
+            success_puts++;
+        } else {
+            // wait for gc thread to work
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    }
+
+    // put a larger kv
+    {
+        std::string key = "large_test_key";
+        std::vector<uint64_t> slice_lengths = {object_size * 2};
+        ReplicateConfig config;
+        config.replica_num = 1;
+        while (1) {
+            auto put_start_result =
+                service_->PutStart(key, slice_lengths, config);
+            if (put_start_result.has_value()) {
+                auto put_end_result = service_->PutEnd(key);
+                ASSERT_TRUE(put_end_result.has_value());
+                success_puts++;
+                LOG(INFO) << "large key put success";
+                break;
+            } else {
+                // wait for gc thread to work
+                // LOG(ERROR) << "large key put fail";
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    service_->RemoveAll();
+}
+
+TEST_F(MasterServiceTest, ConcurrentReadersExtendLease) {
+    // Readers of the same hot key share the shard lock and extend the lease
+    // concurrently, while a writer keeps exclusive semantics for Remove.
+    const uint64_t kv_lease_ttl = 1000;
+    std::unique_ptr<MasterService> service_(
+        new MasterService({.enable_gc = false,
+                           .default_kv_lease_ttl = kv_lease_ttl}));
+
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t size = 1024 * 1024 * 16;
+    Segment segment(generate_uuid(), "hot_key_segment", buffer, size);
+    UUID client_id = generate_uuid();
+    ASSERT_TRUE(service_->MountSegment(segment, client_id).has_value());
+
+    std::string key = "hot_key";
+    ASSERT_TRUE(service_->PutStart(key, {1024}, {.replica_num = 1}));
+    ASSERT_TRUE(service_->PutEnd(key).has_value());
+    // Take the first lease before the writer starts.
+    ASSERT_TRUE(service_->ExistKey(key).value_or(false));
+
+    constexpr size_t num_readers = 8;
+    constexpr size_t reads_per_thread = 2000;
+    std::atomic<size_t> success{0};
+    std::atomic<bool> stop_writer{false};
+    std::atomic<bool> removed{false};
+    std::vector<std::thread> readers;
+    for (size_t t = 0; t < num_readers; ++t) {
+        readers.emplace_back([&]() {
+            for (size_t i = 0; i < reads_per_thread; ++i) {
+                if (service_->GetReplicaList(key).has_value() &&
+                    service_->ExistKey(key).value_or(false)) {
+                    success++;
+                }
+            }
+        });
+    }
+    // The object is continuously leased, so Remove must keep failing.
+    std::thread writer([&]() {
+        while (!stop_writer) {
+            if (service_->Remove(key).has_value()) {
+                removed = true;
+                break;
+            }
+        }
+    });
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    stop_writer = true;
+    writer.join();
+
+    EXPECT_FALSE(removed);
+    EXPECT_EQ(success, num_readers * reads_per_thread);
+
+    // Once the readers stop, the lease expires and Remove succeeds.
+    std::this_thread::sleep_for(std::chrono::milliseconds(kv_lease_ttl));
+    EXPECT_TRUE(service_->Remove(key).has_value());
+    EXPECT_FALSE(service_->ExistKey(key).value_or(true));
+}
+
+TEST_F(MasterServiceTest, HottestShards) {
+    std::unique_ptr<MasterService> service_(
+        new MasterService({.enable_gc = false}));
+
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t size = 1024 * 1024 * 16;
+    Segment segment(generate_uuid(), "hot_shard_segment", buffer, size);
+    UUID client_id = generate_uuid();
+    ASSERT_TRUE(service_->MountSegment(segment, client_id).has_value());
+    ASSERT_TRUE(service_->PutStart("hot_key", {1024}, {.replica_num = 1}));
+    ASSERT_TRUE(service_->PutEnd("hot_key").has_value());
+
+    // Enough accesses per thread for the hold sampling to start
+    std::vector<std::thread> readers;
+    for (size_t t = 0; t < 4; ++t) {
+        readers.emplace_back([&]() {
+            for (size_t i = 0; i < 1000; ++i) {
+                service_->GetReplicaList("hot_key");
+            }
+        });
+    }
+    for (auto& reader : readers) {
+        reader.join();
+    }
+
+    auto hottest = service_->GetHottestShards(3);
+    ASSERT_EQ(hottest.size(), 3);
+    EXPECT_EQ(hottest[0].shard, MasterService::ShardOf("hot_key"));
+    EXPECT_GT(hottest[0].acquisitions, 0);
+    EXPECT_GT(hottest[0].hold_us + hottest[0].wait_us, 0);
+    EXPECT_EQ(hottest[1].acquisitions, 0);
+}
+
+TEST_F(MasterServiceTest, ReplicaCacheInfo) {
+    const uint64_t kv_lease_ttl = 500;
+    std::unique_ptr<MasterService> service_(
+        new MasterService({.enable_gc = false,
+                           .default_kv_lease_ttl = kv_lease_ttl}));
+    auto info = service_->GetReplicaCacheInfo();
+    EXPECT_EQ(info.lease_ttl_ms, kv_lease_ttl);
+    const uint64_t version = info.replica_version;
+
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t size = 1024 * 1024 * 16;
+    Segment segment(generate_uuid(), "cache_info_segment", buffer, size);
+    UUID client_id = generate_uuid();
+    ASSERT_TRUE(service_->MountSegment(segment, client_id).has_value());
+    ASSERT_TRUE(service_->PutStart("key", {1024}, {.replica_num = 1}));
+    ASSERT_TRUE(service_->PutEnd("key").has_value());
+    ASSERT_TRUE(service_->GetReplicaList("key").has_value());
+    // Neither puts nor reads change the version
+    EXPECT_EQ(service_->GetReplicaCacheInfo().replica_version, version);
+
+    // Unmounting drops the leased replicas, so cached copies are stale
+    ASSERT_TRUE(service_->UnmountSegment(segment.id, client_id).has_value());
+    EXPECT_NE(service_->GetReplicaCacheInfo().replica_version, version);
+    EXPECT_FALSE(service_->GetReplicaList("key").has_value());
+}
+
+TEST_F(MasterServiceTest, TopologyAwareReplicaPlacement) {
+    std::unique_ptr<MasterService> service_(new MasterService(
+        {.enable_gc = false,
+         .allocation_strategy = AllocationStrategyType::TOPOLOGY_AWARE}));
+    constexpr size_t size = 1024 * 1024 * 16;
+    // Two segments share host_a, a third one lives on host_b
+    const std::vector<std::pair<std::string, std::string>> segments = {
+        {"a0", "host_a"}, {"a1", "host_a"}, {"b0", "host_b"}};
+    std::unordered_map<std::string, std::string> host_of;
+    for (size_t i = 0; i < segments.size(); ++i) {
+        Segment segment(generate_uuid(), segments[i].first,
+                        0x300000000 + i * size, size);
+        segment.topology.host = segments[i].second;
+        host_of[segments[i].first] = segments[i].second;
+        ASSERT_TRUE(
+            service_->MountSegment(segment, generate_uuid()).has_value());
+    }
+
+    ReplicateConfig config;
+    config.replica_num = 2;
+    config.preferred_segment = "a0";
+    for (int i = 0; i < 10; ++i) {
+        std::string key = "topology_key" + std::to_string(i);
+        auto replicas = service_->PutStart(key, {1024}, config);
+        ASSERT_TRUE(replicas.has_value());
+        ASSERT_EQ(replicas->size(), 2);
+        const auto& first = (*replicas)[0]
+                                .get_memory_descriptor()
+                                .buffer_descriptors[0]
+                                .segment_name_;
+        const auto& second = (*replicas)[1]
+                                 .get_memory_descriptor()
+                                 .buffer_descriptors[0]
+                                 .segment_name_;
+        EXPECT_EQ(first, "a0");
+        EXPECT_EQ(second, "b0");
+        EXPECT_NE(host_of[first], host_of[second]);
+    }
+}
+
+TEST_F(MasterServiceTest, DeviceMemoryTier) {
+    // The offset allocator mixes small and large objects in one segment,
+    // each of which holds a few of the largest
+    std::unique_ptr<MasterService> service_(new MasterService(
+        {.buffer_allocator_type = BufferAllocatorType::OFFSET}));
+    constexpr size_t size = 1024 * 1024 * 64;
+    Segment host(generate_uuid(), "host", 0x300000000, size);
+    Segment device(generate_uuid(), "gpu", 0x300000000 + size, size);
+    device.topology.device = "cuda:0";
+    ASSERT_TRUE(service_->MountSegment(host, generate_uuid()).has_value());
+    ASSERT_TRUE(service_->MountSegment(device, generate_uuid()).has_value());
+
+    auto segment_of = [](const std::vector<Replica::Descriptor>& replicas) {
+        return replicas[0]
+            .get_memory_descriptor()
+            .buffer_descriptors[0]
+            .segment_name_;
+    };
+    ReplicateConfig config;
+    ReplicateConfig hot;
+    hot.prefer_device_memory = true;
+    for (int i = 0; i < 10; ++i) {
+        auto cold = service_->PutStart("cold" + std::to_string(i), {1024},
+                                       config);
+        ASSERT_TRUE(cold.has_value());
+        EXPECT_EQ(segment_of(*cold), "host");
+        auto placed =
+            service_->PutStart("hot" + std::to_string(i), {1024}, hot);
+        ASSERT_TRUE(placed.has_value());
+        EXPECT_EQ(segment_of(*placed), "gpu");
+    }
+
+    // Hot objects fall back to host memory once the GPU is full
+    bool fell_back = false;
+    for (int i = 0; i < 5 && !fell_back; ++i) {
+        auto placed =
+            service_->PutStart("big" + std::to_string(i), {kMaxSliceSize}, hot);
+        ASSERT_TRUE(placed.has_value());
+        fell_back = segment_of(*placed) == "host";
+    }
+    EXPECT_TRUE(fell_back);
+}
+
+TEST_F(MasterServiceTest, ErasureCodedObject) {
+    std::unique_ptr<MasterService> service_(new MasterService());
+    constexpr size_t size = 1024 * 1024 * 16;
+    const UUID client_id = generate_uuid();
+    std::vector<Segment> segments;
+    for (size_t i = 0; i < 5; ++i) {
+        segments.emplace_back(generate_uuid(), "segment" + std::to_string(i),
+                              0x300000000 + i * size, size);
+    }
+    for (size_t i = 0; i < 3; ++i) {
+        ASSERT_TRUE(service_->MountSegment(segments[i], client_id));
+    }
+
+    ReplicateConfig config;
+    config.ec_data_fragments = 2;
+    config.ec_parity_fragments = 2;
+    // Data fragments of 1024 and 1023 bytes, parity fragments of 1024
+    const std::vector<uint64_t> fragments = {1024, 1023, 1024, 1024};
+    EXPECT_EQ(service_->PutStart("ec", fragments, config).error(),
+              ErrorCode::SEGMENT_NOT_FOUND);
+    for (size_t i = 3; i < segments.size(); ++i) {
+        ASSERT_TRUE(service_->MountSegment(segments[i], client_id));
+    }
+    EXPECT_EQ(service_->PutStart("ec", {1024, 1023, 1024}, config).error(),
+              ErrorCode::INVALID_PARAMS);
+    ReplicateConfig replicated = config;
+    replicated.replica_num = 2;
+    EXPECT_EQ(service_->PutStart("ec", fragments, replicated).error(),
+              ErrorCode::INVALID_PARAMS);
+
+    auto replicas = service_->PutStart("ec", fragments, config);
+    ASSERT_TRUE(replicas.has_value());
+    ASSERT_EQ(replicas->size(), 1);
+    ASSERT_TRUE(service_->PutEnd("ec"));
+    auto replica_list = service_->GetReplicaList("ec");
+    ASSERT_TRUE(replica_list.has_value());
+    const auto& memory = (*replica_list)[0].get_memory_descriptor();
+    ASSERT_TRUE(memory.is_erasure_coded());
+    ASSERT_EQ(memory.buffer_descriptors.size(), 2);
+    ASSERT_EQ(memory.parity_descriptors.size(), 2);
+    EXPECT_EQ(memory.buffer_descriptors[1].size_, 1023);
+    // One fragment per segment
+    std::unordered_set<std::string> placed;
+    for (const auto* descriptors :
+         {&memory.buffer_descriptors, &memory.parity_descriptors}) {
+        for (const auto& fragment : *descriptors) {
+            placed.insert(fragment.segment_name_);
+        }
+    }
+    EXPECT_EQ(placed.size(), 4);
+
+    // The object outlives the loss of as many segments as it has parity
+    // fragments, the lost ones are marked
+    std::vector<std::string> lost = {
+        memory.buffer_descriptors[0].segment_name_,
+        memory.parity_descriptors[1].segment_name_};
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(DEFAULT_DEFAULT_KV_LEASE_TTL));
+    for (const auto& segment : segments) {
+        if (std::find(lost.begin(), lost.end(), segment.name) != lost.end()) {
+            ASSERT_TRUE(service_->UnmountSegment(segment.id, client_id));
+        }
+    }
+    replica_list = service_->GetReplicaList("ec");
+    ASSERT_TRUE(replica_list.has_value());
+    const auto& degraded = (*replica_list)[0].get_memory_descriptor();
+    EXPECT_EQ(degraded.buffer_descriptors[0].status_,
+              BufStatus::UNREGISTERED);
+    EXPECT_EQ(degraded.buffer_descriptors[1].status_, BufStatus::COMPLETE);
+    EXPECT_EQ(degraded.parity_descriptors[1].status_,
+              BufStatus::UNREGISTERED);
+
+    // Not copied or migrated, the fragments are no copy of the value
+    EXPECT_EQ(service_->CopyReplica("ec", "").error(),
+              ErrorCode::INVALID_PARAMS);
+
+    // One more is too many
+    const std::string third = degraded.buffer_descriptors[1].segment_name_;
+    for (const auto& segment : segments) {
+        if (segment.name == third) {
+            ASSERT_TRUE(service_->UnmountSegment(segment.id, client_id));
+        }
+    }
+    EXPECT_EQ(service_->GetReplicaList("ec").error(),
+              ErrorCode::OBJECT_NOT_FOUND);
+}
+
+TEST_F(MasterServiceTest, PutInline) {
+    ReplicateConfig config;
+    config.replica_num = 1;
+    auto disabled = std::make_unique<MasterService>();
+    EXPECT_EQ(disabled->PutInline("key", "value", config).error(),
+              ErrorCode::UNAVAILABLE_IN_CURRENT_MODE);
+
+    // Zero-length leases, so that Remove is not refused after reading
+    std::unique_ptr<MasterService> service_(
+        new MasterService({.enable_gc = false,
+                           .default_kv_lease_ttl = 0,
+                           .buffer_allocator_type = BufferAllocatorType::OFFSET,
+                           .inline_object_max_size = 16}));
+
+    // No segment is needed, the value lives in the metadata
+    ASSERT_TRUE(service_->PutInline("key", "value", config).has_value());
+    EXPECT_EQ(service_->PutInline("key", "other", config).error(),
+              ErrorCode::OBJECT_ALREADY_EXISTS);
+    EXPECT_EQ(service_->PutInline("large", std::string(17, 'x'), config)
+                  .error(),
+              ErrorCode::INVALID_PARAMS);
+    EXPECT_EQ(service_->PutInline("empty", "", config).error(),
+              ErrorCode::INVALID_PARAMS);
+
+    auto replicas = service_->GetReplicaList("key");
+    ASSERT_TRUE(replicas.has_value());
+    ASSERT_EQ(replicas->size(), 1);
+    EXPECT_EQ((*replicas)[0].status, ReplicaStatus::COMPLETE);
+    const auto& memory = (*replicas)[0].get_memory_descriptor();
+    ASSERT_TRUE(memory.is_inline());
+    EXPECT_EQ(memory.inline_data, "value");
+    // Sized like the value, so that readers lay out their slices as usual
+    ASSERT_EQ(memory.buffer_descriptors.size(), 1);
+    EXPECT_EQ(memory.buffer_descriptors[0].size_, 5);
+
+    // Survives the packed replica lists
+    auto unpacked =
+        PackedReplicaLists::Pack(service_->BatchGetReplicaList({"key"}))
+            .Unpack();
+    ASSERT_TRUE(unpacked[0].has_value());
+    EXPECT_EQ((*unpacked[0])[0].get_memory_descriptor().inline_data, "value");
+
+    // Has no buffer to copy
+    EXPECT_EQ(service_->CopyReplica("key", "segment").error(),
+              ErrorCode::INVALID_PARAMS);
+    ASSERT_TRUE(service_->Remove("key").has_value());
+    EXPECT_FALSE(service_->ExistKey("key").value());
+}
+
+TEST_F(MasterServiceTest, StripesLargeObjects) {
+    std::unique_ptr<MasterService> service_(
+        new MasterService({.enable_gc = false,
+                           .buffer_allocator_type = BufferAllocatorType::OFFSET,
+                           .stripe_min_size = 4 * 1024 * 1024}));
+    constexpr size_t size = 1024 * 1024 * 16;
+    for (int i = 0; i < 3; ++i) {
+        Segment segment(generate_uuid(), "segment_" + std::to_string(i),
+                        0x300000000 + i * size, size);
+        ASSERT_TRUE(
+            service_->MountSegment(segment, generate_uuid()).has_value());
+    }
+    ReplicateConfig config;
+    config.replica_num = 1;
+    const uint64_t stripe = 1024 * 1024;
+
+    // Six stripes go round the three segments
+    auto replicas = service_->PutStart(
+        "large", std::vector<uint64_t>(6, stripe), config);
+    ASSERT_TRUE(replicas.has_value());
+    const auto& buffers =
+        (*replicas)[0].get_memory_descriptor().buffer_descriptors;
+    ASSERT_EQ(buffers.size(), 6);
+    std::set<std::string> first_round, second_round;
+    for (size_t j = 0; j < 3; ++j) {
+        first_round.insert(buffers[j].segment_name_);
+        second_round.insert(buffers[j + 3].segment_name_);
+    }
+    EXPECT_EQ(first_round.size(), 3);
+    EXPECT_EQ(second_round.size(), 3);
+
+    // Objects below the threshold are placed as usual, e.g. with their
+    // preferred segment
+    config.preferred_segment = "segment_1";
+    replicas = service_->PutStart(
+        "small", std::vector<uint64_t>(3, stripe), config);
+    ASSERT_TRUE(replicas.has_value());
+    for (const auto& buffer :
+         (*replicas)[0].get_memory_descriptor().buffer_descriptors) {
+        EXPECT_EQ(buffer.segment_name_, "segment_1");
+    }
+}
+
+TEST_F(MasterServiceTest, AllocationCredit) {
+    std::unique_ptr<MasterService> service_(new MasterService());
+    constexpr size_t buffer = 0x300000000;
+    constexpr size_t size = 1024 * 1024 * 16;
+    Segment segment(generate_uuid(), "test_segment", buffer, size);
+    UUID client_id = generate_uuid();
+    EXPECT_EQ(service_->GrantAllocationCredit(client_id, 1024 * 1024).error(),
+              ErrorCode::NO_AVAILABLE_HANDLE);
+    ASSERT_TRUE(service_->MountSegment(segment, client_id).has_value());
+
+    auto credit = service_->GrantAllocationCredit(client_id, 1024 * 1024);
+    ASSERT_TRUE(credit.has_value());
+    EXPECT_EQ(credit->extent.segment_name_, "test_segment");
+    EXPECT_EQ(credit->extent.size_, 1024 * 1024);
+    const uint64_t base = credit->extent.buffer_address_;
+
+    std::vector<CreditPut> puts{
+        {"a", 0, {1024, 1024}, false},
+        {"b", 2048, {4096}, false},
+        {"out_of_extent", 1024 * 1024 - 16, {32}, false}};
+    auto results = service_->CommitCreditPuts(client_id, credit->id, puts);
+    ASSERT_EQ(results.size(), 3);
+    EXPECT_TRUE(results[0].has_value());
+    EXPECT_TRUE(results[1].has_value());
+    EXPECT_EQ(results[2].error(), ErrorCode::INVALID_PARAMS);
+
+    // Complete as after PutEnd, in the extent where the client placed them
+    auto replicas = service_->GetReplicaList("b");
+    ASSERT_TRUE(replicas.has_value());
+    ASSERT_EQ(replicas->size(), 1);
+    EXPECT_EQ((*replicas)[0].status, ReplicaStatus::COMPLETE);
+    const auto& buffers =
+        (*replicas)[0].get_memory_descriptor().buffer_descriptors;
+    ASSERT_EQ(buffers.size(), 1);
+    EXPECT_EQ(buffers[0].buffer_address_, base + 2048);
+    EXPECT_EQ(buffers[0].size_, 4096);
+    replicas = service_->GetReplicaList("a");
+    ASSERT_TRUE(replicas.has_value());
+    EXPECT_EQ((*replicas)[0].get_memory_descriptor().buffer_descriptors.size(),
+              2);
+
+    std::vector<CreditPut> again{{"a", 8192, {1024}, false}};
+    EXPECT_EQ(service_->CommitCreditPuts(client_id, credit->id, again)[0]
+                  .error(),
+              ErrorCode::OBJECT_ALREADY_EXISTS);
+    // Only the client the credit was granted to commits into it
+    std::vector<CreditPut> other{{"c", 8192, {1024}, false}};
+    const UUID other_client = generate_uuid();
+    EXPECT_EQ(
+        service_->CommitCreditPuts(other_client, credit->id, other)[0].error(),
+        ErrorCode::INVALID_PARAMS);
+
+    // The objects outlive the credit
+    ASSERT_TRUE(service_->ReturnAllocationCredit(client_id, credit->id)
+                    .has_value());
+    EXPECT_EQ(service_->CommitCreditPuts(client_id, credit->id, other)[0]
+                  .error(),
+              ErrorCode::INVALID_PARAMS);
+    EXPECT_FALSE(service_->ReturnAllocationCredit(client_id, credit->id)
+                     .has_value());
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(DEFAULT_DEFAULT_KV_LEASE_TTL));
+    ASSERT_TRUE(service_->Remove("a").has_value());
+    replicas = service_->GetReplicaList("b");
+    ASSERT_TRUE(replicas.has_value());
+    EXPECT_EQ((*replicas)[0].status, ReplicaStatus::COMPLETE);
+}
+
+TEST_F(MasterServiceTest, ContiguousBatchPut) {
+    std::unique_ptr<MasterService> service_(new MasterService());
+    for (size_t i = 0; i < 4; ++i) {
+        Segment segment(generate_uuid(), "segment_" + std::to_string(i),
+                        0x300000000 + i * 0x10000000, 1024 * 1024 * 16);
+        ASSERT_TRUE(service_->MountSegment(segment, generate_uuid())
+                        .has_value());
+    }
+
+    ReplicateConfig config;
+    config.replica_num = 2;
+    config.contiguous_batch = true;
+    const std::vector<std::string> keys{"layer_0", "layer_1", "layer_2"};
+    auto results = service_->BatchPutStart(
+        keys, {{4096, 4096}, {1001}, {8192}}, config);
+    ASSERT_EQ(results.size(), 3);
+    for (const auto& result : results) {
+        ASSERT_TRUE(result.has_value());
+        ASSERT_EQ(result->size(), 2);
+    }
+
+    // Each replica of the batch is laid out in one segment, the objects one
+    // after another and 8-byte aligned, the two replicas apart
+    for (size_t r = 0; r < 2; ++r) {
+        const auto& first = results[0].value()[r].get_memory_descriptor();
+        const auto& second = results[1].value()[r].get_memory_descriptor();
+        const auto& third = results[2].value()[r].get_memory_descriptor();
+        const auto& segment = first.buffer_descriptors[0].segment_name_;
+        const uint64_t base = first.buffer_descriptors[0].buffer_address_;
+        EXPECT_EQ(first.buffer_descriptors[1].buffer_address_, base + 4096);
+        EXPECT_EQ(second.buffer_descriptors[0].segment_name_, segment);
+        EXPECT_EQ(second.buffer_descriptors[0].buffer_address_, base + 8192);
+        EXPECT_EQ(third.buffer_descriptors[0].segment_name_, segment);
+        EXPECT_EQ(third.buffer_descriptors[0].buffer_address_,
+                  base + 8192 + 1008);
+    }
+    EXPECT_NE(results[0].value()[0]
+                  .get_memory_descriptor()
+                  .buffer_descriptors[0]
+                  .segment_name_,
+              results[0].value()[1]
+                  .get_memory_descriptor()
+                  .buffer_descriptors[0]
+                  .segment_name_);
+
+    // The objects live on their own once put
+    for (const auto& result : service_->BatchPutEnd(keys)) {
+        EXPECT_TRUE(result.has_value());
+    }
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(DEFAULT_DEFAULT_KV_LEASE_TTL));
+    ASSERT_TRUE(service_->Remove("layer_1").has_value());
+    auto replicas = service_->GetReplicaList("layer_2");
+    ASSERT_TRUE(replicas.has_value());
+    EXPECT_EQ((*replicas)[0].status, ReplicaStatus::COMPLETE);
+}
+
+TEST_F(MasterServiceTest, PersistentSegmentKeepsReplicas) {
+    // Only the offset allocator places replicas back at their offsets
+    std::unique_ptr<MasterService> service_(new MasterService(
+        {.buffer_allocator_type = BufferAllocatorType::OFFSET}));
+    constexpr size_t size = 1024 * 1024 * 16;
+    const UUID memory_id = generate_uuid();
+    Segment segment(generate_uuid(), "host:12345", 0x300000000, size);
+    segment.memory_id = memory_id;
+    const UUID client_id = generate_uuid();
+    ASSERT_TRUE(service_->MountSegment(segment, client_id).has_value());
+
+    ReplicateConfig config;
+    config.replica_num = 1;
+    auto put_result = service_->PutStart("warm", {4096}, config);
+    ASSERT_TRUE(put_result.has_value());
+    const uint64_t offset = (*put_result)[0]
+                                .get_memory_descriptor()
+                                .buffer_descriptors[0]
+                                .buffer_address_ -
+                            segment.base;
+    ASSERT_TRUE(service_->PutEnd("warm").has_value());
+
+    // The client goes away, and its objects with it
+    ASSERT_TRUE(service_->UnmountSegment(segment.id, client_id).has_value());
+    EXPECT_FALSE(service_->GetReplicaList("warm").has_value());
+
+    // Restarted, it maps the memory elsewhere under another name
+    Segment remapped(generate_uuid(), "host:23456", 0x500000000, size);
+    remapped.memory_id = memory_id;
+    const UUID new_client_id = generate_uuid();
+    ASSERT_TRUE(service_->MountSegment(remapped, new_client_id).has_value());
+    auto replicas = service_->GetReplicaList("warm");
+    ASSERT_TRUE(replicas.has_value());
+    ASSERT_EQ(replicas->size(), 1);
+    const auto& buffer =
+        (*replicas)[0].get_memory_descriptor().buffer_descriptors[0];
+    EXPECT_EQ(buffer.segment_name_, "host:23456");
+    EXPECT_EQ(buffer.buffer_address_, remapped.base + offset);
+    EXPECT_EQ(buffer.size_, 4096);
+
+    // The restored object holds its space: a new put lands elsewhere
+    put_result = service_->PutStart("cold", {4096}, config);
+    ASSERT_TRUE(put_result.has_value());
+    EXPECT_NE((*put_result)[0]
+                  .get_memory_descriptor()
+                  .buffer_descriptors[0]
+                  .buffer_address_,
+              buffer.buffer_address_);
+    ASSERT_TRUE(service_->PutEnd("cold").has_value());
+
+    // A second process mapping the memory takes it over with its objects
+    Segment takeover(generate_uuid(), "host:34567", 0x700000000, size);
+    takeover.memory_id = memory_id;
+    ASSERT_TRUE(service_->MountSegment(takeover, generate_uuid()).has_value());
+    auto segments = service_->GetAllSegments();
+    ASSERT_TRUE(segments.has_value());
+    EXPECT_EQ(std::vector<std::string>{"host:34567"}, segments.value());
+    EXPECT_TRUE(service_->GetReplicaList("warm").has_value());
+    EXPECT_TRUE(service_->GetReplicaList("cold").has_value());
+}
+
+TEST_F(MasterServiceTest, PersistentSegmentNeedsOffsetAllocator) {
+    std::unique_ptr<MasterService> service_(new MasterService(
+        {.buffer_allocator_type = BufferAllocatorType::CACHELIB}));
+    constexpr size_t size = 1024 * 1024 * 16;
+    const UUID memory_id = generate_uuid();
+    Segment segment(generate_uuid(), "host:12345", 0x300000000, size);
+    segment.memory_id = memory_id;
+    const UUID client_id = generate_uuid();
+    ASSERT_TRUE(service_->MountSegment(segment, client_id).has_value());
+
+    ReplicateConfig config;
+    config.replica_num = 1;
+    ASSERT_TRUE(service_->PutStart("warm", {4096}, config).has_value());
+    ASSERT_TRUE(service_->PutEnd("warm").has_value());
+    ASSERT_TRUE(service_->UnmountSegment(segment.id, client_id).has_value());
+
+    // The segment mounts, but its replicas were dropped
+    Segment remapped(generate_uuid(), "host:23456", 0x500000000, size);
+    remapped.memory_id = memory_id;
+    ASSERT_TRUE(
+        service_->MountSegment(remapped, generate_uuid()).has_value());
+    EXPECT_FALSE(service_->GetReplicaList("warm").has_value());
+}
+
+TEST_F(MasterServiceTest, AttachSharedSegment) {
+    std::unique_ptr<MasterService> service_(new MasterService());
+    constexpr size_t size = 1024 * 1024 * 16;
+    const UUID memory_id = generate_uuid();
+    const UUID owner = generate_uuid();
+    Segment segment(generate_uuid(), "cxl_host:12345", 0x300000000, size);
+    segment.memory_id = memory_id;
+    ASSERT_TRUE(service_->MountSegment(segment, owner).has_value());
+
+    EXPECT_EQ(service_->AttachSegment({0, 0}, generate_uuid()).error(),
+              ErrorCode::INVALID_PARAMS);
+    EXPECT_EQ(service_->AttachSegment(generate_uuid(), generate_uuid())
+                  .error(),
+              ErrorCode::SEGMENT_NOT_FOUND);
+
+    // The owner is not recorded, attaching twice records the client once
+    const UUID client_a = generate_uuid();
+    const UUID client_b = generate_uuid();
+    auto attached = service_->AttachSegment(memory_id, client_a);
+    ASSERT_TRUE(attached.has_value());
+    EXPECT_EQ(attached->id, segment.id);
+    EXPECT_EQ(attached->base, segment.base);
+    EXPECT_EQ(attached->size, size);
+    ASSERT_TRUE(service_->AttachSegment(memory_id, client_a).has_value());
+    ASSERT_TRUE(service_->AttachSegment(memory_id, client_b).has_value());
+    ASSERT_TRUE(service_->AttachSegment(memory_id, owner).has_value());
+    auto clients = service_->GetAttachedClients(segment.id);
+    ASSERT_TRUE(clients.has_value());
+    EXPECT_EQ(*clients, (std::vector<UUID>{client_a, client_b}));
+
+    ASSERT_TRUE(service_->DetachSegment(memory_id, client_a).has_value());
+    ASSERT_TRUE(service_->DetachSegment(memory_id, client_a).has_value());
+    clients = service_->GetAttachedClients(segment.id);
+    ASSERT_TRUE(clients.has_value());
+    EXPECT_EQ(*clients, std::vector<UUID>{client_b});
+
+    // The attachments end with the segment
+    ASSERT_TRUE(service_->UnmountSegment(segment.id, owner).has_value());
+    EXPECT_EQ(service_->GetAttachedClients(segment.id).error(),
+              ErrorCode::SEGMENT_NOT_FOUND);
+    EXPECT_EQ(service_->AttachSegment(memory_id, client_b).error(),
+              ErrorCode::SEGMENT_NOT_FOUND);
 }
 
 TEST_F(MasterServiceTest, FreeListTest) {
@@ -0,0 +1,94 @@
+#include "metadata_change_log.h"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace mooncake {
+
+class MetadataChangeLogTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        google::InitGoogleLogging("MetadataChangeLogTest");
+        FLAGS_logtostderr = 1;
+    }
+
+    void TearDown() override { google::ShutdownGoogleLogging(); }
+};
+
+TEST_F(MetadataChangeLogTest, NothingRecordedBeforeEnable) {
+    MetadataChangeLog log;
+    EXPECT_FALSE(log.enabled());
+    log.Record("a");
+
+    std::vector<std::string> keys;
+    uint64_t seq = 0;
+    // The changes before Enable are unknown
+    EXPECT_FALSE(log.Since(0, 10, keys, seq));
+    log.Enable();
+    EXPECT_TRUE(log.enabled());
+    EXPECT_FALSE(log.Since(0, 10, keys, seq));
+    EXPECT_TRUE(log.Since(seq, 10, keys, seq));
+    EXPECT_TRUE(keys.empty());
+}
+
+TEST_F(MetadataChangeLogTest, ChangesInOrder) {
+    MetadataChangeLog log;
+    log.Enable();
+    std::vector<std::string> keys;
+    uint64_t seq = 0;
+    ASSERT_FALSE(log.Since(0, 10, keys, seq));
+
+    log.Record("a");
+    log.Record("b");
+    log.Record("a");
+    uint64_t next_seq = 0;
+    ASSERT_TRUE(log.Since(seq, 10, keys, next_seq));
+    EXPECT_EQ(keys, (std::vector<std::string>{"a", "b", "a"}));
+    EXPECT_EQ(next_seq, seq + 3);
+
+    // Paged by max_keys
+    keys.clear();
+    ASSERT_TRUE(log.Since(seq, 2, keys, next_seq));
+    EXPECT_EQ(keys, (std::vector<std::string>{"a", "b"}));
+    keys.clear();
+    ASSERT_TRUE(log.Since(next_seq, 2, keys, next_seq));
+    EXPECT_EQ(keys, (std::vector<std::string>{"a"}));
+    keys.clear();
+    ASSERT_TRUE(log.Since(next_seq, 2, keys, next_seq));
+    EXPECT_TRUE(keys.empty());
+    EXPECT_EQ(next_seq, seq + 3);
+
+    // A sequence number this log has not reached comes from another log
+    EXPECT_FALSE(log.Since(next_seq + 1, 2, keys, next_seq));
+}
+
+TEST_F(MetadataChangeLogTest, TrimAndReset) {
+    MetadataChangeLog log(4);
+    log.Enable();
+    std::vector<std::string> keys;
+    uint64_t seq = 0;
+    ASSERT_FALSE(log.Since(0, 10, keys, seq));
+
+    for (int i = 0; i < 4; ++i) {
+        log.Record("key_" + std::to_string(i));
+    }
+    uint64_t next_seq = 0;
+    EXPECT_TRUE(log.Since(seq, 10, keys, next_seq));
+    // The oldest change is trimmed, a follower at seq missed it
+    log.Record("key_4");
+    keys.clear();
+    EXPECT_FALSE(log.Since(seq, 10, keys, next_seq));
+    EXPECT_TRUE(log.Since(seq + 1, 10, keys, next_seq));
+    EXPECT_EQ(keys.size(), 4);
+
+    log.Reset();
+    keys.clear();
+    EXPECT_FALSE(log.Since(next_seq, 10, keys, next_seq));
+    EXPECT_TRUE(log.Since(next_seq, 10, keys, next_seq));
+    EXPECT_TRUE(keys.empty());
+}
+
+}  // namespace mooncake
@@ -0,0 +1,117 @@
+#include "namespace_table.h"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+namespace mooncake {
+
+class NamespaceTableTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        google::InitGoogleLogging("NamespaceTableTest");
+        FLAGS_logtostderr = 1;
+    }
+
+    void TearDown() override { google::ShutdownGoogleLogging(); }
+};
+
+TEST_F(NamespaceTableTest, ParseQuotas) {
+    NamespaceConfig config;
+    EXPECT_TRUE(config.ParseQuotas("a:1000:2, b:0 ,default:500"));
+    ASSERT_EQ(config.quotas.size(), 3);
+    EXPECT_EQ(config.quotas["a"].capacity, 1000);
+    EXPECT_DOUBLE_EQ(config.quotas["a"].weight, 2.0);
+    EXPECT_EQ(config.quotas["b"].capacity, 0);
+    EXPECT_DOUBLE_EQ(config.quotas["b"].weight, 1.0);
+    EXPECT_EQ(config.quotas["default"].capacity, 500);
+    EXPECT_TRUE(config.ParseQuotas(""));
+
+    EXPECT_FALSE(NamespaceConfig().ParseQuotas("a"));
+    EXPECT_FALSE(NamespaceConfig().ParseQuotas(":100"));
+    EXPECT_FALSE(NamespaceConfig().ParseQuotas("a:1k"));
+    EXPECT_FALSE(NamespaceConfig().ParseQuotas("a:100:0"));
+    EXPECT_FALSE(NamespaceConfig().ParseQuotas("a:100:x"));
+}
+
+TEST_F(NamespaceTableTest, FindsNamespaceOfKey) {
+    NamespaceTable disabled(NamespaceConfig{});
+    EXPECT_EQ(disabled.Find("a/key"), nullptr);
+
+    NamespaceConfig config;
+    config.delimiter = "/";
+    ASSERT_TRUE(config.ParseQuotas("b:0,a:0"));
+    NamespaceTable table(config);
+    EXPECT_EQ(table.Names(),
+              (std::vector<std::string>{"default", "a", "b"}));
+    EXPECT_EQ(table.Find("a/key")->name(), "a");
+    EXPECT_EQ(table.Find("b/x/y")->index(), 2);
+    // Unlisted namespaces and keys without one share the default namespace
+    EXPECT_EQ(table.Find("c/key")->name(), "default");
+    EXPECT_EQ(table.Find("key")->name(), "default");
+    EXPECT_EQ(table.Find("ab/key")->name(), "default");
+}
+
+TEST_F(NamespaceTableTest, CapacityLimitsCharges) {
+    NamespaceConfig config;
+    config.delimiter = "/";
+    ASSERT_TRUE(config.ParseQuotas("a:100"));
+    NamespaceTable table(config);
+    auto* usage = table.Find("a/key");
+
+    EXPECT_TRUE(NamespaceTable::HasRoom(usage, 100));
+    NamespaceTable::Charge(usage, 60);
+    EXPECT_TRUE(NamespaceTable::HasRoom(usage, 40));
+    EXPECT_FALSE(NamespaceTable::HasRoom(usage, 41));
+    NamespaceTable::Release(usage, 60);
+    EXPECT_EQ(usage->bytes(), 0);
+    // No cap on the default namespace
+    EXPECT_TRUE(NamespaceTable::HasRoom(table.Find("key"), UINT64_MAX / 2));
+    EXPECT_TRUE(NamespaceTable::HasRoom(nullptr, 1));
+}
+
+TEST_F(NamespaceTableTest, SharesByWeightedMaxMin) {
+    NamespaceConfig config;
+    config.delimiter = "/";
+    ASSERT_TRUE(config.ParseQuotas("a:0:1,b:0:3,c:0:1"));
+    NamespaceTable table(config);
+    auto* a = table.Find("a/");
+    auto* b = table.Find("b/");
+    auto* c = table.Find("c/");
+
+    // No contention, everyone keeps what it uses
+    NamespaceTable::Charge(a, 300);
+    NamespaceTable::Charge(b, 100);
+    EXPECT_EQ(table.UpdateShares(1000, 1.0), 0);
+    EXPECT_EQ(a->share(), 300);
+
+    // a bursts: b keeps its usage, below its part, and c its little
+    NamespaceTable::Charge(c, 50);
+    NamespaceTable::Charge(a, 900);
+    EXPECT_EQ(table.UpdateShares(1000, 1.0), 350);
+    EXPECT_EQ(b->share(), 100);
+    EXPECT_EQ(c->share(), 50);
+    EXPECT_EQ(a->share(), 850);
+    EXPECT_EQ(a->excess(), 350);
+
+    // b wants more than its three fifths, the others their fifth each
+    NamespaceTable::Charge(b, 900);
+    table.UpdateShares(1000, 1.0);
+    EXPECT_EQ(c->share(), 50);
+    EXPECT_NEAR(a->share(), 950.0 / 4, 1);
+    EXPECT_NEAR(b->share(), 950.0 * 3 / 4, 1);
+}
+
+TEST_F(NamespaceTableTest, CapacityCapsShare) {
+    NamespaceConfig config;
+    config.delimiter = ":";
+    ASSERT_TRUE(config.ParseQuotas("a:1000"));
+    NamespaceTable table(config);
+    auto* a = table.Find("a:key");
+
+    NamespaceTable::Charge(a, 960);
+    // Plenty of space, but above 90% of its capacity
+    EXPECT_EQ(table.UpdateShares(100000, 0.9), 60);
+    EXPECT_EQ(a->share(), 900);
+}
+
+}  // namespace mooncake
@@ -0,0 +1,113 @@
+#include "object_cache.h"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mooncake {
+
+class ObjectCacheTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        google::InitGoogleLogging("ObjectCacheTest");
+        FLAGS_logtostderr = 1;
+    }
+
+    void TearDown() override { google::ShutdownGoogleLogging(); }
+
+    static std::vector<Slice> SlicesOf(std::string& value) {
+        return {Slice{value.data(), value.size()}};
+    }
+
+    // The cached value of key, or an empty string on a miss
+    static std::string Read(ObjectCache& cache, const ObjectKey& key,
+                            size_t size) {
+        std::string value(size, '\0');
+        auto slices = SlicesOf(value);
+        return cache.Get(key, slices) ? value : "";
+    }
+
+    static ObjectCache::Clock::time_point After(int ms) {
+        return ObjectCache::Clock::now() + std::chrono::milliseconds(ms);
+    }
+};
+
+TEST_F(ObjectCacheTest, AdmitsOnTheSecondReadUntilTheLeaseExpires) {
+    ObjectCache cache(1024, 2);
+    std::string value = "value";
+
+    cache.Put("key", SlicesOf(value), After(100), cache.generation());
+    EXPECT_EQ(Read(cache, "key", value.size()), "");
+
+    cache.Put("key", SlicesOf(value), After(100), cache.generation());
+    EXPECT_EQ(Read(cache, "key", value.size()), "value");
+    EXPECT_EQ(cache.size_bytes(), value.size());
+    EXPECT_EQ(cache.hits(), 1u);
+    EXPECT_EQ(cache.misses(), 1u);
+
+    // A read into slices of another size misses
+    EXPECT_EQ(Read(cache, "key", value.size() + 1), "");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    EXPECT_EQ(Read(cache, "key", value.size()), "");
+    EXPECT_EQ(cache.size_bytes(), 0u);
+}
+
+TEST_F(ObjectCacheTest, CopiesAcrossSlices) {
+    ObjectCache cache(1024, 1);
+    std::string head = "hello ", tail = "world";
+    cache.Put("key",
+              {Slice{head.data(), head.size()}, Slice{tail.data(), tail.size()}},
+              After(1000), cache.generation());
+
+    std::string first(3, '\0'), second(8, '\0');
+    std::vector<Slice> slices{Slice{first.data(), first.size()},
+                              Slice{second.data(), second.size()}};
+    ASSERT_TRUE(cache.Get("key", slices));
+    EXPECT_EQ(first + second, "hello world");
+}
+
+TEST_F(ObjectCacheTest, EvictsTheLeastRecentlyUsedBytes) {
+    ObjectCache cache(10, 1);
+    std::string a = "aaaa", b = "bbbb", c = "cccc";
+    cache.Put("a", SlicesOf(a), After(1000), cache.generation());
+    cache.Put("b", SlicesOf(b), After(1000), cache.generation());
+    EXPECT_EQ(Read(cache, "a", 4), "aaaa");
+
+    cache.Put("c", SlicesOf(c), After(1000), cache.generation());
+    EXPECT_EQ(Read(cache, "b", 4), "");
+    EXPECT_EQ(Read(cache, "a", 4), "aaaa");
+    EXPECT_EQ(Read(cache, "c", 4), "cccc");
+    EXPECT_EQ(cache.size_bytes(), 8u);
+
+    // Values larger than the cache are never admitted
+    std::string large(11, 'x');
+    cache.Put("large", SlicesOf(large), After(1000), cache.generation());
+    EXPECT_EQ(Read(cache, "large", large.size()), "");
+    EXPECT_EQ(cache.size_bytes(), 8u);
+}
+
+TEST_F(ObjectCacheTest, InvalidateAndClear) {
+    ObjectCache cache(1024, 1);
+    std::string value = "value";
+    cache.Put("a", SlicesOf(value), After(1000), cache.generation());
+    cache.Put("b", SlicesOf(value), After(1000), cache.generation());
+
+    cache.Invalidate("a");
+    EXPECT_EQ(Read(cache, "a", value.size()), "");
+    EXPECT_EQ(Read(cache, "b", value.size()), "value");
+
+    // A read started before the clear must not be cached after it
+    const uint64_t generation = cache.generation();
+    cache.Clear();
+    EXPECT_EQ(Read(cache, "b", value.size()), "");
+    cache.Put("b", SlicesOf(value), After(1000), generation);
+    EXPECT_EQ(Read(cache, "b", value.size()), "");
+    EXPECT_EQ(cache.size_bytes(), 0u);
+}
+
+}  // namespace mooncake
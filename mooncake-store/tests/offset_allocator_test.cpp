@@ -1,7 +1,10 @@
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <chrono>
 #include <map>
 #include <random>
+#include <thread>
 #include <vector>
 
 #include "offset_allocator/offset_allocator.hpp"
@@ -1122,6 +1125,136 @@ TEST_F(OffsetAllocatorTest, BinSystemPageSizeMultiples) {
     }
 }
 
+// Test that blocks held by the thread caches are reclaimed when the central
+// allocator runs out of space
+TEST_F(OffsetAllocatorTest, ThreadCacheReleasedOnFullAllocation) {
+    constexpr size_t ALLOCATOR_SIZE = 64 * 1024 * 1024;  // 64MB
+    auto allocator =
+        OffsetAllocator::create(0, ALLOCATOR_SIZE, 10000, true);
+
+    std::vector<OffsetAllocationHandle> handles;
+    for (int i = 0; i < 1000; i++) {
+        auto handle = allocator->allocate(4096);
+        ASSERT_TRUE(handle.has_value());
+        handles.push_back(std::move(*handle));
+    }
+    handles.clear();
+
+    auto handle = allocator->allocate(ALLOCATOR_SIZE);
+    ASSERT_TRUE(handle.has_value());
+    EXPECT_EQ(handle->size(), ALLOCATOR_SIZE);
+}
+
+// Compare the throughput of concurrent small allocations with and without
+// the thread caches, checking that live allocations never overlap
+TEST_F(OffsetAllocatorTest, MultiThreadedThroughput) {
+    constexpr size_t ALLOCATOR_SIZE = 1024ull * 1024 * 1024;  // 1GB
+    constexpr int NUM_THREADS = 8;
+    constexpr int ITERATIONS = 20000;
+    const std::vector<size_t> sizes = {4096, 16384, 65536, 262144};
+
+    for (bool thread_cache : {false, true}) {
+        auto allocator =
+            OffsetAllocator::create(0, ALLOCATOR_SIZE, 128 * 1024,
+                                    thread_cache);
+        std::atomic<bool> overlap{false};
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (int t = 0; t < NUM_THREADS; t++) {
+            threads.emplace_back([&, t]() {
+                std::mt19937 rng(t);
+                std::map<uint64_t, uint64_t> live;  // address -> end
+                std::vector<OffsetAllocationHandle> handles;
+                for (int i = 0; i < ITERATIONS; i++) {
+                    if (handles.size() < 32 && (rng() % 2 || handles.empty())) {
+                        size_t size = sizes[rng() % sizes.size()];
+                        auto handle = allocator->allocate(size);
+                        if (!handle.has_value()) continue;
+                        if (handle->size() != size) overlap = true;
+                        uint64_t addr = handle->address();
+                        auto next = live.lower_bound(addr);
+                        if (next != live.end() && next->first < addr + size) {
+                            overlap = true;
+                        }
+                        if (next != live.begin() &&
+                            std::prev(next)->second > addr) {
+                            overlap = true;
+                        }
+                        live[addr] = addr + size;
+                        handles.push_back(std::move(*handle));
+                    } else {
+                        size_t index = rng() % handles.size();
+                        live.erase(handles[index].address());
+                        std::swap(handles[index], handles.back());
+                        handles.pop_back();
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+        EXPECT_FALSE(overlap);
+        std::cout << (thread_cache ? "with" : "without")
+                  << " thread cache: "
+                  << NUM_THREADS * ITERATIONS * 1000000.0 / (elapsed + 1)
+                  << " ops/s" << std::endl;
+
+        // Everything was returned, so the whole space is free again
+        auto handle = allocator->allocate(ALLOCATOR_SIZE);
+        EXPECT_TRUE(handle.has_value());
+    }
+}
+
+// Allocations restored at their addresses are freed like any other
+TEST_F(OffsetAllocatorTest, AllocateAtAddress) {
+    constexpr uint64_t BASE = 0x100000000;
+    constexpr uint32 ALLOCATOR_SIZE = 64 * 1024 * 1024;
+    constexpr uint32 BLOCK = 1024 * 1024;
+    auto allocator = OffsetAllocator::create(BASE, ALLOCATOR_SIZE, 1000);
+
+    auto middle = allocator->allocateAt(BASE + 8 * BLOCK, BLOCK);
+    ASSERT_TRUE(middle.has_value());
+    EXPECT_EQ(middle->address(), BASE + 8 * BLOCK);
+    EXPECT_EQ(middle->size(), BLOCK);
+    auto first = allocator->allocateAt(BASE, BLOCK);
+    ASSERT_TRUE(first.has_value());
+    auto last = allocator->allocateAt(BASE + ALLOCATOR_SIZE - BLOCK, BLOCK);
+    ASSERT_TRUE(last.has_value());
+    EXPECT_EQ(allocator->storageReport().totalFreeSpace,
+              ALLOCATOR_SIZE - 3 * BLOCK);
+
+    // Taken, overlapping, outside or misaligned ranges fail
+    EXPECT_FALSE(allocator->allocateAt(BASE + 8 * BLOCK, BLOCK).has_value());
+    EXPECT_FALSE(
+        allocator->allocateAt(BASE + 7 * BLOCK + 1, BLOCK).has_value());
+    EXPECT_FALSE(
+        allocator->allocateAt(BASE + ALLOCATOR_SIZE, BLOCK).has_value());
+    EXPECT_FALSE(allocator->allocateAt(BASE - BLOCK, BLOCK).has_value());
+
+    // New allocations avoid the restored ones
+    std::vector<OffsetAllocationHandle> handles;
+    while (auto handle = allocator->allocate(BLOCK)) {
+        EXPECT_NE(handle->address(), middle->address());
+        EXPECT_NE(handle->address(), first->address());
+        EXPECT_NE(handle->address(), last->address());
+        handles.push_back(std::move(*handle));
+    }
+    EXPECT_EQ(handles.size(), ALLOCATOR_SIZE / BLOCK - 3);
+
+    // Freed restored ranges merge back with their neighbours
+    handles.clear();
+    middle.reset();
+    first.reset();
+    last.reset();
+    auto report = allocator->storageReport();
+    EXPECT_EQ(report.totalFreeSpace, ALLOCATOR_SIZE);
+    EXPECT_EQ(report.largestFreeRegion, ALLOCATOR_SIZE);
+}
+
 int main(int argc, char** argv) {
     // Initialize Google Test
     ::testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,68 @@
+#include "partitioned_master_client.h"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace mooncake {
+
+class PartitionedMasterClientTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        google::InitGoogleLogging("PartitionedMasterClientTest");
+        FLAGS_logtostderr = 1;
+    }
+
+    void TearDown() override { google::ShutdownGoogleLogging(); }
+};
+
+TEST_F(PartitionedMasterClientTest, PartitionOfIsStableAndBalanced) {
+    EXPECT_EQ(PartitionedMasterClient::PartitionOf("key", 1), 0);
+    EXPECT_EQ(PartitionedMasterClient::PartitionOf("key", 0), 0);
+    // FNV-1a of the empty key is its offset basis
+    EXPECT_EQ(PartitionedMasterClient::PartitionOf("", 7),
+              14695981039346656037ull % 7);
+
+    constexpr size_t kPartitions = 4;
+    constexpr int kKeys = 40000;
+    std::vector<int> counts(kPartitions, 0);
+    for (int i = 0; i < kKeys; ++i) {
+        std::string key = "block_" + std::to_string(i);
+        size_t partition = PartitionedMasterClient::PartitionOf(key,
+                                                                kPartitions);
+        ASSERT_LT(partition, kPartitions);
+        EXPECT_EQ(partition,
+                  PartitionedMasterClient::PartitionOf(key, kPartitions));
+        counts[partition]++;
+    }
+    for (int count : counts) {
+        EXPECT_GT(count, kKeys / kPartitions * 9 / 10);
+        EXPECT_LT(count, kKeys / kPartitions * 11 / 10);
+    }
+}
+
+TEST_F(PartitionedMasterClientTest, SplitSegment) {
+    const size_t slab = facebook::cachelib::Slab::kSize;
+    Segment segment(generate_uuid(), "segment", 0x300000000, 10 * slab);
+
+    auto parts = PartitionedMasterClient::SplitSegment(segment, 1);
+    ASSERT_EQ(parts.size(), 1);
+    EXPECT_EQ(parts[0].base, segment.base);
+    EXPECT_EQ(parts[0].size, segment.size);
+
+    // Each partition gets 3 slabs, the last one is left unused
+    parts = PartitionedMasterClient::SplitSegment(segment, 3);
+    ASSERT_EQ(parts.size(), 3);
+    for (size_t i = 0; i < parts.size(); ++i) {
+        EXPECT_EQ(parts[i].id, segment.id);
+        EXPECT_EQ(parts[i].name, segment.name);
+        EXPECT_EQ(parts[i].base, segment.base + i * 3 * slab);
+        EXPECT_EQ(parts[i].size, 3 * slab);
+    }
+
+    EXPECT_TRUE(PartitionedMasterClient::SplitSegment(segment, 11).empty());
+}
+
+}  // namespace mooncake
@@ -0,0 +1,232 @@
+#include "payload_codec.h"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace mooncake {
+
+namespace {
+
+// FP16 values of a normal distribution, similar to KV cache contents
+std::vector<uint16_t> MakeHalves(size_t count, float stddev) {
+    std::mt19937 rng(42);
+    std::normal_distribution<float> dist(0.0f, stddev);
+    std::vector<uint16_t> halves(count);
+    for (auto& half : halves) {
+        float value = dist(rng);
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        const uint32_t magnitude = bits & 0x7fffffff;
+        const uint16_t sign = (bits >> 16) & 0x8000;
+        // Truncates to FP16, normal range only
+        half = magnitude < 0x38800000
+                   ? sign
+                   : sign | ((magnitude - 0x38000000) >> 13);
+    }
+    return halves;
+}
+
+float HalfValue(uint16_t half) {
+    const int exponent = (half >> 10) & 0x1f;
+    const int mantissa = half & 0x3ff;
+    float value = exponent == 0
+                      ? std::ldexp(static_cast<float>(mantissa), -24)
+                      : std::ldexp(1.0f + mantissa / 1024.0f, exponent - 15);
+    return (half & 0x8000) ? -value : value;
+}
+
+class XorCodec : public PayloadCodec {
+   public:
+    PayloadCodecId id() const override {
+        return static_cast<PayloadCodecId>(kFirstCustomPayloadCodec + 1);
+    }
+    std::string name() const override { return "xor"; }
+    size_t MaxEncodedSize(size_t size) const override { return size; }
+    tl::expected<size_t, ErrorCode> Encode(
+        std::span<const uint8_t> in, std::span<uint8_t> out) const override {
+        for (size_t i = 0; i < in.size(); ++i) {
+            out[i] = in[i] ^ 0x5a;
+        }
+        return in.size();
+    }
+    ErrorCode Decode(std::span<const uint8_t> in,
+                     std::span<uint8_t> out) const override {
+        for (size_t i = 0; i < in.size(); ++i) {
+            out[i] = in[i] ^ 0x5a;
+        }
+        return ErrorCode::OK;
+    }
+};
+
+}  // namespace
+
+class PayloadCodecTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        google::InitGoogleLogging("PayloadCodecTest");
+        FLAGS_logtostderr = 1;
+    }
+
+    void TearDown() override { google::ShutdownGoogleLogging(); }
+};
+
+TEST_F(PayloadCodecTest, BytePlaneRoundTrip) {
+    const PayloadCodec* codec = GetPayloadCodec(PayloadCodecId::BYTE_PLANE);
+    ASSERT_NE(codec, nullptr);
+
+    // Over one plane block, with an odd tail byte
+    auto halves = MakeHalves(100000, 0.5f);
+    std::vector<uint8_t> data(halves.size() * 2 + 1);
+    std::memcpy(data.data(), halves.data(), halves.size() * 2);
+    data.back() = 0x7b;
+
+    std::vector<uint8_t> encoded(codec->MaxEncodedSize(data.size()));
+    auto size = codec->Encode(data, encoded);
+    ASSERT_TRUE(size.has_value());
+    EXPECT_LT(size.value(), data.size());
+
+    std::vector<uint8_t> decoded(data.size());
+    EXPECT_EQ(codec->Decode({encoded.data(), size.value()}, decoded),
+              ErrorCode::OK);
+    EXPECT_EQ(decoded, data);
+
+    // Random bytes are kept raw, within the bound
+    std::mt19937 rng(7);
+    for (auto& byte : data) {
+        byte = rng();
+    }
+    size = codec->Encode(data, encoded);
+    ASSERT_TRUE(size.has_value());
+    EXPECT_LE(size.value(), codec->MaxEncodedSize(data.size()));
+    EXPECT_EQ(codec->Decode({encoded.data(), size.value()}, decoded),
+              ErrorCode::OK);
+    EXPECT_EQ(decoded, data);
+
+    // Truncated input is refused
+    EXPECT_NE(codec->Decode({encoded.data(), size.value() - 1}, decoded),
+              ErrorCode::OK);
+}
+
+TEST_F(PayloadCodecTest, Fp8ErrorIsBounded) {
+    const PayloadCodec* codec =
+        GetPayloadCodec(PayloadCodecId::FP8_FROM_FP16);
+    ASSERT_NE(codec, nullptr);
+
+    auto halves = MakeHalves(1000, 2.0f);
+    std::span<const uint8_t> data(
+        reinterpret_cast<const uint8_t*>(halves.data()), halves.size() * 2);
+    std::vector<uint8_t> encoded(codec->MaxEncodedSize(data.size()));
+    auto size = codec->Encode(data, encoded);
+    ASSERT_TRUE(size.has_value());
+    EXPECT_LT(size.value(), data.size() * 6 / 10);
+
+    std::vector<uint16_t> decoded(halves.size());
+    EXPECT_EQ(codec->Decode({encoded.data(), size.value()},
+                            {reinterpret_cast<uint8_t*>(decoded.data()),
+                             decoded.size() * 2}),
+              ErrorCode::OK);
+    for (size_t first = 0; first < halves.size(); first += 128) {
+        float amax = 0.0f;
+        const size_t last = std::min(first + 128, halves.size());
+        for (size_t i = first; i < last; ++i) {
+            amax = std::max(amax, std::fabs(HalfValue(halves[i])));
+        }
+        for (size_t i = first; i < last; ++i) {
+            const float original = HalfValue(halves[i]);
+            const float error = std::fabs(HalfValue(decoded[i]) - original);
+            // 3 mantissa bits, and the subnormal step of the group scale
+            EXPECT_LE(error,
+                      std::fabs(original) / 16 + amax / 448 / 512 + 1e-3f)
+                << "element " << i;
+        }
+    }
+}
+
+TEST_F(PayloadCodecTest, FramedPayloadRoundTrip) {
+    const PayloadCodec* codec = GetPayloadCodec(PayloadCodecId::BYTE_PLANE);
+    std::vector<uint8_t> first(3000, 1), second(5001, 2);
+    std::vector<Slice> slices = {{first.data(), first.size()},
+                                 {second.data(), second.size()}};
+
+    std::vector<uint8_t> stored(
+        MaxEncodedPayloadSize(*codec, first.size() + second.size()));
+    auto stored_size = EncodePayload(*codec, slices, stored);
+    ASSERT_TRUE(stored_size.has_value());
+    auto header = ParsePayloadHeader(stored.data(), stored_size.value());
+    ASSERT_TRUE(header.has_value());
+    EXPECT_EQ(header->codec, PayloadCodecId::BYTE_PLANE);
+    EXPECT_EQ(header->original_size, 8001);
+    // Only the exact stored size is recognized
+    EXPECT_FALSE(ParsePayloadHeader(stored.data(), stored_size.value() + 1));
+
+    // Into slices of another layout
+    std::vector<uint8_t> out(8001);
+    std::vector<Slice> out_slices = {{out.data(), 10},
+                                     {out.data() + 10, out.size() - 10}};
+    auto decoded = DecodePayload({stored.data(), stored_size.value()},
+                                 out_slices);
+    ASSERT_TRUE(decoded.has_value());
+    EXPECT_EQ(decoded.value(), 8001);
+    EXPECT_TRUE(std::equal(first.begin(), first.end(), out.begin()));
+    EXPECT_TRUE(std::equal(second.begin(), second.end(),
+                           out.begin() + first.size()));
+
+    // In place, with and without enough room
+    std::vector<uint8_t> buffer = stored;
+    auto in_place =
+        DecodePayloadInPlace(buffer.data(), stored_size.value(), 8000);
+    ASSERT_FALSE(in_place.has_value());
+    EXPECT_EQ(in_place.error(), ErrorCode::BUFFER_OVERFLOW);
+    buffer = stored;
+    buffer.resize(std::max<size_t>(stored.size(), 8001));
+    in_place = DecodePayloadInPlace(buffer.data(), stored_size.value(),
+                                    buffer.size());
+    ASSERT_TRUE(in_place.has_value());
+    EXPECT_EQ(in_place.value(), 8001);
+    EXPECT_TRUE(std::equal(out.begin(), out.end(), buffer.begin()));
+
+    // Data that is not encoded is left as it is
+    std::vector<uint8_t> plain(100, 9);
+    in_place = DecodePayloadInPlace(plain.data(), plain.size(), plain.size());
+    ASSERT_TRUE(in_place.has_value());
+    EXPECT_EQ(in_place.value(), 100);
+    EXPECT_EQ(plain, std::vector<uint8_t>(100, 9));
+}
+
+TEST_F(PayloadCodecTest, RegistersCustomCodecs) {
+    class ReservedId : public XorCodec {
+       public:
+        PayloadCodecId id() const override {
+            return PayloadCodecId::BYTE_PLANE;
+        }
+    };
+    EXPECT_EQ(RegisterPayloadCodec(std::make_unique<ReservedId>()),
+              ErrorCode::INVALID_PARAMS);
+    EXPECT_EQ(RegisterPayloadCodec(std::make_unique<XorCodec>()),
+              ErrorCode::OK);
+    EXPECT_EQ(RegisterPayloadCodec(std::make_unique<XorCodec>()),
+              ErrorCode::INVALID_PARAMS);
+
+    auto id = static_cast<PayloadCodecId>(kFirstCustomPayloadCodec + 1);
+    const PayloadCodec* codec = GetPayloadCodec(id);
+    ASSERT_NE(codec, nullptr);
+    EXPECT_EQ(codec->name(), "xor");
+
+    std::vector<uint8_t> data(64, 3);
+    std::vector<uint8_t> stored(MaxEncodedPayloadSize(*codec, data.size()));
+    auto stored_size =
+        EncodePayload(*codec, {Slice{data.data(), data.size()}}, stored);
+    ASSERT_TRUE(stored_size.has_value());
+    std::vector<uint8_t> out(64);
+    auto decoded = DecodePayload({stored.data(), stored_size.value()},
+                                 {Slice{out.data(), out.size()}});
+    ASSERT_TRUE(decoded.has_value());
+    EXPECT_EQ(out, data);
+}
+
+}  // namespace mooncake
@@ -0,0 +1,107 @@
+#include "replica_cache.h"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mooncake {
+
+class ReplicaCacheTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        google::InitGoogleLogging("ReplicaCacheTest");
+        FLAGS_logtostderr = 1;
+    }
+
+    void TearDown() override { google::ShutdownGoogleLogging(); }
+
+    // A disk replica whose path identifies it
+    static std::vector<Replica::Descriptor> MakeReplicas(
+        const std::string& path) {
+        Replica::Descriptor replica;
+        replica.descriptor_variant = DiskDescriptor{path, 1024, 0};
+        replica.status = ReplicaStatus::COMPLETE;
+        return {replica};
+    }
+
+    static std::string PathOf(
+        const std::optional<std::vector<Replica::Descriptor>>& replicas) {
+        if (!replicas || replicas->empty()) {
+            return "";
+        }
+        return replicas->front().get_disk_descriptor().file_path;
+    }
+
+    static ReplicaCache::Clock::time_point After(int ms) {
+        return ReplicaCache::Clock::now() + std::chrono::milliseconds(ms);
+    }
+};
+
+TEST_F(ReplicaCacheTest, HitsUntilTheLeaseExpires) {
+    ReplicaCache cache(16);
+    EXPECT_FALSE(cache.Get("key").has_value());
+
+    cache.Put("key", MakeReplicas("a"), After(100), cache.generation());
+    EXPECT_EQ(PathOf(cache.Get("key")), "a");
+    EXPECT_EQ(cache.hits(), 1u);
+    EXPECT_EQ(cache.misses(), 1u);
+
+    // A new lease replaces the entry
+    cache.Put("key", MakeReplicas("b"), After(100), cache.generation());
+    EXPECT_EQ(PathOf(cache.Get("key")), "b");
+    EXPECT_EQ(cache.size(), 1u);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    EXPECT_FALSE(cache.Get("key").has_value());
+    EXPECT_EQ(cache.size(), 0u);
+
+    // Already expired leases are not cached
+    cache.Put("key", MakeReplicas("c"), After(0), cache.generation());
+    EXPECT_FALSE(cache.Get("key").has_value());
+}
+
+TEST_F(ReplicaCacheTest, Invalidation) {
+    ReplicaCache cache(16);
+    cache.Put("first", MakeReplicas("a"), After(10000), cache.generation());
+    cache.Put("second", MakeReplicas("b"), After(10000), cache.generation());
+    cache.Invalidate("first");
+    EXPECT_FALSE(cache.Get("first").has_value());
+    EXPECT_EQ(PathOf(cache.Get("second")), "b");
+
+    // The first version is only recorded
+    cache.SetVersion(7);
+    EXPECT_EQ(PathOf(cache.Get("second")), "b");
+    cache.SetVersion(7);
+    EXPECT_EQ(PathOf(cache.Get("second")), "b");
+
+    // Replicas requested before the version changed are not cached
+    const uint64_t generation = cache.generation();
+    cache.SetVersion(8);
+    EXPECT_FALSE(cache.Get("second").has_value());
+    cache.Put("second", MakeReplicas("old"), After(10000), generation);
+    EXPECT_FALSE(cache.Get("second").has_value());
+    cache.Put("second", MakeReplicas("new"), After(10000),
+              cache.generation());
+    EXPECT_EQ(PathOf(cache.Get("second")), "new");
+
+    cache.Clear();
+    EXPECT_EQ(cache.size(), 0u);
+}
+
+TEST_F(ReplicaCacheTest, DropsLeastRecentlyUsed) {
+    ReplicaCache cache(2);
+    cache.Put("first", MakeReplicas("a"), After(10000), cache.generation());
+    cache.Put("second", MakeReplicas("b"), After(10000), cache.generation());
+    ASSERT_TRUE(cache.Get("first").has_value());
+    cache.Put("third", MakeReplicas("c"), After(10000), cache.generation());
+    EXPECT_EQ(cache.size(), 2u);
+    EXPECT_TRUE(cache.Get("first").has_value());
+    EXPECT_FALSE(cache.Get("second").has_value());
+    EXPECT_TRUE(cache.Get("third").has_value());
+}
+
+}  // namespace mooncake
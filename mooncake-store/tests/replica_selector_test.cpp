@@ -0,0 +1,148 @@
+#include "replica_selector.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "types.h"
+
+namespace mooncake {
+
+namespace {
+
+Replica::Descriptor MakeMemoryReplica(
+    const std::vector<std::string>& segments, uint64_t size = 64 * 1024,
+    ReplicaStatus status = ReplicaStatus::COMPLETE) {
+    MemoryDescriptor mem_desc;
+    for (const auto& segment : segments) {
+        mem_desc.buffer_descriptors.push_back(
+            {segment, size, 0x1000, BufStatus::COMPLETE});
+    }
+    return {mem_desc, status};
+}
+
+Replica::Descriptor MakeDiskReplica() {
+    return {DiskDescriptor{"/tmp/object", 1024}, ReplicaStatus::COMPLETE};
+}
+
+std::string FirstSegment(const Replica::Descriptor& replica) {
+    return replica.get_memory_descriptor().buffer_descriptors[0].segment_name_;
+}
+
+}  // namespace
+
+TEST(ReplicaSelectorTest, HostOf) {
+    EXPECT_EQ(ReplicaSelector::HostOf("10.0.0.1:12345"), "10.0.0.1");
+    EXPECT_EQ(ReplicaSelector::HostOf("node-a"), "node-a");
+    EXPECT_EQ(ReplicaSelector::HostOf("node-a:"), "node-a:");
+    EXPECT_EQ(ReplicaSelector::HostOf("node-a:rdma0"), "node-a:rdma0");
+}
+
+TEST(ReplicaSelectorTest, PrefersLocalThenSameHost) {
+    ReplicaSelector selector("10.0.0.1:1000");
+    std::vector<Replica::Descriptor> replicas = {
+        MakeDiskReplica(),
+        MakeMemoryReplica({"10.0.0.2:1000"}),
+        MakeMemoryReplica({"10.0.0.1:2000"}),
+        MakeMemoryReplica({"10.0.0.1:1000"}),
+    };
+    EXPECT_EQ(selector.GetLocality(replicas[0]),
+              ReplicaSelector::Locality::DISK);
+    EXPECT_EQ(selector.GetLocality(replicas[1]),
+              ReplicaSelector::Locality::REMOTE);
+    EXPECT_EQ(selector.GetLocality(replicas[2]),
+              ReplicaSelector::Locality::SAME_HOST);
+    EXPECT_EQ(selector.GetLocality(replicas[3]),
+              ReplicaSelector::Locality::LOCAL);
+
+    Replica::Descriptor chosen;
+    ASSERT_EQ(selector.Select(replicas, chosen), ErrorCode::OK);
+    EXPECT_EQ(FirstSegment(chosen), "10.0.0.1:1000");
+
+    replicas.pop_back();
+    ASSERT_EQ(selector.Select(replicas, chosen), ErrorCode::OK);
+    EXPECT_EQ(FirstSegment(chosen), "10.0.0.1:2000");
+
+    replicas.pop_back();
+    ASSERT_EQ(selector.Select(replicas, chosen), ErrorCode::OK);
+    EXPECT_EQ(FirstSegment(chosen), "10.0.0.2:1000");
+
+    replicas.pop_back();
+    ASSERT_EQ(selector.Select(replicas, chosen), ErrorCode::OK);
+    EXPECT_FALSE(chosen.is_memory_replica());
+}
+
+TEST(ReplicaSelectorTest, MixedReplicaIsRemote) {
+    ReplicaSelector selector("10.0.0.1:1000");
+    auto replica = MakeMemoryReplica({"10.0.0.1:1000", "10.0.0.2:1000"});
+    EXPECT_EQ(selector.GetLocality(replica),
+              ReplicaSelector::Locality::REMOTE);
+}
+
+TEST(ReplicaSelectorTest, SkipsIncompleteReplicas) {
+    ReplicaSelector selector("10.0.0.1:1000");
+    std::vector<Replica::Descriptor> replicas = {
+        MakeMemoryReplica({"10.0.0.1:1000"}, 1024,
+                          ReplicaStatus::PROCESSING),
+        MakeMemoryReplica({"10.0.0.2:1000"}),
+    };
+    Replica::Descriptor chosen;
+    ASSERT_EQ(selector.Select(replicas, chosen), ErrorCode::OK);
+    EXPECT_EQ(FirstSegment(chosen), "10.0.0.2:1000");
+
+    replicas.pop_back();
+    EXPECT_EQ(selector.Select(replicas, chosen), ErrorCode::INVALID_REPLICA);
+    EXPECT_EQ(selector.Select({}, chosen), ErrorCode::INVALID_REPLICA);
+}
+
+TEST(ReplicaSelectorTest, InflightTransfersSpreadReads) {
+    ReplicaSelector selector("client");
+    std::vector<Replica::Descriptor> replicas = {
+        MakeMemoryReplica({"node-a:1000"}),
+        MakeMemoryReplica({"node-b:1000"}),
+    };
+    Replica::Descriptor chosen;
+    ASSERT_EQ(selector.Select(replicas, chosen), ErrorCode::OK);
+    EXPECT_EQ(FirstSegment(chosen), "node-a:1000");
+
+    auto ticket = selector.BeginTransfer(chosen);
+    ASSERT_EQ(selector.Select(replicas, chosen), ErrorCode::OK);
+    EXPECT_EQ(FirstSegment(chosen), "node-b:1000");
+
+    // A failed transfer releases the endpoint without a latency sample
+    ticket.Finish(false);
+    ASSERT_EQ(selector.Select(replicas, chosen), ErrorCode::OK);
+    EXPECT_EQ(FirstSegment(chosen), "node-a:1000");
+
+    // Destroying a ticket releases the endpoint as well
+    {
+        auto scoped = selector.BeginTransfer(replicas[0]);
+        EXPECT_GT(selector.EstimateCost(replicas[0]),
+                  selector.EstimateCost(replicas[1]));
+    }
+    EXPECT_EQ(selector.EstimateCost(replicas[0]),
+              selector.EstimateCost(replicas[1]));
+}
+
+TEST(ReplicaSelectorTest, LowerLatencyWins) {
+    ReplicaSelector selector("client");
+    std::vector<Replica::Descriptor> replicas = {
+        MakeMemoryReplica({"node-a:1000"}, 1024),
+        MakeMemoryReplica({"node-b:1000"}, 1024),
+    };
+    // node-a: about 20ms per KiB, far slower than the unmeasured default
+    auto slow = selector.BeginTransfer(replicas[0]);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    slow.Finish(true);
+
+    Replica::Descriptor chosen;
+    ASSERT_EQ(selector.Select(replicas, chosen), ErrorCode::OK);
+    EXPECT_EQ(FirstSegment(chosen), "node-b:1000");
+    EXPECT_GT(selector.EstimateCost(replicas[0]),
+              selector.EstimateCost(replicas[1]));
+}
+
+}  // namespace mooncake
@@ -0,0 +1,88 @@
+#include "request_coalescer.h"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mooncake {
+
+class RequestCoalescerTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        google::InitGoogleLogging("RequestCoalescerTest");
+        FLAGS_logtostderr = 1;
+    }
+
+    void TearDown() override { google::ShutdownGoogleLogging(); }
+};
+
+TEST_F(RequestCoalescerTest, MergesConcurrentRequests) {
+    constexpr size_t kThreads = 16;
+    constexpr size_t kRequestsPerThread = 200;
+    constexpr size_t kMaxKeys = 8;
+    std::atomic<size_t> largest_batch{0};
+    RequestCoalescer<std::string> coalescer(
+        [&](const std::vector<std::string>& keys) {
+            size_t seen = largest_batch;
+            while (keys.size() > seen &&
+                   !largest_batch.compare_exchange_weak(seen, keys.size())) {
+            }
+            // Simulate the round trip, so that callers pile up
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            std::vector<std::string> results;
+            for (const auto& key : keys) {
+                results.push_back("value_" + key);
+            }
+            return results;
+        },
+        std::chrono::microseconds(500), kMaxKeys, "error");
+
+    std::atomic<size_t> mismatches{0};
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&, t]() {
+            for (size_t i = 0; i < kRequestsPerThread; ++i) {
+                const std::string key =
+                    std::to_string(t) + "_" + std::to_string(i);
+                if (coalescer.Submit(key) != "value_" + key) {
+                    mismatches++;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(mismatches, 0u);
+    EXPECT_EQ(coalescer.keys(), kThreads * kRequestsPerThread);
+    EXPECT_LT(coalescer.batches(), kThreads * kRequestsPerThread / 2);
+    EXPECT_LE(largest_batch, kMaxKeys);
+}
+
+TEST_F(RequestCoalescerTest, LoneCallerWaitsAtMostTheWindow) {
+    RequestCoalescer<int> coalescer(
+        [](const std::vector<std::string>& keys) {
+            return std::vector<int>(keys.size(), 1);
+        },
+        std::chrono::microseconds(1000), 64, -1);
+    const auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(coalescer.Submit("key"), 1);
+    EXPECT_LT(std::chrono::steady_clock::now() - start,
+              std::chrono::milliseconds(500));
+    EXPECT_EQ(coalescer.batches(), 1u);
+}
+
+TEST_F(RequestCoalescerTest, WrongResultCountFailsTheBatch) {
+    RequestCoalescer<int> coalescer(
+        [](const std::vector<std::string>&) { return std::vector<int>{}; },
+        std::chrono::microseconds(10), 1, -1);
+    EXPECT_EQ(coalescer.Submit("key"), -1);
+}
+
+}  // namespace mooncake
@@ -0,0 +1,87 @@
+#include "request_tracer.h"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace mooncake {
+
+class RequestTracerTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        google::InitGoogleLogging("RequestTracerTest");
+        FLAGS_logtostderr = 1;
+    }
+
+    void TearDown() override { google::ShutdownGoogleLogging(); }
+};
+
+TEST_F(RequestTracerTest, SamplesOneInInterval) {
+    RequestTracer tracer(4, 16);
+    for (int i = 0; i < 16; ++i) {
+        RequestTracer::ScopedTrace trace(&tracer, "Get",
+                                         "key" + std::to_string(i));
+    }
+    EXPECT_EQ(tracer.Recent().size(), 4);
+
+    RequestTracer disabled(0, 16);
+    for (int i = 0; i < 16; ++i) {
+        RequestTracer::ScopedTrace trace(&disabled, "Get", "key");
+        RequestTracer::ScopedSpan span("rpc");
+        EXPECT_EQ(RequestTracer::CurrentTraceId(), 0);
+    }
+    EXPECT_TRUE(disabled.Recent().empty());
+}
+
+TEST_F(RequestTracerTest, RecordsNestedSpans) {
+    RequestTracer tracer(1, 16);
+    uint64_t trace_id = 0;
+    {
+        RequestTracer::ScopedTrace trace(&tracer, "Get", "key\"1");
+        trace_id = RequestTracer::CurrentTraceId();
+        {
+            RequestTracer::ScopedSpan query("query_replicas");
+            RequestTracer::ScopedSpan rpc("master_rpc", "GetReplicaList");
+            // A request made while tracing joins the open trace
+            RequestTracer::ScopedTrace inner(&tracer, "Query", "key\"1");
+            EXPECT_EQ(RequestTracer::CurrentTraceId(), trace_id);
+        }
+        RequestTracer::ScopedSpan wait("transfer_wait");
+        trace.SetStatus(ErrorCode::TRANSFER_FAIL);
+    }
+    EXPECT_NE(trace_id, 0);
+    EXPECT_EQ(RequestTracer::CurrentTraceId(), 0);
+
+    auto traces = tracer.Recent();
+    ASSERT_EQ(traces.size(), 1);
+    EXPECT_EQ(traces[0].trace_id, trace_id);
+    EXPECT_EQ(traces[0].status, ErrorCode::TRANSFER_FAIL);
+    ASSERT_EQ(traces[0].spans.size(), 3);
+    EXPECT_EQ(traces[0].spans[0].name, "query_replicas");
+    EXPECT_EQ(traces[0].spans[0].depth, 0);
+    EXPECT_EQ(traces[0].spans[1].name, "master_rpc:GetReplicaList");
+    EXPECT_EQ(traces[0].spans[1].depth, 1);
+    EXPECT_EQ(traces[0].spans[2].depth, 0);
+
+    const std::string dump = tracer.Dump();
+    EXPECT_NE(dump.find("\"key\":\"key\\\"1\""), std::string::npos);
+    EXPECT_NE(dump.find("\"name\":\"master_rpc:GetReplicaList\""),
+              std::string::npos);
+    EXPECT_EQ(dump.back(), '\n');
+}
+
+TEST_F(RequestTracerTest, KeepsNewestTraces) {
+    RequestTracer tracer(1, 3);
+    for (int i = 0; i < 5; ++i) {
+        RequestTracer::ScopedTrace trace(&tracer, "Get", std::to_string(i));
+    }
+    auto traces = tracer.Recent();
+    ASSERT_EQ(traces.size(), 3);
+    EXPECT_EQ(traces[0].key, "2");
+    EXPECT_EQ(traces[1].key, "3");
+    EXPECT_EQ(traces[2].key, "4");
+}
+
+}  // namespace mooncake
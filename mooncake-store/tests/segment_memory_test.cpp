@@ -0,0 +1,108 @@
+#include "segment_memory.h"
+
+#include <Slab.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "config.h"
+#include "topology.h"
+
+namespace mooncake {
+
+class SegmentMemoryTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        google::InitGoogleLogging("SegmentMemoryTest");
+        FLAGS_logtostderr = 1;
+    }
+
+    void TearDown() override {
+        unsetenv("MC_STORE_HUGEPAGE_SIZE");
+        unsetenv("MC_STORE_PREFAULT_THREADS");
+        google::ShutdownGoogleLogging();
+    }
+
+    static constexpr size_t kAlignment = facebook::cachelib::Slab::kSize;
+};
+
+TEST_F(SegmentMemoryTest, AllocatesAlignedWritableMemory) {
+    EXPECT_EQ(SegmentMemory::Allocate(kAlignment / 2), nullptr);
+
+    const size_t size = 4 * kAlignment;
+    auto memory = SegmentMemory::Allocate(size);
+    ASSERT_NE(memory, nullptr);
+    EXPECT_EQ(memory->size(), size);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(memory->data()) % kAlignment, 0u);
+    EXPECT_EQ(memory->page_size(), (size_t)sysconf(_SC_PAGESIZE));
+    EXPECT_EQ(memory->numa_node(), -1);
+    // Pre-faulted pages read as zero
+    auto data = static_cast<char*>(memory->data());
+    EXPECT_EQ(data[0], 0);
+    EXPECT_EQ(data[size - 1], 0);
+    memset(data, 'x', size);
+    EXPECT_EQ(data[size / 2], 'x');
+}
+
+TEST_F(SegmentMemoryTest, FallsBackWithoutHugePages) {
+    // Either hugepages are reserved on this host or regular pages are used
+    setenv("MC_STORE_HUGEPAGE_SIZE", "2MB", 1);
+    setenv("MC_STORE_PREFAULT_THREADS", "3", 1);
+    auto memory = SegmentMemory::Allocate(2 * kAlignment, 0);
+    ASSERT_NE(memory, nullptr);
+    EXPECT_TRUE(memory->page_size() == (2ull << 20) ||
+                memory->page_size() == (size_t)sysconf(_SC_PAGESIZE));
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(memory->data()) % kAlignment, 0u);
+    memset(memory->data(), 'y', memory->size());
+
+    setenv("MC_STORE_HUGEPAGE_SIZE", "3MB", 1);
+    setenv("MC_STORE_PREFAULT_THREADS", "0", 1);
+    memory = SegmentMemory::Allocate(kAlignment);
+    ASSERT_NE(memory, nullptr);
+    EXPECT_EQ(memory->page_size(), (size_t)sysconf(_SC_PAGESIZE));
+}
+
+TEST_F(SegmentMemoryTest, SharedMemoryIsBackedByMemfd) {
+    auto memory = SegmentMemory::Allocate(kAlignment);
+    ASSERT_NE(memory, nullptr);
+    EXPECT_EQ(memory->fd(), -1);
+
+    globalConfig().enable_shm = true;
+    memory = SegmentMemory::Allocate(2 * kAlignment);
+    globalConfig().enable_shm = false;
+    ASSERT_NE(memory, nullptr);
+    ASSERT_GE(memory->fd(), 0);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(memory->data()) % kAlignment, 0u);
+
+    // A second mapping of the memfd sees the writes to the segment
+    struct stat st;
+    ASSERT_EQ(fstat(memory->fd(), &st), 0);
+    ASSERT_GE((size_t)st.st_size, memory->size());
+    void* view = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED,
+                      memory->fd(), 0);
+    ASSERT_NE(view, MAP_FAILED);
+    const char pattern[] = "mooncake shared segment memory";
+    memcpy(memory->data(), pattern, sizeof(pattern));
+    EXPECT_NE(memmem(view, st.st_size, pattern, sizeof(pattern)), nullptr);
+    munmap(view, st.st_size);
+}
+
+TEST_F(SegmentMemoryTest, NumaNodesFollowTopology) {
+    Topology topology;
+    ASSERT_EQ(topology.parse(R"({
+        "cpu:0": [["mlx5_0"], ["mlx5_1"]],
+        "cpu:1": [["mlx5_1"], ["mlx5_0"]],
+        "cpu:2": [[], ["mlx5_0", "mlx5_1"]],
+        "cuda:0": [["mlx5_0"], []]
+    })"),
+              0);
+    EXPECT_EQ(SegmentNumaNodes(topology), (std::vector<int>{0, 1}));
+    EXPECT_TRUE(SegmentNumaNodes(Topology()).empty());
+}
+
+}  // namespace mooncake
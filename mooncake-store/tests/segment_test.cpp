@@ -439,4 +439,77 @@ TEST_F(SegmentTest, QuerySegments) {
     ASSERT_EQ(capacity, 0);
 }
 
+// A segment grown in place is mounted as several extents under one name:
+// QuerySegments reports their total, and a drained extent stops counting.
+TEST_F(SegmentTest, QuerySegmentsSumsExtents) {
+    SegmentManager segment_manager;
+    auto segment_access = segment_manager.getSegmentAccess();
+    const size_t extent_size = 1024 * 1024 * 16;
+    std::vector<Segment> extents;
+    for (int i = 0; i < 3; i++) {
+        Segment segment;
+        segment.id = generate_uuid();
+        segment.name = "test_segment";
+        segment.size = extent_size;
+        segment.base = 0x100000000 + i * extent_size;
+        ASSERT_EQ(segment_access.MountSegment(segment, generate_uuid()),
+                  ErrorCode::OK);
+        extents.push_back(segment);
+    }
+
+    size_t used = 0, capacity = 0;
+    ASSERT_EQ(segment_access.QuerySegments("test_segment", used, capacity),
+              ErrorCode::OK);
+    EXPECT_EQ(capacity, 3 * extent_size);
+    EXPECT_EQ(used, 0);
+
+    Segment drained;
+    ASSERT_EQ(segment_access.DrainSegment(extents.back().id, drained),
+              ErrorCode::OK);
+    ASSERT_EQ(segment_access.QuerySegments("test_segment", used, capacity),
+              ErrorCode::OK);
+    EXPECT_EQ(capacity, 2 * extent_size);
+}
+
+// Allocations read a snapshot of the allocators without the segment mutex: an
+// allocator access held across a mount neither blocks it nor sees the new
+// segment, while accesses taken after the mount do.
+TEST_F(SegmentTest, AllocatorAccessIsSnapshot) {
+    SegmentManager segment_manager;
+    Segment segment;
+    segment.id = generate_uuid();
+    segment.name = "test_segment";
+    segment.size = 1024 * 1024 * 16;
+    segment.base = 0x100000000;
+    UUID client_id = generate_uuid();
+
+    auto old_access = segment_manager.getAllocatorAccess();
+    {
+        auto segment_access = segment_manager.getSegmentAccess();
+        ASSERT_EQ(segment_access.MountSegment(segment, client_id),
+                  ErrorCode::OK);
+    }
+    EXPECT_TRUE(old_access.getAllocators().empty());
+    EXPECT_TRUE(old_access.getAllocatorsByName().empty());
+
+    auto new_access = segment_manager.getAllocatorAccess();
+    ASSERT_EQ(new_access.getAllocators().size(), 1);
+    EXPECT_EQ(new_access.getAllocatorsByName().count(segment.name), 1);
+
+    // The removal shows in accesses taken after it, and waiting for the
+    // allocations returns once none uses an older snapshot
+    {
+        auto segment_access = segment_manager.getSegmentAccess();
+        size_t metrics_dec_capacity = 0;
+        ASSERT_EQ(segment_access.PrepareUnmountSegment(segment.id,
+                                                       metrics_dec_capacity),
+                  ErrorCode::OK);
+    }
+    EXPECT_EQ(new_access.getAllocators().size(), 1);
+    EXPECT_TRUE(segment_manager.getAllocatorAccess().getAllocators().empty());
+    old_access = segment_manager.getAllocatorAccess();
+    new_access = segment_manager.getAllocatorAccess();
+    segment_manager.WaitForAllocations();
+}
+
 }  // namespace mooncake
@@ -0,0 +1,81 @@
+#include "shard_affinity_pool.h"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mooncake {
+
+class ShardAffinityPoolTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        google::InitGoogleLogging("ShardAffinityPoolTest");
+        FLAGS_logtostderr = 1;
+    }
+
+    void TearDown() override { google::ShutdownGoogleLogging(); }
+};
+
+TEST_F(ShardAffinityPoolTest, SingleGroupRunsInline) {
+    ShardAffinityPool pool(1024, 8, 1);
+    EXPECT_EQ(pool.num_groups(), 0);
+    const auto caller = std::this_thread::get_id();
+    EXPECT_EQ(pool.Run(5, [] { return std::this_thread::get_id(); }), caller);
+}
+
+TEST_F(ShardAffinityPoolTest, RunsOnShardOwner) {
+    ShardAffinityPool pool(1024, 4, 2);
+    ASSERT_EQ(pool.num_groups(), 2);
+    EXPECT_EQ(pool.GroupOf(0), 0);
+    EXPECT_EQ(pool.GroupOf(511), 0);
+    EXPECT_EQ(pool.GroupOf(512), 1);
+    EXPECT_EQ(pool.GroupOf(1023), 1);
+
+    // The shards of a group are served by its workers only
+    std::set<std::thread::id> low, high;
+    for (int i = 0; i < 64; ++i) {
+        low.insert(pool.Run(i, [] { return std::this_thread::get_id(); }));
+        high.insert(
+            pool.Run(1023 - i, [] { return std::this_thread::get_id(); }));
+    }
+    EXPECT_LE(low.size(), 2);
+    EXPECT_LE(high.size(), 2);
+    for (const auto& id : low) {
+        EXPECT_EQ(high.count(id), 0);
+        EXPECT_NE(id, std::this_thread::get_id());
+    }
+}
+
+TEST_F(ShardAffinityPoolTest, BatchKeepsOrder) {
+    ShardAffinityPool pool(1024, 4, 2);
+    std::vector<size_t> shards;
+    for (size_t i = 0; i < 100; ++i) {
+        shards.push_back((i * 37) % 1024);
+    }
+    std::atomic<int> calls{0};
+    auto results = pool.RunBatch<std::string>(
+        shards, [&](const std::vector<size_t>& indices) {
+            calls++;
+            std::vector<std::string> part;
+            for (size_t index : indices) {
+                part.push_back(std::to_string(shards[index]));
+            }
+            return part;
+        });
+    ASSERT_EQ(results.size(), shards.size());
+    for (size_t i = 0; i < shards.size(); ++i) {
+        EXPECT_EQ(results[i], std::to_string(shards[i]));
+    }
+    // One call per group
+    EXPECT_EQ(calls, 2);
+    EXPECT_EQ(pool.QueueDepth(0), 0);
+    EXPECT_TRUE(pool.RunBatch<int>({}, [](const std::vector<size_t>&) {
+                        return std::vector<int>{};
+                    }).empty());
+}
+
+}  // namespace mooncake
@@ -1,9 +1,12 @@
 #include <gtest/gtest.h>
 #include <glog/logging.h>
+#include <array>
 #include <atomic>
 #include <chrono>
 #include <mutex>
 #include <condition_variable>
+#include <thread>
+#include <vector>
 #include "thread_pool.h"
 
 namespace mooncake {
@@ -136,6 +139,93 @@ TEST_F(ThreadPoolTest, StressTest) {
     EXPECT_EQ(counter.load(), num_tasks);
 }
 
+// Test throughput with several producers enqueueing small tasks
+TEST_F(ThreadPoolTest, Throughput) {
+    const int num_producers = 4;
+    const int tasks_per_producer = 250000;
+    const int num_tasks = num_producers * tasks_per_producer;
+    ThreadPool pool(4);
+    std::atomic<int> counter(0);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> producers;
+    for (int p = 0; p < num_producers; ++p) {
+        producers.emplace_back([&]() {
+            for (int i = 0; i < tasks_per_producer; ++i) {
+                pool.enqueue([&counter]() {
+                    counter.fetch_add(1, std::memory_order_relaxed);
+                });
+            }
+        });
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    pool.stop();
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+
+    EXPECT_EQ(counter.load(), num_tasks);
+    LOG(INFO) << "thread_pool_throughput tasks_per_second="
+              << static_cast<uint64_t>(num_tasks / seconds);
+}
+
+// Test that tasks enqueued by a worker are stolen by the idle ones
+TEST_F(ThreadPoolTest, NestedTasksAreStolen) {
+    const size_t num_threads = 4;
+    const int num_children = 16;
+    ThreadPool pool(num_threads, true);
+    std::atomic<int> running_threads(0);
+    std::atomic<int> max_concurrent_threads(0);
+    std::mutex mtx;
+    std::condition_variable cv;
+    int completed = 0;
+
+    pool.enqueue([&]() {
+        // All children land in the queue of this worker
+        for (int i = 0; i < num_children; ++i) {
+            pool.enqueue([&]() {
+                int current = ++running_threads;
+                int old_max = max_concurrent_threads.load();
+                while (old_max < current &&
+                       !max_concurrent_threads.compare_exchange_weak(old_max,
+                                                                     current)) {
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                --running_threads;
+
+                std::lock_guard<std::mutex> lock(mtx);
+                completed++;
+                cv.notify_one();
+            });
+        }
+    });
+
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [&]() { return completed == num_children; });
+
+    EXPECT_GT(max_concurrent_threads.load(), 1);
+    EXPECT_LE(max_concurrent_threads.load(), num_threads);
+}
+
+// Test tasks larger than the inline storage and with arguments
+TEST_F(ThreadPoolTest, LargeTasksAndArguments) {
+    ThreadPool pool(2);
+    std::atomic<int> sum(0);
+    std::array<int, 64> values;
+    values.fill(1);
+
+    pool.enqueue([values, &sum]() {
+        for (int value : values) {
+            sum += value;
+        }
+    });
+    pool.enqueue([&sum](int a, int b) { sum += a + b; }, 2, 3);
+    pool.stop();
+
+    EXPECT_EQ(sum.load(), 64 + 5);
+}
 
 } // namespace mooncake
 
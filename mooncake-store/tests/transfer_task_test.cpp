@@ -1,22 +1,27 @@
 // transfer_task_test.cpp
 #include "transfer_task.h"
 
+#include <async_simple/coro/Lazy.h>
+#include <async_simple/coro/SyncAwait.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
 #include <cstring>
+#include <future>
 #include <memory>
 #include <thread>
 #include <vector>
 
+#include "transfer_engine.h"
 #include "types.h"
 
 namespace mooncake {
 
-// Test fixture for TransferTask tests
-// TODO: Currently, this test does not cover TransferSubmitter and
-// TransferEngine integration. Will add more tests in the future.
+// Test fixture for TransferTask tests, see TransferSubmitterBatchTest for
+// the ones going through a transfer engine
 class TransferTaskTest : public ::testing::Test {
    protected:
     void SetUp() override {
@@ -100,6 +105,41 @@ TEST_F(TransferTaskTest, MemcpyWorkerPoolBasic) {
     }
 }
 
+// Test that large tasks split over several workers are copied correctly
+TEST_F(TransferTaskTest, MemcpyWorkerPoolSplitsLargeTasks) {
+    MemcpyWorkerPool pool(4);
+    EXPECT_EQ(pool.workerCount(), 4u);
+
+    // Odd sizes and offsets, so chunks and streaming stores are unaligned
+    const std::vector<size_t> sizes = {
+        3 * MemcpyWorkerPool::kMinChunkSize + 13,
+        MemcpyWorkerPool::kNonTemporalThreshold + 7, 100};
+    std::vector<std::vector<char>> src_buffers;
+    std::vector<std::vector<char>> dest_buffers;
+    std::vector<MemcpyOperation> operations;
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        src_buffers.emplace_back(sizes[i] + 1);
+        dest_buffers.emplace_back(sizes[i] + 1, 0);
+        for (size_t j = 0; j < src_buffers[i].size(); ++j) {
+            src_buffers[i][j] = static_cast<char>((i * 131 + j * 7) & 0xff);
+        }
+        operations.emplace_back(dest_buffers[i].data() + 1,
+                                src_buffers[i].data() + 1, sizes[i]);
+    }
+
+    auto state = std::make_shared<MemcpyOperationState>();
+    pool.submitTask(MemcpyTask(std::move(operations), state));
+    state->wait_for_completion();
+    EXPECT_EQ(state->get_result(), ErrorCode::OK);
+
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        EXPECT_EQ(dest_buffers[i][0], 0);
+        EXPECT_EQ(std::memcmp(dest_buffers[i].data() + 1,
+                              src_buffers[i].data() + 1, sizes[i]),
+                  0);
+    }
+}
+
 // Test multiple memcpy operations in one task
 TEST_F(TransferTaskTest, MemcpyWorkerPoolMultipleOperations) {
     MemcpyWorkerPool pool;
@@ -160,6 +200,548 @@ TEST_F(TransferTaskTest, TransferStrategyEnum) {
     EXPECT_EQ(oss.str(), "TRANSFER_ENGINE");
 }
 
+// Test callbacks of AsyncOperationState
+TEST_F(TransferTaskTest, AsyncOperationStateCallbacks) {
+    auto state =
+        std::make_shared<AsyncOperationState>(TransferStrategy::LOCAL_MEMCPY);
+    TransferFuture future(state);
+    EXPECT_FALSE(future.isReady());
+    EXPECT_EQ(future.strategy(), TransferStrategy::LOCAL_MEMCPY);
+
+    std::vector<ErrorCode> seen;
+    EXPECT_TRUE(future.then([&seen](ErrorCode ec) { seen.push_back(ec); }));
+    EXPECT_TRUE(seen.empty());
+
+    std::thread completer(
+        [state] { state->set_completed(ErrorCode::TRANSFER_FAIL); });
+    EXPECT_EQ(future.get(), ErrorCode::TRANSFER_FAIL);
+    completer.join();
+    ASSERT_EQ(seen.size(), 1u);
+    EXPECT_EQ(seen[0], ErrorCode::TRANSFER_FAIL);
+
+    // Registered after completion, runs right away
+    EXPECT_TRUE(future.then([&seen](ErrorCode ec) { seen.push_back(ec); }));
+    EXPECT_EQ(seen.size(), 2u);
+
+    // Memcpy operations push their completion as well
+    auto memcpy_state = std::make_shared<MemcpyOperationState>();
+    TransferFuture memcpy_future(memcpy_state);
+    EXPECT_TRUE(
+        memcpy_future.then([&seen](ErrorCode ec) { seen.push_back(ec); }));
+    memcpy_state->set_completed(ErrorCode::OK);
+    ASSERT_EQ(seen.size(), 3u);
+    EXPECT_EQ(seen[2], ErrorCode::OK);
+}
+
+// Test awaiting futures in a coroutine
+TEST_F(TransferTaskTest, AwaitFuture) {
+    auto state =
+        std::make_shared<AsyncOperationState>(TransferStrategy::LOCAL_MEMCPY);
+    std::thread completer([state] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        state->set_completed(ErrorCode::TRANSFER_FAIL);
+    });
+    auto await_all = [](TransferFuture pending,
+                        TransferFuture ready) -> async_simple::coro::Lazy<int> {
+        ErrorCode first = co_await std::move(pending);
+        ErrorCode second = co_await std::move(ready);
+        co_return (first == ErrorCode::TRANSFER_FAIL) +
+            (second == ErrorCode::OK);
+    };
+    auto ready =
+        std::make_shared<AsyncOperationState>(TransferStrategy::LOCAL_MEMCPY);
+    ready->set_completed(ErrorCode::OK);
+    EXPECT_EQ(async_simple::coro::syncAwait(
+                  await_all(TransferFuture(state), TransferFuture(ready))),
+              2);
+    completer.join();
+}
+
+// Test waiting for any or all of several futures
+TEST_F(TransferTaskTest, WaitAnyAndWaitAll) {
+    std::vector<std::shared_ptr<AsyncOperationState>> states;
+    std::vector<TransferFuture> futures;
+    for (int i = 0; i < 3; ++i) {
+        states.push_back(std::make_shared<AsyncOperationState>(
+            TransferStrategy::TRANSFER_ENGINE));
+        futures.emplace_back(states.back());
+    }
+    std::thread completer([&states] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        states[1]->set_completed(ErrorCode::OK);
+    });
+    EXPECT_EQ(TransferFuture::waitAny(futures), 1u);
+    completer.join();
+
+    states[2]->set_completed(ErrorCode::INVALID_PARAMS);
+    states[0]->set_completed(ErrorCode::TRANSFER_FAIL);
+    EXPECT_EQ(TransferFuture::waitAll(futures), ErrorCode::TRANSFER_FAIL);
+
+    std::vector<TransferFuture> empty;
+    EXPECT_EQ(TransferFuture::waitAny(empty), 0u);
+    EXPECT_EQ(TransferFuture::waitAll(empty), ErrorCode::OK);
+}
+
+// Test how TransferSubmitter splits an object into stripes
+TEST_F(TransferTaskTest, PlanStripes) {
+    auto make_handles = [](const std::vector<uint64_t>& sizes) {
+        std::vector<AllocatedBuffer::Descriptor> handles;
+        for (auto size : sizes) {
+            handles.push_back({"segment", size, 0, BufStatus::COMPLETE});
+        }
+        return handles;
+    };
+
+    // Equal buffers are split evenly
+    auto handles = make_handles(std::vector<uint64_t>(8, 1024));
+    EXPECT_EQ(TransferSubmitter::planStripes(handles, 2),
+              (std::vector<size_t>{0, 4, 8}));
+    EXPECT_EQ(TransferSubmitter::planStripes(handles, 3),
+              (std::vector<size_t>{0, 3, 6, 8}));
+
+    // More stripes than buffers, one buffer per stripe
+    handles = make_handles({1024, 1024});
+    EXPECT_EQ(TransferSubmitter::planStripes(handles, 4),
+              (std::vector<size_t>{0, 1, 2}));
+
+    // A large first buffer makes up a stripe on its own
+    handles = make_handles({4096, 1024, 1024, 1024, 1024});
+    EXPECT_EQ(TransferSubmitter::planStripes(handles, 2),
+              (std::vector<size_t>{0, 1, 5}));
+
+    // Every stripe keeps at least one buffer
+    handles = make_handles({1024, 1024, 8192});
+    EXPECT_EQ(TransferSubmitter::planStripes(handles, 3),
+              (std::vector<size_t>{0, 1, 2, 3}));
+
+    handles = make_handles({1024});
+    EXPECT_EQ(TransferSubmitter::planStripes(handles, 1),
+              (std::vector<size_t>{0, 1}));
+}
+
+// Test which adjacent transfer requests TransferSubmitter merges
+TEST_F(TransferTaskTest, MergeRequest) {
+    // Requests at the same offset of a local and a remote range
+    auto make_request = [](uint64_t offset, size_t length) {
+        Transport::TransferRequest request;
+        request.opcode = Transport::TransferRequest::WRITE;
+        request.source = reinterpret_cast<void*>(0x20000 + offset);
+        request.target_id = 1;
+        request.target_offset = 0x10000 + offset;
+        request.length = length;
+        return request;
+    };
+
+    // Contiguous on both sides
+    auto prev = make_request(0, 1024);
+    EXPECT_TRUE(
+        TransferSubmitter::mergeRequest(prev, make_request(1024, 512)));
+    EXPECT_EQ(prev.length, 1536);
+    EXPECT_EQ(prev.source, reinterpret_cast<void*>(0x20000));
+    EXPECT_EQ(prev.target_offset, 0x10000);
+
+    // A gap on either side, another segment or another direction
+    prev = make_request(0, 1024);
+    auto next = make_request(2048, 1024);
+    next.target_offset = prev.target_offset + prev.length;
+    EXPECT_FALSE(TransferSubmitter::mergeRequest(prev, next));
+    next = make_request(1024, 1024);
+    next.target_offset += 64;
+    EXPECT_FALSE(TransferSubmitter::mergeRequest(prev, next));
+    next = make_request(1024, 1024);
+    next.target_id = 2;
+    EXPECT_FALSE(TransferSubmitter::mergeRequest(prev, next));
+    next = make_request(1024, 1024);
+    next.opcode = Transport::TransferRequest::READ;
+    EXPECT_FALSE(TransferSubmitter::mergeRequest(prev, next));
+    next = make_request(1024, 1024);
+    next.traffic_class = Transport::TransferRequest::BACKGROUND;
+    EXPECT_FALSE(TransferSubmitter::mergeRequest(prev, next));
+    EXPECT_EQ(prev.length, 1024);
+
+    // Up to the size cap, and not past it
+    const uint64_t cap = TransferSubmitter::kMaxMergedRequestSize;
+    prev = make_request(0, cap - 100);
+    EXPECT_TRUE(
+        TransferSubmitter::mergeRequest(prev, make_request(cap - 100, 100)));
+    EXPECT_EQ(prev.length, cap);
+    EXPECT_FALSE(TransferSubmitter::mergeRequest(prev, make_request(cap, 1)));
+    EXPECT_EQ(prev.length, cap);
+}
+
+// Test fixture for TransferSubmitter::submitBatch, through a transfer
+// engine that copies to its own segment in-process
+class TransferSubmitterBatchTest : public ::testing::Test {
+   protected:
+    static constexpr size_t kMemorySize = 16 << 20;
+    static constexpr const char* kSegmentName = "127.0.0.1:17731";
+
+    // A buffer of an object: size bytes at target in the segment, read
+    // into or written from source
+    struct Part {
+        char* source;
+        char* target;
+        size_t size;
+    };
+
+    struct Object {
+        Replica::Descriptor replica;
+        std::vector<Slice> slices;
+    };
+
+    void SetUp() override {
+        google::InitGoogleLogging("TransferSubmitterBatchTest");
+        FLAGS_logtostderr = 1;
+
+        // Copies within the segment go through the engine
+        unsetenv("MC_STORE_MEMCPY");
+        const char* env = std::getenv("MC_METADATA_SERVER");
+        metadata_server_ = env ? env : P2PHANDSHAKE;
+        engine_ = std::make_unique<TransferEngine>(false);
+        ASSERT_EQ(engine_->init(metadata_server_, kSegmentName, "127.0.0.1",
+                                17731),
+                  0);
+        // Any transport publishes the local segment
+        ASSERT_NE(engine_->installTransport("shm", nullptr), nullptr);
+
+        // Bytes never equal to 0xff, the fill of untouched memory
+        source_.resize(kMemorySize);
+        for (size_t i = 0; i < kMemorySize; ++i) {
+            source_[i] = static_cast<char>(i % 251);
+        }
+        target_.assign(kMemorySize, static_cast<char>(0xff));
+        ASSERT_EQ(engine_->registerLocalMemory(source_.data(), kMemorySize,
+                                               "cpu:0"),
+                  0);
+        ASSERT_EQ(engine_->registerLocalMemory(target_.data(), kMemorySize,
+                                               "cpu:0"),
+                  0);
+        submitter_ = std::make_unique<TransferSubmitter>(
+            *engine_, kSegmentName, backend_);
+    }
+
+    void TearDown() override {
+        submitter_.reset();
+        if (engine_) {
+            engine_->unregisterLocalMemory(source_.data());
+            engine_->unregisterLocalMemory(target_.data());
+            engine_.reset();
+        }
+        google::ShutdownGoogleLogging();
+    }
+
+    static Object MakeObject(const std::vector<Part>& parts,
+                             const std::string& segment = kSegmentName) {
+        Object object;
+        MemoryDescriptor memory;
+        for (const auto& part : parts) {
+            memory.buffer_descriptors.push_back(
+                {segment, part.size, reinterpret_cast<uintptr_t>(part.target),
+                 BufStatus::COMPLETE});
+            object.slices.push_back(Slice{part.source, part.size});
+        }
+        object.replica.status = ReplicaStatus::COMPLETE;
+        object.replica.descriptor_variant = std::move(memory);
+        return object;
+    }
+
+    std::vector<std::optional<TransferFuture>> SubmitBatch(
+        std::vector<Object>& objects,
+        Transport::TransferRequest::OpCode op_code) {
+        std::vector<TransferSubmitter::BatchItem> items;
+        for (auto& object : objects) {
+            items.push_back({&object.replica, &object.slices});
+        }
+        return submitter_->submitBatch(items, op_code);
+    }
+
+    // Whether the parts were copied, each between its own source and
+    // target
+    static bool PartsCopied(const std::vector<Part>& parts) {
+        return std::all_of(parts.begin(), parts.end(), [](const Part& part) {
+            return memcmp(part.source, part.target, part.size) == 0;
+        });
+    }
+
+    // Bytes of target_ written, which must be those of the parts only
+    size_t TargetBytesWritten() const {
+        return std::count_if(target_.begin(), target_.end(), [](char c) {
+            return c != static_cast<char>(0xff);
+        });
+    }
+
+    std::string metadata_server_;
+    std::unique_ptr<TransferEngine> engine_;
+    std::shared_ptr<StorageBackend> backend_;
+    std::unique_ptr<TransferSubmitter> submitter_;
+    std::vector<char> source_;
+    std::vector<char> target_;
+};
+
+// The objects of a batch share one engine batch, each future completing
+// with its own tasks
+TEST_F(TransferSubmitterBatchTest, SharedBatchCompletesPerFuture) {
+    char* source = source_.data();
+    char* target = target_.data();
+    // Two buffers per object, apart from each other on both sides so that
+    // no request is merged
+    const std::vector<std::vector<Part>> layouts = {
+        {{source, target, 4096}, {source + 8192, target + 8192, 1000}},
+        {{source + 16384, target + 20000, 3000},
+         {source + 24576, target + 32768, 4096}},
+        {{source + 40960, target + 49152, 512},
+         {source + 49152, target + 57344, 2048}},
+    };
+    std::vector<Object> objects;
+    for (const auto& parts : layouts) {
+        objects.push_back(MakeObject(parts));
+    }
+
+    auto futures = SubmitBatch(objects, Transport::TransferRequest::WRITE);
+    ASSERT_EQ(futures.size(), objects.size());
+    std::vector<std::promise<ErrorCode>> callbacks(objects.size());
+    for (size_t i = 0; i < futures.size(); ++i) {
+        ASSERT_TRUE(futures[i].has_value()) << i;
+        EXPECT_EQ(futures[i]->strategy(), TransferStrategy::TRANSFER_ENGINE);
+        ASSERT_TRUE(futures[i]->then([&callbacks, i](ErrorCode result) {
+            callbacks[i].set_value(result);
+        }));
+    }
+    size_t written = 0;
+    for (size_t i = 0; i < futures.size(); ++i) {
+        EXPECT_EQ(futures[i]->get(), ErrorCode::OK) << i;
+        EXPECT_TRUE(PartsCopied(layouts[i])) << i;
+        for (const auto& part : layouts[i]) {
+            written += part.size;
+        }
+        auto callback = callbacks[i].get_future();
+        ASSERT_EQ(callback.wait_for(std::chrono::seconds(5)),
+                  std::future_status::ready)
+            << i;
+        EXPECT_EQ(callback.get(), ErrorCode::OK) << i;
+    }
+    EXPECT_EQ(TargetBytesWritten(), written);
+
+    // Read back into the other half of the source, one object at a time
+    for (const auto& parts : layouts) {
+        std::vector<Part> read_parts;
+        for (const auto& part : parts) {
+            read_parts.push_back(
+                {part.source + kMemorySize / 2, part.target, part.size});
+        }
+        std::vector<Object> read = {MakeObject(read_parts)};
+        auto read_futures =
+            SubmitBatch(read, Transport::TransferRequest::READ);
+        ASSERT_EQ(read_futures.size(), 1);
+        ASSERT_TRUE(read_futures[0].has_value());
+        EXPECT_EQ(read_futures[0]->get(), ErrorCode::OK);
+        EXPECT_TRUE(PartsCopied(read_parts));
+    }
+}
+
+// A failed task fails its object only, and an object that cannot be
+// submitted leaves the others in the batch
+TEST_F(TransferSubmitterBatchTest, PartialFailureInSharedBatch) {
+    // Memory the engine has not registered, which it cannot copy to
+    std::vector<char> unregistered(8192, static_cast<char>(0xff));
+    char* source = source_.data();
+    char* target = target_.data();
+    const std::vector<Part> first = {{source, target, 4096},
+                                     {source + 8192, target + 8192, 4096}};
+    const std::vector<Part> failing = {
+        {source + 16384, target + 16384, 4096},
+        {source + 24576, unregistered.data(), 4096}};
+    const std::vector<Part> last = {{source + 32768, target + 32768, 4096}};
+    std::vector<Object> objects = {MakeObject(first), MakeObject(failing),
+                                   MakeObject(last), MakeObject(last)};
+    // Slices of another size than the buffers
+    objects[3].slices[0].size = 1000;
+
+    auto futures = SubmitBatch(objects, Transport::TransferRequest::WRITE);
+    ASSERT_EQ(futures.size(), objects.size());
+    ASSERT_TRUE(futures[0].has_value());
+    ASSERT_TRUE(futures[1].has_value());
+    ASSERT_TRUE(futures[2].has_value());
+    EXPECT_FALSE(futures[3].has_value());
+
+    std::promise<ErrorCode> failed_callback;
+    ASSERT_TRUE(futures[1]->then([&failed_callback](ErrorCode result) {
+        failed_callback.set_value(result);
+    }));
+    EXPECT_EQ(futures[1]->get(), ErrorCode::TRANSFER_FAIL);
+    auto callback = failed_callback.get_future();
+    ASSERT_EQ(callback.wait_for(std::chrono::seconds(5)),
+              std::future_status::ready);
+    EXPECT_EQ(callback.get(), ErrorCode::TRANSFER_FAIL);
+    EXPECT_EQ(futures[0]->get(), ErrorCode::OK);
+    EXPECT_EQ(futures[2]->get(), ErrorCode::OK);
+    EXPECT_TRUE(PartsCopied(first));
+    EXPECT_TRUE(PartsCopied(last));
+    EXPECT_TRUE(std::all_of(
+        unregistered.begin(), unregistered.end(),
+        [](char c) { return c == static_cast<char>(0xff); }));
+}
+
+// Buffers contiguous on both sides, within and across objects, are moved
+// by merged requests, each byte still landing at its own offset
+TEST_F(TransferSubmitterBatchTest, MergesContiguousObjects) {
+    char* source = source_.data();
+    char* target = target_.data();
+    // Packed objects, e.g. in an allocation credit, of several buffers
+    const std::vector<std::vector<Part>> layouts = {
+        {{source, target, 1000}, {source + 1000, target + 1000, 3000}},
+        {{source + 4000, target + 4000, 96}},
+        {{source + 4096, target + 4096, 4096},
+         {source + 8192, target + 8192, 10}},
+    };
+    std::vector<Object> objects;
+    for (const auto& parts : layouts) {
+        objects.push_back(MakeObject(parts));
+    }
+    auto futures = SubmitBatch(objects, Transport::TransferRequest::WRITE);
+    ASSERT_EQ(futures.size(), objects.size());
+    for (size_t i = 0; i < futures.size(); ++i) {
+        ASSERT_TRUE(futures[i].has_value()) << i;
+        EXPECT_EQ(futures[i]->get(), ErrorCode::OK) << i;
+        EXPECT_TRUE(PartsCopied(layouts[i])) << i;
+    }
+    EXPECT_EQ(TargetBytesWritten(), 8202);
+
+    // Read back into one contiguous buffer elsewhere
+    char* dest = source + kMemorySize / 2;
+    objects.clear();
+    std::vector<std::vector<Part>> read_layouts;
+    for (const auto& parts : layouts) {
+        read_layouts.emplace_back();
+        for (const auto& part : parts) {
+            read_layouts.back().push_back(
+                {dest + (part.source - source), part.target, part.size});
+        }
+        objects.push_back(MakeObject(read_layouts.back()));
+    }
+    futures = SubmitBatch(objects, Transport::TransferRequest::READ);
+    ASSERT_EQ(futures.size(), objects.size());
+    for (size_t i = 0; i < futures.size(); ++i) {
+        ASSERT_TRUE(futures[i].has_value()) << i;
+        EXPECT_EQ(futures[i]->get(), ErrorCode::OK) << i;
+        EXPECT_TRUE(PartsCopied(read_layouts[i])) << i;
+    }
+}
+
+// Buffers contiguous on one side only are not merged, each landing at its
+// own offset with the gaps between them untouched
+TEST_F(TransferSubmitterBatchTest, KeepsRequestsContiguousOnOneSide) {
+    char* source = source_.data();
+    char* target = target_.data();
+    // Contiguous sources into scattered targets, then scattered sources
+    // into contiguous targets
+    const std::vector<std::vector<Part>> layouts = {
+        {{source, target, 1000}, {source + 1000, target + 1064, 1000}},
+        {{source + 2000, target + 4096, 500}},
+        {{source + 8192, target + 8192, 1000},
+         {source + 9256, target + 9192, 1000}},
+        {{source + 12288, target + 10192, 700}},
+    };
+    std::vector<Object> objects;
+    size_t written = 0;
+    for (const auto& parts : layouts) {
+        objects.push_back(MakeObject(parts));
+        for (const auto& part : parts) {
+            written += part.size;
+        }
+    }
+    auto futures = SubmitBatch(objects, Transport::TransferRequest::WRITE);
+    ASSERT_EQ(futures.size(), objects.size());
+    for (size_t i = 0; i < futures.size(); ++i) {
+        ASSERT_TRUE(futures[i].has_value()) << i;
+        EXPECT_EQ(futures[i]->get(), ErrorCode::OK) << i;
+        EXPECT_TRUE(PartsCopied(layouts[i])) << i;
+    }
+    EXPECT_EQ(TargetBytesWritten(), written);
+}
+
+// Buffers adjacent in memory but in different segments are not merged
+TEST_F(TransferSubmitterBatchTest, KeepsSegmentsApart) {
+    static constexpr const char* kOtherSegmentName = "127.0.0.1:17733";
+    const size_t half = kMemorySize / 2;
+    // The second half of the target memory is the other segment's
+    engine_->unregisterLocalMemory(target_.data());
+    ASSERT_EQ(engine_->registerLocalMemory(target_.data(), half, "cpu:0"),
+              0);
+    auto other = std::make_unique<TransferEngine>(false);
+    ASSERT_EQ(other->init(metadata_server_, kOtherSegmentName, "127.0.0.1",
+                          17733),
+              0);
+    ASSERT_NE(other->installTransport("tcp", nullptr), nullptr);
+    ASSERT_NE(engine_->installTransport("tcp", nullptr), nullptr);
+    ASSERT_EQ(other->registerLocalMemory(target_.data() + half, half,
+                                         "cpu:0"),
+              0);
+
+    char* source = source_.data();
+    char* target = target_.data();
+    // One object over both segments, then one per segment
+    const std::vector<std::vector<Part>> layouts = {
+        {{source, target + half - 4096, 4096},
+         {source + 4096, target + half, 4096}},
+        {{source + 8192, target + half - 8192, 4096}},
+        {{source + 12288, target + half + 4096, 4096}},
+    };
+    std::vector<Object> objects;
+    for (const auto& parts : layouts) {
+        objects.push_back(MakeObject(parts));
+    }
+    objects[0]
+        .replica.get_memory_descriptor()
+        .buffer_descriptors[1]
+        .segment_name_ = kOtherSegmentName;
+    objects[2] = MakeObject(layouts[2], kOtherSegmentName);
+    auto futures = SubmitBatch(objects, Transport::TransferRequest::WRITE);
+    ASSERT_EQ(futures.size(), objects.size());
+    for (size_t i = 0; i < futures.size(); ++i) {
+        ASSERT_TRUE(futures[i].has_value()) << i;
+        EXPECT_EQ(futures[i]->get(), ErrorCode::OK) << i;
+        EXPECT_TRUE(PartsCopied(layouts[i])) << i;
+    }
+    EXPECT_EQ(TargetBytesWritten(), 4 * 4096);
+    other->unregisterLocalMemory(target_.data() + half);
+}
+
+// Merging stops at kMaxMergedRequestSize, the requests after the cut
+// still landing at their offsets
+TEST_F(TransferSubmitterBatchTest, MergesUpToSizeCap) {
+    char* source = source_.data();
+    char* target = target_.data();
+    // Contiguous buffers of a quarter of the cap: the first four are
+    // merged, the cut falling inside the second object
+    const size_t size = TransferSubmitter::kMaxMergedRequestSize / 4;
+    const std::vector<std::vector<Part>> layouts = {
+        {{source, target, size},
+         {source + size, target + size, size},
+         {source + 2 * size, target + 2 * size, size}},
+        {{source + 3 * size, target + 3 * size, size},
+         {source + 4 * size, target + 4 * size, size}},
+        {{source + 5 * size, target + 5 * size, 1000}},
+    };
+    std::vector<Object> objects;
+    size_t written = 0;
+    for (const auto& parts : layouts) {
+        objects.push_back(MakeObject(parts));
+        for (const auto& part : parts) {
+            written += part.size;
+        }
+    }
+    ASSERT_LE(written, kMemorySize);
+    auto futures = SubmitBatch(objects, Transport::TransferRequest::WRITE);
+    ASSERT_EQ(futures.size(), objects.size());
+    for (size_t i = 0; i < futures.size(); ++i) {
+        ASSERT_TRUE(futures[i].has_value()) << i;
+        EXPECT_EQ(futures[i]->get(), ErrorCode::OK) << i;
+        EXPECT_TRUE(PartsCopied(layouts[i])) << i;
+    }
+    EXPECT_EQ(TargetBytesWritten(), written);
+}
+
 }  // namespace mooncake
 
 int main(int argc, char** argv) {
@@ -0,0 +1,156 @@
+#include "write_behind_queue.h"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace mooncake {
+
+class WriteBehindQueueTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        google::InitGoogleLogging("WriteBehindQueueTest");
+        FLAGS_logtostderr = 1;
+        test_dir_ = std::filesystem::temp_directory_path() /
+                    ("write_behind_queue_test_" + std::to_string(getpid()));
+        std::filesystem::create_directories(test_dir_);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove_all(test_dir_);
+        google::ShutdownGoogleLogging();
+    }
+
+    std::shared_ptr<StorageBackend> CreateBackend(const char* engine) {
+        setenv("MC_STORE_DISK_ENGINE", engine, 1);
+        auto backend = StorageBackend::Create(test_dir_.string(), engine);
+        unsetenv("MC_STORE_DISK_ENGINE");
+        return backend;
+    }
+
+    static std::string MakeValue(size_t index) {
+        return std::string(1000 + index * 37,
+                           static_cast<char>('a' + index % 26));
+    }
+
+    static bool Push(WriteBehindQueue& queue, const std::string& key,
+                     std::string value) {
+        return queue.Push(key, {{value.data(), value.size()}});
+    }
+
+    std::filesystem::path test_dir_;
+};
+
+TEST_F(WriteBehindQueueTest, StoresAllObjects) {
+    constexpr size_t kObjects = 200;
+    for (const char* engine : {"log", "file"}) {
+        auto backend = CreateBackend(engine);
+        ASSERT_NE(backend, nullptr);
+        std::atomic<size_t> stored{0};
+        WriteBehindQueue queue(backend, 2, 1 << 20, 64 * 1024,
+                               [&](const ObjectKey&) { stored++; });
+        for (size_t i = 0; i < kObjects; ++i) {
+            ASSERT_TRUE(Push(queue, "key" + std::to_string(i), MakeValue(i)));
+        }
+        // Storing an existing key fails without blocking the others
+        ASSERT_TRUE(Push(queue, "key0", "again"));
+        queue.Flush();
+        EXPECT_EQ(stored, kObjects) << engine;
+        EXPECT_EQ(queue.queue_depth(), 0u);
+        EXPECT_EQ(queue.bytes_in_flight(), 0u);
+
+        for (size_t i = 0; i < kObjects; ++i) {
+            std::string value;
+            ASSERT_EQ(backend->LoadObject("key" + std::to_string(i), value),
+                      ErrorCode::OK);
+            EXPECT_EQ(value, MakeValue(i));
+        }
+        backend->RemoveAll();
+    }
+}
+
+TEST_F(WriteBehindQueueTest, BatchStoreObjectIsSequential) {
+    auto backend = CreateBackend("log");
+    ASSERT_NE(backend, nullptr);
+    std::vector<ObjectKey> keys;
+    std::vector<std::string> values;
+    for (size_t i = 0; i < 10; ++i) {
+        keys.push_back("key" + std::to_string(i));
+        values.push_back(MakeValue(i));
+    }
+    keys.push_back("key3");
+    values.push_back("duplicate");
+    auto results = backend->BatchStoreObject(keys, values);
+    ASSERT_EQ(results.size(), keys.size());
+    EXPECT_EQ(results.back(), ErrorCode::FILE_OPEN_FAIL);
+
+    // Adjacent objects in one data file, at aligned offsets
+    uint64_t next_offset = 0;
+    std::string path;
+    for (size_t i = 0; i < 10; ++i) {
+        EXPECT_EQ(results[i], ErrorCode::OK);
+        auto desc = backend->Querykey(keys[i]);
+        ASSERT_TRUE(desc.has_value());
+        const auto& disk = desc->get_disk_descriptor();
+        if (i == 0) {
+            path = disk.file_path;
+        } else {
+            EXPECT_EQ(disk.file_path, path);
+            EXPECT_EQ(disk.file_offset, next_offset);
+        }
+        next_offset = disk.file_offset +
+                      (disk.file_size + IoUringEngine::kAlignment - 1) /
+                          IoUringEngine::kAlignment *
+                          IoUringEngine::kAlignment;
+
+        std::string value;
+        ASSERT_EQ(backend->LoadObject(keys[i], value), ErrorCode::OK);
+        EXPECT_EQ(value, values[i]);
+    }
+}
+
+TEST_F(WriteBehindQueueTest, BudgetAppliesBackpressure) {
+    constexpr uint64_t kBudget = 64 * 1024;
+    constexpr size_t kObjectSize = 10 * 1024;
+    auto backend = CreateBackend("log");
+    ASSERT_NE(backend, nullptr);
+    std::atomic<uint64_t> max_in_flight{0};
+    WriteBehindQueue* queue_ptr = nullptr;
+    WriteBehindQueue queue(backend, 1, kBudget, 16 * 1024,
+                           [&](const ObjectKey&) {
+                               uint64_t in_flight =
+                                   queue_ptr->bytes_in_flight();
+                               uint64_t seen = max_in_flight;
+                               while (in_flight > seen &&
+                                      !max_in_flight.compare_exchange_weak(
+                                          seen, in_flight)) {
+                               }
+                           });
+    queue_ptr = &queue;
+    for (size_t i = 0; i < 100; ++i) {
+        ASSERT_TRUE(Push(queue, "key" + std::to_string(i),
+                         std::string(kObjectSize, 'x')));
+        EXPECT_LE(queue.bytes_in_flight(), kBudget);
+    }
+    // An object over the budget is admitted on its own
+    ASSERT_TRUE(Push(queue, "large", std::string(kBudget * 2, 'y')));
+    queue.Flush();
+    EXPECT_LE(max_in_flight, kBudget * 2);
+    EXPECT_EQ(backend->Existkey("large"), ErrorCode::OK);
+
+    // Objects queued before Stop() are still stored
+    ASSERT_TRUE(Push(queue, "last", "value"));
+    queue.Stop();
+    EXPECT_EQ(backend->Existkey("last"), ErrorCode::OK);
+    EXPECT_FALSE(Push(queue, "after_stop", "value"));
+    EXPECT_FALSE(queue.SerializeMetrics().empty());
+}
+
+}  // namespace mooncake
@@ -1,50 +1,292 @@
 package main
 
 import (
+	"bytes"
+	"compress/gzip"
+	"encoding/gob"
+	"encoding/json"
 	"flag"
+	"hash/fnv"
+	"io"
+	"log"
 	"net/http"
+	"os"
+	"os/signal"
+	"path/filepath"
+	"strconv"
+	"strings"
 	"sync"
+	"syscall"
+	"time"
 
 	"github.com/gin-gonic/gin"
 )
 
 const jsonContentType = "application/json; charset=utf-8"
 
+// Changes kept for watchers, older ones make them resynchronize
+const maxChanges = 4096
+
+const maxWatchTimeout = 30 * time.Second
+
+const snapshotFile = "metadata.snapshot"
+
+// A value, gzipped when compressed is set
+type entry struct {
+	Data       []byte
+	Compressed bool
+}
+
+type shard struct {
+	mutex   sync.RWMutex
+	entries map[string]entry
+}
+
+type change struct {
+	revision uint64
+	key      string
+}
+
 type MetadataStore struct {
-	store sync.Map
+	shards            []shard
+	compressThreshold int
+
+	mutex    sync.Mutex
+	revision uint64
+	// Changes after known are all in changes
+	known   uint64
+	changes []change
+	// Closed and replaced on each change
+	changed chan struct{}
+	// Changed since the last snapshot
+	dirty bool
+
+	saveMutex sync.Mutex
 }
 
-var (
-	metadataStore = MetadataStore{}
-)
+var metadataStore *MetadataStore
 
-func (m *MetadataStore) Get(key string) ([]byte, bool) {
-	value, ok := m.store.Load(key)
-	if !ok {
-		return nil, false
+func NewMetadataStore(shards, compressThreshold int) *MetadataStore {
+	if shards <= 0 {
+		shards = 1
+	}
+	m := &MetadataStore{
+		shards:            make([]shard, shards),
+		compressThreshold: compressThreshold,
+		changed:           make(chan struct{}),
+	}
+	for i := range m.shards {
+		m.shards[i].entries = make(map[string]entry)
 	}
-	return value.([]byte), true
+	// Revisions of a previous run of the server, which may not have been
+	// persisted, are older than any of this one, so watchers resynchronize
+	m.revision = uint64(time.Now().UnixNano())
+	m.known = m.revision
+	return m
+}
+
+func (m *MetadataStore) shardOf(key string) *shard {
+	h := fnv.New32a()
+	h.Write([]byte(key))
+	return &m.shards[h.Sum32()%uint32(len(m.shards))]
+}
+
+func (m *MetadataStore) encode(value []byte) entry {
+	if m.compressThreshold <= 0 || len(value) < m.compressThreshold {
+		return entry{Data: value}
+	}
+	var buf bytes.Buffer
+	w := gzip.NewWriter(&buf)
+	w.Write(value)
+	w.Close()
+	if buf.Len() >= len(value) {
+		return entry{Data: value}
+	}
+	return entry{Data: buf.Bytes(), Compressed: true}
+}
+
+func (e entry) decode() ([]byte, error) {
+	if !e.Compressed {
+		return e.Data, nil
+	}
+	r, err := gzip.NewReader(bytes.NewReader(e.Data))
+	if err != nil {
+		return nil, err
+	}
+	defer r.Close()
+	return io.ReadAll(r)
+}
+
+func (m *MetadataStore) Get(key string) (entry, bool) {
+	s := m.shardOf(key)
+	s.mutex.RLock()
+	defer s.mutex.RUnlock()
+	e, ok := s.entries[key]
+	return e, ok
 }
 
 func (m *MetadataStore) Set(key string, value []byte) {
-	m.store.Store(key, value)
+	e := m.encode(value)
+	s := m.shardOf(key)
+	s.mutex.Lock()
+	s.entries[key] = e
+	s.mutex.Unlock()
+	m.recordChanges(key)
+}
+
+func (m *MetadataStore) SetBatch(values map[string][]byte) {
+	keys := make([]string, 0, len(values))
+	for key, value := range values {
+		e := m.encode(value)
+		s := m.shardOf(key)
+		s.mutex.Lock()
+		s.entries[key] = e
+		s.mutex.Unlock()
+		keys = append(keys, key)
+	}
+	m.recordChanges(keys...)
 }
 
 func (m *MetadataStore) Delete(key string) {
-	m.store.Delete(key)
+	s := m.shardOf(key)
+	s.mutex.Lock()
+	delete(s.entries, key)
+	s.mutex.Unlock()
+	m.recordChanges(key)
+}
+
+func (m *MetadataStore) recordChanges(keys ...string) {
+	if len(keys) == 0 {
+		return
+	}
+	m.mutex.Lock()
+	defer m.mutex.Unlock()
+	for _, key := range keys {
+		m.revision++
+		m.changes = append(m.changes, change{m.revision, key})
+	}
+	if len(m.changes) > maxChanges {
+		m.changes = m.changes[len(m.changes)-maxChanges:]
+		m.known = m.changes[0].revision - 1
+	}
+	m.dirty = true
+	close(m.changed)
+	m.changed = make(chan struct{})
+}
+
+// Keys under prefix changed after revision, the current revision, whether
+// the changes after revision are unknown, and a channel closed on the next
+// change
+func (m *MetadataStore) ChangesSince(prefix string, revision uint64) ([]string, uint64, bool, chan struct{}) {
+	m.mutex.Lock()
+	defer m.mutex.Unlock()
+	keys := []string{}
+	reset := revision > m.revision || revision < m.known
+	if !reset {
+		for _, c := range m.changes {
+			if c.revision > revision && strings.HasPrefix(c.key, prefix) {
+				keys = append(keys, c.key)
+			}
+		}
+	}
+	return keys, m.revision, reset, m.changed
+}
+
+// Write the entries to dir if they changed since the last snapshot,
+// replacing the previous snapshot only once the new one is complete
+func (m *MetadataStore) Save(dir string) error {
+	m.saveMutex.Lock()
+	defer m.saveMutex.Unlock()
+	m.mutex.Lock()
+	dirty := m.dirty
+	m.dirty = false
+	m.mutex.Unlock()
+	if !dirty {
+		return nil
+	}
+	entries := make(map[string]entry)
+	for i := range m.shards {
+		s := &m.shards[i]
+		s.mutex.RLock()
+		for key, e := range s.entries {
+			entries[key] = e
+		}
+		s.mutex.RUnlock()
+	}
+	err := writeSnapshot(filepath.Join(dir, snapshotFile), entries)
+	if err != nil {
+		m.mutex.Lock()
+		m.dirty = true
+		m.mutex.Unlock()
+	}
+	return err
+}
+
+func writeSnapshot(path string, entries map[string]entry) error {
+	tmp := path + ".tmp"
+	file, err := os.Create(tmp)
+	if err != nil {
+		return err
+	}
+	if err = gob.NewEncoder(file).Encode(entries); err == nil {
+		err = file.Sync()
+	}
+	if closeErr := file.Close(); err == nil {
+		err = closeErr
+	}
+	if err != nil {
+		os.Remove(tmp)
+		return err
+	}
+	return os.Rename(tmp, path)
+}
+
+func (m *MetadataStore) Load(dir string) error {
+	file, err := os.Open(filepath.Join(dir, snapshotFile))
+	if os.IsNotExist(err) {
+		return nil
+	}
+	if err != nil {
+		return err
+	}
+	defer file.Close()
+	entries := make(map[string]entry)
+	if err := gob.NewDecoder(file).Decode(&entries); err != nil {
+		return err
+	}
+	for key, e := range entries {
+		m.shardOf(key).entries[key] = e
+	}
+	log.Printf("loaded %d keys from %s", len(entries), dir)
+	return nil
 }
 
 func getQueryKey(c *gin.Context) string {
 	return c.Request.URL.Query().Get("key")
 }
 
+func acceptsGzip(c *gin.Context) bool {
+	return strings.Contains(c.GetHeader("Accept-Encoding"), "gzip")
+}
+
 func getMetadata(c *gin.Context) {
 	key := getQueryKey(c)
-	value, ok := metadataStore.Get(key)
+	e, ok := metadataStore.Get(key)
 	if !ok {
 		c.Data(http.StatusNotFound, jsonContentType, []byte(`metadata not found`))
 		return
 	}
+	// Compressed values go out as they are stored to clients that take them
+	if e.Compressed && acceptsGzip(c) {
+		c.Header("Content-Encoding", "gzip")
+		c.Data(http.StatusOK, jsonContentType, e.Data)
+		return
+	}
+	value, err := e.decode()
+	if err != nil {
+		c.Data(http.StatusInternalServerError, jsonContentType, []byte(`corrupted metadata`))
+		return
+	}
 	c.Data(http.StatusOK, jsonContentType, value)
 }
 
@@ -65,15 +307,133 @@ func deleteMetadata(c *gin.Context) {
 	c.Data(http.StatusOK, jsonContentType, []byte(`metadata deleted`))
 }
 
+// Values of the keys of {"keys": [...]} as {"values": {key: value}}, without
+// the keys not found
+func batchGetMetadata(c *gin.Context) {
+	var request struct {
+		Keys []string `json:"keys"`
+	}
+	if err := c.ShouldBindJSON(&request); err != nil {
+		c.Data(http.StatusBadRequest, jsonContentType, []byte(`invalid request`))
+		return
+	}
+	values := make(map[string]string, len(request.Keys))
+	for _, key := range request.Keys {
+		e, ok := metadataStore.Get(key)
+		if !ok {
+			continue
+		}
+		value, err := e.decode()
+		if err != nil {
+			c.Data(http.StatusInternalServerError, jsonContentType, []byte(`corrupted metadata`))
+			return
+		}
+		values[key] = string(value)
+	}
+	body, _ := json.Marshal(gin.H{"values": values})
+	if acceptsGzip(c) && len(body) >= metadataStore.compressThreshold {
+		var buf bytes.Buffer
+		w := gzip.NewWriter(&buf)
+		w.Write(body)
+		w.Close()
+		c.Header("Content-Encoding", "gzip")
+		c.Data(http.StatusOK, jsonContentType, buf.Bytes())
+		return
+	}
+	c.Data(http.StatusOK, jsonContentType, body)
+}
+
+// Set all the keys of {key: value}, watchers see them changed together
+func batchPutMetadata(c *gin.Context) {
+	var request map[string]string
+	if err := c.ShouldBindJSON(&request); err != nil {
+		c.Data(http.StatusBadRequest, jsonContentType, []byte(`invalid request`))
+		return
+	}
+	values := make(map[string][]byte, len(request))
+	for key, value := range request {
+		values[key] = []byte(value)
+	}
+	metadataStore.SetBatch(values)
+	c.Data(http.StatusOK, jsonContentType, []byte(`metadata updated`))
+}
+
+// Long poll for the keys under prefix changed after revision, answered once
+// there are any or after timeout_ms. Revision 0 gets the current revision
+// right away.
+func watchMetadata(c *gin.Context) {
+	query := c.Request.URL.Query()
+	prefix := query.Get("prefix")
+	revision, _ := strconv.ParseUint(query.Get("revision"), 10, 64)
+	timeout := maxWatchTimeout
+	if ms, err := strconv.Atoi(query.Get("timeout_ms")); err == nil && ms > 0 &&
+		time.Duration(ms)*time.Millisecond < timeout {
+		timeout = time.Duration(ms) * time.Millisecond
+	}
+	timer := time.NewTimer(timeout)
+	defer timer.Stop()
+	for {
+		keys, current, reset, changed := metadataStore.ChangesSince(prefix, revision)
+		if revision == 0 || reset || len(keys) > 0 {
+			c.JSON(http.StatusOK, gin.H{"revision": current, "reset": reset, "keys": keys})
+			return
+		}
+		select {
+		case <-changed:
+		case <-timer.C:
+			c.JSON(http.StatusOK, gin.H{"revision": current, "reset": false, "keys": keys})
+			return
+		case <-c.Request.Context().Done():
+			return
+		}
+	}
+}
+
 func main() {
 	address := flag.String("addr", ":8080", "HTTP server address (default :8080)")
+	shards := flag.Int("shards", 64, "Number of shards of the in-memory store")
+	compressThreshold := flag.Int("compress-threshold", 1024,
+		"Values of at least this many bytes are kept gzipped, 0 to disable")
+	dataDir := flag.String("data-dir", "",
+		"Directory to persist the metadata in, which is kept in memory only when empty")
+	flushInterval := flag.Duration("flush-interval", time.Second,
+		"Interval between snapshots of the changed metadata to the data directory")
 	flag.Parse()
 
+	metadataStore = NewMetadataStore(*shards, *compressThreshold)
+	if *dataDir != "" {
+		if err := os.MkdirAll(*dataDir, 0755); err != nil {
+			log.Fatalf("cannot create %s: %v", *dataDir, err)
+		}
+		if err := metadataStore.Load(*dataDir); err != nil {
+			log.Fatalf("cannot load metadata from %s: %v", *dataDir, err)
+		}
+		go func() {
+			for range time.Tick(*flushInterval) {
+				if err := metadataStore.Save(*dataDir); err != nil {
+					log.Printf("cannot save metadata to %s: %v", *dataDir, err)
+				}
+			}
+		}()
+		signals := make(chan os.Signal, 1)
+		signal.Notify(signals, syscall.SIGINT, syscall.SIGTERM)
+		go func() {
+			<-signals
+			if err := metadataStore.Save(*dataDir); err != nil {
+				log.Printf("cannot save metadata to %s: %v", *dataDir, err)
+			}
+			os.Exit(0)
+		}()
+	}
+
 	r := gin.Default()
 
 	r.GET("/metadata", getMetadata)
 	r.PUT("/metadata", putMetadata)
 	r.DELETE("/metadata", deleteMetadata)
+	r.POST("/metadata/batch_get", batchGetMetadata)
+	r.PUT("/metadata/batch", batchPutMetadata)
+	r.GET("/metadata/watch", watchMetadata)
 
 	r.Run(*address)
 }
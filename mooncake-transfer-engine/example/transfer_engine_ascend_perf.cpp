@@ -25,6 +25,7 @@
 #include <sstream>
 #include <unordered_map>
 #include "common/base/status.h"
+#include "config.h"
 #include "transfer_engine.h"
 #include "transport/transport.h"
 #include "acl/acl.h"
@@ -48,6 +49,17 @@ DEFINE_uint64(device_logicid, 0, "The device logic ID of this machine");
 DEFINE_uint64(device_phyid, 0, "The device phy ID of this machine");
 DEFINE_string(report_unit, "GB", "Report unit: GB|GiB|Gb|MB|MiB|Mb|KB|KiB|Kb");
 DEFINE_uint32(report_precision, 2, "Report precision");
+DEFINE_string(chunk_sizes, "",
+              "Comma separated chunk sizes the initiator sweeps, bytes each "
+              "request is cut into (MC_HCCL_CHUNK_SIZE by default)");
+DEFINE_int32(streams, 0,
+             "ACL streams per initiator thread (MC_HCCL_STREAMS by default)");
+DEFINE_bool(contiguous, false,
+            "Send adjacent blocks, which the transport can merge into fewer "
+            "HCCL operations, instead of every other block");
+DEFINE_int64(merge_size, -1,
+             "Bytes of adjacent slices merged into one HCCL operation "
+             "(MC_HCCL_MERGE_SIZE by default)");
 
 using namespace mooncake;
 
@@ -120,6 +132,33 @@ int allocateDevMem(void* &devAddr, size_t size) {
     return 0;
 }
 
+static std::vector<size_t> parseChunkSizes() {
+    std::vector<size_t> chunk_sizes;
+    std::stringstream ss(FLAGS_chunk_sizes);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        size_t chunk_size = std::strtoull(item.c_str(), nullptr, 10);
+        if (chunk_size)
+            chunk_sizes.push_back(chunk_size);
+        else
+            LOG(WARNING) << "Ignore invalid chunk size: " << item;
+    }
+    if (chunk_sizes.empty())
+        chunk_sizes.push_back(globalConfig().hccl_chunk_size);
+    return chunk_sizes;
+}
+
+// Value of counter name in the metrics of engine, 0 if it is not reported
+static uint64_t metricValue(TransferEngine &engine, const std::string &name) {
+    std::stringstream ss(engine.getMetricsText());
+    std::string line;
+    while (std::getline(ss, line)) {
+        if (line.compare(0, name.size() + 1, name + " ") == 0)
+            return std::strtoull(line.c_str() + name.size() + 1, nullptr, 10);
+    }
+    return 0;
+}
+
 int initiator() {
     aclrtContext context = NULL;
     aclError ret = aclrtCreateContext(&context, g_deviceLogicId);
@@ -128,6 +167,8 @@ int initiator() {
         return ret;
     }
 
+    if (FLAGS_streams > 0) globalConfig().hccl_streams = FLAGS_streams;
+    if (FLAGS_merge_size >= 0) globalConfig().hccl_merge_size = FLAGS_merge_size;
     auto engine = std::make_unique<TransferEngine>(FLAGS_auto_discovery);
 
     auto hostname_port = parseHostNameWithPort(FLAGS_local_server_name);
@@ -219,52 +260,67 @@ int initiator() {
     s = engine->freeBatchID(tmp_batch_id);
     LOG_ASSERT(s.ok());
 
-    for (uint32_t i = 0; i < FLAGS_block_iteration; i++) {
-        uint64_t block_size = FLAGS_block_size * (1 << i);
-        struct timeval start_tv, stop_tv;
-        gettimeofday(&start_tv, nullptr);
-        remote_base = (uint64_t)segment_desc->buffers[i + 1].addr;
-        auto batch_id = engine->allocateBatchID(FLAGS_batch_size);
-        std::vector<TransferRequest> requests;
-        // Send every other block to ensure that all the sent memory is non-contiguous
-        for (int j = 0; j < FLAGS_batch_size; ++j) {
-            TransferRequest entry;
-            entry.opcode = opcode;
-            entry.length = block_size;
-            entry.source = (uint8_t *)(g_addr[i]) + block_size * 2 * j;
-            entry.target_id = segment_id;
-            entry.target_offset = remote_base + block_size * 2 * j; 
-            requests.emplace_back(entry);
-        }
-        s = engine->submitTransfer(batch_id, requests);
-        LOG_ASSERT(s.ok());
-        bool completed = false;
-        TransferStatus status;
-        while (!completed) {
-            Status s = engine->getBatchTransferStatus(batch_id, status);
+    // Bandwidth of each block size against the chunk size requests are cut
+    // into; the chunk size is read on submission
+    for (size_t chunk_size : parseChunkSizes()) {
+        globalConfig().hccl_chunk_size = chunk_size;
+        for (uint32_t i = 0; i < FLAGS_block_iteration; i++) {
+            uint64_t block_size = FLAGS_block_size * (1 << i);
+            // Send every other block to ensure that all the sent memory is
+            // non-contiguous, unless adjacent blocks are asked for
+            uint64_t stride = FLAGS_contiguous ? block_size : block_size * 2;
+            uint64_t slices = metricValue(*engine, "te_hccl_slices_total");
+            uint64_t ops = metricValue(*engine, "te_hccl_ops_total");
+            struct timeval start_tv, stop_tv;
+            gettimeofday(&start_tv, nullptr);
+            remote_base = (uint64_t)segment_desc->buffers[i + 1].addr;
+            auto batch_id = engine->allocateBatchID(FLAGS_batch_size);
+            std::vector<TransferRequest> requests;
+            for (int j = 0; j < FLAGS_batch_size; ++j) {
+                TransferRequest entry;
+                entry.opcode = opcode;
+                entry.length = block_size;
+                entry.source = (uint8_t *)(g_addr[i]) + stride * j;
+                entry.target_id = segment_id;
+                entry.target_offset = remote_base + stride * j; 
+                requests.emplace_back(entry);
+            }
+            s = engine->submitTransfer(batch_id, requests);
             LOG_ASSERT(s.ok());
-            if (status.s == TransferStatusEnum::COMPLETED) {
-                completed = true;
-            } else if (status.s == TransferStatusEnum::FAILED) {
-                LOG(ERROR) << "getTransferStatus FAILED";
-                completed = true;
-            } else if (status.s == TransferStatusEnum::TIMEOUT) {
-                LOG(INFO) << "Sync data transfer timeout";
-                completed = true;
+            bool completed = false;
+            TransferStatus status;
+            while (!completed) {
+                Status s = engine->getBatchTransferStatus(batch_id, status);
+                LOG_ASSERT(s.ok());
+                if (status.s == TransferStatusEnum::COMPLETED) {
+                    completed = true;
+                } else if (status.s == TransferStatusEnum::FAILED) {
+                    LOG(ERROR) << "getTransferStatus FAILED";
+                    completed = true;
+                } else if (status.s == TransferStatusEnum::TIMEOUT) {
+                    LOG(INFO) << "Sync data transfer timeout";
+                    completed = true;
+                }
             }
+            gettimeofday(&stop_tv, nullptr);
+            uint64_t duration = (stop_tv.tv_sec - start_tv.tv_sec) * 1000000.0 +
+                            (stop_tv.tv_usec - start_tv.tv_usec);
+
+            LOG(INFO) << "Test completed: duration " << duration << "us, block size "
+                    << block_size / 1024 << "KB, chunk size "
+                    << chunk_size / 1024 << "KB, streams "
+                    << globalConfig().hccl_streams << ", slices "
+                    << metricValue(*engine, "te_hccl_slices_total") - slices
+                    << " merged into HCCL ops "
+                    << metricValue(*engine, "te_hccl_ops_total") - ops
+                    << ", total size "
+                    << FLAGS_batch_size * block_size / 1024 << "KB , throughput "
+                    << calculateRate(
+                            FLAGS_batch_size * block_size,
+                            duration);
+            s = engine->freeBatchID(batch_id);
+            LOG_ASSERT(s.ok());
         }
-        gettimeofday(&stop_tv, nullptr);
-        uint64_t duration = (stop_tv.tv_sec - start_tv.tv_sec) * 1000000.0 +
-                        (stop_tv.tv_usec - start_tv.tv_usec);
-
-        LOG(INFO) << "Test completed: duration " << duration << "us, block size "
-                << block_size / 1024 << "KB, total size "
-                << FLAGS_batch_size * block_size / 1024 << "KB , throughput "
-                << calculateRate(
-                        FLAGS_batch_size * block_size,
-                        duration);
-        s = engine->freeBatchID(batch_id);
-        LOG_ASSERT(s.ok());
     }
 
     // release resource
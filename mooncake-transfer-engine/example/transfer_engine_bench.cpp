@@ -17,11 +17,14 @@
 #include <signal.h>
 #include <sys/time.h>
 
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
+#include <deque>
 #include <fstream>
 #include <iomanip>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <unordered_map>
 
@@ -65,18 +68,32 @@ DEFINE_string(local_server_name, mooncake::getHostname(),
               "Local server name for segment discovery");
 DEFINE_string(metadata_server, "192.168.3.77:2379", "etcd server host address");
 DEFINE_string(mode, "initiator",
-              "Running mode: initiator or target. Initiator node read/write "
-              "data blocks from target node");
+              "Running mode: initiator, target or peer. Initiator node "
+              "read/write data blocks from target node, a peer node is both");
 DEFINE_string(operation, "read", "Operation type: read or write");
 
-DEFINE_string(protocol, "rdma", "Transfer protocol: rdma|tcp");
+DEFINE_string(protocol, "rdma", "Transfer protocol: rdma|tcp|nvlink|cxl");
 
 DEFINE_string(device_name, "mlx5_2",
               "Device name to use, valid if protocol=rdma");
 DEFINE_string(nic_priority_matrix, "",
               "Path to RDMA NIC priority matrix file (Advanced)");
 
-DEFINE_string(segment_id, "192.168.3.76", "Segment ID to access data");
+DEFINE_string(segment_id, "192.168.3.76",
+              "Segment ID to access data, or comma-separated segment IDs");
+DEFINE_string(pattern, "one_to_one",
+              "Traffic pattern: one_to_one (each thread uses one of the "
+              "segments) or all_to_all (each batch spreads over all of them)");
+DEFINE_double(rate, 0,
+              "Open loop: requests per second submitted by each thread "
+              "whether or not earlier ones completed, 0 for a closed loop");
+DEFINE_int32(max_inflight, 16,
+             "Open loop: batches each thread keeps outstanding at most");
+DEFINE_int64(start_time, 0,
+             "Unix time in seconds to start the transfers at, to line up "
+             "several initiators (e.g. fan-in to one target), 0 for now");
+DEFINE_string(latency_output, "",
+              "Write the request latency histogram to this file as CSV");
 DEFINE_uint64(buffer_size, 1ull << 30, "total size of data buffer");
 DEFINE_int32(batch_size, 128, "Batch size");
 DEFINE_uint64(block_size, 65536, "Block size for each transfer request");
@@ -170,11 +187,89 @@ static inline std::string calculateRate(uint64_t data_bytes, double duration) {
     return oss.str();
 }
 
+// Latencies in nanoseconds, recorded HDR style: exact below 64, then 32
+// linear sub-buckets per power of two, which keeps values within 3%
+class LatencyHistogram {
+   public:
+    static const int kSubBuckets = 32;
+
+    LatencyHistogram() : counts_(2 * kSubBuckets + 58 * kSubBuckets) {}
+
+    void record(uint64_t value) {
+        counts_[bucketOf(value)]++;
+        total_++;
+        max_ = std::max(max_, value);
+    }
+
+    void merge(const LatencyHistogram &other) {
+        for (size_t i = 0; i < counts_.size(); ++i)
+            counts_[i] += other.counts_[i];
+        total_ += other.total_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    uint64_t count() const { return total_; }
+
+    uint64_t max() const { return max_; }
+
+    uint64_t percentile(double p) const {
+        if (!total_) return 0;
+        uint64_t rank = std::max<uint64_t>(1, std::ceil(total_ * p));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            seen += counts_[i];
+            if (seen >= rank) return std::min(upperBound(i), max_);
+        }
+        return max_;
+    }
+
+    // One line per non-empty bucket: upper bound in microseconds, count
+    void writeCsv(std::ostream &out) const {
+        out << "latency_us,count\n";
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            if (counts_[i])
+                out << upperBound(i) / 1000.0 << "," << counts_[i] << "\n";
+        }
+    }
+
+   private:
+    static size_t bucketOf(uint64_t value) {
+        if (value < 2 * kSubBuckets) return value;
+        int shift = 63 - __builtin_clzll(value) - 5;
+        return 2 * kSubBuckets + (shift - 1) * kSubBuckets +
+               (value >> shift) - kSubBuckets;
+    }
+
+    static uint64_t upperBound(size_t bucket) {
+        if (bucket < 2 * kSubBuckets) return bucket;
+        int shift = (bucket - 2 * kSubBuckets) / kSubBuckets + 1;
+        uint64_t sub = (bucket - 2 * kSubBuckets) % kSubBuckets + kSubBuckets;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    std::vector<uint64_t> counts_;
+    uint64_t total_ = 0;
+    uint64_t max_ = 0;
+};
+
 volatile bool running = true;
 std::atomic<size_t> total_batch_count(0);
-
-Status initiatorWorker(TransferEngine *engine, SegmentID segment_id,
-                       int thread_id, void *addr) {
+std::mutex latency_mutex;
+LatencyHistogram request_latency;
+
+// A submitted batch, its requests are polled until all are done
+struct InflightBatch {
+    BatchID batch_id;
+    // Latencies run from here: the submission, or in an open loop the time
+    // it was due, so that a slow target also delays the later batches
+    int64_t start_ns;
+    std::vector<bool> done;
+    int remaining;
+};
+
+Status initiatorWorker(TransferEngine *engine,
+                       std::vector<SegmentID> segment_ids, int thread_id,
+                       void *addr) {
     bindToSocket(thread_id % NR_SOCKETS);
     TransferRequest::OpCode opcode;
     if (FLAGS_operation == "read")
@@ -186,57 +281,102 @@ Status initiatorWorker(TransferEngine *engine, SegmentID segment_id,
         exit(EXIT_FAILURE);
     }
 
-    auto segment_desc = engine->getMetadata()->getSegmentDescByID(segment_id);
-    if (!segment_desc) {
-        LOG(ERROR) << "Unable to get target segment ID, please recheck";
-        exit(EXIT_FAILURE);
+    std::vector<uint64_t> remote_bases;
+    for (auto segment_id : segment_ids) {
+        auto segment_desc =
+            engine->getMetadata()->getSegmentDescByID(segment_id);
+        if (!segment_desc) {
+            LOG(ERROR) << "Unable to get target segment ID, please recheck";
+            exit(EXIT_FAILURE);
+        }
+        // CXL requests address the shared region by offset
+        remote_bases.push_back(
+            segment_desc->protocol == "cxl"
+                ? 0
+                : (uint64_t)segment_desc
+                      ->buffers[thread_id % segment_desc->buffers.size()]
+                      .addr);
     }
-    uint64_t remote_base =
-        (uint64_t)segment_desc->buffers[thread_id % NR_SOCKETS].addr;
 
-    size_t batch_count = 0;
-    while (running) {
+    const bool all_to_all = FLAGS_pattern == "all_to_all";
+    auto submit = [&](int64_t start_ns) {
         auto batch_id = engine->allocateBatchID(FLAGS_batch_size);
-        Status s;
         std::vector<TransferRequest> requests;
         for (int i = 0; i < FLAGS_batch_size; ++i) {
+            size_t target = all_to_all
+                                ? (thread_id + i) % segment_ids.size()
+                                : thread_id % segment_ids.size();
             TransferRequest entry;
             entry.opcode = opcode;
             entry.length = FLAGS_block_size;
             entry.source = (uint8_t *)(addr) +
                            FLAGS_block_size * (i * FLAGS_threads + thread_id);
-            entry.target_id = segment_id;
+            entry.target_id = segment_ids[target];
             entry.target_offset =
-                remote_base +
+                remote_bases[target] +
                 FLAGS_block_size * (i * FLAGS_threads + thread_id);
             requests.emplace_back(entry);
         }
 
-        s = engine->submitTransfer(batch_id, requests);
+        Status s = engine->submitTransfer(batch_id, requests);
         if (!s.ok()) LOG(ERROR) << s.ToString();
         LOG_ASSERT(s.ok());
-        for (int task_id = 0; task_id < FLAGS_batch_size; ++task_id) {
-            bool completed = false;
-            TransferStatus status;
-            while (!completed) {
-                Status s = engine->getTransferStatus(batch_id, task_id, status);
+        return InflightBatch{batch_id, start_ns,
+                             std::vector<bool>(FLAGS_batch_size, false),
+                             FLAGS_batch_size};
+    };
+
+    const int64_t interval_ns =
+        FLAGS_rate > 0 ? int64_t(1e9 * FLAGS_batch_size / FLAGS_rate) : 0;
+    int64_t next_ns = getCurrentTimeInNano();
+    LatencyHistogram latency;
+    std::deque<InflightBatch> inflight;
+    size_t batch_count = 0;
+    while (running || !inflight.empty()) {
+        int64_t now = getCurrentTimeInNano();
+        if (running && FLAGS_rate > 0) {
+            while (next_ns <= now &&
+                   (int)inflight.size() < FLAGS_max_inflight) {
+                inflight.push_back(submit(next_ns));
+                next_ns += interval_ns;
+            }
+        } else if (running && inflight.empty()) {
+            inflight.push_back(submit(now));
+        }
+
+        // Poll every outstanding request, so each is timed when it is done
+        for (auto &batch : inflight) {
+            for (int task_id = 0; task_id < FLAGS_batch_size; ++task_id) {
+                if (batch.done[task_id]) continue;
+                TransferStatus status;
+                Status s =
+                    engine->getTransferStatus(batch.batch_id, task_id, status);
                 LOG_ASSERT(s.ok());
-                if (status.s == TransferStatusEnum::COMPLETED)
-                    completed = true;
-                else if (status.s == TransferStatusEnum::FAILED) {
+                if (status.s == TransferStatusEnum::FAILED) {
                     LOG(INFO) << "FAILED";
-                    completed = true;
                     exit(EXIT_FAILURE);
                 }
+                if (status.s != TransferStatusEnum::COMPLETED) continue;
+                latency.record(getCurrentTimeInNano() - batch.start_ns);
+                batch.done[task_id] = true;
+                batch.remaining--;
             }
         }
-
-        s = engine->freeBatchID(batch_id);
-        LOG_ASSERT(s.ok());
-        batch_count++;
+        for (auto it = inflight.begin(); it != inflight.end();) {
+            if (it->remaining) {
+                ++it;
+                continue;
+            }
+            Status s = engine->freeBatchID(it->batch_id);
+            LOG_ASSERT(s.ok());
+            batch_count++;
+            it = inflight.erase(it);
+        }
     }
     LOG(INFO) << "Worker " << thread_id << " stopped!";
     total_batch_count.fetch_add(batch_count);
+    std::lock_guard<std::mutex> lock(latency_mutex);
+    request_latency.merge(latency);
     return Status::OK();
 }
 
@@ -279,7 +419,7 @@ std::string loadNicPriorityMatrix() {
            device_names + "], []]}";
 }
 
-int initiator() {
+std::unique_ptr<TransferEngine> setupEngine() {
     // disable topology auto discovery for testing.
     auto engine = std::make_unique<TransferEngine>(FLAGS_auto_discovery);
 
@@ -299,12 +439,17 @@ int initiator() {
             xport = engine->installTransport("tcp", nullptr);
         } else if (FLAGS_protocol == "nvlink") {
             xport = engine->installTransport("nvlink", nullptr);
+        } else if (FLAGS_protocol == "cxl") {
+            xport = engine->installTransport("cxl", nullptr);
         } else {
             LOG(ERROR) << "Unsupported protocol";
         }
         LOG_ASSERT(xport);
     }
+    return engine;
+}
 
+std::vector<void *> allocateBuffers(TransferEngine *engine) {
     std::vector<void *> addr(NR_SOCKETS, nullptr);
     int buffer_num = NR_SOCKETS;
 
@@ -325,8 +470,47 @@ int initiator() {
         LOG_ASSERT(!rc);
     }
 #endif
+    return addr;
+}
 
-    auto segment_id = engine->openSegment(FLAGS_segment_id.c_str());
+void reportLatency() {
+    auto us = [](uint64_t ns) { return ns / 1000.0; };
+    LOG(INFO) << "Request latency (us): count " << request_latency.count()
+              << std::fixed << std::setprecision(1) << ", p50 "
+              << us(request_latency.percentile(0.5)) << ", p90 "
+              << us(request_latency.percentile(0.9)) << ", p99 "
+              << us(request_latency.percentile(0.99)) << ", p999 "
+              << us(request_latency.percentile(0.999)) << ", max "
+              << us(request_latency.max());
+    if (!FLAGS_latency_output.empty()) {
+        std::ofstream out(FLAGS_latency_output);
+        request_latency.writeCsv(out);
+        if (!out)
+            LOG(ERROR) << "Failed to write " << FLAGS_latency_output;
+    }
+}
+
+// Runs the workers against the segments of --segment_id, leaving out the
+// local one, and reports the throughput and latencies
+void runInitiators(TransferEngine *engine, const std::vector<void *> &addr) {
+    std::vector<SegmentID> segment_ids;
+    std::stringstream ss(FLAGS_segment_id);
+    std::string name;
+    while (getline(ss, name, ',')) {
+        if (name.empty() || name == FLAGS_local_server_name) continue;
+        segment_ids.push_back(engine->openSegment(name.c_str()));
+    }
+    LOG_ASSERT(!segment_ids.empty());
+
+    if (FLAGS_start_time > 0) {
+        int64_t wait_ns = FLAGS_start_time * 1000000000ll -
+                          getCurrentTimeInNano();
+        if (wait_ns > 0)
+            std::this_thread::sleep_for(std::chrono::nanoseconds(wait_ns));
+        else
+            LOG(WARNING) << "Start time passed " << -wait_ns / 1000000
+                         << " ms ago, starting now";
+    }
 
     std::thread workers[FLAGS_threads];
 
@@ -334,8 +518,8 @@ int initiator() {
     gettimeofday(&start_tv, nullptr);
 
     for (int i = 0; i < FLAGS_threads; ++i)
-        workers[i] = std::thread(initiatorWorker, engine.get(), segment_id, i,
-                                 addr[i % buffer_num]);
+        workers[i] = std::thread(initiatorWorker, engine, segment_ids, i,
+                                 addr[i % addr.size()]);
 
     sleep(FLAGS_duration);
     running = false;
@@ -355,8 +539,16 @@ int initiator() {
               << calculateRate(
                      batch_count * FLAGS_batch_size * FLAGS_block_size,
                      duration);
+    reportLatency();
+}
 
-    for (int i = 0; i < buffer_num; ++i) {
+int initiator() {
+    auto engine = setupEngine();
+    auto addr = allocateBuffers(engine.get());
+
+    runInitiators(engine.get(), addr);
+
+    for (size_t i = 0; i < addr.size(); ++i) {
         engine->unregisterLocalMemory(addr[i]);
         freeMemoryPool(addr[i], FLAGS_buffer_size);
     }
@@ -371,66 +563,46 @@ void signalHandler(int signum) {
     target_running = false;
 }
 
+void serveUntilStopped(TransferEngine *engine,
+                       const std::vector<void *> &addr) {
+    while (target_running) sleep(1);
+    for (size_t i = 0; i < addr.size(); ++i) {
+        engine->unregisterLocalMemory(addr[i]);
+#ifdef USE_MNNVL
+        mooncake::NvlinkTransport::freePinnedLocalMemory(addr[i]);
+#else
+        freeMemoryPool(addr[i], FLAGS_buffer_size);
+#endif
+    }
+}
+
 int target() {
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
 
-    // disable topology auto discovery for testing.
-    auto engine = std::make_unique<TransferEngine>(FLAGS_auto_discovery);
-
-    auto hostname_port = parseHostNameWithPort(FLAGS_local_server_name);
-    engine->init(FLAGS_metadata_server, FLAGS_local_server_name.c_str(),
-                 hostname_port.first.c_str(), hostname_port.second);
+    auto engine = setupEngine();
+    auto addr = allocateBuffers(engine.get());
 
-    if (!FLAGS_auto_discovery) {
-        if (FLAGS_protocol == "rdma") {
-            auto nic_priority_matrix = loadNicPriorityMatrix();
-            void **args = (void **)malloc(2 * sizeof(void *));
-            args[0] = (void *)nic_priority_matrix.c_str();
-            args[1] = nullptr;
-            engine->installTransport("rdma", args);
-        } else if (FLAGS_protocol == "tcp") {
-            engine->installTransport("tcp", nullptr);
-        } else if (FLAGS_protocol == "nvlink") {
-            engine->installTransport("nvlink", nullptr);
-        } else {
-            LOG(ERROR) << "Unsupported protocol";
-        }
-    }
+    LOG(INFO) << "numa node num: " << NR_SOCKETS;
 
-    std::vector<void *> addr(NR_SOCKETS, nullptr);
-    int buffer_num = NR_SOCKETS;
+    serveUntilStopped(engine.get(), addr);
+    return 0;
+}
 
-#ifdef USE_CUDA
-    if (FLAGS_use_vram) LOG(INFO) << "VRAM is used";
-    for (int i = 0; i < buffer_num; ++i) {
-        addr[i] = allocateMemoryPool(FLAGS_buffer_size, i, FLAGS_use_vram);
-        std::string name_prefix = FLAGS_use_vram ? "cuda:" : "cpu:";
-        int rc = engine->registerLocalMemory(addr[i], FLAGS_buffer_size,
-                                             name_prefix + std::to_string(i));
-        LOG_ASSERT(!rc);
-    }
-#else
-    for (int i = 0; i < buffer_num; ++i) {
-        addr[i] = allocateMemoryPool(FLAGS_buffer_size, i, false);
-        int rc = engine->registerLocalMemory(addr[i], FLAGS_buffer_size,
-                                             "cpu:" + std::to_string(i));
-        LOG_ASSERT(!rc);
-    }
-#endif
+// Target and initiator at once, e.g. for all-to-all among the nodes listed
+// in --segment_id. The buffers are served until stopped, for the peers
+// still running.
+int peer() {
+    signal(SIGINT, signalHandler);
+    signal(SIGTERM, signalHandler);
 
-    LOG(INFO) << "numa node num: " << NR_SOCKETS;
+    auto engine = setupEngine();
+    auto addr = allocateBuffers(engine.get());
 
-    while (target_running) sleep(1);
-    for (int i = 0; i < buffer_num; ++i) {
-        engine->unregisterLocalMemory(addr[i]);
-#ifdef USE_MNNVL
-        mooncake::NvlinkTransport::freePinnedLocalMemory(addr[i]);
-#else
-        freeMemoryPool(addr[i], FLAGS_buffer_size);
-#endif
-    }
+    runInitiators(engine.get(), addr);
+    LOG(INFO) << "Serving the buffers to the other peers until stopped";
 
+    serveUntilStopped(engine.get(), addr);
     return 0;
 }
 
@@ -452,7 +624,9 @@ int main(int argc, char **argv) {
         return initiator();
     else if (FLAGS_mode == "target")
         return target();
+    else if (FLAGS_mode == "peer")
+        return peer();
 
-    LOG(ERROR) << "Unsupported mode: must be 'initiator' or 'target'";
+    LOG(ERROR) << "Unsupported mode: must be 'initiator', 'target' or 'peer'";
     exit(EXIT_FAILURE);
 }
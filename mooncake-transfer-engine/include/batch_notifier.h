@@ -0,0 +1,91 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BATCH_NOTIFIER_H_
+#define BATCH_NOTIFIER_H_
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "multi_transport.h"
+
+namespace mooncake {
+// BatchNotifier tells callers a batch is done instead of having each of
+// them poll its tasks, e.g. the Go and Rust bindings, which would burn a
+// thread per transfer otherwise.
+//
+// One thread polls the batches watched, sleeping on the progress futex of
+// one of them between rounds, and once a batch is no longer WAITING it
+// calls its callback and signals its eventfd. The eventfd stays readable
+// until the batch is freed, so an event loop may pick it up late.
+class BatchNotifier {
+   public:
+    using BatchID = Transport::BatchID;
+    using TransferStatus = Transport::TransferStatus;
+    using Callback = std::function<void(BatchID, const TransferStatus &)>;
+
+    explicit BatchNotifier(std::shared_ptr<MultiTransport> transport);
+
+    ~BatchNotifier();
+
+    // Call callback once, from the notifier thread, when the batch is done.
+    // Meant for after the last submission to the batch, which would be
+    // reported done if it has no tasks yet. The callback must not block
+    Status setCallback(BatchID batch_id, Callback callback);
+
+    // Like setCallback(), for callbacks of the engine itself, which leave
+    // the callback set by setCallback() alone and are called after it
+    Status addCallback(BatchID batch_id, Callback callback);
+
+    // An eventfd, nonblocking, which becomes readable when the batch is
+    // done. It is closed by forget(), freeing the batch
+    Status getEventFd(BatchID batch_id, int &fd);
+
+    // Drop the callback and the eventfd of a freed batch
+    void forget(BatchID batch_id);
+
+   private:
+    struct Watch {
+        Callback callback;
+        std::vector<Callback> added_callbacks;
+        int fd = -1;
+        bool done = false;
+    };
+
+    Watch *findWatch(BatchID batch_id);
+
+    void notifyWorker();
+
+   private:
+    // Longest sleep between polls, transports that only notice completions
+    // when polled do not wake the futex
+    const static int64_t kPollTimeoutNs = 100000;
+
+    std::shared_ptr<MultiTransport> transport_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::unordered_map<BatchID, Watch> watches_;
+    // Watches not done yet
+    size_t waiting_;
+    bool running_;
+    std::thread worker_;
+};
+}  // namespace mooncake
+
+#endif  // BATCH_NOTIFIER_H_
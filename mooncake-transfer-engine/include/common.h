@@ -31,9 +31,13 @@
 #include <ctime>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <optional>
 #include <sstream>
+#include <string>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include "error.h"
 
@@ -56,6 +60,8 @@ enum class HandShakeRequestType {
     Connection = 0,
     Metadata = 1,
     Notify = 2,
+    // Credits of writes to the peer, see IncastControl
+    Credit = 3,
     // placeholder for old protocol without RequestType
     OldProtocol = 0xff,
 };
@@ -312,7 +318,7 @@ static inline std::pair<HandShakeRequestType, std::string> readString(int fd) {
         return {type, ""};
     }
 
-    if (buffer[0] <= static_cast<char>(HandShakeRequestType::Notify)) {
+    if (buffer[0] <= static_cast<char>(HandShakeRequestType::Credit)) {
         type = static_cast<HandShakeRequestType>(buffer[0]);
         str.assign(buffer.data() + sizeof(char), length - sizeof(char));
     } else {
@@ -344,6 +350,78 @@ static inline const std::string MakeNicPath(const std::string &server_name,
     return server_name + NIC_PATH_DELIM + nic_name;
 }
 
+// Dense integer ID of an interned NIC path
+using NicPathID = uint32_t;
+const static NicPathID kInvalidNicPathID = UINT32_MAX;
+
+// Process-wide table interning NIC paths into dense IDs, so that the RDMA
+// data path carries and indexes by an integer instead of hashing strings.
+// IDs are never reused. Interning takes a lock; path() does not, as a
+// path is written before its ID is handed out and chunks never move.
+class NicPathTable {
+   public:
+    static NicPathTable &instance() {
+        static NicPathTable table;
+        return table;
+    }
+
+    NicPathTable(const NicPathTable &) = delete;
+    NicPathTable &operator=(const NicPathTable &) = delete;
+
+    // Returns kInvalidNicPathID if the table is full
+    NicPathID intern(const std::string &nic_path) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto iter = ids_.find(nic_path);
+        if (iter != ids_.end()) return iter->second;
+        NicPathID id = size_.load(std::memory_order_relaxed);
+        if (id / kChunkSize >= kMaxChunks) {
+            LOG(ERROR) << "NicPathTable: too many NIC paths, cannot intern "
+                       << nic_path;
+            return kInvalidNicPathID;
+        }
+        auto &chunk = chunks_[id / kChunkSize];
+        if (!chunk.load(std::memory_order_relaxed))
+            chunk.store(new std::string[kChunkSize], std::memory_order_release);
+        chunk.load(std::memory_order_relaxed)[id % kChunkSize] = nic_path;
+        ids_.emplace(nic_path, id);
+        size_.store(id + 1, std::memory_order_release);
+        return id;
+    }
+
+    const std::string &path(NicPathID id) const {
+        static const std::string kEmpty;
+        if (id >= size_.load(std::memory_order_acquire)) return kEmpty;
+        return chunks_[id / kChunkSize].load(
+            std::memory_order_acquire)[id % kChunkSize];
+    }
+
+    // One more than the largest ID handed out
+    size_t size() const { return size_.load(std::memory_order_acquire); }
+
+   private:
+    NicPathTable() = default;
+
+    ~NicPathTable() {
+        for (auto &chunk : chunks_) delete[] chunk.load();
+    }
+
+    const static size_t kChunkSize = 4096;
+    const static size_t kMaxChunks = 1024;
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, NicPathID> ids_;
+    std::atomic<std::string *> chunks_[kMaxChunks] = {};
+    std::atomic<NicPathID> size_{0};
+};
+
+static inline NicPathID InternNicPath(const std::string &nic_path) {
+    return NicPathTable::instance().intern(nic_path);
+}
+
+static inline const std::string &NicPathOf(NicPathID id) {
+    return NicPathTable::instance().path(id);
+}
+
 static inline bool overlap(const void *a, size_t a_len, const void *b,
                            size_t b_len) {
     return (a >= b && a < (char *)b + b_len) ||
@@ -21,6 +21,8 @@
 #include <cstddef>
 #include <cstdint>
 #include <mutex>
+#include <string>
+#include <vector>
 
 namespace mooncake {
 struct GlobalConfig {
@@ -35,10 +37,27 @@ struct GlobalConfig {
     size_t max_sge = 4;
     size_t max_wr = 256;
     size_t max_inline = 64;
+    // Only every signal_interval-th work request of a post is signaled
+    size_t signal_interval = 16;
     ibv_mtu mtu_length = IBV_MTU_4096;
     uint16_t handshake_port = 12001;
     int workers_per_ctx = 2;
+    int connect_workers_per_ctx = 4;
+    // Register memory with on-demand paging where the device supports it
+    bool enable_odp = false;
+    // Buffers larger than this are registered and published in chunks, 0
+    // registers every buffer as a whole
+    size_t mr_chunk_size = 0;
+    // Bytes of unregistered source buffers RdmaTransport registers on first
+    // use and keeps registered, 0 fails transfers from them instead
+    size_t rcache_size = 0;
+    // GPU buffers without GPUDirect RDMA are transferred through this many
+    // registered pinned host buffers of staging_chunk_size, 0 fails them
+    size_t staging_buffers = 8;
+    size_t staging_chunk_size = 4194304;
     size_t slice_size = 65536;
+    // Upper bound of adaptive slices, slice_size disables adaptive slicing
+    size_t max_slice_size = 1048576;
     int retry_cnt = 9;
     int handshake_listen_backlog = 128;
     bool metacache = true;
@@ -48,6 +67,83 @@ struct GlobalConfig {
     bool use_ipv6 = false;
     size_t fragment_limit = 16384;
     bool enable_dest_device_affinity = false;
+    bool enable_multi_rail = false;
+    // Use DC endpoints instead of RC QPs, needs USE_MLX5_DC
+    bool enable_dc = false;
+    size_t num_dci_per_ctx = 16;
+    // Threads running the io_context of TcpTransport
+    int tcp_worker_threads = 4;
+    // Persistent connections TcpTransport keeps at most to each peer
+    int tcp_connections_per_peer = 8;
+    // TCP requests are cut into slices of this size, which are striped over
+    // the connections to the peer
+    size_t tcp_slice_size = 4194304;
+    // Send TCP payloads with MSG_ZEROCOPY
+    bool tcp_zerocopy = false;
+    // CUDA streams NvlinkTransport spreads the copies between two devices
+    // over, 0 for one per copy engine of the issuing device
+    size_t nvlink_streams_per_pair = 0;
+    // Remote buffers NvlinkTransport keeps mapped, least recently used ones
+    // are unmapped beyond that
+    size_t nvlink_max_mappings = 1024;
+    // IOs NVMeoFTransport keeps in flight per target file
+    size_t nvmeof_queue_depth = 32;
+    // Threads CxlTransport runs the copies of slices on
+    int cxl_workers = 4;
+    // Install ShmTransport in Mooncake Store clients and back their
+    // segments with shared memory
+    bool enable_shm = false;
+    // Threads LoopbackTransport copies the transfers to the local segment
+    // on, 0 sends them through the transport of the segment instead
+    int loopback_threads = 4;
+    // ACL streams each HcclTransport initiator pipelines batches over
+    int hccl_streams = 4;
+    // HCCL requests are cut into chunks of this size, spread over the streams
+    size_t hccl_chunk_size = 8388608;
+    // Slices adjacent on both sides are issued as one HCCL operation of up
+    // to this size, 0 issues each on its own
+    size_t hccl_merge_size = 1048576;
+    // Install TcpTransport next to the discovered RDMA transport, and fail
+    // the requests to peers doing the same over to it
+    bool tcp_fallback = false;
+    // Publish segment descriptors with compact buffers, and as deltas when
+    // only their buffers change. Every reader must support it.
+    bool compact_metadata = false;
+    // Refresh cached segment descriptors as the metadata server notifies
+    // their changes, where it can
+    bool metadata_watch = true;
+    // Publish only where segment descriptors can be pulled from in the
+    // metadata server, and serve them over the handshake port
+    bool peer_metadata = false;
+    // Shares of the RDMA bandwidth of the latency, normal and background
+    // traffic classes while they all have slices queued
+    int traffic_class_weights[3] = {8, 4, 1};
+    // RDMA workers that find no completion for this long arm their CQs and
+    // block until the next completion or submission, 0 busy polls always
+    int adaptive_poll_us = 0;
+    // Size the transfer workers and CQs of each RDMA context to the link
+    // rate of its port, and pin each worker to a core of its own local to
+    // the device
+    bool auto_tune_workers = false;
+    // CPUs the application runs on, which RDMA workers stay off
+    std::vector<int> reserved_cpus;
+    // RDMA endpoints of closed segments stay connected this long, and are
+    // reused if the segments are opened again
+    int endpoint_keepalive_ms = 60000;
+    // Evict RDMA endpoints by recent traffic and connection cost, and fit
+    // their count to the QPs the device can create, see
+    // WeightedEndpointStore
+    bool weighted_endpoint_store = false;
+    // Take writes with immediate from peers on every RDMA connection, see
+    // TransferEngine::submitTransferWithImm(). Both sides must enable it.
+    bool inband_notify = false;
+    // Writes to peers of NORMAL and BACKGROUND traffic wait for credits of
+    // the peers, which share their inbound rate between their writers, see
+    // IncastControl. Both sides must enable it.
+    bool incast_control = false;
+    // Inbound bytes per second shared between the writers with incast
+    // control, 0 for the link rates of the local RNICs
+    uint64_t incast_inbound_rate = 0;
 };
 
 void loadGlobalConfig(GlobalConfig &config);
@@ -58,6 +154,17 @@ void updateGlobalConfig(ibv_device_attr &device_attr);
 
 GlobalConfig &globalConfig();
 
+// Immutable copy of the configuration, which the knobs that can change at
+// runtime are read from. A snapshot stays valid for the whole process.
+const GlobalConfig &configSnapshot();
+
+// Set a knob by the name of its field for the transfers submitted from then
+// on, e.g. ("slice_size", "262144"). Only slice_size, max_slice_size,
+// retry_cnt, fragment_limit, slice_timeout, tcp_slice_size,
+// traffic_class_weights ("8,4,1") and rate_limits (see RateLimiter) can
+// change at runtime.
+int updateConfigOption(const std::string &name, const std::string &value);
+
 uint16_t getDefaultHandshakePort();
 }  // namespace mooncake
 
@@ -0,0 +1,85 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DSA_ENGINE_H
+#define DSA_ENGINE_H
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace mooncake {
+
+// DsaEngine offloads memory copies to an Intel Data Streaming Accelerator
+// (DSA) work queue, so that large copies do not occupy a CPU core each.
+// Copies are submitted from user space as batch descriptors through the
+// portal of the work queue, which must be enabled in user mode with shared
+// virtual addressing, e.g. with accel-config. The calling thread waits for
+// the completion records; whatever the device does not complete, e.g. on
+// a page fault, is copied by the CPU instead.
+//
+// Configured through environment variables:
+// - MC_DSA_WQ: work queue device to use, e.g. /dev/dsa/wq0.0. DSA is not
+//   used unless it is set.
+// - MC_DSA_MIN_SIZE: copies smaller than this are left to the CPU, default
+//   64 KB.
+class DsaEngine {
+   public:
+    struct Operation {
+        void *dest;
+        const void *src;
+        size_t length;
+    };
+
+    // The engine of the process, nullptr if DSA is not configured or the
+    // work queue cannot be opened
+    static DsaEngine *get();
+
+    ~DsaEngine();
+
+    DsaEngine(const DsaEngine &) = delete;
+    DsaEngine &operator=(const DsaEngine &) = delete;
+
+    // Copy all operations and return when they are done. Operations are
+    // cut to the maximum transfer size of the work queue and submitted in
+    // batches.
+    void copy(const std::vector<Operation> &operations);
+
+    // Copies below this size are cheaper on the CPU
+    size_t minSize() const { return min_size_; }
+
+   private:
+    DsaEngine() = default;
+
+    int open(const std::string &path);
+
+    // Submit a descriptor to the portal, false if the work queue did not
+    // accept it
+    bool submit(const void *desc);
+
+    void *portal_ = nullptr;
+    int fd_ = -1;
+    bool dedicated_ = false;
+    size_t min_size_ = 65536;
+    size_t max_batch_size_ = 32;
+    size_t max_transfer_size_ = 2097152;
+    // Free entries of a dedicated work queue, which drops descriptors
+    // submitted beyond its size
+    std::atomic<int> credits_{0};
+};
+
+}  // namespace mooncake
+
+#endif  // DSA_ENGINE_H
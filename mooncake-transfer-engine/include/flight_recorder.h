@@ -0,0 +1,88 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace mooncake {
+
+enum class FlightEvent : uint8_t {
+    // id: batch of the first slice, arg0: slices, arg1: bytes
+    kSubmit = 1,
+    // id: peer NIC path, arg0: work requests, arg1: bytes
+    kPost,
+    // id: peer NIC path, arg0: bytes, arg1: ibv_wc_status
+    kComplete,
+    // id: peer NIC path, arg0: bytes, arg1: attempts so far
+    kRetry,
+    // A slice out of attempts. id: peer NIC path, arg0: bytes, arg1: attempts
+    kFail,
+    // id: peer NIC path, arg0: 1 connected / 0 failed or disconnected,
+    // arg1: latency in microseconds or error code
+    kEndpoint,
+    // A batch the store gave up waiting for. id: batch, arg0: tasks,
+    // arg1: seconds waited
+    kTimeout,
+};
+
+const char *flightEventName(FlightEvent event);
+
+// Records the recent transfer events of each thread in a ring buffer of
+// its own, so that a failure can be explained by what led to it.
+//
+// Recording takes a TSC read and four relaxed stores to memory only the
+// calling thread writes. The rings are read without stopping the writers:
+// a slot overwritten while it is read is left out of the dump. The rings of
+// exited threads are dropped.
+//
+// Disabled with MC_FLIGHT_RECORDER=0. The last MC_FLIGHT_RECORDER_EVENTS
+// events of each thread are kept, 4096 by default.
+class FlightRecorder {
+   public:
+    static void record(FlightEvent event, uint64_t id, uint64_t arg0,
+                       uint64_t arg1) {
+        if (!enabled_.load(std::memory_order_relaxed)) return;
+        recordSlow(event, id, arg0, arg1);
+    }
+
+    // The events of all threads, one per line ordered by time, the
+    // last max_events of each thread at most
+    static std::string dump(size_t max_events_per_thread = SIZE_MAX);
+
+    // Logs the last events of every thread at ERROR, at most once every
+    // ten seconds so that a burst of failures logs once
+    static void dumpToLog(const std::string &reason);
+
+    // Logs the events on signo, unless the process has a handler for it
+    static void installSignalHandler(int signo);
+
+    static void setEnabled(bool enabled) {
+        enabled_.store(enabled, std::memory_order_relaxed);
+    }
+
+   private:
+    static void recordSlow(FlightEvent event, uint64_t id, uint64_t arg0,
+                           uint64_t arg1);
+
+    static std::atomic<bool> enabled_;
+};
+
+}  // namespace mooncake
+
+#endif  // FLIGHT_RECORDER_H
@@ -20,6 +20,9 @@
 #include "transport/transport.h"
 
 namespace mooncake {
+class ShmTransport;
+class LoopbackTransport;
+
 class MultiTransport {
    public:
     using BatchID = Transport::BatchID;
@@ -38,6 +41,8 @@ class MultiTransport {
 
     Status freeBatchID(BatchID batch_id);
 
+    // Can be called from many threads on one batch at once, the batch is
+    // reported done once all of them returned and their tasks completed
     Status submitTransfer(BatchID batch_id,
                           const std::vector<TransferRequest> &entries);
 
@@ -53,15 +58,35 @@ class MultiTransport {
 
     std::vector<Transport *> listTransports();
 
+    // Warms up the segments on every installed transport
+    int warmupSegments(const std::vector<std::string> &segment_names);
+
+    // Closes the segment on every installed transport
+    int closeSegment(Transport::SegmentID segment_id);
+
    private:
-    Status selectTransport(const TransferRequest &entry, Transport *&transport);
+    // Submit entries as the tasks of the batch from task_id on
+    Status submitTasks(Transport::BatchDesc &batch_desc, size_t task_id,
+                       const std::vector<TransferRequest> &entries);
+
+    // Route entry to transport, and pick the transport it fails over to,
+    // nullptr if none
+    Status selectTransport(const TransferRequest &entry, Transport *&transport,
+                           Transport *&fallback);
+
+    // Resubmit failed task to its fallback. False if it has none, the task
+    // then stays failed.
+    bool failover(Transport::TransferTask &task);
 
    private:
     std::shared_ptr<TransferMetadata> metadata_;
     std::string local_server_name_;
     std::map<std::string, std::shared_ptr<Transport>> transport_map_;
-    RWSpinlock batch_desc_lock_;
-    std::unordered_map<BatchID, std::shared_ptr<BatchDesc>> batch_desc_set_;
+    // Serves the requests it can map before the protocol of the segment
+    ShmTransport *shm_transport_ = nullptr;
+    // Serves the requests to the local segment ahead of all the others,
+    // nullptr if MC_LOOPBACK_THREADS is 0
+    std::shared_ptr<LoopbackTransport> loopback_transport_;
 };
 }  // namespace mooncake
 
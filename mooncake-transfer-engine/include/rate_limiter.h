@@ -0,0 +1,128 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace mooncake {
+
+// Token bucket of rate bytes per second holding up to burst bytes, kept as
+// the time its debt is paid off so that it is charged with a single CAS
+class TokenBucket {
+   public:
+    TokenBucket(uint64_t rate, uint64_t burst) { setRate(rate, burst); }
+
+    // Bytes that can be sent at now_ns, 0 while the bucket is in debt
+    int64_t available(uint64_t now_ns) const {
+        const uint64_t burst_ns = burst_ns_.load(std::memory_order_relaxed);
+        uint64_t paid_ts = paid_ts_.load(std::memory_order_relaxed);
+        if (paid_ts < now_ns) paid_ts = now_ns;
+        if (paid_ts >= now_ns + burst_ns) return 0;
+        return (now_ns + burst_ns - paid_ts) /
+               ns_per_byte_.load(std::memory_order_relaxed);
+    }
+
+    // Take bytes sent at now_ns, which may put the bucket in debt
+    void consume(uint64_t bytes, uint64_t now_ns) {
+        const uint64_t cost =
+            bytes * ns_per_byte_.load(std::memory_order_relaxed);
+        uint64_t paid_ts = paid_ts_.load(std::memory_order_relaxed);
+        while (!paid_ts_.compare_exchange_weak(
+            paid_ts, std::max(paid_ts, now_ns) + cost,
+            std::memory_order_relaxed))
+            ;
+        admitted_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    // Applies to the bytes consumed from then on, the debt is kept
+    void setRate(uint64_t rate, uint64_t burst) {
+        ns_per_byte_.store(1e9 / rate, std::memory_order_relaxed);
+        burst_ns_.store(burst * 1e9 / rate, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> admitted_bytes{0};
+    // Rounds of the RDMA workers in which slices waited for this bucket
+    std::atomic<uint64_t> throttled{0};
+
+   private:
+    std::atomic<double> ns_per_byte_;
+    std::atomic<uint64_t> burst_ns_;
+    std::atomic<uint64_t> paid_ts_{0};
+};
+
+// Bandwidth limits of the traffic to peer segments, enforced by the RDMA
+// workers before posting. A rule matches transfers by target segment, local
+// device and traffic class; a field left out matches any value, and all the
+// matching traffic shares the bucket of the rule, while "*" gives each
+// value a bucket of its own. Traffic matching several rules is charged to
+// all of them.
+//
+// Rules are separated by ';', their fields by ',', e.g.
+//
+//   segment=*,class=background,rate=2G;device=mlx5_0,rate=10G,burst=64M
+//
+// caps the background traffic to each peer at 2 GiB/s and all the traffic
+// of mlx5_0 at 10 GiB/s. Rates are in bytes per second with an optional K,
+// M or G binary suffix, bursts default to 10 ms of the rate. Set from
+// MC_RATE_LIMITS, and at runtime through updateConfigOption("rate_limits").
+class RateLimiter {
+   public:
+    struct Rule {
+        // Empty for any value, "*" for a bucket per value
+        std::string segment, device;
+        // -1 for any class
+        int traffic_class = -1;
+        bool per_class = false;
+        uint64_t rate = 0, burst = 0;
+        std::string spec;
+
+        std::mutex mutex;
+        // Buckets by the values of the "*" fields
+        std::map<std::string, std::unique_ptr<TokenBucket>> buckets;
+    };
+
+    struct RuleSet {
+        std::vector<std::unique_ptr<Rule>> rules;
+
+        // Buckets traffic of traffic_class from device to segment is
+        // charged to
+        std::vector<TokenBucket *> match(const std::string &segment,
+                                         const std::string &device,
+                                         int traffic_class) const;
+    };
+
+    // Rules in force. Replaced sets stay valid for the whole process.
+    static const RuleSet &rules();
+
+    // Replace the rules, ERR_INVALID_ARGUMENT if spec cannot be parsed. The
+    // buckets start full.
+    static int setRules(const std::string &spec);
+
+    // Prometheus text of the admitted bytes and throttled rounds of each
+    // bucket
+    static void appendMetrics(std::string &out);
+};
+
+}  // namespace mooncake
+
+#endif  // RATE_LIMITER_H
@@ -0,0 +1,120 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef STREAM_TRIGGER_H_
+#define STREAM_TRIGGER_H_
+
+#ifdef USE_CUDA
+
+#include <cuda.h>
+#include <cuda_runtime.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "multi_transport.h"
+
+namespace mooncake {
+// Experimental: StreamTrigger lets a CUDA stream start and wait for
+// transfers without the host synchronizing with it, e.g. to send each
+// layer of the KV cache as soon as the kernel producing it finishes.
+//
+// Both directions go through flags in mapped host memory. submit() queues
+// a write of a flag to the stream, which the GPU performs once the work
+// queued before is done and visible; the trigger thread polls the flags
+// and submits the transfers of those written. wait() queues a wait for a
+// flag the trigger thread writes once the batch is done.
+//
+// The work requests are still posted by the host: ringing the doorbells of
+// the QPs from the GPU needs them mapped into the device, which verbs do
+// not offer.
+class StreamTrigger {
+   public:
+    using BatchID = Transport::BatchID;
+    using TransferRequest = Transport::TransferRequest;
+
+    explicit StreamTrigger(std::shared_ptr<MultiTransport> transport);
+
+    ~StreamTrigger();
+
+    // Submit entries to batch_id once the work queued on stream so far is
+    // done. Submission errors cancel the batch
+    Status submit(BatchID batch_id, const std::vector<TransferRequest> &entries,
+                  cudaStream_t stream);
+
+    // Hold the work queued on stream from now on until the transfers of
+    // batch_id, including those submitted by submit(), succeed or fail.
+    // done, if set, is called from the trigger thread once the stream is
+    // released, and may free the batch
+    Status wait(BatchID batch_id, cudaStream_t stream,
+                std::function<void()> done = nullptr);
+
+    // Hold the work queued on stream from now on until release() is called
+    // with handle, for work done by the host outside of a batch
+    Status hold(cudaStream_t stream, uint64_t &handle);
+
+    void release(uint64_t handle);
+
+   private:
+    struct Trigger {
+        int slot;
+        uint32_t value;
+        BatchID batch_id;
+        bool submit;
+        std::vector<TransferRequest> entries;
+        std::function<void()> done;
+    };
+
+    int init();
+
+    // Slot of a flag, and the value it is to be set to next
+    Status acquireSlot(int &slot, uint32_t &value);
+
+    // Queue on stream a wait for the flag of slot to reach value
+    Status queueWait(cudaStream_t stream, int slot, uint32_t value);
+
+    void triggerWorker();
+
+    // Whether the batch of a wait trigger is done, once no submit trigger
+    // before it targets the batch
+    bool batchDone(BatchID batch_id);
+
+   private:
+    const static int kSlotCount = 4096;
+
+    std::shared_ptr<MultiTransport> transport_;
+    // Host and device views of the flags
+    volatile uint32_t *flags_;
+    CUdeviceptr device_flags_;
+    // Values only grow, so a stream still waiting on a recycled slot is
+    // released by the writes for its successors as well
+    std::vector<uint32_t> next_value_;
+    std::vector<int> free_slots_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<Trigger> pending_;
+    std::atomic<bool> running_;
+    std::thread worker_;
+};
+}  // namespace mooncake
+
+#endif  // USE_CUDA
+
+#endif  // STREAM_TRIGGER_H_
@@ -58,6 +58,33 @@ struct TopologyEntry {
 using TopologyMatrix =
     std::unordered_map<std::string /* storage type */, TopologyEntry>;
 
+// Completion latency and error rate of a local device, kept as
+// exponentially weighted moving averages. Recorded by the RDMA workers and
+// read by Topology::selectDevice() to route around degraded devices.
+class DeviceHealth {
+   public:
+    // Latency of a successful completion, normalized to a 64 KB slice
+    void recordSuccess(uint64_t latency_ns, size_t length);
+
+    void recordFailure();
+
+    // Zero until the first successful completion
+    uint64_t latencyNs() const {
+        return latency_ns_.load(std::memory_order_relaxed);
+    }
+
+    double errorRate() const {
+        return double(error_rate_.load(std::memory_order_relaxed)) /
+               kErrorScale;
+    }
+
+   private:
+    static const uint64_t kErrorScale = 1ull << 20;
+
+    std::atomic<uint64_t> latency_ns_{0};
+    std::atomic<uint64_t> error_rate_{0};
+};
+
 class Topology {
    public:
     Topology();
@@ -73,6 +100,9 @@ class Topology {
         return discover(filter);
     }
 
+    // Rank the HCAs of each CPU socket and CUDA device by PCI distance:
+    // same PCIe switch, same root port, same socket, then cross socket.
+    // Discovered once per process for each filter.
     int discover(const std::vector<std::string> &filter);
 
     int parse(const std::string &topology_json);
@@ -87,6 +117,23 @@ class Topology {
     int selectDevice(const std::string storage_type, std::string_view hint,
                      int retry_count = 0);
 
+    // Devices selectDevice() picks from on the first try, nullptr if the
+    // storage type is unknown
+    const std::vector<int> *preferredDevices(
+        const std::string &storage_type) const;
+
+    // Health of the device at index device_id of getHcaList(), shared by
+    // all copies of this topology. Valid until the next discover(),
+    // parse() or disableDevice()
+    DeviceHealth *deviceHealth(int device_id) const;
+
+    // Latency, error rate and degradation of every device
+    Json::Value healthToJson() const;
+
+    // Override the link rate of a device, which selectDevice() weights
+    // devices by when the rates of all of them are known
+    int setDeviceRate(const std::string &device_name, int rate_gbps);
+
     TopologyMatrix getMatrix() const { return matrix_; }
 
     const std::vector<std::string> &getHcaList() const { return hca_list_; }
@@ -94,6 +141,11 @@ class Topology {
    private:
     int resolve();
 
+    bool degraded(int device_id, uint64_t best_latency_ns) const;
+
+    int selectHealthyDevice(const std::vector<int> &devices,
+                            int rand_value) const;
+
    private:
     TopologyMatrix matrix_;
     std::vector<std::string> hca_list_;
@@ -120,6 +172,14 @@ class Topology {
     };
     std::unordered_map<std::string /* storage type */, ResolvedTopologyEntry>
         resolved_matrix_;
+
+    // Link rates in Gb/s of the discovered devices
+    std::unordered_map<std::string, int> rate_gbps_;
+
+    // Indexed like hca_list_
+    std::shared_ptr<std::vector<DeviceHealth>> health_;
+    std::vector<int> hca_weight_;
+    bool uniform_weight_ = true;
 };
 
 }  // namespace mooncake
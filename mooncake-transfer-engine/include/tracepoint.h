@@ -0,0 +1,50 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TRACEPOINT_H
+#define TRACEPOINT_H
+
+// USDT tracepoints of the transfer engine and the store, for bpftrace,
+// perf or SystemTap attached to a running process, e.g.
+//
+//   bpftrace -e 'usdt:./libtransfer_engine.so:mooncake:rdma_complete
+//                { @lat = hist(arg1 / 1000); }'
+//
+// An unattached tracepoint is a nop instruction, its arguments are only
+// computed into registers. Built with USE_USDT when <sys/sdt.h> is found
+// (systemtap-sdt-dev), compiled out otherwise.
+//
+// Tracepoints of the provider "mooncake" and their arguments:
+// - store_get_begin / store_put_begin: key, bytes
+// - store_get_end / store_put_end: key, bytes, ErrorCode (0 on success).
+//   The latency of a call is the time between its begin and end
+// - master_rpc: RPC name, latency in microseconds
+// - evict_round: latency of an eviction round of the master in
+//   microseconds
+// - evict_done: evicted objects, objects, freed bytes of the round
+// - rdma_submit: slices, bytes, local NIC
+// - rdma_complete: bytes, latency in nanoseconds from the submission, peer
+//   NIC path ID, ibv_wc_status
+// - rdma_connect: local NIC, peer NIC path, latency in microseconds, result
+
+#if defined(USE_USDT) && __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define MC_TRACE(name, ...) STAP_PROBEV(mooncake, name, ##__VA_ARGS__)
+#else
+#define MC_TRACE(name, ...) \
+    do {                    \
+    } while (0)
+#endif
+
+#endif  // TRACEPOINT_H
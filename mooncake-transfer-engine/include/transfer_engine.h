@@ -30,8 +30,11 @@
 #include <thread>
 #include <vector>
 
+#include "batch_notifier.h"
 #include "memory_location.h"
 #include "multi_transport.h"
+#include "rate_limiter.h"
+#include "stream_trigger.h"
 #include "transfer_metadata.h"
 #include "transport/transport.h"
 #ifdef WITH_METRICS
@@ -95,6 +98,14 @@ class TransferEngine {
 
     SegmentHandle openSegment(const std::string &segment_name);
 
+    // Open many segments at once, fetching their descriptors in one batch
+    // from the metadata server. Segments that cannot be opened get the
+    // same handles as from openSegment.
+    std::vector<SegmentHandle> openSegments(
+        const std::vector<std::string> &segment_names);
+
+    // Release the connections to the segment, RDMA endpoints stay connected
+    // for MC_ENDPOINT_KEEPALIVE_MS in case it is opened again
     int closeSegment(SegmentHandle handle);
 
     int removeLocalSegment(const std::string &segment_name);
@@ -116,7 +127,10 @@ class TransferEngine {
     }
 
     Status freeBatchID(BatchID batch_id) {
-        return multi_transports_->freeBatchID(batch_id);
+        Status s = multi_transports_->freeBatchID(batch_id);
+        if (s.ok() && has_batch_notifier_.load(std::memory_order_acquire))
+            batch_notifier_->forget(batch_id);
+        return s;
     }
 
     Status submitTransfer(BatchID batch_id,
@@ -137,6 +151,20 @@ class TransferEngine {
         return s;
     }
 
+    // Submit entries, the last submission to the batch, and once they have
+    // all completed successfully write imm_data to the segment of the last
+    // one with an RDMA write with immediate. It lands after the data, and
+    // the target learns of it from its completion queue, see
+    // getImmNotifies(). Takes RDMA RC targets and MC_INBAND_NOTIFY on both
+    // sides. Nothing is written if a transfer fails.
+    Status submitTransferWithImm(BatchID batch_id,
+                                 const std::vector<TransferRequest> &entries,
+                                 uint32_t imm_data);
+
+    // Move the notifications of submitTransferWithImm() received since the
+    // last call to the end of notifies
+    int getImmNotifies(std::vector<Transport::ImmNotify> &notifies);
+
     int getNotifies(std::vector<TransferMetadata::NotifyDesc> &notifies);
 
     int sendNotify(SegmentID target_id,
@@ -156,6 +184,68 @@ class TransferEngine {
         return result;
     }
 
+    // Time the batch out at deadline_ns, compared against
+    // getCurrentTimeInNano(), 0 for none. See Transport::setBatchDeadline()
+    Status setBatchDeadline(BatchID batch_id, int64_t deadline_ns) {
+        return Transport::setBatchDeadline(batch_id, deadline_ns);
+    }
+
+    // Stop the transfers of the batch which have not started. See
+    // Transport::cancelBatch()
+    Status cancelBatch(BatchID batch_id) {
+        return Transport::cancelBatch(batch_id);
+    }
+
+#ifdef USE_CUDA
+    // Experimental: submit entries to batch_id once the work queued on
+    // stream so far is done, without blocking the caller. See StreamTrigger
+    Status submitTransferOnStream(BatchID batch_id,
+                                  const std::vector<TransferRequest> &entries,
+                                  cudaStream_t stream);
+
+    // Experimental: hold the work queued on stream from now on until the
+    // transfers of batch_id are done
+    Status waitTransferOnStream(BatchID batch_id, cudaStream_t stream);
+
+    // Experimental: transfer entries in the order of stream, i.e. once the
+    // work queued on it so far is done, and hold the work queued after
+    // until they are done, in a batch of the engine. done, if set, gets the
+    // status of the batch from the trigger thread before it is freed, and
+    // must not block
+    Status transferOnStream(
+        const std::vector<TransferRequest> &entries, cudaStream_t stream,
+        std::function<void(const TransferStatus &)> done = nullptr);
+
+    // Experimental: hold the work queued on stream from now on until
+    // releaseStream(handle), e.g. until the host has received data the
+    // stream consumes
+    Status holdStream(cudaStream_t stream, uint64_t &handle);
+
+    void releaseStream(uint64_t handle);
+#endif
+
+    // Call callback once, from a notifier thread, when the batch is done,
+    // after its last submission. See BatchNotifier
+    Status setBatchCallback(BatchID batch_id,
+                            BatchNotifier::Callback callback) {
+        return batchNotifier()->setCallback(batch_id, std::move(callback));
+    }
+
+    // An eventfd which becomes readable when the batch is done, for event
+    // loops. It is closed by freeBatchID()
+    Status getBatchEventFd(BatchID batch_id, int &fd) {
+        return batchNotifier()->getEventFd(batch_id, fd);
+    }
+
+    uint32_t getBatchProgress(BatchID batch_id) {
+        return Transport::getBatchProgress(batch_id);
+    }
+
+    void waitBatchProgress(BatchID batch_id, uint32_t progress,
+                           int64_t timeout_ns) {
+        Transport::waitBatchProgress(batch_id, progress, timeout_ns);
+    }
+
     Status getBatchTransferStatus(BatchID batch_id, TransferStatus &status) {
         Status result = multi_transports_->getBatchTransferStatus(batch_id, status);
 #ifdef WITH_METRICS
@@ -168,10 +258,34 @@ class TransferEngine {
         return result;
     }
 
+    // Establish connections to the segments in the background, e.g. after a
+    // cold start or scale-out, so that first transfers do not stall on
+    // handshakes. Returns immediately; an error means some segment could
+    // not be resolved, while the others are still warmed up
+    int warmupSegments(const std::vector<std::string> &segment_names) {
+        return multi_transports_->warmupSegments(segment_names);
+    }
+
+    // Prometheus text of the counters of the installed transports: bytes,
+    // completions, latencies, retries and queue depths of each RDMA device,
+    // and the traffic with each peer segment, and the rate limit buckets
+    std::string getMetricsText() {
+        std::string out;
+        if (!multi_transports_) return out;
+        for (auto *transport : multi_transports_->listTransports())
+            transport->appendMetrics(out);
+        RateLimiter::appendMetrics(out);
+        return out;
+    }
+
     int syncSegmentCache(const std::string &segment_name = "") {
         return metadata_->syncSegmentCache(segment_name);
     }
 
+    // Change a knob of the configuration for the transfers submitted from
+    // then on, see updateConfigOption() for those that can change
+    int updateConfig(const std::string &name, const std::string &value);
+
     std::shared_ptr<TransferMetadata> getMetadata() { return metadata_; }
 
     bool checkOverlap(void *addr, uint64_t length);
@@ -197,6 +311,17 @@ class TransferEngine {
     std::shared_ptr<TransferMetadata> metadata_;
     std::string local_server_name_;
     std::shared_ptr<MultiTransport> multi_transports_;
+#ifdef USE_CUDA
+    StreamTrigger *streamTrigger();
+
+    std::mutex stream_trigger_mutex_;
+    std::unique_ptr<StreamTrigger> stream_trigger_;
+#endif
+    BatchNotifier *batchNotifier();
+
+    std::mutex batch_notifier_mutex_;
+    std::unique_ptr<BatchNotifier> batch_notifier_;
+    std::atomic<bool> has_batch_notifier_{false};
     std::shared_mutex mutex_;
     std::vector<MemoryRegion> local_memory_regions_;
     std::shared_ptr<Topology> local_topology_;
@@ -83,6 +83,12 @@ struct segment_desc {
 
 typedef struct transfer_status transfer_status_t;
 
+// Called once from a thread of the engine when a batch is done, it must not
+// block. status is that of getBatchTransferStatus()
+typedef void (*transfer_callback_t)(batch_id_t batch_id,
+                                    struct transfer_status status,
+                                    void *user_data);
+
 struct buffer_entry {
     void *addr;
     size_t length;
@@ -152,10 +158,36 @@ int getTransferStatus(transfer_engine_t engine,
                       batch_id_t batch_id, size_t task_id,
                       struct transfer_status *status);
 
+// Status of the whole batch: COMPLETED once all of its tasks are, the
+// status of a task that failed, or WAITING
+int getBatchTransferStatus(transfer_engine_t engine, batch_id_t batch_id,
+                           struct transfer_status *status);
+
+// Call callback once when the batch is done, instead of polling its status.
+// To be set after the last submitTransfer() of the batch
+int setBatchCallback(transfer_engine_t engine, batch_id_t batch_id,
+                     transfer_callback_t callback, void *user_data);
+
+// Store in *fd a nonblocking eventfd which becomes readable when the batch
+// is done, for epoll or the Go netpoller; to be asked for after the last
+// submitTransfer() of the batch. It belongs to the engine, and is closed by
+// freeBatchID()
+int getBatchEventFd(transfer_engine_t engine, batch_id_t batch_id, int *fd);
+
 int freeBatchID(transfer_engine_t engine, batch_id_t batch_id);
 
+// Time the batch out at deadline_ns of CLOCK_REALTIME, 0 for none
+int setBatchDeadline(transfer_engine_t engine, batch_id_t batch_id,
+                     int64_t deadline_ns);
+
+int cancelBatch(transfer_engine_t engine, batch_id_t batch_id);
+
 int syncSegmentCache(transfer_engine_t engine);
 
+int warmupSegment(transfer_engine_t engine, const char *segment_name);
+
+int updateConfig(transfer_engine_t engine, const char *name, const char *value);
+
 #ifdef __cplusplus
 }
 #endif  // __cplusplus
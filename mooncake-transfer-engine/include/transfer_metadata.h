@@ -24,9 +24,12 @@
 #include <netdb.h>
 
 #include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <string>
 #include <thread>
 #include <unordered_map>
@@ -46,6 +49,11 @@ class TransferMetadata {
         std::string name;
         uint16_t lid;
         std::string gid;
+        // DC target of the device, 0 if it does not accept DC transfers
+        uint32_t dct_num = 0;
+        // Interned <segment name>@<name> for RDMA segments, set when the
+        // descriptor is decoded
+        NicPathID nic_path_id = kInvalidNicPathID;
     };
 
     struct BufferDesc {
@@ -57,6 +65,16 @@ class TransferMetadata {
         std::string shm_name;        // for nvlink
     };
 
+    // Buffer that processes on the same host can map, see ShmTransport
+    struct ShmBufferDesc {
+        uint64_t addr;
+        uint64_t length;
+        // File holding the buffer, e.g. /proc/<pid>/fd/<memfd>, and the
+        // offset of the buffer in it
+        std::string shm_name;
+        uint64_t shm_offset;
+    };
+
     struct NVMeoFBufferDesc {
         std::string file_path;
         uint64_t length;
@@ -77,6 +95,38 @@ class TransferMetadata {
 
     using SegmentID = uint64_t;
 
+    // Buffers of a segment sorted by address, built on the first lookup.
+    // Copies of a descriptor start without index, as their buffers may be
+    // changed before they are shared.
+    class BufferIndex {
+       public:
+        BufferIndex() = default;
+
+        BufferIndex(const BufferIndex &) {}
+
+        BufferIndex &operator=(const BufferIndex &) {
+            built_ = false;
+            order_.clear();
+            return *this;
+        }
+
+        // Index in buffers of the one holding [addr, addr + length), -1 if
+        // none. The last hits of each thread are checked first.
+        int find(const std::vector<BufferDesc> &buffers, uint64_t addr,
+                 size_t length) const;
+
+       private:
+        void build(const std::vector<BufferDesc> &buffers) const;
+
+        mutable std::mutex mutex_;
+        mutable std::atomic<bool> built_{false};
+        // Buffer indices by address
+        mutable std::vector<int> order_;
+        mutable uint64_t max_length_ = 0;
+        // Unique among indices, identifies this one in the thread caches
+        mutable uint64_t id_ = 0;
+    };
+
     struct SegmentDesc {
         std::string name;
         std::string protocol;
@@ -91,7 +141,28 @@ class TransferMetadata {
         // this is for ascend
         RankInfoDesc rank_info;
 
-        int tcp_data_port;
+        // Port TcpTransport listens on, 0 when it is not installed
+        int tcp_data_port = 0;
+
+        // Same-host mappable buffers, published by ShmTransport along with
+        // the boot ID of the host, whatever the protocol
+        std::string shm_host;
+        std::vector<ShmBufferDesc> shm_buffers;
+
+        // Version of the descriptor and instance of its publisher, set when
+        // it is published with compact metadata
+        uint64_t version = 0;
+        uint64_t incarnation = 0;
+        // Pulled from its owner, the metadata server only having its stub
+        bool served_by_peer = false;
+
+        BufferIndex buffer_index;
+
+        // Index in buffers of the one holding [addr, addr + length), -1 if
+        // none
+        int findBuffer(uint64_t addr, size_t length) const {
+            return buffer_index.find(buffers, addr, length);
+        }
 
         void dump() const;
     };
@@ -114,6 +185,17 @@ class TransferMetadata {
         std::string notify_msg;
     };
 
+    // Request of a sender for the rate it may write to the peer at, and
+    // the grant of the peer, see IncastControl
+    struct CreditDesc {
+        std::string name;
+        // Bytes per second the sender asks for, 0 for as many as it can get
+        uint64_t demand = 0;
+        // Bytes per second granted until the lease ends
+        uint64_t rate = 0;
+        uint32_t lease_ms = 0;
+    };
+
    public:
     TransferMetadata(const std::string &conn_string);
 
@@ -127,14 +209,29 @@ class TransferMetadata {
 
     int updateLocalSegmentDesc(SegmentID segment_id = LOCAL_SEGMENT_ID);
 
+    // Between these, updateLocalSegmentDesc only marks the segment to be
+    // published, and the marked ones are published once on release. Calls
+    // may nest; the outermost release publishes.
+    void holdLocalSegmentUpdates();
+    int releaseLocalSegmentUpdates();
+
     int updateSegmentDesc(const std::string &segment_name,
                           const SegmentDesc &desc);
 
+    // Fetch the descriptor of segment_name. With compact metadata, cached
+    // is brought up to date with the published deltas when it can be.
     std::shared_ptr<SegmentDesc> getSegmentDesc(
-        const std::string &segment_name);
+        const std::string &segment_name,
+        const std::shared_ptr<SegmentDesc> &cached = nullptr);
 
     SegmentID getSegmentID(const std::string &segment_name);
 
+    // IDs of segment_names, -1 for those that cannot be opened. The
+    // descriptors not cached are fetched in one batch and decoded in
+    // parallel.
+    std::vector<SegmentID> getSegmentIDs(
+        const std::vector<std::string> &segment_names);
+
     int syncSegmentCache(const std::string &segment_name);
 
     int removeSegmentDesc(const std::string &segment_name);
@@ -142,7 +239,18 @@ class TransferMetadata {
     int addLocalMemoryBuffer(const BufferDesc &buffer_desc,
                              bool update_metadata);
 
-    int removeLocalMemoryBuffer(void *addr, bool update_metadata);
+    // Removes the buffer starting at addr, only if it is length bytes long
+    // unless length is 0
+    int removeLocalMemoryBuffer(void *addr, bool update_metadata,
+                                size_t length = 0);
+
+    // Publish or withdraw a same-host mappable buffer, and set the host
+    // they can be mapped on
+    int addLocalShmBuffer(const std::string &shm_host,
+                          const ShmBufferDesc &buffer_desc,
+                          bool update_metadata);
+
+    int removeLocalShmBuffer(void *addr, bool update_metadata);
 
     int addLocalSegment(SegmentID segment_id, const std::string &segment_name,
                         std::shared_ptr<SegmentDesc> &&desc);
@@ -170,13 +278,58 @@ class TransferMetadata {
     int sendNotify(const std::string &peer_server_name,
                    const NotifyDesc &local_desc, NotifyDesc &peer_desc);
 
+    // Serve the credit requests of peers on the handshake port
+    using OnReceiveCredit = std::function<int(const CreditDesc &peer_desc,
+                                              CreditDesc &local_desc)>;
+    void registerOnCredit(OnReceiveCredit on_receive_credit);
+
+    // Ask the peer for credits, failing if it does not serve them
+    int sendCredit(const std::string &peer_server_name,
+                   const CreditDesc &local_desc, CreditDesc &peer_desc);
+
     void dumpMetadataContent(const std::string &segment_name = "",
                              uint64_t offset = 0, uint64_t length = 0);
 
     void dumpMetadataContentUnlocked();
 
+    // Compact encoding of buffers: a version byte followed by varints, with
+    // addresses and lkeys stored as differences. Empty and false on
+    // malformed or unknown versions of input.
+    static std::string encodeCompactBuffers(
+        const std::vector<BufferDesc> &buffers);
+
+    static bool decodeCompactBuffers(const std::string &blob,
+                                     std::vector<BufferDesc> &buffers);
+
    private:
+    enum class BufferEncoding {
+        kJson,
+        // Base64 of encodeCompactBuffers()
+        kCompact,
+        // Left out, for comparing the rest of descriptors
+        kNone,
+    };
+
     int encodeSegmentDesc(const SegmentDesc &desc, Json::Value &segmentJSON);
+    int encodeSegmentDesc(const SegmentDesc &desc, Json::Value &segmentJSON,
+                          BufferEncoding encoding);
+    // Publish desc in full or, when only its buffers changed, as a delta
+    int publishSegmentDesc(const std::string &segment_name,
+                           const SegmentDesc &desc);
+    // Publish only where desc can be pulled from, see pullSegmentDesc()
+    int publishSegmentStub(const std::string &segment_name,
+                           const SegmentDesc &desc);
+    // Pull the descriptor of the stub from its owner, unless cached is
+    // as recent
+    std::shared_ptr<SegmentDesc> pullSegmentDesc(
+        const std::string &segment_name, const Json::Value &stub_json,
+        const std::shared_ptr<SegmentDesc> &cached);
+    // Apply the deltas of deltaJSON newer than desc to it
+    int applySegmentDeltas(SegmentDesc &desc, const Json::Value &deltaJSON);
+    // Refresh the cached descriptors and locations changed in the metadata
+    // server, as they are notified
+    void refreshChangedEntries();
+    void refreshEntries(const std::set<std::string> &keys);
     std::shared_ptr<TransferMetadata::SegmentDesc> decodeSegmentDesc(
         Json::Value &segmentJSON, const std::string &segment_name);
     int receivePeerMetadata(const Json::Value &peer_json,
@@ -190,6 +343,9 @@ class TransferMetadata {
     std::unordered_map<uint64_t, std::shared_ptr<SegmentDesc>>
         segment_id_to_desc_map_;
     std::unordered_map<std::string, uint64_t> segment_name_to_id_map_;
+    std::mutex held_updates_mutex_;
+    int held_updates_depth_ = 0;
+    std::set<SegmentID> held_updates_;
 
     RWSpinlock notify_lock_;
     std::vector<NotifyDesc> notifys;
@@ -201,6 +357,28 @@ class TransferMetadata {
 
     std::shared_ptr<HandShakePlugin> handshake_plugin_;
     std::shared_ptr<MetadataStoragePlugin> storage_plugin_;
+
+    // What was published of each local segment with compact metadata: the
+    // descriptor without buffers, the buffers, and the deltas since the
+    // last full publish
+    struct PublishedSegment {
+        uint64_t version = 0;
+        uint64_t base_version = 0;
+        std::string header;
+        std::vector<BufferDesc> buffers;
+        Json::Value deltas{Json::arrayValue};
+    };
+    std::mutex publish_mutex_;
+    std::unordered_map<std::string, PublishedSegment> published_segments_;
+    const uint64_t incarnation_;
+
+    // Keys notified by the storage plugin, an empty one when any may have
+    // changed
+    std::mutex watch_mutex_;
+    std::condition_variable watch_cond_;
+    std::set<std::string> changed_keys_;
+    bool watch_running_ = false;
+    std::thread watch_thread_;
 };
 
 }  // namespace mooncake
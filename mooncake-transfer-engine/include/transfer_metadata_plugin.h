@@ -28,6 +28,34 @@ struct MetadataStoragePlugin {
     virtual bool get(const std::string &key, Json::Value &value) = 0;
     virtual bool set(const std::string &key, const Json::Value &value) = 0;
     virtual bool remove(const std::string &key) = 0;
+
+    // Values of the keys found, in one round trip where the backend allows
+    virtual bool getBatch(const std::vector<std::string> &keys,
+                          std::unordered_map<std::string, Json::Value> &values) {
+        for (const auto &key : keys) {
+            Json::Value value;
+            if (get(key, value)) values[key] = std::move(value);
+        }
+        return true;
+    }
+
+    // Set the keys in order, in one round trip where the backend allows
+    virtual bool setBatch(
+        const std::vector<std::pair<std::string, Json::Value>> &values) {
+        for (const auto &entry : values)
+            if (!set(entry.first, entry.second)) return false;
+        return true;
+    }
+
+    // Called with the key of each change under the watched prefix, or with
+    // an empty key when changes may have been missed
+    using OnChangeCallBack = std::function<void(const std::string &)>;
+
+    // Notify the changes of keys under prefix from a thread of the plugin,
+    // until it is destroyed. False when the backend cannot notify them.
+    virtual bool watch(const std::string &prefix, OnChangeCallBack callback) {
+        return false;
+    }
 };
 
 struct HandShakePlugin {
@@ -51,6 +79,8 @@ struct HandShakePlugin {
                      const Json::Value &local, Json::Value &peer) = 0;
     virtual int sendNotify(std::string ip_or_host_name, uint16_t rpc_port,
                            const Json::Value &local, Json::Value &peer) = 0;
+    virtual int sendCredit(std::string ip_or_host_name, uint16_t rpc_port,
+                           const Json::Value &local, Json::Value &peer) = 0;
 
     // Exchange metadata with remote peer.
     virtual int exchangeMetadata(std::string ip_or_host_name, uint16_t rpc_port,
@@ -65,6 +95,9 @@ struct HandShakePlugin {
 
     // Register callback function for receiving metadata exchange request.
     virtual void registerOnNotifyCallBack(OnReceiveCallBack callback) = 0;
+
+    // Register callback function for receiving credit request.
+    virtual void registerOnCreditCallBack(OnReceiveCallBack callback) = 0;
 };
 
 std::vector<std::string> findLocalIpAddresses();
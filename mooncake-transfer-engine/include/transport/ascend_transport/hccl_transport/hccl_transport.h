@@ -22,6 +22,7 @@
 #include <map>
 #include <memory>
 #include <mutex>
+#include <queue>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
@@ -75,6 +76,9 @@ class HcclTransport : public Transport {
     int unregisterLocalMemoryBatch(
         const std::vector<void *> &addr_list) override;
 
+    // Slices issued and the HCCL operations they were merged into
+    void appendMetrics(std::string &out) override;
+
    private:
     int allocateLocalSegmentID();
 
@@ -82,6 +86,29 @@ class HcclTransport : public Transport {
 
     void initiatorLoop(int deviceLogicId, int selfIdx);
 
+    // Wait for the batches issued by initiator selfIdx and complete them
+    void completionLoop(int deviceLogicId, int selfIdx);
+
+    // Cut request into chunks of hccl_chunk_size and append them to slices
+    void addSlices(const TransferRequest &request, TransferTask &task,
+                   std::vector<Slice *> &slices);
+
+    // Slices slice_list[first, first + count) issued as one operation
+    struct MergedOp {
+        size_t first;
+        size_t count;
+        uint64_t length;
+        // Ends of the local and remote buffers holding the first slice, 0
+        // until looked up
+        uint64_t local_end;
+        uint64_t remote_end;
+    };
+
+    // Merge runs of slices adjacent on both sides into operations of up to
+    // hccl_merge_size bytes, each within one local and one remote buffer
+    void mergeSlices(const std::vector<Slice *> &slice_list,
+                     const SegmentDesc &remote, std::vector<MergedOp> &ops);
+
     void acceptLoop(int deviceLogicId);
 
     int getDevIdAndIpPortFromServerName(std::string& local_server_name, std::string& ip, int &ip_port, int& devicePhyId);
@@ -89,14 +116,34 @@ class HcclTransport : public Transport {
     int rankInfoParse(int devicePhyId, std::string hostIp);
 
    private:
+    // A batch whose slices have been issued to the streams, complete once
+    // each of its events has been reached
+    struct InflightBatch {
+        std::vector<Slice *> slices;
+        std::vector<aclrtEvent> events;
+    };
+
+    struct CompletionQueue {
+        std::mutex mutex;
+        std::condition_variable cond;
+        std::queue<InflightBatch> batches;
+        std::vector<aclrtEvent> free_events;
+        // Set once the initiator has stopped issuing batches
+        bool stopped = false;
+    };
+
     std::atomic_bool running_;
     std::thread allInitiatorThreads_[THREAD_NUM];
     std::thread allAcceptThreads_[THREAD_NUM];
+    std::thread allCompletionThreads_[THREAD_NUM];
+    CompletionQueue completionQueues_[THREAD_NUM];
     std::queue<std::vector<Slice *>> allReqQueues_[THREAD_NUM];
     std::mutex initiator_mutex_;
     std::condition_variable initiator_cond_;
     RankInfo local_rank_info_;
     RankInfo remote_rank_info_;
+    std::atomic<uint64_t> issued_slices_{0};
+    std::atomic<uint64_t> issued_ops_{0};
 };
 }  // namespace mooncake
 #endif
\ No newline at end of file
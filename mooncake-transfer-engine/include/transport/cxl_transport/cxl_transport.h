@@ -15,16 +15,14 @@
 #ifndef CXL_TRANSPORT_H_
 #define CXL_TRANSPORT_H_
 
-#include <infiniband/verbs.h>
-
 #include <atomic>
+#include <condition_variable>
 #include <cstddef>
-#include <map>
+#include <deque>
 #include <memory>
 #include <mutex>
 #include <string>
-#include <unordered_map>
-#include <unordered_set>
+#include <thread>
 #include <vector>
 
 #include "transfer_metadata.h"
@@ -33,6 +31,13 @@
 namespace mooncake {
 class TransferMetadata;
 
+// CxlTransport moves data between local memory and a CXL memory region
+// shared by the hosts attached to it, e.g. a DAX device. The region is
+// mapped once from MC_CXL_DEV_PATH and target_offset of a request is an
+// offset into it. Copies are done by a pool of worker threads: writes use
+// non-temporal stores, which bypass the cache hierarchy instead of pulling
+// the CXL lines into it, and reads prefetch the source ahead of the copy.
+// Large slices are offloaded to DSA when it is configured, see DsaEngine.
 class CxlTransport : public Transport {
    public:
     using BufferDesc = TransferMetadata::BufferDesc;
@@ -44,15 +49,20 @@ class CxlTransport : public Transport {
 
     ~CxlTransport();
 
-    BatchID allocateBatchID(size_t batch_size) override;
+    Status submitTransfer(BatchID batch_id,
+                          const std::vector<TransferRequest> &entries) override;
 
-    int submitTransfer(BatchID batch_id,
-                       const std::vector<TransferRequest> &entries) override;
+    Status submitTransferTask(
+        const std::vector<TransferRequest *> &request_list,
+        const std::vector<TransferTask *> &task_list) override;
 
     Status getTransferStatus(BatchID batch_id, size_t task_id,
                              TransferStatus &status) override;
 
-    Status freeBatchID(BatchID batch_id) override;
+    // Base address and size of the mapped CXL region
+    void *getBaseAddr() const { return base_addr_; }
+
+    size_t getSize() const { return size_; }
 
    private:
     int install(std::string &local_server_name,
@@ -77,8 +87,35 @@ class CxlTransport : public Transport {
         return 0;
     }
 
+    int mapDevice();
+
+    int allocateLocalSegmentID();
+
+    // Cut a request into slices and queue them to the workers
+    Status submitRequest(const TransferRequest &request, TransferTask &task);
+
+    void worker(int index);
+
+    // Copy the slices and mark them done
+    void copySlices(const std::deque<Slice *> &slices);
+
     const char *getName() const override { return "cxl"; }
+
+   private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::condition_variable cond;
+        std::deque<Slice *> slices;
+    };
+
+    void *base_addr_;
+    size_t size_;
+    int fd_;
+    std::atomic_bool running_;
+    std::vector<std::unique_ptr<WorkerQueue>> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> next_queue_;
 };
 }  // namespace mooncake
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,111 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef LOOPBACK_TRANSPORT_H_
+#define LOOPBACK_TRANSPORT_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "transfer_metadata.h"
+#include "transport/transport.h"
+
+namespace mooncake {
+class TransferMetadata;
+
+// LoopbackTransport serves the transfers whose target is a buffer of the
+// local segment, which would otherwise loop back through the NIC of its
+// protocol. MultiTransport owns it and picks it ahead of the other
+// transports for such requests. Small requests are copied in the submitting
+// thread; larger ones are cut into slices copied by a pool of worker
+// threads, with DSA when it is configured, or with cudaMemcpyAsync when
+// either side is GPU memory and CUDA is enabled.
+class LoopbackTransport : public Transport {
+   public:
+    using BufferDesc = TransferMetadata::BufferDesc;
+    using SegmentDesc = TransferMetadata::SegmentDesc;
+
+   public:
+    LoopbackTransport();
+
+    ~LoopbackTransport();
+
+    Status submitTransfer(BatchID batch_id,
+                          const std::vector<TransferRequest> &entries) override;
+
+    Status submitTransferTask(
+        const std::vector<TransferRequest *> &request_list,
+        const std::vector<TransferTask *> &task_list) override;
+
+    Status getTransferStatus(BatchID batch_id, size_t task_id,
+                             TransferStatus &status) override;
+
+    // Whether the target of entry lies in a buffer of the local segment
+    // desc that can be copied here
+    bool canTransfer(const SegmentDesc &desc, const TransferRequest &entry);
+
+   private:
+    int install(std::string &local_server_name,
+                std::shared_ptr<TransferMetadata> meta,
+                std::shared_ptr<Topology> topo) override;
+
+    int registerLocalMemory(void *addr, size_t length,
+                            const std::string &location, bool remote_accessible,
+                            bool update_metadata) override {
+        return 0;
+    }
+
+    int unregisterLocalMemory(void *addr,
+                              bool update_metadata = false) override {
+        return 0;
+    }
+
+    int registerLocalMemoryBatch(
+        const std::vector<Transport::BufferEntry> &buffer_list,
+        const std::string &location) override {
+        return 0;
+    }
+
+    int unregisterLocalMemoryBatch(
+        const std::vector<void *> &addr_list) override {
+        return 0;
+    }
+
+    Status submitRequest(const TransferRequest &request, TransferTask &task);
+
+    void worker(int index);
+
+    const char *getName() const override { return "loopback"; }
+
+   private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::condition_variable cond;
+        std::deque<Slice *> slices;
+    };
+
+    std::atomic_bool running_;
+    std::vector<std::unique_ptr<WorkerQueue>> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> next_queue_;
+};
+}  // namespace mooncake
+
+#endif
@@ -5,12 +5,15 @@
 
 #include <cuda_runtime.h>
 
+#include <atomic>
+#include <condition_variable>
 #include <functional>
 #include <iostream>
 #include <memory>
 #include <mutex>
 #include <queue>
 #include <string>
+#include <thread>
 #include <vector>
 #include <utility>
 
@@ -68,24 +71,108 @@ class NvlinkTransport : public Transport {
     int unregisterLocalMemoryBatch(
         const std::vector<void*>& addr_list) override;
 
+    // A remote buffer mapped into the local address space
+    struct OpenedShmEntry {
+        void* shm_addr;
+        uint64_t length;
+        // For the LRU eviction of mappings
+        std::atomic<uint64_t> last_use{0};
+        // Copies in flight on the mapping; evicted mappings are released
+        // once none is left
+        std::atomic<int> pins{0};
+        std::atomic<bool> evicted{false};
+    };
+
+    // Translate dest_addr in segment target_id to the local mapping of its
+    // buffer, which is imported on first use. If mapping is not null, the
+    // mapping is pinned and returned there, see unpinMapping()
     int relocateSharedMemoryAddress(uint64_t& dest_addr, uint64_t length,
-                                    uint64_t target_id);
+                                    uint64_t target_id,
+                                    OpenedShmEntry** mapping = nullptr);
+
+    void unpinMapping(OpenedShmEntry* mapping);
 
     const char* getName() const override { return "nvlink"; }
 
    private:
-    std::atomic_bool running_;
+    // Streams of device that copies between a pair of devices are spread
+    // over
+    struct StreamPool {
+        int device;
+        // Each stream is served by one of the copy engines of the device
+        std::vector<cudaStream_t> streams;
+        // Bytes queued on each stream and not completed yet
+        std::unique_ptr<std::atomic<uint64_t>[]> queued_bytes;
+
+        // The stream with the least bytes queued
+        size_t pickStream() const;
+    };
 
-    struct OpenedShmEntry {
-        void* shm_addr;
-        uint64_t length;
+    // Slices whose copies were queued on a stream before event was recorded
+    struct PendingCopy {
+        cudaEvent_t event;
+        int device;
+        StreamPool* pool;
+        size_t stream_index;
+        uint64_t bytes = 0;
+        std::vector<Slice*> slice_list;
     };
 
-    std::unordered_map<std::pair<uint64_t, uint64_t>, OpenedShmEntry, PairHash> remap_entries_;
+    // Queue the copies of slice_list without waiting for them, slices
+    // complete in pollCompletions()
+    void submitSlices(const std::vector<Slice*>& slice_list);
+
+    // The pool for copies from src_device to dst_device, -1 for host memory,
+    // issued on device
+    StreamPool* getStreamPool(int src_device, int dst_device, int device);
+
+    // Events are bound to the device current when they are created
+    cudaEvent_t allocateEvent(int device);
+
+    void pollCompletions();
+
+    // Mark slice and unpin its mapping
+    void completeSlice(Slice* slice, bool success);
+
+    std::shared_ptr<OpenedShmEntry> openSharedMemory(const BufferDesc& buffer);
+
+    void closeSharedMemory(OpenedShmEntry& mapping);
+
+    // Evict the least recently used unpinned mapping, called with remap_lock_
+    // held for writing
+    void evictSharedMemory();
+
+    // Close the evicted mappings no copy uses anymore
+    void releaseEvictedMappings();
+
+    std::atomic_bool running_;
+
+    std::mutex stream_mutex_;
+    std::unordered_map<std::pair<int, int>, std::unique_ptr<StreamPool>,
+                       PairHash>
+        stream_pools_;
+
+    // Protects pending_copies_ and free_events_
+    std::mutex pending_mutex_;
+    std::condition_variable pending_cv_;
+    std::vector<PendingCopy> pending_copies_;
+    std::unordered_map<int, std::vector<cudaEvent_t>> free_events_;
+    std::thread poll_thread_;
+
+    // Keyed by segment ID and buffer address
+    std::unordered_map<std::pair<uint64_t, uint64_t>,
+                       std::shared_ptr<OpenedShmEntry>, PairHash>
+        remap_entries_;
     RWSpinlock remap_lock_;
+    std::atomic<uint64_t> remap_clock_{0};
+    std::mutex evicted_mutex_;
+    std::vector<std::shared_ptr<OpenedShmEntry>> evicted_entries_;
     bool use_fabric_mem_;
 
     std::mutex register_mutex_;
+    // Registered ranges of each local fabric allocation by its base, which
+    // is published once for all of them, e.g. the chunks of nvlink-allocator
+    std::unordered_map<uint64_t, int> registered_allocations_;
 };
 
 }  // namespace mooncake
@@ -21,7 +21,9 @@
 #include <bitset>
 #include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <mutex>
+#include <unordered_map>
 #include <vector>
 
 #include "transfer_engine.h"
@@ -40,8 +42,13 @@ class CUFileDescPool {
     
     int pushParams(int idx, CUfileIOParams_t &io_params);
 
+    // Submit the params pushed since the last call, as many as the queue
+    // depth of their targets allows; the others are submitted as earlier IOs
+    // complete, see getTransferStatus()
     int submitBatch(int idx);
 
+    // Status of the slice_id-th params pushed, reaping the completions of
+    // the batch first
     CUfileIOEvents_t getTransferStatus(int idx, int slice_id);
 
     int getSliceNum(int idx);
@@ -49,6 +56,13 @@ class CUFileDescPool {
     int freeCUfileDesc(int idx);
 
    private:
+    void reapCompletions(int idx);
+
+    int submitPending(int idx);
+
+    // Release the queue slot of an IO that is no longer in flight
+    void releaseSlot(CUfileHandle_t fh);
+
     static const size_t MAX_NR_CUFILE_DESC = 16;
     static const size_t MAX_CUFILE_BATCH_SIZE = 128;
     thread_local static int thread_index;
@@ -59,9 +73,18 @@ class CUFileDescPool {
     CUfileBatchHandle_t handle_[MAX_NR_CUFILE_DESC];
     // 3. start idx
     int start_idx_[MAX_NR_CUFILE_DESC];
-    // 4. IO Params and IO Status
+    // 4. IO Params and IO Status, both indexed by slice; events are matched
+    // to slices by their cookie
     std::vector<CUfileIOParams_t> io_params_[MAX_NR_CUFILE_DESC];
     std::vector<CUfileIOEvents_t> io_events_[MAX_NR_CUFILE_DESC];
+    std::vector<CUfileIOEvents_t> reaped_events_[MAX_NR_CUFILE_DESC];
+    // 5. Slices deferred by the queue depth of their target
+    std::deque<size_t> pending_[MAX_NR_CUFILE_DESC];
+
+    // IOs in flight per target file, across all descriptors
+    const size_t queue_depth_;
+    std::mutex inflight_mutex_;
+    std::unordered_map<CUfileHandle_t, size_t> inflight_;
 
     RWSpinlock mutex_;
 };
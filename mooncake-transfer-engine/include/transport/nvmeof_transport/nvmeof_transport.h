@@ -18,6 +18,7 @@
 #include <bits/stdint-uintn.h>
 
 #include <cstddef>
+#include <map>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -102,8 +103,19 @@ class NVMeoFTransport : public Transport {
                                uint64_t slice_len, uint64_t desc_id,
                                TransferRequest::OpCode op, CUfileHandle_t fh);
 
+    // Register the allocation holding [addr, addr + length) with cuFile
+    // unless a registered buffer covers it. Buffers registered here stay
+    // registered until unregisterLocalMemory() or destruction
+    void registerBufferIfNeeded(void *addr, size_t length);
+
     const char *getName() const override { return "nvmeof"; }
 
+    struct RegisteredBuffer {
+        size_t length;
+        // False if cuFile refused it, transfers then use bounce buffers
+        bool registered;
+    };
+
     std::unordered_map<BatchID, int> batch_to_cufile_desc_;
     std::unordered_map<std::pair<SegmentHandle, uint64_t>,
                        std::shared_ptr<CuFileContext>, pair_hash>
@@ -112,6 +124,10 @@ class NVMeoFTransport : public Transport {
 
     std::shared_ptr<CUFileDescPool> desc_pool_;
     RWSpinlock context_lock_;
+
+    // By start address
+    std::map<uint64_t, RegisteredBuffer> registered_buffers_;
+    RWSpinlock registered_lock_;
 };
 }  // namespace mooncake
 
@@ -0,0 +1,84 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DC_ENDPOINT_H
+#define DC_ENDPOINT_H
+
+#ifdef USE_MLX5_DC
+
+#include <infiniband/mlx5dv.h>
+
+#include "rdma_endpoint.h"
+
+namespace mooncake {
+
+// Access key shared by all DC targets and initiators of Transfer Engine
+const static uint64_t kDcAccessKey = 0x4d6f6f6e63616b65ull;
+
+// A DC initiator: a send queue shared by all DC endpoints of a context,
+// which reaches any DC target given the address handle and DCT number of
+// each work request
+struct DcInitiator {
+    ibv_qp *qp = nullptr;
+    ibv_qp_ex *qp_ex = nullptr;
+    mlx5dv_qp_ex *dv_qp = nullptr;
+    volatile int *cq_outstanding = nullptr;
+    volatile int wr_depth = 0;
+    // Set when a completion failed, the QP is in error state until reset
+    std::atomic<bool> failed{false};
+    RWSpinlock lock;
+};
+
+// DcEndPoint reaches a peer NIC through the DC target (DCT) the peer
+// publishes in its segment descriptor, instead of owning RC QPs. It only
+// refers to an address handle cached by the context: setting it up needs
+// no handshake and evicting it frees nothing, so connection setup and QP
+// memory do not grow with the number of peers. Work requests are posted
+// to the DC initiators of the context, see RdmaContext::selectDci().
+class DcEndPoint : public RdmaEndPoint {
+   public:
+    DcEndPoint(RdmaContext &context);
+
+    int construct(ibv_cq *cq, size_t num_qp_list, size_t max_sge,
+                  size_t max_wr, size_t max_inline) override;
+
+    using RdmaEndPoint::setupConnectionsByActive;
+
+    int setupConnectionsByActive() override;
+
+    // Peers in DC mode never send handshakes, reject RC peers
+    int setupConnectionsByPassive(const HandShakeDesc &peer_desc,
+                                  HandShakeDesc &local_desc) override;
+
+    // Slices in flight hold no resource of the endpoint
+    bool hasOutstandingSlice() const override { return false; }
+
+    void disconnect() override;
+
+    int destroyQP() override { return 0; }
+
+    int submitPostSend(
+        std::vector<Transport::Slice *> &slice_list,
+        std::vector<Transport::Slice *> &failed_slice_list) override;
+
+   private:
+    ibv_ah *ah_ = nullptr;
+    uint32_t peer_dct_num_ = 0;
+};
+
+}  // namespace mooncake
+
+#endif  // USE_MLX5_DC
+
+#endif  // DC_ENDPOINT_H
@@ -18,8 +18,12 @@
 #include <infiniband/verbs.h>
 
 #include <atomic>
+#include <list>
 #include <memory>
 #include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "rdma_context.h"
 #include "rdma_endpoint.h"
@@ -34,45 +38,110 @@ cache data structure and eviction policy are put in the same class, for
 different eviction policy may need different data structure
 (e.g. lock-free queue for FIFO) for better performance
 */
+// Endpoints are keyed by the interned peer NIC path (see NicPathTable) and
+// kept in arrays indexed by that ID, so lookups on the data path do not hash
+// strings.
 class EndpointStore {
    public:
     virtual std::shared_ptr<RdmaEndPoint> getEndpoint(
-        const std::string &peer_nic_path) = 0;
+        NicPathID peer_nic_id) = 0;
     virtual std::shared_ptr<RdmaEndPoint> insertEndpoint(
-        const std::string &peer_nic_path, RdmaContext *context) = 0;
-    virtual int deleteEndpoint(const std::string &peer_nic_path) = 0;
+        NicPathID peer_nic_id, RdmaContext *context) = 0;
+    virtual int deleteEndpoint(NicPathID peer_nic_id) = 0;
+    // Take the endpoint out of use while keeping it connected, so that the
+    // next insertEndpoint() of the peer reuses it, see WarmEndpointPool
+    virtual int releaseEndpoint(NicPathID peer_nic_id) = 0;
     virtual void evictEndpoint() = 0;
     virtual void reclaimEndpoint() = 0;
     virtual size_t getSize() = 0;
+    // Endpoints the store holds at most, kept ones included
+    virtual size_t getCapacity() = 0;
 
     virtual int destroyQPs() = 0;
     virtual int disconnectQPs() = 0;
+
+    // Endpoints created for peers that had one before, each of which costs
+    // another handshake
+    uint64_t reconnects() const {
+        return reconnects_.load(std::memory_order_relaxed);
+    }
+
+   protected:
+    // Count an endpoint created for the peer, under the lock of the store
+    void recordCreated(NicPathID peer_nic_id);
+
+   private:
+    std::vector<bool> created_peers_;
+    std::atomic<uint64_t> reconnects_{0};
+};
+
+// Released endpoints, kept connected for MC_ENDPOINT_KEEPALIVE_MS so that
+// segments closed and opened again reuse their QPs without a handshake. A
+// peer that connects again with new QPs reconnects the reused endpoint
+// through the passive handshake as usual. Kept endpoints count towards the
+// capacity of the store, which drops them first. Guarded by the lock of the
+// store.
+class WarmEndpointPool {
+   public:
+    // False if the endpoint cannot be kept, it is reclaimed as deleted then
+    bool park(NicPathID peer_nic_id, std::shared_ptr<RdmaEndPoint> endpoint);
+
+    // The kept endpoint of the peer, if it is still connected
+    std::shared_ptr<RdmaEndPoint> take(NicPathID peer_nic_id);
+
+    // The endpoint kept for the longest, nullptr if none
+    std::shared_ptr<RdmaEndPoint> dropOldest();
+
+    // Endpoints kept beyond the grace period, which are removed
+    std::vector<std::shared_ptr<RdmaEndPoint>> expire();
+
+    size_t size() const { return entries_.size(); }
+
+    template <typename Func>
+    void forEach(Func func) {
+        for (auto &entry : entries_) func(entry.second.endpoint);
+    }
+
+   private:
+    struct Entry {
+        std::shared_ptr<RdmaEndPoint> endpoint;
+        uint64_t parked_ts;
+    };
+
+    std::unordered_map<NicPathID, Entry> entries_;
 };
 
 // FIFO
 class FIFOEndpointStore : public EndpointStore {
    public:
     FIFOEndpointStore(size_t max_size) : max_size_(max_size) {}
-    std::shared_ptr<RdmaEndPoint> getEndpoint(
-        const std::string &peer_nic_path) override;
-    std::shared_ptr<RdmaEndPoint> insertEndpoint(
-        const std::string &peer_nic_path, RdmaContext *context) override;
-    int deleteEndpoint(const std::string &peer_nic_path) override;
+    std::shared_ptr<RdmaEndPoint> getEndpoint(NicPathID peer_nic_id) override;
+    std::shared_ptr<RdmaEndPoint> insertEndpoint(NicPathID peer_nic_id,
+                                                 RdmaContext *context) override;
+    int deleteEndpoint(NicPathID peer_nic_id) override;
+    int releaseEndpoint(NicPathID peer_nic_id) override;
     void evictEndpoint() override;
     void reclaimEndpoint() override;
     size_t getSize() override;
+    size_t getCapacity() override { return max_size_; }
 
     int destroyQPs() override;
     int disconnectQPs() override;
 
    private:
+    struct Entry {
+        std::shared_ptr<RdmaEndPoint> endpoint;
+        std::list<NicPathID>::iterator fifo_iter;
+    };
+
     RWSpinlock endpoint_map_lock_;
-    std::unordered_map<std::string, std::shared_ptr<RdmaEndPoint>>
-        endpoint_map_;
-    std::unordered_map<std::string, std::list<std::string>::iterator> fifo_map_;
-    std::list<std::string> fifo_list_;
+    // Indexed by NicPathID, empty entries have no endpoint
+    std::vector<Entry> endpoint_map_;
+    std::list<NicPathID> fifo_list_;
+    size_t size_ = 0;
 
     std::unordered_set<std::shared_ptr<RdmaEndPoint>> waiting_list_;
+    WarmEndpointPool warm_pool_;
 
     size_t max_size_;
 };
@@ -82,34 +151,98 @@ class SIEVEEndpointStore : public EndpointStore {
    public:
     SIEVEEndpointStore(size_t max_size)
         : waiting_list_len_(0), max_size_(max_size) {}
-    std::shared_ptr<RdmaEndPoint> getEndpoint(
-        const std::string &peer_nic_path) override;
-    std::shared_ptr<RdmaEndPoint> insertEndpoint(
-        const std::string &peer_nic_path, RdmaContext *context) override;
-    int deleteEndpoint(const std::string &peer_nic_path) override;
+    std::shared_ptr<RdmaEndPoint> getEndpoint(NicPathID peer_nic_id) override;
+    std::shared_ptr<RdmaEndPoint> insertEndpoint(NicPathID peer_nic_id,
+                                                 RdmaContext *context) override;
+    int deleteEndpoint(NicPathID peer_nic_id) override;
+    int releaseEndpoint(NicPathID peer_nic_id) override;
     void evictEndpoint() override;
     void reclaimEndpoint() override;
     size_t getSize() override;
+    size_t getCapacity() override { return max_size_; }
 
     int destroyQPs() override;
     int disconnectQPs() override;
 
    private:
+    struct Entry {
+        std::shared_ptr<RdmaEndPoint> endpoint;
+        std::atomic_bool visited{false};
+        std::list<NicPathID>::iterator fifo_iter;
+    };
+
     RWSpinlock endpoint_map_lock_;
-    // The bool represents visited
-    std::unordered_map<
-        std::string, std::pair<std::shared_ptr<RdmaEndPoint>, std::atomic_bool>>
-        endpoint_map_;
-    std::unordered_map<std::string, std::list<std::string>::iterator> fifo_map_;
-    std::list<std::string> fifo_list_;
+    // Indexed by NicPathID, empty entries have no endpoint. Entries hold an
+    // atomic so they are allocated separately.
+    std::vector<std::unique_ptr<Entry>> endpoint_map_;
+    std::list<NicPathID> fifo_list_;
+    size_t size_ = 0;
 
-    std::optional<std::list<std::string>::iterator> hand_;
+    std::optional<std::list<NicPathID>::iterator> hand_;
 
     std::unordered_set<std::shared_ptr<RdmaEndPoint>> waiting_list_;
     std::atomic<int> waiting_list_len_;
+    WarmEndpointPool warm_pool_;
+    std::atomic<int> warm_pool_len_{0};
 
     size_t max_size_;
 };
+
+// Evicts the endpoint whose loss costs the least: the bytes posted to it
+// recently, decayed with a half-life of a second, times the time its
+// connection took to set up. Idle endpoints go first, cheap ones before
+// those behind a slow handshake. The capacity adapts to the QPs the device
+// can actually create: it shrinks to the endpoints held when creating one
+// fails, and grows back one at a time towards max_size once that is a
+// while ago. Selected by MC_WEIGHTED_ENDPOINT_STORE.
+class WeightedEndpointStore : public EndpointStore {
+   public:
+    WeightedEndpointStore(size_t max_size)
+        : max_size_(max_size), capacity_(max_size) {}
+    std::shared_ptr<RdmaEndPoint> getEndpoint(NicPathID peer_nic_id) override;
+    std::shared_ptr<RdmaEndPoint> insertEndpoint(NicPathID peer_nic_id,
+                                                 RdmaContext *context) override;
+    int deleteEndpoint(NicPathID peer_nic_id) override;
+    int releaseEndpoint(NicPathID peer_nic_id) override;
+    void evictEndpoint() override;
+    void reclaimEndpoint() override;
+    size_t getSize() override;
+    size_t getCapacity() override { return capacity_; }
+
+    int destroyQPs() override;
+    int disconnectQPs() override;
+
+   private:
+    struct Entry {
+        std::shared_ptr<RdmaEndPoint> endpoint;
+        std::list<NicPathID>::iterator member_iter;
+        // Posted bytes of the endpoint at the last update
+        uint64_t seen_bytes = 0;
+        double recent_bytes = 0;
+        uint64_t update_ts = 0;
+    };
+
+    void removeEntry(NicPathID peer_nic_id);
+
+    // Drop the waiting endpoints without outstanding slices
+    void reclaimUnlocked();
+
+    RWSpinlock endpoint_map_lock_;
+    // Indexed by NicPathID, empty entries have no endpoint
+    std::vector<std::unique_ptr<Entry>> endpoint_map_;
+    std::list<NicPathID> members_;
+    size_t size_ = 0;
+
+    std::unordered_set<std::shared_ptr<RdmaEndPoint>> waiting_list_;
+    std::atomic<int> waiting_list_len_{0};
+    WarmEndpointPool warm_pool_;
+    std::atomic<int> warm_pool_len_{0};
+
+    const size_t max_size_;
+    std::atomic<size_t> capacity_;
+    // When the capacity last shrank
+    uint64_t shrink_ts_ = 0;
+};
 }  // namespace mooncake
 
 #endif
\ No newline at end of file
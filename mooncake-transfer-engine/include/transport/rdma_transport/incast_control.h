@@ -0,0 +1,118 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef INCAST_CONTROL_H
+#define INCAST_CONTROL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "rate_limiter.h"
+#include "transfer_metadata.h"
+
+namespace mooncake {
+
+// Receiver-driven control of many-to-one writes. Before writing to a peer,
+// a sender asks it for credits over the handshake port; the peer shares its
+// inbound rate between the senders that asked within the last two leases,
+// max-min fairly by their demands, and grants each its share for one
+// lease. The RDMA workers meter the writes to the peer at the granted rate
+// and keep them queued while they have no grant, renewing it in the
+// background while they keep writing. Peers that do not serve credits are
+// written to without them.
+class IncastControl {
+   public:
+    using CreditDesc = TransferMetadata::CreditDesc;
+
+    static constexpr uint32_t kLeaseMs = 20;
+
+    // inbound_rate: bytes per second granted to all the senders together
+    IncastControl(std::shared_ptr<TransferMetadata> metadata,
+                  const std::string &local_server_name, uint64_t inbound_rate);
+
+    ~IncastControl();
+
+    // Receiver side: grant a share of the inbound rate to the sender
+    int onCreditRequest(const CreditDesc &request, CreditDesc &grant);
+
+    struct PeerCredit {
+        std::string server_name;
+        // At the rate of the last grant
+        TokenBucket bucket{1, 1};
+        // End of the lease, 0 before the first grant
+        std::atomic<uint64_t> expires_ts{0};
+        std::atomic<uint64_t> rate{0};
+        // The peer is written to without credits until then, as it did not
+        // grant any
+        std::atomic<uint64_t> exempt_until_ts{0};
+        std::atomic<bool> requesting{false};
+        // Bytes written and throttled rounds since the last request, for
+        // the demand of the next
+        std::atomic<uint64_t> posted_bytes{0};
+        std::atomic<bool> throttled{false};
+        uint64_t last_request_ts = 0;
+    };
+
+    // Credits of the writes to the peer server. Never freed, so that the
+    // workers can cache it.
+    PeerCredit *peer(const std::string &server_name);
+
+    // Sender side: bytes that can be written to the peer at now_ns, -1 if
+    // they are not metered. A grant is requested in the background when
+    // there is none or it is about to end.
+    int64_t available(PeerCredit *credit, uint64_t now_ns);
+
+    void consume(PeerCredit *credit, uint64_t bytes, uint64_t now_ns);
+
+    // Granted rate of each peer written to, and the writers sharing the
+    // inbound rate
+    void appendMetrics(std::string &out);
+
+   private:
+    void requestWorker();
+
+    void requestCredit(PeerCredit *credit);
+
+    std::shared_ptr<TransferMetadata> metadata_;
+    const std::string local_server_name_;
+    const uint64_t inbound_rate_;
+
+    std::mutex peers_mutex_;
+    std::unordered_map<std::string, std::unique_ptr<PeerCredit>> peers_;
+
+    // Peers to request credits from, served by request_thread_
+    std::mutex request_mutex_;
+    std::condition_variable request_cv_;
+    std::deque<PeerCredit *> request_queue_;
+    bool running_ = true;
+    std::thread request_thread_;
+
+    struct Sender {
+        uint64_t demand;
+        uint64_t last_request_ts;
+    };
+    std::mutex senders_mutex_;
+    std::map<std::string, Sender> senders_;
+};
+
+}  // namespace mooncake
+
+#endif  // INCAST_CONTROL_H
@@ -22,11 +22,14 @@
 #include <atomic>
 #include <condition_variable>
 #include <cstdint>
+#include <iterator>
 #include <list>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include "common.h"
 #include "rdma_transport.h"
@@ -38,6 +41,7 @@ class RdmaEndPoint;
 class RdmaTransport;
 class WorkerPool;
 class EndpointStore;
+struct DcInitiator;
 
 struct RdmaCq {
     RdmaCq() : native(nullptr), outstanding(0) {}
@@ -51,7 +55,7 @@ class RdmaContext {
    public:
     RdmaContext(RdmaTransport &engine, const std::string &device_name);
 
-    ~RdmaContext();
+    virtual ~RdmaContext();
 
     int construct(size_t num_cq_list = 1, size_t num_comp_channels = 1,
                   uint8_t port = 1, int gid_index = 0, size_t max_cqe = 4096,
@@ -66,6 +70,10 @@ class RdmaContext {
 
     int unregisterMemoryRegion(void *addr);
 
+    // Unregisters only the region registered as [addr, addr + length),
+    // leaving the others holding addr
+    int unregisterMemoryRegion(void *addr, size_t length);
+
     uint32_t rkey(void *addr);
 
     uint32_t lkey(void *addr);
@@ -77,15 +85,36 @@ class RdmaContext {
 
    public:
     // EndPoint Management
-    std::shared_ptr<RdmaEndPoint> endpoint(const std::string &peer_nic_path);
+    std::shared_ptr<RdmaEndPoint> endpoint(NicPathID peer_nic_id);
+
+    // A constructed endpoint of the kind this context uses, RC or DC
+    virtual std::shared_ptr<RdmaEndPoint> newEndpoint();
+
+    std::shared_ptr<RdmaEndPoint> endpoint(const std::string &peer_nic_path) {
+        return endpoint(InternNicPath(peer_nic_path));
+    }
+
+    int deleteEndpoint(NicPathID peer_nic_id);
 
-    int deleteEndpoint(const std::string &peer_nic_path);
+    int deleteEndpoint(const std::string &peer_nic_path) {
+        return deleteEndpoint(InternNicPath(peer_nic_path));
+    }
+
+    // Keeps the endpoint connected for reuse, see WarmEndpointPool
+    int releaseEndpoint(NicPathID peer_nic_id);
+
+    // Destroys the endpoints no longer in use, and those released longer
+    // than MC_ENDPOINT_KEEPALIVE_MS ago
+    void reclaimEndpoints();
 
     int disconnectAllEndpoints();
 
+    // Set up the endpoint to peer_nic_id in the background
+    int connectEndpoint(NicPathID peer_nic_id);
+
    public:
     // Device name, such as `mlx5_3`
-    std::string deviceName() const { return device_name_; }
+    const std::string &deviceName() const { return device_name_; }
 
     // NIC Path, such as `192.168.3.76@mlx5_3`
     std::string nicPath() const;
@@ -107,6 +136,9 @@ class RdmaContext {
 
     int activeSpeed() const { return active_speed_; }
 
+    // Whether RC reads and writes may target on-demand paging MRs
+    bool odpSupported() const { return odp_supported_; }
+
     ibv_mtu activeMTU() const { return active_mtu_; }
 
     ibv_comp_channel *compChannel();
@@ -123,10 +155,146 @@ class RdmaContext {
 
     int cqCount() const { return cq_list_.size(); }
 
+    // CQ polled as cq_index, which raises events on its completion channel
+    // once armed with ibv_req_notify_cq()
+    ibv_cq *nativeCq(int cq_index) { return cq_list_[cq_index].native; }
+
     int poll(int num_entries, ibv_wc *wc, int cq_index = 0);
 
     int socketId();
 
+    // Link rate of the port in Gb/s, 0 if unknown
+    int linkRateGbps();
+
+    // Work requests posted, how many of them signaled, and doorbells rung
+    struct PostSendStats {
+        uint64_t doorbells = 0;
+        uint64_t work_requests = 0;
+        uint64_t signaled = 0;
+    };
+
+    void recordPostSend(int work_requests, int signaled) {
+        post_send_doorbells_.fetch_add(1, std::memory_order_relaxed);
+        post_send_work_requests_.fetch_add(work_requests,
+                                           std::memory_order_relaxed);
+        post_send_signaled_.fetch_add(signaled, std::memory_order_relaxed);
+    }
+
+    PostSendStats postSendStats() const {
+        PostSendStats stats;
+        stats.doorbells =
+            post_send_doorbells_.load(std::memory_order_relaxed);
+        stats.work_requests =
+            post_send_work_requests_.load(std::memory_order_relaxed);
+        stats.signaled = post_send_signaled_.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    // Upper bounds of the completion latency buckets in microseconds, from
+    // posting a work request to polling its completion. The last bucket has
+    // no bound.
+    static constexpr uint64_t kLatencyBucketsUs[] = {10,   50,   100,   500,
+                                                     1000, 5000, 10000, 100000};
+    static constexpr size_t kLatencyBucketCount =
+        std::size(kLatencyBucketsUs) + 1;
+
+    // Successful completions, of the device or of a peer segment
+    struct CompletionStats {
+        uint64_t slices = 0;
+        uint64_t bytes = 0;
+        uint64_t latency_ns = 0;
+    };
+
+    struct TransferStats {
+        CompletionStats completions;
+        uint64_t latency_buckets[kLatencyBucketCount] = {};
+        // Failed completions, other than work requests flushed after one
+        uint64_t failures = 0;
+        // Slices queued again after a failed completion, within their retry
+        // budget
+        uint64_t retries = 0;
+        // Slices routed again, after a failed completion or post
+        uint64_t redispatches = 0;
+        uint64_t endpoint_hits = 0;
+        uint64_t endpoint_misses = 0;
+        // Endpoints created again for peers that had one before
+        uint64_t endpoint_reconnects = 0;
+        uint64_t endpoint_capacity = 0;
+        // Work requests posted and not completed yet
+        uint64_t outstanding_work_requests = 0;
+        std::vector<std::pair<Transport::SegmentID, CompletionStats>> peers;
+    };
+
+    // Completions counted by a worker over a poll, added up at its end
+    struct PollStats {
+        CompletionStats completions;
+        uint64_t latency_buckets[kLatencyBucketCount] = {};
+        std::unordered_map<Transport::SegmentID, CompletionStats> peers;
+
+        void record(const Transport::Slice *slice, uint64_t poll_ts);
+    };
+
+    void recordPoll(const PollStats &poll);
+
+    void recordFailure() {
+        completion_failures_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void recordRetry() {
+        completion_retries_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void recordRedispatch(uint64_t slices) {
+        redispatches_.fetch_add(slices, std::memory_order_relaxed);
+    }
+
+    TransferStats transferStats() const;
+
+   public:
+    // In-band notifications, see MC_INBAND_NOTIFY. The receive work
+    // requests taking writes with immediate carry this ID, which no slice
+    // has.
+    static constexpr uint64_t kNotifyRecvWrId = 0;
+
+    // Receive work requests each connected QP keeps posted
+    static constexpr int kNotifyRecvDepth = 16;
+
+    // Post the receive work requests of a connected QP of the endpoint to
+    // peer_server_name, whose notifications then reach the transport
+    int registerNotifyQp(ibv_qp *qp, const std::string &peer_server_name);
+
+    // Called before the QP is reset or destroyed
+    void unregisterNotifyQp(ibv_qp *qp);
+
+    // Called by the workers on a completion of kNotifyRecvWrId
+    void onNotifyRecv(const ibv_wc &wc);
+
+#ifdef USE_MLX5_DC
+   public:
+    // DC transport, enabled by MC_ENABLE_DC, see DcEndPoint
+    bool dcEnabled() const { return dct_ != nullptr; }
+
+    uint32_t dctNum() const { return dct_ ? dct_->qp_num : 0; }
+
+    // A DC initiator to post to, nullptr if all have failed. A failed
+    // initiator is reset once all its work requests have completed
+    DcInitiator *selectDci();
+
+    // Called on a failed completion of the QP that owns wr_depth
+    void markDciFailed(volatile int *wr_depth);
+
+    // Address handle of a peer NIC, kept until the context is destroyed
+    ibv_ah *addressHandle(const std::string &peer_gid, uint16_t peer_lid);
+
+   private:
+    int constructDc(size_t num_dci, size_t max_wr, size_t max_sge,
+                    size_t max_inline);
+
+    int setupDci(DcInitiator &dci);
+
+    void deconstructDc();
+#endif
+
    private:
     int openRdmaDevice(const std::string &device_name, uint8_t port,
                        int gid_index);
@@ -137,9 +305,22 @@ class RdmaContext {
                         struct ibv_context *context, ibv_port_attr &port_attr,
                         uint8_t port);
 
+    // Registered region holding addr, nullptr if none. Caller holds
+    // memory_regions_lock_.
+    ibv_mr *findMemoryRegion(void *addr);
+
    public:
     int submitPostSend(const std::vector<Transport::Slice *> &slice_list);
 
+    uint64_t pendingSliceCount() const;
+
+    // Completion health of this device, nullptr until set by RdmaTransport
+    DeviceHealth *health() const { return health_; }
+
+    void setHealth(DeviceHealth *health) { health_ = health; }
+
+    uint64_t outstandingBytes() const;
+
    private:
     const std::string device_name_;
     RdmaTransport &engine_;
@@ -156,10 +337,12 @@ class RdmaContext {
     uint16_t lid_ = 0;
     int gid_index_ = -1;
     int active_speed_ = -1;
+    bool odp_supported_ = false;
     ibv_mtu active_mtu_;
     ibv_gid gid_;
 
     RWSpinlock memory_regions_lock_;
+    // Sorted by address
     std::vector<ibv_mr *> memory_region_list_;
     std::vector<RdmaCq> cq_list_;
 
@@ -174,6 +357,39 @@ class RdmaContext {
 
     std::shared_ptr<WorkerPool> worker_pool_;
 
+    DeviceHealth *health_ = nullptr;
+
+    struct NotifyQp {
+        ibv_qp *qp;
+        std::string peer_server_name;
+    };
+    RWSpinlock notify_qps_lock_;
+    std::unordered_map<uint32_t, NotifyQp> notify_qps_;  // by QP number
+
+#ifdef USE_MLX5_DC
+    ibv_srq *dc_srq_ = nullptr;
+    ibv_qp *dct_ = nullptr;
+    std::vector<std::unique_ptr<DcInitiator>> dci_list_;
+    std::mutex address_handle_mutex_;
+    std::unordered_map<std::string, ibv_ah *> address_handles_;
+#endif
+
+    std::atomic<uint64_t> post_send_doorbells_{0};
+    std::atomic<uint64_t> post_send_work_requests_{0};
+    std::atomic<uint64_t> post_send_signaled_{0};
+
+    std::atomic<uint64_t> completed_slices_{0};
+    std::atomic<uint64_t> completed_bytes_{0};
+    std::atomic<uint64_t> completed_latency_ns_{0};
+    std::atomic<uint64_t> latency_buckets_[kLatencyBucketCount] = {};
+    std::atomic<uint64_t> completion_failures_{0};
+    std::atomic<uint64_t> completion_retries_{0};
+    std::atomic<uint64_t> redispatches_{0};
+    std::atomic<uint64_t> endpoint_hits_{0};
+    std::atomic<uint64_t> endpoint_misses_{0};
+    mutable std::mutex peer_stats_mutex_;
+    std::unordered_map<Transport::SegmentID, CompletionStats> peer_stats_;
+
     volatile bool active_;
 };
 
@@ -47,10 +47,11 @@ class RdmaEndPoint {
    public:
     RdmaEndPoint(RdmaContext &context);
 
-    ~RdmaEndPoint();
+    virtual ~RdmaEndPoint();
 
-    int construct(ibv_cq *cq, size_t num_qp_list = 2, size_t max_sge = 4,
-                  size_t max_wr = 256, size_t max_inline = 64);
+    virtual int construct(ibv_cq *cq, size_t num_qp_list = 2,
+                          size_t max_sge = 4, size_t max_wr = 256,
+                          size_t max_inline = 64);
 
    private:
     int deconstruct();
@@ -58,7 +59,12 @@ class RdmaEndPoint {
    public:
     void setPeerNicPath(const std::string &peer_nic_path);
 
-    int setupConnectionsByActive();
+    std::string peerNicPath() {
+        RWSpinlock::ReadGuard guard(lock_);
+        return peer_nic_path_;
+    }
+
+    virtual int setupConnectionsByActive();
 
     int setupConnectionsByActive(const std::string &peer_nic_path) {
         setPeerNicPath(peer_nic_path);
@@ -66,10 +72,10 @@ class RdmaEndPoint {
     }
 
     using HandShakeDesc = TransferMetadata::HandShakeDesc;
-    int setupConnectionsByPassive(const HandShakeDesc &peer_desc,
-                                  HandShakeDesc &local_desc);
+    virtual int setupConnectionsByPassive(const HandShakeDesc &peer_desc,
+                                          HandShakeDesc &local_desc);
 
-    bool hasOutstandingSlice() const;
+    virtual bool hasOutstandingSlice() const;
 
     bool active() const { return active_; }
 
@@ -84,18 +90,47 @@ class RdmaEndPoint {
         return (getCurrentTimeInNano() - inactive_time_) / 1000000000.0;
     }
 
+    // Traffic and connection cost, which WeightedEndpointStore evicts by
+    void recordPosted(uint64_t bytes) {
+        posted_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    uint64_t postedBytes() const {
+        return posted_bytes_.load(std::memory_order_relaxed);
+    }
+
+    void recordConnect(uint64_t latency_ns) {
+        connect_ns_.store(latency_ns, std::memory_order_relaxed);
+    }
+
+    // Time the last active connection setup took, 0 if it was connected
+    // by the peer
+    uint64_t connectNs() const {
+        return connect_ns_.load(std::memory_order_relaxed);
+    }
+
    public:
     bool connected() const {
         return status_.load(std::memory_order_relaxed) == CONNECTED;
     }
 
+    // Claims the background connection setup of this endpoint, false if it
+    // is already claimed. See WorkerPool::connectAsync()
+    bool startConnecting() {
+        return !connecting_.exchange(true, std::memory_order_acq_rel);
+    }
+
+    void finishConnecting() {
+        connecting_.store(false, std::memory_order_release);
+    }
+
     // Interrupts the connection, which can be triggered by user or by internal
     // error. Use setupConnectionsByActive or setupConnectionsByPassive to
     // reconnect
-    void disconnect();
+    virtual void disconnect();
 
     // Destroy QPs before CQs (in RDMA Context)
-    int destroyQP();
+    virtual int destroyQP();
 
    private:
     void disconnectUnlocked();
@@ -107,8 +142,9 @@ class RdmaEndPoint {
     // Submit some work requests to HW
     // Submitted tasks (success/failed) are removed in slice_list
     // Failed tasks (which must be submitted) are inserted in failed_slice_list
-    int submitPostSend(std::vector<Transport::Slice *> &slice_list,
-                       std::vector<Transport::Slice *> &failed_slice_list);
+    virtual int submitPostSend(
+        std::vector<Transport::Slice *> &slice_list,
+        std::vector<Transport::Slice *> &failed_slice_list);
 
    private:
     std::vector<uint32_t> qpNum() const;
@@ -121,7 +157,7 @@ class RdmaEndPoint {
                           uint16_t peer_lid, uint32_t peer_qp_num,
                           std::string *reply_msg = nullptr);
 
-   private:
+   protected:
     RdmaContext &context_;
     std::atomic<Status> status_;
 
@@ -132,10 +168,14 @@ class RdmaEndPoint {
 
     volatile int *wr_depth_list_;
     int max_wr_depth_;
+    size_t max_inline_bytes_;
 
     volatile bool active_;
     volatile int *cq_outstanding_;
     volatile uint64_t inactive_time_;
+    std::atomic<bool> connecting_{false};
+    std::atomic<uint64_t> posted_bytes_{0};
+    std::atomic<uint64_t> connect_ns_{0};
 };
 
 }  // namespace mooncake
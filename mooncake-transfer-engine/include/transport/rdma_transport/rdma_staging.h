@@ -0,0 +1,127 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef RDMA_STAGING_H_
+#define RDMA_STAGING_H_
+
+#ifdef USE_CUDA
+
+#include <cuda_runtime.h>
+
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "transport/transport.h"
+
+namespace mooncake {
+
+class RdmaTransport;
+
+// Moves requests whose local buffer is GPU memory no NIC can access, e.g.
+// without GPUDirect RDMA, through a pool of registered pinned host buffers.
+// Requests are cut into chunks of MC_STAGING_CHUNK_SIZE, and the copy of a
+// chunk between the GPU and its staging buffer overlaps the RDMA transfers
+// of the other chunks: writes copy a chunk to the host and then write it to
+// the peer, reads read it from the peer and then copy it to the GPU.
+class RdmaStaging {
+   public:
+    explicit RdmaStaging(RdmaTransport &transport);
+
+    ~RdmaStaging();
+
+    // Whether addr is GPU memory, which must be staged unless registered
+    static bool isDeviceMemory(void *addr);
+
+    // Takes over request, which must not be empty. task counts one slice per
+    // chunk and completes once the chunks did
+    void submit(const Transport::TransferRequest &request,
+                Transport::TransferTask &task);
+
+   private:
+    struct Job {
+        Transport::TransferRequest request;
+        Transport::TransferTask *task;
+        int device;
+        uint64_t next_offset = 0;
+        bool failed = false;
+    };
+
+    struct Chunk {
+        enum State { COPYING_IN, POSTED, COPYING_OUT };
+
+        Job *job;
+        size_t buffer;
+        uint64_t offset;
+        size_t length;
+        State state;
+        cudaEvent_t event = nullptr;
+        // The RDMA transfer of the chunk from or to the staging buffer
+        Transport::TransferRequest request;
+        Transport::TransferTask task;
+    };
+
+    void run();
+
+    // Allocates and registers the staging buffers, false on failure
+    bool allocateBuffers();
+
+    cudaStream_t stream(int device);
+
+    // Starts the next chunk of job in buffer
+    void startChunk(Job &job, size_t buffer);
+
+    // Moves chunk on if its current step completed, true once it is done
+    bool progressChunk(Chunk &chunk);
+
+    // Queues the copy of chunk between the GPU and its staging buffer
+    bool copyChunk(Chunk &chunk, cudaMemcpyKind kind);
+
+    bool postChunk(Chunk &chunk);
+
+    // Counts chunk in the task of its request and frees its buffer
+    void finishChunk(Chunk &chunk, bool success);
+
+    void *bufferAddress(size_t buffer) const {
+        return (char *)buffers_ + buffer * chunk_size_;
+    }
+
+    RdmaTransport &transport_;
+    const size_t chunk_size_;
+    const size_t buffer_count_;
+    void *buffers_ = nullptr;
+    std::vector<size_t> free_buffers_;
+    std::unordered_map<int, cudaStream_t> streams_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<std::unique_ptr<Job>> pending_jobs_;
+    bool running_ = true;
+
+    // Owned by the staging thread
+    std::list<std::unique_ptr<Job>> jobs_;
+    std::list<std::unique_ptr<Chunk>> chunks_;
+    std::thread thread_;
+};
+
+}  // namespace mooncake
+
+#endif  // USE_CUDA
+
+#endif  // RDMA_STAGING_H_
@@ -29,12 +29,14 @@
 
 #include "topology.h"
 #include "transfer_metadata.h"
+#include "transport/rdma_transport/incast_control.h"
 #include "transport/transport.h"
 
 namespace mooncake {
 
 class RdmaContext;
 class RdmaEndPoint;
+class RdmaStaging;
 class TransferMetadata;
 class WorkerPool;
 
@@ -88,9 +90,65 @@ class RdmaTransport : public Transport {
 
     SegmentID getSegmentID(const std::string &segment_name);
 
+    // Queues connection setup from every active local device to every
+    // device of the segment, see WorkerPool::connectAsync()
+    int warmupSegment(const std::string &segment_name) override;
+
+    // Releases the endpoints from every local device to every device of the
+    // segment, see EndpointStore::releaseEndpoint()
+    int closeSegment(SegmentID segment_id) override;
+
+    // Submit the slices, whose peer NICs are all in backoff from context,
+    // through the active local device with the fewest outstanding bytes
+    // among the others registering their source buffers. Those no device
+    // can take are left in slice_list.
+    void failoverSlices(RdmaContext *context, std::vector<Slice *> &slice_list);
+
+    // Counters of every device, see RdmaContext::transferStats()
+    void appendMetrics(std::string &out) override;
+
+    // Notifications pushed by the workers, see RdmaContext::onNotifyRecv()
+    void popImmNotifies(std::vector<ImmNotify> &notifies) override;
+
+    // Called by the workers of any device, without locking
+    void pushImmNotify(const std::string &segment_name, uint32_t imm_data);
+
+    // Credits of writes to peers, nullptr without MC_INCAST_CONTROL
+    IncastControl *incastControl() { return incast_control_.get(); }
+
    private:
     int allocateLocalSegmentID();
 
+    // Registers [addr, addr + length) on every device and publishes it as
+    // one buffer
+    int registerMemoryRange(void *addr, size_t length,
+                            const std::string &name, bool update_metadata);
+
+    int unregisterMemoryRange(void *addr, bool update_metadata);
+
+    // Registers the pages of an unregistered source buffer of a request in
+    // the registration cache, see MC_RCACHE_SIZE. True if desc was updated,
+    // false if the buffer was registered already or could not be.
+    bool cacheRegistration(SegmentDesc *desc, void *addr, size_t length);
+
+    // Unpublishes a cached registration, its regions are unregistered once
+    // slices posted from it can no longer be in flight. Caller holds
+    // rcache_mutex_.
+    void retireRegistration(uint64_t addr);
+
+    // Unregisters the retired registrations past their grace period, or all
+    // of them. Caller holds rcache_mutex_.
+    void reapRegistrations(bool all);
+
+    // Retires the cached registrations overlapping [addr, addr + length),
+    // true if there were any
+    bool invalidateRegistrations(uint64_t addr, size_t length);
+
+    // Hands request over to the staging pipeline if its source is GPU memory
+    // no registered buffer holds, see RdmaStaging
+    bool stageRequest(SegmentDesc *desc, const TransferRequest &request,
+                      TransferTask &task);
+
    public:
     int onSetupRdmaConnections(const HandShakeDesc &peer_desc,
                                HandShakeDesc &local_desc);
@@ -105,6 +163,9 @@ class RdmaTransport : public Transport {
    private:
     int initializeRdmaResources();
 
+    // Slice size for the request, see submitTransferTask
+    size_t sliceSize(const TransferRequest &request) const;
+
     int startHandshakeDaemon(std::string &local_server_name);
 
    public:
@@ -114,9 +175,61 @@ class RdmaTransport : public Transport {
                             std::string_view hint, int &buffer_id,
                             int &device_id, int retry_cnt = 0);
 
+   private:
+    // Outstanding bytes of each local device when multi-rail striping is
+    // enabled, empty otherwise
+    std::vector<uint64_t> railBytes() const;
+
+    // Spreads first tries over the preferred devices of the buffer's
+    // location by rail_bytes, which accounts for the chosen slice; retries
+    // and disabled striping fall back to the static selectDevice()
+    int selectDevice(SegmentDesc *desc, uint64_t offset, size_t length,
+                     std::vector<uint64_t> &rail_bytes, int &buffer_id,
+                     int &device_id, int retry_cnt);
+
    private:
     std::vector<std::shared_ptr<RdmaContext>> context_list_;
     std::shared_ptr<Topology> local_topology_;
+    std::unique_ptr<IncastControl> incast_control_;
+
+    // Chunks of the buffers registered in MC_MR_CHUNK_SIZE pieces, by the
+    // address of the buffer
+    std::mutex chunked_buffer_mutex_;
+    std::unordered_map<void *, std::vector<void *>> chunked_buffer_map_;
+
+    // Registrations made on first use of unregistered source buffers, by
+    // start address. They never overlap each other.
+    struct CachedRegistration {
+        size_t length;
+        uint64_t last_use;
+    };
+    struct RetiredRegistration {
+        void *addr;
+        size_t length;
+        uint64_t retire_ts;
+    };
+    std::mutex rcache_mutex_;
+    std::map<uint64_t, CachedRegistration> rcache_;
+    std::vector<RetiredRegistration> rcache_retired_;
+    size_t rcache_bytes_ = 0;
+    uint64_t rcache_clock_ = 0;
+    std::atomic<bool> rcache_in_use_{false};
+    std::atomic<uint64_t> rcache_hits_{0};
+    std::atomic<uint64_t> rcache_misses_{0};
+    std::atomic<uint64_t> rcache_evictions_{0};
+
+    // Notifications received and not popped yet, newest first
+    struct QueuedImmNotify {
+        ImmNotify notify;
+        QueuedImmNotify *next;
+    };
+    std::atomic<QueuedImmNotify *> imm_notifies_{nullptr};
+
+#ifdef USE_CUDA
+    // Started on the first request to stage
+    std::once_flag staging_once_;
+    std::unique_ptr<RdmaStaging> staging_;
+#endif
 };
 
 using TransferRequest = Transport::TransferRequest;
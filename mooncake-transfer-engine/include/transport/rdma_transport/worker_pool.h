@@ -15,7 +15,10 @@
 #ifndef WORKER_H
 #define WORKER_H
 
+#include <array>
+#include <deque>
 #include <queue>
+#include <unordered_map>
 #include <unordered_set>
 
 #include "rdma_context.h"
@@ -23,52 +26,164 @@
 namespace mooncake {
 class WorkerPool {
    public:
-    WorkerPool(RdmaContext &context, int numa_socket_id = 0);
+    // worker_count transfer workers, or workers_per_ctx of the global
+    // config when 0
+    WorkerPool(RdmaContext &context, int numa_socket_id = 0,
+               int worker_count = 0);
 
     ~WorkerPool();
 
     // Add slices to queue, called by Transport
     int submitPostSend(const std::vector<Transport::Slice *> &slice_list);
 
+    // Slices submitted and not yet completed
+    uint64_t pendingSliceCount() const {
+        return submitted_slice_count_.load(std::memory_order_relaxed) -
+               processed_slice_count_.load(std::memory_order_relaxed);
+    }
+
+    // Bytes of the slices submitted and not yet completed
+    uint64_t outstandingBytes() const {
+        return submitted_bytes_.load(std::memory_order_relaxed) -
+               processed_bytes_.load(std::memory_order_relaxed);
+    }
+
+    // Set up the connection of endpoint in the background, unless it is
+    // connected or already being connected. Slices for it stay queued in
+    // the transfer workers meanwhile
+    void connectAsync(const std::shared_ptr<RdmaEndPoint> &endpoint);
+
+    // Interned path of a NIC of a peer segment
+    static NicPathID peerNicID(const Transport::SegmentDesc &segment_desc,
+                               int device_id);
+
    private:
     void performPostSend(int thread_id);
 
-    void performPollCq(int thread_id);
+    // Number of work completions polled
+    int performPollCq(int thread_id);
+
+    // Route the slices to NICs of their peers not in backoff from this
+    // device, or to another local device when all of them are. With
+    // reload, the peer descriptors are fetched again first.
+    void redispatch(std::vector<Transport::Slice *> &slice_list, int thread_id,
+                    bool reload = true);
 
-    void redispatch(std::vector<Transport::Slice *> &slice_list, int thread_id);
+    // Device of the peer segment for the slice whose NIC is not in backoff,
+    // ERR_DEVICE_NOT_FOUND if all of them are
+    int selectPeerDevice(Transport::SegmentDesc &desc, Transport::Slice *slice,
+                         int &buffer_id, int &device_id);
+
+    // Work requests from this device to a peer NIC that fail put the pair
+    // in exponential backoff, which its next success clears
+    void recordNicFailure(NicPathID peer_nic_id);
+
+    void recordNicSuccess(NicPathID peer_nic_id);
+
+    // End of the backoff of the peer NIC, 0 if it is not in backoff
+    uint64_t backoffUntil(NicPathID peer_nic_id);
 
     void transferWorker(int thread_id);
 
     void monitorWorker();
 
+    void connectWorker();
+
     int doProcessContextEvents();
 
+    // Adaptive polling: arm the CQs of the worker and block until one of
+    // them completes a work request, slices are submitted or timeout_ms
+    // passes, unless completions arrived before the CQs were armed
+    void waitForEvents(int thread_id, int timeout_ms);
+
+    int setupWorkerEvents(int thread_id);
+
+    // Pin transfer worker thread_id to its core, and the other threads,
+    // with thread_id -1, to the local cores left to them
+    void bindThread(int thread_id);
+
    private:
     RdmaContext &context_;
     const int numa_socket_id_;
+    const int worker_count_;
+
+    // Cores of the device's NUMA node not reserved for the application,
+    // and the one of each transfer worker when they are pinned
+    std::vector<int> local_cores_;
+    std::vector<int> worker_cores_;
 
     std::vector<std::thread> worker_thread_;
     std::atomic<bool> workers_running_;
     std::atomic<int> suspended_flag_;
 
-    std::atomic<int> redispatch_counter_;
+    struct NicBackoff {
+        int failures = 0;
+        uint64_t until_ts = 0;
+    };
+    RWSpinlock backoff_lock_;
+    std::unordered_map<NicPathID, NicBackoff> nic_backoff_;
+    // Size of nic_backoff_, so that completions skip the lock while empty
+    std::atomic<int> nic_backoff_count_{0};
 
     std::mutex cond_mutex_;
     std::condition_variable cond_var_;
 
-    using SliceList = std::vector<Transport::Slice *>;
+    // Endpoints waiting for connection setup, drained by the connect
+    // workers so that handshakes neither block the transfer workers nor
+    // run one peer at a time
+    std::vector<std::thread> connect_thread_;
+    std::mutex connect_mutex_;
+    std::condition_variable connect_cv_;
+    std::deque<std::shared_ptr<RdmaEndPoint>> connect_queue_;
 
+    using SliceList = std::vector<Transport::Slice *>;
+    using TrafficClass = Transport::TransferRequest::TrafficClass;
+    const static int kTrafficClassCount =
+        Transport::TransferRequest::kTrafficClassCount;
+
+    // Post the queued slices of the worker, sharing the work requests the
+    // endpoints can take between the traffic classes by deficit round
+    // robin: each round credits every class with queued slices with its
+    // weight in slices, and posts its slices while it has credit, the
+    // higher classes first
+    void postQueuedSlices(int thread_id);
+
+    // Fail the slices of slice_list whose batch was canceled or timed out,
+    // and remove them from it
+    void dropAbortedSlices(SliceList &slice_list);
+
+    // Lock-free multi-producer single-consumer queues, drained by worker
+    // shard_id % worker_count_. Each holds a stack of slices linked
+    // through Slice::next_queued, newest first: submitPostSend pushes a
+    // whole chain with a single CAS and performPostSend takes the stack
+    // with a single exchange, so neither allocates nor takes a lock.
     const static int kShardCount = 8;
-    std::unordered_map<std::string, SliceList> slice_queue_[kShardCount];
-    std::atomic<uint64_t> slice_queue_count_[kShardCount];
-    TicketLock slice_queue_lock_[kShardCount];
+    std::atomic<Transport::Slice *> slice_queue_[kTrafficClassCount]
+                                                [kShardCount];
 
-    std::vector<std::unordered_map<std::string, SliceList>>
+    // Slices of each worker, by traffic class and then peer NIC
+    std::vector<
+        std::array<std::unordered_map<NicPathID, SliceList>, kTrafficClassCount>>
         collective_slice_queue_;
 
+    // Bytes each class of each worker may still post in this round
+    std::vector<std::array<int64_t, kTrafficClassCount>> class_deficit_;
+
     std::atomic<uint64_t> submitted_slice_count_, processed_slice_count_;
+    std::atomic<uint64_t> submitted_bytes_{0}, processed_bytes_{0};
 
     uint64_t success_nr_polls = 0, failed_nr_polls = 0;
+
+    // With adaptive polling, what each worker blocks on: the completion
+    // channels of its CQs and an eventfd written by submitPostSend while
+    // it sleeps
+    struct WorkerEvents {
+        int epoll_fd = -1;
+        int wake_fd = -1;
+        std::vector<ibv_comp_channel *> channels;
+        std::atomic<bool> sleeping{false};
+    };
+    std::unique_ptr<WorkerEvents[]> worker_events_;
 };
 }  // namespace mooncake
 
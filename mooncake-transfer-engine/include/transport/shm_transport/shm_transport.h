@@ -0,0 +1,124 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SHM_TRANSPORT_H_
+#define SHM_TRANSPORT_H_
+
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "transfer_metadata.h"
+#include "transport/transport.h"
+
+namespace mooncake {
+class TransferMetadata;
+
+// ShmTransport serves transfers between processes on the same host by
+// mapping the buffers of the peer and copying directly, without going
+// through the NIC. Buffers are mappable when they are backed by a shared
+// file, e.g. allocated by allocateSharedMemory() or announced with
+// exportSharedMemory(); registering them publishes the file along with the
+// boot ID of the host in the segment descriptor, whatever its protocol.
+//
+// It complements the transport of the segment: MultiTransport picks it for
+// the requests whose target it can map, and the protocol of the segment for
+// the others.
+class ShmTransport : public Transport {
+   public:
+    using BufferDesc = TransferMetadata::BufferDesc;
+    using SegmentDesc = TransferMetadata::SegmentDesc;
+    using ShmBufferDesc = TransferMetadata::ShmBufferDesc;
+
+   public:
+    ShmTransport();
+
+    ~ShmTransport();
+
+    Status submitTransfer(BatchID batch_id,
+                          const std::vector<TransferRequest> &entries) override;
+
+    Status submitTransferTask(
+        const std::vector<TransferRequest *> &request_list,
+        const std::vector<TransferTask *> &task_list) override;
+
+    Status getTransferStatus(BatchID batch_id, size_t task_id,
+                             TransferStatus &status) override;
+
+    // Whether the target of entry in segment desc can be mapped here
+    bool canTransfer(const SegmentDesc &desc, const TransferRequest &entry);
+
+    // Allocate size bytes backed by a memfd, which other processes of the
+    // host can map once registered. nullptr on failure.
+    static void *allocateSharedMemory(size_t size);
+
+    static void freeSharedMemory(void *addr);
+
+    // Announce that [addr, addr + length) is a shared mapping of path at
+    // offset, e.g. a hugetlbfs file or /proc/self/fd/<memfd>. The file must
+    // stay open until unexportSharedMemory().
+    static void exportSharedMemory(void *addr, size_t length,
+                                   const std::string &path, uint64_t offset);
+
+    static void unexportSharedMemory(void *addr);
+
+   private:
+    int install(std::string &local_server_name,
+                std::shared_ptr<TransferMetadata> meta,
+                std::shared_ptr<Topology> topo) override;
+
+    int registerLocalMemory(void *addr, size_t length,
+                            const std::string &location, bool remote_accessible,
+                            bool update_metadata) override;
+
+    int unregisterLocalMemory(void *addr,
+                              bool update_metadata = false) override;
+
+    int registerLocalMemoryBatch(
+        const std::vector<Transport::BufferEntry> &buffer_list,
+        const std::string &location) override;
+
+    int unregisterLocalMemoryBatch(
+        const std::vector<void *> &addr_list) override;
+
+    // Local address of the target of entry, nullptr if it cannot be mapped
+    void *translate(const SegmentDesc &desc, const TransferRequest &entry);
+
+    // Map buffer of segment desc, cached until the transport is destroyed
+    void *map(const SegmentDesc &desc, const ShmBufferDesc &buffer);
+
+    Status submitRequest(const TransferRequest &request, TransferTask &task);
+
+    const char *getName() const override { return "shm"; }
+
+   private:
+    struct Mapping {
+        void *addr;
+        size_t length;
+        // Start of the buffer in the mapping, which is page aligned
+        char *base;
+    };
+
+    std::string shm_host_;
+    std::shared_mutex mapping_mutex_;
+    std::unordered_map<std::string, Mapping> mappings_;
+    // Buffers that failed to map, not retried
+    std::unordered_set<std::string> unmappable_;
+};
+}  // namespace mooncake
+
+#endif
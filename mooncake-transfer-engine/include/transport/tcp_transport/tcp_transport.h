@@ -23,6 +23,7 @@
 #include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -33,7 +34,9 @@
 
 namespace mooncake {
 class TransferMetadata;
-class TcpContext;
+struct TcpContext;
+struct TcpPeer;
+struct Session;
 
 class TcpTransport : public Transport {
    public:
@@ -76,16 +79,34 @@ class TcpTransport : public Transport {
     int unregisterLocalMemoryBatch(
         const std::vector<void *> &addr_list) override;
 
-    void worker();
+    void worker(int index);
+
+    // Cut a request into slices and start them
+    void submitRequest(const TransferRequest &request, TransferTask &task);
 
     void startTransfer(Slice *slice);
 
+    // Run slice on session, a connection to peer owned by slice until it
+    // finishes
+    void startTransfer(const std::shared_ptr<TcpPeer> &peer,
+                       const std::shared_ptr<Session> &session, Slice *slice);
+
+    void connect(const std::shared_ptr<TcpPeer> &peer, Slice *slice);
+
+    // Hand session over to the next slice waiting for peer, or keep it idle.
+    // A failed session is closed instead.
+    void releaseSession(const std::shared_ptr<TcpPeer> &peer,
+                        std::shared_ptr<Session> session, bool failed);
+
     const char *getName() const override { return "tcp"; }
 
    private:
     TcpContext *context_;
     std::atomic_bool running_;
-    std::thread thread_;
+    std::vector<std::thread> workers_;
+    // Installed next to the transport of the local segment, which TCP only
+    // adds its data port to; buffers are published by that transport
+    bool fallback_;
 };
 }  // namespace mooncake
 
@@ -20,12 +20,16 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <atomic>
+#include <cassert>
 #include <cstddef>
 #include <cstdint>
 #include <iostream>
 #include <memory>
+#include <new>
 #include <queue>
 #include <string>
+#include <utility>
 
 #include "common/base/status.h"
 #include "transfer_metadata.h"
@@ -54,12 +58,35 @@ class Transport {
     struct TransferRequest {
         enum OpCode { READ, WRITE };
 
+        // Precedence of requests sharing the NICs, from the highest. The
+        // RDMA workers share the bandwidth between the classes with queued
+        // slices by their weights, see MC_TRAFFIC_CLASS_WEIGHTS.
+        enum TrafficClass { LATENCY = 0, NORMAL = 1, BACKGROUND = 2 };
+        const static int kTrafficClassCount = 3;
+
         OpCode opcode;
         void *source;
         SegmentID target_id;
         uint64_t target_offset;
         size_t length;
         int advise_retry_cnt = 0;
+        TrafficClass traffic_class = NORMAL;
+
+        // Settings of this request in place of the configured ones, 0 keeps
+        // the configured value
+        struct Options {
+            // Fixed size of the slices, instead of adaptive slicing
+            size_t slice_size = 0;
+            // Times each slice is retried before the request fails, RDMA only
+            int max_retry_cnt = 0;
+            // Write imm_data along with the request, raising an ImmNotify
+            // at the target once it has landed. RDMA RC only, and the
+            // request must move no data, see
+            // TransferEngine::submitTransferWithImm()
+            bool with_imm = false;
+            uint32_t imm_data = 0;
+        };
+        Options options;
     };
 
     enum TransferStatusEnum {
@@ -88,10 +115,13 @@ class Transport {
         size_t length;
         TransferRequest::OpCode opcode;
         SegmentID target_id;
-        std::string peer_nic_path;
+        // Interned path of the peer NIC, see NicPathTable
+        NicPathID peer_nic_id;
         SliceStatus status;
         TransferTask *task;
         bool from_cache;
+        // Link in the lock-free slice queues of the RDMA WorkerPool
+        Slice *next_queued;
 
         union {
             struct {
@@ -102,12 +132,25 @@ class Transport {
                 volatile int *qp_depth;
                 uint32_t retry_cnt;
                 uint32_t max_retry_cnt;
+                // Previous unsignaled slice posted by the same doorbell,
+                // completed together with this one
+                Slice *unsignaled_prev;
+                // When the slice was queued to the workers
+                uint64_t submit_ts;
+                TransferRequest::TrafficClass traffic_class;
+                // Posted as a write with immediate of imm_data
+                bool with_imm;
+                uint32_t imm_data;
             } rdma;
             struct {
                 void *dest_addr;
+                // Remote mapping pinned by the slice, see NvlinkTransport
+                void *mapping;
             } local;
             struct {
                 uint64_t dest_addr;
+                // Set once the slice has been retried on a new connection
+                bool retried;
             } tcp;
             struct {
                 uint64_t offset;
@@ -128,67 +171,103 @@ class Transport {
        public:
         void markSuccess() {
             status = Slice::SUCCESS;
-            __sync_fetch_and_add(&task->transferred_bytes, length);
-            __sync_fetch_and_add(&task->success_slice_count, 1);
+            task->finishSlice(true, length);
         }
 
         void markFailed() {
             status = Slice::FAILED;
-            __sync_fetch_and_add(&task->failed_slice_count, 1);
+            task->finishSlice(false);
         }
 
         volatile int64_t ts;
     };
 
+    // Slices are recycled through two magazines per thread, which are
+    // exchanged whole with a process-wide depot once both are full or both
+    // are empty. Slices freed on other threads than the one allocating
+    // them, e.g. the one freeing the batch, thus flow back to the
+    // allocating threads instead of piling up where they are freed.
     struct ThreadLocalSliceCache {
-        ThreadLocalSliceCache() : head_(0), tail_(0) {
-            lazy_delete_slices_.resize(kLazyDeleteSliceCapacity);
-        }
+        const static size_t kMagazineSize = 256;
 
-        ~ThreadLocalSliceCache() {
-            for (uint64_t i = tail_; i != head_; i++) {
-                auto slice = lazy_delete_slices_[i % kLazyDeleteSliceCapacity];
-                delete slice;
-                freed_++;
-            }
-            if (allocated_ != freed_) {
-                LOG(WARNING) << "detected slice leak: allocated " << allocated_
-                             << " freed " << freed_;
-            }
-        }
+        struct Magazine {
+            size_t count = 0;
+            Slice *slices[kMagazineSize];
+        };
+
+        ThreadLocalSliceCache();
+
+        ~ThreadLocalSliceCache();
 
         Slice *allocate() {
-            Slice *slice;
-
-            if (head_ - tail_ == 0) {
-                allocated_++;
-                slice = new Slice();
-                slice->from_cache = false;
-            } else {
-                slice = lazy_delete_slices_[tail_ % kLazyDeleteSliceCapacity];
-                tail_++;
-                slice->from_cache = true;
+            if (!loaded_->count) {
+                if (previous_->count) {
+                    std::swap(loaded_, previous_);
+                } else if (!refill()) {
+                    allocated_++;
+                    auto slice = new Slice();
+                    slice->from_cache = false;
+                    return slice;
+                }
             }
-
+            auto slice = loaded_->slices[--loaded_->count];
+            slice->from_cache = true;
+            reused_++;
             return slice;
         }
 
         void deallocate(Slice *slice) {
-            if (head_ - tail_ == kLazyDeleteSliceCapacity) {
-                delete slice;
-                freed_++;
-                return;
+            if (loaded_->count == kMagazineSize) {
+                if (previous_->count < kMagazineSize)
+                    std::swap(loaded_, previous_);
+                else
+                    flush();
             }
-            lazy_delete_slices_[head_ % kLazyDeleteSliceCapacity] = slice;
-            head_++;
+            loaded_->slices[loaded_->count++] = slice;
         }
 
-        const static size_t kLazyDeleteSliceCapacity = 4096;
-        std::vector<Slice *> lazy_delete_slices_;
-        uint64_t head_, tail_;
-        uint64_t allocated_ = 0, freed_ = 0;
+       private:
+        // Exchange the empty previous magazine for a full one of the depot,
+        // false if it has none
+        bool refill();
+
+        // Exchange the full previous magazine for an empty one
+        void flush();
+
+        // Add the counts of the thread to the process-wide ones
+        void publishStats();
+
+        Magazine *loaded_, *previous_;
+        uint64_t allocated_ = 0, reused_ = 0;
+    };
+
+    struct SliceStats {
+        // Slices created because none could be reused
+        uint64_t allocated;
+        uint64_t reused;
+        // Slices deleted because the depot was full
+        uint64_t freed;
     };
 
+    /// @brief Slice counts of the process, as of the last magazine exchange
+    /// of each thread.
+    static SliceStats getSliceStats();
+
+    struct TrafficClassStats {
+        uint64_t bytes;
+        uint64_t slices;
+        // Sum of the times from submission to completion of the slices
+        uint64_t latency_ns;
+    };
+
+    /// @brief Slices of a traffic class completed by the transports which
+    /// schedule requests by class, i.e. RDMA.
+    static TrafficClassStats getTrafficClassStats(
+        TransferRequest::TrafficClass traffic_class);
+
+    static void recordTrafficClass(TransferRequest::TrafficClass traffic_class,
+                                   const TrafficClassStats &completed);
+
     struct TransferTask {
         volatile uint64_t slice_count = 0;
         volatile uint64_t success_slice_count = 0;
@@ -197,6 +276,12 @@ class Transport {
         volatile bool is_finished = false;
         uint64_t total_bytes = 0;
         BatchID batch_id = 0;
+        // Transport MultiTransport resubmits request to once the task failed
+        // on the one it was routed to, see MultiTransport::failover()
+        Transport *fallback = nullptr;
+        TransferRequest request;
+        // Odd while the task is being resubmitted, bumped at both ends
+        volatile uint32_t failover_seq = 0;
 
         // record the slice list for freeing objects
         std::vector<Slice *> slice_list;
@@ -204,16 +289,160 @@ class Transport {
             for (auto &slice : slice_list)
                 Transport::getSliceCache().deallocate(slice);
         }
+
+        // Count a finished slice, and the bytes it transferred, in the task
+        // and its batch, and wake up the threads waiting for the batch if it
+        // was the last pending slice of the task.
+        inline void finishSlice(bool success, uint64_t bytes = 0);
     };
 
+    // Tasks of a batch, constructed up front in storage for batch_size of
+    // them, so that concurrent submitters each claim a range of tasks and
+    // fill it in place without locking. size() counts the tasks claimed.
+    class TaskList {
+       public:
+        size_t size() const { return size_.load(std::memory_order_acquire); }
+
+        size_t capacity() const { return capacity_; }
+
+        TransferTask &operator[](size_t index) { return tasks_[index]; }
+
+        const TransferTask &operator[](size_t index) const {
+            return tasks_[index];
+        }
+
+        // Only while the list is empty
+        void reserve(size_t capacity) {
+            if (capacity <= capacity_) return;
+            tasks_ = std::make_unique<TransferTask[]>(capacity);
+            capacity_ = capacity;
+        }
+
+        // For a single submitter, size must be within the capacity
+        void resize(size_t size) {
+            assert(size <= capacity_);
+            size_.store(size, std::memory_order_release);
+        }
+
+        // Claim count tasks unless more than limit would be claimed then,
+        // first is the index of the first of them
+        bool claim(size_t count, size_t limit, size_t &first) {
+            assert(limit <= capacity_);
+            size_t size = size_.load(std::memory_order_relaxed);
+            do {
+                if (size + count > limit) return false;
+            } while (!size_.compare_exchange_weak(size, size + count,
+                                                  std::memory_order_acq_rel));
+            first = size;
+            return true;
+        }
+
+        // Reset the claimed tasks, keeping the storage
+        void clear() {
+            const size_t size = size_.load(std::memory_order_relaxed);
+            for (size_t i = 0; i < size; ++i) {
+                tasks_[i].~TransferTask();
+                new (&tasks_[i]) TransferTask();
+            }
+            size_.store(0, std::memory_order_relaxed);
+        }
+
+       private:
+        std::unique_ptr<TransferTask[]> tasks_;
+        size_t capacity_ = 0;
+        std::atomic<size_t> size_{0};
+    };
+
+    // Batch descriptors live in process-wide slots, recycled through
+    // per-thread caches rather than freed, so that their task lists keep
+    // their capacity. A BatchID is the index of the slot tagged with its
+    // generation, which is bumped when the batch is freed: stale IDs are
+    // rejected instead of reaching the next batch of the slot.
     struct BatchDesc {
         BatchID id;
         size_t batch_size;
-        std::vector<TransferTask> task_list;
+        TaskList task_list;
         void *context;  // for transport implementers.
         int64_t start_timestamp;
+
+        // Bumped whenever a task may have finished, waited on with a futex.
+        std::atomic<uint32_t> progress{0};
+        std::atomic<uint32_t> waiters{0};
+        // Slices being finished; the batch cannot be freed until it is zero.
+        std::atomic<uint32_t> finishing{0};
+        // Threads submitting to the batch, which is not done before they
+        // return, see MultiTransport::submitTransfer()
+        std::atomic<uint32_t> submitting{0};
+        // Slices of the tasks submitted, added once their submitter returns,
+        // and those finished, failed or resubmitted to a fallback since, so
+        // that the status of the batch is known without walking its tasks
+        std::atomic<uint64_t> total_slices{0};
+        std::atomic<uint64_t> finished_slices{0};
+        std::atomic<uint64_t> failed_slices{0};
+        std::atomic<uint64_t> retried_slices{0};
+        std::atomic<uint64_t> transferred_bytes{0};
+
+        // Set by cancelBatch(), and by setBatchDeadline() to the
+        // getCurrentTimeInNano() past which the batch times out, 0 if none
+        std::atomic<bool> canceled{false};
+        std::atomic<int64_t> deadline{0};
+        // Whether either was ever set, see hasAbortableBatches()
+        std::atomic<bool> abortable{false};
+
+        // CANCELED or TIMEOUT once the slices of the batch which are not
+        // posted yet are to be dropped, WAITING until then
+        TransferStatusEnum abortStatus() const {
+            if (!abortable.load(std::memory_order_relaxed)) return WAITING;
+            if (canceled.load(std::memory_order_relaxed)) return CANCELED;
+            auto deadline_ts = deadline.load(std::memory_order_relaxed);
+            return deadline_ts && getCurrentTimeInNano() > deadline_ts
+                       ? TIMEOUT
+                       : WAITING;
+        }
+
+        // Whether every slice submitted has finished, with failed set if
+        // some of them failed and were not retried. The counters are read
+        // in the reverse order of their updates, so that a submission or a
+        // failover in progress is never taken for the end of the batch.
+        bool slicesDone(bool &failed) const {
+            const uint64_t finished = finished_slices.load();
+            if (submitting.load()) return false;
+            const uint64_t retried = retried_slices.load();
+            const uint64_t total = total_slices.load();
+            if (!total || finished != total) return false;
+            failed = failed_slices.load() > retried;
+            return true;
+        }
     };
 
+    /// @brief Get the completion progress of a batch, to be passed to
+    /// waitBatchProgress() after checking the task status.
+    static uint32_t getBatchProgress(BatchID batch_id);
+
+    /// @brief Block until a task of the batch may have finished after
+    /// getBatchProgress() returned progress, or until timeout_ns elapsed.
+    /// Transports that only detect completion when polled do not wake up
+    /// waiters, so callers should keep the timeout short.
+    static void waitBatchProgress(BatchID batch_id, uint32_t progress,
+                                  int64_t timeout_ns);
+
+    /// @brief Descriptor of a batch, nullptr if batch_id is not allocated.
+    static BatchDesc *getBatchDesc(BatchID batch_id);
+
+    /// @brief Time the batch out once getCurrentTimeInNano() passes
+    /// deadline_ns, 0 clears the deadline. Its unfinished tasks are then
+    /// reported TIMEOUT, and their slices not posted yet are dropped.
+    static Status setBatchDeadline(BatchID batch_id, int64_t deadline_ns);
+
+    /// @brief Cancel a batch: its unfinished tasks are reported CANCELED,
+    /// and their slices not posted yet are dropped. The batch can be freed
+    /// once the posted ones are done.
+    static Status cancelBatch(BatchID batch_id);
+
+    /// @brief Whether any allocated batch was canceled or has a deadline,
+    /// so that transports only look for slices to drop then.
+    static bool hasAbortableBatches();
+
    public:
     virtual ~Transport() {}
 
@@ -243,6 +472,31 @@ class Transport {
     virtual Status getTransferStatus(BatchID batch_id, size_t task_id,
                                      TransferStatus &status) = 0;
 
+    /// @brief Start establishing connections to a segment in the background,
+    /// so that the first transfers to it do not wait for them. Transports
+    /// without connection setup do nothing.
+    virtual int warmupSegment(const std::string &segment_name) { return 0; }
+
+    /// @brief Release the connections to a segment the application closed.
+    /// Transports without connections do nothing.
+    virtual int closeSegment(SegmentID segment_id) { return 0; }
+
+    /// @brief Append the Prometheus text of the transport's counters, of
+    /// the devices and peer segments it transfers with
+    virtual void appendMetrics(std::string &out) {}
+
+    /// @brief A write with immediate received from a peer, see
+    /// TransferRequest::Options::with_imm
+    struct ImmNotify {
+        std::string segment_name;
+        uint32_t imm_data;
+    };
+
+    /// @brief Move the notifications received since the last call to the
+    /// end of notifies, in the order they arrived from each peer.
+    /// Transports without them append nothing.
+    virtual void popImmNotifies(std::vector<ImmNotify> &notifies) {}
+
     std::shared_ptr<TransferMetadata> &meta() { return metadata_; }
 
     struct BufferEntry {
@@ -258,11 +512,17 @@ class Transport {
     std::string local_server_name_;
     std::shared_ptr<TransferMetadata> metadata_;
 
-    RWSpinlock batch_desc_lock_;
-    std::unordered_map<BatchID, std::shared_ptr<BatchDesc>> batch_desc_set_;
-
     static ThreadLocalSliceCache &getSliceCache();
 
+    // Take a descriptor for a batch of batch_size tasks, nullptr once the
+    // slots are exhausted
+    static BatchDesc *newBatchDesc(size_t batch_size);
+
+    // Give back the descriptor of a freed batch, invalidating its ID
+    static void releaseBatchDesc(BatchDesc *batch_desc);
+
+    static void wakeBatchWaiters(BatchDesc *batch_desc);
+
    private:
     virtual int registerLocalMemory(void *addr, size_t length,
                                     const std::string &location,
@@ -281,6 +541,29 @@ class Transport {
 
     virtual const char *getName() const = 0;
 };
+
+void Transport::TransferTask::finishSlice(bool success, uint64_t bytes) {
+    volatile uint64_t &counter =
+        success ? success_slice_count : failed_slice_count;
+    if (bytes) __sync_fetch_and_add(&transferred_bytes, bytes);
+    auto batch_desc = getBatchDesc(batch_id);
+    if (!batch_desc) {
+        __sync_fetch_and_add(&counter, 1);
+        return;
+    }
+    // Once the count is updated, a waiter may see the task done and free the
+    // batch, which is held back until finishing drops to zero.
+    batch_desc->finishing.fetch_add(1);
+    __sync_fetch_and_add(&counter, 1);
+    if (bytes) batch_desc->transferred_bytes.fetch_add(bytes);
+    if (!success) batch_desc->failed_slices.fetch_add(1);
+    batch_desc->finished_slices.fetch_add(1);
+    if (success_slice_count + failed_slice_count == slice_count) {
+        batch_desc->progress.fetch_add(1);
+        if (batch_desc->waiters.load()) wakeBatchWaiters(batch_desc);
+    }
+    batch_desc->finishing.fetch_sub(1);
+}
 }  // namespace mooncake
 
 #endif  // TRANSPORT_H_
@@ -2,16 +2,98 @@
 #include <cuda_runtime_api.h>
 #include <sys/types.h>
 
+#include <cstdlib>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
-extern "C" {
-void *mc_nvlink_malloc(ssize_t size, int device, cudaStream_t stream) {
+// Fabric memory is slow to create, map and export, and each allocation has
+// to be registered to and mapped by the peers on its own. Allocations are
+// thus carved out of large chunks, created once per device and never
+// released, which NvlinkTransport registers and peers map as a whole.
+// Freed blocks are kept in free lists by size class and handed out again.
+// Allocations above a quarter of a chunk get an allocation of their own,
+// which is cached by size once freed.
+//
+// MC_NVLINK_ALLOCATOR_CHUNK_SIZE sets the size of the chunks, 256 MiB by
+// default, and MC_NVLINK_ALLOCATOR_CACHE=0 creates and releases an
+// allocation per call instead.
+
+namespace {
+
+// Blocks up to this size are multiples of it, larger ones are rounded up to
+// a quarter of their power of two
+const size_t kMinBlockSize = 512;
+const size_t kSmallBlockSize = 4096;
+
+struct Block {
+    size_t size;
+    int device;
+    // Allocated on its own rather than carved out of a chunk
+    bool dedicated;
+};
+
+struct Chunk {
+    char *base = nullptr;
+    size_t size = 0;
+    size_t used = 0;
+};
+
+struct DeviceCache {
+    Chunk chunk;
+    // Freed blocks of the chunks by size class
+    std::unordered_map<size_t, std::vector<void *>> free_blocks;
+    // Freed dedicated allocations by size
+    std::multimap<size_t, void *> free_dedicated;
+};
+
+struct Allocator {
+    std::mutex mutex;
+    bool enabled = true;
+    size_t chunk_size = 256ull << 20;
+    std::unordered_map<int, DeviceCache> devices;
+    std::unordered_map<void *, Block> blocks;
+
+    Allocator() {
+        const char *cache_env = std::getenv("MC_NVLINK_ALLOCATOR_CACHE");
+        if (cache_env && std::string(cache_env) == "0") enabled = false;
+        const char *chunk_env = std::getenv("MC_NVLINK_ALLOCATOR_CHUNK_SIZE");
+        if (chunk_env) {
+            size_t val = strtoull(chunk_env, nullptr, 10);
+            if (val >= (2ull << 20))
+                chunk_size = val;
+            else
+                std::cerr << "Ignore value from environment variable "
+                             "MC_NVLINK_ALLOCATOR_CHUNK_SIZE\n";
+        }
+    }
+};
+
+Allocator &allocator() {
+    static Allocator *instance = new Allocator();
+    return *instance;
+}
+
+size_t sizeClass(size_t size) {
+    if (size <= kSmallBlockSize)
+        return size ? (size + kMinBlockSize - 1) & ~(kMinBlockSize - 1)
+                    : kMinBlockSize;
+    size_t power = 1ull << (63 - __builtin_clzll(size - 1));
+    size_t step = power / 4;
+    return (size + step - 1) & ~(step - 1);
+}
+
+// Create, map and grant every device access to fabric memory of at least
+// size bytes, rounded up to the allocation granularity in size
+void *createAllocation(size_t &size, int device) {
     size_t granularity = 0;
     CUdevice currentDev;
     CUmemAllocationProp prop = {};
     CUmemGenericAllocationHandle handle;
     void *ptr = nullptr;
-    int cudaDev;
     int flag = 0;
     CUresult result = cuDeviceGet(&currentDev, device);
     if (result != CUDA_SUCCESS) {
@@ -76,10 +158,9 @@ void *mc_nvlink_malloc(ssize_t size, int device, cudaStream_t stream) {
     return ptr;
 }
 
-void mc_nvlink_free(void *ptr, ssize_t ssize, int device, cudaStream_t stream) {
+void releaseAllocation(void *ptr) {
     CUmemGenericAllocationHandle handle;
     size_t size = 0;
-    if (!ptr) return;
     auto result = cuMemRetainAllocationHandle(&handle, ptr);
     if (result != CUDA_SUCCESS) {
         std::cerr << "cuMemRetainAllocationHandle failed: " << result << "\n";
@@ -90,6 +171,99 @@ void mc_nvlink_free(void *ptr, ssize_t ssize, int device, cudaStream_t stream) {
         cuMemUnmap((CUdeviceptr)ptr, size);
         cuMemAddressFree((CUdeviceptr)ptr, size);
     }
+    // Once for the retained handle, once for cuMemCreate
     cuMemRelease(handle);
+    cuMemRelease(handle);
+}
+
+void *allocateDedicated(Allocator &alloc, DeviceCache &cache, size_t size,
+                        int device) {
+    size_t rounded = sizeClass(size);
+    auto it = cache.free_dedicated.lower_bound(rounded);
+    // Reuse a freed allocation unless it wastes more than a quarter of it
+    if (it != cache.free_dedicated.end() &&
+        it->first - rounded <= it->first / 4) {
+        void *ptr = it->second;
+        cache.free_dedicated.erase(it);
+        return ptr;
+    }
+    void *ptr = createAllocation(rounded, device);
+    if (ptr) alloc.blocks[ptr] = {rounded, device, true};
+    return ptr;
+}
+
+void *allocateBlock(Allocator &alloc, DeviceCache &cache, size_t size,
+                    int device) {
+    size_t block_size = sizeClass(size);
+    auto &free_list = cache.free_blocks[block_size];
+    if (!free_list.empty()) {
+        void *ptr = free_list.back();
+        free_list.pop_back();
+        return ptr;
+    }
+    auto &chunk = cache.chunk;
+    if (!chunk.base || chunk.size - chunk.used < block_size) {
+        // The rest of the full chunk is left unused
+        size_t chunk_size = alloc.chunk_size;
+        void *base = createAllocation(chunk_size, device);
+        if (!base) return nullptr;
+        chunk.base = (char *)base;
+        chunk.size = chunk_size;
+        chunk.used = 0;
+    }
+    void *ptr = chunk.base + chunk.used;
+    chunk.used += block_size;
+    alloc.blocks[ptr] = {block_size, device, false};
+    return ptr;
+}
+
+}  // namespace
+
+extern "C" {
+void *mc_nvlink_malloc(ssize_t size, int device, cudaStream_t stream) {
+    auto &alloc = allocator();
+    if (!alloc.enabled) {
+        size_t rounded = size;
+        return createAllocation(rounded, device);
+    }
+    std::lock_guard<std::mutex> lock(alloc.mutex);
+    auto &cache = alloc.devices[device];
+    if ((size_t)size > alloc.chunk_size / 4)
+        return allocateDedicated(alloc, cache, size, device);
+    return allocateBlock(alloc, cache, size, device);
+}
+
+void mc_nvlink_free(void *ptr, ssize_t ssize, int device, cudaStream_t stream) {
+    if (!ptr) return;
+    auto &alloc = allocator();
+    if (!alloc.enabled) {
+        releaseAllocation(ptr);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(alloc.mutex);
+    auto it = alloc.blocks.find(ptr);
+    if (it == alloc.blocks.end()) {
+        std::cerr << "mc_nvlink_free: " << ptr
+                  << " was not allocated by mc_nvlink_malloc\n";
+        return;
+    }
+    auto &block = it->second;
+    auto &cache = alloc.devices[block.device];
+    if (block.dedicated)
+        cache.free_dedicated.emplace(block.size, ptr);
+    else
+        cache.free_blocks[block.size].push_back(ptr);
+}
+
+// Release the freed allocations of their own on device, the chunks are kept
+void mc_nvlink_empty_cache(int device) {
+    auto &alloc = allocator();
+    std::lock_guard<std::mutex> lock(alloc.mutex);
+    auto &cache = alloc.devices[device];
+    for (auto &entry : cache.free_dedicated) {
+        alloc.blocks.erase(entry.second);
+        releaseAllocation(entry.second);
+    }
+    cache.free_dedicated.clear();
 }
 }
@@ -134,15 +134,11 @@ fn initiator_worker(
 
         engine.submit_transfer(batch_id, &mut requests)?;
 
-        for task_id in 0..args.batch_size {
-            let mut completed = false;
-            while !completed {
-                let (status, _) = engine.get_transfer_status(batch_id, task_id as u64)?;
-                if status == TransferStatusEnum::Completed as i32
-                    || status == TransferStatusEnum::Failed as i32
-                {
-                    completed = true;
-                }
+        // One call for the whole batch rather than one per task
+        loop {
+            let (status, _) = engine.get_batch_transfer_status(batch_id)?;
+            if status != TransferStatusEnum::Waiting as i32 {
+                break;
             }
         }
 
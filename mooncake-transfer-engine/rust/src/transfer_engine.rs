@@ -28,8 +28,15 @@ mod bindings {
 
 use anyhow::{anyhow, bail, Result};
 use std::ffi::{c_void, CString};
+use std::os::unix::io::{AsRawFd, RawFd};
+use tokio::io::unix::AsyncFd;
+use tokio::io::Interest;
 type BatchID = u64;
 
+/// A request laid out as the C API takes it, so that a slice of them is
+/// submitted without being copied into another vector
+pub type RawTransferRequest = bindings::transfer_request_t;
+
 #[derive(Debug, Clone, Copy, PartialEq, Eq)]
 pub enum OpcodeEnum {
     Read = 0,
@@ -47,6 +54,20 @@ pub enum TransferStatusEnum {
     Failed,
 }
 
+impl TransferStatusEnum {
+    pub fn from_raw(status: i32) -> Self {
+        match status {
+            0 => TransferStatusEnum::Waiting,
+            1 => TransferStatusEnum::Pending,
+            3 => TransferStatusEnum::Canceled,
+            4 => TransferStatusEnum::Completed,
+            5 => TransferStatusEnum::Timeout,
+            6 => TransferStatusEnum::Failed,
+            _ => TransferStatusEnum::Invalid,
+        }
+    }
+}
+
 pub struct TransferRequest {
     pub opcode: OpcodeEnum,
     pub source: *mut c_void,
@@ -55,6 +76,63 @@ pub struct TransferRequest {
     pub length: u64,
 }
 
+impl TransferRequest {
+    pub fn to_raw(&self) -> RawTransferRequest {
+        RawTransferRequest {
+            opcode: self.opcode as i32,
+            source: self.source,
+            target_id: self.target_id,
+            target_offset: self.target_offset,
+            length: self.length,
+        }
+    }
+}
+
+/// The eventfd of a batch, which belongs to the engine
+struct BatchEventFd(RawFd);
+
+impl AsRawFd for BatchEventFd {
+    fn as_raw_fd(&self) -> RawFd {
+        self.0
+    }
+}
+
+/// Frees the batch of an async transfer, or cancels it and has it freed by
+/// the engine once done if the transfer future is dropped before
+struct BatchGuard<'a> {
+    engine: &'a TransferEngine,
+    batch_id: BatchID,
+    done: bool,
+}
+
+extern "C" fn free_batch_when_done(
+    batch_id: bindings::batch_id_t,
+    _status: bindings::transfer_status_t,
+    user_data: *mut c_void,
+) {
+    unsafe {
+        bindings::freeBatchID(user_data as bindings::transfer_engine_t, batch_id);
+    }
+}
+
+impl Drop for BatchGuard<'_> {
+    fn drop(&mut self) {
+        if self.done {
+            let _ = self.engine.free_batch_id(self.batch_id);
+            return;
+        }
+        unsafe {
+            bindings::cancelBatch(self.engine.engine, self.batch_id);
+            bindings::setBatchCallback(
+                self.engine.engine,
+                self.batch_id,
+                Some(free_batch_when_done),
+                self.engine.engine as *mut c_void,
+            );
+        }
+    }
+}
+
 pub struct BufferEntry {
     pub addr: *mut c_void,
     pub length: u64,
@@ -200,6 +278,75 @@ impl TransferEngine {
         }
     }
 
+    /// Submit requests as they are, without converting them
+    pub fn submit_transfer_raw(
+        &self,
+        batch_id: BatchID,
+        requests: &[RawTransferRequest],
+    ) -> Result<()> {
+        // The C API only reads the requests
+        let ret = unsafe {
+            bindings::submitTransfer(
+                self.engine,
+                batch_id,
+                requests.as_ptr() as *mut RawTransferRequest,
+                requests.len(),
+            )
+        };
+        if ret != 0 {
+            bail!("Failed to submit transfer")
+        } else {
+            Ok(())
+        }
+    }
+
+    /// Wait for the batch to be done, after its last submission, without
+    /// blocking the thread: the future is woken through the eventfd of the
+    /// batch. Returns the status of the batch and the bytes transferred.
+    pub async fn wait_batch(&self, batch_id: BatchID) -> Result<(TransferStatusEnum, u64)> {
+        let fd = self.get_batch_event_fd(batch_id)?;
+        let async_fd = AsyncFd::with_interest(BatchEventFd(fd), Interest::READABLE)?;
+        loop {
+            let (status, transferred_bytes) = self.get_batch_transfer_status(batch_id)?;
+            let status = TransferStatusEnum::from_raw(status);
+            if status != TransferStatusEnum::Waiting && status != TransferStatusEnum::Pending {
+                return Ok((status, transferred_bytes));
+            }
+            // The eventfd stays readable once written, so a wakeup before
+            // the status was read is not lost
+            let mut guard = async_fd.readable().await?;
+            guard.clear_ready();
+        }
+    }
+
+    /// Transfer requests in a batch of their own and wait for it as
+    /// wait_batch does. Dropping the future before it completes cancels the
+    /// batch, which the engine frees once done; the buffers must stay
+    /// valid until then.
+    pub async fn transfer(
+        &self,
+        requests: &[RawTransferRequest],
+    ) -> Result<(TransferStatusEnum, u64)> {
+        let batch_id = self.allocate_batch_id(requests.len())?;
+        let mut guard = BatchGuard {
+            engine: self,
+            batch_id,
+            done: false,
+        };
+        if let Err(err) = self.submit_transfer_raw(batch_id, requests) {
+            // The requests submitted before the failure may still run
+            unsafe {
+                bindings::cancelBatch(self.engine, batch_id);
+            }
+            let result = self.wait_batch(batch_id).await;
+            guard.done = result.is_ok();
+            return Err(err);
+        }
+        let result = self.wait_batch(batch_id).await;
+        guard.done = result.is_ok();
+        result
+    }
+
     pub fn get_transfer_status(&self, batch_id: BatchID, task_id: u64) -> Result<(i32, u64)> {
         let mut status = bindings::transfer_status_t {
             status: 0,
@@ -214,6 +361,31 @@ impl TransferEngine {
         }
     }
 
+    pub fn get_batch_transfer_status(&self, batch_id: BatchID) -> Result<(i32, u64)> {
+        let mut status = bindings::transfer_status_t {
+            status: 0,
+            transferred_bytes: 0,
+        };
+        let ret = unsafe { bindings::getBatchTransferStatus(self.engine, batch_id, &mut status) };
+        if ret != 0 {
+            bail!("Failed to get batch transfer status")
+        } else {
+            Ok((status.status, status.transferred_bytes))
+        }
+    }
+
+    /// An eventfd that becomes readable once the batch is done, to register
+    /// with an event loop instead of polling. It is closed by free_batch_id.
+    pub fn get_batch_event_fd(&self, batch_id: BatchID) -> Result<i32> {
+        let mut fd: i32 = -1;
+        let ret = unsafe { bindings::getBatchEventFd(self.engine, batch_id, &mut fd) };
+        if ret != 0 {
+            bail!("Failed to get batch event fd")
+        } else {
+            Ok(fd)
+        }
+    }
+
     pub fn free_batch_id(&self, batch_id: BatchID) -> Result<()> {
         let ret = unsafe { bindings::freeBatchID(self.engine, batch_id) };
         if ret != 0 {
@@ -0,0 +1,166 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "batch_notifier.h"
+
+#include <glog/logging.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace mooncake {
+
+BatchNotifier::BatchNotifier(std::shared_ptr<MultiTransport> transport)
+    : transport_(transport), waiting_(0), running_(true) {
+    worker_ = std::thread(&BatchNotifier::notifyWorker, this);
+}
+
+BatchNotifier::~BatchNotifier() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cond_.notify_all();
+    if (worker_.joinable()) worker_.join();
+    for (auto &entry : watches_)
+        if (entry.second.fd >= 0) close(entry.second.fd);
+}
+
+BatchNotifier::Watch *BatchNotifier::findWatch(BatchID batch_id) {
+    if (!Transport::getBatchDesc(batch_id)) return nullptr;
+    auto [it, inserted] = watches_.try_emplace(batch_id);
+    // Polled again, a done batch is reported at once
+    if (inserted || it->second.done) {
+        it->second.done = false;
+        waiting_++;
+    }
+    return &it->second;
+}
+
+Status BatchNotifier::setCallback(BatchID batch_id, Callback callback) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Watch *watch = findWatch(batch_id);
+        if (!watch) return Status::InvalidArgument("Invalid batch ID");
+        watch->callback = std::move(callback);
+    }
+    cond_.notify_one();
+    return Status::OK();
+}
+
+Status BatchNotifier::addCallback(BatchID batch_id, Callback callback) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Watch *watch = findWatch(batch_id);
+        if (!watch) return Status::InvalidArgument("Invalid batch ID");
+        watch->added_callbacks.push_back(std::move(callback));
+    }
+    cond_.notify_one();
+    return Status::OK();
+}
+
+Status BatchNotifier::getEventFd(BatchID batch_id, int &fd) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = watches_.find(batch_id);
+        if (it != watches_.end() && it->second.fd >= 0) {
+            fd = it->second.fd;
+            return Status::OK();
+        }
+        Watch *watch = findWatch(batch_id);
+        if (!watch) return Status::InvalidArgument("Invalid batch ID");
+        watch->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (watch->fd < 0) {
+            PLOG(ERROR) << "BatchNotifier: eventfd";
+            return Status::Socket("failed to create an eventfd");
+        }
+        fd = watch->fd;
+    }
+    cond_.notify_one();
+    return Status::OK();
+}
+
+void BatchNotifier::forget(BatchID batch_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = watches_.find(batch_id);
+    if (it == watches_.end()) return;
+    if (!it->second.done) waiting_--;
+    if (it->second.fd >= 0) close(it->second.fd);
+    watches_.erase(it);
+}
+
+void BatchNotifier::notifyWorker() {
+    std::vector<std::tuple<Callback, BatchID, TransferStatus>> fired;
+    while (true) {
+        BatchID first = Transport::INVALID_BATCH_ID;
+        uint32_t progress = 0;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [&] { return !running_ || waiting_; });
+            if (!running_) break;
+            for (auto it = watches_.begin(); it != watches_.end();) {
+                auto &watch = it->second;
+                if (watch.done) {
+                    ++it;
+                    continue;
+                }
+                // Taken before the status, so that no wakeup is lost
+                if (first == Transport::INVALID_BATCH_ID) {
+                    first = it->first;
+                    progress = Transport::getBatchProgress(first);
+                }
+                TransferStatus status;
+                Status s =
+                    transport_->getBatchTransferStatus(it->first, status);
+                if (!s.ok()) {
+                    // Freed without forget(), nobody is left to tell
+                    if (watch.fd >= 0) close(watch.fd);
+                    waiting_--;
+                    it = watches_.erase(it);
+                    continue;
+                }
+                if (status.s == Transport::TransferStatusEnum::WAITING) {
+                    ++it;
+                    continue;
+                }
+                watch.done = true;
+                waiting_--;
+                if (watch.fd >= 0) {
+                    uint64_t one = 1;
+                    if (write(watch.fd, &one, sizeof(one)) < 0)
+                        PLOG(ERROR) << "BatchNotifier: eventfd write";
+                }
+                if (watch.callback)
+                    fired.emplace_back(std::exchange(watch.callback, nullptr),
+                                       it->first, status);
+                for (auto &callback : watch.added_callbacks)
+                    fired.emplace_back(std::move(callback), it->first, status);
+                watch.added_callbacks.clear();
+                ++it;
+            }
+        }
+
+        // Outside the lock, callbacks may free their batch
+        for (auto &[callback, batch_id, status] : fired)
+            callback(batch_id, status);
+        if (fired.empty() && first != Transport::INVALID_BATCH_ID)
+            Transport::waitBatchProgress(first, progress, kPollTimeoutNs);
+        fired.clear();
+    }
+}
+
+}  // namespace mooncake
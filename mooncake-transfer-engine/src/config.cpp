@@ -17,6 +17,17 @@
 #include <dirent.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "error.h"
+#include "rate_limiter.h"
+
 namespace mooncake {
 void loadGlobalConfig(GlobalConfig &config) {
     const char *num_cq_per_ctx_env = std::getenv("MC_NUM_CQ_PER_CTX");
@@ -119,6 +130,16 @@ void loadGlobalConfig(GlobalConfig &config) {
                 << "Ignore value from environment variable MC_MAX_INLINE";
     }
 
+    const char *signal_interval_env = std::getenv("MC_SIGNAL_INTERVAL");
+    if (signal_interval_env) {
+        size_t val = atoi(signal_interval_env);
+        if (val > 0 && val <= UINT16_MAX)
+            config.signal_interval = val;
+        else
+            LOG(WARNING)
+                << "Ignore value from environment variable MC_SIGNAL_INTERVAL";
+    }
+
     const char *mtu_length_env = std::getenv("MC_MTU");
     if (mtu_length_env) {
         size_t val = atoi(mtu_length_env);
@@ -157,6 +178,52 @@ void loadGlobalConfig(GlobalConfig &config) {
                 << "Ignore value from environment variable MC_WORKERS_PER_CTX";
     }
 
+    const char *connect_workers_per_ctx_env =
+        std::getenv("MC_CONNECT_WORKERS_PER_CTX");
+    if (connect_workers_per_ctx_env) {
+        size_t val = atoi(connect_workers_per_ctx_env);
+        if (val > 0 && val <= 64)
+            config.connect_workers_per_ctx = val;
+        else
+            LOG(WARNING) << "Ignore value from environment variable "
+                            "MC_CONNECT_WORKERS_PER_CTX";
+    }
+
+    const char *mr_chunk_size_env = std::getenv("MC_MR_CHUNK_SIZE");
+    if (mr_chunk_size_env) {
+        size_t val = atoll(mr_chunk_size_env);
+        if (val == 0 || val >= (1ull << 20))
+            config.mr_chunk_size = val;
+        else
+            LOG(WARNING)
+                << "Ignore value from environment variable MC_MR_CHUNK_SIZE";
+    }
+
+    const char *rcache_size_env = std::getenv("MC_RCACHE_SIZE");
+    if (rcache_size_env) {
+        config.rcache_size = atoll(rcache_size_env);
+    }
+
+    const char *staging_buffers_env = std::getenv("MC_STAGING_BUFFERS");
+    if (staging_buffers_env) {
+        size_t val = atoi(staging_buffers_env);
+        if (val <= 1024)
+            config.staging_buffers = val;
+        else
+            LOG(WARNING) << "Ignore value from environment variable "
+                            "MC_STAGING_BUFFERS";
+    }
+
+    const char *staging_chunk_size_env = std::getenv("MC_STAGING_CHUNK_SIZE");
+    if (staging_chunk_size_env) {
+        size_t val = atoll(staging_chunk_size_env);
+        if (val >= 65536)
+            config.staging_chunk_size = val;
+        else
+            LOG(WARNING) << "Ignore value from environment variable "
+                            "MC_STAGING_CHUNK_SIZE";
+    }
+
     const char *slice_size_env = std::getenv("MC_SLICE_SIZE");
     if (slice_size_env) {
         size_t val = atoi(slice_size_env);
@@ -167,6 +234,18 @@ void loadGlobalConfig(GlobalConfig &config) {
                 << "Ignore value from environment variable MC_SLICE_SIZE";
     }
 
+    const char *max_slice_size_env = std::getenv("MC_MAX_SLICE_SIZE");
+    if (max_slice_size_env) {
+        size_t val = atoi(max_slice_size_env);
+        if (val > 0)
+            config.max_slice_size = val;
+        else
+            LOG(WARNING)
+                << "Ignore value from environment variable MC_MAX_SLICE_SIZE";
+    }
+    if (config.max_slice_size < config.slice_size)
+        config.max_slice_size = config.slice_size;
+
     const char *retry_cnt_env = std::getenv("MC_RETRY_CNT");
     if (retry_cnt_env) {
         size_t val = atoi(retry_cnt_env);
@@ -258,6 +337,249 @@ void loadGlobalConfig(GlobalConfig &config) {
     if (std::getenv("MC_ENABLE_DEST_DEVICE_AFFINITY")) {
         config.enable_dest_device_affinity = true;
     }
+
+    if (std::getenv("MC_ENABLE_MULTI_RAIL")) {
+        config.enable_multi_rail = true;
+    }
+
+    if (std::getenv("MC_ENABLE_ODP")) {
+        config.enable_odp = true;
+    }
+
+    if (std::getenv("MC_ENABLE_DC")) {
+#ifdef USE_MLX5_DC
+        config.enable_dc = true;
+#else
+        LOG(WARNING) << "Ignore environment variable MC_ENABLE_DC, DC "
+                        "transport is not built (USE_MLX5_DC)";
+#endif
+    }
+
+    const char *num_dci_env = std::getenv("MC_NUM_DCI_PER_CTX");
+    if (num_dci_env) {
+        size_t val = atoi(num_dci_env);
+        if (val > 0 && val <= 256)
+            config.num_dci_per_ctx = val;
+        else
+            LOG(WARNING)
+                << "Ignore value from environment variable MC_NUM_DCI_PER_CTX";
+    }
+
+    const char *tcp_worker_threads_env = std::getenv("MC_TCP_WORKER_THREADS");
+    if (tcp_worker_threads_env) {
+        int val = atoi(tcp_worker_threads_env);
+        if (val > 0 && val <= 64)
+            config.tcp_worker_threads = val;
+        else
+            LOG(WARNING) << "Ignore value from environment variable "
+                            "MC_TCP_WORKER_THREADS";
+    }
+
+    const char *tcp_connections_env =
+        std::getenv("MC_TCP_CONNECTIONS_PER_PEER");
+    if (tcp_connections_env) {
+        int val = atoi(tcp_connections_env);
+        if (val > 0 && val <= 256)
+            config.tcp_connections_per_peer = val;
+        else
+            LOG(WARNING) << "Ignore value from environment variable "
+                            "MC_TCP_CONNECTIONS_PER_PEER";
+    }
+
+    const char *tcp_slice_size_env = std::getenv("MC_TCP_SLICE_SIZE");
+    if (tcp_slice_size_env) {
+        size_t val = atoll(tcp_slice_size_env);
+        if (val >= 65536)
+            config.tcp_slice_size = val;
+        else
+            LOG(WARNING)
+                << "Ignore value from environment variable MC_TCP_SLICE_SIZE";
+    }
+
+    if (std::getenv("MC_TCP_ZEROCOPY")) {
+        config.tcp_zerocopy = true;
+    }
+
+    const char *loopback_threads_env = std::getenv("MC_LOOPBACK_THREADS");
+    if (loopback_threads_env) {
+        int val = atoi(loopback_threads_env);
+        if (val >= 0 && val <= 64)
+            config.loopback_threads = val;
+        else
+            LOG(WARNING) << "Ignore value from environment variable "
+                            "MC_LOOPBACK_THREADS";
+    }
+
+    const char *nvlink_streams_env = std::getenv("MC_NVLINK_STREAMS_PER_PAIR");
+    if (nvlink_streams_env) {
+        size_t val = atoi(nvlink_streams_env);
+        if (val > 0 && val <= 64)
+            config.nvlink_streams_per_pair = val;
+        else
+            LOG(WARNING) << "Ignore value from environment variable "
+                            "MC_NVLINK_STREAMS_PER_PAIR";
+    }
+
+    const char *nvlink_mappings_env = std::getenv("MC_NVLINK_MAX_MAPPINGS");
+    if (nvlink_mappings_env) {
+        size_t val = atoi(nvlink_mappings_env);
+        if (val > 0)
+            config.nvlink_max_mappings = val;
+        else
+            LOG(WARNING) << "Ignore value from environment variable "
+                            "MC_NVLINK_MAX_MAPPINGS";
+    }
+
+    const char *nvmeof_queue_depth_env = std::getenv("MC_NVMEOF_QUEUE_DEPTH");
+    if (nvmeof_queue_depth_env) {
+        size_t val = atoi(nvmeof_queue_depth_env);
+        if (val > 0 && val <= 128)
+            config.nvmeof_queue_depth = val;
+        else
+            LOG(WARNING) << "Ignore value from environment variable "
+                            "MC_NVMEOF_QUEUE_DEPTH";
+    }
+
+    const char *cxl_workers_env = std::getenv("MC_CXL_WORKERS");
+    if (cxl_workers_env) {
+        int val = atoi(cxl_workers_env);
+        if (val > 0 && val <= 64)
+            config.cxl_workers = val;
+        else
+            LOG(WARNING) << "Ignore value from environment variable "
+                            "MC_CXL_WORKERS";
+    }
+
+    if (std::getenv("MC_ENABLE_SHM")) {
+        config.enable_shm = true;
+    }
+
+    const char *hccl_streams_env = std::getenv("MC_HCCL_STREAMS");
+    if (hccl_streams_env) {
+        int val = atoi(hccl_streams_env);
+        if (val > 0 && val <= 32)
+            config.hccl_streams = val;
+        else
+            LOG(WARNING) << "Ignore value from environment variable "
+                            "MC_HCCL_STREAMS";
+    }
+
+    const char *hccl_chunk_size_env = std::getenv("MC_HCCL_CHUNK_SIZE");
+    if (hccl_chunk_size_env) {
+        size_t val = atoll(hccl_chunk_size_env);
+        if (val > 0)
+            config.hccl_chunk_size = val;
+        else
+            LOG(WARNING) << "Ignore value from environment variable "
+                            "MC_HCCL_CHUNK_SIZE";
+    }
+
+    const char *hccl_merge_size_env = std::getenv("MC_HCCL_MERGE_SIZE");
+    if (hccl_merge_size_env)
+        config.hccl_merge_size = atoll(hccl_merge_size_env);
+
+    if (std::getenv("MC_TCP_FALLBACK")) {
+        config.tcp_fallback = true;
+    }
+
+    if (std::getenv("MC_COMPACT_METADATA")) {
+        config.compact_metadata = true;
+    }
+
+    if (std::getenv("MC_DISABLE_METADATA_WATCH")) {
+        config.metadata_watch = false;
+    }
+
+    if (std::getenv("MC_PEER_METADATA")) {
+        config.peer_metadata = true;
+    }
+
+    if (std::getenv("MC_INBAND_NOTIFY")) {
+        config.inband_notify = true;
+    }
+
+    const char *traffic_class_weights_env =
+        std::getenv("MC_TRAFFIC_CLASS_WEIGHTS");
+    if (traffic_class_weights_env) {
+        int latency, normal, background;
+        if (sscanf(traffic_class_weights_env, "%d,%d,%d", &latency, &normal,
+                   &background) == 3 &&
+            latency > 0 && normal > 0 && background > 0) {
+            config.traffic_class_weights[0] = latency;
+            config.traffic_class_weights[1] = normal;
+            config.traffic_class_weights[2] = background;
+        } else {
+            LOG(WARNING) << "Ignore value from environment variable "
+                            "MC_TRAFFIC_CLASS_WEIGHTS";
+        }
+    }
+
+    const char *adaptive_poll_env = std::getenv("MC_ADAPTIVE_POLL_US");
+    if (adaptive_poll_env) {
+        int val = atoi(adaptive_poll_env);
+        if (val >= 0)
+            config.adaptive_poll_us = val;
+        else
+            LOG(WARNING) << "Ignore value from environment variable "
+                            "MC_ADAPTIVE_POLL_US";
+    }
+
+    if (std::getenv("MC_AUTO_TUNE_WORKERS")) {
+        config.auto_tune_workers = true;
+    }
+
+    // A CPU list such as "0-7,16"
+    const char *reserved_cpus_env = std::getenv("MC_RESERVED_CPUS");
+    if (reserved_cpus_env) {
+        std::vector<int> cpus;
+        bool valid = true;
+        std::stringstream ss(reserved_cpus_env);
+        std::string range;
+        while (valid && std::getline(ss, range, ',')) {
+            int first, last;
+            int n = sscanf(range.c_str(), "%d-%d", &first, &last);
+            if (n == 1) last = first;
+            valid = n >= 1 && first >= 0 && first <= last;
+            for (int cpu = first; valid && cpu <= last; ++cpu)
+                cpus.push_back(cpu);
+        }
+        if (valid)
+            config.reserved_cpus = std::move(cpus);
+        else
+            LOG(WARNING) << "Ignore value from environment variable "
+                            "MC_RESERVED_CPUS";
+    }
+
+    const char *endpoint_keepalive_env =
+        std::getenv("MC_ENDPOINT_KEEPALIVE_MS");
+    if (endpoint_keepalive_env) {
+        int val = atoi(endpoint_keepalive_env);
+        if (val >= 0)
+            config.endpoint_keepalive_ms = val;
+        else
+            LOG(WARNING) << "Ignore value from environment variable "
+                            "MC_ENDPOINT_KEEPALIVE_MS";
+    }
+
+    if (std::getenv("MC_WEIGHTED_ENDPOINT_STORE")) {
+        config.weighted_endpoint_store = true;
+    }
+
+    if (std::getenv("MC_INCAST_CONTROL")) {
+        config.incast_control = true;
+    }
+
+    const char *incast_inbound_rate_env =
+        std::getenv("MC_INCAST_INBOUND_RATE");
+    if (incast_inbound_rate_env) {
+        char *end = nullptr;
+        unsigned long long val = strtoull(incast_inbound_rate_env, &end, 10);
+        if (end != incast_inbound_rate_env && *end == '\0')
+            config.incast_inbound_rate = val;
+        else
+            LOG(WARNING) << "Ignore value from environment variable "
+                            "MC_INCAST_INBOUND_RATE";
+    }
 }
 
 std::string mtuLengthToString(ibv_mtu mtu) {
@@ -274,6 +596,9 @@ std::string mtuLengthToString(ibv_mtu mtu) {
 }
 
 void updateGlobalConfig(ibv_device_attr &device_attr) {
+    // Devices are opened concurrently
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
     auto &config = globalConfig();
     if (config.max_ep_per_ctx * config.num_qp_per_ep >
         (size_t)device_attr.max_qp)
@@ -305,15 +630,84 @@ void dumpGlobalConfig() {
     LOG(INFO) << "max_sge = " << config.max_sge;
     LOG(INFO) << "max_wr = " << config.max_wr;
     LOG(INFO) << "max_inline = " << config.max_inline;
+    LOG(INFO) << "signal_interval = " << config.signal_interval;
     LOG(INFO) << "mtu_length = " << mtuLengthToString(config.mtu_length);
 }
 
+static std::mutex g_snapshot_mutex;
+static std::atomic<const GlobalConfig *> g_snapshot{nullptr};
+// Replaced snapshots may still be in use by readers, so they are never freed.
+// Updates are rare enough for that not to matter.
+static std::vector<std::unique_ptr<GlobalConfig>> g_snapshot_list;
+
+static void publishSnapshot(const GlobalConfig &config) {
+    g_snapshot_list.emplace_back(new GlobalConfig(config));
+    g_snapshot.store(g_snapshot_list.back().get(), std::memory_order_release);
+}
+
 GlobalConfig &globalConfig() {
     static GlobalConfig config;
     static std::once_flag g_once_flag;
-    std::call_once(g_once_flag, []() { loadGlobalConfig(config); });
+    std::call_once(g_once_flag, []() {
+        loadGlobalConfig(config);
+        std::lock_guard<std::mutex> lock(g_snapshot_mutex);
+        publishSnapshot(config);
+    });
     return config;
 }
 
+const GlobalConfig &configSnapshot() {
+    auto snapshot = g_snapshot.load(std::memory_order_acquire);
+    if (snapshot) return *snapshot;
+    globalConfig();
+    return *g_snapshot.load(std::memory_order_acquire);
+}
+
+int updateConfigOption(const std::string &name, const std::string &value) {
+    if (name == "rate_limits") {
+        int ret = RateLimiter::setRules(value);
+        if (!ret) LOG(INFO) << "Config option " << name << " set to " << value;
+        return ret;
+    }
+    globalConfig();
+    std::lock_guard<std::mutex> lock(g_snapshot_mutex);
+    GlobalConfig config = *g_snapshot.load(std::memory_order_relaxed);
+    char *end = nullptr;
+    long long val = strtoll(value.c_str(), &end, 10);
+    bool is_number = !value.empty() && *end == '\0';
+    if (name == "slice_size" && is_number && val > 0) {
+        config.slice_size = val;
+        if (config.max_slice_size < config.slice_size)
+            config.max_slice_size = config.slice_size;
+    } else if (name == "max_slice_size" && is_number && val > 0) {
+        config.max_slice_size = std::max((size_t)val, config.slice_size);
+    } else if (name == "retry_cnt" && is_number && val > 0 && val < 128) {
+        config.retry_cnt = val;
+    } else if (name == "fragment_limit" && is_number && val >= 0) {
+        config.fragment_limit = val;
+    } else if (name == "slice_timeout" && is_number) {
+        config.slice_timeout = val;
+    } else if (name == "tcp_slice_size" && is_number && val > 0) {
+        config.tcp_slice_size = val;
+    } else if (name == "traffic_class_weights") {
+        int latency, normal, background;
+        if (sscanf(value.c_str(), "%d,%d,%d", &latency, &normal,
+                   &background) != 3 ||
+            latency <= 0 || normal <= 0 || background <= 0) {
+            LOG(ERROR) << "Invalid value of traffic_class_weights: " << value;
+            return ERR_INVALID_ARGUMENT;
+        }
+        config.traffic_class_weights[0] = latency;
+        config.traffic_class_weights[1] = normal;
+        config.traffic_class_weights[2] = background;
+    } else {
+        LOG(ERROR) << "Cannot set config option " << name << " to " << value;
+        return ERR_INVALID_ARGUMENT;
+    }
+    publishSnapshot(config);
+    LOG(INFO) << "Config option " << name << " set to " << value;
+    return 0;
+}
+
 uint16_t getDefaultHandshakePort() { return globalConfig().handshake_port; }
 }  // namespace mooncake
\ No newline at end of file
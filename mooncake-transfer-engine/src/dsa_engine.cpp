@@ -0,0 +1,286 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "dsa_engine.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#include <linux/idxd.h>
+#endif
+
+namespace mooncake {
+
+#if defined(__x86_64__)
+
+namespace {
+
+const size_t kPortalSize = 4096;
+// Batches a thread keeps in flight on the device
+const size_t kMaxInflightBatches = 4;
+const size_t kMaxBatchSize = 32;
+
+static_assert(sizeof(dsa_hw_desc) == 64, "unexpected DSA descriptor size");
+static_assert(sizeof(dsa_completion_record) == 32,
+              "unexpected DSA completion record size");
+
+// Descriptors and completion records of one batch. Descriptors must be 64
+// byte aligned and completion records 32 byte aligned.
+struct alignas(64) Batch {
+    dsa_hw_desc batch_desc;
+    dsa_hw_desc descs[kMaxBatchSize];
+    alignas(32) dsa_completion_record batch_comp;
+    dsa_completion_record comps[kMaxBatchSize];
+    const DsaEngine::Operation *ops;
+    size_t count;
+};
+
+__attribute__((target("movdir64b"))) void movdir64b(void *portal,
+                                                    const void *desc) {
+    _movdir64b(portal, desc);
+}
+
+__attribute__((target("enqcmd"))) bool enqcmd(void *portal,
+                                              const void *desc) {
+    // Zero when the work queue accepted the descriptor
+    return _enqcmd(portal, desc) == 0;
+}
+
+bool cpuSupports(int ecx_bit) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return false;
+    return ecx & (1u << ecx_bit);
+}
+
+std::string readSysfs(const std::string &wq, const std::string &attr) {
+    std::ifstream file("/sys/bus/dsa/devices/" + wq + "/" + attr);
+    std::string value;
+    if (file) std::getline(file, value);
+    return value;
+}
+
+void prepareMemmove(dsa_hw_desc &desc, dsa_completion_record &comp,
+                    const DsaEngine::Operation &op) {
+    memset(&desc, 0, sizeof(desc));
+    memset(&comp, 0, sizeof(comp));
+    desc.opcode = DSA_OPCODE_MEMMOVE;
+    // Without IDXD_OP_FLAG_CC the destination is written to memory rather
+    // than the cache, like non-temporal stores
+    desc.flags = IDXD_OP_FLAG_CRAV | IDXD_OP_FLAG_RCR;
+    desc.completion_addr = (uint64_t)&comp;
+    desc.src_addr = (uint64_t)op.src;
+    desc.dst_addr = (uint64_t)op.dest;
+    desc.xfer_size = op.length;
+}
+
+void waitCompletion(const dsa_completion_record &comp) {
+    while (!comp.status) _mm_pause();
+}
+
+// Copy what the device left undone of op on the CPU
+void completeOperation(const dsa_completion_record &comp,
+                       const DsaEngine::Operation &op) {
+    uint8_t status = comp.status & DSA_COMP_STATUS_MASK;
+    if (status == DSA_COMP_SUCCESS) return;
+    size_t done = status == DSA_COMP_PAGE_FAULT_NOBOF
+                      ? std::min<size_t>(comp.bytes_completed, op.length)
+                      : 0;
+    VLOG(1) << "DsaEngine: operation of " << op.length
+            << " bytes completed with status " << (int)status << " after "
+            << done << " bytes, copying the rest on the CPU";
+    memcpy((char *)op.dest + done, (const char *)op.src + done,
+           op.length - done);
+}
+
+}  // namespace
+
+DsaEngine *DsaEngine::get() {
+    static std::unique_ptr<DsaEngine> engine = []() {
+        std::unique_ptr<DsaEngine> engine;
+        const char *path = std::getenv("MC_DSA_WQ");
+        if (!path) return engine;
+        engine.reset(new DsaEngine());
+        if (engine->open(path)) {
+            LOG(WARNING) << "DsaEngine: cannot use work queue " << path
+                         << ", copying on the CPU";
+            engine.reset();
+            return engine;
+        }
+        const char *min_size_env = std::getenv("MC_DSA_MIN_SIZE");
+        if (min_size_env) {
+            size_t val = atoll(min_size_env);
+            if (val > 0)
+                engine->min_size_ = val;
+            else
+                LOG(WARNING) << "Ignore value from environment variable "
+                                "MC_DSA_MIN_SIZE";
+        }
+        return engine;
+    }();
+    return engine.get();
+}
+
+int DsaEngine::open(const std::string &path) {
+    auto wq = path.substr(path.find_last_of('/') + 1);
+    auto mode = readSysfs(wq, "mode");
+    if (mode.empty()) {
+        LOG(ERROR) << "DsaEngine: work queue " << wq << " not found in sysfs";
+        return -1;
+    }
+    dedicated_ = mode == "dedicated";
+    // Dedicated work queues take MOVDIR64B, shared ones ENQCMD
+    if (!cpuSupports(dedicated_ ? 28 : 29)) {
+        LOG(ERROR) << "DsaEngine: CPU cannot submit to " << mode
+                   << " work queue " << wq;
+        return -1;
+    }
+
+    int size = atoi(readSysfs(wq, "size").c_str());
+    if (size <= 0) {
+        LOG(ERROR) << "DsaEngine: work queue " << wq << " is not configured";
+        return -1;
+    }
+    credits_ = size;
+    size_t max_batch_size = atoll(readSysfs(wq, "max_batch_size").c_str());
+    if (max_batch_size)
+        max_batch_size_ = std::min(max_batch_size, kMaxBatchSize);
+    size_t max_transfer_size =
+        atoll(readSysfs(wq, "max_transfer_size").c_str());
+    if (max_transfer_size) max_transfer_size_ = max_transfer_size;
+
+    fd_ = ::open(path.c_str(), O_RDWR);
+    if (fd_ < 0) {
+        PLOG(ERROR) << "DsaEngine: failed to open " << path;
+        return -1;
+    }
+    void *portal = mmap(nullptr, kPortalSize, PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd_, 0);
+    if (portal == MAP_FAILED) {
+        PLOG(ERROR) << "DsaEngine: failed to map the portal of " << path;
+        return -1;
+    }
+    portal_ = portal;
+    LOG(INFO) << "DsaEngine: using " << mode << " work queue " << wq
+              << " of size " << size << ", max batch size "
+              << max_batch_size_ << ", max transfer size "
+              << max_transfer_size_;
+    return 0;
+}
+
+DsaEngine::~DsaEngine() {
+    if (portal_) munmap(portal_, kPortalSize);
+    if (fd_ >= 0) close(fd_);
+}
+
+bool DsaEngine::submit(const void *desc) {
+    // Descriptors must be visible before the portal write
+    _mm_sfence();
+    if (dedicated_) {
+        if (credits_.fetch_sub(1) <= 0) {
+            credits_.fetch_add(1);
+            return false;
+        }
+        movdir64b(portal_, desc);
+        return true;
+    }
+    for (int retry = 0; retry < 64; ++retry) {
+        if (enqcmd(portal_, desc)) return true;
+        _mm_pause();
+    }
+    return false;
+}
+
+void DsaEngine::copy(const std::vector<Operation> &operations) {
+    std::vector<Operation> pieces;
+    for (auto &op : operations) {
+        for (size_t offset = 0; offset < op.length;
+             offset += max_transfer_size_) {
+            pieces.push_back(
+                {(char *)op.dest + offset, (const char *)op.src + offset,
+                 std::min(max_transfer_size_, op.length - offset)});
+        }
+    }
+
+    thread_local std::unique_ptr<Batch[]> batches(
+        new Batch[kMaxInflightBatches]);
+    size_t head = 0, inflight = 0, next = 0;
+    while (next < pieces.size() || inflight) {
+        if (next < pieces.size() && inflight < kMaxInflightBatches) {
+            auto &batch = batches[(head + inflight) % kMaxInflightBatches];
+            batch.ops = &pieces[next];
+            batch.count = std::min(max_batch_size_, pieces.size() - next);
+            next += batch.count;
+            for (size_t i = 0; i < batch.count; ++i)
+                prepareMemmove(batch.descs[i], batch.comps[i], batch.ops[i]);
+            const void *desc = &batch.descs[0];
+            if (batch.count > 1) {
+                // A batch takes a single work queue entry
+                memset(&batch.batch_desc, 0, sizeof(batch.batch_desc));
+                memset(&batch.batch_comp, 0, sizeof(batch.batch_comp));
+                batch.batch_desc.opcode = DSA_OPCODE_BATCH;
+                batch.batch_desc.flags = IDXD_OP_FLAG_CRAV | IDXD_OP_FLAG_RCR;
+                batch.batch_desc.completion_addr = (uint64_t)&batch.batch_comp;
+                batch.batch_desc.desc_list_addr = (uint64_t)batch.descs;
+                batch.batch_desc.desc_count = batch.count;
+                desc = &batch.batch_desc;
+            }
+            if (submit(desc)) {
+                inflight++;
+            } else {
+                for (size_t i = 0; i < batch.count; ++i)
+                    memcpy(batch.ops[i].dest, batch.ops[i].src,
+                           batch.ops[i].length);
+            }
+            continue;
+        }
+
+        auto &batch = batches[head];
+        waitCompletion(batch.count > 1 ? batch.batch_comp : batch.comps[0]);
+        if (dedicated_) credits_.fetch_add(1);
+        // Each descriptor of a batch has completed once the batch has
+        for (size_t i = 0; i < batch.count; ++i)
+            completeOperation(batch.comps[i], batch.ops[i]);
+        head = (head + 1) % kMaxInflightBatches;
+        inflight--;
+    }
+}
+
+#else
+
+DsaEngine *DsaEngine::get() { return nullptr; }
+
+DsaEngine::~DsaEngine() {}
+
+int DsaEngine::open(const std::string &path) { return -1; }
+
+bool DsaEngine::submit(const void *desc) { return false; }
+
+void DsaEngine::copy(const std::vector<Operation> &operations) {
+    for (auto &op : operations) memcpy(op.dest, op.src, op.length);
+}
+
+#endif
+
+}  // namespace mooncake
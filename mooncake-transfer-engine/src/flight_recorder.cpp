@@ -0,0 +1,330 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "flight_recorder.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mooncake {
+
+namespace {
+
+uint64_t readTsc() {
+#if defined(__x86_64__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t value;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+    return value;
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+// Slots are written under a sequence number, odd while the slot is being
+// written, so that a reader can tell a torn read
+struct Slot {
+    std::atomic<uint64_t> seq{0};
+    std::atomic<uint64_t> tsc{0};
+    std::atomic<uint64_t> event{0};
+    std::atomic<uint64_t> id{0};
+    std::atomic<uint64_t> arg0{0};
+    std::atomic<uint64_t> arg1{0};
+};
+
+struct Ring {
+    explicit Ring(size_t capacity)
+        : mask(capacity - 1),
+          slots(new Slot[capacity]),
+          tid(static_cast<int>(syscall(SYS_gettid))) {}
+
+    const size_t mask;
+    const std::unique_ptr<Slot[]> slots;
+    const int tid;
+    // Events recorded so far, only written by the owning thread
+    std::atomic<uint64_t> head{0};
+};
+
+struct Event {
+    uint64_t tsc;
+    int tid;
+    FlightEvent event;
+    uint64_t id;
+    uint64_t arg0;
+    uint64_t arg1;
+};
+
+size_t ringCapacity() {
+    size_t capacity = 4096;
+    const char *env = std::getenv("MC_FLIGHT_RECORDER_EVENTS");
+    if (env) {
+        long value = atol(env);
+        if (value > 0 && value <= (1l << 24))
+            capacity = value;
+        else
+            LOG(WARNING) << "Ignore value from environment variable "
+                            "MC_FLIGHT_RECORDER_EVENTS: "
+                         << env;
+    }
+    // A power of two, so that positions wrap with a mask
+    size_t rounded = 1;
+    while (rounded < capacity) rounded <<= 1;
+    return rounded;
+}
+
+bool enabledFromEnv() {
+    const char *env = std::getenv("MC_FLIGHT_RECORDER");
+    return !env || std::string(env) != "0";
+}
+
+class Registry {
+   public:
+    static Registry &instance() {
+        static Registry *registry = new Registry();
+        return *registry;
+    }
+
+    std::shared_ptr<Ring> add() {
+        auto ring = std::make_shared<Ring>(capacity_);
+        std::lock_guard<std::mutex> lock(mutex_);
+        rings_.push_back(ring);
+        return ring;
+    }
+
+    void remove(const Ring *ring) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        rings_.erase(std::remove_if(rings_.begin(), rings_.end(),
+                                    [ring](const std::shared_ptr<Ring> &r) {
+                                        return r.get() == ring;
+                                    }),
+                     rings_.end());
+    }
+
+    std::vector<std::shared_ptr<Ring>> rings() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return rings_;
+    }
+
+    // TSC and clocks when the registry was created, to date the events
+    const uint64_t start_tsc = readTsc();
+    const std::chrono::steady_clock::time_point start_steady =
+        std::chrono::steady_clock::now();
+    const std::chrono::system_clock::time_point start_system =
+        std::chrono::system_clock::now();
+
+   private:
+    Registry() : capacity_(ringCapacity()) {}
+
+    const size_t capacity_;
+    std::mutex mutex_;
+    std::vector<std::shared_ptr<Ring>> rings_;
+};
+
+struct ThreadRing {
+    ThreadRing() : ring(Registry::instance().add()) {}
+    ~ThreadRing() { Registry::instance().remove(ring.get()); }
+    std::shared_ptr<Ring> ring;
+};
+
+std::string formatEvent(const Event &event, double ticks_per_ns) {
+    auto &registry = Registry::instance();
+    const int64_t offset_ns = static_cast<int64_t>(
+        (static_cast<double>(event.tsc) -
+         static_cast<double>(registry.start_tsc)) /
+        ticks_per_ns);
+    const auto when =
+        registry.start_system + std::chrono::nanoseconds(offset_ns);
+    const auto since_epoch =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            when.time_since_epoch())
+            .count();
+    const time_t seconds = since_epoch / 1000000;
+    struct tm tm;
+    localtime_r(&seconds, &tm);
+    char line[192];
+    snprintf(line, sizeof(line),
+             "%02d:%02d:%02d.%06lld tid=%d %s id=%llu arg0=%llu arg1=%llu\n",
+             tm.tm_hour, tm.tm_min, tm.tm_sec,
+             static_cast<long long>(since_epoch % 1000000), event.tid,
+             flightEventName(event.event),
+             static_cast<unsigned long long>(event.id),
+             static_cast<unsigned long long>(event.arg0),
+             static_cast<unsigned long long>(event.arg1));
+    return line;
+}
+
+int signal_pipe[2] = {-1, -1};
+
+void onSignal(int) {
+    const int saved_errno = errno;
+    char byte = 0;
+    if (write(signal_pipe[1], &byte, 1) < 0) {
+        // Nothing to do in a signal handler
+    }
+    errno = saved_errno;
+}
+
+}  // namespace
+
+std::atomic<bool> FlightRecorder::enabled_{enabledFromEnv()};
+
+const char *flightEventName(FlightEvent event) {
+    switch (event) {
+        case FlightEvent::kSubmit:
+            return "submit";
+        case FlightEvent::kPost:
+            return "post";
+        case FlightEvent::kComplete:
+            return "complete";
+        case FlightEvent::kRetry:
+            return "retry";
+        case FlightEvent::kFail:
+            return "fail";
+        case FlightEvent::kEndpoint:
+            return "endpoint";
+        case FlightEvent::kTimeout:
+            return "timeout";
+    }
+    return "unknown";
+}
+
+void FlightRecorder::recordSlow(FlightEvent event, uint64_t id, uint64_t arg0,
+                                uint64_t arg1) {
+    thread_local ThreadRing thread_ring;
+    Ring &ring = *thread_ring.ring;
+    const uint64_t pos = ring.head.load(std::memory_order_relaxed);
+    Slot &slot = ring.slots[pos & ring.mask];
+    slot.seq.store(2 * pos + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.tsc.store(readTsc(), std::memory_order_relaxed);
+    slot.event.store(static_cast<uint64_t>(event), std::memory_order_relaxed);
+    slot.id.store(id, std::memory_order_relaxed);
+    slot.arg0.store(arg0, std::memory_order_relaxed);
+    slot.arg1.store(arg1, std::memory_order_relaxed);
+    slot.seq.store(2 * pos + 2, std::memory_order_release);
+    ring.head.store(pos + 1, std::memory_order_release);
+}
+
+std::string FlightRecorder::dump(size_t max_events_per_thread) {
+    auto &registry = Registry::instance();
+    std::vector<Event> events;
+    for (auto &ring : registry.rings()) {
+        const uint64_t head = ring->head.load(std::memory_order_acquire);
+        const uint64_t kept = std::min<uint64_t>(
+            std::min<uint64_t>(head, ring->mask + 1), max_events_per_thread);
+        for (uint64_t pos = head - kept; pos < head; ++pos) {
+            const Slot &slot = ring->slots[pos & ring->mask];
+            const uint64_t seq = slot.seq.load(std::memory_order_acquire);
+            if (seq != 2 * pos + 2) continue;
+            Event event;
+            event.tsc = slot.tsc.load(std::memory_order_relaxed);
+            event.tid = ring->tid;
+            event.event = static_cast<FlightEvent>(
+                slot.event.load(std::memory_order_relaxed));
+            event.id = slot.id.load(std::memory_order_relaxed);
+            event.arg0 = slot.arg0.load(std::memory_order_relaxed);
+            event.arg1 = slot.arg1.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            // Overwritten by the thread meanwhile
+            if (slot.seq.load(std::memory_order_relaxed) != seq) continue;
+            events.push_back(event);
+        }
+    }
+    std::sort(events.begin(), events.end(),
+              [](const Event &a, const Event &b) { return a.tsc < b.tsc; });
+
+    // Ticks of the TSC per nanosecond, measured since the registry started
+    const int64_t elapsed_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - registry.start_steady)
+            .count();
+    const uint64_t elapsed_ticks = readTsc() - registry.start_tsc;
+    const double ticks_per_ns =
+        elapsed_ns > 1000000 && elapsed_ticks > 0
+            ? static_cast<double>(elapsed_ticks) / elapsed_ns
+            : 1.0;
+
+    std::string out;
+    for (const auto &event : events) out += formatEvent(event, ticks_per_ns);
+    return out;
+}
+
+void FlightRecorder::dumpToLog(const std::string &reason) {
+    static std::atomic<int64_t> last_dump_ns{0};
+    const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now().time_since_epoch())
+                            .count();
+    int64_t last = last_dump_ns.load(std::memory_order_relaxed);
+    const int64_t kIntervalNs = 10ll * 1000 * 1000 * 1000;
+    if ((last && now - last < kIntervalNs) ||
+        !last_dump_ns.compare_exchange_strong(last, now,
+                                              std::memory_order_relaxed))
+        return;
+    if (!enabled_.load(std::memory_order_relaxed)) return;
+    LOG(ERROR) << "Recent transfer events before " << reason << ":\n"
+               << dump(256);
+}
+
+void FlightRecorder::installSignalHandler(int signo) {
+    static std::once_flag once;
+    std::call_once(once, [signo] {
+        struct sigaction old_action;
+        if (sigaction(signo, nullptr, &old_action) ||
+            old_action.sa_handler != SIG_DFL) {
+            LOG(INFO) << "Signal " << signo
+                      << " is handled by the application, transfer events "
+                         "are not dumped on it";
+            return;
+        }
+        if (pipe2(signal_pipe, O_CLOEXEC)) {
+            PLOG(WARNING) << "Failed to create the pipe of the flight recorder";
+            return;
+        }
+        std::thread([] {
+            char byte;
+            while (true) {
+                ssize_t n = read(signal_pipe[0], &byte, 1);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) break;
+                LOG(ERROR) << "Recent transfer events on signal:\n" << dump();
+            }
+        }).detach();
+        struct sigaction action = {};
+        action.sa_handler = onSignal;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        sigaction(signo, &action, nullptr);
+    });
+}
+
+}  // namespace mooncake
@@ -14,6 +14,12 @@
 
 #include "memory_location.h"
 
+#include <numaif.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
 #ifdef USE_CUDA
 #include <cuda_runtime.h>
 #endif
@@ -27,6 +33,37 @@ std::string genCpuNodeName(int node) {
     return kWildcardLocation;
 }
 
+namespace {
+
+// Pages between the samples of the first pass, those of a huge page
+const size_t kSampleStride = 512;
+// Pages probed by one call, which bounds the arrays it needs
+const size_t kProbeBatch = 65536;
+
+// Whether the pages at addr are interleaved over several nodes
+bool isInterleaved(void *addr) {
+    int mode = 0;
+    if (get_mempolicy(&mode, nullptr, 0, addr, MPOL_F_ADDR)) return false;
+    if (mode == MPOL_INTERLEAVE) return true;
+#ifdef MPOL_WEIGHTED_INTERLEAVE
+    if (mode == MPOL_WEIGHTED_INTERLEAVE) return true;
+#endif
+    return false;
+}
+
+// Fill status with the nodes of count pages, stride pages apart from page
+// first after aligned_start, or -errno for the pages not on any
+int probePages(uintptr_t aligned_start, size_t first, size_t stride,
+               size_t count, std::vector<int> &status) {
+    std::vector<void *> pages(count);
+    status.resize(count);
+    for (size_t i = 0; i < count; ++i)
+        pages[i] = (void *)(aligned_start + (first + i * stride) * pagesize);
+    return numa_move_pages(0, count, pages.data(), nullptr, status.data(), 0);
+}
+
+}  // namespace
+
 std::string genGpuNodeName(int node) {
     if (node >= 0) return "cuda:" + std::to_string(node);
     return kWildcardLocation;
@@ -56,40 +93,82 @@ const std::vector<MemoryLocationEntry> getMemoryLocation(void *start,
 
     // start and end address may not be page aligned.
     uintptr_t aligned_start = alignPage((uintptr_t)start);
-    long long n = (uintptr_t(start) - aligned_start + len + pagesize - 1) / pagesize;
-    void **pages = (void **)malloc(sizeof(void *) * n);
-    int *status = (int *)malloc(sizeof(int) * n);
+    size_t n =
+        (uintptr_t(start) - aligned_start + len + pagesize - 1) / pagesize;
 
-    for (long long i = 0; i < n; i++) {
-        pages[i] = (void *)((char *)aligned_start + i * pagesize);
-    }
+    // Pages of a huge page, or of a range bound to a node, share the node,
+    // so the pages are sampled sparsely and only the gaps between samples
+    // on different nodes are probed page by page. Interleaved pages alternate
+    // nodes and are all probed.
+    size_t stride = kSampleStride;
+    if (n <= 2 * kSampleStride || isInterleaved(start) ||
+        isInterleaved((char *)start + len - 1))
+        stride = 1;
 
-    int rc = numa_move_pages(0, n, pages, nullptr, status, 0);
-    if (rc != 0) {
+    // Page index where each run of pages on a node begins
+    std::vector<std::pair<size_t, int>> runs;
+    auto append = [&](size_t page, int node) {
+        if (runs.empty() || runs.back().second != node)
+            runs.push_back({page, node});
+    };
+    std::vector<int> samples, gap;
+    size_t last_sample = 0;
+    int last_node = 0;
+    bool failed = false;
+    for (size_t first = 0; first < n && !failed;
+         first += kProbeBatch * stride) {
+        size_t count = std::min(kProbeBatch, (n - 1 - first) / stride + 1);
+        if (probePages(aligned_start, first, stride, count, samples)) {
+            failed = true;
+            break;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            size_t page = first + i * stride;
+            if (page && samples[i] != last_node &&
+                page - last_sample > 1) {
+                if (probePages(aligned_start, last_sample + 1, 1,
+                               page - last_sample - 1, gap)) {
+                    failed = true;
+                    break;
+                }
+                for (size_t j = 0; j < gap.size(); ++j)
+                    append(last_sample + 1 + j, gap[j]);
+            }
+            append(page, samples[i]);
+            last_sample = page;
+            last_node = samples[i];
+        }
+    }
+    // The last page closes the gap after the last sample
+    if (!failed && last_sample != n - 1) {
+        if (probePages(aligned_start, n - 1, 1, 1, samples)) {
+            failed = true;
+        } else if (samples[0] != last_node) {
+            if (probePages(aligned_start, last_sample + 1, 1,
+                           n - 1 - last_sample, gap)) {
+                failed = true;
+            } else {
+                for (size_t j = 0; j < gap.size(); ++j)
+                    append(last_sample + 1 + j, gap[j]);
+            }
+        }
+    }
+    if (failed) {
         PLOG(WARNING) << "Failed to get NUMA node, addr: " << start
                       << ", len: " << len;
         entries.push_back({(uint64_t)start, len, kWildcardLocation});
-        free(pages);
-        free(status);
         return entries;
     }
 
-    int node = status[0];
     uint64_t start_addr = (uint64_t)start;
-    uint64_t new_start_addr;
-    for (long long i = 1; i < n; i++) {
-        if (status[i] != node) {
-            new_start_addr = alignPage((uint64_t)start) + i * pagesize;
-            entries.push_back({start_addr, size_t(new_start_addr - start_addr),
-                               genCpuNodeName(node)});
-            start_addr = new_start_addr;
-            node = status[i];
-        }
+    for (size_t i = 0; i < runs.size(); ++i) {
+        uint64_t end_addr = i + 1 < runs.size()
+                                ? aligned_start + runs[i + 1].first * pagesize
+                                : (uint64_t)start + len;
+        entries.push_back({start_addr, size_t(end_addr - start_addr),
+                           genCpuNodeName(runs[i].second)});
+        start_addr = end_addr;
     }
-    entries.push_back(
-        {start_addr, (uint64_t)start + len - start_addr, genCpuNodeName(node)});
-    free(pages);
-    free(status);
     return entries;
 }
 
@@ -16,7 +16,9 @@
 #include <string>
 
 #include "config.h"
+#include "transport/loopback_transport/loopback_transport.h"
 #include "transport/rdma_transport/rdma_transport.h"
+#include "transport/shm_transport/shm_transport.h"
 #ifdef USE_TCP
 #include "transport/tcp_transport/tcp_transport.h"
 #endif
@@ -30,112 +32,276 @@
 #ifdef USE_MNNVL
 #include "transport/nvlink_transport/nvlink_transport.h"
 #endif
+#ifdef USE_CXL
+#include "transport/cxl_transport/cxl_transport.h"
+#endif
 
 #include <cassert>
 
 namespace mooncake {
 MultiTransport::MultiTransport(std::shared_ptr<TransferMetadata> metadata,
                                std::string &local_server_name)
-    : metadata_(metadata), local_server_name_(local_server_name) {}
+    : metadata_(metadata), local_server_name_(local_server_name) {
+    if (globalConfig().loopback_threads > 0) {
+        loopback_transport_ = std::make_shared<LoopbackTransport>();
+        Transport *transport = loopback_transport_.get();
+        if (transport->install(local_server_name_, metadata_, nullptr))
+            loopback_transport_.reset();
+    }
+}
 
 MultiTransport::~MultiTransport() {}
 
 MultiTransport::BatchID MultiTransport::allocateBatchID(size_t batch_size) {
-    auto batch_desc = new BatchDesc();
+    auto batch_desc = Transport::newBatchDesc(batch_size);
     if (!batch_desc) return ERR_MEMORY;
-    batch_desc->id = BatchID(batch_desc);
-    batch_desc->batch_size = batch_size;
-    batch_desc->task_list.reserve(batch_size);
-    batch_desc->context = NULL;
-#ifdef CONFIG_USE_BATCH_DESC_SET
-    batch_desc_lock_.lock();
-    batch_desc_set_[batch_desc->id] = batch_desc;
-    batch_desc_lock_.unlock();
-#endif
     return batch_desc->id;
 }
 
 Status MultiTransport::freeBatchID(BatchID batch_id) {
-    auto &batch_desc = *((BatchDesc *)(batch_id));
-    const size_t task_count = batch_desc.task_list.size();
+    auto batch_desc_ptr = Transport::getBatchDesc(batch_id);
+    if (!batch_desc_ptr) return Status::InvalidArgument("Invalid batch ID");
+    auto &batch_desc = *batch_desc_ptr;
+    if (batch_desc.submitting.load())
+        return Status::BatchBusy(
+            "BatchID cannot be freed while transfers are submitted to it");
+    bool failed = false;
+    const size_t task_count =
+        batch_desc.slicesDone(failed) ? 0 : batch_desc.task_list.size();
     for (size_t task_id = 0; task_id < task_count; task_id++) {
         if (!batch_desc.task_list[task_id].is_finished) {
             return Status::BatchBusy(
                 "BatchID cannot be freed until all tasks are done");
         }
     }
-    delete &batch_desc;
-#ifdef CONFIG_USE_BATCH_DESC_SET
-    RWSpinlock::WriteGuard guard(batch_desc_lock_);
-    batch_desc_set_.erase(batch_id);
-#endif
+    // Wait for the threads still finishing the last slices
+    while (batch_desc.finishing.load()) PAUSE();
+    Transport::releaseBatchDesc(&batch_desc);
     return Status::OK();
 }
 
 Status MultiTransport::submitTransfer(
     BatchID batch_id, const std::vector<TransferRequest> &entries) {
-    auto &batch_desc = *((BatchDesc *)(batch_id));
-    if (batch_desc.task_list.size() + entries.size() > batch_desc.batch_size) {
-        return Status::TooManyRequests(
+    auto batch_desc_ptr = Transport::getBatchDesc(batch_id);
+    if (!batch_desc_ptr) return Status::InvalidArgument("Invalid batch ID");
+    auto &batch_desc = *batch_desc_ptr;
+    // Any number of threads may submit to the batch at once, each filling
+    // the tasks it claimed
+    batch_desc.submitting.fetch_add(1);
+    size_t task_id = 0;
+    Status status;
+    if (batch_desc.task_list.claim(entries.size(), batch_desc.batch_size,
+                                   task_id)) {
+        status = submitTasks(batch_desc, task_id, entries);
+        // Counted before the batch can be seen done
+        uint64_t slice_count = 0;
+        for (size_t i = 0; i < entries.size(); ++i)
+            slice_count += batch_desc.task_list[task_id + i].slice_count;
+        batch_desc.total_slices.fetch_add(slice_count);
+    } else
+        status = Status::TooManyRequests(
             "Exceed the limitation of batch capacity");
-    }
+    batch_desc.submitting.fetch_sub(1);
+    return status;
+}
 
-    size_t task_id = batch_desc.task_list.size();
-    batch_desc.task_list.resize(task_id + entries.size());
+Status MultiTransport::submitTasks(
+    Transport::BatchDesc &batch_desc, size_t task_id,
+    const std::vector<TransferRequest> &entries) {
+    const BatchID batch_id = batch_desc.id;
+    const size_t first_task_id = task_id;
     struct SubmitTasks {
         std::vector<TransferRequest *> request_list;
         std::vector<Transport::TransferTask *> task_list;
     };
     std::unordered_map<Transport *, SubmitTasks> submit_tasks;
     for (auto &request : entries) {
-        Transport *transport = nullptr;
-        auto status = selectTransport(request, transport);
-        if (!status.ok()) return status;
+        Transport *transport = nullptr, *fallback = nullptr;
+        auto status = selectTransport(request, transport, fallback);
+        if (!status.ok()) {
+            // Claimed tasks cannot be given back, they fail instead
+            for (size_t i = 0; i < entries.size(); ++i) {
+                auto &task = batch_desc.task_list[first_task_id + i];
+                task.batch_id = batch_id;
+                task.fallback = nullptr;
+                task.slice_count = 1;
+                task.failed_slice_count = 1;
+            }
+            batch_desc.failed_slices.fetch_add(entries.size());
+            batch_desc.finished_slices.fetch_add(entries.size());
+            return status;
+        }
         assert(transport);
         auto &task = batch_desc.task_list[task_id];
         task.batch_id = batch_id;
+        if (fallback) {
+            task.fallback = fallback;
+            task.request = request;
+        }
         ++task_id;
         submit_tasks[transport].request_list.push_back(
             (TransferRequest *)&request);
         submit_tasks[transport].task_list.push_back(&task);
     }
     Status overall_status = Status::OK();
+    std::unordered_map<Transport *, SubmitTasks> fallback_tasks;
     for (auto &entry : submit_tasks) {
         auto status = entry.first->submitTransferTask(entry.second.request_list,
                                                       entry.second.task_list);
-        if (!status.ok()) {
-            // LOG(ERROR) << "Failed to submit transfer task to "
-            //            << entry.first->getName();
-            overall_status = status;
+        if (status.ok()) continue;
+        // Tasks the transport rejected before starting them are submitted to
+        // their fallback instead
+        bool rejected = false;
+        for (size_t i = 0; i < entry.second.task_list.size(); ++i) {
+            auto task = entry.second.task_list[i];
+            if (!task->fallback || task->slice_count) {
+                rejected = true;
+                continue;
+            }
+            auto &tasks = fallback_tasks[task->fallback];
+            tasks.request_list.push_back(entry.second.request_list[i]);
+            tasks.task_list.push_back(task);
+            task->fallback = nullptr;
         }
+        LOG(WARNING) << "Failed to submit transfer tasks to "
+                     << entry.first->getName() << ": " << status.ToString();
+        if (rejected) overall_status = status;
+    }
+    for (auto &entry : fallback_tasks) {
+        auto status = entry.first->submitTransferTask(entry.second.request_list,
+                                                      entry.second.task_list);
+        if (!status.ok()) overall_status = status;
     }
     return overall_status;
 }
 
+namespace {
+// Whether source lies in a local buffer of device memory, which TcpTransport
+// cannot read from or write to
+bool isDeviceBuffer(TransferMetadata &metadata, const void *source) {
+    auto desc = metadata.getSegmentDescByID(LOCAL_SEGMENT_ID);
+    if (!desc) return false;
+    for (auto &buffer : desc->buffers) {
+        if ((uint64_t)source >= buffer.addr &&
+            (uint64_t)source < buffer.addr + buffer.length)
+            return buffer.name.rfind("cuda", 0) == 0 ||
+                   buffer.name.rfind("npu", 0) == 0 ||
+                   buffer.name.rfind("musa", 0) == 0;
+    }
+    return false;
+}
+}  // namespace
+
+bool MultiTransport::failover(Transport::TransferTask &task) {
+    // Resubmitting counts as a submission to the batch. It waits for the
+    // submitters, which are still counting the slices of their tasks.
+    auto batch_desc = Transport::getBatchDesc(task.batch_id);
+    if (batch_desc->submitting.fetch_add(1)) {
+        batch_desc->submitting.fetch_sub(1);
+        return true;
+    }
+    // A single poller resubmits the task, the others see it waiting
+    uint32_t seq = __atomic_load_n(&task.failover_seq, __ATOMIC_ACQUIRE);
+    if ((seq & 1) ||
+        !__sync_bool_compare_and_swap(&task.failover_seq, seq, seq + 1)) {
+        batch_desc->submitting.fetch_sub(1);
+        return true;
+    }
+    Transport *fallback = task.fallback;
+    task.fallback = nullptr;
+    if (!fallback || (std::string(fallback->getName()) == "tcp" &&
+                      isDeviceBuffer(*metadata_, task.request.source))) {
+        __atomic_store_n(&task.failover_seq, seq + 2, __ATOMIC_RELEASE);
+        batch_desc->submitting.fetch_sub(1);
+        return false;
+    }
+
+    LOG(WARNING) << "Transfer to segment " << task.request.target_id
+                 << " failed, retrying on " << fallback->getName();
+    // The last slices of the failed attempt may still be finishing
+    while (batch_desc->finishing.load()) PAUSE();
+    // They stay in slice_list until the batch is freed, but are no longer
+    // watched for timeouts
+    for (auto &slice : task.slice_list) slice->ts = 0;
+    const uint64_t failed_slice_count = task.failed_slice_count;
+    batch_desc->transferred_bytes.fetch_sub(task.transferred_bytes);
+    task.slice_count = 0;
+    task.success_slice_count = 0;
+    task.failed_slice_count = 0;
+    task.transferred_bytes = 0;
+    auto status = fallback->submitTransferTask({&task.request}, {&task});
+    if (!status.ok()) {
+        LOG(ERROR) << "Failed to submit transfer task to "
+                   << fallback->getName() << ": " << status.ToString();
+        __sync_fetch_and_add(&task.slice_count, 1);
+        __sync_fetch_and_add(&task.failed_slice_count, 1);
+        batch_desc->failed_slices.fetch_add(1);
+        batch_desc->finished_slices.fetch_add(1);
+    }
+    // The slices of the failed attempt stay counted as finished, and their
+    // failures as retried
+    batch_desc->total_slices.fetch_add(task.slice_count);
+    batch_desc->retried_slices.fetch_add(failed_slice_count);
+    __atomic_store_n(&task.failover_seq, seq + 2, __ATOMIC_RELEASE);
+    batch_desc->submitting.fetch_sub(1);
+    return true;
+}
+
 Status MultiTransport::getTransferStatus(BatchID batch_id, size_t task_id,
                                          TransferStatus &status) {
-    auto &batch_desc = *((BatchDesc *)(batch_id));
+    auto batch_desc_ptr = Transport::getBatchDesc(batch_id);
+    if (!batch_desc_ptr) return Status::InvalidArgument("Invalid batch ID");
+    auto &batch_desc = *batch_desc_ptr;
     const size_t task_count = batch_desc.task_list.size();
     if (task_id >= task_count) {
         return Status::InvalidArgument("Task ID out of range");
     }
     auto &task = batch_desc.task_list[task_id];
+    uint32_t failover_seq =
+        __atomic_load_n(&task.failover_seq, __ATOMIC_ACQUIRE);
     status.transferred_bytes = task.transferred_bytes;
     uint64_t success_slice_count = task.success_slice_count;
     uint64_t failed_slice_count = task.failed_slice_count;
-    assert(task.slice_count);
-    if (success_slice_count + failed_slice_count == task.slice_count) {
+    uint64_t slice_count = task.slice_count;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    // The counters are reset while the task is resubmitted to its fallback
+    if ((failover_seq & 1) || failover_seq != task.failover_seq) {
+        status.transferred_bytes = 0;
+        status.s = Transport::TransferStatusEnum::WAITING;
+        return Status::OK();
+    }
+    // Claimed by a concurrent submitter which has not submitted it yet
+    if (!slice_count) {
+        status.s = Transport::TransferStatusEnum::WAITING;
+        return Status::OK();
+    }
+    auto abort_status = batch_desc.abortStatus();
+    if (success_slice_count + failed_slice_count == slice_count) {
+        // Slices of aborted batches fail when they are dropped
+        if (failed_slice_count &&
+            abort_status == Transport::TransferStatusEnum::WAITING &&
+            task.fallback && failover(task)) {
+            status.transferred_bytes = 0;
+            status.s = Transport::TransferStatusEnum::WAITING;
+            return Status::OK();
+        }
         if (failed_slice_count) {
-            status.s = Transport::TransferStatusEnum::FAILED;
+            status.s = abort_status == Transport::TransferStatusEnum::WAITING
+                           ? Transport::TransferStatusEnum::FAILED
+                           : abort_status;
         } else {
             status.s = Transport::TransferStatusEnum::COMPLETED;
         }
         task.is_finished = true;
+    } else if (abort_status != Transport::TransferStatusEnum::WAITING) {
+        // Reported at once, though the batch can only be freed once the
+        // posted slices are done
+        status.s = abort_status;
     } else {
-        if (globalConfig().slice_timeout > 0) {
+        const int64_t slice_timeout = configSnapshot().slice_timeout;
+        if (slice_timeout > 0) {
             auto current_ts = getCurrentTimeInNano();
-            const int64_t kPacketDeliveryTimeout =
-                globalConfig().slice_timeout * 1000000000;
+            const int64_t kPacketDeliveryTimeout = slice_timeout * 1000000000;
             for (auto &slice : task.slice_list) {
                 auto ts = slice->ts;
                 if (ts > 0 && current_ts > ts &&
@@ -152,15 +318,41 @@ Status MultiTransport::getTransferStatus(BatchID batch_id, size_t task_id,
 }
 
 Status MultiTransport::getBatchTransferStatus(BatchID batch_id, TransferStatus &status) {
-    auto &batch_desc = *((BatchDesc *)(batch_id));
+    auto batch_desc_ptr = Transport::getBatchDesc(batch_id);
+    if (!batch_desc_ptr) return Status::InvalidArgument("Invalid batch ID");
+    auto &batch_desc = *batch_desc_ptr;
     const size_t task_count = batch_desc.task_list.size();
     status.transferred_bytes = 0;
-    
+    const bool submitting = batch_desc.submitting.load() > 0;
+
     if (task_count == 0) {
-        status.s = Transport::TransferStatusEnum::COMPLETED;
+        // A batch canceled before its submission has nothing to complete
+        auto abort_status = batch_desc.abortStatus();
+        status.s = abort_status == Transport::TransferStatusEnum::WAITING &&
+                           !submitting
+                       ? Transport::TransferStatusEnum::COMPLETED
+                       : abort_status;
         return Status::OK();
     }
-    
+
+    // Answered from the counters of the batch, unless some slices failed
+    // and their tasks may fail over, or slices are to be checked for
+    // timeouts
+    bool failed = false;
+    const bool done = batch_desc.slicesDone(failed);
+    if (!failed) {
+        status.transferred_bytes = batch_desc.transferred_bytes.load();
+        if (done) {
+            status.s = Transport::TransferStatusEnum::COMPLETED;
+            return Status::OK();
+        }
+        status.s = batch_desc.abortStatus();
+        if (status.s != Transport::TransferStatusEnum::WAITING ||
+            configSnapshot().slice_timeout <= 0)
+            return Status::OK();
+        status.transferred_bytes = 0;
+    }
+
     size_t success_count = 0;
     for (size_t task_id = 0; task_id < task_count; task_id++) {
         TransferStatus task_status;
@@ -174,13 +366,15 @@ Status MultiTransport::getBatchTransferStatus(BatchID batch_id, TransferStatus &
         if (task_status.s == Transport::TransferStatusEnum::COMPLETED) {
             status.transferred_bytes += task_status.transferred_bytes;
             success_count++;
-        } else if (task_status.s == Transport::TransferStatusEnum::FAILED) {
-            status.s = Transport::TransferStatusEnum::FAILED;
+        } else if (task_status.s == Transport::TransferStatusEnum::FAILED ||
+                   task_status.s == Transport::TransferStatusEnum::CANCELED ||
+                   task_status.s == Transport::TransferStatusEnum::TIMEOUT) {
+            status.s = task_status.s;
             return Status::OK();
         }
     }
     
-    status.s = (success_count == task_count) ? 
+    status.s = (success_count == task_count && !submitting) ? 
            Transport::TransferStatusEnum::COMPLETED : 
            Transport::TransferStatusEnum::WAITING;
     return Status::OK();
@@ -192,6 +386,9 @@ Transport *MultiTransport::installTransport(const std::string &proto,
     if (std::string(proto) == "rdma") {
         transport = new RdmaTransport();
     }
+    else if (std::string(proto) == "shm") {
+        transport = new ShmTransport();
+    }
 #ifdef USE_TCP
     else if (std::string(proto) == "tcp") {
         transport = new TcpTransport();
@@ -212,6 +409,11 @@ Transport *MultiTransport::installTransport(const std::string &proto,
         transport = new NvlinkTransport();
     }
 #endif
+#ifdef USE_CXL
+    else if (std::string(proto) == "cxl") {
+        transport = new CxlTransport();
+    }
+#endif
 
     if (!transport) {
         LOG(ERROR) << "Unsupported transport " << proto
@@ -224,23 +426,57 @@ Transport *MultiTransport::installTransport(const std::string &proto,
     }
 
     transport_map_[proto] = std::shared_ptr<Transport>(transport);
+    if (proto == "shm") shm_transport_ = static_cast<ShmTransport *>(transport);
     return transport;
 }
 
 Status MultiTransport::selectTransport(const TransferRequest &entry,
-                                       Transport *&transport) {
+                                       Transport *&transport,
+                                       Transport *&fallback) {
     auto target_segment_desc = metadata_->getSegmentDescByID(entry.target_id);
     if (!target_segment_desc) {
         return Status::InvalidArgument("Invalid target segment ID " +
                                        std::to_string(entry.target_id));
     }
     auto proto = target_segment_desc->protocol;
-    if (!transport_map_.count(proto)) {
-        return Status::NotSupportedTransport("Transport " + proto +
-                                             " not installed");
+    Transport *primary = nullptr;
+    auto it = transport_map_.find(proto);
+    if (it != transport_map_.end()) primary = it->second.get();
+    // Segments of other protocols accept TCP too when their TcpTransport
+    // advertised its data port
+    Transport *tcp = nullptr;
+    if (proto != "tcp" && target_segment_desc->tcp_data_port > 0) {
+        it = transport_map_.find("tcp");
+        if (it != transport_map_.end()) tcp = it->second.get();
     }
-    transport = transport_map_[proto].get();
-    return Status::OK();
+
+    fallback = nullptr;
+    // Targets in the local segment are copied without looping back through
+    // the NIC
+    if (loopback_transport_ &&
+        loopback_transport_->canTransfer(*target_segment_desc, entry)) {
+        transport = loopback_transport_.get();
+        fallback = primary ? primary : tcp;
+        return Status::OK();
+    }
+    // Targets on the same host are copied directly if they can be mapped
+    if (shm_transport_ &&
+        shm_transport_->canTransfer(*target_segment_desc, entry)) {
+        transport = shm_transport_;
+        fallback = primary ? primary : tcp;
+        return Status::OK();
+    }
+    if (primary) {
+        transport = primary;
+        fallback = tcp;
+        return Status::OK();
+    }
+    if (tcp) {
+        transport = tcp;
+        return Status::OK();
+    }
+    return Status::NotSupportedTransport("Transport " + proto +
+                                         " not installed");
 }
 
 Transport *MultiTransport::getTransport(const std::string &proto) {
@@ -255,4 +491,27 @@ std::vector<Transport *> MultiTransport::listTransports() {
     return transport_list;
 }
 
+int MultiTransport::warmupSegments(
+    const std::vector<std::string> &segment_names) {
+    int result = 0;
+    // Caches the descriptors the transports look up in one batch
+    metadata_->getSegmentIDs(segment_names);
+    for (auto &entry : transport_map_) {
+        for (auto &segment_name : segment_names) {
+            int ret = entry.second->warmupSegment(segment_name);
+            if (ret && !result) result = ret;
+        }
+    }
+    return result;
+}
+
+int MultiTransport::closeSegment(Transport::SegmentID segment_id) {
+    int result = 0;
+    for (auto &entry : transport_map_) {
+        int ret = entry.second->closeSegment(segment_id);
+        if (ret && !result) result = ret;
+    }
+    return result;
+}
+
 }  // namespace mooncake
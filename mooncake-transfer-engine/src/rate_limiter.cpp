@@ -0,0 +1,215 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "rate_limiter.h"
+
+#include <glog/logging.h>
+
+#include <cstdlib>
+#include <sstream>
+
+#include "error.h"
+
+namespace mooncake {
+
+static const char *kTrafficClassNames[] = {"latency", "normal", "background"};
+
+// Bytes of a rate or burst such as "512M", 0 if it is not one
+static uint64_t parseBytes(const std::string &value) {
+    char *end = nullptr;
+    unsigned long long bytes = strtoull(value.c_str(), &end, 10);
+    if (value.empty() || end == value.c_str()) return 0;
+    std::string suffix(end);
+    if (suffix == "K" || suffix == "k")
+        bytes <<= 10;
+    else if (suffix == "M" || suffix == "m")
+        bytes <<= 20;
+    else if (suffix == "G" || suffix == "g")
+        bytes <<= 30;
+    else if (!suffix.empty())
+        return 0;
+    return bytes;
+}
+
+static std::unique_ptr<RateLimiter::Rule> parseRule(const std::string &spec) {
+    auto rule = std::make_unique<RateLimiter::Rule>();
+    rule->spec = spec;
+    std::stringstream fields(spec);
+    std::string field;
+    while (std::getline(fields, field, ',')) {
+        size_t pos = field.find('=');
+        if (pos == std::string::npos) return nullptr;
+        std::string key = field.substr(0, pos), value = field.substr(pos + 1);
+        if (value.empty()) return nullptr;
+        if (key == "segment") {
+            rule->segment = value;
+        } else if (key == "device") {
+            rule->device = value;
+        } else if (key == "class") {
+            if (value == "*") {
+                rule->per_class = true;
+                continue;
+            }
+            for (int i = 0; i < 3; ++i)
+                if (value == kTrafficClassNames[i]) rule->traffic_class = i;
+            if (rule->traffic_class < 0) return nullptr;
+        } else if (key == "rate") {
+            rule->rate = parseBytes(value);
+            if (!rule->rate) return nullptr;
+        } else if (key == "burst") {
+            rule->burst = parseBytes(value);
+            if (!rule->burst) return nullptr;
+        } else {
+            return nullptr;
+        }
+    }
+    if (!rule->rate) return nullptr;
+    if (!rule->burst) rule->burst = std::max<uint64_t>(rule->rate / 100, 1);
+    return rule;
+}
+
+static std::unique_ptr<RateLimiter::RuleSet> parseRules(
+    const std::string &spec) {
+    auto rule_set = std::make_unique<RateLimiter::RuleSet>();
+    std::stringstream rules(spec);
+    std::string rule_spec;
+    while (std::getline(rules, rule_spec, ';')) {
+        if (rule_spec.empty()) continue;
+        auto rule = parseRule(rule_spec);
+        if (!rule) return nullptr;
+        rule_set->rules.push_back(std::move(rule));
+    }
+    return rule_set;
+}
+
+static std::mutex g_rules_mutex;
+static std::atomic<const RateLimiter::RuleSet *> g_rules{nullptr};
+// Replaced rule sets may still be matched by the workers, so they are never
+// freed, like config snapshots
+static std::vector<std::unique_ptr<RateLimiter::RuleSet>> g_rule_sets;
+
+static void publishRules(std::unique_ptr<RateLimiter::RuleSet> rule_set) {
+    g_rule_sets.push_back(std::move(rule_set));
+    g_rules.store(g_rule_sets.back().get(), std::memory_order_release);
+}
+
+const RateLimiter::RuleSet &RateLimiter::rules() {
+    auto rule_set = g_rules.load(std::memory_order_acquire);
+    if (rule_set) return *rule_set;
+    std::lock_guard<std::mutex> lock(g_rules_mutex);
+    if (!g_rules.load(std::memory_order_relaxed)) {
+        std::unique_ptr<RuleSet> loaded;
+        const char *env = std::getenv("MC_RATE_LIMITS");
+        if (env) {
+            loaded = parseRules(env);
+            if (!loaded)
+                LOG(WARNING) << "Ignore value from environment variable "
+                                "MC_RATE_LIMITS: "
+                             << env;
+        }
+        publishRules(loaded ? std::move(loaded)
+                            : std::make_unique<RuleSet>());
+    }
+    return *g_rules.load(std::memory_order_acquire);
+}
+
+int RateLimiter::setRules(const std::string &spec) {
+    auto rule_set = parseRules(spec);
+    if (!rule_set) {
+        LOG(ERROR) << "Invalid value of rate_limits: " << spec;
+        return ERR_INVALID_ARGUMENT;
+    }
+    rules();
+    std::lock_guard<std::mutex> lock(g_rules_mutex);
+    publishRules(std::move(rule_set));
+    return 0;
+}
+
+std::vector<TokenBucket *> RateLimiter::RuleSet::match(
+    const std::string &segment, const std::string &device,
+    int traffic_class) const {
+    std::vector<TokenBucket *> buckets;
+    for (auto &rule : rules) {
+        if (!rule->segment.empty() && rule->segment != "*" &&
+            rule->segment != segment)
+            continue;
+        if (!rule->device.empty() && rule->device != "*" &&
+            rule->device != device)
+            continue;
+        if (rule->traffic_class >= 0 && rule->traffic_class != traffic_class)
+            continue;
+        std::string key;
+        if (rule->segment == "*") key += "segment=" + segment + ",";
+        if (rule->device == "*") key += "device=" + device + ",";
+        if (rule->per_class)
+            key += std::string("class=") + kTrafficClassNames[traffic_class];
+        std::lock_guard<std::mutex> lock(rule->mutex);
+        auto &bucket = rule->buckets[key];
+        if (!bucket)
+            bucket = std::make_unique<TokenBucket>(rule->rate, rule->burst);
+        buckets.push_back(bucket.get());
+    }
+    return buckets;
+}
+
+static std::string metricLabel(const std::string &value) {
+    std::string label;
+    for (char c : value) {
+        if (c == '"' || c == '\\') label += '\\';
+        label += c;
+    }
+    return label;
+}
+
+void RateLimiter::appendMetrics(std::string &out) {
+    auto &rule_set = rules();
+    if (rule_set.rules.empty()) return;
+    struct Sample {
+        std::string labels;
+        uint64_t admitted_bytes, throttled, rate;
+    };
+    std::vector<Sample> samples;
+    for (auto &rule : rule_set.rules) {
+        std::lock_guard<std::mutex> lock(rule->mutex);
+        for (auto &entry : rule->buckets) {
+            auto &bucket = *entry.second;
+            std::string key = entry.first;
+            if (!key.empty() && key.back() == ',') key.pop_back();
+            samples.push_back(
+                {"rule=\"" + metricLabel(rule->spec) + "\",bucket=\"" +
+                     metricLabel(key) + "\"",
+                 bucket.admitted_bytes.load(std::memory_order_relaxed),
+                 bucket.throttled.load(std::memory_order_relaxed),
+                 rule->rate});
+        }
+    }
+    auto append_family = [&](const char *name, const char *type,
+                             const char *help, uint64_t Sample::*field) {
+        out += std::string("# HELP ") + name + " " + help + "\n";
+        out += std::string("# TYPE ") + name + " " + type + "\n";
+        for (auto &sample : samples)
+            out += std::string(name) + "{" + sample.labels + "} " +
+                   std::to_string(sample.*field) + "\n";
+    };
+    append_family("te_rate_limit_bytes_total", "counter",
+                  "Bytes posted through the rate limit bucket",
+                  &Sample::admitted_bytes);
+    append_family("te_rate_limit_throttled_total", "counter",
+                  "Worker rounds in which slices waited for the bucket",
+                  &Sample::throttled);
+    append_family("te_rate_limit_bytes_per_second", "gauge",
+                  "Rate of the bucket", &Sample::rate);
+}
+
+}  // namespace mooncake
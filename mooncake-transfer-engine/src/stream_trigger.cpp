@@ -0,0 +1,237 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifdef USE_CUDA
+
+#include "stream_trigger.h"
+
+#include <glog/logging.h>
+
+#include <cstring>
+#include <unordered_set>
+
+namespace mooncake {
+
+StreamTrigger::StreamTrigger(std::shared_ptr<MultiTransport> transport)
+    : transport_(transport),
+      flags_(nullptr),
+      device_flags_(0),
+      running_(true) {
+    if (init()) {
+        LOG(ERROR) << "StreamTrigger: Failed to allocate mapped flags";
+        return;
+    }
+    worker_ = std::thread(&StreamTrigger::triggerWorker, this);
+}
+
+StreamTrigger::~StreamTrigger() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cond_.notify_all();
+    if (worker_.joinable()) worker_.join();
+    if (flags_) cudaFreeHost((void *)flags_);
+}
+
+int StreamTrigger::init() {
+    void *flags = nullptr;
+    cudaError_t err =
+        cudaHostAlloc(&flags, kSlotCount * sizeof(uint32_t),
+                      cudaHostAllocMapped | cudaHostAllocPortable);
+    if (err != cudaSuccess) {
+        LOG(ERROR) << "StreamTrigger: cudaHostAlloc: "
+                   << cudaGetErrorString(err);
+        return -1;
+    }
+    void *device_flags = nullptr;
+    err = cudaHostGetDevicePointer(&device_flags, flags, 0);
+    if (err != cudaSuccess) {
+        LOG(ERROR) << "StreamTrigger: cudaHostGetDevicePointer: "
+                   << cudaGetErrorString(err);
+        cudaFreeHost(flags);
+        return -1;
+    }
+    memset(flags, 0, kSlotCount * sizeof(uint32_t));
+    flags_ = (volatile uint32_t *)flags;
+    device_flags_ = (CUdeviceptr)device_flags;
+    next_value_.assign(kSlotCount, 1);
+    for (int slot = kSlotCount - 1; slot >= 0; --slot)
+        free_slots_.push_back(slot);
+    return 0;
+}
+
+Status StreamTrigger::acquireSlot(int &slot, uint32_t &value) {
+    if (!flags_) return Status::Memory("stream trigger not initialized");
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_slots_.empty())
+        return Status::TooManyRequests("too many pending stream triggers");
+    slot = free_slots_.back();
+    free_slots_.pop_back();
+    value = next_value_[slot]++;
+    return Status::OK();
+}
+
+Status StreamTrigger::submit(BatchID batch_id,
+                             const std::vector<TransferRequest> &entries,
+                             cudaStream_t stream) {
+    if (!Transport::getBatchDesc(batch_id))
+        return Status::InvalidArgument("Invalid batch ID");
+    int slot;
+    uint32_t value;
+    Status s = acquireSlot(slot, value);
+    if (!s.ok()) return s;
+    // Queue the trigger first, the stream may reach the write right away
+    std::unique_lock<std::mutex> lock(mutex_);
+    pending_.push_back({slot, value, batch_id, true, entries, nullptr});
+    CUresult ret = cuStreamWriteValue32(
+        (CUstream)stream, device_flags_ + slot * sizeof(uint32_t), value,
+        CU_STREAM_WRITE_VALUE_DEFAULT);
+    if (ret != CUDA_SUCCESS) {
+        pending_.pop_back();
+        free_slots_.push_back(slot);
+        lock.unlock();
+        const char *message = nullptr;
+        cuGetErrorString(ret, &message);
+        LOG(ERROR) << "StreamTrigger: cuStreamWriteValue32: "
+                   << (message ? message : "unknown error");
+        return Status::Context("failed to queue a write to the stream");
+    }
+    lock.unlock();
+    cond_.notify_one();
+    return Status::OK();
+}
+
+Status StreamTrigger::queueWait(cudaStream_t stream, int slot,
+                                uint32_t value) {
+    CUresult ret = cuStreamWaitValue32(
+        (CUstream)stream, device_flags_ + slot * sizeof(uint32_t), value,
+        CU_STREAM_WAIT_VALUE_GEQ);
+    if (ret == CUDA_SUCCESS) return Status::OK();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_slots_.push_back(slot);
+    }
+    const char *message = nullptr;
+    cuGetErrorString(ret, &message);
+    LOG(ERROR) << "StreamTrigger: cuStreamWaitValue32: "
+               << (message ? message : "unknown error");
+    return Status::Context("failed to queue a wait to the stream");
+}
+
+Status StreamTrigger::wait(BatchID batch_id, cudaStream_t stream,
+                           std::function<void()> done) {
+    if (!Transport::getBatchDesc(batch_id))
+        return Status::InvalidArgument("Invalid batch ID");
+    int slot;
+    uint32_t value;
+    Status s = acquireSlot(slot, value);
+    if (!s.ok()) return s;
+    s = queueWait(stream, slot, value);
+    if (!s.ok()) return s;
+    std::unique_lock<std::mutex> lock(mutex_);
+    pending_.push_back({slot, value, batch_id, false, {}, std::move(done)});
+    lock.unlock();
+    cond_.notify_one();
+    return Status::OK();
+}
+
+Status StreamTrigger::hold(cudaStream_t stream, uint64_t &handle) {
+    int slot;
+    uint32_t value;
+    Status s = acquireSlot(slot, value);
+    if (!s.ok()) return s;
+    s = queueWait(stream, slot, value);
+    if (!s.ok()) return s;
+    handle = (uint64_t)slot << 32 | value;
+    return Status::OK();
+}
+
+void StreamTrigger::release(uint64_t handle) {
+    const int slot = handle >> 32;
+    flags_[slot] = (uint32_t)handle;
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_slots_.push_back(slot);
+}
+
+bool StreamTrigger::batchDone(BatchID batch_id) {
+    Transport::TransferStatus status;
+    Status s = transport_->getBatchTransferStatus(batch_id, status);
+    return !s.ok() || status.s != Transport::TransferStatusEnum::WAITING;
+}
+
+void StreamTrigger::triggerWorker() {
+    // Triggers in the order they were queued, so that waits see the
+    // submissions to their batch queued before them
+    std::vector<Trigger> active;
+    std::unordered_set<BatchID> unsubmitted;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (active.empty())
+                cond_.wait(lock,
+                           [&] { return !running_ || !pending_.empty(); });
+            if (!running_) break;
+            for (auto &trigger : pending_) active.push_back(std::move(trigger));
+            pending_.clear();
+        }
+
+        std::vector<int> released;
+        unsubmitted.clear();
+        size_t kept = 0;
+        for (size_t i = 0; i < active.size(); ++i) {
+            auto &trigger = active[i];
+            bool fired = false;
+            if (trigger.submit) {
+                if (flags_[trigger.slot] - trigger.value < (1u << 31)) {
+                    Status s = transport_->submitTransfer(trigger.batch_id,
+                                                          trigger.entries);
+                    if (!s.ok()) {
+                        LOG(ERROR) << "StreamTrigger: Failed to submit "
+                                      "transfers: "
+                                   << s.ToString();
+                        Transport::cancelBatch(trigger.batch_id);
+                    }
+                    fired = true;
+                } else {
+                    unsubmitted.insert(trigger.batch_id);
+                }
+            } else if (!unsubmitted.count(trigger.batch_id) &&
+                       batchDone(trigger.batch_id)) {
+                flags_[trigger.slot] = trigger.value;
+                if (trigger.done) trigger.done();
+                fired = true;
+            }
+            if (fired)
+                released.push_back(trigger.slot);
+            else if (kept != i)
+                active[kept++] = std::move(trigger);
+            else
+                kept++;
+        }
+        active.resize(kept);
+
+        if (!released.empty()) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (int slot : released) free_slots_.push_back(slot);
+        } else {
+            // Nothing is ready, the streams are still busy
+            std::this_thread::yield();
+        }
+    }
+}
+
+}  // namespace mooncake
+
+#endif  // USE_CUDA
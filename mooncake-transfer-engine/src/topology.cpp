@@ -14,10 +14,15 @@
 
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <cstdio>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <map>
+#include <mutex>
 #include <set>
+#include <sstream>
 #include <string>
 #include <utility>
 #include <vector>
@@ -32,7 +37,9 @@
 #include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include "memory_location.h"
 #include "topology.h"
@@ -41,9 +48,30 @@ namespace mooncake {
 struct InfinibandDevice {
     std::string name;
     std::string pci_bus_id;
+    // Resolved sysfs path of the PCI device, through its bridges
+    std::string pci_path;
     int numa_node;
+    // Link rate of the first port in Gb/s, 0 if unknown
+    int rate_gbps;
 };
 
+// Distance between a device and an HCA, nearer first
+enum PciDistance {
+    kSamePciSwitch = 0,
+    kSameRootPort = 1,
+    kSameSocket = 2,
+    kCrossSocket = 3,
+};
+
+static int readPortRate(const std::string &device_name) {
+    // e.g. "200 Gb/sec (4X HDR)"
+    std::ifstream file("/sys/class/infiniband/" + device_name +
+                       "/ports/1/rate");
+    double rate = 0;
+    file >> rate;
+    return (int)rate;
+}
+
 static std::vector<InfinibandDevice> listInfiniBandDevices(
     const std::vector<std::string> &filter) {
     int num_devices = 0;
@@ -83,14 +111,39 @@ static std::vector<InfinibandDevice> listInfiniBandDevices(
         snprintf(path, sizeof(path), "%s/numa_node", resolved_path);
         std::ifstream(path) >> numa_node;
 
+        int rate_gbps = readPortRate(device_name);
         devices.push_back(InfinibandDevice{.name = std::move(device_name),
                                            .pci_bus_id = std::move(pci_bus_id),
-                                           .numa_node = numa_node});
+                                           .pci_path = resolved_path,
+                                           .numa_node = numa_node,
+                                           .rate_gbps = rate_gbps});
     }
     ibv_free_device_list(device_list);
     return devices;
 }
 
+// Puts the HCAs of the nearest distance first in preferred_hca, and the
+// others in avail_hca from the nearest, by distance then hops
+static TopologyEntry rankHcas(
+    const std::string &name, const std::vector<InfinibandDevice> &all_hca,
+    const std::function<std::pair<int, int>(const InfinibandDevice &)>
+        &distance) {
+    std::vector<std::pair<std::pair<int, int>, std::string>> ranked;
+    for (const auto &hca : all_hca) ranked.push_back({distance(hca), hca.name});
+    std::stable_sort(
+        ranked.begin(), ranked.end(),
+        [](const auto &lhs, const auto &rhs) { return lhs.first < rhs.first; });
+    TopologyEntry entry;
+    entry.name = name;
+    for (const auto &hca : ranked) {
+        if (hca.first.first == ranked.front().first.first)
+            entry.preferred_hca.push_back(hca.second);
+        else
+            entry.avail_hca.push_back(hca.second);
+    }
+    return entry;
+}
+
 static std::vector<TopologyEntry> discoverCpuTopology(
     const std::vector<InfinibandDevice> &all_hca) {
     DIR *dir = opendir("/sys/devices/system/node");
@@ -109,20 +162,23 @@ static std::vector<TopologyEntry> discoverCpuTopology(
             continue;
         }
         int node_id = atoi(entry->d_name + strlen(prefix));
-        std::vector<std::string> preferred_hca;
-        std::vector<std::string> avail_hca;
+        // NUMA distances to the other nodes order the remote HCAs
+        std::vector<int> node_distance;
+        std::ifstream distance_file(std::string("/sys/devices/system/node/") +
+                                    entry->d_name + "/distance");
+        for (int distance; distance_file >> distance;)
+            node_distance.push_back(distance);
         // an HCA connected to the same cpu NUMA node is preferred
-        for (const auto &hca : all_hca) {
-            if (hca.numa_node == node_id) {
-                preferred_hca.push_back(hca.name);
-            } else {
-                avail_hca.push_back(hca.name);
-            }
-        }
-        topology.push_back(
-            TopologyEntry{.name = "cpu:" + std::to_string(node_id),
-                          .preferred_hca = std::move(preferred_hca),
-                          .avail_hca = std::move(avail_hca)});
+        topology.push_back(rankHcas(
+            "cpu:" + std::to_string(node_id), all_hca,
+            [&](const InfinibandDevice &hca) -> std::pair<int, int> {
+                if (hca.numa_node == node_id) return {kSameSocket, 0};
+                int hops = hca.numa_node >= 0 &&
+                                   hca.numa_node < (int)node_distance.size()
+                               ? node_distance[hca.numa_node]
+                               : INT_MAX;
+                return {kCrossSocket, hops};
+            }));
     }
     (void)closedir(dir);
     return topology;
@@ -130,34 +186,42 @@ static std::vector<TopologyEntry> discoverCpuTopology(
 
 #ifdef USE_CUDA
 
-static int getPciDistance(const char *bus1, const char *bus2) {
-    char buf[PATH_MAX];
-    char path1[PATH_MAX];
-    char path2[PATH_MAX];
-    snprintf(buf, sizeof(buf), "/sys/bus/pci/devices/%s", bus1);
-    if (realpath(buf, path1) == NULL) {
-        return -1;
-    }
-    snprintf(buf, sizeof(buf), "/sys/bus/pci/devices/%s", bus2);
-    if (realpath(buf, path2) == NULL) {
-        return -1;
-    }
-
-    char *ptr1 = path1;
-    char *ptr2 = path2;
-    while (*ptr1 && *ptr1 == *ptr2) {
-        ptr1++;
-        ptr2++;
-    }
-    int distance = 0;
-    for (; *ptr1; ptr1++) {
-        distance += (*ptr1 == '/');
-    }
-    for (; *ptr2; ptr2++) {
-        distance += (*ptr2 == '/');
-    }
-
-    return distance;
+// Distance between PCI devices from their sysfs paths, such as
+// /sys/devices/pci0000:00/0000:00:01.0/0000:01:00.0/0000:02:08.0/0000:05:00.0
+// where pci0000:00 is the host bridge, 0000:00:01.0 the root port and
+// 0000:01:00.0 the upstream port of a switch. Hops between them break ties.
+static std::pair<int, int> getPciDistance(const std::string &path1,
+                                          int numa1,
+                                          const std::string &path2,
+                                          int numa2) {
+    auto split = [](const std::string &path) {
+        std::vector<std::string> components;
+        size_t begin = path.find("/pci");
+        if (begin == std::string::npos) return components;
+        while (begin != std::string::npos) {
+            size_t end = path.find('/', begin + 1);
+            components.push_back(path.substr(
+                begin + 1,
+                end == std::string::npos ? std::string::npos : end - begin - 1));
+            begin = end;
+        }
+        return components;
+    };
+    auto components1 = split(path1);
+    auto components2 = split(path2);
+    size_t common = 0;
+    while (common < components1.size() && common < components2.size() &&
+           components1[common] == components2[common])
+        common++;
+    int hops = components1.size() + components2.size() - 2 * common;
+    // Neither the device nor the HCA themselves are bridges
+    if (common >= 3 && common < components1.size() &&
+        common < components2.size())
+        return {kSamePciSwitch, hops};
+    if (common >= 2) return {kSameRootPort, hops};
+    if (common >= 1 || (numa1 >= 0 && numa1 == numa2))
+        return {kSameSocket, hops};
+    return {kCrossSocket, hops};
 }
 
 static std::vector<TopologyEntry> discoverCudaTopology(
@@ -175,44 +239,198 @@ static std::vector<TopologyEntry> discoverCudaTopology(
         }
         for (char *ch = pci_bus_id; (*ch = tolower(*ch)); ch++);
 
-        std::vector<std::string> preferred_hca;
-        std::vector<std::string> avail_hca;
-        
-        // Find HCAs with minimum distance in one pass
-        int min_distance = INT_MAX;
-        std::vector<std::string> min_distance_hcas;
-        
-        for (const auto &hca : all_hca) {
-            int distance = getPciDistance(hca.pci_bus_id.c_str(), pci_bus_id);
-            if (distance >= 0) {
-                if (distance < min_distance) {
-                    min_distance = distance;
-                    min_distance_hcas.clear();
-                    min_distance_hcas.push_back(hca.name);
-                } else if (distance == min_distance) {
-                    min_distance_hcas.push_back(hca.name);
-                }
-            }
-        }
-        
-        // Add HCAs with minimum distance to preferred_hca, others to avail_hca
-        for (const auto &hca : all_hca) {
-            if (std::find(min_distance_hcas.begin(), min_distance_hcas.end(), hca.name) != min_distance_hcas.end()) {
-                preferred_hca.push_back(hca.name);
-            } else {
-                avail_hca.push_back(hca.name);
-            }
+        char path[PATH_MAX];
+        char resolved_path[PATH_MAX];
+        snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s", pci_bus_id);
+        if (realpath(path, resolved_path) == NULL) {
+            PLOG(WARNING) << "discoverCudaTopology: realpath " << path
+                          << " failed";
+            continue;
         }
-        topology.push_back(
-            TopologyEntry{.name = "cuda:" + std::to_string(i),
-                          .preferred_hca = std::move(preferred_hca),
-                          .avail_hca = std::move(avail_hca)});
+        int numa_node = -1;
+        std::ifstream(std::string(resolved_path) + "/numa_node") >> numa_node;
+        const std::string gpu_path = resolved_path;
+        topology.push_back(rankHcas(
+            "cuda:" + std::to_string(i), all_hca,
+            [&](const InfinibandDevice &hca) {
+                return getPciDistance(gpu_path, numa_node, hca.pci_path,
+                                      hca.numa_node);
+            }));
     }
     return topology;
 }
 
 #endif  // USE_CUDA
 
+namespace {
+
+// Weight of moving averages: the newest sample counts 1/kEwmaWeight
+const int64_t kEwmaWeight = 16;
+// Thresholds of a degraded device, relative to the fastest one
+const double kMaxErrorRate = 0.01;
+const uint64_t kMaxLatencyRatio = 4;
+// Degraded devices receive 1/kDegradedWeightRatio of a healthy one's
+// slices, so their averages keep being refreshed and they can recover
+const int kDegradedWeightRatio = 8;
+
+// Discovered topologies by device filter, as sysfs and the CUDA runtime
+// are slow to walk and the hardware does not change while running
+struct DiscoveredTopology {
+    TopologyMatrix matrix;
+    std::unordered_map<std::string, int> rate_gbps;
+};
+std::mutex discovered_mutex;
+std::map<std::vector<std::string>, DiscoveredTopology> discovered;
+
+std::vector<std::string> listDirectory(const std::string &path) {
+    std::vector<std::string> names;
+    DIR *dir = opendir(path.c_str());
+    if (!dir) return names;
+    while (struct dirent *entry = readdir(dir))
+        if (entry->d_name[0] != '.') names.push_back(entry->d_name);
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+std::string readFile(const std::string &path) {
+    std::ifstream file(path);
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+// What discover() finds depends on: the RDMA devices with their PCI paths
+// and link rates, the NUMA nodes with their distances, and the GPUs the
+// process sees. Reading them from sysfs is much cheaper than the walk, and
+// in particular than initializing the CUDA runtime.
+std::string hardwareFingerprint(const std::vector<std::string> &filter) {
+    std::string fingerprint = "filter=";
+    for (auto &name : filter) fingerprint += name + ",";
+    for (auto &name : listDirectory("/sys/class/infiniband")) {
+        std::string path = "/sys/class/infiniband/" + name;
+        char resolved_path[PATH_MAX];
+        fingerprint += "\nhca=" + name + "@" +
+                       (realpath(path.c_str(), resolved_path) ? resolved_path
+                                                              : "") +
+                       " " + readFile(path + "/ports/1/rate");
+    }
+    for (auto &name : listDirectory("/sys/devices/system/node")) {
+        if (name.rfind("node", 0) != 0) continue;
+        fingerprint += "\n" + name + "=" +
+                       readFile("/sys/devices/system/node/" + name +
+                                "/distance");
+    }
+#ifdef USE_CUDA
+    for (auto &name : listDirectory("/sys/bus/pci/devices")) {
+        std::string path = "/sys/bus/pci/devices/" + name;
+        if (readFile(path + "/vendor").rfind("0x10de", 0) == 0 &&
+            readFile(path + "/class").rfind("0x03", 0) == 0)
+            fingerprint += "\ngpu=" + name;
+    }
+    const char *visible_devices = getenv("CUDA_VISIBLE_DEVICES");
+    fingerprint += "\nvisible=" +
+                   std::string(visible_devices ? visible_devices : "");
+#endif
+    return fingerprint;
+}
+
+// Discovered topologies are kept in MC_TOPOLOGY_CACHE_DIR by the
+// fingerprint of the hardware, so that the processes started on a host
+// after the first one skip the walk
+std::string cachePath(const std::string &fingerprint) {
+    const char *dir = getenv("MC_TOPOLOGY_CACHE_DIR");
+    if (!dir || !*dir) return "";
+    char name[32];
+    snprintf(name, sizeof(name), "topology-%016zx.json",
+             std::hash<std::string>{}(fingerprint));
+    return std::string(dir) + "/" + name;
+}
+
+bool loadCachedTopology(const std::string &path,
+                        const std::string &fingerprint,
+                        DiscoveredTopology &topology) {
+    Json::Value root;
+    Json::Reader reader;
+    std::string content = readFile(path);
+    if (content.empty() || !reader.parse(content, root) ||
+        root["fingerprint"].asString() != fingerprint)
+        return false;
+    const Json::Value &matrix = root["matrix"];
+    for (const auto &key : matrix.getMemberNames()) {
+        const Json::Value &value = matrix[key];
+        if (!value.isArray() || value.size() != 2) return false;
+        TopologyEntry entry;
+        entry.name = key;
+        for (const auto &hca : value[0])
+            entry.preferred_hca.push_back(hca.asString());
+        for (const auto &hca : value[1])
+            entry.avail_hca.push_back(hca.asString());
+        topology.matrix[key] = std::move(entry);
+    }
+    const Json::Value &rate_gbps = root["rate_gbps"];
+    for (const auto &key : rate_gbps.getMemberNames())
+        topology.rate_gbps[key] = rate_gbps[key].asInt();
+    return true;
+}
+
+void storeCachedTopology(const std::string &path,
+                         const std::string &fingerprint,
+                         const DiscoveredTopology &topology) {
+    Json::Value root;
+    root["fingerprint"] = fingerprint;
+    root["matrix"] = Json::Value(Json::objectValue);
+    for (auto &entry : topology.matrix)
+        root["matrix"][entry.first] = entry.second.toJson();
+    root["rate_gbps"] = Json::Value(Json::objectValue);
+    for (auto &entry : topology.rate_gbps)
+        root["rate_gbps"][entry.first] = entry.second;
+    mkdir(path.substr(0, path.rfind('/')).c_str(), 0755);
+    // Renamed into place, so that concurrent readers see whole files
+    std::string tmp_path = path + "." + std::to_string(getpid());
+    {
+        std::ofstream file(tmp_path);
+        file << root.toStyledString();
+        if (!file) {
+            LOG(WARNING) << "Failed to cache the topology in " << path;
+            unlink(tmp_path.c_str());
+            return;
+        }
+    }
+    if (rename(tmp_path.c_str(), path.c_str())) {
+        PLOG(WARNING) << "Failed to cache the topology in " << path;
+        unlink(tmp_path.c_str());
+    }
+}
+
+void updateEwma(std::atomic<uint64_t> &average, uint64_t sample,
+                bool first_sample_replaces) {
+    uint64_t old_value = average.load(std::memory_order_relaxed);
+    uint64_t new_value;
+    do {
+        if (first_sample_replaces && old_value == 0)
+            new_value = sample;
+        else
+            new_value = old_value +
+                        ((int64_t)sample - (int64_t)old_value) / kEwmaWeight;
+    } while (!average.compare_exchange_weak(old_value, new_value,
+                                            std::memory_order_relaxed));
+}
+
+}  // namespace
+
+void DeviceHealth::recordSuccess(uint64_t latency_ns, size_t length) {
+    const static size_t kNormalLength = 65536;
+    if (length > kNormalLength)
+        latency_ns = latency_ns * kNormalLength / length;
+    updateEwma(latency_ns_, latency_ns, true);
+    updateEwma(error_rate_, 0, false);
+}
+
+void DeviceHealth::recordFailure() {
+    updateEwma(error_rate_, kErrorScale, false);
+}
+
 Topology::Topology() {}
 
 Topology::~Topology() {}
@@ -223,19 +441,39 @@ void Topology::clear() {
     matrix_.clear();
     hca_list_.clear();
     resolved_matrix_.clear();
+    rate_gbps_.clear();
 }
 
 int Topology::discover(const std::vector<std::string> &filter) {
-    matrix_.clear();
-    auto all_hca = listInfiniBandDevices(filter);
-    for (auto &ent : discoverCpuTopology(all_hca)) {
-        matrix_[ent.name] = ent;
-    }
+    std::lock_guard<std::mutex> lock(discovered_mutex);
+    auto it = discovered.find(filter);
+    if (it == discovered.end()) {
+        DiscoveredTopology topology;
+        const std::string fingerprint = hardwareFingerprint(filter);
+        const std::string cache_path = cachePath(fingerprint);
+        if (!cache_path.empty() &&
+            loadCachedTopology(cache_path, fingerprint, topology)) {
+            LOG(INFO) << "Topology loaded from " << cache_path;
+        } else {
+            topology = DiscoveredTopology();
+            auto all_hca = listInfiniBandDevices(filter);
+            for (auto &hca : all_hca)
+                topology.rate_gbps[hca.name] = hca.rate_gbps;
+            for (auto &ent : discoverCpuTopology(all_hca)) {
+                topology.matrix[ent.name] = ent;
+            }
 #ifdef USE_CUDA
-    for (auto &ent : discoverCudaTopology(all_hca)) {
-        matrix_[ent.name] = ent;
-    }
+            for (auto &ent : discoverCudaTopology(all_hca)) {
+                topology.matrix[ent.name] = ent;
+            }
 #endif
+            if (!cache_path.empty())
+                storeCachedTopology(cache_path, fingerprint, topology);
+        }
+        it = discovered.emplace(filter, std::move(topology)).first;
+    }
+    matrix_ = it->second.matrix;
+    rate_gbps_ = it->second.rate_gbps;
     return resolve();
 }
 
@@ -249,6 +487,8 @@ int Topology::parse(const std::string &topology_json) {
     }
 
     matrix_.clear();
+    // Link rates are only known for discovered devices
+    rate_gbps_.clear();
     for (const auto &key : root.getMemberNames()) {
         const Json::Value &value = root[key];
         if (value.isArray() && value.size() == 2) {
@@ -305,6 +545,15 @@ int Topology::selectDevice(const std::string storage_type,
     return selectDevice(storage_type, retry_count);
 }
 
+const std::vector<int> *Topology::preferredDevices(
+    const std::string &storage_type) const {
+    auto it = resolved_matrix_.find(storage_type);
+    if (it == resolved_matrix_.end()) return nullptr;
+    auto &entry = it->second;
+    return entry.preferred_hca.empty() ? &entry.avail_hca
+                                       : &entry.preferred_hca;
+}
+
 int Topology::selectDevice(const std::string storage_type, int retry_count) {
     if (resolved_matrix_.count(storage_type) == 0) return ERR_DEVICE_NOT_FOUND;
 
@@ -312,9 +561,9 @@ int Topology::selectDevice(const std::string storage_type, int retry_count) {
     if (retry_count == 0) {
         int rand_value = SimpleRandom::Get().next();
         if (!entry.preferred_hca.empty())
-            return entry.preferred_hca[rand_value % entry.preferred_hca.size()];
+            return selectHealthyDevice(entry.preferred_hca, rand_value);
         else
-            return entry.avail_hca[rand_value % entry.avail_hca.size()];
+            return selectHealthyDevice(entry.avail_hca, rand_value);
     } else {
         size_t index = (retry_count - 1) %
                        (entry.preferred_hca.size() + entry.avail_hca.size());
@@ -364,9 +613,105 @@ int Topology::resolve() {
                 hca_id_map[hca];
         }
     }
+    health_ = std::make_shared<std::vector<DeviceHealth>>(hca_list_.size());
+
+    // Devices are weighted by link rate unless some rate is unknown
+    hca_weight_.assign(hca_list_.size(), 1);
+    uniform_weight_ = true;
+    bool rates_known = !hca_list_.empty();
+    for (auto &hca : hca_list_)
+        if (rate_gbps_.count(hca) == 0 || rate_gbps_[hca] <= 0)
+            rates_known = false;
+    if (rates_known) {
+        for (size_t i = 0; i < hca_list_.size(); ++i) {
+            hca_weight_[i] = rate_gbps_[hca_list_[i]];
+            if (hca_weight_[i] != hca_weight_[0]) uniform_weight_ = false;
+        }
+    }
     return 0;
 }
 
+int Topology::setDeviceRate(const std::string &device_name, int rate_gbps) {
+    if (std::find(hca_list_.begin(), hca_list_.end(), device_name) ==
+        hca_list_.end())
+        return ERR_DEVICE_NOT_FOUND;
+    rate_gbps_[device_name] = rate_gbps;
+    auto health = health_;
+    int ret = resolve();
+    // Keeps the scores shared with copies
+    health_ = health;
+    return ret;
+}
+
+DeviceHealth *Topology::deviceHealth(int device_id) const {
+    if (!health_ || device_id < 0 || device_id >= (int)health_->size())
+        return nullptr;
+    return &(*health_)[device_id];
+}
+
+bool Topology::degraded(int device_id, uint64_t best_latency_ns) const {
+    auto &health = (*health_)[device_id];
+    if (health.errorRate() > kMaxErrorRate) return true;
+    return best_latency_ns &&
+           health.latencyNs() > best_latency_ns * kMaxLatencyRatio;
+}
+
+int Topology::selectHealthyDevice(const std::vector<int> &devices,
+                                  int rand_value) const {
+    uint64_t best_latency_ns = 0;
+    if (health_) {
+        for (int device_id : devices) {
+            auto latency_ns = (*health_)[device_id].latencyNs();
+            if (latency_ns &&
+                (!best_latency_ns || latency_ns < best_latency_ns))
+                best_latency_ns = latency_ns;
+        }
+    }
+
+    int degraded_count = 0;
+    if (health_) {
+        for (int device_id : devices)
+            if (degraded(device_id, best_latency_ns)) degraded_count++;
+    }
+    if (!degraded_count && uniform_weight_)
+        return devices[rand_value % devices.size()];
+
+    // Weighted pick by link rate, degraded devices get a small share
+    auto weight = [&](int device_id) {
+        int64_t weight = hca_weight_[device_id];
+        if (!health_ || !degraded(device_id, best_latency_ns))
+            weight *= kDegradedWeightRatio;
+        return weight;
+    };
+    int64_t total_weight = 0;
+    for (int device_id : devices) total_weight += weight(device_id);
+    int64_t point = (uint32_t)rand_value % total_weight;
+    for (int device_id : devices) {
+        point -= weight(device_id);
+        if (point < 0) return device_id;
+    }
+    return devices.back();
+}
+
+Json::Value Topology::healthToJson() const {
+    Json::Value root(Json::objectValue);
+    if (!health_) return root;
+    uint64_t best_latency_ns = 0;
+    for (auto &health : *health_) {
+        auto latency_ns = health.latencyNs();
+        if (latency_ns && (!best_latency_ns || latency_ns < best_latency_ns))
+            best_latency_ns = latency_ns;
+    }
+    for (size_t i = 0; i < hca_list_.size(); ++i) {
+        Json::Value score;
+        score["latency_ns"] = Json::UInt64((*health_)[i].latencyNs());
+        score["error_rate"] = (*health_)[i].errorRate();
+        score["degraded"] = degraded(i, best_latency_ns);
+        root[hca_list_[i]] = score;
+    }
+    return root;
+}
+
 int Topology::disableDevice(const std::string &device_name) {
     for (auto &record : matrix_) {
         auto &preferred_hca = record.second.preferred_hca;
@@ -14,12 +14,16 @@
 
 #include "transfer_engine.h"
 
+#include <signal.h>
+
 #include <algorithm>
 #include <cctype>
 #include <cstdlib>
 #include <fstream>
 #include <string>
 
+#include "config.h"
+#include "flight_recorder.h"
 #include "transfer_metadata_plugin.h"
 #include "transport/transport.h"
 
@@ -45,6 +49,7 @@ int TransferEngine::init(const std::string &metadata_conn_string,
               << ", Metadata: " << metadata_conn_string
               << ", ip_or_host_name: " << ip_or_host_name
               << ", rpc_port: " << rpc_port;
+    FlightRecorder::installSignalHandler(SIGUSR2);
 
     TransferMetadata::RpcMetaDesc desc;
     std::string rpc_binding_method;
@@ -152,6 +157,9 @@ int TransferEngine::init(const std::string &metadata_conn_string,
         LOG(INFO) << "Topology discovery complete. Found "
                   << local_topology_->getHcaList().size() << " HCAs.";
 
+        // The transports installed below publish the segment once, at the
+        // end
+        metadata_->holdLocalSegmentUpdates();
 #ifdef USE_MNNVL
         if (local_topology_->getHcaList().size() > 0 && !getenv("MC_FORCE_MNNVL")) {
             multi_transports_->installTransport("rdma", local_topology_);
@@ -166,7 +174,13 @@ int TransferEngine::init(const std::string &metadata_conn_string,
             multi_transports_->installTransport("tcp", nullptr);
         }
 #endif
+        // Requests to peers advertising a TCP data port fail over to it
+        if (globalConfig().tcp_fallback &&
+            !multi_transports_->getTransport("tcp"))
+            multi_transports_->installTransport("tcp", nullptr);
         // TODO: install other transports automatically
+        ret = metadata_->releaseLocalSegmentUpdates();
+        if (ret) return ret;
     }
 #endif
 
@@ -174,6 +188,11 @@ int TransferEngine::init(const std::string &metadata_conn_string,
 }
 
 int TransferEngine::freeEngine() {
+#ifdef USE_CUDA
+    stream_trigger_.reset();
+#endif
+    has_batch_notifier_.store(false);
+    batch_notifier_.reset();
     if (metadata_) {
         metadata_->removeRpcMetaEntry(local_server_name_);
         metadata_.reset();
@@ -181,6 +200,70 @@ int TransferEngine::freeEngine() {
     return 0;
 }
 
+BatchNotifier *TransferEngine::batchNotifier() {
+    std::lock_guard<std::mutex> lock(batch_notifier_mutex_);
+    if (!batch_notifier_) {
+        batch_notifier_ = std::make_unique<BatchNotifier>(multi_transports_);
+        has_batch_notifier_.store(true, std::memory_order_release);
+    }
+    return batch_notifier_.get();
+}
+
+#ifdef USE_CUDA
+StreamTrigger *TransferEngine::streamTrigger() {
+    std::lock_guard<std::mutex> lock(stream_trigger_mutex_);
+    if (!stream_trigger_)
+        stream_trigger_ = std::make_unique<StreamTrigger>(multi_transports_);
+    return stream_trigger_.get();
+}
+
+Status TransferEngine::submitTransferOnStream(
+    BatchID batch_id, const std::vector<TransferRequest> &entries,
+    cudaStream_t stream) {
+    return streamTrigger()->submit(batch_id, entries, stream);
+}
+
+Status TransferEngine::waitTransferOnStream(BatchID batch_id,
+                                            cudaStream_t stream) {
+    return streamTrigger()->wait(batch_id, stream);
+}
+
+Status TransferEngine::transferOnStream(
+    const std::vector<TransferRequest> &entries, cudaStream_t stream,
+    std::function<void(const TransferStatus &)> done) {
+    BatchID batch_id = allocateBatchID(entries.size());
+    if (batch_id == Transport::INVALID_BATCH_ID)
+        return Status::InvalidArgument("failed to allocate a batch");
+    Status s = streamTrigger()->submit(batch_id, entries, stream);
+    if (!s.ok()) {
+        freeBatchID(batch_id);
+        return s;
+    }
+    s = streamTrigger()->wait(batch_id, stream, [this, batch_id, done]() {
+        if (done) {
+            TransferStatus status;
+            if (!getBatchTransferStatus(batch_id, status).ok())
+                status.s = Transport::TransferStatusEnum::FAILED;
+            done(status);
+        }
+        freeBatchID(batch_id);
+    });
+    // The submission is queued already, the batch can only be left behind
+    if (!s.ok())
+        LOG(ERROR) << "Failed to wait for batch " << batch_id
+                   << " on the stream: " << s.ToString();
+    return s;
+}
+
+Status TransferEngine::holdStream(cudaStream_t stream, uint64_t &handle) {
+    return streamTrigger()->hold(stream, handle);
+}
+
+void TransferEngine::releaseStream(uint64_t handle) {
+    streamTrigger()->release(handle);
+}
+#endif
+
 // Only for testing
 Transport *TransferEngine::installTransport(const std::string &proto,
                                             void **args) {
@@ -199,8 +282,13 @@ Transport *TransferEngine::installTransport(const std::string &proto,
         }
     }
 
+    // The segment is published once the regions are registered
+    metadata_->holdLocalSegmentUpdates();
     transport = multi_transports_->installTransport(proto, local_topology_);
-    if (!transport) return nullptr;
+    if (!transport) {
+        metadata_->releaseLocalSegmentUpdates();
+        return nullptr;
+    }
 
     // Since installTransport() is only called once during initialization
     // and is not expected to be executed concurrently, we do not acquire a
@@ -210,8 +298,12 @@ Transport *TransferEngine::installTransport(const std::string &proto,
     for (auto &entry : local_memory_regions_) {
         int ret = transport->registerLocalMemory(
             entry.addr, entry.length, entry.location, entry.remote_accessible);
-        if (ret < 0) return nullptr;
+        if (ret < 0) {
+            metadata_->releaseLocalSegmentUpdates();
+            return nullptr;
+        }
     }
+    if (metadata_->releaseLocalSegmentUpdates()) return nullptr;
     return transport;
 }
 
@@ -224,6 +316,67 @@ std::string TransferEngine::getLocalIpAndPort() {
            std::to_string(metadata_->localRpcMeta().rpc_port);
 }
 
+Status TransferEngine::submitTransferWithImm(
+    BatchID batch_id, const std::vector<TransferRequest> &entries,
+    uint32_t imm_data) {
+    if (entries.empty())
+        return Status::InvalidArgument("No transfer to notify of");
+    if (!globalConfig().inband_notify || globalConfig().enable_dc)
+        return Status::NotSupportedTransport(
+            "In-band notifications need MC_INBAND_NOTIFY and RC endpoints");
+    auto rdma = multi_transports_->getTransport("rdma");
+    auto desc = metadata_->getSegmentDescByID(entries.back().target_id);
+    if (!rdma || !desc || desc->protocol != "rdma")
+        return Status::NotSupportedTransport(
+            "In-band notifications need an RDMA target segment");
+
+    // The notification carries no data, it only needs registered addresses
+    // on both sides
+    TransferRequest notify = entries.back();
+    notify.opcode = TransferRequest::WRITE;
+    notify.length = 0;
+    notify.traffic_class = TransferRequest::LATENCY;
+    notify.options.with_imm = true;
+    notify.options.imm_data = imm_data;
+
+    Status s = multi_transports_->submitTransfer(batch_id, entries);
+    if (!s.ok()) return s;
+    return batchNotifier()->addCallback(
+        batch_id, [this, rdma, notify](BatchID id,
+                                       const TransferStatus &status) {
+            if (status.s != TransferStatusEnum::COMPLETED) {
+                LOG(WARNING) << "Batch " << id
+                             << " failed, its notification is not sent";
+                return;
+            }
+            BatchID notify_batch_id = allocateBatchID(1);
+            Status s = rdma->submitTransfer(notify_batch_id, {notify});
+            if (s.ok())
+                s = batchNotifier()->setCallback(
+                    notify_batch_id,
+                    [this, id](BatchID notify_batch_id,
+                               const TransferStatus &status) {
+                        if (status.s != TransferStatusEnum::COMPLETED)
+                            LOG(WARNING) << "Failed to send the notification "
+                                            "of batch "
+                                         << id;
+                        freeBatchID(notify_batch_id);
+                    });
+            if (!s.ok()) {
+                LOG(WARNING) << "Failed to send the notification of batch "
+                             << id << ": " << s.ToString();
+                freeBatchID(notify_batch_id);
+            }
+        });
+}
+
+int TransferEngine::getImmNotifies(
+    std::vector<Transport::ImmNotify> &notifies) {
+    for (auto transport : multi_transports_->listTransports())
+        transport->popImmNotifies(notifies);
+    return 0;
+}
+
 int TransferEngine::getNotifies(
     std::vector<TransferMetadata::NotifyDesc> &notifies) {
     return metadata_->getNotifies(notifies);
@@ -247,7 +400,33 @@ Transport::SegmentHandle TransferEngine::openSegment(
     return metadata_->getSegmentID(trimmed_segment_name);
 }
 
-int TransferEngine::closeSegment(Transport::SegmentHandle handle) { return 0; }
+std::vector<Transport::SegmentHandle> TransferEngine::openSegments(
+    const std::vector<std::string> &segment_names) {
+    std::vector<Transport::SegmentHandle> handles(segment_names.size(),
+                                                  ERR_INVALID_ARGUMENT);
+    std::vector<std::string> trimmed_segment_names;
+    std::vector<size_t> indexes;
+    for (size_t i = 0; i < segment_names.size(); ++i) {
+        std::string trimmed_segment_name = segment_names[i];
+        while (!trimmed_segment_name.empty() && trimmed_segment_name[0] == '/')
+            trimmed_segment_name.erase(0, 1);
+        if (trimmed_segment_name.empty()) continue;
+        trimmed_segment_names.push_back(trimmed_segment_name);
+        indexes.push_back(i);
+    }
+    auto ids = metadata_->getSegmentIDs(trimmed_segment_names);
+    for (size_t i = 0; i < ids.size(); ++i) handles[indexes[i]] = ids[i];
+    return handles;
+}
+
+int TransferEngine::closeSegment(Transport::SegmentHandle handle) {
+    return multi_transports_->closeSegment(handle);
+}
+
+int TransferEngine::updateConfig(const std::string &name,
+                                 const std::string &value) {
+    return updateConfigOption(name, value);
+}
 
 int TransferEngine::removeLocalSegment(const std::string &segment_name) {
     if (segment_name.empty()) return ERR_INVALID_ARGUMENT;
@@ -404,6 +583,14 @@ void TransferEngine::StartMetricsReportingThread() {
         LOG(INFO) << "Metrics reporting thread started (interval: "
                   << metrics_interval_seconds_ << "s)";
         constexpr double kBytesPerMegabyte = 1024.0 * 1024.0;
+        auto last_slice_stats = Transport::getSliceStats();
+        Transport::TrafficClassStats
+            last_class_stats[TransferRequest::kTrafficClassCount];
+        for (int traffic_class = 0;
+             traffic_class < TransferRequest::kTrafficClassCount;
+             ++traffic_class)
+            last_class_stats[traffic_class] = Transport::getTrafficClassStats(
+                TransferRequest::TrafficClass(traffic_class));
 
         while (!should_stop_metrics_thread_) {
             // Sleep for the interval, checking periodically for stop signal
@@ -422,6 +609,41 @@ void TransferEngine::StartMetricsReportingThread() {
             transferred_bytes_counter_
                 .reset();  // Reset counter for the next interval
 
+            auto slice_stats = Transport::getSliceStats();
+            auto slices_reused = slice_stats.reused - last_slice_stats.reused;
+            auto slices_allocated =
+                slice_stats.allocated - last_slice_stats.allocated;
+            if (slices_reused || slices_allocated) {
+                LOG(INFO) << "[Metrics] Slices: " << slices_allocated
+                          << " allocated, " << slices_reused << " reused, "
+                          << slice_stats.freed - last_slice_stats.freed
+                          << " freed (over last " << metrics_interval_seconds_
+                          << "s)";
+            }
+            last_slice_stats = slice_stats;
+
+            for (int traffic_class = 0;
+                 traffic_class < TransferRequest::kTrafficClassCount;
+                 ++traffic_class) {
+                auto class_stats = Transport::getTrafficClassStats(
+                    TransferRequest::TrafficClass(traffic_class));
+                auto &last = last_class_stats[traffic_class];
+                auto slices = class_stats.slices - last.slices;
+                if (slices) {
+                    LOG(INFO)
+                        << "[Metrics] Traffic class " << traffic_class << ": "
+                        << std::fixed << std::setprecision(2)
+                        << (class_stats.bytes - last.bytes) /
+                               (metrics_interval_seconds_ * kBytesPerMegabyte)
+                        << " MB/s, " << slices << " slices, average latency "
+                        << (class_stats.latency_ns - last.latency_ns) /
+                               (slices * 1000.0)
+                        << " us (over last " << metrics_interval_seconds_
+                        << "s)";
+                }
+                last = class_stats;
+            }
+
             if (bytes_transferred_in_interval == 0) {
                 continue;
             }
@@ -185,13 +185,72 @@ notify_msg_t* getNotifsFromEngine(transfer_engine_t engine,
     return notifies;
 }
 
+int getBatchTransferStatus(transfer_engine_t engine, batch_id_t batch_id,
+                           struct transfer_status *status) {
+    TransferEngine *native = (TransferEngine *)engine;
+    Transport::TransferStatus native_status;
+    Status s = native->getBatchTransferStatus((Transport::BatchID)batch_id,
+                                              native_status);
+    if (s.ok()) {
+        status->status = (int)native_status.s;
+        status->transferred_bytes = native_status.transferred_bytes;
+    }
+    return (int)s.code();
+}
+
+int setBatchCallback(transfer_engine_t engine, batch_id_t batch_id,
+                     transfer_callback_t callback, void *user_data) {
+    if (!callback) return (int)Status::Code::kInvalidArgument;
+    TransferEngine *native = (TransferEngine *)engine;
+    Status s = native->setBatchCallback(
+        (Transport::BatchID)batch_id,
+        [callback, user_data](Transport::BatchID id,
+                              const Transport::TransferStatus &status) {
+            struct transfer_status c_status;
+            c_status.status = (int)status.s;
+            c_status.transferred_bytes = status.transferred_bytes;
+            callback((batch_id_t)id, c_status, user_data);
+        });
+    return (int)s.code();
+}
+
+int getBatchEventFd(transfer_engine_t engine, batch_id_t batch_id, int *fd) {
+    TransferEngine *native = (TransferEngine *)engine;
+    Status s = native->getBatchEventFd((Transport::BatchID)batch_id, *fd);
+    return (int)s.code();
+}
+
 int freeBatchID(transfer_engine_t engine, batch_id_t batch_id) {
     TransferEngine *native = (TransferEngine *)engine;
     Status s = native->freeBatchID(batch_id);
     return (int)s.code();
 }
 
+int setBatchDeadline(transfer_engine_t engine, batch_id_t batch_id,
+                     int64_t deadline_ns) {
+    TransferEngine *native = (TransferEngine *)engine;
+    Status s = native->setBatchDeadline(batch_id, deadline_ns);
+    return (int)s.code();
+}
+
+int cancelBatch(transfer_engine_t engine, batch_id_t batch_id) {
+    TransferEngine *native = (TransferEngine *)engine;
+    Status s = native->cancelBatch(batch_id);
+    return (int)s.code();
+}
+
 int syncSegmentCache(transfer_engine_t engine) {
     TransferEngine *native = (TransferEngine *)engine;
     return native->syncSegmentCache();
 }
+
+int warmupSegment(transfer_engine_t engine, const char *segment_name) {
+    TransferEngine *native = (TransferEngine *)engine;
+    return native->warmupSegments({segment_name});
+}
+
+int updateConfig(transfer_engine_t engine, const char *name,
+                 const char *value) {
+    TransferEngine *native = (TransferEngine *)engine;
+    return native->updateConfig(name, value);
+}
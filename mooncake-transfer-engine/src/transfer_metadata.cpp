@@ -16,8 +16,14 @@
 
 #include <json/value.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <random>
 #include <set>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "common.h"
 #include "config.h"
@@ -28,6 +34,12 @@ namespace mooncake {
 
 const static std::string kCommonKeyPrefix = "mooncake/";
 const static std::string kRpcMetaPrefix = kCommonKeyPrefix + "rpc_meta/";
+// Key of the deltas published on top of a segment descriptor, appended to
+// the key of the descriptor
+const static std::string kDeltaKeySuffix = "@delta";
+// Deltas published before the descriptor is published in full again
+const static size_t kMaxSegmentDeltas = 16;
+const static uint8_t kCompactBuffersVersion = 1;
 
 // mooncake/segments/[...]
 static inline std::string getFullMetadataKey(const std::string &segment_name) {
@@ -54,6 +66,25 @@ struct TransferNotifyUtil {
     }
 };
 
+struct TransferCreditUtil {
+    static Json::Value encode(const TransferMetadata::CreditDesc &desc) {
+        Json::Value root;
+        root["name"] = desc.name;
+        root["demand"] = static_cast<Json::UInt64>(desc.demand);
+        root["rate"] = static_cast<Json::UInt64>(desc.rate);
+        root["lease_ms"] = desc.lease_ms;
+        return root;
+    }
+
+    static void decode(const Json::Value &root,
+                       TransferMetadata::CreditDesc &desc) {
+        desc.name = root["name"].asString();
+        desc.demand = root["demand"].asUInt64();
+        desc.rate = root["rate"].asUInt64();
+        desc.lease_ms = root["lease_ms"].asUInt();
+    }
+};
+
 struct TransferHandshakeUtil {
     static Json::Value encode(const TransferMetadata::HandShakeDesc &desc) {
         Json::Value root;
@@ -77,7 +108,9 @@ struct TransferHandshakeUtil {
     }
 };
 
-TransferMetadata::TransferMetadata(const std::string &conn_string) {
+TransferMetadata::TransferMetadata(const std::string &conn_string)
+    : incarnation_(std::random_device{}() | (uint64_t)std::random_device{}()
+                                                 << 32 | 1) {
     next_segment_id_.store(1);
     handshake_plugin_ = HandShakePlugin::Create(conn_string);
     if (!handshake_plugin_) {
@@ -94,10 +127,86 @@ TransferMetadata::TransferMetadata(const std::string &conn_string) {
         LOG(ERROR)
             << "Unable to create metadata storage plugin with conn string "
             << conn_string;
+        return;
+    }
+    // Otherwise cached descriptors are only refreshed by syncSegmentCache()
+    auto on_change = [this](const std::string &key) {
+        std::lock_guard<std::mutex> lock(watch_mutex_);
+        changed_keys_.insert(key);
+        watch_cond_.notify_one();
+    };
+    if (globalConfig().metadata_watch &&
+        storage_plugin_->watch(kCommonKeyPrefix, on_change)) {
+        watch_running_ = true;
+        watch_thread_ =
+            std::thread(&TransferMetadata::refreshChangedEntries, this);
     }
 }
 
-TransferMetadata::~TransferMetadata() { handshake_plugin_.reset(); }
+TransferMetadata::~TransferMetadata() {
+    if (watch_thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(watch_mutex_);
+            watch_running_ = false;
+        }
+        watch_cond_.notify_all();
+        watch_thread_.join();
+    }
+    // Stops the notifications before what they are queued to is destroyed
+    storage_plugin_.reset();
+    handshake_plugin_.reset();
+}
+
+void TransferMetadata::refreshChangedEntries() {
+    std::unique_lock<std::mutex> lock(watch_mutex_);
+    while (true) {
+        watch_cond_.wait(
+            lock, [&] { return !watch_running_ || !changed_keys_.empty(); });
+        if (!watch_running_) return;
+        auto keys = std::move(changed_keys_);
+        changed_keys_.clear();
+        lock.unlock();
+        refreshEntries(keys);
+        lock.lock();
+    }
+}
+
+void TransferMetadata::refreshEntries(const std::set<std::string> &keys) {
+    const bool all = keys.count("");
+    {
+        RWSpinlock::WriteGuard guard(rpc_meta_lock_);
+        if (all) rpc_meta_map_.clear();
+        for (auto &key : keys)
+            if (key.compare(0, kRpcMetaPrefix.size(), kRpcMetaPrefix) == 0)
+                rpc_meta_map_.erase(key.substr(kRpcMetaPrefix.size()));
+    }
+
+    std::vector<std::pair<SegmentID, std::shared_ptr<SegmentDesc>>> changed;
+    {
+        RWSpinlock::ReadGuard guard(segment_lock_);
+        for (auto &entry : segment_id_to_desc_map_) {
+            if (entry.first == LOCAL_SEGMENT_ID) continue;
+            auto key = getFullMetadataKey(entry.second->name);
+            if (all || keys.count(key) || keys.count(key + kDeltaKeySuffix))
+                changed.push_back(entry);
+        }
+    }
+    // Fetched without holding the lock, and dropped if the cached descriptor
+    // was replaced meanwhile
+    for (auto &entry : changed) {
+        auto segment_desc = getSegmentDesc(entry.second->name, entry.second);
+        if (!segment_desc) {
+            LOG(WARNING) << "segment " << entry.second->name
+                         << " is now invalid";
+            continue;
+        }
+        RWSpinlock::WriteGuard guard(segment_lock_);
+        auto iter = segment_id_to_desc_map_.find(entry.first);
+        if (iter != segment_id_to_desc_map_.end() &&
+            iter->second == entry.second)
+            iter->second = segment_desc;
+    }
+}
 
 int TransferMetadata::receivePeerNotify(const Json::Value &peer_json,
                                         Json::Value &local_json) {
@@ -122,51 +231,354 @@ int TransferMetadata::getNotifies(
     return 0;
 }
 
+void TransferMetadata::BufferIndex::build(
+    const std::vector<BufferDesc> &buffers) const {
+    static std::atomic<uint64_t> next_id{1};
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (built_.load(std::memory_order_relaxed)) return;
+    order_.resize(buffers.size());
+    for (size_t i = 0; i < buffers.size(); ++i) order_[i] = i;
+    std::sort(order_.begin(), order_.end(), [&](int lhs, int rhs) {
+        return buffers[lhs].addr < buffers[rhs].addr;
+    });
+    max_length_ = 0;
+    for (auto &buffer : buffers)
+        max_length_ = std::max(max_length_, buffer.length);
+    id_ = next_id.fetch_add(1);
+    built_.store(true, std::memory_order_release);
+}
+
+int TransferMetadata::BufferIndex::find(const std::vector<BufferDesc> &buffers,
+                                        uint64_t addr, size_t length) const {
+    struct Hit {
+        uint64_t index_id = 0;
+        int buffer_id = -1;
+    };
+    // A few slots, as sources and targets of a transfer are looked up in
+    // different segments
+    const static size_t kHitSlots = 4;
+    thread_local Hit hits[kHitSlots];
+    thread_local size_t next_slot = 0;
+
+    if (!built_.load(std::memory_order_acquire)) build(buffers);
+    auto contains = [&](int id) {
+        const auto &buffer = buffers[id];
+        return addr >= buffer.addr && length <= buffer.length &&
+               addr - buffer.addr <= buffer.length - length;
+    };
+    for (auto &hit : hits)
+        if (hit.index_id == id_ && contains(hit.buffer_id))
+            return hit.buffer_id;
+
+    // Walk down from the last buffer starting at or below addr, as long as
+    // a buffer starting there may still reach it
+    auto it = std::upper_bound(
+        order_.begin(), order_.end(), addr,
+        [&](uint64_t value, int id) { return value < buffers[id].addr; });
+    while (it != order_.begin()) {
+        --it;
+        if (addr - buffers[*it].addr > max_length_) break;
+        if (contains(*it)) {
+            hits[next_slot++ % kHitSlots] = {id_, *it};
+            return *it;
+        }
+    }
+    return -1;
+}
+
+namespace {
+
+void putVarint(std::string &out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+bool getVarint(const std::string &in, size_t &pos, uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && pos < in.size(); shift += 7) {
+        uint8_t byte = in[pos++];
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+void putZigzag(std::string &out, int64_t value) {
+    putVarint(out, (uint64_t)value << 1 ^ (uint64_t)(value >> 63));
+}
+
+bool getZigzag(const std::string &in, size_t &pos, int64_t &value) {
+    uint64_t zigzag;
+    if (!getVarint(in, pos, zigzag)) return false;
+    value = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+    return true;
+}
+
+void putString(std::string &out, const std::string &value) {
+    putVarint(out, value.size());
+    out.append(value);
+}
+
+bool getString(const std::string &in, size_t &pos, std::string &value) {
+    uint64_t size;
+    if (!getVarint(in, pos, size) || size > in.size() - pos) return false;
+    value.assign(in, pos, size);
+    pos += size;
+    return true;
+}
+
+const char kBase64Chars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+std::string encodeBase64(const std::string &in) {
+    std::string out;
+    out.reserve((in.size() + 2) / 3 * 4);
+    for (size_t i = 0; i < in.size(); i += 3) {
+        uint32_t triple = (uint8_t)in[i] << 16;
+        if (i + 1 < in.size()) triple |= (uint8_t)in[i + 1] << 8;
+        if (i + 2 < in.size()) triple |= (uint8_t)in[i + 2];
+        out.push_back(kBase64Chars[(triple >> 18) & 0x3f]);
+        out.push_back(kBase64Chars[(triple >> 12) & 0x3f]);
+        out.push_back(i + 1 < in.size() ? kBase64Chars[(triple >> 6) & 0x3f]
+                                        : '=');
+        out.push_back(i + 2 < in.size() ? kBase64Chars[triple & 0x3f] : '=');
+    }
+    return out;
+}
+
+bool decodeBase64(const std::string &in, std::string &out) {
+    if (in.size() % 4) return false;
+    out.clear();
+    out.reserve(in.size() / 4 * 3);
+    uint32_t bits = 0;
+    int count = 0;
+    // Padding only ends the input
+    size_t padding = in.find('=');
+    if (padding != std::string::npos &&
+        (padding + 2 < in.size() ||
+         in.find_first_not_of('=', padding) != std::string::npos))
+        return false;
+    for (size_t i = 0; i < std::min(padding, in.size()); ++i) {
+        char c = in[i];
+        const char *pos = strchr(kBase64Chars, c);
+        if (!c || !pos) return false;
+        bits = bits << 6 | (pos - kBase64Chars);
+        if (++count == 4) {
+            out.push_back((char)(bits >> 16));
+            out.push_back((char)(bits >> 8));
+            out.push_back((char)bits);
+            bits = 0;
+            count = 0;
+        }
+    }
+    if (count == 3) {
+        out.push_back((char)(bits >> 10));
+        out.push_back((char)(bits >> 2));
+    } else if (count == 2) {
+        out.push_back((char)(bits >> 4));
+    } else if (count) {
+        return false;
+    }
+    return true;
+}
+
+Json::Value encodeBuffersJSON(
+    const std::vector<TransferMetadata::BufferDesc> &buffers,
+    const std::string &protocol) {
+    Json::Value buffersJSON(Json::arrayValue);
+    for (const auto &buffer : buffers) {
+        Json::Value bufferJSON;
+        bufferJSON["name"] = buffer.name;
+        bufferJSON["addr"] = static_cast<Json::UInt64>(buffer.addr);
+        bufferJSON["length"] = static_cast<Json::UInt64>(buffer.length);
+        if (protocol == "rdma") {
+            Json::Value rkeyJSON(Json::arrayValue);
+            for (auto &entry : buffer.rkey) rkeyJSON.append(entry);
+            bufferJSON["rkey"] = rkeyJSON;
+            Json::Value lkeyJSON(Json::arrayValue);
+            for (auto &entry : buffer.lkey) lkeyJSON.append(entry);
+            bufferJSON["lkey"] = lkeyJSON;
+        } else if (protocol == "nvlink") {
+            bufferJSON["shm_name"] = buffer.shm_name;
+        }
+        buffersJSON.append(bufferJSON);
+    }
+    return buffersJSON;
+}
+
+// Buffers of segmentJSON, or of a delta, in either encoding
+bool decodeBuffers(const Json::Value &segmentJSON,
+                   std::vector<TransferMetadata::BufferDesc> &buffers) {
+    if (segmentJSON.isMember("compact_buffers")) {
+        std::string blob;
+        return decodeBase64(segmentJSON["compact_buffers"].asString(),
+                            blob) &&
+               TransferMetadata::decodeCompactBuffers(blob, buffers);
+    }
+    for (const auto &bufferJSON : segmentJSON["buffers"]) {
+        TransferMetadata::BufferDesc buffer;
+        buffer.name = bufferJSON["name"].asString();
+        buffer.addr = bufferJSON["addr"].asUInt64();
+        buffer.length = bufferJSON["length"].asUInt64();
+        for (const auto &rkeyJSON : bufferJSON["rkey"])
+            buffer.rkey.push_back(rkeyJSON.asUInt());
+        for (const auto &lkeyJSON : bufferJSON["lkey"])
+            buffer.lkey.push_back(lkeyJSON.asUInt());
+        buffer.shm_name = bufferJSON["shm_name"].asString();
+        buffers.push_back(buffer);
+    }
+    return true;
+}
+
+bool sameBuffer(const TransferMetadata::BufferDesc &lhs,
+                const TransferMetadata::BufferDesc &rhs) {
+    return lhs.addr == rhs.addr && lhs.length == rhs.length &&
+           lhs.name == rhs.name && lhs.rkey == rhs.rkey &&
+           lhs.lkey == rhs.lkey && lhs.shm_name == rhs.shm_name;
+}
+
+}  // namespace
+
+std::string TransferMetadata::encodeCompactBuffers(
+    const std::vector<BufferDesc> &buffers) {
+    // By address, so that addresses are stored as small differences
+    std::vector<const BufferDesc *> sorted;
+    sorted.reserve(buffers.size());
+    for (auto &buffer : buffers) sorted.push_back(&buffer);
+    std::sort(sorted.begin(), sorted.end(),
+              [](const BufferDesc *lhs, const BufferDesc *rhs) {
+                  return lhs->addr < rhs->addr;
+              });
+
+    std::string out;
+    out.push_back((char)kCompactBuffersVersion);
+    std::vector<std::string> names;
+    std::unordered_map<std::string, uint64_t> name_ids;
+    for (auto buffer : sorted)
+        if (name_ids.emplace(buffer->name, names.size()).second)
+            names.push_back(buffer->name);
+    putVarint(out, names.size());
+    for (auto &name : names) putString(out, name);
+
+    putVarint(out, sorted.size());
+    uint64_t prev_addr = 0;
+    std::vector<uint32_t> prev_rkey;
+    for (auto buffer : sorted) {
+        putVarint(out, name_ids[buffer->name]);
+        putVarint(out, buffer->addr - prev_addr);
+        prev_addr = buffer->addr;
+        putVarint(out, buffer->length);
+        // Keys of regions registered one after the other on a device are
+        // usually close, and lkeys are usually close to their rkeys
+        putVarint(out, buffer->rkey.size());
+        for (size_t i = 0; i < buffer->rkey.size(); ++i)
+            putZigzag(out, (int64_t)buffer->rkey[i] -
+                               (i < prev_rkey.size() ? prev_rkey[i] : 0));
+        prev_rkey = buffer->rkey;
+        putVarint(out, buffer->lkey.size());
+        for (size_t i = 0; i < buffer->lkey.size(); ++i)
+            putZigzag(out,
+                      (int64_t)buffer->lkey[i] -
+                          (i < buffer->rkey.size() ? buffer->rkey[i] : 0));
+        putString(out, buffer->shm_name);
+    }
+    return out;
+}
+
+bool TransferMetadata::decodeCompactBuffers(const std::string &blob,
+                                            std::vector<BufferDesc> &buffers) {
+    if (blob.empty() || (uint8_t)blob[0] != kCompactBuffersVersion)
+        return false;
+    size_t pos = 1;
+    uint64_t count;
+    // Counts are bounded by the size of the blob, which each entry takes
+    // at least one byte of
+    if (!getVarint(blob, pos, count) || count > blob.size()) return false;
+    std::vector<std::string> names(count);
+    for (auto &name : names)
+        if (!getString(blob, pos, name)) return false;
+
+    if (!getVarint(blob, pos, count) || count > blob.size()) return false;
+    uint64_t addr = 0;
+    std::vector<uint32_t> prev_rkey;
+    for (uint64_t i = 0; i < count; ++i) {
+        BufferDesc buffer;
+        uint64_t name_id, addr_diff, key_count;
+        if (!getVarint(blob, pos, name_id) || name_id >= names.size() ||
+            !getVarint(blob, pos, addr_diff) ||
+            !getVarint(blob, pos, buffer.length) ||
+            !getVarint(blob, pos, key_count) || key_count > blob.size())
+            return false;
+        buffer.name = names[name_id];
+        addr += addr_diff;
+        buffer.addr = addr;
+        for (uint64_t j = 0; j < key_count; ++j) {
+            int64_t rkey;
+            if (!getZigzag(blob, pos, rkey)) return false;
+            if (j < prev_rkey.size()) rkey += prev_rkey[j];
+            buffer.rkey.push_back((uint32_t)rkey);
+        }
+        prev_rkey = buffer.rkey;
+        if (!getVarint(blob, pos, key_count) || key_count > blob.size())
+            return false;
+        for (uint64_t j = 0; j < key_count; ++j) {
+            int64_t lkey;
+            if (!getZigzag(blob, pos, lkey)) return false;
+            if (j < buffer.rkey.size()) lkey += buffer.rkey[j];
+            buffer.lkey.push_back((uint32_t)lkey);
+        }
+        if (!getString(blob, pos, buffer.shm_name)) return false;
+        buffers.push_back(std::move(buffer));
+    }
+    return pos == blob.size();
+}
+
 int TransferMetadata::encodeSegmentDesc(const SegmentDesc &desc,
                                         Json::Value &segmentJSON) {
+    return encodeSegmentDesc(desc, segmentJSON,
+                             globalConfig().compact_metadata
+                                 ? BufferEncoding::kCompact
+                                 : BufferEncoding::kJson);
+}
+
+int TransferMetadata::encodeSegmentDesc(const SegmentDesc &desc,
+                                        Json::Value &segmentJSON,
+                                        BufferEncoding encoding) {
     segmentJSON["name"] = desc.name;
     segmentJSON["protocol"] = desc.protocol;
     segmentJSON["tcp_data_port"] = desc.tcp_data_port;
     segmentJSON["timestamp"] = getCurrentDateTime();
 
-    if (segmentJSON["protocol"] == "rdma") {
+    if (desc.protocol != "rdma" && desc.protocol != "tcp" &&
+        desc.protocol != "cxl" && desc.protocol != "shm" &&
+        desc.protocol != "ascend" && desc.protocol != "nvlink") {
+        LOG(ERROR) << "Unsupported segment descriptor for register, name "
+                   << desc.name << " protocol " << desc.protocol;
+        return ERR_METADATA;
+    }
+    if (encoding == BufferEncoding::kJson)
+        segmentJSON["buffers"] =
+            encodeBuffersJSON(desc.buffers, desc.protocol);
+    else if (encoding == BufferEncoding::kCompact)
+        segmentJSON["compact_buffers"] =
+            encodeBase64(encodeCompactBuffers(desc.buffers));
+
+    if (desc.protocol == "rdma") {
         Json::Value devicesJSON(Json::arrayValue);
         for (const auto &device : desc.devices) {
             Json::Value deviceJSON;
             deviceJSON["name"] = device.name;
             deviceJSON["lid"] = device.lid;
             deviceJSON["gid"] = device.gid;
+            if (device.dct_num) deviceJSON["dct_num"] = device.dct_num;
             devicesJSON.append(deviceJSON);
         }
         segmentJSON["devices"] = devicesJSON;
-
-        Json::Value buffersJSON(Json::arrayValue);
-        for (const auto &buffer : desc.buffers) {
-            Json::Value bufferJSON;
-            bufferJSON["name"] = buffer.name;
-            bufferJSON["addr"] = static_cast<Json::UInt64>(buffer.addr);
-            bufferJSON["length"] = static_cast<Json::UInt64>(buffer.length);
-            Json::Value rkeyJSON(Json::arrayValue);
-            for (auto &entry : buffer.rkey) rkeyJSON.append(entry);
-            bufferJSON["rkey"] = rkeyJSON;
-            Json::Value lkeyJSON(Json::arrayValue);
-            for (auto &entry : buffer.lkey) lkeyJSON.append(entry);
-            bufferJSON["lkey"] = lkeyJSON;
-            buffersJSON.append(bufferJSON);
-        }
-        segmentJSON["buffers"] = buffersJSON;
         segmentJSON["priority_matrix"] = desc.topology.toJson();
-    } else if (segmentJSON["protocol"] == "tcp") {
-        Json::Value buffersJSON(Json::arrayValue);
-        for (const auto &buffer : desc.buffers) {
-            Json::Value bufferJSON;
-            bufferJSON["name"] = buffer.name;
-            bufferJSON["addr"] = static_cast<Json::UInt64>(buffer.addr);
-            bufferJSON["length"] = static_cast<Json::UInt64>(buffer.length);
-            buffersJSON.append(bufferJSON);
-        }
-        segmentJSON["buffers"] = buffersJSON;
-    } else if (segmentJSON["protocol"] == "ascend") {
+    } else if (desc.protocol == "ascend") {
         Json::Value devicesJSON(Json::arrayValue);
         for (const auto &device : desc.devices) {
             Json::Value deviceJSON;
@@ -175,15 +587,6 @@ int TransferMetadata::encodeSegmentDesc(const SegmentDesc &desc,
             devicesJSON.append(deviceJSON);
         }
         segmentJSON["devices"] = devicesJSON;
-        Json::Value buffersJSON(Json::arrayValue);
-        for (const auto &buffer : desc.buffers) {
-            Json::Value bufferJSON;
-            bufferJSON["name"] = buffer.name;
-            bufferJSON["addr"] = static_cast<Json::UInt64>(buffer.addr);
-            bufferJSON["length"] = static_cast<Json::UInt64>(buffer.length);
-            buffersJSON.append(bufferJSON);
-        }
-        segmentJSON["buffers"] = buffersJSON;
 
         Json::Value rankInfoJSON;
         rankInfoJSON["rankId"] = static_cast<Json::UInt64>(desc.rank_info.rankId);
@@ -197,21 +600,21 @@ int TransferMetadata::encodeSegmentDesc(const SegmentDesc &desc,
         rankInfoJSON["pid"] = static_cast<Json::UInt64>(desc.rank_info.pid);
 
         segmentJSON["rank_info"] = rankInfoJSON;
-    } else if (segmentJSON["protocol"] == "nvlink") {
-        Json::Value buffersJSON(Json::arrayValue);
-        for (const auto &buffer : desc.buffers) {
+    }
+
+    if (!desc.shm_buffers.empty()) {
+        segmentJSON["shm_host"] = desc.shm_host;
+        Json::Value shmBuffersJSON(Json::arrayValue);
+        for (const auto &buffer : desc.shm_buffers) {
             Json::Value bufferJSON;
-            bufferJSON["name"] = buffer.name;
             bufferJSON["addr"] = static_cast<Json::UInt64>(buffer.addr);
             bufferJSON["length"] = static_cast<Json::UInt64>(buffer.length);
             bufferJSON["shm_name"] = buffer.shm_name;
-            buffersJSON.append(bufferJSON);
+            bufferJSON["shm_offset"] =
+                static_cast<Json::UInt64>(buffer.shm_offset);
+            shmBuffersJSON.append(bufferJSON);
         }
-        segmentJSON["buffers"] = buffersJSON;
-    } else {
-        LOG(ERROR) << "Unsupported segment descriptor for register, name "
-                   << desc.name << " protocol " << desc.protocol;
-        return ERR_METADATA;
+        segmentJSON["shm_buffers"] = shmBuffersJSON;
     }
     return 0;
 }
@@ -221,9 +624,13 @@ int TransferMetadata::updateSegmentDesc(const std::string &segment_name,
     if (p2p_handshake_mode_) {
         return 0;
     }
+    if (globalConfig().peer_metadata && local_rpc_meta_.rpc_port)
+        return publishSegmentStub(segment_name, desc);
+    if (globalConfig().compact_metadata)
+        return publishSegmentDesc(segment_name, desc);
 
     Json::Value segmentJSON;
-    int ret = encodeSegmentDesc(desc, segmentJSON);
+    int ret = encodeSegmentDesc(desc, segmentJSON, BufferEncoding::kJson);
     if (ret) {
         return ret;
     }
@@ -237,6 +644,140 @@ int TransferMetadata::updateSegmentDesc(const std::string &segment_name,
     return 0;
 }
 
+int TransferMetadata::publishSegmentDesc(const std::string &segment_name,
+                                         const SegmentDesc &desc) {
+    std::lock_guard<std::mutex> lock(publish_mutex_);
+    auto &published = published_segments_[segment_name];
+    Json::Value headerJSON;
+    int ret = encodeSegmentDesc(desc, headerJSON, BufferEncoding::kNone);
+    if (ret) return ret;
+    headerJSON.removeMember("timestamp");
+    auto header = Json::FastWriter{}.write(headerJSON);
+    uint64_t version = published.version + 1;
+    const auto key = getFullMetadataKey(segment_name);
+
+    // As a delta when only buffers changed, which are then identified by
+    // their address
+    std::unordered_map<uint64_t, const BufferDesc *> old_buffers, new_buffers;
+    for (auto &buffer : published.buffers)
+        old_buffers.emplace(buffer.addr, &buffer);
+    for (auto &buffer : desc.buffers) new_buffers.emplace(buffer.addr, &buffer);
+    if (published.version && header == published.header &&
+        published.deltas.size() < kMaxSegmentDeltas &&
+        old_buffers.size() == published.buffers.size() &&
+        new_buffers.size() == desc.buffers.size()) {
+        Json::Value removedJSON(Json::arrayValue);
+        std::vector<BufferDesc> added;
+        for (auto &entry : old_buffers) {
+            auto iter = new_buffers.find(entry.first);
+            if (iter == new_buffers.end() ||
+                !sameBuffer(*entry.second, *iter->second))
+                removedJSON.append(static_cast<Json::UInt64>(entry.first));
+        }
+        for (auto &buffer : desc.buffers) {
+            auto iter = old_buffers.find(buffer.addr);
+            if (iter == old_buffers.end() || !sameBuffer(*iter->second, buffer))
+                added.push_back(buffer);
+        }
+        if (removedJSON.empty() && added.empty()) return 0;
+
+        Json::Value deltaJSON;
+        deltaJSON["version"] = static_cast<Json::UInt64>(version);
+        deltaJSON["remove"] = removedJSON;
+        deltaJSON["compact_buffers"] =
+            encodeBase64(encodeCompactBuffers(added));
+        Json::Value deltasJSON;
+        deltasJSON["incarnation"] = static_cast<Json::UInt64>(incarnation_);
+        deltasJSON["base_version"] =
+            static_cast<Json::UInt64>(published.base_version);
+        deltasJSON["version"] = static_cast<Json::UInt64>(version);
+        deltasJSON["deltas"] = published.deltas;
+        deltasJSON["deltas"].append(deltaJSON);
+        if (!storage_plugin_->set(key + kDeltaKeySuffix, deltasJSON)) {
+            LOG(ERROR) << "Failed to update segment descriptor, name "
+                       << desc.name << " protocol " << desc.protocol;
+            return ERR_METADATA;
+        }
+        published.deltas = deltasJSON["deltas"];
+        published.version = version;
+        published.buffers = desc.buffers;
+        return 0;
+    }
+
+    Json::Value segmentJSON;
+    ret = encodeSegmentDesc(desc, segmentJSON, BufferEncoding::kCompact);
+    if (ret) return ret;
+    segmentJSON["incarnation"] = static_cast<Json::UInt64>(incarnation_);
+    segmentJSON["version"] = static_cast<Json::UInt64>(version);
+    // Readers ignore deltas not based on the descriptor they got
+    Json::Value deltasJSON;
+    deltasJSON["incarnation"] = static_cast<Json::UInt64>(incarnation_);
+    deltasJSON["base_version"] = static_cast<Json::UInt64>(version);
+    deltasJSON["version"] = static_cast<Json::UInt64>(version);
+    deltasJSON["deltas"] = Json::Value(Json::arrayValue);
+    if (!storage_plugin_->setBatch(
+            {{key, segmentJSON}, {key + kDeltaKeySuffix, deltasJSON}})) {
+        LOG(ERROR) << "Failed to register segment descriptor, name "
+                   << desc.name << " protocol " << desc.protocol;
+        // The descriptor may be stored without its deltas reset, it is
+        // published in full again on the next update
+        published.version = 0;
+        return ERR_METADATA;
+    }
+    published.version = version;
+    published.base_version = version;
+    published.header = header;
+    published.buffers = desc.buffers;
+    published.deltas = deltasJSON["deltas"];
+    return 0;
+}
+
+int TransferMetadata::publishSegmentStub(const std::string &segment_name,
+                                         const SegmentDesc &desc) {
+    std::lock_guard<std::mutex> lock(publish_mutex_);
+    auto &published = published_segments_[segment_name];
+    Json::Value stubJSON;
+    stubJSON["name"] = desc.name;
+    stubJSON["protocol"] = desc.protocol;
+    stubJSON["timestamp"] = getCurrentDateTime();
+    stubJSON["peer_ip_or_host_name"] = local_rpc_meta_.ip_or_host_name;
+    stubJSON["peer_rpc_port"] =
+        static_cast<Json::UInt>(local_rpc_meta_.rpc_port);
+    // Changes on each update, so that watchers pull the descriptor again
+    stubJSON["incarnation"] = static_cast<Json::UInt64>(incarnation_);
+    stubJSON["version"] = static_cast<Json::UInt64>(published.version + 1);
+    if (!storage_plugin_->set(getFullMetadataKey(segment_name), stubJSON)) {
+        LOG(ERROR) << "Failed to register segment descriptor, name "
+                   << desc.name << " protocol " << desc.protocol;
+        return ERR_METADATA;
+    }
+    published.version++;
+    return 0;
+}
+
+int TransferMetadata::applySegmentDeltas(SegmentDesc &desc,
+                                         const Json::Value &deltasJSON) {
+    for (const auto &deltaJSON : deltasJSON["deltas"]) {
+        uint64_t version = deltaJSON["version"].asUInt64();
+        if (version <= desc.version) continue;
+        if (version != desc.version + 1) return ERR_METADATA;
+        std::set<uint64_t> removed;
+        for (const auto &addrJSON : deltaJSON["remove"])
+            removed.insert(addrJSON.asUInt64());
+        std::vector<BufferDesc> added;
+        if (!decodeBuffers(deltaJSON, added)) return ERR_METADATA;
+        auto &buffers = desc.buffers;
+        buffers.erase(std::remove_if(buffers.begin(), buffers.end(),
+                                     [&](const BufferDesc &buffer) {
+                                         return removed.count(buffer.addr);
+                                     }),
+                      buffers.end());
+        buffers.insert(buffers.end(), added.begin(), added.end());
+        desc.version = version;
+    }
+    return 0;
+}
+
 int TransferMetadata::removeSegmentDesc(const std::string &segment_name) {
     if (p2p_handshake_mode_) {
         return 0;
@@ -246,6 +787,15 @@ int TransferMetadata::removeSegmentDesc(const std::string &segment_name) {
                    << segment_name;
         return ERR_METADATA;
     }
+    std::lock_guard<std::mutex> lock(publish_mutex_);
+    if (published_segments_.erase(segment_name) &&
+        !storage_plugin_->remove(getFullMetadataKey(segment_name) +
+                                 kDeltaKeySuffix)) {
+        LOG(ERROR) << "Failed to unregister deltas of segment descriptor, "
+                      "name "
+                   << segment_name;
+        return ERR_METADATA;
+    }
     return 0;
 }
 
@@ -258,6 +808,16 @@ TransferMetadata::decodeSegmentDesc(Json::Value &segmentJSON,
     desc->tcp_data_port = segmentJSON["tcp_data_port"].asInt();
     if (segmentJSON.isMember("timestamp"))
         desc->timestamp = segmentJSON["timestamp"].asString();
+    desc->version = segmentJSON["version"].asUInt64();
+    desc->incarnation = segmentJSON["incarnation"].asUInt64();
+
+    // Checked against the protocol below
+    auto &buffers = desc->buffers;
+    if (desc->protocol != "nvmeof" && !decodeBuffers(segmentJSON, buffers)) {
+        LOG(WARNING) << "Corrupted segment descriptor, name " << segment_name
+                     << " protocol " << desc->protocol;
+        return nullptr;
+    }
 
     if (desc->protocol == "rdma") {
         for (const auto &deviceJSON : segmentJSON["devices"]) {
@@ -265,23 +825,18 @@ TransferMetadata::decodeSegmentDesc(Json::Value &segmentJSON,
             device.name = deviceJSON["name"].asString();
             device.lid = deviceJSON["lid"].asUInt();
             device.gid = deviceJSON["gid"].asString();
+            device.dct_num = deviceJSON["dct_num"].asUInt();
             if (device.name.empty() || device.gid.empty()) {
                 LOG(WARNING) << "Corrupted segment descriptor, name "
                              << segment_name << " protocol " << desc->protocol;
                 return nullptr;
             }
+            device.nic_path_id =
+                InternNicPath(MakeNicPath(desc->name, device.name));
             desc->devices.push_back(device);
         }
 
-        for (const auto &bufferJSON : segmentJSON["buffers"]) {
-            BufferDesc buffer;
-            buffer.name = bufferJSON["name"].asString();
-            buffer.addr = bufferJSON["addr"].asUInt64();
-            buffer.length = bufferJSON["length"].asUInt64();
-            for (const auto &rkeyJSON : bufferJSON["rkey"])
-                buffer.rkey.push_back(rkeyJSON.asUInt());
-            for (const auto &lkeyJSON : bufferJSON["lkey"])
-                buffer.lkey.push_back(lkeyJSON.asUInt());
+        for (const auto &buffer : buffers) {
             if (buffer.name.empty() || !buffer.addr || !buffer.length ||
                 buffer.rkey.empty() ||
                 buffer.rkey.size() != buffer.lkey.size()) {
@@ -289,7 +844,6 @@ TransferMetadata::decodeSegmentDesc(Json::Value &segmentJSON,
                              << segment_name << " protocol " << desc->protocol;
                 return nullptr;
             }
-            desc->buffers.push_back(buffer);
         }
 
         int ret = desc->topology.parse(
@@ -298,26 +852,17 @@ TransferMetadata::decodeSegmentDesc(Json::Value &segmentJSON,
             LOG(WARNING) << "Corrupted segment descriptor, name "
                          << segment_name << " protocol " << desc->protocol;
         }
-    } else if (desc->protocol == "tcp") {
-        for (const auto &bufferJSON : segmentJSON["buffers"]) {
-            BufferDesc buffer;
-            buffer.name = bufferJSON["name"].asString();
-            buffer.addr = bufferJSON["addr"].asUInt64();
-            buffer.length = bufferJSON["length"].asUInt64();
+    } else if (desc->protocol == "tcp" || desc->protocol == "cxl" ||
+               desc->protocol == "shm") {
+        for (const auto &buffer : buffers) {
             if (buffer.name.empty() || !buffer.addr || !buffer.length) {
                 LOG(WARNING) << "Corrupted segment descriptor, name "
                              << segment_name << " protocol " << desc->protocol;
                 return nullptr;
             }
-            desc->buffers.push_back(buffer);
         }
     } else if (desc->protocol == "nvlink") {
-        for (const auto &bufferJSON : segmentJSON["buffers"]) {
-            BufferDesc buffer;
-            buffer.name = bufferJSON["name"].asString();
-            buffer.addr = bufferJSON["addr"].asUInt64();
-            buffer.length = bufferJSON["length"].asUInt64();
-            buffer.shm_name = bufferJSON["shm_name"].asString();
+        for (const auto &buffer : buffers) {
             if (buffer.name.empty() || !buffer.addr || !buffer.length ||
                 buffer.shm_name.empty()) {
                 LOG(WARNING) << "Corrupted segment descriptor, name "
@@ -327,7 +872,6 @@ TransferMetadata::decodeSegmentDesc(Json::Value &segmentJSON,
                              << "buffer shm_name " << buffer.shm_name;
                 return nullptr;
             }
-            desc->buffers.push_back(buffer);
         }
     } else if (desc->protocol == "nvmeof") {
         for (const auto &bufferJSON : segmentJSON["buffers"]) {
@@ -353,17 +897,12 @@ TransferMetadata::decodeSegmentDesc(Json::Value &segmentJSON,
             desc->devices.push_back(device);
         }
 
-        for (const auto &bufferJSON : segmentJSON["buffers"]) {
-            BufferDesc buffer;
-            buffer.name = bufferJSON["name"].asString();
-            buffer.addr = bufferJSON["addr"].asUInt64();
-            buffer.length = bufferJSON["length"].asUInt64();
+        for (const auto &buffer : buffers) {
             if (buffer.name.empty() || !buffer.addr || !buffer.length) {
                 LOG(WARNING) << "Corrupted segment descriptor, name "
                              << segment_name << " protocol " << desc->protocol;
                 return nullptr;
             }
-            desc->buffers.push_back(buffer);
         }
 
         Json::Value rankInfoJSON = segmentJSON["rank_info"];
@@ -381,6 +920,26 @@ TransferMetadata::decodeSegmentDesc(Json::Value &segmentJSON,
                    << " protocol " << desc->protocol;
         return nullptr;
     }
+
+    if (segmentJSON.isMember("shm_buffers")) {
+        desc->shm_host = segmentJSON["shm_host"].asString();
+        for (const auto &bufferJSON : segmentJSON["shm_buffers"]) {
+            ShmBufferDesc buffer;
+            buffer.addr = bufferJSON["addr"].asUInt64();
+            buffer.length = bufferJSON["length"].asUInt64();
+            buffer.shm_name = bufferJSON["shm_name"].asString();
+            buffer.shm_offset = bufferJSON["shm_offset"].asUInt64();
+            // Skip rather than reject, the segment stays reachable through
+            // its protocol
+            if (!buffer.addr || !buffer.length || buffer.shm_name.empty()) {
+                LOG(WARNING) << "Corrupted shared memory buffer in segment "
+                                "descriptor, name "
+                             << segment_name;
+                continue;
+            }
+            desc->shm_buffers.push_back(buffer);
+        }
+    }
     return desc;
 }
 
@@ -389,13 +948,25 @@ int TransferMetadata::receivePeerMetadata(const Json::Value &peer_json,
     // TODO: save to local cache
     // auto peer_desc = decodeSegmentDesc(peer_json,
     // peer_json["name"].asString());
-    auto local_desc = segment_id_to_desc_map_[LOCAL_SEGMENT_ID];
-    int ret = encodeSegmentDesc(*local_desc.get(), local_json);
+    std::shared_ptr<SegmentDesc> local_desc;
+    {
+        RWSpinlock::ReadGuard guard(segment_lock_);
+        auto iter = segment_id_to_desc_map_.find(LOCAL_SEGMENT_ID);
+        if (iter != segment_id_to_desc_map_.end()) local_desc = iter->second;
+    }
+    if (!local_desc) return ERR_METADATA;
+    // Compact buffers only to peers that can decode them
+    auto encoding =
+        peer_json["accept_compact_buffers"].asUInt() >= kCompactBuffersVersion
+            ? BufferEncoding::kCompact
+            : BufferEncoding::kJson;
+    int ret = encodeSegmentDesc(*local_desc.get(), local_json, encoding);
     return ret;
 }
 
 std::shared_ptr<TransferMetadata::SegmentDesc> TransferMetadata::getSegmentDesc(
-    const std::string &segment_name) {
+    const std::string &segment_name,
+    const std::shared_ptr<SegmentDesc> &cached) {
     Json::Value peer_json;
 
     if (p2p_handshake_mode_) {
@@ -406,21 +977,91 @@ std::shared_ptr<TransferMetadata::SegmentDesc> TransferMetadata::getSegmentDesc(
         if (ret) {
             return nullptr;
         }
+        local_json["accept_compact_buffers"] =
+            (Json::UInt)kCompactBuffersVersion;
         ret = handshake_plugin_->exchangeMetadata(ip, port, local_json,
                                                   peer_json);
         if (ret) {
             return nullptr;
         }
-    } else {
-        if (!storage_plugin_->get(getFullMetadataKey(segment_name),
-                                  peer_json)) {
+        return decodeSegmentDesc(peer_json, segment_name);
+    }
+
+    // Descriptors published with compact metadata may have deltas on top,
+    // which bring the cached descriptor up to date without fetching it
+    const auto key = getFullMetadataKey(segment_name);
+    Json::Value deltas_json;
+    if (cached && cached->incarnation && !cached->served_by_peer &&
+        storage_plugin_->get(key + kDeltaKeySuffix, deltas_json) &&
+        deltas_json["incarnation"].asUInt64() == cached->incarnation &&
+        deltas_json["base_version"].asUInt64() <= cached->version &&
+        deltas_json["version"].asUInt64() >= cached->version) {
+        if (deltas_json["version"].asUInt64() == cached->version)
+            return cached;
+        auto desc = std::make_shared<SegmentDesc>();
+        *desc = *cached;
+        if (!applySegmentDeltas(*desc, deltas_json)) return desc;
+    }
+
+    // The descriptor may be published in full again between reading it and
+    // its deltas
+    const static int kMaxRetries = 3;
+    std::shared_ptr<SegmentDesc> desc;
+    for (int retry = 0; retry < kMaxRetries; ++retry) {
+        // Both in one round trip where the metadata server allows
+        std::unordered_map<std::string, Json::Value> values;
+        storage_plugin_->getBatch({key, key + kDeltaKeySuffix}, values);
+        if (!values.count(key)) {
             LOG(WARNING) << "Failed to retrieve segment descriptor, name "
                          << segment_name;
             return nullptr;
         }
+        peer_json = std::move(values[key]);
+        if (peer_json.isMember("peer_rpc_port"))
+            return pullSegmentDesc(segment_name, peer_json, cached);
+        desc = decodeSegmentDesc(peer_json, segment_name);
+        if (!desc || !desc->incarnation) return desc;
+        auto it = values.find(key + kDeltaKeySuffix);
+        if (it == values.end()) continue;
+        deltas_json = std::move(it->second);
+        if (deltas_json["incarnation"].asUInt64() == desc->incarnation &&
+            deltas_json["base_version"].asUInt64() == desc->version &&
+            !applySegmentDeltas(*desc, deltas_json))
+            return desc;
     }
+    LOG(WARNING) << "Failed to retrieve deltas of segment descriptor, name "
+                 << segment_name;
+    return desc;
+}
 
-    return decodeSegmentDesc(peer_json, segment_name);
+std::shared_ptr<TransferMetadata::SegmentDesc>
+TransferMetadata::pullSegmentDesc(const std::string &segment_name,
+                                  const Json::Value &stub_json,
+                                  const std::shared_ptr<SegmentDesc> &cached) {
+    uint64_t incarnation = stub_json["incarnation"].asUInt64();
+    uint64_t version = stub_json["version"].asUInt64();
+    if (cached && cached->served_by_peer &&
+        cached->incarnation == incarnation && cached->version == version)
+        return cached;
+
+    // The owner ignores the rest of the request
+    Json::Value local_json, peer_json;
+    local_json["name"] = local_rpc_meta_.ip_or_host_name;
+    local_json["accept_compact_buffers"] = (Json::UInt)kCompactBuffersVersion;
+    if (handshake_plugin_->exchangeMetadata(
+            stub_json["peer_ip_or_host_name"].asString(),
+            stub_json["peer_rpc_port"].asUInt(), local_json, peer_json)) {
+        LOG(WARNING) << "Failed to pull segment descriptor from its owner, "
+                        "name "
+                     << segment_name;
+        return nullptr;
+    }
+    auto desc = decodeSegmentDesc(peer_json, segment_name);
+    if (!desc) return nullptr;
+    desc->served_by_peer = true;
+    desc->incarnation = incarnation;
+    desc->version = version;
+    return desc;
 }
 
 int TransferMetadata::syncSegmentCache(const std::string &segment_name) {
@@ -429,7 +1070,7 @@ int TransferMetadata::syncSegmentCache(const std::string &segment_name) {
         if (entry.first == LOCAL_SEGMENT_ID) continue;
         if (!segment_name.empty() && entry.second->name != segment_name)
             continue;
-        auto segment_desc = getSegmentDesc(entry.second->name);
+        auto segment_desc = getSegmentDesc(entry.second->name, entry.second);
         if (segment_desc)
             entry.second = segment_desc;
         else
@@ -471,8 +1112,8 @@ TransferMetadata::getSegmentDescByID(SegmentID segment_id, bool force_update) {
         (!globalConfig().metacache || force_update)) {
         RWSpinlock::WriteGuard guard(segment_lock_);
         if (!segment_id_to_desc_map_.count(segment_id)) return nullptr;
-        auto segment_desc =
-            getSegmentDesc(segment_id_to_desc_map_[segment_id]->name);
+        auto &cached = segment_id_to_desc_map_[segment_id];
+        auto segment_desc = getSegmentDesc(cached->name, cached);
         if (!segment_desc) return nullptr;
         segment_id_to_desc_map_[segment_id] = segment_desc;
         return segment_id_to_desc_map_[segment_id];
@@ -502,12 +1143,125 @@ TransferMetadata::SegmentID TransferMetadata::getSegmentID(
     return id;
 }
 
+std::vector<TransferMetadata::SegmentID> TransferMetadata::getSegmentIDs(
+    const std::vector<std::string> &segment_names) {
+    const SegmentID kInvalidID = (SegmentID)-1;
+    std::vector<SegmentID> ids(segment_names.size(), kInvalidID);
+    std::vector<std::string> pending;
+    {
+        RWSpinlock::ReadGuard guard(segment_lock_);
+        std::unordered_set<std::string> seen;
+        for (size_t i = 0; i < segment_names.size(); ++i) {
+            auto iter = segment_name_to_id_map_.find(segment_names[i]);
+            if (iter != segment_name_to_id_map_.end())
+                ids[i] = iter->second;
+            else if (seen.insert(segment_names[i]).second)
+                pending.push_back(segment_names[i]);
+        }
+    }
+    if (pending.empty()) return ids;
+
+    std::unordered_map<std::string, Json::Value> values;
+    if (!p2p_handshake_mode_) {
+        std::vector<std::string> keys;
+        for (const auto &name : pending) {
+            keys.push_back(getFullMetadataKey(name));
+            keys.push_back(getFullMetadataKey(name) + kDeltaKeySuffix);
+        }
+        storage_plugin_->getBatch(keys, values);
+    }
+
+    // Descriptors that are not complete in the batch, such as those served
+    // by their owners, are fetched on their own
+    auto fetch = [&](const std::string &name) -> std::shared_ptr<SegmentDesc> {
+        if (p2p_handshake_mode_) return getSegmentDesc(name);
+        const auto key = getFullMetadataKey(name);
+        auto iter = values.find(key);
+        if (iter == values.end()) {
+            LOG(WARNING) << "Failed to retrieve segment descriptor, name "
+                         << name;
+            return nullptr;
+        }
+        auto peer_json = iter->second;
+        if (peer_json.isMember("peer_rpc_port"))
+            return pullSegmentDesc(name, peer_json, nullptr);
+        auto desc = decodeSegmentDesc(peer_json, name);
+        if (!desc || !desc->incarnation) return desc;
+        auto deltas = values.find(key + kDeltaKeySuffix);
+        if (deltas != values.end() &&
+            deltas->second["incarnation"].asUInt64() == desc->incarnation &&
+            deltas->second["base_version"].asUInt64() == desc->version &&
+            !applySegmentDeltas(*desc, deltas->second))
+            return desc;
+        return getSegmentDesc(name);
+    };
+
+    const static size_t kMaxFetchThreads = 16;
+    std::vector<std::shared_ptr<SegmentDesc>> descs(pending.size());
+    {
+        // Fetches in handshake mode read the local descriptor
+        if (p2p_handshake_mode_) segment_lock_.lockShared();
+        std::atomic<size_t> next{0};
+        auto worker = [&]() {
+            for (size_t i = next++; i < pending.size(); i = next++)
+                descs[i] = fetch(pending[i]);
+        };
+        std::vector<std::thread> threads;
+        size_t num_threads = std::min(kMaxFetchThreads, pending.size());
+        for (size_t i = 1; i < num_threads; ++i) threads.emplace_back(worker);
+        worker();
+        for (auto &thread : threads) thread.join();
+        if (p2p_handshake_mode_) segment_lock_.unlockShared();
+    }
+
+    RWSpinlock::WriteGuard guard(segment_lock_);
+    for (size_t i = 0; i < pending.size(); ++i) {
+        if (!descs[i] || segment_name_to_id_map_.count(pending[i])) continue;
+        SegmentID id = next_segment_id_.fetch_add(1);
+        segment_id_to_desc_map_[id] = descs[i];
+        segment_name_to_id_map_[pending[i]] = id;
+    }
+    for (size_t i = 0; i < segment_names.size(); ++i) {
+        if (ids[i] != kInvalidID) continue;
+        auto iter = segment_name_to_id_map_.find(segment_names[i]);
+        if (iter != segment_name_to_id_map_.end()) ids[i] = iter->second;
+    }
+    return ids;
+}
+
 int TransferMetadata::updateLocalSegmentDesc(uint64_t segment_id) {
+    {
+        std::lock_guard<std::mutex> lock(held_updates_mutex_);
+        if (held_updates_depth_) {
+            held_updates_.insert(segment_id);
+            return 0;
+        }
+    }
     RWSpinlock::ReadGuard guard(segment_lock_);
     auto desc = segment_id_to_desc_map_[segment_id];
     return this->updateSegmentDesc(desc->name, *desc);
 }
 
+void TransferMetadata::holdLocalSegmentUpdates() {
+    std::lock_guard<std::mutex> lock(held_updates_mutex_);
+    ++held_updates_depth_;
+}
+
+int TransferMetadata::releaseLocalSegmentUpdates() {
+    std::set<SegmentID> segment_ids;
+    {
+        std::lock_guard<std::mutex> lock(held_updates_mutex_);
+        if (held_updates_depth_ == 0 || --held_updates_depth_) return 0;
+        segment_ids.swap(held_updates_);
+    }
+    int ret = 0;
+    for (auto segment_id : segment_ids) {
+        int rc = updateLocalSegmentDesc(segment_id);
+        if (rc) ret = rc;
+    }
+    return ret;
+}
+
 int TransferMetadata::addLocalSegment(SegmentID segment_id,
                                       const std::string &segment_name,
                                       std::shared_ptr<SegmentDesc> &&desc) {
@@ -542,7 +1296,8 @@ int TransferMetadata::addLocalMemoryBuffer(const BufferDesc &buffer_desc,
 }
 
 int TransferMetadata::removeLocalMemoryBuffer(void *addr,
-                                              bool update_metadata) {
+                                              bool update_metadata,
+                                              size_t length) {
     bool addr_exist = false;
     {
         RWSpinlock::WriteGuard guard(segment_lock_);
@@ -552,7 +1307,8 @@ int TransferMetadata::removeLocalMemoryBuffer(void *addr,
         segment_desc = new_segment_desc;
         for (auto iter = segment_desc->buffers.begin();
              iter != segment_desc->buffers.end(); ++iter) {
-            if (iter->addr == (uint64_t)addr) {
+            if (iter->addr == (uint64_t)addr &&
+                (!length || iter->length == length)) {
                 segment_desc->buffers.erase(iter);
                 addr_exist = true;
                 break;
@@ -566,11 +1322,51 @@ int TransferMetadata::removeLocalMemoryBuffer(void *addr,
     return ERR_ADDRESS_NOT_REGISTERED;
 }
 
+int TransferMetadata::addLocalShmBuffer(const std::string &shm_host,
+                                        const ShmBufferDesc &buffer_desc,
+                                        bool update_metadata) {
+    {
+        RWSpinlock::WriteGuard guard(segment_lock_);
+        auto new_segment_desc = std::make_shared<SegmentDesc>();
+        auto &segment_desc = segment_id_to_desc_map_[LOCAL_SEGMENT_ID];
+        *new_segment_desc = *segment_desc;
+        segment_desc = new_segment_desc;
+        segment_desc->shm_host = shm_host;
+        segment_desc->shm_buffers.push_back(buffer_desc);
+    }
+    if (update_metadata) return updateLocalSegmentDesc();
+    return 0;
+}
+
+int TransferMetadata::removeLocalShmBuffer(void *addr, bool update_metadata) {
+    bool addr_exist = false;
+    {
+        RWSpinlock::WriteGuard guard(segment_lock_);
+        auto new_segment_desc = std::make_shared<SegmentDesc>();
+        auto &segment_desc = segment_id_to_desc_map_[LOCAL_SEGMENT_ID];
+        *new_segment_desc = *segment_desc;
+        segment_desc = new_segment_desc;
+        for (auto iter = segment_desc->shm_buffers.begin();
+             iter != segment_desc->shm_buffers.end(); ++iter) {
+            if (iter->addr == (uint64_t)addr) {
+                segment_desc->shm_buffers.erase(iter);
+                addr_exist = true;
+                break;
+            }
+        }
+    }
+    if (addr_exist) {
+        if (update_metadata) return updateLocalSegmentDesc();
+        return 0;
+    }
+    return ERR_ADDRESS_NOT_REGISTERED;
+}
+
 int TransferMetadata::addRpcMetaEntry(const std::string &server_name,
                                       RpcMetaDesc &desc) {
     local_rpc_meta_ = desc;
 
-    if (p2p_handshake_mode_) {
+    if (p2p_handshake_mode_ || globalConfig().peer_metadata) {
         int rc = handshake_plugin_->startDaemon(desc.rpc_port, desc.sockfd);
         if (rc != 0) {
             return rc;
@@ -580,7 +1376,7 @@ int TransferMetadata::addRpcMetaEntry(const std::string &server_name,
                 return receivePeerMetadata(peer, local);
             });
 
-        return 0;
+        if (p2p_handshake_mode_) return 0;
     }
 
     Json::Value rpcMetaJSON;
@@ -697,4 +1493,33 @@ int TransferMetadata::sendNotify(const std::string &peer_server_name,
     return 0;
 }
 
+void TransferMetadata::registerOnCredit(OnReceiveCredit on_receive_credit) {
+    handshake_plugin_->registerOnCreditCallBack(
+        [on_receive_credit](const Json::Value &peer,
+                            Json::Value &local) -> int {
+            CreditDesc local_desc, peer_desc;
+            TransferCreditUtil::decode(peer, peer_desc);
+            int ret = on_receive_credit(peer_desc, local_desc);
+            if (ret) return ret;
+            local = TransferCreditUtil::encode(local_desc);
+            return 0;
+        });
+}
+
+int TransferMetadata::sendCredit(const std::string &peer_server_name,
+                                 const CreditDesc &local_desc,
+                                 CreditDesc &peer_desc) {
+    RpcMetaDesc peer_location;
+    if (getRpcMetaEntry(peer_server_name, peer_location)) {
+        return ERR_METADATA;
+    }
+    Json::Value peer;
+    int ret = handshake_plugin_->sendCredit(
+        peer_location.ip_or_host_name, peer_location.rpc_port,
+        TransferCreditUtil::encode(local_desc), peer);
+    if (ret) return ret;
+    TransferCreditUtil::decode(peer, peer_desc);
+    return peer_desc.rate ? 0 : ERR_METADATA;
+}
+
 }  // namespace mooncake
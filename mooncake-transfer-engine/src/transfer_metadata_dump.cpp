@@ -32,6 +32,9 @@ void TransferMetadata::SegmentDesc::dump() const {
                   << (void *)(buffer.addr + buffer.length);
     }
     LOG(INFO) << "  nvmeof buffers: " << nvmeof_buffers.size() << " items";
+    if (!shm_buffers.empty())
+        LOG(INFO) << "  shm buffers: " << shm_buffers.size()
+                  << " items on host " << shm_host;
     LOG(INFO) << "  timestamp: " << timestamp;
 }
 
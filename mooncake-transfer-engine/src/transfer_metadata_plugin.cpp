@@ -37,13 +37,19 @@
 #ifdef USE_ETCD
 #ifdef USE_ETCD_LEGACY
 #include <etcd/SyncClient.hpp>
+#include <etcd/Watcher.hpp>
 #else
 #include <libetcd_wrapper.h>
 #endif
 #endif  // USE_ETCD
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <mutex>
 #include <set>
+#include <thread>
 
 #include "common.h"
 #include "config.h"
@@ -74,22 +80,16 @@ struct RedisStoragePlugin : public MetadataStoragePlugin {
     RedisStoragePlugin(const std::string &metadata_uri,
                        const std::string &password, const uint8_t &db_index)
         : RedisStoragePlugin(metadata_uri) {
+        password_ = password;
+        db_index_ = db_index;
         if (!client_) {
             return;
         }
 
-        if (!password.empty()) {
-            auto *reply = static_cast<redisReply *>(
-                redisCommand(client_, "AUTH %s", password.c_str()));
-            if (!reply || reply->type == REDIS_REPLY_ERROR) {
-                LOG(ERROR) << "RedisStoragePlugin: authentication failed for "
-                           << metadata_uri_;
-                freeReplyObject(reply);
-                redisFree(client_);
-                client_ = nullptr;
-                return;
-            }
-            freeReplyObject(reply);
+        if (!authenticate(client_)) {
+            redisFree(client_);
+            client_ = nullptr;
+            return;
         }
 
         if (db_index != 0) {
@@ -108,12 +108,92 @@ struct RedisStoragePlugin : public MetadataStoragePlugin {
     }
 
     virtual ~RedisStoragePlugin() {
+        if (watch_thread_.joinable()) {
+            // Wakes the thread up from reading notifications
+            shutdown(subscriber_->fd, SHUT_RDWR);
+            watch_thread_.join();
+        }
+        if (subscriber_) redisFree(subscriber_);
         if (client_) {
             redisFree(client_);
             client_ = nullptr;
         }
     }
 
+    bool authenticate(redisContext *client) {
+        if (password_.empty()) return true;
+        auto *reply = static_cast<redisReply *>(
+            redisCommand(client, "AUTH %s", password_.c_str()));
+        if (!reply || reply->type == REDIS_REPLY_ERROR) {
+            LOG(ERROR) << "RedisStoragePlugin: authentication failed for "
+                       << metadata_uri_;
+            freeReplyObject(reply);
+            return false;
+        }
+        freeReplyObject(reply);
+        return true;
+    }
+
+    // Through keyspace notifications, on a connection of their own
+    virtual bool watch(const std::string &prefix, OnChangeCallBack callback) {
+        {
+            std::lock_guard<std::mutex> lock(access_client_mutex_);
+            if (!client_) return false;
+            // Keyspace notifications are off by default, and the server
+            // may not let clients turn them on
+            auto *reply = static_cast<redisReply *>(redisCommand(
+                client_, "CONFIG SET notify-keyspace-events K$g"));
+            if (!reply || reply->type == REDIS_REPLY_ERROR)
+                LOG(WARNING) << "RedisStoragePlugin: unable to enable "
+                                "keyspace notifications on "
+                             << metadata_uri_;
+            freeReplyObject(reply);
+        }
+
+        auto hostname_port = parseHostNameWithPort(metadata_uri_);
+        subscriber_ =
+            redisConnect(hostname_port.first.c_str(), hostname_port.second);
+        if (!subscriber_ || subscriber_->err || !authenticate(subscriber_)) {
+            LOG(WARNING) << "RedisStoragePlugin: unable to connect "
+                         << metadata_uri_ << " for notifications";
+            if (subscriber_) redisFree(subscriber_);
+            subscriber_ = nullptr;
+            return false;
+        }
+        const std::string channel_prefix =
+            "__keyspace@" + std::to_string(db_index_) + "__:";
+        auto *reply = static_cast<redisReply *>(
+            redisCommand(subscriber_, "PSUBSCRIBE %s%s*",
+                         channel_prefix.c_str(), prefix.c_str()));
+        if (!reply || reply->type == REDIS_REPLY_ERROR) {
+            LOG(WARNING) << "RedisStoragePlugin: unable to subscribe to "
+                            "keyspace notifications on "
+                         << metadata_uri_;
+            freeReplyObject(reply);
+            redisFree(subscriber_);
+            subscriber_ = nullptr;
+            return false;
+        }
+        freeReplyObject(reply);
+
+        watch_thread_ = std::thread([this, channel_prefix, callback]() {
+            redisReply *reply;
+            while (redisGetReply(subscriber_, (void **)&reply) == REDIS_OK) {
+                // pmessage, pattern, channel, event
+                if (reply->type == REDIS_REPLY_ARRAY && reply->elements == 4 &&
+                    reply->element[2]->type == REDIS_REPLY_STRING) {
+                    std::string channel(reply->element[2]->str,
+                                        reply->element[2]->len);
+                    if (channel.compare(0, channel_prefix.size(),
+                                        channel_prefix) == 0)
+                        callback(channel.substr(channel_prefix.size()));
+                }
+                freeReplyObject(reply);
+            }
+        });
+        return true;
+    }
+
     virtual bool get(const std::string &key, Json::Value &value) {
         std::lock_guard<std::mutex> lock(access_client_mutex_);
         if (!client_) return false;
@@ -139,6 +219,39 @@ struct RedisStoragePlugin : public MetadataStoragePlugin {
         return true;
     }
 
+    virtual bool getBatch(
+        const std::vector<std::string> &keys,
+        std::unordered_map<std::string, Json::Value> &values) {
+        if (keys.empty()) return true;
+        std::vector<const char *> argv{"MGET"};
+        std::vector<size_t> argvlen{4};
+        for (const auto &key : keys) {
+            argv.push_back(key.c_str());
+            argvlen.push_back(key.size());
+        }
+        std::lock_guard<std::mutex> lock(access_client_mutex_);
+        if (!client_) return false;
+        redisReply *resp = (redisReply *)redisCommandArgv(
+            client_, argv.size(), argv.data(), argvlen.data());
+        if (!resp || resp->type != REDIS_REPLY_ARRAY ||
+            resp->elements != keys.size()) {
+            LOG(ERROR) << "RedisStoragePlugin: unable to get " << keys.size()
+                       << " keys from " << metadata_uri_;
+            freeReplyObject(resp);
+            return false;
+        }
+        Json::Reader reader;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            auto *element = resp->element[i];
+            Json::Value value;
+            if (element->type == REDIS_REPLY_STRING &&
+                reader.parse(element->str, element->str + element->len, value))
+                values[keys[i]] = std::move(value);
+        }
+        freeReplyObject(resp);
+        return true;
+    }
+
     virtual bool set(const std::string &key, const Json::Value &value) {
         std::lock_guard<std::mutex> lock(access_client_mutex_);
         if (!client_) return false;
@@ -174,6 +287,10 @@ struct RedisStoragePlugin : public MetadataStoragePlugin {
     redisContext *client_;
     const std::string metadata_uri_;
     std::mutex access_client_mutex_;
+    std::string password_;
+    uint8_t db_index_ = 0;
+    redisContext *subscriber_ = nullptr;
+    std::thread watch_thread_;
 };
 #endif  // USE_REDIS
 
@@ -190,6 +307,10 @@ struct HTTPStoragePlugin : public MetadataStoragePlugin {
     }
 
     virtual ~HTTPStoragePlugin() {
+        if (watch_thread_.joinable()) {
+            watch_running_ = false;
+            watch_thread_.join();
+        }
         curl_easy_cleanup(client_);
         curl_global_cleanup();
     }
@@ -209,12 +330,15 @@ struct HTTPStoragePlugin : public MetadataStoragePlugin {
     }
 
     virtual bool get(const std::string &key, Json::Value &value) {
+        std::lock_guard<std::mutex> lock(access_client_mutex_);
         curl_easy_reset(client_);
         curl_easy_setopt(client_, CURLOPT_TIMEOUT_MS, 3000);  // 3s timeout
 
         std::string url = encodeUrl(key);
         curl_easy_setopt(client_, CURLOPT_URL, url.c_str());
         curl_easy_setopt(client_, CURLOPT_WRITEFUNCTION, writeCallback);
+        // Large descriptors may be sent gzipped
+        curl_easy_setopt(client_, CURLOPT_ACCEPT_ENCODING, "");
 
         // get response body
         std::string readBuffer;
@@ -242,6 +366,7 @@ struct HTTPStoragePlugin : public MetadataStoragePlugin {
     }
 
     virtual bool set(const std::string &key, const Json::Value &value) {
+        std::lock_guard<std::mutex> lock(access_client_mutex_);
         curl_easy_reset(client_);
         curl_easy_setopt(client_, CURLOPT_TIMEOUT_MS, 3000);  // 3s timeout
 
@@ -285,6 +410,7 @@ struct HTTPStoragePlugin : public MetadataStoragePlugin {
     }
 
     virtual bool remove(const std::string &key) {
+        std::lock_guard<std::mutex> lock(access_client_mutex_);
         curl_easy_reset(client_);
         curl_easy_setopt(client_, CURLOPT_TIMEOUT_MS, 3000);  // 3s timeout
 
@@ -315,8 +441,168 @@ struct HTTPStoragePlugin : public MetadataStoragePlugin {
         return true;
     }
 
+    // POST <metadata_uri>/batch_get with {"keys": [...]}, answered with
+    // {"values": {key: value}}. Servers without it get one GET per key.
+    virtual bool getBatch(
+        const std::vector<std::string> &keys,
+        std::unordered_map<std::string, Json::Value> &values) {
+        if (!batch_supported_)
+            return MetadataStoragePlugin::getBatch(keys, values);
+        Json::Value request;
+        request["keys"] = Json::Value(Json::arrayValue);
+        for (const auto &key : keys) request["keys"].append(key);
+        std::string readBuffer;
+        long responseCode =
+            performBatch(metadata_uri_ + "/batch_get", "POST", request,
+                         readBuffer);
+        if (responseCode == 404 || responseCode == 405) {
+            batch_supported_ = false;
+            return MetadataStoragePlugin::getBatch(keys, values);
+        }
+        Json::Value response;
+        Json::Reader reader;
+        if (responseCode != 200 || !reader.parse(readBuffer, response))
+            return false;
+        const auto &found = response["values"];
+        for (const auto &key : found.getMemberNames()) {
+            Json::Value value;
+            if (reader.parse(found[key].asString(), value))
+                values[key] = std::move(value);
+        }
+        return true;
+    }
+
+    // PUT <metadata_uri>/batch with {key: value}, which the server applies
+    // at once. Servers without it get one PUT per key.
+    virtual bool setBatch(
+        const std::vector<std::pair<std::string, Json::Value>> &values) {
+        if (!batch_supported_) return MetadataStoragePlugin::setBatch(values);
+        Json::FastWriter writer;
+        Json::Value request(Json::objectValue);
+        for (const auto &entry : values)
+            request[entry.first] = writer.write(entry.second);
+        std::string readBuffer;
+        long responseCode =
+            performBatch(metadata_uri_ + "/batch", "PUT", request, readBuffer);
+        if (responseCode == 404 || responseCode == 405) {
+            batch_supported_ = false;
+            return MetadataStoragePlugin::setBatch(values);
+        }
+        return responseCode == 200;
+    }
+
+    // The response code of a batch request, 0 if it was not answered
+    long performBatch(const std::string &url, const char *method,
+                      const Json::Value &request, std::string &readBuffer) {
+        Json::FastWriter writer;
+        const std::string body = writer.write(request);
+        std::lock_guard<std::mutex> lock(access_client_mutex_);
+        curl_easy_reset(client_);
+        curl_easy_setopt(client_, CURLOPT_TIMEOUT_MS, 3000);  // 3s timeout
+        curl_easy_setopt(client_, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(client_, CURLOPT_WRITEFUNCTION, writeCallback);
+        curl_easy_setopt(client_, CURLOPT_WRITEDATA, &readBuffer);
+        curl_easy_setopt(client_, CURLOPT_ACCEPT_ENCODING, "");
+        curl_easy_setopt(client_, CURLOPT_POSTFIELDS, body.c_str());
+        curl_easy_setopt(client_, CURLOPT_POSTFIELDSIZE, body.size());
+        curl_easy_setopt(client_, CURLOPT_CUSTOMREQUEST, method);
+        struct curl_slist *headers = NULL;
+        headers = curl_slist_append(headers, "Content-Type: application/json");
+        curl_easy_setopt(client_, CURLOPT_HTTPHEADER, headers);
+        CURLcode res = curl_easy_perform(client_);
+        curl_slist_free_all(headers);
+        if (res != CURLE_OK) {
+            LOG(ERROR) << "Error from http client, " << method << " " << url
+                       << " error: " << curl_easy_strerror(res);
+            return 0;
+        }
+        long responseCode;
+        curl_easy_getinfo(client_, CURLINFO_RESPONSE_CODE, &responseCode);
+        if (responseCode != 200 && responseCode != 404 &&
+            responseCode != 405) {
+            LOG(ERROR) << "Unexpected code in http response, " << method
+                       << " " << url << " response code: " << responseCode
+                       << " response body: " << readBuffer;
+        }
+        return responseCode;
+    }
+
+    // Long polls of <metadata_uri>/watch, which answers with the keys
+    // changed after a revision once there are any, on a client of its own
+    virtual bool watch(const std::string &prefix, OnChangeCallBack callback) {
+        CURL *client = curl_easy_init();
+        if (!client) return false;
+        char *escaped = curl_easy_escape(client, prefix.c_str(), prefix.size());
+        const std::string url = metadata_uri_ + "/watch?prefix=" + escaped;
+        curl_free(escaped);
+
+        // Servers without watch support answer 404
+        uint64_t revision;
+        bool reset;
+        if (!pollChanges(client, url, 0, revision, reset, callback)) {
+            LOG(WARNING) << "HTTPStoragePlugin: " << metadata_uri_
+                         << " does not notify changes";
+            curl_easy_cleanup(client);
+            return false;
+        }
+        watch_running_ = true;
+        watch_thread_ = std::thread([this, client, url, revision,
+                                     callback]() mutable {
+            bool reset, missed = false;
+            while (watch_running_) {
+                if (!pollChanges(client, url, revision, revision, reset,
+                                 callback)) {
+                    // Changes may be missed while the server is unreachable
+                    missed = true;
+                    for (int i = 0; i < 10 && watch_running_; ++i)
+                        std::this_thread::sleep_for(
+                            std::chrono::milliseconds(100));
+                    continue;
+                }
+                if ((reset || missed) && watch_running_) callback("");
+                missed = false;
+            }
+            curl_easy_cleanup(client);
+        });
+        return true;
+    }
+
+    // Wait for the changes after revision, at most a second so that the
+    // watch can be stopped. reset if changes since revision are unknown.
+    bool pollChanges(CURL *client, const std::string &url, uint64_t revision,
+                     uint64_t &new_revision, bool &reset,
+                     const OnChangeCallBack &callback) {
+        const std::string poll_url = url + "&revision=" +
+                                     std::to_string(revision) +
+                                     "&timeout_ms=1000";
+        curl_easy_reset(client);
+        curl_easy_setopt(client, CURLOPT_TIMEOUT_MS, 5000);
+        curl_easy_setopt(client, CURLOPT_URL, poll_url.c_str());
+        curl_easy_setopt(client, CURLOPT_WRITEFUNCTION, writeCallback);
+        std::string readBuffer;
+        curl_easy_setopt(client, CURLOPT_WRITEDATA, &readBuffer);
+        CURLcode res = curl_easy_perform(client);
+        long responseCode = 0;
+        if (res == CURLE_OK)
+            curl_easy_getinfo(client, CURLINFO_RESPONSE_CODE, &responseCode);
+        Json::Value value;
+        Json::Reader reader;
+        if (responseCode != 200 || !reader.parse(readBuffer, value))
+            return false;
+
+        new_revision = value["revision"].asUInt64();
+        reset = value["reset"].asBool();
+        if (!reset)
+            for (const auto &key : value["keys"]) callback(key.asString());
+        return true;
+    }
+
     CURL *client_;
     const std::string metadata_uri_;
+    std::mutex access_client_mutex_;
+    std::atomic<bool> watch_running_{false};
+    std::thread watch_thread_;
+    std::atomic<bool> batch_supported_{true};
 };
 #endif  // USE_HTTP
 
@@ -326,7 +612,9 @@ struct EtcdStoragePlugin : public MetadataStoragePlugin {
     EtcdStoragePlugin(const std::string &metadata_uri)
         : client_(metadata_uri), metadata_uri_(metadata_uri) {}
 
-    virtual ~EtcdStoragePlugin() {}
+    virtual ~EtcdStoragePlugin() {
+        if (watcher_) watcher_->Cancel();
+    }
 
     virtual bool get(const std::string &key, Json::Value &value) {
         Json::Reader reader;
@@ -364,8 +652,24 @@ struct EtcdStoragePlugin : public MetadataStoragePlugin {
         return true;
     }
 
+    virtual bool watch(const std::string &prefix, OnChangeCallBack callback) {
+        watcher_ = std::make_unique<etcd::Watcher>(
+            client_, prefix,
+            [callback](etcd::Response resp) {
+                if (!resp.is_ok()) {
+                    callback("");
+                    return;
+                }
+                for (const auto &event : resp.events())
+                    callback(event.kv().key());
+            },
+            true);
+        return true;
+    }
+
     etcd::SyncClient client_;
     const std::string metadata_uri_;
+    std::unique_ptr<etcd::Watcher> watcher_;
 };
 #else
 struct EtcdStoragePlugin : public MetadataStoragePlugin {
@@ -381,7 +685,14 @@ struct EtcdStoragePlugin : public MetadataStoragePlugin {
         }
     }
 
-    virtual ~EtcdStoragePlugin() { EtcdCloseWrapper(); }
+    virtual ~EtcdStoragePlugin() {
+        if (watch_thread_.joinable()) {
+            watch_running_ = false;
+            watch_thread_.join();
+            EtcdCancelWatchPrefixWrapper(watch_id_);
+        }
+        EtcdCloseWrapper();
+    }
 
     virtual bool get(const std::string &key, Json::Value &value) {
         Json::Reader reader;
@@ -405,6 +716,41 @@ struct EtcdStoragePlugin : public MetadataStoragePlugin {
         return true;
     }
 
+    // In transactions of at most kMaxTxnOps gets, the default limit of
+    // etcd servers
+    virtual bool getBatch(
+        const std::vector<std::string> &keys,
+        std::unordered_map<std::string, Json::Value> &values) {
+        const static size_t kMaxTxnOps = 128;
+        Json::Reader reader;
+        for (size_t begin = 0; begin < keys.size(); begin += kMaxTxnOps) {
+            size_t count = std::min(kMaxTxnOps, keys.size() - begin);
+            std::vector<char *> batch_keys(count);
+            std::vector<char *> batch_values(count, nullptr);
+            for (size_t i = 0; i < count; ++i)
+                batch_keys[i] = (char *)keys[begin + i].c_str();
+            auto ret = EtcdGetBatchWrapper(batch_keys.data(), (int)count,
+                                           batch_values.data(), &err_msg_);
+            if (ret) {
+                LOG(ERROR) << "EtcdStoragePlugin: unable to get " << count
+                           << " keys in " << metadata_uri_ << ": "
+                           << err_msg_;
+                free(err_msg_);
+                err_msg_ = nullptr;
+                return false;
+            }
+            for (size_t i = 0; i < count; ++i) {
+                if (!batch_values[i]) continue;
+                Json::Value value;
+                if (reader.parse(batch_values[i], value))
+                    values[keys[begin + i]] = std::move(value);
+                // free the memory allocated by EtcdGetBatchWrapper
+                free(batch_values[i]);
+            }
+        }
+        return true;
+    }
+
     virtual bool set(const std::string &key, const Json::Value &value) {
         Json::FastWriter writer;
         const std::string json_file = writer.write(value);
@@ -434,8 +780,43 @@ struct EtcdStoragePlugin : public MetadataStoragePlugin {
         return true;
     }
 
+    virtual bool watch(const std::string &prefix, OnChangeCallBack callback) {
+        if (EtcdWatchPrefixWrapper((char *)prefix.c_str(), &watch_id_,
+                                   &err_msg_)) {
+            LOG(WARNING) << "EtcdStoragePlugin: unable to watch " << prefix
+                         << " in " << metadata_uri_ << ": " << err_msg_;
+            free(err_msg_);
+            err_msg_ = nullptr;
+            return false;
+        }
+        watch_running_ = true;
+        watch_thread_ = std::thread([this, callback]() {
+            while (watch_running_) {
+                char *key = nullptr, *err_msg = nullptr;
+                // Times out every second so that the watch can be stopped
+                int ret = EtcdNextWatchEventWrapper(watch_id_, 1000, &key,
+                                                    &err_msg);
+                if (ret < 0) {
+                    LOG(WARNING) << "EtcdStoragePlugin: stopped watching "
+                                 << metadata_uri_ << ": " << err_msg;
+                    free(err_msg);
+                    return;
+                }
+                if (ret == 0) {
+                    std::string changed_key(key);
+                    free(key);
+                    callback(changed_key);
+                }
+            }
+        });
+        return true;
+    }
+
     const std::string metadata_uri_;
     char *err_msg_;
+    int watch_id_ = 0;
+    std::atomic<bool> watch_running_{false};
+    std::thread watch_thread_;
 };
 #endif
 #endif  // USE_ETCD
@@ -564,6 +945,10 @@ struct SocketHandShakePlugin : public HandShakePlugin {
         on_notify_callback_ = callback;
     }
 
+    virtual void registerOnCreditCallBack(OnReceiveCallBack callback) {
+        on_credit_callback_ = callback;
+    }
+
     virtual int startDaemon(uint16_t listen_port, int sockfd) {
         if (listener_running_) {
             // LOG(INFO) << "SocketHandShakePlugin: listener already running";
@@ -693,6 +1078,9 @@ struct SocketHandShakePlugin : public HandShakePlugin {
                     on_metadata_callback_(peer, local);
                 } else if (type == HandShakeRequestType::Notify) {
                     on_notify_callback_(peer, local);
+                } else if (type == HandShakeRequestType::Credit &&
+                           on_credit_callback_) {
+                    on_credit_callback_(peer, local);
                 } else {
                     LOG(ERROR) << "SocketHandShakePlugin: unexpected handshake "
                                   "message type";
@@ -773,6 +1161,34 @@ struct SocketHandShakePlugin : public HandShakePlugin {
         return ret;
     }
 
+    virtual int sendCredit(std::string ip_or_host_name, uint16_t rpc_port,
+                           const Json::Value &local, Json::Value &peer) {
+        struct addrinfo hints;
+        struct addrinfo *result, *rp;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = globalConfig().use_ipv6 ? AF_INET6 : AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+
+        char service[16];
+        sprintf(service, "%u", rpc_port);
+        if (getaddrinfo(ip_or_host_name.c_str(), service, &hints, &result)) {
+            PLOG(ERROR)
+                << "SocketHandShakePlugin: failed to get IP address of peer "
+                   "server "
+                << ip_or_host_name << ":" << rpc_port;
+            return ERR_DNS;
+        }
+
+        int ret = 0;
+        for (rp = result; rp; rp = rp->ai_next) {
+            ret = doSendRequest(rp, HandShakeRequestType::Credit, local, peer);
+            if (ret == 0 || ret == ERR_MALFORMED_JSON) break;
+        }
+
+        freeaddrinfo(result);
+        return ret;
+    }
+
     virtual int send(std::string ip_or_host_name, uint16_t rpc_port,
                      const Json::Value &local, Json::Value &peer) {
         struct addrinfo hints;
@@ -1000,6 +1416,35 @@ struct SocketHandShakePlugin : public HandShakePlugin {
         return 0;
     }
 
+    // One request of type and its reply
+    int doSendRequest(struct addrinfo *addr, HandShakeRequestType type,
+                      const Json::Value &local, Json::Value &peer) {
+        int conn_fd = -1;
+        int ret = doConnect(addr, conn_fd);
+        if (ret) {
+            return ret;
+        }
+
+        ret = writeString(conn_fd, type, Json::FastWriter{}.write(local));
+        if (ret) {
+            close(conn_fd);
+            return ret;
+        }
+
+        Json::Reader reader;
+        auto [reply_type, json_str] = readString(conn_fd);
+        close(conn_fd);
+        // Peers not handling the type close the connection
+        if (reply_type != type) return ERR_SOCKET;
+        if (!reader.parse(json_str, peer)) {
+            LOG(ERROR) << "SocketHandShakePlugin: failed to receive reply, "
+                          "malformed json format: "
+                       << reader.getFormattedErrorMessages();
+            return ERR_MALFORMED_JSON;
+        }
+        return 0;
+    }
+
     std::atomic<bool> listener_running_;
     std::thread listener_;
     int listen_fd_;
@@ -1008,6 +1453,7 @@ struct SocketHandShakePlugin : public HandShakePlugin {
     OnReceiveCallBack on_connection_callback_;
     OnReceiveCallBack on_metadata_callback_;
     OnReceiveCallBack on_notify_callback_;
+    OnReceiveCallBack on_credit_callback_;
 };
 
 std::shared_ptr<HandShakePlugin> HandShakePlugin::Create(
@@ -27,6 +27,8 @@
 #include <netdb.h>
 #include <random>
 #include <ifaddrs.h>
+#include <map>
+#include <mutex>
 #include "mpi.h"
 #include "transport/ascend_transport/hccl_transport/hccl_transport_mem_c.h"
 
@@ -49,6 +51,14 @@ std::unique_ptr<hccl::NotifyPool> notifyPool_;
 HcclDispatcher dispatcher_{nullptr};
 std::unordered_map<std::string, ConnectionInfo> target_key_to_connection_map_;
 std::vector<MergeMem> g_localMergeMem;
+// Registration and export of a local buffer over the vnic (false) or nic
+// (true) context, made once and shared by the connections with every peer
+struct LocalMemExport {
+    HcclBuf buf;
+    std::string desc;
+};
+std::mutex g_localMemExportMutex;
+std::map<std::pair<bool, void *>, LocalMemExport> g_localMemExports;
 int g_server_socket_ = 0;
 int g_epoll_fd = 0;
 struct epoll_event g_ev;
@@ -433,6 +443,63 @@ int createClientSocket(std::shared_ptr<hccl::HcclSocket> &hccl_socket, RankInfo
     return 0;
 }
 
+// Describe local buffer i to the peer, registering and exporting it only the first time it is shared over its context; peers within HCCS are granted access each
+static int exportLocalRmaMem(size_t i, bool is_cross_hccs, uint64_t local_logic_id, uint64_t remote_logic_id, uint64_t remote_pid, hccl::TransportMem::RmaMemDesc &rma_mem_desc) {
+    int ret = 0;
+    void *addr = g_localMergeMem[i].addr;
+    uint64_t len = g_localMergeMem[i].len;
+    std::unique_lock<std::mutex> lock(g_localMemExportMutex);
+    auto iter = g_localMemExports.find({is_cross_hccs, addr});
+    if (iter == g_localMemExports.end()) {
+        HcclMem mem;
+        HcclBuf buf;
+        mem.addr = addr;
+        mem.size = len;
+        mem.type = HCCL_MEM_TYPE_DEVICE;
+        if (!is_cross_hccs) {
+            ret = HcclMemReg(vnicNetDevCtx_, &mem, &buf);
+        } else {
+            ret = HcclMemReg(nicNetDevCtx_, &mem, &buf);
+        }
+        if (ret != 0 && ret != 20) {
+            LOG(ERROR) << "HcclMemReg failed, ret: " << ret << ", addr: " << addr << ", len: " << len;
+            return ret;
+        }
+        char *desc = nullptr;
+        uint64_t desc_len = 0;
+        ret = HcclMemExport(&buf, &desc, &desc_len);
+        if (ret) {
+            LOG(ERROR) << "HcclMemExport failed, ret: " << ret << ", addr: " << addr << ", len: " << len;
+            return ret;
+        }
+        iter = g_localMemExports.emplace(std::make_pair(is_cross_hccs, addr), LocalMemExport{buf, std::string(desc, desc_len)}).first;
+    }
+    HcclBuf buf = iter->second.buf;
+    const std::string &desc = iter->second.desc;
+
+    rma_mem_desc.localRankId = local_logic_id;
+    rma_mem_desc.remoteRankId = remote_logic_id;
+    memset_s(rma_mem_desc.memDesc, hccl::TRANSPORT_EMD_ESC_SIZE, 0, hccl::TRANSPORT_EMD_ESC_SIZE);
+    if (memcpy_s(rma_mem_desc.memDesc, hccl::TRANSPORT_EMD_ESC_SIZE, desc.c_str(), desc.size() + 1) != EOK) {
+        LOG(ERROR) << "memcpy_s failed, addr: " << addr << ", len: " << len;
+        return -1;
+    }
+    lock.unlock();
+
+    // In the scenario within HCCS, it is necessary to call HcclMemGrant to authorize peer memory
+    if (!is_cross_hccs) {
+        HcclMemGrantInfo grant_info;
+        grant_info.remotePid = (int32_t)remote_pid;
+        grant_info.remoteSdid = 0xFFFFFFFF;
+        ret = HcclMemGrant(&buf, &grant_info);
+        if (ret) {
+            LOG(ERROR) << "HcclMemGrant failed, ret: " << ret << ", addr: " << addr << ", len: " << len;
+            return ret;
+        }
+    }
+    return 0;
+}
+
 int createTransportMem(RankInfo *local_rank_info, RankInfo *remote_rank_info, std::shared_ptr<hccl::TransportMem>& transport_mem) {
     int ret = 0;
     bool same_host = local_rank_info->hostIp.s_addr == remote_rank_info->hostIp.s_addr;
@@ -511,49 +578,11 @@ int createTransportMem(RankInfo *local_rank_info, RankInfo *remote_rank_info, st
     target_key_to_connection_map_[key_str].transport_mem = transport_mem;
     size_t m_num = g_localMergeMem.size();
     std::vector<hccl::TransportMem::RmaMemDesc> rmaMemDescs(m_num);
-
     for (size_t i = 0; i < m_num; ++i) {
-        HcclMem mem;
-        HcclBuf buf;
-        mem.addr = g_localMergeMem[i].addr;
-        mem.size = g_localMergeMem[i].len;
-        mem.type = HCCL_MEM_TYPE_DEVICE;
-        if (!is_cross_hccs) {
-            ret = HcclMemReg(vnicNetDevCtx_, &mem, &buf);
-        } else {
-            ret = HcclMemReg(nicNetDevCtx_, &mem, &buf);
-        }
-        if (ret != 0 && ret != 20) {
-            LOG(ERROR) << "HcclMemReg failed, ret: " << ret << " addr: " << g_localMergeMem[i].addr << " len: " << g_localMergeMem[i].len;
-            return ret;
-        }
-        char *desc = nullptr;
-        uint64_t desc_len = 0;
-        ret = HcclMemExport(&buf, &desc, &desc_len);
+        ret = exportLocalRmaMem(i, is_cross_hccs, local_rank_info->deviceLogicId, remote_rank_info->deviceLogicId, remote_rank_info->pid, rmaMemDescs[i]);
         if (ret) {
-            LOG(ERROR) << "HcclMemExport failed, ret: " << ret << ", addr: " << g_localMergeMem[i].addr << ", len: " << g_localMergeMem[i].len;
             return ret;
         }
-        
-        rmaMemDescs[i].localRankId = local_rank_info->deviceLogicId;
-        rmaMemDescs[i].remoteRankId = remote_rank_info->deviceLogicId;
-        memset_s(rmaMemDescs[i].memDesc, hccl::TRANSPORT_EMD_ESC_SIZE, 0, hccl::TRANSPORT_EMD_ESC_SIZE);
-        if (memcpy_s(rmaMemDescs[i].memDesc, hccl::TRANSPORT_EMD_ESC_SIZE, desc, desc_len + 1) != EOK) {
-            LOG(ERROR) << "memcpy_s failed, ret: " << ret << ", addr: " << g_localMergeMem[i].addr << ", len: " << g_localMergeMem[i].len;
-            return -1;
-        }
-
-        // In the scenario within HCCS, it is necessary to call HcclMemGrant to authorize peer memory
-        if (!is_cross_hccs) {
-            HcclMemGrantInfo grant_info;
-            grant_info.remotePid = (int32_t)remote_rank_info->pid;
-            grant_info.remoteSdid = 0xFFFFFFFF;
-            ret = HcclMemGrant(&buf, &grant_info);
-            if (ret) {
-                LOG(ERROR) << "HcclMemGrant failed, ret: " << ret << ", addr: " << g_localMergeMem[i].addr << ", len: " << g_localMergeMem[i].len;
-                return ret;
-            }
-        }
     }
     hccl::TransportMem::RmaMemDescs localRmaMemDescs;
     localRmaMemDescs.array = rmaMemDescs.data();
@@ -611,7 +640,7 @@ int transportMemTask(RankInfo *local_rank_info, RankInfo *remote_rank_info,
             return ret;
         }
     } else {
-        transport_mem = target_key_to_connection_map_[key_str].transport_mem;
+        transport_mem = iter->second.transport_mem;
     }
     hccl::TransportMem::RmaOpMem localMem;
     localMem.addr = local_mem;
@@ -838,47 +867,10 @@ int transportMemAccept(RankInfo *local_rank_info) {
     size_t m_num = g_localMergeMem.size();
     std::vector<hccl::TransportMem::RmaMemDesc> rmaMemDescs(m_num);
     for (size_t i = 0; i < m_num; ++i) {
-        HcclBuf buf;
-        HcclMem mem;
-        mem.addr = g_localMergeMem[i].addr;
-        mem.size = g_localMergeMem[i].len;
-        mem.type = HCCL_MEM_TYPE_DEVICE;
-        if (!is_cross_hccs) {
-            ret = HcclMemReg(vnicNetDevCtx_, &mem, &buf);
-        } else {
-            ret = HcclMemReg(nicNetDevCtx_, &mem, &buf);
-        }
-        if (ret != 0 && ret != 20) {
-            LOG(ERROR) << "HcclMemReg failed, ret: " << ret << ", addr: " << g_localMergeMem[i].addr << ", len: " << g_localMergeMem[i].len;
-            return ret;
-        }
-        char *desc = nullptr;
-        uint64_t desc_len = 0;
-        ret = HcclMemExport(&buf, &desc, &desc_len);
+        ret = exportLocalRmaMem(i, is_cross_hccs, local_rank_info->deviceLogicId, remote_control_info.deviceLogicId, remote_control_info.pid, rmaMemDescs[i]);
         if (ret) {
-            LOG(ERROR) << "HcclMemExport failed, ret: " << ret << ", addr: " << g_localMergeMem[i].addr << ", len: " << g_localMergeMem[i].len;
             return ret;
         }
-        
-        rmaMemDescs[i].localRankId = local_rank_info->deviceLogicId;
-        rmaMemDescs[i].remoteRankId = remote_control_info.deviceLogicId;
-        memset_s(rmaMemDescs[i].memDesc, hccl::TRANSPORT_EMD_ESC_SIZE, 0, hccl::TRANSPORT_EMD_ESC_SIZE);
-        if (memcpy_s(rmaMemDescs[i].memDesc, hccl::TRANSPORT_EMD_ESC_SIZE, desc, desc_len + 1) != EOK) {
-            LOG(ERROR) << "memcpy_s failed, ret: " << ret << ", addr: " << g_localMergeMem[i].addr << ", len: " << g_localMergeMem[i].len;
-            return -1;
-        }
-
-        // In the scenario within HCCS, it is necessary to call HcclMemGrant to authorize peer memory
-        if (!is_cross_hccs) {
-            HcclMemGrantInfo grant_info;
-            grant_info.remotePid = (int32_t)remote_control_info.pid;
-            grant_info.remoteSdid = 0xFFFFFFFF;
-            ret = HcclMemGrant(&buf, &grant_info);
-            if (ret) {
-                LOG(ERROR) << "HcclMemGrant failed, ret: " << ret << ", addr: " << g_localMergeMem[i].addr << ", len: " << g_localMergeMem[i].len;
-                return ret;
-            }
-        }
     }
     hccl::TransportMem::RmaMemDescs localRmaMemDescs;
     localRmaMemDescs.array = rmaMemDescs.data();
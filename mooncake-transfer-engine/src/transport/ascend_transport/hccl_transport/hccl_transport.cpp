@@ -13,6 +13,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <cassert>
 #include <iostream>
 #include <fstream>
@@ -21,9 +22,14 @@
 #include <sys/socket.h>
 #include <cstdlib>
 #include <string>
+#include "config.h"
 #include "transport/ascend_transport/hccl_transport/hccl_transport.h"
 
 namespace mooncake{
+// Batches an initiator keeps issued to its streams before waiting for the
+// oldest one to complete
+const static size_t kMaxInflightBatches = 4;
+
 HcclTransport::HcclTransport() : running_(-1) {
     //TODO
 }
@@ -31,9 +37,16 @@ HcclTransport::HcclTransport() : running_(-1) {
 HcclTransport::~HcclTransport() {
     if (running_) {
         running_ = false;
-       
+        initiator_cond_.notify_all();
         for (size_t i = 0; i < THREAD_NUM; ++i) {
             allInitiatorThreads_[i].join();
+            // Batches issued by the initiator are drained before it stops
+            {
+                std::lock_guard<std::mutex> lock(completionQueues_[i].mutex);
+                completionQueues_[i].stopped = true;
+            }
+            completionQueues_[i].cond.notify_all();
+            allCompletionThreads_[i].join();
             allAcceptThreads_[i].join();
         }
     }
@@ -41,29 +54,50 @@ HcclTransport::~HcclTransport() {
 }
 
 void HcclTransport::initiatorLoop(int deviceLogicId, int selfIdx) {
-    aclrtStream stream;
     int ret = aclrtSetDevice(deviceLogicId);
     if (ret) {
         LOG(ERROR) << "HcclTransport: aclrtSetDevice error, ret: " << ret;
     }
 
-    ret = aclrtCreateStream(&stream);
-    if (ret) {
-        LOG(ERROR) << "HcclTransport: aclrtCreateStream error, ret: " << ret;
+    // Consecutive slices are issued to different streams, so that the
+    // chunks of a large request are moved in parallel
+    std::vector<aclrtStream> streams(globalConfig().hccl_streams);
+    for (auto &stream : streams) {
+        ret = aclrtCreateStream(&stream);
+        if (ret) {
+            LOG(ERROR) << "HcclTransport: aclrtCreateStream error, ret: " << ret;
+        }
     }
-    
-    while(1) {
+
+    auto &completion = completionQueues_[selfIdx];
+    {
+        std::lock_guard<std::mutex> lock(completion.mutex);
+        for (size_t i = 0; i < kMaxInflightBatches * streams.size(); ++i) {
+            aclrtEvent event;
+            ret = aclrtCreateEvent(&event);
+            if (ret) {
+                LOG(ERROR) << "HcclTransport: aclrtCreateEvent error, ret: "
+                           << ret;
+                continue;
+            }
+            completion.free_events.push_back(event);
+        }
+    }
+
+    while (true) {
         auto waitlock = std::chrono::high_resolution_clock::now();
         std::unique_lock<std::mutex> lock(initiator_mutex_);
-        if (allReqQueues_[selfIdx].empty()){
-            initiator_cond_.wait(lock);
-        }
+        initiator_cond_.wait(lock, [&] {
+            return !running_ || !allReqQueues_[selfIdx].empty();
+        });
+        if (allReqQueues_[selfIdx].empty()) break;
         auto start = std::chrono::high_resolution_clock::now();
         auto slice_list = std::move(allReqQueues_[selfIdx].front());
         allReqQueues_[selfIdx].pop();
         lock.unlock();
         if (slice_list.empty()) {
             LOG(ERROR) << "HcclTransport: empty transfer request batch";
+            continue;
         }
         auto segment_desc = metadata_->getSegmentDescByID(slice_list[0]->target_id);
         if (!segment_desc) {
@@ -84,9 +118,31 @@ void HcclTransport::initiatorLoop(int deviceLogicId, int selfIdx) {
         remote_rank_info_.serverIdx = 0;
         remote_rank_info_.pid = segment_desc->rank_info.pid;
 
-        for (auto slice : slice_list) {
+        std::vector<MergedOp> ops;
+        mergeSlices(slice_list, *segment_desc, ops);
+
+        // Each stream used by the batch records an event, and events are
+        // only returned once the batch completed, which bounds the batches
+        // in flight
+        InflightBatch batch;
+        size_t used_streams = std::min(ops.size(), streams.size());
+        std::unique_lock<std::mutex> completion_lock(completion.mutex);
+        completion.cond.wait(completion_lock, [&] {
+            return completion.free_events.size() >= used_streams;
+        });
+        batch.events.assign(completion.free_events.end() - used_streams,
+                            completion.free_events.end());
+        completion.free_events.resize(completion.free_events.size() -
+                                      used_streams);
+        completion_lock.unlock();
+
+        batch.slices.reserve(slice_list.size());
+        for (size_t i = 0; i < ops.size(); ++i) {
+            auto &op = ops[i];
+            auto slice = slice_list[op.first];
             ret = transportMemTask(&local_rank_info_, &remote_rank_info_, slice->opcode,
-                slice->hccl.dest_addr, slice->length, slice->source_addr, stream);
+                slice->hccl.dest_addr, op.length, slice->source_addr,
+                streams[i % used_streams]);
             if (ret) {
                 LOG(ERROR) << "HcclTransport: transportMemTask error, local devicePhyId: "
                         << local_rank_info_.devicePhyId
@@ -96,66 +152,194 @@ void HcclTransport::initiatorLoop(int deviceLogicId, int selfIdx) {
                         << slice->source_addr
                         << ", dest_addr: "
                         << slice->hccl.dest_addr
+                        << ", length: " << op.length
                         << ", ret: " << ret;
-                slice->markFailed();
-                slice->status = Slice::SliceStatus::FAILED;
+                for (size_t j = op.first; j < op.first + op.count; ++j)
+                    slice_list[j]->markFailed();
+                continue;
             }
+            batch.slices.insert(batch.slices.end(),
+                                slice_list.begin() + op.first,
+                                slice_list.begin() + op.first + op.count);
         }
-        
+        issued_slices_.fetch_add(slice_list.size(), std::memory_order_relaxed);
+        issued_ops_.fetch_add(ops.size(), std::memory_order_relaxed);
+
         auto mid = std::chrono::high_resolution_clock::now();
-        ret = transportMemAddOpFence(&remote_rank_info_, stream);
-        if (ret) {
-            LOG(ERROR) << "transportMemAddOpFence failed, local devicePhyId: " 
-                    << local_rank_info_.devicePhyId
-                    << ", remote devicePhyId: "
-                    << remote_rank_info_.devicePhyId
-                    << ", ret: " << ret;
-            for (auto slice : slice_list) {
-                slice->markFailed();
+        bool failed = false;
+        for (size_t i = 0; i < used_streams && !failed; ++i) {
+            ret = transportMemAddOpFence(&remote_rank_info_, streams[i]);
+            if (ret) {
+                LOG(ERROR) << "transportMemAddOpFence failed, local devicePhyId: " 
+                        << local_rank_info_.devicePhyId
+                        << ", remote devicePhyId: "
+                        << remote_rank_info_.devicePhyId
+                        << ", ret: " << ret;
+                failed = true;
+                break;
+            }
+            ret = aclrtRecordEvent(batch.events[i], streams[i]);
+            if (ret) {
+                LOG(ERROR) << "aclrtRecordEvent failed, local devicePhyId: "
+                        << local_rank_info_.devicePhyId
+                        << ", ret: " << ret;
+                failed = true;
             }
         }
         auto addOpfence = std::chrono::high_resolution_clock::now();
 
-        ret = aclrtSynchronizeStream(stream);
-        if (ret) {
-            LOG(ERROR) << "aclrtSynchronizeStream failed, local devicePhyId: " 
-                    << local_rank_info_.devicePhyId
-                    << ", remote devicePhyId: "
-                    << remote_rank_info_.devicePhyId
-                    << ", ret: " << ret;
-            for (auto slice : slice_list) {
+        if (failed) {
+            // Nothing of the batch may still be in flight once it is failed
+            for (size_t i = 0; i < used_streams; ++i)
+                aclrtSynchronizeStream(streams[i]);
+            for (auto slice : batch.slices) {
                 slice->markFailed();
             }
+            batch.slices.clear();
         }
-        for (auto slice : slice_list) {
-            if (slice->status != Slice::SliceStatus::FAILED) {
-                slice->markSuccess();
-                slice->task->transferred_bytes = slice->length;
-            }   
+        completion_lock.lock();
+        if (failed) {
+            completion.free_events.insert(completion.free_events.end(),
+                                          batch.events.begin(),
+                                          batch.events.end());
+        } else {
+            completion.batches.push(std::move(batch));
         }
-        auto stop = std::chrono::high_resolution_clock::now();
+        completion_lock.unlock();
+        completion.cond.notify_all();
+
         if (printEnabled()) {
             pid_t pid = getpid();
             auto duration_wait = std::chrono::duration_cast<std::chrono::milliseconds>(start - waitlock);
             auto duration_call = std::chrono::duration_cast<std::chrono::microseconds>(mid - start);
             auto duration_addOpfence = std::chrono::duration_cast<std::chrono::microseconds>(addOpfence - mid);
-            auto duration_sync = std::chrono::duration_cast<std::chrono::microseconds>(stop - addOpfence);
             LOG(INFO) << "pid: " << pid
             << ", target hostIp: " << segment_desc->rank_info.hostIp.c_str()
             << ", local devicePhyId: " << local_rank_info_.devicePhyId 
             << ", target devicePhyId: " << remote_rank_info_.devicePhyId
+            << ", streams: " << used_streams
+            << ", slices: " << slice_list.size()
+            << ", ops: " << ops.size()
             << ", batch waitlock spent: "<< duration_wait.count() << "ms"
             << ", batch call spent: "<< duration_call.count() << "us"
-            << ", batch addOpfence spent: " << duration_addOpfence.count() << "us"
-            << ", batch sync spent: " << duration_sync.count() << "us";
+            << ", batch addOpfence spent: " << duration_addOpfence.count() << "us";
         } else {
             (void)waitlock;
             (void)start;
             (void)mid;
             (void)addOpfence;
-            (void)stop;
         }
     }
+
+    for (auto stream : streams) {
+        aclrtSynchronizeStream(stream);
+        aclrtDestroyStream(stream);
+    }
+}
+
+// End of the buffer holding addr, 0 if there is none
+static uint64_t bufferEnd(
+    const std::vector<TransferMetadata::BufferDesc> &buffers, uint64_t addr) {
+    for (auto &buffer : buffers) {
+        if (addr >= buffer.addr && addr < buffer.addr + buffer.length)
+            return buffer.addr + buffer.length;
+    }
+    return 0;
+}
+
+void HcclTransport::mergeSlices(const std::vector<Slice *> &slice_list,
+                                const SegmentDesc &remote,
+                                std::vector<MergedOp> &ops) {
+    const size_t merge_size = globalConfig().hccl_merge_size;
+    std::shared_ptr<SegmentDesc> local;
+    ops.reserve(slice_list.size());
+    for (size_t i = 0; i < slice_list.size(); ++i) {
+        auto slice = slice_list[i];
+        if (!ops.empty()) {
+            auto &op = ops.back();
+            auto first = slice_list[op.first];
+            uint64_t source = (uint64_t)first->source_addr + op.length;
+            uint64_t dest = first->hccl.dest_addr + op.length;
+            if (slice->opcode == first->opcode &&
+                (uint64_t)slice->source_addr == source &&
+                slice->hccl.dest_addr == dest &&
+                op.length + slice->length <= merge_size) {
+                if (!op.local_end) {
+                    if (!local)
+                        local = metadata_->getSegmentDescByID(LOCAL_SEGMENT_ID);
+                    if (local)
+                        op.local_end = bufferEnd(local->buffers,
+                                                 (uint64_t)first->source_addr);
+                    op.remote_end = bufferEnd(remote.buffers,
+                                              first->hccl.dest_addr);
+                }
+                if (source + slice->length <= op.local_end &&
+                    dest + slice->length <= op.remote_end) {
+                    ++op.count;
+                    op.length += slice->length;
+                    continue;
+                }
+            }
+        }
+        ops.push_back({i, 1, slice->length, 0, 0});
+    }
+}
+
+void HcclTransport::completionLoop(int deviceLogicId, int selfIdx) {
+    int ret = aclrtSetDevice(deviceLogicId);
+    if (ret) {
+        LOG(ERROR) << "HcclTransport: aclrtSetDevice error, ret: " << ret;
+    }
+
+    auto &completion = completionQueues_[selfIdx];
+    while (true) {
+        std::unique_lock<std::mutex> lock(completion.mutex);
+        completion.cond.wait(lock, [&] {
+            return completion.stopped || !completion.batches.empty();
+        });
+        if (completion.batches.empty()) break;
+        auto batch = std::move(completion.batches.front());
+        completion.batches.pop();
+        lock.unlock();
+
+        auto start = std::chrono::high_resolution_clock::now();
+        bool failed = false;
+        for (auto event : batch.events) {
+            ret = aclrtSynchronizeEvent(event);
+            if (ret) {
+                LOG(ERROR) << "aclrtSynchronizeEvent failed, local devicePhyId: "
+                        << local_rank_info_.devicePhyId
+                        << ", ret: " << ret;
+                failed = true;
+            }
+        }
+        for (auto slice : batch.slices) {
+            if (failed)
+                slice->markFailed();
+            else
+                slice->markSuccess();
+        }
+        auto stop = std::chrono::high_resolution_clock::now();
+
+        lock.lock();
+        completion.free_events.insert(completion.free_events.end(),
+                                      batch.events.begin(),
+                                      batch.events.end());
+        lock.unlock();
+        completion.cond.notify_all();
+
+        if (printEnabled()) {
+            auto duration_sync = std::chrono::duration_cast<std::chrono::microseconds>(stop - start);
+            LOG(INFO) << "pid: " << getpid()
+            << ", local devicePhyId: " << local_rank_info_.devicePhyId
+            << ", slices: " << batch.slices.size()
+            << ", batch sync spent: " << duration_sync.count() << "us";
+        }
+    }
+
+    // The initiator has stopped, so every event is back in the pool
+    for (auto event : completion.free_events) aclrtDestroyEvent(event);
+    completion.free_events.clear();
 }
 
 void HcclTransport::acceptLoop(int deviceLogicId) {
@@ -184,6 +368,7 @@ int HcclTransport::initPdThread() {
     for (int i = 0; i < THREAD_NUM; ++i) {
         allInitiatorThreads_[i] = std::thread(&HcclTransport::initiatorLoop, this, deviceLogicId, i);
         allAcceptThreads_[i] = std::thread(&HcclTransport::acceptLoop, this, deviceLogicId);
+        allCompletionThreads_[i] = std::thread(&HcclTransport::completionLoop, this, deviceLogicId, i);
     }
 
     LOG(INFO) << "HcclTransport: initPdThread, pid: " << pid << ";" << "init " << THREAD_NUM << " initiator threads and accept threads, deviceLogicId: " << deviceLogicId;
@@ -340,7 +525,9 @@ int HcclTransport::install(std::string &local_server_name,
 
 Status HcclTransport::submitTransfer(
     BatchID batch_id, const std::vector<TransferRequest> &entries) {
-    auto &batch_desc = *((BatchDesc *)(batch_id));
+    auto batch_desc_ptr = getBatchDesc(batch_id);
+    if (!batch_desc_ptr) return Status::InvalidArgument("Invalid batch ID");
+    auto &batch_desc = *batch_desc_ptr;
     if (batch_desc.task_list.size() + entries.size() > batch_desc.batch_size) {
         LOG(ERROR) << "HcclTransport: Exceed the limitation of current batch's "
                       "capacity";
@@ -356,21 +543,7 @@ Status HcclTransport::submitTransfer(
     for (auto &request : entries) {
         TransferTask &task = batch_desc.task_list[task_id];
         ++task_id;
-        task.total_bytes = request.length;
-        Slice *slice = getSliceCache().allocate();
-        slice->source_addr = request.source;
-        slice->length = request.length;
-        slice->opcode = request.opcode;
-        slice->hccl.dest_addr = request.target_offset;
-        slice->task = &task;
-        slice->target_id = request.target_id;
-        slice->status = Slice::PENDING;
-        task.slice_list.push_back(slice);
-        __sync_fetch_and_add(&task.slice_count, 1);
-        std::unique_lock<std::mutex> lock(initiator_mutex_);
-        slice_list.push_back(slice);
-        lock.unlock();
-        initiator_cond_.notify_one();
+        addSlices(request, task, slice_list);
     }
     std::unique_lock<std::mutex> lock(initiator_mutex_);
     allReqQueues_[0].push(slice_list);
@@ -389,18 +562,7 @@ Status HcclTransport::submitTransferTask(
     for (auto &request : request_list) {
         TransferTask &task = *task_list[task_id];
         ++task_id;
-        task.total_bytes = request->length;
-        Slice *slice = getSliceCache().allocate();
-        slice->source_addr = (char *)request->source;
-        slice->length = request->length;
-        slice->opcode = request->opcode;
-        slice->hccl.dest_addr = request->target_offset;
-        slice->task = &task;
-        slice->target_id = request->target_id;
-        slice->status = Slice::PENDING;
-        task.slice_list.push_back(slice);
-        __sync_fetch_and_add(&task.slice_count, 1);
-        slice_list.push_back(slice);
+        addSlices(*request, task, slice_list);
     }
     std::unique_lock<std::mutex> lock(initiator_mutex_);
     allReqQueues_[0].push(slice_list);
@@ -410,9 +572,31 @@ Status HcclTransport::submitTransferTask(
     return Status::OK();
 }
 
+void HcclTransport::addSlices(const TransferRequest &request,
+                              TransferTask &task,
+                              std::vector<Slice *> &slices) {
+    const size_t chunk_size = globalConfig().hccl_chunk_size;
+    task.total_bytes = request.length;
+    for (size_t offset = 0; offset < request.length; offset += chunk_size) {
+        Slice *slice = getSliceCache().allocate();
+        slice->source_addr = (char *)request.source + offset;
+        slice->length = std::min(chunk_size, request.length - offset);
+        slice->opcode = request.opcode;
+        slice->hccl.dest_addr = request.target_offset + offset;
+        slice->task = &task;
+        slice->target_id = request.target_id;
+        slice->status = Slice::PENDING;
+        task.slice_list.push_back(slice);
+        __sync_fetch_and_add(&task.slice_count, 1);
+        slices.push_back(slice);
+    }
+}
+
 Status HcclTransport::getTransferStatus(BatchID batch_id, size_t task_id,
                                        TransferStatus &status) {
-    auto &batch_desc = *((BatchDesc *)(batch_id));
+    auto batch_desc_ptr = getBatchDesc(batch_id);
+    if (!batch_desc_ptr) return Status::InvalidArgument("Invalid batch ID");
+    auto &batch_desc = *batch_desc_ptr;
     const size_t task_count = batch_desc.task_list.size();
     if (task_id >= task_count) {
         return Status::InvalidArgument(
@@ -466,6 +650,20 @@ int HcclTransport::unregisterLocalMemory(void *addr, bool update_metadata) {
     return metadata_->removeLocalMemoryBuffer(addr, update_metadata);
 }
 
+void HcclTransport::appendMetrics(std::string &out) {
+    out +=
+        "# HELP te_hccl_slices_total Slices issued by the HCCL transport\n"
+        "# TYPE te_hccl_slices_total counter\n"
+        "te_hccl_slices_total " +
+        std::to_string(issued_slices_.load(std::memory_order_relaxed)) +
+        "\n"
+        "# HELP te_hccl_ops_total HCCL operations the slices were merged "
+        "into\n"
+        "# TYPE te_hccl_ops_total counter\n"
+        "te_hccl_ops_total " +
+        std::to_string(issued_ops_.load(std::memory_order_relaxed)) + "\n";
+}
+
 int HcclTransport::allocateLocalSegmentID() {
     auto desc = std::make_shared<SegmentDesc>();
     if (!desc) return ERR_MEMORY;
@@ -14,59 +14,421 @@
 
 #include "transport/cxl_transport/cxl_transport.h"
 
-#include <bits/stdint-uintn.h>
+#include <fcntl.h>
 #include <glog/logging.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <algorithm>
-#include <cassert>
-#include <cstddef>
 #include <cstdint>
-#include <iomanip>
+#include <cstdlib>
+#include <cstring>
 #include <memory>
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 #include "common.h"
-#include "transfer_engine.h"
+#include "config.h"
+#include "dsa_engine.h"
 #include "transfer_metadata.h"
 #include "transport/transport.h"
 
 namespace mooncake {
-CxlTransport::CxlTransport() {
-    // TODO
+
+namespace {
+
+// Requests are cut into slices of this size, which are spread over the
+// workers
+constexpr size_t kCxlSliceSize = 1048576;
+
+// Distance in bytes prefetched ahead of the copy when reading from CXL,
+// enough to cover the latency of the extra hop
+constexpr size_t kPrefetchDistance = 1024;
+
+#if defined(__x86_64__)
+__attribute__((target("avx512f"))) void streamCopyAvx512(char *dst,
+                                                         const char *src,
+                                                         size_t len) {
+    // Non-temporal stores need aligned destinations
+    size_t head = std::min(len, (size_t)(-(uintptr_t)dst & 63));
+    memcpy(dst, src, head);
+    dst += head, src += head, len -= head;
+    for (; len >= 256; dst += 256, src += 256, len -= 256) {
+        _mm_prefetch(src + kPrefetchDistance, _MM_HINT_NTA);
+        _mm_prefetch(src + kPrefetchDistance + 128, _MM_HINT_NTA);
+        __m512i v0 = _mm512_loadu_si512((const void *)src);
+        __m512i v1 = _mm512_loadu_si512((const void *)(src + 64));
+        __m512i v2 = _mm512_loadu_si512((const void *)(src + 128));
+        __m512i v3 = _mm512_loadu_si512((const void *)(src + 192));
+        _mm512_stream_si512((__m512i *)dst, v0);
+        _mm512_stream_si512((__m512i *)(dst + 64), v1);
+        _mm512_stream_si512((__m512i *)(dst + 128), v2);
+        _mm512_stream_si512((__m512i *)(dst + 192), v3);
+    }
+    for (; len >= 64; dst += 64, src += 64, len -= 64)
+        _mm512_stream_si512((__m512i *)dst,
+                            _mm512_loadu_si512((const void *)src));
+    // Order the streaming stores before the slice is reported complete
+    _mm_sfence();
+    memcpy(dst, src, len);
+}
+
+__attribute__((target("avx2"))) void streamCopyAvx2(char *dst,
+                                                    const char *src,
+                                                    size_t len) {
+    size_t head = std::min(len, (size_t)(-(uintptr_t)dst & 31));
+    memcpy(dst, src, head);
+    dst += head, src += head, len -= head;
+    for (; len >= 128; dst += 128, src += 128, len -= 128) {
+        _mm_prefetch(src + kPrefetchDistance, _MM_HINT_NTA);
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)src);
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)(src + 32));
+        __m256i v2 = _mm256_loadu_si256((const __m256i *)(src + 64));
+        __m256i v3 = _mm256_loadu_si256((const __m256i *)(src + 96));
+        _mm256_stream_si256((__m256i *)dst, v0);
+        _mm256_stream_si256((__m256i *)(dst + 32), v1);
+        _mm256_stream_si256((__m256i *)(dst + 64), v2);
+        _mm256_stream_si256((__m256i *)(dst + 96), v3);
+    }
+    for (; len >= 32; dst += 32, src += 32, len -= 32)
+        _mm256_stream_si256((__m256i *)dst,
+                            _mm256_loadu_si256((const __m256i *)src));
+    _mm_sfence();
+    memcpy(dst, src, len);
+}
+#endif
+
+void memcpyCopy(char *dst, const char *src, size_t len) {
+    memcpy(dst, src, len);
 }
 
-CxlTransport::~CxlTransport() {}
+using CopyFunc = void (*)(char *, const char *, size_t);
 
-CxlTransport::BatchID CxlTransport::allocateBatchID(size_t batch_size) {
-    auto batch_id = Transport::allocateBatchID(batch_size);
-    return batch_id;
+CopyFunc selectStreamCopy() {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        LOG(INFO) << "CxlTransport: using AVX-512 non-temporal stores";
+        return streamCopyAvx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        LOG(INFO) << "CxlTransport: using AVX2 non-temporal stores";
+        return streamCopyAvx2;
+    }
+#endif
+    LOG(INFO) << "CxlTransport: no non-temporal stores, using memcpy";
+    return memcpyCopy;
 }
 
-Status CxlTransport::getTransferStatus(BatchID batch_id, size_t task_id,
-                                    TransferStatus &status) {
-    return 0;
+// Copy to CXL memory without polluting the caches with the destination
+void streamCopy(void *dst, const void *src, size_t len) {
+    static const CopyFunc func = selectStreamCopy();
+    func((char *)dst, (const char *)src, len);
 }
 
-Status CxlTransport::submitTransfer(BatchID batch_id,
-                                 const std::vector<TransferRequest> &entries) {
-    return 0;
+// Copy from CXL memory, prefetching the next block while copying one
+void prefetchCopy(void *dst, const void *src, size_t len) {
+    const size_t kBlock = 4096;
+    auto d = (char *)dst;
+    auto s = (const char *)src;
+    for (size_t offset = 0; offset < len; offset += kBlock) {
+        size_t block = std::min(kBlock, len - offset);
+#if defined(__x86_64__)
+        const char *ahead = s + offset + kPrefetchDistance;
+        for (size_t i = 0; i < block && ahead + i < s + len; i += 64)
+            _mm_prefetch(ahead + i, _MM_HINT_T0);
+#else
+        __builtin_prefetch(s + offset + kPrefetchDistance);
+#endif
+        memcpy(d + offset, s + offset, block);
+    }
 }
 
-int CxlTransport::freeBatchID(BatchID batch_id) { return 0; }
+}  // namespace
+
+CxlTransport::CxlTransport()
+    : base_addr_(nullptr),
+      size_(0),
+      fd_(-1),
+      running_(false),
+      next_queue_(0) {}
+
+CxlTransport::~CxlTransport() {
+    if (running_) {
+        running_ = false;
+        for (auto &queue : queues_) {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            queue->cond.notify_all();
+        }
+        for (auto &worker : workers_) worker.join();
+    }
+
+    if (base_addr_) {
+        munmap(base_addr_, size_);
+        base_addr_ = nullptr;
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+
+    if (metadata_) metadata_->removeSegmentDesc(local_server_name_);
+}
 
 int CxlTransport::install(std::string &local_server_name,
                           std::shared_ptr<TransferMetadata> meta,
                           std::shared_ptr<Topology> topo) {
+    metadata_ = meta;
+    local_server_name_ = local_server_name;
+
+    int ret = mapDevice();
+    if (ret) return ret;
+
+    ret = allocateLocalSegmentID();
+    if (ret) {
+        LOG(ERROR) << "CxlTransport: cannot allocate local segment";
+        return -1;
+    }
+
+    ret = metadata_->updateLocalSegmentDesc();
+    if (ret) {
+        LOG(ERROR) << "CxlTransport: cannot publish segments, "
+                      "check the availability of metadata storage";
+        return -1;
+    }
+
+    running_ = true;
+    for (int i = 0; i < globalConfig().cxl_workers; ++i)
+        queues_.emplace_back(new WorkerQueue());
+    for (int i = 0; i < globalConfig().cxl_workers; ++i)
+        workers_.emplace_back(&CxlTransport::worker, this, i);
+    return 0;
+}
+
+int CxlTransport::mapDevice() {
+    const char *path = std::getenv("MC_CXL_DEV_PATH");
+    if (!path) {
+        LOG(ERROR) << "CxlTransport: MC_CXL_DEV_PATH is not set";
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    fd_ = open(path, O_RDWR);
+    if (fd_ < 0) {
+        PLOG(ERROR) << "CxlTransport: failed to open " << path;
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    // DAX character devices report no size, it must be given then
+    const char *size_env = std::getenv("MC_CXL_DEV_SIZE");
+    if (size_env) {
+        size_ = strtoull(size_env, nullptr, 10);
+    } else {
+        struct stat st;
+        if (fstat(fd_, &st) == 0) size_ = st.st_size;
+    }
+    if (!size_) {
+        LOG(ERROR) << "CxlTransport: unknown size of " << path
+                   << ", set MC_CXL_DEV_SIZE";
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    void *addr =
+        mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (addr == MAP_FAILED) {
+        PLOG(ERROR) << "CxlTransport: failed to map " << size_
+                    << " bytes of " << path;
+        return ERR_MEMORY;
+    }
+    base_addr_ = addr;
+    LOG(INFO) << "CxlTransport: mapped " << size_ << " bytes of " << path;
+    return 0;
+}
+
+int CxlTransport::allocateLocalSegmentID() {
+    auto desc = std::make_shared<SegmentDesc>();
+    if (!desc) return ERR_MEMORY;
+    desc->name = local_server_name_;
+    desc->protocol = "cxl";
+    // The region is the only buffer; peers address it by offset
+    BufferDesc buffer_desc;
+    buffer_desc.name = "cxl";
+    buffer_desc.addr = (uint64_t)base_addr_;
+    buffer_desc.length = size_;
+    desc->buffers.push_back(buffer_desc);
+    metadata_->addLocalSegment(LOCAL_SEGMENT_ID, local_server_name_,
+                               std::move(desc));
     return 0;
 }
 
 int CxlTransport::registerLocalMemory(void *addr, size_t length,
-                                      const string &location,
+                                      const std::string &location,
                                       bool remote_accessible,
                                       bool update_metadata) {
+    // CPU copies need no registration of local buffers
     return 0;
 }
 
 int CxlTransport::unregisterLocalMemory(void *addr, bool update_metadata) {
     return 0;
 }
-}  // namespace mooncake
\ No newline at end of file
+
+Status CxlTransport::getTransferStatus(BatchID batch_id, size_t task_id,
+                                       TransferStatus &status) {
+    auto batch_desc_ptr = getBatchDesc(batch_id);
+    if (!batch_desc_ptr) return Status::InvalidArgument("Invalid batch ID");
+    auto &batch_desc = *batch_desc_ptr;
+    const size_t task_count = batch_desc.task_list.size();
+    if (task_id >= task_count) {
+        return Status::InvalidArgument(
+            "CxlTransport::getTransportStatus invalid argument, batch id: " +
+            std::to_string(batch_id));
+    }
+    auto &task = batch_desc.task_list[task_id];
+    status.transferred_bytes = task.transferred_bytes;
+    uint64_t success_slice_count = task.success_slice_count;
+    uint64_t failed_slice_count = task.failed_slice_count;
+    if (success_slice_count + failed_slice_count == task.slice_count) {
+        if (failed_slice_count) {
+            status.s = TransferStatusEnum::FAILED;
+        } else {
+            status.s = TransferStatusEnum::COMPLETED;
+        }
+        task.is_finished = true;
+    } else {
+        status.s = TransferStatusEnum::WAITING;
+    }
+    return Status::OK();
+}
+
+Status CxlTransport::submitTransfer(
+    BatchID batch_id, const std::vector<TransferRequest> &entries) {
+    auto batch_desc_ptr = getBatchDesc(batch_id);
+    if (!batch_desc_ptr) return Status::InvalidArgument("Invalid batch ID");
+    auto &batch_desc = *batch_desc_ptr;
+    if (batch_desc.task_list.size() + entries.size() > batch_desc.batch_size) {
+        LOG(ERROR) << "CxlTransport: Exceed the limitation of current batch's "
+                      "capacity";
+        return Status::InvalidArgument(
+            "CxlTransport: Exceed the limitation of capacity, batch id: " +
+            std::to_string(batch_id));
+    }
+
+    size_t task_id = batch_desc.task_list.size();
+    batch_desc.task_list.resize(task_id + entries.size());
+
+    for (auto &request : entries) {
+        TransferTask &task = batch_desc.task_list[task_id];
+        ++task_id;
+        auto status = submitRequest(request, task);
+        if (!status.ok()) return status;
+    }
+    return Status::OK();
+}
+
+Status CxlTransport::submitTransferTask(
+    const std::vector<TransferRequest *> &request_list,
+    const std::vector<TransferTask *> &task_list) {
+    for (size_t index = 0; index < request_list.size(); ++index) {
+        auto status = submitRequest(*request_list[index], *task_list[index]);
+        if (!status.ok()) return status;
+    }
+    return Status::OK();
+}
+
+Status CxlTransport::submitRequest(const TransferRequest &request,
+                                   TransferTask &task) {
+    if (request.target_offset > size_ ||
+        request.length > size_ - request.target_offset) {
+        LOG(ERROR) << "CxlTransport: request at offset "
+                   << request.target_offset << " of length " << request.length
+                   << " exceeds the CXL region of " << size_ << " bytes";
+        return Status::AddressNotRegistered(
+            "CxlTransport: request exceeds the CXL region");
+    }
+
+    task.total_bytes = request.length;
+    std::vector<Slice *> slice_list;
+    uint64_t offset = 0;
+    do {
+        Slice *slice = getSliceCache().allocate();
+        slice->source_addr = (char *)request.source + offset;
+        slice->length = std::min(kCxlSliceSize, request.length - offset);
+        slice->opcode = request.opcode;
+        slice->cxl.remote_addr =
+            (char *)base_addr_ + request.target_offset + offset;
+        slice->cxl.remote_offset = request.target_offset + offset;
+        slice->task = &task;
+        slice->target_id = request.target_id;
+        slice->status = Slice::PENDING;
+        slice->ts = 0;
+        task.slice_list.push_back(slice);
+        slice_list.push_back(slice);
+        offset += slice->length;
+    } while (offset < request.length);
+    // All slices are counted before any of them can finish the task
+    __sync_fetch_and_add(&task.slice_count, slice_list.size());
+
+    for (auto slice : slice_list) {
+        auto &queue =
+            *queues_[next_queue_.fetch_add(1, std::memory_order_relaxed) %
+                     queues_.size()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.slices.push_back(slice);
+        }
+        queue.cond.notify_one();
+    }
+    return Status::OK();
+}
+
+void CxlTransport::worker(int index) {
+    auto &queue = *queues_[index];
+    std::deque<Slice *> slices;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(queue.mutex);
+            queue.cond.wait(
+                lock, [&] { return !running_ || !queue.slices.empty(); });
+            if (queue.slices.empty()) return;
+            slices.swap(queue.slices);
+        }
+        copySlices(slices);
+        slices.clear();
+    }
+}
+
+void CxlTransport::copySlices(const std::deque<Slice *> &slices) {
+    // Large slices are offloaded to DSA together, as batches
+    DsaEngine *dsa = DsaEngine::get();
+    std::vector<DsaEngine::Operation> operations;
+    std::vector<Slice *> offloaded;
+    for (auto slice : slices) {
+        slice->status = Slice::POSTED;
+        bool is_write = slice->opcode == TransferRequest::WRITE;
+        if (dsa && slice->length >= dsa->minSize()) {
+            if (is_write)
+                operations.push_back({slice->cxl.remote_addr,
+                                      slice->source_addr, slice->length});
+            else
+                operations.push_back({slice->source_addr,
+                                      slice->cxl.remote_addr, slice->length});
+            offloaded.push_back(slice);
+            continue;
+        }
+        if (is_write)
+            streamCopy(slice->cxl.remote_addr, slice->source_addr,
+                       slice->length);
+        else
+            prefetchCopy(slice->source_addr, slice->cxl.remote_addr,
+                         slice->length);
+        slice->markSuccess();
+    }
+    if (offloaded.empty()) return;
+    dsa->copy(operations);
+    for (auto slice : offloaded) slice->markSuccess();
+}
+
+}  // namespace mooncake
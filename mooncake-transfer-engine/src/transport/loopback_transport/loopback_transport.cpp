@@ -0,0 +1,331 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "transport/loopback_transport/loopback_transport.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+#ifdef USE_CUDA
+#include <cuda_runtime.h>
+#endif
+
+#include "common.h"
+#include "config.h"
+#include "dsa_engine.h"
+#include "transfer_metadata.h"
+#include "transport/transport.h"
+
+namespace mooncake {
+
+namespace {
+
+// Requests up to this size are copied in the submitting thread, as waking a
+// worker costs more than the copy
+const size_t kInlineCopySize = 65536;
+// Larger requests are spread over the workers in slices of at least this
+const size_t kMinSliceSize = 1048576;
+
+// Whether memory of a buffer named so can be copied here
+bool isCopyable(const std::string &name) {
+#ifdef USE_CUDA
+    if (name.rfind("cuda", 0) == 0) return true;
+#endif
+    return name.rfind("cuda", 0) != 0 && name.rfind("npu", 0) != 0 &&
+           name.rfind("musa", 0) != 0;
+}
+
+void copyHost(void *dest, const void *src, size_t length) {
+    DsaEngine *dsa = DsaEngine::get();
+    if (dsa && length >= dsa->minSize())
+        dsa->copy({{dest, src, length}});
+    else
+        memcpy(dest, src, length);
+}
+
+#ifdef USE_CUDA
+// Device of the GPU memory at ptr, -1 for host memory
+int deviceOf(const void *ptr) {
+    cudaPointerAttributes attr;
+    if (cudaPointerGetAttributes(&attr, ptr) != cudaSuccess) {
+        cudaGetLastError();
+        return -1;
+    }
+    if (attr.type == cudaMemoryTypeDevice ||
+        attr.type == cudaMemoryTypeManaged)
+        return attr.device;
+    return -1;
+}
+
+// Streams of a worker by device, for the copies from or to GPU memory
+class DeviceCopier {
+   public:
+    ~DeviceCopier() {
+        for (auto &entry : streams_) {
+            cudaSetDevice(entry.first);
+            cudaStreamDestroy(entry.second);
+        }
+    }
+
+    bool copy(void *dest, const void *src, size_t length, int device) {
+        auto &stream = streams_[device];
+        cudaSetDevice(device);
+        if (!stream &&
+            cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking) !=
+                cudaSuccess) {
+            LOG(ERROR) << "LoopbackTransport: failed to create a stream on "
+                          "device "
+                       << device;
+            streams_.erase(device);
+            return false;
+        }
+        cudaError_t err =
+            cudaMemcpyAsync(dest, src, length, cudaMemcpyDefault, stream);
+        if (err == cudaSuccess) err = cudaStreamSynchronize(stream);
+        if (err != cudaSuccess) {
+            LOG(ERROR) << "LoopbackTransport: failed to copy " << length
+                       << " bytes on device " << device << ": "
+                       << cudaGetErrorString(err);
+            return false;
+        }
+        return true;
+    }
+
+   private:
+    std::unordered_map<int, cudaStream_t> streams_;
+};
+#endif
+
+}  // namespace
+
+LoopbackTransport::LoopbackTransport() : running_(false), next_queue_(0) {}
+
+LoopbackTransport::~LoopbackTransport() {
+    if (running_) {
+        running_ = false;
+        for (auto &queue : queues_) {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            queue->cond.notify_all();
+        }
+        for (auto &worker : workers_) worker.join();
+    }
+}
+
+int LoopbackTransport::install(std::string &local_server_name,
+                               std::shared_ptr<TransferMetadata> meta,
+                               std::shared_ptr<Topology> topo) {
+    metadata_ = meta;
+    local_server_name_ = local_server_name;
+    const int threads = std::max(globalConfig().loopback_threads, 1);
+    running_ = true;
+    for (int i = 0; i < threads; ++i)
+        queues_.emplace_back(new WorkerQueue());
+    for (int i = 0; i < threads; ++i)
+        workers_.emplace_back(&LoopbackTransport::worker, this, i);
+    return 0;
+}
+
+bool LoopbackTransport::canTransfer(const SegmentDesc &desc,
+                                    const TransferRequest &entry) {
+    if (entry.target_id != LOCAL_SEGMENT_ID &&
+        desc.name != local_server_name_)
+        return false;
+    auto contains = [](uint64_t addr, uint64_t length, uint64_t start,
+                       uint64_t size) {
+        return start >= addr && start + size <= addr + length;
+    };
+    bool found = false;
+    for (auto &buffer : desc.buffers) {
+        if (contains(buffer.addr, buffer.length, (uint64_t)entry.source,
+                     entry.length) &&
+            !isCopyable(buffer.name))
+            return false;
+        if (contains(buffer.addr, buffer.length, entry.target_offset,
+                     entry.length)) {
+            if (!isCopyable(buffer.name)) return false;
+            found = true;
+        }
+    }
+    if (found) return true;
+    for (auto &buffer : desc.shm_buffers)
+        if (contains(buffer.addr, buffer.length, entry.target_offset,
+                     entry.length))
+            return true;
+    return false;
+}
+
+Status LoopbackTransport::getTransferStatus(BatchID batch_id, size_t task_id,
+                                            TransferStatus &status) {
+    auto batch_desc_ptr = getBatchDesc(batch_id);
+    if (!batch_desc_ptr) return Status::InvalidArgument("Invalid batch ID");
+    auto &batch_desc = *batch_desc_ptr;
+    const size_t task_count = batch_desc.task_list.size();
+    if (task_id >= task_count) {
+        return Status::InvalidArgument(
+            "LoopbackTransport::getTransportStatus invalid argument, batch "
+            "id: " +
+            std::to_string(batch_id));
+    }
+    auto &task = batch_desc.task_list[task_id];
+    status.transferred_bytes = task.transferred_bytes;
+    uint64_t success_slice_count = task.success_slice_count;
+    uint64_t failed_slice_count = task.failed_slice_count;
+    if (success_slice_count + failed_slice_count == task.slice_count) {
+        if (failed_slice_count) {
+            status.s = TransferStatusEnum::FAILED;
+        } else {
+            status.s = TransferStatusEnum::COMPLETED;
+        }
+        task.is_finished = true;
+    } else {
+        status.s = TransferStatusEnum::WAITING;
+    }
+    return Status::OK();
+}
+
+Status LoopbackTransport::submitTransfer(
+    BatchID batch_id, const std::vector<TransferRequest> &entries) {
+    auto batch_desc_ptr = getBatchDesc(batch_id);
+    if (!batch_desc_ptr) return Status::InvalidArgument("Invalid batch ID");
+    auto &batch_desc = *batch_desc_ptr;
+    if (batch_desc.task_list.size() + entries.size() > batch_desc.batch_size) {
+        LOG(ERROR) << "LoopbackTransport: Exceed the limitation of current "
+                      "batch's capacity";
+        return Status::InvalidArgument(
+            "LoopbackTransport: Exceed the limitation of capacity, batch id: " +
+            std::to_string(batch_id));
+    }
+
+    size_t task_id = batch_desc.task_list.size();
+    batch_desc.task_list.resize(task_id + entries.size());
+
+    for (auto &request : entries) {
+        TransferTask &task = batch_desc.task_list[task_id];
+        ++task_id;
+        auto status = submitRequest(request, task);
+        if (!status.ok()) return status;
+    }
+    return Status::OK();
+}
+
+Status LoopbackTransport::submitTransferTask(
+    const std::vector<TransferRequest *> &request_list,
+    const std::vector<TransferTask *> &task_list) {
+    for (size_t index = 0; index < request_list.size(); ++index) {
+        auto status = submitRequest(*request_list[index], *task_list[index]);
+        if (!status.ok()) return status;
+    }
+    return Status::OK();
+}
+
+Status LoopbackTransport::submitRequest(const TransferRequest &request,
+                                        TransferTask &task) {
+    task.total_bytes = request.length;
+    bool on_device = false;
+#ifdef USE_CUDA
+    on_device = deviceOf(request.source) >= 0 ||
+                deviceOf((void *)request.target_offset) >= 0;
+#endif
+    // Copies from or to GPU memory are issued as a whole, on a stream of a
+    // worker
+    const size_t slice_size =
+        on_device ? std::max<size_t>(request.length, 1)
+                  : std::max(kMinSliceSize,
+                             (request.length + queues_.size() - 1) /
+                                 queues_.size());
+    std::vector<Slice *> slice_list;
+    uint64_t offset = 0;
+    do {
+        Slice *slice = getSliceCache().allocate();
+        slice->source_addr = (char *)request.source + offset;
+        slice->length = std::min<uint64_t>(slice_size, request.length - offset);
+        slice->opcode = request.opcode;
+        slice->local.dest_addr = (char *)request.target_offset + offset;
+        slice->local.mapping = nullptr;
+        slice->task = &task;
+        slice->target_id = request.target_id;
+        slice->status = Slice::PENDING;
+        slice->ts = 0;
+        task.slice_list.push_back(slice);
+        slice_list.push_back(slice);
+        offset += slice->length;
+    } while (offset < request.length);
+    // All slices are counted before any of them can finish the task
+    __sync_fetch_and_add(&task.slice_count, slice_list.size());
+
+    if (!on_device && request.length <= kInlineCopySize) {
+        auto slice = slice_list[0];
+        if (request.opcode == TransferRequest::WRITE)
+            copyHost(slice->local.dest_addr, slice->source_addr,
+                     slice->length);
+        else
+            copyHost(slice->source_addr, slice->local.dest_addr,
+                     slice->length);
+        slice->markSuccess();
+        return Status::OK();
+    }
+
+    for (auto slice : slice_list) {
+        auto &queue =
+            *queues_[next_queue_.fetch_add(1, std::memory_order_relaxed) %
+                     queues_.size()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.slices.push_back(slice);
+        }
+        queue.cond.notify_one();
+    }
+    return Status::OK();
+}
+
+void LoopbackTransport::worker(int index) {
+    auto &queue = *queues_[index];
+#ifdef USE_CUDA
+    DeviceCopier device_copier;
+#endif
+    std::deque<Slice *> slices;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(queue.mutex);
+            queue.cond.wait(
+                lock, [&] { return !running_ || !queue.slices.empty(); });
+            if (queue.slices.empty()) return;
+            slices.swap(queue.slices);
+        }
+        for (auto slice : slices) {
+            slice->status = Slice::POSTED;
+            void *dest = slice->local.dest_addr, *src = slice->source_addr;
+            if (slice->opcode == TransferRequest::READ) std::swap(dest, src);
+#ifdef USE_CUDA
+            int device = deviceOf(dest);
+            if (device < 0) device = deviceOf(src);
+            if (device >= 0) {
+                if (device_copier.copy(dest, src, slice->length, device))
+                    slice->markSuccess();
+                else
+                    slice->markFailed();
+                continue;
+            }
+#endif
+            copyHost(dest, src, slice->length);
+            slice->markSuccess();
+        }
+        slices.clear();
+    }
+}
+
+}  // namespace mooncake
@@ -58,19 +58,45 @@ static bool supportFabricMem() {
     return true;
 }
 
-NvlinkTransport::NvlinkTransport() : use_fabric_mem_(supportFabricMem()) {}
+// Device holding ptr, -1 for host memory
+static int getPointerDevice(const void *ptr) {
+    cudaPointerAttributes attr;
+    if (cudaPointerGetAttributes(&attr, ptr) != cudaSuccess) {
+        cudaGetLastError();
+        return -1;
+    }
+    if (attr.type == cudaMemoryTypeDevice || attr.type == cudaMemoryTypeManaged)
+        return attr.device;
+    return -1;
+}
+
+NvlinkTransport::NvlinkTransport()
+    : running_(false), use_fabric_mem_(supportFabricMem()) {}
 
 NvlinkTransport::~NvlinkTransport() {
-    if (use_fabric_mem_) {
-        for (auto &entry : remap_entries_) {
-            freePinnedLocalMemory(entry.second.shm_addr);
-        }
-    } else {
-        for (auto &entry : remap_entries_) {
-            cudaIpcCloseMemHandle(entry.second.shm_addr);
+    if (running_) {
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex_);
+            running_ = false;
         }
+        pending_cv_.notify_all();
+        poll_thread_.join();
+    }
+    for (auto &entry : stream_pools_) {
+        cudaSetDevice(entry.second->device);
+        for (auto stream : entry.second->streams) cudaStreamDestroy(stream);
     }
+    stream_pools_.clear();
+    for (auto &entry : free_events_) {
+        cudaSetDevice(entry.first);
+        for (auto event : entry.second) cudaEventDestroy(event);
+    }
+    free_events_.clear();
+
+    for (auto &entry : remap_entries_) closeSharedMemory(*entry.second);
     remap_entries_.clear();
+    for (auto &entry : evicted_entries_) closeSharedMemory(*entry);
+    evicted_entries_.clear();
 }
 
 int NvlinkTransport::install(std::string &local_server_name,
@@ -85,12 +111,16 @@ int NvlinkTransport::install(std::string &local_server_name,
     desc->protocol = "nvlink";
     metadata_->addLocalSegment(LOCAL_SEGMENT_ID, local_server_name_,
                                std::move(desc));
+    running_ = true;
+    poll_thread_ = std::thread(&NvlinkTransport::pollCompletions, this);
     return 0;
 }
 
 Status NvlinkTransport::submitTransfer(
     BatchID batch_id, const std::vector<TransferRequest> &entries) {
-    auto &batch_desc = *((BatchDesc *)(batch_id));
+    auto batch_desc_ptr = getBatchDesc(batch_id);
+    if (!batch_desc_ptr) return Status::InvalidArgument("Invalid batch ID");
+    auto &batch_desc = *batch_desc_ptr;
     if (batch_desc.task_list.size() + entries.size() > batch_desc.batch_size) {
         LOG(ERROR)
             << "NvlinkTransport: Exceed the limitation of current batch's "
@@ -103,44 +133,44 @@ Status NvlinkTransport::submitTransfer(
     size_t task_id = batch_desc.task_list.size();
     batch_desc.task_list.resize(task_id + entries.size());
 
+    std::vector<Slice *> slice_list;
+    slice_list.reserve(entries.size());
     for (auto &request : entries) {
         TransferTask &task = batch_desc.task_list[task_id];
         ++task_id;
         uint64_t dest_addr = request.target_offset;
+        OpenedShmEntry *mapping = nullptr;
         if (request.target_id != LOCAL_SEGMENT_ID) {
             int rc = relocateSharedMemoryAddress(dest_addr, request.length,
-                                                 request.target_id);
-            if (rc) return Status::Memory("device memory not registered");
+                                                 request.target_id, &mapping);
+            if (rc) {
+                submitSlices(slice_list);
+                return Status::Memory("device memory not registered");
+            }
         }
         task.total_bytes = request.length;
         Slice *slice = getSliceCache().allocate();
         slice->source_addr = (char *)request.source;
         slice->local.dest_addr = (char *)dest_addr;
+        slice->local.mapping = mapping;
         slice->length = request.length;
         slice->opcode = request.opcode;
         slice->task = &task;
         slice->target_id = request.target_id;
         slice->status = Slice::PENDING;
         __sync_fetch_and_add(&task.slice_count, 1);
-        cudaError_t err;
-        if (slice->opcode == TransferRequest::READ)
-            err = cudaMemcpy(slice->source_addr, (void *)slice->local.dest_addr,
-                             slice->length, cudaMemcpyDefault);
-        else
-            err = cudaMemcpy((void *)slice->local.dest_addr, slice->source_addr,
-                             slice->length, cudaMemcpyDefault);
-        if (err != cudaSuccess)
-            slice->markFailed();
-        else
-            slice->markSuccess();
+        slice_list.push_back(slice);
     }
 
+    submitSlices(slice_list);
     return Status::OK();
 }
 
 Status NvlinkTransport::getTransferStatus(BatchID batch_id, size_t task_id,
                                           TransferStatus &status) {
-    auto &batch_desc = *((BatchDesc *)(batch_id));
+    auto batch_desc_ptr = getBatchDesc(batch_id);
+    if (!batch_desc_ptr) return Status::InvalidArgument("Invalid batch ID");
+    auto &batch_desc = *batch_desc_ptr;
     const size_t task_count = batch_desc.task_list.size();
     if (task_id >= task_count) {
         return Status::InvalidArgument(
@@ -167,19 +197,26 @@ Status NvlinkTransport::getTransferStatus(BatchID batch_id, size_t task_id,
 Status NvlinkTransport::submitTransferTask(
     const std::vector<TransferRequest *> &request_list,
     const std::vector<TransferTask *> &task_list) {
+    std::vector<Slice *> slice_list;
+    slice_list.reserve(request_list.size());
     for (size_t index = 0; index < request_list.size(); ++index) {
         auto &request = *request_list[index];
         auto &task = *task_list[index];
         uint64_t dest_addr = request.target_offset;
+        OpenedShmEntry *mapping = nullptr;
         if (request.target_id != LOCAL_SEGMENT_ID) {
             int rc = relocateSharedMemoryAddress(dest_addr, request.length,
-                                                 request.target_id);
-            if (rc) return Status::Memory("device memory not registered");
+                                                 request.target_id, &mapping);
+            if (rc) {
+                submitSlices(slice_list);
+                return Status::Memory("device memory not registered");
+            }
         }
         task.total_bytes = request.length;
         Slice *slice = getSliceCache().allocate();
         slice->source_addr = (char *)request.source;
         slice->local.dest_addr = (char *)dest_addr;
+        slice->local.mapping = mapping;
         slice->length = request.length;
         slice->opcode = request.opcode;
         slice->task = &task;
@@ -187,21 +224,203 @@ Status NvlinkTransport::submitTransferTask(
         slice->status = Slice::PENDING;
         task.slice_list.push_back(slice);
         __sync_fetch_and_add(&task.slice_count, 1);
-        cudaError_t err;
-        if (slice->opcode == TransferRequest::READ)
-            err = cudaMemcpy(slice->source_addr, (void *)slice->local.dest_addr,
-                             slice->length, cudaMemcpyDefault);
-        else
-            err = cudaMemcpy((void *)slice->local.dest_addr, slice->source_addr,
-                             slice->length, cudaMemcpyDefault);
-        if (err != cudaSuccess)
-            slice->markFailed();
-        else
-            slice->markSuccess();
+        slice_list.push_back(slice);
     }
+    submitSlices(slice_list);
     return Status::OK();
 }
 
+void NvlinkTransport::submitSlices(const std::vector<Slice *> &slice_list) {
+    if (slice_list.empty()) return;
+    int saved_device = 0;
+    cudaGetDevice(&saved_device);
+    // The copies queued on a stream are completed by one event recorded
+    // after the last of them
+    std::unordered_map<cudaStream_t, PendingCopy> batches;
+    for (auto slice : slice_list) {
+        void *src = slice->source_addr;
+        void *dst = slice->local.dest_addr;
+        if (slice->opcode == TransferRequest::READ) std::swap(src, dst);
+        int src_device = getPointerDevice(src);
+        int dst_device = getPointerDevice(dst);
+        // Issue on the device pushing the data
+        int device = src_device >= 0 ? src_device : dst_device;
+        if (device < 0) device = saved_device;
+        auto pool = getStreamPool(src_device, dst_device, device);
+        if (!pool) {
+            completeSlice(slice, false);
+            continue;
+        }
+        // The least loaded copy engine serving the pair takes the copy
+        size_t stream_index = pool->pickStream();
+        auto stream = pool->streams[stream_index];
+        cudaSetDevice(device);
+        cudaError_t err = cudaMemcpyAsync(dst, src, slice->length,
+                                          cudaMemcpyDefault, stream);
+        if (err != cudaSuccess) {
+            LOG(ERROR) << "NvlinkTransport: cudaMemcpyAsync failed: "
+                       << cudaGetErrorString(err);
+            completeSlice(slice, false);
+            continue;
+        }
+        slice->status = Slice::POSTED;
+        pool->queued_bytes[stream_index] += slice->length;
+        auto &batch = batches[stream];
+        batch.device = device;
+        batch.pool = pool;
+        batch.stream_index = stream_index;
+        batch.bytes += slice->length;
+        batch.slice_list.push_back(slice);
+    }
+
+    std::vector<PendingCopy> pending_copies;
+    for (auto &entry : batches) {
+        auto &batch = entry.second;
+        cudaSetDevice(batch.device);
+        batch.event = allocateEvent(batch.device);
+        cudaError_t err = cudaErrorInvalidResourceHandle;
+        if (batch.event) err = cudaEventRecord(batch.event, entry.first);
+        if (err != cudaSuccess) {
+            // Complete the batch synchronously instead
+            err = cudaStreamSynchronize(entry.first);
+            batch.pool->queued_bytes[batch.stream_index] -= batch.bytes;
+            for (auto slice : batch.slice_list)
+                completeSlice(slice, err == cudaSuccess);
+            if (batch.event) cudaEventDestroy(batch.event);
+            continue;
+        }
+        pending_copies.push_back(std::move(batch));
+    }
+    cudaSetDevice(saved_device);
+
+    if (pending_copies.empty()) return;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        for (auto &copy : pending_copies)
+            pending_copies_.push_back(std::move(copy));
+    }
+    pending_cv_.notify_one();
+}
+
+NvlinkTransport::StreamPool *NvlinkTransport::getStreamPool(int src_device,
+                                                            int dst_device,
+                                                            int device) {
+    std::lock_guard<std::mutex> lock(stream_mutex_);
+    auto &pool = stream_pools_[std::make_pair(src_device, dst_device)];
+    if (pool) return pool.get();
+    cudaSetDevice(device);
+    auto new_pool = std::make_unique<StreamPool>();
+    new_pool->device = device;
+    int num_streams = globalConfig().nvlink_streams_per_pair;
+    if (!num_streams) {
+        // One stream per copy engine of the device
+        if (cudaDeviceGetAttribute(&num_streams, cudaDevAttrAsyncEngineCount,
+                                   device) != cudaSuccess)
+            num_streams = 1;
+        num_streams = std::max(num_streams, 1);
+    }
+    for (int i = 0; i < num_streams; ++i) {
+        cudaStream_t stream;
+        cudaError_t err =
+            cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking);
+        if (err != cudaSuccess) {
+            LOG(ERROR) << "NvlinkTransport: cudaStreamCreateWithFlags failed: "
+                       << cudaGetErrorString(err);
+            break;
+        }
+        new_pool->streams.push_back(stream);
+    }
+    if (new_pool->streams.empty()) {
+        stream_pools_.erase(std::make_pair(src_device, dst_device));
+        return nullptr;
+    }
+    new_pool->queued_bytes.reset(
+        new std::atomic<uint64_t>[new_pool->streams.size()]());
+    pool = std::move(new_pool);
+    return pool.get();
+}
+
+size_t NvlinkTransport::StreamPool::pickStream() const {
+    size_t best = 0;
+    for (size_t i = 1; i < streams.size(); ++i)
+        if (queued_bytes[i] < queued_bytes[best]) best = i;
+    return best;
+}
+
+void NvlinkTransport::completeSlice(Slice *slice, bool success) {
+    // The slice may be released once marked
+    auto mapping = (OpenedShmEntry *)slice->local.mapping;
+    if (success)
+        slice->markSuccess();
+    else
+        slice->markFailed();
+    unpinMapping(mapping);
+}
+
+cudaEvent_t NvlinkTransport::allocateEvent(int device) {
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        auto &events = free_events_[device];
+        if (!events.empty()) {
+            auto event = events.back();
+            events.pop_back();
+            return event;
+        }
+    }
+    cudaEvent_t event;
+    cudaError_t err = cudaEventCreateWithFlags(&event, cudaEventDisableTiming);
+    if (err != cudaSuccess) {
+        LOG(ERROR) << "NvlinkTransport: cudaEventCreateWithFlags failed: "
+                   << cudaGetErrorString(err);
+        return nullptr;
+    }
+    return event;
+}
+
+void NvlinkTransport::pollCompletions() {
+    std::vector<PendingCopy> copies;
+    while (true) {
+        std::vector<std::pair<int, cudaEvent_t>> released_events;
+        {
+            std::unique_lock<std::mutex> lock(pending_mutex_);
+            pending_cv_.wait(lock, [&] {
+                return !running_ || !copies.empty() ||
+                       !pending_copies_.empty();
+            });
+            for (auto &copy : pending_copies_)
+                copies.push_back(std::move(copy));
+            pending_copies_.clear();
+            if (!running_ && copies.empty()) return;
+        }
+
+        for (auto it = copies.begin(); it != copies.end();) {
+            // Wait for the copies still in flight on shutdown
+            cudaError_t err = running_ ? cudaEventQuery(it->event)
+                                       : cudaEventSynchronize(it->event);
+            if (err == cudaErrorNotReady) {
+                ++it;
+                continue;
+            }
+            if (err != cudaSuccess)
+                LOG(ERROR) << "NvlinkTransport: copy failed: "
+                           << cudaGetErrorString(err);
+            it->pool->queued_bytes[it->stream_index] -= it->bytes;
+            for (auto slice : it->slice_list)
+                completeSlice(slice, err == cudaSuccess);
+            released_events.emplace_back(it->device, it->event);
+            it = copies.erase(it);
+        }
+
+        if (!released_events.empty()) {
+            std::lock_guard<std::mutex> lock(pending_mutex_);
+            for (auto &entry : released_events)
+                free_events_[entry.first].push_back(entry.second);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
 int hexCharToValue(char c) {
     if (c >= '0' && c <= '9') return c - '0';
     if (c >= 'A' && c <= 'F') return 10 + c - 'A';
@@ -302,10 +521,20 @@ int NvlinkTransport::registerLocalMemory(void *addr, size_t length,
             real_size = (length + granularity - 1) & ~(granularity - 1);
         }
 
+        // Ranges of an allocation registered already are reached through
+        // it, peers map the allocation once for all of them
+        auto &registrations = registered_allocations_[(uint64_t)real_addr];
+        if (registrations++) {
+            cuMemRelease(handle);
+            return 0;
+        }
+
         CUmemFabricHandle export_handle;
         result = cuMemExportToShareableHandle(&export_handle, handle,
                                               CU_MEM_HANDLE_TYPE_FABRIC, 0);
+        cuMemRelease(handle);
         if (result != CUDA_SUCCESS) {
+            registered_allocations_.erase((uint64_t)real_addr);
             LOG(ERROR)
                 << "NvlinkTransport: cuMemExportToShareableHandle failed: "
                 << result;
@@ -323,112 +552,194 @@ int NvlinkTransport::registerLocalMemory(void *addr, size_t length,
 }
 
 int NvlinkTransport::unregisterLocalMemory(void *addr, bool update_metadata) {
+    std::lock_guard<std::mutex> lock(register_mutex_);
+    void *real_addr = nullptr;
+    if (use_fabric_mem_ &&
+        cuMemGetAddressRange((CUdeviceptr *)&real_addr, nullptr,
+                             (CUdeviceptr)addr) == CUDA_SUCCESS) {
+        auto it = registered_allocations_.find((uint64_t)real_addr);
+        if (it != registered_allocations_.end()) {
+            // The allocation stays published for its other ranges
+            if (--it->second) return 0;
+            registered_allocations_.erase(it);
+            return metadata_->removeLocalMemoryBuffer(real_addr,
+                                                      update_metadata);
+        }
+    }
     return metadata_->removeLocalMemoryBuffer(addr, update_metadata);
 }
 
 int NvlinkTransport::relocateSharedMemoryAddress(uint64_t &dest_addr,
                                                  uint64_t length,
-                                                 uint64_t target_id) {
+                                                 uint64_t target_id,
+                                                 OpenedShmEntry **mapping) {
     auto desc = metadata_->getSegmentDescByID(target_id);
-    int index = 0;
+    if (!desc) {
+        LOG(ERROR) << "NvlinkTransport: segment " << target_id << " not found";
+        return ERR_INVALID_ARGUMENT;
+    }
     for (auto &entry : desc->buffers) {
-        if (!entry.shm_name.empty() && entry.addr <= dest_addr &&
-            dest_addr + length <= entry.addr + entry.length) {
-            remap_lock_.lockShared();
-            if (remap_entries_.count(std::make_pair(target_id, entry.addr))) {
-                auto shm_addr = remap_entries_[std::make_pair(target_id, entry.addr)].shm_addr;
-                remap_lock_.unlockShared();
-                dest_addr = dest_addr - entry.addr + ((uint64_t)shm_addr);
-                return 0;
+        if (entry.shm_name.empty() || entry.addr > dest_addr ||
+            dest_addr + length > entry.addr + entry.length)
+            continue;
+        auto key = std::make_pair(target_id, entry.addr);
+        std::shared_ptr<OpenedShmEntry> shm_entry;
+        {
+            // Mappings are only evicted with the lock held for writing, so
+            // one pinned here stays mapped
+            RWSpinlock::ReadGuard guard(remap_lock_);
+            auto it = remap_entries_.find(key);
+            if (it != remap_entries_.end()) {
+                shm_entry = it->second;
+                if (mapping) shm_entry->pins++;
             }
-            remap_lock_.unlockShared();
-            RWSpinlock::WriteGuard lock_guard(remap_lock_);
-            if (!remap_entries_.count(std::make_pair(target_id, entry.addr))) {
-                std::vector<unsigned char> output_buffer;
-                deserializeBinaryData(entry.shm_name, output_buffer);
-                if (output_buffer.size() == sizeof(cudaIpcMemHandle_t) &&
-                    !use_fabric_mem_) {
-                    cudaIpcMemHandle_t handle;
-                    memcpy(&handle, output_buffer.data(), sizeof(handle));
-                    void *shm_addr = nullptr;
-                    cudaError_t err = cudaIpcOpenMemHandle(
-                        &shm_addr, handle, cudaIpcMemLazyEnablePeerAccess);
-                    if (err != cudaSuccess) {
-                        LOG(ERROR)
-                            << "NvlinkTransport: cudaIpcOpenMemHandle failed: "
-                            << cudaGetErrorString(err);
-                        return -1;
-                    }
-                    OpenedShmEntry shm_entry;
-                    shm_entry.shm_addr = shm_addr;
-                    shm_entry.length = length;
-                    remap_entries_[std::make_pair(target_id, entry.addr)] = shm_entry;
-                } else if (output_buffer.size() == sizeof(CUmemFabricHandle) &&
-                           use_fabric_mem_) {
-                    CUmemFabricHandle export_handle;
-                    memcpy(&export_handle, output_buffer.data(),
-                           sizeof(export_handle));
-                    void *shm_addr = nullptr;
-                    CUmemGenericAllocationHandle handle;
-                    auto result = cuMemImportFromShareableHandle(
-                        &handle, &export_handle, CU_MEM_HANDLE_TYPE_FABRIC);
-                    if (result != CUDA_SUCCESS) {
-                        LOG(ERROR) << "NvlinkTransport: "
-                                      "cuMemImportFromShareableHandle failed: "
-                                   << result;
-                        return -1;
-                    }
-                    result = cuMemAddressReserve((CUdeviceptr *)&shm_addr,
-                                                 entry.length, 0, 0, 0);
-                    if (result != CUDA_SUCCESS) {
-                        LOG(ERROR)
-                            << "NvlinkTransport: cuMemAddressReserve failed: "
-                            << result;
-                        return -1;
-                    }
-                    result = cuMemMap((CUdeviceptr)shm_addr, entry.length, 0,
-                                      handle, 0);
-                    if (result != CUDA_SUCCESS) {
-                        LOG(ERROR)
-                            << "NvlinkTransport: cuMemMap failed: " << result;
-                        return -1;
-                    }
-                    
-                    int device_count;
-                    cudaGetDeviceCount(&device_count);
-                    CUmemAccessDesc accessDesc[device_count];
-                    for (int device_id = 0; device_id < device_count; ++device_id) {
-                        accessDesc[device_id].location.type = CU_MEM_LOCATION_TYPE_DEVICE;
-                        accessDesc[device_id].location.id = device_id;
-                        accessDesc[device_id].flags = CU_MEM_ACCESS_FLAGS_PROT_READWRITE;
-                    }
-                    result = cuMemSetAccess((CUdeviceptr)shm_addr, entry.length,
-                                            accessDesc, device_count);
-                    if (result != CUDA_SUCCESS) {
-                        LOG(ERROR) << "NvlinkTransport: cuMemSetAccess failed: "
-                                   << result;
-                        return -1;
-                    }
-                    OpenedShmEntry shm_entry;
-                    shm_entry.shm_addr = shm_addr;
-                    shm_entry.length = length;
-                    remap_entries_[std::make_pair(target_id, entry.addr)] = shm_entry;
-                } else {
-                    LOG(ERROR) << "Mismatched NVLink data transfer method";
-                    return -1;
-                }
+        }
+        if (!shm_entry) {
+            RWSpinlock::WriteGuard guard(remap_lock_);
+            auto it = remap_entries_.find(key);
+            if (it != remap_entries_.end()) {
+                shm_entry = it->second;
+            } else {
+                shm_entry = openSharedMemory(entry);
+                if (!shm_entry) return -1;
+                if (remap_entries_.size() >=
+                    globalConfig().nvlink_max_mappings)
+                    evictSharedMemory();
+                remap_entries_[key] = shm_entry;
             }
-            auto shm_addr = remap_entries_[std::make_pair(target_id, entry.addr)].shm_addr;
-            dest_addr = dest_addr - entry.addr + ((uint64_t)shm_addr);
-            return 0;
+            if (mapping) shm_entry->pins++;
         }
-        index++;
+        shm_entry->last_use = ++remap_clock_;
+        if (mapping) *mapping = shm_entry.get();
+        dest_addr = dest_addr - entry.addr + ((uint64_t)shm_entry->shm_addr);
+        return 0;
     }
     LOG(ERROR) << "Requested address " << (void *)dest_addr << " to "
                << (void *)(dest_addr + length) << " not found!";
     return ERR_INVALID_ARGUMENT;
 }
 
+std::shared_ptr<NvlinkTransport::OpenedShmEntry>
+NvlinkTransport::openSharedMemory(const BufferDesc &buffer) {
+    std::vector<unsigned char> output_buffer;
+    deserializeBinaryData(buffer.shm_name, output_buffer);
+    auto shm_entry = std::make_shared<OpenedShmEntry>();
+    shm_entry->length = buffer.length;
+    if (output_buffer.size() == sizeof(cudaIpcMemHandle_t) &&
+        !use_fabric_mem_) {
+        cudaIpcMemHandle_t handle;
+        memcpy(&handle, output_buffer.data(), sizeof(handle));
+        void *shm_addr = nullptr;
+        cudaError_t err = cudaIpcOpenMemHandle(&shm_addr, handle,
+                                               cudaIpcMemLazyEnablePeerAccess);
+        if (err != cudaSuccess) {
+            LOG(ERROR) << "NvlinkTransport: cudaIpcOpenMemHandle failed: "
+                       << cudaGetErrorString(err);
+            return nullptr;
+        }
+        shm_entry->shm_addr = shm_addr;
+    } else if (output_buffer.size() == sizeof(CUmemFabricHandle) &&
+               use_fabric_mem_) {
+        CUmemFabricHandle export_handle;
+        memcpy(&export_handle, output_buffer.data(), sizeof(export_handle));
+        void *shm_addr = nullptr;
+        CUmemGenericAllocationHandle handle;
+        auto result = cuMemImportFromShareableHandle(
+            &handle, &export_handle, CU_MEM_HANDLE_TYPE_FABRIC);
+        if (result != CUDA_SUCCESS) {
+            LOG(ERROR) << "NvlinkTransport: "
+                          "cuMemImportFromShareableHandle failed: "
+                       << result;
+            return nullptr;
+        }
+        result = cuMemAddressReserve((CUdeviceptr *)&shm_addr, buffer.length,
+                                     0, 0, 0);
+        if (result != CUDA_SUCCESS) {
+            LOG(ERROR) << "NvlinkTransport: cuMemAddressReserve failed: "
+                       << result;
+            cuMemRelease(handle);
+            return nullptr;
+        }
+        result = cuMemMap((CUdeviceptr)shm_addr, buffer.length, 0, handle, 0);
+        // The mapping holds the allocation from now on
+        cuMemRelease(handle);
+        if (result != CUDA_SUCCESS) {
+            LOG(ERROR) << "NvlinkTransport: cuMemMap failed: " << result;
+            cuMemAddressFree((CUdeviceptr)shm_addr, buffer.length);
+            return nullptr;
+        }
+
+        int device_count;
+        cudaGetDeviceCount(&device_count);
+        CUmemAccessDesc accessDesc[device_count];
+        for (int device_id = 0; device_id < device_count; ++device_id) {
+            accessDesc[device_id].location.type = CU_MEM_LOCATION_TYPE_DEVICE;
+            accessDesc[device_id].location.id = device_id;
+            accessDesc[device_id].flags = CU_MEM_ACCESS_FLAGS_PROT_READWRITE;
+        }
+        result = cuMemSetAccess((CUdeviceptr)shm_addr, buffer.length,
+                                accessDesc, device_count);
+        if (result != CUDA_SUCCESS) {
+            LOG(ERROR) << "NvlinkTransport: cuMemSetAccess failed: " << result;
+            cuMemUnmap((CUdeviceptr)shm_addr, buffer.length);
+            cuMemAddressFree((CUdeviceptr)shm_addr, buffer.length);
+            return nullptr;
+        }
+        shm_entry->shm_addr = shm_addr;
+    } else {
+        LOG(ERROR) << "Mismatched NVLink data transfer method";
+        return nullptr;
+    }
+    return shm_entry;
+}
+
+void NvlinkTransport::closeSharedMemory(OpenedShmEntry &mapping) {
+    if (use_fabric_mem_) {
+        cuMemUnmap((CUdeviceptr)mapping.shm_addr, mapping.length);
+        cuMemAddressFree((CUdeviceptr)mapping.shm_addr, mapping.length);
+    } else {
+        cudaIpcCloseMemHandle(mapping.shm_addr);
+    }
+}
+
+void NvlinkTransport::evictSharedMemory() {
+    auto victim = remap_entries_.end();
+    for (auto it = remap_entries_.begin(); it != remap_entries_.end(); ++it) {
+        if (it->second->pins) continue;
+        if (victim == remap_entries_.end() ||
+            it->second->last_use < victim->second->last_use)
+            victim = it;
+    }
+    // All mappings are in use, exceed the limit for now
+    if (victim == remap_entries_.end()) return;
+    auto shm_entry = std::move(victim->second);
+    remap_entries_.erase(victim);
+    shm_entry->evicted = true;
+    {
+        std::lock_guard<std::mutex> lock(evicted_mutex_);
+        evicted_entries_.push_back(std::move(shm_entry));
+    }
+    releaseEvictedMappings();
+}
+
+void NvlinkTransport::releaseEvictedMappings() {
+    std::lock_guard<std::mutex> lock(evicted_mutex_);
+    for (auto it = evicted_entries_.begin(); it != evicted_entries_.end();) {
+        if ((*it)->pins) {
+            ++it;
+            continue;
+        }
+        closeSharedMemory(**it);
+        it = evicted_entries_.erase(it);
+    }
+}
+
+void NvlinkTransport::unpinMapping(OpenedShmEntry *mapping) {
+    if (!mapping) return;
+    if (mapping->pins.fetch_sub(1) == 1 && mapping->evicted)
+        releaseEvictedMappings();
+}
+
 int NvlinkTransport::registerLocalMemoryBatch(
     const std::vector<Transport::BufferEntry> &buffer_list,
     const std::string &location) {
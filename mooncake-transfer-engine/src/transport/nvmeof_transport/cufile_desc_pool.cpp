@@ -18,8 +18,10 @@
 
 #include <atomic>
 #include <cstddef>
+#include <cstring>
 #include <mutex>
 
+#include "config.h"
 #include "cufile.h"
 #include "transfer_engine.h"
 #include "transport/nvmeof_transport/cufile_context.h"
@@ -28,11 +30,17 @@ namespace mooncake {
 thread_local int CUFileDescPool::thread_index = -1;
 std::atomic<int> CUFileDescPool::index_counter(0);
 
-CUFileDescPool::CUFileDescPool() {
+static bool isFinished(CUfileStatus_t status) {
+    return status != CUFILE_WAITING && status != CUFILE_PENDING;
+}
+
+CUFileDescPool::CUFileDescPool()
+    : queue_depth_(globalConfig().nvmeof_queue_depth) {
     for (size_t i = 0; i < MAX_NR_CUFILE_DESC; ++i) {
         handle_[i] = NULL;
         io_params_[i].reserve(MAX_CUFILE_BATCH_SIZE);
-        io_events_[i].resize(MAX_CUFILE_BATCH_SIZE);
+        io_events_[i].reserve(MAX_CUFILE_BATCH_SIZE);
+        reaped_events_[i].resize(MAX_CUFILE_BATCH_SIZE);
         start_idx_[i] = 0;
         occupied_[i].store(0, std::memory_order_relaxed);
         CUFILE_CHECK(cuFileBatchIOSetUp(&handle_[i], MAX_CUFILE_BATCH_SIZE));
@@ -68,25 +76,79 @@ int CUFileDescPool::pushParams(int idx, CUfileIOParams_t &io_params) {
     if (params.size() >= params.capacity()) {
         return -1;
     }
+    io_params.cookie = (void *)(uintptr_t)params.size();
     params.push_back(io_params);
+    CUfileIOEvents_t event;
+    memset(&event, 0, sizeof(event));
+    event.cookie = io_params.cookie;
+    event.status = CUFILE_WAITING;
+    io_events_[idx].push_back(event);
     return 0;
 }
 
 int CUFileDescPool::submitBatch(int idx) {
     auto &params = io_params_[idx];
     // LOG(INFO) << "submit " << idx;
-    CUFILE_CHECK(cuFileBatchIOSubmit(handle_[idx],
-                                     params.size() - start_idx_[idx],
-                                     params.data() + start_idx_[idx], 0));
+    for (size_t i = start_idx_[idx]; i < params.size(); ++i)
+        pending_[idx].push_back(i);
     start_idx_[idx] = params.size();
+    return submitPending(idx);
+}
+
+int CUFileDescPool::submitPending(int idx) {
+    auto &pending = pending_[idx];
+    if (pending.empty()) return 0;
+    std::vector<CUfileIOParams_t> batch;
+    {
+        std::lock_guard<std::mutex> lock(inflight_mutex_);
+        for (auto it = pending.begin(); it != pending.end();) {
+            auto &params = io_params_[idx][*it];
+            auto &inflight = inflight_[params.fh];
+            if (inflight >= queue_depth_) {
+                ++it;
+                continue;
+            }
+            inflight++;
+            io_events_[idx][*it].status = CUFILE_PENDING;
+            batch.push_back(params);
+            it = pending.erase(it);
+        }
+    }
+    if (batch.empty()) return 0;
+    CUFILE_CHECK(
+        cuFileBatchIOSubmit(handle_[idx], batch.size(), batch.data(), 0));
     return 0;
 }
 
-CUfileIOEvents_t CUFileDescPool::getTransferStatus(int idx, int slice_id) {
-    unsigned nr = io_params_[idx].size();
-    // TODO: optimize this & fix start
+void CUFileDescPool::releaseSlot(CUfileHandle_t fh) {
+    std::lock_guard<std::mutex> lock(inflight_mutex_);
+    auto it = inflight_.find(fh);
+    if (it != inflight_.end() && it->second) it->second--;
+}
+
+void CUFileDescPool::reapCompletions(int idx) {
+    unsigned nr = reaped_events_[idx].size();
     CUFILE_CHECK(cuFileBatchIOGetStatus(handle_[idx], 0, &nr,
-                                        io_events_[idx].data(), NULL));
+                                        reaped_events_[idx].data(), NULL));
+    bool released = false;
+    for (unsigned i = 0; i < nr; ++i) {
+        auto &reaped = reaped_events_[idx][i];
+        size_t slice_id = (uintptr_t)reaped.cookie;
+        if (slice_id >= io_events_[idx].size()) continue;
+        auto &event = io_events_[idx][slice_id];
+        if (isFinished(event.status)) continue;
+        event = reaped;
+        if (isFinished(event.status)) {
+            releaseSlot(io_params_[idx][slice_id].fh);
+            released = true;
+        }
+    }
+    // Slots of the targets may have been released by other batches as well
+    if (released || !pending_[idx].empty()) submitPending(idx);
+}
+
+CUfileIOEvents_t CUFileDescPool::getTransferStatus(int idx, int slice_id) {
+    if (!isFinished(io_events_[idx][slice_id].status)) reapCompletions(idx);
     return io_events_[idx][slice_id];
 }
 
@@ -96,11 +158,16 @@ int CUFileDescPool::getSliceNum(int idx) {
 }
 
 int CUFileDescPool::freeCUfileDesc(int idx) {
+    // Give back the slots of IOs never reaped
+    for (size_t i = 0; i < io_events_[idx].size(); ++i) {
+        if (io_events_[idx][i].status == CUFILE_PENDING)
+            releaseSlot(io_params_[idx][i].fh);
+    }
     occupied_[idx].store(0, std::memory_order_relaxed);
     io_params_[idx].clear();
+    io_events_[idx].clear();
+    pending_[idx].clear();
     start_idx_[idx] = 0;
-    // memset(io_events_[idx].data(), 0, io_events_[idx].size() *
-    // sizeof(CUfileIOEvents_t));
     return 0;
 }
-}  // namespace mooncake
\ No newline at end of file
+}  // namespace mooncake
@@ -39,7 +39,11 @@ NVMeoFTransport::NVMeoFTransport() {
     desc_pool_ = std::make_shared<CUFileDescPool>();
 }
 
-NVMeoFTransport::~NVMeoFTransport() {}
+NVMeoFTransport::~NVMeoFTransport() {
+    for (auto &entry : registered_buffers_) {
+        if (entry.second.registered) cuFileBufDeregister((void *)entry.first);
+    }
+}
 
 Transport::TransferStatusEnum from_cufile_transfer_status(
     CUfileStatus_t status) {
@@ -66,7 +70,7 @@ Transport::TransferStatusEnum from_cufile_transfer_status(
 NVMeoFTransport::BatchID NVMeoFTransport::allocateBatchID(size_t batch_size) {
     auto nvmeof_desc = new NVMeoFBatchDesc();
     auto batch_id = Transport::allocateBatchID(batch_size);
-    auto &batch_desc = *((BatchDesc *)(batch_id));
+    auto &batch_desc = *getBatchDesc(batch_id);
     nvmeof_desc->desc_idx_ = desc_pool_->allocCUfileDesc(batch_size);
     nvmeof_desc->transfer_status.reserve(batch_size);
     nvmeof_desc->task_to_slices.reserve(batch_size);
@@ -76,7 +80,9 @@ NVMeoFTransport::BatchID NVMeoFTransport::allocateBatchID(size_t batch_size) {
 
 Status NVMeoFTransport::getTransferStatus(BatchID batch_id, size_t task_id,
                                        TransferStatus &status) {
-    auto &batch_desc = *((BatchDesc *)(batch_id));
+    auto batch_desc_ptr = getBatchDesc(batch_id);
+    if (!batch_desc_ptr) return Status::InvalidArgument("Invalid batch ID");
+    auto &batch_desc = *batch_desc_ptr;
     auto &task = batch_desc.task_list[task_id];
     auto &nvmeof_desc = *((NVMeoFBatchDesc *)(batch_desc.context));
     // LOG(DEBUG) << "get t n " << nr;
@@ -85,12 +91,10 @@ Status NVMeoFTransport::getTransferStatus(BatchID batch_id, size_t task_id,
                                       .transferred_bytes = 0};
     auto [slice_id, slice_num] = nvmeof_desc.task_to_slices[task_id];
     for (size_t i = slice_id; i < slice_id + slice_num; ++i) {
-        // LOG(INFO) << "task " << task_id << " i " << i << " upper bound " <<
-        // slice_num;
-        auto event =
-            desc_pool_->getTransferStatus(nvmeof_desc.desc_idx_, slice_id);
+        auto event = desc_pool_->getTransferStatus(nvmeof_desc.desc_idx_, i);
         transfer_status.s = from_cufile_transfer_status(event.status);
-        // TODO(FIXME): what to do if multi slices have different status?
+        if (transfer_status.s == COMPLETED && event.ret < 0)
+            transfer_status.s = FAILED;
         if (transfer_status.s == COMPLETED) {
             transfer_status.transferred_bytes += event.ret;
         } else {
@@ -114,7 +118,9 @@ Status NVMeoFTransport::submitTransferTask(
 
 Status NVMeoFTransport::submitTransfer(
     BatchID batch_id, const std::vector<TransferRequest> &entries) {
-    auto &batch_desc = *((BatchDesc *)(batch_id));
+    auto batch_desc_ptr = getBatchDesc(batch_id);
+    if (!batch_desc_ptr) return Status::InvalidArgument("Invalid batch ID");
+    auto &batch_desc = *batch_desc_ptr;
     auto &nvmeof_desc = *((NVMeoFBatchDesc *)(batch_desc.context));
 
     if (batch_desc.task_list.size() + entries.size() > batch_desc.batch_size) {
@@ -167,6 +173,7 @@ Status NVMeoFTransport::submitTransfer(
                     buffer_desc.local_path_map[local_server_name_].c_str();
                 void *source_addr =
                     (char *)request.source + slice_start - segment_start;
+                registerBufferIfNeeded(source_addr, slice_end - slice_start);
                 uint64_t file_offset = slice_start - current_offset;
                 uint64_t slice_len = slice_end - slice_start;
                 addSliceToTask(source_addr, slice_len, file_offset,
@@ -205,7 +212,9 @@ Status NVMeoFTransport::submitTransfer(
 }
 
 Status NVMeoFTransport::freeBatchID(BatchID batch_id) {
-    auto &batch_desc = *((BatchDesc *)(batch_id));
+    auto batch_desc_ptr = getBatchDesc(batch_id);
+    if (!batch_desc_ptr) return Status::InvalidArgument("Invalid batch ID");
+    auto &batch_desc = *batch_desc_ptr;
     auto &nvmeof_desc = *((NVMeoFBatchDesc *)(batch_desc.context));
     int desc_idx = nvmeof_desc.desc_idx_;
     Status rc = Transport::freeBatchID(batch_id);
@@ -228,16 +237,63 @@ int NVMeoFTransport::registerLocalMemory(void *addr, size_t length,
                                          bool update_metadata) {
     (void)remote_accessible;
     (void)update_metadata;
+    RWSpinlock::WriteGuard guard(registered_lock_);
+    auto it = registered_buffers_.find((uint64_t)addr);
+    if (it != registered_buffers_.end()) {
+        if (it->second.registered && it->second.length >= length) return 0;
+        if (it->second.registered) cuFileBufDeregister(addr);
+        registered_buffers_.erase(it);
+    }
     CUFILE_CHECK(cuFileBufRegister(addr, length, 0));
+    registered_buffers_[(uint64_t)addr] = {length, true};
     return 0;
 }
 
 int NVMeoFTransport::unregisterLocalMemory(void *addr, bool update_metadata) {
     (void)update_metadata;
-    CUFILE_CHECK(cuFileBufDeregister(addr));
+    RWSpinlock::WriteGuard guard(registered_lock_);
+    auto it = registered_buffers_.find((uint64_t)addr);
+    if (it == registered_buffers_.end()) {
+        CUFILE_CHECK(cuFileBufDeregister(addr));
+        return 0;
+    }
+    if (it->second.registered) CUFILE_CHECK(cuFileBufDeregister(addr));
+    registered_buffers_.erase(it);
     return 0;
 }
 
+void NVMeoFTransport::registerBufferIfNeeded(void *addr, size_t length) {
+    auto covered = [&]() {
+        auto it = registered_buffers_.upper_bound((uint64_t)addr);
+        if (it == registered_buffers_.begin()) return false;
+        --it;
+        return (uint64_t)addr + length <= it->first + it->second.length;
+    };
+    {
+        RWSpinlock::ReadGuard guard(registered_lock_);
+        if (covered()) return;
+    }
+    // Register the whole device allocation, so that the next transfers
+    // from it find it registered; host memory is registered as given
+    CUdeviceptr base = 0;
+    size_t size = 0;
+    if (cuMemGetAddressRange(&base, &size, (CUdeviceptr)addr) !=
+        CUDA_SUCCESS) {
+        base = (CUdeviceptr)addr;
+        size = length;
+    }
+    RWSpinlock::WriteGuard guard(registered_lock_);
+    if (covered()) return;
+    auto status = cuFileBufRegister((void *)base, size, 0);
+    if (status.err != CU_FILE_SUCCESS)
+        // Remembered as well, cuFile goes through its bounce buffers
+        LOG(WARNING) << "NVMeoFTransport: cuFileBufRegister failed for "
+                     << (void *)base << ", length " << size << ": "
+                     << cuFileGetErrorString(status);
+    registered_buffers_[(uint64_t)base] = {size,
+                                           status.err == CU_FILE_SUCCESS};
+}
+
 void NVMeoFTransport::addSliceToTask(void *source_addr, uint64_t slice_len,
                                      uint64_t target_start,
                                      TransferRequest::OpCode op,
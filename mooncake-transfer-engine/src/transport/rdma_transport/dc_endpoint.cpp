@@ -0,0 +1,181 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifdef USE_MLX5_DC
+
+#include "transport/rdma_transport/dc_endpoint.h"
+
+#include <glog/logging.h>
+
+#include <cassert>
+#include <cstddef>
+
+#include "config.h"
+
+namespace mooncake {
+
+DcEndPoint::DcEndPoint(RdmaContext &context) : RdmaEndPoint(context) {}
+
+int DcEndPoint::construct(ibv_cq *cq, size_t num_qp_list, size_t max_sge,
+                          size_t max_wr, size_t max_inline) {
+    if (status_.load(std::memory_order_relaxed) != INITIALIZING) {
+        LOG(ERROR) << "Endpoint has already been constructed";
+        return ERR_ENDPOINT;
+    }
+    if (!context_.dcEnabled()) {
+        LOG(ERROR) << "DC transport is not enabled on device "
+                   << context_.deviceName();
+        return ERR_ENDPOINT;
+    }
+    // Work requests go to the DC initiators of the context, whose CQs
+    // account for them
+    max_wr_depth_ = (int)max_wr;
+    max_inline_bytes_ = max_inline;
+    status_.store(UNCONNECTED, std::memory_order_relaxed);
+    return 0;
+}
+
+int DcEndPoint::setupConnectionsByActive() {
+    RWSpinlock::WriteGuard guard(lock_);
+    if (connected()) {
+        LOG(INFO) << "Connection has been established";
+        return 0;
+    }
+
+    auto peer_server_name = getServerNameFromNicPath(peer_nic_path_);
+    auto peer_nic_name = getNicNameFromNicPath(peer_nic_path_);
+    if (peer_server_name.empty() || peer_nic_name.empty()) {
+        LOG(ERROR) << "Parse peer nic path failed: " << peer_nic_path_;
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    // loopback mode
+    auto segment_desc =
+        context_.nicPath() == peer_nic_path_
+            ? context_.engine().meta()->getSegmentDescByID(LOCAL_SEGMENT_ID)
+            : context_.engine().meta()->getSegmentDescByName(
+                  peer_server_name);
+    if (!segment_desc) {
+        LOG(ERROR) << "Segment " << peer_server_name << " not found";
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    for (auto &nic : segment_desc->devices) {
+        if (nic.name != peer_nic_name) continue;
+        if (!nic.dct_num) {
+            LOG(ERROR) << "Peer NIC " << peer_nic_path_
+                       << " does not publish a DC target, set MC_ENABLE_DC "
+                          "on both sides";
+            return ERR_REJECT_HANDSHAKE;
+        }
+        auto ah = context_.addressHandle(nic.gid, nic.lid);
+        if (!ah) return ERR_ENDPOINT;
+        ah_ = ah;
+        peer_dct_num_ = nic.dct_num;
+        status_.store(CONNECTED, std::memory_order_relaxed);
+        return 0;
+    }
+
+    LOG(ERROR) << "Peer NIC " << peer_nic_path_ << " not found";
+    return ERR_DEVICE_NOT_FOUND;
+}
+
+int DcEndPoint::setupConnectionsByPassive(const HandShakeDesc &peer_desc,
+                                          HandShakeDesc &local_desc) {
+    local_desc.reply_msg = "Peer " + peer_desc.local_nic_path +
+                           " uses RC while " + context_.nicPath() +
+                           " uses DC, check MC_ENABLE_DC";
+    LOG(ERROR) << local_desc.reply_msg;
+    return ERR_REJECT_HANDSHAKE;
+}
+
+void DcEndPoint::disconnect() {
+    RWSpinlock::WriteGuard guard(lock_);
+    // The address handle belongs to the context and may be shared
+    ah_ = nullptr;
+    peer_dct_num_ = 0;
+    status_.store(UNCONNECTED, std::memory_order_release);
+}
+
+int DcEndPoint::submitPostSend(
+    std::vector<Transport::Slice *> &slice_list,
+    std::vector<Transport::Slice *> &failed_slice_list) {
+    RWSpinlock::ReadGuard guard(lock_);
+    if (!active_ || !ah_) return 0;
+    auto dci = context_.selectDci();
+    if (!dci) return 0;
+
+    RWSpinlock::WriteGuard dci_guard(dci->lock);
+    int wr_count =
+        std::min(max_wr_depth_ - dci->wr_depth, (int)slice_list.size());
+    wr_count = std::min(int(globalConfig().max_cqe) - *dci->cq_outstanding,
+                        wr_count);
+    if (wr_count <= 0) return 0;
+
+    // Same signaling scheme as RdmaEndPoint::submitPostSend(), a completion
+    // covers the unsignaled WRs before it on the DCI
+    const int signal_interval =
+        std::max(1, int(globalConfig().signal_interval));
+    int signaled_count = 0;
+    Transport::Slice *unsignaled_prev = nullptr;
+    auto qp_ex = dci->qp_ex;
+    ibv_wr_start(qp_ex);
+    for (int i = 0; i < wr_count; ++i) {
+        auto slice = slice_list[i];
+        bool is_read = slice->opcode == Transport::TransferRequest::READ;
+        qp_ex->wr_id = (uint64_t)slice;
+        qp_ex->wr_flags = 0;
+        slice->rdma.unsignaled_prev = unsignaled_prev;
+        if ((i + 1) % signal_interval == 0 || i + 1 == wr_count) {
+            qp_ex->wr_flags |= IBV_SEND_SIGNALED;
+            unsignaled_prev = nullptr;
+            signaled_count++;
+        } else {
+            unsignaled_prev = slice;
+        }
+        if (is_read)
+            ibv_wr_rdma_read(qp_ex, slice->rdma.dest_rkey,
+                             slice->rdma.dest_addr);
+        else
+            ibv_wr_rdma_write(qp_ex, slice->rdma.dest_rkey,
+                              slice->rdma.dest_addr);
+        mlx5dv_wr_set_dc_addr(dci->dv_qp, ah_, peer_dct_num_, kDcAccessKey);
+        if (!is_read && slice->length <= max_inline_bytes_)
+            ibv_wr_set_inline_data(qp_ex, slice->source_addr, slice->length);
+        else
+            ibv_wr_set_sge(qp_ex, slice->rdma.source_lkey,
+                           (uint64_t)slice->source_addr, slice->length);
+        slice->ts = getCurrentTimeInNano();
+        slice->status = Transport::Slice::POSTED;
+        slice->rdma.qp_depth = &dci->wr_depth;
+    }
+    __sync_fetch_and_add(&dci->wr_depth, wr_count);
+    __sync_fetch_and_add(dci->cq_outstanding, wr_count);
+    int rc = ibv_wr_complete(qp_ex);
+    context_.recordPostSend(wr_count, signaled_count);
+    if (rc) {
+        // The whole batch is discarded by ibv_wr_complete()
+        LOG(ERROR) << "Failed to ibv_wr_complete: " << strerror(rc);
+        for (int i = 0; i < wr_count; ++i)
+            failed_slice_list.push_back(slice_list[i]);
+        __sync_fetch_and_sub(&dci->wr_depth, wr_count);
+        __sync_fetch_and_sub(dci->cq_outstanding, wr_count);
+    }
+    slice_list.erase(slice_list.begin(), slice_list.begin() + wr_count);
+    return 0;
+}
+
+}  // namespace mooncake
+
+#endif  // USE_MLX5_DC
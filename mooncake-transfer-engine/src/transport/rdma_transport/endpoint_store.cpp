@@ -18,6 +18,8 @@
 
 #include <atomic>
 #include <cassert>
+#include <algorithm>
+#include <cmath>
 #include <cstddef>
 #include <memory>
 #include <utility>
@@ -27,152 +29,288 @@
 #include "transport/rdma_transport/rdma_endpoint.h"
 
 namespace mooncake {
+// Half-life of the bytes WeightedEndpointStore weighs endpoints by
+const static double kRecentBytesHalfLifeNs = 1e9;
+// Connection cost of the endpoints connected by their peer
+const static uint64_t kDefaultConnectNs = 1000000;
+// The capacity grows back this long after it last shrank
+const static uint64_t kCapacityGrowNs = 10000000000ull;
+
+void EndpointStore::recordCreated(NicPathID peer_nic_id) {
+    if (peer_nic_id >= created_peers_.size())
+        created_peers_.resize(peer_nic_id + 1);
+    if (created_peers_[peer_nic_id])
+        reconnects_.fetch_add(1, std::memory_order_relaxed);
+    created_peers_[peer_nic_id] = true;
+}
+
+bool WarmEndpointPool::park(NicPathID peer_nic_id,
+                            std::shared_ptr<RdmaEndPoint> endpoint) {
+    if (globalConfig().endpoint_keepalive_ms <= 0 || !endpoint->active() ||
+        !endpoint->connected())
+        return false;
+    entries_[peer_nic_id] = {std::move(endpoint), getCurrentTimeInNano()};
+    return true;
+}
+
+std::shared_ptr<RdmaEndPoint> WarmEndpointPool::take(NicPathID peer_nic_id) {
+    auto iter = entries_.find(peer_nic_id);
+    if (iter == entries_.end()) return nullptr;
+    auto endpoint = std::move(iter->second.endpoint);
+    entries_.erase(iter);
+    return endpoint;
+}
+
+std::shared_ptr<RdmaEndPoint> WarmEndpointPool::dropOldest() {
+    auto oldest = entries_.end();
+    for (auto iter = entries_.begin(); iter != entries_.end(); ++iter)
+        if (oldest == entries_.end() ||
+            iter->second.parked_ts < oldest->second.parked_ts)
+            oldest = iter;
+    if (oldest == entries_.end()) return nullptr;
+    auto endpoint = std::move(oldest->second.endpoint);
+    entries_.erase(oldest);
+    return endpoint;
+}
+
+std::vector<std::shared_ptr<RdmaEndPoint>> WarmEndpointPool::expire() {
+    std::vector<std::shared_ptr<RdmaEndPoint>> expired;
+    if (entries_.empty()) return expired;
+    const uint64_t kGracePeriod =
+        uint64_t(std::max(globalConfig().endpoint_keepalive_ms, 0)) * 1000000;
+    auto current_ts = getCurrentTimeInNano();
+    for (auto iter = entries_.begin(); iter != entries_.end();) {
+        if (current_ts - iter->second.parked_ts >= kGracePeriod) {
+            expired.push_back(std::move(iter->second.endpoint));
+            iter = entries_.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+    return expired;
+}
+
 std::shared_ptr<RdmaEndPoint> FIFOEndpointStore::getEndpoint(
-    const std::string &peer_nic_path) {
+    NicPathID peer_nic_id) {
     RWSpinlock::ReadGuard guard(endpoint_map_lock_);
-    auto iter = endpoint_map_.find(peer_nic_path);
-    if (iter != endpoint_map_.end()) return iter->second;
+    if (peer_nic_id < endpoint_map_.size())
+        return endpoint_map_[peer_nic_id].endpoint;
     return nullptr;
 }
 
 std::shared_ptr<RdmaEndPoint> FIFOEndpointStore::insertEndpoint(
-    const std::string &peer_nic_path, RdmaContext *context) {
+    NicPathID peer_nic_id, RdmaContext *context) {
     RWSpinlock::WriteGuard guard(endpoint_map_lock_);
-    if (endpoint_map_.find(peer_nic_path) != endpoint_map_.end()) {
-        LOG(INFO) << "Endpoint " << peer_nic_path
+    if (peer_nic_id < endpoint_map_.size() &&
+        endpoint_map_[peer_nic_id].endpoint) {
+        LOG(INFO) << "Endpoint " << NicPathOf(peer_nic_id)
                   << " already exists in FIFOEndpointStore";
-        return endpoint_map_[peer_nic_path];
+        return endpoint_map_[peer_nic_id].endpoint;
     }
-    auto endpoint = std::make_shared<RdmaEndPoint>(*context);
-    if (!endpoint) {
-        LOG(ERROR) << "Failed to allocate memory for RdmaEndPoint";
-        return nullptr;
+    auto endpoint = warm_pool_.take(peer_nic_id);
+    if (endpoint && !(endpoint->active() && endpoint->connected())) {
+        waiting_list_.insert(endpoint);
+        endpoint.reset();
     }
-    auto &config = globalConfig();
-    int ret =
-        endpoint->construct(context->cq(), config.num_qp_per_ep, config.max_sge,
-                            config.max_wr, config.max_inline);
-    if (ret) return nullptr;
+    bool reused = endpoint != nullptr;
+    if (!reused) endpoint = context->newEndpoint();
+    if (!endpoint) return nullptr;
+    if (!reused) recordCreated(peer_nic_id);
 
-    while (this->getSize() >= max_size_) evictEndpoint();
+    while (this->getSize() + warm_pool_.size() >= max_size_) {
+        auto dropped = warm_pool_.dropOldest();
+        if (dropped)
+            waiting_list_.insert(dropped);
+        else
+            evictEndpoint();
+    }
 
-    endpoint->setPeerNicPath(peer_nic_path);
-    endpoint_map_[peer_nic_path] = endpoint;
-    fifo_list_.push_back(peer_nic_path);
-    auto it = fifo_list_.end();
-    fifo_map_[peer_nic_path] = --it;
+    if (!reused) endpoint->setPeerNicPath(NicPathOf(peer_nic_id));
+    if (peer_nic_id >= endpoint_map_.size())
+        endpoint_map_.resize(peer_nic_id + 1);
+    auto &entry = endpoint_map_[peer_nic_id];
+    entry.endpoint = endpoint;
+    fifo_list_.push_back(peer_nic_id);
+    entry.fifo_iter = --fifo_list_.end();
+    size_++;
     return endpoint;
 }
 
-int FIFOEndpointStore::deleteEndpoint(const std::string &peer_nic_path) {
+int FIFOEndpointStore::deleteEndpoint(NicPathID peer_nic_id) {
     RWSpinlock::WriteGuard guard(endpoint_map_lock_);
-    auto iter = endpoint_map_.find(peer_nic_path);
     // remove endpoint but leaving it status unchanged
     // in case it is setting up connection or submitting slice
-    if (iter != endpoint_map_.end()) {
-        waiting_list_.insert(iter->second);
-        endpoint_map_.erase(iter);
-        auto fifo_iter = fifo_map_[peer_nic_path];
-        fifo_list_.erase(fifo_iter);
-        fifo_map_.erase(peer_nic_path);
+    if (peer_nic_id < endpoint_map_.size() &&
+        endpoint_map_[peer_nic_id].endpoint) {
+        auto &entry = endpoint_map_[peer_nic_id];
+        waiting_list_.insert(entry.endpoint);
+        entry.endpoint.reset();
+        fifo_list_.erase(entry.fifo_iter);
+        size_--;
+    }
+    auto warm_endpoint = warm_pool_.take(peer_nic_id);
+    if (warm_endpoint) waiting_list_.insert(warm_endpoint);
+    return 0;
+}
+
+int FIFOEndpointStore::releaseEndpoint(NicPathID peer_nic_id) {
+    RWSpinlock::WriteGuard guard(endpoint_map_lock_);
+    if (peer_nic_id < endpoint_map_.size() &&
+        endpoint_map_[peer_nic_id].endpoint) {
+        auto &entry = endpoint_map_[peer_nic_id];
+        if (!warm_pool_.park(peer_nic_id, entry.endpoint))
+            waiting_list_.insert(entry.endpoint);
+        entry.endpoint.reset();
+        fifo_list_.erase(entry.fifo_iter);
+        size_--;
     }
     return 0;
 }
 
 void FIFOEndpointStore::evictEndpoint() {
     if (fifo_list_.empty()) return;
-    std::string victim = fifo_list_.front();
+    NicPathID victim = fifo_list_.front();
     fifo_list_.pop_front();
-    fifo_map_.erase(victim);
-    // LOG(INFO) << victim << " evicted";
-    waiting_list_.insert(endpoint_map_[victim]);
-    endpoint_map_.erase(victim);
+    // LOG(INFO) << NicPathOf(victim) << " evicted";
+    auto &entry = endpoint_map_[victim];
+    waiting_list_.insert(entry.endpoint);
+    entry.endpoint.reset();
+    size_--;
     return;
 }
 
 void FIFOEndpointStore::reclaimEndpoint() {
     RWSpinlock::WriteGuard guard(endpoint_map_lock_);
+    for (auto &endpoint : warm_pool_.expire()) waiting_list_.insert(endpoint);
     std::vector<std::shared_ptr<RdmaEndPoint>> to_delete;
     for (auto &endpoint : waiting_list_)
         if (!endpoint->hasOutstandingSlice()) to_delete.push_back(endpoint);
     for (auto &endpoint : to_delete) waiting_list_.erase(endpoint);
 }
 
-size_t FIFOEndpointStore::getSize() { return endpoint_map_.size(); }
+size_t FIFOEndpointStore::getSize() { return size_; }
 
 int FIFOEndpointStore::destroyQPs() {
-    for (auto &kv : endpoint_map_) {
-        kv.second->destroyQP();
+    for (auto &entry : endpoint_map_) {
+        if (entry.endpoint) entry.endpoint->destroyQP();
     }
+    warm_pool_.forEach([](auto &endpoint) { endpoint->destroyQP(); });
     return 0;
 }
 
 int FIFOEndpointStore::disconnectQPs() {
-    for (auto &kv : endpoint_map_) {
-        kv.second->disconnect();
+    for (auto &entry : endpoint_map_) {
+        if (entry.endpoint) entry.endpoint->disconnect();
     }
+    warm_pool_.forEach([](auto &endpoint) { endpoint->disconnect(); });
     return 0;
 }
 
 std::shared_ptr<RdmaEndPoint> SIEVEEndpointStore::getEndpoint(
-    const std::string &peer_nic_path) {
+    NicPathID peer_nic_id) {
     RWSpinlock::ReadGuard guard(endpoint_map_lock_);
-    auto iter = endpoint_map_.find(peer_nic_path);
-    if (iter != endpoint_map_.end()) {
-        iter->second.second.store(
-            true, std::memory_order_relaxed);  // This is safe within read lock
-                                               // because of idempotence
-        return iter->second.first;
-    }
-    // LOG(INFO) << "Endpoint " << peer_nic_path << " not found in
+    if (peer_nic_id < endpoint_map_.size() && endpoint_map_[peer_nic_id]) {
+        auto &entry = *endpoint_map_[peer_nic_id];
+        entry.visited.store(true,
+                            std::memory_order_relaxed);  // This is safe within
+                                                         // read lock because
+                                                         // of idempotence
+        return entry.endpoint;
+    }
+    // LOG(INFO) << "Endpoint " << NicPathOf(peer_nic_id) << " not found in
     // SIEVEEndpointStore";
     return nullptr;
 }
 
 std::shared_ptr<RdmaEndPoint> SIEVEEndpointStore::insertEndpoint(
-    const std::string &peer_nic_path, RdmaContext *context) {
+    NicPathID peer_nic_id, RdmaContext *context) {
     RWSpinlock::WriteGuard guard(endpoint_map_lock_);
-    if (endpoint_map_.find(peer_nic_path) != endpoint_map_.end()) {
-        LOG(INFO) << "Endpoint " << peer_nic_path
+    if (peer_nic_id < endpoint_map_.size() && endpoint_map_[peer_nic_id]) {
+        LOG(INFO) << "Endpoint " << NicPathOf(peer_nic_id)
                   << " already exists in SIEVEEndpointStore";
-        return endpoint_map_[peer_nic_path].first;
+        return endpoint_map_[peer_nic_id]->endpoint;
     }
-    auto endpoint = std::make_shared<RdmaEndPoint>(*context);
+    auto endpoint = warm_pool_.take(peer_nic_id);
+    if (endpoint && !(endpoint->active() && endpoint->connected())) {
+        waiting_list_len_++;
+        waiting_list_.insert(endpoint);
+        endpoint.reset();
+    }
+    bool reused = endpoint != nullptr;
+    if (!reused) endpoint = context->newEndpoint();
     if (!endpoint) {
-        LOG(ERROR) << "Failed to allocate memory for RdmaEndPoint";
+        warm_pool_len_ = warm_pool_.size();
         return nullptr;
     }
-    auto &config = globalConfig();
-    int ret =
-        endpoint->construct(context->cq(), config.num_qp_per_ep, config.max_sge,
-                            config.max_wr, config.max_inline);
-    if (ret) return nullptr;
+    if (!reused) recordCreated(peer_nic_id);
 
-    while (this->getSize() >= max_size_) evictEndpoint();
+    while (this->getSize() + warm_pool_.size() >= max_size_) {
+        auto dropped = warm_pool_.dropOldest();
+        if (dropped) {
+            waiting_list_len_++;
+            waiting_list_.insert(dropped);
+        } else {
+            evictEndpoint();
+        }
+    }
+    warm_pool_len_ = warm_pool_.size();
 
-    endpoint->setPeerNicPath(peer_nic_path);
-    endpoint_map_[peer_nic_path] = std::make_pair(endpoint, false);
-    fifo_list_.push_front(peer_nic_path);
-    fifo_map_[peer_nic_path] = fifo_list_.begin();
+    if (!reused) endpoint->setPeerNicPath(NicPathOf(peer_nic_id));
+    if (peer_nic_id >= endpoint_map_.size())
+        endpoint_map_.resize(peer_nic_id + 1);
+    auto entry = std::make_unique<Entry>();
+    entry->endpoint = endpoint;
+    fifo_list_.push_front(peer_nic_id);
+    entry->fifo_iter = fifo_list_.begin();
+    endpoint_map_[peer_nic_id] = std::move(entry);
+    size_++;
     return endpoint;
 }
 
-int SIEVEEndpointStore::deleteEndpoint(const std::string &peer_nic_path) {
+int SIEVEEndpointStore::deleteEndpoint(NicPathID peer_nic_id) {
     RWSpinlock::WriteGuard guard(endpoint_map_lock_);
-    auto iter = endpoint_map_.find(peer_nic_path);
     // remove endpoint but leaving it status unchanged
     // in case it is setting up connection or submitting slice
-    if (iter != endpoint_map_.end()) {
+    if (peer_nic_id < endpoint_map_.size() && endpoint_map_[peer_nic_id]) {
+        auto &entry = *endpoint_map_[peer_nic_id];
+        waiting_list_len_++;
+        waiting_list_.insert(entry.endpoint);
+        auto fifo_iter = entry.fifo_iter;
+        if (hand_.has_value() && hand_.value() == fifo_iter) {
+            fifo_iter == fifo_list_.begin() ? hand_ = std::nullopt
+                                            : hand_ = std::prev(fifo_iter);
+        }
+        fifo_list_.erase(fifo_iter);
+        endpoint_map_[peer_nic_id].reset();
+        size_--;
+    }
+    auto warm_endpoint = warm_pool_.take(peer_nic_id);
+    if (warm_endpoint) {
         waiting_list_len_++;
-        waiting_list_.insert(iter->second.first);
-        endpoint_map_.erase(iter);
-        auto fifo_iter = fifo_map_[peer_nic_path];
+        waiting_list_.insert(warm_endpoint);
+        warm_pool_len_ = warm_pool_.size();
+    }
+    return 0;
+}
+
+int SIEVEEndpointStore::releaseEndpoint(NicPathID peer_nic_id) {
+    RWSpinlock::WriteGuard guard(endpoint_map_lock_);
+    if (peer_nic_id < endpoint_map_.size() && endpoint_map_[peer_nic_id]) {
+        auto &entry = *endpoint_map_[peer_nic_id];
+        if (warm_pool_.park(peer_nic_id, entry.endpoint)) {
+            warm_pool_len_ = warm_pool_.size();
+        } else {
+            waiting_list_len_++;
+            waiting_list_.insert(entry.endpoint);
+        }
+        auto fifo_iter = entry.fifo_iter;
         if (hand_.has_value() && hand_.value() == fifo_iter) {
             fifo_iter == fifo_list_.begin() ? hand_ = std::nullopt
                                             : hand_ = std::prev(fifo_iter);
         }
         fifo_list_.erase(fifo_iter);
-        fifo_map_.erase(peer_nic_path);
+        endpoint_map_[peer_nic_id].reset();
+        size_--;
     }
     return 0;
 }
@@ -182,12 +320,12 @@ void SIEVEEndpointStore::evictEndpoint() {
         return;
     }
     auto o = hand_.has_value() ? hand_.value() : --fifo_list_.end();
-    std::string victim;
+    NicPathID victim;
     while (true) {
         victim = *o;
-        if (endpoint_map_[victim].second.load(std::memory_order_relaxed)) {
-            endpoint_map_[victim].second.store(false,
-                                               std::memory_order_relaxed);
+        auto &visited = endpoint_map_[victim]->visited;
+        if (visited.load(std::memory_order_relaxed)) {
+            visited.store(false, std::memory_order_relaxed);
             o = (o == fifo_list_.begin() ? --fifo_list_.end() : std::prev(o));
         } else {
             break;
@@ -195,19 +333,26 @@ void SIEVEEndpointStore::evictEndpoint() {
     }
     hand_ = (o == fifo_list_.begin() ? --fifo_list_.end() : std::prev(o));
     fifo_list_.erase(o);
-    fifo_map_.erase(victim);
-    // LOG(INFO) << victim << " evicted";
-    auto victim_instance = endpoint_map_[victim].first;
+    // LOG(INFO) << NicPathOf(victim) << " evicted";
+    auto victim_instance = endpoint_map_[victim]->endpoint;
     victim_instance->set_active(false);
     waiting_list_len_++;
     waiting_list_.insert(victim_instance);
-    endpoint_map_.erase(victim);
+    endpoint_map_[victim].reset();
+    size_--;
     return;
 }
 
 void SIEVEEndpointStore::reclaimEndpoint() {
-    if (waiting_list_len_.load(std::memory_order_relaxed) == 0) return;
+    if (waiting_list_len_.load(std::memory_order_relaxed) == 0 &&
+        warm_pool_len_.load(std::memory_order_relaxed) == 0)
+        return;
     RWSpinlock::WriteGuard guard(endpoint_map_lock_);
+    for (auto &endpoint : warm_pool_.expire()) {
+        waiting_list_len_++;
+        waiting_list_.insert(endpoint);
+    }
+    warm_pool_len_ = warm_pool_.size();
     std::vector<std::shared_ptr<RdmaEndPoint>> to_delete;
     for (auto &endpoint : waiting_list_)
         if (!endpoint->hasOutstandingSlice()) to_delete.push_back(endpoint);
@@ -217,15 +362,213 @@ void SIEVEEndpointStore::reclaimEndpoint() {
 
 int SIEVEEndpointStore::destroyQPs() {
     for (auto &endpoint : waiting_list_) endpoint->destroyQP();
-    for (auto &kv : endpoint_map_) kv.second.first->destroyQP();
+    for (auto &entry : endpoint_map_)
+        if (entry) entry->endpoint->destroyQP();
+    warm_pool_.forEach([](auto &endpoint) { endpoint->destroyQP(); });
     return 0;
 }
 
 int SIEVEEndpointStore::disconnectQPs() {
     for (auto &endpoint : waiting_list_) endpoint->disconnect();
-    for (auto &kv : endpoint_map_) kv.second.first->disconnect();
+    for (auto &entry : endpoint_map_)
+        if (entry) entry->endpoint->disconnect();
+    warm_pool_.forEach([](auto &endpoint) { endpoint->disconnect(); });
     return 0;
 }
 
-size_t SIEVEEndpointStore::getSize() { return endpoint_map_.size(); }
-}  // namespace mooncake
\ No newline at end of file
+size_t SIEVEEndpointStore::getSize() { return size_; }
+
+std::shared_ptr<RdmaEndPoint> WeightedEndpointStore::getEndpoint(
+    NicPathID peer_nic_id) {
+    RWSpinlock::ReadGuard guard(endpoint_map_lock_);
+    if (peer_nic_id < endpoint_map_.size() && endpoint_map_[peer_nic_id])
+        return endpoint_map_[peer_nic_id]->endpoint;
+    return nullptr;
+}
+
+std::shared_ptr<RdmaEndPoint> WeightedEndpointStore::insertEndpoint(
+    NicPathID peer_nic_id, RdmaContext *context) {
+    RWSpinlock::WriteGuard guard(endpoint_map_lock_);
+    if (peer_nic_id < endpoint_map_.size() && endpoint_map_[peer_nic_id]) {
+        LOG(INFO) << "Endpoint " << NicPathOf(peer_nic_id)
+                  << " already exists in WeightedEndpointStore";
+        return endpoint_map_[peer_nic_id]->endpoint;
+    }
+    auto endpoint = warm_pool_.take(peer_nic_id);
+    if (endpoint && !(endpoint->active() && endpoint->connected())) {
+        waiting_list_len_++;
+        waiting_list_.insert(endpoint);
+        endpoint.reset();
+    }
+    bool reused = endpoint != nullptr;
+    const uint64_t now = getCurrentTimeInNano();
+    size_t capacity = capacity_.load(std::memory_order_relaxed);
+    if (!reused) {
+        // Try one more endpoint than the device last held once that is a
+        // while ago, creating it fails if the QPs are still short
+        if (capacity < max_size_ && size_ + warm_pool_.size() >= capacity &&
+            now - shrink_ts_ >= kCapacityGrowNs)
+            capacity++;
+        endpoint = context->newEndpoint();
+        if (!endpoint && size_ + warm_pool_.size() > 0) {
+            // Out of QPs: hold no more endpoints than now, and make room
+            // for the next attempt
+            capacity = std::max<size_t>(size_ + warm_pool_.size(), 1);
+            capacity_ = capacity;
+            shrink_ts_ = now;
+            LOG(WARNING) << "Failed to create an endpoint for "
+                         << NicPathOf(peer_nic_id)
+                         << ", endpoint capacity of the device lowered to "
+                         << capacity;
+            auto dropped = warm_pool_.dropOldest();
+            if (dropped) {
+                waiting_list_len_++;
+                waiting_list_.insert(dropped);
+            } else {
+                evictEndpoint();
+            }
+            warm_pool_len_ = warm_pool_.size();
+            reclaimUnlocked();
+            return nullptr;
+        }
+    }
+    if (!endpoint) {
+        warm_pool_len_ = warm_pool_.size();
+        return nullptr;
+    }
+    if (!reused) recordCreated(peer_nic_id);
+    capacity_ = capacity;
+
+    while (size_ + warm_pool_.size() >= capacity) {
+        auto dropped = warm_pool_.dropOldest();
+        if (dropped) {
+            waiting_list_len_++;
+            waiting_list_.insert(dropped);
+        } else {
+            evictEndpoint();
+        }
+    }
+    warm_pool_len_ = warm_pool_.size();
+
+    if (!reused) endpoint->setPeerNicPath(NicPathOf(peer_nic_id));
+    if (peer_nic_id >= endpoint_map_.size())
+        endpoint_map_.resize(peer_nic_id + 1);
+    auto entry = std::make_unique<Entry>();
+    entry->endpoint = endpoint;
+    entry->seen_bytes = endpoint->postedBytes();
+    entry->update_ts = now;
+    members_.push_back(peer_nic_id);
+    entry->member_iter = --members_.end();
+    endpoint_map_[peer_nic_id] = std::move(entry);
+    size_++;
+    return endpoint;
+}
+
+void WeightedEndpointStore::removeEntry(NicPathID peer_nic_id) {
+    members_.erase(endpoint_map_[peer_nic_id]->member_iter);
+    endpoint_map_[peer_nic_id].reset();
+    size_--;
+}
+
+int WeightedEndpointStore::deleteEndpoint(NicPathID peer_nic_id) {
+    RWSpinlock::WriteGuard guard(endpoint_map_lock_);
+    // remove endpoint but leaving it status unchanged
+    // in case it is setting up connection or submitting slice
+    if (peer_nic_id < endpoint_map_.size() && endpoint_map_[peer_nic_id]) {
+        waiting_list_len_++;
+        waiting_list_.insert(endpoint_map_[peer_nic_id]->endpoint);
+        removeEntry(peer_nic_id);
+    }
+    auto warm_endpoint = warm_pool_.take(peer_nic_id);
+    if (warm_endpoint) {
+        waiting_list_len_++;
+        waiting_list_.insert(warm_endpoint);
+        warm_pool_len_ = warm_pool_.size();
+    }
+    return 0;
+}
+
+int WeightedEndpointStore::releaseEndpoint(NicPathID peer_nic_id) {
+    RWSpinlock::WriteGuard guard(endpoint_map_lock_);
+    if (peer_nic_id < endpoint_map_.size() && endpoint_map_[peer_nic_id]) {
+        auto &endpoint = endpoint_map_[peer_nic_id]->endpoint;
+        if (warm_pool_.park(peer_nic_id, endpoint)) {
+            warm_pool_len_ = warm_pool_.size();
+        } else {
+            waiting_list_len_++;
+            waiting_list_.insert(endpoint);
+        }
+        removeEntry(peer_nic_id);
+    }
+    return 0;
+}
+
+void WeightedEndpointStore::evictEndpoint() {
+    if (members_.empty()) return;
+    const uint64_t now = getCurrentTimeInNano();
+    NicPathID victim = kInvalidNicPathID;
+    double victim_score = 0;
+    for (auto peer_nic_id : members_) {
+        auto &entry = *endpoint_map_[peer_nic_id];
+        uint64_t posted_bytes = entry.endpoint->postedBytes();
+        entry.recent_bytes =
+            entry.recent_bytes *
+                std::exp2(-double(now - entry.update_ts) /
+                          kRecentBytesHalfLifeNs) +
+            double(posted_bytes - entry.seen_bytes);
+        entry.seen_bytes = posted_bytes;
+        entry.update_ts = now;
+        uint64_t connect_ns = entry.endpoint->connectNs();
+        if (!connect_ns) connect_ns = kDefaultConnectNs;
+        double score = (entry.recent_bytes + 1) * double(connect_ns);
+        if (victim == kInvalidNicPathID || score < victim_score) {
+            victim = peer_nic_id;
+            victim_score = score;
+        }
+    }
+    auto victim_instance = endpoint_map_[victim]->endpoint;
+    victim_instance->set_active(false);
+    waiting_list_len_++;
+    waiting_list_.insert(victim_instance);
+    removeEntry(victim);
+}
+
+void WeightedEndpointStore::reclaimUnlocked() {
+    std::vector<std::shared_ptr<RdmaEndPoint>> to_delete;
+    for (auto &endpoint : waiting_list_)
+        if (!endpoint->hasOutstandingSlice()) to_delete.push_back(endpoint);
+    for (auto &endpoint : to_delete) waiting_list_.erase(endpoint);
+    waiting_list_len_ -= to_delete.size();
+}
+
+void WeightedEndpointStore::reclaimEndpoint() {
+    if (waiting_list_len_.load(std::memory_order_relaxed) == 0 &&
+        warm_pool_len_.load(std::memory_order_relaxed) == 0)
+        return;
+    RWSpinlock::WriteGuard guard(endpoint_map_lock_);
+    for (auto &endpoint : warm_pool_.expire()) {
+        waiting_list_len_++;
+        waiting_list_.insert(endpoint);
+    }
+    warm_pool_len_ = warm_pool_.size();
+    reclaimUnlocked();
+}
+
+size_t WeightedEndpointStore::getSize() { return size_; }
+
+int WeightedEndpointStore::destroyQPs() {
+    for (auto &endpoint : waiting_list_) endpoint->destroyQP();
+    for (auto &entry : endpoint_map_)
+        if (entry) entry->endpoint->destroyQP();
+    warm_pool_.forEach([](auto &endpoint) { endpoint->destroyQP(); });
+    return 0;
+}
+
+int WeightedEndpointStore::disconnectQPs() {
+    for (auto &endpoint : waiting_list_) endpoint->disconnect();
+    for (auto &entry : endpoint_map_)
+        if (entry) entry->endpoint->disconnect();
+    warm_pool_.forEach([](auto &endpoint) { endpoint->disconnect(); });
+    return 0;
+}
+}  // namespace mooncake
@@ -0,0 +1,205 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "transport/rdma_transport/incast_control.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "common.h"
+
+namespace mooncake {
+
+const static uint64_t kLeaseNs = IncastControl::kLeaseMs * 1000000ull;
+// Peers that do not grant credits are asked again after this long
+const static uint64_t kExemptNs = 10000000000ull;
+// Least rate granted, so that a sender is never stopped altogether
+const static uint64_t kMinRate = 1 << 20;
+
+IncastControl::IncastControl(std::shared_ptr<TransferMetadata> metadata,
+                             const std::string &local_server_name,
+                             uint64_t inbound_rate)
+    : metadata_(metadata),
+      local_server_name_(local_server_name),
+      inbound_rate_(std::max(inbound_rate, kMinRate)) {
+    request_thread_ = std::thread(&IncastControl::requestWorker, this);
+}
+
+IncastControl::~IncastControl() {
+    {
+        std::lock_guard<std::mutex> lock(request_mutex_);
+        running_ = false;
+    }
+    request_cv_.notify_all();
+    request_thread_.join();
+}
+
+int IncastControl::onCreditRequest(const CreditDesc &request,
+                                   CreditDesc &grant) {
+    const uint64_t now = getCurrentTimeInNano();
+    std::vector<uint64_t> demands;
+    uint64_t demand;
+    {
+        std::lock_guard<std::mutex> lock(senders_mutex_);
+        senders_[request.name] = {request.demand, now};
+        for (auto it = senders_.begin(); it != senders_.end();) {
+            if (it->second.last_request_ts + 2 * kLeaseNs < now)
+                it = senders_.erase(it);
+            else
+                ++it;
+        }
+        for (auto &entry : senders_)
+            demands.push_back(entry.second.demand ? entry.second.demand
+                                                  : inbound_rate_);
+        demand = request.demand ? request.demand : inbound_rate_;
+    }
+
+    // Water filling: the senders asking for less than an equal share get
+    // what they ask for, the others share the rest equally
+    std::sort(demands.begin(), demands.end());
+    uint64_t remaining = inbound_rate_;
+    uint64_t share = remaining;
+    for (size_t i = 0; i < demands.size(); ++i) {
+        share = remaining / (demands.size() - i);
+        if (demands[i] > share) break;
+        remaining -= demands[i];
+    }
+    grant.name = local_server_name_;
+    grant.rate = std::max(std::min(demand, share), kMinRate);
+    grant.lease_ms = kLeaseMs;
+    return 0;
+}
+
+IncastControl::PeerCredit *IncastControl::peer(
+    const std::string &server_name) {
+    std::lock_guard<std::mutex> lock(peers_mutex_);
+    auto &credit = peers_[server_name];
+    if (!credit) {
+        credit = std::make_unique<PeerCredit>();
+        credit->server_name = server_name;
+    }
+    return credit.get();
+}
+
+int64_t IncastControl::available(PeerCredit *credit, uint64_t now_ns) {
+    if (credit->exempt_until_ts.load(std::memory_order_relaxed) > now_ns)
+        return -1;
+    const uint64_t expires_ts =
+        credit->expires_ts.load(std::memory_order_acquire);
+    if (expires_ts < now_ns + kLeaseNs / 2 &&
+        !credit->requesting.exchange(true, std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(request_mutex_);
+        request_queue_.push_back(credit);
+        request_cv_.notify_one();
+    }
+    if (expires_ts <= now_ns) return 0;
+    int64_t bytes = credit->bucket.available(now_ns);
+    if (bytes <= 0) {
+        credit->bucket.throttled.fetch_add(1, std::memory_order_relaxed);
+        credit->throttled.store(true, std::memory_order_relaxed);
+    }
+    return bytes;
+}
+
+void IncastControl::consume(PeerCredit *credit, uint64_t bytes,
+                            uint64_t now_ns) {
+    credit->bucket.consume(bytes, now_ns);
+    credit->posted_bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void IncastControl::requestCredit(PeerCredit *credit) {
+    const uint64_t now = getCurrentTimeInNano();
+    CreditDesc request, grant;
+    request.name = local_server_name_;
+    // Twice the rate written at since the last request, unless the grant
+    // held the writes back
+    const uint64_t posted_bytes =
+        credit->posted_bytes.exchange(0, std::memory_order_relaxed);
+    const bool throttled =
+        credit->throttled.exchange(false, std::memory_order_relaxed);
+    if (credit->last_request_ts && !throttled) {
+        const uint64_t elapsed_ns =
+            std::max<uint64_t>(now - credit->last_request_ts, 1);
+        request.demand = std::max<uint64_t>(
+            2 * posted_bytes * 1000000000ull / elapsed_ns, kMinRate);
+    }
+    credit->last_request_ts = now;
+
+    int ret = metadata_->sendCredit(credit->server_name, request, grant);
+    if (ret) {
+        LOG(WARNING) << "No credits granted by " << credit->server_name
+                     << ", writing to it without them for "
+                     << kExemptNs / 1000000000ull << " seconds";
+        credit->exempt_until_ts.store(now + kExemptNs,
+                                      std::memory_order_relaxed);
+    } else {
+        // About one millisecond of burst at the granted rate
+        credit->bucket.setRate(grant.rate,
+                               std::max<uint64_t>(grant.rate / 1000, 65536));
+        credit->rate.store(grant.rate, std::memory_order_relaxed);
+        credit->expires_ts.store(
+            getCurrentTimeInNano() + grant.lease_ms * 1000000ull,
+            std::memory_order_release);
+    }
+    credit->requesting.store(false, std::memory_order_relaxed);
+}
+
+void IncastControl::requestWorker() {
+    std::unique_lock<std::mutex> lock(request_mutex_);
+    while (true) {
+        request_cv_.wait(
+            lock, [this] { return !running_ || !request_queue_.empty(); });
+        if (!running_) return;
+        auto credit = request_queue_.front();
+        request_queue_.pop_front();
+        lock.unlock();
+        requestCredit(credit);
+        lock.lock();
+    }
+}
+
+void IncastControl::appendMetrics(std::string &out) {
+    const uint64_t now = getCurrentTimeInNano();
+    out +=
+        "# HELP te_incast_granted_bytes_per_second Rate granted by the peer "
+        "for writing to it\n"
+        "# TYPE te_incast_granted_bytes_per_second gauge\n";
+    {
+        std::lock_guard<std::mutex> lock(peers_mutex_);
+        for (auto &entry : peers_) {
+            auto &credit = *entry.second;
+            if (credit.expires_ts.load(std::memory_order_relaxed) <= now)
+                continue;
+            out += "te_incast_granted_bytes_per_second{peer=\"" +
+                   entry.first + "\"} " +
+                   std::to_string(credit.rate.load(std::memory_order_relaxed)) +
+                   "\n";
+        }
+    }
+    size_t senders = 0;
+    {
+        std::lock_guard<std::mutex> lock(senders_mutex_);
+        for (auto &entry : senders_)
+            if (entry.second.last_request_ts + 2 * kLeaseNs >= now) ++senders;
+    }
+    out +=
+        "# HELP te_incast_senders Writers sharing the inbound rate\n"
+        "# TYPE te_incast_senders gauge\n"
+        "te_incast_senders " +
+        std::to_string(senders) + "\n";
+}
+
+}  // namespace mooncake
@@ -14,9 +14,11 @@
 
 #include "transport/rdma_transport/rdma_context.h"
 
+#include <arpa/inet.h>
 #include <fcntl.h>
 #include <sys/epoll.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <fstream>
@@ -24,6 +26,7 @@
 #include <thread>
 
 #include "config.h"
+#include "transport/rdma_transport/dc_endpoint.h"
 #include "transport/rdma_transport/endpoint_store.h"
 #include "transport/rdma_transport/rdma_endpoint.h"
 #include "transport/rdma_transport/rdma_transport.h"
@@ -61,7 +64,11 @@ RdmaContext::~RdmaContext() {
 int RdmaContext::construct(size_t num_cq_list, size_t num_comp_channels,
                            uint8_t port, int gid_index, size_t max_cqe,
                            int max_endpoints) {
-    endpoint_store_ = std::make_shared<SIEVEEndpointStore>(max_endpoints);
+    if (globalConfig().weighted_endpoint_store)
+        endpoint_store_ =
+            std::make_shared<WeightedEndpointStore>(max_endpoints);
+    else
+        endpoint_store_ = std::make_shared<SIEVEEndpointStore>(max_endpoints);
     if (openRdmaDevice(device_name_, port, gid_index)) {
         LOG(ERROR) << "Failed to open device " << device_name_ << " on port "
                    << port << " with GID " << gid_index;
@@ -106,6 +113,23 @@ int RdmaContext::construct(size_t num_cq_list, size_t num_comp_channels,
             return ERR_CONTEXT;
         }
 
+    // With auto tuning, a transfer worker per kGbpsPerWorker of link rate
+    // and a CQ of its own for each
+    const static int kGbpsPerWorker = 100;
+    const static int kMaxWorkers = 8;
+    int num_workers = globalConfig().workers_per_ctx;
+    if (globalConfig().auto_tune_workers) {
+        int rate_gbps = linkRateGbps();
+        if (rate_gbps > 0)
+            num_workers = std::clamp(
+                (rate_gbps + kGbpsPerWorker - 1) / kGbpsPerWorker, 1,
+                kMaxWorkers);
+        num_cq_list = std::max(num_cq_list, (size_t)num_workers);
+        LOG(INFO) << "RDMA device " << device_name_ << ": " << rate_gbps
+                  << " Gb/s, " << num_workers << " workers, " << num_cq_list
+                  << " CQs";
+    }
+
     cq_list_.resize(num_cq_list);
     for (size_t i = 0; i < num_cq_list; ++i) {
         auto cq =
@@ -120,7 +144,19 @@ int RdmaContext::construct(size_t num_cq_list, size_t num_comp_channels,
         cq_list_[i].native = cq;
     }
 
-    worker_pool_ = std::make_shared<WorkerPool>(*this, socketId());
+#ifdef USE_MLX5_DC
+    auto &config = globalConfig();
+    if (config.enable_dc &&
+        constructDc(config.num_dci_per_ctx, config.max_wr, config.max_sge,
+                    config.max_inline)) {
+        LOG(ERROR) << "Failed to set up DC transport on device "
+                   << device_name_;
+        close(event_fd_);
+        return ERR_CONTEXT;
+    }
+#endif
+
+    worker_pool_ = std::make_shared<WorkerPool>(*this, socketId(), num_workers);
 
     LOG(INFO) << "RDMA device: " << context_->device->name << ", LID: " << lid_
               << ", GID: (GID_Index " << gid_index_ << ") " << gid();
@@ -142,11 +178,24 @@ int RdmaContext::socketId() {
     }
 }
 
+int RdmaContext::linkRateGbps() {
+    // e.g. "200 Gb/sec (4X HDR)"
+    std::ifstream file("/sys/class/infiniband/" + device_name_ + "/ports/" +
+                       std::to_string(port_) + "/rate");
+    double rate = 0;
+    file >> rate;
+    return (int)rate;
+}
+
 int RdmaContext::deconstruct() {
     worker_pool_.reset();
 
     endpoint_store_->destroyQPs();
 
+#ifdef USE_MLX5_DC
+    deconstructDc();
+#endif
+
     for (auto &entry : memory_region_list_) {
         int ret = ibv_dereg_mr(entry);
         if (ret) {
@@ -200,14 +249,34 @@ int RdmaContext::registerMemoryRegion(void *addr, size_t length, int access) {
                       << "shrink it to " << globalConfig().max_mr_size;
         length = (size_t)globalConfig().max_mr_size;
     }
+    // ODP registration neither pins nor maps the pages up front, so it
+    // takes about the same time for any length
+    const bool odp = globalConfig().enable_odp && odp_supported_;
+    if (odp) access |= IBV_ACCESS_ON_DEMAND;
     ibv_mr *mr = ibv_reg_mr(pd_, addr, length, access);
     if (!mr) {
         PLOG(ERROR) << "Failed to register memory " << addr;
         return ERR_CONTEXT;
     }
+    if (odp) {
+        // Fault the pages in the background instead of on first access
+        const static size_t kPrefetchSize = 1ull << 30;
+        for (size_t offset = 0; offset < length; offset += kPrefetchSize) {
+            ibv_sge sge;
+            sge.addr = (uint64_t)addr + offset;
+            sge.length = std::min(length - offset, kPrefetchSize);
+            sge.lkey = mr->lkey;
+            if (ibv_advise_mr(pd_, IBV_ADVISE_MR_ADVICE_PREFETCH_WRITE, 0,
+                              &sge, 1))
+                break;
+        }
+    }
 
     RWSpinlock::WriteGuard guard(memory_regions_lock_);
-    memory_region_list_.push_back(mr);
+    auto iter = std::upper_bound(
+        memory_region_list_.begin(), memory_region_list_.end(), mr->addr,
+        [](void *addr, ibv_mr *entry) { return addr < entry->addr; });
+    memory_region_list_.insert(iter, mr);
     return 0;
 }
 
@@ -233,13 +302,39 @@ int RdmaContext::unregisterMemoryRegion(void *addr) {
     return 0;
 }
 
+int RdmaContext::unregisterMemoryRegion(void *addr, size_t length) {
+    length = std::min(length, (size_t)globalConfig().max_mr_size);
+    RWSpinlock::WriteGuard guard(memory_regions_lock_);
+    for (auto iter = memory_region_list_.begin();
+         iter != memory_region_list_.end(); ++iter) {
+        if ((*iter)->addr != addr || (*iter)->length != length) continue;
+        if (ibv_dereg_mr(*iter)) {
+            LOG(ERROR) << "Failed to unregister memory " << addr;
+            return ERR_CONTEXT;
+        }
+        memory_region_list_.erase(iter);
+        return 0;
+    }
+    return ERR_ADDRESS_NOT_REGISTERED;
+}
+
+ibv_mr *RdmaContext::findMemoryRegion(void *addr) {
+    // The regions are sorted by address, the one holding addr, if any,
+    // usually is the last one starting at or below it
+    auto iter = std::upper_bound(
+        memory_region_list_.begin(), memory_region_list_.end(), addr,
+        [](void *addr, ibv_mr *entry) { return addr < entry->addr; });
+    while (iter != memory_region_list_.begin()) {
+        --iter;
+        if (addr < (char *)((*iter)->addr) + (*iter)->length) return *iter;
+    }
+    return nullptr;
+}
+
 uint32_t RdmaContext::rkey(void *addr) {
     RWSpinlock::ReadGuard guard(memory_regions_lock_);
-    for (auto iter = memory_region_list_.begin();
-         iter != memory_region_list_.end(); ++iter)
-        if ((*iter)->addr <= addr &&
-            addr < (char *)((*iter)->addr) + (*iter)->length)
-            return (*iter)->rkey;
+    auto mr = findMemoryRegion(addr);
+    if (mr) return mr->rkey;
 
     LOG(ERROR) << "Address " << addr << " rkey not found for " << deviceName();
     return 0;
@@ -247,46 +342,72 @@ uint32_t RdmaContext::rkey(void *addr) {
 
 uint32_t RdmaContext::lkey(void *addr) {
     RWSpinlock::ReadGuard guard(memory_regions_lock_);
-    for (auto iter = memory_region_list_.begin();
-         iter != memory_region_list_.end(); ++iter)
-        if ((*iter)->addr <= addr &&
-            addr < (char *)((*iter)->addr) + (*iter)->length)
-            return (*iter)->lkey;
+    auto mr = findMemoryRegion(addr);
+    if (mr) return mr->lkey;
 
     LOG(ERROR) << "Address " << addr << " lkey not found for " << deviceName();
     return 0;
 }
 
-std::shared_ptr<RdmaEndPoint> RdmaContext::endpoint(
-    const std::string &peer_nic_path) {
+std::shared_ptr<RdmaEndPoint> RdmaContext::endpoint(NicPathID peer_nic_id) {
     if (!active_) {
         LOG(ERROR) << "Context is not active: " << deviceName();
         return nullptr;
     }
 
-    if (peer_nic_path.empty()) {
+    if (peer_nic_id == kInvalidNicPathID || NicPathOf(peer_nic_id).empty()) {
         LOG(ERROR) << "Invalid peer NIC path: " << deviceName();
         return nullptr;
     }
 
-    auto endpoint = endpoint_store_->getEndpoint(peer_nic_path);
+    auto endpoint = endpoint_store_->getEndpoint(peer_nic_id);
     if (endpoint) {
+        endpoint_hits_.fetch_add(1, std::memory_order_relaxed);
         return endpoint;
     }
 
-    endpoint = endpoint_store_->insertEndpoint(peer_nic_path, this);
+    endpoint_misses_.fetch_add(1, std::memory_order_relaxed);
+    endpoint = endpoint_store_->insertEndpoint(peer_nic_id, this);
     endpoint_store_->reclaimEndpoint();
     return endpoint;
 }
 
+std::shared_ptr<RdmaEndPoint> RdmaContext::newEndpoint() {
+    std::shared_ptr<RdmaEndPoint> endpoint;
+#ifdef USE_MLX5_DC
+    if (dcEnabled())
+        endpoint = std::make_shared<DcEndPoint>(*this);
+    else
+#endif
+        endpoint = std::make_shared<RdmaEndPoint>(*this);
+    auto &config = globalConfig();
+    int ret = endpoint->construct(cq(), config.num_qp_per_ep, config.max_sge,
+                                  config.max_wr, config.max_inline);
+    if (ret) return nullptr;
+    return endpoint;
+}
+
+int RdmaContext::connectEndpoint(NicPathID peer_nic_id) {
+    auto endpoint = this->endpoint(peer_nic_id);
+    if (!endpoint) return ERR_ENDPOINT;
+    worker_pool_->connectAsync(endpoint);
+    return 0;
+}
+
 int RdmaContext::disconnectAllEndpoints() {
     return endpoint_store_->disconnectQPs();
 }
 
-int RdmaContext::deleteEndpoint(const std::string &peer_nic_path) {
-    return endpoint_store_->deleteEndpoint(peer_nic_path);
+int RdmaContext::deleteEndpoint(NicPathID peer_nic_id) {
+    return endpoint_store_->deleteEndpoint(peer_nic_id);
 }
 
+int RdmaContext::releaseEndpoint(NicPathID peer_nic_id) {
+    return endpoint_store_->releaseEndpoint(peer_nic_id);
+}
+
+void RdmaContext::reclaimEndpoints() { endpoint_store_->reclaimEndpoint(); }
+
 std::string RdmaContext::nicPath() const {
     return MakeNicPath(engine_.local_server_name_, device_name_);
 }
@@ -417,6 +538,18 @@ int RdmaContext::openRdmaDevice(const std::string &device_name, uint8_t port,
         }
 
         updateGlobalConfig(device_attr);
+
+        ibv_device_attr_ex device_attr_ex;
+        const uint32_t kRcOdpCaps = IBV_ODP_SUPPORT_READ |
+                                    IBV_ODP_SUPPORT_WRITE;
+        odp_supported_ =
+            !ibv_query_device_ex(context, nullptr, &device_attr_ex) &&
+            (device_attr_ex.odp_caps.general_caps & IBV_ODP_SUPPORT) &&
+            (device_attr_ex.odp_caps.per_transport_caps.rc_odp_caps &
+             kRcOdpCaps) == kRcOdpCaps;
+        if (globalConfig().enable_odp && !odp_supported_)
+            LOG(WARNING) << "Device " << device_name
+                         << " does not support ODP, memory will be pinned";
         if (gid_index == 0) {
             int ret = getBestGidIndex(device_name, context, port_attr, port);
             if (ret >= 0) {
@@ -499,8 +632,343 @@ int RdmaContext::poll(int num_entries, ibv_wc *wc, int cq_index) {
     return nr_poll;
 }
 
+static int postNotifyRecv(ibv_qp *qp, int count) {
+    ibv_recv_wr wr_list[count], *bad_wr = nullptr;
+    memset(wr_list, 0, sizeof(ibv_recv_wr) * count);
+    for (int i = 0; i < count; ++i) {
+        // Writes with immediate of no data need no buffer
+        wr_list[i].wr_id = RdmaContext::kNotifyRecvWrId;
+        wr_list[i].num_sge = 0;
+        wr_list[i].next = (i + 1 == count) ? nullptr : &wr_list[i + 1];
+    }
+    return ibv_post_recv(qp, wr_list, &bad_wr);
+}
+
+int RdmaContext::registerNotifyQp(ibv_qp *qp,
+                                  const std::string &peer_server_name) {
+    RWSpinlock::WriteGuard guard(notify_qps_lock_);
+    if (postNotifyRecv(qp, kNotifyRecvDepth)) {
+        PLOG(ERROR) << "Failed to post notification receives";
+        return ERR_ENDPOINT;
+    }
+    notify_qps_[qp->qp_num] = NotifyQp{qp, peer_server_name};
+    return 0;
+}
+
+void RdmaContext::unregisterNotifyQp(ibv_qp *qp) {
+    RWSpinlock::WriteGuard guard(notify_qps_lock_);
+    notify_qps_.erase(qp->qp_num);
+}
+
+void RdmaContext::onNotifyRecv(const ibv_wc &wc) {
+    // Flushed as the QP failed or went away, the connection set up next
+    // posts its own
+    if (wc.status != IBV_WC_SUCCESS) return;
+    RWSpinlock::ReadGuard guard(notify_qps_lock_);
+    auto it = notify_qps_.find(wc.qp_num);
+    if (it == notify_qps_.end()) return;
+    if (wc.opcode == IBV_WC_RECV_RDMA_WITH_IMM)
+        engine_.pushImmNotify(it->second.peer_server_name,
+                              ntohl(wc.imm_data));
+    if (postNotifyRecv(it->second.qp, 1))
+        PLOG(ERROR) << "Failed to post notification receive";
+}
+
 int RdmaContext::submitPostSend(
     const std::vector<Transport::Slice *> &slice_list) {
     return worker_pool_->submitPostSend(slice_list);
 }
-}  // namespace mooncake
\ No newline at end of file
+
+uint64_t RdmaContext::pendingSliceCount() const {
+    return worker_pool_->pendingSliceCount();
+}
+
+uint64_t RdmaContext::outstandingBytes() const {
+    return worker_pool_->outstandingBytes();
+}
+
+void RdmaContext::PollStats::record(const Transport::Slice *slice,
+                                    uint64_t poll_ts) {
+    const uint64_t latency_ns =
+        poll_ts > uint64_t(slice->ts) ? poll_ts - slice->ts : 0;
+    size_t bucket = 0;
+    while (bucket < std::size(kLatencyBucketsUs) &&
+           latency_ns > kLatencyBucketsUs[bucket] * 1000)
+        bucket++;
+    latency_buckets[bucket]++;
+    for (auto *stats : {&completions, &peers[slice->target_id]}) {
+        stats->slices++;
+        stats->bytes += slice->length;
+        stats->latency_ns += latency_ns;
+    }
+}
+
+void RdmaContext::recordPoll(const PollStats &poll) {
+    if (!poll.completions.slices) return;
+    completed_slices_.fetch_add(poll.completions.slices,
+                                std::memory_order_relaxed);
+    completed_bytes_.fetch_add(poll.completions.bytes,
+                               std::memory_order_relaxed);
+    completed_latency_ns_.fetch_add(poll.completions.latency_ns,
+                                    std::memory_order_relaxed);
+    for (size_t i = 0; i < kLatencyBucketCount; ++i) {
+        if (poll.latency_buckets[i])
+            latency_buckets_[i].fetch_add(poll.latency_buckets[i],
+                                          std::memory_order_relaxed);
+    }
+    std::lock_guard<std::mutex> lock(peer_stats_mutex_);
+    for (auto &entry : poll.peers) {
+        auto &stats = peer_stats_[entry.first];
+        stats.slices += entry.second.slices;
+        stats.bytes += entry.second.bytes;
+        stats.latency_ns += entry.second.latency_ns;
+    }
+}
+
+RdmaContext::TransferStats RdmaContext::transferStats() const {
+    TransferStats stats;
+    stats.completions.slices =
+        completed_slices_.load(std::memory_order_relaxed);
+    stats.completions.bytes = completed_bytes_.load(std::memory_order_relaxed);
+    stats.completions.latency_ns =
+        completed_latency_ns_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < kLatencyBucketCount; ++i)
+        stats.latency_buckets[i] =
+            latency_buckets_[i].load(std::memory_order_relaxed);
+    stats.failures = completion_failures_.load(std::memory_order_relaxed);
+    stats.retries = completion_retries_.load(std::memory_order_relaxed);
+    stats.redispatches = redispatches_.load(std::memory_order_relaxed);
+    stats.endpoint_hits = endpoint_hits_.load(std::memory_order_relaxed);
+    stats.endpoint_misses = endpoint_misses_.load(std::memory_order_relaxed);
+    if (endpoint_store_) {
+        stats.endpoint_reconnects = endpoint_store_->reconnects();
+        stats.endpoint_capacity = endpoint_store_->getCapacity();
+    }
+    for (const auto &cq : cq_list_) {
+        int outstanding = cq.outstanding;
+        if (outstanding > 0) stats.outstanding_work_requests += outstanding;
+    }
+    std::lock_guard<std::mutex> lock(peer_stats_mutex_);
+    stats.peers.assign(peer_stats_.begin(), peer_stats_.end());
+    return stats;
+}
+
+#ifdef USE_MLX5_DC
+int RdmaContext::constructDc(size_t num_dci, size_t max_wr, size_t max_sge,
+                             size_t max_inline) {
+    // RDMA reads and writes consume no receive, the SRQ only has to exist
+    ibv_srq_init_attr srq_attr;
+    memset(&srq_attr, 0, sizeof(srq_attr));
+    srq_attr.attr.max_wr = 1;
+    srq_attr.attr.max_sge = 1;
+    dc_srq_ = ibv_create_srq(pd_, &srq_attr);
+    if (!dc_srq_) {
+        PLOG(ERROR) << "Failed to create SRQ for DC target";
+        return ERR_CONTEXT;
+    }
+
+    ibv_qp_init_attr_ex attr_ex;
+    memset(&attr_ex, 0, sizeof(attr_ex));
+    attr_ex.qp_type = IBV_QPT_DRIVER;
+    attr_ex.send_cq = attr_ex.recv_cq = cq();
+    attr_ex.srq = dc_srq_;
+    attr_ex.comp_mask = IBV_QP_INIT_ATTR_PD;
+    attr_ex.pd = pd_;
+    mlx5dv_qp_init_attr dv_attr;
+    memset(&dv_attr, 0, sizeof(dv_attr));
+    dv_attr.comp_mask = MLX5DV_QP_INIT_ATTR_MASK_DC;
+    dv_attr.dc_init_attr.dc_type = MLX5DV_DCTYPE_DCT;
+    dv_attr.dc_init_attr.dct_access_key = kDcAccessKey;
+    dct_ = mlx5dv_create_qp(context_, &attr_ex, &dv_attr);
+    if (!dct_) {
+        PLOG(ERROR) << "Failed to create DC target";
+        return ERR_CONTEXT;
+    }
+
+    ibv_qp_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.qp_state = IBV_QPS_INIT;
+    attr.pkey_index = 0;
+    attr.port_num = port_;
+    attr.qp_access_flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |
+                           IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_ATOMIC;
+    if (ibv_modify_qp(dct_, &attr,
+                      IBV_QP_STATE | IBV_QP_PKEY_INDEX | IBV_QP_PORT |
+                          IBV_QP_ACCESS_FLAGS)) {
+        PLOG(ERROR) << "Failed to modify DC target to INIT";
+        return ERR_CONTEXT;
+    }
+    memset(&attr, 0, sizeof(attr));
+    attr.qp_state = IBV_QPS_RTR;
+    attr.path_mtu = std::min(active_mtu_, globalConfig().mtu_length);
+    attr.min_rnr_timer = 12;
+    attr.ah_attr.is_global = 1;
+    attr.ah_attr.grh.hop_limit = 16;
+    attr.ah_attr.grh.sgid_index = gid_index_;
+    attr.ah_attr.port_num = port_;
+    if (ibv_modify_qp(dct_, &attr,
+                      IBV_QP_STATE | IBV_QP_MIN_RNR_TIMER | IBV_QP_AV |
+                          IBV_QP_PATH_MTU)) {
+        PLOG(ERROR) << "Failed to modify DC target to RTR";
+        return ERR_CONTEXT;
+    }
+
+    for (size_t i = 0; i < num_dci; ++i) {
+        auto dci = std::make_unique<DcInitiator>();
+        auto send_cq = cq();
+        memset(&attr_ex, 0, sizeof(attr_ex));
+        attr_ex.qp_type = IBV_QPT_DRIVER;
+        attr_ex.send_cq = attr_ex.recv_cq = send_cq;
+        attr_ex.comp_mask =
+            IBV_QP_INIT_ATTR_PD | IBV_QP_INIT_ATTR_SEND_OPS_FLAGS;
+        attr_ex.pd = pd_;
+        attr_ex.send_ops_flags =
+            IBV_QP_EX_WITH_RDMA_WRITE | IBV_QP_EX_WITH_RDMA_READ;
+        attr_ex.cap.max_send_wr = max_wr;
+        attr_ex.cap.max_send_sge = max_sge;
+        attr_ex.cap.max_inline_data = max_inline;
+        memset(&dv_attr, 0, sizeof(dv_attr));
+        dv_attr.comp_mask = MLX5DV_QP_INIT_ATTR_MASK_DC;
+        dv_attr.dc_init_attr.dc_type = MLX5DV_DCTYPE_DCI;
+        dci->qp = mlx5dv_create_qp(context_, &attr_ex, &dv_attr);
+        if (!dci->qp) {
+            PLOG(ERROR) << "Failed to create DC initiator";
+            return ERR_CONTEXT;
+        }
+        dci->qp_ex = ibv_qp_to_qp_ex(dci->qp);
+        dci->dv_qp = mlx5dv_qp_ex_from_ibv_qp_ex(dci->qp_ex);
+        dci->cq_outstanding = (volatile int *)send_cq->cq_context;
+        int ret = setupDci(*dci);
+        dci_list_.push_back(std::move(dci));
+        if (ret) return ret;
+    }
+
+    LOG(INFO) << "DC transport on device " << device_name_ << ", DCT "
+              << dct_->qp_num << ", " << num_dci << " initiators";
+    return 0;
+}
+
+int RdmaContext::setupDci(DcInitiator &dci) {
+    ibv_qp_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.qp_state = IBV_QPS_RESET;
+    if (ibv_modify_qp(dci.qp, &attr, IBV_QP_STATE)) {
+        PLOG(ERROR) << "Failed to modify DC initiator to RESET";
+        return ERR_CONTEXT;
+    }
+    memset(&attr, 0, sizeof(attr));
+    attr.qp_state = IBV_QPS_INIT;
+    attr.pkey_index = 0;
+    attr.port_num = port_;
+    if (ibv_modify_qp(dci.qp, &attr,
+                      IBV_QP_STATE | IBV_QP_PKEY_INDEX | IBV_QP_PORT)) {
+        PLOG(ERROR) << "Failed to modify DC initiator to INIT";
+        return ERR_CONTEXT;
+    }
+    memset(&attr, 0, sizeof(attr));
+    attr.qp_state = IBV_QPS_RTR;
+    attr.path_mtu = std::min(active_mtu_, globalConfig().mtu_length);
+    attr.ah_attr.port_num = port_;
+    if (ibv_modify_qp(dci.qp, &attr, IBV_QP_STATE | IBV_QP_PATH_MTU)) {
+        PLOG(ERROR) << "Failed to modify DC initiator to RTR";
+        return ERR_CONTEXT;
+    }
+    memset(&attr, 0, sizeof(attr));
+    attr.qp_state = IBV_QPS_RTS;
+    attr.timeout = 14;
+    attr.retry_cnt = 7;
+    attr.rnr_retry = 7;
+    attr.sq_psn = 0;
+    attr.max_rd_atomic = 16;
+    if (ibv_modify_qp(dci.qp, &attr,
+                      IBV_QP_STATE | IBV_QP_TIMEOUT | IBV_QP_RETRY_CNT |
+                          IBV_QP_RNR_RETRY | IBV_QP_SQ_PSN |
+                          IBV_QP_MAX_QP_RD_ATOMIC)) {
+        PLOG(ERROR) << "Failed to modify DC initiator to RTS";
+        return ERR_CONTEXT;
+    }
+    return 0;
+}
+
+DcInitiator *RdmaContext::selectDci() {
+    const int count = dci_list_.size();
+    if (!count) return nullptr;
+    int start = SimpleRandom::Get().next(count);
+    for (int i = 0; i < count; ++i) {
+        auto &dci = *dci_list_[(start + i) % count];
+        if (!dci.failed.load(std::memory_order_acquire)) return &dci;
+        // Flushed work requests of the failure must complete first
+        if (dci.wr_depth != 0) continue;
+        RWSpinlock::WriteGuard guard(dci.lock);
+        if (dci.failed.load(std::memory_order_relaxed) && dci.wr_depth == 0 &&
+            setupDci(dci) == 0) {
+            dci.failed.store(false, std::memory_order_release);
+            return &dci;
+        }
+    }
+    return nullptr;
+}
+
+void RdmaContext::markDciFailed(volatile int *wr_depth) {
+    for (auto &dci : dci_list_) {
+        if (&dci->wr_depth == wr_depth) {
+            dci->failed.store(true, std::memory_order_release);
+            return;
+        }
+    }
+}
+
+ibv_ah *RdmaContext::addressHandle(const std::string &peer_gid,
+                                   uint16_t peer_lid) {
+    auto key = peer_gid + "/" + std::to_string(peer_lid);
+    std::lock_guard<std::mutex> lock(address_handle_mutex_);
+    auto it = address_handles_.find(key);
+    if (it != address_handles_.end()) return it->second;
+
+    ibv_ah_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    std::istringstream iss(peer_gid);
+    for (int i = 0; i < 16; ++i) {
+        int value;
+        iss >> std::hex >> value;
+        attr.grh.dgid.raw[i] = static_cast<uint8_t>(value);
+        if (i < 15) iss.ignore(1, ':');
+    }
+    attr.grh.sgid_index = gid_index_;
+    attr.grh.hop_limit = 16;
+    attr.is_global = 1;
+    attr.dlid = peer_lid;
+    attr.port_num = port_;
+    auto ah = ibv_create_ah(pd_, &attr);
+    if (!ah) {
+        PLOG(ERROR) << "Failed to create address handle for GID " << peer_gid;
+        return nullptr;
+    }
+    address_handles_[key] = ah;
+    return ah;
+}
+
+void RdmaContext::deconstructDc() {
+    for (auto &dci : dci_list_) {
+        if (dci->qp && ibv_destroy_qp(dci->qp))
+            PLOG(ERROR) << "Failed to destroy DC initiator";
+        // No completion will decrease these any more
+        if (dci->wr_depth)
+            __sync_fetch_and_sub(dci->cq_outstanding, dci->wr_depth);
+    }
+    dci_list_.clear();
+    if (dct_) {
+        if (ibv_destroy_qp(dct_)) PLOG(ERROR) << "Failed to destroy DC target";
+        dct_ = nullptr;
+    }
+    if (dc_srq_) {
+        if (ibv_destroy_srq(dc_srq_)) PLOG(ERROR) << "Failed to destroy SRQ";
+        dc_srq_ = nullptr;
+    }
+    for (auto &entry : address_handles_)
+        if (ibv_destroy_ah(entry.second))
+            PLOG(ERROR) << "Failed to destroy address handle";
+    address_handles_.clear();
+}
+#endif  // USE_MLX5_DC
+}  // namespace mooncake
@@ -14,6 +14,7 @@
 
 #include "transport/rdma_transport/rdma_endpoint.h"
 
+#include <arpa/inet.h>
 #include <glog/logging.h>
 
 #include <cassert>
@@ -48,6 +49,7 @@ int RdmaEndPoint::construct(ibv_cq *cq, size_t num_qp_list,
     cq_outstanding_ = (volatile int *)cq->cq_context;
 
     max_wr_depth_ = (int)max_wr_depth;
+    max_inline_bytes_ = max_inline_bytes;
     wr_depth_list_ = new volatile int[num_qp_list];
     if (!wr_depth_list_) {
         LOG(ERROR) << "Failed to allocate memory for work request depth list";
@@ -78,6 +80,7 @@ int RdmaEndPoint::construct(ibv_cq *cq, size_t num_qp_list,
 
 int RdmaEndPoint::deconstruct() {
     for (size_t i = 0; i < qp_list_.size(); ++i) {
+        context_.unregisterNotifyQp(qp_list_[i]);
         if (ibv_destroy_qp(qp_list_[i])) {
             PLOG(ERROR) << "Failed to destroy QP";
             return ERR_ENDPOINT;
@@ -230,6 +233,7 @@ void RdmaEndPoint::disconnectUnlocked() {
     memset(&attr, 0, sizeof(attr));
     attr.qp_state = IBV_QPS_RESET;
     for (size_t i = 0; i < qp_list_.size(); ++i) {
+        context_.unregisterNotifyQp(qp_list_[i]);
         int ret = ibv_modify_qp(qp_list_[i], &attr, IBV_QP_STATE);
         if (ret) PLOG(ERROR) << "Failed to modify QP to RESET";
         // After resetting QP, the wr_depth_list_ won't change
@@ -275,6 +279,13 @@ int RdmaEndPoint::submitPostSend(
         std::min(int(globalConfig().max_cqe) - *cq_outstanding_, wr_count);
     if (wr_count <= 0) return 0;
 
+    // The whole batch is chained into one doorbell. Only every
+    // signal_interval-th WR and the last one are signaled; a completion
+    // covers the unsignaled WRs before it on the QP, see performPollCq()
+    const int signal_interval =
+        std::max(1, int(globalConfig().signal_interval));
+    int signaled_count = 0;
+    Transport::Slice *unsignaled_prev = nullptr;
     ibv_send_wr wr_list[wr_count], *bad_wr = nullptr;
     ibv_sge sge_list[wr_count];
     memset(wr_list, 0, sizeof(ibv_send_wr) * wr_count);
@@ -292,9 +303,25 @@ int RdmaEndPoint::submitPostSend(
                         : IBV_WR_RDMA_WRITE;
         wr.num_sge = 1;
         wr.sg_list = &sge;
-        wr.send_flags = IBV_SEND_SIGNALED;
-        wr.next = (i + 1 == wr_count) ? nullptr : &wr_list[i + 1];
+        wr.send_flags = 0;
         wr.imm_data = 0;
+        if (slice->rdma.with_imm && wr.opcode == IBV_WR_RDMA_WRITE) {
+            wr.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
+            wr.imm_data = htonl(slice->rdma.imm_data);
+            if (!slice->length) wr.num_sge = 0;
+        }
+        if (wr.opcode != IBV_WR_RDMA_READ &&
+            slice->length <= max_inline_bytes_)
+            wr.send_flags |= IBV_SEND_INLINE;
+        slice->rdma.unsignaled_prev = unsignaled_prev;
+        if ((i + 1) % signal_interval == 0 || i + 1 == wr_count) {
+            wr.send_flags |= IBV_SEND_SIGNALED;
+            unsignaled_prev = nullptr;
+            signaled_count++;
+        } else {
+            unsignaled_prev = slice;
+        }
+        wr.next = (i + 1 == wr_count) ? nullptr : &wr_list[i + 1];
         wr.wr.rdma.remote_addr = slice->rdma.dest_addr;
         wr.wr.rdma.rkey = slice->rdma.dest_rkey;
         slice->ts = getCurrentTimeInNano();
@@ -304,8 +331,16 @@ int RdmaEndPoint::submitPostSend(
     __sync_fetch_and_add(&wr_depth_list_[qp_index], wr_count);
     __sync_fetch_and_add(cq_outstanding_, wr_count);
     int rc = ibv_post_send(qp_list_[qp_index], wr_list, &bad_wr);
+    context_.recordPostSend(wr_count, signaled_count);
     if (rc) {
         PLOG(ERROR) << "Failed to ibv_post_send";
+        // WRs posted after the last signaled one would never complete,
+        // resubmit them with the rejected ones
+        int first_failed = bad_wr - wr_list;
+        while (first_failed > 0 &&
+               !(wr_list[first_failed - 1].send_flags & IBV_SEND_SIGNALED))
+            first_failed--;
+        bad_wr = &wr_list[first_failed];
         while (bad_wr) {
             int i = bad_wr - wr_list;
             failed_slice_list.push_back(slice_list[i]);
@@ -344,6 +379,19 @@ int RdmaEndPoint::doSetupConnection(const std::string &peer_gid,
         if (ret) return ret;
     }
 
+    // Taking writes with immediate from the peer, see MC_INBAND_NOTIFY
+    if (globalConfig().inband_notify) {
+        auto peer_server_name = getServerNameFromNicPath(peer_nic_path_);
+        for (auto qp : qp_list_) {
+            int ret = context_.registerNotifyQp(qp, peer_server_name);
+            if (ret) {
+                if (reply_msg)
+                    *reply_msg = "Failed to post notification receives";
+                return ret;
+            }
+        }
+    }
+
     status_.store(CONNECTED, std::memory_order_relaxed);
     return 0;
 }
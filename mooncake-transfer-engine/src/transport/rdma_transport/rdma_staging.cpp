@@ -0,0 +1,302 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifdef USE_CUDA
+
+#include "transport/rdma_transport/rdma_staging.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+
+#include "config.h"
+#include "memory_location.h"
+#include "transport/rdma_transport/rdma_transport.h"
+
+namespace mooncake {
+
+RdmaStaging::RdmaStaging(RdmaTransport &transport)
+    : transport_(transport),
+      chunk_size_(globalConfig().staging_chunk_size),
+      buffer_count_(globalConfig().staging_buffers) {
+    thread_ = std::thread(&RdmaStaging::run, this);
+}
+
+RdmaStaging::~RdmaStaging() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cond_.notify_all();
+    thread_.join();
+    for (auto &entry : streams_) {
+        cudaSetDevice(entry.first);
+        cudaStreamDestroy(entry.second);
+    }
+    if (buffers_) {
+        transport_.unregisterLocalMemory(buffers_, false);
+        cudaFreeHost(buffers_);
+    }
+}
+
+bool RdmaStaging::isDeviceMemory(void *addr) {
+    cudaPointerAttributes attributes;
+    if (cudaPointerGetAttributes(&attributes, addr) != cudaSuccess) {
+        cudaGetLastError();
+        return false;
+    }
+    return attributes.type == cudaMemoryTypeDevice;
+}
+
+void RdmaStaging::submit(const Transport::TransferRequest &request,
+                         Transport::TransferTask &task) {
+    cudaPointerAttributes attributes;
+    cudaPointerGetAttributes(&attributes, request.source);
+    auto job = std::make_unique<Job>();
+    job->request = request;
+    job->task = &task;
+    job->device = attributes.device;
+    const uint64_t chunk_count =
+        (request.length + chunk_size_ - 1) / chunk_size_;
+    task.total_bytes += request.length;
+    __sync_fetch_and_add(&task.slice_count, chunk_count);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_jobs_.push_back(std::move(job));
+    }
+    cond_.notify_one();
+}
+
+bool RdmaStaging::allocateBuffers() {
+    const size_t length = chunk_size_ * buffer_count_;
+    cudaError_t err =
+        cudaHostAlloc(&buffers_, length, cudaHostAllocPortable);
+    if (err != cudaSuccess) {
+        LOG(ERROR) << "RdmaStaging: cannot allocate " << length
+                   << " bytes of pinned memory: " << cudaGetErrorString(err);
+        buffers_ = nullptr;
+        return false;
+    }
+    if (transport_.registerLocalMemory(buffers_, length, kWildcardLocation,
+                                       false, false)) {
+        LOG(ERROR) << "RdmaStaging: cannot register staging buffers";
+        cudaFreeHost(buffers_);
+        buffers_ = nullptr;
+        return false;
+    }
+    for (size_t i = buffer_count_; i > 0; --i) free_buffers_.push_back(i - 1);
+    return true;
+}
+
+cudaStream_t RdmaStaging::stream(int device) {
+    auto it = streams_.find(device);
+    if (it != streams_.end()) return it->second;
+    cudaStream_t stream = nullptr;
+    cudaSetDevice(device);
+    if (cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking) !=
+        cudaSuccess)
+        return nullptr;
+    streams_[device] = stream;
+    return stream;
+}
+
+void RdmaStaging::run() {
+    bool allocated = false;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            // Chunks in flight are polled, the thread sleeps only when idle
+            cond_.wait(lock, [this] {
+                return !running_ || !pending_jobs_.empty() ||
+                       !jobs_.empty() || !chunks_.empty();
+            });
+            if (!running_) break;
+            while (!pending_jobs_.empty()) {
+                jobs_.push_back(std::move(pending_jobs_.front()));
+                pending_jobs_.pop_front();
+            }
+        }
+        if (!allocated && !jobs_.empty()) allocated = allocateBuffers();
+        if (!allocated) {
+            // Nothing can be staged, fail every chunk
+            for (auto &job : jobs_) {
+                uint64_t chunk_count =
+                    (job->request.length + chunk_size_ - 1) / chunk_size_;
+                for (uint64_t i = 0; i < chunk_count; ++i)
+                    job->task->finishSlice(false);
+            }
+            jobs_.clear();
+            continue;
+        }
+
+        // Jobs take the free buffers in submission order, so the chunks of a
+        // request are pipelined together rather than spread thin
+        for (auto &job : jobs_) {
+            while (!free_buffers_.empty() &&
+                   job->next_offset < job->request.length) {
+                size_t buffer = free_buffers_.back();
+                free_buffers_.pop_back();
+                startChunk(*job, buffer);
+            }
+            if (free_buffers_.empty()) break;
+        }
+
+        bool progressed = false;
+        for (auto it = chunks_.begin(); it != chunks_.end();) {
+            if (progressChunk(**it)) {
+                it = chunks_.erase(it);
+                progressed = true;
+            } else {
+                ++it;
+            }
+        }
+        for (auto it = jobs_.begin(); it != jobs_.end();) {
+            Job &job = **it;
+            bool started = job.next_offset >= job.request.length;
+            bool in_flight = std::any_of(
+                chunks_.begin(), chunks_.end(),
+                [&job](const auto &chunk) { return chunk->job == &job; });
+            if (started && !in_flight)
+                it = jobs_.erase(it);
+            else
+                ++it;
+        }
+        if (!progressed) std::this_thread::yield();
+    }
+}
+
+void RdmaStaging::startChunk(Job &job, size_t buffer) {
+    auto chunk = std::make_unique<Chunk>();
+    chunk->job = &job;
+    chunk->buffer = buffer;
+    chunk->offset = job.next_offset;
+    chunk->length = std::min<uint64_t>(chunk_size_,
+                                       job.request.length - job.next_offset);
+    job.next_offset += chunk->length;
+    chunk->request = job.request;
+    chunk->request.source = bufferAddress(buffer);
+    chunk->request.target_offset = job.request.target_offset + chunk->offset;
+    chunk->request.length = chunk->length;
+    chunk->task.batch_id = Transport::INVALID_BATCH_ID;
+
+    bool ok = !job.failed;
+    if (ok && job.request.opcode == Transport::TransferRequest::WRITE) {
+        chunk->state = Chunk::COPYING_IN;
+        ok = copyChunk(*chunk, cudaMemcpyDeviceToHost);
+    } else if (ok) {
+        chunk->state = Chunk::POSTED;
+        ok = postChunk(*chunk);
+    }
+    if (!ok) {
+        finishChunk(*chunk, false);
+        return;
+    }
+    chunks_.push_back(std::move(chunk));
+}
+
+bool RdmaStaging::copyChunk(Chunk &chunk, cudaMemcpyKind kind) {
+    cudaStream_t copy_stream = stream(chunk.job->device);
+    if (!copy_stream) return false;
+    cudaSetDevice(chunk.job->device);
+    if (!chunk.event &&
+        cudaEventCreateWithFlags(&chunk.event, cudaEventDisableTiming) !=
+            cudaSuccess) {
+        chunk.event = nullptr;
+        return false;
+    }
+    char *device_addr = (char *)chunk.job->request.source + chunk.offset;
+    void *host_addr = bufferAddress(chunk.buffer);
+    cudaError_t err =
+        kind == cudaMemcpyDeviceToHost
+            ? cudaMemcpyAsync(host_addr, device_addr, chunk.length, kind,
+                              copy_stream)
+            : cudaMemcpyAsync(device_addr, host_addr, chunk.length, kind,
+                              copy_stream);
+    if (err == cudaSuccess) err = cudaEventRecord(chunk.event, copy_stream);
+    if (err != cudaSuccess) {
+        LOG(ERROR) << "RdmaStaging: copy failed: " << cudaGetErrorString(err);
+        return false;
+    }
+    return true;
+}
+
+bool RdmaStaging::postChunk(Chunk &chunk) {
+    std::vector<Transport::TransferRequest *> requests{&chunk.request};
+    std::vector<Transport::TransferTask *> tasks{&chunk.task};
+    auto status = transport_.submitTransferTask(requests, tasks);
+    if (!status.ok()) {
+        LOG(ERROR) << "RdmaStaging: cannot submit chunk: "
+                   << status.ToString();
+        return false;
+    }
+    return true;
+}
+
+bool RdmaStaging::progressChunk(Chunk &chunk) {
+    switch (chunk.state) {
+        case Chunk::COPYING_IN:
+        case Chunk::COPYING_OUT: {
+            cudaError_t err = cudaEventQuery(chunk.event);
+            if (err == cudaErrorNotReady) return false;
+            if (err != cudaSuccess || chunk.state == Chunk::COPYING_OUT) {
+                finishChunk(chunk, err == cudaSuccess);
+                return true;
+            }
+            chunk.state = Chunk::POSTED;
+            if (!postChunk(chunk)) {
+                finishChunk(chunk, false);
+                return true;
+            }
+            return false;
+        }
+        case Chunk::POSTED: {
+            auto &task = chunk.task;
+            if (task.success_slice_count + task.failed_slice_count !=
+                task.slice_count)
+                return false;
+            if (task.failed_slice_count ||
+                chunk.request.opcode == Transport::TransferRequest::WRITE) {
+                finishChunk(chunk, !task.failed_slice_count);
+                return true;
+            }
+            chunk.state = Chunk::COPYING_OUT;
+            if (!copyChunk(chunk, cudaMemcpyHostToDevice)) {
+                finishChunk(chunk, false);
+                return true;
+            }
+            return false;
+        }
+    }
+    return false;
+}
+
+void RdmaStaging::finishChunk(Chunk &chunk, bool success) {
+    auto &task = *chunk.job->task;
+    if (success) {
+        task.finishSlice(true, chunk.length);
+    } else {
+        // The remaining chunks of the request are failed without a transfer
+        chunk.job->failed = true;
+        task.finishSlice(false);
+    }
+    if (chunk.event) {
+        cudaEventDestroy(chunk.event);
+        chunk.event = nullptr;
+    }
+    free_buffers_.push_back(chunk.buffer);
+}
+
+}  // namespace mooncake
+
+#endif  // USE_CUDA
@@ -17,11 +17,14 @@
 #include <glog/logging.h>
 #include <sys/mman.h>
 #include <sys/time.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
 #include <future>
 #include <set>
+#include <string_view>
 
 #include "common.h"
 #include "config.h"
@@ -29,18 +32,20 @@
 #include "topology.h"
 #include "transport/rdma_transport/rdma_context.h"
 #include "transport/rdma_transport/rdma_endpoint.h"
+#include "transport/rdma_transport/rdma_staging.h"
+#include "transport/rdma_transport/worker_pool.h"
 
 namespace mooncake {
 RdmaTransport::RdmaTransport() {}
 
 RdmaTransport::~RdmaTransport() {
-#ifdef CONFIG_USE_BATCH_DESC_SET
-    for (auto &entry : batch_desc_set_) delete entry.second;
-    batch_desc_set_.clear();
+#ifdef USE_CUDA
+    staging_.reset();
 #endif
-    metadata_->removeSegmentDesc(local_server_name_);
-    batch_desc_set_.clear();
+    if (metadata_) metadata_->removeSegmentDesc(local_server_name_);
     context_list_.clear();
+    std::vector<ImmNotify> notifies;
+    popImmNotifies(notifies);
 }
 
 int RdmaTransport::install(std::string &local_server_name,
@@ -74,6 +79,21 @@ int RdmaTransport::install(std::string &local_server_name,
         return ret;
     }
 
+    if (globalConfig().incast_control) {
+        uint64_t inbound_rate = globalConfig().incast_inbound_rate;
+        if (!inbound_rate) {
+            for (auto &context : context_list_)
+                inbound_rate += context->linkRateGbps() * 125000000ull;
+        }
+        incast_control_ = std::make_unique<IncastControl>(
+            metadata_, local_server_name, inbound_rate);
+        metadata_->registerOnCredit(
+            std::bind(&IncastControl::onCreditRequest, incast_control_.get(),
+                      std::placeholders::_1, std::placeholders::_2));
+        LOG(INFO) << "RdmaTransport: incast control with inbound rate "
+                  << inbound_rate << " bytes/s";
+    }
+
     ret = metadata_->updateLocalSegmentDesc();
     if (ret) {
         LOG(ERROR) << "RdmaTransport: cannot publish segments";
@@ -88,13 +108,60 @@ int RdmaTransport::registerLocalMemory(void *addr, size_t length,
                                        bool remote_accessible,
                                        bool update_metadata) {
     (void)remote_accessible;
+    // Explicit registrations take over the pages cached on first use
+    invalidateRegistrations((uint64_t)addr, length);
+    const size_t chunk_size = globalConfig().mr_chunk_size;
+    if (!chunk_size || length <= chunk_size)
+        return registerMemoryRange(addr, length, name, update_metadata);
+
+    // Every chunk is published once registered, so peers can use the first
+    // chunks of a huge buffer while the others are still being registered
+    std::vector<void *> chunk_list;
+    for (size_t offset = 0; offset < length; offset += chunk_size) {
+        void *chunk = (char *)addr + offset;
+        int ret = registerMemoryRange(
+            chunk, std::min(chunk_size, length - offset), name,
+            update_metadata);
+        if (ret) {
+            for (auto &entry : chunk_list)
+                unregisterMemoryRange(entry, update_metadata);
+            return ret;
+        }
+        chunk_list.push_back(chunk);
+    }
+    std::lock_guard<std::mutex> lock(chunked_buffer_mutex_);
+    chunked_buffer_map_[addr] = std::move(chunk_list);
+    return 0;
+}
+
+int RdmaTransport::registerMemoryRange(void *addr, size_t length,
+                                       const std::string &name,
+                                       bool update_metadata) {
     BufferDesc buffer_desc;
     const static int access_rights = IBV_ACCESS_LOCAL_WRITE |
                                      IBV_ACCESS_REMOTE_WRITE |
                                      IBV_ACCESS_REMOTE_READ;
+    // Pinning dominates the cost and is done per device, so register on
+    // all devices at once
+    std::vector<std::future<int>> results;
+    for (auto &context : context_list_) {
+        results.emplace_back(std::async(
+            std::launch::async, [&context, addr, length]() -> int {
+                return context->registerMemoryRegion(addr, length,
+                                                     access_rights);
+            }));
+    }
+    int ret = 0;
+    for (size_t i = 0; i < results.size(); ++i) {
+        int rc = results[i].get();
+        if (rc && !ret) ret = rc;
+    }
+    if (ret) {
+        for (auto &context : context_list_)
+            context->unregisterMemoryRegion(addr, length);
+        return ret;
+    }
     for (auto &context : context_list_) {
-        int ret = context->registerMemoryRegion(addr, length, access_rights);
-        if (ret) return ret;
         buffer_desc.lkey.push_back(context->lkey(addr));
         buffer_desc.rkey.push_back(context->rkey(addr));
     }
@@ -123,6 +190,33 @@ int RdmaTransport::registerLocalMemory(void *addr, size_t length,
 }
 
 int RdmaTransport::unregisterLocalMemory(void *addr, bool update_metadata) {
+    std::vector<void *> chunk_list;
+    {
+        std::lock_guard<std::mutex> lock(chunked_buffer_mutex_);
+        auto it = chunked_buffer_map_.find(addr);
+        if (it != chunked_buffer_map_.end()) {
+            chunk_list = std::move(it->second);
+            chunked_buffer_map_.erase(it);
+        }
+    }
+    if (chunk_list.empty()) {
+        int rc = unregisterMemoryRange(addr, update_metadata);
+        // Unregistering a buffer only cached on first use invalidates it,
+        // e.g. before the memory is freed
+        if (rc == ERR_ADDRESS_NOT_REGISTERED &&
+            invalidateRegistrations((uint64_t)addr, 1))
+            return 0;
+        return rc;
+    }
+    int ret = 0;
+    for (auto &chunk : chunk_list) {
+        int rc = unregisterMemoryRange(chunk, update_metadata);
+        if (rc && !ret) ret = rc;
+    }
+    return ret;
+}
+
+int RdmaTransport::unregisterMemoryRange(void *addr, bool update_metadata) {
     int rc = metadata_->removeLocalMemoryBuffer(addr, update_metadata);
     if (rc) return rc;
 
@@ -131,6 +225,143 @@ int RdmaTransport::unregisterLocalMemory(void *addr, bool update_metadata) {
     return 0;
 }
 
+bool RdmaTransport::cacheRegistration(SegmentDesc *desc, void *addr,
+                                      size_t length) {
+    const size_t kLimit = globalConfig().rcache_size;
+    if (!kLimit || !length) return false;
+    const uint64_t start = (uint64_t)addr, end = start + length;
+    if (desc && desc->findBuffer(start, length) >= 0) {
+        if (!rcache_in_use_.load(std::memory_order_relaxed)) return false;
+        std::lock_guard<std::mutex> lock(rcache_mutex_);
+        auto it = rcache_.upper_bound(start);
+        if (it == rcache_.begin()) return false;
+        --it;
+        if (end <= it->first + it->second.length) {
+            it->second.last_use = ++rcache_clock_;
+            rcache_hits_.fetch_add(1, std::memory_order_relaxed);
+        }
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(rcache_mutex_);
+    reapRegistrations(false);
+    // Another request may have registered the buffer meanwhile
+    auto local_desc = metadata_->getSegmentDescByID(LOCAL_SEGMENT_ID);
+    if (local_desc && local_desc->findBuffer(start, length) >= 0) return true;
+
+    // Cached registrations overlapping the buffer are merged into one
+    uint64_t merged_start = start, merged_end = end;
+    std::vector<uint64_t> overlapping;
+    auto it = rcache_.upper_bound(start);
+    if (it != rcache_.begin() &&
+        std::prev(it)->first + std::prev(it)->second.length > start)
+        --it;
+    for (; it != rcache_.end() && it->first < end; ++it) {
+        overlapping.push_back(it->first);
+        merged_start = std::min(merged_start, it->first);
+        merged_end = std::max(merged_end, it->first + it->second.length);
+    }
+
+    // Whole hugepages where they are mapped, fewer and larger registrations
+    // are found again by more requests; whole pages otherwise
+    const static uint64_t kHugePageSize = 2ull << 20;
+    const static uint64_t kPageSize = getpagesize();
+    uint64_t reg_start = 0, reg_end = 0;
+    int rc = -1;
+    for (uint64_t alignment : {kHugePageSize, kPageSize}) {
+        reg_start = merged_start / alignment * alignment;
+        reg_end = (merged_end + alignment - 1) / alignment * alignment;
+        rc = registerMemoryRange((void *)reg_start, reg_end - reg_start,
+                                 kWildcardLocation, false);
+        if (!rc) break;
+    }
+    if (rc) {
+        LOG(WARNING) << "RdmaTransport: Failed to register buffer " << addr
+                     << " on first use, error " << rc;
+        return false;
+    }
+    for (uint64_t entry : overlapping) retireRegistration(entry);
+    rcache_[reg_start] = {reg_end - reg_start, ++rcache_clock_};
+    rcache_bytes_ += reg_end - reg_start;
+    rcache_in_use_.store(true, std::memory_order_relaxed);
+    rcache_misses_.fetch_add(1, std::memory_order_relaxed);
+
+    // Least recently used registrations go beyond the limit, but not the
+    // one just made
+    while (rcache_bytes_ > kLimit && rcache_.size() > 1) {
+        auto victim = rcache_.end();
+        for (auto entry = rcache_.begin(); entry != rcache_.end(); ++entry) {
+            if (entry->first == reg_start) continue;
+            if (victim == rcache_.end() ||
+                entry->second.last_use < victim->second.last_use)
+                victim = entry;
+        }
+        retireRegistration(victim->first);
+        rcache_evictions_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+void RdmaTransport::retireRegistration(uint64_t addr) {
+    auto it = rcache_.find(addr);
+    if (it == rcache_.end()) return;
+    const size_t length = it->second.length;
+    metadata_->removeLocalMemoryBuffer((void *)addr, false, length);
+    rcache_retired_.push_back(
+        {(void *)addr, length, (uint64_t)getCurrentTimeInNano()});
+    rcache_bytes_ -= length;
+    rcache_.erase(it);
+}
+
+void RdmaTransport::reapRegistrations(bool all) {
+    // Slices are posted from the descriptor they found the buffer in, which
+    // may predate the retirement, and are retried for a while after that
+    const static uint64_t kGracePeriodNs = 30ull * 1000000000;
+    const uint64_t now = getCurrentTimeInNano();
+    auto it = rcache_retired_.begin();
+    while (it != rcache_retired_.end()) {
+        if (!all && now - it->retire_ts < kGracePeriodNs) {
+            ++it;
+            continue;
+        }
+        for (auto &context : context_list_)
+            context->unregisterMemoryRegion(it->addr, it->length);
+        it = rcache_retired_.erase(it);
+    }
+}
+
+bool RdmaTransport::invalidateRegistrations(uint64_t addr, size_t length) {
+    if (!rcache_in_use_.load(std::memory_order_relaxed)) return false;
+    std::lock_guard<std::mutex> lock(rcache_mutex_);
+    std::vector<uint64_t> overlapping;
+    auto it = rcache_.upper_bound(addr);
+    if (it != rcache_.begin() &&
+        std::prev(it)->first + std::prev(it)->second.length > addr)
+        --it;
+    for (; it != rcache_.end() && it->first < addr + length; ++it)
+        overlapping.push_back(it->first);
+    for (uint64_t entry : overlapping) retireRegistration(entry);
+    return !overlapping.empty();
+}
+
+bool RdmaTransport::stageRequest(SegmentDesc *desc,
+                                 const TransferRequest &request,
+                                 TransferTask &task) {
+#ifdef USE_CUDA
+    if (!globalConfig().staging_buffers || !request.length) return false;
+    if (desc && desc->findBuffer((uint64_t)request.source, request.length) >= 0)
+        return false;
+    if (!RdmaStaging::isDeviceMemory(request.source)) return false;
+    std::call_once(staging_once_, [this]() {
+        staging_ = std::make_unique<RdmaStaging>(*this);
+    });
+    staging_->submit(request, task);
+    return true;
+#else
+    return false;
+#endif
+}
+
 int RdmaTransport::allocateLocalSegmentID() {
     auto desc = std::make_shared<SegmentDesc>();
     if (!desc) return ERR_MEMORY;
@@ -141,6 +372,9 @@ int RdmaTransport::allocateLocalSegmentID() {
         device_desc.name = entry->deviceName();
         device_desc.lid = entry->lid();
         device_desc.gid = entry->gid();
+#ifdef USE_MLX5_DC
+        device_desc.dct_num = entry->dctNum();
+#endif
         desc->devices.push_back(device_desc);
     }
     desc->topology = *(local_topology_.get());
@@ -191,9 +425,44 @@ int RdmaTransport::unregisterLocalMemoryBatch(
     return metadata_->updateLocalSegmentDesc();
 }
 
+size_t RdmaTransport::sliceSize(const TransferRequest &request) const {
+    // Slices kept in flight per NIC by a large request
+    const static size_t kSlicesPerDevice = 8;
+    const static int kHdrSpeed = 64;  // IBV_SPEED_HDR
+    if (request.options.slice_size) return request.options.slice_size;
+    const size_t length = request.length;
+    auto &config = configSnapshot();
+    const size_t kMinSliceSize = config.slice_size;
+    size_t max_slice_size = config.max_slice_size;
+    if (max_slice_size <= kMinSliceSize || context_list_.empty())
+        return kMinSliceSize;
+
+    int max_speed = 0;
+    uint64_t pending_slice_count = 0;
+    for (auto &context : context_list_) {
+        max_speed = std::max(max_speed, context->activeSpeed());
+        pending_slice_count += context->pendingSliceCount();
+    }
+    // Per-slice overhead matters less below HDR links, unless the workers
+    // are backlogged, in which case fewer and larger slices catch up
+    const size_t kBacklog = globalConfig().max_wr *
+                            globalConfig().num_qp_per_ep *
+                            context_list_.size();
+    if (max_speed < kHdrSpeed && pending_slice_count < kBacklog)
+        max_slice_size = std::max(kMinSliceSize, max_slice_size / 2);
+
+    // Enough slices to spread the request over all NICs, in multiples of
+    // slice_size so that slices stay aligned
+    size_t slice_size = length / (context_list_.size() * kSlicesPerDevice);
+    slice_size = slice_size / kMinSliceSize * kMinSliceSize;
+    return std::clamp(slice_size, kMinSliceSize, max_slice_size);
+}
+
 Status RdmaTransport::submitTransfer(
     BatchID batch_id, const std::vector<TransferRequest> &entries) {
-    auto &batch_desc = *((BatchDesc *)(batch_id));
+    auto batch_desc_ptr = getBatchDesc(batch_id);
+    if (!batch_desc_ptr) return Status::InvalidArgument("Invalid batch ID");
+    auto &batch_desc = *batch_desc_ptr;
     if (batch_desc.task_list.size() + entries.size() > batch_desc.batch_size) {
         LOG(ERROR) << "RdmaTransport: Exceed the limitation of current batch's "
                       "capacity";
@@ -207,13 +476,22 @@ Status RdmaTransport::submitTransfer(
     size_t task_id = batch_desc.task_list.size();
     batch_desc.task_list.resize(task_id + entries.size());
     auto local_segment_desc = metadata_->getSegmentDescByID(LOCAL_SEGMENT_ID);
-    const size_t kBlockSize = globalConfig().slice_size;
-    const int kMaxRetryCount = globalConfig().retry_cnt;
+    auto &config = configSnapshot();
+    const int kMaxRetryCount = config.retry_cnt;
+    auto rail_bytes = railBytes();
 
     for (auto &request : entries) {
         TransferTask &task = batch_desc.task_list[task_id];
         ++task_id;
-        for (uint64_t offset = 0; offset < request.length;
+        if (stageRequest(local_segment_desc.get(), request, task)) continue;
+        if (cacheRegistration(local_segment_desc.get(), request.source,
+                              request.length))
+            local_segment_desc =
+                metadata_->getSegmentDescByID(LOCAL_SEGMENT_ID);
+        const size_t kBlockSize = sliceSize(request);
+        // A write with immediate of no data still takes a slice
+        for (uint64_t offset = 0; offset < request.length ||
+                                  (request.options.with_imm && offset == 0);
              offset += kBlockSize) {
             Slice *slice = getSliceCache().allocate();
             slice->source_addr = (char *)request.source + offset;
@@ -221,7 +499,13 @@ Status RdmaTransport::submitTransfer(
             slice->opcode = request.opcode;
             slice->rdma.dest_addr = request.target_offset + offset;
             slice->rdma.retry_cnt = 0;
-            slice->rdma.max_retry_cnt = kMaxRetryCount;
+            slice->rdma.max_retry_cnt = request.options.max_retry_cnt
+                                             ? request.options.max_retry_cnt
+                                             : kMaxRetryCount;
+            slice->rdma.traffic_class = request.traffic_class;
+            slice->rdma.with_imm = request.options.with_imm &&
+                                   offset + slice->length == request.length;
+            slice->rdma.imm_data = request.options.imm_data;
             slice->task = &task;
             slice->target_id = request.target_id;
             slice->ts = 0;
@@ -232,7 +516,8 @@ Status RdmaTransport::submitTransfer(
             while (retry_cnt < kMaxRetryCount) {
                 if (selectDevice(local_segment_desc.get(),
                                  (uint64_t)slice->source_addr, slice->length,
-                                 buffer_id, device_id, retry_cnt++))
+                                 rail_bytes, buffer_id, device_id,
+                                 retry_cnt++))
                     continue;
                 auto &context = context_list_[device_id];
                 if (!context->active()) continue;
@@ -269,17 +554,26 @@ Status RdmaTransport::submitTransferTask(
         slices_to_post;
     auto local_segment_desc = metadata_->getSegmentDescByID(LOCAL_SEGMENT_ID);
     assert(local_segment_desc.get());
-    const size_t kBlockSize = globalConfig().slice_size;
-    const int kMaxRetryCount = globalConfig().retry_cnt;
-    const size_t kFragmentSize = globalConfig().fragment_limit;
+    auto &config = configSnapshot();
+    const int kMaxRetryCount = config.retry_cnt;
+    const size_t kFragmentSize = config.fragment_limit;
     const size_t kSubmitWatermark = globalConfig().max_wr * globalConfig().num_qp_per_ep;
+    auto rail_bytes = railBytes();
     uint64_t nr_slices;
     for (size_t index = 0; index < request_list.size(); ++index) {
         assert(request_list[index] && task_list[index]);
         auto &request = *request_list[index];
         auto &task = *task_list[index];
+        if (stageRequest(local_segment_desc.get(), request, task)) continue;
+        if (cacheRegistration(local_segment_desc.get(), request.source,
+                              request.length))
+            local_segment_desc =
+                metadata_->getSegmentDescByID(LOCAL_SEGMENT_ID);
+        const size_t kBlockSize = sliceSize(request);
         nr_slices = 0;
-        for (uint64_t offset = 0; offset < request.length;
+        // A write with immediate of no data still takes a slice
+        for (uint64_t offset = 0; offset < request.length ||
+                                  (request.options.with_imm && offset == 0);
              offset += kBlockSize) {
             Slice *slice = getSliceCache().allocate();
             assert(slice);
@@ -294,7 +588,13 @@ Status RdmaTransport::submitTransferTask(
             slice->opcode = request.opcode;
             slice->rdma.dest_addr = request.target_offset + offset;
             slice->rdma.retry_cnt = request.advise_retry_cnt;
-            slice->rdma.max_retry_cnt = kMaxRetryCount;
+            slice->rdma.max_retry_cnt = request.options.max_retry_cnt
+                                             ? request.options.max_retry_cnt
+                                             : kMaxRetryCount;
+            slice->rdma.traffic_class = request.traffic_class;
+            slice->rdma.with_imm = request.options.with_imm &&
+                                   offset + slice->length == request.length;
+            slice->rdma.imm_data = request.options.imm_data;
             slice->task = &task;
             slice->target_id = request.target_id;
             slice->status = Slice::PENDING;
@@ -307,7 +607,8 @@ Status RdmaTransport::submitTransferTask(
             while (retry_cnt < kMaxRetryCount) {
                 if (selectDevice(local_segment_desc.get(),
                                  (uint64_t)slice->source_addr, slice->length,
-                                 buffer_id, device_id, retry_cnt++))
+                                 rail_bytes, buffer_id, device_id,
+                                 retry_cnt++))
                     continue;
                 assert(device_id >= 0 && device_id < context_list_.size());
                 auto &context = context_list_[device_id];
@@ -359,7 +660,9 @@ Status RdmaTransport::submitTransferTask(
 
 Status RdmaTransport::getTransferStatus(BatchID batch_id,
                                         std::vector<TransferStatus> &status) {
-    auto &batch_desc = *((BatchDesc *)(batch_id));
+    auto batch_desc_ptr = getBatchDesc(batch_id);
+    if (!batch_desc_ptr) return Status::InvalidArgument("Invalid batch ID");
+    auto &batch_desc = *batch_desc_ptr;
     const size_t task_count = batch_desc.task_list.size();
     status.resize(task_count);
     for (size_t task_id = 0; task_id < task_count; task_id++) {
@@ -382,7 +685,9 @@ Status RdmaTransport::getTransferStatus(BatchID batch_id,
 
 Status RdmaTransport::getTransferStatus(BatchID batch_id, size_t task_id,
                                         TransferStatus &status) {
-    auto &batch_desc = *((BatchDesc *)(batch_id));
+    auto batch_desc_ptr = getBatchDesc(batch_id);
+    if (!batch_desc_ptr) return Status::InvalidArgument("Invalid batch ID");
+    auto &batch_desc = *batch_desc_ptr;
     const size_t task_count = batch_desc.task_list.size();
     if (task_id >= task_count) {
         return Status::InvalidArgument(
@@ -410,6 +715,290 @@ RdmaTransport::SegmentID RdmaTransport::getSegmentID(
     return metadata_->getSegmentID(segment_name);
 }
 
+int RdmaTransport::warmupSegment(const std::string &segment_name) {
+    auto desc = metadata_->getSegmentDescByName(segment_name);
+    if (!desc) {
+        LOG(ERROR) << "Cannot get segment description of " << segment_name;
+        return ERR_INVALID_ARGUMENT;
+    }
+    if (desc->protocol != "rdma") return 0;
+    for (auto &context : context_list_) {
+        if (!context->active()) continue;
+        for (size_t device_id = 0; device_id < desc->devices.size();
+             ++device_id) {
+            int ret = context->connectEndpoint(
+                WorkerPool::peerNicID(*desc, device_id));
+            if (ret) return ret;
+        }
+    }
+    return 0;
+}
+
+int RdmaTransport::closeSegment(SegmentID segment_id) {
+    if (segment_id == LOCAL_SEGMENT_ID) return 0;
+    auto desc = metadata_->getSegmentDescByID(segment_id);
+    if (!desc || desc->protocol != "rdma") return 0;
+    for (auto &context : context_list_) {
+        for (size_t device_id = 0; device_id < desc->devices.size();
+             ++device_id)
+            context->releaseEndpoint(WorkerPool::peerNicID(*desc, device_id));
+    }
+    return 0;
+}
+
+void RdmaTransport::failoverSlices(RdmaContext *context,
+                                   std::vector<Slice *> &slice_list) {
+    auto local_segment_desc = metadata_->getSegmentDescByID(LOCAL_SEGMENT_ID);
+    if (!local_segment_desc || context_list_.size() < 2) return;
+    std::unordered_map<RdmaContext *, std::vector<Slice *>> slices_to_post;
+    std::vector<Slice *> remaining_slice_list;
+    for (auto &slice : slice_list) {
+        int buffer_id = local_segment_desc->findBuffer(
+            (uint64_t)slice->source_addr, slice->length);
+        int device_id = -1;
+        if (buffer_id >= 0) {
+            auto &lkey = local_segment_desc->buffers[buffer_id].lkey;
+            for (size_t id = 0; id < context_list_.size(); ++id) {
+                auto &candidate = context_list_[id];
+                if (candidate.get() == context || !candidate->active() ||
+                    id >= lkey.size())
+                    continue;
+                if (device_id < 0 || candidate->outstandingBytes() <
+                                         context_list_[device_id]
+                                             ->outstandingBytes())
+                    device_id = id;
+            }
+        }
+        if (device_id < 0) {
+            remaining_slice_list.push_back(slice);
+            continue;
+        }
+        slice->rdma.source_lkey =
+            local_segment_desc->buffers[buffer_id].lkey[device_id];
+        slices_to_post[context_list_[device_id].get()].push_back(slice);
+    }
+    for (auto &entry : slices_to_post)
+        entry.first->submitPostSend(entry.second);
+    slice_list.swap(remaining_slice_list);
+}
+
+// Prometheus label value, with quotes, backslashes and line breaks escaped
+static std::string metricLabel(std::string_view value) {
+    std::string label;
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            label += '\\';
+            label += c;
+        } else if (c == '\n') {
+            label += "\\n";
+        } else {
+            label += c;
+        }
+    }
+    return label;
+}
+
+static void appendMetricHeader(std::string &out, const char *name,
+                               const char *type, const char *help) {
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+static void appendMetricSample(std::string &out, const char *name,
+                               const std::string &labels, uint64_t value) {
+    out += name;
+    out += '{';
+    out += labels;
+    out += "} ";
+    out += std::to_string(value);
+    out += '\n';
+}
+
+void RdmaTransport::appendMetrics(std::string &out) {
+    struct DeviceMetrics {
+        std::string labels;
+        RdmaContext::TransferStats transfer;
+        RdmaContext::PostSendStats post_send;
+    };
+    std::vector<DeviceMetrics> devices;
+    for (auto &context : context_list_) {
+        devices.push_back({"device=\"" + metricLabel(context->deviceName()) +
+                               "\"",
+                           context->transferStats(),
+                           context->postSendStats()});
+    }
+    if (devices.empty()) return;
+
+    // One header per family, followed by the samples of every device
+    using Field = uint64_t (*)(const DeviceMetrics &);
+    auto append_family = [&](const char *name, const char *type,
+                             const char *help, Field field) {
+        appendMetricHeader(out, name, type, help);
+        for (auto &device : devices)
+            appendMetricSample(out, name, device.labels, field(device));
+    };
+    append_family(
+        "te_rdma_device_bytes_total", "counter",
+        "Bytes of the slices completed successfully on the device",
+        [](const DeviceMetrics &d) { return d.transfer.completions.bytes; });
+    append_family(
+        "te_rdma_device_completions_total", "counter",
+        "Slices completed successfully on the device",
+        [](const DeviceMetrics &d) { return d.transfer.completions.slices; });
+    append_family("te_rdma_device_failures_total", "counter",
+                  "Work requests completed with an error, flushes excluded",
+                  [](const DeviceMetrics &d) { return d.transfer.failures; });
+    append_family("te_rdma_device_retries_total", "counter",
+                  "Slices queued again after a failed completion",
+                  [](const DeviceMetrics &d) { return d.transfer.retries; });
+    append_family(
+        "te_rdma_device_redispatches_total", "counter",
+        "Slices routed to a device again after a failure",
+        [](const DeviceMetrics &d) { return d.transfer.redispatches; });
+    append_family(
+        "te_rdma_device_work_requests_total", "counter",
+        "Work requests posted to the device",
+        [](const DeviceMetrics &d) { return d.post_send.work_requests; });
+    append_family(
+        "te_rdma_device_doorbells_total", "counter",
+        "Doorbells rung on the device, one per post of a chain",
+        [](const DeviceMetrics &d) { return d.post_send.doorbells; });
+    append_family(
+        "te_rdma_device_outstanding_work_requests", "gauge",
+        "Work requests posted to the device and not completed yet",
+        [](const DeviceMetrics &d) {
+            return d.transfer.outstanding_work_requests;
+        });
+    append_family(
+        "te_rdma_endpoint_cache_hits_total", "counter",
+        "Endpoint lookups served by the endpoint store",
+        [](const DeviceMetrics &d) { return d.transfer.endpoint_hits; });
+    append_family(
+        "te_rdma_endpoint_cache_misses_total", "counter",
+        "Endpoint lookups which created an endpoint",
+        [](const DeviceMetrics &d) { return d.transfer.endpoint_misses; });
+    append_family(
+        "te_rdma_endpoint_reconnects_total", "counter",
+        "Endpoints created again for a peer NIC that had one before",
+        [](const DeviceMetrics &d) { return d.transfer.endpoint_reconnects; });
+    append_family(
+        "te_rdma_endpoint_capacity", "gauge",
+        "Endpoints the device holds at most",
+        [](const DeviceMetrics &d) { return d.transfer.endpoint_capacity; });
+
+    const char *kLatency = "te_rdma_completion_latency_microseconds";
+    appendMetricHeader(out, kLatency, "histogram",
+                       "Time from posting a slice to polling its completion");
+    const std::string bucket_name = std::string(kLatency) + "_bucket";
+    for (auto &device : devices) {
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < RdmaContext::kLatencyBucketCount; ++i) {
+            cumulative += device.transfer.latency_buckets[i];
+            std::string le =
+                i < std::size(RdmaContext::kLatencyBucketsUs)
+                    ? std::to_string(RdmaContext::kLatencyBucketsUs[i])
+                    : std::string("+Inf");
+            appendMetricSample(out, bucket_name.c_str(),
+                               device.labels + ",le=\"" + le + "\"",
+                               cumulative);
+        }
+        out += std::string(kLatency) + "_sum{" + device.labels + "} " +
+               std::to_string(device.transfer.completions.latency_ns / 1000) +
+               '\n';
+        out += std::string(kLatency) + "_count{" + device.labels + "} " +
+               std::to_string(cumulative) + '\n';
+    }
+
+    // Peers are keyed by segment ID, named through the cached descriptors
+    std::unordered_map<SegmentID, std::string> segment_names;
+    for (auto &device : devices) {
+        for (auto &peer : device.transfer.peers) {
+            if (segment_names.count(peer.first)) continue;
+            auto desc = metadata_->getSegmentDescByID(peer.first);
+            segment_names[peer.first] =
+                desc ? metricLabel(desc->name) : std::to_string(peer.first);
+        }
+    }
+    const char *kPeerBytes = "te_rdma_peer_bytes_total";
+    const char *kPeerSlices = "te_rdma_peer_completions_total";
+    appendMetricHeader(out, kPeerBytes, "counter",
+                       "Bytes completed successfully with a peer segment");
+    for (auto &device : devices) {
+        for (auto &peer : device.transfer.peers)
+            appendMetricSample(out, kPeerBytes,
+                               device.labels + ",segment=\"" +
+                                   segment_names[peer.first] + "\"",
+                               peer.second.bytes);
+    }
+    appendMetricHeader(out, kPeerSlices, "counter",
+                       "Slices completed successfully with a peer segment");
+    for (auto &device : devices) {
+        for (auto &peer : device.transfer.peers)
+            appendMetricSample(out, kPeerSlices,
+                               device.labels + ",segment=\"" +
+                                   segment_names[peer.first] + "\"",
+                               peer.second.slices);
+    }
+
+    if (!globalConfig().rcache_size) return;
+    size_t rcache_bytes;
+    {
+        std::lock_guard<std::mutex> lock(rcache_mutex_);
+        rcache_bytes = rcache_bytes_;
+    }
+    auto append_value = [&](const char *name, const char *type,
+                            const char *help, uint64_t value) {
+        appendMetricHeader(out, name, type, help);
+        out += name;
+        out += ' ';
+        out += std::to_string(value);
+        out += '\n';
+    };
+    append_value("te_rdma_rcache_hits_total", "counter",
+                 "Requests from buffers registered on first use before",
+                 rcache_hits_.load(std::memory_order_relaxed));
+    append_value("te_rdma_rcache_misses_total", "counter",
+                 "Unregistered buffers registered on first use",
+                 rcache_misses_.load(std::memory_order_relaxed));
+    append_value("te_rdma_rcache_evictions_total", "counter",
+                 "Registrations made on first use evicted beyond the limit",
+                 rcache_evictions_.load(std::memory_order_relaxed));
+    append_value("te_rdma_rcache_bytes", "gauge",
+                 "Bytes of the registrations made on first use",
+                 rcache_bytes);
+    if (incast_control_) incast_control_->appendMetrics(out);
+}
+
+void RdmaTransport::pushImmNotify(const std::string &segment_name,
+                                  uint32_t imm_data) {
+    auto queued = new QueuedImmNotify{{segment_name, imm_data}, nullptr};
+    queued->next = imm_notifies_.load(std::memory_order_relaxed);
+    while (!imm_notifies_.compare_exchange_weak(queued->next, queued,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed))
+        ;
+}
+
+void RdmaTransport::popImmNotifies(std::vector<ImmNotify> &notifies) {
+    auto queued = imm_notifies_.exchange(nullptr, std::memory_order_acquire);
+    // Newest first, appended in reverse
+    size_t first = notifies.size();
+    while (queued) {
+        auto next = queued->next;
+        notifies.push_back(std::move(queued->notify));
+        delete queued;
+        queued = next;
+    }
+    std::reverse(notifies.begin() + first, notifies.end());
+}
+
 int RdmaTransport::onSetupRdmaConnections(const HandShakeDesc &peer_desc,
                                           HandShakeDesc &local_desc) {
     auto local_nic_name = getNicNameFromNicPath(peer_desc.peer_nic_path);
@@ -436,24 +1025,39 @@ int RdmaTransport::onSetupRdmaConnections(const HandShakeDesc &peer_desc,
 
 int RdmaTransport::initializeRdmaResources() {
     auto hca_list = local_topology_->getHcaList();
+    // Opening a device, picking its GID and creating its CQs and workers
+    // take long enough to be done on all devices at once
+    std::vector<std::shared_ptr<RdmaContext>> contexts;
+    std::vector<std::future<int>> results;
+    // Copied, as each device lowers the limits of the global config to its
+    // own while the others are opened
+    const GlobalConfig config = globalConfig();
     for (auto &device_name : hca_list) {
         auto context = std::make_shared<RdmaContext>(*this, device_name);
-        auto &config = globalConfig();
-        int ret = context->construct(config.num_cq_per_ctx,
-                                     config.num_comp_channels_per_ctx,
-                                     config.port, config.gid_index,
-                                     config.max_cqe, config.max_ep_per_ctx);
-        if (ret) {
-            local_topology_->disableDevice(device_name);
-            LOG(WARNING) << "Disable device " << device_name;
+        contexts.push_back(context);
+        results.emplace_back(
+            std::async(std::launch::async, [context, &config]() -> int {
+                return context->construct(
+                    config.num_cq_per_ctx, config.num_comp_channels_per_ctx,
+                    config.port, config.gid_index, config.max_cqe,
+                    config.max_ep_per_ctx);
+            }));
+    }
+    for (size_t i = 0; i < hca_list.size(); ++i) {
+        if (results[i].get()) {
+            local_topology_->disableDevice(hca_list[i]);
+            LOG(WARNING) << "Disable device " << hca_list[i];
         } else {
-            context_list_.push_back(context);
+            context_list_.push_back(contexts[i]);
         }
     }
     if (local_topology_->empty()) {
         LOG(ERROR) << "RdmaTransport: No available RNIC";
         return ERR_DEVICE_NOT_FOUND;
     }
+    // The HCA list is final now, contexts are indexed like it
+    for (size_t i = 0; i < context_list_.size(); ++i)
+        context_list_[i]->setHealth(local_topology_->deviceHealth(i));
     return 0;
 }
 
@@ -470,24 +1074,18 @@ int RdmaTransport::startHandshakeDaemon(std::string &local_server_name) {
 int RdmaTransport::selectDevice(SegmentDesc *desc, uint64_t offset, size_t length,
                                 std::string_view hint, int &buffer_id, int &device_id, int retry_count) {
     if (desc == nullptr) return ERR_ADDRESS_NOT_REGISTERED;
-    const auto &buffers = desc->buffers;
-    for (buffer_id = 0; buffer_id < static_cast<int>(buffers.size()); ++buffer_id) {
-        const auto &buffer = buffers[buffer_id];
-
-        // Check if offset is within buffer range
-        if (offset < buffer.addr || length > buffer.length || offset - buffer.addr > buffer.length - length) {
-            continue;
-        }
+    buffer_id = desc->findBuffer(offset, length);
+    if (buffer_id < 0) return ERR_ADDRESS_NOT_REGISTERED;
+    const auto &buffer = desc->buffers[buffer_id];
 
-        device_id = hint.empty()
-            ? desc->topology.selectDevice(buffer.name, retry_count)
-            : desc->topology.selectDevice(buffer.name, hint, retry_count);
-        if (device_id >= 0) return 0;
-        device_id = hint.empty()
-            ? desc->topology.selectDevice(kWildcardLocation, retry_count)
-            : desc->topology.selectDevice(kWildcardLocation, hint, retry_count);
-        if (device_id >= 0) return 0;
-    }
+    device_id = hint.empty()
+        ? desc->topology.selectDevice(buffer.name, retry_count)
+        : desc->topology.selectDevice(buffer.name, hint, retry_count);
+    if (device_id >= 0) return 0;
+    device_id = hint.empty()
+        ? desc->topology.selectDevice(kWildcardLocation, retry_count)
+        : desc->topology.selectDevice(kWildcardLocation, hint, retry_count);
+    if (device_id >= 0) return 0;
     return ERR_ADDRESS_NOT_REGISTERED;
 }
 
@@ -495,5 +1093,49 @@ int RdmaTransport::selectDevice(SegmentDesc *desc, uint64_t offset, size_t lengt
                                 int &buffer_id, int &device_id, int retry_count) {
     return selectDevice(desc, offset, length, "", buffer_id, device_id, retry_count);
 }
+
+std::vector<uint64_t> RdmaTransport::railBytes() const {
+    std::vector<uint64_t> rail_bytes;
+    if (!globalConfig().enable_multi_rail) return rail_bytes;
+    rail_bytes.reserve(context_list_.size());
+    for (auto &context : context_list_)
+        rail_bytes.push_back(context->outstandingBytes());
+    return rail_bytes;
+}
+
+int RdmaTransport::selectDevice(SegmentDesc *desc, uint64_t offset,
+                                size_t length,
+                                std::vector<uint64_t> &rail_bytes,
+                                int &buffer_id, int &device_id,
+                                int retry_count) {
+    if (rail_bytes.empty() || retry_count)
+        return selectDevice(desc, offset, length, buffer_id, device_id,
+                            retry_count);
+    if (desc == nullptr) return ERR_ADDRESS_NOT_REGISTERED;
+    buffer_id = desc->findBuffer(offset, length);
+    if (buffer_id < 0) return ERR_ADDRESS_NOT_REGISTERED;
+    const auto &buffer = desc->buffers[buffer_id];
+
+    // The active preferred device with the fewest outstanding bytes
+    auto devices = desc->topology.preferredDevices(buffer.name);
+    if (!devices || devices->empty())
+        devices = desc->topology.preferredDevices(kWildcardLocation);
+    if (devices) {
+        device_id = -1;
+        for (int id : *devices) {
+            if (id < 0 || id >= (int)rail_bytes.size() ||
+                !context_list_[id]->active())
+                continue;
+            if (device_id < 0 || rail_bytes[id] < rail_bytes[device_id])
+                device_id = id;
+        }
+        if (device_id >= 0) {
+            rail_bytes[device_id] += length;
+            return 0;
+        }
+    }
+    // Let the retries pick from all devices
+    return selectDevice(desc, offset, length, buffer_id, device_id, 1);
+}
 }  // namespace mooncake
 
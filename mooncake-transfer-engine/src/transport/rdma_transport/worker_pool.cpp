@@ -15,13 +15,21 @@
 #include "transport/rdma_transport/worker_pool.h"
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <mutex>
 
 #include "config.h"
+#include "flight_recorder.h"
+#include "rate_limiter.h"
 #include "transport/rdma_transport/rdma_context.h"
 #include "transport/rdma_transport/rdma_endpoint.h"
 #include "transport/rdma_transport/rdma_transport.h"
+#include "tracepoint.h"
 
 // Experimental: Per-thread SegmentDesc & EndPoint Caches
 // #define CONFIG_CACHE_SEGMENT_DESC
@@ -29,34 +37,243 @@
 
 namespace mooncake {
 
-const static int kTransferWorkerCount = globalConfig().workers_per_ctx;
+namespace {
 
-WorkerPool::WorkerPool(RdmaContext &context, int numa_socket_id)
+// Transfer workers pinned on each NUMA node so far, so that the workers of
+// the devices sharing a node are pinned to different cores
+std::mutex pinned_mutex;
+std::unordered_map<int, size_t> pinned_count;
+
+std::vector<int> localCores(int socket_id) {
+    std::vector<int> cores;
+    if (numa_available() < 0) return cores;
+    if (socket_id < 0 || socket_id >= numa_num_configured_nodes())
+        socket_id = 0;
+    const auto &reserved = globalConfig().reserved_cpus;
+    struct bitmask *cpu_list = numa_allocate_cpumask();
+    numa_node_to_cpus(socket_id, cpu_list);
+    int nr_possible_cpus = numa_num_possible_cpus();
+    for (int cpu = 0; cpu < nr_possible_cpus && cpu < CPU_SETSIZE; ++cpu) {
+        if (numa_bitmask_isbitset(cpu_list, cpu) &&
+            numa_bitmask_isbitset(numa_all_cpus_ptr, cpu) &&
+            std::find(reserved.begin(), reserved.end(), cpu) ==
+                reserved.end())
+            cores.push_back(cpu);
+    }
+    numa_free_cpumask(cpu_list);
+    return cores;
+}
+
+}  // namespace
+
+WorkerPool::WorkerPool(RdmaContext &context, int numa_socket_id,
+                       int worker_count)
     : context_(context),
       numa_socket_id_(numa_socket_id),
+      worker_count_(worker_count > 0 ? worker_count
+                                     : globalConfig().workers_per_ctx),
       workers_running_(true),
       suspended_flag_(0),
-      redispatch_counter_(0),
       submitted_slice_count_(0),
       processed_slice_count_(0) {
-    for (int i = 0; i < kShardCount; ++i)
-        slice_queue_count_[i].store(0, std::memory_order_relaxed);
-    collective_slice_queue_.resize(kTransferWorkerCount);
-    for (int i = 0; i < kTransferWorkerCount; ++i)
+    for (auto &class_queue : slice_queue_)
+        for (auto &queue : class_queue)
+            queue.store(nullptr, std::memory_order_relaxed);
+    if (globalConfig().auto_tune_workers ||
+        !globalConfig().reserved_cpus.empty())
+        local_cores_ = localCores(numa_socket_id_);
+    // Spread from the last cores of the node, as applications tend to take
+    // the first ones
+    if (globalConfig().auto_tune_workers && !local_cores_.empty()) {
+        std::lock_guard<std::mutex> lock(pinned_mutex);
+        auto &count = pinned_count[numa_socket_id_];
+        for (int i = 0; i < worker_count_; ++i, ++count)
+            worker_cores_.push_back(
+                local_cores_[local_cores_.size() - 1 -
+                             count % local_cores_.size()]);
+    }
+    collective_slice_queue_.resize(worker_count_);
+    class_deficit_.resize(worker_count_);
+    if (globalConfig().adaptive_poll_us) {
+        worker_events_.reset(new WorkerEvents[worker_count_]);
+        for (int i = 0; i < worker_count_; ++i) {
+            if (setupWorkerEvents(i)) {
+                LOG(WARNING) << "Worker: Adaptive polling disabled for "
+                             << context_.deviceName();
+                for (int j = 0; j <= i; ++j) {
+                    if (worker_events_[j].epoll_fd >= 0)
+                        close(worker_events_[j].epoll_fd);
+                    if (worker_events_[j].wake_fd >= 0)
+                        close(worker_events_[j].wake_fd);
+                }
+                worker_events_.reset();
+                break;
+            }
+        }
+    }
+    for (int i = 0; i < worker_count_; ++i)
         worker_thread_.emplace_back(
             std::thread(std::bind(&WorkerPool::transferWorker, this, i)));
     worker_thread_.emplace_back(
         std::thread(std::bind(&WorkerPool::monitorWorker, this)));
+    for (int i = 0; i < globalConfig().connect_workers_per_ctx; ++i)
+        connect_thread_.emplace_back(
+            std::thread(std::bind(&WorkerPool::connectWorker, this)));
 }
 
 WorkerPool::~WorkerPool() {
     if (workers_running_) {
         cond_var_.notify_all();
-        workers_running_.store(false);
+        {
+            std::lock_guard<std::mutex> lock(connect_mutex_);
+            workers_running_.store(false);
+        }
+        connect_cv_.notify_all();
+        if (worker_events_) {
+            for (int i = 0; i < worker_count_; ++i) {
+                uint64_t value = 1;
+                if (write(worker_events_[i].wake_fd, &value, sizeof(value)) <
+                    0)
+                    PLOG(WARNING) << "Worker: Failed to wake up worker " << i;
+            }
+        }
         for (auto &entry : worker_thread_) entry.join();
+        for (auto &entry : connect_thread_) entry.join();
+    }
+    if (worker_events_) {
+        for (int i = 0; i < worker_count_; ++i) {
+            close(worker_events_[i].epoll_fd);
+            close(worker_events_[i].wake_fd);
+        }
+    }
+}
+
+int WorkerPool::setupWorkerEvents(int thread_id) {
+    auto &events = worker_events_[thread_id];
+    events.epoll_fd = epoll_create1(0);
+    if (events.epoll_fd < 0) {
+        PLOG(ERROR) << "Worker: Failed to create epoll";
+        return ERR_CONTEXT;
+    }
+    events.wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (events.wake_fd < 0) {
+        PLOG(ERROR) << "Worker: Failed to create eventfd";
+        return ERR_CONTEXT;
+    }
+    epoll_event event;
+    memset(&event, 0, sizeof(epoll_event));
+    event.events = EPOLLIN;
+    event.data.fd = events.wake_fd;
+    if (epoll_ctl(events.epoll_fd, EPOLL_CTL_ADD, events.wake_fd, &event)) {
+        PLOG(ERROR) << "Worker: Failed to register eventfd to epoll";
+        return ERR_CONTEXT;
+    }
+    // CQs may share a channel, which is nonblocking already as the context
+    // watches it too
+    for (int cq_index = thread_id; cq_index < context_.cqCount();
+         cq_index += worker_count_) {
+        auto channel = context_.nativeCq(cq_index)->channel;
+        if (!channel) {
+            LOG(ERROR) << "Worker: CQ " << cq_index
+                       << " has no completion channel";
+            return ERR_CONTEXT;
+        }
+        if (std::find(events.channels.begin(), events.channels.end(),
+                      channel) != events.channels.end())
+            continue;
+        events.channels.push_back(channel);
+        event.data.fd = channel->fd;
+        if (epoll_ctl(events.epoll_fd, EPOLL_CTL_ADD, channel->fd, &event)) {
+            PLOG(ERROR) << "Worker: Failed to register completion channel "
+                           "to epoll";
+            return ERR_CONTEXT;
+        }
+    }
+    return 0;
+}
+
+void WorkerPool::bindThread(int thread_id) {
+    std::vector<int> cores;
+    if (thread_id >= 0 && thread_id < (int)worker_cores_.size())
+        cores.push_back(worker_cores_[thread_id]);
+    else
+        cores = local_cores_;
+    if (cores.empty()) {
+        bindToSocket(numa_socket_id_);
+        return;
+    }
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (int cpu : cores) CPU_SET(cpu, &cpu_set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpu_set))
+        LOG(WARNING) << "Worker: Failed to bind thread to its cores";
+}
+
+void WorkerPool::connectAsync(const std::shared_ptr<RdmaEndPoint> &endpoint) {
+    if (endpoint->connected() || !endpoint->startConnecting()) return;
+    {
+        std::lock_guard<std::mutex> lock(connect_mutex_);
+        connect_queue_.push_back(endpoint);
+    }
+    connect_cv_.notify_one();
+}
+
+void WorkerPool::connectWorker() {
+    bindThread(-1);
+    while (true) {
+        std::shared_ptr<RdmaEndPoint> endpoint;
+        {
+            std::unique_lock<std::mutex> lock(connect_mutex_);
+            connect_cv_.wait(lock, [this] {
+                return !workers_running_.load(std::memory_order_relaxed) ||
+                       !connect_queue_.empty();
+            });
+            if (!workers_running_.load(std::memory_order_relaxed)) return;
+            endpoint = std::move(connect_queue_.front());
+            connect_queue_.pop_front();
+        }
+        if (!endpoint->active() || endpoint->connected()) {
+            endpoint->finishConnecting();
+            continue;
+        }
+        const int64_t connect_ts = getCurrentTimeInNano();
+        const int rc = endpoint->setupConnectionsByActive();
+        if (!rc) endpoint->recordConnect(getCurrentTimeInNano() - connect_ts);
+        {
+            const std::string peer = endpoint->peerNicPath();
+            const int64_t latency_us =
+                (getCurrentTimeInNano() - connect_ts) / 1000;
+            MC_TRACE(rdma_connect, context_.deviceName().c_str(),
+                     peer.c_str(), latency_us, rc);
+            FlightRecorder::record(FlightEvent::kEndpoint, InternNicPath(peer),
+                                   rc == 0, rc == 0 ? latency_us : rc);
+        }
+        if (rc) {
+            LOG(ERROR) << "Worker: Cannot make connection for endpoint: "
+                       << endpoint->toString() << ", mark it inactive";
+            // Queued slices see the endpoint inactive and are redispatched
+            endpoint->set_active(false);
+            failed_nr_polls++;
+            if (context_.active() && failed_nr_polls > 32 &&
+                !success_nr_polls) {
+                LOG(WARNING)
+                    << "Failed to establish peer endpoints in local RNIC "
+                    << context_.nicPath() << ", mark it inactive";
+                context_.set_active(false);
+            }
+        }
+        endpoint->finishConnecting();
     }
 }
 
+NicPathID WorkerPool::peerNicID(const Transport::SegmentDesc &segment_desc,
+                                int device_id) {
+    auto &device = segment_desc.devices[device_id];
+    // Interned when the descriptor was decoded, unless it was built locally
+    if (device.nic_path_id != kInvalidNicPathID) return device.nic_path_id;
+    return InternNicPath(MakeNicPath(segment_desc.name, device.name));
+}
+
 int WorkerPool::submitPostSend(
     const std::vector<Transport::Slice *> &slice_list) {
 #ifdef CONFIG_CACHE_SEGMENT_DESC
@@ -95,8 +312,11 @@ int WorkerPool::submitPostSend(
     }
 #endif  // CONFIG_CACHE_SEGMENT_DESC
 
-    SliceList slice_list_map[kShardCount];
-    uint64_t submitted_slice_count = 0;
+    // Chains to push to each shard, newest slice first
+    Transport::Slice *chain_head[kTrafficClassCount][kShardCount] = {};
+    Transport::Slice *chain_tail[kTrafficClassCount][kShardCount] = {};
+    uint64_t submitted_slice_count = 0, submitted_bytes = 0;
+    const uint64_t submit_ts = getCurrentTimeInNano();
     thread_local std::unordered_map<int, uint64_t> failed_target_ids;
     for (auto &slice : slice_list) {
         if (failed_target_ids.count(slice->target_id)) {
@@ -140,65 +360,91 @@ int WorkerPool::submitPostSend(
         }
         slice->rdma.dest_rkey =
             peer_segment_desc->buffers[buffer_id].rkey[device_id];
-        auto peer_nic_path =
-            MakeNicPath(peer_segment_desc->name,
-                        peer_segment_desc->devices[device_id].name);
-        slice->peer_nic_path = peer_nic_path;
+        slice->peer_nic_id = peerNicID(*peer_segment_desc, device_id);
+        slice->rdma.submit_ts = submit_ts;
         int shard_id = (slice->target_id * 10007 + device_id) % kShardCount;
-        slice_list_map[shard_id].push_back(slice);
+        auto &head = chain_head[slice->rdma.traffic_class][shard_id];
+        auto &tail = chain_tail[slice->rdma.traffic_class][shard_id];
+        slice->next_queued = head;
+        head = slice;
+        if (!tail) tail = slice;
         submitted_slice_count++;
+        submitted_bytes += slice->length;
     }
 
-    for (int shard_id = 0; shard_id < kShardCount; ++shard_id) {
-        if (slice_list_map[shard_id].empty()) continue;
-        slice_queue_lock_[shard_id].lock();
-        for (auto &slice : slice_list_map[shard_id])
-            slice_queue_[shard_id][slice->peer_nic_path].push_back(slice);
-        slice_queue_count_[shard_id].fetch_add(slice_list_map[shard_id].size(),
-                                               std::memory_order_relaxed);
-        slice_queue_lock_[shard_id].unlock();
+    for (int traffic_class = 0; traffic_class < kTrafficClassCount;
+         ++traffic_class) {
+        for (int shard_id = 0; shard_id < kShardCount; ++shard_id) {
+            auto chain = chain_head[traffic_class][shard_id];
+            if (!chain) continue;
+            auto &queue = slice_queue_[traffic_class][shard_id];
+            auto head = queue.load(std::memory_order_relaxed);
+            do {
+                chain_tail[traffic_class][shard_id]->next_queued = head;
+            } while (!queue.compare_exchange_weak(head, chain,
+                                                  std::memory_order_release,
+                                                  std::memory_order_relaxed));
+        }
     }
 
+    MC_TRACE(rdma_submit, submitted_slice_count, submitted_bytes,
+             context_.deviceName().c_str());
+    if (!slice_list.empty())
+        FlightRecorder::record(FlightEvent::kSubmit,
+                               slice_list.front()->task->batch_id,
+                               submitted_slice_count, submitted_bytes);
+    submitted_bytes_.fetch_add(submitted_bytes, std::memory_order_relaxed);
     submitted_slice_count_.fetch_add(submitted_slice_count,
                                      std::memory_order_relaxed);
     if (suspended_flag_.load(std::memory_order_relaxed)) cond_var_.notify_all();
+    if (worker_events_) {
+        // Pairs with the fence of waitForEvents: either the worker sees the
+        // slices before sleeping, or it is seen sleeping here
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for (int i = 0; i < worker_count_; ++i) {
+            auto &events = worker_events_[i];
+            if (!events.sleeping.load(std::memory_order_relaxed)) continue;
+            uint64_t value = 1;
+            if (write(events.wake_fd, &value, sizeof(value)) < 0)
+                PLOG(WARNING) << "Worker: Failed to wake up worker " << i;
+        }
+    }
 
     return 0;
 }
 
 void WorkerPool::performPostSend(int thread_id) {
     auto &local_slice_queue = collective_slice_queue_[thread_id];
-    for (int shard_id = thread_id; shard_id < kShardCount;
-         shard_id += kTransferWorkerCount) {
-        if (slice_queue_count_[shard_id].load(std::memory_order_relaxed) == 0)
-            continue;
+    for (int traffic_class = 0; traffic_class < kTrafficClassCount;
+         ++traffic_class) {
+        for (int shard_id = thread_id; shard_id < kShardCount;
+             shard_id += worker_count_) {
+            auto &queue = slice_queue_[traffic_class][shard_id];
+            if (!queue.load(std::memory_order_relaxed)) continue;
 
-        slice_queue_lock_[shard_id].lock();
-        for (auto &entry : slice_queue_[shard_id]) {
-            for (auto &slice : entry.second)
-                local_slice_queue[entry.first].push_back(slice);
-            entry.second.clear();
+            // Reverse the stack to post the slices in submission order
+            auto slice = queue.exchange(nullptr, std::memory_order_acquire);
+            Transport::Slice *oldest = nullptr;
+            while (slice) {
+                auto next = slice->next_queued;
+                slice->next_queued = oldest;
+                oldest = slice;
+                slice = next;
+            }
+            for (slice = oldest; slice; slice = slice->next_queued)
+                local_slice_queue[traffic_class][slice->peer_nic_id]
+                    .push_back(slice);
         }
-        slice_queue_count_[shard_id].store(0, std::memory_order_relaxed);
-        slice_queue_lock_[shard_id].unlock();
     }
 
-    // Redispatch slices to other endpoints, for temporary failures
-    thread_local int tl_redispatch_counter = 0;
-    if (tl_redispatch_counter <
-        redispatch_counter_.load(std::memory_order_relaxed)) {
-        tl_redispatch_counter =
-            redispatch_counter_.load(std::memory_order_relaxed);
-        auto local_slice_queue_clone = local_slice_queue;
-        local_slice_queue.clear();
-        for (auto &entry : local_slice_queue_clone)
-            redispatch(entry.second, thread_id);
-        return;
-    }
+    postQueuedSlices(thread_id);
+}
 
+void WorkerPool::postQueuedSlices(int thread_id) {
+    auto &local_slice_queue = collective_slice_queue_[thread_id];
 #ifdef CONFIG_CACHE_ENDPOINT
     thread_local uint64_t tl_last_cache_ts = getCurrentTimeInNano();
-    thread_local std::unordered_map<std::string, std::shared_ptr<RdmaEndPoint>>
+    thread_local std::unordered_map<NicPathID, std::shared_ptr<RdmaEndPoint>>
         endpoint_map;
     uint64_t current_ts = getCurrentTimeInNano();
     if (current_ts - tl_last_cache_ts > 1000000000) {
@@ -207,81 +453,329 @@ void WorkerPool::performPostSend(int thread_id) {
     }
 #endif
 
-    SliceList failed_slice_list;
-    for (auto &entry : local_slice_queue) {
-        if (entry.second.empty()) continue;
+    struct ReadyQueue {
+        std::shared_ptr<RdmaEndPoint> endpoint;
+        SliceList *slices;
+        // Rate limit buckets charged for the slices, nullptr if none
+        const std::vector<TokenBucket *> *buckets;
+        // Credits of the peer writes wait for, nullptr if they do not
+        IncastControl::PeerCredit *credit;
+    };
+    thread_local std::vector<ReadyQueue> tl_ready_queues[kTrafficClassCount];
+    // Buckets of each peer NIC, matched again when the rate limits change
+    auto &rate_limits = RateLimiter::rules();
+    thread_local const RateLimiter::RuleSet *tl_rate_limits = nullptr;
+    thread_local std::unordered_map<NicPathID, std::vector<TokenBucket *>>
+        tl_buckets[kTrafficClassCount];
+    if (tl_rate_limits != &rate_limits) {
+        for (auto &buckets : tl_buckets) buckets.clear();
+        tl_rate_limits = &rate_limits;
+    }
+    auto incast_control = context_.engine().incastControl();
+    thread_local std::unordered_map<NicPathID, IncastControl::PeerCredit *>
+        tl_credits;
+    // Queued slices of canceled and timed out batches are looked for at
+    // most every millisecond
+    const static uint64_t kSweepPeriodInNano = 1000000;
+    thread_local uint64_t tl_last_sweep_ts = 0;
+    bool sweep = false;
+    if (Transport::hasAbortableBatches()) {
+        uint64_t current_ts = getCurrentTimeInNano();
+        if (current_ts - tl_last_sweep_ts > kSweepPeriodInNano) {
+            sweep = true;
+            tl_last_sweep_ts = current_ts;
+        }
+    }
+    SliceList failed_slice_list, rerouted_slice_list;
+    // Backoff each peer NIC's queued slices were last rerouted for. They
+    // are rerouted once as the NIC enters backoff, and those with nowhere
+    // else to go wait it out.
+    thread_local std::unordered_map<NicPathID, uint64_t> tl_rerouted;
+    for (int traffic_class = 0; traffic_class < kTrafficClassCount;
+         ++traffic_class) {
+        for (auto &entry : local_slice_queue[traffic_class]) {
+            if (sweep) dropAbortedSlices(entry.second);
+            if (entry.second.empty()) continue;
+            uint64_t until_ts = backoffUntil(entry.first);
+            if (until_ts) {
+                auto &rerouted_ts = tl_rerouted[entry.first];
+                if (rerouted_ts != until_ts) {
+                    rerouted_ts = until_ts;
+                    rerouted_slice_list.insert(rerouted_slice_list.end(),
+                                               entry.second.begin(),
+                                               entry.second.end());
+                    entry.second.clear();
+                }
+                continue;
+            }
+            if (!tl_rerouted.empty()) tl_rerouted.erase(entry.first);
 
 #ifdef USE_FAKE_POST_SEND
-        for (auto &slice : entry.second) slice->markSuccess();
-        processed_slice_count_.fetch_add(entry.second.size());
-        entry.second.clear();
+            for (auto &slice : entry.second) {
+                processed_bytes_.fetch_add(slice->length);
+                slice->markSuccess();
+            }
+            processed_slice_count_.fetch_add(entry.second.size());
+            entry.second.clear();
 #else
 #ifdef CONFIG_CACHE_ENDPOINT
-        auto &endpoint = endpoint_map[entry.first];
-        if (endpoint == nullptr || !endpoint->active())
-            endpoint = context_.endpoint(entry.first);
+            auto &endpoint = endpoint_map[entry.first];
+            if (endpoint == nullptr || !endpoint->active())
+                endpoint = context_.endpoint(entry.first);
 #else
-        auto endpoint = context_.endpoint(entry.first);
+            auto endpoint = context_.endpoint(entry.first);
+#endif
+            if (!endpoint) {
+                for (auto &slice : entry.second)
+                    failed_slice_list.push_back(slice);
+                entry.second.clear();
+                continue;
+            }
+            if (!endpoint->active()) {
+                if (endpoint->inactiveTime() > 1.0)
+                    context_.deleteEndpoint(
+                        entry.first);  // enable for re-establishation
+                for (auto &slice : entry.second)
+                    failed_slice_list.push_back(slice);
+                entry.second.clear();
+                continue;
+            }
+            if (!endpoint->connected()) {
+                // Keep the slices queued here while a connect worker does
+                // the handshake, other peers of this worker are not held up
+                connectAsync(endpoint);
+                continue;
+            }
+            const std::vector<TokenBucket *> *buckets = nullptr;
+            if (!rate_limits.rules.empty()) {
+                auto &class_buckets = tl_buckets[traffic_class];
+                auto it = class_buckets.find(entry.first);
+                if (it == class_buckets.end())
+                    it = class_buckets
+                             .emplace(entry.first,
+                                      rate_limits.match(
+                                          getServerNameFromNicPath(
+                                              NicPathOf(entry.first)),
+                                          context_.deviceName(),
+                                          traffic_class))
+                             .first;
+                if (!it->second.empty()) buckets = &it->second;
+            }
+            // Latency-critical slices do not wait for credits
+            IncastControl::PeerCredit *credit = nullptr;
+            if (incast_control && traffic_class != TrafficClass::LATENCY) {
+                auto &cached = tl_credits[entry.first];
+                if (!cached)
+                    cached = incast_control->peer(
+                        getServerNameFromNicPath(NicPathOf(entry.first)));
+                credit = cached;
+            }
+            tl_ready_queues[traffic_class].push_back(
+                {endpoint, &entry.second, buckets, credit});
 #endif
-        if (!endpoint) {
-            for (auto &slice : entry.second) failed_slice_list.push_back(slice);
-            entry.second.clear();
-            continue;
-        }
-        if (!endpoint->active()) {
-            if (endpoint->inactiveTime() > 1.0)
-                context_.deleteEndpoint(entry.first); // enable for re-establishation
-            for (auto &slice : entry.second) failed_slice_list.push_back(slice);
-            entry.second.clear();
-            continue;
         }
-        if (!endpoint->connected() && endpoint->setupConnectionsByActive()) {
-            LOG(ERROR) << "Worker: Cannot make connection for endpoint: "
-                       << entry.first << ", mark it inactive";
-            for (auto &slice : entry.second) failed_slice_list.push_back(slice);
-            endpoint->set_active(false);
-            failed_nr_polls++;
-            if (context_.active() && failed_nr_polls > 32 &&
-                !success_nr_polls) {
-                LOG(WARNING)
-                    << "Failed to establish peer endpoints in local RNIC "
-                    << context_.nicPath() << ", mark it inactive";
-                context_.set_active(false);
+    }
+
+    // Rounds go on until the endpoints take no more work requests. Classes
+    // without queued slices bank no credit, nor do blocked ones beyond two
+    // rounds.
+    auto &deficit = class_deficit_[thread_id];
+    auto &config = configSnapshot();
+    const int64_t kQuantum = config.slice_size;
+    thread_local SliceList tl_batch;
+    thread_local std::vector<int64_t> tl_batch_bytes;
+    bool posted = true;
+    while (posted) {
+        posted = false;
+        for (int traffic_class = 0; traffic_class < kTrafficClassCount;
+             ++traffic_class) {
+            auto &ready_queues = tl_ready_queues[traffic_class];
+            const int64_t credit =
+                kQuantum * config.traffic_class_weights[traffic_class];
+            bool backlogged = false;
+            for (auto &queue : ready_queues)
+                if (!queue.slices->empty()) backlogged = true;
+            if (!backlogged) {
+                deficit[traffic_class] = 0;
+                continue;
+            }
+            deficit[traffic_class] =
+                std::min(deficit[traffic_class] + credit, 2 * credit);
+            for (auto &queue : ready_queues) {
+                auto &slices = *queue.slices;
+                if (slices.empty() || deficit[traffic_class] <= 0) continue;
+                // Slices over the rate limits stay queued for later rounds
+                int64_t allowance = deficit[traffic_class];
+                uint64_t now_ts = 0;
+                if (queue.buckets) {
+                    now_ts = getCurrentTimeInNano();
+                    bool throttled = false;
+                    for (auto bucket : *queue.buckets) {
+                        int64_t available = bucket->available(now_ts);
+                        if (available <= 0) {
+                            bucket->throttled.fetch_add(
+                                1, std::memory_order_relaxed);
+                            throttled = true;
+                        }
+                        allowance = std::min(allowance, available);
+                    }
+                    if (throttled) continue;
+                }
+                // Writes wait for credits of the peer, see IncastControl
+                IncastControl::PeerCredit *credit = nullptr;
+                if (queue.credit && slices.front()->opcode ==
+                                        Transport::TransferRequest::WRITE) {
+                    if (!now_ts) now_ts = getCurrentTimeInNano();
+                    int64_t granted =
+                        incast_control->available(queue.credit, now_ts);
+                    if (!granted) continue;
+                    if (granted > 0) {
+                        credit = queue.credit;
+                        allowance = std::min(allowance, granted);
+                    }
+                }
+                // Lengths are read before posting, the slices may complete
+                // on another worker right away
+                tl_batch.clear();
+                tl_batch_bytes.clear();
+                int64_t bytes = 0;
+                while (tl_batch.size() < slices.size() && bytes < allowance) {
+                    auto slice = slices[tl_batch.size()];
+                    bytes += slice->length;
+                    tl_batch.push_back(slice);
+                    tl_batch_bytes.push_back(bytes);
+                }
+                size_t count = tl_batch.size();
+                queue.endpoint->submitPostSend(tl_batch, failed_slice_list);
+                size_t sent = count - tl_batch.size();
+                if (!sent) continue;
+                queue.endpoint->recordPosted(tl_batch_bytes[sent - 1]);
+                FlightRecorder::record(FlightEvent::kPost,
+                                       slices.front()->peer_nic_id, sent,
+                                       tl_batch_bytes[sent - 1]);
+                slices.erase(slices.begin(), slices.begin() + sent);
+                deficit[traffic_class] -= tl_batch_bytes[sent - 1];
+                if (queue.buckets)
+                    for (auto bucket : *queue.buckets)
+                        bucket->consume(tl_batch_bytes[sent - 1], now_ts);
+                if (credit)
+                    incast_control->consume(credit, tl_batch_bytes[sent - 1],
+                                            now_ts);
+                posted = true;
             }
-            entry.second.clear();
-            continue;
         }
-        endpoint->submitPostSend(entry.second, failed_slice_list);
-#endif
     }
+    for (auto &ready_queues : tl_ready_queues) ready_queues.clear();
 
     if (!failed_slice_list.empty()) {
         for (auto &slice : failed_slice_list) slice->rdma.retry_cnt++;
         redispatch(failed_slice_list, thread_id);
     }
+    if (!rerouted_slice_list.empty())
+        redispatch(rerouted_slice_list, thread_id, false);
 }
 
-void WorkerPool::performPollCq(int thread_id) {
+void WorkerPool::dropAbortedSlices(SliceList &slice_list) {
+    size_t kept = 0, dropped = 0;
+    uint64_t dropped_bytes = 0;
+    // Slices of a batch are mostly queued together
+    Transport::BatchID last_batch_id = Transport::INVALID_BATCH_ID;
+    bool aborted = false;
+    for (auto slice : slice_list) {
+        if (slice->task->batch_id != last_batch_id) {
+            last_batch_id = slice->task->batch_id;
+            auto batch_desc = Transport::getBatchDesc(last_batch_id);
+            aborted = batch_desc && batch_desc->abortStatus() !=
+                                        Transport::TransferStatusEnum::WAITING;
+        }
+        if (!aborted) {
+            slice_list[kept++] = slice;
+            continue;
+        }
+        dropped++;
+        dropped_bytes += slice->length;
+        slice->markFailed();
+    }
+    slice_list.resize(kept);
+    if (dropped) {
+        processed_bytes_.fetch_add(dropped_bytes);
+        processed_slice_count_.fetch_add(dropped);
+    }
+}
+
+// Count a slice completed at ts in the stats of its traffic class
+static void countCompletion(Transport::TrafficClassStats *class_stats,
+                            const Transport::Slice *slice, uint64_t ts) {
+    auto &stats = class_stats[slice->rdma.traffic_class];
+    stats.bytes += slice->length;
+    stats.slices++;
+    stats.latency_ns += ts - slice->rdma.submit_ts;
+}
+
+int WorkerPool::performPollCq(int thread_id) {
+    int polled_wc_count = 0;
     int processed_slice_count = 0;
+    uint64_t processed_bytes = 0;
+    Transport::TrafficClassStats class_stats[kTrafficClassCount] = {};
+    RdmaContext::PollStats poll_stats;
     const static size_t kPollCount = 64;
     std::unordered_map<volatile int *, int> qp_depth_set;
+    SliceList failed_slice_list;
     for (int cq_index = thread_id; cq_index < context_.cqCount();
-         cq_index += kTransferWorkerCount) {
+         cq_index += worker_count_) {
         ibv_wc wc[kPollCount];
         int nr_poll = context_.poll(kPollCount, wc, cq_index);
         if (nr_poll < 0) {
             LOG(ERROR) << "Worker: Failed to poll completion queues";
             continue;
         }
+        polled_wc_count += nr_poll;
 
+        int completed_wr_count = 0;
+        auto health = context_.health();
+        uint64_t poll_ts = nr_poll ? getCurrentTimeInNano() : 0;
         for (int i = 0; i < nr_poll; ++i) {
+            // A notification from a peer, which no slice of ours waits for
+            if (wc[i].wr_id == RdmaContext::kNotifyRecvWrId) {
+                context_.onNotifyRecv(wc[i]);
+                continue;
+            }
             Transport::Slice *slice = (Transport::Slice *)wc[i].wr_id;
             assert(slice);
-            if (qp_depth_set.count(slice->rdma.qp_depth))
-                qp_depth_set[slice->rdma.qp_depth]++;
-            else
-                qp_depth_set[slice->rdma.qp_depth] = 1;
+            // A completion also covers the unsignaled WRs posted before it
+            // by the same doorbell. Every WR that fails completes on its
+            // own, so flushed WRs leave their predecessors alone.
+            int covered = 1;
+            if (wc[i].status != IBV_WC_WR_FLUSH_ERR) {
+                auto prev = slice->rdma.unsignaled_prev;
+                while (prev) {
+                    // Read the link first, the task may go away once done
+                    auto next = prev->rdma.unsignaled_prev;
+                    processed_bytes += prev->length;
+                    countCompletion(class_stats, prev, poll_ts);
+                    poll_stats.record(prev, poll_ts);
+                    prev->markSuccess();
+                    processed_slice_count++;
+                    covered++;
+                    prev = next;
+                }
+            }
+            MC_TRACE(rdma_complete, slice->length,
+                     poll_ts - slice->rdma.submit_ts, slice->peer_nic_id,
+                     static_cast<int>(wc[i].status));
+            FlightRecorder::record(FlightEvent::kComplete, slice->peer_nic_id,
+                                   slice->length, wc[i].status);
+            qp_depth_set[slice->rdma.qp_depth] += covered;
+            completed_wr_count += covered;
             // __sync_fetch_and_sub(slice->rdma.qp_depth, 1);
+            // Flushed WRs follow another failure, do not count them
+            if (health && wc[i].status == IBV_WC_SUCCESS)
+                health->recordSuccess(poll_ts - slice->ts, slice->length);
+            else if (health && wc[i].status != IBV_WC_WR_FLUSH_ERR)
+                health->recordFailure();
+            if (wc[i].status != IBV_WC_SUCCESS &&
+                wc[i].status != IBV_WC_WR_FLUSH_ERR)
+                context_.recordFailure();
             if (wc[i].status != IBV_WC_SUCCESS) {
                 bool show_work_request_flushed_error = globalConfig().trace;
                 // After detect an error, subsequent work requests will result
@@ -295,7 +789,7 @@ void WorkerPool::performPollCq(int thread_id) {
                         << ", length: " << slice->length
                         << ", dest_addr: " << (void *)slice->rdma.dest_addr
                         << ", local_nic: " << context_.deviceName()
-                        << ", peer_nic: " << slice->peer_nic_path
+                        << ", peer_nic: " << NicPathOf(slice->peer_nic_id)
                         << ", dest_rkey: " << slice->rdma.dest_rkey
                         << ", retry_cnt: " << slice->rdma.retry_cnt
                         << "): " << ibv_wc_status_str(wc[i].status);
@@ -306,79 +800,215 @@ void WorkerPool::performPollCq(int thread_id) {
                                  << context_.nicPath() << ", mark it inactive";
                     context_.set_active(false);
                 }
-                context_.deleteEndpoint(slice->peer_nic_path);
+#ifdef USE_MLX5_DC
+                // The DC initiator went to error state, reset it once its
+                // flushed WRs are drained
+                if (context_.dcEnabled())
+                    context_.markDciFailed(slice->rdma.qp_depth);
+#endif
+                context_.deleteEndpoint(slice->peer_nic_id);
+                if (wc[i].status != IBV_WC_WR_FLUSH_ERR)
+                    recordNicFailure(slice->peer_nic_id);
                 slice->rdma.retry_cnt++;
                 if (slice->rdma.retry_cnt >= slice->rdma.max_retry_cnt) {
+                    FlightRecorder::record(FlightEvent::kFail,
+                                           slice->peer_nic_id, slice->length,
+                                           slice->rdma.retry_cnt);
+                    FlightRecorder::dumpToLog("a slice failed after " +
+                                              std::to_string(
+                                                  slice->rdma.retry_cnt) +
+                                              " attempts");
+                    processed_bytes += slice->length;
                     slice->markFailed();
                     processed_slice_count_++;
                 } else {
-                    collective_slice_queue_[thread_id][slice->peer_nic_path]
-                        .push_back(slice);
-                    redispatch_counter_++;
-                    // std::vector<RdmaTransport::Slice *> slice_list { slice };
-                    // redispatch(slice_list, thread_id);
+                    FlightRecorder::record(FlightEvent::kRetry,
+                                           slice->peer_nic_id, slice->length,
+                                           slice->rdma.retry_cnt);
+                    // Rerouted right away, the other slices of its task
+                    // carry on meanwhile
+                    failed_slice_list.push_back(slice);
+                    context_.recordRetry();
                 }
             } else {
+                if (nic_backoff_count_.load(std::memory_order_relaxed))
+                    recordNicSuccess(slice->peer_nic_id);
+                processed_bytes += slice->length;
+                countCompletion(class_stats, slice, poll_ts);
+                poll_stats.record(slice, poll_ts);
                 slice->markSuccess();
                 processed_slice_count++;
                 success_nr_polls++;
             }
         }
-        if (nr_poll)
+        if (completed_wr_count)
             __sync_fetch_and_sub(context_.cqOutstandingCount(cq_index),
-                                 nr_poll);
+                                 completed_wr_count);
     }
 
     for (auto &entry : qp_depth_set)
         __sync_fetch_and_sub(entry.first, entry.second);
 
+    if (!failed_slice_list.empty()) redispatch(failed_slice_list, thread_id);
+
+    context_.recordPoll(poll_stats);
+    if (processed_bytes) processed_bytes_.fetch_add(processed_bytes);
     if (processed_slice_count)
         processed_slice_count_.fetch_add(processed_slice_count);
+    for (int traffic_class = 0; traffic_class < kTrafficClassCount;
+         ++traffic_class) {
+        if (class_stats[traffic_class].slices)
+            Transport::recordTrafficClass(TrafficClass(traffic_class),
+                                          class_stats[traffic_class]);
+    }
+    return polled_wc_count;
+}
+
+void WorkerPool::recordNicFailure(NicPathID peer_nic_id) {
+    const static uint64_t kMinBackoffInNano = 1000000;      // 1ms
+    const static uint64_t kMaxBackoffInNano = 1000000000;  // 1s
+    RWSpinlock::WriteGuard guard(backoff_lock_);
+    auto &backoff = nic_backoff_[peer_nic_id];
+    // Failures of the WRs posted before the backoff began count once
+    auto current_ts = getCurrentTimeInNano();
+    if (backoff.until_ts > current_ts) return;
+    backoff.failures++;
+    uint64_t period = kMinBackoffInNano << std::min(backoff.failures - 1, 10);
+    backoff.until_ts = current_ts + std::min(period, kMaxBackoffInNano);
+    nic_backoff_count_.store(nic_backoff_.size(), std::memory_order_relaxed);
+}
+
+void WorkerPool::recordNicSuccess(NicPathID peer_nic_id) {
+    {
+        RWSpinlock::ReadGuard guard(backoff_lock_);
+        if (!nic_backoff_.count(peer_nic_id)) return;
+    }
+    RWSpinlock::WriteGuard guard(backoff_lock_);
+    nic_backoff_.erase(peer_nic_id);
+    nic_backoff_count_.store(nic_backoff_.size(), std::memory_order_relaxed);
+}
+
+uint64_t WorkerPool::backoffUntil(NicPathID peer_nic_id) {
+    if (!nic_backoff_count_.load(std::memory_order_relaxed)) return 0;
+    RWSpinlock::ReadGuard guard(backoff_lock_);
+    auto iter = nic_backoff_.find(peer_nic_id);
+    if (iter == nic_backoff_.end()) return 0;
+    if (iter->second.until_ts <= getCurrentTimeInNano()) return 0;
+    return iter->second.until_ts;
+}
+
+int WorkerPool::selectPeerDevice(Transport::SegmentDesc &desc,
+                                 Transport::Slice *slice, int &buffer_id,
+                                 int &device_id) {
+    // Later retry counts walk through all devices of the peer
+    for (size_t attempt = 0; attempt <= desc.devices.size(); ++attempt) {
+        int ret = RdmaTransport::selectDevice(
+            &desc, slice->rdma.dest_addr, slice->length, buffer_id, device_id,
+            slice->rdma.retry_cnt + attempt);
+        if (ret) return ret;
+        if (!backoffUntil(peerNicID(desc, device_id))) return 0;
+    }
+    return ERR_DEVICE_NOT_FOUND;
 }
 
 void WorkerPool::redispatch(std::vector<Transport::Slice *> &slice_list,
-                            int thread_id) {
+                            int thread_id, bool reload) {
     std::unordered_map<SegmentID, std::shared_ptr<Transport::SegmentDesc>>
         segment_desc_map;
     for (auto &slice : slice_list) {
         auto target_id = slice->target_id;
         if (!segment_desc_map.count(target_id)) {
             segment_desc_map[target_id] =
-                context_.engine().meta()->getSegmentDescByID(target_id, true);
+                context_.engine().meta()->getSegmentDescByID(target_id,
+                                                             reload);
         }
     }
 
+    uint64_t redispatched = 0;
+    SliceList failover_slice_list;
     for (auto &slice : slice_list) {
         if (slice->rdma.retry_cnt >= slice->rdma.max_retry_cnt) {
+            processed_bytes_.fetch_add(slice->length);
+            slice->markFailed();
+            processed_slice_count_++;
+            continue;
+        }
+        auto &peer_segment_desc = segment_desc_map[slice->target_id];
+        int buffer_id, device_id;
+        int ret = peer_segment_desc
+                      ? selectPeerDevice(*peer_segment_desc, slice, buffer_id,
+                                         device_id)
+                      : ERR_ADDRESS_NOT_REGISTERED;
+        if (ret == ERR_DEVICE_NOT_FOUND) {
+            failover_slice_list.push_back(slice);
+            continue;
+        }
+        if (ret) {
+            processed_bytes_.fetch_add(slice->length);
             slice->markFailed();
             processed_slice_count_++;
-        } else {
+            continue;
+        }
+        slice->rdma.dest_rkey =
+            peer_segment_desc->buffers[buffer_id].rkey[device_id];
+        slice->peer_nic_id = peerNicID(*peer_segment_desc, device_id);
+        auto &class_queue =
+            collective_slice_queue_[thread_id][slice->rdma.traffic_class];
+        class_queue[slice->peer_nic_id].push_back(slice);
+        redispatched++;
+    }
+
+    if (!failover_slice_list.empty()) {
+        // Every peer NIC is in backoff from this device, so the slices move
+        // to another local device, which counts them from then on
+        uint64_t bytes = 0;
+        for (auto &slice : failover_slice_list) bytes += slice->length;
+        size_t count = failover_slice_list.size();
+        context_.engine().failoverSlices(&context_, failover_slice_list);
+        for (auto &slice : failover_slice_list) bytes -= slice->length;
+        if (count > failover_slice_list.size()) {
+            processed_bytes_.fetch_add(bytes);
+            processed_slice_count_.fetch_add(count -
+                                             failover_slice_list.size());
+            redispatched += count - failover_slice_list.size();
+        }
+        // No other device can take them, they wait out the backoff
+        for (auto &slice : failover_slice_list) {
             auto &peer_segment_desc = segment_desc_map[slice->target_id];
             int buffer_id, device_id;
-            if (!peer_segment_desc ||
-                RdmaTransport::selectDevice(peer_segment_desc.get(),
-                                            slice->rdma.dest_addr,
-                                            slice->length, buffer_id, device_id,
-                                            slice->rdma.retry_cnt)) {
+            if (RdmaTransport::selectDevice(
+                    peer_segment_desc.get(), slice->rdma.dest_addr,
+                    slice->length, buffer_id, device_id,
+                    slice->rdma.retry_cnt)) {
+                processed_bytes_.fetch_add(slice->length);
                 slice->markFailed();
                 processed_slice_count_++;
                 continue;
             }
             slice->rdma.dest_rkey =
                 peer_segment_desc->buffers[buffer_id].rkey[device_id];
-            auto peer_nic_path =
-                MakeNicPath(peer_segment_desc->name,
-                            peer_segment_desc->devices[device_id].name);
-            slice->peer_nic_path = peer_nic_path;
-            collective_slice_queue_[thread_id][peer_nic_path].push_back(slice);
+            slice->peer_nic_id = peerNicID(*peer_segment_desc, device_id);
+            auto &class_queue =
+                collective_slice_queue_[thread_id][slice->rdma.traffic_class];
+            class_queue[slice->peer_nic_id].push_back(slice);
+            redispatched++;
         }
     }
+    if (redispatched) context_.recordRedispatch(redispatched);
 }
 
 void WorkerPool::transferWorker(int thread_id) {
-    bindToSocket(numa_socket_id_);
+    bindThread(thread_id);
     const static uint64_t kWaitPeriodInNano = 100000000;  // 100ms
+    // Busy poll while completions keep coming within this period, block on
+    // completion events otherwise
+    const uint64_t busy_poll_period =
+        worker_events_ ? globalConfig().adaptive_poll_us * 1000ull : 0;
+    // Idle workers keep polling for notifications, and only block on
+    // completion events, see MC_ADAPTIVE_POLL_US
+    const bool inband_notify = globalConfig().inband_notify;
     uint64_t last_wait_ts = getCurrentTimeInNano();
+    uint64_t last_busy_ts = last_wait_ts;
     while (workers_running_.load(std::memory_order_relaxed)) {
         auto processed_slice_count =
             processed_slice_count_.load(std::memory_order_relaxed);
@@ -386,7 +1016,23 @@ void WorkerPool::transferWorker(int thread_id) {
             submitted_slice_count_.load(std::memory_order_relaxed);
         if (processed_slice_count == submitted_slice_count) {
             uint64_t curr_wait_ts = getCurrentTimeInNano();
-            if (curr_wait_ts - last_wait_ts > kWaitPeriodInNano) {
+#ifndef USE_FAKE_POST_SEND
+            // Notifications from peers arrive with nothing of ours in
+            // flight, so the CQs are polled all along
+            if (inband_notify && performPollCq(thread_id)) {
+                last_busy_ts = curr_wait_ts;
+                continue;
+            }
+#endif
+            if (busy_poll_period) {
+                if (curr_wait_ts - last_busy_ts > busy_poll_period) {
+                    waitForEvents(thread_id, 1000);
+                    last_busy_ts = getCurrentTimeInNano();
+                }
+                continue;
+            }
+            if (!inband_notify &&
+                curr_wait_ts - last_wait_ts > kWaitPeriodInNano) {
                 std::unique_lock<std::mutex> lock(cond_mutex_);
                 suspended_flag_.fetch_add(1);
                 cond_var_.wait_for(lock, std::chrono::seconds(1));
@@ -397,8 +1043,64 @@ void WorkerPool::transferWorker(int thread_id) {
         }
         performPostSend(thread_id);
 #ifndef USE_FAKE_POST_SEND
-        performPollCq(thread_id);
+        int polled_wc_count = performPollCq(thread_id);
+#else
+        int polled_wc_count = 0;
 #endif
+        if (!busy_poll_period) continue;
+        uint64_t current_ts = getCurrentTimeInNano();
+        if (polled_wc_count) {
+            last_busy_ts = current_ts;
+        } else if (current_ts - last_busy_ts > busy_poll_period) {
+            // Slices waiting for a connection are retried every millisecond
+            waitForEvents(thread_id, 1);
+            last_busy_ts = getCurrentTimeInNano();
+        }
+    }
+}
+
+void WorkerPool::waitForEvents(int thread_id, int timeout_ms) {
+    auto &events = worker_events_[thread_id];
+    for (int cq_index = thread_id; cq_index < context_.cqCount();
+         cq_index += worker_count_) {
+        if (ibv_req_notify_cq(context_.nativeCq(cq_index), 0)) {
+            LOG(ERROR) << "Worker: Failed to arm CQ " << cq_index;
+            return;
+        }
+    }
+    events.sleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool pending = false;
+    for (int traffic_class = 0; traffic_class < kTrafficClassCount;
+         ++traffic_class) {
+        for (int shard_id = thread_id; shard_id < kShardCount;
+             shard_id += worker_count_) {
+            if (slice_queue_[traffic_class][shard_id].load(
+                    std::memory_order_relaxed))
+                pending = true;
+        }
+    }
+    // Completions that arrived before arming raise no event
+#ifndef USE_FAKE_POST_SEND
+    if (!pending && performPollCq(thread_id)) pending = true;
+#endif
+    if (!pending) {
+        epoll_event event[8];
+        if (epoll_wait(events.epoll_fd, event, 8, timeout_ms) < 0 &&
+            errno != EINTR)
+            PLOG(ERROR) << "Worker: epoll_wait()";
+    }
+    events.sleeping.store(false, std::memory_order_relaxed);
+
+    uint64_t value;
+    while (read(events.wake_fd, &value, sizeof(value)) > 0)
+        ;
+    // Every event must be acknowledged before its CQ can be destroyed
+    for (auto channel : events.channels) {
+        ibv_cq *cq;
+        void *cq_context;
+        while (ibv_get_cq_event(channel, &cq, &cq_context) == 0)
+            ibv_ack_cq_events(cq, 1);
     }
 }
 
@@ -409,8 +1111,9 @@ int WorkerPool::doProcessContextEvents() {
                  << ibv_event_type_str(event.event_type) << " for context "
                  << context_.deviceName();
     if (event.event_type == IBV_EVENT_QP_FATAL) {
+        // DC initiators have no endpoint and recover on their own
         auto endpoint = (RdmaEndPoint *)event.element.qp->qp_context;
-        endpoint->set_active(false);
+        if (endpoint) endpoint->set_active(false);
     } else if (event.event_type == IBV_EVENT_DEVICE_FATAL ||
                event.event_type == IBV_EVENT_CQ_ERR ||
                event.event_type == IBV_EVENT_WQ_FATAL ||
@@ -430,13 +1133,29 @@ int WorkerPool::doProcessContextEvents() {
 }
 
 void WorkerPool::monitorWorker() {
-    bindToSocket(numa_socket_id_);
+    bindThread(-1);
     auto last_reset_ts = getCurrentTimeInNano();
+    auto last_stats = context_.postSendStats();
     while (workers_running_) {
         auto current_ts = getCurrentTimeInNano();
         if (current_ts - last_reset_ts > 1000000000ll) {
             context_.set_active(true);
+            context_.reclaimEndpoints();
             last_reset_ts = current_ts;
+            auto stats = context_.postSendStats();
+            auto doorbells = stats.doorbells - last_stats.doorbells;
+            if (globalConfig().trace && doorbells) {
+                auto work_requests =
+                    stats.work_requests - last_stats.work_requests;
+                LOG(INFO) << "Worker: " << context_.deviceName() << " posted "
+                          << work_requests << " WRs in " << doorbells
+                          << " doorbells, "
+                          << double(work_requests) / doorbells
+                          << " WRs per doorbell, signaled ratio "
+                          << double(stats.signaled - last_stats.signaled) /
+                                 work_requests;
+            }
+            last_stats = stats;
         }
         struct epoll_event event;
         int num_events = epoll_wait(context_.eventFd(), &event, 1, 100);
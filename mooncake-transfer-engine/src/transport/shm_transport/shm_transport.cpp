@@ -0,0 +1,390 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "transport/shm_transport/shm_transport.h"
+
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+
+#include "common.h"
+#include "dsa_engine.h"
+#include "transfer_metadata.h"
+#include "transport/transport.h"
+
+namespace mooncake {
+
+namespace {
+
+struct ExportedMemory {
+    size_t length;
+    std::string path;
+    uint64_t offset;
+    // memfd owned by allocateSharedMemory(), -1 for exported memory
+    int fd;
+};
+
+std::mutex &exportedMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+// Shared memory of the process by address
+std::map<uint64_t, ExportedMemory> &exportedMemory() {
+    static std::map<uint64_t, ExportedMemory> memory;
+    return memory;
+}
+
+// Processes on the same host see the same boot ID, so can map the files
+// published by each other
+std::string getBootId() {
+    std::ifstream file("/proc/sys/kernel/random/boot_id");
+    std::string boot_id;
+    if (file) std::getline(file, boot_id);
+    return boot_id;
+}
+
+void copyData(void *dest, const void *src, size_t length) {
+    DsaEngine *dsa = DsaEngine::get();
+    if (dsa && length >= dsa->minSize())
+        dsa->copy({{dest, src, length}});
+    else
+        memcpy(dest, src, length);
+}
+
+}  // namespace
+
+void *ShmTransport::allocateSharedMemory(size_t size) {
+    int fd = memfd_create("mooncake", MFD_CLOEXEC);
+    if (fd < 0) {
+        PLOG(ERROR) << "ShmTransport: failed to create memfd";
+        return nullptr;
+    }
+    if (ftruncate(fd, size)) {
+        PLOG(ERROR) << "ShmTransport: failed to resize memfd to " << size;
+        close(fd);
+        return nullptr;
+    }
+    void *addr =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        PLOG(ERROR) << "ShmTransport: failed to map " << size << " bytes";
+        close(fd);
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(exportedMutex());
+    exportedMemory()[(uint64_t)addr] = {
+        size, "/proc/" + std::to_string(getpid()) + "/fd/" + std::to_string(fd),
+        0, fd};
+    return addr;
+}
+
+void ShmTransport::freeSharedMemory(void *addr) {
+    std::lock_guard<std::mutex> lock(exportedMutex());
+    auto it = exportedMemory().find((uint64_t)addr);
+    if (it == exportedMemory().end() || it->second.fd < 0) {
+        LOG(ERROR) << "ShmTransport: " << addr
+                   << " was not allocated by allocateSharedMemory()";
+        return;
+    }
+    munmap(addr, it->second.length);
+    close(it->second.fd);
+    exportedMemory().erase(it);
+}
+
+void ShmTransport::exportSharedMemory(void *addr, size_t length,
+                                      const std::string &path,
+                                      uint64_t offset) {
+    // Peers resolve /proc/self to themselves
+    std::string exported_path = path;
+    const std::string kProcSelf = "/proc/self/";
+    if (exported_path.compare(0, kProcSelf.size(), kProcSelf) == 0)
+        exported_path = "/proc/" + std::to_string(getpid()) + "/" +
+                        exported_path.substr(kProcSelf.size());
+    std::lock_guard<std::mutex> lock(exportedMutex());
+    exportedMemory()[(uint64_t)addr] = {length, exported_path, offset, -1};
+}
+
+void ShmTransport::unexportSharedMemory(void *addr) {
+    std::lock_guard<std::mutex> lock(exportedMutex());
+    auto it = exportedMemory().find((uint64_t)addr);
+    if (it != exportedMemory().end() && it->second.fd < 0)
+        exportedMemory().erase(it);
+}
+
+ShmTransport::ShmTransport() {}
+
+ShmTransport::~ShmTransport() {
+    for (auto &entry : mappings_)
+        munmap(entry.second.addr, entry.second.length);
+    mappings_.clear();
+}
+
+int ShmTransport::install(std::string &local_server_name,
+                          std::shared_ptr<TransferMetadata> meta,
+                          std::shared_ptr<Topology> topo) {
+    metadata_ = meta;
+    local_server_name_ = local_server_name;
+    shm_host_ = getBootId();
+    if (shm_host_.empty()) {
+        LOG(ERROR) << "ShmTransport: cannot read the boot ID of the host";
+        return -1;
+    }
+
+    // Shared buffers are usually published along with the segment of
+    // another transport, installed before
+    if (!metadata_->getSegmentDescByID(LOCAL_SEGMENT_ID)) {
+        auto desc = std::make_shared<SegmentDesc>();
+        if (!desc) return ERR_MEMORY;
+        desc->name = local_server_name_;
+        desc->protocol = "shm";
+        metadata_->addLocalSegment(LOCAL_SEGMENT_ID, local_server_name_,
+                                   std::move(desc));
+        if (metadata_->updateLocalSegmentDesc()) {
+            LOG(ERROR) << "ShmTransport: cannot publish segments, "
+                          "check the availability of metadata storage";
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int ShmTransport::registerLocalMemory(void *addr, size_t length,
+                                      const std::string &location,
+                                      bool remote_accessible,
+                                      bool update_metadata) {
+    ShmBufferDesc buffer_desc;
+    {
+        std::lock_guard<std::mutex> lock(exportedMutex());
+        auto &memory = exportedMemory();
+        auto it = memory.upper_bound((uint64_t)addr);
+        if (it == memory.begin()) return 0;
+        --it;
+        uint64_t delta = (uint64_t)addr - it->first;
+        if (delta + length > it->second.length) {
+            VLOG(1) << "ShmTransport: " << addr
+                    << " is not shared memory, peers on the host reach it "
+                       "through the protocol of the segment";
+            return 0;
+        }
+        buffer_desc.shm_name = it->second.path;
+        buffer_desc.shm_offset = it->second.offset + delta;
+    }
+    buffer_desc.addr = (uint64_t)addr;
+    buffer_desc.length = length;
+    return metadata_->addLocalShmBuffer(shm_host_, buffer_desc,
+                                        update_metadata);
+}
+
+int ShmTransport::unregisterLocalMemory(void *addr, bool update_metadata) {
+    int ret = metadata_->removeLocalShmBuffer(addr, update_metadata);
+    return ret == ERR_ADDRESS_NOT_REGISTERED ? 0 : ret;
+}
+
+int ShmTransport::registerLocalMemoryBatch(
+    const std::vector<Transport::BufferEntry> &buffer_list,
+    const std::string &location) {
+    for (auto &buffer : buffer_list)
+        registerLocalMemory(buffer.addr, buffer.length, location, true, false);
+    return metadata_->updateLocalSegmentDesc();
+}
+
+int ShmTransport::unregisterLocalMemoryBatch(
+    const std::vector<void *> &addr_list) {
+    for (auto &addr : addr_list) unregisterLocalMemory(addr, false);
+    return metadata_->updateLocalSegmentDesc();
+}
+
+bool ShmTransport::canTransfer(const SegmentDesc &desc,
+                               const TransferRequest &entry) {
+    return translate(desc, entry) != nullptr;
+}
+
+void *ShmTransport::translate(const SegmentDesc &desc,
+                              const TransferRequest &entry) {
+    auto contains = [&](uint64_t addr, uint64_t length) {
+        return entry.target_offset >= addr &&
+               entry.target_offset + entry.length <= addr + length;
+    };
+    // Buffers of this process are copied from as they are, except GPU
+    // memory that the CPU cannot copy
+    if (entry.target_id == LOCAL_SEGMENT_ID ||
+        desc.name == local_server_name_) {
+        for (auto &buffer : desc.buffers)
+            if (contains(buffer.addr, buffer.length))
+                return buffer.name.rfind("cuda:", 0) == 0
+                           ? nullptr
+                           : (void *)entry.target_offset;
+        for (auto &buffer : desc.shm_buffers)
+            if (contains(buffer.addr, buffer.length))
+                return (void *)entry.target_offset;
+        return nullptr;
+    }
+
+    if (desc.shm_host != shm_host_) return nullptr;
+    for (auto &buffer : desc.shm_buffers) {
+        if (!contains(buffer.addr, buffer.length)) continue;
+        auto base = (char *)map(desc, buffer);
+        if (!base) return nullptr;
+        return base + (entry.target_offset - buffer.addr);
+    }
+    return nullptr;
+}
+
+void *ShmTransport::map(const SegmentDesc &desc, const ShmBufferDesc &buffer) {
+    auto key = desc.name + "@" + std::to_string(buffer.addr) + ":" +
+               buffer.shm_name + ":" + std::to_string(buffer.shm_offset);
+    {
+        std::shared_lock<std::shared_mutex> lock(mapping_mutex_);
+        auto it = mappings_.find(key);
+        if (it != mappings_.end()) return it->second.base;
+        if (unmappable_.count(key)) return nullptr;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mapping_mutex_);
+    auto it = mappings_.find(key);
+    if (it != mappings_.end()) return it->second.base;
+    if (unmappable_.count(key)) return nullptr;
+
+    // Opening /proc/<pid>/fd/<fd> of a peer needs it to run as the same
+    // user, otherwise the segment is reached through its protocol
+    int fd = open(buffer.shm_name.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        PLOG(WARNING) << "ShmTransport: failed to open " << buffer.shm_name
+                      << " of segment " << desc.name;
+        unmappable_.insert(key);
+        return nullptr;
+    }
+    static const uint64_t kPageSize = sysconf(_SC_PAGESIZE);
+    uint64_t delta = buffer.shm_offset % kPageSize;
+    size_t length = buffer.length + delta;
+    void *addr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd, buffer.shm_offset - delta);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        PLOG(WARNING) << "ShmTransport: failed to map " << buffer.shm_name
+                      << " of segment " << desc.name;
+        unmappable_.insert(key);
+        return nullptr;
+    }
+    Mapping mapping{addr, length, (char *)addr + delta};
+    mappings_[key] = mapping;
+    VLOG(1) << "ShmTransport: mapped " << buffer.length << " bytes of segment "
+            << desc.name << " from " << buffer.shm_name;
+    return mapping.base;
+}
+
+Status ShmTransport::getTransferStatus(BatchID batch_id, size_t task_id,
+                                       TransferStatus &status) {
+    auto batch_desc_ptr = getBatchDesc(batch_id);
+    if (!batch_desc_ptr) return Status::InvalidArgument("Invalid batch ID");
+    auto &batch_desc = *batch_desc_ptr;
+    const size_t task_count = batch_desc.task_list.size();
+    if (task_id >= task_count) {
+        return Status::InvalidArgument(
+            "ShmTransport::getTransportStatus invalid argument, batch id: " +
+            std::to_string(batch_id));
+    }
+    auto &task = batch_desc.task_list[task_id];
+    status.transferred_bytes = task.transferred_bytes;
+    uint64_t success_slice_count = task.success_slice_count;
+    uint64_t failed_slice_count = task.failed_slice_count;
+    if (success_slice_count + failed_slice_count == task.slice_count) {
+        if (failed_slice_count) {
+            status.s = TransferStatusEnum::FAILED;
+        } else {
+            status.s = TransferStatusEnum::COMPLETED;
+        }
+        task.is_finished = true;
+    } else {
+        status.s = TransferStatusEnum::WAITING;
+    }
+    return Status::OK();
+}
+
+Status ShmTransport::submitTransfer(
+    BatchID batch_id, const std::vector<TransferRequest> &entries) {
+    auto batch_desc_ptr = getBatchDesc(batch_id);
+    if (!batch_desc_ptr) return Status::InvalidArgument("Invalid batch ID");
+    auto &batch_desc = *batch_desc_ptr;
+    if (batch_desc.task_list.size() + entries.size() > batch_desc.batch_size) {
+        LOG(ERROR) << "ShmTransport: Exceed the limitation of current batch's "
+                      "capacity";
+        return Status::InvalidArgument(
+            "ShmTransport: Exceed the limitation of capacity, batch id: " +
+            std::to_string(batch_id));
+    }
+
+    size_t task_id = batch_desc.task_list.size();
+    batch_desc.task_list.resize(task_id + entries.size());
+
+    for (auto &request : entries) {
+        TransferTask &task = batch_desc.task_list[task_id];
+        ++task_id;
+        auto status = submitRequest(request, task);
+        if (!status.ok()) return status;
+    }
+    return Status::OK();
+}
+
+Status ShmTransport::submitTransferTask(
+    const std::vector<TransferRequest *> &request_list,
+    const std::vector<TransferTask *> &task_list) {
+    for (size_t index = 0; index < request_list.size(); ++index) {
+        auto status = submitRequest(*request_list[index], *task_list[index]);
+        if (!status.ok()) return status;
+    }
+    return Status::OK();
+}
+
+// The copy runs in the submitting thread, the task is complete on return
+Status ShmTransport::submitRequest(const TransferRequest &request,
+                                   TransferTask &task) {
+    task.total_bytes = request.length;
+    Slice *slice = getSliceCache().allocate();
+    slice->source_addr = (char *)request.source;
+    slice->length = request.length;
+    slice->opcode = request.opcode;
+    slice->task = &task;
+    slice->target_id = request.target_id;
+    slice->status = Slice::PENDING;
+    slice->ts = 0;
+    task.slice_list.push_back(slice);
+    __sync_fetch_and_add(&task.slice_count, 1);
+
+    auto desc = metadata_->getSegmentDescByID(request.target_id);
+    void *target = desc ? translate(*desc, request) : nullptr;
+    if (!target) {
+        LOG(ERROR) << "ShmTransport: cannot map target "
+                   << (void *)request.target_offset << " of segment "
+                   << request.target_id;
+        slice->markFailed();
+        return Status::OK();
+    }
+    slice->local.dest_addr = target;
+    if (request.opcode == TransferRequest::WRITE)
+        copyData(target, request.source, request.length);
+    else
+        copyData(request.source, target, request.length);
+    slice->markSuccess();
+    return Status::OK();
+}
+
+}  // namespace mooncake
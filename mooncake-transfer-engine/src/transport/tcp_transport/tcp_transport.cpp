@@ -16,23 +16,48 @@
 
 #include <bits/stdint-uintn.h>
 #include <glog/logging.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
 
 #include <algorithm>
 #include <cassert>
+#include <cerrno>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <deque>
 #include <memory>
 #include <random>
 
 #include "common.h"
+#include "config.h"
 #include "transfer_engine.h"
 #include "transfer_metadata.h"
 #include "transfer_metadata_plugin.h"
 #include "transport/transport.h"
 
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
 namespace mooncake {
 using tcpsocket = asio::ip::tcp::socket;
 const static size_t kDefaultBufferSize = 65536;
+// Smaller sends are copied, pinning pages costs more than copying them
+const static size_t kZeroCopyMinSize = 16384;
+const static size_t kZeroCopyBufferSize = 262144;
 
 struct SessionHeader {
     uint64_t size;
@@ -41,7 +66,12 @@ struct SessionHeader {
 };
 
 struct Session : public std::enable_shared_from_this<Session> {
-    explicit Session(tcpsocket socket) : socket_(std::move(socket)) {}
+    explicit Session(tcpsocket socket, bool passive = false)
+        : socket_(std::move(socket)), passive_(passive) {
+        asio::error_code ec;
+        socket_.set_option(asio::ip::tcp::no_delay(true), ec);
+        if (globalConfig().tcp_zerocopy) enableZeroCopy();
+    }
 
     tcpsocket socket_;
     SessionHeader header_;
@@ -49,6 +79,17 @@ struct Session : public std::enable_shared_from_this<Session> {
     char *local_buffer_;
     std::function<void(TransferStatusEnum)> on_finalize_;
     std::mutex session_mutex_;
+    // Accepted sessions serve requests until the peer closes the connection
+    const bool passive_;
+    // Set once the session has served a request
+    bool reused_ = false;
+    // The body is sent with MSG_ZEROCOPY: the kernel references the pages
+    // instead of copying them, and reports on the error queue of the socket
+    // when it has released them
+    bool zerocopy_ = false;
+    // Zerocopy sends issued, and how many of them have been released
+    uint32_t zerocopy_sent_ = 0;
+    uint32_t zerocopy_released_ = 0;
 
     void initiate(void *buffer, uint64_t dest_addr, size_t size,
                   TransferRequest::OpCode opcode) {
@@ -68,6 +109,30 @@ struct Session : public std::enable_shared_from_this<Session> {
     }
 
    private:
+    void enableZeroCopy() {
+        int one = 1;
+        if (setsockopt(socket_.native_handle(), SOL_SOCKET, SO_ZEROCOPY, &one,
+                       sizeof(one))) {
+            // Kernels before 4.14
+            static std::atomic_bool warned(false);
+            if (!warned.exchange(true))
+                PLOG(WARNING)
+                    << "Session: SO_ZEROCOPY is not supported, copying sends";
+            return;
+        }
+        zerocopy_ = true;
+    }
+
+    // The session is unlocked before on_finalize_ runs, which may start the
+    // next request on it
+    void finalize(TransferStatusEnum status) {
+        auto on_finalize = std::move(on_finalize_);
+        on_finalize_ = nullptr;
+        session_mutex_.unlock();
+        if (on_finalize) on_finalize(status);
+        if (passive_ && status == TransferStatusEnum::COMPLETED) onAccept();
+    }
+
     void writeHeader() {
         // LOG(INFO) << "writeHeader";
         auto self(shared_from_this());
@@ -80,8 +145,7 @@ struct Session : public std::enable_shared_from_this<Session> {
                         << ec.message() << " (value: " << ec.value() << ")"
                         << ", bytes written: " << len
                         << ", expected: " << sizeof(SessionHeader);
-                    if (on_finalize_) on_finalize_(TransferStatusEnum::FAILED);
-                    session_mutex_.unlock();
+                    finalize(TransferStatusEnum::FAILED);
                     return;
                 }
                 if (header_.opcode == (uint8_t)TransferRequest::WRITE)
@@ -97,14 +161,18 @@ struct Session : public std::enable_shared_from_this<Session> {
         asio::async_read(
             socket_, asio::buffer(&header_, sizeof(SessionHeader)),
             [this, self](const asio::error_code &ec, std::size_t len) {
+                if (passive_ && ec == asio::error::eof && len == 0) {
+                    // The peer closed the connection between requests
+                    finalize(TransferStatusEnum::FAILED);
+                    return;
+                }
                 if (ec || len != sizeof(SessionHeader)) {
                     LOG(ERROR)
                         << "Session::readHeader failed. Error: " << ec.message()
                         << " (value: " << ec.value() << ")"
                         << ", bytes read: " << len
                         << ", expected: " << sizeof(SessionHeader);
-                    if (on_finalize_) on_finalize_(TransferStatusEnum::FAILED);
-                    session_mutex_.unlock();
+                    finalize(TransferStatusEnum::FAILED);
                     return;
                 }
 
@@ -116,7 +184,7 @@ struct Session : public std::enable_shared_from_this<Session> {
             });
     }
 
-    void writeBody() {
+    void writeBody(bool allow_zerocopy = true) {
         // LOG(INFO) << "writeBody";
         auto self(shared_from_this());
         uint64_t size = le64toh(header_.size);
@@ -125,8 +193,13 @@ struct Session : public std::enable_shared_from_this<Session> {
         size_t buffer_size =
             std::min(kDefaultBufferSize, size - total_transferred_bytes_);
         if (buffer_size == 0) {
-            if (on_finalize_) on_finalize_(TransferStatusEnum::COMPLETED);
-            session_mutex_.unlock();
+            finishWriteBody();
+            return;
+        }
+        if (zerocopy_ && allow_zerocopy &&
+            size - total_transferred_bytes_ >= kZeroCopyMinSize) {
+            writeBodyZeroCopy(std::min(kZeroCopyBufferSize,
+                                       size - total_transferred_bytes_));
             return;
         }
 
@@ -141,15 +214,100 @@ struct Session : public std::enable_shared_from_this<Session> {
                         << ", total_transferred_bytes_: "
                         << total_transferred_bytes_
                         << ", current transferred_bytes: " << transferred_bytes;
-                    if (on_finalize_) on_finalize_(TransferStatusEnum::FAILED);
-                    session_mutex_.unlock();
+                    finalize(TransferStatusEnum::FAILED);
+                    return;
+                }
+                total_transferred_bytes_ += transferred_bytes;
+                writeBody();
+            });
+    }
+
+    void writeBodyZeroCopy(size_t buffer_size) {
+        auto self(shared_from_this());
+        socket_.async_send(
+            asio::buffer(local_buffer_ + total_transferred_bytes_, buffer_size),
+            MSG_ZEROCOPY,
+            [this, self](const asio::error_code &ec,
+                         std::size_t transferred_bytes) {
+                if (ec == asio::error::no_buffer_space) {
+                    // Too many sends hold pages (net.core.optmem_max)
+                    writeBody(false);
+                    return;
+                }
+                if (ec) {
+                    LOG(ERROR)
+                        << "Session::writeBodyZeroCopy failed. Error: "
+                        << ec.message() << " (value: " << ec.value() << ")"
+                        << ", total_transferred_bytes_: "
+                        << total_transferred_bytes_;
+                    finalize(TransferStatusEnum::FAILED);
                     return;
                 }
+                zerocopy_sent_++;
                 total_transferred_bytes_ += transferred_bytes;
                 writeBody();
             });
     }
 
+    // The buffer must stay untouched until the kernel has released the
+    // pages of every zerocopy send, so the request completes only then
+    void finishWriteBody() {
+        if (zerocopy_released_ == zerocopy_sent_) {
+            finalize(TransferStatusEnum::COMPLETED);
+            return;
+        }
+        auto self(shared_from_this());
+        socket_.async_wait(
+            tcpsocket::wait_error, [this, self](const asio::error_code &ec) {
+                if (ec || !reapZeroCopy()) {
+                    LOG(ERROR) << "Session::finishWriteBody failed. Error: "
+                               << (ec ? ec.message() : strerror(errno));
+                    finalize(TransferStatusEnum::FAILED);
+                    return;
+                }
+                finishWriteBody();
+            });
+    }
+
+    // Consume the zerocopy notifications queued on the socket
+    bool reapZeroCopy() {
+        int fd = socket_.native_handle();
+        int err = 0;
+        socklen_t err_len = sizeof(err);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len) || err) {
+            if (err) errno = err;
+            return false;
+        }
+        while (true) {
+            char control[128];
+            msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+                if (errno == EINTR) continue;
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm;
+                 cm = CMSG_NXTHDR(&msg, cm)) {
+                bool ip_error =
+                    (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                    (cm->cmsg_level == SOL_IPV6 &&
+                     cm->cmsg_type == IPV6_RECVERR);
+                if (!ip_error) continue;
+                auto serr = (sock_extended_err *)CMSG_DATA(cm);
+                if (serr->ee_errno || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                    continue;
+                // Sends [ee_info, ee_data] have been released
+                if ((int32_t)(serr->ee_data + 1 - zerocopy_released_) > 0)
+                    zerocopy_released_ = serr->ee_data + 1;
+                // The kernel copied anyway, e.g. over loopback
+                if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                    zerocopy_ = false;
+            }
+        }
+    }
+
     void readBody() {
         // LOG(INFO) << "readBody";
         auto self(shared_from_this());
@@ -159,8 +317,7 @@ struct Session : public std::enable_shared_from_this<Session> {
         size_t buffer_size =
             std::min(kDefaultBufferSize, size - total_transferred_bytes_);
         if (buffer_size == 0) {
-            if (on_finalize_) on_finalize_(TransferStatusEnum::COMPLETED);
-            session_mutex_.unlock();
+            finalize(TransferStatusEnum::COMPLETED);
             return;
         }
 
@@ -175,8 +332,7 @@ struct Session : public std::enable_shared_from_this<Session> {
                         << ", total_transferred_bytes_: "
                         << total_transferred_bytes_
                         << ", current transferred_bytes: " << transferred_bytes;
-                    if (on_finalize_) on_finalize_(TransferStatusEnum::FAILED);
-                    session_mutex_.unlock();
+                    finalize(TransferStatusEnum::FAILED);
                     return;
                 }
                 total_transferred_bytes_ += transferred_bytes;
@@ -185,23 +341,55 @@ struct Session : public std::enable_shared_from_this<Session> {
     }
 };
 
+// Persistent connections to the data port of a peer
+struct TcpPeer {
+    asio::ip::tcp::resolver::results_type endpoints;
+    std::mutex mutex;
+    std::vector<std::shared_ptr<Session>> idle_sessions;
+    // Slices waiting for a connection, as many as allowed being busy
+    std::deque<Transport::Slice *> pending_slices;
+    // Connections open or being opened
+    int connections = 0;
+};
+
 struct TcpContext {
     TcpContext(short port)
         : acceptor(io_context,
-                   asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port)) {}
+                   asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port)),
+          work_guard(asio::make_work_guard(io_context)) {}
 
     void doAccept() {
         acceptor.async_accept([this](asio::error_code ec, tcpsocket socket) {
-            if (!ec) std::make_shared<Session>(std::move(socket))->onAccept();
+            if (!ec)
+                std::make_shared<Session>(std::move(socket), true)->onAccept();
             doAccept();
         });
     }
 
+    // Throws if host cannot be resolved
+    std::shared_ptr<TcpPeer> getPeer(const std::string &host, uint16_t port) {
+        auto key = host + ":" + std::to_string(port);
+        std::lock_guard<std::mutex> lock(peer_mutex);
+        auto it = peer_map.find(key);
+        if (it != peer_map.end()) return it->second;
+        asio::ip::tcp::resolver resolver(io_context);
+        auto peer = std::make_shared<TcpPeer>();
+        peer->endpoints =
+            resolver.resolve(asio::ip::tcp::v4(), host, std::to_string(port));
+        peer_map[key] = peer;
+        return peer;
+    }
+
     asio::io_context io_context;
     asio::ip::tcp::acceptor acceptor;
+    // Keeps the worker threads running while no operation is pending
+    asio::executor_work_guard<asio::io_context::executor_type> work_guard;
+    std::mutex peer_mutex;
+    std::unordered_map<std::string, std::shared_ptr<TcpPeer>> peer_map;
 };
 
-TcpTransport::TcpTransport() : context_(nullptr), running_(false) {
+TcpTransport::TcpTransport()
+    : context_(nullptr), running_(false), fallback_(false) {
     // TODO
 }
 
@@ -209,7 +397,7 @@ TcpTransport::~TcpTransport() {
     if (running_) {
         running_ = false;
         context_->io_context.stop();
-        thread_.join();
+        for (auto &worker : workers_) worker.join();
     }
 
     if (context_) {
@@ -249,12 +437,28 @@ int TcpTransport::install(std::string &local_server_name,
     close(sockfd); // the above function has opened a socket
     LOG(INFO) << "TcpTransport: listen on port " << tcp_port;
     context_ = new TcpContext(tcp_port);
+    context_->doAccept();
     running_ = true;
-    thread_ = std::thread(&TcpTransport::worker, this);
+    for (int i = 0; i < globalConfig().tcp_worker_threads; ++i)
+        workers_.emplace_back(&TcpTransport::worker, this, i);
     return 0;
 }
 
 int TcpTransport::allocateLocalSegmentID(int tcp_data_port) {
+    // Peers fail over to TCP when the segment of another transport
+    // advertises a data port, see MultiTransport::selectTransport()
+    auto local_desc = metadata_->getSegmentDescByID(LOCAL_SEGMENT_ID);
+    if (local_desc && local_desc->protocol != "tcp") {
+        auto desc = std::make_shared<SegmentDesc>(*local_desc);
+        desc->tcp_data_port = tcp_data_port;
+        metadata_->addLocalSegment(LOCAL_SEGMENT_ID, local_server_name_,
+                                   std::move(desc));
+        fallback_ = true;
+        LOG(INFO) << "TcpTransport: serving as fallback of "
+                  << local_desc->protocol;
+        return 0;
+    }
+
     auto desc = std::make_shared<SegmentDesc>();
     if (!desc) return ERR_MEMORY;
     desc->name = local_server_name_;
@@ -270,6 +474,7 @@ int TcpTransport::registerLocalMemory(void *addr, size_t length,
                                       bool remote_accessible,
                                       bool update_metadata) {
     (void)remote_accessible;
+    if (fallback_) return 0;
     BufferDesc buffer_desc;
     buffer_desc.name = local_server_name_;
     buffer_desc.addr = (uint64_t)addr;
@@ -278,6 +483,7 @@ int TcpTransport::registerLocalMemory(void *addr, size_t length,
 }
 
 int TcpTransport::unregisterLocalMemory(void *addr, bool update_metadata) {
+    if (fallback_) return 0;
     return metadata_->removeLocalMemoryBuffer(addr, update_metadata);
 }
 
@@ -297,7 +503,9 @@ int TcpTransport::unregisterLocalMemoryBatch(
 
 Status TcpTransport::getTransferStatus(BatchID batch_id, size_t task_id,
                                        TransferStatus &status) {
-    auto &batch_desc = *((BatchDesc *)(batch_id));
+    auto batch_desc_ptr = getBatchDesc(batch_id);
+    if (!batch_desc_ptr) return Status::InvalidArgument("Invalid batch ID");
+    auto &batch_desc = *batch_desc_ptr;
     const size_t task_count = batch_desc.task_list.size();
     if (task_id >= task_count) {
         return Status::InvalidArgument(
@@ -323,7 +531,9 @@ Status TcpTransport::getTransferStatus(BatchID batch_id, size_t task_id,
 
 Status TcpTransport::submitTransfer(
     BatchID batch_id, const std::vector<TransferRequest> &entries) {
-    auto &batch_desc = *((BatchDesc *)(batch_id));
+    auto batch_desc_ptr = getBatchDesc(batch_id);
+    if (!batch_desc_ptr) return Status::InvalidArgument("Invalid batch ID");
+    auto &batch_desc = *batch_desc_ptr;
     if (batch_desc.task_list.size() + entries.size() > batch_desc.batch_size) {
         LOG(ERROR) << "TcpTransport: Exceed the limitation of current batch's "
                       "capacity";
@@ -338,19 +548,7 @@ Status TcpTransport::submitTransfer(
     for (auto &request : entries) {
         TransferTask &task = batch_desc.task_list[task_id];
         ++task_id;
-        task.total_bytes = request.length;
-        Slice *slice = getSliceCache().allocate();
-        slice->source_addr = (char *)request.source;
-        slice->length = request.length;
-        slice->opcode = request.opcode;
-        slice->tcp.dest_addr = request.target_offset;
-        slice->task = &task;
-        slice->target_id = request.target_id;
-        slice->status = Slice::PENDING;
-        slice->ts = 0;
-        task.slice_list.push_back(slice);
-        __sync_fetch_and_add(&task.slice_count, 1);
-        startTransfer(slice);
+        submitRequest(request, task);
     }
 
     return Status::OK();
@@ -359,34 +557,65 @@ Status TcpTransport::submitTransfer(
 Status TcpTransport::submitTransferTask(
     const std::vector<TransferRequest *> &request_list,
     const std::vector<TransferTask *> &task_list) {
-    for (size_t index = 0; index < request_list.size(); ++index) {
-        auto &request = *request_list[index];
-        auto &task = *task_list[index];
-        task.total_bytes = request.length;
+    for (size_t index = 0; index < request_list.size(); ++index)
+        submitRequest(*request_list[index], *task_list[index]);
+    return Status::OK();
+}
+
+void TcpTransport::submitRequest(const TransferRequest &request,
+                                 TransferTask &task) {
+    const size_t slice_size = request.options.slice_size
+                                  ? request.options.slice_size
+                                  : configSnapshot().tcp_slice_size;
+    task.total_bytes = request.length;
+    std::vector<Slice *> slice_list;
+    uint64_t offset = 0;
+    do {
         Slice *slice = getSliceCache().allocate();
-        slice->source_addr = (char *)request.source;
-        slice->length = request.length;
+        slice->source_addr = (char *)request.source + offset;
+        slice->length = std::min(slice_size, request.length - offset);
         slice->opcode = request.opcode;
-        slice->tcp.dest_addr = request.target_offset;
+        slice->tcp.dest_addr = request.target_offset + offset;
+        slice->tcp.retried = false;
         slice->task = &task;
         slice->target_id = request.target_id;
         slice->status = Slice::PENDING;
         slice->ts = 0;
         task.slice_list.push_back(slice);
-        __sync_fetch_and_add(&task.slice_count, 1);
-        startTransfer(slice);
-    }
-    return Status::OK();
+        slice_list.push_back(slice);
+        offset += slice->length;
+    } while (offset < request.length);
+    // All slices are counted before any of them can finish the task
+    __sync_fetch_and_add(&task.slice_count, slice_list.size());
+    for (auto slice : slice_list) startTransfer(slice);
 }
 
-void TcpTransport::worker() {
+void TcpTransport::worker(int index) {
+    // Spread the threads over the CPUs the process may run on
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        int target = index * CPU_COUNT(&allowed) /
+                     globalConfig().tcp_worker_threads;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (!CPU_ISSET(cpu, &allowed) || target--) continue;
+            cpu_set_t cpuset;
+            CPU_ZERO(&cpuset);
+            CPU_SET(cpu, &cpuset);
+            int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpuset),
+                                            &cpuset);
+            if (rc)
+                LOG(WARNING) << "TcpTransport: failed to pin worker " << index
+                             << " to CPU " << cpu << ": " << strerror(rc);
+            break;
+        }
+    }
+
     while (running_) {
         try {
-            context_->doAccept();
             context_->io_context.run();
         } catch (std::exception &e) {
             LOG(ERROR) << "TcpTransport::worker encountered an exception "
-                          "during doAccept/run: "
+                          "during run: "
                        << e.what();
         }
     }
@@ -394,8 +623,6 @@ void TcpTransport::worker() {
 
 void TcpTransport::startTransfer(Slice *slice) {
     try {
-        asio::ip::tcp::resolver resolver(context_->io_context);
-        asio::ip::tcp::socket socket(context_->io_context);
         auto desc = metadata_->getSegmentDescByID(slice->target_id);
         if (!desc) {
             LOG(ERROR) << "TcpTransport::startTransfer failed to get segment "
@@ -413,19 +640,26 @@ void TcpTransport::startTransfer(Slice *slice) {
             slice->markFailed();
             return;
         }
-        auto endpoint_iterator =
-            resolver.resolve(asio::ip::tcp::v4(), meta_entry.ip_or_host_name,
-                             std::to_string(desc->tcp_data_port));
-        asio::connect(socket, endpoint_iterator);
-        auto session = std::make_shared<Session>(std::move(socket));
-        session->on_finalize_ = [slice](TransferStatusEnum status) {
-            if (status == TransferStatusEnum::COMPLETED)
-                slice->markSuccess();
-            else
-                slice->markFailed();
-        };
-        session->initiate(slice->source_addr, slice->tcp.dest_addr,
-                          slice->length, slice->opcode);
+        auto peer =
+            context_->getPeer(meta_entry.ip_or_host_name, desc->tcp_data_port);
+        std::shared_ptr<Session> session;
+        {
+            std::lock_guard<std::mutex> lock(peer->mutex);
+            if (!peer->idle_sessions.empty()) {
+                session = std::move(peer->idle_sessions.back());
+                peer->idle_sessions.pop_back();
+            } else if (peer->connections <
+                       globalConfig().tcp_connections_per_peer) {
+                peer->connections++;
+            } else {
+                peer->pending_slices.push_back(slice);
+                return;
+            }
+        }
+        if (session)
+            startTransfer(peer, session, slice);
+        else
+            connect(peer, slice);
     } catch (std::exception &e) {
         LOG(ERROR) << "TcpTransport::startTransfer encountered an ASIO "
                       "exception. Slice details - source_addr: "
@@ -436,4 +670,95 @@ void TcpTransport::startTransfer(Slice *slice) {
         slice->markFailed();
     }
 }
+
+void TcpTransport::startTransfer(const std::shared_ptr<TcpPeer> &peer,
+                                 const std::shared_ptr<Session> &session,
+                                 Slice *slice) {
+    // A raw pointer, the session must not own itself through on_finalize_
+    Session *raw_session = session.get();
+    session->on_finalize_ = [this, peer, raw_session,
+                             slice](TransferStatusEnum status) {
+        auto session = raw_session->shared_from_this();
+        bool failed = status != TransferStatusEnum::COMPLETED;
+        if (failed && session->reused_ && !slice->tcp.retried) {
+            // The peer may have closed the idle connection, e.g. when it
+            // restarted. Requests are idempotent, retry on a new one
+            slice->tcp.retried = true;
+            releaseSession(peer, std::move(session), true);
+            startTransfer(slice);
+            return;
+        }
+        if (failed)
+            slice->markFailed();
+        else
+            slice->markSuccess();
+        releaseSession(peer, std::move(session), failed);
+    };
+    session->initiate(slice->source_addr, slice->tcp.dest_addr, slice->length,
+                      slice->opcode);
+}
+
+void TcpTransport::connect(const std::shared_ptr<TcpPeer> &peer,
+                           Slice *slice) {
+    auto socket = std::make_shared<tcpsocket>(context_->io_context);
+    asio::async_connect(
+        *socket, peer->endpoints,
+        [this, peer, socket, slice](const asio::error_code &ec,
+                                    const asio::ip::tcp::endpoint &) {
+            if (ec) {
+                LOG(ERROR) << "TcpTransport::connect failed. Error: "
+                           << ec.message() << " (value: " << ec.value()
+                           << ")";
+                std::vector<Slice *> failed_slices{slice};
+                {
+                    std::lock_guard<std::mutex> lock(peer->mutex);
+                    peer->connections--;
+                    // No connection is left to serve the waiting slices
+                    if (peer->connections == 0) {
+                        failed_slices.insert(failed_slices.end(),
+                                             peer->pending_slices.begin(),
+                                             peer->pending_slices.end());
+                        peer->pending_slices.clear();
+                    }
+                }
+                for (auto failed_slice : failed_slices)
+                    failed_slice->markFailed();
+                return;
+            }
+            startTransfer(peer, std::make_shared<Session>(std::move(*socket)),
+                          slice);
+        });
+}
+
+void TcpTransport::releaseSession(const std::shared_ptr<TcpPeer> &peer,
+                                  std::shared_ptr<Session> session,
+                                  bool failed) {
+    Slice *next_slice = nullptr;
+    std::vector<std::shared_ptr<Session>> stale_sessions;
+    {
+        std::lock_guard<std::mutex> lock(peer->mutex);
+        if (failed) {
+            peer->connections--;
+            if (session->reused_) {
+                // Idle connections opened as long ago are likely closed too
+                stale_sessions.swap(peer->idle_sessions);
+                peer->connections -= stale_sessions.size();
+            }
+        } else {
+            session->reused_ = true;
+        }
+        if (!peer->pending_slices.empty()) {
+            next_slice = peer->pending_slices.front();
+            peer->pending_slices.pop_front();
+            if (failed) peer->connections++;
+        } else if (!failed) {
+            peer->idle_sessions.push_back(std::move(session));
+        }
+    }
+    if (!next_slice) return;
+    if (failed)
+        connect(peer, next_slice);
+    else
+        startTransfer(peer, session, next_slice);
+}
 }  // namespace mooncake
@@ -14,33 +14,335 @@
 
 #include "transport/transport.h"
 
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <ctime>
+#include <mutex>
+#include <vector>
+
 #include "error.h"
 #include "transfer_engine.h"
 
 namespace mooncake {
+namespace {
+class SliceDepot {
+   public:
+    using Magazine = Transport::ThreadLocalSliceCache::Magazine;
+
+    // Full and empty magazines kept each, beyond which they are freed
+    const static size_t kMaxMagazines = 256;
+
+    Magazine *takeFull() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (full_.empty()) return nullptr;
+        auto magazine = full_.back();
+        full_.pop_back();
+        return magazine;
+    }
+
+    Magazine *takeEmpty() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!empty_.empty()) {
+                auto magazine = empty_.back();
+                empty_.pop_back();
+                return magazine;
+            }
+        }
+        return new Magazine();
+    }
+
+    void put(Magazine *magazine) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto &list = magazine->count ? full_ : empty_;
+            if (list.size() < kMaxMagazines) {
+                list.push_back(magazine);
+                return;
+            }
+        }
+        for (size_t i = 0; i < magazine->count; ++i)
+            delete magazine->slices[i];
+        freed.fetch_add(magazine->count, std::memory_order_relaxed);
+        delete magazine;
+    }
+
+    std::atomic<uint64_t> allocated{0}, reused{0}, freed{0};
+
+   private:
+    std::mutex mutex_;
+    std::vector<Magazine *> full_, empty_;
+};
+
+// Outlives the thread-local caches returning their magazines to it
+SliceDepot &sliceDepot() {
+    static auto depot = new SliceDepot();
+    return *depot;
+}
+}  // namespace
+
+Transport::ThreadLocalSliceCache::ThreadLocalSliceCache()
+    : loaded_(sliceDepot().takeEmpty()), previous_(sliceDepot().takeEmpty()) {}
+
+Transport::ThreadLocalSliceCache::~ThreadLocalSliceCache() {
+    publishStats();
+    sliceDepot().put(loaded_);
+    sliceDepot().put(previous_);
+}
+
+bool Transport::ThreadLocalSliceCache::refill() {
+    publishStats();
+    auto full = sliceDepot().takeFull();
+    if (!full) return false;
+    sliceDepot().put(previous_);
+    previous_ = loaded_;
+    loaded_ = full;
+    return true;
+}
+
+void Transport::ThreadLocalSliceCache::flush() {
+    publishStats();
+    sliceDepot().put(previous_);
+    previous_ = loaded_;
+    loaded_ = sliceDepot().takeEmpty();
+}
+
+void Transport::ThreadLocalSliceCache::publishStats() {
+    auto &depot = sliceDepot();
+    depot.allocated.fetch_add(allocated_, std::memory_order_relaxed);
+    depot.reused.fetch_add(reused_, std::memory_order_relaxed);
+    allocated_ = reused_ = 0;
+}
+
+Transport::SliceStats Transport::getSliceStats() {
+    auto &depot = sliceDepot();
+    return {depot.allocated.load(std::memory_order_relaxed),
+            depot.reused.load(std::memory_order_relaxed),
+            depot.freed.load(std::memory_order_relaxed)};
+}
+
+namespace {
+struct TrafficClassCounters {
+    std::atomic<uint64_t> bytes{0}, slices{0}, latency_ns{0};
+};
+
+TrafficClassCounters
+    traffic_class_counters[Transport::TransferRequest::kTrafficClassCount];
+}  // namespace
+
+Transport::TrafficClassStats Transport::getTrafficClassStats(
+    TransferRequest::TrafficClass traffic_class) {
+    auto &counters = traffic_class_counters[traffic_class];
+    return {counters.bytes.load(std::memory_order_relaxed),
+            counters.slices.load(std::memory_order_relaxed),
+            counters.latency_ns.load(std::memory_order_relaxed)};
+}
+
+void Transport::recordTrafficClass(TransferRequest::TrafficClass traffic_class,
+                                   const TrafficClassStats &completed) {
+    auto &counters = traffic_class_counters[traffic_class];
+    counters.bytes.fetch_add(completed.bytes, std::memory_order_relaxed);
+    counters.slices.fetch_add(completed.slices, std::memory_order_relaxed);
+    counters.latency_ns.fetch_add(completed.latency_ns,
+                                  std::memory_order_relaxed);
+}
+
 thread_local static Transport::ThreadLocalSliceCache tl_slice_cache;
 
 Transport::ThreadLocalSliceCache &Transport::getSliceCache() {
     return tl_slice_cache;
 }
 
+namespace {
+struct BatchSlot {
+    // Never zero, so that zero is never a valid BatchID
+    std::atomic<uint32_t> generation{1};
+    Transport::BatchDesc desc;
+};
+
+// Slots are allocated by chunks which are never freed, so that looking up a
+// slot takes no lock
+class BatchSlotTable {
+   public:
+    const static size_t kChunkSize = 4096;
+    const static size_t kMaxChunks = 4096;
+
+    BatchSlot *get(uint32_t index) {
+        if (index / kChunkSize >= kMaxChunks) return nullptr;
+        auto chunk =
+            chunks_[index / kChunkSize].load(std::memory_order_acquire);
+        return chunk ? &chunk[index % kChunkSize] : nullptr;
+    }
+
+    // Take up to count free slots, returns the number taken
+    size_t acquire(uint32_t *indexes, size_t count) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_.empty()) {
+            if (size_ / kChunkSize >= kMaxChunks) return 0;
+            chunks_[size_ / kChunkSize].store(new BatchSlot[kChunkSize],
+                                              std::memory_order_release);
+            for (size_t i = kChunkSize; i > 0; --i)
+                free_.push_back(size_ + i - 1);
+            size_ += kChunkSize;
+        }
+        size_t taken = 0;
+        while (taken < count && !free_.empty()) {
+            indexes[taken++] = free_.back();
+            free_.pop_back();
+        }
+        return taken;
+    }
+
+    void release(const uint32_t *indexes, size_t count) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.insert(free_.end(), indexes, indexes + count);
+    }
+
+   private:
+    std::mutex mutex_;
+    std::vector<uint32_t> free_;
+    size_t size_ = 0;
+    std::atomic<BatchSlot *> chunks_[kMaxChunks] = {};
+};
+
+// Outlives the thread-local caches returning their slots to it
+BatchSlotTable &batchSlotTable() {
+    static auto table = new BatchSlotTable();
+    return *table;
+}
+
+struct ThreadLocalBatchCache {
+    const static size_t kCapacity = 64;
+
+    ~ThreadLocalBatchCache() { batchSlotTable().release(indexes, count); }
+
+    uint32_t indexes[kCapacity];
+    size_t count = 0;
+};
+
+thread_local static ThreadLocalBatchCache tl_batch_cache;
+
+std::atomic<uint64_t> abortable_batch_count{0};
+}  // namespace
+
+Transport::BatchDesc *Transport::getBatchDesc(BatchID batch_id) {
+    auto slot = batchSlotTable().get(uint32_t(batch_id));
+    if (!slot ||
+        slot->generation.load(std::memory_order_acquire) != batch_id >> 32)
+        return nullptr;
+    return &slot->desc;
+}
+
+Transport::BatchDesc *Transport::newBatchDesc(size_t batch_size) {
+    auto &cache = tl_batch_cache;
+    if (!cache.count)
+        cache.count = batchSlotTable().acquire(
+            cache.indexes, ThreadLocalBatchCache::kCapacity / 2);
+    if (!cache.count) return nullptr;
+    uint32_t index = cache.indexes[--cache.count];
+    auto slot = batchSlotTable().get(index);
+    auto &batch_desc = slot->desc;
+    batch_desc.id = (BatchID(slot->generation.load()) << 32) | index;
+    batch_desc.batch_size = batch_size;
+    batch_desc.task_list.reserve(batch_size);
+    batch_desc.context = nullptr;
+    batch_desc.start_timestamp = 0;
+    batch_desc.canceled.store(false, std::memory_order_relaxed);
+    batch_desc.deadline.store(0, std::memory_order_relaxed);
+    batch_desc.total_slices.store(0, std::memory_order_relaxed);
+    batch_desc.finished_slices.store(0, std::memory_order_relaxed);
+    batch_desc.failed_slices.store(0, std::memory_order_relaxed);
+    batch_desc.retried_slices.store(0, std::memory_order_relaxed);
+    batch_desc.transferred_bytes.store(0, std::memory_order_relaxed);
+    return &batch_desc;
+}
+
+void Transport::releaseBatchDesc(BatchDesc *batch_desc) {
+    uint32_t index = uint32_t(batch_desc->id);
+    auto slot = batchSlotTable().get(index);
+    uint32_t generation = slot->generation.load() + 1;
+    slot->generation.store(generation ? generation : 1,
+                           std::memory_order_release);
+    // Keeps the capacity of the task list for the next batch of the slot
+    batch_desc->task_list.clear();
+    if (batch_desc->abortable.exchange(false, std::memory_order_relaxed))
+        abortable_batch_count.fetch_sub(1, std::memory_order_relaxed);
+    auto &cache = tl_batch_cache;
+    if (cache.count == ThreadLocalBatchCache::kCapacity) {
+        const size_t kept = ThreadLocalBatchCache::kCapacity / 2;
+        batchSlotTable().release(cache.indexes + kept, cache.count - kept);
+        cache.count = kept;
+    }
+    cache.indexes[cache.count++] = index;
+}
+
+// Make the batch abortable before its deadline or cancellation is visible
+static void markAbortable(Transport::BatchDesc &batch_desc) {
+    if (!batch_desc.abortable.load(std::memory_order_relaxed) &&
+        !batch_desc.abortable.exchange(true))
+        abortable_batch_count.fetch_add(1);
+}
+
+Status Transport::setBatchDeadline(BatchID batch_id, int64_t deadline_ns) {
+    auto batch_desc = getBatchDesc(batch_id);
+    if (!batch_desc) return Status::InvalidArgument("Invalid batch ID");
+    markAbortable(*batch_desc);
+    batch_desc->deadline.store(deadline_ns);
+    return Status::OK();
+}
+
+Status Transport::cancelBatch(BatchID batch_id) {
+    auto batch_desc = getBatchDesc(batch_id);
+    if (!batch_desc) return Status::InvalidArgument("Invalid batch ID");
+    markAbortable(*batch_desc);
+    batch_desc->canceled.store(true);
+    // Waiters see the tasks canceled at once
+    batch_desc->progress.fetch_add(1);
+    if (batch_desc->waiters.load()) wakeBatchWaiters(batch_desc);
+    return Status::OK();
+}
+
+bool Transport::hasAbortableBatches() {
+    return abortable_batch_count.load(std::memory_order_relaxed);
+}
+
+uint32_t Transport::getBatchProgress(BatchID batch_id) {
+    auto batch_desc = getBatchDesc(batch_id);
+    return batch_desc ? batch_desc->progress.load() : 0;
+}
+
+void Transport::waitBatchProgress(BatchID batch_id, uint32_t progress,
+                                  int64_t timeout_ns) {
+    auto batch_desc_ptr = getBatchDesc(batch_id);
+    if (!batch_desc_ptr) return;
+    auto &batch_desc = *batch_desc_ptr;
+    struct timespec timeout;
+    timeout.tv_sec = timeout_ns / 1000000000;
+    timeout.tv_nsec = timeout_ns % 1000000000;
+    batch_desc.waiters.fetch_add(1);
+    // Returns at once if progress has changed in the meantime
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&batch_desc.progress),
+            FUTEX_WAIT_PRIVATE, progress, &timeout, nullptr, 0);
+    batch_desc.waiters.fetch_sub(1);
+}
+
+void Transport::wakeBatchWaiters(BatchDesc *batch_desc) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&batch_desc->progress),
+            FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+}
+
 Transport::BatchID Transport::allocateBatchID(size_t batch_size) {
-    auto batch_desc = new BatchDesc();
+    auto batch_desc = newBatchDesc(batch_size);
     if (!batch_desc) return ERR_MEMORY;
-    batch_desc->id = BatchID(batch_desc);
-    batch_desc->batch_size = batch_size;
-    batch_desc->task_list.reserve(batch_size);
-    batch_desc->context = NULL;
-#ifdef CONFIG_USE_BATCH_DESC_SET
-    batch_desc_lock_.lock();
-    batch_desc_set_[batch_desc->id] = batch_desc;
-    batch_desc_lock_.unlock();
-#endif
     return batch_desc->id;
 }
 
 Status Transport::freeBatchID(BatchID batch_id) {
-    auto &batch_desc = *((BatchDesc *)(batch_id));
+    auto batch_desc_ptr = getBatchDesc(batch_id);
+    if (!batch_desc_ptr) return Status::InvalidArgument("Invalid batch ID");
+    auto &batch_desc = *batch_desc_ptr;
     const size_t task_count = batch_desc.task_list.size();
     for (size_t task_id = 0; task_id < task_count; task_id++) {
         if (!batch_desc.task_list[task_id].is_finished) {
@@ -49,11 +351,8 @@ Status Transport::freeBatchID(BatchID batch_id) {
                 "BatchID cannot be freed until all tasks are done");
         }
     }
-    delete &batch_desc;
-#ifdef CONFIG_USE_BATCH_DESC_SET
-    RWSpinlock::WriteGuard guard(batch_desc_lock_);
-    batch_desc_set_.erase(batch_id);
-#endif
+    while (batch_desc.finishing.load()) PAUSE();
+    releaseBatchDesc(&batch_desc);
     return Status::OK();
 }
 
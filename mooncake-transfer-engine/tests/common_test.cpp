@@ -4,6 +4,7 @@
 #include <optional>
 
 #include "common.h"
+#include "config.h"
 
 
 namespace {
@@ -238,4 +239,53 @@ TEST(ParseHostNameWithPortAscend, HostPortDevice) {
     EXPECT_EQ(dev, 1);
 }
 
+//------------------------------------------------------------------------------
+// NicPathTable
+//------------------------------------------------------------------------------
+
+TEST(NicPathTable, InternIsIdempotent) {
+    auto id = InternNicPath("server_a@mlx5_0");
+    ASSERT_NE(id, kInvalidNicPathID);
+    EXPECT_EQ(InternNicPath("server_a@mlx5_0"), id);
+    EXPECT_NE(InternNicPath("server_a@mlx5_1"), id);
+    EXPECT_EQ(NicPathOf(id), "server_a@mlx5_0");
+}
+
+TEST(NicPathTable, UnknownID) {
+    EXPECT_EQ(NicPathOf(kInvalidNicPathID), "");
+}
+
+//------------------------------------------------------------------------------
+// updateConfigOption
+//------------------------------------------------------------------------------
+
+TEST(UpdateConfigOption, PublishesNewSnapshot) {
+    const GlobalConfig &before = configSnapshot();
+    size_t slice_size = before.slice_size;
+    ASSERT_EQ(updateConfigOption("slice_size", "262144"), 0);
+    const GlobalConfig &after = configSnapshot();
+    EXPECT_EQ(after.slice_size, 262144u);
+    EXPECT_GE(after.max_slice_size, after.slice_size);
+    // Earlier snapshots stay as they were
+    EXPECT_EQ(before.slice_size, slice_size);
+    ASSERT_EQ(updateConfigOption("slice_size", std::to_string(slice_size)),
+              0);
+}
+
+TEST(UpdateConfigOption, TrafficClassWeights) {
+    ASSERT_EQ(updateConfigOption("traffic_class_weights", "2,2,1"), 0);
+    EXPECT_EQ(configSnapshot().traffic_class_weights[0], 2);
+    EXPECT_EQ(configSnapshot().traffic_class_weights[2], 1);
+    ASSERT_EQ(updateConfigOption("traffic_class_weights", "8,4,1"), 0);
+}
+
+TEST(UpdateConfigOption, RejectsInvalidOptions) {
+    int retry_cnt = configSnapshot().retry_cnt;
+    EXPECT_NE(updateConfigOption("retry_cnt", "0"), 0);
+    EXPECT_NE(updateConfigOption("retry_cnt", "abc"), 0);
+    EXPECT_NE(updateConfigOption("max_wr", "16"), 0);
+    EXPECT_NE(updateConfigOption("traffic_class_weights", "1,2"), 0);
+    EXPECT_EQ(configSnapshot().retry_cnt, retry_cnt);
+}
+
 }  // namespace
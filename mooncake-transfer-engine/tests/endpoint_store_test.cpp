@@ -0,0 +1,244 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "transport/rdma_transport/endpoint_store.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "config.h"
+#include "transport/rdma_transport/rdma_transport.h"
+
+namespace mooncake {
+namespace {
+
+// An endpoint without QPs, connected and disconnected by the test in place
+// of the handshake
+class FakeEndPoint : public RdmaEndPoint {
+   public:
+    FakeEndPoint(RdmaContext &context) : RdmaEndPoint(context) {}
+
+    void setConnected(bool connected) {
+        status_.store(connected ? CONNECTED : UNCONNECTED);
+    }
+
+    bool hasOutstandingSlice() const override { return false; }
+
+    void disconnect() override { setConnected(false); }
+
+    int destroyQP() override { return 0; }
+};
+
+// A context that needs no device and hands out FakeEndPoints
+class FakeRdmaContext : public RdmaContext {
+   public:
+    FakeRdmaContext(RdmaTransport &engine) : RdmaContext(engine, "fake0") {}
+
+    std::shared_ptr<RdmaEndPoint> newEndpoint() override {
+        if (out_of_qps) return nullptr;
+        return std::make_shared<FakeEndPoint>(*this);
+    }
+
+    // Fails creating endpoints as a device without free QPs does
+    bool out_of_qps = false;
+};
+
+NicPathID PeerNic(int index) {
+    return InternNicPath("192.168.0.1:12001@mlx5_" + std::to_string(index));
+}
+
+void SetConnected(const std::shared_ptr<RdmaEndPoint> &endpoint,
+                  bool connected) {
+    static_cast<FakeEndPoint *>(endpoint.get())->setConnected(connected);
+}
+
+class EndpointStoreTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        keepalive_ms_ = globalConfig().endpoint_keepalive_ms;
+    }
+
+    void TearDown() override {
+        globalConfig().endpoint_keepalive_ms = keepalive_ms_;
+    }
+
+    // Inserts the endpoint of the peer and connects it as the handshake does
+    std::shared_ptr<RdmaEndPoint> Connect(EndpointStore &store, int peer) {
+        auto endpoint = store.insertEndpoint(PeerNic(peer), &context_);
+        if (endpoint) SetConnected(endpoint, true);
+        return endpoint;
+    }
+
+    RdmaTransport transport_;
+    FakeRdmaContext context_{transport_};
+    int keepalive_ms_ = 0;
+};
+
+TEST_F(EndpointStoreTest, ReleasedEndpointIsReused) {
+    SIEVEEndpointStore sieve(8);
+    FIFOEndpointStore fifo(8);
+    EndpointStore *stores[] = {&sieve, &fifo};
+    for (auto *store : stores) {
+        auto endpoint = Connect(*store, 0);
+        ASSERT_NE(endpoint, nullptr);
+        EXPECT_EQ(store->releaseEndpoint(PeerNic(0)), 0);
+        EXPECT_EQ(store->getEndpoint(PeerNic(0)), nullptr);
+        EXPECT_EQ(store->getSize(), 0u);
+
+        // Reopening the segment takes the kept endpoint, still connected
+        EXPECT_EQ(store->insertEndpoint(PeerNic(0), &context_), endpoint);
+        EXPECT_TRUE(endpoint->connected());
+        EXPECT_EQ(store->getEndpoint(PeerNic(0)), endpoint);
+        EXPECT_EQ(store->reconnects(), 0u);
+    }
+}
+
+TEST_F(EndpointStoreTest, DeletedOrDisconnectedEndpointIsNotReused) {
+    SIEVEEndpointStore store(8);
+    auto deleted = Connect(store, 0);
+    ASSERT_NE(deleted, nullptr);
+    store.releaseEndpoint(PeerNic(0));
+    // Deleting drops the kept endpoint as well
+    store.deleteEndpoint(PeerNic(0));
+    auto endpoint = store.insertEndpoint(PeerNic(0), &context_);
+    ASSERT_NE(endpoint, nullptr);
+    EXPECT_NE(endpoint, deleted);
+    EXPECT_EQ(store.reconnects(), 1u);
+
+    // A kept endpoint that lost its connection is replaced
+    SetConnected(endpoint, true);
+    store.releaseEndpoint(PeerNic(0));
+    endpoint->disconnect();
+    auto replaced = store.insertEndpoint(PeerNic(0), &context_);
+    ASSERT_NE(replaced, nullptr);
+    EXPECT_NE(replaced, endpoint);
+    EXPECT_EQ(store.reconnects(), 2u);
+
+    // Unconnected endpoints are not kept at all
+    store.releaseEndpoint(PeerNic(0));
+    EXPECT_NE(store.insertEndpoint(PeerNic(0), &context_), replaced);
+}
+
+TEST_F(EndpointStoreTest, KeptEndpointsAreDroppedBeforeLiveOnes) {
+    SIEVEEndpointStore store(2);
+    auto kept = Connect(store, 0);
+    store.releaseEndpoint(PeerNic(0));
+    auto first = Connect(store, 1);
+    auto second = Connect(store, 2);
+    ASSERT_NE(first, nullptr);
+    ASSERT_NE(second, nullptr);
+    // The kept endpoint counts towards the capacity and made room
+    EXPECT_EQ(store.getEndpoint(PeerNic(1)), first);
+    EXPECT_EQ(store.getEndpoint(PeerNic(2)), second);
+    EXPECT_EQ(store.getSize(), 2u);
+    EXPECT_NE(store.insertEndpoint(PeerNic(0), &context_), kept);
+}
+
+TEST_F(EndpointStoreTest, KeptEndpointsExpire) {
+    SIEVEEndpointStore store(8);
+    globalConfig().endpoint_keepalive_ms = 1;
+    auto endpoint = Connect(store, 0);
+    store.releaseEndpoint(PeerNic(0));
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    store.reclaimEndpoint();
+    EXPECT_NE(store.insertEndpoint(PeerNic(0), &context_), endpoint);
+
+    // A keep-alive of 0 disables keeping them
+    globalConfig().endpoint_keepalive_ms = 0;
+    endpoint = Connect(store, 1);
+    store.releaseEndpoint(PeerNic(1));
+    EXPECT_NE(store.insertEndpoint(PeerNic(1), &context_), endpoint);
+}
+
+TEST_F(EndpointStoreTest, WeightedStoreEvictsIdleEndpoints) {
+    WeightedEndpointStore store(3);
+    auto busy = Connect(store, 0);
+    auto idle = Connect(store, 1);
+    auto recent = Connect(store, 2);
+    ASSERT_NE(busy, nullptr);
+    ASSERT_NE(idle, nullptr);
+    ASSERT_NE(recent, nullptr);
+    busy->recordPosted(64 << 20);
+    recent->recordPosted(1 << 20);
+
+    // The endpoint without traffic goes, however recently it was added
+    ASSERT_NE(Connect(store, 3), nullptr);
+    EXPECT_EQ(store.getEndpoint(PeerNic(1)), nullptr);
+    EXPECT_FALSE(idle->active());
+    EXPECT_EQ(store.getEndpoint(PeerNic(0)), busy);
+    EXPECT_EQ(store.getEndpoint(PeerNic(2)), recent);
+    EXPECT_EQ(store.getSize(), 3u);
+}
+
+TEST_F(EndpointStoreTest, WeightedStoreWeighsConnectionCost) {
+    WeightedEndpointStore store(2);
+    auto slow = Connect(store, 0);
+    auto fast = Connect(store, 1);
+    ASSERT_NE(slow, nullptr);
+    ASSERT_NE(fast, nullptr);
+    slow->recordConnect(50000000);
+    fast->recordConnect(1000000);
+    // Equal traffic, the endpoint that is quicker to connect again goes
+    slow->recordPosted(1 << 20);
+    fast->recordPosted(1 << 20);
+    ASSERT_NE(Connect(store, 2), nullptr);
+    EXPECT_EQ(store.getEndpoint(PeerNic(0)), slow);
+    EXPECT_EQ(store.getEndpoint(PeerNic(1)), nullptr);
+}
+
+TEST_F(EndpointStoreTest, WeightedStoreSkipsUnhealthyEndpoints) {
+    WeightedEndpointStore store(8);
+    auto healthy = Connect(store, 0);
+    auto broken = Connect(store, 1);
+    ASSERT_NE(healthy, nullptr);
+    ASSERT_NE(broken, nullptr);
+    store.releaseEndpoint(PeerNic(0));
+    store.releaseEndpoint(PeerNic(1));
+    broken->disconnect();
+
+    // Only the kept endpoint that is still connected is taken back
+    EXPECT_EQ(store.insertEndpoint(PeerNic(0), &context_), healthy);
+    auto replaced = store.insertEndpoint(PeerNic(1), &context_);
+    ASSERT_NE(replaced, nullptr);
+    EXPECT_NE(replaced, broken);
+    EXPECT_EQ(store.reconnects(), 1u);
+}
+
+TEST_F(EndpointStoreTest, WeightedStoreCapacityFollowsTheDevice) {
+    WeightedEndpointStore store(8);
+    EXPECT_EQ(store.getCapacity(), 8u);
+    for (int peer = 0; peer < 3; ++peer)
+        ASSERT_NE(Connect(store, peer), nullptr);
+
+    // Out of QPs, the store holds no more than it has and makes room
+    context_.out_of_qps = true;
+    EXPECT_EQ(store.insertEndpoint(PeerNic(3), &context_), nullptr);
+    EXPECT_EQ(store.getCapacity(), 3u);
+    EXPECT_EQ(store.getSize(), 2u);
+
+    // The next endpoint fits in the room made, the capacity does not grow
+    // back yet
+    context_.out_of_qps = false;
+    ASSERT_NE(Connect(store, 3), nullptr);
+    ASSERT_NE(Connect(store, 4), nullptr);
+    EXPECT_EQ(store.getCapacity(), 3u);
+    EXPECT_EQ(store.getSize(), 3u);
+}
+
+}  // namespace
+}  // namespace mooncake
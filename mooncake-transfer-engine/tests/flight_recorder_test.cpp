@@ -0,0 +1,73 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "flight_recorder.h"
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mooncake {
+namespace {
+
+std::vector<std::string> Lines(const std::string &text) {
+    std::vector<std::string> lines;
+    std::stringstream ss(text);
+    std::string line;
+    while (std::getline(ss, line)) lines.push_back(line);
+    return lines;
+}
+
+TEST(FlightRecorderTest, DumpsEventsInOrder) {
+    std::thread([] {
+        FlightRecorder::record(FlightEvent::kSubmit, 7, 3, 12288);
+        FlightRecorder::record(FlightEvent::kRetry, 42, 4096, 1);
+        FlightRecorder::record(FlightEvent::kFail, 42, 4096, 9);
+        auto lines = Lines(FlightRecorder::dump());
+        ASSERT_EQ(lines.size(), 3);
+        EXPECT_NE(lines[0].find("submit id=7 arg0=3 arg1=12288"),
+                  std::string::npos);
+        EXPECT_NE(lines[1].find("retry id=42"), std::string::npos);
+        EXPECT_NE(lines[2].find("fail id=42 arg0=4096 arg1=9"),
+                  std::string::npos);
+    }).join();
+    // The ring of an exited thread is dropped
+    EXPECT_TRUE(FlightRecorder::dump().empty());
+}
+
+TEST(FlightRecorderTest, KeepsTheLastEvents) {
+    std::thread([] {
+        for (uint64_t i = 0; i < 10000; ++i)
+            FlightRecorder::record(FlightEvent::kComplete, i, 64, 0);
+        auto lines = Lines(FlightRecorder::dump());
+        ASSERT_EQ(lines.size(), 4096);
+        EXPECT_NE(lines.back().find("id=9999 "), std::string::npos);
+        EXPECT_EQ(Lines(FlightRecorder::dump(10)).size(), 10);
+    }).join();
+}
+
+TEST(FlightRecorderTest, DisabledRecordsNothing) {
+    FlightRecorder::setEnabled(false);
+    std::thread([] {
+        FlightRecorder::record(FlightEvent::kPost, 1, 1, 1);
+        EXPECT_TRUE(FlightRecorder::dump().empty());
+    }).join();
+    FlightRecorder::setEnabled(true);
+}
+
+}  // namespace
+}  // namespace mooncake
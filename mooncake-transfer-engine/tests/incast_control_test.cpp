@@ -0,0 +1,54 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "transport/rdma_transport/incast_control.h"
+
+#include <gtest/gtest.h>
+
+namespace mooncake {
+namespace {
+
+const uint64_t kGiB = 1ull << 30;
+
+uint64_t Grant(IncastControl &control, const std::string &sender,
+               uint64_t demand) {
+    IncastControl::CreditDesc request, grant;
+    request.name = sender;
+    request.demand = demand;
+    EXPECT_EQ(control.onCreditRequest(request, grant), 0);
+    EXPECT_EQ(grant.lease_ms, IncastControl::kLeaseMs);
+    return grant.rate;
+}
+
+TEST(IncastControlTest, SharesInboundRateBetweenSenders) {
+    IncastControl control(nullptr, "decode:12345", 12 * kGiB);
+    EXPECT_EQ(Grant(control, "prefill-0", 0), 12 * kGiB);
+    EXPECT_EQ(Grant(control, "prefill-1", 0), 6 * kGiB);
+    EXPECT_EQ(Grant(control, "prefill-2", 0), 4 * kGiB);
+    // A sender asking for less gets it, the others share the rest
+    EXPECT_EQ(Grant(control, "prefill-3", 1 * kGiB), 1 * kGiB);
+    EXPECT_EQ(Grant(control, "prefill-0", 0), 11 * kGiB / 3);
+}
+
+TEST(IncastControlTest, SendersOfPastLeasesAreForgotten) {
+    IncastControl control(nullptr, "decode:12345", 8 * kGiB);
+    EXPECT_EQ(Grant(control, "prefill-0", 0), 8 * kGiB);
+    EXPECT_EQ(Grant(control, "prefill-1", 0), 4 * kGiB);
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(3 * IncastControl::kLeaseMs));
+    EXPECT_EQ(Grant(control, "prefill-1", 0), 8 * kGiB);
+}
+
+}  // namespace
+}  // namespace mooncake
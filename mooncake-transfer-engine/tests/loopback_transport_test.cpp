@@ -0,0 +1,102 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "transport/loopback_transport/loopback_transport.h"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#include "transfer_engine.h"
+#include "transport/transport.h"
+
+using namespace mooncake;
+
+namespace mooncake {
+
+class LoopbackTransportTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        google::InitGoogleLogging("LoopbackTransportTest");
+        FLAGS_logtostderr = 1;
+
+        const char *env = std::getenv("MC_METADATA_SERVER");
+        metadata_server = env ? env : P2PHANDSHAKE;
+    }
+
+    void TearDown() override { google::ShutdownGoogleLogging(); }
+
+    void transfer(TransferEngine *engine, Transport::SegmentID segment_id,
+                  TransferRequest::OpCode opcode, void *source,
+                  uint64_t target, size_t length) {
+        auto batch_id = engine->allocateBatchID(1);
+        TransferRequest entry;
+        entry.opcode = opcode;
+        entry.length = length;
+        entry.source = source;
+        entry.target_id = segment_id;
+        entry.target_offset = target;
+        Status s = engine->submitTransfer(batch_id, {entry});
+        ASSERT_TRUE(s.ok());
+        TransferStatus status;
+        do {
+            s = engine->getTransferStatus(batch_id, 0, status);
+            ASSERT_TRUE(s.ok());
+            ASSERT_NE(status.s, TransferStatusEnum::FAILED);
+        } while (status.s != TransferStatusEnum::COMPLETED);
+        EXPECT_EQ(status.transferred_bytes, length);
+        ASSERT_TRUE(engine->freeBatchID(batch_id).ok());
+    }
+
+    std::string metadata_server;
+};
+
+TEST_F(LoopbackTransportTest, WriteAndReadLocalSegment) {
+    auto engine = std::make_unique<TransferEngine>(false);
+    ASSERT_EQ(engine->init(metadata_server, "127.0.0.1:17711", "127.0.0.1",
+                           17711),
+              0);
+    // Any transport publishes the local segment
+    ASSERT_NE(engine->installTransport("shm", nullptr), nullptr);
+
+    // Copied inline, and spread over the workers
+    for (size_t length : {size_t(4096), size_t(9 << 20)}) {
+        std::vector<char> buffer(3 * length);
+        for (size_t i = 0; i < length; ++i)
+            buffer[i] = 'a' + lrand48() % 26;
+        ASSERT_EQ(engine->registerLocalMemory(buffer.data(), buffer.size(),
+                                              "cpu:0"),
+                  0);
+        auto segment_id = engine->openSegment("127.0.0.1:17711");
+        transfer(engine.get(), segment_id, TransferRequest::WRITE,
+                 buffer.data(), (uint64_t)buffer.data() + length, length);
+        EXPECT_EQ(memcmp(buffer.data(), buffer.data() + length, length), 0);
+        transfer(engine.get(), segment_id, TransferRequest::READ,
+                 buffer.data() + 2 * length,
+                 (uint64_t)buffer.data() + length, length);
+        EXPECT_EQ(memcmp(buffer.data(), buffer.data() + 2 * length, length),
+                  0);
+        engine->unregisterLocalMemory(buffer.data());
+    }
+}
+
+}  // namespace mooncake
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
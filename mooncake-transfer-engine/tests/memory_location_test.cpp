@@ -123,3 +123,37 @@ TEST(MemoryLocationTest, MallocMultipleNodes) {
 
     numa_free(addr, size);
 }
+
+TEST(MemoryLocationTest, LargeBufferMatchesEveryPage) {
+    // Half of the buffer faulted, so that its node changes midway
+    const size_t size = 4096 * 5000;
+    void *addr = numa_alloc_onnode(size, 0);
+    ASSERT_NE(addr, nullptr);
+    memset(addr, 0, 4096 * 2600 + 100);
+
+    std::vector<void *> pages(size / 4096);
+    std::vector<int> status(pages.size());
+    for (size_t i = 0; i < pages.size(); ++i)
+        pages[i] = (char *)addr + i * 4096;
+    ASSERT_EQ(numa_move_pages(0, pages.size(), pages.data(), nullptr,
+                              status.data(), 0),
+              0);
+    size_t expected = 1;
+    for (size_t i = 1; i < status.size(); ++i)
+        if (status[i] != status[i - 1]) ++expected;
+
+    auto entries = mooncake::getMemoryLocation(addr, size);
+    ASSERT_EQ(entries.size(), expected);
+    uint64_t next = reinterpret_cast<uint64_t>(addr);
+    for (auto &entry : entries) {
+        EXPECT_EQ(entry.start, next);
+        size_t page = (entry.start - reinterpret_cast<uint64_t>(addr)) / 4096;
+        EXPECT_EQ(entry.location,
+                  status[page] >= 0 ? "cpu:" + std::to_string(status[page])
+                                    : mooncake::kWildcardLocation);
+        next += entry.len;
+    }
+    EXPECT_EQ(next, reinterpret_cast<uint64_t>(addr) + size);
+
+    numa_free(addr, size);
+}
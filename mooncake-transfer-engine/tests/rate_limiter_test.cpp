@@ -0,0 +1,72 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "rate_limiter.h"
+
+#include <gtest/gtest.h>
+
+namespace mooncake {
+namespace {
+
+const uint64_t kSecond = 1000000000;
+
+TEST(RateLimiterTest, BucketRefillsAtItsRate) {
+    TokenBucket bucket(1 << 20, 1 << 16);
+    const uint64_t start = 10 * kSecond;
+    EXPECT_EQ(bucket.available(start), 1 << 16);
+    // A burst overdraws the bucket, which pays it off at 1 MiB/s
+    bucket.consume(1 << 17, start);
+    EXPECT_EQ(bucket.available(start), 0);
+    EXPECT_EQ(bucket.available(start + kSecond / 16), 0);
+    EXPECT_NEAR(bucket.available(start + kSecond / 8), 1 << 16, 1);
+    EXPECT_NEAR(bucket.available(start + kSecond), 1 << 16, 1);
+    EXPECT_EQ(bucket.admitted_bytes.load(), 1 << 17);
+}
+
+TEST(RateLimiterTest, MatchesRules) {
+    ASSERT_EQ(RateLimiter::setRules("segment=*,class=background,rate=2G;"
+                                    "device=mlx5_0,rate=10G,burst=64M"),
+              0);
+    auto &rules = RateLimiter::rules();
+    ASSERT_EQ(rules.rules.size(), 2);
+    // Background traffic to each peer has a bucket of its own
+    auto a = rules.match("node-a:12345", "mlx5_1", 2);
+    auto b = rules.match("node-b:12345", "mlx5_1", 2);
+    ASSERT_EQ(a.size(), 1);
+    ASSERT_EQ(b.size(), 1);
+    EXPECT_NE(a[0], b[0]);
+    EXPECT_EQ(rules.match("node-a:12345", "mlx5_1", 2)[0], a[0]);
+    EXPECT_TRUE(rules.match("node-a:12345", "mlx5_1", 0).empty());
+    // All the traffic of mlx5_0 shares one
+    auto c = rules.match("node-a:12345", "mlx5_0", 2);
+    auto d = rules.match("node-b:12345", "mlx5_0", 0);
+    ASSERT_EQ(c.size(), 2);
+    ASSERT_EQ(d.size(), 1);
+    EXPECT_EQ(c[1], d[0]);
+
+    std::string metrics;
+    RateLimiter::appendMetrics(metrics);
+    EXPECT_NE(metrics.find("bucket=\"segment=node-b:12345\""),
+              std::string::npos);
+
+    EXPECT_NE(RateLimiter::setRules("rate=fast"), 0);
+    EXPECT_NE(RateLimiter::setRules("class=bulk,rate=1G"), 0);
+    EXPECT_NE(RateLimiter::setRules("segment=node-a:12345"), 0);
+    EXPECT_EQ(&RateLimiter::rules(), &rules);
+    ASSERT_EQ(RateLimiter::setRules(""), 0);
+    EXPECT_TRUE(RateLimiter::rules().rules.empty());
+}
+
+}  // namespace
+}  // namespace mooncake
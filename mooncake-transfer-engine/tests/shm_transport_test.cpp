@@ -0,0 +1,135 @@
+// Copyright 2024 KVCache.AI
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "transport/shm_transport/shm_transport.h"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#include "transfer_engine.h"
+#include "transport/transport.h"
+
+using namespace mooncake;
+
+namespace mooncake {
+
+class ShmTransportTest : public ::testing::Test {
+   protected:
+    void SetUp() override {
+        google::InitGoogleLogging("ShmTransportTest");
+        FLAGS_logtostderr = 1;
+
+        const char *env = std::getenv("MC_METADATA_SERVER");
+        metadata_server = env ? env : P2PHANDSHAKE;
+        LOG(INFO) << "metadata_server: " << metadata_server;
+    }
+
+    void TearDown() override { google::ShutdownGoogleLogging(); }
+
+    std::unique_ptr<TransferEngine> createEngine(const std::string &name) {
+        auto engine = std::make_unique<TransferEngine>(false);
+        auto hostname_port = parseHostNameWithPort(name);
+        int rc = engine->init(metadata_server, name,
+                              hostname_port.first.c_str(),
+                              hostname_port.second);
+        EXPECT_EQ(rc, 0);
+        EXPECT_NE(engine->installTransport("shm", nullptr), nullptr);
+        return engine;
+    }
+
+    void transfer(TransferEngine *engine, Transport::SegmentID segment_id,
+                  TransferRequest::OpCode opcode, void *source,
+                  uint64_t target, size_t length) {
+        auto batch_id = engine->allocateBatchID(1);
+        TransferRequest entry;
+        entry.opcode = opcode;
+        entry.length = length;
+        entry.source = source;
+        entry.target_id = segment_id;
+        entry.target_offset = target;
+        Status s = engine->submitTransfer(batch_id, {entry});
+        ASSERT_TRUE(s.ok());
+        TransferStatus status;
+        do {
+            s = engine->getTransferStatus(batch_id, 0, status);
+            ASSERT_TRUE(s.ok());
+            ASSERT_NE(status.s, TransferStatusEnum::FAILED);
+        } while (status.s != TransferStatusEnum::COMPLETED);
+        EXPECT_EQ(status.transferred_bytes, length);
+        ASSERT_TRUE(engine->freeBatchID(batch_id).ok());
+    }
+
+    std::string metadata_server;
+};
+
+TEST_F(ShmTransportTest, WriteAndReadPeerSegment) {
+    const size_t kLength = 4 << 20;
+    auto target = createEngine("127.0.0.1:17701");
+    auto initiator = createEngine("127.0.0.1:17702");
+
+    // The target segment is mapped by the initiator through its memfd
+    void *shared = ShmTransport::allocateSharedMemory(kLength);
+    ASSERT_NE(shared, nullptr);
+    ASSERT_EQ(target->registerLocalMemory(shared, kLength, "cpu:0"), 0);
+
+    std::vector<char> local(2 * kLength);
+    for (size_t i = 0; i < kLength; ++i) local[i] = 'a' + lrand48() % 26;
+    ASSERT_EQ(initiator->registerLocalMemory(local.data(), local.size(),
+                                             "cpu:0"),
+              0);
+
+    auto segment_id = initiator->openSegment("127.0.0.1:17701");
+    auto desc = initiator->getMetadata()->getSegmentDescByID(segment_id);
+    ASSERT_TRUE(desc);
+    ASSERT_EQ(desc->shm_buffers.size(), 1u);
+    EXPECT_EQ(desc->shm_buffers[0].addr, (uint64_t)shared);
+
+    transfer(initiator.get(), segment_id, TransferRequest::WRITE,
+             local.data(), (uint64_t)shared, kLength);
+    EXPECT_EQ(memcmp(shared, local.data(), kLength), 0);
+
+    transfer(initiator.get(), segment_id, TransferRequest::READ,
+             local.data() + kLength, (uint64_t)shared, kLength);
+    EXPECT_EQ(memcmp(local.data(), local.data() + kLength, kLength), 0);
+
+    initiator->unregisterLocalMemory(local.data());
+    target->unregisterLocalMemory(shared);
+    ShmTransport::freeSharedMemory(shared);
+}
+
+TEST_F(ShmTransportTest, LocalSegment) {
+    const size_t kLength = 1 << 20;
+    auto engine = createEngine("127.0.0.1:17703");
+    std::vector<char> buffer(2 * kLength);
+    for (size_t i = 0; i < kLength; ++i) buffer[i] = 'a' + lrand48() % 26;
+    ASSERT_EQ(engine->registerLocalMemory(buffer.data(), buffer.size(),
+                                          "cpu:0"),
+              0);
+    auto segment_id = engine->openSegment("127.0.0.1:17703");
+    transfer(engine.get(), segment_id, TransferRequest::WRITE, buffer.data(),
+             (uint64_t)buffer.data() + kLength, kLength);
+    EXPECT_EQ(memcmp(buffer.data(), buffer.data() + kLength, kLength), 0);
+    engine->unregisterLocalMemory(buffer.data());
+}
+
+}  // namespace mooncake
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -17,6 +17,7 @@
 #include <gtest/gtest.h>
 #include <sys/time.h>
 
+#include <chrono>
 #include <cstdlib>
 #include <fstream>
 #include <iomanip>
@@ -43,6 +44,7 @@ static void checkCudaError(cudaError_t result, const char *message) {
 }
 #endif
 
+#include "config.h"
 #include "transfer_engine.h"
 #include "transport/transport.h"
 
@@ -341,6 +343,136 @@ TEST_F(TCPTransportTest, WriteAndRead2test) {
                            kDataLength));
 }
 
+// A TcpTransport installed after another transport only adds its data port
+// to the segment, which peers with TCP alone are then routed to
+TEST_F(TCPTransportTest, RoutesToTcpFallback) {
+    const size_t kDataLength = 1 << 20;
+    auto hostname_port = parseHostNameWithPort(local_server_name);
+    std::string target_name = hostname_port.first + ":" +
+                              std::to_string(hostname_port.second + 2);
+    auto target = std::make_unique<TransferEngine>(false);
+    auto target_hostname_port = parseHostNameWithPort(target_name);
+    int rc = target->init(metadata_server, target_name,
+                          target_hostname_port.first.c_str(),
+                          target_hostname_port.second);
+    LOG_ASSERT(rc == 0);
+    ASSERT_NE(target->installTransport("shm", nullptr), nullptr);
+    ASSERT_NE(target->installTransport("tcp", nullptr), nullptr);
+    auto local_desc =
+        target->getMetadata()->getSegmentDescByID(LOCAL_SEGMENT_ID);
+    ASSERT_EQ(local_desc->protocol, "shm");
+    ASSERT_GT(local_desc->tcp_data_port, 0);
+
+    auto engine = std::make_unique<TransferEngine>(false);
+    rc = engine->init(metadata_server, local_server_name,
+                      hostname_port.first.c_str(), hostname_port.second);
+    LOG_ASSERT(rc == 0);
+    ASSERT_NE(engine->installTransport("tcp", nullptr), nullptr);
+
+    std::vector<char> remote(kDataLength), local(kDataLength);
+    for (auto &c : local) c = 'a' + lrand48() % 26;
+    ASSERT_EQ(target->registerLocalMemory(remote.data(), kDataLength,
+                                          "cpu:0"),
+              0);
+    ASSERT_EQ(engine->registerLocalMemory(local.data(), kDataLength,
+                                          "cpu:0"),
+              0);
+
+    auto segment_id = engine->openSegment(target_name);
+    auto batch_id = engine->allocateBatchID(1);
+    TransferRequest entry;
+    entry.opcode = TransferRequest::WRITE;
+    entry.length = kDataLength;
+    entry.source = local.data();
+    entry.target_id = segment_id;
+    entry.target_offset = (uint64_t)remote.data();
+    Status s = engine->submitTransfer(batch_id, {entry});
+    ASSERT_TRUE(s.ok());
+    TransferStatus status;
+    do {
+        s = engine->getTransferStatus(batch_id, 0, status);
+        ASSERT_TRUE(s.ok());
+        ASSERT_NE(status.s, TransferStatusEnum::FAILED);
+    } while (status.s != TransferStatusEnum::COMPLETED);
+    ASSERT_TRUE(engine->freeBatchID(batch_id).ok());
+    EXPECT_EQ(memcmp(local.data(), remote.data(), kDataLength), 0);
+
+    engine->unregisterLocalMemory(local.data());
+    target->unregisterLocalMemory(remote.data());
+}
+
+// Throughput over loopback with the given number of connections, each
+// request being striped over all of them
+class TCPTransportBenchTest : public TCPTransportTest,
+                              public ::testing::WithParamInterface<int> {};
+
+TEST_P(TCPTransportBenchTest, Throughput) {
+    const int streams = GetParam();
+    const size_t kDataLength = 256ull << 20;
+    const int kRounds = 4;
+    auto &config = globalConfig();
+    const int saved_connections = config.tcp_connections_per_peer;
+    config.tcp_connections_per_peer = streams;
+
+    auto engine = std::make_unique<TransferEngine>(false);
+    auto hostname_port = parseHostNameWithPort(local_server_name);
+    engine->init(metadata_server, local_server_name,
+                 hostname_port.first.c_str(), hostname_port.second);
+    Transport *xport = engine->installTransport("tcp", nullptr);
+    LOG_ASSERT(xport != nullptr);
+
+    void *addr = allocateMemoryPool(2 * kDataLength, 0, false);
+    int rc = engine->registerLocalMemory(addr, 2 * kDataLength, "cpu:0");
+    LOG_ASSERT(!rc);
+    for (size_t offset = 0; offset < kDataLength; ++offset)
+        *((char *)(addr) + offset) = 'a' + lrand48() % 26;
+
+    auto segment_id = engine->openSegment(local_server_name);
+    auto segment_desc = engine->getMetadata()->getSegmentDescByID(segment_id);
+    uint64_t remote_base = (uint64_t)segment_desc->buffers[0].addr;
+
+    for (auto opcode : {TransferRequest::WRITE, TransferRequest::READ}) {
+        auto start = std::chrono::steady_clock::now();
+        for (int round = 0; round < kRounds; ++round) {
+            auto batch_id = engine->allocateBatchID(1);
+            TransferRequest entry;
+            entry.opcode = opcode;
+            entry.length = kDataLength;
+            entry.source = (uint8_t *)(addr) + kDataLength;
+            entry.target_id = segment_id;
+            entry.target_offset = remote_base;
+            if (opcode == TransferRequest::WRITE) {
+                entry.source = (uint8_t *)(addr);
+                entry.target_offset = remote_base + kDataLength;
+            }
+            Status s = engine->submitTransfer(batch_id, {entry});
+            LOG_ASSERT(s.ok());
+            TransferStatus status;
+            do {
+                s = engine->getTransferStatus(batch_id, 0, status);
+                ASSERT_EQ(s, Status::OK());
+                ASSERT_NE(status.s, TransferStatusEnum::FAILED);
+            } while (status.s != TransferStatusEnum::COMPLETED);
+            ASSERT_EQ(status.transferred_bytes, kDataLength);
+            s = engine->freeBatchID(batch_id);
+            ASSERT_EQ(s, Status::OK());
+        }
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        LOG(INFO) << (opcode == TransferRequest::WRITE ? "write" : "read")
+                  << " streams=" << streams << " throughput="
+                  << kRounds * kDataLength / elapsed.count() / (1 << 30)
+                  << " GB/s";
+    }
+    LOG_ASSERT(0 == memcmp((uint8_t *)(addr), (uint8_t *)(addr) + kDataLength,
+                           kDataLength));
+    numa_free(addr, 2 * kDataLength);
+    config.tcp_connections_per_peer = saved_connections;
+}
+
+INSTANTIATE_TEST_SUITE_P(Streams, TCPTransportBenchTest,
+                         ::testing::Values(1, 4, 16));
+
 }  // namespace mooncake
 
 int main(int argc, char **argv) {
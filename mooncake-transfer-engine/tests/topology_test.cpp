@@ -106,6 +106,44 @@ TEST(ToplogyTest, TestSelectDeviceAny) {
     ASSERT_TRUE(items.empty());
 }
 
+TEST(ToplogyTest, TestSelectHealthyDevice) {
+    mooncake::Topology topology;
+    std::string json_str = "{\"cpu:0\" : [[\"erdma_0\", \"erdma_1\"],[]]}";
+    topology.parse(json_str);
+    auto healthy = topology.deviceHealth(0);
+    auto degraded = topology.deviceHealth(1);
+    ASSERT_TRUE(healthy && degraded);
+    for (int i = 0; i < 64; ++i) {
+        healthy->recordSuccess(10000, 65536);
+        degraded->recordSuccess(100000, 65536);
+    }
+    int selected[2] = {0, 0};
+    for (int i = 0; i < 9000; ++i) selected[topology.selectDevice("cpu:0")]++;
+    ASSERT_GT(selected[0], selected[1] * 4);
+    ASSERT_GT(selected[1], 0);
+
+    // Copies share the scores
+    auto copy = topology;
+    ASSERT_TRUE(copy.healthToJson()["erdma_1"]["degraded"].asBool());
+    for (int i = 0; i < 200; ++i) degraded->recordSuccess(10000, 65536);
+    ASSERT_FALSE(copy.healthToJson()["erdma_1"]["degraded"].asBool());
+    for (int i = 0; i < 10; ++i) healthy->recordFailure();
+    ASSERT_TRUE(topology.healthToJson()["erdma_0"]["degraded"].asBool());
+}
+
+TEST(ToplogyTest, TestSelectDeviceByRate) {
+    mooncake::Topology topology;
+    std::string json_str = "{\"cpu:0\" : [[\"erdma_0\", \"erdma_1\"],[]]}";
+    topology.parse(json_str);
+    ASSERT_EQ(topology.setDeviceRate("erdma_0", 400), 0);
+    ASSERT_EQ(topology.setDeviceRate("erdma_1", 100), 0);
+    ASSERT_NE(topology.setDeviceRate("erdma_2", 100), 0);
+    int selected[2] = {0, 0};
+    for (int i = 0; i < 10000; ++i) selected[topology.selectDevice("cpu:0")]++;
+    ASSERT_GT(selected[0], selected[1] * 2);
+    ASSERT_GT(selected[1], 0);
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -19,6 +19,7 @@
 #include <gtest/gtest.h>
 #include <sys/time.h>
 
+#include <algorithm>
 #include <cstdlib>
 
 #include "transport/transport.h"
@@ -79,6 +80,30 @@ TEST_F(TransferMetadataTest, LocalSegmentTest) {
     ASSERT_EQ(re, 0);
 }
 
+// open cached segments in a batch
+TEST_F(TransferMetadataTest, GetSegmentIDsTest) {
+    std::vector<std::string> segment_names;
+    for (int i = 0; i < 4; ++i) {
+        auto segment_des = std::make_shared<TransferMetadata::SegmentDesc>();
+        segment_des->name = "test_batch_segment_" + std::to_string(i);
+        segment_des->protocol = "rdma";
+        int re = metadata_client->addLocalSegment(2222222 + i,
+                                                  segment_des->name,
+                                                  std::move(segment_des));
+        ASSERT_EQ(re, 0);
+        segment_names.push_back("test_batch_segment_" + std::to_string(i));
+    }
+    segment_names.push_back(segment_names[1]);
+    auto ids = metadata_client->getSegmentIDs(segment_names);
+    ASSERT_EQ(ids.size(), segment_names.size());
+    for (int i = 0; i < 4; ++i) ASSERT_EQ(ids[i], 2222222 + i);
+    ASSERT_EQ(ids[4], ids[1]);
+    for (int i = 0; i < 4; ++i) {
+        int re = metadata_client->removeLocalSegment(segment_names[i]);
+        ASSERT_EQ(re, 0);
+    }
+}
+
 // add and remove LocalMemoryBufferMeta
 TEST_F(TransferMetadataTest, LocalMemoryBufferTest) {
     auto segment_des = std::make_shared<TransferMetadata::SegmentDesc>();
@@ -107,6 +132,80 @@ TEST_F(TransferMetadataTest, LocalMemoryBufferTest) {
     ASSERT_EQ(re, 0);
 }
 
+// look up buffers by address in a segment
+TEST_F(TransferMetadataTest, FindBufferTest) {
+    TransferMetadata::SegmentDesc desc;
+    // Registered out of address order
+    for (int i : {3, 0, 2, 1}) {
+        TransferMetadata::BufferDesc buffer_des;
+        buffer_des.addr = 4096 + i * 2048;
+        buffer_des.length = 1024;
+        desc.buffers.push_back(buffer_des);
+    }
+    for (size_t i = 0; i < desc.buffers.size(); ++i) {
+        auto addr = desc.buffers[i].addr;
+        ASSERT_EQ(desc.findBuffer(addr, 1024), (int)i);
+        ASSERT_EQ(desc.findBuffer(addr + 512, 512), (int)i);
+        ASSERT_EQ(desc.findBuffer(addr + 512, 1024), -1);
+        ASSERT_EQ(desc.findBuffer(addr + 1024, 1), -1);
+    }
+    ASSERT_EQ(desc.findBuffer(0, 1), -1);
+    ASSERT_EQ(desc.findBuffer(4096 - 1, 2), -1);
+
+    // A copy indexes its own buffers
+    auto copy = desc;
+    TransferMetadata::BufferDesc buffer_des;
+    buffer_des.addr = 64;
+    buffer_des.length = 1 << 20;
+    copy.buffers.push_back(buffer_des);
+    ASSERT_EQ(copy.findBuffer(4096 + 1536, 1024), 4);
+    ASSERT_EQ(copy.findBuffer(4096 + 2048, 1024), 3);
+    ASSERT_EQ(desc.findBuffer(4096 + 1536, 1024), -1);
+}
+
+// encode and decode buffers compactly
+TEST_F(TransferMetadataTest, CompactBuffersTest) {
+    std::vector<TransferMetadata::BufferDesc> buffers;
+    for (int i = 0; i < 64; ++i) {
+        TransferMetadata::BufferDesc buffer_des;
+        buffer_des.name = "cpu:" + std::to_string(i % 2);
+        // Not sorted by address
+        buffer_des.addr = (1ull << 40) + (uint64_t)(i * 37 % 64) * (1 << 30);
+        buffer_des.length = 1 << 30;
+        for (int j = 0; j < 8; ++j) {
+            buffer_des.rkey.push_back(0x100000 + i * 0x100 + j);
+            buffer_des.lkey.push_back(j % 2 ? 0x100000 + i * 0x100 + j : 7);
+        }
+        if (i == 1) buffer_des.shm_name = "shm";
+        buffers.push_back(buffer_des);
+    }
+    auto blob = TransferMetadata::encodeCompactBuffers(buffers);
+    std::vector<TransferMetadata::BufferDesc> decoded;
+    ASSERT_TRUE(TransferMetadata::decodeCompactBuffers(blob, decoded));
+    ASSERT_EQ(decoded.size(), buffers.size());
+    for (auto &buffer : buffers) {
+        auto iter = std::find_if(decoded.begin(), decoded.end(),
+                                 [&](const TransferMetadata::BufferDesc &d) {
+                                     return d.addr == buffer.addr;
+                                 });
+        ASSERT_NE(iter, decoded.end());
+        ASSERT_EQ(iter->name, buffer.name);
+        ASSERT_EQ(iter->length, buffer.length);
+        ASSERT_EQ(iter->rkey, buffer.rkey);
+        ASSERT_EQ(iter->lkey, buffer.lkey);
+        ASSERT_EQ(iter->shm_name, buffer.shm_name);
+    }
+
+    // Truncated blobs and unknown versions are rejected
+    for (size_t size = 0; size < blob.size(); ++size) {
+        decoded.clear();
+        ASSERT_FALSE(TransferMetadata::decodeCompactBuffers(
+            blob.substr(0, size), decoded));
+    }
+    blob[0] = 0;
+    ASSERT_FALSE(TransferMetadata::decodeCompactBuffers(blob, decoded));
+}
+
 // add, get and remove RPCMetaEntryMeta
 TEST_F(TransferMetadataTest, RpcMetaEntryTest) {
     auto hostname_port = parseHostNameWithPort(local_server_name);
@@ -15,13 +15,21 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
+#include <poll.h>
 #include <sys/time.h>
 
+#include <atomic>
+#include <condition_variable>
 #include <cstdlib>
 #include <fstream>
 #include <iomanip>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
+#include "batch_notifier.h"
+#include "multi_transport.h"
 #include "transfer_engine.h"
 #include "transport/transport.h"
 
@@ -171,6 +179,205 @@ TEST_F(TransportTest, ReadEmptyFile) {
 
     close(fd);
 }
+
+TEST_F(TransportTest, BatchIDReuse) {
+    std::string server_name = "localhost";
+    MultiTransport transport(nullptr, server_name);
+    auto batch_id = transport.allocateBatchID(16);
+    auto batch_desc = Transport::getBatchDesc(batch_id);
+    ASSERT_NE(batch_desc, nullptr);
+    EXPECT_EQ(batch_desc->batch_size, 16u);
+    EXPECT_GE(batch_desc->task_list.capacity(), 16u);
+    ASSERT_TRUE(transport.freeBatchID(batch_id).ok());
+
+    // The slot is recycled for the next batch, under a new ID
+    auto next_batch_id = transport.allocateBatchID(4);
+    EXPECT_NE(next_batch_id, batch_id);
+    EXPECT_EQ(Transport::getBatchDesc(next_batch_id), batch_desc);
+    EXPECT_GE(batch_desc->task_list.capacity(), 16u);
+    EXPECT_EQ(Transport::getBatchDesc(batch_id), nullptr);
+    EXPECT_FALSE(transport.freeBatchID(batch_id).ok());
+    EXPECT_EQ(Transport::getBatchDesc(0), nullptr);
+    EXPECT_EQ(Transport::getBatchDesc(Transport::INVALID_BATCH_ID), nullptr);
+    ASSERT_TRUE(transport.freeBatchID(next_batch_id).ok());
+}
+
+TEST_F(TransportTest, ConcurrentTaskClaims) {
+    std::string server_name = "localhost";
+    MultiTransport transport(nullptr, server_name);
+    const size_t kThreads = 8, kClaims = 64, kCount = 2;
+    auto batch_id = transport.allocateBatchID(kThreads * kClaims * kCount);
+    auto batch_desc = Transport::getBatchDesc(batch_id);
+    ASSERT_NE(batch_desc, nullptr);
+
+    // Each task is claimed exactly once, whichever thread gets it
+    std::vector<std::atomic<int>> owners(batch_desc->batch_size);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < kThreads; ++i) {
+        threads.emplace_back([&] {
+            for (size_t j = 0; j < kClaims; ++j) {
+                size_t first = 0;
+                ASSERT_TRUE(batch_desc->task_list.claim(
+                    kCount, batch_desc->batch_size, first));
+                for (size_t k = first; k < first + kCount; ++k)
+                    owners[k].fetch_add(1);
+            }
+        });
+    }
+    for (auto &thread : threads) thread.join();
+    EXPECT_EQ(batch_desc->task_list.size(), batch_desc->batch_size);
+    for (auto &owner : owners) EXPECT_EQ(owner.load(), 1);
+    size_t first = 0;
+    EXPECT_FALSE(
+        batch_desc->task_list.claim(1, batch_desc->batch_size, first));
+
+    for (size_t i = 0; i < batch_desc->task_list.size(); ++i)
+        batch_desc->task_list[i].is_finished = true;
+    ASSERT_TRUE(transport.freeBatchID(batch_id).ok());
+}
+
+TEST_F(TransportTest, BatchStatusCounters) {
+    std::string server_name = "localhost";
+    MultiTransport transport(nullptr, server_name);
+    auto batch_id = transport.allocateBatchID(2);
+    auto batch_desc = Transport::getBatchDesc(batch_id);
+    ASSERT_NE(batch_desc, nullptr);
+    size_t first = 0;
+    ASSERT_TRUE(batch_desc->task_list.claim(2, 2, first));
+    for (size_t i = 0; i < 2; ++i) {
+        batch_desc->task_list[i].batch_id = batch_id;
+        batch_desc->task_list[i].slice_count = 1;
+    }
+    batch_desc->total_slices.fetch_add(2);
+
+    TransferStatus status;
+    ASSERT_TRUE(transport.getBatchTransferStatus(batch_id, status).ok());
+    EXPECT_EQ(status.s, Transport::TransferStatusEnum::WAITING);
+    batch_desc->task_list[0].finishSlice(true, 100);
+    ASSERT_TRUE(transport.getBatchTransferStatus(batch_id, status).ok());
+    EXPECT_EQ(status.s, Transport::TransferStatusEnum::WAITING);
+    EXPECT_EQ(status.transferred_bytes, 100u);
+    batch_desc->task_list[1].finishSlice(true, 28);
+    ASSERT_TRUE(transport.getBatchTransferStatus(batch_id, status).ok());
+    EXPECT_EQ(status.s, Transport::TransferStatusEnum::COMPLETED);
+    EXPECT_EQ(status.transferred_bytes, 128u);
+    // Done by the counters, without querying the tasks one by one
+    ASSERT_TRUE(transport.freeBatchID(batch_id).ok());
+
+    batch_id = transport.allocateBatchID(1);
+    batch_desc = Transport::getBatchDesc(batch_id);
+    ASSERT_TRUE(batch_desc->task_list.claim(1, 1, first));
+    batch_desc->task_list[0].batch_id = batch_id;
+    batch_desc->task_list[0].slice_count = 1;
+    batch_desc->total_slices.fetch_add(1);
+    batch_desc->task_list[0].finishSlice(false);
+    ASSERT_TRUE(transport.getBatchTransferStatus(batch_id, status).ok());
+    EXPECT_EQ(status.s, Transport::TransferStatusEnum::FAILED);
+    ASSERT_TRUE(transport.freeBatchID(batch_id).ok());
+}
+
+TEST_F(TransportTest, BatchDeadlineAndCancel) {
+    std::string server_name = "localhost";
+    MultiTransport transport(nullptr, server_name);
+    auto batch_id = transport.allocateBatchID(1);
+    auto batch_desc = Transport::getBatchDesc(batch_id);
+    ASSERT_NE(batch_desc, nullptr);
+    EXPECT_EQ(batch_desc->abortStatus(), Transport::WAITING);
+
+    int64_t now = getCurrentTimeInNano();
+    ASSERT_TRUE(Transport::setBatchDeadline(batch_id, now + 3600000000000ll)
+                    .ok());
+    EXPECT_EQ(batch_desc->abortStatus(), Transport::WAITING);
+    EXPECT_TRUE(Transport::hasAbortableBatches());
+    ASSERT_TRUE(Transport::setBatchDeadline(batch_id, now - 1).ok());
+    EXPECT_EQ(batch_desc->abortStatus(), Transport::TIMEOUT);
+    ASSERT_TRUE(Transport::cancelBatch(batch_id).ok());
+    EXPECT_EQ(batch_desc->abortStatus(), Transport::CANCELED);
+    ASSERT_TRUE(transport.freeBatchID(batch_id).ok());
+    EXPECT_FALSE(Transport::hasAbortableBatches());
+    EXPECT_FALSE(Transport::cancelBatch(batch_id).ok());
+
+    // The next batch of the slot starts afresh
+    auto next_batch_id = transport.allocateBatchID(1);
+    EXPECT_EQ(Transport::getBatchDesc(next_batch_id)->abortStatus(),
+              Transport::WAITING);
+    ASSERT_TRUE(transport.freeBatchID(next_batch_id).ok());
+}
+
+TEST_F(TransportTest, BatchNotifierReportsDoneBatches) {
+    std::string server_name = "localhost";
+    auto transport = std::make_shared<MultiTransport>(nullptr, server_name);
+    BatchNotifier notifier(transport);
+
+    // Canceled before any submission, done at once
+    auto batch_id = transport->allocateBatchID(1);
+    std::mutex mutex;
+    std::condition_variable cond;
+    int calls = 0;
+    Transport::TransferStatusEnum reported = Transport::WAITING;
+    ASSERT_TRUE(Transport::cancelBatch(batch_id).ok());
+    ASSERT_TRUE(notifier
+                    .setCallback(batch_id,
+                                 [&](Transport::BatchID id,
+                                     const Transport::TransferStatus &status) {
+                                     EXPECT_EQ(id, batch_id);
+                                     std::lock_guard<std::mutex> lock(mutex);
+                                     reported = status.s;
+                                     calls++;
+                                     cond.notify_all();
+                                 })
+                    .ok());
+    int fd = -1;
+    ASSERT_TRUE(notifier.getEventFd(batch_id, fd).ok());
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        ASSERT_TRUE(cond.wait_for(lock, std::chrono::seconds(5),
+                                  [&] { return calls > 0; }));
+    }
+    EXPECT_EQ(reported, Transport::CANCELED);
+    struct pollfd pfd = {fd, POLLIN, 0};
+    ASSERT_EQ(poll(&pfd, 1, 5000), 1);
+    uint64_t count = 0;
+    ASSERT_EQ(read(fd, &count, sizeof(count)), (ssize_t)sizeof(count));
+    EXPECT_GE(count, 1u);
+    // The same eventfd is handed out again
+    int again = -1;
+    ASSERT_TRUE(notifier.getEventFd(batch_id, again).ok());
+    EXPECT_EQ(again, fd);
+
+    notifier.forget(batch_id);
+    ASSERT_TRUE(transport->freeBatchID(batch_id).ok());
+    EXPECT_FALSE(notifier.getEventFd(batch_id, fd).ok());
+    EXPECT_FALSE(notifier.setCallback(batch_id, nullptr).ok());
+    std::lock_guard<std::mutex> lock(mutex);
+    EXPECT_EQ(calls, 1);
+}
+
+TEST_F(TransportTest, SlicesFlowBackThroughDepot) {
+    using SliceCache = Transport::ThreadLocalSliceCache;
+    const size_t kCount = 4 * SliceCache::kMagazineSize;
+    auto before = Transport::getSliceStats();
+    {
+        SliceCache allocator;
+        std::vector<Transport::Slice *> slices;
+        {
+            // Freed by another cache, as by the thread freeing the batch
+            SliceCache releaser;
+            for (size_t i = 0; i < kCount; ++i)
+                slices.push_back(allocator.allocate());
+            for (auto slice : slices) releaser.deallocate(slice);
+        }
+        size_t reused = 0;
+        for (auto &slice : slices) {
+            slice = allocator.allocate();
+            reused += slice->from_cache;
+        }
+        EXPECT_EQ(reused, kCount);
+        for (auto slice : slices) allocator.deallocate(slice);
+    }
+    auto after = Transport::getSliceStats();
+    EXPECT_GE(after.reused - before.reused, kCount);
+}
 }  // namespace mooncake
 
 int main(int argc, char** argv) {
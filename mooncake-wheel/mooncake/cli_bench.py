@@ -7,11 +7,29 @@ import os
 import sys
 import subprocess
 
+# Flags for common scenarios, selected by the first argument, e.g.
+#   transfer_engine_bench all_to_all --segment_id=node1,node2,node3 ...
+# Flags given after the preset take precedence over its own.
+PRESETS = {
+    # One request at a time, for the unloaded latency distribution
+    "latency": ["--mode=initiator", "--threads=1", "--batch_size=1"],
+    # Requests at a fixed rate whether or not earlier ones completed,
+    # for the latency under load
+    "open_loop": ["--mode=initiator", "--rate=100000", "--max_inflight=64"],
+    # Run on each initiator with the same --start_time and one target
+    "fan_in": ["--mode=initiator", "--pattern=one_to_one"],
+    # One initiator spreading each batch over several targets
+    "fan_out": ["--mode=initiator", "--pattern=all_to_all"],
+    # Run on every node with all of them in --segment_id
+    "all_to_all": ["--mode=peer", "--pattern=all_to_all"],
+}
+
 
 def main():
     """
     Main entry point for the transfer_engine_bench command.
-    Simply runs the transfer_engine_bench binary with all arguments passed through.
+    Runs the transfer_engine_bench binary with all arguments passed through,
+    after the flags of the preset named by the first argument if any.
     """
     # Get the path to the transfer_engine_bench binary
     package_dir = os.path.dirname(os.path.abspath(__file__))
@@ -19,9 +37,13 @@ def main():
     
     # Make sure the binary is executable
     os.chmod(bin_path, 0o755)
-    
+
+    args = sys.argv[1:]
+    if args and args[0] in PRESETS:
+        args = PRESETS[args[0]] + args[1:]
+
     # Run the binary with all arguments passed through
-    return subprocess.call([bin_path] + sys.argv[1:])
+    return subprocess.call([bin_path] + args)
 
 
 if __name__ == "__main__":
@@ -28,6 +28,11 @@ class KVPoll(Enum):
     Success = 4
 
 
+# Changes kept for watchers, older ones make them resynchronize
+MAX_CHANGES = 4096
+MAX_WATCH_TIMEOUT_MS = 30000
+
+
 class KVBootstrapServer:
     """HTTP server for storing and retrieving metadata."""
     
@@ -43,6 +48,11 @@ class KVBootstrapServer:
         self.app = web.Application()
         self.store = dict()
         self.lock = asyncio.Lock()
+        # (revision, key) of the latest changes, and an event set on the
+        # next one
+        self.revision = 0
+        self.changes = []
+        self.changed = None
         self._loop = None
         self._runner = None
         self.thread = None
@@ -58,6 +68,90 @@ class KVBootstrapServer:
     def _setup_routes(self):
         """Set up the HTTP routes."""
         self.app.router.add_route('*', '/metadata', self._handle_metadata)
+        self.app.router.add_get('/metadata/watch', self._handle_watch)
+        self.app.router.add_post('/metadata/batch_get',
+                                 self._handle_batch_get)
+        self.app.router.add_put('/metadata/batch', self._handle_batch_put)
+
+    def _record_change(self, key):
+        """Record a change of key, called with the lock held."""
+        self.revision += 1
+        self.changes.append((self.revision, key))
+        if len(self.changes) > MAX_CHANGES:
+            del self.changes[:len(self.changes) - MAX_CHANGES]
+        if self.changed is not None:
+            self.changed.set()
+            self.changed = None
+
+    async def _handle_watch(self, request: web.Request):
+        """Long poll for the keys under prefix changed after revision.
+
+        Answered once there are any or after timeout_ms. Revision 0 gets
+        the current revision right away.
+        """
+        prefix = request.query.get('prefix', '')
+        try:
+            revision = int(request.query.get('revision', '0'))
+            timeout_ms = int(request.query.get('timeout_ms',
+                                               MAX_WATCH_TIMEOUT_MS))
+        except ValueError:
+            return web.Response(text='invalid request', status=400,
+                                content_type='application/json')
+        if timeout_ms <= 0 or timeout_ms > MAX_WATCH_TIMEOUT_MS:
+            timeout_ms = MAX_WATCH_TIMEOUT_MS
+        deadline = asyncio.get_running_loop().time() + timeout_ms / 1000
+        while True:
+            async with self.lock:
+                reset = revision > self.revision or (
+                    self.changes and revision + 1 < self.changes[0][0])
+                keys = [] if reset else [
+                    key for rev, key in self.changes
+                    if rev > revision and key.startswith(prefix)
+                ]
+                current = self.revision
+                if self.changed is None:
+                    self.changed = asyncio.Event()
+                changed = self.changed
+            remaining = deadline - asyncio.get_running_loop().time()
+            if revision == 0 or reset or keys or remaining <= 0:
+                return web.json_response({'revision': current,
+                                          'reset': bool(reset),
+                                          'keys': keys})
+            try:
+                await asyncio.wait_for(changed.wait(), remaining)
+            except asyncio.TimeoutError:
+                pass
+
+    async def _handle_batch_get(self, request: web.Request):
+        """Values of the keys of {"keys": [...]} as {"values": {...}}.
+
+        Keys not found are left out.
+        """
+        try:
+            keys = (await request.json())['keys']
+        except (ValueError, KeyError, TypeError):
+            return web.Response(text='invalid request', status=400,
+                                content_type='application/json')
+        async with self.lock:
+            values = {key: self.store[key].decode('utf-8', 'replace')
+                      for key in keys if key in self.store}
+        return web.json_response({'values': values})
+
+    async def _handle_batch_put(self, request: web.Request):
+        """Set all the keys of {key: value} at once."""
+        try:
+            values = await request.json()
+            if not isinstance(values, dict):
+                raise ValueError
+        except ValueError:
+            return web.Response(text='invalid request', status=400,
+                                content_type='application/json')
+        async with self.lock:
+            for key, value in values.items():
+                self.store[key] = str(value).encode('utf-8')
+                self._record_change(key)
+        return web.Response(text='metadata updated', status=200,
+                            content_type='application/json')
 
     async def _handle_metadata(self, request: web.Request):
         """Handle metadata requests."""
@@ -87,6 +181,7 @@ class KVBootstrapServer:
         data = await request.read()
         async with self.lock:
             self.store[key] = data
+            self._record_change(key)
         return web.Response(text='metadata updated', status=200,
                           content_type='application/json')
 
@@ -97,6 +192,7 @@ class KVBootstrapServer:
                 return web.Response(text='metadata not found', status=404,
                                   content_type='application/json')
             del self.store[key]
+            self._record_change(key)
         return web.Response(text='metadata deleted', status=200,
                           content_type='application/json')
                           
@@ -349,6 +349,149 @@ class TestDistributedObjectStore(unittest.TestCase):
             self.assertEqual(self.store.remove(key), 0)
 
 
+    def test_iov_operations(self):
+        """Test put_from_iov and get_into_iov with misaligned buffers."""
+        import ctypes
+
+        # Buffers larger than a slice are split, and the gets take buffers
+        # laid out otherwise than the puts
+        slice_limit = 4 * 1024 * 1024
+        put_sizes = [slice_limit + 123, 1000, slice_limit - 1]
+        total = sum(put_sizes)
+        get_sizes = [777, slice_limit + 2 * 1000, total - slice_limit - 2777]
+        gap = 64
+        keys = [f"test_iov_key_{i}" for i in range(2)]
+        values = [os.urandom(total) for _ in keys]
+
+        region_size = 2 * (total + len(put_sizes) * gap)
+        region = (ctypes.c_ubyte * region_size)()
+        region_ptr = ctypes.addressof(region)
+        self.assertEqual(self.store.register_buffer(region_ptr, region_size), 0)
+
+        def scatter(base, sizes):
+            """Pointers of buffers of the given sizes, gap bytes apart."""
+            ptrs = []
+            for size in sizes:
+                ptrs.append(base)
+                base += size + gap
+            return ptrs
+
+        def gather(ptrs, sizes):
+            return b"".join(ctypes.string_at(ptr, size)
+                            for ptr, size in zip(ptrs, sizes))
+
+        src_ptrs = scatter(region_ptr, put_sizes)
+        offset = 0
+        for ptr, size in zip(src_ptrs, put_sizes):
+            ctypes.memmove(ptr, values[0][offset:offset + size], size)
+            offset += size
+        self.assertEqual(
+            self.store.put_from_iov(keys[0], src_ptrs, put_sizes), 0)
+        self.assertEqual(self.store.get(keys[0]), values[0])
+
+        dst_base = region_ptr + region_size // 2
+        ctypes.memset(dst_base, 0xff, region_size // 2)
+        dst_ptrs = scatter(dst_base, get_sizes)
+        self.assertEqual(self.store.get_into_iov(keys[0], dst_ptrs, get_sizes),
+                         total)
+        self.assertEqual(gather(dst_ptrs, get_sizes), values[0])
+        for ptr, size in zip(dst_ptrs, get_sizes):
+            self.assertEqual(ctypes.string_at(ptr + size, gap), b"\xff" * gap)
+
+        # Buffers must add up to the object size
+        short_sizes = get_sizes[:-1] + [get_sizes[-1] - 1]
+        self.assertLess(
+            self.store.get_into_iov(keys[0], dst_ptrs, short_sizes), 0)
+        self.assertLess(
+            self.store.get_into_iov(keys[0], dst_ptrs[:1], [total + 1]), 0)
+        # One size per buffer
+        self.assertLess(
+            self.store.get_into_iov(keys[0], dst_ptrs, get_sizes[:-1]), 0)
+
+        # Batch versions, the second key put with the layout of the gets
+        # and read with the layout of the puts
+        src_ptrs = scatter(region_ptr, get_sizes)
+        offset = 0
+        for ptr, size in zip(src_ptrs, get_sizes):
+            ctypes.memmove(ptr, values[1][offset:offset + size], size)
+            offset += size
+        self.assertEqual(self.store.batch_put_from_iov(
+            keys[1:], [src_ptrs], [get_sizes]), [0])
+        self.assertEqual(self.store.get(keys[1]), values[1])
+
+        ctypes.memset(dst_base, 0xff, region_size // 2)
+        dst_ptrs = scatter(dst_base, put_sizes)
+        results = self.store.batch_get_into_iov(
+            keys[1:] + ["test_iov_missing_key"],
+            [dst_ptrs, dst_ptrs], [put_sizes, put_sizes])
+        self.assertEqual(results[0], total)
+        self.assertLess(results[1], 0)
+        self.assertEqual(gather(dst_ptrs, put_sizes), values[1])
+
+        # One list of buffers per key, with a size per buffer
+        self.assertEqual(self.store.batch_get_into_iov(
+            keys[1:], [dst_ptrs], [put_sizes[:-1]]), [-1])
+
+        time.sleep(DEFAULT_KV_LEASE_TTL / 1000)
+        self.assertEqual(self.store.unregister_buffer(region_ptr), 0)
+        for key in keys:
+            self.assertEqual(self.store.remove(key), 0)
+
+    def test_layer_streams(self):
+        """Test put_layers_from and get_layers_into, layer by layer."""
+        import ctypes
+
+        num_layers = 4
+        keys_per_layer = 3
+        block_size = 4096
+        keys = [f"test_layer_stream_key_{l}_{b}"
+                for l in range(num_layers) for b in range(keys_per_layer)]
+        total_size = block_size * len(keys)
+
+        src = (ctypes.c_ubyte * total_size)()
+        dst = (ctypes.c_ubyte * total_size)()
+        src_ptr = ctypes.addressof(src)
+        dst_ptr = ctypes.addressof(dst)
+        self.assertEqual(self.store.register_buffer(src_ptr, total_size), 0)
+        self.assertEqual(self.store.register_buffer(dst_ptr, total_size), 0)
+        src_ptrs = [src_ptr + i * block_size for i in range(len(keys))]
+        dst_ptrs = [dst_ptr + i * block_size for i in range(len(keys))]
+        sizes = [block_size] * len(keys)
+
+        stream = self.store.put_layers_from(keys, src_ptrs, sizes, keys_per_layer)
+        self.assertEqual(stream.num_layers, num_layers)
+        expected = []
+        for layer in range(num_layers):
+            # The layer is "computed", then written
+            for b in range(keys_per_layer):
+                data = bytes([layer * keys_per_layer + b + 1]) * block_size
+                i = layer * keys_per_layer + b
+                ctypes.memmove(ctypes.c_void_p(src_ptrs[i]), data, block_size)
+                expected.append(data)
+            self.assertEqual(stream.submit_layer(layer), 0)
+        self.assertLess(stream.submit_layer(num_layers), 0)
+        self.assertEqual(stream.finish(), [0] * len(keys))
+
+        stream = self.store.get_layers_into(keys, dst_ptrs, sizes, keys_per_layer)
+        for layer in range(num_layers):
+            self.assertEqual(stream.wait_layer(layer),
+                             [block_size] * keys_per_layer)
+            for b in range(keys_per_layer):
+                i = layer * keys_per_layer + b
+                self.assertEqual(ctypes.string_at(dst_ptrs[i], block_size),
+                                 expected[i])
+        del stream
+
+        # Keys must be a whole number of layers
+        self.assertIsNone(self.store.put_layers_from(keys[:-1], src_ptrs[:-1],
+                                                     sizes[:-1], keys_per_layer))
+
+        time.sleep(DEFAULT_KV_LEASE_TTL / 1000)
+        self.assertEqual(self.store.unregister_buffer(src_ptr), 0)
+        self.assertEqual(self.store.unregister_buffer(dst_ptr), 0)
+        for key in keys:
+            self.assertEqual(self.store.remove(key), 0)
+
     def test_concurrent_stress_with_barrier(self):
         """Test concurrent Put/Get operations with multiple threads using barrier."""
         NUM_THREADS = 8
@@ -590,6 +733,63 @@ class TestDistributedObjectStore(unittest.TestCase):
             result = self.store.put(key=key, value=test_data, config_arg_name_error=config)
 
 
+    def test_put_with_codec(self):
+        """Test puts encoded with a payload codec, decoded on get."""
+        import ctypes
+        import struct
+        from mooncake.store import PayloadCodec, ReplicateConfig
+
+        # BF16 values, the high bytes take few values and compress
+        value = b"".join(struct.pack("<H", 0x3f00 | (i % 7) << 4)
+                         for i in range(64 * 1024))
+        config = ReplicateConfig()
+        config.codec = PayloadCodec.BYTE_PLANE
+        key = "test_put_codec_key"
+        self.assertEqual(self.store.put(key, value, config), 0)
+        # Stored encoded, smaller than the value
+        self.assertLess(self.store.get_size(key), len(value))
+        self.assertEqual(self.store.get(key), value)
+
+        buffer = (ctypes.c_ubyte * len(value))()
+        buffer_ptr = ctypes.addressof(buffer)
+        self.assertEqual(self.store.register_buffer(buffer_ptr, len(value)), 0)
+        self.assertEqual(self.store.get_into(key, buffer_ptr, len(value)),
+                         len(value))
+        self.assertEqual(ctypes.string_at(buffer_ptr, len(value)), value)
+        self.assertEqual(self.store.unregister_buffer(buffer_ptr), 0)
+
+        # Lossy, the size is kept and the stored object is about half
+        config.codec = PayloadCodec.FP8_FROM_BF16
+        lossy_key = "test_put_codec_lossy_key"
+        self.assertEqual(self.store.put(lossy_key, value, config), 0)
+        self.assertLess(self.store.get_size(lossy_key), len(value) * 6 // 10)
+        self.assertEqual(len(self.store.get(lossy_key)), len(value))
+
+        time.sleep(DEFAULT_KV_LEASE_TTL / 1000)
+        self.assertEqual(self.store.remove(key), 0)
+        self.assertEqual(self.store.remove(lossy_key), 0)
+
+    def test_put_with_content_hash(self):
+        """Test puts of equal content hashes sharing one stored copy."""
+        from mooncake.store import ReplicateConfig
+
+        value = os.urandom(64 * 1024)
+        config = ReplicateConfig()
+        config.content_hash = "test_content_hash_block"
+        keys = ["test_content_hash_tenant_a", "test_content_hash_tenant_b"]
+        for key in keys:
+            self.assertEqual(self.store.put(key, value, config), 0)
+        for key in keys:
+            self.assertEqual(self.store.get(key), value)
+
+        # The copy stays for the other alias
+        time.sleep(DEFAULT_KV_LEASE_TTL / 1000)
+        self.assertEqual(self.store.remove(keys[0]), 0)
+        self.assertEqual(self.store.is_exist(keys[0]), 0)
+        self.assertEqual(self.store.get(keys[1]), value)
+        time.sleep(DEFAULT_KV_LEASE_TTL / 1000)
+        self.assertEqual(self.store.remove(keys[1]), 0)
+
     def test_put_batch_with_config_parameter(self):
         """Test put_batch method with config parameter."""
         from mooncake.store import ReplicateConfig
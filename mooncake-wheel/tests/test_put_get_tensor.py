@@ -112,6 +112,43 @@ class TestDistributedObjectStore(unittest.TestCase):
         self.store.remove(key_int)
         self.store.remove(key_bool)
         self.store.remove(key_rand)
-             
+
+    def test_registered_tensor_zero_copy(self):
+        """Test put/get straight through the storage of registered tensors."""
+        import torch
+
+        num_layers = 4
+        layer_shape = (16, 1024)
+        # One registered buffer holding all layers
+        src = torch.rand((num_layers,) + layer_shape, dtype=torch.float32)
+        dst = torch.zeros_like(src)
+        for buffer in (src, dst):
+            nbytes = buffer.numel() * buffer.element_size()
+            self.assertEqual(
+                self.store.register_buffer(buffer.data_ptr(), nbytes), 0)
+
+        keys = [f"test_layer_{i}" for i in range(num_layers)]
+        results = self.store.batch_put_tensor(keys, list(src))
+        self.assertEqual(results, [0] * num_layers)
+        layer_bytes = src[0].numel() * src[0].element_size()
+        results = self.store.batch_get_tensor_into(keys, list(dst))
+        self.assertEqual(results, [layer_bytes] * num_layers)
+        self.assertTrue(torch.equal(src, dst))
+
+        # Single tensor variants, and an unregistered target
+        self.assertEqual(self.store.put_tensor("test_layer_single", src[1]), 0)
+        target = torch.zeros(layer_shape, dtype=torch.float32)
+        self.assertEqual(
+            self.store.get_tensor_into("test_layer_single", target), layer_bytes)
+        self.assertTrue(torch.equal(src[1], target))
+
+        # Non-contiguous tensors are rejected
+        self.assertLess(self.store.put_tensor("test_layer_t", src[0].t()), 0)
+
+        for buffer in (src, dst):
+            self.assertEqual(self.store.unregister_buffer(buffer.data_ptr()), 0)
+        for key in keys + ["test_layer_single"]:
+            self.store.remove(key)
+
 if __name__ == '__main__':
     unittest.main()
\ No newline at end of file
@@ -131,6 +131,56 @@ class TestVLLMAdaptorTransfer(unittest.TestCase):
 
         print(f"[✓] {circles} rounds of batch_write_read passed, batch size {batch_size}.")
 
+    def test_batch_write_read_arrays(self):
+        """Test batch transfers with numpy descriptor arrays and per-request statuses."""
+        try:
+            import numpy as np
+        except ImportError:
+            self.skipTest("numpy is not installed")
+
+        adaptor = self.adaptor
+        batch_size = 1000
+        block_size = 64
+
+        base_src_addr = adaptor.get_first_buffer_address(self.initiator_server_name)
+        base_dst_addr = adaptor.get_first_buffer_address(self.target_server_name)
+        offsets = np.arange(batch_size, dtype=np.int64) * block_size
+        src_addrs = base_src_addr + offsets
+        dst_addrs = base_dst_addr + offsets
+        lengths = np.full(batch_size, block_size, dtype=np.int64)
+
+        src_data = os.urandom(batch_size * block_size)
+        result = adaptor.write_bytes_to_buffer(base_src_addr, src_data, len(src_data))
+        self.assertEqual(result, 0, "writeBytesToBuffer failed")
+
+        result = adaptor.batch_transfer_sync_write(
+            self.target_server_name, src_addrs, dst_addrs, lengths
+        )
+        self.assertEqual(result, 0, "batch_transfer_sync_write with arrays failed")
+
+        clear_data = bytes(len(src_data))
+        result = adaptor.write_bytes_to_buffer(base_src_addr, clear_data, len(clear_data))
+        self.assertEqual(result, 0, "Clear buffer failed")
+
+        statuses = adaptor.batch_transfer_sync_status(
+            self.target_server_name, src_addrs, dst_addrs, lengths,
+            TransferEngine.TransferOpcode.Read
+        )
+        self.assertEqual(statuses.shape, (batch_size,))
+        self.assertTrue(
+            (statuses == int(TransferEngine.TransferStatus.Completed)).all(),
+            "batch_transfer_sync_status reported failed requests")
+
+        read_back = adaptor.read_bytes_from_buffer(base_src_addr, len(src_data))
+        self.assertEqual(read_back, src_data, "Data mismatch in array batch read")
+
+        with self.assertRaises(RuntimeError):
+            adaptor.batch_transfer_sync_write(
+                self.target_server_name, src_addrs, dst_addrs, lengths[:-1]
+            )
+
+        print(f"[✓] batch_write_read_arrays passed, batch size {batch_size}.")
+
     def test_async_batch_write_read(self):
         """Test batch_transfer_async_write and batch_transfer_async_read for batch write/read consistency."""
         import random, string